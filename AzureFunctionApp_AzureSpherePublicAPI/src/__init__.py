@@ -1,4 +1,6 @@
 import logging
+import threading
+import time
 import requests
 import json
 from azure.identity import DefaultAzureCredential
@@ -7,19 +9,48 @@ from requests.structures import CaseInsensitiveDict
 import azure.functions as func
 AzureSphereApiUri = "https://prod.core.sphere.azure.net"
 
+# The worker process keeps these between invocations, so a burst of triggers shares one
+# token, one connection pool and the cached responses, rather than throttling the Public API.
+TokenRefreshMargin = 300        # seconds before expiry that the token is renewed
+ResponseTimeToLive = 300        # seconds that tenant and device group metadata is reused
+
+default_credential = None
+cached_token = None
+cached_responses = {}           # relativeUrl -> (expiry time, response content)
+cache_lock = threading.Lock()
+token_lock = threading.Lock()
+session = requests.Session()
+
+def GetAS3Token():
+    global default_credential, cached_token
+    with token_lock:
+        if cached_token and cached_token.expires_on - TokenRefreshMargin > time.time():
+            return cached_token.token
+
+        scope="https://firstparty.sphere.azure.net/api/.default"
+        if not default_credential:
+            default_credential = DefaultAzureCredential(managed_identity_client_id="YOUR_FUNCTION_APP_SYSTEM_ASSIGNED_MANAGED_IDENTITY")
+            logging.info('Have default_credential')
+        token=default_credential.get_token(scope)
+        if (not token):
+            logging.info("Didn't get a token")
+            return None
+
+        cached_token=token
+        logging.info('Have a token...')
+        return token.token
+
 def GetAS3SData(relativeUrl):
     logging.info('Getting AS3 data')
-    scope="https://firstparty.sphere.azure.net/api/.default" 
-    default_credential = DefaultAzureCredential(managed_identity_client_id="YOUR_FUNCTION_APP_SYSTEM_ASSIGNED_MANAGED_IDENTITY")
-    logging.info('Have default_credential')
-    token=default_credential.get_token(scope)
-    if (not token):
-        logging.info("Didn't get a token")
-        return b'[]'
+    with cache_lock:
+        cached = cached_responses.get(relativeUrl)
+        if cached and cached[0] > time.time():
+            logging.info('Using cached response')
+            return cached[1]
 
-    AS3Token=token.token
-    logging.info('Have a token...')
-    logging.info(AS3Token)
+    AS3Token=GetAS3Token()
+    if (not AS3Token):
+        return b'[]'
 
     url=AzureSphereApiUri+f'/v2/{relativeUrl}'
     headers = CaseInsensitiveDict()
@@ -30,11 +61,18 @@ def GetAS3SData(relativeUrl):
 
     resp=b''
     try:
-        resp = requests.get(url, headers=headers)
-    except: 
+        resp = session.get(url, headers=headers)
+    except:
         logging.info('AS3 call failed :(')
         return b'[]'
 
+    if resp.status_code != 200:
+        logging.info(f'AS3 call returned {resp.status_code}')
+        return b'[]'
+
+    with cache_lock:
+        cached_responses[relativeUrl] = (time.time() + ResponseTimeToLive, resp.content)
+
     return resp.content
 
 def main(req: func.HttpRequest) -> func.HttpResponse:
@@ -31,6 +31,8 @@ static int DeviceMethodCallback(const char *methodName, const unsigned char *pay
 static void ConnectionCallbackHandler(Connection_Status status,
                                       IOTHUB_DEVICE_CLIENT_LL_HANDLE clientHandle);
 static bool IsConnectionReadyToSendTelemetry(void);
+static void ScheduleDoWork(int delayMilliseconds);
+static void KickDoWork(void);
 
 /// <summary>
 /// Authentication state of the client with respect to the Azure IoT Hub.
@@ -53,10 +55,14 @@ static const int AzureIoTDefaultConnectPeriodSeconds =
     1; // check if device is connected to the internet and Azure client is setup every second
 static const int AzureIoTMinReconnectPeriodSeconds = 10;      // back off when reconnecting
 static const int AzureIoTMaxReconnectPeriodSeconds = 10 * 60; // back off limit
-static const int AzureIoTDoWorkIntervalMilliseconds =
-    100; // Call IoTHubDeviceClient_LL_DoWork() every 100 ms
+static const int AzureIoTDoWorkMinIntervalMilliseconds =
+    100; // Call IoTHubDeviceClient_LL_DoWork() every 100 ms while work is pending
+static const int AzureIoTDoWorkMaxIntervalMilliseconds =
+    2000; // back off limit when idle
 static const int NanosecondsPerMillisecond = 1000000;
 static int azureIoTConnectPeriodSeconds = -1;
+static int azureIoTDoWorkIntervalMilliseconds = -1;
+static int pendingAcks = 0; // telemetry and reported state not yet acknowledged
 static EventLoopTimer *azureIoTConnectionTimer = NULL;
 static EventLoopTimer *azureIoTDoWorkTimer = NULL;
 
@@ -92,15 +98,14 @@ ExitCode AzureIoT_Initialize(EventLoop *eventLoop, ExitCode_CallbackType failure
         return ExitCode_Init_AzureIoTConnectionTimer;
     }
 
-    int azureIoTDoWorkIntervalNanoseconds =
-        AzureIoTDoWorkIntervalMilliseconds * NanosecondsPerMillisecond;
-    struct timespec azureIoTDoWorkPollPeriod = {.tv_sec = 0,
-                                                .tv_nsec = azureIoTDoWorkIntervalNanoseconds};
-    azureIoTDoWorkTimer = CreateEventLoopPeriodicTimer(eventLoop, &AzureIoTDoWorkTimerEventHandler,
-                                                       &azureIoTDoWorkPollPeriod);
+    // One shot, each run rearms it with an interval depending on pending work
+    azureIoTDoWorkTimer =
+        CreateEventLoopDisarmedTimer(eventLoop, &AzureIoTDoWorkTimerEventHandler);
     if (azureIoTDoWorkTimer == NULL) {
         return ExitCode_Init_AzureIoTDoWorkTimer;
     }
+    azureIoTDoWorkIntervalMilliseconds = AzureIoTDoWorkMinIntervalMilliseconds;
+    ScheduleDoWork(azureIoTDoWorkIntervalMilliseconds);
 
     return ExitCode_Success;
 }
@@ -151,6 +156,9 @@ static void ConnectionCallbackHandler(Connection_Status status,
                                                       NULL);
         IoTHubDeviceClient_LL_SetConnectionStatusCallback(iothubClientHandle,
                                                           ConnectionStatusCallback, NULL);
+
+        // Authentication is driven by DoWork
+        KickDoWork();
         break;
     }
 
@@ -216,6 +224,45 @@ static void AzureIoTDoWorkTimerEventHandler(EventLoopTimer *timer)
     if (iothubClientHandle != NULL) {
         IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
     }
+
+    // Tick fast while sends, acks or authentication are outstanding, otherwise back off
+    bool workPending =
+        iothubClientHandle != NULL &&
+        (pendingAcks > 0 ||
+         iotHubClientAuthenticationState == IoTHubClientAuthenticationState_AuthenticationInitiated);
+    if (workPending) {
+        azureIoTDoWorkIntervalMilliseconds = AzureIoTDoWorkMinIntervalMilliseconds;
+    } else {
+        azureIoTDoWorkIntervalMilliseconds *= 2;
+        if (azureIoTDoWorkIntervalMilliseconds > AzureIoTDoWorkMaxIntervalMilliseconds) {
+            azureIoTDoWorkIntervalMilliseconds = AzureIoTDoWorkMaxIntervalMilliseconds;
+        }
+    }
+    ScheduleDoWork(azureIoTDoWorkIntervalMilliseconds);
+}
+
+/// <summary>
+///     Arms azureIoTDoWorkTimer to fire once after the given delay.
+/// </summary>
+static void ScheduleDoWork(int delayMilliseconds)
+{
+    struct timespec delay = {.tv_sec = delayMilliseconds / 1000,
+                             .tv_nsec = (delayMilliseconds % 1000) * NanosecondsPerMillisecond};
+    // A zero timespec would disarm the timer
+    if (delayMilliseconds == 0) {
+        delay.tv_nsec = 1;
+    }
+    SetEventLoopTimerOneShot(azureIoTDoWorkTimer, &delay);
+}
+
+/// <summary>
+///     Runs IoTHubDeviceClient_LL_DoWork() on the next event loop iteration, so work just
+///     handed to the client is sent without waiting for the current interval.
+/// </summary>
+static void KickDoWork(void)
+{
+    azureIoTDoWorkIntervalMilliseconds = AzureIoTDoWorkMinIntervalMilliseconds;
+    ScheduleDoWork(0);
 }
 
 /// <summary>
@@ -228,6 +275,7 @@ static void SetUpAzureIoTHubClient(void)
     if (iothubClientHandle != NULL) {
         IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
         iothubClientHandle = NULL;
+        pendingAcks = 0;
     }
 
     if (connectionStatus == Connection_NotStarted || connectionStatus == Connection_Failed) {
@@ -289,10 +337,11 @@ static void DeviceTwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsig
     }
 }
 
-AzureIoT_Result AzureIoT_SendTelemetryWithProperties(const char *jsonMessage, void *context, MESSAGE_PROPERTY** messageProperties, size_t messagePropertyCount)
+/// <summary>
+///     Check that telemetry can be sent: the device is online and the client is authenticated.
+/// </summary>
+static AzureIoT_Result CheckReadyToSendTelemetry(void)
 {
-    Log_Debug("Sending Azure IoT Hub telemetry: %s. (%d properties)\n", jsonMessage, messagePropertyCount);
-
     // Check whether the device is connected to the internet.
     if (IsConnectionReadyToSendTelemetry() == false) {
         return AzureIoT_Result_NoNetwork;
@@ -304,6 +353,41 @@ AzureIoT_Result AzureIoT_SendTelemetryWithProperties(const char *jsonMessage, vo
         return AzureIoT_Result_OtherFailure;
     }
 
+    return AzureIoT_Result_OK;
+}
+
+/// <summary>
+///     Hand a message to the IoT Hub client, which keeps its own copy, and destroy it.
+/// </summary>
+static AzureIoT_Result SendTelemetryMessage(IOTHUB_MESSAGE_HANDLE messageHandle, void *context)
+{
+    AzureIoT_Result result = AzureIoT_Result_OK;
+
+    if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendEventCallback,
+                                             context) != IOTHUB_CLIENT_OK) {
+        Log_Debug("ERROR: failure requesting IoTHubClient to send telemetry event.\n");
+        result = AzureIoT_Result_OtherFailure;
+    } else {
+        Log_Debug("INFO: IoTHubClient accepted the telemetry event for delivery.\n");
+        pendingAcks++;
+        KickDoWork();
+    }
+
+    IoTHubMessage_Destroy(messageHandle);
+    return result;
+}
+
+AzureIoT_Result AzureIoT_SendTelemetryWithProperties(const char *jsonMessage, void *context, MESSAGE_PROPERTY** messageProperties, size_t messagePropertyCount)
+{
+#ifndef NDEBUG
+    Log_Debug("Sending Azure IoT Hub telemetry: %s. (%d properties)\n", jsonMessage, messagePropertyCount);
+#endif
+
+    AzureIoT_Result result = CheckReadyToSendTelemetry();
+    if (result != AzureIoT_Result_OK) {
+        return result;
+    }
+
     IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromString(jsonMessage);
 
     if (messageHandle == 0) {
@@ -323,18 +407,44 @@ AzureIoT_Result AzureIoT_SendTelemetryWithProperties(const char *jsonMessage, vo
 		}
 	}
 
-    AzureIoT_Result result = AzureIoT_Result_OK;
+    return SendTelemetryMessage(messageHandle, context);
+}
 
-    if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendEventCallback,
-                                             context) != IOTHUB_CLIENT_OK) {
-        Log_Debug("ERROR: failure requesting IoTHubClient to send telemetry event.\n");
-        result = AzureIoT_Result_OtherFailure;
-    } else {
-        Log_Debug("INFO: IoTHubClient accepted the telemetry event for delivery.\n");
+AzureIoT_Result AzureIoT_SendTelemetryFromTemplate(const AzureIoT_MessageTemplate *messageTemplate,
+                                                   const char *jsonMessage, size_t jsonMessageLength,
+                                                   void *context)
+{
+#ifndef NDEBUG
+    Log_Debug("Sending Azure IoT Hub telemetry: %.*s\n", (int)jsonMessageLength, jsonMessage);
+#endif
+
+    AzureIoT_Result result = CheckReadyToSendTelemetry();
+    if (result != AzureIoT_Result_OK) {
+        return result;
     }
 
-    IoTHubMessage_Destroy(messageHandle);
-    return result;
+    IOTHUB_MESSAGE_HANDLE messageHandle =
+        IoTHubMessage_CreateFromByteArray((const unsigned char *)jsonMessage, jsonMessageLength);
+
+    if (messageHandle == 0) {
+        Log_Debug("ERROR: unable to create a new IoTHubMessage.\n");
+        return AzureIoT_Result_OtherFailure;
+    }
+
+    if (messageTemplate->contentType != NULL) {
+        IoTHubMessage_SetContentTypeSystemProperty(messageHandle, messageTemplate->contentType);
+    }
+    if (messageTemplate->contentEncoding != NULL) {
+        IoTHubMessage_SetContentEncodingSystemProperty(messageHandle, messageTemplate->contentEncoding);
+    }
+
+    // the template's properties were checked when it was defined, see AzureIoT_MessageTemplate
+    for (size_t i = 0; i < messageTemplate->propertyCount; i++) {
+        IoTHubMessage_SetProperty(messageHandle, messageTemplate->properties[i]->key,
+                                  messageTemplate->properties[i]->value);
+    }
+
+    return SendTelemetryMessage(messageHandle, context);
 }
 
 AzureIoT_Result AzureIoT_SendTelemetry(const char *jsonMessage, void *context)
@@ -349,6 +459,10 @@ static void SendEventCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *co
 {
     Log_Debug("INFO: Azure IoT Hub send telemetry event callback: status code %d.\n", result);
 
+    if (pendingAcks > 0) {
+        pendingAcks--;
+    }
+
     if (callbacks.sendTelemetryCallbackFunction != NULL) {
         callbacks.sendTelemetryCallbackFunction(result == IOTHUB_CLIENT_CONFIRMATION_OK, context);
     }
@@ -378,6 +492,8 @@ AzureIoT_Result AzureIoT_DeviceTwinReportState(const char *jsonState, void *cont
     }
 
     Log_Debug("INFO: Azure IoT Hub client accepted request to report state '%s'.\n", jsonState);
+    pendingAcks++;
+    KickDoWork();
     return AzureIoT_Result_OK;
 }
 
@@ -389,6 +505,10 @@ static void ReportedStateCallback(int result, void *context)
 {
     Log_Debug("INFO: Azure IoT Hub Device Twin reported state callback: status code %d.\n", result);
 
+    if (pendingAcks > 0) {
+        pendingAcks--;
+    }
+
     if (callbacks.deviceTwinReportStateAckCallbackTypeFunction != NULL) {
         callbacks.deviceTwinReportStateAckCallbackTypeFunction(result != 0, context);
     }
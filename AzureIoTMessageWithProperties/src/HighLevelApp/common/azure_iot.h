@@ -138,6 +138,35 @@ typedef struct MESSAGE_PROPERTY
 
 AzureIoT_Result AzureIoT_SendTelemetryWithProperties(const char *jsonMessage, void *context, MESSAGE_PROPERTY** messageProperties, size_t messagePropertyCount);
 
+/// <summary>
+///     A template for telemetry messages that all carry the same properties, defined once.
+///     Every property must have a non-NULL key and value; a value may be changed in place
+///     between sends (e.g. a sequence number held in a buffer the property points to).
+/// </summary>
+typedef struct {
+    /// <summary>Content type system property, e.g. "application/json", or NULL</summary>
+    const char *contentType;
+    /// <summary>Content encoding system property, e.g. "utf-8", or NULL</summary>
+    const char *contentEncoding;
+    /// <summary>Application properties, e.g. routing keys</summary>
+    MESSAGE_PROPERTY **properties;
+    size_t propertyCount;
+} AzureIoT_MessageTemplate;
+
+/// <summary>
+///     Enqueue telemetry with the properties of a message template, as
+///     <see cref="AzureIoT_SendTelemetryWithProperties" />. The message isn't logged in release
+///     (NDEBUG) builds.
+/// </summary>
+/// <param name="messageTemplate">The properties to send the telemetry with.</param>
+/// <param name="jsonMessage">The telemetry to send, as JSON.</param>
+/// <param name="jsonMessageLength">The length of jsonMessage, which needn't be NULL-terminated.</param>
+/// <param name="context">An optional context, which will be passed to the callback.</param>
+/// <returns>An <see cref="AzureIoT_Result" /> indicating success or failure.</returns>
+AzureIoT_Result AzureIoT_SendTelemetryFromTemplate(const AzureIoT_MessageTemplate *messageTemplate,
+                                                   const char *jsonMessage, size_t jsonMessageLength,
+                                                   void *context);
+
 /// <summary>
 ///     Enqueue a report containing Device Twin properties to send to the Azure IoT Hub. The report
 ///     is not sent immediately; the function will return immediately, and then call the
@@ -28,6 +28,15 @@ static MESSAGE_PROPERTY* telemetryMessageProperties[] = {
     &(MESSAGE_PROPERTY) {.key = "version", .value = "1" }
 };
 
+// The telemetry properties never change, so they're defined once. The content type and encoding
+// also let IoT Hub message routing query the JSON body.
+static const AzureIoT_MessageTemplate telemetryMessageTemplate = {
+    .contentType = "application/json",
+    .contentEncoding = "utf-8",
+    .properties = telemetryMessageProperties,
+    .propertyCount = NELEMS(telemetryMessageProperties)
+};
+
 // Azure IoT Hub callback handlers
 static void DeviceTwinCallbackHandler(const char *nullTerminatedJsonString);
 static int DeviceMethodCallbackHandler(const char *methodName, const unsigned char *payload,
@@ -111,7 +120,7 @@ Cloud_Result Cloud_SendTelemetry(const Cloud_Telemetry *telemetry)
     json_object_dotset_number(telemetryRoot, "temperature", telemetry->temperature);
     char *serializedTelemetry = json_serialize_to_string(telemetryValue);
 
-    AzureIoT_Result aziotResult = AzureIoT_SendTelemetryWithProperties(serializedTelemetry, NULL, telemetryMessageProperties , NELEMS(telemetryMessageProperties));
+    AzureIoT_Result aziotResult = AzureIoT_SendTelemetryFromTemplate(&telemetryMessageTemplate, serializedTelemetry, strlen(serializedTelemetry), NULL);
 
     Cloud_Result result = AzureIoTToCloudResult(aziotResult);
 
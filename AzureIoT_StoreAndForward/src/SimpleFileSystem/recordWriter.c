@@ -0,0 +1,194 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "recordWriter.h"
+#include "sfs.h"
+
+static pthread_t writerThread;
+static bool running = false;
+
+// guards the ring and the writer's state
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queuedCondition = PTHREAD_COND_INITIALIZER;     // records queued, or stopping
+static pthread_cond_t committedCondition = PTHREAD_COND_INITIALIZER;  // the writer finished a batch
+
+// held by whichever thread is in SimpleFs
+static pthread_mutex_t fsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static char directory[9];
+static size_t recordSize = 0;
+
+static uint8_t *ring = NULL;    // RECORD_WRITER_QUEUE_SIZE records
+static uint8_t *batch = NULL;   // the records being committed, oldest first
+static size_t head = 0;         // where the next record is queued
+static size_t queued = 0;
+static bool writing = false;
+static bool stopping = false;
+static bool failed = false;
+
+static void *WriterThread(void *arg)
+{
+    pthread_mutex_lock(&queueLock);
+    for (;;) {
+        while ((queued == 0) && !stopping) {
+            pthread_cond_wait(&queuedCondition, &queueLock);
+        }
+        if (queued == 0) {
+            // stopping, and everything has been committed
+            break;
+        }
+
+        // take everything queued, so records arriving during a slow write go in the next batch
+        size_t count = queued;
+        size_t tail = (head + RECORD_WRITER_QUEUE_SIZE - queued) % RECORD_WRITER_QUEUE_SIZE;
+        for (size_t i = 0; i < count; i++) {
+            memcpy(&batch[i * recordSize],
+                   &ring[((tail + i) % RECORD_WRITER_QUEUE_SIZE) * recordSize], recordSize);
+        }
+        queued = 0;
+        writing = true;
+        pthread_mutex_unlock(&queueLock);
+
+        pthread_mutex_lock(&fsLock);
+        int result = FS_AppendRecords(directory, batch, recordSize, count);
+        int numFiles = FS_GetNumberOfFilesInDirectory(directory);
+        pthread_mutex_unlock(&fsLock);
+
+        if (result != 0) {
+            Log_Debug("ERROR: Could not store %zu telemetry item%s\n", count, count == 1 ? "" : "s");
+        } else {
+            Log_Debug("%zu telemetry item%sstored (%d file%sin storage)\n", count,
+                      count == 1 ? " " : "s ", numFiles, numFiles == 1 ? " " : "s ");
+        }
+
+        pthread_mutex_lock(&queueLock);
+        writing = false;
+        failed = failed || (result != 0);
+        pthread_cond_broadcast(&committedCondition);
+    }
+    pthread_mutex_unlock(&queueLock);
+
+    return NULL;
+}
+
+int RecordWriter_Start(const char *dirName, size_t size)
+{
+    if (running || (size == 0)) {
+        return -1;
+    }
+
+    strncpy(directory, dirName, sizeof(directory) - 1);
+    directory[sizeof(directory) - 1] = '\0';
+    recordSize = size;
+
+    ring = malloc(RECORD_WRITER_QUEUE_SIZE * recordSize);
+    batch = malloc(RECORD_WRITER_QUEUE_SIZE * recordSize);
+    if ((ring == NULL) || (batch == NULL)) {
+        free(ring);
+        free(batch);
+        ring = batch = NULL;
+        return -1;
+    }
+
+    head = 0;
+    queued = 0;
+    writing = false;
+    stopping = false;
+    failed = false;
+
+    if (pthread_create(&writerThread, NULL, WriterThread, NULL) != 0) {
+        Log_Debug("ERROR: Could not start the storage writer thread\n");
+        free(ring);
+        free(batch);
+        ring = batch = NULL;
+        return -1;
+    }
+
+    running = true;
+    return 0;
+}
+
+void RecordWriter_Stop(void)
+{
+    if (!running) {
+        return;
+    }
+
+    pthread_mutex_lock(&queueLock);
+    stopping = true;
+    pthread_cond_signal(&queuedCondition);
+    pthread_mutex_unlock(&queueLock);
+
+    // the writer commits what's left in the ring before it exits
+    pthread_join(writerThread, NULL);
+    running = false;
+
+    free(ring);
+    free(batch);
+    ring = batch = NULL;
+}
+
+bool RecordWriter_Queue(const void *record)
+{
+    bool accepted = false;
+
+    pthread_mutex_lock(&queueLock);
+    if (running && !stopping && (queued < RECORD_WRITER_QUEUE_SIZE)) {
+        memcpy(&ring[head * recordSize], record, recordSize);
+        head = (head + 1) % RECORD_WRITER_QUEUE_SIZE;
+        queued++;
+        accepted = true;
+        pthread_cond_signal(&queuedCondition);
+    }
+    pthread_mutex_unlock(&queueLock);
+
+    return accepted;
+}
+
+int RecordWriter_Flush(void)
+{
+    pthread_mutex_lock(&queueLock);
+    while (running && ((queued > 0) || writing)) {
+        pthread_cond_wait(&committedCondition, &queueLock);
+    }
+    int result = failed ? -1 : 0;
+    failed = false;
+    pthread_mutex_unlock(&queueLock);
+
+    return result;
+}
+
+int RecordWriter_Read(void *records, size_t maxCount)
+{
+    pthread_mutex_lock(&fsLock);
+    int result = FS_ReadRecords(directory, records, recordSize, maxCount);
+    pthread_mutex_unlock(&fsLock);
+
+    return result;
+}
+
+int RecordWriter_Consume(size_t count)
+{
+    pthread_mutex_lock(&fsLock);
+    int result = FS_ConsumeRecords(directory, count);
+    pthread_mutex_unlock(&fsLock);
+
+    return result;
+}
+
+void RecordWriter_Lock(void)
+{
+    pthread_mutex_lock(&fsLock);
+}
+
+void RecordWriter_Unlock(void)
+{
+    pthread_mutex_unlock(&fsLock);
+}
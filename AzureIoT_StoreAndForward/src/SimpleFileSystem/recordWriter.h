@@ -0,0 +1,55 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Appends fixed size records to a SimpleFs directory on a writer thread, so the event loop
+// doesn't wait on the block device.
+//
+// RecordWriter_Queue copies a record into a ring and returns straight away; the writer thread
+// takes everything queued since its last pass and commits it with a single FS_AppendRecords.
+// SimpleFs isn't thread safe, so while the writer runs every other SimpleFs call must go
+// through RecordWriter_Lock/RecordWriter_Unlock (RecordWriter_Read and RecordWriter_Consume
+// do). RecordWriter_Flush is the barrier for records still in the ring, RecordWriter_Stop
+// flushes before the thread exits.
+
+// Most records waiting for the writer, a record queued while the ring is full is dropped.
+#define RECORD_WRITER_QUEUE_SIZE 64
+
+/// <summary>
+///     Starts the writer thread for records of recordSize bytes appended to dirName, which must
+///     already exist. Returns 0 on success, -1 on failure.
+/// </summary>
+int RecordWriter_Start(const char *dirName, size_t recordSize);
+
+/// <summary>
+///     Flushes the queued records, then stops the writer thread.
+/// </summary>
+void RecordWriter_Stop(void);
+
+/// <summary>
+///     Queues a copy of a record, returns false if the ring is full and the record was dropped.
+/// </summary>
+bool RecordWriter_Queue(const void *record);
+
+/// <summary>
+///     Waits until every record queued so far is committed. Returns 0, or -1 if a write has
+///     failed since the last flush.
+/// </summary>
+int RecordWriter_Flush(void);
+
+/// <summary>
+///     FS_ReadRecords and FS_ConsumeRecords on the directory, serialized with the writer. Records
+///     still queued aren't seen until they're committed.
+/// </summary>
+int RecordWriter_Read(void *records, size_t maxCount);
+int RecordWriter_Consume(size_t count);
+
+/// <summary>
+///     Holds the writer off SimpleFs around any other SimpleFs call.
+/// </summary>
+void RecordWriter_Lock(void);
+void RecordWriter_Unlock(void);
@@ -56,7 +56,8 @@ typedef enum {
     ExitCode_Init_AzureIoTDoWorkTimer = 30,
     ExitCode_AzureIoTDoWorkTimer_Consume = 31,
 
-    Exit_Code_Init_FileSystem = 32
+    Exit_Code_Init_FileSystem = 32,
+    ExitCode_Init_RecordWriter = 33
 } ExitCode;
 
 /// <summary>
@@ -81,6 +81,7 @@ static const char *serialNumber = "TEMPMON-01234";
 // Simple File System
 #include "sfs.h"
 #include "remoteDiskIO.h"
+#include "recordWriter.h"
 
 #define BLOCK_SIZE     512
 #define TOTAL_BLOCKS   8192
@@ -91,7 +92,17 @@ typedef struct
     time_t timestamp;
 } FileData;
 
-FileData fileData;
+// Stored telemetry is drained in bursts, one per timer tick. The burst doubles while every item
+// in it is sent and halves when a send fails, so a long backlog drains quickly over a good
+// connection without flooding a poor one.
+#define DRAIN_BURST_MIN 1
+#define DRAIN_BURST_MAX 64
+
+static FileData drainBuffer[DRAIN_BURST_MAX];
+static int drainBurst = DRAIN_BURST_MIN;
+
+static void StoreTelemetry(float temperature, time_t timestamp);
+static void DrainStoredTelemetry(void);
 
 static int ReadBlock(uint32_t block, uint8_t* buffer, size_t size);
 static int WriteBlock(uint32_t block, uint8_t* buffer, size_t size);
@@ -237,6 +248,9 @@ static void ConnectionChangedCallbackHandler(bool connected)
 {
     isConnected = connected;
 
+    // nothing is known about a new connection yet, start draining slowly
+    drainBurst = DRAIN_BURST_MIN;
+
     if (isConnected) {
         Cloud_Result result = Cloud_SendDeviceDetails(serialNumber);
         if (result != Cloud_Result_OK) {
@@ -246,6 +260,56 @@ static void ConnectionChangedCallbackHandler(bool connected)
     }
 }
 
+static void StoreTelemetry(float temperature, time_t timestamp)
+{
+    FileData fileData = {.temperature = temperature, .timestamp = timestamp};
+
+    // temperature and time of the event, queued for the writer thread which packs items into
+    // the files of the directory rather than taking a file each
+    if (!RecordWriter_Queue(&fileData)) {
+        Log_Debug("WARNING: Storage queue full, telemetry item dropped\n");
+    }
+}
+
+static void DrainStoredTelemetry(void)
+{
+    int numItems = RecordWriter_Read(drainBuffer, (size_t)drainBurst);
+    if (numItems <= 0) {
+        // nothing to upload
+        return;
+    }
+
+    // stored items are sent with the time they were generated, stop at the first failure so
+    // none are skipped
+    int numSent = 0;
+    while (numSent < numItems) {
+        Cloud_Telemetry stored = {.temperature = drainBuffer[numSent].temperature};
+        Cloud_Result result = Cloud_SendTelemetry(&stored, drainBuffer[numSent].timestamp);
+        if (result != Cloud_Result_OK) {
+            Log_Debug("WARNING: Could not send stored telemetry to cloud: %s\n",
+                      CloudResultToString(result));
+            break;
+        }
+        numSent++;
+    }
+
+    if (numSent > 0) {
+        RecordWriter_Consume((size_t)numSent);
+
+        struct tm *t = gmtime(&drainBuffer[0].timestamp);
+        Log_Debug("upload: %d stored telemetry item%sfrom %04d/%02d/%02d - %02d:%02d:%02d (burst %d)\n",
+                  numSent, numSent == 1 ? " " : "s ", t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
+                  t->tm_hour, t->tm_min, t->tm_sec, drainBurst);
+    }
+
+    if (numSent < numItems) {
+        drainBurst = (drainBurst / 2 > DRAIN_BURST_MIN) ? drainBurst / 2 : DRAIN_BURST_MIN;
+    } else if (numItems == drainBurst) {
+        // a short read means the backlog is gone, only a full burst says the connection keeps up
+        drainBurst = (drainBurst * 2 < DRAIN_BURST_MAX) ? drainBurst * 2 : DRAIN_BURST_MAX;
+    }
+}
+
 static void TelemetryTimerCallbackHandler(EventLoopTimer *timer)
 {
     static Cloud_Telemetry telemetry = {.temperature = 50.f};
@@ -258,7 +322,6 @@ static void TelemetryTimerCallbackHandler(EventLoopTimer *timer)
     time_t now;
     time(&now);
     struct tm* t = gmtime(&now);
-    int numFiles = 0;
 
     if (isConnected) {
         if (t->tm_sec % 5 == 0)
@@ -267,65 +330,27 @@ static void TelemetryTimerCallbackHandler(EventLoopTimer *timer)
             float delta = ((float)(rand() % 41)) / 20.0f - 1.0f; // between -1.0 and +1.0
             telemetry.temperature += delta;
 
-            numFiles = FS_GetNumberOfFilesInDirectory("data");
-
-            // if we can upload, and there aren't any files in storage, then upload the data
-            if (telemetryUploadEnabled && numFiles == 0)
+            // live telemetry goes straight out while the backlog drains, every item carries its
+            // own timestamp; if upload isn't enabled, or the send fails, it's stored instead
+            Cloud_Result result = Cloud_Result_OtherFailure;
+            if (telemetryUploadEnabled)
             {
-                Cloud_Result result = Cloud_SendTelemetry(&telemetry, now);
+                result = Cloud_SendTelemetry(&telemetry, now);
                 if (result != Cloud_Result_OK) {
                     Log_Debug("WARNING: Could not send thermometer telemetry to cloud: %s\n",
                         CloudResultToString(result));
                 }
             }
-            else
-            {
-                // if upload isn't enabled, or there are still files in storage, then store the data (data order is preserved)
-
-                fileData.temperature = telemetry.temperature;
-                fileData.timestamp = now;
 
-                // write temperature and time of iso8601 time format event data/time
-                assert(FS_WriteFile("data", "temperature.txt", (uint8_t*)&fileData, sizeof(fileData)) == 0);
-                numFiles = FS_GetNumberOfFilesInDirectory("data");
-                Log_Debug("%d telemetry item%sstored\n", numFiles, numFiles == 1 ? " " : "s ");
-            }
-        }
-        else
-        {
-            if (!telemetryUploadEnabled)
-            {
-                return;
-            }
-            // See if there's anything in storage that we need to upload.
-            // Note that this is happening every second (skipping seconds % 5 == 0).
-            numFiles = FS_GetNumberOfFilesInDirectory("data");
-            if (numFiles == 0)
+            if (result != Cloud_Result_OK)
             {
-                // nothing to upload, bail...
-                return;
+                StoreTelemetry(telemetry.temperature, now);
             }
+        }
 
-            struct fileEntry fileInfo;
-            FS_GetOldestFileInfo("data", &fileInfo);
-            uint8_t* data = (uint8_t*)malloc(fileInfo.fileSize);
-            memset(data, 0x00, fileInfo.fileSize);
-            FS_ReadOldestFile("data", data, fileInfo.fileSize);
-
-            FileData* fData = (FileData*)data;
-
-            // Send the telemetry
-            telemetry.temperature = fData->temperature;
-            // get the date/time.
-            t = gmtime(&(fData->timestamp));
-            Log_Debug("(%d telemetry items in storage) upload: %04d/%02d/%02d - %02d:%02d:%02d - %3.2f\n",numFiles,t->tm_year+1900,t->tm_mon+1,t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec, fData->temperature);
-            Cloud_Result result = Cloud_SendTelemetry(&telemetry, fData->timestamp);
-
-            // if upload was ok, delete the oldest file.
-            if (result == Cloud_Result_OK) {
-                FS_DeleteOldestFileInDirectory("data");
-            }
-            free(data);
+        if (telemetryUploadEnabled)
+        {
+            DrainStoredTelemetry();
         }
     }
 }
@@ -357,7 +382,7 @@ int InitializeFileSystem(void)
         // directory doesn't exist, add it.
 
         dir.maxFiles = 4000;    // 4000 files is 8000 blocks (one for the file header, one for the file data)
-        dir.maxFileSize = 256;
+        dir.maxFileSize = BLOCK_SIZE;   // a block of telemetry items per file
         snprintf(dir.dirName, 8, "data");
 
         if (FS_AddDirectory(&dir) == -1)
@@ -385,6 +410,10 @@ static ExitCode InitPeripheralsAndHandlers(void)
     if (InitializeFileSystem() != 0)
         return Exit_Code_Init_FileSystem;
 
+    // from here on SimpleFs is only used through the record writer
+    if (RecordWriter_Start("data", sizeof(FileData)) != 0)
+        return ExitCode_Init_RecordWriter;
+
     eventLoop = EventLoop_Create();
     if (eventLoop == NULL) {
         Log_Debug("Could not create event loop.\n");
@@ -420,6 +449,13 @@ static ExitCode InitPeripheralsAndHandlers(void)
 static void ClosePeripheralsAndHandlers(void)
 {
     DisposeEventLoopTimer(telemetryTimer);
+
+    // nothing queues records now, commit what's still waiting before the device goes away
+    if (RecordWriter_Flush() != 0) {
+        Log_Debug("WARNING: Some telemetry items could not be stored\n");
+    }
+    RecordWriter_Stop();
+
     Cloud_Cleanup();
     UserInterface_Cleanup();
     Connection_Cleanup();
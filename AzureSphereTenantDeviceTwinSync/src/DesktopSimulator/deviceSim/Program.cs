@@ -2,8 +2,15 @@
    Licensed under the MIT License. */
 
 using Microsoft.Azure.Devices.Client;
+using Microsoft.Azure.Devices.Shared;
 using Newtonsoft.Json;
+using Newtonsoft.Json.Linq;
 using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Linq;
 using System.Text;
 using System.Threading;
 using System.Threading.Tasks;
@@ -19,10 +26,23 @@ namespace deviceSim
 
         static async Task Main(string[] args)
         {
+            if (args.Length > 0)
+            {
+                LoadOptions options = LoadOptions.Parse(args);
+                if (options == null)
+                {
+                    LoadOptions.Usage();
+                    return;
+                }
+                await LoadTest.Run(options);
+                return;
+            }
+
             if (string.IsNullOrEmpty(connStr))
             {
                 Console.WriteLine("You need to set the device connection string 'connStr'");
                 Console.WriteLine("This can be obtained from the Azure IoT Explorer tool, or from the Azure Portal (IoT Hub/Devices)");
+                Console.WriteLine("To simulate many devices at once, run with --devices, see the README");
                 return;
             }
 
@@ -63,7 +83,7 @@ namespace deviceSim
             }
         }
 
-        static async Task SendTelemetryMessage(DeviceClient client, string message)
+        public static async Task SendTelemetryMessage(DeviceClient client, string message)
         {
             var msg = new Microsoft.Azure.Devices.Client.Message(Encoding.UTF8.GetBytes(message));
             msg.ContentEncoding = "utf-8";
@@ -79,4 +99,339 @@ namespace deviceSim
         public bool AppRestart { get; set; }
     }
 
+    /// <summary>
+    /// Load test settings, from the command line
+    /// </summary>
+    public class LoadOptions
+    {
+        public List<string> ConnectionStrings = new List<string>();
+        public int Devices = 0;                             // 0: one per connection string, at most that
+        public double TelemetrySeconds = 2;                 // between telemetry messages, per device
+        public double TriggersPerMinute = 1;                // AppRestart/NoUpdateAvailable messages, per device
+        public int DurationSeconds = 300;
+        public int TwinTimeoutSeconds = 60;                 // a trigger with no twin update by then counts as a timeout
+        public string ServiceConnectionString = null;       // clears OSVersion before each trigger, so every trigger needs a sync
+
+        public static void Usage()
+        {
+            Console.WriteLine("deviceSim --devices connectionStrings.txt [--count N] [--telemetry seconds] [--triggers perMinute]");
+            Console.WriteLine("          [--duration seconds] [--twin-timeout seconds] [--service iotHubConnectionString]");
+        }
+
+        public static LoadOptions Parse(string[] args)
+        {
+            LoadOptions options = new LoadOptions();
+            string devicesFile = null;
+
+            for (int i = 0; i + 1 < args.Length; i += 2)
+            {
+                string value = args[i + 1];
+                switch (args[i])
+                {
+                    case "--devices": devicesFile = value; break;
+                    case "--count": if (!int.TryParse(value, out options.Devices) || options.Devices <= 0) return null; break;
+                    case "--telemetry": if (!double.TryParse(value, out options.TelemetrySeconds) || options.TelemetrySeconds <= 0) return null; break;
+                    case "--triggers": if (!double.TryParse(value, out options.TriggersPerMinute) || options.TriggersPerMinute < 0) return null; break;
+                    case "--duration": if (!int.TryParse(value, out options.DurationSeconds) || options.DurationSeconds <= 0) return null; break;
+                    case "--twin-timeout": if (!int.TryParse(value, out options.TwinTimeoutSeconds) || options.TwinTimeoutSeconds <= 0) return null; break;
+                    case "--service": options.ServiceConnectionString = value; break;
+                    default: return null;
+                }
+            }
+
+            if (args.Length % 2 != 0 || devicesFile == null)
+            {
+                return null;
+            }
+
+            // one device connection string per line, each for a device that's in the Azure Sphere tenant
+            options.ConnectionStrings = File.ReadAllLines(devicesFile)
+                .Select(line => line.Trim())
+                .Where(line => line.Length > 0 && !line.StartsWith("#"))
+                .ToList();
+            if (options.ConnectionStrings.Count == 0)
+            {
+                return null;
+            }
+            if (options.Devices == 0)
+            {
+                options.Devices = options.ConnectionStrings.Count;
+            }
+            else if (options.Devices > options.ConnectionStrings.Count)
+            {
+                // IoT Hub allows one connection per device identity, so each simulated device needs its own
+                Console.WriteLine($"--count {options.Devices} needs as many connection strings, {devicesFile} has {options.ConnectionStrings.Count}");
+                return null;
+            }
+
+            return options;
+        }
+    }
+
+    /// <summary>
+    /// Runs many simulated devices at once against IoT Hub and the REST API service, and measures:
+    ///  - telemetry latency, the time SendEventAsync takes to be acknowledged by IoT Hub
+    ///  - twin sync latency, from sending an AppRestart/NoUpdateAvailable message until the REST API
+    ///    service's desired property update reaches the device
+    ///  - errors: failed sends, and triggers with no twin update within the twin timeout
+    /// The backend only updates a twin when the AS3 data differs, so without --service most triggers
+    /// after the first go unanswered; with --service each device's desired OSVersion is cleared
+    /// before each trigger, so every trigger needs a sync.
+    /// </summary>
+    public class LoadTest
+    {
+        private static readonly TimeSpan reportPeriod = TimeSpan.FromSeconds(10);
+
+        private class Stats
+        {
+            public ConcurrentQueue<double> TelemetryMs = new ConcurrentQueue<double>();
+            public ConcurrentQueue<double> TwinMs = new ConcurrentQueue<double>();
+            public long Sent;
+            public long SendErrors;
+            public long Triggers;
+            public long TwinTimeouts;
+            public long ResetErrors;
+        }
+
+        // the report swaps interval for a new one, total covers the whole run
+        private static Stats interval = new Stats();
+        private static readonly Stats total = new Stats();
+
+        private static void RecordTelemetry(double ms, bool trigger)
+        {
+            foreach (Stats stats in new[] { Volatile.Read(ref interval), total })
+            {
+                stats.TelemetryMs.Enqueue(ms);
+                Interlocked.Increment(ref stats.Sent);
+                if (trigger)
+                {
+                    Interlocked.Increment(ref stats.Triggers);
+                }
+            }
+        }
+
+        private static void RecordTwinSync(double ms)
+        {
+            Volatile.Read(ref interval).TwinMs.Enqueue(ms);
+            total.TwinMs.Enqueue(ms);
+        }
+
+        private static void Count(Action<Stats> counter)
+        {
+            counter(Volatile.Read(ref interval));
+            counter(total);
+        }
+
+        private class SimDevice
+        {
+            public string DeviceId;
+            public DeviceClient Client;
+            public readonly object Lock = new object();
+            public Stopwatch PendingTrigger = null;      // running while a trigger waits for its twin update
+        }
+
+        public static async Task Run(LoadOptions options)
+        {
+            Microsoft.Azure.Devices.RegistryManager registry = options.ServiceConnectionString == null ? null :
+                Microsoft.Azure.Devices.RegistryManager.CreateFromConnectionString(options.ServiceConnectionString);
+
+            List<SimDevice> devices = new List<SimDevice>();
+            for (int i = 0; i < options.Devices; i++)
+            {
+                string connectionString = options.ConnectionStrings[i];
+                devices.Add(new SimDevice
+                {
+                    DeviceId = IotHubConnectionStringBuilder.Create(connectionString).DeviceId,
+                    Client = DeviceClient.CreateFromConnectionString(connectionString, Microsoft.Azure.Devices.Client.TransportType.Mqtt)
+                });
+            }
+
+            Console.WriteLine($"Simulating {devices.Count} devices for {options.DurationSeconds}s: telemetry every {options.TelemetrySeconds}s, " +
+                $"{options.TriggersPerMinute} triggers/minute each{(registry != null ? ", clearing OSVersion before each trigger" : "")}");
+
+            CancellationTokenSource cancel = new CancellationTokenSource(TimeSpan.FromSeconds(options.DurationSeconds));
+            Console.CancelKeyPress += (sender, e) => { e.Cancel = true; cancel.Cancel(); };
+
+            List<Task> tasks = new List<Task>();
+            for (int i = 0; i < devices.Count; i++)
+            {
+                // spread the devices' start over one telemetry interval, so they don't all connect at once
+                TimeSpan startDelay = TimeSpan.FromSeconds(options.TelemetrySeconds * i / devices.Count);
+                tasks.Add(RunDevice(devices[i], options, registry, startDelay, cancel.Token));
+            }
+
+            Stopwatch run = Stopwatch.StartNew();
+            Task all = Task.WhenAll(tasks);
+            while (!all.IsCompleted)
+            {
+                await Task.WhenAny(all, Task.Delay(reportPeriod));
+                Report($"{run.Elapsed.TotalSeconds,5:F0}s", Interlocked.Exchange(ref interval, new Stats()), reportPeriod.TotalSeconds);
+            }
+
+            Console.WriteLine();
+            Report("total", total, run.Elapsed.TotalSeconds);
+
+            foreach (SimDevice device in devices)
+            {
+                await device.Client.CloseAsync();
+                device.Client.Dispose();
+            }
+            registry?.Dispose();
+        }
+
+        private static async Task RunDevice(SimDevice device, LoadOptions options, Microsoft.Azure.Devices.RegistryManager registry,
+            TimeSpan startDelay, CancellationToken cancel)
+        {
+            Random random = new Random(device.DeviceId.GetHashCode() ^ Environment.TickCount);
+            double triggerChance = options.TriggersPerMinute * options.TelemetrySeconds / 60.0;
+            telemetry deviceTelemetry = new telemetry { temperature = 11.5 };
+            int triggers = 0;
+
+            try
+            {
+                await Task.Delay(startDelay, cancel);
+                await device.Client.OpenAsync(cancel);
+
+                // the REST API service writes AS3 data to the desired properties; the clear from
+                // --service has a null OSVersion, and doesn't count as a sync
+                await device.Client.SetDesiredPropertyUpdateCallbackAsync((desired, context) =>
+                {
+                    if (desired.Contains("OSVersion") && ((JToken)desired["OSVersion"]).Type != JTokenType.Null)
+                    {
+                        lock (device.Lock)
+                        {
+                            if (device.PendingTrigger != null)
+                            {
+                                RecordTwinSync(device.PendingTrigger.Elapsed.TotalMilliseconds);
+                                device.PendingTrigger = null;
+                            }
+                        }
+                    }
+                    return Task.CompletedTask;
+                }, null, cancel);
+            }
+            catch (OperationCanceledException)
+            {
+                return;
+            }
+            catch (Exception ex)
+            {
+                Console.WriteLine($"{device.DeviceId}: could not connect: {ex.Message}");
+                Count(stats => Interlocked.Increment(ref stats.SendErrors));
+                return;
+            }
+
+            while (!cancel.IsCancellationRequested)
+            {
+                deviceTelemetry.temperature += random.NextDouble() - 0.5;
+                deviceTelemetry.AppRestart = false;
+                deviceTelemetry.NoUpdateAvailable = false;
+
+                bool trigger;
+                lock (device.Lock)
+                {
+                    if (device.PendingTrigger != null && device.PendingTrigger.Elapsed.TotalSeconds > options.TwinTimeoutSeconds)
+                    {
+                        Count(stats => Interlocked.Increment(ref stats.TwinTimeouts));
+                        device.PendingTrigger = null;
+                    }
+
+                    // one trigger outstanding per device, so each latency has one start
+                    trigger = device.PendingTrigger == null && random.NextDouble() < triggerChance;
+                }
+
+                if (trigger)
+                {
+                    // as the single device simulator, a NoUpdateAvailable for every five AppRestarts
+                    if (++triggers % 6 == 0)
+                    {
+                        deviceTelemetry.NoUpdateAvailable = true;
+                    }
+                    else
+                    {
+                        deviceTelemetry.AppRestart = true;
+                    }
+
+                    if (registry != null)
+                    {
+                        try
+                        {
+                            await registry.UpdateTwinAsync(device.DeviceId, "{ properties: { desired: { OSVersion: null } } }", "*", cancel);
+                        }
+                        catch (Exception)
+                        {
+                            if (cancel.IsCancellationRequested)
+                            {
+                                break;
+                            }
+                            Count(stats => Interlocked.Increment(ref stats.ResetErrors));
+                        }
+                    }
+                }
+
+                Stopwatch send = Stopwatch.StartNew();
+                try
+                {
+                    if (trigger)
+                    {
+                        lock (device.Lock)
+                        {
+                            device.PendingTrigger = Stopwatch.StartNew();
+                        }
+                    }
+
+                    await Program.SendTelemetryMessage(device.Client, JsonConvert.SerializeObject(deviceTelemetry));
+
+                    RecordTelemetry(send.Elapsed.TotalMilliseconds, trigger);
+                }
+                catch (Exception)
+                {
+                    Count(stats => Interlocked.Increment(ref stats.SendErrors));
+                    lock (device.Lock)
+                    {
+                        device.PendingTrigger = null;
+                    }
+                }
+
+                try
+                {
+                    TimeSpan wait = TimeSpan.FromSeconds(options.TelemetrySeconds) - send.Elapsed;
+                    if (wait > TimeSpan.Zero)
+                    {
+                        await Task.Delay(wait, cancel);
+                    }
+                }
+                catch (OperationCanceledException)
+                {
+                }
+            }
+        }
+
+        private static string Percentiles(ConcurrentQueue<double> samples)
+        {
+            if (samples.IsEmpty)
+            {
+                return "-";
+            }
+
+            double[] sorted = samples.ToArray();
+            Array.Sort(sorted);
+            double At(double p) => sorted[Math.Max(0, (int)Math.Ceiling(p * sorted.Length) - 1)];
+            return $"p50 {At(0.50):F0} p95 {At(0.95):F0} p99 {At(0.99):F0} max {sorted[sorted.Length - 1]:F0}ms";
+        }
+
+        private static void Report(string label, Stats stats, double seconds)
+        {
+            long sent = Interlocked.Read(ref stats.Sent);
+            long errors = Interlocked.Read(ref stats.SendErrors);
+            long attempts = sent + errors;
+            long triggers = Interlocked.Read(ref stats.Triggers);
+            long timeouts = Interlocked.Read(ref stats.TwinTimeouts);
+
+            Console.WriteLine($"{label}: telemetry {sent / seconds:F1}/s, {errors} errors ({(attempts > 0 ? 100.0 * errors / attempts : 0):F2}%), {Percentiles(stats.TelemetryMs)}");
+            Console.WriteLine($"{new string(' ', label.Length)}  twin sync {triggers} triggers, {stats.TwinMs.Count} synced, {timeouts} timed out" +
+                $"{(stats.ResetErrors > 0 ? $", {stats.ResetErrors} resets failed" : "")}, {Percentiles(stats.TwinMs)}");
+        }
+    }
+
 }
@@ -7,6 +7,7 @@
 
 #include <memory.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <applibs/eventloop.h>
 #include <applibs/log.h>
@@ -59,6 +60,49 @@ bool updateInstallingEventPending = false;
 
 static EventLoopTimer *eventTimer = NULL;
 
+// Telemetry samples are queued and sent together once per window, or as soon as the batch is
+// full, as one message: {"samples":[{"temperature":..., "timestamp":"..."}, ...]}. A batch that
+// can't be sent is kept for the next window; when it's full the oldest sample is dropped.
+#define TELEMETRY_WINDOW_SECONDS 300
+#define TELEMETRY_BATCH_MAX_SAMPLES 32
+
+typedef struct {
+    float temperature;
+    time_t timestamp;
+} TelemetrySample;
+
+static TelemetrySample telemetryBatch[TELEMETRY_BATCH_MAX_SAMPLES];
+static size_t telemetryBatchCount = 0;
+static EventLoopTimer *telemetryWindowTimer = NULL;
+
+// Batches sent but not yet confirmed by IoT Hub, each is the context of its send so the
+// confirmation can be matched to the time it was sent.
+#define TELEMETRY_MAX_IN_FLIGHT 4
+
+typedef struct {
+    bool inUse;
+    struct timespec sentAt;
+    size_t sampleCount;
+} TelemetryInFlight;
+
+static TelemetryInFlight telemetryInFlight[TELEMETRY_MAX_IN_FLIGHT];
+
+// Send-to-confirm latency histogram, logged and reset every report period to tune the window.
+#define TELEMETRY_LATENCY_REPORT_SECONDS 3600
+
+static const unsigned int latencyBucketLimitsMs[] = {250, 500, 1000, 2000, 5000, 10000, 30000};
+#define LATENCY_BUCKET_COUNT (sizeof(latencyBucketLimitsMs) / sizeof(latencyBucketLimitsMs[0]) + 1)
+
+static struct {
+    unsigned int buckets[LATENCY_BUCKET_COUNT];
+    unsigned int failures;
+    unsigned long maxMs;
+    unsigned long long totalMs;
+    unsigned int samplesSent;
+} latencyStats;
+
+static EventLoopTimer *latencyReportTimer = NULL;
+
 
 Cloud_Result Cloud_SendEvent(const char *eventName, void *context);
 
@@ -105,8 +149,131 @@ static void EventTimerCallbackHandler(EventLoopTimer *timer)
     }
 }
 
+static unsigned long ElapsedMs(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)((now.tv_sec - since->tv_sec) * 1000 +
+                           (now.tv_nsec - since->tv_nsec) / 1000000);
+}
+
+static void RecordTelemetryDelivery(TelemetryInFlight *inFlight, bool success)
+{
+    if (success) {
+        unsigned long latencyMs = ElapsedMs(&inFlight->sentAt);
+        size_t bucket = 0;
+        while (bucket < LATENCY_BUCKET_COUNT - 1 && latencyMs > latencyBucketLimitsMs[bucket]) {
+            bucket++;
+        }
+        latencyStats.buckets[bucket]++;
+        latencyStats.totalMs += latencyMs;
+        latencyStats.samplesSent += (unsigned int)inFlight->sampleCount;
+        if (latencyMs > latencyStats.maxMs) {
+            latencyStats.maxMs = latencyMs;
+        }
+    } else {
+        latencyStats.failures++;
+        Log_Debug("WARNING: Batch of %zu telemetry samples failed to send to IoT Hub.\n",
+                  inFlight->sampleCount);
+    }
+
+    inFlight->inUse = false;
+}
+
+static void LatencyReportTimerCallbackHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        return;
+    }
+
+    unsigned int delivered = 0;
+    for (size_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+        delivered += latencyStats.buckets[i];
+    }
+
+    Log_Debug("INFO: Telemetry batches: %u delivered (%u samples), %u failed, mean %llu ms, max %lu ms\n",
+              delivered, latencyStats.samplesSent, latencyStats.failures,
+              delivered > 0 ? latencyStats.totalMs / delivered : 0, latencyStats.maxMs);
+    for (size_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+        if (i < LATENCY_BUCKET_COUNT - 1) {
+            Log_Debug("INFO:   <= %5u ms: %u\n", latencyBucketLimitsMs[i], latencyStats.buckets[i]);
+        } else {
+            Log_Debug("INFO:    > %5u ms: %u\n", latencyBucketLimitsMs[i - 1],
+                      latencyStats.buckets[i]);
+        }
+    }
+
+    memset(&latencyStats, 0, sizeof(latencyStats));
+}
+
+static Cloud_Result SendTelemetryBatch(void)
+{
+    if (telemetryBatchCount == 0) {
+        return Cloud_Result_OK;
+    }
+
+    TelemetryInFlight *inFlight = NULL;
+    for (size_t i = 0; i < TELEMETRY_MAX_IN_FLIGHT; i++) {
+        if (!telemetryInFlight[i].inUse) {
+            inFlight = &telemetryInFlight[i];
+            break;
+        }
+    }
+    if (inFlight == NULL) {
+        Log_Debug("WARNING: Too many telemetry batches awaiting confirmation; holding %zu samples.\n",
+                  telemetryBatchCount);
+        return Cloud_Result_OtherFailure;
+    }
+
+    JSON_Value *batchValue = json_value_init_object();
+    JSON_Value *samplesValue = json_value_init_array();
+    JSON_Array *samples = json_value_get_array(samplesValue);
+    for (size_t i = 0; i < telemetryBatchCount; i++) {
+        JSON_Value *sampleValue = json_value_init_object();
+        JSON_Object *sample = json_value_get_object(sampleValue);
+        char timestamp[sizeof("YYYY-MM-DDTHH:MM:SSZ")];
+        struct tm utc;
+        gmtime_r(&telemetryBatch[i].timestamp, &utc);
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &utc);
+        json_object_set_number(sample, "temperature", telemetryBatch[i].temperature);
+        json_object_set_string(sample, "timestamp", timestamp);
+        json_array_append_value(samples, sampleValue);
+    }
+    json_object_set_value(json_value_get_object(batchValue), "samples", samplesValue);
+    char *serializedBatch = json_serialize_to_string(batchValue);
+
+    clock_gettime(CLOCK_MONOTONIC, &inFlight->sentAt);
+    inFlight->sampleCount = telemetryBatchCount;
+    AzureIoT_Result aziotResult = AzureIoT_SendTelemetry(serializedBatch, inFlight);
+    Cloud_Result result = AzureIoTToCloudResult(aziotResult);
+    if (result == Cloud_Result_OK) {
+        inFlight->inUse = true;
+        telemetryBatchCount = 0;
+    }
+
+    json_free_serialized_string(serializedBatch);
+    json_value_free(batchValue);
+
+    return result;
+}
+
+static void TelemetryWindowTimerCallbackHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        return;
+    }
+
+    SendTelemetryBatch();
+}
+
 static void TelemetryCallbackHandler(bool success, void *context)
 {
+    if (context >= (void *)&telemetryInFlight[0] &&
+        context < (void *)&telemetryInFlight[TELEMETRY_MAX_IN_FLIGHT]) {
+        RecordTelemetryDelivery((TelemetryInFlight *)context, success);
+        return;
+    }
+
     if(context == &updateInstallingEventPending)
     {
         if(success)
@@ -174,6 +341,21 @@ ExitCode Cloud_Initialize(EventLoop *el, void *backendContext,
         return ExitCode_Init_TelemetryTimer; // need new value
     }
 
+    struct timespec telemetryWindowPeriod = {.tv_sec = TELEMETRY_WINDOW_SECONDS, .tv_nsec = 0};
+    telemetryWindowTimer = CreateEventLoopPeriodicTimer(el, &TelemetryWindowTimerCallbackHandler,
+                                                        &telemetryWindowPeriod);
+    if (telemetryWindowTimer == NULL) {
+        return ExitCode_Init_TelemetryTimer;
+    }
+
+    struct timespec latencyReportPeriod = {.tv_sec = TELEMETRY_LATENCY_REPORT_SECONDS,
+                                           .tv_nsec = 0};
+    latencyReportTimer = CreateEventLoopPeriodicTimer(el, &LatencyReportTimerCallbackHandler,
+                                                      &latencyReportPeriod);
+    if (latencyReportTimer == NULL) {
+        return ExitCode_Init_TelemetryTimer;
+    }
+
     AzureIoT_Callbacks callbacks = {
         .connectionStatusCallbackFunction = ConnectionChangedCallbackHandler,
         .deviceTwinReceivedCallbackFunction = DeviceTwinCallbackHandler,
@@ -187,6 +369,8 @@ ExitCode Cloud_Initialize(EventLoop *el, void *backendContext,
 void Cloud_Cleanup(void)
 {
     DisposeEventLoopTimer(eventTimer);
+    DisposeEventLoopTimer(telemetryWindowTimer);
+    DisposeEventLoopTimer(latencyReportTimer);
     AzureIoT_Cleanup();
 }
 
@@ -204,17 +388,22 @@ static Cloud_Result AzureIoTToCloudResult(AzureIoT_Result result) {
 
 Cloud_Result Cloud_SendTelemetry(const Cloud_Telemetry *telemetry)
 {
-    JSON_Value *telemetryValue = json_value_init_object();
-    JSON_Object *telemetryRoot = json_value_get_object(telemetryValue);
-    json_object_dotset_number(telemetryRoot, "temperature", telemetry->temperature);
-    char *serializedTelemetry = json_serialize_to_string(telemetryValue);
-    AzureIoT_Result aziotResult = AzureIoT_SendTelemetry(serializedTelemetry, NULL);
-    Cloud_Result result = AzureIoTToCloudResult(aziotResult);
+    if (telemetryBatchCount == TELEMETRY_BATCH_MAX_SAMPLES) {
+        Log_Debug("WARNING: Telemetry batch full; dropping the oldest sample.\n");
+        memmove(&telemetryBatch[0], &telemetryBatch[1],
+                (TELEMETRY_BATCH_MAX_SAMPLES - 1) * sizeof(telemetryBatch[0]));
+        telemetryBatchCount--;
+    }
 
-    json_free_serialized_string(serializedTelemetry);
-    json_value_free(telemetryValue);
+    telemetryBatch[telemetryBatchCount].temperature = telemetry->temperature;
+    telemetryBatch[telemetryBatchCount].timestamp = time(NULL);
+    telemetryBatchCount++;
 
-    return result;
+    if (telemetryBatchCount == TELEMETRY_BATCH_MAX_SAMPLES) {
+        return SendTelemetryBatch();
+    }
+
+    return Cloud_Result_OK;
 }
 
 void Cloud_SignalNoUpdatePending(void) 
@@ -93,7 +93,8 @@ ExitCode Cloud_Initialize(
 void Cloud_Cleanup(void);
 
 /// <summary>
-/// Queue sending telemtry to the cloud backend.
+/// Queue sending telemtry to the cloud backend. Samples are batched and sent together once per
+/// send window, or as soon as the batch is full.
 /// </summary>
 /// <param name="telemetry">A pointer to a <see cref="Cloud_Telemetry" /> structure to send.</param>
 /// <returns>A <see cref="Cloud_Result" /> indicating success or failure.</returns>
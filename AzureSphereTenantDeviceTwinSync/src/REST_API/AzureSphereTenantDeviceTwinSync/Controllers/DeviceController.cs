@@ -57,16 +57,13 @@ namespace DevicePropertiesWebHook.Controllers
         /// <returns></returns>
         private static string APIKey = "";
 
-        /// <summary>
-        /// List of App Update policies for a device group
-        /// </summary>
-        private static string[] AppUpdatePolicies = new string[] { "Update All", "No 3rd Party App Updates", "No Updates" };
-
         private IConfiguration _configuration;
+        private TwinSync _twinSync;
 
-        public WebHook(IConfiguration configuration)
+        public WebHook(IConfiguration configuration, TwinSync twinSync)
         {
             _configuration = configuration;
+            _twinSync = twinSync;
         }
 
         // GET: used to initialize the Token process
@@ -125,7 +122,7 @@ namespace DevicePropertiesWebHook.Controllers
 
         // POST: the webhook endpoint called from EventGrid
         [HttpPost]
-        public async Task<IActionResult> Post(JArray data)
+        public IActionResult Post(JArray data)
         {
             Debug.WriteLine($"\nPOST Received:\n{data}");
             Debug.WriteLine("");
@@ -151,63 +148,28 @@ namespace DevicePropertiesWebHook.Controllers
                 {
                     return Ok("Request Failed");
                 }
-                // iothub-connection-device-id
-                string deviceId = data[0]["data"]["systemProperties"]["iothub-connection-device-id"].ToString();
-                Debug.WriteLine($"Device ID: {deviceId}");
-
-                JToken dataBody = data[0]["data"]["body"];
-                if (dataBody != null)
+                // Event Grid may deliver several events in one POST
+                foreach (JToken eventData in data)
                 {
-                    string jsonBody = data[0]["data"]["body"].ToString();
-                    JObject jBody = JObject.Parse(jsonBody);
-                    JProperty noUpdate = jBody.Properties().FirstOrDefault(p => p.Name.Contains("NoUpdateAvailable"));
-                    JProperty appRestart = jBody.Properties().FirstOrDefault(p => p.Name.Contains("AppRestart"));
-
-                    // If the device reports no update available, this is because it has just checked with AS3 for updates, so the AS3 device data (e.g.the current OS) is up to date.
-                    // An app restart may also indicate that a software update happened, and including this facilitates testing as well as it is an easy event to trigger.
-                    if (noUpdate != null || appRestart != null)
-                    {
-                        string token = string.Empty;
-
-                        // get the access token.
-                        bool useDeviceCodeFlow = _configuration.GetValue<bool>("MySettings:UseDeviceCodeFlow");
-                        if (useDeviceCodeFlow)
-                        {
-                            if (ADToken.isAuthComplete())
-                            {
-                                Debug.WriteLine("AS3 device info...");
-                                AuthenticationResult result = await ADToken.GetAToken();
-                                if (result != null)
-                                {
-                                    token = result.AccessToken;
-                                }
-                            }
-                        }
-                        else
-                        {
-                            token = await Utils.GetAS3Token();
-                        }
+                    // iothub-connection-device-id
+                    string deviceId = eventData["data"]["systemProperties"]["iothub-connection-device-id"].ToString();
+                    Debug.WriteLine($"Device ID: {deviceId}");
 
-                        if (string.IsNullOrEmpty(token))
-                        {
-                            return Ok("No Token");
-                        }
-
-                        TwinState state = GetDeviceTwinDataFromAS3(token, deviceId);
-
-                        // Get current twin data for 'deviceId'
-                        RegistryManager registryManager = RegistryManager.CreateFromConnectionString(IoTHubConnectionString);
-                        var twin = await registryManager.GetTwinAsync(deviceId);
-
-                        string _desiredJson = twin.Properties.Desired.ToJson();
-                        // anything changed?
-                        if (!IsDeviceTwinUpdateNeeded(_desiredJson, state))
+                    JToken dataBody = eventData["data"]["body"];
+                    if (dataBody != null)
+                    {
+                        string jsonBody = dataBody.ToString();
+                        JObject jBody = JObject.Parse(jsonBody);
+                        JProperty noUpdate = jBody.Properties().FirstOrDefault(p => p.Name.Contains("NoUpdateAvailable"));
+                        JProperty appRestart = jBody.Properties().FirstOrDefault(p => p.Name.Contains("AppRestart"));
+
+                        // If the device reports no update available, this is because it has just checked with AS3 for updates, so the AS3 device data (e.g.the current OS) is up to date.
+                        // An app restart may also indicate that a software update happened, and including this facilitates testing as well as it is an easy event to trigger.
+                        if (noUpdate != null || appRestart != null)
                         {
-                            return Ok();
+                            // the twin is synced with the next batch, see TwinSync
+                            _twinSync.Queue(deviceId);
                         }
-
-                        var patch = $"{{ properties: {{ desired: {JsonConvert.SerializeObject(state) } }} }}";
-                        await registryManager.UpdateTwinAsync(twin.DeviceId, patch, twin.ETag);
                     }
                 }
 
@@ -215,88 +177,6 @@ namespace DevicePropertiesWebHook.Controllers
             }
         }
 
-        static TwinState GetDeviceTwinDataFromAS3(string token, string deviceId)
-        {
-            string deviceData = Utils.GetAS3Data($"tenants/{AzureSphereTenantId}/devices/{deviceId}", token);
-            DeviceInfo devInfo = JsonConvert.DeserializeObject<DeviceInfo>(deviceData);
-
-            // https://prod.core.sphere.azure.net/v2/tenants/{tenantId}/devicegroups/{deviceGroupId}
-            string deviceGroup = Utils.GetAS3Data($"tenants/{AzureSphereTenantId}/devicegroups/{devInfo.DeviceGroupId}", token);
-            Debug.WriteLine(deviceGroup);
-            DeviceGroupInfo dgInfo = JsonConvert.DeserializeObject<DeviceGroupInfo>(deviceGroup);
-
-            // https://prod.core.sphere.azure.net/v2/tenants/{tenantId}/products/{productId}
-            string product = Utils.GetAS3Data($"tenants/{AzureSphereTenantId}/products/{devInfo.ProductId}", token);
-            Debug.WriteLine(product);
-            ProductInfo prodInfo = JsonConvert.DeserializeObject<ProductInfo>(product);
-
-            TwinState state = new TwinState
-            {
-                Product = prodInfo.Name,
-                DeviceGroup = dgInfo.Name,
-                RetailEval = dgInfo.OsFeedType == 1 ? true : false,
-                AppUpdatePolicy = AppUpdatePolicies[dgInfo.UpdatePolicy],
-                OSVersion = string.IsNullOrEmpty(devInfo.LastInstalledOSVersion) ? "None" : devInfo.LastInstalledOSVersion
-            };
-
-            Debug.WriteLine($"Device                    : {deviceId}");
-            Debug.WriteLine($"Product                   : {state.Product}");
-            Debug.WriteLine($"Device Group              : {state.DeviceGroup}");
-            Debug.WriteLine($"Retail Eval               : {state.RetailEval}");
-            Debug.WriteLine($"App Update Policy         : {state.AppUpdatePolicy}");
-            Debug.WriteLine($"Last Installed OS Version : {state.OSVersion}");
-
-            return state;
-        }
-
-        static bool IsDeviceTwinUpdateNeeded(string twinJson, TwinState state)
-        {
-            JObject _desired = JObject.Parse(twinJson);
-
-            string twinDesiredOS = (string)_desired["OSVersion"];
-            if (string.IsNullOrEmpty(twinDesiredOS) || twinDesiredOS != state.OSVersion)
-            {
-                Debug.WriteLine("No OS Version, or OS Version doesn't match");
-                return true;
-            }
-
-            string twinDesiredProduct = (string)_desired["Product"];
-            if (string.IsNullOrEmpty(twinDesiredProduct) || twinDesiredProduct != state.Product)
-            {
-                Debug.WriteLine("No Product, or product names don't match");
-                return true;
-            }
-
-            string twinDeviceGroup = (string)_desired["DeviceGroup"];
-            if (string.IsNullOrEmpty(twinDeviceGroup) || twinDeviceGroup != state.DeviceGroup)
-            {
-                Debug.WriteLine("No Device Group, or Device Group names don't match");
-                return true;
-            }
-
-            if (!_desired.ContainsKey("RetailEval"))
-            {
-                Debug.WriteLine("RetailEval not found in JSON");
-                return true;
-            }
-
-            bool twinRetailEval = (bool)_desired["RetailEval"];
-            if (twinRetailEval != state.RetailEval)
-            {
-                Debug.WriteLine("RetailEval doesn't match");
-                return true;
-            }
-
-            string twinUpdtePolicy = (string)_desired["AppUpdatePolicy"];
-            if (string.IsNullOrEmpty(twinUpdtePolicy) || twinUpdtePolicy != state.AppUpdatePolicy)
-            {
-                Debug.WriteLine("No App Update Policy, or App Update Policy names don't match");
-                return true;
-            }
-
-            return false;
-        }
-
         private bool GetSecrets()
         {
             APIKey = Utils.GetKeyVaultString("APIKey");
@@ -26,6 +26,10 @@ namespace DevicePropertiesWebHook
         public void ConfigureServices(IServiceCollection services)
         {
             services.AddControllers().AddNewtonsoftJson();
+
+            // one batcher, shared by the webhook that queues devices and the host that runs it
+            services.AddSingleton<TwinSync>();
+            services.AddHostedService(provider => provider.GetRequiredService<TwinSync>());
         }
 
         // This method gets called by the runtime. Use this method to configure the HTTP request pipeline.
@@ -0,0 +1,343 @@
+using Microsoft.Azure.Devices;
+using Microsoft.Azure.Devices.Shared;
+using Microsoft.Extensions.Configuration;
+using Microsoft.Extensions.Hosting;
+using Newtonsoft.Json;
+using Newtonsoft.Json.Linq;
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Threading;
+using System.Threading.Channels;
+using System.Threading.Tasks;
+
+namespace DevicePropertiesWebHook
+{
+    /// <summary>
+    /// Syncs device twins in batches, so a fleet-wide event (every device checking for updates at once)
+    /// doesn't cost a set of Public API calls and two IoT Hub calls per device.
+    ///
+    /// The webhook queues the device id and returns. Every batch window the queued ids (duplicates
+    /// removed) are looked up in per-tenant device, device group and product lists that are fetched
+    /// at most once per cache lifetime, their twins are read with one IoT Hub query per 100 devices,
+    /// and the twins that need a change are patched with one bulk update per 100 devices.
+    /// </summary>
+    public class TwinSync : BackgroundService
+    {
+        /// <summary>
+        /// Most devices in one IoT Hub bulk twin update, and in one twin query
+        /// </summary>
+        private const int maxBatchSize = 100;
+
+        /// <summary>
+        /// List of App Update policies for a device group
+        /// </summary>
+        private static string[] AppUpdatePolicies = new string[] { "Update All", "No 3rd Party App Updates", "No Updates" };
+
+        private readonly IConfiguration _configuration;
+        private readonly Channel<string> queue = Channel.CreateUnbounded<string>(new UnboundedChannelOptions { SingleReader = true });
+
+        private readonly TimeSpan batchWindow;
+        private readonly TimeSpan listLifetime;
+
+        /// <summary>
+        /// The tenant's lists, as of Fetched. A device that isn't in them is fetched on its own.
+        /// </summary>
+        private class TenantLists
+        {
+            public DateTime Fetched;
+            public Dictionary<string, DeviceInfo> Devices;
+            public Dictionary<string, DeviceGroupInfo> DeviceGroups;
+            public Dictionary<string, ProductInfo> Products;
+        }
+
+        private readonly Dictionary<string, TenantLists> tenants = new Dictionary<string, TenantLists>();
+
+        private RegistryManager registryManager = null;
+        private string registryConnectionString = string.Empty;
+
+        public TwinSync(IConfiguration configuration)
+        {
+            _configuration = configuration;
+            batchWindow = TimeSpan.FromMilliseconds(_configuration.GetValue("MySettings:TwinBatchWindowMs", 2000));
+            listLifetime = TimeSpan.FromSeconds(_configuration.GetValue("MySettings:DeviceListCacheSeconds", 30));
+        }
+
+        /// <summary>
+        /// Queues a device for the next batch
+        /// </summary>
+        public void Queue(string deviceId)
+        {
+            queue.Writer.TryWrite(deviceId);
+        }
+
+        protected override async Task ExecuteAsync(CancellationToken stoppingToken)
+        {
+            ChannelReader<string> reader = queue.Reader;
+
+            try
+            {
+                while (await reader.WaitToReadAsync(stoppingToken))
+                {
+                    // let the rest of a storm arrive, then take everything queued
+                    await Task.Delay(batchWindow, stoppingToken);
+
+                    HashSet<string> deviceIds = new HashSet<string>();
+                    while (reader.TryRead(out string deviceId))
+                    {
+                        deviceIds.Add(deviceId);
+                    }
+
+                    try
+                    {
+                        await SyncDevices(deviceIds.ToList());
+                    }
+                    catch (Exception ex)
+                    {
+                        Debug.WriteLine($"Twin sync of {deviceIds.Count} devices failed: {ex.Message}");
+                    }
+                }
+            }
+            catch (OperationCanceledException)
+            {
+            }
+        }
+
+        private async Task SyncDevices(List<string> deviceIds)
+        {
+            string tenantId = Utils.GetKeyVaultString("tenantId");
+            string connectionString = Utils.GetKeyVaultString("IoTHubConnectionString");
+            if (string.IsNullOrEmpty(tenantId) || string.IsNullOrEmpty(connectionString))
+            {
+                return;
+            }
+
+            string token = await Utils.GetToken(_configuration.GetValue<bool>("MySettings:UseDeviceCodeFlow"));
+            if (string.IsNullOrEmpty(token))
+            {
+                Debug.WriteLine($"No Token, {deviceIds.Count} devices not synced");
+                return;
+            }
+
+            if (registryManager == null || connectionString != registryConnectionString)
+            {
+                registryManager?.Dispose();
+                registryManager = RegistryManager.CreateFromConnectionString(connectionString);
+                registryConnectionString = connectionString;
+            }
+
+            TenantLists lists = GetTenantLists(tenantId, token);
+
+            Dictionary<string, TwinState> states = new Dictionary<string, TwinState>();
+            foreach (string deviceId in deviceIds)
+            {
+                TwinState state = GetDeviceTwinState(tenantId, lists, deviceId, token);
+                if (state != null)
+                {
+                    states[deviceId] = state;
+                }
+            }
+
+            int updated = 0;
+            for (int start = 0; start < deviceIds.Count; start += maxBatchSize)
+            {
+                List<string> batch = deviceIds.Skip(start).Take(maxBatchSize).Where(id => states.ContainsKey(id)).ToList();
+                if (batch.Count == 0)
+                {
+                    continue;
+                }
+
+                // current twin data for the whole batch, in one query
+                string idList = string.Join(",", batch.Select(id => $"'{id.Replace("'", "''")}'"));
+                IQuery query = registryManager.CreateQuery($"SELECT * FROM devices WHERE deviceId IN [{idList}]", maxBatchSize);
+
+                List<Twin> patches = new List<Twin>();
+                while (query.HasMoreResults)
+                {
+                    foreach (Twin twin in await query.GetNextAsTwinAsync())
+                    {
+                        TwinState state = states[twin.DeviceId];
+
+                        // anything changed?
+                        if (!IsDeviceTwinUpdateNeeded(twin.Properties.Desired.ToJson(), state))
+                        {
+                            continue;
+                        }
+
+                        Twin patch = new Twin(twin.DeviceId) { ETag = twin.ETag };
+                        patch.Properties.Desired = new TwinCollection(JsonConvert.SerializeObject(state));
+                        patches.Add(patch);
+                    }
+                }
+
+                if (patches.Count == 0)
+                {
+                    continue;
+                }
+
+                BulkRegistryOperationResult result = await registryManager.UpdateTwins2Async(patches, false);
+                updated += patches.Count;
+                if (!result.IsSuccessful)
+                {
+                    foreach (DeviceRegistryOperationError error in result.Errors)
+                    {
+                        Debug.WriteLine($"Twin update of {error.DeviceId} failed: {error.ErrorCode} {error.ErrorStatus}");
+                        updated--;
+                    }
+                }
+            }
+
+            Debug.WriteLine($"Twin sync: {deviceIds.Count} devices, {states.Count} found, {updated} twins updated");
+        }
+
+        /// <summary>
+        /// The tenant's device, device group and product lists, refetched once they're older than the
+        /// cache lifetime; if a refetch fails the old lists are kept.
+        /// </summary>
+        private TenantLists GetTenantLists(string tenantId, string token)
+        {
+            if (tenants.TryGetValue(tenantId, out TenantLists lists) && DateTime.UtcNow - lists.Fetched < listLifetime)
+            {
+                return lists;
+            }
+
+            List<DeviceInfo> devices = Utils.GetAS3List<DeviceInfo>($"tenants/{tenantId}/devices", token);
+            List<DeviceGroupInfo> deviceGroups = Utils.GetAS3List<DeviceGroupInfo>($"tenants/{tenantId}/devicegroups", token);
+            List<ProductInfo> products = Utils.GetAS3List<ProductInfo>($"tenants/{tenantId}/products", token);
+
+            if (devices == null || deviceGroups == null || products == null)
+            {
+                Debug.WriteLine("Could not list the tenant's devices, device groups or products");
+                return lists ?? new TenantLists
+                {
+                    Fetched = DateTime.MinValue,
+                    Devices = new Dictionary<string, DeviceInfo>(StringComparer.OrdinalIgnoreCase),
+                    DeviceGroups = new Dictionary<string, DeviceGroupInfo>(StringComparer.OrdinalIgnoreCase),
+                    Products = new Dictionary<string, ProductInfo>(StringComparer.OrdinalIgnoreCase)
+                };
+            }
+
+            lists = new TenantLists
+            {
+                Fetched = DateTime.UtcNow,
+                Devices = devices.Where(d => d.DeviceId != null).GroupBy(d => d.DeviceId, StringComparer.OrdinalIgnoreCase)
+                    .ToDictionary(g => g.Key, g => g.First(), StringComparer.OrdinalIgnoreCase),
+                DeviceGroups = deviceGroups.Where(g => g.Id != null).GroupBy(g => g.Id, StringComparer.OrdinalIgnoreCase)
+                    .ToDictionary(g => g.Key, g => g.First(), StringComparer.OrdinalIgnoreCase),
+                Products = products.Where(p => p.Id != null).GroupBy(p => p.Id, StringComparer.OrdinalIgnoreCase)
+                    .ToDictionary(g => g.Key, g => g.First(), StringComparer.OrdinalIgnoreCase)
+            };
+            tenants[tenantId] = lists;
+
+            Debug.WriteLine($"Tenant lists: {lists.Devices.Count} devices, {lists.DeviceGroups.Count} device groups, {lists.Products.Count} products");
+            return lists;
+        }
+
+        private TwinState GetDeviceTwinState(string tenantId, TenantLists lists, string deviceId, string token)
+        {
+            // a device claimed since the lists were fetched is looked up on its own, and added
+            if (!lists.Devices.TryGetValue(deviceId, out DeviceInfo devInfo))
+            {
+                string deviceData = Utils.GetAS3Data($"tenants/{tenantId}/devices/{deviceId}", token);
+                devInfo = string.IsNullOrEmpty(deviceData) ? null : JsonConvert.DeserializeObject<DeviceInfo>(deviceData);
+                if (devInfo == null)
+                {
+                    Debug.WriteLine($"Device {deviceId} not found in the tenant");
+                    return null;
+                }
+                lists.Devices[deviceId] = devInfo;
+            }
+
+            // https://prod.core.sphere.azure.net/v2/tenants/{tenantId}/devicegroups/{deviceGroupId}
+            if (devInfo.DeviceGroupId == null || !lists.DeviceGroups.TryGetValue(devInfo.DeviceGroupId, out DeviceGroupInfo dgInfo))
+            {
+                string deviceGroup = Utils.GetAS3Data($"tenants/{tenantId}/devicegroups/{devInfo.DeviceGroupId}", token);
+                dgInfo = string.IsNullOrEmpty(deviceGroup) ? null : JsonConvert.DeserializeObject<DeviceGroupInfo>(deviceGroup);
+                if (dgInfo == null)
+                {
+                    return null;
+                }
+                lists.DeviceGroups[devInfo.DeviceGroupId] = dgInfo;
+            }
+
+            // https://prod.core.sphere.azure.net/v2/tenants/{tenantId}/products/{productId}
+            if (devInfo.ProductId == null || !lists.Products.TryGetValue(devInfo.ProductId, out ProductInfo prodInfo))
+            {
+                string product = Utils.GetAS3Data($"tenants/{tenantId}/products/{devInfo.ProductId}", token);
+                prodInfo = string.IsNullOrEmpty(product) ? null : JsonConvert.DeserializeObject<ProductInfo>(product);
+                if (prodInfo == null)
+                {
+                    return null;
+                }
+                lists.Products[devInfo.ProductId] = prodInfo;
+            }
+
+            TwinState state = new TwinState
+            {
+                Product = prodInfo.Name,
+                DeviceGroup = dgInfo.Name,
+                RetailEval = dgInfo.OsFeedType == 1 ? true : false,
+                AppUpdatePolicy = AppUpdatePolicies[dgInfo.UpdatePolicy],
+                OSVersion = string.IsNullOrEmpty(devInfo.LastInstalledOSVersion) ? "None" : devInfo.LastInstalledOSVersion
+            };
+
+            Debug.WriteLine($"Device                    : {deviceId}");
+            Debug.WriteLine($"Product                   : {state.Product}");
+            Debug.WriteLine($"Device Group              : {state.DeviceGroup}");
+            Debug.WriteLine($"Retail Eval               : {state.RetailEval}");
+            Debug.WriteLine($"App Update Policy         : {state.AppUpdatePolicy}");
+            Debug.WriteLine($"Last Installed OS Version : {state.OSVersion}");
+
+            return state;
+        }
+
+        static bool IsDeviceTwinUpdateNeeded(string twinJson, TwinState state)
+        {
+            JObject _desired = JObject.Parse(twinJson);
+
+            string twinDesiredOS = (string)_desired["OSVersion"];
+            if (string.IsNullOrEmpty(twinDesiredOS) || twinDesiredOS != state.OSVersion)
+            {
+                Debug.WriteLine("No OS Version, or OS Version doesn't match");
+                return true;
+            }
+
+            string twinDesiredProduct = (string)_desired["Product"];
+            if (string.IsNullOrEmpty(twinDesiredProduct) || twinDesiredProduct != state.Product)
+            {
+                Debug.WriteLine("No Product, or product names don't match");
+                return true;
+            }
+
+            string twinDeviceGroup = (string)_desired["DeviceGroup"];
+            if (string.IsNullOrEmpty(twinDeviceGroup) || twinDeviceGroup != state.DeviceGroup)
+            {
+                Debug.WriteLine("No Device Group, or Device Group names don't match");
+                return true;
+            }
+
+            if (!_desired.ContainsKey("RetailEval"))
+            {
+                Debug.WriteLine("RetailEval not found in JSON");
+                return true;
+            }
+
+            bool twinRetailEval = (bool)_desired["RetailEval"];
+            if (twinRetailEval != state.RetailEval)
+            {
+                Debug.WriteLine("RetailEval doesn't match");
+                return true;
+            }
+
+            string twinUpdtePolicy = (string)_desired["AppUpdatePolicy"];
+            if (string.IsNullOrEmpty(twinUpdtePolicy) || twinUpdtePolicy != state.AppUpdatePolicy)
+            {
+                Debug.WriteLine("No App Update Policy, or App Update Policy names don't match");
+                return true;
+            }
+
+            return false;
+        }
+    }
+}
@@ -8,6 +8,7 @@ using System.Diagnostics;
 using System.Linq;
 using System.Net.Http;
 using System.Text;
+using System.Threading;
 using System.Threading.Tasks;
 
 namespace DevicePropertiesWebHook
@@ -17,27 +18,93 @@ namespace DevicePropertiesWebHook
         private static string keyVaultUrl = "";        // TODO: Add your KeyVault URL here.
 
         /// <summary>
-        /// Attempts to get a Value from Keyvault based on a given key.
+        /// One credential for Key Vault and the Public API, it caches its own tokens
+        /// </summary>
+        private static readonly DefaultAzureCredential credential = new DefaultAzureCredential();
+        private static SecretClient secretClient = null;
+
+        /// <summary>
+        /// Secrets are re-read from Key Vault after this long, so a rotated secret is picked up
+        /// </summary>
+        private static readonly TimeSpan secretLifetime = TimeSpan.FromMinutes(5);
+        private static readonly Dictionary<string, (string Value, DateTimeOffset Expires)> secrets = new Dictionary<string, (string, DateTimeOffset)>();
+
+        /// <summary>
+        /// The Public API token is renewed this long before it expires
+        /// </summary>
+        private static readonly TimeSpan tokenRenewal = TimeSpan.FromMinutes(5);
+        private static Azure.Core.AccessToken as3Token;
+        private static readonly SemaphoreSlim tokenLock = new SemaphoreSlim(1, 1);
+
+        /// <summary>
+        /// Attempts to get a Value from Keyvault based on a given key, cached for a few minutes.
         /// </summary>
         public static string GetKeyVaultString(string Key)
         {
-            var client = new SecretClient(new Uri(keyVaultUrl), new DefaultAzureCredential());
-            KeyVaultSecret secret = client.GetSecret(Key);
+            lock (secrets)
+            {
+                if (secrets.TryGetValue(Key, out var cached) && cached.Expires > DateTimeOffset.UtcNow)
+                {
+                    return cached.Value;
+                }
+
+                if (secretClient == null)
+                {
+                    secretClient = new SecretClient(new Uri(keyVaultUrl), credential);
+                }
+                KeyVaultSecret secret = secretClient.GetSecret(Key);
 
-            return secret.Value;
+                secrets[Key] = (secret.Value, DateTimeOffset.UtcNow + secretLifetime);
+                return secret.Value;
+            }
         }
 
         /// <summary>
-        /// Used to return a Managed Identity token (not Device Code Flow)
+        /// Used to return a Managed Identity token (not Device Code Flow); the token is reused until
+        /// shortly before it expires, and concurrent callers share one request for a new one.
         /// </summary>
         /// <returns></returns>
         public static async Task<string> GetAS3Token()
         {
-            DefaultAzureCredential credential = new DefaultAzureCredential();
-            var result = await credential.GetTokenAsync(new Azure.Core.TokenRequestContext(
-            new[] { "https://firstparty.sphere.azure.net/api/.default" }));
+            await tokenLock.WaitAsync();
+            try
+            {
+                if (as3Token.Token == null || as3Token.ExpiresOn - tokenRenewal <= DateTimeOffset.UtcNow)
+                {
+                    as3Token = await credential.GetTokenAsync(new Azure.Core.TokenRequestContext(
+                    new[] { "https://firstparty.sphere.azure.net/api/.default" }));
+                }
+
+                return as3Token.Token;
+            }
+            finally
+            {
+                tokenLock.Release();
+            }
+        }
+
+        /// <summary>
+        /// Returns a Public API token from Device Code Flow or Managed Identity, or an empty string if there isn't one.
+        /// </summary>
+        public static async Task<string> GetToken(bool useDeviceCodeFlow)
+        {
+            if (!useDeviceCodeFlow)
+            {
+                return await GetAS3Token();
+            }
+
+            // MSAL keeps the token in its own cache, AcquireTokenSilent only renews it when it's due
+            if (ADToken.isAuthComplete())
+            {
+                Debug.WriteLine("AS3 device info...");
+                Microsoft.Identity.Client.AuthenticationResult result = await ADToken.GetAToken();
+                if (result != null)
+                {
+                    return result.AccessToken;
+                }
+            }
 
-            return result.Token;
+            return string.Empty;
         }
 
         /// <summary>
@@ -73,5 +140,49 @@ namespace DevicePropertiesWebHook
             }
             return string.Empty;
         }
+
+        /// <summary>
+        /// One page of a Public API list call
+        /// </summary>
+        private class AS3Page<T>
+        {
+            public List<T> Items { get; set; }
+            public string ContinuationToken { get; set; }
+        }
+
+        /// <summary>
+        /// Gets every item of a Public API list endpoint, following continuation tokens. Returns null on failure.
+        /// </summary>
+        public static List<T> GetAS3List<T>(string EndpointUrl, string token)
+        {
+            List<T> items = new List<T>();
+            string continuation = null;
+            RestClient client = new RestClient(AzureSphereApiUri);
+
+            do
+            {
+                RestRequest request = new RestRequest($"/v2/{EndpointUrl}", Method.GET);
+                request.AddParameter("Authorization", string.Format("Bearer " + token), ParameterType.HttpHeader);
+                if (!string.IsNullOrEmpty(continuation))
+                {
+                    request.AddParameter("Sphere-Continuation", continuation, ParameterType.HttpHeader);
+                }
+
+                var response = client.Execute(request);
+                if (!response.IsSuccessful)
+                {
+                    return null;
+                }
+
+                AS3Page<T> page = JsonConvert.DeserializeObject<AS3Page<T>>(response.Content);
+                if (page?.Items != null)
+                {
+                    items.AddRange(page.Items);
+                }
+                continuation = page?.ContinuationToken;
+            } while (!string.IsNullOrEmpty(continuation));
+
+            return items;
+        }
     }
 }
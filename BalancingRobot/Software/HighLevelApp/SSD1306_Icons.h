@@ -309,7 +309,8 @@ uint8_t imageCopyBuffer[128];
 uint8_t textBuffer[128];
 uint8_t drawBuffer[128];
 
-uint8_t BatteryIcon_Rot180[128];
+// Battery_Icon00 to Battery_Icon100, rotated once at start up
+uint8_t BatteryIcons_Rot180[11][128];
 uint8_t WiFiIcon_Rot180[128];
 uint8_t IotcIcon_Rot180[128];
 uint8_t UpdateIcon_Rot180[128];
@@ -3,5 +3,35 @@
 
 #pragma once
 
-int Log_Debug(const char *fmt, ...);
+#include <stdint.h>
+
+// Each datagram starts with a UdpLogHeader, followed by lineCount lines, each a UdpLogLine and
+// then its text (not NUL terminated). All fields are little endian.
+#define UDPLOG_VERSION 1
+
+typedef enum {
+	UDPLOG_SEVERITY_DEBUG = 0,
+	UDPLOG_SEVERITY_INFO = 1,		// the line starts "info:" or "information:"
+	UDPLOG_SEVERITY_WARNING = 2,	// "warning:"
+	UDPLOG_SEVERITY_ERROR = 3,		// "error:"
+} UdpLogSeverity;
 
+typedef struct __attribute__((packed)) {
+	uint8_t version;				// UDPLOG_VERSION
+	uint8_t lineCount;
+	uint16_t reserved;
+	uint32_t deviceId;				// GetDeviceIdHash of the WLAN MAC address, unless set
+	uint32_t sequence;				// per datagram, from 0 at start up
+	uint32_t dropped;				// lines dropped with the ring full, since start up
+} UdpLogHeader;
+
+typedef struct __attribute__((packed)) {
+	uint32_t timestampMs;			// CLOCK_MONOTONIC when Log_Debug was called
+	uint8_t severity;				// UdpLogSeverity
+	uint8_t reserved;
+	uint16_t length;				// of the text that follows
+} UdpLogLine;
+
+int Log_Debug(const char *fmt, ...);
+// Overrides the device ID sent, for an app that has a better one (from its device certificate, say).
+void UdpLog_SetDeviceId(uint32_t deviceId);
@@ -2,6 +2,7 @@
    Licensed under the MIT License. */
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include <errno.h>
@@ -14,17 +15,220 @@
 
 #include "eventloop_timer_utilities.h"
 
-static int SetTimerPeriod(int timerFd, const struct timespec *initial,
-                          const struct timespec *repeat);
+// All the timers of an event loop share one timerfd, which is armed for the earliest expiry.
+// Timers are kept in a hierarchical timer wheel: level 0 has a slot per tick, and each slot of
+// level n covers a whole turn of level n-1. A timer is filed at the level its expiry falls in,
+// and moves down a level each time the level below completes a turn. Expiries are rounded up to
+// a tick, so timers expiring within the same tick are dispatched by a single wakeup.
+#define TIMER_WHEEL_TICK_MS 10
+#define TIMER_WHEEL_LEVELS 5
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+// Expiries beyond the wheel's range, about 124 days, are filed in its last slot and re-filed
+// when they reach it.
+#define TIMER_WHEEL_MAX_TICKS ((1ull << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS)) - 1)
 
-static int SetTimerPeriod(int timerFd, const struct timespec *initial,
-                          const struct timespec *repeat)
+typedef struct TimerListNode {
+    struct TimerListNode *next;
+    struct TimerListNode *prev;
+} TimerListNode;
+
+typedef struct TimerWheel {
+    EventLoop *eventLoop;
+    int fd;
+    EventRegistration *registration;
+    struct timespec base;
+    // The next tick to dispatch; ticks are counted from base.
+    uint64_t tick;
+    TimerListNode slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    unsigned int timerCount;
+    // Set while timers are dispatched, the timerfd is armed once they've all run.
+    bool dispatching;
+    struct TimerWheel *next;
+} TimerWheel;
+
+struct EventLoopTimer {
+    // Must be first, a node in a slot list is converted back to its timer.
+    TimerListNode node;
+    TimerWheel *wheel;
+    EventLoopTimerHandler handler;
+    bool armed;
+    // Expiry in milliseconds since the wheel was created, it's filed at the tick it falls in.
+    uint64_t expiresMs;
+    // Period in milliseconds, 0 for a one-shot timer. Periodic timers don't drift even if the
+    // period isn't a whole number of ticks.
+    uint64_t periodMs;
+};
+
+static TimerWheel *wheels = NULL;
+
+static void ListInit(TimerListNode *list)
+{
+    list->next = list;
+    list->prev = list;
+}
+
+static bool ListIsEmpty(const TimerListNode *list)
+{
+    return list->next == list;
+}
+
+static void ListAppend(TimerListNode *list, TimerListNode *node)
+{
+    node->prev = list->prev;
+    node->next = list;
+    list->prev->next = node;
+    list->prev = node;
+}
+
+static void ListRemove(TimerListNode *node)
 {
-    static const struct timespec nullTimeSpec = {.tv_sec = 0, .tv_nsec = 0};
-    struct itimerspec newValue = {.it_value = initial ? *initial : nullTimeSpec,
-                                  .it_interval = repeat ? *repeat : nullTimeSpec};
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    ListInit(node);
+}
+
+// Move all the nodes of a list to another, empty, list.
+static void ListMove(TimerListNode *from, TimerListNode *to)
+{
+    if (ListIsEmpty(from)) {
+        ListInit(to);
+        return;
+    }
+
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    ListInit(from);
+}
 
-    if (timerfd_settime(timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) < 0) {
+static uint64_t TimespecToMs(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000 + ((uint64_t)ts->tv_nsec + 999999) / 1000000;
+}
+
+static bool IsZeroTimespec(const struct timespec *ts)
+{
+    return ts == NULL || (ts->tv_sec == 0 && ts->tv_nsec == 0);
+}
+
+// Milliseconds since the wheel was created.
+static uint64_t CurrentMs(const TimerWheel *wheel)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t ms = (int64_t)(now.tv_sec - wheel->base.tv_sec) * 1000 +
+                 (now.tv_nsec - wheel->base.tv_nsec) / 1000000;
+    return ms <= 0 ? 0 : (uint64_t)ms;
+}
+
+// The tick a timer is dispatched at, the first to start at or after its expiry.
+static uint64_t ExpiryTick(const EventLoopTimer *timer)
+{
+    return (timer->expiresMs + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+}
+
+static void FileTimer(TimerWheel *wheel, EventLoopTimer *timer)
+{
+    uint64_t expires = ExpiryTick(timer);
+    unsigned int level = 0;
+    unsigned int slot;
+
+    if (expires < wheel->tick) {
+        // Already due, dispatch with the next tick.
+        slot = wheel->tick & TIMER_WHEEL_SLOT_MASK;
+    } else {
+        uint64_t delta = expires - wheel->tick;
+        if (delta > TIMER_WHEEL_MAX_TICKS) {
+            expires = wheel->tick + TIMER_WHEEL_MAX_TICKS;
+            delta = TIMER_WHEEL_MAX_TICKS;
+        }
+        while (delta >> ((level + 1) * TIMER_WHEEL_SLOT_BITS) != 0) {
+            level++;
+        }
+        slot = (expires >> (level * TIMER_WHEEL_SLOT_BITS)) & TIMER_WHEEL_SLOT_MASK;
+    }
+
+    ListAppend(&wheel->slots[level][slot], &timer->node);
+    wheel->occupied[level] |= 1ull << slot;
+}
+
+static void UnfileTimer(TimerWheel *wheel, EventLoopTimer *timer)
+{
+    TimerListNode *list = timer->node.next;
+    ListRemove(&timer->node);
+
+    // A list that became empty may be a slot list, clear its bit.
+    if (ListIsEmpty(list)) {
+        for (unsigned int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+            TimerListNode *slots = wheel->slots[level];
+            if (list >= slots && list < slots + TIMER_WHEEL_SLOTS) {
+                wheel->occupied[level] &= ~(1ull << (list - slots));
+                break;
+            }
+        }
+    }
+}
+
+// Re-file the timers of a slot one level down, now that the level below has completed a turn.
+// Returns the slot index, the next level up is cascaded too when it's 0.
+static unsigned int CascadeLevel(TimerWheel *wheel, unsigned int level)
+{
+    unsigned int slot =
+        (wheel->tick >> (level * TIMER_WHEEL_SLOT_BITS)) & TIMER_WHEEL_SLOT_MASK;
+    TimerListNode pending;
+    ListMove(&wheel->slots[level][slot], &pending);
+    wheel->occupied[level] &= ~(1ull << slot);
+
+    while (!ListIsEmpty(&pending)) {
+        EventLoopTimer *timer = (EventLoopTimer *)pending.next;
+        ListRemove(&timer->node);
+        FileTimer(wheel, timer);
+    }
+
+    return slot;
+}
+
+// Arm the wheel's timerfd for the earliest expiry, or disarm it if no timer is armed.
+static int ArmWheel(TimerWheel *wheel)
+{
+    bool found = false;
+    uint64_t earliest = 0;
+
+    for (unsigned int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint64_t occupied = wheel->occupied[level];
+        while (occupied != 0) {
+            unsigned int slot = (unsigned int)__builtin_ctzll(occupied);
+            occupied &= occupied - 1;
+            TimerListNode *list = &wheel->slots[level][slot];
+            for (TimerListNode *node = list->next; node != list; node = node->next) {
+                uint64_t expires = ExpiryTick((EventLoopTimer *)node);
+                if (!found || expires < earliest) {
+                    earliest = expires;
+                    found = true;
+                }
+            }
+        }
+    }
+
+    struct itimerspec newValue = {.it_value = {0, 0}, .it_interval = {0, 0}};
+    if (found) {
+        if (earliest < wheel->tick) {
+            earliest = wheel->tick;
+        }
+        uint64_t ms = earliest * TIMER_WHEEL_TICK_MS;
+        newValue.it_value.tv_sec = wheel->base.tv_sec + (time_t)(ms / 1000);
+        newValue.it_value.tv_nsec = wheel->base.tv_nsec + (long)(ms % 1000) * 1000000;
+        if (newValue.it_value.tv_nsec >= 1000000000) {
+            newValue.it_value.tv_sec++;
+            newValue.it_value.tv_nsec -= 1000000000;
+        }
+    }
+
+    if (timerfd_settime(wheel->fd, TFD_TIMER_ABSTIME, &newValue, /* old_value */ NULL) == -1) {
         Log_Debug("ERROR: Could not set timer period: %s (%d).\n", strerror(errno), errno);
         return -1;
     }
@@ -32,65 +236,212 @@ static int SetTimerPeriod(int timerFd, const struct timespec *initial,
     return 0;
 }
 
-struct EventLoopTimer {
-    EventLoop *eventLoop;
-    EventLoopTimerHandler handler;
-    int fd;
-    EventRegistration *registration;
-};
+// Dispatch the timers of every tick up to the current one. Ticks whose level 0 slot is empty
+// are skipped, but never past the end of a turn, where the levels above are cascaded.
+static void RunWheel(TimerWheel *wheel)
+{
+    uint64_t nowMs = CurrentMs(wheel);
+    uint64_t now = nowMs / TIMER_WHEEL_TICK_MS;
+
+    while (wheel->tick <= now) {
+        unsigned int index = wheel->tick & TIMER_WHEEL_SLOT_MASK;
+
+        if (index == 0) {
+            for (unsigned int level = 1;
+                 level < TIMER_WHEEL_LEVELS && CascadeLevel(wheel, level) == 0; level++) {
+            }
+        }
+
+        uint64_t later = wheel->occupied[0] & (~0ull << index);
+        uint64_t turnEnd = (wheel->tick | TIMER_WHEEL_SLOT_MASK) + 1;
+        uint64_t next = later != 0 ? wheel->tick - index + (uint64_t)__builtin_ctzll(later) : turnEnd;
+        if (next > now) {
+            wheel->tick = now + 1;
+            break;
+        }
+        if (next == turnEnd) {
+            wheel->tick = turnEnd;
+            continue;
+        }
+
+        unsigned int slot = (unsigned int)(next & TIMER_WHEEL_SLOT_MASK);
+        TimerListNode due;
+        ListMove(&wheel->slots[0][slot], &due);
+        wheel->occupied[0] &= ~(1ull << slot);
+        // Timers armed by the handlers below are filed relative to the next tick.
+        wheel->tick = next + 1;
+
+        while (!ListIsEmpty(&due)) {
+            EventLoopTimer *timer = (EventLoopTimer *)due.next;
+            ListRemove(&timer->node);
+
+            // A periodic timer is re-filed before its handler runs, which may change or dispose
+            // of it. Like a timerfd, expiries that were missed are reported by a single call.
+            if (timer->periodMs != 0) {
+                timer->expiresMs += timer->periodMs;
+                if (timer->expiresMs <= nowMs) {
+                    timer->expiresMs +=
+                        ((nowMs - timer->expiresMs) / timer->periodMs + 1) * timer->periodMs;
+                }
+                FileTimer(wheel, timer);
+            } else {
+                timer->armed = false;
+            }
+
+            timer->handler(timer);
+        }
+    }
+}
+
+static void DisposeWheel(TimerWheel *wheel)
+{
+    for (TimerWheel **link = &wheels; *link != NULL; link = &(*link)->next) {
+        if (*link == wheel) {
+            *link = wheel->next;
+            break;
+        }
+    }
+
+    EventLoop_UnregisterIo(wheel->eventLoop, wheel->registration);
+
+    if (wheel->fd != -1) {
+        close(wheel->fd);
+    }
+
+    free(wheel);
+}
 
 // This satisfies the EventLoopIoCallback signature.
-static void TimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+static void WheelCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
 {
-    EventLoopTimer *timer = (EventLoopTimer *)context;
+    TimerWheel *wheel = (TimerWheel *)context;
 
-    timer->handler(timer);
+    uint64_t timerData = 0;
+    if (read(wheel->fd, &timerData, sizeof(timerData)) == -1 && errno != EAGAIN) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    wheel->dispatching = true;
+    RunWheel(wheel);
+    wheel->dispatching = false;
+
+    // The handlers may have disposed of every timer.
+    if (wheel->timerCount == 0) {
+        DisposeWheel(wheel);
+        return;
+    }
+
+    ArmWheel(wheel);
 }
 
-EventLoopTimer *CreateEventLoopPeriodicTimer(EventLoop *eventLoop, EventLoopTimerHandler handler,
-                                             const struct timespec *period)
+static TimerWheel *GetWheel(EventLoop *eventLoop)
 {
-    if (handler == NULL) {
-        errno = EINVAL;
-        return NULL;
+    for (TimerWheel *wheel = wheels; wheel != NULL; wheel = wheel->next) {
+        if (wheel->eventLoop == eventLoop) {
+            return wheel;
+        }
     }
 
-    EventLoopTimer *timer = malloc(sizeof(EventLoopTimer));
-    if (timer == NULL) {
+    TimerWheel *wheel = malloc(sizeof(TimerWheel));
+    if (wheel == NULL) {
         return NULL;
     }
 
-    timer->eventLoop = eventLoop;
-    timer->handler = handler;
+    wheel->eventLoop = eventLoop;
+    wheel->tick = 0;
+    wheel->timerCount = 0;
+    wheel->dispatching = false;
+    for (unsigned int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (unsigned int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            ListInit(&wheel->slots[level][slot]);
+        }
+        wheel->occupied[level] = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wheel->base);
 
     // Initialize to unused values in case have to clean up partially initialized object.
-    timer->fd = -1;
-    timer->registration = NULL;
+    wheel->registration = NULL;
+    wheel->next = wheels;
+    wheels = wheel;
 
-    timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
-    if (timer->fd == -1) {
+    wheel->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (wheel->fd == -1) {
         Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
         goto failed;
     }
 
-    if (SetTimerPeriod(timer->fd, /* initial */ period, /* repeat */ period) == -1) {
-        goto failed;
-    }
-
-    timer->registration =
-        EventLoop_RegisterIo(eventLoop, timer->fd, EventLoop_Input, TimerCallback, timer);
-    if (timer->registration == NULL) {
+    wheel->registration =
+        EventLoop_RegisterIo(eventLoop, wheel->fd, EventLoop_Input, WheelCallback, wheel);
+    if (wheel->registration == NULL) {
         Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
         goto failed;
     }
 
-    return timer;
+    return wheel;
 
 failed:
-    DisposeEventLoopTimer(timer);
+    DisposeWheel(wheel);
     return NULL;
 }
 
+static int SetTimerPeriod(EventLoopTimer *timer, const struct timespec *initial,
+                          const struct timespec *repeat)
+{
+    TimerWheel *wheel = timer->wheel;
+
+    if (timer->armed) {
+        UnfileTimer(wheel, timer);
+        timer->armed = false;
+    }
+
+    if (!IsZeroTimespec(initial)) {
+        timer->expiresMs = CurrentMs(wheel) + TimespecToMs(initial);
+        timer->periodMs = IsZeroTimespec(repeat) ? 0 : TimespecToMs(repeat);
+        FileTimer(wheel, timer);
+        timer->armed = true;
+    }
+
+    return wheel->dispatching ? 0 : ArmWheel(wheel);
+}
+
+EventLoopTimer *CreateEventLoopPeriodicTimer(EventLoop *eventLoop, EventLoopTimerHandler handler,
+                                             const struct timespec *period)
+{
+    if (handler == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    TimerWheel *wheel = GetWheel(eventLoop);
+    if (wheel == NULL) {
+        return NULL;
+    }
+
+    EventLoopTimer *timer = malloc(sizeof(EventLoopTimer));
+    if (timer == NULL) {
+        if (wheel->timerCount == 0) {
+            DisposeWheel(wheel);
+        }
+        return NULL;
+    }
+
+    ListInit(&timer->node);
+    timer->wheel = wheel;
+    timer->handler = handler;
+    timer->armed = false;
+    timer->expiresMs = 0;
+    timer->periodMs = 0;
+    wheel->timerCount++;
+
+    if (SetTimerPeriod(timer, /* initial */ period, /* repeat */ period) == -1) {
+        DisposeEventLoopTimer(timer);
+        return NULL;
+    }
+
+    return timer;
+}
+
 EventLoopTimer *CreateEventLoopDisarmedTimer(EventLoop *eventLoop, EventLoopTimerHandler handler)
 {
     return CreateEventLoopPeriodicTimer(eventLoop, handler, NULL);
@@ -102,38 +453,37 @@ void DisposeEventLoopTimer(EventLoopTimer *timer)
         return;
     }
 
-    EventLoop_UnregisterIo(timer->eventLoop, timer->registration);
+    TimerWheel *wheel = timer->wheel;
 
-    if (timer->fd != -1) {
-        close(timer->fd);
+    if (timer->armed) {
+        UnfileTimer(wheel, timer);
     }
 
     free(timer);
+
+    // The timerfd is re-armed on its next expiry, which at worst is now one without a timer.
+    if (--wheel->timerCount == 0 && !wheel->dispatching) {
+        DisposeWheel(wheel);
+    }
 }
 
 int ConsumeEventLoopTimerEvent(EventLoopTimer *timer)
 {
-    uint64_t timerData = 0;
-
-    if (read(timer->fd, &timerData, sizeof(timerData)) == -1) {
-        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
-        return -1;
-    }
-
+    // The shared timerfd was already read when the timer wheel dispatched this timer.
     return 0;
 }
 
 int SetEventLoopTimerPeriod(EventLoopTimer *timer, const struct timespec *period)
 {
-    return SetTimerPeriod(timer->fd, /* initial */ period, /* period */ period);
+    return SetTimerPeriod(timer, /* initial */ period, /* repeat */ period);
 }
 
 int SetEventLoopTimerOneShot(EventLoopTimer *timer, const struct timespec *delay)
 {
-    return SetTimerPeriod(timer->fd, /* initial */ delay, /* repeat */ NULL);
+    return SetTimerPeriod(timer, /* initial */ delay, /* repeat */ NULL);
 }
 
 int DisarmEventLoopTimer(EventLoopTimer *timer)
 {
-    return SetTimerPeriod(timer->fd, /* initial */ NULL, /* repeat */ NULL);
+    return SetTimerPeriod(timer, /* initial */ NULL, /* repeat */ NULL);
 }
@@ -58,7 +58,9 @@ EventLoopTimer *CreateEventLoopDisarmedTimer(EventLoop *eventLoop, EventLoopTime
 void DisposeEventLoopTimer(EventLoopTimer *timer);
 
 /// <summary>
-/// The timer callback should call this function to consume the timer event.
+/// The timer callback should call this function to consume the timer event. All of an event
+/// loop's timers share one timerfd, which has already been read when the callback runs, so this
+/// always succeeds; it's kept so that callbacks written for per-timer timerfds work unchanged.
 /// </summary>
 /// <param name="timer">Successfully allocated timer.</param>
 /// <returns>0 on success, -1 on failure, in which case errno contains more information.</returns>
@@ -0,0 +1,85 @@
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <applibs/log.h>
+#include "intercore.h"
+#include "intercore_messages.h"
+#include "flightrecorder.h"
+
+static int sock = -1;
+static struct sockaddr_in broadcastAddr;
+static uint32_t lastSeq = 0;
+static uint32_t lostBlocks = 0;
+
+static int OpenSocket(void)
+{
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        Log_Debug("ERROR: Unable to create flight recorder socket: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    int yes = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(yes)) == -1) {
+        Log_Debug("ERROR: Unable to enable broadcast: %d (%s)\n", errno, strerror(errno));
+        close(sock);
+        sock = -1;
+        return -1;
+    }
+
+    memset(&broadcastAddr, 0, sizeof(broadcastAddr));
+    broadcastAddr.sin_family = AF_INET;
+    broadcastAddr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    broadcastAddr.sin_port = htons(FLIGHT_RECORDER_PORT);
+    return 0;
+}
+
+int FlightRecorder_SetMode(const char* mode)
+{
+    struct FLIGHT_RECORDER msg = {
+        .id = MSG_FLIGHT_RECORDER
+    };
+
+    if (strcasecmp(mode, "stop") == 0) {
+        msg.mode = FLIGHT_RECORDER_STOP;
+    } else if (strcasecmp(mode, "dump") == 0) {
+        msg.mode = FLIGHT_RECORDER_DUMP;
+    } else if (strcasecmp(mode, "stream") == 0) {
+        msg.mode = FLIGHT_RECORDER_STREAM;
+    } else {
+        Log_Debug("WARNING: Unknown flight recorder mode '%s'\n", mode);
+        return -1;
+    }
+
+    Log_Debug("INFO: Flight recorder %s, %u blocks lost so far\n", mode, lostBlocks);
+    EnqueueIntercoreMessage(&msg, sizeof(msg));
+    return 0;
+}
+
+void FlightRecorder_Forward(const uint8_t* block, size_t size)
+{
+    const struct FLIGHT_BLOCK* pBlock = (const struct FLIGHT_BLOCK*)block;
+
+    if (size < offsetof(struct FLIGHT_BLOCK, data) || size < offsetof(struct FLIGHT_BLOCK, data) + pBlock->size) {
+        Log_Debug("ERROR: Short flight recorder block, %zu bytes\n", size);
+        return;
+    }
+
+    // a dump starts over from the oldest block, only a gap going forward is a loss
+    if (pBlock->seq > lastSeq + 1 && lastSeq != 0) {
+        lostBlocks += pBlock->seq - lastSeq - 1;
+    }
+    lastSeq = pBlock->seq;
+
+    if (sock == -1 && OpenSocket() != 0) {
+        return;
+    }
+
+    if (sendto(sock, block, size, 0, (const struct sockaddr*)&broadcastAddr, sizeof(broadcastAddr)) == -1) {
+        Log_Debug("ERROR: Unable to send flight recorder block: %d (%s)\n", errno, strerror(errno));
+    }
+}
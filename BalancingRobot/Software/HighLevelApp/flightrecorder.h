@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Forwards the M4's flight recorder blocks (MSG_FLIGHT_BLOCK, see intercore_messages.h) to the
+// network, one UDP broadcast datagram per block on FLIGHT_RECORDER_PORT, for a PC on the same
+// network to capture; the block is sent as it came over intercore.
+#define FLIGHT_RECORDER_PORT 1826
+
+// Asks the M4 to stop, dump or stream its flight recorder: "stop", "dump" or "stream", as set by
+// the FlightRecorder device twin property. Returns -1 for any other mode.
+int FlightRecorder_SetMode(const char* mode);
+
+// Sends a MSG_FLIGHT_BLOCK received from the M4.
+void FlightRecorder_Forward(const uint8_t* block, size_t size);
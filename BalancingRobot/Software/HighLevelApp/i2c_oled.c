@@ -6,6 +6,7 @@
 #include <errno.h>
 #include "utils.h"
 #include <string.h>
+#include <pthread.h>
 
 #include "soc/mt3620_i2cs.h"
 #include "applibs/i2c.h"
@@ -17,13 +18,43 @@
 #define SSD1306_TALL_LCDWIDTH 128
 #define SSD1306_TALL_LCDHEIGHT 32
 
+#define SSD1306_MAX_PAGES (SSD1306_WIDE_LCDHEIGHT / 8)
+#define SSD1306_DATA_CHUNK 31      // display bytes per I2C write, after the 0x40 data prefix
+
 static uint8_t displayBuffer[1024]; // 128*64 pixels (128/8)*64 bytes - also covers 32*128 (4x128) = 512
 
+// columns of each page drawn since the last SSD1306_Display, start > end if none
+static int dirtyStart[SSD1306_MAX_PAGES];
+static int dirtyEnd[SSD1306_MAX_PAGES];
+
+// what the panel is showing as of the last flush, so only the columns that changed are sent
+static uint8_t panelBuffer[1024];
+static bool panelKnown = false;
+
+// With the display thread running, SSD1306_Display hands the drawn frame over in frontBuffer and
+// returns; the thread takes the latest one (frames handed over while it's busy replace each other,
+// their dirty spans merged) and does the I2C writes, so a slow bus doesn't hold up the caller.
+static pthread_t displayThread;
+static pthread_mutex_t displayLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t frameCond = PTHREAD_COND_INITIALIZER;
+static bool displayThreadRunning = false;
+static bool displayThreadStop = false;
+static bool frameReady = false;
+static uint8_t frontBuffer[1024];
+static int frontDirtyStart[SSD1306_MAX_PAGES];
+static int frontDirtyEnd[SSD1306_MAX_PAGES];
+
 static void ssd1306_command(uint8_t c);
 static void ssd1306_commands(uint8_t* commands, int numCommands); 
 static void i2cSendBytes(uint8_t* data, size_t length);
 static bool IsPixel(uint8_t* image, int width, int height, int x, int y);
 static void SSD1306_SetPixelInternal(int x, int y, bool turnOn);
+static void MarkDirty(int x, int y, int width, int height);
+static void MarkClean(int* start, int* end);
+static void MergeDirty(int* start, int* end, const int* fromStart, const int* fromEnd);
+static void FlushFrame(const uint8_t* frame, const int* dirtyFrom, const int* dirtyTo);
+static void SendWindow(const uint8_t* frame, int page, int startColumn, int endColumn);
+static void* DisplayThread(void* arg);
 
 static uint8_t oledDisplayAddress = 0x3C;
 static int _i2cfd = -1;
@@ -158,9 +189,11 @@ bool SSD1306_Init(bool useVerticalDisplay)
         ssd1306_command(0xAF); // drivers on
     }
 
+    // whatever the panel had on it, all of it is sent
+    panelKnown = false;
     SSD1306_Clear();
     SSD1306_Display();
-    
+
 
     return true;
 }
@@ -177,6 +210,8 @@ static void ssd1306_commands(uint8_t* commands, int numCommands)
 
 void SSD1306_DrawImage(uint8_t* image, int width, int height, int xOffset, int yOffset)
 {
+    MarkDirty(xOffset, yOffset, width, height);
+
     for (int y = 0; y < height; y++)
     {
         for (int x = 0; x < width; x++)
@@ -288,6 +323,44 @@ static bool IsPixel(uint8_t* image, int width, int height, int x, int y)
 void SSD1306_Clear(void)
 {
     memset(&displayBuffer[0], 0x00, 1024);
+    MarkDirty(0, 0, DisplayWidth, DisplayHeight);
+}
+
+// Widens the dirty column span of the pages under the rectangle, clipped to the display.
+static void MarkDirty(int x, int y, int width, int height)
+{
+    int startColumn = x < 0 ? 0 : x;
+    int endColumn = x + width > DisplayWidth ? DisplayWidth - 1 : x + width - 1;
+    int startPage = y < 0 ? 0 : y / 8;
+    int endPage = y + height > DisplayHeight ? DisplayHeight / 8 - 1 : (y + height - 1) / 8;
+
+    for (int page = startPage; page <= endPage; page++)
+    {
+        if (startColumn < dirtyStart[page])
+            dirtyStart[page] = startColumn;
+        if (endColumn > dirtyEnd[page])
+            dirtyEnd[page] = endColumn;
+    }
+}
+
+static void MarkClean(int* start, int* end)
+{
+    for (int page = 0; page < SSD1306_MAX_PAGES; page++)
+    {
+        start[page] = SSD1306_WIDE_LCDWIDTH;
+        end[page] = -1;
+    }
+}
+
+static void MergeDirty(int* start, int* end, const int* fromStart, const int* fromEnd)
+{
+    for (int page = 0; page < SSD1306_MAX_PAGES; page++)
+    {
+        if (fromStart[page] < start[page])
+            start[page] = fromStart[page];
+        if (fromEnd[page] > end[page])
+            end[page] = fromEnd[page];
+    }
 }
 
 void SSD1306_SetPixel(uint8_t*image, int width, int height, int x, int y, bool turnOn)
@@ -319,43 +392,152 @@ static void ssd1306_command(uint8_t c)
 
 void SSD1306_Display(void)
 {
-    uint8_t pagecol[5] = { 0x22,0x00,0xff,0x21,0x00 };
-    ssd1306_commands(pagecol, 5);
-    ssd1306_command(0x7f);
+    if (!displayThreadRunning)
+    {
+        FlushFrame(displayBuffer, dirtyStart, dirtyEnd);
+        MarkClean(dirtyStart, dirtyEnd);
+        return;
+    }
 
-    uint8_t dataBuffer[32];
-    dataBuffer[0x00] = 0x40;
-    int copyPos = 0;
-    int copyLen = 31;
-    bool haveData = true;
-    int totalSent = 0;
+    pthread_mutex_lock(&displayLock);
+    memcpy(frontBuffer, displayBuffer, (size_t)(DisplayWidth * DisplayHeight / 8));
+    if (!frameReady)
+    {
+        MarkClean(frontDirtyStart, frontDirtyEnd);
+    }
+    MergeDirty(frontDirtyStart, frontDirtyEnd, dirtyStart, dirtyEnd);
+    frameReady = true;
+    pthread_cond_signal(&frameCond);
+    pthread_mutex_unlock(&displayLock);
 
-    int totalBytes = 1024;
+    MarkClean(dirtyStart, dirtyEnd);
+}
 
-    //DumpDisplayBuffer(displayBuffer,DisplayWidth, DisplayHeight);
+bool SSD1306_StartDisplayThread(void)
+{
+    if (displayThreadRunning)
+    {
+        return true;
+    }
 
-    while (haveData)
+    displayThreadStop = false;
+    if (pthread_create(&displayThread, NULL, DisplayThread, NULL) != 0)
     {
-        memcpy(&dataBuffer[1], &displayBuffer[copyPos], copyLen);
-        totalSent += copyLen;
-        i2cSendBytes(dataBuffer, copyLen + 1);
-        copyPos += copyLen;
-        if (totalBytes - copyPos >= 31)
-            copyLen = 31;
-        else
+        Log_Debug("ERROR: could not start the display thread: errno=%d (%s)\n", errno, strerror(errno));
+        return false;
+    }
+    displayThreadRunning = true;
+    return true;
+}
+
+void SSD1306_StopDisplayThread(void)
+{
+    if (!displayThreadRunning)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&displayLock);
+    displayThreadStop = true;
+    pthread_cond_signal(&frameCond);
+    pthread_mutex_unlock(&displayLock);
+
+    // the thread sends the last frame handed over before it exits
+    pthread_join(displayThread, NULL);
+    displayThreadRunning = false;
+}
+
+static void* DisplayThread(void* arg)
+{
+    static uint8_t frame[1024];
+    int start[SSD1306_MAX_PAGES];
+    int end[SSD1306_MAX_PAGES];
+
+    while (true)
+    {
+        pthread_mutex_lock(&displayLock);
+        while (!frameReady && !displayThreadStop)
+        {
+            pthread_cond_wait(&frameCond, &displayLock);
+        }
+        if (!frameReady)
+        {
+            pthread_mutex_unlock(&displayLock);
+            break;
+        }
+        memcpy(frame, frontBuffer, (size_t)(DisplayWidth * DisplayHeight / 8));
+        memcpy(start, frontDirtyStart, sizeof(start));
+        memcpy(end, frontDirtyEnd, sizeof(end));
+        frameReady = false;
+        pthread_mutex_unlock(&displayLock);
+
+        FlushFrame(frame, start, end);
+    }
+
+    return NULL;
+}
+
+// Sends the columns that differ from what the panel shows, one page and column window at a time.
+// Drawing marks what it touched; the comparison with panelBuffer then trims each page's span down
+// to what really changed, since a redraw after SSD1306_Clear is mostly the same pixels again.
+static void FlushFrame(const uint8_t* frame, const int* dirtyFrom, const int* dirtyTo)
+{
+    int pages = DisplayHeight / 8;
+
+    //DumpDisplayBuffer(frame,DisplayWidth, DisplayHeight);
+
+    for (int page = 0; page < pages; page++)
+    {
+        int start = 0;
+        int end = DisplayWidth - 1;
+
+        if (panelKnown)
         {
-            copyLen = totalBytes - copyPos;
+            const uint8_t* drawn = &frame[page * DisplayWidth];
+            const uint8_t* shown = &panelBuffer[page * DisplayWidth];
+
+            start = dirtyFrom[page];
+            end = dirtyTo[page];
+            while (start <= end && drawn[start] == shown[start])
+                start++;
+            while (end >= start && drawn[end] == shown[end])
+                end--;
         }
 
-        if (copyPos >= totalBytes)
-            haveData = false;
+        if (start <= end)
+        {
+            SendWindow(frame, page, start, end);
+        }
+    }
+
+    panelKnown = true;
+}
+
+static void SendWindow(const uint8_t* frame, int page, int startColumn, int endColumn)
+{
+    uint8_t window[6] = { 0x21, (uint8_t)startColumn, (uint8_t)endColumn, 0x22, (uint8_t)page, (uint8_t)page };
+    ssd1306_commands(window, 6);
+
+    uint8_t dataBuffer[SSD1306_DATA_CHUNK + 1];
+    dataBuffer[0x00] = 0x40;
+    int copyPos = page * DisplayWidth + startColumn;
+    int totalBytes = endColumn - startColumn + 1;
+
+    while (totalBytes > 0)
+    {
+        int copyLen = totalBytes < SSD1306_DATA_CHUNK ? totalBytes : SSD1306_DATA_CHUNK;
+        memcpy(&dataBuffer[1], &frame[copyPos], copyLen);
+        memcpy(&panelBuffer[copyPos], &frame[copyPos], copyLen);
+        i2cSendBytes(dataBuffer, copyLen + 1);
+        copyPos += copyLen;
+        totalBytes -= copyLen;
     }
 }
 
 static void i2cSendBytes(uint8_t* data, size_t length)
 {
+    // I2CMaster_Write returns once the transfer is done, no need to pace the writes
     I2CMaster_Write(_i2cfd, oledDisplayAddress, data, length);
-    delay(1);
 }
 
 void SSD1306_FillRegion(uint8_t *image, int width, int height, int x, int y, int regionWidth, int regionHeight, bool turnOn)
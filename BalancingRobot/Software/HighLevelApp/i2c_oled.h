@@ -7,6 +7,9 @@
 
 bool SSD1306_Init(bool useVerticalDisplay);
 void SSD1306_Display(void);
+// Until it's started SSD1306_Display writes to the panel itself; stopping sends the last frame first.
+bool SSD1306_StartDisplayThread(void);
+void SSD1306_StopDisplayThread(void);
 void SSD1306_Clear(void);
 void SSD1306_FillRegion(uint8_t* image, int width, int height, int x, int y, int regionWidth, int regionHeight, bool turnOn);
 void SSD1306_SetPixel(uint8_t *image, int width, int height, int x, int y, bool turnOn);
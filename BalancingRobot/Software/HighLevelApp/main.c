@@ -23,6 +23,7 @@
 #include "MutableStorageKVP.h"
 #include "utils.h"
 #include "intercore.h"
+#include "flightrecorder.h"
 #include "parson.h"
 #include "pthread.h"
 
@@ -63,6 +64,16 @@ static void* UDPReadThread(void* arg);
 void error(char* msg);
 static pthread_t UDP_Thread = 0;
 
+// Sequenced remote control: the controller's last address, for the acknowledgements, and the round
+// trip from forwarding a command to the M4 to its MSG_REMOTE_CMD_ACK, reported with the telemetry.
+static int udpSocket = -1;
+static struct sockaddr_in remoteClient;
+static bool haveRemoteClient = false;
+static pthread_mutex_t remoteClientLock = PTHREAD_MUTEX_INITIALIZER;
+static TelemetryStat remoteLatencyStat;
+static uint32_t MonotonicMs(void);
+static void HandleRemoteCommandAck(const struct REMOTE_CMD_ACK* pAck);
+
 // contains current device information (pitch, yaw, roll, battery).
 struct DEVICE_STATUS device_status;
 
@@ -84,19 +95,30 @@ static const char* GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason
 static const char* getAzureSphereProvisioningResultString(
     AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult);
 // static void SendTelemetry(const unsigned char* key, const unsigned char* value);
-static void SendTelemetryInt(const unsigned char* key, const int value);
 static void SendIoTMessageRaw(const char* message);
 static void SetupAzureClient(void);
 void SocketEventHandler(EventLoop* el, int fd, EventLoop_IoEvents events, void* context);
 void GetCompassDirection(float compassAngle, char* CompassString, size_t length);
 static void TwinReportIntState(const char* propertyName, int propertyValue, int messageVersion);
+static void TwinReportStringState(const char* propertyName, const char* propertyValue, int messageVersion);
 
 static void ShowUpdatingIcon(void);
 static void ShowWaitIcon(void);
 
 static size_t lastDeviceTwinVersion = 0;
 
-static char telemetryMessage[255];
+static char telemetryMessage[512];
+
+// The M4 streams a TELEMETRY_SAMPLE every TELEMETRY_SAMPLE_PERIOD_MS, they're aggregated and sent
+// to IoT Central as one message every TELEMETRY_WINDOW_SAMPLES.
+#define TELEMETRY_SAMPLE_PERIOD_MS 1000
+#define TELEMETRY_WINDOW_SAMPLES 20
+static unsigned long telemetrySamples = 0;     // received since start up
+static TelemetryStat rollStat;
+static TelemetryStat outputStat;
+static void HandleDeviceStatus(const struct DEVICE_STATUS* pDevStatus, bool storeSetpoint);
+static void HandleIntercoreMessage(const uint8_t* msg, size_t size);
+static void SendTelemetryBatch(const struct DEVICE_STATUS* pDevStatus);
 
 enum Icon_Codes {
     None = 0,
@@ -251,12 +273,12 @@ int main(int argc, char* argv[])
         return -1;
     }
 
-    char deviceTwinString[20];
+    int32_t deviceTwinVersion = 0;
     // get last device twin version.
-    if (GetProfileString("DeviceTwinVersion", deviceTwinString, 20) != -1)
+    if (GetProfileInt("DeviceTwinVersion", &deviceTwinVersion))
     {
         // set last DeviceTwin version, so we don't duplicate that behavior.
-        lastDeviceTwinVersion = atol(deviceTwinString);
+        lastDeviceTwinVersion = (size_t)deviceTwinVersion;
     }
 
 
@@ -298,6 +320,9 @@ int main(int argc, char* argv[])
         Log_Debug("Failed to setup data refresh timers...\n");
     }
 
+    // batch the Setpoint/DeviceTwinVersion updates into one mutable storage write
+    InitProfileStrings(eventLoop, 2000);
+
     InitInterCoreCommunications(eventLoop);
 
     // enable the motors on the M4 app.
@@ -321,6 +346,17 @@ int main(int argc, char* argv[])
 	SSD1306_RotateImage(Update_Icon, UpdateIcon_Rot180, 32, 32, 180);
     SSD1306_RotateImage(Update_Icon_Defer_Rejected, Update_Icon_Defer_Rejected_Rot180, 32, 32, 180);
 
+    // UpdateDisplay picks from these rather than rotating on every draw
+    const uint8_t* batteryIcons[11] = { Battery_Icon00, Battery_Icon10, Battery_Icon20, Battery_Icon30, Battery_Icon40,
+        Battery_Icon50, Battery_Icon60, Battery_Icon70, Battery_Icon80, Battery_Icon90, Battery_Icon100 };
+    for (int x = 0; x < 11; x++)
+    {
+        SSD1306_RotateImage((uint8_t*)batteryIcons[x], BatteryIcons_Rot180[x], 32, 32, 180);
+    }
+
+    // the I2C writes for the display happen on their own thread from here on
+    SSD1306_StartDisplayThread();
+
     BatteryLevel = GetBatteryLevel();
 
     // clear wait icon once we have imuStable from intercore comms.
@@ -342,6 +378,8 @@ int main(int argc, char* argv[])
 		}
 	}
 
+    CloseProfileStrings();
+
     // show 'updating' icon.
     if (updateApplied)
     {
@@ -355,6 +393,8 @@ int main(int argc, char* argv[])
         SSD1306_DrawImage(fillBuffer, 32, 128, 0, 0);
         SSD1306_Display();
     }
+
+    SSD1306_StopDisplayThread();
 }
 
 static void ImuStableTimerEventHandler(EventLoopTimer* timer)
@@ -421,19 +461,8 @@ static void BatteryTimerEventHandler(EventLoopTimer* timer)
         return;
     }
 
+    // sent with the next telemetry batch
     BatteryLevel = GetBatteryLevel();
-    SendTelemetryInt("BatteryLevel", BatteryLevel);
-}
-
-static void SendTelemetryInt(const unsigned char* key, const int value)
-{
-    static char eventBuffer[100] = { 0 };
-    static const char* EventMsgTemplate = "{ \"%s\": %d }";
-    int len = snprintf(eventBuffer, sizeof(eventBuffer), EventMsgTemplate, key, value);
-    if (len < 0)
-        return;
-
-    SendIoTMessageRaw(eventBuffer);
 }
 
 /// <summary>
@@ -629,8 +658,10 @@ static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned ch
     Log_Debug("INFO: Device Twin Rx - %s\n", nullTerminatedJsonString);
 
 
+    // The twin document is only read, then freed as a whole, so parse it into a single arena with
+    // its strings left in (and unescaped over) the copy of the payload, which is freed after it.
     JSON_Value* rootProperties = NULL;
-    rootProperties = json_parse_string(nullTerminatedJsonString);
+    rootProperties = json_parse_string_in_situ(nullTerminatedJsonString);
     if (rootProperties == NULL) {
         Log_Debug("WARNING: Cannot parse the string as JSON content.\n");
         goto cleanup;
@@ -642,9 +673,6 @@ static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned ch
         desiredProperties = rootObject;
     }
 
-    char MsgBuffer[10];
-    memset(&MsgBuffer[0], 0x00, 10);
-
     JSON_Value* value = json_object_get_value(desiredProperties, "$version");
 
     bool processMessage = false;
@@ -655,8 +683,7 @@ static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned ch
         if (iVersion > lastDeviceTwinVersion)
         {
             processMessage = true;
-            snprintf(MsgBuffer, 10, "%d", iVersion);
-            WriteProfileString("DeviceTwinVersion", MsgBuffer);
+            WriteProfileInt("DeviceTwinVersion", (int32_t)iVersion);
             lastDeviceTwinVersion = iVersion;
             Log_Debug("Msg Version Updated: %d\n", iVersion);
         }
@@ -693,6 +720,12 @@ static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned ch
         Log_Debug("INFO: Setting 'TURN_NORTH' data: heading: %d\n", compassHeading);
     }
 
+    // "stop", "dump" or "stream" the M4's full rate balance loop trace, see flightrecorder.h
+    const char* recorderMode = json_object_get_string(desiredProperties, "FlightRecorder");
+    if (recorderMode != NULL && FlightRecorder_SetMode(recorderMode) == 0) {
+        TwinReportStringState("FlightRecorder", recorderMode, lastDeviceTwinVersion);
+    }
+
 cleanup:
     // Release the allocated memory.
     json_value_free(rootProperties);
@@ -780,72 +813,21 @@ void UpdateDisplay(uint8_t batteryLevel, bool haveNetwork, bool haveIoTC, int Ap
         return;
     // update the display.
     SSD1306_Clear();
-    memset(BatteryIcon_Rot180, 0x00, 128);
+    static const uint8_t noIcon[128] = { 0 };
+    const uint8_t* batteryIcon = noIcon;
 
     Log_Debug("Battery: %d, Network: %s, IoTC: %s, AppUpdateIcon %d\n", batteryLevel, haveNetwork ? "Yes" : "No", haveIoTC ? "Yes" : "No", AppUpdateIcon);
 
     if (batteryLevel == 255)
     {
-        memcpy(BatteryIcon_Rot180, low_Batt, 128);
+        batteryIcon = low_Batt;
     }
-    else
+    else if (batteryLevel <= 100)
     {
-        if (batteryLevel > 90 && batteryLevel <= 100)
-        {
-            SSD1306_RotateImage(Battery_Icon100, BatteryIcon_Rot180, 32, 32, 180);
-        }
-
-        if (batteryLevel > 80 && batteryLevel <= 90)
-        {
-            SSD1306_RotateImage(Battery_Icon90, BatteryIcon_Rot180, 32, 32, 180);
-        }
-
-        if (batteryLevel > 70 && batteryLevel <= 80)
-        {
-            SSD1306_RotateImage(Battery_Icon80, BatteryIcon_Rot180, 32, 32, 180);
-        }
-
-        if (batteryLevel > 60 && batteryLevel <= 70)
-        {
-            SSD1306_RotateImage(Battery_Icon70, BatteryIcon_Rot180, 32, 32, 180);
-        }
-
-        if (batteryLevel > 50 && batteryLevel <= 60)
-        {
-            SSD1306_RotateImage(Battery_Icon60, BatteryIcon_Rot180, 32, 32, 180);
-        }
-
-        if (batteryLevel > 40 && batteryLevel <= 50)
-        {
-            SSD1306_RotateImage(Battery_Icon50, BatteryIcon_Rot180, 32, 32, 180);
-        }
-
-        if (batteryLevel > 30 && batteryLevel <= 40)
-        {
-            SSD1306_RotateImage(Battery_Icon40, BatteryIcon_Rot180, 32, 32, 180);
-        }
-
-        if (batteryLevel > 20 && batteryLevel <= 30)
-        {
-            SSD1306_RotateImage(Battery_Icon30, BatteryIcon_Rot180, 32, 32, 180);
-        }
-
-        if (batteryLevel > 10 && batteryLevel <= 20)
-        {
-            SSD1306_RotateImage(Battery_Icon20, BatteryIcon_Rot180, 32, 32, 180);
-        }
-
-        if (batteryLevel > 0 && batteryLevel <= 10)
-        {
-            SSD1306_RotateImage(Battery_Icon10, BatteryIcon_Rot180, 32, 32, 180);
-        }
-
-        if (batteryLevel == 0)
-        {
-            SSD1306_RotateImage(Battery_Icon00, BatteryIcon_Rot180, 32, 32, 180);
-        }
+        // 0, then 1-10, 11-20 ... 91-100
+        batteryIcon = BatteryIcons_Rot180[(batteryLevel + 9) / 10];
     }
-    SSD1306_DrawImage(&BatteryIcon_Rot180[0], 32, 32, 96, 0);
+    SSD1306_DrawImage((uint8_t*)batteryIcon, 32, 32, 96, 0);
 
     if (haveNetwork)
     {
@@ -946,12 +928,28 @@ static void IntercoreTimerEventHandler(EventLoopTimer* timer)
         return;
     }
 
-    Log_Debug("Sending telemetry request to M4\n");
-    Log_Debug("Sending telemetry request to M4\n");
-    struct TELEMETRY_REQUEST msg = {
-        .id = MSG_TELEMETRY_REQUEST
-    };
-    EnqueueIntercoreMessage(&msg, sizeof(msg));
+    // (re)start the M4's telemetry stream if nothing came from it since the last tick, it may have restarted
+    static unsigned long lastTelemetrySamples = 0;
+    if (telemetrySamples == lastTelemetrySamples) {
+        Log_Debug("Requesting telemetry stream from M4\n");
+        struct TELEMETRY_STREAM msg = {
+            .id = MSG_TELEMETRY_STREAM,
+            .periodMs = TELEMETRY_SAMPLE_PERIOD_MS
+        };
+        EnqueueIntercoreMessage(&msg, sizeof(msg));
+    }
+    lastTelemetrySamples = telemetrySamples;
+
+    // control loop timing every minute, each report covers the minute before it
+    static unsigned long loopTimingCount = 0;
+    loopTimingCount++;
+    if (loopTimingCount == 12) {
+        loopTimingCount = 0;
+        struct LOOP_TIMING_REQUEST timingMsg = {
+            .id = MSG_LOOP_TIMING_REQUEST
+        };
+        EnqueueIntercoreMessage(&timingMsg, sizeof(timingMsg));
+    }
 }
 
 /// <summary>
@@ -959,10 +957,9 @@ static void IntercoreTimerEventHandler(EventLoopTimer* timer)
 /// </summary>
 void SocketEventHandler(EventLoop* el, int fd, EventLoop_IoEvents events, void* context)
 {
-    // Read response from real-time capable application.
-    char rxBuf[64];
-    int bytesReceived = recv(fd, rxBuf, sizeof(rxBuf), 0);
-    char spBuffer[10];  // used to write the current setpoint to isolated storage.
+    // Read response from real-time capable application, a message or a batch of them.
+    uint8_t rxBuf[INTERCORE_MAX_PAYLOAD];
+    ssize_t bytesReceived = recv(fd, rxBuf, sizeof(rxBuf), 0);
 
     if (bytesReceived == -1) {
         Log_Debug("ERROR: Unable to receive message: %d (%s)\n", errno, strerror(errno));
@@ -973,70 +970,186 @@ void SocketEventHandler(EventLoop* el, int fd, EventLoop_IoEvents events, void*
         return;
     }
 
-    Log_Debug("Have Intercore Msg\n");
     Log_Debug("Have Intercore Msg\n");
 
-    char CompassDirection[10];
+    if (rxBuf[0] != MSG_INTERCORE_BATCH) {
+        HandleIntercoreMessage(rxBuf, (size_t)bytesReceived);
+        return;
+    }
+
+    const struct BATCH_HEADER* pBatch = (const struct BATCH_HEADER*)rxBuf;
+    if ((size_t)bytesReceived < sizeof(struct BATCH_HEADER) || pBatch->version != INTERCORE_WIRE_VERSION) {
+        Log_Debug("ERROR: Dropping intercore batch, version %d expected %d\n",
+            bytesReceived > 1 ? rxBuf[1] : -1, INTERCORE_WIRE_VERSION);
+        return;
+    }
 
-    switch (rxBuf[0]) {
+    // each message is handled where it lies in rxBuf, the packed structs need no alignment
+    const uint8_t* pNext = rxBuf + sizeof(struct BATCH_HEADER);
+    const uint8_t* pEnd = rxBuf + bytesReceived;
+    for (uint8_t i = 0; i < pBatch->count; i++) {
+        const struct BATCH_RECORD* pRecord = (const struct BATCH_RECORD*)pNext;
+        if (pNext + sizeof(struct BATCH_RECORD) > pEnd || pRecord->size == 0 ||
+            pRecord->size > (size_t)(pEnd - pNext) - sizeof(struct BATCH_RECORD)) {
+            Log_Debug("ERROR: Intercore batch truncated at message %d of %d\n", i, pBatch->count);
+            return;
+        }
+        HandleIntercoreMessage(pNext + sizeof(struct BATCH_RECORD), pRecord->size);
+        pNext += sizeof(struct BATCH_RECORD) + pRecord->size;
+    }
+}
+
+/// <summary>
+///     Handle one message from the real-time capable application, in place.
+/// </summary>
+static void HandleIntercoreMessage(const uint8_t* msg, size_t size)
+{
+    switch (msg[0]) {
     case MSG_IMU_STABLE_RESULT:
         // stop timer icon if imuState = true;
-        if (bytesReceived >= sizeof(struct IMU_STABLE_RESULT))
+        if (size >= sizeof(struct IMU_STABLE_RESULT))
         {
-            struct IMU_STABLE_RESULT* pImuResult = (struct IMU_STABLE_RESULT*)rxBuf;
+            const struct IMU_STABLE_RESULT* pImuResult = (const struct IMU_STABLE_RESULT*)msg;
             imuStable = pImuResult->imuStable;
         }
         break;
     case MSG_TURN_DETAILS:
-        if (bytesReceived >= sizeof(struct TURN_DETAILS))
+        if (size >= sizeof(struct TURN_DETAILS))
         {
-            struct TURN_DETAILS* pTurnStatus = (struct TURN_DETAILS*)rxBuf;
+            const struct TURN_DETAILS* pTurnStatus = (const struct TURN_DETAILS*)msg;
             Log_Debug("INFO: Turn Complete: Start Heading %3.2f, End Heading %3.2f\n", pTurnStatus->startHeading, pTurnStatus->endHeading);
         }
         break;
     case MSG_DEVICE_STATUS:
-        if (bytesReceived >= sizeof(struct DEVICE_STATUS))
+        if (size >= sizeof(struct DEVICE_STATUS))
         {
-            struct DEVICE_STATUS* pDevStatus = (struct DEVICE_STATUS*)rxBuf;
-            haveFirstDeviceData = true;
-            // copy latest value to the device status folder.
-            memcpy(&device_status, pDevStatus, sizeof(device_status));
-            GetCompassDirection(pDevStatus->yaw, &CompassDirection[0],10);
-
-            Log_Debug("%8u: Yaw: %3.2f | Roll: %3.2f | Setpoint: %3.2f (output: %3.2f) | Obstacles %u (active: %s) | Turn North: %s\r\n", pDevStatus->timestamp, pDevStatus->yaw, pDevStatus->roll, pDevStatus->setpoint, pDevStatus->output, pDevStatus->numObstaclesDetected, pDevStatus->avoidActive ? "yes" : "no", pDevStatus->turnNorth == true ? "yes" : "no");
-
-            if (pDevStatus->setpoint > 80 && pDevStatus->setpoint < 100)
-            {
-                snprintf(spBuffer, 10, "%3.2f", pDevStatus->setpoint);
-                WriteProfileString("Setpoint", spBuffer);
-            }
+            const struct DEVICE_STATUS* pDevStatus = (const struct DEVICE_STATUS*)msg;
+            HandleDeviceStatus(pDevStatus, true);
 
             static unsigned long telemetryCount = 0;
             telemetryCount++;
 
-            if (telemetryCount == 20)   // 20 seconds.
+            if (telemetryCount == 20)
             {
                 telemetryCount = 0;
-                snprintf(telemetryMessage, 255, "{\"BatteryLevel\": %d, \"Heading\": %d, \"HeadingCompass\": \"%s\", \"ObstaclesAvoided\": %u, \"CurrentApp\": \"%s\" }", BatteryLevel, (int)pDevStatus->yaw, CompassDirection, pDevStatus->numObstaclesDetected, isAppA == true ? "A" : "B");
-                Log_Debug(telemetryMessage);
-                SendIoTMessageRaw(telemetryMessage);
+                SendTelemetryBatch(pDevStatus);
             }
-
-            if (updateDeferred == true && pDevStatus->roll <= 45)
+        }
+        break;
+    case MSG_TELEMETRY_SAMPLE:
+        if (size >= sizeof(struct TELEMETRY_SAMPLE))
+        {
+            const struct TELEMETRY_SAMPLE* pSample = (const struct TELEMETRY_SAMPLE*)msg;
+            struct DEVICE_STATUS status = {
+                .id = MSG_DEVICE_STATUS,
+                .timestamp = pSample->timestamp,
+                .setpoint = pSample->setpoint / 100.0f,
+                .pitch = pSample->pitch / 100.0f,
+                .yaw = pSample->yaw / 100.0f,
+                .roll = pSample->roll / 100.0f,
+                .output = pSample->output / 100.0,
+                .numObstaclesDetected = pSample->numObstaclesDetected,
+                .avoidActive = (pSample->flags & TELEMETRY_FLAG_AVOID_ACTIVE) != 0,
+                .turnNorth = (pSample->flags & TELEMETRY_FLAG_TURN_NORTH) != 0
+            };
+            telemetrySamples++;
+            TelemetryStat_Add(&rollStat, status.roll);
+            TelemetryStat_Add(&outputStat, (float)status.output);
+
+            // the setpoint drifts as the M4 calibrates, it's stored once a window rather than every sample
+            bool windowComplete = rollStat.count >= TELEMETRY_WINDOW_SAMPLES;
+            HandleDeviceStatus(&status, windowComplete);
+            if (windowComplete)
             {
-                SysEvent_ResumeEvent(SysEvent_Events_UpdateReadyForInstall);
-                updateDeferred = false;
-                currentIcon = UpdateApp;
-                UpdateDisplay(BatteryLevel, HaveNetwork, HaveIoTC, currentIcon);
+                SendTelemetryBatch(&status);
             }
         }
         break;
+    case MSG_REMOTE_CMD_ACK:
+        if (size >= sizeof(struct REMOTE_CMD_ACK))
+        {
+            HandleRemoteCommandAck((const struct REMOTE_CMD_ACK*)msg);
+        }
+        break;
+    case MSG_LOOP_TIMING:
+        if (size >= sizeof(struct LOOP_TIMING))
+        {
+            static const char* loopNames[] = { "IMU", "ToF", "Intercore" };
+            const struct LOOP_TIMING* pTiming = (const struct LOOP_TIMING*)msg;
+            const char* loopName = pTiming->loopId < 3 ? loopNames[pTiming->loopId] : "?";
+
+            Log_Debug("INFO: %s loop (%u ms): %u runs, %u missed, %u overruns | max jitter %u us, max response %u us\n",
+                loopName, pTiming->periodMs, pTiming->activations, pTiming->missed, pTiming->overruns,
+                pTiming->maxJitterUs, pTiming->maxResponseUs);
+            Log_Debug("INFO: %s jitter <50/200/1000/2000/5000/more us: %u %u %u %u %u %u | response <25/50/75/100/200/more %%: %u %u %u %u %u %u\n",
+                loopName, pTiming->jitter[0], pTiming->jitter[1], pTiming->jitter[2], pTiming->jitter[3], pTiming->jitter[4], pTiming->jitter[5],
+                pTiming->response[0], pTiming->response[1], pTiming->response[2], pTiming->response[3], pTiming->response[4], pTiming->response[5]);
+        }
+        break;
+    case MSG_FLIGHT_BLOCK:
+        FlightRecorder_Forward(msg, size);
+        break;
     default:
-        Log_Debug("ERROR: Unexpected message id %d from bare-metal\n", rxBuf[0]);
+        Log_Debug("ERROR: Unexpected message id %d from bare-metal\n", msg[0]);
         break;
     }
 }
 
+static void HandleDeviceStatus(const struct DEVICE_STATUS* pDevStatus, bool storeSetpoint)
+{
+    haveFirstDeviceData = true;
+    // copy latest value to the device status folder.
+    memcpy(&device_status, pDevStatus, sizeof(device_status));
+
+    Log_Debug("%8u: Yaw: %3.2f | Roll: %3.2f | Setpoint: %3.2f (output: %3.2f) | Obstacles %u (active: %s) | Turn North: %s\r\n", pDevStatus->timestamp, pDevStatus->yaw, pDevStatus->roll, pDevStatus->setpoint, pDevStatus->output, pDevStatus->numObstaclesDetected, pDevStatus->avoidActive ? "yes" : "no", pDevStatus->turnNorth == true ? "yes" : "no");
+
+    if (storeSetpoint && pDevStatus->setpoint > 80 && pDevStatus->setpoint < 100)
+    {
+        WriteProfileFloat("Setpoint", pDevStatus->setpoint);
+    }
+
+    if (updateDeferred == true && pDevStatus->roll <= 45)
+    {
+        SysEvent_ResumeEvent(SysEvent_Events_UpdateReadyForInstall);
+        updateDeferred = false;
+        currentIcon = UpdateApp;
+        UpdateDisplay(BatteryLevel, HaveNetwork, HaveIoTC, currentIcon);
+    }
+}
+
+// One IoT message with the latest status and, for streamed telemetry, the window's aggregates.
+static void SendTelemetryBatch(const struct DEVICE_STATUS* pDevStatus)
+{
+    char CompassDirection[10];
+    GetCompassDirection(pDevStatus->yaw, &CompassDirection[0], 10);
+
+    char rollText[96] = { 0 };
+    char outputText[96] = { 0 };
+    char latencyText[112] = { 0 };
+    if (rollStat.count > 0)
+    {
+        TelemetryStat_Format(rollText, sizeof(rollText), "Roll", &rollStat);
+        TelemetryStat_Format(outputText, sizeof(outputText), "Output", &outputStat);
+    }
+    // remote control round trips (ms) since the last batch, if the controller sent any
+    if (remoteLatencyStat.count > 0)
+    {
+        TelemetryStat_Format(latencyText, sizeof(latencyText), "RemoteLatency", &remoteLatencyStat);
+    }
+
+    snprintf(telemetryMessage, sizeof(telemetryMessage), "{\"BatteryLevel\": %d, \"Heading\": %d, \"HeadingCompass\": \"%s\", \"ObstaclesAvoided\": %u, \"CurrentApp\": \"%s\"%s%s%s%s%s%s }",
+        BatteryLevel, (int)pDevStatus->yaw, CompassDirection, pDevStatus->numObstaclesDetected, isAppA == true ? "A" : "B",
+        rollStat.count > 0 ? ", " : "", rollText, rollStat.count > 0 ? ", " : "", outputText,
+        remoteLatencyStat.count > 0 ? ", " : "", latencyText);
+
+    TelemetryStat_Reset(&rollStat);
+    TelemetryStat_Reset(&outputStat);
+    TelemetryStat_Reset(&remoteLatencyStat);
+
+    Log_Debug(telemetryMessage);
+    SendIoTMessageRaw(telemetryMessage);
+}
+
 void SendIoTMessageRaw(const char* message)
 {
     bool isNetworkingReady = false;
@@ -1091,6 +1204,28 @@ static void TwinReportIntState(const char* propertyName, int propertyValue, int
     }
 }
 
+static void TwinReportStringState(const char* propertyName, const char* propertyValue, int messageVersion)
+{
+    if (iothubClientHandle == NULL) {
+        Log_Debug("ERROR: client not initialized\n");
+    }
+    else {
+        memset(&reportedPropertiesString[0], 0x00, 120);
+        int len = snprintf(reportedPropertiesString, 120, "{ \"%s\": { \"value\": \"%s\", \"statusCode\": 200, \"status\": \"completed\", \"desiredVersion\": %d }}", propertyName, propertyValue, messageVersion);
+        if (len < 0 || len >= 120)
+            return;
+
+        if (IoTHubDeviceClient_LL_SendReportedState(
+            iothubClientHandle, (unsigned char*)reportedPropertiesString,
+            strlen(reportedPropertiesString), ReportStatusCallback, 0) != IOTHUB_CLIENT_OK) {
+            Log_Debug("ERROR: failed to set reported state for '%s'.\n", propertyName);
+        }
+        else {
+            Log_Debug("INFO: Reported state for '%s' to value '%s'.\n", propertyName, propertyValue);
+        }
+    }
+}
+
 const char* CompassArray[16] = { "N", "NNE", "NE", "ENE", "E", "ESE", "SE", "SSE", "S", "SSW", "SW", "WSW", "W", "WNW", "NW", "NNW" };
 
 void GetCompassDirection(float compassAngle, char* CompassString, size_t length)
@@ -1144,6 +1279,9 @@ static void* UDPReadThread(void* arg)
     remoteCmd.id = MSG_REMOTE_CMD;
     remoteCmd.cmd = 0x04;   //stop (default message).
 
+    struct REMOTE_CMD_SEQ remoteCmdSeq;
+    remoteCmdSeq.id = MSG_REMOTE_CMD_SEQ;
+
     Log_Debug("UDP Rx Thread starting...\n");
 
     /*
@@ -1152,6 +1290,7 @@ static void* UDPReadThread(void* arg)
     sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     if (sockfd < 0)
         error("ERROR opening socket");
+    udpSocket = sockfd;
 
     /* setsockopt: Handy debugging trick that lets
      * us rerun the server immediately after we kill it;
@@ -1206,11 +1345,12 @@ static void* UDPReadThread(void* arg)
                 {
                 case 5:
                     Log_Debug("UDP Reboot\n");
+                    CommitProfileStrings();     // don't lose a batched write
                     PowerManagement_ForceSystemReboot();
                     break;
                 case 6:
                     Log_Debug("Clear Device Twin version\n");
-                    WriteProfileString("DeviceTwinVersion", "0");
+                    WriteProfileInt("DeviceTwinVersion", 0);
                     lastDeviceTwinVersion = 0;
                     break;
                 default:
@@ -1223,10 +1363,50 @@ static void* UDPReadThread(void* arg)
             }
             EnqueueIntercoreMessage(&remoteCmd, sizeof(remoteCmd));
         }
+        // sequenced: 'R', 'T', cmd (0-4), seq and ttl in ms (little endian 16 bit), see MSG_REMOTE_CMD_SEQ;
+        // the M4 keeps the newest, and each one it applies is acknowledged with 'R', 'A', seq, cmd
+        else if (n == 7 && buf[0] == 'R' && buf[1] == 'T' && buf[2] <= 4)
+        {
+            pthread_mutex_lock(&remoteClientLock);
+            remoteClient = clientaddr;
+            haveRemoteClient = true;
+            pthread_mutex_unlock(&remoteClientLock);
+
+            remoteCmdSeq.cmd = buf[2];
+            remoteCmdSeq.seq = (uint16_t)((uint8_t)buf[3] | (uint8_t)buf[4] << 8);
+            remoteCmdSeq.ttlMs = (uint16_t)((uint8_t)buf[5] | (uint8_t)buf[6] << 8);
+            remoteCmdSeq.sentMs = MonotonicMs();
+            EnqueueIntercoreMessage(&remoteCmdSeq, sizeof(remoteCmdSeq));
+        }
     }
     return (void*)0;
 }
 
+static uint32_t MonotonicMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000 + now.tv_nsec / OneMS);
+}
+
+static void HandleRemoteCommandAck(const struct REMOTE_CMD_ACK* pAck)
+{
+    uint32_t roundTrip = MonotonicMs() - pAck->sentMs;
+    TelemetryStat_Add(&remoteLatencyStat, (float)roundTrip);
+    Log_Debug("INFO: Remote command %u (seq %u) applied, %u ms round trip\n", pAck->cmd, pAck->seq, roundTrip);
+
+    pthread_mutex_lock(&remoteClientLock);
+    struct sockaddr_in client = remoteClient;
+    bool haveClient = haveRemoteClient;
+    pthread_mutex_unlock(&remoteClientLock);
+
+    if (haveClient && udpSocket >= 0)
+    {
+        uint8_t reply[5] = { 'R', 'A', (uint8_t)pAck->seq, (uint8_t)(pAck->seq >> 8), pAck->cmd };
+        sendto(udpSocket, reply, sizeof(reply), 0, (struct sockaddr*)&client, sizeof(client));
+    }
+}
+
 void error(char* msg)
 {
     perror(msg);
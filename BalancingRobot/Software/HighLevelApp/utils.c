@@ -3,6 +3,7 @@
 #include <applibs/networking.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 #include <time.h>
 
 bool IsNetworkReady(void)
@@ -45,4 +46,28 @@ int genGuid(unsigned char* buf, size_t len)
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
+
+void TelemetryStat_Reset(TelemetryStat* stat)
+{
+	stat->min = 0.0f;
+	stat->max = 0.0f;
+	stat->sum = 0.0f;
+	stat->count = 0;
+}
+
+void TelemetryStat_Add(TelemetryStat* stat, float value)
+{
+	if (stat->count == 0 || value < stat->min)
+		stat->min = value;
+	if (stat->count == 0 || value > stat->max)
+		stat->max = value;
+	stat->sum += value;
+	stat->count++;
+}
+
+int TelemetryStat_Format(char* buf, size_t size, const char* name, const TelemetryStat* stat)
+{
+	float mean = stat->count == 0 ? 0.0f : stat->sum / (float)stat->count;
+	return snprintf(buf, size, "\"%sMin\": %.2f, \"%sMax\": %.2f, \"%sMean\": %.2f", name, stat->min, name, stat->max, name, mean);
+}
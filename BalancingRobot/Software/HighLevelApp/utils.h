@@ -15,4 +15,17 @@ int genGuid(unsigned char* buf, size_t len);
 
 typedef void(*callback)(void);
 
+// Min, max and mean of the samples added since the last reset.
+typedef struct TelemetryStat {
+    float min;
+    float max;
+    float sum;
+    unsigned int count;
+} TelemetryStat;
+
+void TelemetryStat_Reset(TelemetryStat* stat);
+void TelemetryStat_Add(TelemetryStat* stat, float value);
+// Writes "<name>Min": x, "<name>Max": x, "<name>Mean": x into buf, as snprintf does.
+int TelemetryStat_Format(char* buf, size_t size, const char* name, const TelemetryStat* stat);
+
 #endif
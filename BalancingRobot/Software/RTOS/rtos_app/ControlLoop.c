@@ -0,0 +1,123 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "utils.h"
+#include "ControlLoop.h"
+#include "tx_api.h"
+
+// upper bounds of the jitter buckets, the last bucket takes the rest
+static const uint32_t jitterBucketsUs[LOOP_TIMING_BUCKETS - 1] = { 50, 200, 1000, 2000, 5000 };
+
+// stats is a packed wire struct, so its counters are passed by value rather than by address
+static uint16_t Count(uint16_t counter)
+{
+	return counter != UINT16_MAX ? counter + 1 : counter;
+}
+
+static void ResetStats(ControlLoop* loop)
+{
+	memset(&loop->stats, 0x00, sizeof(loop->stats));
+	loop->stats.id = MSG_LOOP_TIMING;
+	loop->stats.loopId = loop->id;
+	loop->stats.periodMs = (uint16_t)loop->periodMs;
+}
+
+// time since release, or 0 if the release was due later (the first one came in late)
+static uint32_t SinceRelease(ControlLoop* loop)
+{
+	int32_t elapsed = (int32_t)(micros() - loop->releaseUs);
+	return elapsed > 0 ? (uint32_t)elapsed : 0;
+}
+
+UINT ControlLoop_Create(ControlLoop* loop, const char* name, uint8_t id, uint32_t periodMs)
+{
+	memset(loop, 0x00, sizeof(*loop));
+	loop->name = name;
+	loop->id = id;
+	loop->periodMs = periodMs;
+	loop->periodTicks = periodMs / CONTROL_LOOP_TICK_MS;
+	loop->countdown = loop->periodTicks;
+	ResetStats(loop);
+
+	return tx_event_flags_create(&loop->flags, (CHAR*)name);
+}
+
+void ControlLoop_Tick(ControlLoop* loop)
+{
+	if (--loop->countdown != 0)
+		return;
+
+	loop->countdown = loop->periodTicks;
+	// later releases are due a whole number of periods after the first, so they don't drift
+	if (loop->releases == 0)
+		loop->firstReleaseUs = micros();
+	loop->releases++;
+
+	if (tx_event_flags_set(&loop->flags, 0x1, TX_OR) != TX_SUCCESS)
+	{
+		printf("failed to set %s event flags\r\n", loop->name);
+	}
+}
+
+void ControlLoop_Wait(ControlLoop* loop)
+{
+	ULONG actual_flags = 0;
+	uint32_t release = 0;
+
+	// a release which came while the last activation was starting has already been taken
+	do
+	{
+		tx_event_flags_get(&loop->flags, 0x1, TX_OR_CLEAR, &actual_flags, TX_WAIT_FOREVER);
+		release = loop->releases;
+	} while (release == loop->activated);
+
+	// releases that came and went while the thread was still busy or waiting to run
+	if (release - loop->activated > 1)
+	{
+		uint32_t missed = release - loop->activated - 1;
+		loop->stats.missed = missed > (uint32_t)(UINT16_MAX - loop->stats.missed) ? UINT16_MAX : loop->stats.missed + missed;
+	}
+	loop->activated = release;
+	loop->releaseUs = loop->firstReleaseUs + (release - 1) * loop->periodMs * 1000;
+
+	uint32_t jitter = SinceRelease(loop);
+	int bucket = 0;
+	while (bucket < LOOP_TIMING_BUCKETS - 1 && jitter >= jitterBucketsUs[bucket])
+		bucket++;
+	loop->stats.jitter[bucket] = Count(loop->stats.jitter[bucket]);
+	if (jitter > loop->stats.maxJitterUs)
+		loop->stats.maxJitterUs = jitter;
+}
+
+void ControlLoop_Done(ControlLoop* loop)
+{
+	uint32_t periodUs = loop->periodMs * 1000;
+	uint32_t response = SinceRelease(loop);
+
+	// quarters of the period up to the deadline, then within two periods, then beyond
+	int bucket = response < periodUs ? (int)(response * 4 / periodUs) : response < periodUs * 2 ? 4 : 5;
+	loop->stats.response[bucket] = Count(loop->stats.response[bucket]);
+	if (response > loop->stats.maxResponseUs)
+		loop->stats.maxResponseUs = response;
+
+	if (response > periodUs)
+	{
+		loop->stats.overruns = Count(loop->stats.overruns);
+#ifdef SHOW_DEBUG_MSGS
+		printf("%s overrun: %u us (period %u ms)\r\n", loop->name, response, loop->periodMs);
+#endif
+	}
+	loop->stats.activations++;
+}
+
+void ControlLoop_Report(ControlLoop* loop)
+{
+	struct LOOP_TIMING msg;
+
+	// the loop's own thread may preempt this one mid copy
+	UINT posture = tx_interrupt_control(TX_INT_DISABLE);
+	msg = loop->stats;
+	ResetStats(loop);
+	tx_interrupt_control(posture);
+
+	EnqueueIntercoreMessage(&msg, sizeof(msg));
+}
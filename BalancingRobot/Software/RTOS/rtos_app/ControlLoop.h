@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "tx_api.h"
+#include "intercore_messages.h"
+
+// Periodic loops released from the 5 ms timer; every period is a multiple of it.
+#define CONTROL_LOOP_TICK_MS 5
+
+// A thread run once per period. The timer releases it, the thread waits for the release, does its
+// work, and marks it done; each activation's deadline is the next release. Per rate-monotonic
+// scheduling, the shorter the period the higher the thread's priority should be.
+typedef struct ControlLoop {
+	const char* name;
+	uint8_t id;					// LOOP_ID_*
+	uint32_t periodMs;
+	uint32_t periodTicks;
+	uint32_t countdown;
+	TX_EVENT_FLAGS_GROUP flags;
+
+	// written by the timer
+	uint32_t firstReleaseUs;
+	volatile uint32_t releases;
+
+	// written by the loop's thread
+	uint32_t activated;			// release the current, or last, activation was for
+	uint32_t releaseUs;			// when that release was due
+	struct LOOP_TIMING stats;	// since the last report
+} ControlLoop;
+
+UINT ControlLoop_Create(ControlLoop* loop, const char* name, uint8_t id, uint32_t periodMs);
+// Called from the timer every CONTROL_LOOP_TICK_MS.
+void ControlLoop_Tick(ControlLoop* loop);
+// Waits for the next release, then records how late the activation started.
+void ControlLoop_Wait(ControlLoop* loop);
+// Records how long the activation took against its deadline.
+void ControlLoop_Done(ControlLoop* loop);
+// Sends the loop's timing to the HL app and starts a new report.
+void ControlLoop_Report(ControlLoop* loop);
@@ -1,4 +1,6 @@
 #pragma once
 
 static const uint8_t pca9546aAddress = 0x70;
+// Channel for the ToF transfers that follow, the I2C queue switches to it ahead of the first.
 bool SelectFanoutChannel(uint8_t channelNumber);
+uint8_t GetFanoutChannel(void);
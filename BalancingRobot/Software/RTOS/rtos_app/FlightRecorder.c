@@ -0,0 +1,149 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "utils.h"
+#include "intercore_messages.h"
+#include "FlightRecorder.h"
+
+// worst case of a sample, a 5 byte time delta and five 3 byte values
+#define MAX_SAMPLE_SIZE (5 + 5 * 3)
+
+static struct FLIGHT_BLOCK blocks[FLIGHT_RECORDER_BLOCKS];
+
+// written by the hardware thread
+static volatile uint32_t writeSeq = 0;		// block being filled
+static bool started = false;
+static FlightSample last;
+static uint32_t lastMs = 0;
+
+// the Intercore thread's
+static uint8_t mode = FLIGHT_RECORDER_STOP;
+static uint32_t sendSeq = 0;				// next block to send
+static uint32_t dumpEnd = 0;				// a dump stops before this block
+
+static size_t PutVarint(uint8_t* out, uint32_t value)
+{
+	size_t n = 0;
+	while (value >= 0x80)
+	{
+		out[n++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	out[n++] = (uint8_t)value;
+	return n;
+}
+
+static size_t PutDelta(uint8_t* out, int16_t value, int16_t previous)
+{
+	int32_t delta = (int32_t)value - previous;
+	return PutVarint(out, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+}
+
+static struct FLIGHT_BLOCK* StartBlock(uint32_t seq, uint32_t timeMs)
+{
+	// publish the block as taken before writing over it, the sender checks this after its copy
+	__atomic_store_n(&writeSeq, seq, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	struct FLIGHT_BLOCK* block = &blocks[seq % FLIGHT_RECORDER_BLOCKS];
+	block->id = MSG_FLIGHT_BLOCK;
+	block->count = 0;
+	block->size = 0;
+	block->seq = seq;
+	block->startMs = timeMs;
+
+	// the first sample of a block is against zero, so the block decodes on its own
+	memset(&last, 0x00, sizeof(last));
+	lastMs = timeMs;
+	return block;
+}
+
+void FlightRecorder_Record(uint32_t timeMs, const FlightSample* sample)
+{
+	uint32_t seq = writeSeq;
+	struct FLIGHT_BLOCK* block = &blocks[seq % FLIGHT_RECORDER_BLOCKS];
+
+	if (!started)
+	{
+		block = StartBlock(0, timeMs);
+		started = true;
+	}
+	else if (block->size + MAX_SAMPLE_SIZE > FLIGHT_BLOCK_DATA_SIZE || block->count == UINT8_MAX)
+	{
+		block = StartBlock(seq + 1, timeMs);
+	}
+
+	uint8_t* out = &block->data[block->size];
+	size_t n = PutVarint(out, timeMs - lastMs);
+	n += PutDelta(&out[n], sample->roll, last.roll);
+	n += PutDelta(&out[n], sample->setpoint, last.setpoint);
+	n += PutDelta(&out[n], sample->output, last.output);
+	n += PutDelta(&out[n], sample->dutyLeft, last.dutyLeft);
+	n += PutDelta(&out[n], sample->dutyRight, last.dutyRight);
+
+	block->size += (uint16_t)n;
+	block->count++;
+	last = *sample;
+	lastMs = timeMs;
+}
+
+void FlightRecorder_Control(uint8_t newMode)
+{
+	uint32_t current = __atomic_load_n(&writeSeq, __ATOMIC_ACQUIRE);
+
+	switch (newMode)
+	{
+	case FLIGHT_RECORDER_DUMP:
+		// the complete blocks still in the ring, as of now
+		sendSeq = current >= FLIGHT_RECORDER_BLOCKS - 1 ? current - (FLIGHT_RECORDER_BLOCKS - 1) : 0;
+		dumpEnd = current;
+		break;
+	case FLIGHT_RECORDER_STREAM:
+		sendSeq = current;
+		break;
+	case FLIGHT_RECORDER_STOP:
+		break;
+	default:
+		return;
+	}
+	mode = newMode;
+}
+
+int FlightRecorder_Send(OutboxSend send)
+{
+	struct FLIGHT_BLOCK copy;
+	int sent = 0;
+
+	while (mode != FLIGHT_RECORDER_STOP && sent < FLIGHT_RECORDER_SEND_BLOCKS)
+	{
+		uint32_t current = __atomic_load_n(&writeSeq, __ATOMIC_ACQUIRE);
+
+		if (mode == FLIGHT_RECORDER_DUMP && sendSeq >= dumpEnd)
+		{
+			mode = FLIGHT_RECORDER_STOP;
+			break;
+		}
+		// only complete blocks are sent
+		if (sendSeq >= current)
+			break;
+		// fallen a ring behind, those blocks are gone
+		if (current - sendSeq >= FLIGHT_RECORDER_BLOCKS)
+		{
+			sendSeq = current - (FLIGHT_RECORDER_BLOCKS - 1);
+			continue;
+		}
+
+		memcpy(&copy, &blocks[sendSeq % FLIGHT_RECORDER_BLOCKS], sizeof(copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		// the writer started over this block while it was being copied
+		if (__atomic_load_n(&writeSeq, __ATOMIC_RELAXED) - sendSeq >= FLIGHT_RECORDER_BLOCKS)
+			continue;
+
+		if (!send(&copy, offsetof(struct FLIGHT_BLOCK, data) + copy.size))
+			break;
+		sendSeq++;
+		sent++;
+	}
+	return sent;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "IntercoreOutbox.h"
+
+// Full rate trace of the balance loop, for tuning it: every activation's roll, setpoint, PID output
+// and motor duty, delta encoded into a ring of MSG_FLIGHT_BLOCKs in TCM (see intercore_messages.h
+// for the encoding). A sample takes 6 to 8 bytes, so the ring holds about 25 seconds at 200 Hz;
+// streaming to the HL app keeps the whole run.
+//
+// The hardware thread records, the Intercore thread sends. A block is only sent once complete, and
+// the writer only comes back to it FLIGHT_RECORDER_BLOCKS blocks later, so the sender copies it
+// without a lock and checks afterwards that the writer hadn't got round to it in the meantime.
+
+#ifndef FLIGHT_RECORDER_BLOCKS
+#define FLIGHT_RECORDER_BLOCKS 160		// 212 bytes each
+#endif
+
+// Most blocks sent per activation of the Intercore thread, each is a frame of its own.
+#define FLIGHT_RECORDER_SEND_BLOCKS 4
+
+typedef struct {
+	int16_t roll;			// hundredths of a degree
+	int16_t setpoint;		// hundredths of a degree
+	int16_t output;			// hundredths
+	int16_t dutyLeft;		// negative driving backwards
+	int16_t dutyRight;
+} FlightSample;
+
+// Adds the balance loop's sample at timeMs; hardware thread only.
+void FlightRecorder_Record(uint32_t timeMs, const FlightSample* sample);
+
+// FLIGHT_RECORDER_STOP, _DUMP or _STREAM, from MSG_FLIGHT_RECORDER; Intercore thread only.
+void FlightRecorder_Control(uint8_t mode);
+
+// Sends up to FLIGHT_RECORDER_SEND_BLOCKS blocks due by the mode through send, a block send refuses
+// is sent next time. Returns the number sent; Intercore thread only.
+int FlightRecorder_Send(OutboxSend send);
@@ -0,0 +1,192 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "utils.h"
+#include "I2CQueue.h"
+#include "FanOut.h"
+#include "os_hal_i2c.h"
+#include "tx_api.h"
+
+#define I2C_SERVER_STACK_SIZE 1024
+
+typedef struct {
+	i2c_num bus;
+	TX_THREAD thread;
+	TX_QUEUE queue;
+	ULONG queueStorage[I2C_QUEUE_DEPTH];
+	uint8_t selectedChannel;	// FanOut channel last written, 0 if unknown
+} I2CBus;
+
+static I2CBus buses[I2C_QUEUE_BUSES];
+
+// Transfers larger than 8 bytes must be in sysram (they go by DMA), only the servers touch these
+static __attribute__((section(".sysram"))) uint8_t writeBuffers[I2C_QUEUE_BUSES][I2C_MAX_TRANSFER];
+static __attribute__((section(".sysram"))) uint8_t readBuffers[I2C_QUEUE_BUSES][I2C_MAX_TRANSFER];
+
+static int RunStep(i2c_num bus, const I2CStep* step)
+{
+	uint8_t* writeBuffer = writeBuffers[bus];
+	uint8_t* readBuffer = readBuffers[bus];
+	int result = 0;
+
+	__builtin_memcpy(writeBuffer, step->tx, step->txLen);
+
+	switch (step->type)
+	{
+	case I2C_STEP_WRITE:
+		result = mtk_os_hal_i2c_write(bus, step->address, writeBuffer, step->txLen);
+		break;
+	case I2C_STEP_READ:
+		result = mtk_os_hal_i2c_read(bus, step->address, readBuffer, step->rxLen);
+		break;
+	case I2C_STEP_WRITE_READ:
+		result = mtk_os_hal_i2c_write_read(bus, step->address, writeBuffer, readBuffer, step->txLen, step->rxLen);
+		break;
+	}
+
+	if (result >= 0 && step->rxLen > 0)
+	{
+		__builtin_memcpy(step->rx, readBuffer, step->rxLen);
+	}
+	return result < 0 ? result : 0;
+}
+
+static void I2CServer(ULONG busIndex)
+{
+	I2CBus* b = &buses[busIndex];
+	I2CTransaction* t = NULL;
+
+	while (1)
+	{
+		if (tx_queue_receive(&b->queue, &t, TX_WAIT_FOREVER) != TX_SUCCESS)
+			continue;
+
+		int result = 0;
+		// the switch takes effect on the write's stop condition, so the steps can follow straight away
+		if (t->fanoutChannel != 0 && t->fanoutChannel != b->selectedChannel)
+		{
+			I2CStep select = { .type = I2C_STEP_WRITE, .address = pca9546aAddress, .txLen = 1, .tx = { t->fanoutChannel } };
+			result = RunStep(b->bus, &select);
+			b->selectedChannel = result == 0 ? t->fanoutChannel : 0;
+		}
+
+		for (int step = 0; step < t->stepCount && result == 0; step++)
+		{
+			result = RunStep(b->bus, &t->steps[step]);
+		}
+		t->result = result;
+
+		if (t->events != NULL)
+		{
+			tx_event_flags_set(t->events, t->flag, TX_OR);
+		}
+	}
+}
+
+UINT I2CQueue_Init(TX_BYTE_POOL* pool, UINT priority)
+{
+	static const char* names[I2C_QUEUE_BUSES] = { "I2C ISU0", "I2C ISU1" };
+
+	for (int x = 0; x < I2C_QUEUE_BUSES; x++)
+	{
+		I2CBus* b = &buses[x];
+		CHAR* stack = NULL;
+		b->bus = (i2c_num)(OS_HAL_I2C_ISU0 + x);
+
+		UINT status = tx_queue_create(&b->queue, (CHAR*)names[x], TX_1_ULONG, b->queueStorage, sizeof(b->queueStorage));
+		if (status == TX_SUCCESS)
+			status = tx_byte_allocate(pool, (VOID**)&stack, I2C_SERVER_STACK_SIZE, TX_NO_WAIT);
+		if (status == TX_SUCCESS)
+			status = tx_thread_create(&b->thread, (CHAR*)names[x], I2CServer, (ULONG)x,
+				stack, I2C_SERVER_STACK_SIZE, priority, priority, TX_NO_TIME_SLICE, TX_AUTO_START);
+		if (status != TX_SUCCESS)
+		{
+			printf("failed to start the %s server (%u)\r\n", names[x], status);
+			return status;
+		}
+	}
+	return TX_SUCCESS;
+}
+
+void I2CTransaction_Init(I2CTransaction* t, i2c_num bus)
+{
+	t->bus = bus;
+	t->fanoutChannel = 0;
+	t->stepCount = 0;
+	t->result = 0;
+	t->events = NULL;
+	t->flag = 0;
+}
+
+static I2CStep* AddStep(I2CTransaction* t, I2CStepType type, uint8_t address, const uint8_t* tx, uint8_t txLen, uint8_t* rx, uint8_t rxLen)
+{
+	if (t->stepCount == I2C_MAX_STEPS || txLen > sizeof(t->steps[0].tx) || rxLen > I2C_MAX_TRANSFER)
+	{
+		printf("I2C transaction too large\r\n");
+		return NULL;
+	}
+
+	I2CStep* step = &t->steps[t->stepCount++];
+	step->type = type;
+	step->address = address;
+	step->txLen = txLen;
+	step->rxLen = rxLen;
+	step->rx = rx;
+	if (txLen > 0)
+		__builtin_memcpy(step->tx, tx, txLen);
+	return step;
+}
+
+bool I2CTransaction_AddWrite(I2CTransaction* t, uint8_t address, const uint8_t* tx, uint8_t txLen)
+{
+	return AddStep(t, I2C_STEP_WRITE, address, tx, txLen, NULL, 0) != NULL;
+}
+
+bool I2CTransaction_AddRead(I2CTransaction* t, uint8_t address, uint8_t* rx, uint8_t rxLen)
+{
+	return AddStep(t, I2C_STEP_READ, address, NULL, 0, rx, rxLen) != NULL;
+}
+
+bool I2CTransaction_AddWriteRead(I2CTransaction* t, uint8_t address, const uint8_t* tx, uint8_t txLen, uint8_t* rx, uint8_t rxLen)
+{
+	return AddStep(t, I2C_STEP_WRITE_READ, address, tx, txLen, rx, rxLen) != NULL;
+}
+
+UINT I2CQueue_Submit(I2CTransaction* t, bool urgent)
+{
+	I2CBus* b = &buses[t->bus - OS_HAL_I2C_ISU0];
+
+	if (t->events != NULL)
+	{
+		ULONG discard;
+		tx_event_flags_get(t->events, t->flag, TX_OR_CLEAR, &discard, TX_NO_WAIT);
+	}
+
+	return urgent ? tx_queue_front_send(&b->queue, &t, TX_NO_WAIT) : tx_queue_send(&b->queue, &t, TX_NO_WAIT);
+}
+
+int I2CQueue_Run(I2CTransaction* t, bool urgent)
+{
+	TX_EVENT_FLAGS_GROUP done;
+	ULONG actual_flags = 0;
+
+	if (tx_event_flags_create(&done, "i2c done") != TX_SUCCESS)
+		return -1;
+	t->events = &done;
+	t->flag = 0x1;
+
+	int result = -1;
+	if (I2CQueue_Submit(t, urgent) == TX_SUCCESS)
+	{
+		tx_event_flags_get(&done, 0x1, TX_OR_CLEAR, &actual_flags, TX_WAIT_FOREVER);
+		result = t->result;
+	}
+	else
+	{
+		printf("I2C queue full\r\n");
+	}
+
+	t->events = NULL;
+	tx_event_flags_delete(&done);
+	return result;
+}
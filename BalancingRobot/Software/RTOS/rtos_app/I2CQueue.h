@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "os_hal_i2c.h"
+#include "tx_api.h"
+
+// Every transfer on an I2C bus goes through that bus's queue. A server thread per bus runs the
+// queued transactions one at a time, so the steps of a transaction (a FanOut channel select and the
+// reads that follow it, say) are never interleaved with another thread's. Completion is signalled
+// on a ThreadX event flags group, so the submitting thread is free until it needs the result.
+// The server also tracks which FanOut channel is selected, and switches it ahead of a transaction
+// for another channel, so a thread moving between ToF sensors costs no transfer unless needed.
+
+#define I2C_QUEUE_BUSES 2			// OS_HAL_I2C_ISU0 (IMU), OS_HAL_I2C_ISU1 (ToF and FanOut)
+#define I2C_QUEUE_DEPTH 8
+#define I2C_MAX_STEPS 4
+#define I2C_MAX_TRANSFER 32		// per step, bounded by the server's .sysram buffers
+
+typedef enum {
+	I2C_STEP_WRITE,
+	I2C_STEP_READ,
+	I2C_STEP_WRITE_READ,		// repeated start between the write and the read
+} I2CStepType;
+
+typedef struct {
+	I2CStepType type;
+	uint8_t address;
+	uint8_t txLen;
+	uint8_t rxLen;
+	uint8_t tx[8];				// register address and/or data, copied into the transaction
+	uint8_t* rx;				// caller's buffer
+} I2CStep;
+
+typedef struct {
+	i2c_num bus;
+	uint8_t fanoutChannel;		// PCA9546A channel the steps are for, 0 if they don't go through it
+	uint8_t stepCount;
+	I2CStep steps[I2C_MAX_STEPS];
+	volatile int result;		// 0, or the HAL error of the step that failed (later steps are skipped)
+
+	// set with flag once the transaction has run, if not NULL
+	TX_EVENT_FLAGS_GROUP* events;
+	ULONG flag;
+} I2CTransaction;
+
+// Creates, and starts, the server threads, their stacks come from pool.
+UINT I2CQueue_Init(TX_BYTE_POOL* pool, UINT priority);
+
+void I2CTransaction_Init(I2CTransaction* t, i2c_num bus);
+bool I2CTransaction_AddWrite(I2CTransaction* t, uint8_t address, const uint8_t* tx, uint8_t txLen);
+bool I2CTransaction_AddRead(I2CTransaction* t, uint8_t address, uint8_t* rx, uint8_t rxLen);
+bool I2CTransaction_AddWriteRead(I2CTransaction* t, uint8_t address, const uint8_t* tx, uint8_t txLen, uint8_t* rx, uint8_t rxLen);
+
+// Queues t, ahead of the other waiting transactions if urgent; t and its rx buffers must stay
+// valid until it completes. Returns TX_SUCCESS, or TX_QUEUE_FULL.
+UINT I2CQueue_Submit(I2CTransaction* t, bool urgent);
+// Submits t and waits for it, returns its result (-1 if it couldn't be queued).
+int I2CQueue_Run(I2CTransaction* t, bool urgent);
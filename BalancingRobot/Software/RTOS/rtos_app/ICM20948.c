@@ -0,0 +1,248 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "utils.h"
+#include "I2CQueue.h"
+#include "ICM20948.h"
+#include "tx_api.h"
+
+// user bank 0
+#define REG_WHO_AM_I 0x00
+#define REG_USER_CTRL 0x03
+#define REG_PWR_MGMT_1 0x06
+#define REG_PWR_MGMT_2 0x07
+#define REG_INT_PIN_CFG 0x0F
+#define REG_FIFO_EN_2 0x67
+#define REG_FIFO_RST 0x68
+#define REG_FIFO_MODE 0x69
+#define REG_FIFO_COUNTH 0x70
+#define REG_FIFO_R_W 0x72
+#define REG_BANK_SEL 0x7F
+
+// user bank 2
+#define REG_GYRO_SMPLRT_DIV 0x00
+#define REG_GYRO_CONFIG_1 0x01
+#define REG_ACCEL_SMPLRT_DIV_1 0x10
+#define REG_ACCEL_SMPLRT_DIV_2 0x11
+#define REG_ACCEL_CONFIG 0x14
+
+#define WHO_AM_I_ICM20948 0xEA
+#define SAMPLE_RATE_DIV 4					// 1125 Hz / (1 + 4)
+#define SENSOR_CONFIG 0x1B					// 51 Hz low pass, +-4 g or +-500 dps
+
+// AK09916, reached through bypass
+#define AK09916_ADDRESS 0x0C
+#define AK09916_WIA2 0x01
+#define AK09916_ST1 0x10					// ST1, HXL..HZH, TMPS, ST2; reading ST2 releases the sample
+#define AK09916_CNTL2 0x31
+#define AK09916_CNTL3 0x32
+#define WIA2_AK09916 0x09
+#define MAG_READ_SIZE 9
+#define MAG_CONTINUOUS_100HZ 0x08
+
+#define FRAME_SIZE 12						// accelerometer then gyro, big endian
+#define FRAMES_PER_STEP (I2C_MAX_TRANSFER / FRAME_SIZE)
+// stream mode overwrites the oldest bytes once full, so well short of the 512 byte FIFO, its
+// frames can no longer be trusted to start on a frame boundary; the FIFO is reset
+#define FIFO_RESYNC_BYTES 480
+
+static I2CTransaction transaction;
+static TX_EVENT_FLAGS_GROUP events;
+static bool inFlight = false;
+static bool haveMag = false;
+static int framesRequested = 0;			// by the transaction in flight
+static int framesAvailable = 0;			// in the FIFO as of the last count, less those requested
+static bool resetFifo = false;
+
+// rx buffers of the transaction in flight
+static uint8_t fifoBuffer[ICM20948_MAX_FRAMES * FRAME_SIZE];
+static uint8_t countBuffer[2];
+static uint8_t magBuffer[MAG_READ_SIZE];
+
+static int WriteReg(uint8_t address, uint8_t reg, uint8_t value)
+{
+	uint8_t buffer[2] = { reg, value };
+	I2CTransaction t;
+	I2CTransaction_Init(&t, OS_HAL_I2C_ISU0);
+	I2CTransaction_AddWrite(&t, address, buffer, sizeof(buffer));
+	return I2CQueue_Run(&t, false);
+}
+
+static int ReadReg(uint8_t address, uint8_t reg, uint8_t* value)
+{
+	I2CTransaction t;
+	I2CTransaction_Init(&t, OS_HAL_I2C_ISU0);
+	I2CTransaction_AddWriteRead(&t, address, &reg, 1, value, 1);
+	return I2CQueue_Run(&t, false);
+}
+
+static int SelectBank(uint8_t bank)
+{
+	return WriteReg(ICM20948_ADDRESS, REG_BANK_SEL, (uint8_t)(bank << 4));
+}
+
+static bool InitMag(void)
+{
+	uint8_t id = 0;
+
+	WriteReg(AK09916_ADDRESS, AK09916_CNTL3, 0x01);		// soft reset
+	delay(1);
+	if (ReadReg(AK09916_ADDRESS, AK09916_WIA2, &id) != 0 || id != WIA2_AK09916)
+	{
+		printf("AK09916 not found (%02x), no heading correction\r\n", id);
+		return false;
+	}
+	return WriteReg(AK09916_ADDRESS, AK09916_CNTL2, MAG_CONTINUOUS_100HZ) == 0;
+}
+
+// Reads the frames the last count said were there, then the count, then the magnetometer; or
+// resets the FIFO instead of reading it, if it overflowed.
+static void SubmitRead(void)
+{
+	static const uint8_t fifoRead = REG_FIFO_R_W;
+	static const uint8_t countRead = REG_FIFO_COUNTH;
+	static const uint8_t magRead = AK09916_ST1;
+
+	I2CTransaction_Init(&transaction, OS_HAL_I2C_ISU0);
+	transaction.events = &events;
+	transaction.flag = 0x1;
+
+	framesRequested = 0;
+	if (resetFifo)
+	{
+		static const uint8_t assertReset[2] = { REG_FIFO_RST, 0x1F };
+		static const uint8_t releaseReset[2] = { REG_FIFO_RST, 0x00 };
+		I2CTransaction_AddWrite(&transaction, ICM20948_ADDRESS, assertReset, sizeof(assertReset));
+		I2CTransaction_AddWrite(&transaction, ICM20948_ADDRESS, releaseReset, sizeof(releaseReset));
+		framesAvailable = 0;
+		resetFifo = false;
+	}
+
+	while (framesAvailable > 0 && framesRequested < ICM20948_MAX_FRAMES)
+	{
+		int frames = framesAvailable < FRAMES_PER_STEP ? framesAvailable : FRAMES_PER_STEP;
+		if (framesRequested + frames > ICM20948_MAX_FRAMES)
+			frames = ICM20948_MAX_FRAMES - framesRequested;
+		I2CTransaction_AddWriteRead(&transaction, ICM20948_ADDRESS, &fifoRead, 1,
+			&fifoBuffer[framesRequested * FRAME_SIZE], (uint8_t)(frames * FRAME_SIZE));
+		framesRequested += frames;
+		framesAvailable -= frames;
+	}
+
+	I2CTransaction_AddWriteRead(&transaction, ICM20948_ADDRESS, &countRead, 1, countBuffer, sizeof(countBuffer));
+	if (haveMag)
+	{
+		I2CTransaction_AddWriteRead(&transaction, AK09916_ADDRESS, &magRead, 1, magBuffer, sizeof(magBuffer));
+	}
+
+	inFlight = I2CQueue_Submit(&transaction, true) == TX_SUCCESS;
+}
+
+bool ICM20948_Init(void)
+{
+	uint8_t id = 0;
+
+	// the reset returns to bank 0
+	SelectBank(0);
+	WriteReg(ICM20948_ADDRESS, REG_PWR_MGMT_1, 0x80);
+	delay(10);
+	WriteReg(ICM20948_ADDRESS, REG_PWR_MGMT_1, 0x01);		// awake, best clock
+	delay(10);
+
+	if (ReadReg(ICM20948_ADDRESS, REG_WHO_AM_I, &id) != 0 || id != WHO_AM_I_ICM20948)
+	{
+		printf("ICM-20948 not found (%02x)\r\n", id);
+		return false;
+	}
+	WriteReg(ICM20948_ADDRESS, REG_PWR_MGMT_2, 0x00);		// accelerometer and gyro on
+
+	SelectBank(2);
+	WriteReg(ICM20948_ADDRESS, REG_GYRO_SMPLRT_DIV, SAMPLE_RATE_DIV);
+	WriteReg(ICM20948_ADDRESS, REG_GYRO_CONFIG_1, SENSOR_CONFIG);
+	WriteReg(ICM20948_ADDRESS, REG_ACCEL_SMPLRT_DIV_1, 0);
+	WriteReg(ICM20948_ADDRESS, REG_ACCEL_SMPLRT_DIV_2, SAMPLE_RATE_DIV);
+	WriteReg(ICM20948_ADDRESS, REG_ACCEL_CONFIG, SENSOR_CONFIG);
+	SelectBank(0);
+
+	// the magnetometer on the bus itself, rather than behind the IMU's own I2C master
+	WriteReg(ICM20948_ADDRESS, REG_USER_CTRL, 0x00);
+	WriteReg(ICM20948_ADDRESS, REG_INT_PIN_CFG, 0x02);
+	haveMag = InitMag();
+
+	WriteReg(ICM20948_ADDRESS, REG_FIFO_EN_2, 0x1E);		// accelerometer, gyro x, y and z
+	WriteReg(ICM20948_ADDRESS, REG_FIFO_MODE, 0x00);		// stream
+	WriteReg(ICM20948_ADDRESS, REG_FIFO_RST, 0x1F);
+	WriteReg(ICM20948_ADDRESS, REG_FIFO_RST, 0x00);
+	if (WriteReg(ICM20948_ADDRESS, REG_USER_CTRL, 0x40) != 0)	// FIFO on
+	{
+		return false;
+	}
+
+	if (tx_event_flags_create(&events, "imu read") != TX_SUCCESS)
+	{
+		return false;
+	}
+
+	framesAvailable = 0;
+	SubmitRead();
+	return inFlight;
+}
+
+static int16_t BigEndian(const uint8_t* p)
+{
+	return (int16_t)((p[0] << 8) | p[1]);
+}
+
+static int16_t LittleEndian(const uint8_t* p)
+{
+	return (int16_t)((p[1] << 8) | p[0]);
+}
+
+int ICM20948_Poll(ICM20948_Frame* frames, ICM20948_Mag* mag)
+{
+	int count = 0;
+
+	mag->fresh = false;
+
+	if (inFlight)
+	{
+		ULONG actual_flags = 0;
+		tx_event_flags_get(&events, 0x1, TX_OR_CLEAR, &actual_flags, TX_WAIT_FOREVER);
+		inFlight = false;
+
+		if (transaction.result != 0)
+		{
+			// the count is lost with it, start over from a fresh count
+			framesAvailable = 0;
+			count = -1;
+		}
+		else
+		{
+			for (count = 0; count < framesRequested; count++)
+			{
+				const uint8_t* p = &fifoBuffer[count * FRAME_SIZE];
+				frames[count].ax = BigEndian(&p[0]);
+				frames[count].ay = BigEndian(&p[2]);
+				frames[count].az = BigEndian(&p[4]);
+				frames[count].gx = BigEndian(&p[6]);
+				frames[count].gy = BigEndian(&p[8]);
+				frames[count].gz = BigEndian(&p[10]);
+			}
+
+			int bytes = ((countBuffer[0] & 0x1F) << 8) | countBuffer[1];
+			framesAvailable = bytes / FRAME_SIZE;
+			resetFifo = bytes >= FIFO_RESYNC_BYTES;
+
+			// data ready, and no overflow; y and z point the other way to the accelerometer's
+			if (haveMag && (magBuffer[0] & 0x01) && !(magBuffer[8] & 0x08))
+			{
+				mag->mx = LittleEndian(&magBuffer[1]);
+				mag->my = (int16_t)-LittleEndian(&magBuffer[3]);
+				mag->mz = (int16_t)-LittleEndian(&magBuffer[5]);
+				mag->fresh = true;
+			}
+		}
+	}
+
+	SubmitRead();
+	return count;
+}
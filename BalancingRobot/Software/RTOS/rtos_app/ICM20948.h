@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// ICM-20948 on OS_HAL_I2C_ISU0, accelerometer and gyro streamed through its FIFO, magnetometer
+// (the AK09916 inside it) read directly in bypass mode.
+//
+// Reads go through the I2C queue without the caller waiting on them: each ICM20948_Poll takes the
+// transaction the previous poll submitted, and submits the next. That reads the frames the FIFO
+// count of the previous transaction said were there, then the count again for the next one, so
+// it never reads past the data in the FIFO, and the hardware thread never waits on the bus.
+
+#define ICM20948_ADDRESS 0x69			// AD0 high
+#define ICM20948_SAMPLE_HZ 225.0f		// 1125 Hz / (1 + 4), just over the 200 Hz balance loop
+#define ICM20948_MAX_FRAMES 4			// per poll, two 24 byte reads
+
+// Raw readings. Axes are the accelerometer's, the magnetometer's are turned to match.
+#define ICM20948_ACCEL_LSB_PER_G 8192.0f			// +-4 g
+#define ICM20948_GYRO_LSB_PER_DPS 65.5f			// +-500 dps
+#define ICM20948_MAG_UT_PER_LSB 0.15f
+
+typedef struct {
+	int16_t ax, ay, az;
+	int16_t gx, gy, gz;
+} ICM20948_Frame;
+
+typedef struct {
+	int16_t mx, my, mz;
+	bool fresh;						// a new sample since the last poll
+} ICM20948_Mag;
+
+// Resets and configures the IMU, and starts the FIFO; waits on the bus, so call before the loops run.
+bool ICM20948_Init(void);
+
+// Returns the frames read by the transaction submitted last poll, up to ICM20948_MAX_FRAMES into
+// frames, and the magnetometer reading from it; then submits the next. -1 if the last read failed.
+int ICM20948_Poll(ICM20948_Frame* frames, ICM20948_Mag* mag);
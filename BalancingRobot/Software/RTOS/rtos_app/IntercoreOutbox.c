@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "utils.h"
+#include "IntercoreOutbox.h"
+
+typedef struct {
+	volatile uint32_t seq;		// odd while the producer is writing
+	uint8_t size;
+	uint8_t payload[OUTBOX_PAYLOAD_SIZE];
+} OutboxSlot;
+
+static OutboxSlot slots[OUTBOX_SLOTS];
+static volatile uint32_t pending = 0;		// bit per slot with an unsent message
+
+static void MarkPending(uint32_t mask)
+{
+	__atomic_fetch_or(&pending, mask, __ATOMIC_RELEASE);
+}
+
+bool IntercoreOutbox_Post(const void* payload, size_t payload_size)
+{
+	uint8_t id = *(const uint8_t*)payload;
+
+	if (id >= OUTBOX_SLOTS || payload_size > OUTBOX_PAYLOAD_SIZE)
+	{
+		printf("IntercoreOutbox_Post insufficient buffer\r\n");
+		return false;
+	}
+
+	OutboxSlot* slot = &slots[id];
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(slot->payload, payload, payload_size);
+	slot->size = (uint8_t)payload_size;
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+
+	MarkPending(1u << id);
+	return true;
+}
+
+int IntercoreOutbox_Drain(OutboxSend send)
+{
+	uint8_t payload[OUTBOX_PAYLOAD_SIZE];
+	uint32_t mask = __atomic_exchange_n(&pending, 0, __ATOMIC_ACQUIRE);
+	uint32_t retry = 0;
+	int sent = 0;
+
+	while (mask != 0)
+	{
+		int id = __builtin_ctz(mask);
+		mask &= mask - 1;
+
+		OutboxSlot* slot = &slots[id];
+		uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		uint8_t size = slot->size;
+		if ((seq & 1) == 0 && size <= sizeof(payload))
+		{
+			memcpy(payload, slot->payload, size);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		}
+
+		// written over while being copied: the producer has marked it again, or will when it's done
+		if ((seq & 1) != 0 || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+		{
+			continue;
+		}
+
+		if (send(payload, size))
+		{
+			sent++;
+		}
+		else
+		{
+			retry |= 1u << id;
+		}
+	}
+
+	if (retry != 0)
+	{
+		MarkPending(retry);
+	}
+	return sent;
+}
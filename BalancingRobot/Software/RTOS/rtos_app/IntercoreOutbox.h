@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Latest-value slots for the messages sent to the HL app, one per message id. Posting a message
+// overwrites the unsent one with the same id, so slow reads on the HL side never leave a backlog
+// of stale telemetry in the shared buffer; the Intercore thread drains the slots into it.
+//
+// Each slot has one producer (whichever thread owns that message) and one consumer (the drain), so
+// a sequence count is all the locking it needs: the drain skips a slot caught mid write, and
+// picks it up next time.
+
+#define OUTBOX_SLOTS 32				// message ids are below 0x20
+#define OUTBOX_PAYLOAD_SIZE 44		// the largest message, LOOP_TIMING
+
+// Copies payload (its first byte is the message id) into the id's slot, returns false if it doesn't fit.
+bool IntercoreOutbox_Post(const void* payload, size_t payload_size);
+
+// Sends each posted message, latest first per id, through send (given the payload); a message send
+// refuses stays posted, unless a newer one replaces it. Returns the number sent.
+typedef bool (*OutboxSend)(const void* payload, size_t payload_size);
+int IntercoreOutbox_Drain(OutboxSend send);
@@ -0,0 +1,147 @@
+#include <math.h>
+#include "Mahony.h"
+
+#define RAD_TO_DEG 57.29577951f
+
+static float InvSqrt(float x)
+{
+	return 1.0f / sqrtf(x);
+}
+
+void Mahony_Init(Mahony* m, float sampleHz, float kp, float ki)
+{
+	m->q0 = 1.0f;
+	m->q1 = 0.0f;
+	m->q2 = 0.0f;
+	m->q3 = 0.0f;
+	m->ix = 0.0f;
+	m->iy = 0.0f;
+	m->iz = 0.0f;
+	m->dt = 1.0f / sampleHz;
+	Mahony_SetGains(m, kp, ki);
+}
+
+void Mahony_SetGains(Mahony* m, float kp, float ki)
+{
+	m->twoKp = 2.0f * kp;
+	m->twoKi = 2.0f * ki;
+}
+
+// Closes the loop on error (ex, ey, ez), then integrates the corrected gyro into the quaternion.
+static void Integrate(Mahony* m, float gx, float gy, float gz, float ex, float ey, float ez)
+{
+	if (m->twoKi > 0.0f)
+	{
+		m->ix += m->twoKi * ex * m->dt;
+		m->iy += m->twoKi * ey * m->dt;
+		m->iz += m->twoKi * ez * m->dt;
+		gx += m->ix;
+		gy += m->iy;
+		gz += m->iz;
+	}
+
+	gx += m->twoKp * ex;
+	gy += m->twoKp * ey;
+	gz += m->twoKp * ez;
+
+	// q += 0.5 * q x (0, g) * dt
+	float halfDt = 0.5f * m->dt;
+	gx *= halfDt;
+	gy *= halfDt;
+	gz *= halfDt;
+	float q0 = m->q0, q1 = m->q1, q2 = m->q2, q3 = m->q3;
+	m->q0 += -q1 * gx - q2 * gy - q3 * gz;
+	m->q1 += q0 * gx + q2 * gz - q3 * gy;
+	m->q2 += q0 * gy - q1 * gz + q3 * gx;
+	m->q3 += q0 * gz + q1 * gy - q2 * gx;
+
+	float norm = InvSqrt(m->q0 * m->q0 + m->q1 * m->q1 + m->q2 * m->q2 + m->q3 * m->q3);
+	m->q0 *= norm;
+	m->q1 *= norm;
+	m->q2 *= norm;
+	m->q3 *= norm;
+}
+
+void Mahony_UpdateIMU(Mahony* m, float gx, float gy, float gz, float ax, float ay, float az)
+{
+	float ex = 0.0f, ey = 0.0f, ez = 0.0f;
+
+	// in free fall there's no gravity to correct against
+	if (ax != 0.0f || ay != 0.0f || az != 0.0f)
+	{
+		float norm = InvSqrt(ax * ax + ay * ay + az * az);
+		ax *= norm;
+		ay *= norm;
+		az *= norm;
+
+		// gravity as the quaternion sees it, half of
+		float vx = m->q1 * m->q3 - m->q0 * m->q2;
+		float vy = m->q0 * m->q1 + m->q2 * m->q3;
+		float vz = m->q0 * m->q0 - 0.5f + m->q3 * m->q3;
+
+		ex = ay * vz - az * vy;
+		ey = az * vx - ax * vz;
+		ez = ax * vy - ay * vx;
+	}
+
+	Integrate(m, gx, gy, gz, ex, ey, ez);
+}
+
+void Mahony_Update(Mahony* m, float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz)
+{
+	if ((mx == 0.0f && my == 0.0f && mz == 0.0f) || (ax == 0.0f && ay == 0.0f && az == 0.0f))
+	{
+		Mahony_UpdateIMU(m, gx, gy, gz, ax, ay, az);
+		return;
+	}
+
+	float norm = InvSqrt(ax * ax + ay * ay + az * az);
+	ax *= norm;
+	ay *= norm;
+	az *= norm;
+
+	norm = InvSqrt(mx * mx + my * my + mz * mz);
+	mx *= norm;
+	my *= norm;
+	mz *= norm;
+
+	float q0q0 = m->q0 * m->q0, q0q1 = m->q0 * m->q1, q0q2 = m->q0 * m->q2, q0q3 = m->q0 * m->q3;
+	float q1q1 = m->q1 * m->q1, q1q2 = m->q1 * m->q2, q1q3 = m->q1 * m->q3;
+	float q2q2 = m->q2 * m->q2, q2q3 = m->q2 * m->q3;
+	float q3q3 = m->q3 * m->q3;
+
+	// earth's field in the earth frame, rotated onto the x-z plane so only its dip is kept
+	float hx = 2.0f * (mx * (0.5f - q2q2 - q3q3) + my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
+	float hy = 2.0f * (mx * (q1q2 + q0q3) + my * (0.5f - q1q1 - q3q3) + mz * (q2q3 - q0q1));
+	float bx = sqrtf(hx * hx + hy * hy);
+	float bz = 2.0f * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1) + mz * (0.5f - q1q1 - q2q2));
+
+	// gravity and field as the quaternion sees them, half of
+	float vx = q1q3 - q0q2;
+	float vy = q0q1 + q2q3;
+	float vz = q0q0 - 0.5f + q3q3;
+	float wx = bx * (0.5f - q2q2 - q3q3) + bz * (q1q3 - q0q2);
+	float wy = bx * (q1q2 - q0q3) + bz * (q0q1 + q2q3);
+	float wz = bx * (q0q2 + q1q3) + bz * (0.5f - q1q1 - q2q2);
+
+	float ex = (ay * vz - az * vy) + (my * wz - mz * wy);
+	float ey = (az * vx - ax * vz) + (mz * wx - mx * wz);
+	float ez = (ax * vy - ay * vx) + (mx * wy - my * wx);
+
+	Integrate(m, gx, gy, gz, ex, ey, ez);
+}
+
+void Mahony_GetEuler(const Mahony* m, float* roll, float* pitch, float* yaw)
+{
+	float q0 = m->q0, q1 = m->q1, q2 = m->q2, q3 = m->q3;
+	float sinPitch = -2.0f * (q1 * q3 - q0 * q2);
+
+	if (sinPitch > 1.0f)
+		sinPitch = 1.0f;
+	if (sinPitch < -1.0f)
+		sinPitch = -1.0f;
+
+	*roll = atan2f(q0 * q1 + q2 * q3, 0.5f - q1 * q1 - q2 * q2) * RAD_TO_DEG;
+	*pitch = asinf(sinPitch) * RAD_TO_DEG;
+	*yaw = atan2f(q1 * q2 + q0 * q3, 0.5f - q2 * q2 - q3 * q3) * RAD_TO_DEG;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Mahony's complementary filter on the attitude quaternion, in single precision for the M4F's
+// float only FPU. The gyro is integrated every sample, and the error between where the quaternion
+// says gravity (and magnetic north, when there's a magnetometer sample) should be and where the
+// accelerometer (and magnetometer) see it is fed back through a PI controller, the integral
+// taking out the gyro's bias. An update is a few hundred cycles, see IMU_BENCHMARK in rtos_app.c.
+typedef struct {
+	float q0, q1, q2, q3;		// body to earth
+	float twoKp;				// 2 * proportional gain
+	float twoKi;				// 2 * integral gain
+	float ix, iy, iz;			// integral feedback, scaled by twoKi
+	float dt;					// sample period, in seconds
+} Mahony;
+
+void Mahony_Init(Mahony* m, float sampleHz, float kp, float ki);
+void Mahony_SetGains(Mahony* m, float kp, float ki);
+
+// Gyro in rad/s; accelerometer and magnetometer in any units, they're normalized. A magnetometer
+// reading of 0, 0, 0 updates from the gyro and accelerometer only, as does Mahony_UpdateIMU.
+void Mahony_Update(Mahony* m, float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz);
+void Mahony_UpdateIMU(Mahony* m, float gx, float gy, float gz, float ax, float ay, float az);
+
+// Euler angles, in degrees: roll and yaw -180 to 180, pitch -90 to 90.
+void Mahony_GetEuler(const Mahony* m, float* roll, float* pitch, float* yaw);
@@ -0,0 +1,160 @@
+/**********************************************************************************************
+ * Single precision, fixed step port of the Arduino PID Library - Version 1.2.1
+ * by Brett Beauregard <br3ttb@gmail.com> brettbeauregard.com
+ *
+ * This Library is licensed under the MIT License
+ **********************************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "PIDf.h"
+
+static float Clamp(const PIDf* pid, float value)
+{
+	if (value > pid->outMax) return pid->outMax;
+	if (value < pid->outMin) return pid->outMin;
+	return value;
+}
+
+// gains as Compute() uses them: scaled by the sample time, negated for a REVERSE process
+static void ScaleTunings(PIDf* pid)
+{
+	float sign = pid->direction == REVERSE ? -1.0f : 1.0f;
+	pid->kp = sign * pid->dispKp;
+	pid->kiDt = sign * pid->dispKi * pid->dt;
+	pid->kdOverDt = sign * pid->dispKd / pid->dt;
+	pid->dFilterGain = pid->dt / (pid->tau + pid->dt);
+}
+
+/* Init(...)******************************************************************
+ *    Links the PID to the Input, Output, and Setpoint, the controller starts
+ *    in MANUAL mode, limited to 0-255 and sampled every 100ms.
+ ***************************************************************************/
+void PIDf_Init(PIDf* pid, float* Input, float* Output, float* Setpoint,
+	float Kp, float Ki, float Kd, int POn, int ControllerDirection)
+{
+	pid->input = Input;
+	pid->output = Output;
+	pid->setpoint = Setpoint;
+	pid->inAuto = false;
+	pid->outputSum = 0.0f;
+	pid->lastInput = 0.0f;
+	pid->dInput = 0.0f;
+	pid->tau = 0.0f;
+	pid->dt = 0.1f;
+	pid->direction = ControllerDirection;
+
+	PIDf_SetOutputLimits(pid, 0.0f, 255.0f);
+	pid->dispKp = pid->dispKi = pid->dispKd = 0.0f;
+	PIDf_SetTunings(pid, Kp, Ki, Kd, POn);
+}
+
+/* Compute() **********************************************************************
+ *   Called once per sample period, returns false when the controller is in MANUAL.
+ *   The derivative acts on the (filtered) measurement, so setpoint steps don't kick
+ *   the output, and the integral stops growing while the output is pinned at the limit
+ *   the error is pushing it towards.
+ **********************************************************************************/
+bool PIDf_Compute(PIDf* pid)
+{
+	if (!pid->inAuto) return false;
+
+	float input = *pid->input;
+	float error = *pid->setpoint - input;
+	float dInput = input - pid->lastInput;
+	pid->dInput += pid->dFilterGain * (dInput - pid->dInput);
+
+	float proportional = pid->pOnE ? pid->kp * error : 0.0f;
+	float derivative = pid->kdOverDt * pid->dInput;
+
+	/*Add Proportional on Measurement, if P_ON_M is specified*/
+	if (!pid->pOnE) pid->outputSum -= pid->kp * dInput;
+
+	float integral = pid->kiDt * error;
+	float unclamped = proportional + pid->outputSum - derivative;
+	if (!((unclamped >= pid->outMax && integral > 0.0f) || (unclamped <= pid->outMin && integral < 0.0f)))
+	{
+		pid->outputSum += integral;
+	}
+	pid->outputSum = Clamp(pid, pid->outputSum);
+
+	*pid->output = Clamp(pid, proportional + pid->outputSum - derivative);
+
+	pid->lastInput = input;
+	return true;
+}
+
+/* SetTunings(...)*************************************************************
+ * Adjusts the controller's dynamic performance, negative gains are ignored.
+ ******************************************************************************/
+void PIDf_SetTunings(PIDf* pid, float Kp, float Ki, float Kd, int POn)
+{
+	if (Kp < 0 || Ki < 0 || Kd < 0) return;
+
+	pid->pOnE = POn == P_ON_E;
+	pid->dispKp = Kp; pid->dispKi = Ki; pid->dispKd = Kd;
+	ScaleTunings(pid);
+}
+
+/* SetSampleTime(...) *********************************************************
+ * Sets the period, in Milliseconds, at which Compute() is called.
+ ******************************************************************************/
+void PIDf_SetSampleTime(PIDf* pid, int NewSampleTime)
+{
+	if (NewSampleTime > 0)
+	{
+		pid->dt = (float)NewSampleTime / 1000.0f;
+		ScaleTunings(pid);
+	}
+}
+
+void PIDf_SetDerivativeFilter(PIDf* pid, float Tau)
+{
+	if (Tau >= 0)
+	{
+		pid->tau = Tau;
+		ScaleTunings(pid);
+	}
+}
+
+/* SetOutputLimits(...)****************************************************
+ * Clamps the output, and the integral, to Min-Max.
+ **************************************************************************/
+void PIDf_SetOutputLimits(PIDf* pid, float Min, float Max)
+{
+	if (Min >= Max) return;
+	pid->outMin = Min;
+	pid->outMax = Max;
+
+	if (pid->inAuto)
+	{
+		*pid->output = Clamp(pid, *pid->output);
+		pid->outputSum = Clamp(pid, pid->outputSum);
+	}
+}
+
+/* SetMode(...)****************************************************************
+ * MANUAL (0) or AUTOMATIC (non-zero). Going from manual to automatic starts
+ * the integral from the current output, for a bumpless transfer.
+ ******************************************************************************/
+void PIDf_SetMode(PIDf* pid, int Mode)
+{
+	bool newAuto = (Mode == AUTOMATIC);
+	if (newAuto && !pid->inAuto)
+	{
+		pid->outputSum = Clamp(pid, *pid->output);
+		pid->lastInput = *pid->input;
+		pid->dInput = 0.0f;
+	}
+	pid->inAuto = newAuto;
+}
+
+/* SetControllerDirection(...)*************************************************
+ * DIRECT: +Output leads to +Input, REVERSE: +Output leads to -Input.
+ ******************************************************************************/
+void PIDf_SetControllerDirection(PIDf* pid, int Direction)
+{
+	pid->direction = Direction;
+	ScaleTunings(pid);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include "PID_v1.h"		// AUTOMATIC/MANUAL, DIRECT/REVERSE, P_ON_M/P_ON_E
+
+// Single precision, fixed step version of the PID_v1 controller, for the M4F's float only FPU.
+// Compute() does no timing of its own: it is called once per sample period (from a ControlLoop),
+// and the gains are scaled by that period once, when they are set.
+typedef struct {
+	float* input;
+	float* output;
+	float* setpoint;
+
+	// tuning as given, for display
+	float dispKp;
+	float dispKi;
+	float dispKd;
+
+	// tuning scaled by the sample time and signed by the direction
+	float kp;
+	float kiDt;				// Ki * dt
+	float kdOverDt;			// Kd / dt
+	float dt;				// sample time, in seconds
+
+	// derivative low-pass: d += dFilterGain * (dInput - d), dFilterGain = dt / (tau + dt)
+	float tau;
+	float dFilterGain;
+
+	float outMin;
+	float outMax;
+
+	// controller memory
+	float outputSum;
+	float lastInput;
+	float dInput;
+
+	int direction;
+	bool pOnE;
+	bool inAuto;
+} PIDf;
+
+void PIDf_Init(PIDf* pid, float* Input, float* Output, float* Setpoint,
+	float Kp, float Ki, float Kd, int POn, int ControllerDirection);
+
+bool PIDf_Compute(PIDf* pid);
+
+void PIDf_SetTunings(PIDf* pid, float Kp, float Ki, float Kd, int POn);
+void PIDf_SetOutputLimits(PIDf* pid, float Min, float Max);
+void PIDf_SetSampleTime(PIDf* pid, int NewSampleTime);		// milliseconds, 100 by default
+// Time constant of the derivative filter in seconds, 0 (the default) for no filtering.
+void PIDf_SetDerivativeFilter(PIDf* pid, float Tau);
+void PIDf_SetMode(PIDf* pid, int Mode);
+void PIDf_SetControllerDirection(PIDf* pid, int Direction);
+
+static inline float PIDf_GetKp(const PIDf* pid) { return pid->dispKp; }
+static inline float PIDf_GetKi(const PIDf* pid) { return pid->dispKi; }
+static inline float PIDf_GetKd(const PIDf* pid) { return pid->dispKd; }
+static inline int PIDf_GetMode(const PIDf* pid) { return pid->inAuto ? AUTOMATIC : MANUAL; }
+static inline int PIDf_GetDirection(const PIDf* pid) { return pid->direction; }
@@ -601,9 +601,10 @@ void VL53L1X_readResults()
     txBuffer[0] = (RESULT__RANGE_STATUS >> 8) & 0xFF;
     txBuffer[1] = RESULT__RANGE_STATUS & 0xFF;
 
+    // one 17 byte burst, the register address auto-increments
     int result = readBlockData(txBuffer, rxBuffer, 2, 17);
 
-    if (result == -1)
+    if (result < 0)
     {
         printf("VL53L1X_readResults - failed\n");
         return;
@@ -1,39 +1,29 @@
 #include "i2c.h"
 #include "os_hal_i2c.h"
 #include "utils.h"
+#include "I2CQueue.h"
+#include "FanOut.h"
 #include <tx_api.h>
 
-extern TX_MUTEX i2cMutex;
-#define TXRX_BUFFER_SIZE 32
-
-// Transfers larger than 8 bytes must be in sysram
-static __attribute__((section(".sysram"))) uint8_t writeBuffer[TXRX_BUFFER_SIZE];
-static __attribute__((section(".sysram"))) uint8_t readBuffer[TXRX_BUFFER_SIZE];
+#define VL53L1X_ADDRESS 0x29
 
 int Native_ReadData(i2c_num i2cBus, uint16_t reg, void* data, size_t len, uint8_t deviceAddress)
 {
 #ifdef SHOW_DEBUG_MSGS
 	Log_Entry();
 #endif
-	if (len > TXRX_BUFFER_SIZE)
+	if (len > I2C_MAX_TRANSFER)
 	{
 		printf("Native_ReadData - buffer size too large\r\n");
 		return -1;
 	}
 
 	uint8_t regW = reg & 0xff;
-	int ret = 0;
-	writeBuffer[0] = regW;
-
-	if (len > 8)
-	{
-		printf("request size too large...\r\n");
-	}
-
-	mtk_os_hal_i2c_write_read(i2cBus, deviceAddress, &writeBuffer[0], &readBuffer[0], 1, len);
+	I2CTransaction t;
+	I2CTransaction_Init(&t, i2cBus);
+	I2CTransaction_AddWriteRead(&t, deviceAddress, &regW, 1, (uint8_t*)data, (uint8_t)len);
 
-	memcpy(data, readBuffer, len);
-	return ret;
+	return I2CQueue_Run(&t, false);
 }
 
 int Native_ReadRegU8(i2c_num i2cBus, uint8_t reg, uint8_t* value, uint8_t deviceAddress)
@@ -46,6 +36,32 @@ int Native_ReadRegU8(i2c_num i2cBus, uint8_t reg, uint8_t* value, uint8_t device
 	return ret;
 }
 
+// Writes to the VL53L1X on ISU1, behind the selected FanOut channel
+static int WriteToF(const uint8_t* buffer, uint8_t len)
+{
+	I2CTransaction t;
+	I2CTransaction_Init(&t, OS_HAL_I2C_ISU1);
+	t.fanoutChannel = GetFanoutChannel();
+	I2CTransaction_AddWrite(&t, VL53L1X_ADDRESS, buffer, len);
+
+	return I2CQueue_Run(&t, false);
+}
+
+// Reads len bytes from a VL53L1X register, in one transfer with a repeated start
+static int ReadToF(uint16_t addr, uint8_t* value, uint8_t len)
+{
+	uint8_t buffer[2];
+	buffer[0] = addr >> 8;
+	buffer[1] = addr & 0xff;
+
+	I2CTransaction t;
+	I2CTransaction_Init(&t, OS_HAL_I2C_ISU1);
+	t.fanoutChannel = GetFanoutChannel();
+	I2CTransaction_AddWriteRead(&t, VL53L1X_ADDRESS, buffer, 2, value, len);
+
+	return I2CQueue_Run(&t, false);
+}
+
 //Write a byte to a spot
 void writeRegister(uint16_t addr, uint8_t val)
 {
@@ -54,9 +70,7 @@ void writeRegister(uint16_t addr, uint8_t val)
 	buffer[1] = addr & 0xff;
 	buffer[2] = val;
 
-	__builtin_memcpy(writeBuffer, buffer, 3);
-
-	int fnRes = mtk_os_hal_i2c_write(OS_HAL_I2C_ISU1, 0x29, writeBuffer, 3);
+	int fnRes = WriteToF(buffer, 3);
 	if (fnRes < 0)
 	{
 		printf("writeRegister failed\r\n");
@@ -72,9 +86,7 @@ void writeRegister16(uint16_t addr, uint16_t val)
 	buffer[2] = val >> 8;
 	buffer[3] = val & 0xff;
 
-	__builtin_memcpy(writeBuffer, buffer, 4);
-
-	int fnRes = mtk_os_hal_i2c_write(OS_HAL_I2C_ISU1, 0x29, writeBuffer, 4);
+	int fnRes = WriteToF(buffer, 4);
 	if (fnRes < 0)
 	{
 		printf("writeRegister16 failed\r\n");
@@ -92,9 +104,7 @@ void writeRegister32(uint16_t reg, uint32_t value)
 	buffer[4] = (value >> 8) & 0xFF;
 	buffer[5] = value & 0xFF; // value lowest byte
 
-	__builtin_memcpy(writeBuffer, buffer, 6);
-
-	int fnRes=mtk_os_hal_i2c_write(OS_HAL_I2C_ISU1, 0x29, writeBuffer, 6);
+	int fnRes = WriteToF(buffer, 6);
 	if (fnRes < 0)
 	{
 		printf("writeRegister32 failed\r\n");
@@ -105,41 +115,31 @@ void writeRegister32(uint16_t reg, uint32_t value)
 //Returns zero on error
 uint8_t readRegister(uint16_t addr)
 {
-	uint8_t buffer[4] = { 0 };
-	buffer[0] = addr >> 8;
-	buffer[1] = addr & 0xff;
-
-	__builtin_memcpy(writeBuffer, buffer, 2);
+	uint8_t readBuffer[1] = { 0 };
 
-	int result = mtk_os_hal_i2c_write_read(OS_HAL_I2C_ISU1, 0x29, writeBuffer, readBuffer, 2, 1);
+	int result = ReadToF(addr, readBuffer, 1);
 
 	if (result < 0)
 	{
 		printf("readRegister - Failed mtk_os_hal_i2c_write_read (%d)\r\n", result);
+		return 0;
 	}
 
-	uint8_t value = 0;
-
-	value = readBuffer[0];       // value lowest byte
-
-	return value;
+	return readBuffer[0];
 }
 
 //Reads two consecutive bytes from a given location
 //Returns zero on error
 uint16_t readRegister16(uint16_t addr)
 {
-	uint8_t buffer[4] = { 0 };
-	buffer[0] = addr >> 8;
-	buffer[1] = addr & 0xff;
-
-	__builtin_memcpy(writeBuffer, buffer, 2);
+	uint8_t readBuffer[2] = { 0 };
 
-	int result = mtk_os_hal_i2c_write_read(OS_HAL_I2C_ISU1, 0x29, writeBuffer, readBuffer, 2, 2);
+	int result = ReadToF(addr, readBuffer, 2);
 
 	if (result < 0)
 	{
 		printf("readRegister16 - Failed mtk_os_hal_i2c_write_read (%d)\r\n", result);
+		return 0;
 	}
 
 	uint16_t value=0;
@@ -153,17 +153,14 @@ uint16_t readRegister16(uint16_t addr)
 // Read a 32-bit register
 uint32_t readRegister32(uint16_t reg)
 {
-	uint8_t buffer[4] = { 0 };
-	buffer[0] = reg >> 8;
-	buffer[1] = reg & 0xff;
+	uint8_t readBuffer[4] = { 0 };
 
-	__builtin_memcpy(writeBuffer, buffer, 2);
-
-	int result = mtk_os_hal_i2c_write_read(OS_HAL_I2C_ISU1, 0x29, writeBuffer, readBuffer, 2, 4);
+	int result = ReadToF(reg, readBuffer, 4);
 
 	if (result < 0)
 	{
 		printf("readRegister32 - Failed mtk_os_hal_i2c_write_read (%d)\r\n", result);
+		return 0;
 	}
 
 	uint32_t value;
@@ -176,29 +173,26 @@ uint32_t readRegister32(uint16_t reg)
 	return value;
 }
 
+// Burst read: the register address, a repeated start, then readLen bytes as the device
+// auto-increments, all in one transfer (by DMA when over 8 bytes)
 int readBlockData(uint8_t* txBuffer, uint8_t* rxBuffer, uint16_t writeLen, uint16_t readLen)
 {
-	__builtin_memcpy(writeBuffer, txBuffer, writeLen);
-
-	int result = mtk_os_hal_i2c_write(OS_HAL_I2C_ISU1, 0x29, writeBuffer, writeLen);
-	if (result < 0)
+	if (writeLen > 8 || readLen > I2C_MAX_TRANSFER)
 	{
-		printf("readBlockData - write failed\r\n");
+		printf("readBlockData - buffer size too large\r\n");
+		return -1;
 	}
 
-	for (int x = 0; x < readLen; x++)
+	I2CTransaction t;
+	I2CTransaction_Init(&t, OS_HAL_I2C_ISU1);
+	t.fanoutChannel = GetFanoutChannel();
+	I2CTransaction_AddWriteRead(&t, VL53L1X_ADDRESS, txBuffer, (uint8_t)writeLen, rxBuffer, (uint8_t)readLen);
+
+	int result = I2CQueue_Run(&t, false);
+	if (result < 0)
 	{
-		result = mtk_os_hal_i2c_read(OS_HAL_I2C_ISU1, 0x29, readBuffer, 1);
-		if (result < 0)
-		{
-			printf("readBlockData - read failed\r\n");
-			break;
-		}
-		else
-		{
-			rxBuffer[x] = readBuffer[0];
-		}
+		printf("readBlockData - read failed\r\n");
 	}
 
 	return result;
-}
\ No newline at end of file
+}
@@ -3,6 +3,9 @@
 #include <stdint.h>
 
 #include "i2c.h"
+#include "I2CQueue.h"
+#include "IntercoreOutbox.h"
+#include "FlightRecorder.h"
 #include "mt3620-intercore.h"
 #include "intercore_messages.h"
 #include "os_hal_gpio.h"
@@ -15,10 +18,15 @@
 
 #include "utils.h"
 #include "PID_v1.h"
+#include "PIDf.h"
 #include "PID.h"
 
 #include "FanOut.h"
 #include "VL53L1X.h"
+#include "ControlLoop.h"
+#include "ICM20948.h"
+#include "Mahony.h"
+#include "mt3620.h"
 
 // Show Debug Log messages for Yaw/Pitch/Roll/Roll Delta
 // #define SHOW_LOG
@@ -56,6 +64,21 @@ static unsigned long ToF_Settle_Counter = 0;
 struct TURN_DETAILS details;
 struct DEVICE_STATUS tMsg;
 struct IMU_STABLE_RESULT tImuStatusMsg;
+
+// streamed telemetry, see MSG_TELEMETRY_STREAM
+static uint32_t telemetryPeriodMs = 0;
+static unsigned long lastTelemetrySample = 0;
+static void PostTelemetrySample(void);
+static int16_t ToCenti(float value);
+
+// sequenced remote control, see MSG_REMOTE_CMD_SEQ; only the Intercore thread uses these
+static uint16_t remoteSeq = 0;
+static bool remoteSeqValid = false;
+static unsigned long remoteSeqTime = 0;		// when remoteSeq was applied
+static unsigned long remoteDeadline = 0;
+static bool remoteDeadlineArmed = false;	// a moving command that cancels itself at remoteDeadline
+static void ApplyRemoteCommand(uint8_t cmd);
+static void HandleRemoteCommandSeq(const struct REMOTE_CMD_SEQ* pRemote);
 struct TURN_ROBOT tNorth;
 int turnHeading = -1;
 unsigned long ToF_ObstacleCounter = 0;
@@ -63,11 +86,15 @@ unsigned long ToF_ObstacleCounter = 0;
 static bool updating = false;		// set to true when update is accepted in the HL app.
 
 // resources for inter core messaging
-static uint8_t buf[64];
+static uint8_t buf[INTERCORE_HEADER_SIZE + INTERCORE_MAX_PAYLOAD];
 static uint32_t dataSize;
 static BufferHeader* outbound, * inbound;
 static uint32_t sharedBufSize = 0;
-static const size_t payloadStart = 20;
+static const size_t payloadStart = INTERCORE_HEADER_SIZE;
+
+// the MSG_INTERCORE_BATCH being filled this activation of the Intercore thread, after the frame header
+static uint8_t batchFrame[INTERCORE_HEADER_SIZE + INTERCORE_MAX_PAYLOAD];
+static size_t batchSize = 0;
 bool highLevelReady = false;
 
 static bool haveHLApp = false;		// used to determine whether we've received a message from the HL app.
@@ -82,9 +109,11 @@ TX_THREAD               tx_ToF_Thread;
 TX_THREAD               tx_Intercore_Thread;
 
 TX_TIMER				msTimer;
-TX_EVENT_FLAGS_GROUP    hardware_event_flags_0;
-TX_EVENT_FLAGS_GROUP    ToF_event_flags_0;
-TX_EVENT_FLAGS_GROUP    Intercore_event_flags_0;
+
+// Periodic loops, released by timerFn; thread priorities follow their rates.
+ControlLoop             hardwareLoop;		// IMU read, PID and motors - 200 Hz
+ControlLoop             ToFLoop;			// 10 Hz
+ControlLoop             IntercoreLoop;		// 20 Hz
 
 TX_BYTE_POOL            byte_pool_0;
 TX_BLOCK_POOL           block_pool_0;
@@ -99,6 +128,8 @@ void Intercore_thread(ULONG thread_input);
 void hardware_init_thread(ULONG thread_input);
 
 void EnqueueIntercoreMessage(void* payload, size_t payload_size);
+static bool SendIntercoreMessage(const void* payload, size_t payload_size);
+static bool FlushIntercoreBatch(void);
 int GetCompassDirection(float compassAngle);
 
 static bool TurnRobotFlag = false;
@@ -110,12 +141,12 @@ static float turnStartHeading = 0.0;
 #define M_PI 3.14159265358979323846
 
 // auto-calibration stuff.
-#define SETPOINT_DEFAULT 90.54 
+#define SETPOINT_DEFAULT 90.54f
 
 static bool AutoCalibrateSetpoint = false;
 // 5ms tick, 200 ticks (1 second) for auto-adjust.
-static double setpoint = SETPOINT_DEFAULT;
-static double CalibratedSetpoint = SETPOINT_DEFAULT;
+static float setpoint = SETPOINT_DEFAULT;
+static float CalibratedSetpoint = SETPOINT_DEFAULT;
 
 // setpoint adjust values.
 float ToFSetpointAdjust = 0.0;
@@ -151,9 +182,11 @@ static bool GetRotationDirection(float current, float desired);
 bool applyAutoAdjust = true;
 float setpointTweak = SETPOINT_TWEAK_MAX;
 
-static float rollHistory[200];
-static int rollHistoryPointer = 0;
-static unsigned long loopCounter = 0;
+// the IMU is stable once the roll has stayed within IMU_STABLE_RANGE for IMU_STABLE_SAMPLES loops.
+#define IMU_STABLE_SAMPLES 200
+#define IMU_STABLE_RANGE 0.02f
+static SlidingEntry rollHistoryStorage[2 * IMU_STABLE_SAMPLES];
+static SlidingMinMax rollHistory;
 static bool imuStable = false;
 
 float oldOutput = 0.0;
@@ -162,14 +195,42 @@ float oldOutput = 0.0;
 float g_pitch, g_yaw, g_roll = 0.0;
 float g_heading = 0.0;
 
-double input, output = 0.0;
+// attitude from the ICM-20948, fused every FIFO frame; a high gain pulls the quaternion onto
+// gravity for the first IMU_SETTLE_UPDATES, then the normal gains keep it there
+#define IMU_KP 0.5f
+#define IMU_KI 0.02f
+#define IMU_SETTLE_KP 10.0f
+#define IMU_SETTLE_UPDATES 450		// 2 seconds of frames
+#define DEG_TO_RAD 0.01745329252f
+static bool imuPresent = false;
+static Mahony ahrs;
+static uint32_t ahrsUpdates = 0;
+
+// Fusion per activation is budgeted at 2% of the 5 ms period, at the M4's 197.6 MHz. The DWT cycle
+// counter measures it; with SHOW_DEBUG_MSGS the worst case and the mean per update are printed
+// every 10 seconds, with the activations over budget.
+#define IMU_FUSION_BUDGET_CYCLES 20000
+typedef struct {
+	uint32_t activations;
+	uint32_t updates;
+	uint32_t cycles;			// total, over the updates
+	uint32_t maxCycles;			// most in one activation
+	uint32_t overBudget;		// activations over IMU_FUSION_BUDGET_CYCLES
+	uint32_t readErrors;
+} ImuStats;
+static ImuStats imuStats;
+static void ReadImu(void);
+
+// the balance PID runs in float, the M4F has no double precision FPU
+float input, output = 0.0f;
+static PIDf balancePID;
 
 // offset to add to/subtract from motors to allow spin.
 #define SPIN_OFFSET 150
 
-double Kp = 16; 
-double Ki = 120;
-double Kd = .4;
+float Kp = 16; 
+float Ki = 120;
+float Kd = .4f;
 
 #define ACCELEROMETER_SENSITIVITY 8192.0
 #define GYROSCOPE_SENSITIVITY 65.536
@@ -214,42 +275,27 @@ unsigned long loop(void)
 	unsigned long startPeriod = millis();
 
 
-	// TODO: Read IMU, calculate Yaw, Pitch, Roll
-	// ICM-20948 oritentation gives Roll as lean angle.
-
-	float _Roll = 0.0;	// 
-	float g_heading = 0.0; //
-	if (g_heading < 0)
-		g_heading += 360;
-
-	loopCounter++;		// counter to ensure we have 200 items in the rollHistory array.
+	if (!imuPresent)
+	{
+		return 0;
+	}
 
+	// ICM-20948 oritentation gives Roll as lean angle.
+	ReadImu();
+	float _Roll = g_roll;
 
 	// roll history is used to determine how stable the IMU readings are before unlocking the motors/telemetry
-	rollHistory[rollHistoryPointer] = _Roll;
-	rollHistoryPointer = (rollHistoryPointer + 1) % 200;
-
-	float min = 360.0;
-	float max = 0;
-	int rollHistoryCount = 0;
-	for (int x = 0; x < 200; x++)
+	// once stable the IMU stays stable, so the history is no longer kept.
+	if (!imuStable)
 	{
-		if (rollHistory[x] != -1)
+		SlidingMinMax_Add(&rollHistory, _Roll);
+		if (SlidingMinMax_Full(&rollHistory) &&
+			fabsf(SlidingMinMax_Max(&rollHistory) - SlidingMinMax_Min(&rollHistory)) < IMU_STABLE_RANGE)
 		{
-			rollHistoryCount++;
-			if (rollHistory[x] < min)
-				min = rollHistory[x];
-			if (rollHistory[x] > max)
-				max = rollHistory[x];
+			imuStable = true;
 		}
 	}
 
-	// determine whether the IMU is stable.
-	if (!imuStable && rollHistoryCount == 200 && fabs(max - min) < 0.02)
-	{
-		imuStable = true;
-	}
-
 	// if the IMU is not stable, or the system is updating then return (motor control code after this point)
 	if (!imuStable || updating)
 	{
@@ -267,7 +313,7 @@ unsigned long loop(void)
 			details.id = MSG_TURN_DETAILS;
 			details.startHeading = turnStartHeading;
 			details.endHeading = g_heading;
-			EnqueueIntercoreMessage(&details, sizeof(details));
+			IntercoreOutbox_Post(&details, sizeof(details));
 			TurnRobotFlag = false;
 		}
 	}
@@ -275,7 +321,7 @@ unsigned long loop(void)
 	// set the PID input
 	input = _Roll;
 
-	float delta = fabs(_Roll - CalibratedSetpoint);
+	float delta = fabsf(_Roll - CalibratedSetpoint);
 
 	static unsigned long calibrationCounter = 0;
 
@@ -287,24 +333,24 @@ unsigned long loop(void)
 		calibrationCounter = 0;
 		if (!AutoCalibrateSetpoint && !ObstacleDetected && _Roll > 80)
 		{
-			setpointMotorAdjust = PIDController_Update(&pid, 0, output/100.0);
+			setpointMotorAdjust = PIDController_Update(&pid, 0, output/100.0f);
 			SpeedSetpointAdjust = setpointMotorAdjust * -1;
 		}
 	}
 
 	setpoint = CalibratedSetpoint + ToFSetpointAdjust + SpeedSetpointAdjust + RemoteFwdBackAdjust;
 
-	Compute();
+	PIDf_Compute(&balancePID);
 
 	if (!TurnRobotFlag && !ObstacleDetected && _Roll > 80 && RemoteFwdBackAdjust == 0 && RemoteRotateCommand == 0)
 	{
 		if (output > 0)
 		{
-			CalibratedSetpoint += 0.005;
+			CalibratedSetpoint += 0.005f;
 		}
 		if (output < 0)
 		{
-			CalibratedSetpoint -= 0.005;
+			CalibratedSetpoint -= 0.005f;
 		}
 	}
 
@@ -313,6 +359,12 @@ unsigned long loop(void)
 		printf("Calibrated Setpoint %3.2f | Setpoint %3.2f (Tweak %3.2f) [AutoCalib %c | calibStarted %c | Tick %d] | Delta %3.2f | Output %3.2f\n", CalibratedSetpoint, setpoint, setpointTweak, AutoCalibrateSetpoint == true ? 'Y' : 'N', autoCalibrateStarted == true ? 'Y' : 'N', AutoCalibrationTickCounter, delta, output);
 #endif
 
+	FlightSample sample = {
+		.roll = ToCenti(_Roll),
+		.setpoint = ToCenti(setpoint),
+		.output = ToCenti(output)
+	};
+
 	if (output == 0 || delta > CUT_OFF_ANGLE)
 	{
 		Tof_Active = false;
@@ -400,13 +452,171 @@ unsigned long loop(void)
 		mtk_os_hal_gpio_set_output(OS_HAL_GPIO_13, 1);
 		mtk_os_hal_pwm_config_freq_duty_normal(OS_HAL_PWM_GROUP1, PWM_CHANNEL0, PWM_PERIOD, dutyLeft);
 		mtk_os_hal_pwm_config_freq_duty_normal(OS_HAL_PWM_GROUP1, PWM_CHANNEL1, PWM_PERIOD, dutyRight);
+
+		sample.dutyLeft = output > 0 ? (int16_t)dutyLeft : -(int16_t)dutyLeft;
+		sample.dutyRight = output > 0 ? (int16_t)dutyRight : -(int16_t)dutyRight;
 	}
 
+	FlightRecorder_Record(startPeriod, &sample);
+
 	unsigned long timePeriod = millis() - startPeriod;
 
 	return timePeriod;
 }
 
+// Fuses the frames the last IMU read brought back, and updates the angles from them.
+static void ReadImu(void)
+{
+	ICM20948_Frame frames[ICM20948_MAX_FRAMES];
+	ICM20948_Mag mag;
+	const float gyroScale = DEG_TO_RAD / ICM20948_GYRO_LSB_PER_DPS;
+
+	int count = ICM20948_Poll(frames, &mag);
+	if (count < 0)
+	{
+		imuStats.readErrors++;
+		return;
+	}
+	if (count == 0)
+	{
+		return;
+	}
+
+	uint32_t start = DWT->CYCCNT;
+	for (int x = 0; x < count; x++)
+	{
+		const ICM20948_Frame* f = &frames[x];
+		// the magnetometer runs at 100 Hz, its sample goes in with the latest frame
+		if (x == count - 1 && mag.fresh)
+		{
+			Mahony_Update(&ahrs, f->gx * gyroScale, f->gy * gyroScale, f->gz * gyroScale,
+				f->ax, f->ay, f->az, mag.mx, mag.my, mag.mz);
+		}
+		else
+		{
+			Mahony_UpdateIMU(&ahrs, f->gx * gyroScale, f->gy * gyroScale, f->gz * gyroScale, f->ax, f->ay, f->az);
+		}
+
+		if (++ahrsUpdates == IMU_SETTLE_UPDATES)
+		{
+			Mahony_SetGains(&ahrs, IMU_KP, IMU_KI);
+		}
+	}
+	Mahony_GetEuler(&ahrs, &g_roll, &g_pitch, &g_yaw);
+	g_heading = g_yaw < 0 ? g_yaw + 360 : g_yaw;
+	uint32_t cycles = DWT->CYCCNT - start;
+
+	imuStats.activations++;
+	imuStats.updates += count;
+	imuStats.cycles += cycles;
+	if (cycles > imuStats.maxCycles)
+		imuStats.maxCycles = cycles;
+	if (cycles > IMU_FUSION_BUDGET_CYCLES)
+		imuStats.overBudget++;
+
+#ifdef SHOW_DEBUG_MSGS
+	if (imuStats.activations == 2000)
+	{
+		printf("IMU fusion: max %u cycles per activation, mean %u per update, %u over budget, %u read errors\r\n",
+			imuStats.maxCycles, imuStats.cycles / imuStats.updates, imuStats.overBudget, imuStats.readErrors);
+		memset(&imuStats, 0x00, sizeof(imuStats));
+	}
+#endif
+}
+
+#ifdef IMU_BENCHMARK
+#define IMU_BENCHMARK_RUNS 1000
+
+// Prints the cycles per Mahony update, with and without a magnetometer sample, from the DWT cycle
+// counter; the inputs are typical raw readings, converted up front.
+static void BenchmarkMahony(void)
+{
+	Mahony bench;
+	Mahony_Init(&bench, ICM20948_SAMPLE_HZ, IMU_KP, IMU_KI);
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	uint32_t start = DWT->CYCCNT;
+	for (int x = 0; x < IMU_BENCHMARK_RUNS; x++)
+	{
+		Mahony_UpdateIMU(&bench, 0.01f * (x % 7), -0.02f, 0.005f, 120.0f, 8150.0f + (x % 13), -300.0f);
+	}
+	uint32_t imuCycles = DWT->CYCCNT - start;
+
+	start = DWT->CYCCNT;
+	for (int x = 0; x < IMU_BENCHMARK_RUNS; x++)
+	{
+		Mahony_Update(&bench, 0.01f * (x % 7), -0.02f, 0.005f, 120.0f, 8150.0f + (x % 13), -300.0f, 150.0f, -40.0f, 260.0f);
+	}
+	uint32_t magCycles = DWT->CYCCNT - start;
+
+	float roll, pitch, yaw;
+	start = DWT->CYCCNT;
+	for (int x = 0; x < IMU_BENCHMARK_RUNS; x++)
+	{
+		Mahony_GetEuler(&bench, &roll, &pitch, &yaw);
+	}
+	uint32_t eulerCycles = DWT->CYCCNT - start;
+
+	printf("Mahony cycles: update %u, with magnetometer %u, to Euler angles %u\r\n",
+		imuCycles / IMU_BENCHMARK_RUNS, magCycles / IMU_BENCHMARK_RUNS, eulerCycles / IMU_BENCHMARK_RUNS);
+}
+#endif
+
+#ifdef PID_BENCHMARK
+#define PID_BENCHMARK_RUNS 1000
+
+// Prints the cycles per Compute() of the double PID_v1 and the float PIDf, from the DWT cycle
+// counter; both are fed the same inputs, converted up front so the loops only time the PIDs.
+static void BenchmarkPID(void)
+{
+	static double doubleInputs[20];
+	static float floatInputs[20];
+	for (int x = 0; x < 20; x++)
+	{
+		floatInputs[x] = 90.0f + (float)x * 0.05f;
+		doubleInputs[x] = floatInputs[x];
+	}
+
+	double dIn = 90.0, dOut = 0.0, dSet = SETPOINT_DEFAULT;
+	float fIn = 90.0f, fOut = 0.0f, fSet = SETPOINT_DEFAULT;
+	PIDf fPID;
+
+	PID(&dIn, &dOut, &dSet, Kp, Ki, Kd, DIRECT);
+	SetMode(AUTOMATIC);
+	SetSampleTime(CONTROL_LOOP_TICK_MS);
+	SetOutputLimits(-PID_RANGE, PID_RANGE);
+
+	PIDf_Init(&fPID, &fIn, &fOut, &fSet, Kp, Ki, Kd, P_ON_E, DIRECT);
+	PIDf_SetMode(&fPID, AUTOMATIC);
+	PIDf_SetSampleTime(&fPID, CONTROL_LOOP_TICK_MS);
+	PIDf_SetOutputLimits(&fPID, -PID_RANGE, PID_RANGE);
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	uint32_t start = DWT->CYCCNT;
+	for (int x = 0; x < PID_BENCHMARK_RUNS; x++)
+	{
+		dIn = doubleInputs[x % 20];
+		Compute();
+	}
+	uint32_t doubleCycles = DWT->CYCCNT - start;
+
+	start = DWT->CYCCNT;
+	for (int x = 0; x < PID_BENCHMARK_RUNS; x++)
+	{
+		fIn = floatInputs[x % 20];
+		PIDf_Compute(&fPID);
+	}
+	uint32_t floatCycles = DWT->CYCCNT - start;
+
+	printf("PID Compute() cycles: double %u, float %u\r\n", doubleCycles / PID_BENCHMARK_RUNS, floatCycles / PID_BENCHMARK_RUNS);
+}
+#endif
+
 bool InitHardware(void)
 {
 	// Initialize I2C (IMU)
@@ -454,50 +664,43 @@ bool InitHardware(void)
 	mtk_os_hal_pwm_start_normal(OS_HAL_PWM_GROUP1, PWM_CHANNEL1);
 	mtk_os_hal_pwm_start_normal(OS_HAL_PWM_GROUP1, PWM_CHANNEL2);
 
-	// TODO: Initialize the IMU here
-
-	PID(&input, &output, &setpoint, Kp, Ki, Kd, DIRECT);
-	SetMode(AUTOMATIC);
-	SetSampleTime(5);
-	SetOutputLimits(-PID_RANGE, PID_RANGE); // (-100,100);
-
-	return true;
-}
-
-void ToF_thread(ULONG thread_input)
-{
-	printf("Initialize ToF\r\n");
-	SelectFanoutChannel(1);
-	
-	VL53L1X_setActiveLaser(1);	// used to track which has been configued.
-
-	bool initOk = VL53L1X_init(true);
+	// the IMU's fusion is timed by the cycle counter
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 
-	if (!initOk)
+	// without it the motors are never driven, the other loops still run
+	imuPresent = ICM20948_Init();
+	if (!imuPresent)
 	{
-		printf("ToF Channel 1 failed\r\n");
-		return;
+		printf("IMU init failed\r\n");
 	}
+	Mahony_Init(&ahrs, ICM20948_SAMPLE_HZ, IMU_SETTLE_KP, IMU_KI);
 
-	VL53L1X_setDistanceMode(Long);
-	VL53L1X_setMeasurementTimingBudget(50000);
-	// Start continuous readings at a rate of one measurement every 50 ms (the
-	// inter-measurement period). This period should be at least as long as the
-	// timing budget.
-	VL53L1X_startContinuous(50);
+	SlidingMinMax_Init(&rollHistory, rollHistoryStorage, IMU_STABLE_SAMPLES);
 
-	delay(2);
+	PIDf_Init(&balancePID, &input, &output, &setpoint, Kp, Ki, Kd, P_ON_E, DIRECT);
+	PIDf_SetMode(&balancePID, AUTOMATIC);
+	PIDf_SetSampleTime(&balancePID, CONTROL_LOOP_TICK_MS);	// computed every hardware loop
+	PIDf_SetOutputLimits(&balancePID, -PID_RANGE, PID_RANGE); // (-100,100);
 
-	SelectFanoutChannel(2);
+	return true;
+}
 
-	VL53L1X_setActiveLaser(1);	// used to track which has been configued.
+// The ToF sensors range continuously and concurrently, each activation reads out every sensor
+// with a measurement ready, so a sweep of them all takes one ToF period rather than one each.
+#define TOF_SENSORS 2
+static const uint8_t tofFanoutChannels[TOF_SENSORS] = { 1, 2 };	// front, rear
+static const float tofSetpointAdjust[TOF_SENSORS] = { -1.5, 1.5 };	// lean away from the obstacle
 
-	initOk = VL53L1X_init(true);
+static bool InitToF(int index)
+{
+	SelectFanoutChannel(tofFanoutChannels[index]);
+	VL53L1X_setActiveLaser(index);	// used to track which has been configued.
 
-	if (!initOk)
+	if (!VL53L1X_init(true))
 	{
-		printf("ToF Channel 2 failed\r\n");
-		return;
+		printf("ToF Channel %d failed\r\n", tofFanoutChannels[index]);
+		return false;
 	}
 
 	VL53L1X_setDistanceMode(Long);
@@ -507,33 +710,49 @@ void ToF_thread(ULONG thread_input)
 	// timing budget.
 	VL53L1X_startContinuous(50);
 
-	SelectFanoutChannel(1);
+	return true;
+}
 
-	bool useFrontToF = true;		// TODO: tick/tock on front/rear sensors.
+void ToF_thread(ULONG thread_input)
+{
+	printf("Initialize ToF\r\n");
 
-	ULONG   actual_flags = 0;
+	for (int index = 0; index < TOF_SENSORS; index++)
+	{
+		if (!InitToF(index))
+		{
+			return;
+		}
+	}
 
-	uint16_t distances[2];	// front and rear lasers.
 	// setup last distances to be 'far'.
-	uint16_t lastDistances[2] = { 2400,2400 };
+	uint16_t lastDistances[TOF_SENSORS] = { 2400,2400 };
 
-	bool obstacles[2] = { false, false };
+	bool obstacles[TOF_SENSORS] = { false, false };
 
 	while (true)
 	{
 		// wait on timer tick.
-		tx_event_flags_get(&ToF_event_flags_0, 0x1, TX_OR_CLEAR, &actual_flags, TX_WAIT_FOREVER);
+		ControlLoop_Wait(&ToFLoop);
 
-		if (Tof_Active)
+		for (int index = 0; Tof_Active && index < TOF_SENSORS; index++)
 		{
-			int index = useFrontToF == true ? 0 : 1;
-			distances[index] = VL53L1X_read(true);
+			SelectFanoutChannel(tofFanoutChannels[index]);
+			VL53L1X_setActiveLaser(index);
 
-			if (distances[index] != 0)
+			// still integrating, it's picked up next period
+			if (!VL53L1X_dataReady())
+			{
+				continue;
+			}
+
+			uint16_t distance = VL53L1X_read(false);
+
+			if (distance != 0)
 			{
 				// Log_Debug("ToF Distance %d\r\n", distance);
 
-				if (distances[index] < TOF_OBSTACLE_DISTANCE_MM && distances[index] > 0 && !obstacles[index])
+				if (distance < TOF_OBSTACLE_DISTANCE_MM && distance > 0 && !obstacles[index])
 				{
 					mtk_os_hal_pwm_config_freq_duty_normal(OS_HAL_PWM_GROUP1, PWM_CHANNEL2, PWM_PERIOD, 1000);
 					// Log_Debug("Obstacle Found - adjusting setpoint\n");
@@ -541,18 +760,11 @@ void ToF_thread(ULONG thread_input)
 					ObstacleDetected = true;
 					ToF_ObstacleCounter++;
 
-					if (useFrontToF)
-					{
-						ToFSetpointAdjust = -1.5;
-					}
-					else
-					{
-						ToFSetpointAdjust = 1.5;
-					}
+					ToFSetpointAdjust = tofSetpointAdjust[index];
 				}
 
 				// see if we're moving away, and if yes, cancel the movement.
-				if (obstacles[index] && lastDistances[index] < distances[index] && distances[index] > 0) //distances[index] > 100 && obstacles[index])
+				if (obstacles[index] && lastDistances[index] < distance && distance > 0) //distance > 100 && obstacles[index])
 				{
 					mtk_os_hal_pwm_config_freq_duty_normal(OS_HAL_PWM_GROUP1, PWM_CHANNEL2, PWM_PERIOD, 0);
 					obstacles[index] = false;
@@ -560,10 +772,10 @@ void ToF_thread(ULONG thread_input)
 					ToFSetpointAdjust = 0.0;
 				}
 			}
-			lastDistances[index] = distances[index];
-			useFrontToF = !useFrontToF;
-			SelectFanoutChannel(useFrontToF == true ? 1 : 2);
+			lastDistances[index] = distance;
 		}
+
+		ControlLoop_Done(&ToFLoop);
 	}
 
 	printf("ToF Thread exit\r\n");
@@ -571,118 +783,224 @@ void ToF_thread(ULONG thread_input)
 
 void Intercore_thread(ULONG thread_input)
 {
-	ULONG   actual_flags = 0;
-
 	printf("Intercore Thread Starting\r\n");
 
 	struct TURN_ROBOT* pTurn;
 	struct SETPOINT* pSetpoint;
 	struct REMOTE_CMD* pRemote;
 	struct UPDATE_ACTIVE* pUpdate;
+	struct TELEMETRY_STREAM* pStream;
+	struct REMOTE_CMD_SEQ* pRemoteSeq;
+	struct FLIGHT_RECORDER* pRecorder;
 
 	while (true)
 	{
 		// wait on timer tick.
-		tx_event_flags_get(&Intercore_event_flags_0, 0x1, TX_OR_CLEAR, &actual_flags, TX_WAIT_FOREVER);
-		dataSize = sizeof(buf);
-		int r = DequeueData(outbound, inbound, sharedBufSize, buf, &dataSize);
-		if (r == 0 && dataSize > payloadStart) {
-			size_t payloadBytes = dataSize - payloadStart;
-			if (payloadBytes > 0) {
-				switch (buf[payloadStart]) {
-				case MSG_UPDATE_ACTIVE:
-					pUpdate = (struct UPDATE_ACTIVE*)&buf[payloadStart];
-					if (pUpdate->updateActive)
-					{
-						updating = true;
-					}
-					else
-					{
-						updating = false;
-					}
-					break;
-				case MSG_REMOTE_CMD:
-					pRemote=(struct REMOTE_CMD*)&buf[payloadStart];
-					switch (pRemote->cmd)
-					{
-					case 4:	// stop.
-						RemoteFwdBackAdjust = 0.0;
-						RemoteRotateCommand = 0;
-						break;
-					case 1:	// foreward
-						RemoteFwdBackAdjust = 1.5;
-						RemoteRotateCommand = 0;
-						break;
-					case 3:	// back
-						RemoteFwdBackAdjust = -1.5;
-						RemoteRotateCommand = 0;
-						break;
-					case 2:		// right
-						RemoteFwdBackAdjust = 0.0;
-						RotateClockwise = false;
-						RemoteRotateCommand = 2;	// right
-							break;
-					case 0:		// left
-						RemoteFwdBackAdjust = 0.0;
-						RotateClockwise = true;
-						RemoteRotateCommand = 1;	// left.
-						break;
-					default:
-						break;
-					};
-					break;
-				case MSG_IMU_STABLE_REQUEST:
-					tImuStatusMsg.id = MSG_IMU_STABLE_RESULT;
-					tImuStatusMsg.imuStable = imuStable;
-					EnqueueIntercoreMessage(&tImuStatusMsg, sizeof(tImuStatusMsg));
-					break;
-				case MSG_TELEMETRY_REQUEST:
-					haveHLApp = true;		// have received at least one message from the HL App, can now start sending IMU telemetry.
-					tMsg.id = MSG_DEVICE_STATUS;
-					tMsg.timestamp = millis();
-					tMsg.numObstaclesDetected = ToF_ObstacleCounter;
-					tMsg.setpoint = CalibratedSetpoint;
-					tMsg.pitch = g_pitch;
-					tMsg.yaw = g_heading;
-					tMsg.roll = g_roll;
-					tMsg.turnNorth = TurnRobotFlag;
-					tMsg.avoidActive = ObstacleDetected;
-					EnqueueIntercoreMessage(&tMsg, sizeof(tMsg));
-					break;
-				case MSG_SETPOINT:
-					pSetpoint = (struct SETPOINT*)&buf[payloadStart];
-					if (pSetpoint->setpoint > 80 && pSetpoint->setpoint < 100)
+		ControlLoop_Wait(&IntercoreLoop);
+		// every waiting message, so a remote command isn't held behind the others for a period each
+		while (true)
+		{
+			dataSize = sizeof(buf);
+			if (DequeueData(outbound, inbound, sharedBufSize, buf, &dataSize) != 0)
+				break;
+			if (dataSize <= payloadStart)
+				continue;
+
+			switch (buf[payloadStart]) {
+			case MSG_UPDATE_ACTIVE:
+				pUpdate = (struct UPDATE_ACTIVE*)&buf[payloadStart];
+				if (pUpdate->updateActive)
+				{
+					updating = true;
+				}
+				else
+				{
+					updating = false;
+				}
+				break;
+			case MSG_REMOTE_CMD:
+				pRemote=(struct REMOTE_CMD*)&buf[payloadStart];
+				remoteDeadlineArmed = false;		// unsequenced commands last until the next
+				ApplyRemoteCommand(pRemote->cmd);
+				break;
+			case MSG_IMU_STABLE_REQUEST:
+				tImuStatusMsg.id = MSG_IMU_STABLE_RESULT;
+				tImuStatusMsg.imuStable = imuStable;
+				IntercoreOutbox_Post(&tImuStatusMsg, sizeof(tImuStatusMsg));
+				break;
+			case MSG_LOOP_TIMING_REQUEST:
+				ControlLoop_Report(&hardwareLoop);
+				ControlLoop_Report(&ToFLoop);
+				ControlLoop_Report(&IntercoreLoop);
+				break;
+			case MSG_TELEMETRY_REQUEST:
+				haveHLApp = true;		// have received at least one message from the HL App, can now start sending IMU telemetry.
+				tMsg.id = MSG_DEVICE_STATUS;
+				tMsg.timestamp = millis();
+				tMsg.numObstaclesDetected = ToF_ObstacleCounter;
+				tMsg.setpoint = CalibratedSetpoint;
+				tMsg.pitch = g_pitch;
+				tMsg.yaw = g_heading;
+				tMsg.roll = g_roll;
+				tMsg.turnNorth = TurnRobotFlag;
+				tMsg.avoidActive = ObstacleDetected;
+				IntercoreOutbox_Post(&tMsg, sizeof(tMsg));
+				break;
+			case MSG_REMOTE_CMD_SEQ:
+				pRemoteSeq = (struct REMOTE_CMD_SEQ*)&buf[payloadStart];
+				HandleRemoteCommandSeq(pRemoteSeq);
+				break;
+			case MSG_TELEMETRY_STREAM:
+				pStream = (struct TELEMETRY_STREAM*)&buf[payloadStart];
+				haveHLApp = true;
+				telemetryPeriodMs = pStream->periodMs;
+				lastTelemetrySample = millis() - telemetryPeriodMs;	// first sample this activation
+				break;
+			case MSG_FLIGHT_RECORDER:
+				pRecorder = (struct FLIGHT_RECORDER*)&buf[payloadStart];
+				FlightRecorder_Control(pRecorder->mode);
+				break;
+			case MSG_SETPOINT:
+				pSetpoint = (struct SETPOINT*)&buf[payloadStart];
+				if (pSetpoint->setpoint > 80 && pSetpoint->setpoint < 100)
+				{
+					CalibratedSetpoint = pSetpoint->setpoint;
+				}
+				break;
+			case MSG_TURN_ROBOT:
+				pTurn = (struct TURN_ROBOT*)&buf[payloadStart];
+				
+				// accept the turn if we're stood up.
+				if (g_roll > 80)
+				{
+					if (pTurn->enabled)
 					{
-						CalibratedSetpoint = pSetpoint->setpoint;
+						RotateClockwise = GetRotationDirection(g_heading, pTurn->heading);
 					}
-					break;
-				case MSG_TURN_ROBOT:
-					pTurn = (struct TURN_ROBOT*)&buf[payloadStart];
-					
-					// accept the turn if we're stood up.
-					if (g_roll > 80)
+					turnHeading = pTurn->heading;
+					TurnRobotFlag = pTurn->enabled;
+					if (TurnRobotFlag)
 					{
-						if (pTurn->enabled)
-						{
-							RotateClockwise = GetRotationDirection(g_heading, pTurn->heading);
-						}
-						turnHeading = pTurn->heading;
-						TurnRobotFlag = pTurn->enabled;
-						if (TurnRobotFlag)
-						{
-							// store current heading (used in telemetry).
-							turnStartHeading = g_heading;
-						}
+						// store current heading (used in telemetry).
+						turnStartHeading = g_heading;
 					}
-					break;
-				};
-			}
+				}
+				break;
+			};
 		}
+
+		// the controller has gone quiet
+		if (remoteDeadlineArmed && (long)(millis() - remoteDeadline) >= 0)
+		{
+			remoteDeadlineArmed = false;
+			ApplyRemoteCommand(4);	// stop
+		}
+
+		if (telemetryPeriodMs != 0 && millis() - lastTelemetrySample >= telemetryPeriodMs)
+		{
+			lastTelemetrySample = millis();
+			PostTelemetrySample();
+		}
+
+		// telemetry posted since the last activation, the latest of each, in as few frames as fit
+		IntercoreOutbox_Drain(SendIntercoreMessage);
+		FlightRecorder_Send(SendIntercoreMessage);
+		FlushIntercoreBatch();
+
+		ControlLoop_Done(&IntercoreLoop);
 	}
 
 	printf("Intercore Thread exit\r\n");
 }
 
+// 0-4 = left, right, forward, back, and stop
+static void ApplyRemoteCommand(uint8_t cmd)
+{
+	switch (cmd)
+	{
+	case 4:	// stop.
+		RemoteFwdBackAdjust = 0.0;
+		RemoteRotateCommand = 0;
+		break;
+	case 1:	// foreward
+		RemoteFwdBackAdjust = 1.5;
+		RemoteRotateCommand = 0;
+		break;
+	case 3:	// back
+		RemoteFwdBackAdjust = -1.5;
+		RemoteRotateCommand = 0;
+		break;
+	case 2:		// right
+		RemoteFwdBackAdjust = 0.0;
+		RotateClockwise = false;
+		RemoteRotateCommand = 2;	// right
+		break;
+	case 0:		// left
+		RemoteFwdBackAdjust = 0.0;
+		RotateClockwise = true;
+		RemoteRotateCommand = 1;	// left.
+		break;
+	default:
+		break;
+	}
+}
+
+static void HandleRemoteCommandSeq(const struct REMOTE_CMD_SEQ* pRemote)
+{
+	unsigned long now = millis();
+
+	// latest wins: a duplicate, or one overtaken by a newer command, is dropped
+	if (remoteSeqValid && now - remoteSeqTime <= REMOTE_CMD_MAX_TTL_MS && (int16_t)(pRemote->seq - remoteSeq) <= 0)
+	{
+		return;
+	}
+
+	remoteSeq = pRemote->seq;
+	remoteSeqValid = true;
+	remoteSeqTime = now;
+
+	uint32_t ttl = pRemote->ttlMs == 0 || pRemote->ttlMs > REMOTE_CMD_MAX_TTL_MS ? REMOTE_CMD_MAX_TTL_MS : pRemote->ttlMs;
+	remoteDeadline = now + ttl;
+	remoteDeadlineArmed = pRemote->cmd != 4;
+	ApplyRemoteCommand(pRemote->cmd);
+
+	struct REMOTE_CMD_ACK ack = {
+		.id = MSG_REMOTE_CMD_ACK,
+		.cmd = pRemote->cmd,
+		.seq = pRemote->seq,
+		.sentMs = pRemote->sentMs
+	};
+	IntercoreOutbox_Post(&ack, sizeof(ack));
+}
+
+// hundredths, saturated to the sample's 16 bits
+static int16_t ToCenti(float value)
+{
+	float centi = value * 100.0f;
+	if (centi > INT16_MAX)
+		return INT16_MAX;
+	if (centi < INT16_MIN)
+		return INT16_MIN;
+	return (int16_t)centi;
+}
+
+static void PostTelemetrySample(void)
+{
+	struct TELEMETRY_SAMPLE sample;
+
+	sample.id = MSG_TELEMETRY_SAMPLE;
+	sample.flags = (ObstacleDetected ? TELEMETRY_FLAG_AVOID_ACTIVE : 0) | (TurnRobotFlag ? TELEMETRY_FLAG_TURN_NORTH : 0);
+	sample.numObstaclesDetected = ToF_ObstacleCounter > UINT16_MAX ? UINT16_MAX : (uint16_t)ToF_ObstacleCounter;
+	sample.timestamp = millis();
+	sample.roll = ToCenti(g_roll);
+	sample.pitch = ToCenti(g_pitch);
+	sample.yaw = g_heading < 0 || g_heading >= 360 ? 0 : (uint16_t)(g_heading * 100.0f);
+	sample.setpoint = ToCenti(CalibratedSetpoint);
+	sample.output = ToCenti(output);
+
+	IntercoreOutbox_Post(&sample, sizeof(sample));
+}
+
 static bool GetRotationDirection(float current, float desired)
 {
 	bool increment = false;
@@ -704,98 +1022,108 @@ static bool GetRotationDirection(float current, float desired)
 	return increment;
 }
 
-void EnqueueIntercoreMessage(void* payload, size_t payload_size)
+// Sends the batch filled so far as one frame, a single message goes as it is.
+static bool FlushIntercoreBatch(void)
 {
-	uint8_t sendbuf[64];
+	struct BATCH_HEADER* header = (struct BATCH_HEADER*)&batchFrame[payloadStart];
+	size_t frameSize = payloadStart + batchSize;
 
-	if ((payloadStart + payload_size) > sizeof(sendbuf)) {
-		printf("EnqueueIntercoreMessage insufficient buffer\n");
-		return;
+	if (batchSize == 0)
+		return true;
+
+	// the header is the component id, zero padded to payloadStart
+	memcpy(batchFrame, HighLevelAppComponentId, sizeof(HighLevelAppComponentId));
+	memset(&batchFrame[sizeof(HighLevelAppComponentId)], 0x00, payloadStart - sizeof(HighLevelAppComponentId));
+
+	uint8_t* frame = batchFrame;
+	if (header->count == 1)
+	{
+		// move the frame header up to the lone message, over the batch and record headers
+		size_t skip = sizeof(struct BATCH_HEADER) + sizeof(struct BATCH_RECORD);
+		memmove(&batchFrame[skip], batchFrame, payloadStart);
+		frame = &batchFrame[skip];
+		frameSize -= skip;
 	}
 
-	memset(sendbuf, 0x00, 64);
-	memcpy(sendbuf, HighLevelAppComponentId, sizeof(HighLevelAppComponentId));
-	memcpy(&sendbuf[payloadStart], payload, payload_size);
-	int result = EnqueueData(inbound, outbound, sharedBufSize, sendbuf, payloadStart + payload_size);
-	if (result != 0)
+	batchSize = 0;
+	if (EnqueueData(inbound, outbound, sharedBufSize, frame, frameSize) != 0)
 	{
 		printf("Unable to queue intercore data\r\n");
+		return false;
 	}
+	return true;
+}
+
+// Adds the message to this activation's batch, sending the batch first if the message doesn't
+// fit. Messages already in a batch the shared buffer refuses are lost, they would be stale by the
+// time the HL app caught up anyway; the message being added is refused with them, so the outbox
+// keeps it for the next activation.
+static bool SendIntercoreMessage(const void* payload, size_t payload_size)
+{
+	struct BATCH_HEADER* header = (struct BATCH_HEADER*)&batchFrame[payloadStart];
+	size_t recordSize = sizeof(struct BATCH_RECORD) + payload_size;
+
+	if (sizeof(struct BATCH_HEADER) + recordSize > INTERCORE_MAX_PAYLOAD) {
+		printf("EnqueueIntercoreMessage insufficient buffer\n");
+		return false;
+	}
+
+	if (batchSize + recordSize > INTERCORE_MAX_PAYLOAD && !FlushIntercoreBatch())
+		return false;
+
+	if (batchSize == 0)
+	{
+		header->id = MSG_INTERCORE_BATCH;
+		header->version = INTERCORE_WIRE_VERSION;
+		header->count = 0;
+		batchSize = sizeof(struct BATCH_HEADER);
+	}
+
+	struct BATCH_RECORD* record = (struct BATCH_RECORD*)&batchFrame[payloadStart + batchSize];
+	record->size = (uint8_t)payload_size;
+	memcpy(&batchFrame[payloadStart + batchSize + sizeof(struct BATCH_RECORD)], payload, payload_size);
+	batchSize += recordSize;
+	header->count++;
+	return true;
+}
+
+// Not coalesced, for replies from the Intercore thread that are all wanted (a timing report per
+// loop, say), but batched with the rest of the activation's messages; telemetry from the other
+// threads goes through IntercoreOutbox_Post.
+void EnqueueIntercoreMessage(void* payload, size_t payload_size)
+{
+	SendIntercoreMessage(payload, payload_size);
 }
 
 int GetCompassDirection(float compassAngle)
 {
-	int pos = (int)((compassAngle / 22.5) + .5);
+	int pos = (int)((compassAngle / 22.5f) + .5f);
 	pos = pos % 16;
 	return pos;
 }
 
 void hardware_thread(ULONG thread_input)
 {
-	ULONG   actual_flags = 0;
-#ifdef SHOW_DEBUG_MSGS
-	unsigned long last = 0;
-	unsigned long now = 0;
-	unsigned long delta = 0;
-	unsigned long loopTime = 0;
-#endif
-
 	printf("hardware thread starting...\r\n");
 
+	// jitter and overruns are collected by the loop, and printed with SHOW_DEBUG_MSGS
 	while (true)
 	{
-		tx_event_flags_get(&hardware_event_flags_0, 0x1, TX_OR_CLEAR, &actual_flags, TX_WAIT_FOREVER);
-#ifdef SHOW_DEBUG_MSGS
-		loopTime = loop();
-		now = millis();
-		delta = now - last;
-		last = now;
-
-		printf("%u | %u | %s - Loop: %u\r\n",now, delta, delta > 5 ? "***"  : " ",loopTime);
-#else
+		ControlLoop_Wait(&hardwareLoop);
 		loop();
-#endif
-
+		ControlLoop_Done(&hardwareLoop);
 	}
 }
 
 void timerFn(ULONG input)
 {
-	static unsigned long IntercoreTickCounter = 0;
-	static unsigned long ToFTickCounter = 0;
-	ULONG status = TX_SUCCESS;
-
 	if (hardwareInitOK == true)
 	{
-		status = tx_event_flags_set(&hardware_event_flags_0, 0x1, TX_OR);
-		if (status != TX_SUCCESS)
-		{
-			printf("failed to set hardware event flags\r\n");
-		}
-
-		ToFTickCounter++;
-		if (ToFTickCounter == 20)	// 100ms
-		{
-			ToFTickCounter=0;
-			status = tx_event_flags_set(&ToF_event_flags_0, 0x1, TX_OR);
-			if (status != TX_SUCCESS)
-			{
-				printf("failed to set ToF event flags\r\n");
-			}
-		}
-
+		ControlLoop_Tick(&hardwareLoop);
+		ControlLoop_Tick(&ToFLoop);
 		// Azure HL App 'Device Twin' check is every 5 seconds
 		// Request for Telemetry is every 20 seconds.
-		IntercoreTickCounter++;
-		if (IntercoreTickCounter == 100)	// 0.5 seconds.
-		{
-			IntercoreTickCounter = 0;
-			status = tx_event_flags_set(&Intercore_event_flags_0, 0x1, TX_OR);
-			if (status != TX_SUCCESS)
-			{
-				printf("failed to set Intercore event flags\r\n");
-			}
-		}
+		ControlLoop_Tick(&IntercoreLoop);
 	}
 }
 
@@ -804,12 +1132,18 @@ void hardware_init_thread(ULONG thread_input)
 {
 	printf("Hardware Init Thread - start: %u\r\n", millis());
 	UINT status = TX_SUCCESS;
+#ifdef PID_BENCHMARK
+	BenchmarkPID();
+#endif
+#ifdef IMU_BENCHMARK
+	BenchmarkMahony();
+#endif
 	bool hwInitOk = InitHardware();
 
 	if (hwInitOk)
 	{
 		hardwareInitOK = true;
-		status = tx_timer_create(&msTimer, "5ms Timer", timerFn, 0, 5, 5, TX_AUTO_ACTIVATE);
+		status = tx_timer_create(&msTimer, "5ms Timer", timerFn, 0, CONTROL_LOOP_TICK_MS, CONTROL_LOOP_TICK_MS, TX_AUTO_ACTIVATE);
 		if (status != TX_SUCCESS)
 		{
 			printf("failed to create timer\r\n");
@@ -846,23 +1180,30 @@ void tx_application_define(void* first_unused_memory) {
 	/* Create a byte memory pool from which to allocate the thread stacks.  */
 	tx_byte_pool_create(&byte_pool_0, "byte pool 0", memory_area, DEMO_BYTE_POOL_SIZE);
 
-	// create event flags
-	status = tx_event_flags_create(&hardware_event_flags_0, "Hardware Event");		// Hardware events fire every 5 ms
+	// create the periodic loops
+	status = ControlLoop_Create(&hardwareLoop, "Hardware Event", LOOP_ID_IMU, 5);		// Hardware events fire every 5 ms
 	if (status != TX_SUCCESS)
 	{
-		printf("failed to create hardware_event_flags\r\n");
+		printf("failed to create hardware loop\r\n");
 	}
 
-	status = tx_event_flags_create(&ToF_event_flags_0, "ToF Event");					// ToF events fire every 100 ms
+	status = ControlLoop_Create(&ToFLoop, "ToF Event", LOOP_ID_TOF, 100);				// ToF events fire every 100 ms
 	if (status != TX_SUCCESS)
 	{
-		printf("failed to create ToF_event_flags\r\n");
+		printf("failed to create ToF loop\r\n");
 	}
 
-	status = tx_event_flags_create(&Intercore_event_flags_0, "Intercore Event");		// Intercore events fire every 10 ms
+	status = ControlLoop_Create(&IntercoreLoop, "Intercore Event", LOOP_ID_INTERCORE, 50);	// Intercore events fire every 50 ms, the remote control latency
 	if (status != TX_SUCCESS)
 	{
-		printf("failed to create Intercore_event_flags\r\n");
+		printf("failed to create Intercore loop\r\n");
+	}
+
+	// the I2C bus servers run at the hardware thread's priority, so a queued transfer isn't held behind the ToF and intercore threads
+	status = I2CQueue_Init(&byte_pool_0, 1);
+	if (status != TX_SUCCESS)
+	{
+		printf("failed to start the I2C queues\r\n");
 	}
 
 	/* Allocate the stack for thread 0.  */
@@ -872,14 +1213,14 @@ void tx_application_define(void* first_unused_memory) {
 		pointer, DEMO_STACK_SIZE, 1, 1, TX_NO_TIME_SLICE, TX_AUTO_START);
 
 	tx_byte_allocate(&byte_pool_0, (VOID**)&pointer, DEMO_STACK_SIZE, TX_NO_WAIT);
-	/* Create the Time of Flight thread.  */
+	/* Create the Time of Flight thread, it runs more often than the intercore thread so preempts it.  */
 	tx_thread_create(&tx_ToF_Thread, "ToF Thread", ToF_thread, 0,
-		pointer, DEMO_STACK_SIZE, 8, 8, TX_NO_TIME_SLICE, TX_AUTO_START);
+		pointer, DEMO_STACK_SIZE, 4, 4, TX_NO_TIME_SLICE, TX_AUTO_START);
 
 	tx_byte_allocate(&byte_pool_0, (VOID**)&pointer, DEMO_STACK_SIZE, TX_NO_WAIT);
 	/* Create the intercore msg thread.  */
 	tx_thread_create(&tx_Intercore_Thread, "Intercore Thread", Intercore_thread, 0,
-		pointer, DEMO_STACK_SIZE, 4, 4, TX_NO_TIME_SLICE, TX_AUTO_START);
+		pointer, DEMO_STACK_SIZE, 8, 8, TX_NO_TIME_SLICE, TX_AUTO_START);
 
 	tx_byte_allocate(&byte_pool_0, (VOID**)&pointer, DEMO_STACK_SIZE, TX_NO_WAIT);
 	// Create a hardware init thread.
@@ -3,12 +3,87 @@
 #include "utils.h"
 #include <tx_api.h>
 #include "i2c.h"
+#include "mt3620.h"
 
 unsigned long millis(void)
 {
 	return tx_time_get();
 }
 
+// The ms tick plus how far SysTick has counted down towards the next one.
+unsigned long micros(void)
+{
+	ULONG ms;
+	uint32_t count;
+	bool pending;
+
+	do
+	{
+		ms = tx_time_get();
+		count = SysTick->VAL;
+		pending = (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) != 0;
+	} while (ms != tx_time_get());
+
+	// SysTick has reloaded, but its interrupt hasn't run yet (interrupts are off)
+	if (pending && count > SysTick->LOAD / 2)
+		ms++;
+
+	return ms * 1000 + ((SysTick->LOAD - count) * 1000) / (SysTick->LOAD + 1);
+}
+
+void SlidingMinMax_Init(SlidingMinMax* sm, SlidingEntry* storage, uint32_t window)
+{
+	memset(sm, 0x00, sizeof(*sm));
+	sm->window = window;
+	sm->minQ = storage;
+	sm->maxQ = storage + window;
+}
+
+// adds value to one deque, dropping what has left the window and what value makes redundant
+static void SlidingQueue_Add(SlidingEntry* q, uint32_t* head, uint32_t* size, uint32_t window, uint32_t seq, float value, bool keepMin)
+{
+	if (*size > 0 && seq - q[*head].seq >= window)
+	{
+		*head = (*head + 1) % window;
+		(*size)--;
+	}
+
+	while (*size > 0)
+	{
+		float last = q[(*head + *size - 1) % window].value;
+		if (keepMin ? last < value : last > value)
+			break;
+		(*size)--;
+	}
+
+	SlidingEntry* e = &q[(*head + *size) % window];
+	e->seq = seq;
+	e->value = value;
+	(*size)++;
+}
+
+void SlidingMinMax_Add(SlidingMinMax* sm, float value)
+{
+	uint32_t seq = sm->count++;
+	SlidingQueue_Add(sm->minQ, &sm->minHead, &sm->minSize, sm->window, seq, value, true);
+	SlidingQueue_Add(sm->maxQ, &sm->maxHead, &sm->maxSize, sm->window, seq, value, false);
+}
+
+bool SlidingMinMax_Full(const SlidingMinMax* sm)
+{
+	return sm->count >= sm->window;
+}
+
+float SlidingMinMax_Min(const SlidingMinMax* sm)
+{
+	return sm->minSize > 0 ? sm->minQ[sm->minHead].value : 0.0f;
+}
+
+float SlidingMinMax_Max(const SlidingMinMax* sm)
+{
+	return sm->maxSize > 0 ? sm->maxQ[sm->maxHead].value : 0.0f;
+}
+
 void EnumI2CDevices(i2c_num driver)
 {
     printf("Enumerate I2C Devices\r\n");
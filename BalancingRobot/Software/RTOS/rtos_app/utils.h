@@ -29,7 +29,33 @@ void EnqueueCallback(CallbackNode* node);
 // Intercore communication
 void EnqueueIntercoreMessage(void* payload, size_t payload_size);
 
+// Min and max over the last `window` samples, in amortized O(1) per sample: each deque keeps only
+// the samples that can still become the min (or max) before they leave the window.
+typedef struct SlidingEntry {
+    uint32_t seq;
+    float value;
+} SlidingEntry;
+
+typedef struct SlidingMinMax {
+    uint32_t window;
+    uint32_t count;         // samples added so far
+    SlidingEntry* minQ;     // rising values, oldest at head
+    SlidingEntry* maxQ;     // falling values, oldest at head
+    uint32_t minHead, minSize;
+    uint32_t maxHead, maxSize;
+} SlidingMinMax;
+
+// storage holds 2 * window entries.
+void SlidingMinMax_Init(SlidingMinMax* sm, SlidingEntry* storage, uint32_t window);
+void SlidingMinMax_Add(SlidingMinMax* sm, float value);
+// True once window samples have been added.
+bool SlidingMinMax_Full(const SlidingMinMax* sm);
+float SlidingMinMax_Min(const SlidingMinMax* sm);
+float SlidingMinMax_Max(const SlidingMinMax* sm);
+
 unsigned long millis(void);
+// Microseconds since boot, wraps after ~71 minutes.
+unsigned long micros(void);
 void EnumI2CDevices(i2c_num driver);
 
 void DumpBuffer(uint8_t* buffer, uint16_t length);
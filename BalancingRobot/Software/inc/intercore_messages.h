@@ -9,6 +9,24 @@
 //   First byte is the message ID
 //   Remainder of payload is specific to each message ID
 //
+// Both cores build from this header, but the A7 and the M4 are separate compilers and apps, so
+// messages are packed with no padding and every size is checked at compile time; a field that
+// changes size on either side breaks the build rather than the wire. Packed structs are byte
+// aligned, so a message can be read in place from a receive buffer at any offset.
+//
+// A frame is either one message, or a MSG_INTERCORE_BATCH carrying several (see below). The M4 batches what
+// it sends in an activation of its intercore loop; the A7 accepts both, and sends single messages.
+//
+
+#define INTERCORE_PACKED __attribute__((packed))
+#define INTERCORE_SIZE(name, size) _Static_assert(sizeof(struct name) == (size), #name " changed size on the wire")
+
+// Bumped whenever a message changes layout; a batch from another version is dropped whole.
+#define INTERCORE_WIRE_VERSION 1
+
+// Payload of one intercore frame, after the 20 byte header the M4 sees (the A7 doesn't).
+#define INTERCORE_HEADER_SIZE 20
+#define INTERCORE_MAX_PAYLOAD 236
 
 //
 // Messages from high-level app to bare-metal app
@@ -17,7 +35,7 @@
 // Debug Message being passed from the M4 to the A7
 // Payload is 3x float (Pitch, Yaw, Roll)
 #define MSG_DEBUG_YPR 0x01
-struct DEBUG_YPR {
+struct INTERCORE_PACKED DEBUG_YPR {
     uint8_t id; // MSG_DEBUG_YPR
     float pitch;
     float yaw;
@@ -27,29 +45,32 @@ struct DEBUG_YPR {
     double output;
     unsigned long duty;
 };
+INTERCORE_SIZE(DEBUG_YPR, 37);
 
 
 // Debug Message being passed from the M4 to the A7
 // Payload is bool - Init Completed/Failed.
 #define MSG_DEBUG_INIT 0x02
-struct DEBUG_INIT {
+struct INTERCORE_PACKED DEBUG_INIT {
     uint8_t id; // MSG_DEBUG_INIT
     bool InitCompleted;
 };
+INTERCORE_SIZE(DEBUG_INIT, 2);
 
 // Debug Message being passed from the M4 to the A7
 // Payload is ISU Number (0, 1, 2, 3), and 5x uint8_t for found addresses.
 #define MSG_DEBUG_I2C_ENUM 0x03
-struct DEBUG_I2C_ENUM {
+struct INTERCORE_PACKED DEBUG_I2C_ENUM {
     uint8_t id; // MSG_DEBUG_INIT
     uint8_t ISU_Num;
     uint8_t devices[5];
 };
+INTERCORE_SIZE(DEBUG_I2C_ENUM, 7);
 
 // Debug Message being passed from the M4 to the A7
 // Initialization State.
 #define MSG_DEBUG_INIT_STATE 0x04
-struct DEBUG_INIT_STATE {
+struct INTERCORE_PACKED DEBUG_INIT_STATE {
     uint8_t id; // MSG_DEBUG_INIT_STATE
     bool ToF_Channel1;
     bool ToF_Channel2;
@@ -58,25 +79,28 @@ struct DEBUG_INIT_STATE {
     bool IMU_Found;
     bool MAG_Found;
 };
+INTERCORE_SIZE(DEBUG_INIT_STATE, 7);
 
 // WiFi State Message being passed from the A7 to the M4
 #define MSG_WIFI_STATE 0x05
-struct WIFI_STATE {
+struct INTERCORE_PACKED WIFI_STATE {
     uint8_t id; // MSG_WIFI_STATE
     bool WiFiState;
 };
+INTERCORE_SIZE(WIFI_STATE, 2);
 
 // ToF Data (front == 1, back == 2), distance == mm.
 #define MSG_TOF_STATE 0x06
-struct TOF_STATE {
+struct INTERCORE_PACKED TOF_STATE {
     uint8_t id; // MSG_TOF_STATE
     int ToFSensorId;
     int distance;
 };
+INTERCORE_SIZE(TOF_STATE, 9);
 
 // High Level app - device status.
 #define MSG_DEVICE_STATUS 0x07
-struct DEVICE_STATUS {
+struct INTERCORE_PACKED DEVICE_STATUS {
     uint8_t id; // MSG_DEVICE_STATUS
     unsigned long timestamp;
     float setpoint;
@@ -88,64 +112,215 @@ struct DEVICE_STATUS {
     bool avoidActive;
     bool turnNorth;
 };
+INTERCORE_SIZE(DEVICE_STATUS, 35);
 
 // High Level app - IoTC Message to turn north.
 #define MSG_TURN_ROBOT 0x08
-struct TURN_ROBOT {
+struct INTERCORE_PACKED TURN_ROBOT {
     uint8_t id; // MSG_DEVICE_STATUS
     int heading;
     bool enabled;
 };
+INTERCORE_SIZE(TURN_ROBOT, 6);
 
 // ToF counter for obstacles found.
 #define MSG_TOF_OBSTACLE 0x09
-struct TOF_OBSTACLE {
+struct INTERCORE_PACKED TOF_OBSTACLE {
     uint8_t id; // MSG_TOF_OBSTACLE
     unsigned long ToF_Count;
 };
+INTERCORE_SIZE(TOF_OBSTACLE, 5);
 
 // A7 to M4 telemetry request
 #define MSG_TELEMETRY_REQUEST 0x0a
-struct TELEMETRY_REQUEST {
+struct INTERCORE_PACKED TELEMETRY_REQUEST {
     uint8_t id; // MSG_TELEMETRY_REQUEST
 };
+INTERCORE_SIZE(TELEMETRY_REQUEST, 1);
 
 // A7 to M4 IMU stability request
 #define MSG_IMU_STABLE_REQUEST 0x0b
-struct IMU_STABLE_REQUEST {
+struct INTERCORE_PACKED IMU_STABLE_REQUEST {
     uint8_t id; // MSG_IMU_STABLE_REQUEST
 };
+INTERCORE_SIZE(IMU_STABLE_REQUEST, 1);
 
 #define MSG_IMU_STABLE_RESULT 0x0c
-struct IMU_STABLE_RESULT {
+struct INTERCORE_PACKED IMU_STABLE_RESULT {
     uint8_t id; // MSG_IMU_STABLE_RESULT
     bool imuStable;
 };
+INTERCORE_SIZE(IMU_STABLE_RESULT, 2);
 
 #define MSG_SETPOINT 0x0d
-struct SETPOINT {
+struct INTERCORE_PACKED SETPOINT {
     uint8_t id; // MSG_SETPOINT
     float setpoint;
 };
+INTERCORE_SIZE(SETPOINT, 5);
 
 #define MSG_TURN_DETAILS 0x0e
-struct TURN_DETAILS
+struct INTERCORE_PACKED TURN_DETAILS
 {
     uint8_t id; // MSG_TURN_DETAILS
     float startHeading;
     float endHeading;
 };
+INTERCORE_SIZE(TURN_DETAILS, 9);
 
 #define MSG_REMOTE_CMD 0x0f
-struct REMOTE_CMD
+struct INTERCORE_PACKED REMOTE_CMD
 {
     uint8_t id; // MSG_REMOTE_CMD
     uint8_t cmd;    // 0-4 (left, right, foreward, back, stop).
 };
+INTERCORE_SIZE(REMOTE_CMD, 2);
 
 #define MSG_UPDATE_ACTIVE 0x10
-struct UPDATE_ACTIVE
+struct INTERCORE_PACKED UPDATE_ACTIVE
 {
     uint8_t id; // MSG_UPDATE_ACTIVE
     bool updateActive;
 };
+INTERCORE_SIZE(UPDATE_ACTIVE, 2);
+
+// A7 to M4 request for the control loop timing, answered with one MSG_LOOP_TIMING per loop.
+#define MSG_LOOP_TIMING_REQUEST 0x11
+struct INTERCORE_PACKED LOOP_TIMING_REQUEST
+{
+    uint8_t id; // MSG_LOOP_TIMING_REQUEST
+};
+INTERCORE_SIZE(LOOP_TIMING_REQUEST, 1);
+
+#define LOOP_ID_IMU 0
+#define LOOP_ID_TOF 1
+#define LOOP_ID_INTERCORE 2
+
+#define LOOP_TIMING_BUCKETS 6
+
+// Timing of one control loop since the previous report.
+//   jitter: release to start of the activation, < 50, 200, 1000, 2000, 5000 us, and above.
+//   response: release to end of the activation, < 25, 50, 75, 100, 200 % of the period, and above;
+//   the last two buckets are the overruns.
+#define MSG_LOOP_TIMING 0x12
+struct INTERCORE_PACKED LOOP_TIMING
+{
+    uint8_t id; // MSG_LOOP_TIMING
+    uint8_t loopId; // LOOP_ID_*
+    uint16_t periodMs;
+    uint32_t activations;
+    uint16_t missed; // releases dropped because the previous activation hadn't started
+    uint16_t overruns; // activations that ended after their deadline
+    uint32_t maxJitterUs;
+    uint32_t maxResponseUs;
+    uint16_t jitter[LOOP_TIMING_BUCKETS];
+    uint16_t response[LOOP_TIMING_BUCKETS];
+};
+INTERCORE_SIZE(LOOP_TIMING, 44);
+
+// A7 to M4: push a MSG_TELEMETRY_SAMPLE every periodMs, 0 to stop; replaces polling with
+// MSG_TELEMETRY_REQUEST. The period is rounded up to the M4's 50 ms intercore period.
+#define MSG_TELEMETRY_STREAM 0x13
+struct INTERCORE_PACKED TELEMETRY_STREAM
+{
+    uint8_t id; // MSG_TELEMETRY_STREAM
+    uint16_t periodMs;
+};
+INTERCORE_SIZE(TELEMETRY_STREAM, 3);
+
+#define TELEMETRY_FLAG_AVOID_ACTIVE 0x01
+#define TELEMETRY_FLAG_TURN_NORTH 0x02
+
+// M4 to A7: compact device status, angles in hundredths of a degree.
+#define MSG_TELEMETRY_SAMPLE 0x14
+struct INTERCORE_PACKED TELEMETRY_SAMPLE
+{
+    uint8_t id; // MSG_TELEMETRY_SAMPLE
+    uint8_t flags; // TELEMETRY_FLAG_*
+    uint16_t numObstaclesDetected;
+    uint32_t timestamp;
+    int16_t roll;
+    int16_t pitch;
+    uint16_t yaw; // 0 to 36000
+    int16_t setpoint;
+    int16_t output; // balance PID output, in hundredths
+};
+INTERCORE_SIZE(TELEMETRY_SAMPLE, 18);
+
+// A7 to M4: a remote control command (REMOTE_CMD's cmd) that has a sequence number and a lifetime.
+// The M4 applies the newest command only: another with the same or an earlier seq is dropped, unless
+// the last command was applied more than REMOTE_CMD_MAX_TTL_MS ago (the controller restarted, say).
+// A moving command is cancelled ttlMs after the M4 receives it, so the robot stops if the controller
+// goes quiet; ttlMs is capped at REMOTE_CMD_MAX_TTL_MS, 0 asks for the cap.
+#define MSG_REMOTE_CMD_SEQ 0x15
+#define REMOTE_CMD_MAX_TTL_MS 2000
+struct INTERCORE_PACKED REMOTE_CMD_SEQ
+{
+    uint8_t id; // MSG_REMOTE_CMD_SEQ
+    uint8_t cmd;
+    uint16_t seq;
+    uint16_t ttlMs;
+    uint32_t sentMs; // A7 clock, echoed in the MSG_REMOTE_CMD_ACK
+};
+INTERCORE_SIZE(REMOTE_CMD_SEQ, 10);
+
+// M4 to A7: the latest MSG_REMOTE_CMD_SEQ applied.
+#define MSG_REMOTE_CMD_ACK 0x16
+struct INTERCORE_PACKED REMOTE_CMD_ACK
+{
+    uint8_t id; // MSG_REMOTE_CMD_ACK
+    uint8_t cmd;
+    uint16_t seq;
+    uint32_t sentMs;
+};
+INTERCORE_SIZE(REMOTE_CMD_ACK, 8);
+
+// M4 to A7: several messages in one frame, each a BATCH_RECORD then that many bytes of message
+// (id first, as when sent alone). A reader skips a record whose id it doesn't know.
+#define MSG_INTERCORE_BATCH 0x17
+struct INTERCORE_PACKED BATCH_HEADER
+{
+    uint8_t id; // MSG_INTERCORE_BATCH
+    uint8_t version; // INTERCORE_WIRE_VERSION
+    uint8_t count; // records that follow
+};
+INTERCORE_SIZE(BATCH_HEADER, 3);
+
+struct INTERCORE_PACKED BATCH_RECORD
+{
+    uint8_t size; // of the message that follows
+};
+INTERCORE_SIZE(BATCH_RECORD, 1);
+
+// A7 to M4: what to do with the flight recorder's samples, FLIGHT_RECORDER_*. The M4 records every
+// balance loop regardless; a dump sends the blocks complete when it's asked for, oldest first, and
+// a stream sends each block as it completes, until stopped.
+#define MSG_FLIGHT_RECORDER 0x18
+#define FLIGHT_RECORDER_STOP 0
+#define FLIGHT_RECORDER_DUMP 1
+#define FLIGHT_RECORDER_STREAM 2
+struct INTERCORE_PACKED FLIGHT_RECORDER
+{
+    uint8_t id; // MSG_FLIGHT_RECORDER
+    uint8_t mode; // FLIGHT_RECORDER_*
+};
+INTERCORE_SIZE(FLIGHT_RECORDER, 2);
+
+// M4 to A7: a block of balance loop samples. Each sample is its time since the previous sample in
+// ms, then roll, setpoint and output in hundredths and the left and right motor duty (negative
+// driving backwards), each less the previous sample's; all are LEB128 varints, the five values
+// zigzag encoded. The first sample of a block is at startMs, and its values are less 0 rather than
+// a previous sample, so each block decodes on its own. seq counts blocks since the M4 started, a gap
+// is blocks overwritten or dropped before they were sent.
+#define MSG_FLIGHT_BLOCK 0x19
+#define FLIGHT_BLOCK_DATA_SIZE 200
+struct INTERCORE_PACKED FLIGHT_BLOCK
+{
+    uint8_t id; // MSG_FLIGHT_BLOCK
+    uint8_t count; // samples
+    uint16_t size; // bytes of data used
+    uint32_t seq;
+    uint32_t startMs; // M4 clock
+    uint8_t data[FLIGHT_BLOCK_DATA_SIZE];
+};
+INTERCORE_SIZE(FLIGHT_BLOCK, 212);
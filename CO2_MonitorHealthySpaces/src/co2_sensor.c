@@ -12,7 +12,11 @@
 /// <returns></returns>
 bool co2_initialize(void)
 {
+#ifdef LOW_POWER
+    uint16_t interval_in_seconds = CO2_LOW_POWER_INTERVAL_SECONDS;
+#else
     uint16_t interval_in_seconds = 2;
+#endif
     int retry = 0;
     uint8_t asc_enabled, enable_asc;
 
@@ -50,7 +54,10 @@ bool co2_initialize(void)
     scd30_set_measurement_interval(interval_in_seconds);
     sensirion_sleep_usec(20000u);
     scd30_start_periodic_measurement(0);
+#ifndef LOW_POWER
+    // in low power mode the first wake window waits for the first sample instead
     sensirion_sleep_usec(interval_in_seconds * 1000000u);
+#endif
 
     return true;
 }
@@ -97,6 +104,8 @@ bool co2_initialize(void)
         }
     }
 
+#ifndef LOW_POWER
+    // In low power mode the sensor idles between single shots, see co2_measure_single_shot
     error = scd4x_start_periodic_measurement();
     if (error)
     {
@@ -104,13 +113,39 @@ bool co2_initialize(void)
     }
 
     sensirion_i2c_hal_sleep_usec(5000000);
+#endif
 
     return 0;
 }
 
 #endif
 
-bool co2_read(ENVIRONMENT *telemetry)
+#ifdef LOW_POWER
+bool co2_measure_single_shot(void)
+{
+#ifdef SCD30
+    return true;
+#else
+    return scd4x_measure_single_shot() == NO_ERROR;
+#endif
+}
+#endif
+
+bool co2_data_ready(void)
+{
+#ifdef SCD30
+    uint16_t data_ready = 0;
+
+    return scd30_get_data_ready(&data_ready) == STATUS_OK && data_ready != 0;
+#else
+    uint16_t data_ready = 0;
+
+    // the measurement is ready if any of the low 11 bits are set
+    return scd4x_get_data_ready_status(&data_ready) == NO_ERROR && (data_ready & 0x07FF) != 0;
+#endif
+}
+
+bool co2_read_sample(SENSOR_SAMPLE *sample)
 {
 #ifdef SCD30
     float co2_ppm, temperature, relative_humidity;
@@ -119,9 +154,9 @@ bool co2_read(ENVIRONMENT *telemetry)
     {
         if (!isnan(co2_ppm) && !isnan(temperature) && !isnan(relative_humidity))
         {
-            telemetry->latest.co2ppm = (int)co2_ppm;
-            telemetry->latest.temperature = (int)temperature;
-            telemetry->latest.humidity = (int)relative_humidity;
+            sample->co2ppm = co2_ppm;
+            sample->temperature = temperature;
+            sample->humidity = relative_humidity;
             return true;
         }
     }
@@ -133,9 +168,9 @@ bool co2_read(ENVIRONMENT *telemetry)
 
     if (scd4x_read_measurement(&co2_ppm, &temperature, &relative_humidity) == NO_ERROR)
     {
-        telemetry->latest.co2ppm = co2_ppm;
-        telemetry->latest.temperature = temperature / 1000;
-        telemetry->latest.humidity = relative_humidity / 1000;
+        sample->co2ppm = co2_ppm;
+        sample->temperature = temperature / 1000.0f;
+        sample->humidity = relative_humidity / 1000.0f;
         return true;
     }
     return false;
@@ -153,9 +188,14 @@ bool co2_set_altitude(int altitude_in_meters)
     scd30_start_periodic_measurement(0);
 #else
     // can only set altitude in idle mode
+#ifdef LOW_POWER
+    // idle between single shots already
+    result = scd4x_set_sensor_altitude((uint16_t)altitude_in_meters) == 0;
+#else
     scd4x_stop_periodic_measurement();
     result = scd4x_set_sensor_altitude((uint16_t)altitude_in_meters) == 0;
     scd4x_start_periodic_measurement();
+#endif
 #endif
 
     return result;
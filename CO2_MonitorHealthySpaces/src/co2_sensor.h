@@ -5,6 +5,7 @@
 
 #include <stdbool.h>
 #include "Onboard/onboard_sensors.h"
+#include "sensor_window.h"
 
 #ifdef SCD30
 #include "AzureSphereDrivers/EmbeddedScd30/scd30/scd30.h"
@@ -16,6 +17,21 @@
 
 extern DX_I2C_BINDING i2c_co2_sensor;
 
+#ifdef LOW_POWER
+// Seconds between low power samples, one per publish. The SCD30 has no single shot mode, so it
+// measures periodically at this interval instead (its maximum is 1800 seconds)
+#define CO2_LOW_POWER_INTERVAL_SECONDS 300
+
+#ifdef SCD30
+#define CO2_MEASUREMENT_MS 0
+// the first periodic sample can be a whole interval away, until the wakes line up with it
+#define CO2_WAKE_TIMEOUT_MS (CO2_LOW_POWER_INTERVAL_SECONDS * 1000)
+#else
+#define CO2_MEASUREMENT_MS 5000
+#define CO2_WAKE_TIMEOUT_MS (CO2_MEASUREMENT_MS + 3000)
+#endif
+#endif
+
 /// <summary>
 /// Initialize the CO2 sensor
 /// </summary>
@@ -23,12 +39,29 @@ extern DX_I2C_BINDING i2c_co2_sensor;
 /// <returns></returns>
 bool co2_initialize(void);
 
+#ifdef LOW_POWER
+/// <summary>
+/// Start a measurement: a single shot on the SCD4x, ready after 5 seconds, while the SCD30's
+/// periodic measurement carries on. co2_data_ready reports when it can be read
+/// </summary>
+/// <param name=""></param>
+/// <returns></returns>
+bool co2_measure_single_shot(void);
+#endif
+
+/// <summary>
+/// Check the CO2 sensor's data-ready status: true when a new measurement can be read
+/// </summary>
+/// <param name=""></param>
+/// <returns></returns>
+bool co2_data_ready(void);
+
 /// <summary>
-/// Read CO2 sensor telemetry
+/// Read the CO2 sensor's latest measurement, at full resolution
 /// </summary>
-/// <param name="telemetry"></param>
+/// <param name="sample"></param>
 /// <returns></returns>
-bool co2_read(ENVIRONMENT *telemetry);
+bool co2_read_sample(SENSOR_SAMPLE *sample);
 
 /// <summary>
 /// Set the CO2 sensor altitude
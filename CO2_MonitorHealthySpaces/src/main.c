@@ -37,38 +37,68 @@
  * Publish data to Azure IoT Hub/Central
  **********************************************************************************************************/
 
+#ifdef LOW_POWER
+static int64_t elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static int64_t monotonic_ms(void)
+{
+    return elapsed_ms(&(struct timespec){0, 0});
+}
+
+/// <summary>
+/// Percentage of the time since the first wake spent in the wake windows
+/// </summary>
+static float wake_window_duty_cycle(void)
+{
+    int64_t total_ms = monotonic_ms() - wake_window.first_ms;
+    return total_ms > 0 ? 100.0f * (float)wake_window.awake_ms / (float)total_ms : 0.0f;
+}
+#endif
+
 /// <summary>
 /// Publish HVAC telemetry
+/// CO2, temperature and humidity are summarized over the samples read since the last publish
 /// </summary>
-/// <param name="eventLoopTimer"></param>
-static void publish_telemetry_handler(EventLoopTimer *eventLoopTimer)
+static void publish_telemetry(void)
 {
     static int msgId = 0;
+    WINDOW_SUMMARY window;
 
-    if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0)
-    {
-        dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
-        return;
-    }
-
-    if (telemetry.valid && azure_connected)
+    if (azure_connected && sensor_window_summarize(&window))
     {
         // clang-format off
         // Serialize telemetry as JSON
-        if (dx_jsonSerialize(msgBuffer, sizeof(msgBuffer), 7,
-            DX_JSON_INT, "msgId", msgId++,
-            DX_JSON_INT, "co2ppm", telemetry.latest.co2ppm,
-            DX_JSON_INT, "humidity", telemetry.latest.humidity,
-            DX_JSON_INT, "pressure", telemetry.latest.pressure,
-            DX_JSON_INT, "temperature", telemetry.latest.temperature,
-            DX_JSON_INT, "peakUserMemoryKiB", (int)Applications_GetPeakUserModeMemoryUsageInKB(),
-            DX_JSON_INT, "totalMemoryKiB", (int)Applications_GetTotalMemoryUsageInKB()))
+        int len = snprintf(msgBuffer, sizeof(msgBuffer),
+            "{\"msgId\":%d,\"samples\":%d,"
+#ifdef LOW_POWER
+            "\"wakeWindowMs\":%d,\"dutyCycle\":%.3f,"
+#endif
+            "\"co2ppm\":%d,\"co2ppmMin\":%d,\"co2ppmMax\":%d,\"co2ppmP95\":%d,"
+            "\"temperature\":%.1f,\"temperatureMin\":%.1f,\"temperatureMax\":%.1f,\"temperatureP95\":%.1f,"
+            "\"humidity\":%.1f,\"humidityMin\":%.1f,\"humidityMax\":%.1f,\"humidityP95\":%.1f,"
+            "\"pressure\":%d,\"peakUserMemoryKiB\":%d,\"totalMemoryKiB\":%d}",
+            msgId++, window.samples,
+#ifdef LOW_POWER
+            wake_window.last_window_ms, wake_window_duty_cycle(),
+#endif
+            (int)lroundf(window.co2ppm.mean), (int)lroundf(window.co2ppm.min), (int)lroundf(window.co2ppm.max), (int)lroundf(window.co2ppm.p95),
+            window.temperature.mean, window.temperature.min, window.temperature.max, window.temperature.p95,
+            window.humidity.mean, window.humidity.min, window.humidity.max, window.humidity.p95,
+            telemetry.latest.pressure, (int)Applications_GetPeakUserModeMemoryUsageInKB(), (int)Applications_GetTotalMemoryUsageInKB());
         // clang-format on
+
+        if (len > 0 && len < (int)sizeof(msgBuffer))
         {
             dx_Log_Debug("%s\n", msgBuffer);
 
             // Publish telemetry message to IoT Hub/Central
             dx_azurePublish(msgBuffer, strlen(msgBuffer), messageProperties, NELEMS(messageProperties), &contentProperties);
+            sensor_window_reset();
         }
         else
         {
@@ -78,26 +108,28 @@ static void publish_telemetry_handler(EventLoopTimer *eventLoopTimer)
     }
 }
 
-/// <summary>
-/// Determine if telemetry value changed. If so, update it's device twin
-/// </summary>
-/// <param name="new_value"></param>
-/// <param name="previous_value"></param>
-/// <param name="device_twin"></param>
-static void device_twin_update(int *latest_value, int *previous_value, DX_DEVICE_TWIN_BINDING *device_twin)
+static void publish_telemetry_handler(EventLoopTimer *eventLoopTimer)
 {
-    if (*latest_value != *previous_value)
+    if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0)
     {
-        *previous_value = *latest_value;
-        dx_deviceTwinReportValue(device_twin, latest_value);
+        dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
+        return;
     }
+    publish_telemetry();
 }
 
 /// <summary>
-/// Only update device twins if data changed to minimize network and cloud costs
+/// Send the environment twin properties that moved past their hysteresis since they were last
+/// reported, as one merged patch per window, to minimize network and cloud costs
 /// </summary>
-/// <param name="temperature"></param>
-/// <param name="pressure"></param>
+static void flush_device_twins(void)
+{
+    if (azure_connected)
+    {
+        twin_reporter_flush(reported_environment, NELEMS(reported_environment));
+    }
+}
+
 static void update_device_twins(EventLoopTimer *eventLoopTimer)
 {
     if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0)
@@ -105,34 +137,25 @@ static void update_device_twins(EventLoopTimer *eventLoopTimer)
         dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
         return;
     }
-
-    if (telemetry.valid && azure_connected)
-    {
-        device_twin_update(&telemetry.latest.temperature, &telemetry.previous.temperature, &dt_temperature);
-        device_twin_update(&telemetry.latest.pressure, &telemetry.previous.pressure, &dt_pressure);
-        device_twin_update(&telemetry.latest.humidity, &telemetry.previous.humidity, &dt_humidity);
-        device_twin_update(&telemetry.latest.co2ppm, &telemetry.previous.co2ppm, &dt_carbon_dioxide);
-    }
+    flush_device_twins();
 }
 
 /// <summary>
-/// Handler called every 20 seconds
-/// The CO2 sensor and Avnet Onboard sensors are read
-/// Then reload 20 second oneshot timer
+/// Read the CO2 sensor's new measurement with the Avnet Onboard sensors, and add it to the
+/// telemetry window and the twin reports if it's valid
 /// </summary>
-/// <param name="eventLoopTimer"></param>
-static void read_telemetry_handler(EventLoopTimer *eventLoopTimer)
+static void read_sample(void)
 {
-    if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0)
-    {
-        dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
-        return;
-    }
+    SENSOR_SAMPLE sample;
 
     onboard_sensors_read(&telemetry.latest);
 
-    if (co2_read(&telemetry))
+    if (co2_read_sample(&sample))
     {
+        telemetry.latest.co2ppm = (int)sample.co2ppm;
+        telemetry.latest.temperature = (int)sample.temperature;
+        telemetry.latest.humidity = (int)sample.humidity;
+
         // clang-format off
         telemetry.valid =
             IN_RANGE(telemetry.latest.temperature, -20, 50) &&
@@ -140,14 +163,47 @@ static void read_telemetry_handler(EventLoopTimer *eventLoopTimer)
             IN_RANGE(telemetry.latest.humidity, 0, 100) &&
             IN_RANGE(telemetry.latest.co2ppm, 0, 20000);
         // clang-format on
+
+        if (telemetry.valid)
+        {
+            sensor_window_add(&sample);
+
+            twin_reporter_set(&rp_temperature, telemetry.latest.temperature);
+            twin_reporter_set(&rp_pressure, telemetry.latest.pressure);
+            twin_reporter_set(&rp_humidity, telemetry.latest.humidity);
+            twin_reporter_set(&rp_carbon_dioxide, telemetry.latest.co2ppm);
+        }
     }
     else
     {
         telemetry.valid = false;
     }
+}
 
-    dx_timerOneShotSet(&tmr_read_telemetry, &(struct timespec){20, 0});
+#ifndef LOW_POWER
+/// <summary>
+/// Handler called every co2_data_ready_poll_period to check the CO2 sensor's data-ready status
+/// Each new measurement is read and added to the telemetry window, so the sensor is sampled at
+/// its own measurement interval
+/// Then reload the oneshot timer
+/// </summary>
+/// <param name="eventLoopTimer"></param>
+static void read_telemetry_handler(EventLoopTimer *eventLoopTimer)
+{
+    if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0)
+    {
+        dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
+        return;
+    }
+
+    if (co2_data_ready())
+    {
+        read_sample();
+    }
+
+    dx_timerOneShotSet(&tmr_read_telemetry, &co2_data_ready_poll_period);
 }
+#endif
 
 /***********************************************************************************************************
  *
@@ -232,6 +288,93 @@ static void co2_alert_handler(EventLoopTimer *eventLoopTimer)
     update_co2_alert_status();
 }
 
+#ifdef LOW_POWER
+/***********************************************************************************************************
+ * LOW POWER WAKE WINDOW
+ *
+ * Take one sample, then publish it, send the twin reports and update the alert, together
+ **********************************************************************************************************/
+
+/// <summary>
+/// Close the wake window: do the IoT work for the sample, and schedule the next window so the
+/// sample is due just after it opens
+/// </summary>
+/// <param name="sampled">a measurement was read in this window</param>
+static void close_wake_window(bool sampled)
+{
+    publish_telemetry();
+    flush_device_twins();
+    update_co2_alert_status();
+
+    int64_t window_ms = elapsed_ms(&wake_window.start);
+    wake_window.last_window_ms = (int)window_ms;
+    wake_window.awake_ms += window_ms;
+    wake_window.open = false;
+
+    Log_Debug("Wake window %d ms, %s, duty cycle %.3f%%\n", wake_window.last_window_ms, sampled ? "sampled" : "no sample",
+              wake_window_duty_cycle());
+
+    // The SCD30's next periodic sample is an interval after this one, the SCD4x's is taken on
+    // waking; without a sample, keep to the interval from this window's start
+    int64_t next_ms = sampled ? CO2_LOW_POWER_INTERVAL_SECONDS * 1000 - CO2_MEASUREMENT_MS - 1000
+                              : CO2_LOW_POWER_INTERVAL_SECONDS * 1000 - window_ms;
+    if (next_ms < 1000)
+    {
+        next_ms = 1000;
+    }
+    dx_timerOneShotSet(&tmr_read_telemetry, &(struct timespec){next_ms / 1000, (next_ms % 1000) * ONE_MS});
+}
+
+/// <summary>
+/// Opens the wake window and starts a measurement, then polls the CO2 sensor's data-ready status
+/// every co2_data_ready_poll_period until the sample is read or CO2_WAKE_TIMEOUT_MS passes
+/// </summary>
+/// <param name="eventLoopTimer"></param>
+static void wake_window_handler(EventLoopTimer *eventLoopTimer)
+{
+    if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0)
+    {
+        dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
+        return;
+    }
+
+    if (!wake_window.open)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &wake_window.start);
+        if (wake_window.first_ms == 0)
+        {
+            wake_window.first_ms = monotonic_ms();
+        }
+        wake_window.open = true;
+
+        if (!co2_measure_single_shot())
+        {
+            close_wake_window(false);
+            return;
+        }
+        if (CO2_MEASUREMENT_MS > 0)
+        {
+            dx_timerOneShotSet(&tmr_read_telemetry, &(struct timespec){CO2_MEASUREMENT_MS / 1000, (CO2_MEASUREMENT_MS % 1000) * ONE_MS});
+            return;
+        }
+    }
+
+    if (co2_data_ready())
+    {
+        read_sample();
+        close_wake_window(true);
+    }
+    else if (elapsed_ms(&wake_window.start) >= CO2_WAKE_TIMEOUT_MS)
+    {
+        close_wake_window(false);
+    }
+    else
+    {
+        dx_timerOneShotSet(&tmr_read_telemetry, &co2_data_ready_poll_period);
+    }
+}
+#endif
+
 /***********************************************************************************************************
  * REMOTE OPERATIONS: DEVICE TWINS
  *
@@ -458,7 +601,6 @@ static void InitPeripheralsAndHandlers(void)
 
     dx_timerOneShotSet(&tmr_read_telemetry, &(struct timespec){0, 250 * ONE_MS});
 
-    telemetry.previous.temperature = telemetry.previous.pressure = telemetry.previous.humidity = telemetry.previous.co2ppm = INT32_MAX;
 
     // Uncomment for production
     // start_watchdog();
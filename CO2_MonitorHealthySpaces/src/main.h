@@ -18,13 +18,17 @@
 #include "Onboard/onboard_sensors.h"
 #include "Onboard/azure_status.h"
 #include "co2_sensor.h"
+#include "twin_reporter.h"
 
 #include <applibs/applications.h>
 #include <applibs/log.h>
 #include <applibs/powermanagement.h>
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
 
 // https://docs.microsoft.com/en-us/azure/iot-pnp/overview-iot-plug-and-play
-#define IOT_PLUG_AND_PLAY_MODEL_ID "dtmi:com:example:azuresphere:co2monitor;2"
+#define IOT_PLUG_AND_PLAY_MODEL_ID "dtmi:com:example:azuresphere:co2monitor;4"
 #define NETWORK_INTERFACE "wlan0"
 #define CO2_MONITOR_FIRMWARE_VERSION "3.02"
 
@@ -39,7 +43,11 @@ static void co2_alert_handler(EventLoopTimer *eventLoopTimer);
 static void delayed_restart_device_handler(EventLoopTimer *eventLoopTimer);
 static void publish_telemetry_handler(EventLoopTimer *eventLoopTimer);
 static void read_buttons_handler(EventLoopTimer *eventLoopTimer);
+#ifdef LOW_POWER
+static void wake_window_handler(EventLoopTimer *eventLoopTimer);
+#else
 static void read_telemetry_handler(EventLoopTimer *eventLoopTimer);
+#endif
 static void set_co2_alert_level(DX_DEVICE_TWIN_BINDING *deviceTwinBinding);
 static void set_device_altitude(DX_DEVICE_TWIN_BINDING *deviceTwinBinding);
 static void update_device_twins(EventLoopTimer *eventLoopTimer);
@@ -54,7 +62,7 @@ void azure_status_led_on_handler(EventLoopTimer *eventLoopTimer);
 #define Log_Debug(f_, ...) dx_Log_Debug((f_), ##__VA_ARGS__)
 static char Log_Debug_Time_buffer[128];
 
-#define JSON_MESSAGE_BYTES 256
+#define JSON_MESSAGE_BYTES 512
 static char msgBuffer[JSON_MESSAGE_BYTES] = {0};
 
 // Set alert level to a reasonable default. This is updated by CO2PPMAlertLevel device twin
@@ -62,6 +70,27 @@ static int32_t co2_alert_level = 1000;
 
 static bool be_quiet = false;
 
+#ifdef LOW_POWER
+// Battery powered: the sensor idles between samples, and the app wakes once per
+// CO2_LOW_POWER_INTERVAL_SECONDS to take one, publish it, and send the twin reports, in one window.
+// The window's length and the time awake are kept, to work out the battery life from
+static const struct timespec co2_data_ready_poll_period = {0, 500 * ONE_MS};
+
+typedef struct
+{
+    struct timespec start;       // of the open window
+    bool open;
+    int64_t first_ms;            // the first window's start
+    int64_t awake_ms;            // in all the closed windows
+    int last_window_ms;
+} WAKE_WINDOW;
+
+static WAKE_WINDOW wake_window;
+#else
+// The CO2 sensor has no data-ready interrupt line, so its status is polled
+static const struct timespec co2_data_ready_poll_period = {1, 0};
+#endif
+
 ENVIRONMENT telemetry;
 
 static DX_USER_CONFIG dx_config;
@@ -98,6 +127,12 @@ static DX_DEVICE_TWIN_BINDING dt_pressure = {.propertyName = "Pressure", .twinTy
 static DX_DEVICE_TWIN_BINDING dt_temperature = {.propertyName = "Temperature", .twinType = DX_DEVICE_TWIN_INT};
 static DX_DEVICE_TWIN_BINDING dt_carbon_dioxide = {.propertyName = "CarbonDioxide", .twinType = DX_DEVICE_TWIN_INT};
 
+// Environment properties are reported by exception, with these hysteresis thresholds
+static TWIN_REPORTED_INT rp_humidity = {.binding = &dt_humidity, .threshold = 2};             // percent
+static TWIN_REPORTED_INT rp_pressure = {.binding = &dt_pressure, .threshold = 2};             // millibar
+static TWIN_REPORTED_INT rp_temperature = {.binding = &dt_temperature, .threshold = 1};       // degrees Celsius
+static TWIN_REPORTED_INT rp_carbon_dioxide = {.binding = &dt_carbon_dioxide, .threshold = 25}; // ppm
+
 static DX_DEVICE_TWIN_BINDING dt_startup_utc = {.propertyName = "StartupUtc", .twinType = DX_DEVICE_TWIN_STRING};
 static DX_DEVICE_TWIN_BINDING dt_sw_version = {.propertyName = "SoftwareVersion", .twinType = DX_DEVICE_TWIN_STRING};
 
@@ -126,12 +161,20 @@ DX_TIMER_BINDING tmr_azure_status_led_on = {
     .period = {0, 500 * ONE_MS}, .name = "tmr_azure_status_led_on", .handler = azure_status_led_on_handler};
 static DX_TIMER_BINDING tmr_co2_alert_buzzer_off_oneshot = {.name = "tmr_co2_alert_buzzer_off_oneshot",
                                                             .handler = co2_alert_buzzer_off_handler};
+#ifdef LOW_POWER
+// The alert, publish and twin reports run in the wake window, so these are never armed
+static DX_TIMER_BINDING tmr_co2_alert_timer = {.name = "tmr_co2_alert_timer", .handler = co2_alert_handler};
+static DX_TIMER_BINDING tmr_publish_telemetry = {.name = "tmr_publish_telemetry", .handler = publish_telemetry_handler};
+static DX_TIMER_BINDING tmr_update_device_twins = {.name = "tmr_update_device_twins", .handler = update_device_twins};
+static DX_TIMER_BINDING tmr_read_telemetry = {.name = "tmr_read_telemetry", .handler = wake_window_handler};
+#else
 static DX_TIMER_BINDING tmr_co2_alert_timer = {.period = {8, 0}, .name = "tmr_co2_alert_timer", .handler = co2_alert_handler};
-static DX_TIMER_BINDING tmr_delayed_restart_device = {.name = "tmr_delayed_restart_device", .handler = delayed_restart_device_handler};
 static DX_TIMER_BINDING tmr_publish_telemetry = {.period = {20, 0}, .name = "tmr_publish_telemetry", .handler = publish_telemetry_handler};
-static DX_TIMER_BINDING tmr_read_buttons = {.period = {0, 100 * ONE_MS}, .name = "tmr_read_buttons", .handler = read_buttons_handler};
+static DX_TIMER_BINDING tmr_update_device_twins = {.period = {60, 0}, .name = "tmr_update_device_twins", .handler = update_device_twins};
 static DX_TIMER_BINDING tmr_read_telemetry = {.name = "tmr_read_telemetry", .handler = read_telemetry_handler};
-static DX_TIMER_BINDING tmr_update_device_twins = {.period = {15, 0}, .name = "tmr_update_device_twins", .handler = update_device_twins};
+#endif
+static DX_TIMER_BINDING tmr_delayed_restart_device = {.name = "tmr_delayed_restart_device", .handler = delayed_restart_device_handler};
+static DX_TIMER_BINDING tmr_read_buttons = {.period = {0, 100 * ONE_MS}, .name = "tmr_read_buttons", .handler = read_buttons_handler};
 static DX_TIMER_BINDING tmr_watchdog = {.period = {30, 0}, .name = "tmr_publish_telemetry", .handler = watchdog_handler};
 
 /***********************************************************************************************************
@@ -162,6 +205,8 @@ static DX_DEVICE_TWIN_BINDING *device_twin_bindings[] = {&dt_co2_ppm_alert_level
                                                          &dt_temperature,         &dt_pressure,        &dt_humidity,
                                                          &dt_carbon_dioxide,      &dt_defer_requested, &dt_altitude_in_meters};
 
+static TWIN_REPORTED_INT *reported_environment[] = {&rp_temperature, &rp_pressure, &rp_humidity, &rp_carbon_dioxide};
+
 static DX_PWM_BINDING *pwm_bindings[] = {&pwm_buzz_click, &pwm_led_green, &pwm_led_red, &pwm_led_blue};
 
 DX_I2C_BINDING *i2c_bindings[] = {&i2c_co2_sensor, &i2c_onboard_sensors};
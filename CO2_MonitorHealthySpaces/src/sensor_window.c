@@ -0,0 +1,76 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "sensor_window.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+
+static SENSOR_SAMPLE window[SENSOR_WINDOW_SIZE];
+static int window_next = 0;
+static int window_count = 0;
+
+// Scratch space to sort one channel for its percentile
+static float sorted[SENSOR_WINDOW_SIZE];
+
+void sensor_window_add(const SENSOR_SAMPLE *sample)
+{
+    window[window_next] = *sample;
+    window_next = (window_next + 1) % SENSOR_WINDOW_SIZE;
+
+    if (window_count < SENSOR_WINDOW_SIZE)
+    {
+        window_count++;
+    }
+}
+
+void sensor_window_reset(void)
+{
+    window_next = 0;
+    window_count = 0;
+}
+
+static int compare_float(const void *a, const void *b)
+{
+    float fa = *(const float *)a;
+    float fb = *(const float *)b;
+    return (fa > fb) - (fa < fb);
+}
+
+/// <summary>
+/// Min, mean, max and nearest-rank 95th percentile of one channel (a float offset in SENSOR_SAMPLE)
+/// </summary>
+static void summarize_channel(size_t offset, WINDOW_STATS *stats)
+{
+    double sum = 0;
+
+    for (int i = 0; i < window_count; i++)
+    {
+        sorted[i] = *(const float *)((const char *)&window[i] + offset);
+        sum += sorted[i];
+    }
+
+    qsort(sorted, (size_t)window_count, sizeof(float), compare_float);
+
+    int p95_rank = (window_count * 95 + 99) / 100;
+
+    stats->min = sorted[0];
+    stats->max = sorted[window_count - 1];
+    stats->mean = (float)(sum / window_count);
+    stats->p95 = sorted[p95_rank - 1];
+}
+
+bool sensor_window_summarize(WINDOW_SUMMARY *summary)
+{
+    if (window_count == 0)
+    {
+        return false;
+    }
+
+    summary->samples = window_count;
+    summarize_channel(offsetof(SENSOR_SAMPLE, co2ppm), &summary->co2ppm);
+    summarize_channel(offsetof(SENSOR_SAMPLE, temperature), &summary->temperature);
+    summarize_channel(offsetof(SENSOR_SAMPLE, humidity), &summary->humidity);
+
+    return true;
+}
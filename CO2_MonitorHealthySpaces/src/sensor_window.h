@@ -0,0 +1,49 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+
+// Samples held between publishes. The SCD30 measures every 2 seconds and the SCD4x every
+// 5 seconds, so this covers publish intervals of a couple of minutes; older samples are overwritten.
+#define SENSOR_WINDOW_SIZE 64
+
+typedef struct {
+    float co2ppm;
+    float temperature;
+    float humidity;
+} SENSOR_SAMPLE;
+
+typedef struct {
+    float min;
+    float mean;
+    float max;
+    float p95;
+} WINDOW_STATS;
+
+typedef struct {
+    int samples;
+    WINDOW_STATS co2ppm;
+    WINDOW_STATS temperature;
+    WINDOW_STATS humidity;
+} WINDOW_SUMMARY;
+
+/// <summary>
+/// Add a sample to the window
+/// </summary>
+/// <param name="sample"></param>
+void sensor_window_add(const SENSOR_SAMPLE *sample);
+
+/// <summary>
+/// Summarize the samples added since the last reset
+/// </summary>
+/// <param name="summary"></param>
+/// <returns>false if the window is empty</returns>
+bool sensor_window_summarize(WINDOW_SUMMARY *summary);
+
+/// <summary>
+/// Empty the window, to start the next publish interval
+/// </summary>
+/// <param name=""></param>
+void sensor_window_reset(void);
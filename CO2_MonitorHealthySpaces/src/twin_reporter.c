@@ -0,0 +1,61 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "twin_reporter.h"
+
+#include "dx_azure_iot.h"
+#include <iothub_device_client_ll.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static char patch[TWIN_REPORTER_PATCH_BYTES];
+
+void twin_reporter_set(TWIN_REPORTED_INT *property, int value)
+{
+    property->value = value;
+    property->dirty = !property->has_reported || abs(value - property->reported) >= property->threshold;
+}
+
+bool twin_reporter_flush(TWIN_REPORTED_INT **properties, size_t count)
+{
+    int len = snprintf(patch, sizeof(patch), "{");
+    int dirty = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (properties[i]->dirty)
+        {
+            len += snprintf(patch + len, sizeof(patch) - (size_t)len, "%s\"%s\":%d", dirty++ ? "," : "",
+                            properties[i]->binding->propertyName, properties[i]->value);
+            if (len >= (int)sizeof(patch) - 1)
+            {
+                return false;
+            }
+        }
+    }
+
+    if (dirty == 0)
+    {
+        return true;
+    }
+
+    len += snprintf(patch + len, sizeof(patch) - (size_t)len, "}");
+
+    if (IoTHubDeviceClient_LL_SendReportedState(dx_azureClientHandleGet(), (const unsigned char *)patch, (size_t)len, NULL,
+                                                NULL) != IOTHUB_CLIENT_OK)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (properties[i]->dirty)
+        {
+            properties[i]->reported = properties[i]->value;
+            properties[i]->has_reported = true;
+            properties[i]->dirty = false;
+        }
+    }
+
+    return true;
+}
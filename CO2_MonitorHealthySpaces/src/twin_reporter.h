@@ -0,0 +1,39 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "dx_device_twins.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Twin size budget for one merged reported properties patch
+#define TWIN_REPORTER_PATCH_BYTES 256
+
+/// <summary>
+/// An integer reported property, reported by exception: it's marked dirty when it moves at least
+/// threshold away from the value last reported, and dirty properties are sent in one merged patch
+/// </summary>
+typedef struct {
+    DX_DEVICE_TWIN_BINDING *binding; // names the reported property
+    int threshold;                   // hysteresis, 1 reports every change
+    int value;                       // latest value
+    int reported;                    // value last reported
+    bool has_reported;
+    bool dirty;
+} TWIN_REPORTED_INT;
+
+/// <summary>
+/// Record a property's latest value, marking it dirty if it's outside the hysteresis band
+/// </summary>
+/// <param name="property"></param>
+/// <param name="value"></param>
+void twin_reporter_set(TWIN_REPORTED_INT *property, int value);
+
+/// <summary>
+/// Send the dirty properties as one reported properties patch
+/// </summary>
+/// <param name="properties"></param>
+/// <param name="count"></param>
+/// <returns>false if the patch couldn't be sent, the properties stay dirty</returns>
+bool twin_reporter_flush(TWIN_REPORTED_INT **properties, size_t count);
@@ -4,6 +4,7 @@
 import argparse
 import atexit
 import base64
+from concurrent.futures import ThreadPoolExecutor
 import json
 import logging
 import msal
@@ -27,15 +28,18 @@ TOKEN_SAVE_FILENAME="token_cache"
 # The keyring details to securely store access token
 keyring_namespace = 'azuresphere-crashdumps-configure'
 keyring_username = 'accessToken'
+# Number of device groups to update or get at once (feel free to edit, or use --parallel)
+DEFAULT_MAX_PARALLEL=8
 
 class AzureSphereAPIClient:
 
     class AzureSphereAPIClientException(Exception):
         pass
 
-    def __init__(self, forceinteractive:bool, nocache:bool):
+    def __init__(self, forceinteractive:bool, nocache:bool, max_parallel:int=DEFAULT_MAX_PARALLEL):
         self.forceinteractive = forceinteractive
         self.nocache = nocache
+        self.max_parallel = max(1, max_parallel)
         if not self.nocache:
             self.cache = msal.SerializableTokenCache()
             self.register_update_cache()
@@ -86,13 +90,13 @@ class AzureSphereAPIClient:
         except OSError:
             pass
 
-    # create session that retries 3 times on 429 and 500 responses
+    # create session that retries 3 times on 429 and 500 responses, with a connection for each parallel request
     def init_requests_session(self):
         retry_strategy = Retry(
             total=3,
             status_forcelist=[500, 429],
         )
-        adapter = HTTPAdapter(max_retries=retry_strategy)
+        adapter = HTTPAdapter(max_retries=retry_strategy, pool_maxsize=self.max_parallel)
         session = requests.Session()
         session.mount("https://", adapter)
         session.mount("http://", adapter)
@@ -127,21 +131,29 @@ class AzureSphereAPIClient:
             logging.error(result.get("error_description"))
             return None
 
+    # Runs action(devicegroup_id) for all devicegroup_ids, at most max_parallel at once, and returns the parsed json responses
+    # in the order of devicegroup_ids, along with the ids that failed. action returns a json string, or None on error
+    def for_devicegroups(self, devicegroup_ids:List[str], action, description:str):
+        def run(devicegroup_id):
+            try:
+                return json.loads(action(devicegroup_id))
+            except (json.decoder.JSONDecodeError, TypeError) as e:
+                logging.error("Error " + description + " device group: " + devicegroup_id)
+                logging.debug(e)
+                return None
+        with ThreadPoolExecutor(max_workers=self.max_parallel) as executor:
+            responses = list(executor.map(run, devicegroup_ids))
+        devicegroups = [devicegroup for devicegroup in responses if devicegroup is not None]
+        failed = [devicegroup_id for devicegroup_id, devicegroup in zip(devicegroup_ids, responses) if devicegroup is None]
+        return devicegroups, failed
+
     # Sets AllowCrashDumpsCollection for all devicegroup_ids to value of should_set_on. devicegroup_ids are assumed to be in the supplied tenant_id
-    def set_allowcrashdumpscollection_devicegroups(self, tenant_id:str, devicegroup_ids :List[str], should_set_on:bool) -> str:
-        devicegroups = []
-        for devicegroup_id in devicegroup_ids:
-            devicegroup = self.patch_devicegroup_allowcrashdumpscollection(tenant_id, devicegroup_id, should_set_on)
-            if devicegroup is None:
-                logging.error("Error updating device group: " + devicegroup_id)
-            else:
-                try:
-                    devicegroups.append(json.loads(devicegroup))
-                except (json.decoder.JSONDecodeError, TypeError) as e:
-                    logging.error("Error parsing patch device group " + devicegroup_id + " response")
-                    logging.error(e)
-                    logging.debug("devicegroup: " + devicegroup)
-        return devicegroups
+    def set_allowcrashdumpscollection_devicegroups(self, tenant_id:str, devicegroup_ids :List[str], should_set_on:bool):
+        return self.for_devicegroups(devicegroup_ids, lambda devicegroup_id: self.patch_devicegroup_allowcrashdumpscollection(tenant_id, devicegroup_id, should_set_on), "updating")
+
+    # Gets all devicegroup_ids. devicegroup_ids are assumed to be in the supplied tenant_id
+    def get_devicegroups(self, tenant_id:str, devicegroup_ids:List[str]):
+        return self.for_devicegroups(devicegroup_ids, lambda devicegroup_id: self.get_devicegroup(tenant_id, devicegroup_id), "getting")
 
     # print in the case of an error or if verbose logging is enabled
     def log_api_response(self, response):
@@ -241,6 +253,7 @@ def parse_args() -> argparse.Namespace:
     parser.add_argument("--set", nargs=1, type=str, choices=["on", "off"], help="Set AllowCrashDumpsCollection")
     parser.add_argument("--tenantid", "-t", type=validate_tenantid, nargs=1, help="Tenant id for which to get or set AllowCrashDumpsCollection")
     parser.add_argument("--devicegroupid", "-dg", type=validate_devicegroupid, nargs="+", help="Device group ids (separated by a space) for which to get or set AllowCrashDumpsCollection")
+    parser.add_argument("--parallel", type=int, default=DEFAULT_MAX_PARALLEL, help="Maximum number of device groups to get or set at once (default: %(default)s)")
     parser.add_argument("--verbose", "-v", action="store_true", default=False, help="Enable verbose logging")
     parser.add_argument("--forceinteractive", action="store_true", default=False, help="Force interactive auth instead of trying to load a token from the cache")
     parser.add_argument("--nocache", action="store_true", default=False, help="Don't cache an (encrypted) access token in a file in the current directory")
@@ -292,6 +305,8 @@ def get_or_set_crashdumps_configuration(args:argparse.Namespace, azsphere_api_cl
     if not tenants:
         print("No tenants found.")
         return
+    succeeded = 0
+    failed = []
     for tenant_id, tenant_name in tenants:
         print("\nTenant Id: " + tenant_id + ("\nTenant Name: " + tenant_name if tenant_name else ""))
         if args.get:
@@ -307,14 +322,9 @@ def get_or_set_crashdumps_configuration(args:argparse.Namespace, azsphere_api_cl
                     return
             else:
                 # get select device groups
-                devicegroups = []
-                for devicegroupid in args.devicegroupid:
-                    try:
-                        devicegroups.append(json.loads(azsphere_api_client.get_devicegroup(tenant_id, devicegroupid)))
-                    except (json.decoder.JSONDecodeError, TypeError) as e:
-                        logging.error("Error getting device group: " + devicegroupid)
-                        logging.debug(e)
-                        continue
+                devicegroups, tenant_failed = azsphere_api_client.get_devicegroups(tenant_id, args.devicegroupid)
+                succeeded += len(devicegroups)
+                failed += tenant_failed
                 print_devicegroups_table(devicegroups)
         elif args.set:
             # doing --set
@@ -330,11 +340,15 @@ def get_or_set_crashdumps_configuration(args:argparse.Namespace, azsphere_api_cl
                 # set select device groups
                 devicegroupids = args.devicegroupid
             logging.info("Updating device group(s). This may take a few seconds...")
-            devicegroups = azsphere_api_client.set_allowcrashdumpscollection_devicegroups(tenant_id, devicegroupids, should_set_on)
+            devicegroups, tenant_failed = azsphere_api_client.set_allowcrashdumpscollection_devicegroups(tenant_id, devicegroupids, should_set_on)
+            succeeded += len(devicegroups)
+            failed += tenant_failed
             print_devicegroups_table(devicegroups)
         else:
             logging.error("Unexpected error with get and set arguments")
             return
+    if args.set or args.devicegroupid is not None:
+        print("\nSummary: " + str(succeeded) + " device group(s) " + ("updated" if args.set else "retrieved") + ", " + str(len(failed)) + " failed" + (": " + " ".join(failed) if failed else ""))
 
 def configure_logging(is_verbose):
     logging.basicConfig(format='%(levelname)s:%(message)s', level=logging.DEBUG if is_verbose else logging.INFO)
@@ -356,7 +370,7 @@ def main():
     logging.debug("args: " + str(args))
 
     try:
-        azsphere_api_client = AzureSphereAPIClient(args.forceinteractive, args.nocache)
+        azsphere_api_client = AzureSphereAPIClient(args.forceinteractive, args.nocache, args.parallel)
     except AzureSphereAPIClient.AzureSphereAPIClientException as e:
         logging.error(e)
         return
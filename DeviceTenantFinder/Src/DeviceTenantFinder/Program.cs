@@ -5,6 +5,9 @@ using Microsoft.Identity.Client;
 using RestSharp;
 using System;
 using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Threading;
 using System.Threading.Tasks;
 using Newtonsoft.Json;
 using System.Linq;
@@ -31,15 +34,29 @@ namespace DeviceTenantFinder
         /// </summary>
         private const string AzureSphereApiUri = "https://prod.core.sphere.azure.net";
         /// <summary>
+        /// Maximum number of Azure Sphere Public API requests in flight at once.
+        /// </summary>
+        private const int MaxConcurrentRequests = 8;
+        private static readonly SemaphoreSlim RequestSlots = new SemaphoreSlim(MaxConcurrentRequests);
+        private static int RequestCount = 0;
+        /// <summary>
+        /// Each tenant's device list is cached for this long, use --refresh to ignore the cache.
+        /// </summary>
+        private static readonly TimeSpan DeviceCacheLifetime = TimeSpan.FromMinutes(15);
+        private static readonly string DeviceCacheFolder = Path.Combine(Path.GetTempPath(), "AzureSphereDeviceCache");
+        /// <summary>
         /// Program entry-point.
         /// </summary>
         /// <returns>Zero on success, otherwise non-zero.</returns>
 
         public static async Task<int> Main(string[] args)
         {
+            bool refresh = args.Contains("--refresh");
+            args = args.Where(a => a != "--refresh").ToArray();
+
             if (args.Count() != 1)
             {
-                Console.WriteLine("App requires a device id on the command line");
+                Console.WriteLine("App requires a device id on the command line (and optionally --refresh to ignore cached device lists)");
                 return -1;
             }
 
@@ -58,7 +75,7 @@ namespace DeviceTenantFinder
                 return -1;
             }
 
-            string result = GetData("tenants", token);
+            string result = await GetDataAsync("tenants", token).ConfigureAwait(false);
 
             List<Tenant> tenantList = JsonConvert.DeserializeObject<List<Tenant>>(result);
 
@@ -78,12 +95,19 @@ namespace DeviceTenantFinder
             string deviceGroupId = "None";
 
 
-            foreach (Tenant tenant in tenantList)
-            {
-                result = GetData($"tenants/{tenant.Id}/devices", token);
+            // Fetch every tenant's devices concurrently, then search them
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            List<Item>[] tenantDevices = await Task.WhenAll(tenantList.Select(tenant => GetTenantDevicesAsync(tenant, token, refresh))).ConfigureAwait(false);
+            stopwatch.Stop();
 
-                Devices devices = JsonConvert.DeserializeObject<Devices>(result);
-                foreach (Item item in devices.Items)
+            int deviceCount = tenantDevices.Sum(list => list.Count);
+            double seconds = Math.Max(stopwatch.Elapsed.TotalSeconds, 0.001);
+            Console.WriteLine($"Listed {deviceCount} device(s) in {seconds:F1}s, {RequestCount} request(s), {deviceCount / seconds:F0} devices/s");
+
+            for (int index = 0; index < tenantList.Count && !deviceFound; index++)
+            {
+                Tenant tenant = tenantList[index];
+                foreach (Item item in tenantDevices[index])
                 {
                     if (item.DeviceId.ToLower() == args[0].ToLower())
                     {
@@ -115,18 +139,67 @@ namespace DeviceTenantFinder
             return 0;
         }
 
-        private static string GetData(string relativeUrl, string token)
+        private static async Task<string> GetDataAsync(string relativeUrl, string token, string continuationToken = null)
         {
-            var client = new RestClient(AzureSphereApiUri);
-            var request = new RestRequest($"/v2/{relativeUrl}", Method.GET);
-            request.AddParameter("Authorization", string.Format("Bearer " + token), ParameterType.HttpHeader);
-            var response = client.Execute(request);
+            await RequestSlots.WaitAsync().ConfigureAwait(false);
+            try
+            {
+                var client = new RestClient(AzureSphereApiUri);
+                var request = new RestRequest($"/v2/{relativeUrl}", Method.GET);
+                request.AddParameter("Authorization", string.Format("Bearer " + token), ParameterType.HttpHeader);
+                if (!string.IsNullOrEmpty(continuationToken))
+                {
+                    request.AddParameter("Sphere-Continuation", continuationToken, ParameterType.HttpHeader);
+                }
+                var response = await client.ExecuteAsync(request).ConfigureAwait(false);
+                Interlocked.Increment(ref RequestCount);
 
-            if (response.IsSuccessful)
+                if (response.IsSuccessful)
+                {
+                    return response.Content;
+                }
+                return string.Empty;
+            }
+            finally
             {
-                return response.Content;
+                RequestSlots.Release();
             }
-            return string.Empty;
+        }
+
+        /// <summary>
+        /// Get all of a tenant's devices, following continuation tokens, from the local cache if it's recent.
+        /// A list that fails part way is returned but not cached.
+        /// </summary>
+        private static async Task<List<Item>> GetTenantDevicesAsync(Tenant tenant, string token, bool refresh)
+        {
+            string cacheFile = Path.Combine(DeviceCacheFolder, $"{tenant.Id}.json");
+            if (!refresh && File.Exists(cacheFile) && DateTime.UtcNow - File.GetLastWriteTimeUtc(cacheFile) < DeviceCacheLifetime)
+            {
+                return JsonConvert.DeserializeObject<List<Item>>(File.ReadAllText(cacheFile)) ?? new List<Item>();
+            }
+
+            List<Item> items = new List<Item>();
+            string continuationToken = null;
+            do
+            {
+                string result = await GetDataAsync($"tenants/{tenant.Id}/devices", token, continuationToken).ConfigureAwait(false);
+                if (string.IsNullOrEmpty(result))
+                {
+                    Console.WriteLine($"Failed to list the devices in tenant {tenant.Name}");
+                    return items;
+                }
+
+                Devices devices = JsonConvert.DeserializeObject<Devices>(result);
+                if (devices.Items != null)
+                {
+                    items.AddRange(devices.Items);
+                }
+                continuationToken = devices.ContinuationToken?.ToString();
+            } while (!string.IsNullOrEmpty(continuationToken));
+
+            Directory.CreateDirectory(DeviceCacheFolder);
+            File.WriteAllText(cacheFile, JsonConvert.SerializeObject(items));
+            return items;
         }
 
         private static async Task<string> GetTokenAsync()
@@ -54,15 +54,23 @@ typedef enum
 } ConnectionManagerState;
 
 /// <summary>
-///     Local structs & state-variables for the connection timer-handler
+///     Local structs & state-variables for the connection timer-handler.
+///     The OS doesn't notify connection changes, so the connection state is polled: quickly at
+///     first, as a network that is going to connect usually does so within a few seconds, then
+///     backing off to CONNECTION_POLL_MAX_MS. The overall timeout stays MAX_CONNECTION_RETRIES
+///     times the maximum period.
 /// </summary>
-static const struct timespec connectionPollSeconds = { .tv_sec = 10, .tv_nsec = 0 };
+#define CONNECTION_POLL_FIRST_MS	500
+#define CONNECTION_POLL_MAX_MS		10000
+#define CONNECTION_TIMEOUT_MS		(MAX_CONNECTION_RETRIES * CONNECTION_POLL_MAX_MS)
 typedef struct
 {
 	char connectionNetworkName[WIFICONFIG_CONFIG_NAME_MAX_LENGTH + 1];
 	EventLoop *eventLoop;
 	EventLoopTimer *connectionTimer;
-	volatile sig_atomic_t connectionRetries;
+	volatile sig_atomic_t connectionAttempts;
+	int pollMs;
+	int elapsedMs;
 	volatile sig_atomic_t exitCode;
 } ConnectionTimerHandlerContext;
 static ConnectionTimerHandlerContext connectionTimerHandlerContext =
@@ -70,10 +78,29 @@ static ConnectionTimerHandlerContext connectionTimerHandlerContext =
 	"",
 	NULL,
 	NULL,
-	MAX_CONNECTION_RETRIES,
+	0,
+	CONNECTION_POLL_FIRST_MS,
+	0,
 	EapTlsResult_Error,
 };
 
+/// <summary>
+///     Next connection poll period: doubles up to CONNECTION_POLL_MAX_MS, and never past the timeout.
+/// </summary>
+static int NextConnectionPollMs(int pollMs, int elapsedMs)
+{
+	pollMs *= 2;
+	if (pollMs > CONNECTION_POLL_MAX_MS)
+	{
+		pollMs = CONNECTION_POLL_MAX_MS;
+	}
+	if (pollMs > CONNECTION_TIMEOUT_MS - elapsedMs)
+	{
+		pollMs = CONNECTION_TIMEOUT_MS - elapsedMs;
+	}
+	return pollMs;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 //////////////////////////////////////////////////////////////
@@ -104,23 +131,31 @@ static void ConnectionTimerEventHandler(EventLoopTimer *timer)
 		return;
 	}
 
-	if (connectionTimerHandlerContext.connectionRetries--)
+	connectionTimerHandlerContext.connectionAttempts++;
+	connectionTimerHandlerContext.elapsedMs += connectionTimerHandlerContext.pollMs;
+
+	EapTlsResult iRes = EapTls_IsNetworkConnected(connectionTimerHandlerContext.connectionNetworkName);
+	if (EapTlsResult_Disconnected != iRes)
 	{
-		EapTlsResult iRes = EapTls_IsNetworkConnected(connectionTimerHandlerContext.connectionNetworkName);
-		if (EapTlsResult_Disconnected == iRes)
-		{
-			connectionTimerHandlerContext.exitCode = EapTlsResult_Connecting;
-		}
-		else
-		{
-			connectionTimerHandlerContext.exitCode = EapTlsResult_Connected;
-		}
+		connectionTimerHandlerContext.exitCode = EapTlsResult_Connected;
 	}
-	else
+	else if (connectionTimerHandlerContext.elapsedMs >= CONNECTION_TIMEOUT_MS)
 	{
 		connectionTimerHandlerContext.exitCode = EapTlsResult_ConnectionTimeout;
 	}
+	else
+	{
+		connectionTimerHandlerContext.pollMs = NextConnectionPollMs(connectionTimerHandlerContext.pollMs, connectionTimerHandlerContext.elapsedMs);
+		const struct timespec nextPoll = { .tv_sec = connectionTimerHandlerContext.pollMs / 1000, .tv_nsec = (connectionTimerHandlerContext.pollMs % 1000) * 1000000 };
+		if (SetEventLoopTimerOneShot(timer, &nextPoll) != 0)
+		{
+			connectionTimerHandlerContext.exitCode = EapTlsResult_Error;
+			return;
+		}
+		connectionTimerHandlerContext.exitCode = EapTlsResult_Connecting;
+	}
 }
+static void DisposeConnectionTimerHandler(void);
 static EapTlsResult InitConnectionTimerHandler(const char *networkName)
 {
 	EapTlsResult iRes = EapTlsResult_Error;
@@ -144,13 +179,23 @@ static EapTlsResult InitConnectionTimerHandler(const char *networkName)
 		connectionTimerHandlerContext.eventLoop = EventLoop_Create();
 		if (NULL != connectionTimerHandlerContext.eventLoop)
 		{
-			connectionTimerHandlerContext.connectionRetries = MAX_CONNECTION_RETRIES;
+			connectionTimerHandlerContext.connectionAttempts = 0;
+			connectionTimerHandlerContext.pollMs = CONNECTION_POLL_FIRST_MS;
+			connectionTimerHandlerContext.elapsedMs = 0;
 			strncpy(connectionTimerHandlerContext.connectionNetworkName, networkName, sizeof(connectionTimerHandlerContext.connectionNetworkName) - 1);
 			connectionTimerHandlerContext.exitCode = EapTlsResult_Connecting;
-			connectionTimerHandlerContext.connectionTimer = CreateEventLoopPeriodicTimer(connectionTimerHandlerContext.eventLoop, &ConnectionTimerEventHandler, &connectionPollSeconds);
+			connectionTimerHandlerContext.connectionTimer = CreateEventLoopDisarmedTimer(connectionTimerHandlerContext.eventLoop, &ConnectionTimerEventHandler);
 			if (NULL != connectionTimerHandlerContext.connectionTimer)
 			{
-				iRes = EapTlsResult_Success;
+				const struct timespec firstPoll = { .tv_sec = 0, .tv_nsec = CONNECTION_POLL_FIRST_MS * 1000000 };
+				if (SetEventLoopTimerOneShot(connectionTimerHandlerContext.connectionTimer, &firstPoll) == 0)
+				{
+					iRes = EapTlsResult_Success;
+				}
+				else
+				{
+					DisposeConnectionTimerHandler();
+				}
 			}
 		}
 		else
@@ -769,14 +814,14 @@ EapTlsResult EapTls_ConfigureNetworkSecurity(const char *networkName, const char
 }
 EapTlsResult EapTls_WaitToConnectTo(const char *networkName)
 {
-	EapTlsResult iRes = EapTlsResult_Error, retries = MAX_CONNECTION_RETRIES;
-	const struct timespec sleepTime = { .tv_sec = 10, .tv_nsec = 0 };
+	EapTlsResult iRes = EapTlsResult_Error;
+	int attempt = 0, pollMs = CONNECTION_POLL_FIRST_MS, elapsedMs = 0;
 
 	if (NULL != networkName)
 	{
-		while (retries--)
+		while (elapsedMs <= CONNECTION_TIMEOUT_MS)
 		{
-			EapTls_Log("Connection attempt #%d...\n", MAX_CONNECTION_RETRIES - retries);
+			EapTls_Log("Connection attempt #%d...\n", ++attempt);
 			iRes = EapTls_IsNetworkConnected(networkName);
 			if (EapTlsResult_Connected == iRes)
 			{
@@ -788,7 +833,15 @@ EapTlsResult EapTls_WaitToConnectTo(const char *networkName)
 				return iRes;
 			}
 
+			if (elapsedMs == CONNECTION_TIMEOUT_MS)
+			{
+				break;
+			}
+
+			const struct timespec sleepTime = { .tv_sec = pollMs / 1000, .tv_nsec = (pollMs % 1000) * 1000000 };
 			nanosleep(&sleepTime, NULL);
+			elapsedMs += pollMs;
+			pollMs = NextConnectionPollMs(pollMs, elapsedMs);
 		}
 
 		iRes = EapTlsResult_ConnectionTimeout;
@@ -814,6 +867,12 @@ EapTlsResult EapTls_ConnectToNetwork(const char *networkName)
 			// or
 			//iRes = EapTls_SetTargetScanOnNetwork(networkName, true);
 		}
+		if (EapTlsResult_Success == iRes && EapTlsResult_Connected == EapTls_IsNetworkConnected(networkName))
+		{
+			// Fast path: typically after a reboot the OS has already connected, so don't wait for a poll
+			EapTls_Log("Already CONNECTED to network '%s'!\n", networkName);
+			return EapTlsResult_Connected;
+		}
 		if (EapTlsResult_Success == iRes)
 		{
 			// Let's kick-off the connection handler
@@ -840,7 +899,7 @@ EapTlsResult EapTls_ConnectToNetwork(const char *networkName)
 					{
 						case EapTlsResult_Connecting:
 						{
-							EapTls_Log("Attempt #%d connecting to network '%s'... \n", MAX_CONNECTION_RETRIES - connectionTimerHandlerContext.connectionRetries, networkName);
+							EapTls_Log("Attempt #%d connecting to network '%s'... \n", connectionTimerHandlerContext.connectionAttempts, networkName);
 						}
 						break;
 
@@ -898,6 +957,65 @@ exit_timer:
 //////////////////////////////////////////////////////////////
 // Certificate store helpers
 //////////////////////////////////////////////////////////////
+
+/// <summary>
+///     FNV-1a hash of a PEM blob: identifies a certificate the library installed, it's not a security check.
+/// </summary>
+static uint64_t PemFingerprint(const uint8_t *pem, size_t size)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= pem[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+static CertificateFingerprint *FindCertificateFingerprint(const char *certificateId)
+{
+	for (int i = 0; i < MAX_CERTIFICATE_FINGERPRINTS; i++)
+	{
+		if (0 == strncmp(deviceConfiguration.installedCertificates[i].id, certificateId, CERTSTORE_MAX_IDENTIFIER_LENGTH))
+		{
+			return &deviceConfiguration.installedCertificates[i];
+		}
+	}
+	return NULL;
+}
+static void RecordCertificateFingerprint(const char *certificateId, const char *certificatePem)
+{
+	CertificateFingerprint *entry = FindCertificateFingerprint(certificateId);
+	if (NULL == entry)
+	{
+		// Take a free entry, or else recycle the oldest one
+		entry = FindCertificateFingerprint("");
+		if (NULL == entry)
+		{
+			memmove(&deviceConfiguration.installedCertificates[0], &deviceConfiguration.installedCertificates[1], sizeof(CertificateFingerprint) * (MAX_CERTIFICATE_FINGERPRINTS - 1));
+			entry = &deviceConfiguration.installedCertificates[MAX_CERTIFICATE_FINGERPRINTS - 1];
+		}
+		memset(entry, 0, sizeof(CertificateFingerprint));
+		strncpy(entry->id, certificateId, sizeof(entry->id) - 1);
+	}
+	entry->fingerprint = PemFingerprint((const uint8_t *)certificatePem, strlen(certificatePem));
+	EapTls_StoreDeviceConfiguration(&deviceConfiguration);
+}
+static void MoveCertificateFingerprint(const char *srcCertificateId, const char *dstCertificateId)
+{
+	CertificateFingerprint *dst = FindCertificateFingerprint(dstCertificateId);
+	if (NULL != dst)
+	{
+		memset(dst, 0, sizeof(CertificateFingerprint));
+	}
+	CertificateFingerprint *src = FindCertificateFingerprint(srcCertificateId);
+	if (NULL != src)
+	{
+		memset(src->id, 0, sizeof(src->id));
+		strncpy(src->id, dstCertificateId, sizeof(src->id) - 1);
+	}
+	EapTls_StoreDeviceConfiguration(&deviceConfiguration);
+}
+
 EapTlsResult EapTls_CompareCertificates(const char *certificateId, const uint8_t *certificatePem, size_t certSize)
 {
 	EapTlsResult iRes = 0;
@@ -917,9 +1035,12 @@ EapTlsResult EapTls_CompareCertificates(const char *certificateId, const uint8_t
 			}
 		}
 #else
-		// There is no released API to retrieve the fingerprint on a stored certificate and neither on a PEM blob, so we just say they are different...
-		// NOTE!! this uses flash write-cycles to (re)write certificate!!
-		iRes = EapTlsResult_Error;
+		// There is no released API to retrieve the fingerprint of a stored certificate, so compare with the fingerprint
+		// recorded when the library installed it: an unchanged certificate from the WebAPI doesn't cost flash write-cycles.
+		CertificateFingerprint *installed = FindCertificateFingerprint(certificateId);
+		iRes = (NULL != installed &&
+			EapTlsResult_Success == EapTls_IsCertificateInstalled(certificateId) &&
+			installed->fingerprint == PemFingerprint(certificatePem, certSize)) ? EapTlsResult_Success : EapTlsResult_Error;
 #endif
 	}
 	else
@@ -1077,6 +1198,7 @@ EapTlsResult EapTls_InstallRootCaCertificatePem(const char *certificateId, const
 			if (CertStore_InstallRootCACertificate(certificateId, certificatePem, cert_len) == 0)
 			{
 				iRes = EapTlsResult_Success;
+				RecordCertificateFingerprint(certificateId, certificatePem);
 				EapTls_Log("Successfully installed '%s' rootCA certificate\n", certificateId);
 			}
 			else
@@ -1156,6 +1278,7 @@ EapTlsResult EapTls_InstallClientCertificatePem(const char *certificateId, const
 			if (CertStore_InstallClientCertificate(certificateId, certificatePem, cert_len, privateKeyPem, pk_len, privateKeyPassword) == 0)
 			{
 				iRes = EapTlsResult_Success;
+				RecordCertificateFingerprint(certificateId, certificatePem);
 				EapTls_Log("Successfully installed '%s' client certificate\n", certificateId);
 			}
 			else
@@ -1372,6 +1495,7 @@ EapTlsResult EapTls_RunConnectionManager(EapTlsConfig *eapTlsConfig)
 	// Temporary storage for the RootCA & Client certificates returned from the WebAPI (use Stack or static depending on SRAM/Flash constraints)
 	MemoryBlock webApiResponseBlob = { .data = NULL, .size = 0 };
 	WebApiResponse *webApiResponse = NULL;
+	char webApiETag[MAX_WEBAPI_ETAG_LEN + 1] = { 0 };
 
 	// Check basic parameter requirements
 	{
@@ -1437,6 +1561,15 @@ EapTlsResult EapTls_RunConnectionManager(EapTlsConfig *eapTlsConfig)
 			case ConnectionManagerState_Idle: // Just starting off: let's check if we have RootCA and Client certificates
 			{
 				EapTls_Log("EapTls_RunConnectionManager::ConnectionManagerState_Idle\n");
+
+				// An Ethernet bootstrap network doesn't compete with the EAP-TLS network for the Wi-Fi radio: bring it up now,
+				// so that its link and DHCP lease are ready by the time a certificate request needs it.
+				// (a Wi-Fi bootstrap network can't be prepared this way, as connecting targets a single network)
+				if (NetworkInterfaceType_Ethernet == radiusNetwork.bootstrapNetworkInterfaceType)
+				{
+					EapTls_SetBootstrapNetworkEnabledState(eapTlsConfig, true);
+				}
+
 				currentState = ConnectionManagerState_CheckCertsInstalled;
 			}
 			break;
@@ -1516,7 +1649,7 @@ EapTlsResult EapTls_RunConnectionManager(EapTlsConfig *eapTlsConfig)
 					// Install the RootCA certificate, if we asked for one and if it's different
 					if (requestRootCaCertificate)
 					{
-						if (0 != EapTls_CompareCertificates((const char*)&network->eapTlsRootCertificate, webApiResponse->rootCACertficate, strlen((const char*)&network->eapTlsRootCertificate)))
+						if (0 != EapTls_CompareCertificates(network->eapTlsRootCertificate.id, (const uint8_t *)webApiResponse->rootCACertficate, strlen(webApiResponse->rootCACertficate)))
 						{
 							iRes = EapTls_InstallRootCaCertificatePem((const char*)&network->eapTlsRootCertificate.id, webApiResponse->rootCACertficate);
 							if (EapTlsResult_Success != iRes)
@@ -1531,7 +1664,7 @@ EapTlsResult EapTls_RunConnectionManager(EapTlsConfig *eapTlsConfig)
 					// Install the Client certificate, if we asked for one and if it's different
 					if (requestClientCertificate)
 					{
-						if (0 != EapTls_CompareCertificates((const char*)&network->eapTlsClientCertificate, webApiResponse->clientPublicCertificate, strlen((const char*)&network->eapTlsClientCertificate)))
+						if (0 != EapTls_CompareCertificates(network->eapTlsClientCertificate.id, (const uint8_t *)webApiResponse->clientPublicCertificate, strlen(webApiResponse->clientPublicCertificate)))
 						{
 							// NOTE: it left to the customer to decide wither to use the private key password that "may" be returned from the WebAPI
 							// or a password that is hard-coded into the code (and that could be updated with future App updates)
@@ -1563,6 +1696,13 @@ EapTlsResult EapTls_RunConnectionManager(EapTlsConfig *eapTlsConfig)
 					continue;
 				}
 
+				// Remember which version of the certificates is installed, for the next WebAPI call
+				if (0 != strncmp(deviceConfiguration.webApiCertificatesETag, webApiETag, sizeof(deviceConfiguration.webApiCertificatesETag)))
+				{
+					strncpy(deviceConfiguration.webApiCertificatesETag, webApiETag, sizeof(deviceConfiguration.webApiCertificatesETag) - 1);
+					EapTls_StoreDeviceConfiguration(&deviceConfiguration);
+				}
+
 				// We now have the new certs installed, let's attempt to add the EAP-TLS network, or configure the duplicated one if we're coming from that path
 				currentState = duplicatingNetwork ? ConnectionManagerState_ConfigureEapTlsNetwork_Dup : ConnectionManagerState_AddEapTlsNetwork;
 			}
@@ -1812,6 +1952,10 @@ EapTlsResult EapTls_RunConnectionManager(EapTlsConfig *eapTlsConfig)
 								{
 									// Rename the NEW root & client certificates
 									res = CertStore_MoveCertificate(radiusNetwork_dup.eapTlsRootCertificate.id, radiusNetwork.eapTlsRootCertificate.id);
+									if (-1 != res)
+									{
+										MoveCertificateFingerprint(radiusNetwork_dup.eapTlsRootCertificate.id, radiusNetwork.eapTlsRootCertificate.id);
+									}
 									if (-1 == res)
 									{
 										iRes = EapTlsResult_FailedSwappingEapTlsNetworkConfig;
@@ -1821,6 +1965,10 @@ EapTlsResult EapTls_RunConnectionManager(EapTlsConfig *eapTlsConfig)
 									else
 									{
 										res = CertStore_MoveCertificate(radiusNetwork_dup.eapTlsClientCertificate.id, radiusNetwork.eapTlsClientCertificate.id);
+										if (-1 != res)
+										{
+											MoveCertificateFingerprint(radiusNetwork_dup.eapTlsClientCertificate.id, radiusNetwork.eapTlsClientCertificate.id);
+										}
 										if (-1 == res)
 										{
 											iRes = EapTlsResult_FailedSwappingEapTlsNetworkConfig;
@@ -1912,12 +2060,25 @@ EapTlsResult EapTls_RunConnectionManager(EapTlsConfig *eapTlsConfig)
 			{
 				EapTls_Log("EapTls_RunConnectionManager::ConnectionManagerState_CallMdmWebApi\n");
 
-				iRes = EapTls_CallMdmWebApi(&radiusNetwork, requestRootCaCertificate, requestClientCertificate, &webApiResponseBlob);
+				// If the installed certificates failed authenticating, only download them if the WebAPI has different ones
+				memset(webApiETag, 0, sizeof(webApiETag));
+				if (duplicatingNetwork)
+				{
+					strncpy(webApiETag, deviceConfiguration.webApiCertificatesETag, sizeof(webApiETag) - 1);
+				}
+
+				iRes = EapTls_CallMdmWebApi(&radiusNetwork, requestRootCaCertificate, requestClientCertificate, webApiETag, &webApiResponseBlob);
 				if (EapTlsResult_Success == iRes)
 				{
 					// The WebAPI has successfully returned a response --> let's move to parsing
 					currentState = ConnectionManagerState_HandleMdmWebApiResponse;
 				}
+				else if (EapTlsResult_MdmWebApiCertificatesUnchanged == iRes)
+				{
+					// Installing the same certificates again would fail authenticating just the same --> return to the App
+					currentState = ConnectionManagerState_Error_Exit;
+					EapTls_Log("The WebAPI '%s' has no newer certificates --> exiting\n", radiusNetwork.mdmWebApiInterfaceUrl);
+				}
 				else
 				{
 					iRes = EapTlsResult_FailedConnectingToMdmWebApi;
@@ -1,4 +1,5 @@
 #pragma once
+#include <stdint.h>
 #include <time.h>
 #include "../applibs_versions.h"
 #include <applibs/log.h>
@@ -22,7 +23,9 @@
 /// </summary>
 #define MAX_CONNECTION_RETRIES        4  // This is the number of retries the library will attempt in connecting to a network
 #define MAX_NETWORK_CONFIGURATIONS   10  // Max number network configurations that can be stored
+#define MAX_CERTIFICATE_FINGERPRINTS  4  // Max number of installed certificates whose fingerprint is remembered
 #define MAX_URL_LEN                 255
+#define MAX_WEBAPI_ETAG_LEN          72  // Max length of the entity-tag the WebAPI returns with the certificates
 
 /// <summary>
 ///     Network interface definitions.
@@ -73,6 +76,7 @@ typedef enum
     EapTlsResult_FailedConfiguringCertificates,
     EapTlsResult_FailedInstallingNewCertificates,
     EapTlsResult_FailedConfiguringNewCertificates,
+    EapTlsResult_MdmWebApiCertificatesUnchanged,
 
 } EapTlsResult;
 
@@ -84,6 +88,16 @@ typedef struct {
     size_t size;
 } MemoryBlock;
 
+/// <summary>
+///     Fingerprint of a certificate PEM installed by the library, in the device's CertStore.
+/// </summary>
+typedef struct
+{
+    char id[CERTSTORE_MAX_IDENTIFIER_LENGTH + 1];
+    uint64_t fingerprint;
+
+} CertificateFingerprint;
+
 /// <summary>
 ///     Data structure for handling the device's permanent configuration.
 /// </summary>
@@ -92,6 +106,14 @@ typedef struct
     char eapTlsNetworkSsid[WIFICONFIG_SSID_MAX_LENGTH + 1];
     char eapTlsClientIdentity[WIFICONFIG_EAP_IDENTITY_MAX_LENGTH + 1];
 
+    // The certificates last installed by the library, so that a certificate returned
+    // unchanged by the WebAPI is not written to the CertStore again.
+    CertificateFingerprint installedCertificates[MAX_CERTIFICATE_FINGERPRINTS];
+
+    // The entity-tag of the certificates last installed from the WebAPI, sent back with the
+    // next request so that the WebAPI only returns the certificates if they have changed.
+    char webApiCertificatesETag[MAX_WEBAPI_ETAG_LEN + 1];
+
     // Here you can store other entities that may be part of a local
     // configuration that needs to persist across device reboot and updates.
     // The maximum size is set in the app_manifest.json (currently it's 8Kb).
@@ -324,7 +346,8 @@ EapTlsResult EapTls_CloneNetworkConfig(EapTlsConfig *srcNetwork, EapTlsConfig *d
 EapTlsResult EapTls_ConfigureNetworkSecurity(const char *networkName, const char *identity, const char *rootCACertificateId, const char *clientCertificateId);
 
 /// <summary>
-///     Checks for MAX_CONNECTION_RETRIES if the given configuration name is connected.
+///     Checks if the given configuration name is connected, polling with a backoff from 0.5s to 10s
+///     for up to MAX_CONNECTION_RETRIES times 10 seconds.
 /// </summary>
 /// <param name="networkName">The network configuration name to connect to.</param>
 /// <returns>
@@ -370,14 +393,14 @@ EapTlsResult EapTls_ConnectToNetwork(const char *networkName);
 //////////////////////////////////////////////////////////////
 
 /// <summary>
-///     (prototype) Currently, just uses some unavailable API stubs (to be enabled with the USE_ADDITIONAL_API_STUBS precompiler #define)
+///     Compares an installed certificate with a PEM blob. Without the (unavailable) fingerprint APIs enabled by
+///     USE_ADDITIONAL_API_STUBS, the PEM is compared with the fingerprint recorded when the library installed the
+///     certificate, so a certificate the library didn't install always compares as different.
 /// </summary>
 /// <param name="certificateId">The certificate ID in the device's CertStore that needs to be compared with the PEM blob.</param>
 /// <param name="certificatePem">The certificate, in PEM format, that needs to be compared with certificate ID in the device's CertStore.</param>
 /// <param name="certSize">The size of the certificate PEM-blob.</param>
 /// <returns>
-///     <para>Note: currently ALWAYS returns EapTlsResult_Error.</para>
-///     <para>Stable implementation with new APIs will return:</para>
 ///     <para>EapTlsResult_Success, the certificates are identical.</para>
 ///     <para>EapTlsResult_Error, the certificates are different.</para>
 ///     <para>EapTlsResult_BadParameters, one or more of the provided pointers are NULL or empty.</para>
@@ -523,5 +546,6 @@ EapTlsResult EapTls_SetBootstrapNetworkEnabledState(EapTlsConfig* eapTlsConfig,
 ///     <para>EapTlsResult_FailedConnectingToMdmWebApi, failed calling WebAPI.</para>
 ///     <para>EapTlsResult_FailedParsingMdmWebApiResponse, failed parsing response from WebAPI.</para>
 ///     <para>EapTlsResult_FailedReceivingNewCertificates, the WebAPI did not return the requested certificates.</para>
+///     <para>EapTlsResult_MdmWebApiCertificatesUnchanged, the WebAPI has no newer certificates than the ones that failed authenticating.</para>
 /// </returns>
 EapTlsResult EapTls_RunConnectionManager(EapTlsConfig *eapTlsConfig);
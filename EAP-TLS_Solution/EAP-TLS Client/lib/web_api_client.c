@@ -1,6 +1,7 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <curl/curl.h>
@@ -171,6 +172,35 @@ static size_t EapTls_StoreDownloadedDataCallback(void *chunks, size_t chunkSize,
 
 	return additionalDataSize;
 }
+static size_t EapTls_StoreETagHeaderCallback(char *header, size_t size, size_t headersCount, void *eTag)
+{
+	static const char eTagHeader[] = "ETag:";
+	size_t headerSize = size * headersCount;
+
+	if (headerSize > sizeof(eTagHeader) - 1 && 0 == strncasecmp(header, eTagHeader, sizeof(eTagHeader) - 1))
+	{
+		// Headers are not null-terminated: trim the value's surrounding blanks and the trailing CRLF
+		const char *value = header + sizeof(eTagHeader) - 1;
+		const char *end = header + headerSize;
+		while (value < end && (' ' == *value || '\t' == *value))
+			value++;
+		while (end > value && (' ' == end[-1] || '\r' == end[-1] || '\n' == end[-1]))
+			end--;
+
+		size_t valueSize = (size_t)(end - value);
+		if (valueSize <= MAX_WEBAPI_ETAG_LEN)
+		{
+			memcpy(eTag, value, valueSize);
+			((char *)eTag)[valueSize] = 0;
+		}
+		else
+		{
+			Log_Debug("WARNING: ignoring an ETag of %zu bytes\n", valueSize);
+		}
+	}
+
+	return headerSize;
+}
 static CURLcode EapTls_DeviceAuth_CurlSslFunc(CURL *curl, void *sslctx, void *userCtx)
 {
 	DeviceAuthSslResult err = DeviceAuth_SslCtxFunc(sslctx);
@@ -198,7 +228,7 @@ static CURLcode EapTls_DeviceAuth_CurlSslFunc(CURL *curl, void *sslctx, void *us
 
 	return CURLE_OK;
 }
-EapTlsResult EapTls_CallWebApi(const char *url, const char *queryString, const char *putString, const char *webApiRootCACertRelativePath, MemoryBlock *responseBlock)
+EapTlsResult EapTls_CallWebApi(const char *url, const char *queryString, const char *putString, const char *webApiRootCACertRelativePath, char *eTag, MemoryBlock *responseBlock)
 {
 	EapTlsResult iRes = EapTlsResult_Error;
 
@@ -210,6 +240,7 @@ EapTlsResult EapTls_CallWebApi(const char *url, const char *queryString, const c
 		if (curlHandle)
 		{
 			CURLcode res;
+			struct curl_slist *hs = NULL;
 			// Set up for DAA mutual authentication
 			// Device: https://docs.microsoft.com/en-us/azure-sphere/app-development/curl
 			// WebAPI: https://docs.microsoft.com/en-us/azure/app-service/app-service-web-configure-tls-mutual-auth#special-considerations-for-certificate-validation
@@ -246,7 +277,6 @@ EapTlsResult EapTls_CallWebApi(const char *url, const char *queryString, const c
 					}
 					else
 					{
-						struct curl_slist *hs = NULL;
 						hs = curl_slist_append(hs, "Content-Type: application/json");
 						if ((res = curl_easy_setopt(curlHandle, CURLOPT_HTTPHEADER, hs)) != CURLE_OK)
 						{
@@ -271,6 +301,31 @@ EapTlsResult EapTls_CallWebApi(const char *url, const char *queryString, const c
 						}
 					}
 				}
+				// Let the WebAPI reply "304 Not Modified" if what we already have is still current
+				if (NULL != eTag)
+				{
+					if (0 != *eTag)
+					{
+						char hdrTemp[MAX_WEBAPI_ETAG_LEN + sizeof("If-None-Match: ")];
+						snprintf(hdrTemp, sizeof(hdrTemp), "If-None-Match: %s", eTag);
+						hs = curl_slist_append(hs, hdrTemp);
+						if ((res = curl_easy_setopt(curlHandle, CURLOPT_HTTPHEADER, hs)) != CURLE_OK)
+						{
+							LogCurlError(" FAILED curl_easy_setopt CURLOPT_HTTPHEADER", res);
+						}
+					}
+
+					// The ETag of the response replaces the one sent
+					*eTag = 0;
+					if ((res = curl_easy_setopt(curlHandle, CURLOPT_HEADERFUNCTION, EapTls_StoreETagHeaderCallback)) != CURLE_OK)
+					{
+						LogCurlError(" FAILED curl_easy_setopt CURLOPT_HEADERFUNCTION", res);
+					}
+					else if ((res = curl_easy_setopt(curlHandle, CURLOPT_HEADERDATA, (void *)eTag)) != CURLE_OK)
+					{
+						LogCurlError(" FAILED curl_easy_setopt CURLOPT_HEADERDATA", res);
+					}
+				}
 				//if ((res = curl_easy_setopt(curlHandle, CURLOPT_SSL_VERIFYHOST, 0)) != CURLE_OK)
 				//{
 				//	LogCurlError("curl_easy_setopt CURLOPT_SSL_VERIFYHOST", res);
@@ -343,10 +398,20 @@ EapTlsResult EapTls_CallWebApi(const char *url, const char *queryString, const c
 													Log_Debug("Connecting to %s...\n", call_url);
 													if ((res = curl_easy_perform(curlHandle)) == CURLE_OK)
 													{
-														// #NOTE: SSL renegotiation is not currently supported by Azure Sphere
-														Log_Debug("\n -===- Downloaded content (%zu bytes): -===-\n", responseBlock->size);
-														Log_Debug("%s\n", responseBlock->data);
-														iRes = EapTlsResult_Success;
+														long httpStatus = 0;
+														curl_easy_getinfo(curlHandle, CURLINFO_RESPONSE_CODE, &httpStatus);
+														if (304 == httpStatus)
+														{
+															Log_Debug("\n -===- Content not modified (ETag %s) -===-\n", NULL != eTag ? eTag : "");
+															iRes = EapTlsResult_MdmWebApiCertificatesUnchanged;
+														}
+														else
+														{
+															// #NOTE: SSL renegotiation is not currently supported by Azure Sphere
+															Log_Debug("\n -===- Downloaded content (%zu bytes): -===-\n", responseBlock->size);
+															Log_Debug("%s\n", responseBlock->data);
+															iRes = EapTlsResult_Success;
+														}
 													}
 													else
 													{
@@ -365,6 +430,7 @@ EapTlsResult EapTls_CallWebApi(const char *url, const char *queryString, const c
 			}
 
 			curl_easy_cleanup(curlHandle);
+			curl_slist_free_all(hs);
 		}
 		else
 		{
@@ -380,7 +446,7 @@ EapTlsResult EapTls_CallWebApi(const char *url, const char *queryString, const c
 
 	return iRes;
 }
-EapTlsResult EapTls_CallMdmWebApi(EapTlsConfig *eapTlsConfig, bool getRootCACertificate, bool getClientCertificate, MemoryBlock *responseBlock)
+EapTlsResult EapTls_CallMdmWebApi(EapTlsConfig *eapTlsConfig, bool getRootCACertificate, bool getClientCertificate, char *eTag, MemoryBlock *responseBlock)
 {
 	EapTlsResult iRes = EapTlsResult_Error;
 
@@ -408,13 +474,17 @@ EapTlsResult EapTls_CallMdmWebApi(EapTlsConfig *eapTlsConfig, bool getRootCACert
 		if (EapTlsResult_Error == EapTls_ValidateCertificates(eapTlsConfig->eapTlsRootCertificate.id, NULL, NULL))
 			getClientCertificate = true;
 
+		// Missing certificates must be downloaded anyway, whatever the WebAPI's version of them
+		if (NULL != eTag && (EapTlsResult_Error == EapTls_IsCertificateInstalled(eapTlsConfig->eapTlsRootCertificate.id) || EapTlsResult_Error == EapTls_IsCertificateInstalled(eapTlsConfig->eapTlsClientCertificate.id)))
+			*eTag = 0;
+
 #if defined(WEBAPI_SERVER)
 		// Call MDM WebApi "auth" method
-		iRes = EapTls_CallWebApi(eapTlsConfig->mdmWebApiInterfaceUrl, NULL, "{}", eapTlsConfig->mdmWebApiRootCertificate.relativePath, responseBlock);
+		iRes = EapTls_CallWebApi(eapTlsConfig->mdmWebApiInterfaceUrl, NULL, "{}", eapTlsConfig->mdmWebApiRootCertificate.relativePath, eTag, responseBlock);
 #endif
 #if defined(WEBAPI_KESTREL)
 		snprintf(query_str, sizeof(query_str) - 1, "%s=%s&%s=%s", webApi_RootCertificateField, getRootCACertificate ? strTrue : strFalse, webApi_ClientCertificateField, getClientCertificate ? strTrue : strFalse);
-		iRes = EapTls_CallWebApi(eapTlsConfig->mdmWebApiInterfaceUrl, query_str, NULL, eapTlsConfig->mdmWebApiRootCertificate.relativePath, responseBlock);
+		iRes = EapTls_CallWebApi(eapTlsConfig->mdmWebApiInterfaceUrl, query_str, NULL, eapTlsConfig->mdmWebApiRootCertificate.relativePath, eTag, responseBlock);
 #endif
 	}
 	else
@@ -437,7 +507,7 @@ EapTlsResult EapTls_WebApiRegisterDevice(EapTlsConfig *eapTlsConfig)
 		MemoryBlock responseBlock = { .data = NULL, .size = 0 };
 
 		// Add further specific parameters here (currently set as an empty JSON body).
-		iRes = EapTls_CallWebApi(g_webApiInterfaceRegisterUrl, NULL, "{}", eapTlsConfig->mdmWebApiRootCertificate.relativePath, &responseBlock);
+		iRes = EapTls_CallWebApi(g_webApiInterfaceRegisterUrl, NULL, "{}", eapTlsConfig->mdmWebApiRootCertificate.relativePath, NULL, &responseBlock);
 
 		size_t nullTerminatedJsonSize = responseBlock.size + 1;
 		char *nullTerminatedJsonString = (char *)malloc(nullTerminatedJsonSize);
@@ -29,14 +29,16 @@ EapTlsResult EapTls_ParseMdmWebApiResponse(MemoryBlock *responseBlock, WebApiRes
 /// <param name="queryString">A pointer to the webAPI's query string, which will be used to call the web API. Can be NULL if not needed</param>
 /// <param name="putString">A pointer to the webAPI's PUT fields, which will be used to call the web API.. Can be NULL if not needed</param>
 /// <param name="webApiRootCACertiRelativePath">The relative path in the App's image RootCA certificate Id that will be used to authenticate the Web API Server.</param>
+/// <param name="eTag">A buffer of MAX_WEBAPI_ETAG_LEN + 1 chars, or NULL if not needed. If not empty, it is sent as the request's "If-None-Match" header; on return it holds the response's "ETag" header, if any.</param>
 /// <param name="responseBlock">A valid pointer to a 'MemoryBlock' struct, into which the allocated raw-byte response from the WebAPI will be stored in.</param>
 /// <returns>
 ///     <para>EapTlsResult_Success, succeeded calling the WebAPI, and <paramref name="responseBlock"/> contains a pointer the raw-byte response.</para>
+///     <para>EapTlsResult_MdmWebApiCertificatesUnchanged, the WebAPI replied "304 Not Modified" to the given <paramref name="eTag"/>, and <paramref name="responseBlock"/> is empty.</para>
 ///     <para>EapTlsResult_Error, error setting-up libcurl.</para>
 ///     <para>EapTlsResult_FailedConnectingToMdmWebApi, libcurl failed connecting to the WebAPI.</para>
 ///     <para>EapTlsResult_BadParameters, one or more of the provided pointers are NULL or empty.</para>
 /// </returns>
-EapTlsResult EapTls_CallWebApi(const char *url, const char *queryString, const char *putString, const char *webApiRootCACertiRelativePath, MemoryBlock *responseBlock);
+EapTlsResult EapTls_CallWebApi(const char *url, const char *queryString, const char *putString, const char *webApiRootCACertiRelativePath, char *eTag, MemoryBlock *responseBlock);
 
 /// <summary>
 ///     Calls the authentication WebAPI, and returns the parsed response.
@@ -44,14 +46,16 @@ EapTlsResult EapTls_CallWebApi(const char *url, const char *queryString, const c
 /// <param name="eapTlsConfig">A valid pointer to a pre-configured 'EapTlsConfig' struct, containing all the connection details</param>
 /// <param name="getRootCACertificate">True if the RootCA certificate is required.</param>
 /// <param name="getClientCertificate">True if the Client certificate is required.</param>
+/// <param name="eTag">A buffer of MAX_WEBAPI_ETAG_LEN + 1 chars, or NULL: see EapTls_CallWebApi(). It is only sent when the certificates are already installed.</param>
 /// <param name="responseBlock">A valid pointer to a 'MemoryBlock' struct, into which the allocated raw-byte response from the WebAPI will be stored in.</param>
 /// <returns>
 ///     <para>EapTlsResult_Success, succeeded calling the WebAPI, and <paramref name="responseBlock"/> contains a pointer the raw-byte response.</para>
+///     <para>EapTlsResult_MdmWebApiCertificatesUnchanged, the WebAPI has no newer certificates than the ones identified by <paramref name="eTag"/>.</para>
 ///     <para>EapTlsResult_Error, error setting-up libcurl.</para>
 ///     <para>EapTlsResult_FailedConnectingToMdmWebApi, libcurl failed connecting to the WebAPI.</para>
 ///     <para>EapTlsResult_BadParameters, one or more of the provided pointers are NULL or empty.</para>
 /// </returns>
-EapTlsResult EapTls_CallMdmWebApi(EapTlsConfig *eapTlsConfig, bool getRootCACertificate, bool getClientCertificate, MemoryBlock *responseBlock);
+EapTlsResult EapTls_CallMdmWebApi(EapTlsConfig *eapTlsConfig, bool getRootCACertificate, bool getClientCertificate, char *eTag, MemoryBlock *responseBlock);
 
 /// <summary>
 ///		Calls the registration WebAPI, and returns the result of the registration process.
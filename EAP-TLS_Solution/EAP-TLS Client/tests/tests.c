@@ -241,7 +241,7 @@ EapTlsResult TestEapTlsLib_ProvisionWithMdmWebApi(EapTlsConfig *eapTlsConfig)
 			if (EapTlsResult_Success == iRes)
 			{
 				MemoryBlock webApiResponseBlob = { .data = NULL, .size = 0 };
-				iRes = EapTls_CallMdmWebApi(eapTlsConfig, true, true, &webApiResponseBlob);
+				iRes = EapTls_CallMdmWebApi(eapTlsConfig, true, true, NULL, &webApiResponseBlob);
 				if (EapTlsResult_Success == iRes)
 				{
 					WebApiResponse response;
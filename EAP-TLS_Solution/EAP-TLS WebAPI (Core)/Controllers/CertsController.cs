@@ -1,6 +1,8 @@
 ﻿using System;
 using System.IO;
+using System.Security.Cryptography;
 using System.Security.Cryptography.X509Certificates;
+using System.Text;
 using Microsoft.AspNetCore.Mvc;
 using Microsoft.Extensions.Configuration;
 
@@ -114,6 +116,20 @@ namespace EapTlsWebAPICore.Controllers
             return response;
         }
 
+        // Identifies the certificates in a response, regardless of its Timestamp, so that a device
+        // whose certificates failed authenticating doesn't download and install the same ones again.
+        private static string ComputeETag(ResponseToClient response)
+        {
+            string content = string.Join("\n", response.RootCACertificate, response.EapTlsNetworkSsid, response.ClientIdentity,
+                response.ClientPublicCertificate, response.ClientPrivateKey, response.ClientPrivateKeyPass);
+
+            using (SHA256 sha256 = SHA256.Create())
+            {
+                byte[] hash = sha256.ComputeHash(Encoding.UTF8.GetBytes(content));
+                return "\"" + BitConverter.ToString(hash).Replace("-", "").ToLowerInvariant() + "\"";
+            }
+        }
+
         // NOTE: These parameter names must match the ones defined in the Azure Sphere App code
         [HttpGet]        
         public ActionResult<ResponseToClient> Get([FromQuery] bool needRootCACertificate, [FromQuery] bool needClientCertificate)
@@ -128,6 +144,14 @@ namespace EapTlsWebAPICore.Controllers
                 try
                 {
                     response = CallCMSDeviceVerification(clientDAACertificate, needRootCACertificate, needClientCertificate);
+
+                    string eTag = ComputeETag(response);
+                    Response.Headers["ETag"] = eTag;
+                    if (Request.Headers["If-None-Match"] == eTag)
+                    {
+                        Console.WriteLine("Certificates not modified since the device's last request");
+                        return StatusCode(304);
+                    }
                 }
                 catch (Exception ex)
                 {
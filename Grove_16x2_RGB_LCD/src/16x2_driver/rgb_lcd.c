@@ -17,8 +17,15 @@
 #define LCD_ADDRESS     0x3e
 #define RGB_ADDRESS     0x62
 
+#define LCD_ROWS        2
+#define LCD_COLUMNS     16
+
 static int _i2cFd = -1;
 
+// What the display is showing, so SetText only sends the characters that change
+static char _shadow[LCD_ROWS][LCD_COLUMNS];
+static bool _shadowValid = false;
+
 static void textCommand(uint8_t cmd);
 static void write_byte_data(uint8_t address, uint8_t b0, uint8_t b1);
 
@@ -50,8 +57,32 @@ static void textCommand(uint8_t cmd)
     WriteI2CData(LCD_ADDRESS, data, 2);
 }
 
+// Move the cursor, then write a run of characters in one I2C transaction
+static int writeRun(int row, int column, const char* chars, size_t len)
+{
+    uint8_t data[1 + LCD_COLUMNS];
+
+    textCommand((uint8_t)(0x80 | (row * 0x40) | column));
+    data[0] = 0x40;
+    memcpy(&data[1], chars, len);
+    return WriteI2CData(LCD_ADDRESS, data, len + 1);
+}
+
+static void clearDisplay(void)
+{
+    textCommand(0x01);
+    delay(50);
+    textCommand(0x08 | 0x04); // display on, no cursor
+    textCommand(0x28); // 2 lines
+    delay(50);
+
+    memset(_shadow, ' ', sizeof(_shadow));
+    _shadowValid = true;
+}
+
 int RGBLCD_Init(int ISU)
 {
+    _shadowValid = false;
     _i2cFd = I2CMaster_Open(ISU);
     if (_i2cFd > -1)
     {
@@ -81,38 +112,53 @@ void RGBLCD_SetColor(uint8_t r, uint8_t g, uint8_t b)
 
 void RGBLCD_SetText(char* data)
 {
-    textCommand(0x01);
-    delay(50);
-    textCommand(0x08 | 0x04); // display on, no cursor
-    textCommand(0x28); // 2 lines
-    delay(50);
+    // Lay the text out on the display, 16 characters a row, '\n' starting the second row
+    char frame[LCD_ROWS][LCD_COLUMNS];
+    memset(frame, ' ', sizeof(frame));
 
-    int count = 0;
     int row = 0;
+    int column = 0;
 
-    size_t len = strlen(data);
-    uint8_t chr = 0x00;
-
-    for (size_t x = 0; x < 32; x++)
+    for (const char* chr = data; *chr != '\0' && row < LCD_ROWS; chr++)
     {
-        if (x >= len)
-            chr = 0x20;
-        else
-            chr = data[x];
-
-        if (chr == '\n' || count == 16)
+        if (*chr == '\n' || column == LCD_COLUMNS)
         {
-            count = 0;
             row += 1;
-            if (row == 2)
+            column = 0;
+            if (*chr == '\n')
+                continue;
+            if (row == LCD_ROWS)
                 break;
-
-            textCommand(0xc0);
         }
-        else
+        frame[row][column++] = *chr;
+    }
+
+    if (!_shadowValid)
+        clearDisplay();
+
+    // Send each run of changed characters; the shadow only takes runs that were written,
+    // and is dropped on failure so the next call starts from a clear display
+    for (row = 0; row < LCD_ROWS; row++)
+    {
+        column = 0;
+        while (column < LCD_COLUMNS)
         {
-            write_byte_data(LCD_ADDRESS, 0x40, chr);
+            if (frame[row][column] == _shadow[row][column])
+            {
+                column++;
+                continue;
+            }
+
+            int start = column;
+            while (column < LCD_COLUMNS && frame[row][column] != _shadow[row][column])
+                column++;
+
+            if (writeRun(row, start, &frame[row][start], (size_t)(column - start)) < 0)
+            {
+                _shadowValid = false;
+                return;
+            }
+            memcpy(&_shadow[row][start], &frame[row][start], (size_t)(column - start));
         }
-        count += 1;
     }
 }
@@ -0,0 +1,255 @@
+/*
+* Copyright (c) Microsoft Corporation.
+* Licensed under the MIT License.
+*/
+// Runs fixed allocation traces through the HeapTracker wrappers, and reports the time per
+// allocator call and the memory HeapTracker uses. It's built once per configuration by
+// CMakeLists.txt in this folder, HEAP_BENCHMARK_BASELINE builds it without HeapTracker.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "heap_tracker_lib.h"
+
+#ifndef HEAP_BENCHMARK_CONFIG
+#	define HEAP_BENCHMARK_CONFIG	"default"
+#endif
+
+#if HEAP_BENCHMARK_BASELINE || ENABLE_POINTER_TRACKING
+#	define BENCH_FREE(ptr, size)					free(ptr)
+#	define BENCH_REALLOC(ptr, old_size, new_size)	realloc(ptr, new_size)
+#else
+#	define BENCH_FREE(ptr, size)					_free(ptr, size)
+#	define BENCH_REALLOC(ptr, old_size, new_size)	_realloc(ptr, old_size, new_size)
+#endif
+
+#if HEAP_BENCHMARK_BASELINE
+// the library isn't linked in
+volatile ssize_t heap_allocated = 0;
+void heap_track_init(void) {}
+#endif
+
+// the per call logs are discarded
+int Log_Debug(const char *fmt, ...)
+{
+	(void)fmt;
+	return 0;
+}
+
+// Every allocation goes through here, so the compiler can't elide the unwrapped malloc/free pairs of the baseline.
+static void *volatile bench_sink;
+
+static void *keep(void *ptr)
+{
+	bench_sink = ptr;
+	return bench_sink;
+}
+
+static uint32_t bench_random = 1;
+
+static uint32_t next_random(void)
+{
+	bench_random ^= bench_random << 13;
+	bench_random ^= bench_random >> 17;
+	bench_random ^= bench_random << 5;
+	return bench_random;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+typedef struct
+{
+	void *ptr;
+	size_t size;
+} slot_t;
+
+#define SLOTS 1024
+static slot_t slots[SLOTS];
+
+// The largest overhead seen while the trace runs, sampled when the most pointers are live.
+static size_t peak_overhead = 0;
+
+static void sample_overhead(void)
+{
+#if !HEAP_BENCHMARK_BASELINE && ENABLE_POINTER_TRACKING
+	size_t overhead = heap_track_overhead();
+	if (overhead > peak_overhead)
+	{
+		peak_overhead = overhead;
+	}
+#endif
+}
+
+static void free_slots(uint32_t *ops)
+{
+	for (size_t i = 0; i < SLOTS; i++)
+	{
+		if (slots[i].ptr)
+		{
+			BENCH_FREE(slots[i].ptr, slots[i].size);
+			slots[i].ptr = NULL;
+			(*ops)++;
+		}
+	}
+}
+
+// Small churn: 1024 live blocks of 16 to 128 bytes, each step frees one at random and allocates another.
+static uint32_t trace_small_churn(void)
+{
+	uint32_t ops = 0;
+	for (uint32_t i = 0; i < 1000000; i++)
+	{
+		slot_t *slot = &slots[next_random() % SLOTS];
+		if (slot->ptr)
+		{
+			BENCH_FREE(slot->ptr, slot->size);
+			ops++;
+		}
+		slot->size = 16 + (next_random() % 113);
+		slot->ptr = keep(malloc(slot->size));
+		ops++;
+	}
+	sample_overhead();
+	free_slots(&ops);
+	return ops;
+}
+
+// Realloc growth: 64 buffers grown 64 bytes at a time up to 8KB, as when accumulating a payload, then freed.
+static uint32_t trace_realloc_growth(void)
+{
+	uint32_t ops = 0;
+	for (uint32_t round = 0; round < 40; round++)
+	{
+		for (size_t size = 64; size <= 8192; size += 64)
+		{
+			for (size_t i = 0; i < 64; i++)
+			{
+				slots[i].ptr = keep(BENCH_REALLOC(slots[i].ptr, slots[i].size, size));
+				slots[i].size = size;
+				ops++;
+			}
+		}
+		sample_overhead();
+		free_slots(&ops);
+	}
+	return ops;
+}
+
+// IDC mixed: the allocations of one poll cycle of the IndustrialDeviceController HL app, modeled
+// on its call sites: the IPC command and response buffers, the telemetry structures with their
+// masks, values and strdup'ed strings, the batch record, and the cloud send context.
+static uint32_t trace_idc_mixed(void)
+{
+	uint32_t ops = 0;
+	for (uint32_t cycle = 0; cycle < 50000; cycle++)
+	{
+		uint32_t num_values = 4 + (next_random() % 28);
+
+		// ipc.c: command, then response
+		size_t msg_size = 32 + (next_random() % 224);
+		void *msg = keep(malloc(msg_size));
+		void *resp = keep(malloc(1040));
+		ops += 2;
+
+		// adapter.c: the telemetry of one device
+		void *telemetry = keep(calloc(1, 48));
+		void *cov_mask = keep(calloc(1, (num_values + 7) / 8));
+		void *str_mask = keep(calloc(1, (num_values + 7) / 8));
+		void *values = keep(calloc(num_values, 16));
+		ops += 4;
+
+		// device_hal.c: string values
+		void *strs[4];
+		uint32_t num_strs = next_random() % 4;
+		for (uint32_t i = 0; i < num_strs; i++)
+		{
+			strs[i] = keep(malloc(8 + (next_random() % 24)));
+			ops++;
+		}
+
+		BENCH_FREE(msg, msg_size);
+		BENCH_FREE(resp, 1040);
+		ops += 2;
+
+		// telemetry_batch.c: the batch record is kept, in a ring of pending records
+		slot_t *record = &slots[cycle % 256];
+		if (record->ptr)
+		{
+			BENCH_FREE(record->ptr, record->size);
+			ops++;
+		}
+		record->size = 16 + num_values * sizeof(void *);
+		record->ptr = keep(malloc(record->size));
+		ops++;
+
+		// azure_iot_utilities.c: the send context lives until the message is confirmed
+		void *ctx = keep(calloc(1, 40));
+		ops++;
+
+		for (uint32_t i = 0; i < num_strs; i++)
+		{
+			BENCH_FREE(strs[i], 0);
+			ops++;
+		}
+		BENCH_FREE(values, num_values * 16);
+		BENCH_FREE(str_mask, (num_values + 7) / 8);
+		BENCH_FREE(cov_mask, (num_values + 7) / 8);
+		BENCH_FREE(telemetry, 48);
+		BENCH_FREE(ctx, 40);
+		ops += 5;
+
+		if (cycle % 1000 == 0)
+		{
+			sample_overhead();
+		}
+	}
+	free_slots(&ops);
+	return ops;
+}
+
+typedef struct
+{
+	const char *name;
+	uint32_t (*run)(void);
+} trace_t;
+
+static const trace_t traces[] = {
+	{ "small-churn", trace_small_churn },
+	{ "realloc-growth", trace_realloc_growth },
+	{ "idc-mixed", trace_idc_mixed },
+};
+
+// Runs the trace named on the command line, or all of them. The tracking tables never shrink,
+// so the overhead reported for a trace is only its own when it runs alone.
+int main(int argc, char *argv[])
+{
+	heap_track_init();
+
+	for (size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); i++)
+	{
+		if (argc > 1 && 0 != strcmp(argv[1], traces[i].name))
+		{
+			continue;
+		}
+
+		bench_random = 0x12345678;
+		peak_overhead = 0;
+
+		uint64_t start = now_ns();
+		uint32_t ops = traces[i].run();
+		uint64_t elapsed = now_ns() - start;
+
+		printf("%-24s %-16s %9u ops %8.1f ns/op %8zu bytes overhead\n", HEAP_BENCHMARK_CONFIG, traces[i].name,
+			ops, (double)elapsed / ops, peak_overhead);
+	}
+
+	return 0;
+}
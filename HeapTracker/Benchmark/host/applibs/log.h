@@ -0,0 +1,8 @@
+/*
+* Copyright (c) Microsoft Corporation.
+* Licensed under the MIT License.
+*/
+#pragma once
+
+// Host stand-in for the Azure Sphere log library, the benchmark measures the tracking and not the logging.
+int Log_Debug(const char *fmt, ...);
@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
 #include <pthread.h>
 
 #include "heap_tracker_lib.h"
@@ -23,56 +25,180 @@ const size_t heap_threshold = 250 * 1024;
 // Heap allocated amount (in bytes). This is signed so the user can debug allocation issues.
 volatile ssize_t heap_allocated = 0;
 
-int heap_track_pointer(void *ptr, size_t size);
-int heap_untrack_pointer(void *ptr);
+typedef struct
+{
+	void *address;
+	size_t size;
+#if HEAP_SAMPLE_INTERVAL > 0
+	size_t weight;		// the bytes accounted for the pointer, as a sample
+#endif
+#if ENABLE_SITE_PROFILING
+	uintptr_t site;
+	uint32_t epoch;
+#endif
+} t_pointer;
+
+int heap_track_pointer(void *ptr, size_t size, size_t weight, uintptr_t site);
+int heap_untrack_pointer(void *ptr, t_pointer *entry);
+
+#if ENABLE_SITE_PROFILING
+// Advanced by heap_snapshot_take(), each tracked pointer records the epoch it was allocated in.
+static volatile uint32_t profile_epoch = 0;
+
+static void profile_alloc(uintptr_t site, size_t size, size_t weight);
+static void profile_free(uintptr_t site, size_t weight, uint32_t count);
+#endif // ENABLE_SITE_PROFILING
 
 //////////////////////////////////////////////////////////////////////////////////
 // THREAD SAFETY
 //////////////////////////////////////////////////////////////////////////////////
+/*
+*	The wrappers don't share a lock: 'heap_allocated' is updated atomically, and the
+*	pointer tracking table is split in shards by address, each with its own mutex,
+*	so threads only contend when they (de)allocate pointers of the same shard.
+*/
 #if ENABLE_THREAD_SAFETY
-static pthread_mutex_t mux;
+#	define HEAP_ALLOCATED_ADD(delta)	__atomic_add_fetch(&heap_allocated, (delta), __ATOMIC_RELAXED)
+#	define HEAP_ALLOCATED_GET()		__atomic_load_n(&heap_allocated, __ATOMIC_RELAXED)
+#	define MUTEX_LOCK(mux)			pthread_mutex_lock(mux);
+#	define MUTEX_UNLOCK(mux)		pthread_mutex_unlock(mux);
+#else
+#	define HEAP_ALLOCATED_ADD(delta)	(heap_allocated += (delta))
+#	define HEAP_ALLOCATED_GET()		(heap_allocated)
+#	define MUTEX_LOCK(mux)
+#	define MUTEX_UNLOCK(mux)
+#endif
+
+#if ENABLE_POINTER_TRACKING
+static void heap_track_init_shards(void);
 #endif
 
 void heap_track_init(void)
 {
-#if ENABLE_THREAD_SAFETY
-	pthread_mutex_init(&mux, NULL);
+#if ENABLE_POINTER_TRACKING
+	heap_track_init_shards();
 #endif
 }
 
-#if ENABLE_THREAD_SAFETY
-#	define MUTEX_LOCK	pthread_mutex_lock(&mux);
-#	define MUTEX_UNLOCK	pthread_mutex_unlock(&mux);
-#else
-#	define MUTEX_LOCK
-#	define MUTEX_UNLOCK
-#endif
-
 //////////////////////////////////////////////////////////////////////////////////
 // LOGGING
 //////////////////////////////////////////////////////////////////////////////////
 #define HEAP_TRACKER_LIB_LOG_PREFIX		"Heap-Tracker: "
 #define HeapTracker_Log(...)			Log_Debug(HEAP_TRACKER_LIB_LOG_PREFIX __VA_ARGS__)
-#define LogHeapStatus()					log_heap_status() 
+#if HEAP_SAMPLE_INTERVAL > 0
+// Logging every call would cost far more than the sampling saves.
+#	define HeapTracker_CallLog(...)
+#	define LogHeapStatus()
+#else
+#	define HeapTracker_CallLog(...)		HeapTracker_Log(__VA_ARGS__)
+#	define LogHeapStatus()				log_heap_status()
+#endif
+
+// The code calling the wrapper, the allocation site recorded for the pointer.
+#define HEAP_CALL_SITE()				((uintptr_t)__builtin_return_address(0))
 
 void log_heap_status(void)
 {
-	if (heap_allocated < 0)
+	ssize_t allocated = HEAP_ALLOCATED_GET();
+
+	if (allocated < 0)
 	{
-		Log_Debug("WARNING: heap_allocated (%zd) is NEGATIVE --> 'heap_allocated' will not be reliable from now on!\n", heap_allocated);
+		Log_Debug("WARNING: heap_allocated (%zd) is NEGATIVE --> 'heap_allocated' will not be reliable from now on!\n", allocated);
 	}
-	else if (heap_allocated > heap_threshold)
+	else if (allocated > heap_threshold)
 	{
-		Log_Debug("WARNING: heap_allocated (%zd bytes) is above heap_threshold (%zu bytes)\n", heap_allocated, heap_threshold);
+		Log_Debug("WARNING: heap_allocated (%zd bytes) is above heap_threshold (%zu bytes)\n", allocated, heap_threshold);
 	}
 #if ENABLE_DEBUG_VERBOSE_LOGS
 	else
 	{
-		Log_Debug("SUCCESS: heap_allocated (%zd bytes) - delta with heap_threshold(%zd bytes)\n", heap_allocated, (ssize_t)heap_threshold - heap_allocated);
+		Log_Debug("SUCCESS: heap_allocated (%zd bytes) - delta with heap_threshold(%zd bytes)\n", allocated, (ssize_t)heap_threshold - allocated);
 	}
 #endif
 }
 
+//////////////////////////////////////////////////////////////////////////////////
+// SAMPLING
+//////////////////////////////////////////////////////////////////////////////////
+#if HEAP_SAMPLE_INTERVAL > 0
+
+#if !ENABLE_POINTER_TRACKING
+#	error "HEAP_SAMPLE_INTERVAL requires ENABLE_POINTER_TRACKING, to recognize the sampled pointers when they're freed"
+#endif
+
+/*
+*	Sampling points fall on the allocated bytes as a Poisson process, HEAP_SAMPLE_INTERVAL
+*	bytes apart on average: each thread counts down the bytes to its next sampling point,
+*	drawn from an exponential distribution, and only tracks the allocation which reaches it.
+*	An allocation of 'size' bytes is sampled with probability 1 - exp(-size / HEAP_SAMPLE_INTERVAL),
+*	so it is accounted for size / (1 - exp(-size / HEAP_SAMPLE_INTERVAL)) bytes, which keeps
+*	'heap_allocated' an unbiased estimate of the heap use.
+*/
+static __thread ssize_t sample_bytes_left = 0;
+static __thread uint32_t sample_random = 0;
+
+static ssize_t sample_next_interval(void)
+{
+	if (0 == sample_random)
+	{
+		sample_random = (uint32_t)(uintptr_t)&sample_bytes_left ^ 0x9e3779b9;
+	}
+
+	// xorshift32, then a uniform value in (0, 1] for the exponential distribution
+	sample_random ^= sample_random << 13;
+	sample_random ^= sample_random >> 17;
+	sample_random ^= sample_random << 5;
+	double u = ((sample_random >> 8) + 1) / (double)(1 << 24);
+
+	return (ssize_t)(-log(u) * HEAP_SAMPLE_INTERVAL) + 1;
+}
+
+// Returns the bytes a sampled allocation of size bytes accounts for, 0 if it isn't sampled.
+static size_t sample_weight(size_t size)
+{
+	static __thread bool started = false;
+	if (!started)
+	{
+		started = true;
+		sample_bytes_left = sample_next_interval();
+	}
+
+	sample_bytes_left -= (ssize_t)size;
+	if (sample_bytes_left > 0)
+	{
+		return 0;
+	}
+	sample_bytes_left = sample_next_interval();
+
+	double x = (double)(size ? size : 1) / HEAP_SAMPLE_INTERVAL;
+	return (size_t)((size ? size : 1) / -expm1(-x) + 0.5);
+}
+
+// The number of allocations a pointer of size bytes sampled for weight bytes stands for.
+#define SAMPLE_COUNT(size, weight)	((size) && (weight) > (size) ? ((weight) + (size) / 2) / (size) : 1)
+#define POINTER_WEIGHT(entry)		((entry).weight)
+
+#else
+
+#define sample_weight(size)			(size)
+#define SAMPLE_COUNT(size, weight)	1
+#define POINTER_WEIGHT(entry)		((entry).size)
+
+#endif // HEAP_SAMPLE_INTERVAL > 0
+
+#if ENABLE_POINTER_TRACKING
+// Accounts for and tracks a new allocation, or with sampling, only if it is sampled.
+static void heap_track_allocation(void *ptr, size_t size, uintptr_t site)
+{
+	size_t weight = sample_weight(size);
+	if (0 != weight)
+	{
+		HEAP_ALLOCATED_ADD((ssize_t)weight);
+		heap_track_pointer(ptr, size, weight, site);
+	}
+}
+#endif // ENABLE_POINTER_TRACKING
+
 //////////////////////////////////////////////////////////////////////////////////
 // NATIVE malloc/free WRAPPERS
 //////////////////////////////////////////////////////////////////////////////////
@@ -93,169 +219,154 @@ void __real_free(void *ptr);
 // Heap-tracking malloc() wrapper
 void *__wrap_malloc(size_t size)
 {
-	MUTEX_LOCK;
-
 	void *ptr = __real_malloc(size);
 
-	HeapTracker_Log("malloc(%zu)=%p... ", size, ptr);
+	HeapTracker_CallLog("malloc(%zu)=%p... ", size, ptr);
 	if (NULL != ptr)
 	{
-		heap_allocated += (ssize_t)size;
-
 #if ENABLE_POINTER_TRACKING
-		heap_track_pointer(ptr, size);
+		heap_track_allocation(ptr, size, HEAP_CALL_SITE());
+#else
+		HEAP_ALLOCATED_ADD((ssize_t)size);
 #endif // ENABLE_POINTER_TRACKING
-
 	}
 
 	LogHeapStatus();
 
-	MUTEX_UNLOCK;
-
 	return ptr;
 }
 
 // Custom heap-tracking calloc() wrapper
 void *__wrap_calloc(size_t num, size_t size)
 {
-	MUTEX_LOCK;
-
 	void *ptr = __real_calloc(num, size);
 
-	HeapTracker_Log("calloc(%zu,%zu)=%p...", num, size, ptr);
+	HeapTracker_CallLog("calloc(%zu,%zu)=%p...", num, size, ptr);
 	if (ptr)
 	{
-		heap_allocated += (ssize_t)(num * size);
-
 #if ENABLE_POINTER_TRACKING
-		heap_track_pointer(ptr, size);
+		heap_track_allocation(ptr, num * size, HEAP_CALL_SITE());
+#else
+		HEAP_ALLOCATED_ADD((ssize_t)(num * size));
 #endif // ENABLE_POINTER_TRACKING
 	}
 
 	LogHeapStatus();
 
-	MUTEX_UNLOCK;
-
 	return ptr;
 }
 
 // Custom heap-tracking aligned_alloc() wrapper
 void *__wrap_aligned_alloc(size_t alignment, size_t size)
 {
-	MUTEX_LOCK;
-
 	void *ptr = __real_aligned_alloc(alignment, size);
 
-	HeapTracker_Log("aligned_alloc(%zu,%zu)=%p...", alignment, size, ptr);
+	HeapTracker_CallLog("aligned_alloc(%zu,%zu)=%p...", alignment, size, ptr);
 	if (ptr)
 	{
-		heap_allocated += (ssize_t)size;
-
 #if ENABLE_POINTER_TRACKING
-		heap_track_pointer(ptr, size);
+		heap_track_allocation(ptr, size, HEAP_CALL_SITE());
+#else
+		HEAP_ALLOCATED_ADD((ssize_t)size);
 #endif // ENABLE_POINTER_TRACKING
 	}
 
 	LogHeapStatus();
 
-	MUTEX_UNLOCK;
-
 	return ptr;
 }
 
 // Custom heap-tracking realloc() wrapper
 void *__wrap_realloc(void *ptr, size_t new_size)
 {
-	MUTEX_LOCK;
+#if ENABLE_POINTER_TRACKING
+	// Untracked before reallocating: once realloc() has released it, the old address
+	// can be handed out to (and tracked by) another thread straight away.
+	t_pointer old = { 0 };
+	int tracked = (ptr) ? heap_untrack_pointer(ptr, &old) : -1;
+	if (ptr && -1 == tracked)
+	{
+		HeapTracker_CallLog("WARNING: free(%p) was called for a non-tracked pointer.\n", ptr);
+	}
+#endif // ENABLE_POINTER_TRACKING
 
 	void *new_ptr = __real_realloc(ptr, new_size);
 
-	HeapTracker_Log("realloc(%p, %zu)=%p... ", ptr, new_size, new_ptr);
+	HeapTracker_CallLog("realloc(%p, %zu)=%p... ", ptr, new_size, new_ptr);
 	if (NULL != new_ptr)
 	{
-		heap_allocated += (ssize_t)(new_size);
-
 #if ENABLE_POINTER_TRACKING
-		if (ptr && -1 == heap_untrack_pointer(ptr))
-		{
-			HeapTracker_Log("WARNING: free(%p) was called for a non-tracked pointer.\n", ptr);
-		}
-
-		if (-1 == heap_track_pointer(new_ptr, new_size))
-		{
-			HeapTracker_Log("WARNING: free(%p) was called for a non-tracked pointer.\n", ptr);
-		}
+		heap_track_allocation(new_ptr, new_size, HEAP_CALL_SITE());
 #else
-		HeapTracker_Log("WARNING! Native realloc(%p,%zu) was called instead of _realloc() helper: 'heap_allocated' will not be reliable from now on!\n", ptr, new_size);
+		HEAP_ALLOCATED_ADD((ssize_t)(new_size));
+		HeapTracker_CallLog("WARNING! Native realloc(%p,%zu) was called instead of _realloc() helper: 'heap_allocated' will not be reliable from now on!\n", ptr, new_size);
 #endif
 	}
+#if ENABLE_POINTER_TRACKING
+	else if (0 != new_size && 0 == tracked)
+	{
+		// the reallocation failed, and the original pointer is still allocated
+		HEAP_ALLOCATED_ADD((ssize_t)POINTER_WEIGHT(old));
+#if ENABLE_SITE_PROFILING
+		heap_track_pointer(ptr, old.size, POINTER_WEIGHT(old), old.site);
+#else
+		heap_track_pointer(ptr, old.size, POINTER_WEIGHT(old), 0);
+#endif
+	}
+#endif // ENABLE_POINTER_TRACKING
 
 	LogHeapStatus();
 
-	MUTEX_UNLOCK;
-
 	return new_ptr;
 }
 
 // Native free() wrapper (does NOT track heap!)
 void __wrap_free(void *ptr)
 {
-	MUTEX_LOCK;
-
-	HeapTracker_Log("free(%p)... ", ptr);
+	HeapTracker_CallLog("free(%p)... ", ptr);
 
 #if ENABLE_POINTER_TRACKING
-	if (ptr && -1 == heap_untrack_pointer(ptr))
+	if (ptr && -1 == heap_untrack_pointer(ptr, NULL))
 	{
-		HeapTracker_Log("WARNING: free(%p) was called for a non-tracked pointer.\n", ptr);
+		HeapTracker_CallLog("WARNING: free(%p) was called for a non-tracked pointer.\n", ptr);
 	}
 #else
-	HeapTracker_Log("WARNING! Native free(%p) was called instead of _free() helper: 'heap_allocated' will not be reliable from now on!\n", ptr);
+	HeapTracker_CallLog("WARNING! Native free(%p) was called instead of _free() helper: 'heap_allocated' will not be reliable from now on!\n", ptr);
 #endif // ENABLE_POINTER_TRACKING
 
 	LogHeapStatus();
 
 	__real_free(ptr);
-
-	MUTEX_UNLOCK;
 }
 
 #if !ENABLE_POINTER_TRACKING
 // Custom heap-tracking free() helper
 void _free(void *ptr, size_t size)
 {
-	MUTEX_LOCK;
-
 	HeapTracker_Log("_free(%p,%zu)... ", ptr, size);
 
 	__real_free(ptr);
 	if (ptr)
 	{
-		heap_allocated -= (ssize_t)size;
+		HEAP_ALLOCATED_ADD(-(ssize_t)size);
 	}
 
 	LogHeapStatus();
-
-	MUTEX_UNLOCK;
 }
 
 // Custom heap-tracking realloc() helper
 void *_realloc(void *ptr, size_t old_size, size_t new_size)
 {
-	MUTEX_LOCK;
-
 	void *new_ptr = __real_realloc(ptr, new_size);
 
 	HeapTracker_Log("_realloc(%p,%zu,%zu)=%p... ", ptr, old_size, new_size, new_ptr);
 	if (NULL != new_ptr)
 	{
-		heap_allocated += (ssize_t)(new_size - old_size + 1);
+		HEAP_ALLOCATED_ADD((ssize_t)(new_size - old_size + 1));
 	}
 
 	LogHeapStatus();
 
-	MUTEX_UNLOCK;
-
 	return new_ptr;
 }
 #endif // ENABLE_POINTER_TRACKING
@@ -266,62 +377,481 @@ void *_realloc(void *ptr, size_t old_size, size_t new_size)
 //////////////////////////////////////////////////////////////////////////////////
 #if ENABLE_POINTER_TRACKING
 
+// Open-addressing hash tables (linear probing) keyed by address, a NULL address marks a free slot.
+// Their size is always a power of 2, and each one is doubled whenever it gets more than half full.
+// Pointers are spread over POINTER_TRACK_SHARDS tables by address, each guarded by its own mutex.
 typedef struct
 {
-	void *address;
+#if ENABLE_THREAD_SAFETY
+	pthread_mutex_t mux;
+#endif
+	t_pointer *table;
 	size_t size;
-} t_pointer;
+	size_t count;
+} t_pointer_shard;
+
+static t_pointer_shard pointer_shards[POINTER_TRACK_SHARDS];
+
+static void heap_track_init_shards(void)
+{
+#if ENABLE_THREAD_SAFETY
+	for (size_t i = 0; i < POINTER_TRACK_SHARDS; i++)
+	{
+		pthread_mutex_init(&pointer_shards[i].mux, NULL);
+	}
+#endif
+}
+
+static size_t pointer_hash(const void *ptr)
+{
+	// Heap pointers are at least 8-byte aligned, so the low bits carry no information.
+	uintptr_t h = (uintptr_t)ptr >> 3;
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return (size_t)h;
+}
+
+// The low bits of the hash select the shard, the rest the slot within it.
+#define POINTER_SHARD(hash)			(&pointer_shards[(hash) % POINTER_TRACK_SHARDS])
+#define POINTER_SLOT(hash, mask)	(((hash) / POINTER_TRACK_SHARDS) & (mask))
+
+static void pointer_insert(t_pointer *table, size_t table_size, const t_pointer *entry)
+{
+	size_t pos = POINTER_SLOT(pointer_hash(entry->address), table_size - 1);
+	while (NULL != table[pos].address)
+	{
+		pos = (pos + 1) & (table_size - 1);
+	}
+
+	table[pos] = *entry;
+}
+
+static int pointer_grow(t_pointer_shard *shard)
+{
+	size_t new_size = (0 == shard->size) ? POINTER_TRACK_INITIAL_SIZE : shard->size * 2;
+	t_pointer *new_table = __real_calloc(new_size, sizeof(t_pointer));
+	if (NULL == new_table)
+	{
+		return -1;
+	}
+
+	for (size_t i = 0; i < shard->size; i++)
+	{
+		if (NULL != shard->table[i].address)
+		{
+			pointer_insert(new_table, new_size, &shard->table[i]);
+		}
+	}
+
+	__real_free(shard->table);
+	shard->table = new_table;
+	shard->size = new_size;
+
+	return 0;
+}
+
+int heap_track_pointer(void *ptr, size_t size, size_t weight, uintptr_t site)
+{
+	t_pointer_shard *shard = POINTER_SHARD(pointer_hash(ptr));
+	t_pointer entry = { .address = ptr, .size = size };
+	int result = 0;
+
+#if HEAP_SAMPLE_INTERVAL > 0
+	entry.weight = weight;
+#else
+	(void)weight;
+#endif
+#if ENABLE_SITE_PROFILING
+	entry.site = site;
+	entry.epoch = __atomic_load_n(&profile_epoch, __ATOMIC_RELAXED);
+#else
+	(void)site;
+#endif
+
+	MUTEX_LOCK(&shard->mux);
+
+	if ((shard->count + 1) * 2 > shard->size && -1 == pointer_grow(shard))
+	{
+		result = -1;
+	}
+	else
+	{
+		pointer_insert(shard->table, shard->size, &entry);
+		shard->count++;
+	}
+
+	MUTEX_UNLOCK(&shard->mux);
+
+	if (-1 == result)
+	{
+		HeapTracker_Log("heap_track_pointer(%p,%zu) FAILED - out of memory!!", ptr, size);
+	}
+#if ENABLE_SITE_PROFILING
+	else
+	{
+		profile_alloc(site, size, weight);
+	}
+#endif // ENABLE_SITE_PROFILING
 
-static t_pointer **allocated_pointers = NULL;
-static size_t allocated_pointers_size = 0;
-static unsigned int allocated_pointers_count = 0;
+	return result;
+}
 
-int heap_track_pointer(void *ptr, size_t size)
+int heap_untrack_pointer(void *ptr, t_pointer *entry)
 {
-	if (NULL == allocated_pointers || allocated_pointers_size < (allocated_pointers_count * sizeof(void *)))
+	size_t hash = pointer_hash(ptr);
+	t_pointer_shard *shard = POINTER_SHARD(hash);
+
+	MUTEX_LOCK(&shard->mux);
+
+	if (NULL == shard->table)
+	{
+		MUTEX_UNLOCK(&shard->mux);
+		return -1;
+	}
+
+	size_t mask = shard->size - 1;
+	size_t pos = POINTER_SLOT(hash, mask);
+	while (shard->table[pos].address != ptr)
 	{
-		size_t new_size = (allocated_pointers_count + POINTER_TRACK_INC) * sizeof(void *);
-		void *new_ptr = __real_realloc(allocated_pointers, new_size);
-		if (NULL == new_ptr)
+		if (NULL == shard->table[pos].address)
 		{
-			HeapTracker_Log("heap_track_pointer(%p,%zu) FAILED - out of memory!!", ptr, size);
+			MUTEX_UNLOCK(&shard->mux);
 			return -1;
 		}
-		else
+		pos = (pos + 1) & mask;
+	}
+
+	t_pointer freed = shard->table[pos];
+	shard->count--;
+
+	// Shift back the entries following in the same probe run, so no lookup stops short at the freed slot.
+	size_t next = pos;
+	for (;;)
+	{
+		next = (next + 1) & mask;
+		if (NULL == shard->table[next].address)
+		{
+			break;
+		}
+
+		size_t home = POINTER_SLOT(pointer_hash(shard->table[next].address), mask);
+		if (((next - home) & mask) >= ((next - pos) & mask))
 		{
-			allocated_pointers = new_ptr;
-			allocated_pointers_size = new_size;
+			shard->table[pos] = shard->table[next];
+			pos = next;
 		}
 	}
+	shard->table[pos].address = NULL;
+	shard->table[pos].size = 0;
 
-	allocated_pointers[allocated_pointers_count]->address = ptr;
-	allocated_pointers[allocated_pointers_count]->size = size;
-	allocated_pointers_count++;
+	MUTEX_UNLOCK(&shard->mux);
+
+	HEAP_ALLOCATED_ADD(-(ssize_t)POINTER_WEIGHT(freed));
+#if ENABLE_SITE_PROFILING
+	profile_free(freed.site, POINTER_WEIGHT(freed), (uint32_t)SAMPLE_COUNT(freed.size, POINTER_WEIGHT(freed)));
+#endif // ENABLE_SITE_PROFILING
+	if (entry)
+	{
+		*entry = freed;
+	}
 
 	return 0;
 }
 
-int heap_untrack_pointer(void *ptr)
+size_t heap_tracked_pointers(void)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < POINTER_TRACK_SHARDS; i++)
+	{
+		MUTEX_LOCK(&pointer_shards[i].mux);
+		count += pointer_shards[i].count;
+		MUTEX_UNLOCK(&pointer_shards[i].mux);
+	}
+
+	return count;
+}
+
+#endif // ENABLE_POINTER_TRACKING
+
+//////////////////////////////////////////////////////////////////////////////////
+// ALLOCATION-SITE PROFILING
+//////////////////////////////////////////////////////////////////////////////////
+#if ENABLE_SITE_PROFILING
+
+#if !ENABLE_POINTER_TRACKING
+#	error "ENABLE_SITE_PROFILING requires ENABLE_POINTER_TRACKING, to charge each free() back to its allocation site"
+#endif
+
+// Size classes are powers of 2: class k counts the allocations of (2^(k-1), 2^k] bytes,
+// the last one all of those larger.
+#define PROFILE_SIZE_CLASSES		20
+
+typedef struct
+{
+	uintptr_t site;
+	volatile ssize_t bytes;
+	volatile ssize_t peak;
+	volatile uint32_t allocs;
+	volatile uint32_t frees;
+	volatile size_t min_size;
+	volatile size_t max_size;
+} t_site;
+
+// Open-addressing table of the allocation sites, filled lock-free: a slot is claimed by
+// swapping its site in, and its counters are only ever updated atomically.
+// Sites beyond HEAP_PROFILE_SITES are aggregated into 'profile_other_sites'.
+static t_site profile_sites[HEAP_PROFILE_SITES];
+static t_site profile_other_sites;
+static volatile uint32_t profile_size_classes[PROFILE_SIZE_CLASSES];
+static volatile ssize_t profile_heap_peak = 0;
+// heap_allocated high-water mark since the last snapshot
+static volatile ssize_t profile_window_peak = 0;
+
+// Provided by the GNU linker, the site offsets in the report can be fed straight to addr2line.
+extern const char __executable_start[];
+
+static void profile_max(volatile ssize_t *peak, ssize_t value)
+{
+	ssize_t cur = __atomic_load_n(peak, __ATOMIC_RELAXED);
+	while (value > cur && !__atomic_compare_exchange_n(peak, &cur, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static size_t profile_size_class(size_t size)
 {
-	int pos = 0;
-	t_pointer **cur = allocated_pointers;
-	while (cur && pos < allocated_pointers_count)
+	size_t k = 0;
+	while (k < PROFILE_SIZE_CLASSES - 1 && ((size_t)1 << k) < size)
 	{
-		if ((*cur)->address == ptr)
+		k++;
+	}
+	return k;
+}
+
+static t_site *profile_site(uintptr_t site)
+{
+	if (0 == site)
+	{
+		return &profile_other_sites;
+	}
+
+	size_t pos = pointer_hash((void *)site) & (HEAP_PROFILE_SITES - 1);
+	for (size_t i = 0; i < HEAP_PROFILE_SITES; i++)
+	{
+		uintptr_t cur = __atomic_load_n(&profile_sites[pos].site, __ATOMIC_ACQUIRE);
+		if (0 == cur && __atomic_compare_exchange_n(&profile_sites[pos].site, &cur, site, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		{
+			return &profile_sites[pos];
+		}
+		if (cur == site)
 		{
-			heap_allocated -= (ssize_t)(allocated_pointers[pos]->size);
+			return &profile_sites[pos];
+		}
+		pos = (pos + 1) & (HEAP_PROFILE_SITES - 1);
+	}
 
-			memcpy(allocated_pointers[pos], allocated_pointers[pos + 1], allocated_pointers_size - sizeof(t_pointer));
-			memset(allocated_pointers[allocated_pointers_count - 1], 0, sizeof(t_pointer));
-			allocated_pointers_count--;
+	return &profile_other_sites;
+}
+
+static void profile_alloc(uintptr_t site, size_t size, size_t weight)
+{
+	t_site *entry = profile_site(site);
+	uint32_t count = (uint32_t)SAMPLE_COUNT(size, weight);
+
+	profile_max(&entry->peak, __atomic_add_fetch(&entry->bytes, (ssize_t)weight, __ATOMIC_RELAXED));
+	__atomic_add_fetch(&entry->allocs, count, __ATOMIC_RELAXED);
+
+	size_t cur = __atomic_load_n(&entry->min_size, __ATOMIC_RELAXED);
+	while ((0 == cur || size < cur) && !__atomic_compare_exchange_n(&entry->min_size, &cur, size, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	cur = __atomic_load_n(&entry->max_size, __ATOMIC_RELAXED);
+	while (size > cur && !__atomic_compare_exchange_n(&entry->max_size, &cur, size, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	__atomic_add_fetch(&profile_size_classes[profile_size_class(size)], count, __ATOMIC_RELAXED);
+	ssize_t allocated = HEAP_ALLOCATED_GET();
+	profile_max(&profile_heap_peak, allocated);
+	profile_max(&profile_window_peak, allocated);
+}
 
-			return 0;
+// count is the number of allocations the freed pointer stands for, see SAMPLE_COUNT
+static void profile_free(uintptr_t site, size_t weight, uint32_t count)
+{
+	t_site *entry = profile_site(site);
+
+	__atomic_sub_fetch(&entry->bytes, (ssize_t)weight, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&entry->frees, count, __ATOMIC_RELAXED);
+}
+
+#define PROFILE_PRINT(file, ...)	((file) ? fprintf((file), __VA_ARGS__) : HeapTracker_Log(__VA_ARGS__))
+
+void heap_profile_dump(FILE *file)
+{
+	// Snapshot first, so the report doesn't change under the sort.
+	t_site sites[HEAP_PROFILE_SITES + 1];
+	size_t count = 0;
+	for (size_t i = 0; i <= HEAP_PROFILE_SITES; i++)
+	{
+		const t_site *entry = (i < HEAP_PROFILE_SITES) ? &profile_sites[i] : &profile_other_sites;
+		if (0 != __atomic_load_n(&entry->allocs, __ATOMIC_RELAXED))
+		{
+			sites[count] = *entry;
+			// insertion sort, by peak bytes descending
+			size_t j = count++;
+			while (j > 0 && sites[j - 1].peak < sites[j].peak)
+			{
+				t_site tmp = sites[j - 1];
+				sites[j - 1] = sites[j];
+				sites[j] = tmp;
+				j--;
+			}
 		}
+	}
+
+	PROFILE_PRINT(file, "profile: allocated=%zd peak=%zd tracked=%zu sites=%zu\n",
+		HEAP_ALLOCATED_GET(), __atomic_load_n(&profile_heap_peak, __ATOMIC_RELAXED), heap_tracked_pointers(), count);
 
-		cur++, pos++;
+	// each line is printed with a single call, so it's a single UDP log message
+	char line[256];
+	int len;
+	for (size_t i = 0; i < count; i++)
+	{
+		const t_site *entry = &sites[i];
+		len = (0 == entry->site)
+			? snprintf(line, sizeof(line), "site=other")
+			: snprintf(line, sizeof(line), "site=%p(+0x%tx)", (void *)entry->site, (const char *)entry->site - __executable_start);
+		snprintf(line + len, sizeof(line) - (size_t)len, " bytes=%zd peak=%zd allocs=%u frees=%u size=%zu..%zu",
+			entry->bytes, entry->peak, entry->allocs, entry->frees, entry->min_size, entry->max_size);
+		PROFILE_PRINT(file, "%s\n", line);
 	}
 
-	return -1;
+	// only the size classes used: <largest size of the class>:<allocations>
+	len = snprintf(line, sizeof(line), "sizes:");
+	for (size_t k = 0; k < PROFILE_SIZE_CLASSES && len < (int)sizeof(line); k++)
+	{
+		uint32_t n = __atomic_load_n(&profile_size_classes[k], __ATOMIC_RELAXED);
+		if (0 != n)
+		{
+			len += (k == PROFILE_SIZE_CLASSES - 1)
+				? snprintf(line + len, sizeof(line) - (size_t)len, " >%zu:%u", (size_t)1 << (k - 1), n)
+				: snprintf(line + len, sizeof(line) - (size_t)len, " %zu:%u", (size_t)1 << k, n);
+		}
+	}
+	PROFILE_PRINT(file, "%s\n", line);
 }
 
-#endif // ENABLE_POINTER_TRACKING
\ No newline at end of file
+void heap_snapshot_take(heap_snapshot *snapshot)
+{
+	// allocations from now on belong to the new epoch
+	snapshot->epoch = __atomic_add_fetch(&profile_epoch, 1, __ATOMIC_RELAXED);
+	snapshot->allocated = HEAP_ALLOCATED_GET();
+	snapshot->high_water = __atomic_exchange_n(&profile_window_peak, snapshot->allocated, __ATOMIC_RELAXED);
+	if (snapshot->high_water < snapshot->allocated)
+	{
+		snapshot->high_water = snapshot->allocated;
+	}
+}
+
+typedef struct
+{
+	uintptr_t site;
+	uint32_t count;
+	ssize_t bytes;
+} t_leak;
+
+void heap_snapshot_diff(const heap_snapshot *a, const heap_snapshot *b, FILE *file)
+{
+	// Live pointers allocated between the two snapshots, grouped by site; the last entry
+	// aggregates the sites which don't fit.
+	t_leak leaks[HEAP_PROFILE_SITES + 1] = { 0 };
+	uint32_t total_count = 0;
+	ssize_t total_bytes = 0;
+
+	for (size_t i = 0; i < POINTER_TRACK_SHARDS; i++)
+	{
+		t_pointer_shard *shard = &pointer_shards[i];
+
+		MUTEX_LOCK(&shard->mux);
+
+		for (size_t j = 0; j < shard->size; j++)
+		{
+			const t_pointer *entry = &shard->table[j];
+			if (NULL == entry->address || entry->epoch < a->epoch || entry->epoch >= b->epoch)
+			{
+				continue;
+			}
+
+			t_leak *leak = &leaks[HEAP_PROFILE_SITES];
+			size_t pos = pointer_hash((void *)entry->site) & (HEAP_PROFILE_SITES - 1);
+			for (size_t k = 0; 0 != entry->site && k < HEAP_PROFILE_SITES; k++)
+			{
+				if (0 == leaks[pos].site || entry->site == leaks[pos].site)
+				{
+					leak = &leaks[pos];
+					leak->site = entry->site;
+					break;
+				}
+				pos = (pos + 1) & (HEAP_PROFILE_SITES - 1);
+			}
+
+			uint32_t count = (uint32_t)SAMPLE_COUNT(entry->size, POINTER_WEIGHT(*entry));
+			leak->count += count;
+			leak->bytes += (ssize_t)POINTER_WEIGHT(*entry);
+			total_count += count;
+			total_bytes += (ssize_t)POINTER_WEIGHT(*entry);
+		}
+
+		MUTEX_UNLOCK(&shard->mux);
+	}
+
+	PROFILE_PRINT(file, "snapshot %u..%u: allocated=%zd (%+zd) high-water=%zd live=%u bytes=%zd\n",
+		a->epoch, b->epoch, b->allocated, b->allocated - a->allocated, b->high_water, total_count, total_bytes);
+
+	// by bytes descending, sites are few enough to sort by repeated selection
+	for (;;)
+	{
+		t_leak *largest = NULL;
+		for (size_t i = 0; i <= HEAP_PROFILE_SITES; i++)
+		{
+			if (0 != leaks[i].count && (NULL == largest || leaks[i].bytes > largest->bytes))
+			{
+				largest = &leaks[i];
+			}
+		}
+		if (NULL == largest)
+		{
+			break;
+		}
+
+		if (0 == largest->site)
+		{
+			PROFILE_PRINT(file, "site=other live=%u bytes=%zd\n", largest->count, largest->bytes);
+		}
+		else
+		{
+			PROFILE_PRINT(file, "site=%p(+0x%tx) live=%u bytes=%zd\n", (void *)largest->site,
+				(const char *)largest->site - __executable_start, largest->count, largest->bytes);
+		}
+		largest->count = 0;
+	}
+}
+
+#endif // ENABLE_SITE_PROFILING
+
+#if ENABLE_POINTER_TRACKING
+size_t heap_track_overhead(void)
+{
+	size_t bytes = sizeof(pointer_shards);
+
+	for (size_t i = 0; i < POINTER_TRACK_SHARDS; i++)
+	{
+		MUTEX_LOCK(&pointer_shards[i].mux);
+		bytes += pointer_shards[i].size * sizeof(t_pointer);
+		MUTEX_UNLOCK(&pointer_shards[i].mux);
+	}
+
+#if ENABLE_SITE_PROFILING
+	bytes += sizeof(profile_sites) + sizeof(profile_other_sites) + sizeof(profile_size_classes);
+#endif // ENABLE_SITE_PROFILING
+
+	return bytes;
+}
+#endif // ENABLE_POINTER_TRACKING
@@ -4,15 +4,31 @@
 */
 #pragma once
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 //////////////////////////////////////////////////////////////////////////////////
 // GLOBAL VARIABLES & DEFINES
 //////////////////////////////////////////////////////////////////////////////////
+// The options within #ifndef can also be set on the compiler command line (i.e. by the benchmark in Benchmark/).
 #define ENABLE_DEBUG_VERBOSE_LOGS				1	// Enables(1)/Disables(0) verbose logging.
+#ifndef ENABLE_THREAD_SAFETY
 #define ENABLE_THREAD_SAFETY					1	// Enables(1)/Disables(0) thread safety.
+#endif
+#ifndef ENABLE_POINTER_TRACKING
 #define ENABLE_POINTER_TRACKING                 1	// Enables(1)/Disables(0) pointer tracking.
-#define POINTER_TRACK_INC						50	// Defines the growth size (in # of elements) for the internal pointer tracking array, 
-													// once the number of allocated pointers overflows the current array size.
+#endif
+#define POINTER_TRACK_INITIAL_SIZE			64	// Defines the initial size (in # of elements, a power of 2) of the internal pointer tracking hash table,
+													// which is doubled whenever it gets more than half full.
+#define POINTER_TRACK_SHARDS					8	// Defines the number of pointer tracking hash tables, each with its own lock, pointers are spread over them by address.
+#ifndef HEAP_SAMPLE_INTERVAL
+#define HEAP_SAMPLE_INTERVAL					0	// Defines the average number of bytes allocated between two tracked allocations (requires ENABLE_POINTER_TRACKING),
+													// 0 tracks every allocation, otherwise 'heap_allocated' and the profiles are estimates.
+#endif
+#ifndef ENABLE_SITE_PROFILING
+#define ENABLE_SITE_PROFILING					1	// Enables(1)/Disables(0) per allocation site statistics (requires ENABLE_POINTER_TRACKING).
+#endif
+#define HEAP_PROFILE_SITES						64	// Defines the number of allocation sites profiled individually (a power of 2), the others are aggregated together.
 extern const size_t		heap_threshold;				// Sets a reference allocation threshold (in bytes) after which the library will log warnings.
 extern volatile ssize_t	heap_allocated;				// Currently allocated heap (in bytes).
 
@@ -27,6 +43,52 @@ extern volatile ssize_t	heap_allocated;				// Currently allocated heap (in bytes
 /// <param name="">none</param>
 void heap_track_init(void);
 
+#if ENABLE_POINTER_TRACKING
+/// <summary>
+///		Returns the number of pointers currently tracked, summed over all the tracking tables.
+/// </summary>
+size_t heap_tracked_pointers(void);
+
+/// <summary>
+///		Returns the memory (in bytes) used by HeapTracker itself, for the tracking tables and the profiles.
+/// </summary>
+size_t heap_track_overhead(void);
+#endif // ENABLE_POINTER_TRACKING
+
+#if ENABLE_SITE_PROFILING
+/// <summary>
+///		Writes a report of the heap usage per allocation site (the code calling malloc(), calloc(),
+///		aligned_alloc() or realloc()), sorted by peak usage, followed by a power of 2 histogram of
+///		the allocation sizes. Each site is reported with its offset in the App image, for addr2line.
+/// </summary>
+/// <param name="file">The file the report is written to, or NULL to write it to Log_Debug().</param>
+void heap_profile_dump(FILE *file);
+
+typedef struct
+{
+	uint32_t epoch;					// Allocations made after the snapshot belong to this epoch, or a later one.
+	ssize_t allocated;				// 'heap_allocated' when the snapshot was taken.
+	ssize_t high_water;				// Highest 'heap_allocated' since the previous snapshot.
+} heap_snapshot;
+
+/// <summary>
+///		Takes a snapshot of the heap, to compare a later one against with heap_snapshot_diff().
+///		The high-water mark starts over from the current 'heap_allocated' with each snapshot.
+/// </summary>
+/// <param name="snapshot">The snapshot to fill in.</param>
+void heap_snapshot_take(heap_snapshot *snapshot);
+
+/// <summary>
+///		Writes a report of the allocations made between snapshots <paramref name="a"/> and <paramref name="b"/>
+///		which are still live, grouped by allocation site and sorted by bytes. Called right after taking
+///		<paramref name="b"/>, these are the allocations that grew the heap in the meantime and may be leaks.
+/// </summary>
+/// <param name="a">The earlier snapshot.</param>
+/// <param name="b">The later snapshot.</param>
+/// <param name="file">The file the report is written to, or NULL to write it to Log_Debug().</param>
+void heap_snapshot_diff(const heap_snapshot *a, const heap_snapshot *b, FILE *file);
+#endif // ENABLE_SITE_PROFILING
+
 #if !ENABLE_POINTER_TRACKING
 ////////////////////////////////////////////////////////////////////////////////////
 // Heap-tracking free and realloc functions (when pointer tracking is disabled)
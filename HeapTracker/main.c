@@ -102,6 +102,13 @@ int main(void)
     const struct timespec sleepTime = {.tv_sec = 5, .tv_nsec = 0};
 
     heap_track_init();
+
+#if ENABLE_SITE_PROFILING
+    // each pass is compared with the previous one, anything it left allocated shows as growth
+    heap_snapshot previous, current;
+    heap_snapshot_take(&previous);
+#endif // ENABLE_SITE_PROFILING
+
     while (true) {
 
 #if (0)
@@ -109,6 +116,14 @@ int main(void)
 #else
         consumeHeap_realloc();
 #endif
+
+#if ENABLE_SITE_PROFILING
+        heap_profile_dump(NULL);
+
+        heap_snapshot_take(&current);
+        heap_snapshot_diff(&previous, &current, NULL);
+        previous = current;
+#endif // ENABLE_SITE_PROFILING
         nanosleep(&sleepTime, NULL);
     }
 
@@ -0,0 +1,257 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host benchmark of modbus point decoding, compare the switch on data type
+// per point, as decode_point() used to, against the decode program compiled
+// with the read plan. Points of the schema are laid out in blocks of
+// MODBUS_MAX_WORD_PER_READ registers as the read plan would request them.
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "modbus_decode.h"
+
+#define NUM_POINT 2000
+#define MODBUS_MAX_WORD_PER_READ 0x7D
+#define ROUNDS 2000
+
+// modbus_point_t without the SDK headers device_hal.h pulls in
+typedef struct {
+    int32_t value_offset;
+    float scale;
+    uint16_t addr;
+    uint8_t reg_type;
+    uint8_t data_type;
+    uint8_t bit_offset;
+} bench_point_t;
+
+typedef struct {
+    uint16_t addr;
+    int32_t first;
+    int32_t count;
+} bench_block_t;
+
+static bench_point_t s_points[NUM_POINT];
+static uint16_t s_regs[NUM_POINT * 4];
+static int32_t s_num_block;
+static bench_block_t s_blocks[NUM_POINT];
+static int32_t s_num_run;
+static modbus_decode_run_t s_runs[NUM_POINT];
+static int32_t s_run_block[NUM_POINT];
+static modbus_decode_op_t s_ops[NUM_POINT];
+
+static double elapse_ns(struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+static int num_reg(const bench_point_t *p)
+{
+    switch (p->data_type) {
+    case TYPE_INT32_BE:
+    case TYPE_INT32_LE:
+    case TYPE_UINT32_BE:
+    case TYPE_UINT32_LE:
+    case TYPE_FLOAT_BE:
+    case TYPE_FLOAT_LE:
+        return 2;
+    case TYPE_INT64_BE:
+    case TYPE_INT64_LE:
+        return 4;
+    default:
+        return 1;
+    }
+}
+
+// decode_point() as it was, switch on data type of every point
+static int switch_decode(const bench_point_t *mp, const uint16_t *regs, double *value)
+{
+    switch (mp->data_type) {
+    case TYPE_BIT:
+        *value = (regs[0] & (1 << mp->bit_offset)) ? 1 : 0;
+        *value -= mp->value_offset;
+        break;
+    case TYPE_BYTE: {
+        uint8_t rv = (regs[0] >> mp->bit_offset) & 0xFF;
+        *value = (double)(rv - mp->value_offset);
+        break;
+    }
+    case TYPE_INT16:
+        *value = (double)(int16_t)regs[0] - mp->value_offset;
+        break;
+    case TYPE_UINT16:
+        *value = (double)regs[0] - mp->value_offset;
+        break;
+    case TYPE_UINT32_BE:
+        *value = (double)(((uint32_t)regs[0] << 16) + regs[1]) - mp->value_offset;
+        break;
+    case TYPE_UINT32_LE:
+        *value = (double)(((uint32_t)regs[1] << 16) + regs[0]) - mp->value_offset;
+        break;
+    case TYPE_INT32_BE:
+        *value = (double)(int32_t)(((uint32_t)regs[0] << 16) + regs[1]) - mp->value_offset;
+        break;
+    case TYPE_INT32_LE:
+        *value = (double)(int32_t)(((uint32_t)regs[1] << 16) + regs[0]) - mp->value_offset;
+        break;
+    case TYPE_FLOAT_BE:
+    case TYPE_FLOAT_LE: {
+        uint32_t u32 = mp->data_type == TYPE_FLOAT_BE ? ((uint32_t)regs[0] << 16) + regs[1]
+                                                      : ((uint32_t)regs[1] << 16) + regs[0];
+        float rv;
+        memcpy(&rv, &u32, sizeof(rv));
+        *value = (double)rv - mp->value_offset;
+        break;
+    }
+    case TYPE_INT64_BE: {
+        int64_t rv = regs[0];
+        rv = (rv << 16) + regs[1];
+        rv = (rv << 16) + regs[2];
+        rv = (rv << 16) + regs[3];
+        *value = rv - mp->value_offset;
+        break;
+    }
+    case TYPE_INT64_LE: {
+        int64_t rv = regs[3];
+        rv = (rv << 16) + regs[2];
+        rv = (rv << 16) + regs[1];
+        rv = (rv << 16) + regs[0];
+        *value = rv - mp->value_offset;
+        break;
+    }
+    default:
+        return -1;
+    }
+
+    if (fabs(mp->scale - 1.0) >= DBL_EPSILON) {
+        *value /= mp->scale;
+        if (fabs(*value) < DBL_EPSILON)
+            *value = 0;
+    }
+    return 0;
+}
+
+// schema of register points of every type, laid out back to back
+static void build_schema(void)
+{
+    uint16_t addr = 0;
+    srand(1);
+    for (int i = 0; i < NUM_POINT; i++) {
+        bench_point_t *p = &s_points[i];
+        p->reg_type = HOLDING_REGISTER;
+        p->data_type = TYPE_BIT + rand() % (TYPE_INT64_LE - TYPE_BIT + 1);
+        p->bit_offset = p->data_type == TYPE_BIT ? rand() % 16 : (p->data_type == TYPE_BYTE ? 8 * (rand() % 2) : 0);
+        p->value_offset = rand() % 4 ? 0 : rand() % 100;
+        p->scale = rand() % 2 ? 1 : 10;
+        p->addr = addr;
+        addr += num_reg(p);
+    }
+    for (int i = 0; i < addr; i++) {
+        s_regs[i] = rand();
+    }
+
+    // greedy blocks as the read plan builds them
+    for (int i = 0; i < NUM_POINT; i++) {
+        bench_block_t *b = s_num_block ? &s_blocks[s_num_block - 1] : NULL;
+        if (!b || s_points[i].addr + num_reg(&s_points[i]) - b->addr > MODBUS_MAX_WORD_PER_READ) {
+            b = &s_blocks[s_num_block++];
+            b->addr = s_points[i].addr;
+            b->first = i;
+            b->count = 0;
+        }
+        b->count++;
+    }
+}
+
+// compile program, in each block group points by kernel, keep address order
+static void compile_program(void)
+{
+    int32_t j = 0;
+    for (int b = 0; b < s_num_block; b++) {
+        bench_block_t *block = &s_blocks[b];
+        for (int8_t kernel = 0; kernel < KERNEL_COUNT; kernel++) {
+            modbus_decode_run_t *run = NULL;
+            for (int i = block->first; i < block->first + block->count; i++) {
+                bench_point_t *p = &s_points[i];
+                if (modbus_decode_kernel(p->reg_type, p->data_type) != kernel) {
+                    continue;
+                }
+                if (!run || run->count == MODBUS_DECODE_MAX_RUN) {
+                    s_run_block[s_num_run] = b;
+                    run = &s_runs[s_num_run++];
+                    run->kernel = kernel;
+                    run->first = j;
+                    run->count = 0;
+                }
+                modbus_decode_op_init(&s_ops[j++], p->addr - block->addr, p->bit_offset, i, p->value_offset,
+                                      p->scale);
+                run->count++;
+            }
+        }
+    }
+}
+
+static double decode_by_switch(double *out)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int b = 0; b < s_num_block; b++) {
+            const bench_block_t *block = &s_blocks[b];
+            const uint16_t *regs = &s_regs[block->addr];
+            for (int i = block->first; i < block->first + block->count; i++) {
+                switch_decode(&s_points[i], &regs[s_points[i].addr - block->addr], &out[i]);
+            }
+        }
+    }
+    return elapse_ns(&start) / ROUNDS / NUM_POINT;
+}
+
+static double decode_by_program(double *out)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int n = 0; n < s_num_run; n++) {
+            const modbus_decode_run_t *run = &s_runs[n];
+            const modbus_decode_op_t *ops = &s_ops[run->first];
+            double values[MODBUS_DECODE_MAX_RUN];
+
+            modbus_decode_run(run->kernel, ops, run->count, &s_regs[s_blocks[s_run_block[n]].addr], values);
+            for (int k = 0; k < run->count; k++) {
+                out[ops[k].index] = values[k];
+            }
+        }
+    }
+    return elapse_ns(&start) / ROUNDS / NUM_POINT;
+}
+
+int main(void)
+{
+    static double by_switch[NUM_POINT], by_program[NUM_POINT];
+
+    build_schema();
+    compile_program();
+
+    double switch_ns = decode_by_switch(by_switch);
+    double program_ns = decode_by_program(by_program);
+
+    for (int i = 0; i < NUM_POINT; i++) {
+        if (memcmp(&by_switch[i], &by_program[i], sizeof(double)) != 0) {
+            printf("mismatch at point %d type %d: %g vs %g\n", i, s_points[i].data_type, by_switch[i],
+                   by_program[i]);
+            return 1;
+        }
+    }
+
+    printf("%d points in %d blocks, %d decode runs\n", NUM_POINT, s_num_block, s_num_run);
+    printf("switch %6.2f ns/point, program %6.2f ns/point, %4.1fx\n", switch_ns, program_ns,
+           switch_ns / program_ns);
+    return 0;
+}
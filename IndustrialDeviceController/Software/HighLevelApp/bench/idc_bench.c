@@ -0,0 +1,791 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host benchmark of the app built from its own sources, with applibs, IoT hub
+// and modbus transport replaced by the shims in bench/shim. Each result is
+// printed as "name value unit" on its own line, so runs of two commits can be
+// compared with diff or joined by name. Optional arguments select sections:
+//   idc_bench [provision] [restore] [decode] [expr] [crc] [escape] [timer] [serialize] [scheduler] [sim]
+// IDC_BENCH_SECONDS sets how long each adapter run lasts, 3 by default.
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/eventloop.h>
+#include <applibs/storage.h>
+#include <frozen/frozen.h>
+#include <init/adapter.h>
+#include <init/device_hal.h>
+#include <init/globals.h>
+#include <utils/event_loop_timer.h>
+#include <utils/expr.h>
+#include <utils/memory.h>
+#include <utils/utils.h>
+
+#include <crc16.h>
+#include <modbus_decode.h>
+
+#include "shim/idc_shim.h"
+
+#define CRC_BUF_SIZE (64 * 1024)
+#define CRC_ROUNDS 2000
+
+#define DECODE_POINTS 2000
+#define DECODE_ROUNDS 200
+
+#define EXPR_INPUTS 64
+#define EXPR_ROUNDS 100000
+
+#define ESCAPE_STRINGS 1000
+#define ESCAPE_ROUNDS 200
+
+#define TIMER_ROUNDS 500
+
+#define PROVISION_DEVICES 200
+#define PROVISION_POINTS 200
+#define PROVISION_ROUNDS 20
+#define RESTORE_ROUNDS 10
+
+// devices behind one gateway, as units of a modbus tcp connection
+#define DEVICES_PER_GATEWAY 10
+
+typedef struct provision_spec_t provision_spec_t;
+struct provision_spec_t {
+    int64_t epoch;
+    int32_t num_device;
+    int32_t num_point;
+    int32_t interval;
+    // ms, 1000 if 0
+    int32_t timeout;
+    const char *encoding;
+    const char *flags;
+    // options of simulated slaves, a simulated bus per gateway, NULL for
+    // loopback gateways
+    const char *sim_options;
+    // last gateways whose simulated slaves never answer
+    int32_t sim_dead_gateways;
+};
+
+static EventLoop *s_eloop;
+static int32_t s_seconds = 3;
+static int64_t s_epoch;
+
+
+static double monotonic_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// user + system time of all threads, adapter work is done by its workers
+static double cpu_s(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec +
+           usage.ru_stime.tv_usec / 1e6;
+}
+
+
+static void report(const char *name, double value, const char *unit)
+{
+    printf("%-40s %14.3f %s\n", name, value, unit);
+    fflush(stdout);
+}
+
+
+static char *append(char *p, const char *end, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(p, end - p, fmt, ap);
+    va_end(ap);
+    return (n > 0 && p + n < end) ? p + n : p;
+}
+
+
+// points definition of modbus schema: consecutive holding registers, every
+// fourth a float spanning two registers
+static char *append_points(char *p, const char *end, int32_t num_point)
+{
+    uint32_t addr = 1;
+    for (int32_t i = 0; i < num_point; i++) {
+        bool is_float = (i % 4) == 3;
+        p = append(p, end, "%sp%d:%u:%d", i ? "," : "", i, 400000 + addr,
+                   is_float ? TYPE_FLOAT_BE : TYPE_UINT16);
+        addr += is_float ? 2 : 1;
+    }
+    return p;
+}
+
+
+// provision as the cloud pushes it, devices of one schema spread over
+// gateways, schema and device names carry the epoch so nothing of previous
+// provision is taken over
+static char *build_provision(const provision_spec_t *spec, size_t *len)
+{
+    size_t size = 1024 + spec->num_point * 24 + spec->num_device * 192;
+    char *buf = (char *)malloc(size);
+    char *p = buf, *end = buf + size;
+
+    p = append(p, end,
+               "{\"epoch\":%lld,\"data\":{\"name\":\"bench\",\"location\":\"lab\",\"sourceId\":\"bench\","
+               "\"encoding\":\"%s\",\"schemas\":[{\"name\":\"s%lld\",\"protocol\":\"MODBUS_TCP\","
+               "\"interval\":%d,\"timeout\":%d,\"flags\":[%s],\"points\":\"",
+               spec->epoch, spec->encoding, spec->epoch, spec->interval, spec->timeout ? spec->timeout : 1000,
+               spec->flags);
+    p = append_points(p, end, spec->num_point);
+    p = append(p, end, "\"}],\"devices\":[");
+
+    for (int32_t d = 0; d < spec->num_device; d++) {
+        int32_t gateway = d / DEVICES_PER_GATEWAY;
+        p = append(p, end, "%s{\"name\":\"d%lld_%d\",\"schema\":\"s%lld\",\"id\":\"%d\",", d ? "," : "",
+                   spec->epoch, d, spec->epoch, d % DEVICES_PER_GATEWAY + 1);
+        if (spec->sim_options) {
+            bool dead = gateway >= (spec->num_device - 1) / DEVICES_PER_GATEWAY + 1 - spec->sim_dead_gateways;
+            p = append(p, end, "\"connection\":\"sim:%d:%s%s\"}", gateway, spec->sim_options,
+                       dead ? ",first=100" : "");
+        } else {
+            p = append(p, end, "\"connection\":\"10.%d.%d.1:502\",\"pipeline\":4}", gateway / 256, gateway % 256);
+        }
+    }
+    p = append(p, end, "]}}");
+
+    *len = p - buf;
+    return buf;
+}
+
+
+static bool provision(const provision_spec_t *spec)
+{
+    size_t len;
+    char *payload = build_provision(spec, &len);
+    adapter_provision(payload, len, false);
+    free(payload);
+
+    int32_t num_device = 0;
+    for (ce_device_t *device = adapter_get_devices(); device; device = device->next) {
+        num_device++;
+    }
+    return num_device == spec->num_device;
+}
+
+// ------------------------------- provision ----------------------------------
+
+static void bench_provision(void)
+{
+    provision_spec_t spec = {
+        .num_device = PROVISION_DEVICES,
+        .num_point = PROVISION_POINTS,
+        .interval = 3600000,
+        .encoding = "json",
+        .flags = "",
+    };
+
+    double total = 0;
+    for (int32_t i = 0; i < PROVISION_ROUNDS; i++) {
+        spec.epoch = ++s_epoch;
+        size_t len;
+        char *payload = build_provision(&spec, &len);
+
+        double start = monotonic_s();
+        adapter_provision(payload, len, false);
+        total += monotonic_s() - start;
+        free(payload);
+
+        if (!adapter_get_devices()) {
+            fprintf(stderr, "provision failed\n");
+            return;
+        }
+    }
+
+    // depth of gateways comes from "pipeline" field of their devices
+    if (idc_loopback_last_depth() != 4) {
+        fprintf(stderr, "pipeline depth %d, expected 4\n", idc_loopback_last_depth());
+    }
+
+    report("provision_ms", total * 1e3 / PROVISION_ROUNDS, "ms");
+    report("provision_us_per_device", total * 1e6 / PROVISION_ROUNDS / PROVISION_DEVICES, "us");
+}
+
+// ------------------------------- restore ------------------------------------
+
+// write provision to local storage as it was saved before images, JSON as is
+static void save_provision_v01(const char *payload, size_t len)
+{
+    struct {
+        char magic[8];
+        uint32_t hashcode;
+        int32_t size;
+    } hdr = {{'P', 'R', 'O', 'V', ' ', 'V', '0', '1'}, hash((const unsigned char *)payload, len), len};
+
+    int fd = Storage_OpenMutableFile();
+    lseek(fd, PROVISION_FILE_OFFSET, SEEK_SET);
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || write(fd, payload, len) != (ssize_t)len) {
+        fprintf(stderr, "failed to write provision\n");
+    }
+    close(fd);
+}
+
+static double restart_adapter(void)
+{
+    adapter_deinit();
+    double start = monotonic_s();
+    adapter_init(s_eloop);
+    return monotonic_s() - start;
+}
+
+// startup with provision in local storage: from JSON of a V01 file, which is
+// saved again with its image, then from that image
+static void bench_restore(void)
+{
+    provision_spec_t spec = {
+        .num_device = PROVISION_DEVICES,
+        .num_point = PROVISION_POINTS,
+        .interval = 3600000,
+        .encoding = "json",
+        .flags = "",
+    };
+    spec.epoch = ++s_epoch;
+    size_t len;
+    char *payload = build_provision(&spec, &len);
+
+    double json_total = 0;
+    double image_total = 0;
+    for (int32_t i = 0; i < RESTORE_ROUNDS; i++) {
+        save_provision_v01(payload, len);
+        json_total += restart_adapter();
+        if (!adapter_get_devices()) {
+            fprintf(stderr, "restore from json failed\n");
+            break;
+        }
+
+        image_total += restart_adapter();
+        if (!adapter_get_devices()) {
+            fprintf(stderr, "restore from image failed\n");
+            break;
+        }
+    }
+    free(payload);
+
+    report("restore_json_ms", json_total * 1e3 / RESTORE_ROUNDS, "ms");
+    report("restore_image_ms", image_total * 1e3 / RESTORE_ROUNDS, "ms");
+}
+
+// -------------------------------- decode ------------------------------------
+
+// a full poll of one device through the modbus driver over loopback: building
+// requests, pipelining them and decoding the registers of every point
+static void bench_decode(void)
+{
+    char *points_def = (char *)malloc(DECODE_POINTS * 24);
+    int len = append_points(points_def, points_def + DECODE_POINTS * 24, DECODE_POINTS) - points_def;
+    struct json_token t_points = {.ptr = points_def, .len = len, .type = JSON_TYPE_STRING};
+
+    data_schema_t schema;
+    memset(&schema, 0, sizeof(schema));
+    schema.name = "decode";
+    schema.protocol = DEVICE_PROTOCOL_MODBUS_TCP;
+    schema.interval = 1000;
+    schema.timeout = 1000;
+    schema.max_gap = -1;
+
+    if (create_point_table(schema.protocol, &t_points, &schema.num_point, &schema.points) != DEVICE_OK) {
+        fprintf(stderr, "failed to create point table\n");
+        free(points_def);
+        return;
+    }
+    // no computed points, every point is read from the device
+    schema.num_read_point = schema.num_point;
+
+    create_point_index(&schema);
+    if (create_read_plan(schema.protocol, &schema) != DEVICE_OK) {
+        fprintf(stderr, "failed to create read plan\n");
+        destroy_point_index(&schema);
+        destroy_point_table(schema.protocol, schema.points, schema.num_point);
+        free(points_def);
+        return;
+    }
+
+    telemetry_t telemetry;
+    memset(&telemetry, 0, sizeof(telemetry));
+    telemetry.num_values = schema.num_point;
+    telemetry.cov_mask = CALLOC(1, (schema.num_point + 7) / 8);
+    telemetry.str_mask = CALLOC(1, (schema.num_point + 7) / 8);
+    telemetry.nums = MALLOC(schema.num_point * sizeof(double));
+
+    device_driver_t *driver = create_driver(schema.protocol, "127.0.0.1:502:4");
+    driver->driver_open(driver, 1, schema.timeout);
+
+    double checksum = 0;
+    double start = monotonic_s();
+    for (int32_t i = 0; i < DECODE_ROUNDS; i++) {
+        idc_loopback_set_tick(i);
+        if (driver->get_point_list(driver, 1, &schema, &telemetry, schema.timeout) != DEVICE_OK) {
+            fprintf(stderr, "failed to read points\n");
+            break;
+        }
+        checksum += telemetry.nums[i % schema.num_point];
+    }
+    double elapsed = monotonic_s() - start;
+
+    report("decode_ns_per_point", elapsed * 1e9 / DECODE_ROUNDS / schema.num_point, "ns");
+    if (isnan(checksum)) {
+        fprintf(stderr, "unexpected value\n");
+    }
+
+    driver->driver_close(driver);
+    destroy_driver(driver);
+    destroy_telemetry_strings(&telemetry);
+    FREE(telemetry.cov_mask);
+    FREE(telemetry.str_mask);
+    FREE(telemetry.nums);
+    destroy_schema_plans(&schema);
+    destroy_point_index(&schema);
+    destroy_point_table(schema.protocol, schema.points, schema.num_point);
+    free(points_def);
+}
+
+// --------------------------------- expr -------------------------------------
+
+static int32_t resolve_expr_input(const char *name, size_t len, void *context)
+{
+    char *end = NULL;
+    long index = (len > 1 && name[0] == 'p') ? strtol(name + 1, &end, 10) : -1;
+    return (end == name + len && index < EXPR_INPUTS) ? index : -1;
+}
+
+// computed points as a meter schema defines them, evaluated after every poll
+static void bench_expr(void)
+{
+    static const char *exprs[] = {
+        "p0 * p1 * p3 / 1000",
+        "sqrt(p4 * p4 + p5 * p5)",
+        "p6 - p7",
+        "bits(p8, 4, 3)",
+        "(p9 >> 8 & 0xff) * 0.1 - 40",
+        "if(p10 > p11 && p12 != 0, p13, -1)",
+        "max(p14, min(p15, 100)) + abs(p16 - p17)",
+        "round((p18 + p19 + p20 + p21) / 4 * 10) / 10",
+    };
+    const int32_t num_expr = sizeof(exprs) / sizeof(exprs[0]);
+
+    expr_program_t *program = expr_program_create();
+    for (int32_t i = 0; i < num_expr; i++) {
+        if (expr_compile(program, exprs[i], strlen(exprs[i]), resolve_expr_input, NULL) != i) {
+            fprintf(stderr, "failed to compile %s\n", exprs[i]);
+            expr_program_destroy(program);
+            return;
+        }
+    }
+
+    double values[EXPR_INPUTS];
+    for (int32_t i = 0; i < EXPR_INPUTS; i++) {
+        values[i] = 100 + i * 7;
+    }
+
+    double checksum = 0;
+    double start = monotonic_s();
+    for (int32_t i = 0; i < EXPR_ROUNDS; i++) {
+        values[i % EXPR_INPUTS] += 1;
+        for (int32_t j = 0; j < num_expr; j++) {
+            checksum += expr_eval(program, j, values);
+        }
+    }
+    double elapsed = monotonic_s() - start;
+
+    report("expr_ns_per_eval", elapsed * 1e9 / EXPR_ROUNDS / num_expr, "ns");
+    report("expr_program_bytes", expr_program_size(program), "B");
+    if (isnan(checksum)) {
+        fprintf(stderr, "unexpected value\n");
+    }
+    expr_program_destroy(program);
+}
+
+// --------------------------------- crc --------------------------------------
+
+static void bench_crc_variant(const char *name, uint16_t (*update)(uint16_t, const uint8_t *, size_t),
+                              const uint8_t *buf)
+{
+    volatile uint16_t crc = 0;
+    double start = monotonic_s();
+    for (int32_t i = 0; i < CRC_ROUNDS; i++) {
+        crc ^= update(crc16_init(), buf, CRC_BUF_SIZE);
+    }
+    double elapsed = monotonic_s() - start;
+    report(name, (double)CRC_BUF_SIZE * CRC_ROUNDS / elapsed / 1e6, "MB/s");
+}
+
+
+static void bench_crc(void)
+{
+    uint8_t *buf = (uint8_t *)malloc(CRC_BUF_SIZE);
+    for (int32_t i = 0; i < CRC_BUF_SIZE; i++) {
+        buf[i] = (uint8_t)(i * 131 + 7);
+    }
+
+    bench_crc_variant("crc16_table_mb_s", crc16_update_table, buf);
+    bench_crc_variant("crc16_slice4_mb_s", crc16_update_slice4, buf);
+    bench_crc_variant("crc16_mb_s", crc16_update, buf);
+    free(buf);
+}
+
+// -------------------------------- escape ------------------------------------
+
+// %Q of point keys and string values as in a telemetry message, each string
+// is one of ESCAPE_STRINGS of 8 to 40 chars, one in every_escape chars
+// needs escaping, 0 for none
+static void bench_escape_variant(const char *name, int32_t every_escape)
+{
+    char *strs[ESCAPE_STRINGS];
+    size_t total = 0;
+    for (int32_t i = 0; i < ESCAPE_STRINGS; i++) {
+        int32_t len = 8 + (i * 7) % 33;
+        strs[i] = (char *)malloc(len + 1);
+        for (int32_t j = 0; j < len; j++) {
+            int32_t k = i * 41 + j;
+            strs[i][j] = (every_escape > 0 && k % every_escape == 0) ? "\"\\\n"[k % 3] : 'A' + k % 26;
+        }
+        strs[i][len] = '\0';
+        total += len;
+    }
+
+    size_t size = total * 2 + ESCAPE_STRINGS * 4;
+    char *buf = (char *)malloc(size);
+    volatile int checksum = 0;
+    double start = monotonic_s();
+    for (int32_t r = 0; r < ESCAPE_ROUNDS; r++) {
+        struct json_out out = JSON_OUT_BUF(buf, size);
+        for (int32_t i = 0; i < ESCAPE_STRINGS; i++) {
+            checksum += json_printf(&out, "%Q,", strs[i]);
+        }
+    }
+    double elapsed = monotonic_s() - start;
+    report(name, (double)total * ESCAPE_ROUNDS / elapsed / 1e6, "MB/s");
+
+    free(buf);
+    for (int32_t i = 0; i < ESCAPE_STRINGS; i++) {
+        free(strs[i]);
+    }
+}
+
+
+static void bench_escape(void)
+{
+    bench_escape_variant("escape_plain_mb_s", 0);
+    bench_escape_variant("escape_mixed_mb_s", 16);
+}
+
+// ------------------------------- adapter ------------------------------------
+
+typedef struct run_result_t run_result_t;
+struct run_result_t {
+    double seconds;
+    double cpu_seconds;
+    int64_t polls;
+    int64_t messages;
+    int64_t bytes;
+    uint32_t poll_p99_ms;
+};
+
+// run event loop as main() does, confirming sent messages every pass as the
+// SDK would, registers change every 100ms so values keep changing
+static void run_adapter(double seconds, run_result_t *result)
+{
+    histogram_t *poll_hist = idc_shim_histogram("poll_ms");
+    histogram_t polls;
+    idc_shim_stats_t stats_start, stats_end;
+
+    histogram_reset(&polls);
+    histogram_take(poll_hist, &polls);
+    histogram_reset(&polls);
+    idc_shim_get_stats(&stats_start);
+
+    double start = monotonic_s();
+    double cpu_start = cpu_s();
+    double elapsed = 0;
+    while (elapsed < seconds) {
+        EventLoop_Run(s_eloop, 10, false);
+        idc_shim_deliver();
+        idc_loopback_set_tick((uint32_t)(elapsed * 10));
+        elapsed = monotonic_s() - start;
+    }
+
+    result->seconds = elapsed;
+    result->cpu_seconds = cpu_s() - cpu_start;
+    histogram_take(poll_hist, &polls);
+    idc_shim_get_stats(&stats_end);
+    result->polls = polls.total;
+    result->poll_p99_ms = histogram_percentile(&polls, 99);
+    result->messages = stats_end.messages - stats_start.messages;
+    result->bytes = stats_end.bytes - stats_start.bytes;
+}
+
+
+// many points per device, every value sent each poll: bytes of telemetry
+// the whole pipeline turns out per cpu second, which serialization dominates
+static void bench_serialize(void)
+{
+    static const char *encodings[] = {"json", "cbor"};
+
+    for (size_t i = 0; i < sizeof(encodings) / sizeof(encodings[0]); i++) {
+        provision_spec_t spec = {
+            .epoch = ++s_epoch,
+            .num_device = 10,
+            .num_point = 500,
+            .interval = 100,
+            .encoding = encodings[i],
+            .flags = "\"no_batch\"",
+        };
+
+        if (!provision(&spec)) {
+            fprintf(stderr, "provision failed\n");
+            return;
+        }
+
+        run_result_t warmup, result;
+        run_adapter(0.5, &warmup);
+        run_adapter(s_seconds, &result);
+
+        char name[64];
+        snprintf(name, sizeof(name), "serialize_%s_mb_per_cpu_s", encodings[i]);
+        report(name, result.bytes / result.cpu_seconds / 1e6, "MB/s");
+        snprintf(name, sizeof(name), "serialize_%s_bytes_per_point", encodings[i]);
+        report(name, result.polls ? (double)result.bytes / result.polls / spec.num_point : 0, "B");
+    }
+}
+
+
+// devices of 20 points polled every second, what the adapter costs around
+// each poll and whether it keeps up
+static void bench_scheduler(void)
+{
+    static const int32_t num_devices[] = {10, 100, 1000};
+
+    for (size_t i = 0; i < sizeof(num_devices) / sizeof(num_devices[0]); i++) {
+        provision_spec_t spec = {
+            .epoch = ++s_epoch,
+            .num_device = num_devices[i],
+            .num_point = 20,
+            .interval = 1000,
+            .encoding = "json",
+            .flags = "",
+        };
+
+        if (!provision(&spec)) {
+            fprintf(stderr, "provision failed\n");
+            return;
+        }
+
+        // first polls are spread over an interval
+        run_result_t warmup, result;
+        run_adapter(spec.interval / 1000.0, &warmup);
+        run_adapter(s_seconds, &result);
+
+        double expected = spec.num_device * result.seconds * 1000 / spec.interval;
+        char name[64];
+        snprintf(name, sizeof(name), "scheduler_%d_polls_per_s", spec.num_device);
+        report(name, result.polls / result.seconds, "1/s");
+        snprintf(name, sizeof(name), "scheduler_%d_polls_pct_of_due", spec.num_device);
+        report(name, result.polls * 100.0 / expected, "%");
+        snprintf(name, sizeof(name), "scheduler_%d_cpu_us_per_poll", spec.num_device);
+        report(name, result.polls ? result.cpu_seconds * 1e6 / result.polls : 0, "us");
+        snprintf(name, sizeof(name), "scheduler_%d_poll_p99_ms", spec.num_device);
+        report(name, result.poll_p99_ms, "ms");
+        snprintf(name, sizeof(name), "scheduler_%d_cpu_load", spec.num_device);
+        report(name, result.cpu_seconds * 100 / result.seconds, "%");
+    }
+}
+
+
+// devices on simulated slaves with response time, slow responses, exceptions
+// and lost requests, plus one bus whose slaves never answer: whether polls of
+// healthy buses keep up while failures are retried and breakers open
+static void bench_sim(void)
+{
+    provision_spec_t spec = {
+        .epoch = ++s_epoch,
+        .num_device = 500,
+        .num_point = 20,
+        .interval = 1000,
+        .timeout = 100,
+        .encoding = "json",
+        .flags = "",
+        .sim_options = "latency=1-3,slow=1:50,exception=1,timeout=0.2,change=100:10",
+        .sim_dead_gateways = 1,
+    };
+
+    if (!provision(&spec)) {
+        fprintf(stderr, "provision failed\n");
+        return;
+    }
+
+    run_result_t warmup, result;
+    run_adapter(spec.interval / 1000.0, &warmup);
+    run_adapter(s_seconds, &result);
+
+    int32_t num_open = 0;
+    for (ce_device_t *device = adapter_get_devices(); device; device = device->next) {
+        num_open += device->breaker != BREAKER_CLOSED;
+    }
+
+    double expected = spec.num_device * result.seconds * 1000 / spec.interval;
+    report("sim_500_polls_per_s", result.polls / result.seconds, "1/s");
+    report("sim_500_polls_pct_of_due", result.polls * 100.0 / expected, "%");
+    report("sim_500_poll_p99_ms", result.poll_p99_ms, "ms");
+    report("sim_500_breakers_open", num_open, "");
+}
+
+
+typedef struct timer_probe_t timer_probe_t;
+struct timer_probe_t {
+    double due;
+    double fired;
+};
+
+static void timer_probe_callback(void *context)
+{
+    timer_probe_t *probe = (timer_probe_t *)context;
+    probe->fired = monotonic_s();
+}
+
+// one shot timers of fractional ms delays, set at every sub ms phase of the
+// clock: a timer must never fire before its delay has elapsed
+static void bench_timer(void)
+{
+    EventLoop *eloop = EventLoop_Create();
+    timer_probe_t probe = {0, 0};
+    struct timespec init = {0, 0};
+    event_loop_timer_t *timer = event_loop_register_timer(eloop, NULL, NULL, NULL, timer_probe_callback, &probe);
+    if (!timer) {
+        fprintf(stderr, "timer register failed\n");
+        EventLoop_Close(eloop);
+        return;
+    }
+
+    int32_t num_early = 0;
+    double max_early = 0;
+    double total_late = 0;
+    srand(1);
+    for (int32_t i = 0; i < TIMER_ROUNDS; i++) {
+        usleep(rand() % 1000);
+        init.tv_nsec = (i % 50) * 100000 + 50000;
+        probe.fired = 0;
+        probe.due = monotonic_s() + init.tv_nsec / 1e9;
+        event_loop_set_timer(timer, &init, NULL);
+        while (probe.fired == 0) {
+            EventLoop_Run(eloop, 10, true);
+        }
+
+        double late = probe.fired - probe.due;
+        if (late < 0) {
+            num_early++;
+            max_early = fmax(max_early, -late);
+        } else {
+            total_late += late;
+        }
+    }
+
+    event_loop_unregister_timer(eloop, timer);
+    EventLoop_Close(eloop);
+
+    report("timer_early_fires", num_early, "");
+    report("timer_max_early_ms", max_early * 1e3, "ms");
+    report("timer_mean_late_ms", TIMER_ROUNDS > num_early ? total_late * 1e3 / (TIMER_ROUNDS - num_early) : 0, "ms");
+}
+
+// --------------------------------- main -------------------------------------
+
+static bool is_selected(int argc, char *argv[], const char *section)
+{
+    if (argc < 2) {
+        return true;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], section) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *seconds = getenv("IDC_BENCH_SECONDS");
+    if (seconds && atoi(seconds) > 0) {
+        s_seconds = atoi(seconds);
+    }
+
+    if (is_selected(argc, argv, "crc")) {
+        bench_crc();
+    }
+
+    if (is_selected(argc, argv, "decode")) {
+        bench_decode();
+    }
+
+    if (is_selected(argc, argv, "expr")) {
+        bench_expr();
+    }
+
+    if (is_selected(argc, argv, "escape")) {
+        bench_escape();
+    }
+
+    if (is_selected(argc, argv, "timer")) {
+        bench_timer();
+    }
+
+    bool with_provision = is_selected(argc, argv, "provision");
+    bool with_restore = is_selected(argc, argv, "restore");
+    bool with_serialize = is_selected(argc, argv, "serialize");
+    bool with_scheduler = is_selected(argc, argv, "scheduler");
+    bool with_sim = is_selected(argc, argv, "sim");
+    if (!with_provision && !with_restore && !with_serialize && !with_scheduler && !with_sim) {
+        return 0;
+    }
+
+    // no provision left from a previous run
+    Storage_DeleteMutableFile();
+    s_eloop = EventLoop_Create();
+    if (!s_eloop || adapter_init(s_eloop) != 0) {
+        fprintf(stderr, "failed to init adapter\n");
+        return 1;
+    }
+
+    if (with_provision) {
+        bench_provision();
+    }
+
+    if (with_restore) {
+        bench_restore();
+    }
+
+    if (with_serialize) {
+        bench_serialize();
+    }
+
+    if (with_scheduler) {
+        bench_scheduler();
+    }
+
+    if (with_sim) {
+        bench_sim();
+    }
+
+    adapter_deinit();
+    idc_shim_deliver();
+    EventLoop_Close(s_eloop);
+    Storage_DeleteMutableFile();
+    return 0;
+}
@@ -0,0 +1,174 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host benchmark of provision parsing, compare scanning the schemas and
+// devices arrays with a json_scanf_array_elem() loop, as the adapter used to,
+// against the single pass json_array_walk(). Each element is scanned with the
+// same json_scanf() formats as init/adapter.c.
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <frozen/frozen.h>
+#include <utils/json_array.h>
+
+#define NUM_SCHEMA 8
+#define NUM_POINT 2000
+#define NUM_DEVICE 300
+#define ROUNDS 3
+
+#define SCHEMA_FORMAT "{name:%T, protocol:%T, interval:%d, timeout:%d, flags:%T, maxGap:%d, maxAge:%d, points:%T}"
+#define DEVICE_FORMAT "{name:%T, schema:%T, id:%T, connection:%T, location:%T, interval:%d, timeout:%d}"
+
+typedef struct {
+    int count;
+    long checksum;
+} scan_result_t;
+
+static double elapse_ms(struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static char *append(char *p, const char *end, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(p, end - p, fmt, ap);
+    va_end(ap);
+    return (n > 0 && p + n < end) ? p + n : p;
+}
+
+// provision in the shape the cloud pushes, num_device devices spread over
+// NUM_SCHEMA schemas of NUM_POINT points in total
+static char *build_provision(int num_device, int *len)
+{
+    size_t size = 1024 + NUM_POINT * 48 + num_device * 160;
+    char *buf = malloc(size);
+    char *p = buf, *end = buf + size;
+
+    p = append(p, end, "{\"name\":\"bench\",\"location\":\"lab\",\"schemas\":[");
+    for (int s = 0; s < NUM_SCHEMA; s++) {
+        p = append(p, end, "%s{\"name\":\"schema%d\",\"protocol\":\"modbus-tcp\",\"interval\":1000,\"timeout\":500,"
+                   "\"flags\":[\"deadband\"],\"points\":\"", s ? "," : "", s);
+        for (int i = 0; i < NUM_POINT / NUM_SCHEMA; i++) {
+            p = append(p, end, "%sp%d:HOLDING_REGISTER:100:UINT16:1:0", i ? "," : "", i);
+        }
+        p = append(p, end, "\"}");
+    }
+    p = append(p, end, "],\"devices\":[");
+    for (int d = 0; d < num_device; d++) {
+        p = append(p, end, "%s{\"name\":\"device%d\",\"schema\":\"schema%d\",\"id\":\"1\",", d ? "," : "",
+                   d);
+        p = append(p, end, "\"connection\":\"10.0.%d.%d:502\",\"interval\":1000,\"timeout\":500}", d / 256, d % 256);
+    }
+    p = append(p, end, "]}");
+
+    *len = (int)(p - buf);
+    return buf;
+}
+
+static void scan_element(const struct json_token *t, bool schema, scan_result_t *result)
+{
+    struct json_token tok[5];
+    int num[4] = {0};
+
+    memset(tok, 0, sizeof(tok));
+    if (schema) {
+        json_scanf(t->ptr, t->len, SCHEMA_FORMAT, &tok[0], &tok[1], &num[0], &num[1], &tok[2], &num[2], &num[3], &tok[3]);
+    } else {
+        json_scanf(t->ptr, t->len, DEVICE_FORMAT, &tok[0], &tok[1], &tok[2], &tok[3], &tok[4], &num[0], &num[1]);
+    }
+
+    result->count++;
+    for (int i = 0; i < 5; i++) {
+        result->checksum += tok[i].len;
+    }
+    result->checksum += num[0] + num[1];
+}
+
+static bool walk_schema(const struct json_token *elem, int index, void *user_data)
+{
+    scan_element(elem, true, (scan_result_t *)user_data);
+    return true;
+}
+
+static bool walk_device(const struct json_token *elem, int index, void *user_data)
+{
+    scan_element(elem, false, (scan_result_t *)user_data);
+    return true;
+}
+
+static void scan_arrays(const char *str, int len, struct json_token *schemas, struct json_token *devices)
+{
+    json_scanf(str, len, "{schemas:%T,devices:%T}", schemas, devices);
+}
+
+static scan_result_t scan_by_index(const char *str, int len)
+{
+    scan_result_t result = {0, 0};
+    struct json_token schemas, devices, t;
+    scan_arrays(str, len, &schemas, &devices);
+
+    for (int i = 0; json_scanf_array_elem(schemas.ptr, schemas.len, "", i, &t) > 0; i++) {
+        scan_element(&t, true, &result);
+    }
+    for (int i = 0; json_scanf_array_elem(devices.ptr, devices.len, "", i, &t) > 0; i++) {
+        scan_element(&t, false, &result);
+    }
+    return result;
+}
+
+static scan_result_t scan_by_walk(const char *str, int len)
+{
+    scan_result_t result = {0, 0};
+    struct json_token schemas, devices;
+    scan_arrays(str, len, &schemas, &devices);
+
+    json_array_walk(schemas.ptr, schemas.len, walk_schema, &result);
+    json_array_walk(devices.ptr, devices.len, walk_device, &result);
+    return result;
+}
+
+static double bench(scan_result_t (*scan)(const char *, int), const char *str, int len, scan_result_t *result)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < ROUNDS; r++) {
+        *result = scan(str, len);
+    }
+    return elapse_ms(&start) / ROUNDS;
+}
+
+int main(void)
+{
+    const int num_devices[] = {50, 100, NUM_DEVICE, 2 * NUM_DEVICE};
+
+    printf("%d schemas, %d points\n", NUM_SCHEMA, NUM_POINT);
+    for (size_t i = 0; i < sizeof(num_devices) / sizeof(num_devices[0]); i++) {
+        int len;
+        char *provision = build_provision(num_devices[i], &len);
+        scan_result_t by_index, by_walk;
+
+        double index_ms = bench(scan_by_index, provision, len, &by_index);
+        double walk_ms = bench(scan_by_walk, provision, len, &by_walk);
+
+        if (by_index.count != NUM_SCHEMA + num_devices[i] || by_index.count != by_walk.count ||
+            by_index.checksum != by_walk.checksum) {
+            printf("mismatch for %d devices: %d/%ld vs %d/%ld elements/checksum\n", num_devices[i], by_index.count,
+                   by_index.checksum, by_walk.count, by_walk.checksum);
+            return 1;
+        }
+
+        printf("%4d devices, %7d bytes: array_elem %9.2f ms, walk %7.2f ms, %6.1fx\n", num_devices[i], len, index_ms,
+               walk_ms, index_ms / walk_ms);
+        free(provision);
+    }
+    return 0;
+}
@@ -0,0 +1,12 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// host stand-in of the Azure Sphere SDK header, only what the host bench
+// build uses, implemented in applibs_shim.c
+
+#pragma once
+
+#include <stdbool.h>
+
+// there is no real-time core on host, always fails
+int Application_Connect(const char *componentId);
@@ -0,0 +1,9 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// host stand-in of the Azure Sphere SDK header, only what the host bench
+// build uses, implemented in applibs_shim.c
+
+#pragma once
+
+int Log_Debug(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
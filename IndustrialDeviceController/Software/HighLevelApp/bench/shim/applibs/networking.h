@@ -0,0 +1,17 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// host stand-in of the Azure Sphere SDK header, only what the host bench
+// build uses, implemented in applibs_shim.c
+
+#pragma once
+
+#include <stdbool.h>
+
+typedef int Networking_InterfaceConnectionStatus;
+enum {
+    Networking_InterfaceConnectionStatus_InterfaceUp = 1,
+    Networking_InterfaceConnectionStatus_ConnectedToNetwork = 2,
+    Networking_InterfaceConnectionStatus_IpAvailable = 4,
+    Networking_InterfaceConnectionStatus_ConnectedToInternet = 8
+};
@@ -0,0 +1,11 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// host stand-in of the Azure Sphere SDK header, only what the host bench
+// build uses, implemented in applibs_shim.c
+
+#pragma once
+
+// backed by a file named by IDC_BENCH_STORAGE, idc_bench.storage by default
+int Storage_OpenMutableFile(void);
+int Storage_DeleteMutableFile(void);
@@ -0,0 +1,192 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host implementation of the applibs calls the app makes: an epoll based
+// EventLoop, mutable storage backed by a plain file, and Log_Debug printing
+// to stderr when IDC_BENCH_VERBOSE is set.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/application.h>
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+struct EventLoop {
+    int epoll_fd;
+    bool stopped;
+};
+
+struct EventRegistration {
+    int fd;
+    EventLoopIoCallback *callback;
+    void *context;
+};
+
+
+EventLoop *EventLoop_Create(void)
+{
+    EventLoop *el = (EventLoop *)calloc(1, sizeof(EventLoop));
+    el->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (el->epoll_fd < 0) {
+        free(el);
+        return NULL;
+    }
+    return el;
+}
+
+
+void EventLoop_Close(EventLoop *el)
+{
+    if (el) {
+        close(el->epoll_fd);
+        free(el);
+    }
+}
+
+
+static int64_t monotonic_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+// one event per wait, so a callback may unregister any registration safely
+EventLoop_Run_Result EventLoop_Run(EventLoop *el, int duration_in_milliseconds, bool process_one_event)
+{
+    int64_t deadline = duration_in_milliseconds < 0 ? -1 : monotonic_ms() + duration_in_milliseconds;
+    bool processed = false;
+
+    el->stopped = false;
+    while (!el->stopped) {
+        int timeout = -1;
+        if (deadline >= 0) {
+            int64_t remain = deadline - monotonic_ms();
+            timeout = remain > 0 ? (int)remain : 0;
+        }
+
+        struct epoll_event event;
+        int n = epoll_wait(el->epoll_fd, &event, 1, timeout);
+        if (n < 0 && errno != EINTR) {
+            return EventLoop_Run_Failed;
+        }
+
+        if (n > 0) {
+            EventRegistration *reg = (EventRegistration *)event.data.ptr;
+            EventLoop_IoEvents events = ((event.events & EPOLLIN) ? EventLoop_Input : 0) |
+                                        ((event.events & EPOLLOUT) ? EventLoop_Output : 0) |
+                                        ((event.events & EPOLLERR) ? EventLoop_Error : 0);
+            reg->callback(el, reg->fd, events, reg->context);
+            processed = true;
+            if (process_one_event) {
+                break;
+            }
+        } else if (n == 0) {
+            break;
+        }
+    }
+    return processed ? EventLoop_Run_Finished : EventLoop_Run_FinishedEmpty;
+}
+
+
+int EventLoop_Stop(EventLoop *el)
+{
+    el->stopped = true;
+    return 0;
+}
+
+
+int EventLoop_GetWaitDescriptor(EventLoop *el)
+{
+    return el->epoll_fd;
+}
+
+
+EventRegistration *EventLoop_RegisterIo(EventLoop *el, int fd, EventLoop_IoEvents eventBitmask,
+                                        EventLoopIoCallback *callback, void *context)
+{
+    EventRegistration *reg = (EventRegistration *)calloc(1, sizeof(EventRegistration));
+    reg->fd = fd;
+    reg->callback = callback;
+    reg->context = context;
+
+    struct epoll_event event = {.data.ptr = reg};
+    event.events = ((eventBitmask & EventLoop_Input) ? EPOLLIN : 0) | ((eventBitmask & EventLoop_Output) ? EPOLLOUT : 0);
+    if (epoll_ctl(el->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        free(reg);
+        return NULL;
+    }
+    return reg;
+}
+
+
+int EventLoop_ModifyIoEvents(EventLoop *el, EventRegistration *reg, EventLoop_IoEvents eventBitmask)
+{
+    struct epoll_event event = {.data.ptr = reg};
+    event.events = ((eventBitmask & EventLoop_Input) ? EPOLLIN : 0) | ((eventBitmask & EventLoop_Output) ? EPOLLOUT : 0);
+    return epoll_ctl(el->epoll_fd, EPOLL_CTL_MOD, reg->fd, &event);
+}
+
+
+int EventLoop_UnregisterIo(EventLoop *el, EventRegistration *reg)
+{
+    if (!reg) {
+        return -1;
+    }
+    int ret = epoll_ctl(el->epoll_fd, EPOLL_CTL_DEL, reg->fd, NULL);
+    free(reg);
+    return ret;
+}
+
+
+static const char *storage_path(void)
+{
+    const char *path = getenv("IDC_BENCH_STORAGE");
+    return path ? path : "idc_bench.storage";
+}
+
+
+int Storage_OpenMutableFile(void)
+{
+    return open(storage_path(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+}
+
+
+int Storage_DeleteMutableFile(void)
+{
+    return unlink(storage_path());
+}
+
+
+int Application_Connect(const char *componentId)
+{
+    errno = ENOENT;
+    return -1;
+}
+
+
+int Log_Debug(const char *fmt, ...)
+{
+    static int verbose = -1;
+    if (verbose < 0) {
+        verbose = getenv("IDC_BENCH_VERBOSE") != NULL;
+    }
+    if (!verbose) {
+        return 0;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    int n = vfprintf(stderr, fmt, args);
+    va_end(args);
+    return n;
+}
@@ -0,0 +1,12 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// host stand-in of the Azure IoT SDK header, only types iot/iot.h refers to,
+// the IoT client itself is replaced by idc_shim.c
+
+#pragma once
+
+typedef enum {
+    AZURE_SPHERE_PROV_RESULT_OK,
+    AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR
+} AZURE_SPHERE_PROV_RESULT;
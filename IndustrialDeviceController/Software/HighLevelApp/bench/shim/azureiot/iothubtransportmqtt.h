@@ -0,0 +1,9 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// host stand-in of the Azure IoT SDK header, only types iot/iot.h refers to,
+// the IoT client itself is replaced by idc_shim.c
+
+#pragma once
+
+typedef int IOTHUB_CLIENT_CONNECTION_STATUS_REASON;
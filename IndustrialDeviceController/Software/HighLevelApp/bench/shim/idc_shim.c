@@ -0,0 +1,207 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <iot/diag.h>
+#include <iot/iot.h>
+#include <utils/llog.h>
+#include <utils/network.h>
+
+#include "idc_shim.h"
+
+#define SHIM_MAX_HISTOGRAMS 16
+
+typedef struct pending_delivery_t pending_delivery_t;
+struct pending_delivery_t {
+    message_delivery_confirmation_func_t callback;
+    void *context;
+};
+
+typedef struct shim_histogram_t shim_histogram_t;
+struct shim_histogram_t {
+    char key[32];
+    histogram_t hist;
+};
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static idc_shim_stats_t s_stats;
+static pending_delivery_t *s_pending;
+static int32_t s_num_pending;
+static int32_t s_max_pending;
+static shim_histogram_t s_histograms[SHIM_MAX_HISTOGRAMS];
+static int32_t s_num_histograms;
+
+volatile bool g_app_running = true;
+
+
+static int send_message(size_t len, message_delivery_confirmation_func_t callback, void *context)
+{
+    pthread_mutex_lock(&s_lock);
+    s_stats.messages++;
+    s_stats.bytes += len;
+    if (s_num_pending == s_max_pending) {
+        s_max_pending = s_max_pending ? s_max_pending * 2 : 64;
+        s_pending = (pending_delivery_t *)realloc(s_pending, s_max_pending * sizeof(pending_delivery_t));
+    }
+    s_pending[s_num_pending++] = (pending_delivery_t){callback, context};
+    pthread_mutex_unlock(&s_lock);
+    return 0;
+}
+
+
+int32_t idc_shim_deliver(void)
+{
+    pthread_mutex_lock(&s_lock);
+    pending_delivery_t *pending = s_pending;
+    int32_t num_pending = s_num_pending;
+    s_pending = NULL;
+    s_num_pending = 0;
+    s_max_pending = 0;
+    pthread_mutex_unlock(&s_lock);
+
+    for (int32_t i = 0; i < num_pending; i++) {
+        if (pending[i].callback) {
+            pending[i].callback(true, pending[i].context);
+        }
+    }
+    free(pending);
+    return num_pending;
+}
+
+
+void idc_shim_get_stats(idc_shim_stats_t *stats)
+{
+    pthread_mutex_lock(&s_lock);
+    *stats = s_stats;
+    pthread_mutex_unlock(&s_lock);
+}
+
+
+histogram_t *idc_shim_histogram(const char *key)
+{
+    for (int32_t i = 0; i < s_num_histograms; i++) {
+        if (strcmp(s_histograms[i].key, key) == 0) {
+            return &s_histograms[i].hist;
+        }
+    }
+    return NULL;
+}
+
+// ------------------------------- iot ----------------------------------------
+
+bool iot_is_connected(void)
+{
+    return true;
+}
+
+
+int iot_send_message_async(const char *iot_message, const char *iot_message_type,
+                           message_delivery_confirmation_func_t callback, void *context)
+{
+    return send_message(strlen(iot_message), callback, context);
+}
+
+
+int iot_send_priority_message_async(const char *iot_message, const char *iot_message_type,
+                                    message_delivery_confirmation_func_t callback, void *context)
+{
+    return send_message(strlen(iot_message), callback, context);
+}
+
+
+int iot_send_binary_message_async(const uint8_t *payload, size_t payload_size, const char *iot_message_type,
+                                  const char *content_type, const char *content_encoding,
+                                  const message_property_t *properties,
+                                  message_delivery_confirmation_func_t callback, void *context)
+{
+    return send_message(payload_size, callback, context);
+}
+
+
+int iot_report_device_twin_async(const char *properties, device_twin_delivery_confirmation_func_t callback,
+                                 void *context)
+{
+    pthread_mutex_lock(&s_lock);
+    s_stats.twin_reports++;
+    pthread_mutex_unlock(&s_lock);
+    if (callback) {
+        callback(true, context);
+    }
+    return 0;
+}
+
+// ------------------------------- diag ---------------------------------------
+
+diag_handle_t diag_register(const char *key)
+{
+    return DIAG_INVALID_HANDLE;
+}
+
+
+diag_handle_t diag_register_stats(const char *key)
+{
+    return DIAG_INVALID_HANDLE;
+}
+
+
+void diag_log_handle(diag_handle_t handle, double value)
+{
+}
+
+
+int diag_log_count_value(const char *key)
+{
+    return 0;
+}
+
+
+void diag_log_event(event_code_t code)
+{
+}
+
+
+histogram_t *diag_histogram(const char *key)
+{
+    pthread_mutex_lock(&s_lock);
+    histogram_t *h = idc_shim_histogram(key);
+    if (!h && s_num_histograms < SHIM_MAX_HISTOGRAMS) {
+        shim_histogram_t *entry = &s_histograms[s_num_histograms++];
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+        histogram_reset(&entry->hist);
+        h = &entry->hist;
+    }
+    pthread_mutex_unlock(&s_lock);
+    return h;
+}
+
+// ------------------------------ network -------------------------------------
+
+int network_config(link_t *uplink, link_t *downlink)
+{
+    return 0;
+}
+
+// ------------------------------ logging -------------------------------------
+
+void llog(int level, const char *file, const char *func, const char *fmt, ...)
+{
+    static int verbose = -1;
+    if (verbose < 0) {
+        verbose = getenv("IDC_BENCH_VERBOSE") != NULL;
+    }
+    if (!verbose) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "[%d] %s: ", level, file);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
@@ -0,0 +1,54 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/histogram.h>
+
+// Host stand-ins of the modules the adapter talks to but which need the
+// device: IoT hub client, diag, network and logging. Messages sent to the
+// fake hub are counted and confirmed when idc_shim_deliver() is called, as
+// the SDK would from its do_work.
+
+typedef struct idc_shim_stats_t idc_shim_stats_t;
+struct idc_shim_stats_t {
+    int64_t messages;
+    int64_t bytes;
+    int64_t twin_reports;
+};
+
+/**
+ * confirm delivery of every message sent so far
+ * @return number of messages confirmed
+ */
+int32_t idc_shim_deliver(void);
+
+/**
+ * get counters of messages sent to fake hub
+ * @param stats out parameter receive counters
+ */
+void idc_shim_get_stats(idc_shim_stats_t *stats);
+
+/**
+ * find a histogram registered with diag_histogram()
+ * @param key histogram key
+ * @return histogram, NULL if not registered
+ */
+histogram_t *idc_shim_histogram(const char *key);
+
+/**
+ * change every register served by loopback modbus transport, so polls
+ * after it see changed values
+ * @param tick value mixed into registers
+ */
+void idc_loopback_set_tick(uint32_t tick);
+
+/**
+ * get pipeline depth of loopback modbus transport created last, as parsed
+ * from its connection string
+ * @return depth, 0 if none was created
+ */
+int32_t idc_loopback_last_depth(void);
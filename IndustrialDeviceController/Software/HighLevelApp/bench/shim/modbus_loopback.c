@@ -0,0 +1,204 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Loopback modbus transport for the host bench, replaces the transport
+// factory of drivers/modbus/modbus_transport.c. Every unit answers at once
+// from a register image derived from the address, so a poll costs only the
+// driver and adapter work around it. Connection string is ignored except an
+// optional ":<depth>" suffix, the pipeline depth as with modbus TCP.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <driver/modbus.h>
+#include <init/device_hal.h>
+#include <utils/memory.h>
+
+#include "../../drivers/modbus/modbus_transport.h"
+#include "../../drivers/modbus/modbus_transport_sim.h"
+#include "idc_shim.h"
+
+#define LOOPBACK_MAX_DEPTH 8
+#define LOOPBACK_MAX_PDU 256
+
+typedef struct loopback_response_t loopback_response_t;
+struct loopback_response_t {
+    uint8_t pdu[LOOPBACK_MAX_PDU];
+    int32_t len;
+};
+
+typedef struct modbus_loopback_t modbus_loopback_t;
+struct modbus_loopback_t {
+    modbus_transport_t base;
+    loopback_response_t queue[LOOPBACK_MAX_DEPTH];
+    int32_t head;
+    int32_t count;
+};
+
+static volatile uint32_t s_tick;
+// pipeline depth of loopback transport created last
+static int32_t s_last_depth;
+
+
+void idc_loopback_set_tick(uint32_t tick)
+{
+    s_tick = tick;
+}
+
+
+int32_t idc_loopback_last_depth(void)
+{
+    return s_last_depth;
+}
+
+
+static uint16_t register_value(uint8_t id, uint16_t addr)
+{
+    return (uint16_t)((addr * 2654435761u) >> 16) ^ (uint16_t)(id + s_tick);
+}
+
+
+static int32_t build_response(uint8_t id, const uint8_t *pdu, int32_t pdu_len, uint8_t *rsp)
+{
+    uint8_t function = pdu[0];
+    uint16_t addr = (pdu[1] << 8) + pdu[2];
+    uint16_t quantity = (pdu[3] << 8) + pdu[4];
+
+    switch (function) {
+    case FC_READ_HOLDING_REGISTERS:
+    case FC_READ_INPUT_REGISTERS:
+        if (quantity == 0 || quantity > 0x7D) {
+            break;
+        }
+        rsp[0] = function;
+        rsp[1] = quantity * 2;
+        for (uint16_t i = 0; i < quantity; i++) {
+            uint16_t value = register_value(id, addr + i);
+            rsp[2 + i * 2] = value >> 8;
+            rsp[3 + i * 2] = value & 0xFF;
+        }
+        return 2 + quantity * 2;
+
+    case FC_READ_COILS:
+    case FC_READ_DISCRETE_INPUTS:
+        if (quantity == 0 || quantity > 0x7D0) {
+            break;
+        }
+        rsp[0] = function;
+        rsp[1] = (quantity + 7) / 8;
+        memset(rsp + 2, 0, rsp[1]);
+        for (uint16_t i = 0; i < quantity; i++) {
+            if (register_value(id, addr + i) & 1) {
+                rsp[2 + i / 8] |= 1u << (i % 8);
+            }
+        }
+        return 2 + rsp[1];
+
+    case FC_WRITE_SINGLE_COIL:
+    case FC_WRITE_SINGLE_REGISTER:
+    case FC_WRITE_COILS:
+    case FC_WRITE_HOLDING_REGISTERS:
+        memcpy(rsp, pdu, 5);
+        return 5;
+
+    default:
+        break;
+    }
+
+    rsp[0] = function | 0x80;
+    rsp[1] = 0x01;
+    return 2;
+}
+
+
+static err_code loopback_open(modbus_transport_t *instance, int32_t timeout_ms)
+{
+    return DEVICE_OK;
+}
+
+
+static err_code loopback_close(modbus_transport_t *instance)
+{
+    modbus_loopback_t *loopback = (modbus_loopback_t *)instance;
+    loopback->count = 0;
+    return DEVICE_OK;
+}
+
+
+static err_code loopback_send_request(modbus_transport_t *instance, uint8_t id, const uint8_t *pdu, int32_t pdu_len,
+                                      int32_t timeout)
+{
+    modbus_loopback_t *loopback = (modbus_loopback_t *)instance;
+
+    if (loopback->count >= instance->max_outstanding || pdu_len < 5) {
+        return DEVICE_E_INVALID;
+    }
+
+    loopback_response_t *rsp = &loopback->queue[(loopback->head + loopback->count) % LOOPBACK_MAX_DEPTH];
+    rsp->len = build_response(id, pdu, pdu_len, rsp->pdu);
+    loopback->count++;
+    return DEVICE_OK;
+}
+
+
+static err_code loopback_recv_response(modbus_transport_t *instance, uint8_t id, uint8_t *pdu, int32_t *ppdu_len,
+                                       int32_t timeout)
+{
+    modbus_loopback_t *loopback = (modbus_loopback_t *)instance;
+
+    if (loopback->count == 0) {
+        return DEVICE_E_TIMEOUT;
+    }
+
+    loopback_response_t *rsp = &loopback->queue[loopback->head];
+    loopback->head = (loopback->head + 1) % LOOPBACK_MAX_DEPTH;
+    loopback->count--;
+
+    memcpy(pdu, rsp->pdu, rsp->len);
+    *ppdu_len = rsp->len;
+    return DEVICE_OK;
+}
+
+
+static void loopback_cancel_requests(modbus_transport_t *instance)
+{
+    modbus_loopback_t *loopback = (modbus_loopback_t *)instance;
+    loopback->count = 0;
+}
+
+
+modbus_transport_t *modbus_create_transport(device_protocol_t protocol, const char *conn_str)
+{
+    if (conn_str && modbus_transport_sim_match(conn_str)) {
+        return modbus_transport_sim_create(conn_str);
+    }
+
+    modbus_loopback_t *loopback = (modbus_loopback_t *)CALLOC(1, sizeof(modbus_loopback_t));
+
+    loopback->base.transport_open = loopback_open;
+    loopback->base.transport_close = loopback_close;
+    loopback->base.send_request = loopback_send_request;
+    loopback->base.recv_response = loopback_recv_response;
+    loopback->base.cancel_requests = loopback_cancel_requests;
+    loopback->base.max_outstanding = 1;
+
+    const char *colon = conn_str ? strrchr(conn_str, ':') : NULL;
+    if (colon && strchr(conn_str, ':') != colon) {
+        int depth = atoi(colon + 1);
+        if (depth >= 1 && depth <= LOOPBACK_MAX_DEPTH) {
+            loopback->base.max_outstanding = depth;
+        }
+    }
+    s_last_depth = loopback->base.max_outstanding;
+    return &loopback->base;
+}
+
+
+void modbus_destroy_transport(device_protocol_t protocol, modbus_transport_t *transport)
+{
+    if (modbus_transport_is_sim(transport)) {
+        modbus_transport_sim_destroy(transport);
+        return;
+    }
+    FREE(transport);
+}
@@ -0,0 +1,1011 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <init/globals.h>
+#include <init/device_hal.h>
+#include <utils/utils.h>
+#include <utils/llog.h>
+#include <utils/timer.h>
+#include <driver/bacnet.h>
+
+#include <frozen/frozen.h>
+#include <safeclib/safe_lib.h>
+
+#include "bacnet_apdu.h"
+
+// BACnet/IP client of one device. Every poll reads the points of a schema
+// with as few ReadPropertyMultiple requests as the read plan allows, one
+// request in flight at a time on a UDP socket connected to the device.
+// Present values may also be subscribed with SubscribeCOV, on a second socket
+// which the event loop thread reads.
+
+#define MAX_FIELD_LENGTH 100
+
+// COV notification of standard objects carry present value and status flags
+#define BACNET_MAX_NOTIFY_VALUES 8
+
+// data point definition array field sequence
+enum {
+    BACNET_SCHEMA_FIELD_KEY,
+    BACNET_SCHEMA_FIELD_OBJECT,
+    BACNET_SCHEMA_FIELD_INSTANCE,
+    BACNET_SCHEMA_FIELD_PROPERTY,
+    BACNET_SCHEMA_FIELD_MULTIPLIER,
+    BACNET_SCHEMA_FIELD_DEADBAND,
+    BACNET_SCHEMA_FIELD_MAX_AGE,
+    BACNET_SCHEMA_FIELD_LAST
+};
+
+// object type may be given by its usual abbreviation instead of number
+static const struct {
+    const char *name;
+    uint16_t object_type;
+} OBJECT_NAMES[] = {
+    {"AI", BACNET_OBJECT_ANALOG_INPUT},
+    {"AO", BACNET_OBJECT_ANALOG_OUTPUT},
+    {"AV", BACNET_OBJECT_ANALOG_VALUE},
+    {"BI", BACNET_OBJECT_BINARY_INPUT},
+    {"BO", BACNET_OBJECT_BINARY_OUTPUT},
+    {"BV", BACNET_OBJECT_BINARY_VALUE},
+    {"MI", BACNET_OBJECT_MULTI_STATE_INPUT},
+    {"MO", BACNET_OBJECT_MULTI_STATE_OUTPUT},
+    {"MV", BACNET_OBJECT_MULTI_STATE_VALUE},
+};
+
+// points of plan->order[first, first + count) read by one request
+typedef struct bacnet_request_t bacnet_request_t;
+struct bacnet_request_t {
+    int32_t first;
+    int32_t count;
+};
+
+typedef struct bacnet_read_plan_t bacnet_read_plan_t;
+struct bacnet_read_plan_t {
+    // point indexes sorted by object and property
+    int32_t *order;
+    bacnet_request_t *requests;
+    int32_t num_request;
+};
+
+// point sort key when planning
+typedef struct bacnet_plan_entry_t bacnet_plan_entry_t;
+struct bacnet_plan_entry_t {
+    uint16_t object_type;
+    uint32_t instance;
+    uint32_t property;
+    int32_t index;
+};
+
+// subscribed point, instance has schema offset added
+typedef struct bacnet_watch_t bacnet_watch_t;
+struct bacnet_watch_t {
+    uint16_t object_type;
+    uint32_t instance;
+    int32_t index;
+    float scale;
+};
+
+// COV subscription of a schema accepted by device, subscriber id is used as
+// subscriber process identifier
+typedef struct bacnet_subscription_t bacnet_subscription_t;
+struct bacnet_subscription_t {
+    uint32_t subscriber;
+    struct timespec expire;
+    bacnet_watch_t *watches;
+    int32_t num_watch;
+    bacnet_subscription_t *next;
+};
+
+typedef struct bacnet_device_t bacnet_device_t;
+struct bacnet_device_t {
+    device_driver_t base; // must be first
+    int sock_fd;
+    char ip[16]; // only support ipv4
+    int port;
+    uint8_t invoke_id;
+    uint8_t frame[BACNET_MAX_FRAME];
+
+    // SubscribeCOV is sent from and notifications arrive on this socket, only
+    // event loop thread read it and hand answer of subscription to the worker
+    int notify_fd;
+    pthread_mutex_t notify_lock;
+    pthread_cond_t notify_cond;
+    bacnet_subscription_t *subscriptions;
+    uint8_t subscribe_invoke_id;
+    bool subscribe_pending;
+    err_code subscribe_result;
+    uint8_t notify_frame[BACNET_MAX_FRAME];
+};
+
+
+static err_code parse_object_type(const char *str, uint16_t *object_type)
+{
+    for (size_t i = 0; i < sizeof(OBJECT_NAMES) / sizeof(OBJECT_NAMES[0]); i++) {
+        if (strcasecmp(str, OBJECT_NAMES[i].name) == 0) {
+            *object_type = OBJECT_NAMES[i].object_type;
+            return DEVICE_OK;
+        }
+    }
+
+    errno = 0;
+    char *endptr = NULL;
+    long number = strtol(str, &endptr, 10);
+    if (errno || endptr == str || number < 0 || number > BACNET_OBJECT_MAX) {
+        return DEVICE_E_CONFIG;
+    }
+    *object_type = number;
+    return DEVICE_OK;
+}
+
+
+static err_code parse_point_definition(const char *ptr, int16_t len, data_point_t *p)
+{
+    if (!ptr || len <= 0 || !p) {
+        return DEVICE_E_CONFIG;
+    }
+
+    char buf[MAX_FIELD_LENGTH + 1];
+
+    bacnet_point_t *bp = &(p->d.bacnet);
+    // set default value
+    bp->property = BACNET_PROPERTY_PRESENT_VALUE;
+    bp->scale = 1;
+    p->deadband = 0;
+    p->deadband_percent = false;
+    p->max_age_ms = -1;
+
+    int16_t field_num = 0;
+
+    for (int16_t b = 0, e = 0; b < len; b = e + 1, e = b) {
+        while (e < len && ptr[e] != ':') {
+            e++;
+        }
+
+        if (e - b > MAX_FIELD_LENGTH) {
+            return DEVICE_E_CONFIG;
+        }
+
+        switch (field_num) {
+        case BACNET_SCHEMA_FIELD_KEY:
+            strncpy_s(p->key, e - b + 1, ptr + b, e - b);
+            break;
+
+        case BACNET_SCHEMA_FIELD_OBJECT:
+            strncpy_s(buf, sizeof(buf), ptr + b, e - b);
+            if (parse_object_type(buf, &bp->object_type) != DEVICE_OK) {
+                return DEVICE_E_CONFIG;
+            }
+            break;
+
+        case BACNET_SCHEMA_FIELD_INSTANCE: {
+            strncpy_s(buf, sizeof(buf), ptr + b, e - b);
+            errno = 0;
+            char *endptr = NULL;
+            long instance = strtol(buf, &endptr, 10);
+            if (errno || endptr == buf || instance < 0 || instance >= 0x3FFFFF) {
+                return DEVICE_E_CONFIG;
+            }
+            bp->instance = instance;
+            break;
+        }
+
+        // empty for present value
+        case BACNET_SCHEMA_FIELD_PROPERTY: {
+            if (e == b) {
+                break;
+            }
+            strncpy_s(buf, sizeof(buf), ptr + b, e - b);
+            errno = 0;
+            char *endptr = NULL;
+            long property = strtol(buf, &endptr, 10);
+            if (errno || endptr == buf || property < 0 || property > 0x3FFFFF) {
+                return DEVICE_E_CONFIG;
+            }
+            bp->property = property;
+            break;
+        }
+
+        case BACNET_SCHEMA_FIELD_MULTIPLIER: {
+            if (e == b) {
+                break;
+            }
+            strncpy_s(buf, sizeof(buf), ptr + b, e - b);
+            errno = 0;
+            double multiplier = strtod(buf, NULL);
+            if (errno || multiplier == 0) {
+                return DEVICE_E_CONFIG;
+            }
+            bp->scale = 1 / multiplier;
+            break;
+        }
+
+        // absolute deadband, or percent of last reported value when end with '%'
+        case BACNET_SCHEMA_FIELD_DEADBAND: {
+            if (e == b) {
+                break;
+            }
+            strncpy_s(buf, sizeof(buf), ptr + b, e - b);
+            errno = 0;
+            char *endptr = NULL;
+            double deadband = strtod(buf, &endptr);
+            if (errno || endptr == buf || deadband < 0) {
+                return DEVICE_E_CONFIG;
+            }
+            p->deadband = deadband;
+            p->deadband_percent = (*endptr == '%');
+            break;
+        }
+
+        // ms value from poll may serve on-demand read, empty to use schema maxAge
+        case BACNET_SCHEMA_FIELD_MAX_AGE: {
+            if (e == b) {
+                break;
+            }
+            strncpy_s(buf, sizeof(buf), ptr + b, e - b);
+            errno = 0;
+            char *endptr = NULL;
+            long max_age = strtol(buf, &endptr, 10);
+            if (errno || endptr == buf || max_age < 0 || max_age > INT32_MAX) {
+                return DEVICE_E_CONFIG;
+            }
+            p->max_age_ms = max_age;
+            break;
+        }
+        }
+
+        field_num++;
+    }
+
+    // minimum is key, object, instance
+    if (field_num < 3) {
+        return DEVICE_E_CONFIG;
+    } else {
+        return DEVICE_OK;
+    }
+}
+
+
+static int compare_plan_entry(const void *a, const void *b)
+{
+    const bacnet_plan_entry_t *ea = (const bacnet_plan_entry_t *)a;
+    const bacnet_plan_entry_t *eb = (const bacnet_plan_entry_t *)b;
+
+    if (ea->object_type != eb->object_type) {
+        return ea->object_type < eb->object_type ? -1 : 1;
+    }
+    if (ea->instance != eb->instance) {
+        return ea->instance < eb->instance ? -1 : 1;
+    }
+    if (ea->property != eb->property) {
+        return ea->property < eb->property ? -1 : 1;
+    }
+    return ea->index - eb->index;
+}
+
+
+/// <summary>
+/// send a confirmed request and wait for its response, datagrams which are not
+/// the response are dropped
+/// </summary>
+/// <returns>DEVICE_OK with service ACK data in self->frame, or error code</returns>
+static err_code transact(bacnet_device_t *self, int32_t frame_len, uint8_t service, const uint8_t **pbody,
+                         int32_t *pbody_len, int32_t timeout)
+{
+    uint8_t invoke_id = self->frame[8];
+
+    if (send(self->sock_fd, self->frame, frame_len, MSG_NOSIGNAL) != frame_len) {
+        LOGE("Failed to send BACnet request: %d (%s)", errno, strerror(errno));
+        return DEVICE_E_IO;
+    }
+
+    struct pollfd fds[1];
+    fds[0].fd = self->sock_fd;
+    fds[0].events = POLLIN;
+
+    struct timespec poll_sw;
+    timer_stopwatch_start(&poll_sw);
+
+    while (true) {
+        int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
+        if (elapse_ms >= timeout) {
+            return DEVICE_E_TIMEOUT;
+        }
+
+        int nevents = poll(fds, 1, timeout - elapse_ms);
+        if (nevents < 0) {
+            LOGE("socket I/O error");
+            return DEVICE_E_IO;
+        } else if (nevents == 0) {
+            LOGE("BACnet response timeout");
+            return DEVICE_E_TIMEOUT;
+        }
+
+        int nrecv = recv(self->sock_fd, self->frame, sizeof(self->frame), MSG_DONTWAIT);
+        if (nrecv < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+            // ICMP port unreachable of an earlier datagram show up here
+            LOGE("socket I/O error: %d (%s)", errno, strerror(errno));
+            return DEVICE_E_BROKEN;
+        }
+
+        err_code err = bacnet_decode_response(self->frame, nrecv, invoke_id, service, pbody, pbody_len);
+        if (err != DEVICE_E_NO_DATA) {
+            return err;
+        }
+        LOGD("Drop %d bytes of stale BACnet datagram", nrecv);
+    }
+}
+
+
+/// <summary>
+/// read points with one ReadPropertyMultiple, schema offset is added to
+/// object instance so devices of same model can share a schema
+/// </summary>
+/// <returns>DEVICE_OK if response matched the request, or error code</returns>
+static err_code read_points(bacnet_device_t *self, data_schema_t *schema, const int32_t *indexes, int32_t count,
+                            telemetry_t *telemetry, int32_t timeout)
+{
+    bacnet_point_t points[BACNET_MAX_POINTS_PER_REQUEST];
+    const bacnet_point_t *refs[BACNET_MAX_POINTS_PER_REQUEST];
+    bacnet_result_t results[BACNET_MAX_POINTS_PER_REQUEST];
+
+    ASSERT(count <= BACNET_MAX_POINTS_PER_REQUEST);
+
+    for (int32_t i = 0; i < count; i++) {
+        points[i] = schema->points[indexes[i]].d.bacnet;
+        points[i].instance += schema->offset;
+        refs[i] = &points[i];
+    }
+
+    int32_t frame_len =
+        bacnet_encode_read_property_multiple(self->frame, sizeof(self->frame), ++self->invoke_id, refs, count);
+    if (frame_len < 0) {
+        return DEVICE_E_INTERNAL;
+    }
+
+    const uint8_t *body = NULL;
+    int32_t body_len = 0;
+    err_code err = transact(self, frame_len, BACNET_SERVICE_READ_PROPERTY_MULTIPLE, &body, &body_len, timeout);
+    if (err) {
+        return err;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &telemetry->ts_response);
+
+    int32_t num_result = bacnet_decode_read_property_multiple_ack(body, body_len, results, count);
+    if (num_result != count) {
+        LOGE("Malformed ReadPropertyMultiple-ACK, %d of %d results", num_result, count);
+        return DEVICE_E_PROTOCOL;
+    }
+
+    for (int32_t i = 0; i < count; i++) {
+        const data_point_t *p = &schema->points[indexes[i]];
+        if (results[i].object_type != points[i].object_type || results[i].instance != points[i].instance ||
+            results[i].property != points[i].property) {
+            LOGE("ReadPropertyMultiple-ACK out of order at point %s", p->key);
+            return DEVICE_E_PROTOCOL;
+        }
+
+        // one unreadable property doesn't fail the others read with it
+        if (results[i].code) {
+            LOGW("Failed to read point '%s':%d:%u:%u", p->key, points[i].object_type, points[i].instance,
+                 points[i].property);
+            continue;
+        }
+
+        set_telemetry_number_value(telemetry, indexes[i], results[i].value * p->d.bacnet.scale, p);
+    }
+
+    return DEVICE_OK;
+}
+
+
+static int open_connected_socket(const char *ip, int port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        LOGE("Failed to open socket");
+        return -1;
+    }
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = inet_addr(ip);
+    server.sin_port = htons(port);
+
+    // connected so only datagrams from the device are received
+    if (connect(sock, (struct sockaddr *)&server, sizeof(server)) != 0) {
+        LOGE("Failed to connect to %s:%d", ip, port);
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+
+static void destroy_subscription(bacnet_subscription_t *sub)
+{
+    FREE(sub->watches);
+    FREE(sub);
+}
+
+
+// drop subscription of subscriber, and any lapsed one along the way
+static void remove_subscription_locked(bacnet_device_t *self, uint32_t subscriber)
+{
+    struct timespec ts_now;
+    clock_gettime(CLOCK_MONOTONIC, &ts_now);
+
+    bacnet_subscription_t **link = &self->subscriptions;
+    while (*link) {
+        bacnet_subscription_t *sub = *link;
+        if (sub->subscriber == subscriber || timespec_compare(&sub->expire, &ts_now) < 0) {
+            *link = sub->next;
+            destroy_subscription(sub);
+        } else {
+            link = &sub->next;
+        }
+    }
+}
+
+
+/// <summary>
+/// subscribe one object and wait until event loop thread read device's answer
+/// </summary>
+/// <returns>DEVICE_OK if device accepted subscription, or error code</returns>
+static err_code subscribe_object(bacnet_device_t *self, uint32_t subscriber, const bacnet_watch_t *watch,
+                                 int32_t lifetime_s, int32_t timeout)
+{
+    pthread_mutex_lock(&self->notify_lock);
+    uint8_t invoke_id = ++self->subscribe_invoke_id;
+    self->subscribe_pending = true;
+    self->subscribe_result = DEVICE_E_TIMEOUT;
+    pthread_mutex_unlock(&self->notify_lock);
+
+    err_code err = DEVICE_OK;
+    int32_t frame_len = bacnet_encode_subscribe_cov(self->frame, sizeof(self->frame), invoke_id, subscriber,
+                                                    watch->object_type, watch->instance, lifetime_s);
+    if (frame_len < 0) {
+        err = DEVICE_E_INTERNAL;
+    } else if (send(self->notify_fd, self->frame, frame_len, MSG_NOSIGNAL) != frame_len) {
+        LOGE("Failed to send BACnet request: %d (%s)", errno, strerror(errno));
+        err = DEVICE_E_IO;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    struct timespec ts_timeout = MS2SPEC(timeout);
+    timespec_add(&deadline, &ts_timeout);
+
+    pthread_mutex_lock(&self->notify_lock);
+    while (!err && self->subscribe_pending) {
+        if (pthread_cond_timedwait(&self->notify_cond, &self->notify_lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    self->subscribe_pending = false;
+    if (!err) {
+        err = self->subscribe_result;
+    }
+    pthread_mutex_unlock(&self->notify_lock);
+
+    if (err) {
+        LOGW("COV subscription of %d:%u failed: %s", watch->object_type, watch->instance, err_str(err));
+    }
+    return err;
+}
+
+
+// hand values of a COV notification to subscriber of points they belong to
+static void dispatch_notification_locked(bacnet_device_t *self, int32_t len, point_notify_fn notify, void *context)
+{
+    uint32_t subscriber = 0;
+    bacnet_result_t results[BACNET_MAX_NOTIFY_VALUES];
+
+    int32_t num_result =
+        bacnet_decode_cov_notification(self->notify_frame, len, &subscriber, results, BACNET_MAX_NOTIFY_VALUES);
+    if (num_result < 0) {
+        LOGD("Drop %d bytes of BACnet datagram", len);
+        return;
+    }
+
+    struct timespec ts_now;
+    clock_gettime(CLOCK_MONOTONIC, &ts_now);
+
+    bacnet_subscription_t *sub = self->subscriptions;
+    while (sub && sub->subscriber != subscriber) {
+        sub = sub->next;
+    }
+    if (!sub || timespec_compare(&sub->expire, &ts_now) < 0) {
+        LOGD("Drop COV notification of subscriber %u", subscriber);
+        return;
+    }
+
+    for (int32_t i = 0; i < num_result; i++) {
+        if (results[i].property != BACNET_PROPERTY_PRESENT_VALUE || results[i].code) {
+            continue;
+        }
+
+        // same object may be read by more than one point, e.g. scaled differently
+        for (int32_t j = 0; j < sub->num_watch; j++) {
+            const bacnet_watch_t *watch = &sub->watches[j];
+            if (watch->object_type == results[i].object_type && watch->instance == results[i].instance) {
+                notify(context, subscriber, watch->index, results[i].value * watch->scale);
+            }
+        }
+    }
+}
+
+// ------------------------ public interface --------------------------------
+
+
+err_code bacnet_open(void *instance, uint32_t unit_id, int32_t timeout)
+{
+    bacnet_device_t *self = (bacnet_device_t *)instance;
+    if (self->sock_fd >= 0) {
+        return DEVICE_OK;
+    }
+
+    int sock = open_connected_socket(self->ip, self->port);
+    if (sock < 0) {
+        return DEVICE_E_IO;
+    }
+
+    LOGD("Connected to BACnet device %s:%d", self->ip, self->port);
+    self->sock_fd = sock;
+    return DEVICE_OK;
+}
+
+
+err_code bacnet_close(void *instance)
+{
+    bacnet_device_t *self = (bacnet_device_t *)instance;
+    ASSERT(self);
+
+    LOGD("bacnet_close");
+
+    if (self->sock_fd >= 0) {
+        close(self->sock_fd);
+        self->sock_fd = -1;
+    }
+
+    return DEVICE_OK;
+}
+
+
+err_code bacnet_get_point(void *instance, uint32_t unit_id, const char *key, data_schema_t *schema,
+                          telemetry_t *telemetry, int32_t timeout)
+{
+    bacnet_device_t *self = (bacnet_device_t *)instance;
+
+    if (self->sock_fd < 0) {
+        return DEVICE_E_BROKEN;
+    }
+
+    int32_t index = find_read_point_index(schema, key);
+    if (index < 0) {
+        LOGE("Can't read invalid data point %s", key);
+        return DEVICE_E_INVALID;
+    }
+
+    return read_points(self, schema, &index, 1, telemetry, timeout);
+}
+
+
+err_code bacnet_get_point_list(void *instance, uint32_t unit_id, data_schema_t *schema, telemetry_t *telemetry,
+                               int32_t timeout)
+{
+    bacnet_device_t *self = (bacnet_device_t *)instance;
+
+    if (self->sock_fd < 0) {
+        return DEVICE_E_BROKEN;
+    }
+
+    bacnet_read_plan_t *plan = (bacnet_read_plan_t *)schema->read_plan;
+    if (!plan) {
+        LOGE("Schema %s has no read plan", schema->name);
+        return DEVICE_E_CONFIG;
+    }
+
+    struct timespec poll_sw;
+    timer_stopwatch_start(&poll_sw);
+
+    for (int32_t i = 0; i < plan->num_request; i++) {
+        int32_t remain_ms = timeout - timer_stopwatch_stop(&poll_sw);
+        if (remain_ms <= 0) {
+            return DEVICE_E_TIMEOUT;
+        }
+
+        bacnet_request_t *request = &plan->requests[i];
+        err_code err = read_points(self, schema, plan->order + request->first, request->count, telemetry, remain_ms);
+        if (err) {
+            return err;
+        }
+    }
+
+    return DEVICE_OK;
+}
+
+
+err_code bacnet_set_point(void *instance, uint32_t unit_id, const char *key, const char *value,
+                          data_schema_t *schema, int32_t timeout)
+{
+    bacnet_device_t *self = (bacnet_device_t *)instance;
+
+    if (self->sock_fd < 0) {
+        return DEVICE_E_BROKEN;
+    }
+
+    int index = find_read_point_index(schema, key);
+    if (index < 0) {
+        LOGE("Can't write invalid data point");
+        return DEVICE_E_INVALID;
+    }
+
+    bacnet_point_t point = schema->points[index].d.bacnet;
+    point.instance += schema->offset;
+
+    char *endptr = NULL;
+    double num_value = strtod(value, &endptr);
+    if (endptr == value) {
+        LOGE("Can't write non numeric value %s=%s", key, value);
+        return DEVICE_E_INVALID;
+    }
+
+    int32_t frame_len = bacnet_encode_write_property(self->frame, sizeof(self->frame), ++self->invoke_id, &point,
+                                                     num_value / point.scale);
+    if (frame_len < 0) {
+        return DEVICE_E_INTERNAL;
+    }
+
+    const uint8_t *body = NULL;
+    int32_t body_len = 0;
+    err_code err = transact(self, frame_len, BACNET_SERVICE_WRITE_PROPERTY, &body, &body_len, timeout);
+    if (err) {
+        LOGE("Failed to write data %s=%s:%s", key, value, err_str(err));
+        return err;
+    }
+
+    return DEVICE_OK;
+}
+
+
+err_code bacnet_subscribe(void *instance, uint32_t unit_id, uint32_t subscriber, data_schema_t *schema,
+                          int32_t lifetime_s, int32_t timeout)
+{
+    bacnet_device_t *self = (bacnet_device_t *)instance;
+
+    if (self->notify_fd < 0) {
+        return DEVICE_E_BROKEN;
+    }
+
+    bacnet_read_plan_t *plan = (bacnet_read_plan_t *)schema->read_plan;
+    if (!plan) {
+        LOGE("Schema %s has no read plan", schema->name);
+        return DEVICE_E_CONFIG;
+    }
+
+    // only present value is notified, other properties are left to integrity
+    // poll. Plan order is sorted by object so each object is subscribed once
+    bacnet_watch_t *watches = (bacnet_watch_t *)MALLOC(MAX(schema->num_read_point, 1) * sizeof(bacnet_watch_t));
+    int32_t num_watch = 0;
+    for (int32_t i = 0; i < schema->num_read_point; i++) {
+        const data_point_t *p = &schema->points[plan->order[i]];
+        if (p->d.bacnet.property != BACNET_PROPERTY_PRESENT_VALUE) {
+            continue;
+        }
+
+        bacnet_watch_t *watch = &watches[num_watch++];
+        watch->object_type = p->d.bacnet.object_type;
+        watch->instance = p->d.bacnet.instance + schema->offset;
+        watch->index = plan->order[i];
+        watch->scale = p->d.bacnet.scale;
+    }
+
+    if (num_watch == 0) {
+        LOGW("Schema %s has no present value to subscribe", schema->name);
+        FREE(watches);
+        return DEVICE_E_CONFIG;
+    }
+
+    struct timespec sw;
+    timer_stopwatch_start(&sw);
+
+    err_code err = DEVICE_OK;
+    for (int32_t i = 0; i < num_watch && !err; i++) {
+        if (i > 0 && watches[i].object_type == watches[i - 1].object_type &&
+            watches[i].instance == watches[i - 1].instance) {
+            continue;
+        }
+
+        int32_t remain_ms = timeout - timer_stopwatch_stop(&sw);
+        if (remain_ms <= 0) {
+            err = DEVICE_E_TIMEOUT;
+            break;
+        }
+        err = subscribe_object(self, subscriber, &watches[i], lifetime_s, remain_ms);
+    }
+
+    pthread_mutex_lock(&self->notify_lock);
+    remove_subscription_locked(self, subscriber);
+    if (!err) {
+        bacnet_subscription_t *sub = (bacnet_subscription_t *)CALLOC(1, sizeof(bacnet_subscription_t));
+        sub->subscriber = subscriber;
+        clock_gettime(CLOCK_MONOTONIC, &sub->expire);
+        struct timespec ts_lifetime = MS2SPEC(lifetime_s * 1000L);
+        timespec_add(&sub->expire, &ts_lifetime);
+        sub->watches = watches;
+        sub->num_watch = num_watch;
+        sub->next = self->subscriptions;
+        self->subscriptions = sub;
+    }
+    pthread_mutex_unlock(&self->notify_lock);
+
+    if (err) {
+        FREE(watches);
+        return err;
+    }
+
+    LOGI("Subscribed %d points of schema %s", num_watch, schema->name);
+    return DEVICE_OK;
+}
+
+
+int bacnet_get_notify_fd(void *instance)
+{
+    bacnet_device_t *self = (bacnet_device_t *)instance;
+    return self->notify_fd;
+}
+
+
+void bacnet_read_notification(void *instance, point_notify_fn notify, void *context)
+{
+    bacnet_device_t *self = (bacnet_device_t *)instance;
+
+    while (true) {
+        int nrecv = recv(self->notify_fd, self->notify_frame, sizeof(self->notify_frame), MSG_DONTWAIT);
+        if (nrecv < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOGW("socket I/O error: %d (%s)", errno, strerror(errno));
+            }
+            return;
+        }
+
+        // answer of pending subscription go to waiting worker, anything else
+        // may be a notification
+        pthread_mutex_lock(&self->notify_lock);
+        const uint8_t *body = NULL;
+        int32_t body_len = 0;
+        err_code err = DEVICE_E_NO_DATA;
+        if (self->subscribe_pending) {
+            err = bacnet_decode_response(self->notify_frame, nrecv, self->subscribe_invoke_id,
+                                         BACNET_SERVICE_SUBSCRIBE_COV, &body, &body_len);
+        }
+
+        if (err != DEVICE_E_NO_DATA) {
+            self->subscribe_result = err;
+            self->subscribe_pending = false;
+            pthread_cond_signal(&self->notify_cond);
+        } else {
+            dispatch_notification_locked(self, nrecv, notify, context);
+        }
+        pthread_mutex_unlock(&self->notify_lock);
+    }
+}
+
+
+device_protocol_t bacnet_get_protocol(void *instance)
+{
+    return DEVICE_PROTOCOL_BACNET_IP;
+}
+
+
+err_code bacnet_create_point_table(struct json_token *points_def, int *npoints, data_point_t **ppoints)
+{
+    if (!points_def || !points_def->ptr || points_def->len == 0) {
+        LOGW("schema has no points defintion");
+        *npoints = 0;
+        *ppoints = NULL;
+        return DEVICE_OK;
+    }
+
+    const char *ptr = points_def->ptr;
+    int len = points_def->len;
+    int num_point = 0;
+    size_t total_key_len = 0;
+
+    for (int b = 0, e = 0; b < len; b = e + 1, e = b) {
+        while (e < len && ptr[e] != ':') {
+            e++;
+        }
+        total_key_len += e - b;
+
+        while (e < len && ptr[e] != ',') {
+            e++;
+        }
+        num_point++;
+    }
+
+    data_point_t *points = CALLOC(num_point, sizeof(data_point_t));
+    // All keys been put in a single memory block to avoid fragment
+    char *keys = MALLOC(total_key_len + num_point);
+
+    for (int b = 0, e = 0, i = 0; b < len && i < num_point; b = e + 1, e = b, i++) {
+        while (e < len && ptr[e] != ',') {
+            e++;
+        }
+
+        data_point_t *p = &points[i];
+        p->key = keys;
+        if (parse_point_definition(ptr + b, e - b, p) != DEVICE_OK) {
+            LOGE("Failed to parse definition: [%.*s]", e - b, ptr + b);
+            bacnet_destroy_point_table(points, num_point);
+            return DEVICE_E_CONFIG;
+        }
+
+        keys += strlen(p->key) + 1; // make sure to include null terminate
+    }
+
+    *npoints = num_point;
+    *ppoints = points;
+    return DEVICE_OK;
+}
+
+
+void bacnet_destroy_point_table(data_point_t *points, int npoint)
+{
+    ASSERT(points);
+    // All keys been put in a single memory block to avoid fragment
+    FREE(points[0].key);
+    FREE(points);
+}
+
+
+err_code bacnet_create_read_plan(const data_schema_t *schema, void **pplan)
+{
+    ASSERT(schema);
+    ASSERT(pplan);
+
+    int32_t num_point = 0;
+    bacnet_read_plan_t *plan = (bacnet_read_plan_t *)CALLOC(1, sizeof(bacnet_read_plan_t));
+
+    // properties of same object next to each other share one object in request,
+    // only points of groups plan is created for
+    bacnet_plan_entry_t *entries = (bacnet_plan_entry_t *)MALLOC(MAX(schema->num_read_point, 1) * sizeof(bacnet_plan_entry_t));
+    for (int32_t i = 0; i < schema->num_read_point; i++) {
+        if (!IN_POINT_GROUPS(schema, schema->plan_groups, i)) {
+            continue;
+        }
+        entries[num_point].object_type = schema->points[i].d.bacnet.object_type;
+        entries[num_point].instance = schema->points[i].d.bacnet.instance;
+        entries[num_point].property = schema->points[i].d.bacnet.property;
+        entries[num_point].index = i;
+        num_point++;
+    }
+
+    if (num_point == 0) {
+        FREE(entries);
+        *pplan = plan;
+        return DEVICE_OK;
+    }
+    qsort(entries, num_point, sizeof(bacnet_plan_entry_t), compare_plan_entry);
+
+    plan->order = (int32_t *)MALLOC(num_point * sizeof(int32_t));
+    for (int32_t i = 0; i < num_point; i++) {
+        plan->order[i] = entries[i].index;
+    }
+    FREE(entries);
+
+    // no_batch read every point on its own
+    int32_t per_request = (schema->flags & FLAG_NO_BATCH) ? 1 : BACNET_MAX_POINTS_PER_REQUEST;
+
+    plan->num_request = (num_point + per_request - 1) / per_request;
+    plan->requests = (bacnet_request_t *)CALLOC(plan->num_request, sizeof(bacnet_request_t));
+    for (int32_t i = 0; i < plan->num_request; i++) {
+        plan->requests[i].first = i * per_request;
+        plan->requests[i].count = MIN(per_request, num_point - i * per_request);
+    }
+
+    LOGI("Schema %s: %d points in %d read requests", schema->name, num_point, plan->num_request);
+
+    *pplan = plan;
+    return DEVICE_OK;
+}
+
+
+void bacnet_destroy_read_plan(void *plan)
+{
+    bacnet_read_plan_t *self = (bacnet_read_plan_t *)plan;
+    ASSERT(self);
+
+    FREE(self->requests);
+    FREE(self->order);
+    FREE(self);
+}
+
+
+// connection string is "ip[:port]"
+device_driver_t *bacnet_create_driver(device_protocol_t protocol, const char *conn_str)
+{
+    if (!conn_str) {
+        return NULL;
+    }
+
+    bacnet_device_t *bacnet = (bacnet_device_t *)CALLOC(1, sizeof(bacnet_device_t));
+
+    bacnet->base.driver_open = bacnet_open;
+    bacnet->base.driver_close = bacnet_close;
+    bacnet->base.get_point = bacnet_get_point;
+    bacnet->base.get_point_list = bacnet_get_point_list;
+    bacnet->base.set_point = bacnet_set_point;
+    bacnet->base.get_protocol = bacnet_get_protocol;
+    bacnet->base.subscribe = bacnet_subscribe;
+    bacnet->base.get_notify_fd = bacnet_get_notify_fd;
+    bacnet->base.read_notification = bacnet_read_notification;
+
+    bacnet->sock_fd = -1;
+    bacnet->notify_fd = -1;
+    pthread_mutex_init(&bacnet->notify_lock, NULL);
+    pthread_cond_init(&bacnet->notify_cond, NULL);
+    bacnet->port = BACNET_IP_DEFAULT_PORT;
+
+    const char *colon = strchr(conn_str, ':');
+    if (colon) {
+        strncpy_s(bacnet->ip, sizeof(bacnet->ip), conn_str, colon - conn_str);
+        bacnet->port = strtol(colon + 1, NULL, 10);
+    } else {
+        strncpy_s(bacnet->ip, sizeof(bacnet->ip), conn_str, strlen(conn_str));
+    }
+
+    if ((strlen(bacnet->ip) == 0) || (bacnet->port <= 0) || (bacnet->port > UINT16_MAX) ||
+        (inet_addr(bacnet->ip) == INADDR_NONE)) {
+        LOGE("Invalid connection string");
+        bacnet_destroy_driver((device_driver_t *)bacnet);
+        return NULL;
+    }
+
+    // without it device is only polled
+    bacnet->notify_fd = open_connected_socket(bacnet->ip, bacnet->port);
+
+    LOGI("Created bacnet driver: connection=%s:%d", bacnet->ip, bacnet->port);
+
+    return (device_driver_t *)bacnet;
+}
+
+
+void bacnet_destroy_driver(device_driver_t *instance)
+{
+    bacnet_device_t *self = (bacnet_device_t *)instance;
+    ASSERT(self);
+
+    LOGI("Destroy bacnet driver");
+
+    if (self->sock_fd >= 0) {
+        bacnet_close(self);
+    }
+    if (self->notify_fd >= 0) {
+        close(self->notify_fd);
+    }
+    while (self->subscriptions) {
+        bacnet_subscription_t *sub = self->subscriptions;
+        self->subscriptions = sub->next;
+        destroy_subscription(sub);
+    }
+    pthread_mutex_destroy(&self->notify_lock);
+    pthread_cond_destroy(&self->notify_cond);
+    FREE(self);
+}
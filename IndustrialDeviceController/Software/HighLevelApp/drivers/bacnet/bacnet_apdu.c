@@ -0,0 +1,644 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include <utils/llog.h>
+
+#include "bacnet_apdu.h"
+
+#define BVLC_TYPE_BACNET_IP 0x81
+#define BVLC_FORWARDED_NPDU 0x04
+#define BVLC_ORIGINAL_UNICAST_NPDU 0x0A
+#define BVLC_HEADER_SIZE 4
+
+#define NPDU_VERSION 0x01
+#define NPDU_NETWORK_MESSAGE 0x80
+#define NPDU_DNET_PRESENT 0x20
+#define NPDU_SNET_PRESENT 0x08
+#define NPDU_EXPECTING_REPLY 0x04
+
+#define PDU_TYPE_CONFIRMED_REQUEST 0x00
+#define PDU_TYPE_UNCONFIRMED_REQUEST 0x10
+#define PDU_TYPE_SIMPLE_ACK 0x20
+#define PDU_TYPE_COMPLEX_ACK 0x30
+#define PDU_TYPE_ERROR 0x50
+#define PDU_TYPE_REJECT 0x60
+#define PDU_TYPE_ABORT 0x70
+#define PDU_SEGMENTED 0x08
+
+// max segments unspecified, max APDU 1476 octets
+#define APDU_MAX_ACCEPTED 0x05
+
+enum {
+    TAG_NULL = 0,
+    TAG_BOOLEAN = 1,
+    TAG_UNSIGNED = 2,
+    TAG_SIGNED = 3,
+    TAG_REAL = 4,
+    TAG_DOUBLE = 5,
+    TAG_ENUMERATED = 9,
+};
+
+typedef struct bacnet_tag_t bacnet_tag_t;
+struct bacnet_tag_t {
+    uint8_t number;
+    bool context;
+    bool opening;
+    bool closing;
+    // length of data after header, or value of application boolean
+    uint32_t len;
+};
+
+// ------------------------ encoding --------------------------------
+
+// context tagged unsigned in as few octets as it needs
+static uint8_t *encode_context_unsigned(uint8_t *p, uint8_t tag, uint32_t value)
+{
+    uint8_t len = value <= 0xFF ? 1 : value <= 0xFFFF ? 2 : value <= 0xFFFFFF ? 3 : 4;
+    *p++ = (tag << 4) | 0x08 | len;
+    for (int i = len - 1; i >= 0; i--) {
+        *p++ = value >> (8 * i);
+    }
+    return p;
+}
+
+static uint8_t *encode_context_object_id(uint8_t *p, uint8_t tag, uint16_t object_type, uint32_t instance)
+{
+    uint32_t id = ((uint32_t)object_type << 22) | (instance & 0x3FFFFF);
+    *p++ = (tag << 4) | 0x08 | 4;
+    *p++ = id >> 24;
+    *p++ = id >> 16;
+    *p++ = id >> 8;
+    *p++ = id;
+    return p;
+}
+
+// frame headers of a confirmed request, length in BVLC is filled once known
+static uint8_t *encode_request_header(uint8_t *p, uint8_t invoke_id, uint8_t service)
+{
+    *p++ = BVLC_TYPE_BACNET_IP;
+    *p++ = BVLC_ORIGINAL_UNICAST_NPDU;
+    *p++ = 0;
+    *p++ = 0;
+
+    *p++ = NPDU_VERSION;
+    *p++ = NPDU_EXPECTING_REPLY;
+
+    *p++ = PDU_TYPE_CONFIRMED_REQUEST;
+    *p++ = APDU_MAX_ACCEPTED;
+    *p++ = invoke_id;
+    *p++ = service;
+    return p;
+}
+
+static int32_t finish_frame(uint8_t *buf, uint8_t *end)
+{
+    int32_t len = end - buf;
+    buf[2] = len >> 8;
+    buf[3] = len;
+    return len;
+}
+
+int32_t bacnet_encode_read_property_multiple(uint8_t *buf, int32_t size, uint8_t invoke_id,
+                                             const bacnet_point_t *const *points, int32_t num_point)
+{
+    // headers, then at most object id, opening, property and closing tags per point
+    if (size < 10 + num_point * 12) {
+        return -1;
+    }
+
+    uint8_t *p = encode_request_header(buf, invoke_id, BACNET_SERVICE_READ_PROPERTY_MULTIPLE);
+
+    for (int32_t i = 0; i < num_point; i++) {
+        const bacnet_point_t *bp = points[i];
+        bool same_object = i > 0 && points[i - 1]->object_type == bp->object_type &&
+                           points[i - 1]->instance == bp->instance;
+
+        if (!same_object) {
+            if (i > 0) {
+                *p++ = 0x1F; // closing tag 1, list of property references
+            }
+            p = encode_context_object_id(p, 0, bp->object_type, bp->instance);
+            *p++ = 0x1E; // opening tag 1
+        }
+        p = encode_context_unsigned(p, 0, bp->property);
+    }
+    if (num_point > 0) {
+        *p++ = 0x1F;
+    }
+
+    return finish_frame(buf, p);
+}
+
+int32_t bacnet_encode_write_property(uint8_t *buf, int32_t size, uint8_t invoke_id, const bacnet_point_t *point,
+                                     double value)
+{
+    if (size < 32) {
+        return -1;
+    }
+
+    uint8_t *p = encode_request_header(buf, invoke_id, BACNET_SERVICE_WRITE_PROPERTY);
+    p = encode_context_object_id(p, 0, point->object_type, point->instance);
+    p = encode_context_unsigned(p, 1, point->property);
+
+    *p++ = 0x3E; // opening tag 3, property value
+    switch (point->object_type) {
+    case BACNET_OBJECT_BINARY_INPUT:
+    case BACNET_OBJECT_BINARY_OUTPUT:
+    case BACNET_OBJECT_BINARY_VALUE:
+        *p++ = (TAG_ENUMERATED << 4) | 1;
+        *p++ = value != 0 ? 1 : 0;
+        break;
+
+    case BACNET_OBJECT_MULTI_STATE_INPUT:
+    case BACNET_OBJECT_MULTI_STATE_OUTPUT:
+    case BACNET_OBJECT_MULTI_STATE_VALUE: {
+        uint32_t state = value < 0 ? 0 : (uint32_t)value;
+        *p++ = (TAG_UNSIGNED << 4) | 4;
+        *p++ = state >> 24;
+        *p++ = state >> 16;
+        *p++ = state >> 8;
+        *p++ = state;
+        break;
+    }
+
+    default: {
+        float f = value;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        *p++ = (TAG_REAL << 4) | 4;
+        *p++ = bits >> 24;
+        *p++ = bits >> 16;
+        *p++ = bits >> 8;
+        *p++ = bits;
+        break;
+    }
+    }
+    *p++ = 0x3F; // closing tag 3
+
+    return finish_frame(buf, p);
+}
+
+int32_t bacnet_encode_subscribe_cov(uint8_t *buf, int32_t size, uint8_t invoke_id, uint32_t process_id,
+                                    uint16_t object_type, uint32_t instance, uint32_t lifetime_s)
+{
+    if (size < 32) {
+        return -1;
+    }
+
+    uint8_t *p = encode_request_header(buf, invoke_id, BACNET_SERVICE_SUBSCRIBE_COV);
+    p = encode_context_unsigned(p, 0, process_id);
+    p = encode_context_object_id(p, 1, object_type, instance);
+    // [2] issue confirmed notifications, false so none need an ACK
+    *p++ = 0x29;
+    *p++ = 0;
+    p = encode_context_unsigned(p, 3, lifetime_s);
+
+    return finish_frame(buf, p);
+}
+
+// ------------------------ decoding --------------------------------
+
+// decode tag header, return its length or -1 if truncated
+static int32_t decode_tag(const uint8_t *p, int32_t len, bacnet_tag_t *tag)
+{
+    int32_t n = 0;
+    if (len < 1) {
+        return -1;
+    }
+
+    uint8_t b = p[n++];
+    tag->number = b >> 4;
+    tag->context = (b & 0x08) != 0;
+    uint8_t lvt = b & 0x07;
+
+    if (tag->number == 0x0F) {
+        if (len < n + 1) {
+            return -1;
+        }
+        tag->number = p[n++];
+    }
+
+    tag->opening = tag->context && lvt == 6;
+    tag->closing = tag->context && lvt == 7;
+    tag->len = 0;
+    if (tag->opening || tag->closing) {
+        return n;
+    }
+
+    if (lvt < 5) {
+        tag->len = lvt;
+    } else {
+        if (len < n + 1) {
+            return -1;
+        }
+        uint8_t ext = p[n++];
+        if (ext == 254) {
+            if (len < n + 2) {
+                return -1;
+            }
+            tag->len = (p[n] << 8) | p[n + 1];
+            n += 2;
+        } else if (ext == 255) {
+            if (len < n + 4) {
+                return -1;
+            }
+            tag->len = ((uint32_t)p[n] << 24) | (p[n + 1] << 16) | (p[n + 2] << 8) | p[n + 3];
+            n += 4;
+        } else {
+            tag->len = ext;
+        }
+    }
+
+    // application boolean carry its value in the length field
+    if (!tag->context && tag->number == TAG_BOOLEAN) {
+        return n;
+    }
+    if (tag->len > (uint32_t)(len - n)) {
+        return -1;
+    }
+    return n;
+}
+
+static uint32_t decode_unsigned(const uint8_t *p, uint32_t len)
+{
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < len && i < 4; i++) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+// decode one application tagged value as number
+static err_code decode_number(const bacnet_tag_t *tag, const uint8_t *p, double *value)
+{
+    switch (tag->number) {
+    case TAG_BOOLEAN:
+        *value = tag->len ? 1 : 0;
+        return DEVICE_OK;
+
+    case TAG_UNSIGNED:
+    case TAG_ENUMERATED:
+        if (tag->len < 1 || tag->len > 4) {
+            return DEVICE_E_NO_DATA;
+        }
+        *value = decode_unsigned(p, tag->len);
+        return DEVICE_OK;
+
+    case TAG_SIGNED: {
+        if (tag->len < 1 || tag->len > 4) {
+            return DEVICE_E_NO_DATA;
+        }
+        int32_t v = (int8_t)p[0];
+        for (uint32_t i = 1; i < tag->len; i++) {
+            v = (v * 256) + p[i];
+        }
+        *value = v;
+        return DEVICE_OK;
+    }
+
+    case TAG_REAL: {
+        if (tag->len != 4) {
+            return DEVICE_E_NO_DATA;
+        }
+        uint32_t bits = decode_unsigned(p, 4);
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        *value = f;
+        return DEVICE_OK;
+    }
+
+    case TAG_DOUBLE: {
+        if (tag->len != 8) {
+            return DEVICE_E_NO_DATA;
+        }
+        uint64_t bits = ((uint64_t)decode_unsigned(p, 4) << 32) | decode_unsigned(p + 4, 4);
+        memcpy(value, &bits, sizeof(*value));
+        return DEVICE_OK;
+    }
+
+    default:
+        return DEVICE_E_NO_DATA;
+    }
+}
+
+// skip tags until closing tag matching an opening tag already consumed,
+// return offset after it or -1 if malformed
+static int32_t skip_constructed(const uint8_t *body, int32_t len, int32_t pos, uint8_t number)
+{
+    int32_t depth = 1;
+    while (pos < len) {
+        bacnet_tag_t tag;
+        int32_t n = decode_tag(body + pos, len - pos, &tag);
+        if (n < 0) {
+            return -1;
+        }
+        pos += n;
+
+        if (tag.opening) {
+            depth++;
+        } else if (tag.closing) {
+            if (--depth == 0) {
+                return tag.number == number ? pos : -1;
+            }
+        } else if (tag.context || tag.number != TAG_BOOLEAN) {
+            pos += tag.len;
+        }
+    }
+    return -1;
+}
+
+// skip BVLC and NPDU headers, return offset of APDU or -1 if frame carry none
+static int32_t locate_apdu(const uint8_t *buf, int32_t len)
+{
+    if (len < BVLC_HEADER_SIZE + 2 || buf[0] != BVLC_TYPE_BACNET_IP) {
+        return -1;
+    }
+
+    int32_t pos = BVLC_HEADER_SIZE;
+    if (buf[1] == BVLC_FORWARDED_NPDU) {
+        pos += 6; // address of original source
+    } else if (buf[1] != BVLC_ORIGINAL_UNICAST_NPDU) {
+        return -1;
+    }
+
+    if (len < pos + 2 || buf[pos] != NPDU_VERSION) {
+        return -1;
+    }
+    uint8_t control = buf[pos + 1];
+    pos += 2;
+    if (control & NPDU_NETWORK_MESSAGE) {
+        return -1;
+    }
+    if (control & NPDU_DNET_PRESENT) {
+        if (len < pos + 3) {
+            return -1;
+        }
+        pos += 3 + buf[pos + 2];
+    }
+    if (control & NPDU_SNET_PRESENT) {
+        if (len < pos + 3) {
+            return -1;
+        }
+        pos += 3 + buf[pos + 2];
+    }
+    if (control & NPDU_DNET_PRESENT) {
+        pos += 1; // hop count
+    }
+
+    if (len < pos + 2) {
+        return -1;
+    }
+    return pos;
+}
+
+
+err_code bacnet_decode_response(const uint8_t *buf, int32_t len, uint8_t invoke_id, uint8_t service,
+                                const uint8_t **pbody, int32_t *pbody_len)
+{
+    int32_t pos = locate_apdu(buf, len);
+    if (pos < 0) {
+        return DEVICE_E_NO_DATA;
+    }
+
+    const uint8_t *apdu = buf + pos;
+    int32_t apdu_len = len - pos;
+    uint8_t type = apdu[0] & 0xF0;
+
+    switch (type) {
+    case PDU_TYPE_SIMPLE_ACK:
+        if (apdu_len < 3 || apdu[1] != invoke_id || apdu[2] != service) {
+            return DEVICE_E_NO_DATA;
+        }
+        *pbody = apdu + 3;
+        *pbody_len = 0;
+        return DEVICE_OK;
+
+    case PDU_TYPE_COMPLEX_ACK:
+        if (apdu_len < 3 || apdu[1] != invoke_id) {
+            return DEVICE_E_NO_DATA;
+        }
+        if (apdu[0] & PDU_SEGMENTED) {
+            LOGE("BACnet segmented response not supported, read fewer points per request");
+            return DEVICE_E_PROTOCOL;
+        }
+        if (apdu[2] != service) {
+            return DEVICE_E_PROTOCOL;
+        }
+        *pbody = apdu + 3;
+        *pbody_len = apdu_len - 3;
+        return DEVICE_OK;
+
+    case PDU_TYPE_ERROR:
+        if (apdu_len < 3 || apdu[1] != invoke_id) {
+            return DEVICE_E_NO_DATA;
+        }
+        LOGW("BACnet error response to service %d", apdu[2]);
+        return DEVICE_E_INVALID;
+
+    case PDU_TYPE_REJECT:
+    case PDU_TYPE_ABORT:
+        if (apdu_len < 3 || apdu[1] != invoke_id) {
+            return DEVICE_E_NO_DATA;
+        }
+        LOGW("BACnet %s, reason %d", type == PDU_TYPE_REJECT ? "reject" : "abort", apdu[2]);
+        return DEVICE_E_PROTOCOL;
+
+    default:
+        return DEVICE_E_NO_DATA;
+    }
+}
+
+int32_t bacnet_decode_read_property_multiple_ack(const uint8_t *body, int32_t len, bacnet_result_t *results,
+                                                 int32_t max_result)
+{
+    int32_t pos = 0;
+    int32_t num_result = 0;
+    bacnet_tag_t tag;
+    int32_t n;
+
+    while (pos < len) {
+        // [0] object identifier
+        n = decode_tag(body + pos, len - pos, &tag);
+        if (n < 0 || !tag.context || tag.number != 0 || tag.len != 4) {
+            return -1;
+        }
+        uint32_t id = decode_unsigned(body + pos + n, 4);
+        pos += n + 4;
+
+        // [1] list of results
+        n = decode_tag(body + pos, len - pos, &tag);
+        if (n < 0 || !tag.opening || tag.number != 1) {
+            return -1;
+        }
+        pos += n;
+
+        while (true) {
+            n = decode_tag(body + pos, len - pos, &tag);
+            if (n < 0) {
+                return -1;
+            }
+            if (tag.closing && tag.number == 1) {
+                pos += n;
+                break;
+            }
+
+            // [2] property identifier, optional [3] array index
+            if (!tag.context || tag.number != 2 || tag.len < 1 || tag.len > 4) {
+                return -1;
+            }
+            uint32_t property = decode_unsigned(body + pos + n, tag.len);
+            pos += n + tag.len;
+
+            n = decode_tag(body + pos, len - pos, &tag);
+            if (n >= 0 && tag.context && tag.number == 3 && !tag.opening) {
+                pos += n + tag.len;
+                n = decode_tag(body + pos, len - pos, &tag);
+            }
+
+            // [4] value or [5] error
+            if (n < 0 || !tag.opening || (tag.number != 4 && tag.number != 5)) {
+                return -1;
+            }
+            pos += n;
+
+            if (num_result >= max_result) {
+                return -1;
+            }
+            bacnet_result_t *r = &results[num_result++];
+            r->object_type = id >> 22;
+            r->instance = id & 0x3FFFFF;
+            r->property = property;
+            r->code = DEVICE_E_NO_DATA;
+            r->value = 0;
+
+            if (tag.number == 4) {
+                bacnet_tag_t value_tag;
+                n = decode_tag(body + pos, len - pos, &value_tag);
+                if (n >= 0 && !value_tag.context) {
+                    r->code = decode_number(&value_tag, body + pos + n, &r->value);
+                }
+            }
+
+            pos = skip_constructed(body, len, pos, tag.number);
+            if (pos < 0) {
+                return -1;
+            }
+        }
+    }
+
+    return num_result;
+}
+
+int32_t bacnet_decode_cov_notification(const uint8_t *buf, int32_t len, uint32_t *process_id,
+                                       bacnet_result_t *results, int32_t max_result)
+{
+    int32_t pos = locate_apdu(buf, len);
+    if (pos < 0 || buf[pos] != PDU_TYPE_UNCONFIRMED_REQUEST || buf[pos + 1] != BACNET_SERVICE_UNCONFIRMED_COV_NOTIFICATION) {
+        return -1;
+    }
+
+    const uint8_t *body = buf + pos + 2;
+    len -= pos + 2;
+    pos = 0;
+
+    bacnet_tag_t tag;
+    int32_t n;
+
+    // [0] subscriber process identifier
+    n = decode_tag(body, len, &tag);
+    if (n < 0 || !tag.context || tag.number != 0 || tag.len < 1 || tag.len > 4) {
+        return -1;
+    }
+    *process_id = decode_unsigned(body + n, tag.len);
+    pos += n + tag.len;
+
+    // [1] initiating device identifier
+    n = decode_tag(body + pos, len - pos, &tag);
+    if (n < 0 || !tag.context || tag.number != 1) {
+        return -1;
+    }
+    pos += n + tag.len;
+
+    // [2] monitored object identifier
+    n = decode_tag(body + pos, len - pos, &tag);
+    if (n < 0 || !tag.context || tag.number != 2 || tag.len != 4) {
+        return -1;
+    }
+    uint32_t id = decode_unsigned(body + pos + n, 4);
+    pos += n + 4;
+
+    // [3] time remaining
+    n = decode_tag(body + pos, len - pos, &tag);
+    if (n < 0 || !tag.context || tag.number != 3) {
+        return -1;
+    }
+    pos += n + tag.len;
+
+    // [4] list of values
+    n = decode_tag(body + pos, len - pos, &tag);
+    if (n < 0 || !tag.opening || tag.number != 4) {
+        return -1;
+    }
+    pos += n;
+
+    int32_t num_result = 0;
+    while (true) {
+        n = decode_tag(body + pos, len - pos, &tag);
+        if (n < 0) {
+            return -1;
+        }
+        if (tag.closing && tag.number == 4) {
+            break;
+        }
+
+        // [0] property identifier, optional [1] array index
+        if (!tag.context || tag.number != 0 || tag.len < 1 || tag.len > 4) {
+            return -1;
+        }
+        uint32_t property = decode_unsigned(body + pos + n, tag.len);
+        pos += n + tag.len;
+
+        n = decode_tag(body + pos, len - pos, &tag);
+        if (n >= 0 && tag.context && tag.number == 1 && !tag.opening) {
+            pos += n + tag.len;
+            n = decode_tag(body + pos, len - pos, &tag);
+        }
+
+        // [2] value
+        if (n < 0 || !tag.opening || tag.number != 2) {
+            return -1;
+        }
+        pos += n;
+
+        // values beyond what caller take are parsed over and dropped
+        bacnet_result_t *r = num_result < max_result ? &results[num_result++] : NULL;
+        if (r) {
+            r->object_type = id >> 22;
+            r->instance = id & 0x3FFFFF;
+            r->property = property;
+            r->code = DEVICE_E_NO_DATA;
+            r->value = 0;
+
+            bacnet_tag_t value_tag;
+            n = decode_tag(body + pos, len - pos, &value_tag);
+            if (n >= 0 && !value_tag.context) {
+                r->code = decode_number(&value_tag, body + pos + n, &r->value);
+            }
+        }
+
+        pos = skip_constructed(body, len, pos, 2);
+        if (pos < 0) {
+            return -1;
+        }
+
+        // optional [3] priority
+        n = decode_tag(body + pos, len - pos, &tag);
+        if (n >= 0 && tag.context && tag.number == 3 && !tag.opening && !tag.closing) {
+            pos += n + tag.len;
+        }
+    }
+
+    return num_result;
+}
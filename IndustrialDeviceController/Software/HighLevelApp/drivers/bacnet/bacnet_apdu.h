@@ -0,0 +1,129 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <init/device_hal.h>
+
+// BACnet/IP frames, BVLC + NPDU + APDU, of the few confirmed services the
+// driver use. Segmentation is not supported either way, so every request and
+// response must fit one frame.
+
+#define BACNET_IP_DEFAULT_PORT 47808
+
+// largest APDU on BACnet/IP, and the whole UDP payload around it
+#define BACNET_MAX_APDU 1476
+#define BACNET_MAX_FRAME 1500
+
+#define BACNET_SERVICE_SUBSCRIBE_COV 5
+#define BACNET_SERVICE_READ_PROPERTY_MULTIPLE 14
+#define BACNET_SERVICE_WRITE_PROPERTY 15
+
+// unconfirmed service choice
+#define BACNET_SERVICE_UNCONFIRMED_COV_NOTIFICATION 2
+
+#define BACNET_PROPERTY_PRESENT_VALUE 85
+
+enum {
+    BACNET_OBJECT_ANALOG_INPUT = 0,
+    BACNET_OBJECT_ANALOG_OUTPUT = 1,
+    BACNET_OBJECT_ANALOG_VALUE = 2,
+    BACNET_OBJECT_BINARY_INPUT = 3,
+    BACNET_OBJECT_BINARY_OUTPUT = 4,
+    BACNET_OBJECT_BINARY_VALUE = 5,
+    BACNET_OBJECT_MULTI_STATE_INPUT = 13,
+    BACNET_OBJECT_MULTI_STATE_OUTPUT = 14,
+    BACNET_OBJECT_MULTI_STATE_VALUE = 19,
+    BACNET_OBJECT_MAX = 1023
+};
+
+// one property of ReadPropertyMultiple-ACK in request order, or of COV notification
+typedef struct bacnet_result_t bacnet_result_t;
+struct bacnet_result_t {
+    uint16_t object_type;
+    uint32_t instance;
+    uint32_t property;
+    // DEVICE_E_NO_DATA when device return error or a value that is not a number
+    err_code code;
+    double value;
+};
+
+/**
+ * encode ReadPropertyMultiple request, consecutive points of same object are
+ * read with one read access specification
+ * @param buf buffer to encode frame into
+ * @param size size of buffer
+ * @param invoke_id invoke id to match response with
+ * @param points points to read
+ * @param num_point number of points
+ * @return frame length, or -1 if it doesn't fit buffer
+ */
+int32_t bacnet_encode_read_property_multiple(uint8_t *buf, int32_t size, uint8_t invoke_id,
+                                             const bacnet_point_t *const *points, int32_t num_point);
+
+/**
+ * encode WriteProperty request of a number, encoded as the application type
+ * usual for present value of object type, without priority
+ * @param buf buffer to encode frame into
+ * @param size size of buffer
+ * @param invoke_id invoke id to match response with
+ * @param point point to write
+ * @param value value to write, already scaled
+ * @return frame length, or -1 if it doesn't fit buffer
+ */
+int32_t bacnet_encode_write_property(uint8_t *buf, int32_t size, uint8_t invoke_id, const bacnet_point_t *point,
+                                     double value);
+
+/**
+ * encode SubscribeCOV request for unconfirmed notifications
+ * @param buf buffer to encode frame into
+ * @param size size of buffer
+ * @param invoke_id invoke id to match response with
+ * @param process_id subscriber process identifier, returned in notifications
+ * @param object_type type of object to monitor
+ * @param instance instance of object to monitor
+ * @param lifetime_s seconds subscription lasts unless subscribed again
+ * @return frame length, or -1 if it doesn't fit buffer
+ */
+int32_t bacnet_encode_subscribe_cov(uint8_t *buf, int32_t size, uint8_t invoke_id, uint32_t process_id,
+                                    uint16_t object_type, uint32_t instance, uint32_t lifetime_s);
+
+/**
+ * decode frame received as response of a confirmed request
+ * @param buf frame received
+ * @param len length of frame
+ * @param invoke_id invoke id of request
+ * @param service service choice of request
+ * @param pbody out parameter point to service ACK data on success
+ * @param pbody_len out parameter contains length of service ACK data on success
+ * @return DEVICE_OK on ACK, DEVICE_E_NO_DATA if frame is not response of the
+ *         request, or error code if device returned error, reject or abort
+ */
+err_code bacnet_decode_response(const uint8_t *buf, int32_t len, uint8_t invoke_id, uint8_t service,
+                                const uint8_t **pbody, int32_t *pbody_len);
+
+/**
+ * decode ReadPropertyMultiple-ACK
+ * @param body service ACK data
+ * @param len length of data
+ * @param results array to receive results, in order of response
+ * @param max_result length of results
+ * @return number of results decoded, or -1 if data is malformed
+ */
+int32_t bacnet_decode_read_property_multiple_ack(const uint8_t *body, int32_t len, bacnet_result_t *results,
+                                                 int32_t max_result);
+
+/**
+ * decode UnconfirmedCOVNotification
+ * @param buf frame received
+ * @param len length of frame
+ * @param process_id out parameter contains subscriber process identifier
+ * @param results array to receive values notified, all of monitored object
+ * @param max_result length of results, values beyond are dropped
+ * @return number of results decoded, or -1 if frame is not a COV notification
+ */
+int32_t bacnet_decode_cov_notification(const uint8_t *buf, int32_t len, uint32_t *process_id,
+                                       bacnet_result_t *results, int32_t max_result);
@@ -8,17 +8,20 @@
 #include <stdbool.h>
 #include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
 
 #include <init/globals.h>
 #include <init/device_hal.h>
 #include <utils/utils.h>
 #include <utils/llog.h>
 #include <utils/timer.h>
+#include <utils/property.h>
 #include <driver/modbus.h>
 
 #include <frozen/frozen.h>
 #include <safeclib/safe_lib.h>
 
+#include "modbus_decode.h"
 #include "modbus_transport.h"
 
 #define MAX_FIELD_LENGTH 100
@@ -27,9 +30,23 @@
 #define MODBUS_MAX_WORD_PER_READ 0x7D
 #define MODBUS_MAX_BIT_PER_WRITE 0x7B0
 #define MODBUS_MAX_WORD_PER_WRITE 0x7B
+// write side of FC 0x17, which also read the registers back in its response
+#define MODBUS_MAX_WORD_PER_READ_WRITE 0x79
 
 #define MODBUS_READ_REQUEST_FRAME_LENGTH 5
 
+// max read requests kept in flight during one poll, transport may allow less
+#define MODBUS_MAX_PIPELINE_DEPTH 8
+
+// exceptions a unit answer a read larger than it takes with
+#define MODBUS_EXCEPTION_ILLEGAL_ADDRESS 0x02
+#define MODBUS_EXCEPTION_ILLEGAL_VALUE 0x03
+#define IS_SIZE_EXCEPTION(e) ((e) == MODBUS_EXCEPTION_ILLEGAL_ADDRESS || (e) == MODBUS_EXCEPTION_ILLEGAL_VALUE)
+#define IS_REGISTER(reg_type) ((reg_type) == HOLDING_REGISTER || (reg_type) == INPUT_REGISTER)
+
+// property learned read limits of a downlink are kept in, by connection hash
+#define MODBUS_READ_LIMIT_PROPERTY "modbus_read_limit_%08x"
+
 // data point definition array field sequence
 enum {
     MODBUS_SCHEMA_FIELD_KEY,
@@ -38,24 +55,12 @@ enum {
     MODBUS_SCHEMA_FIELD_BIT,
     MODBUS_SCHEMA_FIELD_MULTIPLIER,
     MODBUS_SCHEMA_FIELD_OFFSET,
+    MODBUS_SCHEMA_FIELD_DEADBAND,
+    MODBUS_SCHEMA_FIELD_MAX_AGE,
     MODBUS_SCHEMA_FIELD_LAST
 };
 
 
-// intentionally to make it align with the address number.
-// register number  Data Addresses  Table Name
-// 000001 - 065536	0000 - FFFF 	Discrete Output Coils
-// 100001 - 165536	0000 - FFFF 	Discrete Input Contacts
-// 300001 - 365536	0000 - FFFF 	Analog Input Registers
-// 400001 - 465536	0000 - FFFF 	Analog Output Holding Registers
-enum {
-    COIL = 0,
-    DISCRETE_INPUT = 1,
-    INVALID = 2,
-    INPUT_REGISTER = 3,
-    HOLDING_REGISTER= 4
-};
-
 static const char *REG_NAMES[] =
 {
     "COIL",
@@ -65,27 +70,6 @@ static const char *REG_NAMES[] =
     "HOLDING_REGISTER"
 };
 
-// modbus protocol only defined two data type, bit (bool) or register (uint16)
-// OEM defined more data type based on register like int32,uint32, float etc.
-// This require additional decoding when getting a data point.
-// In this code, we refer to raw bit/register value as "value" while deoded data
-// as "point"
-enum {
-    TYPE_INVALID,
-    TYPE_BIT,
-    TYPE_BYTE,
-    TYPE_INT16,
-    TYPE_UINT16,
-    TYPE_INT32_BE, // 0x1234 as [0] = 0x12, [1] = 0x34
-    TYPE_INT32_LE, // 0x1234 as [0] = 0x34, [1] = 0x12
-    TYPE_UINT32_BE,
-    TYPE_UINT32_LE,
-    TYPE_FLOAT_BE,
-    TYPE_FLOAT_LE,
-    TYPE_INT64_BE, //0x12345678 as [0]=0x12, [1]=0x34, [2]=0x56, [3]=0x78
-    TYPE_INT64_LE, //0x12345678 as [0]=0x78, [1]=0x56, [2]=0x34, [3]=0x12
-};
-
 // key - standard data point name, we don't care vendor name
 // reg_type - coil, discrete, input register, holding register as defined in modbus protocol
 // data_type - as defined above, bit, byte, uint16, int16, uint32, int32, float
@@ -103,20 +87,101 @@ enum {
 // implement data_point_t interface, so make sure
 // key, value, next is at the head
 
+// registers of one read block kept from last poll, addr is on the wire with
+// schema offset applied
+typedef struct modbus_cache_block_t modbus_cache_block_t;
+struct modbus_cache_block_t {
+    uint8_t reg_type;
+    uint16_t addr;
+    uint16_t quantity;
+    struct timespec ts;
+    uint16_t *regs;
+};
+
+// register cache of one unit on the downlink
+typedef struct modbus_cache_t modbus_cache_t;
+struct modbus_cache_t {
+    uint32_t unit_id;
+    int32_t num_block;
+    modbus_cache_block_t blocks[MODBUS_CACHE_MAX_BLOCKS];
+    modbus_cache_t *next;
+};
+
+// registers a unit is known to take in one read and the fewest it rejected,
+// 0 if not known. Some units reject reads shorter than spec maximum with an
+// exception, the size is bisected between the two until they are adjacent
+typedef struct modbus_read_limit_t modbus_read_limit_t;
+struct modbus_read_limit_t {
+    uint8_t good;
+    uint8_t bad;
+};
+
 typedef struct modbus_device_t modbus_device_t;
 struct modbus_device_t {
     struct device_driver_t base;
     device_protocol_t protocol;
     bool opened;
     modbus_transport_t *transport;
+    // polls of devices on the downlink may run in parallel with on-demand read
+    pthread_mutex_t cache_lock;
+    modbus_cache_t *cache;
+    // blocks of every poll are kept, not only of plans with cached points,
+    // for the local gateway to serve them
+    bool keep_cache;
+    // bitmap of units which answered FC 0x17 with illegal function, their
+    // writes are not verified
+    uint8_t no_read_write[32];
+    // register read size of each unit, learned from rejected reads
+    modbus_read_limit_t read_limits[256];
+    uint32_t conn_hash;
 };
 
 
-struct register_buffer_t {
+// one read request in a read plan, its points decoded by runs[first_run, first_run + num_run)
+typedef struct modbus_read_block_t modbus_read_block_t;
+struct modbus_read_block_t {
     uint8_t reg_type;
-    uint16_t begin_addr;
-    uint16_t end_addr;
-    uint16_t buf[2000];
+    uint16_t addr;
+    uint16_t quantity;
+    int32_t first_run;
+    int32_t num_run;
+};
+
+// precomputed read requests for a schema, built once when schema loaded
+typedef struct modbus_read_plan_t modbus_read_plan_t;
+struct modbus_read_plan_t {
+    int32_t num_block;
+    modbus_read_block_t *blocks;
+    // decode program, ops of each block grouped into runs by kernel
+    int32_t num_run;
+    modbus_decode_run_t *runs;
+    modbus_decode_op_t *ops;
+    // any point of schema may be served from cache, so polled blocks are kept
+    bool cached;
+};
+
+// sort key of a point when building read plan, block and kernel are filled
+// once blocks are known to group its points for decoding
+typedef struct modbus_plan_entry_t modbus_plan_entry_t;
+struct modbus_plan_entry_t {
+    uint8_t reg_type;
+    uint16_t addr;
+    int32_t index;
+    int32_t block;
+    int8_t kernel;
+};
+
+// one point to write, registers as encoded and which of their bits the point
+// own, addr is on the wire with schema offset applied
+typedef struct modbus_write_entry_t modbus_write_entry_t;
+struct modbus_write_entry_t {
+    uint8_t reg_type;
+    uint16_t addr;
+    uint8_t quantity;
+    // position in request, later write of same register win
+    int32_t seq;
+    uint16_t regs[4];
+    uint16_t mask[4];
 };
 
 
@@ -128,9 +193,10 @@ struct register_buffer_t {
 /// <param name="response">response pdu</param>
 /// <param name="len_rsp">length ofresponse pdu</param>
 /// <param name="regs">buffer to hold parsed value</param>
+/// <param name="exception">out exception code server answered with, may be NULL</param>
 /// <returns>0 on success, or error code if failed</returns>
 static err_code parse_read_response(modbus_device_t *modbus, uint8_t *request, uint8_t *response, int16_t len_rsp,
-                                    uint16_t *regs)
+                                    uint16_t *regs, uint8_t *exception)
 {
     // minimum 2 bytes, even in error case
     if (len_rsp < 2) {
@@ -153,7 +219,8 @@ static err_code parse_read_response(modbus_device_t *modbus, uint8_t *request, u
             return DEVICE_E_PROTOCOL;
         }
 
-        if ((function == FC_READ_INPUT_REGISTERS) || (function == FC_READ_HOLDING_REGISTERS)) {
+        if ((function == FC_READ_INPUT_REGISTERS) || (function == FC_READ_HOLDING_REGISTERS) ||
+            (function == FC_READ_WRITE_REGISTERS)) {
             // check bytes received match requested
             if (byte_count != 2 * quantity_req) {
                 LOGE("byte count not match requested");
@@ -179,6 +246,9 @@ static err_code parse_read_response(modbus_device_t *modbus, uint8_t *request, u
         // server echo back function code with LSB set when something wrong
         uint8_t exception_code = response[1];
         LOGW("Exception code: %d", exception_code);
+        if (exception) {
+            *exception = exception_code;
+        }
         return DEVICE_E_PROTOCOL;
     } else {
         LOGW("Invalid server response: PDU:%s", hex(response, len_rsp));
@@ -190,40 +260,84 @@ static err_code parse_read_response(modbus_device_t *modbus, uint8_t *request, u
 
 
 /// <summary>
-/// Build and send read request pdu, then receive and parse response
+/// Build and send read request pdu
 /// </summary>
 /// <param name="modbus">this</param>
 /// <param name="function_code">funtion code</param>
 /// <param name="addr">start address</param>
 /// <param name="quantity">number of register request</param>
-/// <param name="regs">out buffer to hold register value</param>
+/// <param name="request">out buffer to hold request pdu, MODBUS_READ_REQUEST_FRAME_LENGTH bytes</param>
 /// <param name="timeout">the value of timer in ms for this operation</param>
 /// <returns>0 on success, or error code on failure</returns>
-
-static err_code handle_read_request(modbus_device_t *modbus, uint8_t slave_id, uint8_t function_code, uint16_t addr,
-                                    uint16_t quantity, uint16_t *regs, int32_t timeout)
+static err_code send_read_request(modbus_device_t *modbus, uint8_t slave_id, uint8_t function_code, uint16_t addr,
+                                  uint16_t quantity, uint8_t *request, int32_t timeout)
 {
-    uint8_t request[5];
-    uint8_t response[MODBUS_MAX_PDU_SIZE];
-
     request[0] = function_code;          // MODBUS FUNCTION CODE
     request[1] = (addr >> 8) & 0xFF;     // START REGISTER (Hi)
     request[2] = addr & 0xFF;            // START REGISTER (Lo)
     request[3] = (quantity >> 8) & 0xFF; // NUMBER OF REGISTERS (Hi)
     request[4] = quantity & 0xFF;        // NUMBER OF REGISTERS (Lo)
 
-    // send request
-    struct timespec poll_sw;
-    timer_stopwatch_start(&poll_sw);
     int err = modbus->transport->send_request(modbus->transport, slave_id, request, MODBUS_READ_REQUEST_FRAME_LENGTH,
                                               timeout);
     if (err) {
         LOGE("Failed to send request:%s", err_str(err));
+    }
+    return err;
+}
+
+
+/// <summary>
+/// receive and parse response of earliest outstanding read request
+/// </summary>
+/// <param name="modbus">this</param>
+/// <param name="request">request pdu the response is for</param>
+/// <param name="regs">out buffer to hold register value</param>
+/// <param name="timeout">the value of timer in ms for this operation</param>
+/// <param name="exception">out exception code server answered with, may be NULL</param>
+/// <returns>0 on success, or error code on failure</returns>
+static err_code recv_read_response(modbus_device_t *modbus, uint8_t slave_id, uint8_t *request, uint16_t *regs,
+                                   int32_t timeout, uint8_t *exception)
+{
+    uint8_t response[MODBUS_MAX_PDU_SIZE];
+    int32_t len_rsp;
+
+    err_code err = modbus->transport->recv_response(modbus->transport, slave_id, response, &len_rsp, timeout);
+    if (err) {
+        LOGE("Failed to receive response:%s", err_str(err));
+        return err;
+    }
+
+    // parse reponse
+    return parse_read_response(modbus, request, response, len_rsp, regs, exception);
+}
+
+
+/// <summary>
+/// Build and send read request pdu, then receive and parse response
+/// </summary>
+/// <param name="modbus">this</param>
+/// <param name="function_code">funtion code</param>
+/// <param name="addr">start address</param>
+/// <param name="quantity">number of register request</param>
+/// <param name="regs">out buffer to hold register value</param>
+/// <param name="timeout">the value of timer in ms for this operation</param>
+/// <returns>0 on success, or error code on failure</returns>
+
+static err_code handle_read_request(modbus_device_t *modbus, uint8_t slave_id, uint8_t function_code, uint16_t addr,
+                                    uint16_t quantity, uint16_t *regs, int32_t timeout)
+{
+    uint8_t request[MODBUS_READ_REQUEST_FRAME_LENGTH];
+
+    // send request
+    struct timespec poll_sw;
+    timer_stopwatch_start(&poll_sw);
+    err_code err = send_read_request(modbus, slave_id, function_code, addr, quantity, request, timeout);
+    if (err) {
         return err;
     }
 
     // recv response
-    int32_t len_rsp;
     // sending is not a blocked operation, so only use timeout for receiving
     int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
 
@@ -231,14 +345,7 @@ static err_code handle_read_request(modbus_device_t *modbus, uint8_t slave_id, u
         return DEVICE_E_TIMEOUT;
     }
 
-    err = modbus->transport->recv_response(modbus->transport, slave_id, response, &len_rsp, timeout - elapse_ms);
-    if (err) {
-        LOGE("Failed to receive response:%s", err_str(err));
-        return err;
-    }
-
-    // parse reponse
-    return parse_read_response(modbus, request, response, len_rsp, regs);
+    return recv_read_response(modbus, slave_id, request, regs, timeout - elapse_ms, NULL);
 }
 
 
@@ -349,7 +456,20 @@ static err_code handle_write_request(modbus_device_t *modbus, uint8_t slave_id,
     if (elapse_ms >= timeout) {
         return DEVICE_E_TIMEOUT;
     }
-    err = modbus->transport->recv_response(modbus->transport, slave_id, response, &len_rsp, timeout - elapse_ms);
+
+    // nothing comes back from a broadcast, waiting for the response keep the
+    // bus idle for the turnaround slaves need to process it
+    if (slave_id == MODBUS_BROADCAST_ID) {
+        err = modbus->transport->recv_response(modbus->transport, slave_id, response, &len_rsp,
+                                               MIN(timeout - elapse_ms, MODBUS_BROADCAST_TURNAROUND_MS));
+        if (err == DEVICE_E_TIMEOUT) {
+            modbus->transport->cancel_requests(modbus->transport);
+            return DEVICE_OK;
+        }
+    } else {
+        err = modbus->transport->recv_response(modbus->transport, slave_id, response, &len_rsp, timeout - elapse_ms);
+    }
+
     if (err) {
         LOGE("Failed to receive response:%s", err_str(err));
         return err;
@@ -359,23 +479,87 @@ static err_code handle_write_request(modbus_device_t *modbus, uint8_t slave_id,
 }
 
 
-err_code mb_read_register(modbus_device_t *modbus, uint8_t slave_id, uint8_t reg_type, uint16_t addr,
-                                 uint16_t quantity, uint16_t *regs, int32_t timeout)
+/// <summary>
+/// write holding registers and read them back in one FC 0x17 transaction
+/// </summary>
+/// <param name="modbus">this</param>
+/// <param name="addr">start address</param>
+/// <param name="quantity">number of register to write and read</param>
+/// <param name="regs">in buffer to hold register value to write</param>
+/// <param name="readback">out buffer to hold register value read after write</param>
+/// <param name="timeout">the value of timer in ms for this operation</param>
+/// <returns>0 on success, DEVICE_E_INVALID if unit doesn't support function, or error code on failure</returns>
+static err_code handle_read_write_request(modbus_device_t *modbus, uint8_t slave_id, uint16_t addr, uint16_t quantity,
+                                          const uint16_t *regs, uint16_t *readback, int32_t timeout)
+{
+    uint8_t request[MODBUS_MAX_PDU_SIZE];
+    uint8_t response[MODBUS_MAX_PDU_SIZE];
+
+    request[0] = FC_READ_WRITE_REGISTERS;
+    request[1] = (addr >> 8) & 0xFF;     // READ START (Hi)
+    request[2] = addr & 0xFF;            // READ START (Lo)
+    request[3] = (quantity >> 8) & 0xFF; // READ QUANTITY (Hi)
+    request[4] = quantity & 0xFF;        // READ QUANTITY (Lo)
+    request[5] = request[1];             // WRITE START
+    request[6] = request[2];
+    request[7] = request[3];             // WRITE QUANTITY
+    request[8] = request[4];
+    request[9] = quantity * 2;           // BYTE COUNT
+
+    for (int i = 0; i < quantity; i++) {
+        request[10 + 2 * i] = (regs[i] >> 8);
+        request[10 + 2 * i + 1] = regs[i] & 0xFF;
+    }
+
+    struct timespec poll_sw;
+    timer_stopwatch_start(&poll_sw);
+    err_code err = modbus->transport->send_request(modbus->transport, slave_id, request, 10 + request[9], timeout);
+    if (err) {
+        LOGE("Failed to send request:%s", err_str(err));
+        return err;
+    }
+
+    int32_t len_rsp;
+    int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
+    if (elapse_ms >= timeout) {
+        return DEVICE_E_TIMEOUT;
+    }
+    err = modbus->transport->recv_response(modbus->transport, slave_id, response, &len_rsp, timeout - elapse_ms);
+    if (err) {
+        LOGE("Failed to receive response:%s", err_str(err));
+        return err;
+    }
+
+    // illegal function
+    if (len_rsp >= 2 && response[0] == (FC_READ_WRITE_REGISTERS | 0x80) && response[1] == 0x01) {
+        return DEVICE_E_INVALID;
+    }
+
+    // response carry registers read, same as read holding registers
+    return parse_read_response(modbus, request, response, len_rsp, readback, NULL);
+}
+
+
+static uint8_t read_function_code(uint8_t reg_type)
 {
-    uint8_t fc = FC_INVALID;
     switch (reg_type) {
     case COIL:
-        fc = FC_READ_COILS;
-        break;
+        return FC_READ_COILS;
     case DISCRETE_INPUT:
-        fc = FC_READ_DISCRETE_INPUTS;
-        break;
+        return FC_READ_DISCRETE_INPUTS;
     case INPUT_REGISTER:
-        fc = FC_READ_INPUT_REGISTERS;
-        break;
+        return FC_READ_INPUT_REGISTERS;
     case HOLDING_REGISTER:
-        fc = FC_READ_HOLDING_REGISTERS;
+        return FC_READ_HOLDING_REGISTERS;
+    default:
+        return FC_INVALID;
     }
+}
+
+err_code mb_read_register(modbus_device_t *modbus, uint8_t slave_id, uint8_t reg_type, uint16_t addr,
+                                 uint16_t quantity, uint16_t *regs, int32_t timeout)
+{
+    uint8_t fc = read_function_code(reg_type);
 
     if (fc != FC_INVALID) {
         return handle_read_request(modbus, slave_id, fc, addr, quantity, regs, timeout);
@@ -540,112 +724,43 @@ static err_code encode_point(modbus_device_t *modbus, modbus_point_t *mp, const
 
 
 /// <summary>
-/// decode data point from register value to measured value
+/// bits of encoded registers a data point own, a bit or byte point only own
+/// part of its holding register
 /// </summary>
-/// <param name="point">point to be decoded</param>
-/// <param name="value_str">buffer hold the decoded value</param>
-/// <param name="value_str">size of buffer</param>
-/// <returns>0 on success, or error code on failure</returns>
-static err_code decode_point(modbus_device_t *modbus, modbus_point_t *mp, uint16_t *regs, double *value)
+/// <param name="mp">point to be written</param>
+/// <param name="mask">out buffer to hold mask of each register</param>
+static void write_mask(modbus_point_t *mp, uint16_t *mask)
 {
-    // parse data
-    switch (mp->data_type) {
-    case TYPE_BIT: {
-        if ((mp->reg_type == INPUT_REGISTER) || (mp->reg_type == HOLDING_REGISTER)) {
-            uint8_t bit_offset = mp->bit_offset;
-            *value = (regs[0] & (1 << bit_offset)) ? 1 : 0;
-        } else if ((mp->reg_type == COIL) || (mp->reg_type == DISCRETE_INPUT)) {
-            *value = regs[0] ? 1 : 0;
-        }
-
-        *value -= mp->value_offset;
-        break;
-    }
-
-    case TYPE_BYTE: {
-        uint8_t rv = (regs[0] >> mp->bit_offset) & 0xFF;
-        *value = (double)(rv - mp->value_offset);
-        break;
-    }
-
-    case TYPE_INT16: {
-        int16_t rv = regs[0];
-        *value = ((double)rv - mp->value_offset);
-        break;
-    }
-
-    case TYPE_UINT16: {
-        uint16_t rv = regs[0];
-        *value = ((double)rv - mp->value_offset);
-        break;
-    }
-
-    case TYPE_UINT32_BE: {
-        uint32_t rv = (regs[0] << 16) + regs[1];
-        *value = ((double)rv - mp->value_offset);
-        break;
-    }
-
-    case TYPE_UINT32_LE: {
-        uint32_t rv = (regs[1] << 16) + regs[0];
-        *value = ((double)rv - mp->value_offset);
-        break;
-    }
-
-    case TYPE_INT32_BE: {
-        int32_t rv = ((regs[0]) << 16) + regs[1];
-        *value = ((double)rv - mp->value_offset);
-        break;
-    }
-
-    case TYPE_INT32_LE: {
-        int32_t rv = ((regs[1]) << 16) + regs[0];
-        *value = ((double)rv - mp->value_offset);
-        break;
-    }
-
-    case TYPE_FLOAT_BE: {
-        uint32_t u32 = (regs[0] << 16) + regs[1];
-        float rv = *((float *)&u32);
-        *value = ((double)rv - mp->value_offset);
-        break;
-    }
-
-    case TYPE_FLOAT_LE: {
-        uint32_t u32 = (regs[1] << 16) + regs[0];
-        float rv = *((float *)&u32);
-        *value = ((double)rv - mp->value_offset);
-        break;
+    for (int i = 0; i < 4; i++) {
+        mask[i] = 0xFFFF;
     }
 
-    case TYPE_INT64_BE: {
-        int64_t rv = regs[0];
-        rv = (rv << 16) + regs[1];
-        rv = (rv << 16) + regs[2];
-        rv = (rv << 16) + regs[3];
-        *value = rv - mp->value_offset;
-        break;
+    if (mp->reg_type == HOLDING_REGISTER && mp->data_type == TYPE_BIT) {
+        mask[0] = 1 << mp->bit_offset;
+    } else if (mp->reg_type == HOLDING_REGISTER && mp->data_type == TYPE_BYTE) {
+        mask[0] = 0xFF << mp->bit_offset;
     }
+}
 
-    case TYPE_INT64_LE: {
-        int64_t rv = regs[3];
-        rv = (rv << 16) + regs[2];
-        rv = (rv << 16) + regs[1];
-        rv = (rv << 16) + regs[0];
-        *value = rv - mp->value_offset;
-        break;
-    }
 
-    default:
+/// <summary>
+/// decode data point from register value to measured value, polls decode
+/// with the program of read plan instead
+/// </summary>
+/// <param name="point">point to be decoded</param>
+/// <param name="value_str">buffer hold the decoded value</param>
+/// <param name="value_str">size of buffer</param>
+/// <returns>0 on success, or error code on failure</returns>
+static err_code decode_point(modbus_device_t *modbus, modbus_point_t *mp, uint16_t *regs, double *value)
+{
+    int8_t kernel = modbus_decode_kernel(mp->reg_type, mp->data_type);
+    if (kernel == KERNEL_INVALID) {
         return DEVICE_E_INVALID;
     }
 
-    if (!is_double_equal(mp->scale, 1)) {
-        *value /= mp->scale;
-        // If value is -0, set to be 0
-        if (is_double_equal(*value, -0))
-            *value = 0;
-    }
+    modbus_decode_op_t op;
+    modbus_decode_op_init(&op, 0, mp->bit_offset, 0, mp->value_offset, mp->scale);
+    modbus_decode_run(kernel, &op, 1, regs, value);
 
     return DEVICE_OK;
 }
@@ -664,6 +779,9 @@ static err_code parse_point_definition(const char *ptr, int16_t len, data_point_
     mp->value_offset = 0;
     mp->scale = 1;
     mp->bit_offset = 0;
+    p->deadband = 0;
+    p->deadband_percent = false;
+    p->max_age_ms = -1;
 
     int16_t field_num = 0;
 
@@ -734,6 +852,39 @@ static err_code parse_point_definition(const char *ptr, int16_t len, data_point_
             }
             break;
         }
+
+        // absolute deadband, or percent of last reported value when end with '%'
+        case MODBUS_SCHEMA_FIELD_DEADBAND: {
+            if (e == b) {
+                break;
+            }
+            strncpy_s(buf, sizeof(buf), ptr + b, e - b);
+            errno = 0;
+            char *endptr = NULL;
+            double deadband = strtod(buf, &endptr);
+            if (errno || endptr == buf || deadband < 0) {
+                return DEVICE_E_CONFIG;
+            }
+            p->deadband = deadband;
+            p->deadband_percent = (*endptr == '%');
+            break;
+        }
+
+        // ms value from poll may serve on-demand read, empty to use schema maxAge
+        case MODBUS_SCHEMA_FIELD_MAX_AGE: {
+            if (e == b) {
+                break;
+            }
+            strncpy_s(buf, sizeof(buf), ptr + b, e - b);
+            errno = 0;
+            char *endptr = NULL;
+            long max_age = strtol(buf, &endptr, 10);
+            if (errno || endptr == buf || max_age < 0 || max_age > INT32_MAX) {
+                return DEVICE_E_CONFIG;
+            }
+            p->max_age_ms = max_age;
+            break;
+        }
         }
 
         field_num++;
@@ -747,87 +898,294 @@ static err_code parse_point_definition(const char *ptr, int16_t len, data_point_
     }
 }
 
-// same type of point, address same (bit) or increasing
-// allow overlap does not allow hole
-static bool can_combine(modbus_point_t *current, modbus_point_t *next)
+static int compare_plan_entry(const void *a, const void *b)
 {
-    // Check integer overflow
-    uint32_t endAddr = current->addr + num_reg(current);
+    const modbus_plan_entry_t *ea = (const modbus_plan_entry_t *)a;
+    const modbus_plan_entry_t *eb = (const modbus_plan_entry_t *)b;
 
-    return (next && (next->reg_type == current->reg_type) && (next->addr >= current->addr) &&
-            (endAddr <= 0x00FFFF && next->addr <= endAddr));
+    if (ea->reg_type != eb->reg_type) {
+        return ea->reg_type - eb->reg_type;
+    }
+    if (ea->addr != eb->addr) {
+        return ea->addr - eb->addr;
+    }
+    // keep schema order for points on same address
+    return ea->index - eb->index;
 }
 
 
-static int find_modbus_point_index_by_key(data_schema_t *schema, const char *key)
+// decode order of points, in block by kernel then address
+static int compare_decode_entry(const void *a, const void *b)
 {
-    for (int i = 0; i < schema->num_point; i++) {
-        if (strcmp(schema->points[i].key, key) == 0) {
-            return i;
-        }
+    const modbus_plan_entry_t *ea = (const modbus_plan_entry_t *)a;
+    const modbus_plan_entry_t *eb = (const modbus_plan_entry_t *)b;
+
+    if (ea->block != eb->block) {
+        return ea->block - eb->block;
+    }
+    if (ea->kernel != eb->kernel) {
+        return ea->kernel - eb->kernel;
     }
-    return -1;
+    if (ea->addr != eb->addr) {
+        return ea->addr - eb->addr;
+    }
+    return ea->index - eb->index;
 }
 
 
-static bool is_register_value_in_buffer(modbus_point_t *mp, struct register_buffer_t *rbuf)
+static int compare_write_entry(const void *a, const void *b)
 {
-    return (mp->reg_type == rbuf->reg_type) && (mp->addr >= rbuf->begin_addr) && (mp->addr <= rbuf->end_addr);
+    const modbus_write_entry_t *ea = (const modbus_write_entry_t *)a;
+    const modbus_write_entry_t *eb = (const modbus_write_entry_t *)b;
+
+    if (ea->reg_type != eb->reg_type) {
+        return ea->reg_type - eb->reg_type;
+    }
+    if (ea->addr != eb->addr) {
+        return ea->addr - eb->addr;
+    }
+    return ea->seq - eb->seq;
 }
 
 
-static size_t calc_register_quantity_to_read(int mpi, data_schema_t *schema)
+/// <summary>
+/// max number of registers to bridge between two points in one read request
+/// </summary>
+/// <param name="schema">schema to be planned</param>
+/// <returns>max gap in registers</returns>
+static int32_t calc_max_gap(const data_schema_t *schema)
 {
-    modbus_point_t *mp = &schema->points[mpi].d.modbus;
-    int quantity = 0;
-    int max_quantity =
-        (mp->reg_type == COIL || mp->reg_type == DISCRETE_INPUT) ? MODBUS_MAX_BIT_PER_READ : MODBUS_MAX_WORD_PER_READ;
+    // no_batch only combine contiguous or overlapped points
     if (schema->flags & FLAG_NO_BATCH) {
-        int j = mpi + 1;
-
-        while ((j < schema->num_point) && can_combine(&schema->points[j - 1].d.modbus, &schema->points[j].d.modbus)) {
-            j++;
-        }
+        return 0;
+    }
 
-        modbus_point_t *mp_end = &schema->points[j - 1].d.modbus;
-        quantity = MIN(max_quantity, (mp_end->addr + num_reg(mp_end) - mp->addr));
-    } else {
-        quantity = num_reg(mp);
-
-        for (int j = mpi + 1; j < schema->num_point; j++) {
-            modbus_point_t *next = &schema->points[j].d.modbus;
-            if (next->reg_type == mp->reg_type) {
-                int nreg = next->addr - mp->addr + num_reg(next);
-                if (nreg <= max_quantity) {
-                    quantity = nreg;
-                    continue;
-                }
-            }
-            break;
-        }
+    // no limit configured, any hole fit in one request can be bridged
+    if (schema->max_gap < 0) {
+        return MODBUS_MAX_BIT_PER_READ;
     }
-    return quantity;
+
+    return schema->max_gap;
 }
 
-// ------------------------ public interface --------------------------------
+
+/// <summary>
+/// max age of cached value the point can be served with
+/// </summary>
+/// <returns>max age in ms, 0 if point must always be read from device</returns>
+static int32_t point_max_age(const data_schema_t *schema, const data_point_t *p)
+{
+    return p->max_age_ms >= 0 ? p->max_age_ms : MAX(schema->max_age_ms, 0);
+}
 
 
-// setup connection with device and verify communication of given channel (slave_id)
-err_code modbus_open(void *instance, uint32_t unit_id, int32_t timeout)
+static modbus_cache_t *cache_find_locked(modbus_device_t *self, uint32_t unit_id, bool create)
 {
-    modbus_device_t *self = (modbus_device_t*)instance;
-    if (self->opened) {
-        return DEVICE_OK;
+    for (modbus_cache_t *cache = self->cache; cache; cache = cache->next) {
+        if (cache->unit_id == unit_id) {
+            return cache;
+        }
     }
 
-    struct timespec poll_sw;
-    timer_stopwatch_start(&poll_sw);
-
-    if (self->transport->transport_open(self->transport, timeout) != 0) {
-        return DEVICE_E_IO;
+    if (!create) {
+        return NULL;
     }
 
-    int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
+    modbus_cache_t *cache = (modbus_cache_t *)CALLOC(1, sizeof(modbus_cache_t));
+    cache->unit_id = unit_id;
+    cache->next = self->cache;
+    self->cache = cache;
+    return cache;
+}
+
+
+/// <summary>
+/// keep registers of a block just read, replace block of same range or the
+/// oldest one when cache is full
+/// </summary>
+static void cache_store(modbus_device_t *self, uint32_t unit_id, uint8_t reg_type, uint16_t addr, uint16_t quantity,
+                        const uint16_t *regs)
+{
+    pthread_mutex_lock(&self->cache_lock);
+
+    modbus_cache_t *cache = cache_find_locked(self, unit_id, true);
+    modbus_cache_block_t *block = NULL;
+
+    for (int32_t i = 0; i < cache->num_block; i++) {
+        modbus_cache_block_t *b = &cache->blocks[i];
+        if (b->reg_type == reg_type && b->addr == addr && b->quantity == quantity) {
+            block = b;
+            break;
+        }
+    }
+
+    if (!block && cache->num_block < MODBUS_CACHE_MAX_BLOCKS) {
+        block = &cache->blocks[cache->num_block++];
+    } else if (!block) {
+        block = &cache->blocks[0];
+        for (int32_t i = 1; i < cache->num_block; i++) {
+            if (timespec_compare(&cache->blocks[i].ts, &block->ts) < 0) {
+                block = &cache->blocks[i];
+            }
+        }
+    }
+
+    if (block->quantity != quantity || !block->regs) {
+        FREE(block->regs);
+        block->regs = (uint16_t *)MALLOC(quantity * sizeof(uint16_t));
+    }
+
+    block->reg_type = reg_type;
+    block->addr = addr;
+    block->quantity = quantity;
+    memcpy_s(block->regs, quantity * sizeof(uint16_t), regs, quantity * sizeof(uint16_t));
+    timer_stopwatch_start(&block->ts);
+
+    pthread_mutex_unlock(&self->cache_lock);
+}
+
+
+/// <summary>
+/// copy registers from freshest cached block covering them, if no older than max_age_ms
+/// </summary>
+/// <returns>true if registers found in cache</returns>
+static bool cache_load(modbus_device_t *self, uint32_t unit_id, uint8_t reg_type, uint16_t addr, uint16_t quantity,
+                       int32_t max_age_ms, uint16_t *regs)
+{
+    bool found = false;
+    pthread_mutex_lock(&self->cache_lock);
+
+    modbus_cache_t *cache = cache_find_locked(self, unit_id, false);
+    modbus_cache_block_t *block = NULL;
+
+    for (int32_t i = 0; cache && i < cache->num_block; i++) {
+        modbus_cache_block_t *b = &cache->blocks[i];
+        if (b->reg_type == reg_type && b->addr <= addr && (uint32_t)addr + quantity <= (uint32_t)b->addr + b->quantity &&
+            (!block || timespec_compare(&b->ts, &block->ts) > 0)) {
+            block = b;
+        }
+    }
+
+    if (block && timer_stopwatch_stop(&block->ts) < max_age_ms) {
+        memcpy_s(regs, quantity * sizeof(uint16_t), block->regs + (addr - block->addr), quantity * sizeof(uint16_t));
+        found = true;
+    }
+
+    pthread_mutex_unlock(&self->cache_lock);
+    return found;
+}
+
+
+/// <summary>
+/// drop cached blocks overlapping registers written, device may have changed them,
+/// a broadcast write drop them of every unit
+/// </summary>
+static void cache_invalidate(modbus_device_t *self, uint32_t unit_id, uint8_t reg_type, uint16_t addr,
+                             uint16_t quantity)
+{
+    pthread_mutex_lock(&self->cache_lock);
+
+    for (modbus_cache_t *cache = self->cache; cache; cache = cache->next) {
+        if (unit_id != MODBUS_BROADCAST_ID && cache->unit_id != unit_id) {
+            continue;
+        }
+
+        for (int32_t i = 0; i < cache->num_block;) {
+            modbus_cache_block_t *b = &cache->blocks[i];
+            bool overlap = b->reg_type == reg_type && b->addr < (uint32_t)addr + quantity &&
+                           addr < (uint32_t)b->addr + b->quantity;
+            if (!overlap) {
+                i++;
+                continue;
+            }
+
+            FREE(b->regs);
+            *b = cache->blocks[--cache->num_block];
+            cache->blocks[cache->num_block].regs = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&self->cache_lock);
+}
+
+
+/// <summary>
+/// copy registers from cached blocks, the range may span several of them
+/// </summary>
+/// <returns>DEVICE_OK, DEVICE_E_NO_DATA if a register isn't cached or DEVICE_E_TIMEOUT
+/// if it is older than max_age_ms</returns>
+static err_code cache_load_range(modbus_device_t *self, uint32_t unit_id, uint8_t reg_type, uint16_t addr,
+                                 uint16_t quantity, int32_t max_age_ms, uint16_t *regs)
+{
+    err_code err = DEVICE_OK;
+    pthread_mutex_lock(&self->cache_lock);
+
+    modbus_cache_t *cache = cache_find_locked(self, unit_id, false);
+    uint32_t next = addr;
+    uint32_t end = (uint32_t)addr + quantity;
+
+    while (next < end) {
+        modbus_cache_block_t *block = NULL;
+        for (int32_t i = 0; cache && i < cache->num_block; i++) {
+            modbus_cache_block_t *b = &cache->blocks[i];
+            if (b->reg_type == reg_type && b->addr <= next && next < (uint32_t)b->addr + b->quantity &&
+                (!block || timespec_compare(&b->ts, &block->ts) > 0)) {
+                block = b;
+            }
+        }
+
+        if (!block) {
+            err = DEVICE_E_NO_DATA;
+            break;
+        }
+        if (timer_stopwatch_stop(&block->ts) >= max_age_ms) {
+            err = DEVICE_E_TIMEOUT;
+            break;
+        }
+
+        uint32_t count = MIN(end, (uint32_t)block->addr + block->quantity) - next;
+        memcpy_s(regs + (next - addr), count * sizeof(uint16_t), block->regs + (next - block->addr),
+                 count * sizeof(uint16_t));
+        next += count;
+    }
+
+    pthread_mutex_unlock(&self->cache_lock);
+    return err;
+}
+
+
+static void cache_destroy(modbus_device_t *self)
+{
+    while (self->cache) {
+        modbus_cache_t *cache = self->cache;
+        self->cache = cache->next;
+        for (int32_t i = 0; i < cache->num_block; i++) {
+            FREE(cache->blocks[i].regs);
+        }
+        FREE(cache);
+    }
+}
+
+
+// ------------------------ public interface --------------------------------
+
+
+// setup connection with device and verify communication of given channel (slave_id)
+err_code modbus_open(void *instance, uint32_t unit_id, int32_t timeout)
+{
+    modbus_device_t *self = (modbus_device_t*)instance;
+    if (self->opened) {
+        return DEVICE_OK;
+    }
+
+    struct timespec poll_sw;
+    timer_stopwatch_start(&poll_sw);
+
+    if (self->transport->transport_open(self->transport, timeout) != 0) {
+        return DEVICE_E_IO;
+    }
+
+    int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
 
     if (elapse_ms >= timeout) {
         return DEVICE_E_TIMEOUT;
@@ -845,7 +1203,7 @@ err_code modbus_close(void *instance)
 
     LOGD("modbus_close");
 
-    if (!self->opened) {
+    if (self->opened) {
         self->opened = false;
         self->transport->transport_close(self->transport);
     }
@@ -863,7 +1221,7 @@ err_code modbus_get_point(void *instance, uint32_t unit_id, const char *key,
         return DEVICE_E_BROKEN;
     }
 
-    int index = find_modbus_point_index_by_key(schema, key);
+    int index = find_read_point_index(schema, key);
 
     if (index < 0) {
         LOGE("Can't read invalid data point %s", key);
@@ -873,8 +1231,16 @@ err_code modbus_get_point(void *instance, uint32_t unit_id, const char *key,
 
     uint16_t regs[2];
     memset(regs, 0, sizeof(regs));
-    err_code err =
-        mb_read_register(self, unit_id, mp->reg_type, mp->addr + schema->offset, num_reg(mp), regs, timeout);
+    err_code err = DEVICE_OK;
+
+    // a recent poll already read it, don't hit the bus again
+    int32_t max_age_ms = point_max_age(schema, &schema->points[index]);
+    if (max_age_ms > 0 &&
+        cache_load(self, unit_id, mp->reg_type, mp->addr + schema->offset, num_reg(mp), max_age_ms, regs)) {
+        LOGV("Point %s served from cache", schema->points[index].key);
+    } else {
+        err = mb_read_register(self, unit_id, mp->reg_type, mp->addr + schema->offset, num_reg(mp), regs, timeout);
+    }
 
     if (err) {
         LOGW("Failed to read point '%s':%s:%d", schema->points[index].key, REG_NAMES[mp->reg_type], mp->addr);
@@ -889,71 +1255,283 @@ err_code modbus_get_point(void *instance, uint32_t unit_id, const char *key,
         return err;
     }
 
-    clear_mask(telemetry->str_mask, index);
-    if (is_double_equal(telemetry->values[index].num, new_value)) {
-        clear_mask(telemetry->cov_mask, index);
-    } else {
-        telemetry->values[index].num = new_value;
-        set_mask(telemetry->cov_mask, index);
-    }
+    set_telemetry_number_value(telemetry, index, new_value, &schema->points[index]);
 
     return DEVICE_OK;
 }
 
 
-err_code modbus_get_point_list_internal(void *instance, uint32_t unit_id,
-                               data_schema_t *schema, telemetry_t *telemetry, int32_t timeout)
+static bool is_read_limit_settled(const modbus_read_limit_t *limit)
 {
-    modbus_device_t *self = (modbus_device_t*)instance;
+    return limit->bad && limit->bad - limit->good <= 1;
+}
 
-    if (!self->opened) {
-        return DEVICE_E_BROKEN;
+
+// registers to ask unit for in one read, spec maximum until a read is
+// rejected, then bisected between largest taken and smallest rejected
+static uint16_t read_limit(const modbus_device_t *self, uint8_t unit)
+{
+    const modbus_read_limit_t *limit = &self->read_limits[unit];
+
+    if (!limit->bad) {
+        return MODBUS_MAX_WORD_PER_READ;
+    }
+    if (is_read_limit_settled(limit)) {
+        return MAX(limit->good, 1);
+    }
+    return MAX((limit->good + limit->bad) / 2, 1);
+}
+
+
+// keep settled read limits of all units in one property, "unit:limit,..."
+static void save_read_limits(modbus_device_t *self)
+{
+    char key[32];
+    char value[MAX_FIELD_LENGTH * 4];
+    size_t len = 0;
+
+    value[0] = '\0';
+    for (int32_t unit = 0; unit < 256; unit++) {
+        const modbus_read_limit_t *limit = &self->read_limits[unit];
+        if (is_read_limit_settled(limit) && len + 9 < sizeof(value)) {
+            len += snprintf(value + len, sizeof(value) - len, "%s%d:%d", len ? "," : "", unit, limit->good);
+        }
+    }
+
+    snprintf(key, sizeof(key), MODBUS_READ_LIMIT_PROPERTY, self->conn_hash);
+    if (write_property(key, value) != 0) {
+        LOGW("Failed to save read limits");
+    }
+}
+
+
+static void load_read_limits(modbus_device_t *self)
+{
+    char key[32];
+    snprintf(key, sizeof(key), MODBUS_READ_LIMIT_PROPERTY, self->conn_hash);
+
+    char *value = read_property(key);
+    if (!value) {
+        return;
+    }
+
+    for (char *p = value; *p;) {
+        char *end = NULL;
+        long unit = strtol(p, &end, 10);
+        if (*end != ':') {
+            break;
+        }
+        long good = strtol(end + 1, &end, 10);
+        if (unit >= 0 && unit < 256 && good > 0 && good < MODBUS_MAX_WORD_PER_READ) {
+            self->read_limits[unit].good = good;
+            self->read_limits[unit].bad = good + 1;
+            LOGI("Unit %ld reads at most %ld registers", unit, good);
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+    FREE(value);
+}
+
+
+// read of quantity registers was answered, a larger size may be taken
+static void read_limit_passed(modbus_device_t *self, uint8_t unit, uint16_t quantity)
+{
+    modbus_read_limit_t *limit = &self->read_limits[unit];
+    if (!limit->bad || quantity <= limit->good) {
+        return;
     }
 
-    struct register_buffer_t rbuf = {.reg_type = INVALID};
+    limit->good = quantity;
+    if (is_read_limit_settled(limit)) {
+        LOGI("Unit %d reads at most %d registers", unit, limit->good);
+        save_read_limits(self);
+    }
+}
+
+
+// read of quantity registers was rejected, return false if it isn't about
+// size as even a single register is rejected
+static bool read_limit_failed(modbus_device_t *self, uint8_t unit, uint16_t quantity)
+{
+    modbus_read_limit_t *limit = &self->read_limits[unit];
+
+    if (quantity <= 1) {
+        // points rejected for their address, don't stay bisecting on them
+        if (!is_read_limit_settled(limit)) {
+            memset(limit, 0, sizeof(*limit));
+        }
+        return false;
+    }
+
+    if (!limit->bad || quantity < limit->bad) {
+        limit->bad = quantity;
+    }
+    // size taken before is rejected now, bisect again from scratch
+    if (limit->good >= limit->bad) {
+        limit->good = 0;
+    }
+
+    LOGW("Unit %d rejected read of %d registers, retry with %d", unit, quantity, read_limit(self, unit));
+    return true;
+}
+
+
+/// <summary>
+/// read registers one request at a time, each no larger than unit takes.
+/// Read limit is bisected down whenever unit rejects a read as too large
+/// </summary>
+/// <returns>0 on success, or error code on failure</returns>
+static err_code read_registers_limited(modbus_device_t *self, uint8_t slave_id, uint8_t reg_type, uint16_t addr,
+                                       uint16_t quantity, uint16_t *regs, int32_t timeout)
+{
     struct timespec poll_sw;
     timer_stopwatch_start(&poll_sw);
 
-    for (int i = 0; i < schema->num_point; i++) {
-        modbus_point_t *mp = &schema->points[i].d.modbus;
-        int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
+    for (uint16_t done = 0; done < quantity;) {
+        uint16_t count = MIN(quantity - done, read_limit(self, slave_id));
+        uint8_t request[MODBUS_READ_REQUEST_FRAME_LENGTH];
+        uint8_t exception = 0;
 
+        int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
         if (elapse_ms >= timeout) {
             return DEVICE_E_TIMEOUT;
         }
 
-        if (!is_register_value_in_buffer(mp, &rbuf)) {
-            int quantity = calc_register_quantity_to_read(i, schema);
-            LOGV("Read [%s:%d+%d]", REG_NAMES[mp->reg_type], mp->addr, quantity);
+        err_code err = send_read_request(self, slave_id, read_function_code(reg_type), addr + done, count, request,
+                                         timeout - elapse_ms);
+        if (!err) {
+            elapse_ms = timer_stopwatch_stop(&poll_sw);
+            err = elapse_ms >= timeout
+                      ? DEVICE_E_TIMEOUT
+                      : recv_read_response(self, slave_id, request, regs + done, timeout - elapse_ms, &exception);
+        }
+
+        if (err == DEVICE_E_PROTOCOL && IS_SIZE_EXCEPTION(exception) && read_limit_failed(self, slave_id, count)) {
+            continue;
+        }
+        if (err) {
+            return err;
+        }
+
+        read_limit_passed(self, slave_id, count);
+        done += count;
+    }
+
+    return DEVICE_OK;
+}
+
 
-            err_code err = mb_read_register(self, unit_id, mp->reg_type, mp->addr + schema->offset, quantity, rbuf.buf,
-                                            timeout - elapse_ms);
+/// <summary>
+/// execute read plan of schema and decode all points, keep up to transport
+/// allowed number of requests in flight
+/// </summary>
+/// <returns>0 on success, or error code on failure</returns>
+static err_code execute_read_plan(modbus_device_t *self, uint32_t unit_id, data_schema_t *schema,
+                                  modbus_read_plan_t *plan, telemetry_t *telemetry, int32_t timeout)
+{
+    uint16_t regs[MODBUS_MAX_BIT_PER_READ];
+    uint8_t requests[MODBUS_MAX_PIPELINE_DEPTH][MODBUS_READ_REQUEST_FRAME_LENGTH];
+    // block is read in smaller requests when it exceeds read limit of unit
+    bool split[MODBUS_MAX_PIPELINE_DEPTH];
+    int32_t depth = MIN(MAX(self->transport->max_outstanding, 1), MODBUS_MAX_PIPELINE_DEPTH);
+    struct timespec poll_sw;
+    timer_stopwatch_start(&poll_sw);
+
+    // unit rejecting large reads is read one request at a time
+    for (int i = 0; i < plan->num_block; i++) {
+        if (IS_REGISTER(plan->blocks[i].reg_type) && plan->blocks[i].quantity > read_limit(self, unit_id)) {
+            depth = 1;
+        }
+    }
+
+    // keep up to depth requests in flight, responses come back in request order
+    for (int sent = 0, done = 0; done < plan->num_block; done++) {
+        for (; sent < plan->num_block && sent - done < depth; sent++) {
+            modbus_read_block_t *block = &plan->blocks[sent];
+            int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
+
+            if (elapse_ms >= timeout) {
+                return DEVICE_E_TIMEOUT;
+            }
+
+            split[sent % depth] = IS_REGISTER(block->reg_type) && block->quantity > read_limit(self, unit_id);
+            if (split[sent % depth]) {
+                continue;
+            }
+
+            LOGV("Read [%s:%d+%d]", REG_NAMES[block->reg_type], block->addr, block->quantity);
+
+            err_code err = send_read_request(self, unit_id, read_function_code(block->reg_type),
+                                             block->addr + schema->offset, block->quantity,
+                                             requests[sent % depth], timeout - elapse_ms);
             if (err) {
                 LOGE("Failed to read registers: %s", err_str(err));
                 return err;
             }
-            rbuf.begin_addr = mp->addr;
-            rbuf.end_addr = mp->addr + quantity;
-            rbuf.reg_type = mp->reg_type;
         }
 
-        double new_value = NAN;
+        modbus_read_block_t *block = &plan->blocks[done];
+        int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
 
-        if (decode_point(self, mp, &rbuf.buf[mp->addr - rbuf.begin_addr], &new_value) != 0) {
-            LOGW("Failed to decode data point %s", schema->points[i].key);
-            return DEVICE_E_PROTOCOL;
+        if (elapse_ms >= timeout) {
+            return DEVICE_E_TIMEOUT;
         }
 
-        set_telemetry_number_value(telemetry, i, new_value);
+        err_code err = DEVICE_OK;
+        uint8_t exception = 0;
+        if (split[done % depth]) {
+            err = read_registers_limited(self, unit_id, block->reg_type, block->addr + schema->offset, block->quantity,
+                                         regs, timeout - elapse_ms);
+        } else {
+            err = recv_read_response(self, unit_id, requests[done % depth], regs, timeout - elapse_ms, &exception);
+            if (!err && IS_REGISTER(block->reg_type)) {
+                read_limit_passed(self, unit_id, block->quantity);
+            }
+        }
+
+        if (err == DEVICE_E_PROTOCOL && IS_SIZE_EXCEPTION(exception) && IS_REGISTER(block->reg_type) &&
+            read_limit_failed(self, unit_id, block->quantity)) {
+            // drop requests sent ahead, rest of poll is read one request at
+            // a time starting over with this block
+            if (sent - done > 1) {
+                self->transport->cancel_requests(self->transport);
+            }
+            depth = 1;
+            sent = done + 1;
+            err = read_registers_limited(self, unit_id, block->reg_type, block->addr + schema->offset,
+                                         block->quantity, regs, timeout - elapse_ms);
+        }
 
-        LOGV("%s=%.2f", schema->points[i].key, new_value);
+        if (err) {
+            LOGE("Failed to read registers: %s", err_str(err));
+            return err;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &telemetry->ts_response);
+
+        if (plan->cached || self->keep_cache) {
+            cache_store(self, unit_id, block->reg_type, block->addr + schema->offset, block->quantity, regs);
+        }
+
+        for (int r = block->first_run; r < block->first_run + block->num_run; r++) {
+            modbus_decode_run_t *run = &plan->runs[r];
+            modbus_decode_op_t *ops = &plan->ops[run->first];
+            double values[MODBUS_DECODE_MAX_RUN];
+
+            modbus_decode_run(run->kernel, ops, run->count, regs, values);
+
+            for (int k = 0; k < run->count; k++) {
+                int i = ops[k].index;
+                set_telemetry_number_value(telemetry, i, values[k], &schema->points[i]);
+                LOGV("%s=%.2f", schema->points[i].key, values[k]);
+            }
+        }
     }
 
     return DEVICE_OK;
 }
 
 
-err_code modbus_get_point_list(void *instance, uint32_t unit_id,
+err_code modbus_get_point_list_internal(void *instance, uint32_t unit_id,
                                data_schema_t *schema, telemetry_t *telemetry, int32_t timeout)
 {
     modbus_device_t *self = (modbus_device_t*)instance;
@@ -962,12 +1540,24 @@ err_code modbus_get_point_list(void *instance, uint32_t unit_id,
         return DEVICE_E_BROKEN;
     }
 
-    return modbus_get_point_list_internal(instance, unit_id, schema, telemetry, timeout);
+    modbus_read_plan_t *plan = (modbus_read_plan_t *)schema->read_plan;
+    if (!plan) {
+        LOGE("Schema %s has no read plan", schema->name);
+        return DEVICE_E_CONFIG;
+    }
+
+    err_code err = execute_read_plan(self, unit_id, schema, plan, telemetry, timeout);
+
+    if (err) {
+        // requests still in flight belong to this aborted poll
+        self->transport->cancel_requests(self->transport);
+    }
+    return err;
 }
 
 
-err_code modbus_set_point(void *instance, uint32_t unit_id, const char *key, const char *value,
-                          data_schema_t *schema, int32_t timeout)
+err_code modbus_get_point_list(void *instance, uint32_t unit_id,
+                               data_schema_t *schema, telemetry_t *telemetry, int32_t timeout)
 {
     modbus_device_t *self = (modbus_device_t*)instance;
 
@@ -975,36 +1565,148 @@ err_code modbus_set_point(void *instance, uint32_t unit_id, const char *key, con
         return DEVICE_E_BROKEN;
     }
 
-    int index = find_modbus_point_index_by_key(schema, key);
+    return modbus_get_point_list_internal(instance, unit_id, schema, telemetry, timeout);
+}
+
 
-    if (index < 0) {
-        LOGE("Can't write invalid data point");
-        return DEVICE_E_INVALID;
+/// <summary>
+/// write one run of contiguous registers, holding registers are read back in
+/// same transaction when verify is set and unit support it
+/// </summary>
+/// <returns>DEVICE_OK if written (and read back same), or error code</returns>
+static err_code write_registers(modbus_device_t *self, uint32_t unit_id, uint8_t reg_type, uint16_t addr,
+                                uint16_t quantity, uint16_t *regs, bool verify, int32_t timeout)
+{
+    uint8_t slave_id = unit_id;
+
+    // broadcast can't be read back
+    if (verify && reg_type == HOLDING_REGISTER && slave_id != MODBUS_BROADCAST_ID &&
+        !test_mask(self->no_read_write, slave_id)) {
+        uint16_t readback[MODBUS_MAX_WORD_PER_READ_WRITE];
+        err_code err = handle_read_write_request(self, slave_id, addr, quantity, regs, readback, timeout);
+        if (err != DEVICE_E_INVALID) {
+            if (!err && memcmp(regs, readback, quantity * sizeof(uint16_t)) != 0) {
+                LOGW("Holding registers %d-%d read back differ from written", addr, addr + quantity - 1);
+                return DEVICE_E_PROTOCOL;
+            }
+            return err;
+        }
+
+        LOGW("Unit %d doesn't support read/write multiple registers, write without verify", slave_id);
+        set_mask(self->no_read_write, slave_id);
     }
 
-    modbus_point_t *mp = &schema->points[index].d.modbus;
+    return mb_write_register(self, slave_id, reg_type, addr, quantity, regs, timeout);
+}
 
-    if (mp->reg_type != COIL && mp->reg_type != HOLDING_REGISTER) {
-        LOGE("Can't write invalid data point %s", key);
-        return DEVICE_E_INVALID;
+
+err_code modbus_set_point_list(void *instance, uint32_t unit_id, const char *const *keys, const char *const *values,
+                               int32_t num_point, data_schema_t *schema, int32_t timeout)
+{
+    modbus_device_t *self = (modbus_device_t*)instance;
+
+    if (!self->opened) {
+        return DEVICE_E_BROKEN;
     }
 
-    uint16_t regs[4] = {0, 0, 0, 0};
-    err_code err = encode_point(self, mp, value, regs);
+    if (num_point <= 0) {
+        return DEVICE_OK;
+    }
+
+    // every point is encoded before anything is written
+    err_code err = DEVICE_OK;
+    modbus_write_entry_t *entries = (modbus_write_entry_t *)CALLOC(num_point, sizeof(modbus_write_entry_t));
+    for (int32_t i = 0; i < num_point && !err; i++) {
+        int index = find_read_point_index(schema, keys[i]);
+        if (index < 0) {
+            LOGE("Can't write invalid data point %s", keys[i]);
+            err = DEVICE_E_INVALID;
+            break;
+        }
+
+        modbus_point_t *mp = &schema->points[index].d.modbus;
+        if (mp->reg_type != COIL && mp->reg_type != HOLDING_REGISTER) {
+            LOGE("Can't write invalid data point %s", keys[i]);
+            err = DEVICE_E_INVALID;
+            break;
+        }
+
+        modbus_write_entry_t *e = &entries[i];
+        e->reg_type = mp->reg_type;
+        e->addr = mp->addr + schema->offset;
+        e->quantity = num_reg(mp);
+        e->seq = i;
+        write_mask(mp, e->mask);
+
+        err = encode_point(self, mp, values[i], e->regs);
+        if (err) {
+            LOGE("Failed to encode point %s=%s:%s", keys[i], values[i], err_str(err));
+        }
+    }
 
     if (err) {
-        LOGE("Failed to encode point %s=%s:%s", key, value, err_str(err));
+        FREE(entries);
         return err;
     }
 
-    err = mb_write_register(self, unit_id, mp->reg_type, mp->addr + schema->offset, num_reg(mp), regs, timeout);
+    qsort(entries, num_point, sizeof(modbus_write_entry_t), compare_write_entry);
 
-    if (err) {
-        LOGE("Failed to write data %s=%s", key, value, err_str(err));
-        return err;
+    bool verify = schema->flags & FLAG_VERIFY_WRITE;
+    uint16_t *run = (uint16_t *)MALLOC(MODBUS_MAX_BIT_PER_WRITE * sizeof(uint16_t));
+
+    struct timespec write_sw;
+    timer_stopwatch_start(&write_sw);
+
+    // points on contiguous or shared registers of same type are written
+    // together, bits of a register shared by points are combined
+    for (int32_t i = 0, j = 0; i < num_point && !err; i = j) {
+        uint8_t reg_type = entries[i].reg_type;
+        uint16_t start = entries[i].addr;
+        int32_t end = start;
+        int32_t max_quantity = reg_type == COIL ? MODBUS_MAX_BIT_PER_WRITE
+                             : verify           ? MODBUS_MAX_WORD_PER_READ_WRITE
+                                                : MODBUS_MAX_WORD_PER_WRITE;
+
+        memset(run, 0, max_quantity * sizeof(uint16_t));
+        for (j = i; j < num_point; j++) {
+            modbus_write_entry_t *e = &entries[j];
+            if (e->reg_type != reg_type || e->addr > end || e->addr + e->quantity - start > max_quantity) {
+                break;
+            }
+
+            for (int k = 0; k < e->quantity; k++) {
+                uint16_t *reg = &run[e->addr - start + k];
+                *reg = (*reg & ~e->mask[k]) | (e->regs[k] & e->mask[k]);
+            }
+            end = MAX(end, e->addr + e->quantity);
+        }
+
+        int32_t remain_ms = timeout - timer_stopwatch_stop(&write_sw);
+        if (remain_ms <= 0) {
+            err = DEVICE_E_TIMEOUT;
+            break;
+        }
+
+        err = write_registers(self, unit_id, reg_type, start, end - start, run, verify, remain_ms);
+
+        // even a failed write may have reached the device
+        cache_invalidate(self, unit_id, reg_type, start, end - start);
+
+        if (err) {
+            LOGE("Failed to write %s %d-%d:%s", REG_NAMES[reg_type], start, end - 1, err_str(err));
+        }
     }
 
-    return DEVICE_OK;
+    FREE(run);
+    FREE(entries);
+    return err;
+}
+
+
+err_code modbus_set_point(void *instance, uint32_t unit_id, const char *key, const char *value,
+                          data_schema_t *schema, int32_t timeout)
+{
+    return modbus_set_point_list(instance, unit_id, &key, &value, 1, schema, timeout);
 }
 
 device_protocol_t modbus_get_protocol(void *instance)
@@ -1075,6 +1777,124 @@ void modbus_destroy_point_table(data_point_t *points, int npoint)
 }
 
 
+err_code modbus_create_read_plan(const data_schema_t *schema, void **pplan)
+{
+    ASSERT(schema);
+    ASSERT(pplan);
+
+    int32_t num_point = 0;
+    modbus_read_plan_t *plan = (modbus_read_plan_t *)CALLOC(1, sizeof(modbus_read_plan_t));
+
+    // only points of groups plan is created for
+    modbus_plan_entry_t *entries = (modbus_plan_entry_t *)MALLOC(MAX(schema->num_read_point, 1) * sizeof(modbus_plan_entry_t));
+    for (int i = 0; i < schema->num_read_point; i++) {
+        if (!IN_POINT_GROUPS(schema, schema->plan_groups, i)) {
+            continue;
+        }
+        entries[num_point].reg_type = schema->points[i].d.modbus.reg_type;
+        entries[num_point].addr = schema->points[i].d.modbus.addr;
+        entries[num_point].index = i;
+        num_point++;
+    }
+
+    if (num_point == 0) {
+        FREE(entries);
+        *pplan = plan;
+        return DEVICE_OK;
+    }
+    qsort(entries, num_point, sizeof(modbus_plan_entry_t), compare_plan_entry);
+
+    // worst case one block and one run per point
+    plan->blocks = (modbus_read_block_t *)CALLOC(num_point, sizeof(modbus_read_block_t));
+    plan->runs = (modbus_decode_run_t *)CALLOC(num_point, sizeof(modbus_decode_run_t));
+    plan->ops = (modbus_decode_op_t *)MALLOC(num_point * sizeof(modbus_decode_op_t));
+
+    int32_t max_gap = calc_max_gap(schema);
+    modbus_read_block_t *block = NULL;
+    uint32_t block_end = 0;
+
+    // greedy on sorted points give minimum number of requests under gap and
+    // quantity limit
+    for (int j = 0; j < num_point; j++) {
+        modbus_point_t *mp = &schema->points[entries[j].index].d.modbus;
+        uint32_t point_end = (uint32_t)mp->addr + num_reg(mp);
+        int32_t max_quantity =
+            (mp->reg_type == COIL || mp->reg_type == DISCRETE_INPUT) ? MODBUS_MAX_BIT_PER_READ : MODBUS_MAX_WORD_PER_READ;
+
+        entries[j].kernel = modbus_decode_kernel(mp->reg_type, mp->data_type);
+
+        if (point_end > 0x10000 || entries[j].kernel == KERNEL_INVALID) {
+            LOGE("Point %s out of address range or of unknown type", schema->points[entries[j].index].key);
+            FREE(entries);
+            modbus_destroy_read_plan(plan);
+            return DEVICE_E_CONFIG;
+        }
+
+        bool fit = block && (block->reg_type == mp->reg_type) &&
+                   ((int32_t)mp->addr - (int32_t)block_end <= max_gap) &&
+                   ((int32_t)(MAX(block_end, point_end) - block->addr) <= max_quantity);
+
+        if (!fit) {
+            block = &plan->blocks[plan->num_block++];
+            block->reg_type = mp->reg_type;
+            block->addr = mp->addr;
+            block_end = mp->addr;
+        }
+
+        block_end = MAX(block_end, point_end);
+        block->quantity = block_end - block->addr;
+        entries[j].block = plan->num_block - 1;
+        plan->cached |= point_max_age(schema, &schema->points[entries[j].index]) > 0;
+    }
+
+    // compile decode program, points of a block with same kernel are decoded
+    // by one run, split so a run can be decoded onto stack
+    qsort(entries, num_point, sizeof(modbus_plan_entry_t), compare_decode_entry);
+
+    modbus_decode_run_t *run = NULL;
+    for (int j = 0; j < num_point; j++) {
+        modbus_point_t *mp = &schema->points[entries[j].index].d.modbus;
+        block = &plan->blocks[entries[j].block];
+
+        if (!run || run->kernel != entries[j].kernel || run->count == MODBUS_DECODE_MAX_RUN ||
+            entries[j - 1].block != entries[j].block) {
+            if (block->num_run == 0) {
+                block->first_run = plan->num_run;
+            }
+            block->num_run++;
+            run = &plan->runs[plan->num_run++];
+            run->kernel = entries[j].kernel;
+            run->first = j;
+            run->count = 0;
+        }
+
+        modbus_decode_op_init(&plan->ops[j], mp->addr - block->addr, mp->bit_offset, entries[j].index,
+                              mp->value_offset, mp->scale);
+        run->count++;
+    }
+
+    FREE(entries);
+
+    LOGI("Schema %s: %d points in %d read requests, %d decode runs", schema->name, num_point, plan->num_block,
+         plan->num_run);
+
+    *pplan = plan;
+    return DEVICE_OK;
+}
+
+
+void modbus_destroy_read_plan(void *plan)
+{
+    modbus_read_plan_t *self = (modbus_read_plan_t *)plan;
+    ASSERT(self);
+
+    FREE(self->blocks);
+    FREE(self->runs);
+    FREE(self->ops);
+    FREE(self);
+}
+
+
 
 // modbus connection string will be in two format
 // for modbus tcp, "unitid,<ip>""
@@ -1094,10 +1914,16 @@ device_driver_t *modbus_create_driver(device_protocol_t protocol, const char *co
     modbus->base.get_point = modbus_get_point;
     modbus->base.get_point_list = modbus_get_point_list;
     modbus->base.set_point = modbus_set_point;
+    modbus->base.set_point_list = modbus_set_point_list;
     modbus->base.get_protocol = modbus_get_protocol;
     modbus->protocol = protocol;
 
     modbus->opened = false;
+    pthread_mutex_init(&modbus->cache_lock, NULL);
+    modbus->cache = NULL;
+
+    modbus->conn_hash = hash((const unsigned char *)conn_str, strlen(conn_str));
+    load_read_limits(modbus);
 
     modbus->transport = modbus_create_transport(protocol, conn_str);
 
@@ -1113,6 +1939,43 @@ device_driver_t *modbus_create_driver(device_protocol_t protocol, const char *co
 }
 
 
+void modbus_keep_cache(device_driver_t *instance, bool keep)
+{
+    modbus_device_t *self = (modbus_device_t*)instance;
+    ASSERT(self);
+
+    self->keep_cache = keep;
+}
+
+
+err_code modbus_read_cache(device_driver_t *instance, uint32_t unit_id, uint8_t function_code, uint16_t addr,
+                           uint16_t quantity, int32_t max_age_ms, uint16_t *regs)
+{
+    modbus_device_t *self = (modbus_device_t*)instance;
+    ASSERT(self);
+
+    uint8_t reg_type;
+    switch (function_code) {
+    case FC_READ_COILS:
+        reg_type = COIL;
+        break;
+    case FC_READ_DISCRETE_INPUTS:
+        reg_type = DISCRETE_INPUT;
+        break;
+    case FC_READ_INPUT_REGISTERS:
+        reg_type = INPUT_REGISTER;
+        break;
+    case FC_READ_HOLDING_REGISTERS:
+        reg_type = HOLDING_REGISTER;
+        break;
+    default:
+        return DEVICE_E_INVALID;
+    }
+
+    return cache_load_range(self, unit_id, reg_type, addr, quantity, max_age_ms, regs);
+}
+
+
 void modbus_destroy_driver(device_driver_t *instance)
 {
     modbus_device_t *self = (modbus_device_t*)instance;
@@ -1123,5 +1986,7 @@ void modbus_destroy_driver(device_driver_t *instance)
     if (self->transport) {
         modbus_destroy_transport(self->protocol, self->transport);
     }
+    cache_destroy(self);
+    pthread_mutex_destroy(&self->cache_lock);
     FREE(self);
 }
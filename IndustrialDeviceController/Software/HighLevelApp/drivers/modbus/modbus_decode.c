@@ -0,0 +1,125 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include "modbus_decode.h"
+
+typedef void (*decode_kernel_fn)(const modbus_decode_op_t *ops, int32_t count, const uint16_t *regs, double *values);
+
+// measured_value = (register_value - value_offset) / scale, raw has offset
+// applied already as integer types subtract it differently
+static inline double scale_value(const modbus_decode_op_t *op, double raw)
+{
+    if (op->scale != 1) {
+        raw /= op->scale;
+        // If value is -0, set to be 0
+        if (fabs(raw) < DBL_EPSILON)
+            raw = 0;
+    }
+    return raw;
+}
+
+static inline float to_float(uint32_t u32)
+{
+    float f;
+    memcpy(&f, &u32, sizeof(f));
+    return f;
+}
+
+// r point to first register of op
+#define DECODE_KERNEL(name, expr)                                                                                      \
+    static void name(const modbus_decode_op_t *ops, int32_t count, const uint16_t *regs, double *values)              \
+    {                                                                                                                  \
+        for (int32_t k = 0; k < count; k++) {                                                                          \
+            const modbus_decode_op_t *op = &ops[k];                                                                    \
+            const uint16_t *r = regs + op->reg;                                                                        \
+            values[k] = scale_value(op, (expr));                                                                       \
+        }                                                                                                              \
+    }
+
+DECODE_KERNEL(decode_bit_coil, (r[0] ? 1.0 : 0.0) - op->value_offset)
+DECODE_KERNEL(decode_bit_register, ((r[0] & (1 << op->bit_offset)) ? 1.0 : 0.0) - op->value_offset)
+DECODE_KERNEL(decode_byte, (double)((uint8_t)(r[0] >> op->bit_offset) - op->value_offset))
+DECODE_KERNEL(decode_int16, (double)(int16_t)r[0] - op->value_offset)
+DECODE_KERNEL(decode_uint16, (double)r[0] - op->value_offset)
+DECODE_KERNEL(decode_int32_be, (double)(int32_t)(((uint32_t)r[0] << 16) + r[1]) - op->value_offset)
+DECODE_KERNEL(decode_int32_le, (double)(int32_t)(((uint32_t)r[1] << 16) + r[0]) - op->value_offset)
+DECODE_KERNEL(decode_uint32_be, (double)(((uint32_t)r[0] << 16) + r[1]) - op->value_offset)
+DECODE_KERNEL(decode_uint32_le, (double)(((uint32_t)r[1] << 16) + r[0]) - op->value_offset)
+DECODE_KERNEL(decode_float_be, (double)to_float(((uint32_t)r[0] << 16) + r[1]) - op->value_offset)
+DECODE_KERNEL(decode_float_le, (double)to_float(((uint32_t)r[1] << 16) + r[0]) - op->value_offset)
+DECODE_KERNEL(decode_int64_be, (double)((int64_t)(((uint64_t)r[0] << 48) + ((uint64_t)r[1] << 32) +
+                                                  ((uint64_t)r[2] << 16) + r[3]) - op->value_offset))
+DECODE_KERNEL(decode_int64_le, (double)((int64_t)(((uint64_t)r[3] << 48) + ((uint64_t)r[2] << 32) +
+                                                  ((uint64_t)r[1] << 16) + r[0]) - op->value_offset))
+
+static const decode_kernel_fn KERNELS[KERNEL_COUNT] = {
+    [KERNEL_BIT_COIL] = decode_bit_coil,
+    [KERNEL_BIT_REGISTER] = decode_bit_register,
+    [KERNEL_BYTE] = decode_byte,
+    [KERNEL_INT16] = decode_int16,
+    [KERNEL_UINT16] = decode_uint16,
+    [KERNEL_INT32_BE] = decode_int32_be,
+    [KERNEL_INT32_LE] = decode_int32_le,
+    [KERNEL_UINT32_BE] = decode_uint32_be,
+    [KERNEL_UINT32_LE] = decode_uint32_le,
+    [KERNEL_FLOAT_BE] = decode_float_be,
+    [KERNEL_FLOAT_LE] = decode_float_le,
+    [KERNEL_INT64_BE] = decode_int64_be,
+    [KERNEL_INT64_LE] = decode_int64_le,
+};
+
+
+int8_t modbus_decode_kernel(uint8_t reg_type, uint8_t data_type)
+{
+    switch (data_type) {
+    case TYPE_BIT:
+        return (reg_type == COIL || reg_type == DISCRETE_INPUT) ? KERNEL_BIT_COIL : KERNEL_BIT_REGISTER;
+    case TYPE_BYTE:
+        return KERNEL_BYTE;
+    case TYPE_INT16:
+        return KERNEL_INT16;
+    case TYPE_UINT16:
+        return KERNEL_UINT16;
+    case TYPE_INT32_BE:
+        return KERNEL_INT32_BE;
+    case TYPE_INT32_LE:
+        return KERNEL_INT32_LE;
+    case TYPE_UINT32_BE:
+        return KERNEL_UINT32_BE;
+    case TYPE_UINT32_LE:
+        return KERNEL_UINT32_LE;
+    case TYPE_FLOAT_BE:
+        return KERNEL_FLOAT_BE;
+    case TYPE_FLOAT_LE:
+        return KERNEL_FLOAT_LE;
+    case TYPE_INT64_BE:
+        return KERNEL_INT64_BE;
+    case TYPE_INT64_LE:
+        return KERNEL_INT64_LE;
+    default:
+        return KERNEL_INVALID;
+    }
+}
+
+
+void modbus_decode_op_init(modbus_decode_op_t *op, uint16_t reg, uint8_t bit_offset, int32_t index,
+                           int32_t value_offset, float scale)
+{
+    op->reg = reg;
+    op->bit_offset = bit_offset;
+    op->index = index;
+    op->value_offset = value_offset;
+    // same tolerance as is_double_equal(), so kernels compare exactly
+    op->scale = (fabs(scale - 1.0) < DBL_EPSILON) ? 1 : scale;
+}
+
+
+void modbus_decode_run(int8_t kernel, const modbus_decode_op_t *ops, int32_t count, const uint16_t *regs,
+                       double *values)
+{
+    KERNELS[kernel](ops, count, regs, values);
+}
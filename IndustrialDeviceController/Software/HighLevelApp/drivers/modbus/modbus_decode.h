@@ -0,0 +1,121 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Point decoding, compiled when read plan is built. Points are grouped by
+// decode kernel, one per data type and word order, and each kernel decodes
+// its run of points with a loop free of per point branching on type. Kept
+// free of SDK headers so it can be benchmarked on host.
+
+// max points of one run, so caller can decode a run onto stack
+#define MODBUS_DECODE_MAX_RUN 64
+
+// intentionally to make it align with the address number.
+// register number  Data Addresses  Table Name
+// 000001 - 065536	0000 - FFFF 	Discrete Output Coils
+// 100001 - 165536	0000 - FFFF 	Discrete Input Contacts
+// 300001 - 365536	0000 - FFFF 	Analog Input Registers
+// 400001 - 465536	0000 - FFFF 	Analog Output Holding Registers
+enum {
+    COIL = 0,
+    DISCRETE_INPUT = 1,
+    INVALID = 2,
+    INPUT_REGISTER = 3,
+    HOLDING_REGISTER= 4
+};
+
+// modbus protocol only defined two data type, bit (bool) or register (uint16)
+// OEM defined more data type based on register like int32,uint32, float etc.
+// This require additional decoding when getting a data point.
+// In this code, we refer to raw bit/register value as "value" while deoded data
+// as "point"
+enum {
+    TYPE_INVALID,
+    TYPE_BIT,
+    TYPE_BYTE,
+    TYPE_INT16,
+    TYPE_UINT16,
+    TYPE_INT32_BE, // 0x1234 as [0] = 0x12, [1] = 0x34
+    TYPE_INT32_LE, // 0x1234 as [0] = 0x34, [1] = 0x12
+    TYPE_UINT32_BE,
+    TYPE_UINT32_LE,
+    TYPE_FLOAT_BE,
+    TYPE_FLOAT_LE,
+    TYPE_INT64_BE, //0x12345678 as [0]=0x12, [1]=0x34, [2]=0x56, [3]=0x78
+    TYPE_INT64_LE, //0x12345678 as [0]=0x78, [1]=0x56, [2]=0x34, [3]=0x12
+};
+
+// decode kernels, bit of register and bit of coil decode differently
+enum {
+    KERNEL_INVALID = -1,
+    KERNEL_BIT_COIL,
+    KERNEL_BIT_REGISTER,
+    KERNEL_BYTE,
+    KERNEL_INT16,
+    KERNEL_UINT16,
+    KERNEL_INT32_BE,
+    KERNEL_INT32_LE,
+    KERNEL_UINT32_BE,
+    KERNEL_UINT32_LE,
+    KERNEL_FLOAT_BE,
+    KERNEL_FLOAT_LE,
+    KERNEL_INT64_BE,
+    KERNEL_INT64_LE,
+    KERNEL_COUNT
+};
+
+// one point to decode
+typedef struct modbus_decode_op_t modbus_decode_op_t;
+struct modbus_decode_op_t {
+    // first register of point, relative to registers decoded
+    uint16_t reg;
+    uint8_t bit_offset;
+    // point index in schema
+    int32_t index;
+    int32_t value_offset;
+    // 1 if point is not scaled
+    double scale;
+};
+
+// points of one kernel, ops[first, first + count)
+typedef struct modbus_decode_run_t modbus_decode_run_t;
+struct modbus_decode_run_t {
+    int8_t kernel;
+    int32_t first;
+    int32_t count;
+};
+
+/**
+ * get decode kernel of a point
+ * @param reg_type register type of point
+ * @param data_type data type of point
+ * @return kernel, or KERNEL_INVALID if data type is unknown
+ */
+int8_t modbus_decode_kernel(uint8_t reg_type, uint8_t data_type);
+
+/**
+ * fill decode op of a point
+ * @param op op to fill
+ * @param reg first register of point, relative to registers decoded
+ * @param bit_offset bit offset of point in register
+ * @param index point index in schema
+ * @param value_offset offset subtracted from raw value
+ * @param scale multiplier raw value is divided by
+ */
+void modbus_decode_op_init(modbus_decode_op_t *op, uint16_t reg, uint8_t bit_offset, int32_t index,
+                           int32_t value_offset, float scale);
+
+/**
+ * decode points of one kernel to measured value
+ * @param kernel kernel of points
+ * @param ops points to decode
+ * @param count number of points, at most MODBUS_DECODE_MAX_RUN
+ * @param regs registers ops are relative to
+ * @param values out parameter receive measured value of ops in order
+ */
+void modbus_decode_run(int8_t kernel, const modbus_decode_op_t *ops, int32_t count, const uint16_t *regs,
+                       double *values);
@@ -6,6 +6,7 @@
 
 #include "modbus_transport.h"
 #include "modbus_transport_rtu.h"
+#include "modbus_transport_sim.h"
 #include "modbus_transport_tcp.h"
 
 
@@ -20,6 +21,11 @@ modbus_transport_t *modbus_create_transport(device_protocol_t protocol, const ch
 {
     ASSERT(conn_str);
 
+    // simulated slaves stand in for either protocol
+    if (modbus_transport_sim_match(conn_str)) {
+        return modbus_transport_sim_create(conn_str);
+    }
+
     switch (protocol) {
     case DEVICE_PROTOCOL_MODBUS_TCP:
         return modbus_transport_tcp_create(conn_str);
@@ -36,6 +42,11 @@ void modbus_destroy_transport(device_protocol_t protocol, modbus_transport_t *tr
 {
     ASSERT(transport);
 
+    if (modbus_transport_is_sim(transport)) {
+        modbus_transport_sim_destroy(transport);
+        return;
+    }
+
     switch (protocol) {
     case DEVICE_PROTOCOL_MODBUS_RTU:
         modbus_transport_rtu_destroy(transport);
@@ -8,6 +8,10 @@
 
 typedef struct modbus_transport_t modbus_transport_t;
 struct modbus_transport_t {
+    // max number of requests allowed to be sent before receiving response,
+    // responses are always returned in request order
+    int32_t max_outstanding;
+
     // open the transport channel, return error code
     err_code (*transport_open)(modbus_transport_t *instance, int32_t timeout_ms);
 
@@ -18,9 +22,12 @@ struct modbus_transport_t {
     err_code (*send_request)(modbus_transport_t *instance, uint8_t id, const uint8_t *pdu, int32_t pdu_len,
                              int32_t timeout);
 
-    // recv pdu for pervious request, return error code
+    // recv pdu for earliest outstanding request, return error code
     err_code (*recv_response)(modbus_transport_t *instance, uint8_t id, uint8_t *pdu, int32_t *ppdu_len,
                               int32_t timeout);
+
+    // forget all outstanding requests, late responses for them will be dropped
+    void (*cancel_requests)(modbus_transport_t *instance);
 };
 
 
@@ -4,7 +4,6 @@
 #include <applibs/gpio.h>
 #include <applibs/application.h>
 #include <math.h>
-#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,11 +26,50 @@
 
 #include "modbus_transport.h"
 #include "modbus_transport_rtu.h"
+#include "modbus_transport_sim.h"
 
 // Note: Modbus RTU only support one outgoing transcation, so everything
 // is serialized, for Sphere to talking to multiple modbus rtu device (e.g. two
 // device A, B, the sequence will be
 // req1A, resp1A, req2A, resp2A, req1B, resp1B, req2B, resp2B.
+//
+// Framing, T3.5 timing and CRC are done on RT core, each request/response
+// exchange is one IPC_MODBUS_TRANSACT, so requests are only queued in
+// send_request and exchanged in recv_response. Up to MODBUS_RTU_MAX_BATCH
+// queued requests go in one IPC_BATCH so one mailbox round trip serve them.
+//
+// Uart config followed by ",sim:<options>" has RT core simulate the slaves on
+// ISU1, wired to ISU0, so the whole path is exercised without real devices.
+
+// response time history of one slave on the bus
+typedef struct rtu_slave_stats_t rtu_slave_stats_t;
+struct rtu_slave_stats_t {
+    uint8_t slave_id;
+    // ring buffer of response time in ms
+    uint16_t samples[MODBUS_RTU_LATENCY_SAMPLES];
+    int32_t num_sample;
+    int32_t next_sample;
+    int32_t p50_ms;
+    int32_t p99_ms;
+    int32_t num_timeout;
+    // consecutive timeouts on timeout derived from samples
+    int32_t fast_timeouts;
+    rtu_slave_stats_t *next;
+};
+
+// request queued until exchanged with RT core, then hold its response
+typedef struct rtu_request_t rtu_request_t;
+struct rtu_request_t {
+    // IPC_MODBUS_TRANSACT data, 4 bytes timeout followed by slave id and pdu
+    uint8_t data[4 + MB_RTU_MAX_ADU_SIZE];
+    int32_t adu_len;
+    // timeout derived from slave stats been used
+    bool fast;
+    int32_t model_timeout;
+    err_code code;
+    uint8_t pdu[MODBUS_MAX_PDU_SIZE];
+    int32_t pdu_len;
+};
 
 typedef struct modbus_transport_rtu_t modbus_transport_rtu_t;
 struct modbus_transport_rtu_t {
@@ -41,289 +79,167 @@ struct modbus_transport_rtu_t {
     int uart_port;
     int uart_tx_enable_fd;
     int t35_ms;
-    int t35_adjust_times;
     UART_Config uart_config;
+
+    // ring of outstanding requests, first num_exchanged ones from head
+    // already have response
+    rtu_request_t requests[MODBUS_RTU_MAX_BATCH];
+    int32_t head;
+    int32_t num_request;
+    int32_t num_exchanged;
+    rtu_slave_stats_t *slave_stats;
+
+    // slaves simulated by RT core while connection is open
+    bool sim;
+    modbus_sim_config_t sim_config;
 };
 
-static int rtu_ensure_idle(modbus_transport_rtu_t* ctx, int32_t timeout)
+static rtu_slave_stats_t *rtu_find_slave_stats(modbus_transport_rtu_t *ctx, uint8_t slave_id)
 {
-    struct timespec poll_sw;
-    timer_stopwatch_start(&poll_sw);
-
-    struct pollfd fds[1];
-    fds[0].fd = ctx->rtcore_socket_fd;
-    fds[0].events = POLLIN;
-
-    bool quit = false;
-    uint8_t garbage[MB_RTU_MAX_ADU_SIZE];
-
-    while (!quit) {
-        int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
-
-        if (elapse_ms >= timeout) {
-            quit = true;
-            continue;
-        }
-
-        int nevents = poll(fds, 1, ctx->t35_ms);
-        if (nevents == 0) {
-            // no data on rtu
-            return 0;
-        } else if ((nevents == 1) && (fds[0].revents & POLLIN)) {
-            // Read garbage data in uart buffer up to one frame of 256 bytes.
-            int count = UART_read(ctx->uart_fd, garbage, MB_RTU_MAX_ADU_SIZE);
-            LOGD("Consume garbage data: read %d byes of garbage on RTU", count);
-            LOGD("Garbage data <--%s", hex(garbage, count));
-        } else {
-            LOGE("Uart poll error in rtu_ensure_idle");
-            quit = true;
+    for (rtu_slave_stats_t *stats = ctx->slave_stats; stats; stats = stats->next) {
+        if (stats->slave_id == slave_id) {
+            return stats;
         }
     }
 
-    return -1;
+    rtu_slave_stats_t *stats = (rtu_slave_stats_t *)CALLOC(1, sizeof(rtu_slave_stats_t));
+    stats->slave_id = slave_id;
+    stats->next = ctx->slave_stats;
+    ctx->slave_stats = stats;
+    return stats;
 }
 
-static uint16_t crc16(const uint8_t *buffer, int32_t len)
+/// <summary>
+/// record response time of one request and update percentiles
+/// </summary>
+/// <param name="stats">stats of slave responded</param>
+/// <param name="response_ms">time from request sent to response received</param>
+static void rtu_add_latency_sample(rtu_slave_stats_t *stats, int32_t response_ms)
 {
-    uint16_t temp, flag;
-    temp = 0xFFFF;
-    for (int32_t i = 0; i < len; i++) {
-        temp = temp ^ buffer[i];
-
-        for (int j = 1; j <= 8; j++) {
-            flag = temp & 0x0001;
-            temp >>= 1;
-
-            if (flag) {
-                temp ^= 0xA001;
-            }
+    stats->samples[stats->next_sample] = response_ms > UINT16_MAX ? UINT16_MAX : response_ms;
+    stats->next_sample = (stats->next_sample + 1) % MODBUS_RTU_LATENCY_SAMPLES;
+    if (stats->num_sample < MODBUS_RTU_LATENCY_SAMPLES) {
+        stats->num_sample++;
+    }
+
+    // insertion sort on copy, history is short
+    uint16_t sorted[MODBUS_RTU_LATENCY_SAMPLES];
+    for (int32_t i = 0; i < stats->num_sample; i++) {
+        int32_t j = i;
+        while (j > 0 && sorted[j - 1] > stats->samples[i]) {
+            sorted[j] = sorted[j - 1];
+            j--;
         }
+        sorted[j] = stats->samples[i];
     }
 
-    return temp;
+    // nearest rank
+    stats->p50_ms = sorted[(stats->num_sample * 50 + 99) / 100 - 1];
+    stats->p99_ms = sorted[(stats->num_sample * 99 + 99) / 100 - 1];
 }
 
 /// <summary>
-/// try to write RTU frame over uart connection, timeout in MB_RTU_WRITE_TIMEOUT_MS
+/// response timeout derived from slave response time history
 /// </summary>
 /// <param name="ctx">RTU transportion instance</param>
-/// <param name="buf">buffer to send</param>
-/// <param name="count">count of bytes to send</param>
-/// <param name="timeout">the value of timer in ms for this operation</param>
-/// <returns>error code</returns>
-static err_code rtu_write_frame(modbus_transport_rtu_t *ctx, uint8_t *buf, int32_t count, int32_t timeout)
+/// <param name="stats">stats of slave to be waited</param>
+/// <returns>timeout in ms since request sent, or -1 if not enough history</returns>
+static int32_t rtu_model_timeout(modbus_transport_rtu_t *ctx, const rtu_slave_stats_t *stats)
 {
-    err_code result = ipc_execute_command(ctx->rtcore_socket_fd, IPC_WRITE_UART, buf, count);
-    if (DEVICE_OK != result) {
-        LOGE("ERROR: Could not write bytes to UART on the real-time core with erro code: %d", result);
+    if (stats->num_sample < MODBUS_RTU_LATENCY_MIN_SAMPLES) {
+        return -1;
     }
 
-    return result;
+    int32_t timeout = stats->p99_ms * MODBUS_RTU_TIMEOUT_FACTOR + 2 * ctx->t35_ms;
+    return timeout > MODBUS_RTU_MIN_TIMEOUT_MS ? timeout : MODBUS_RTU_MIN_TIMEOUT_MS;
 }
 
-/// <summary>
-/// try to find pdu len from first two bytes of pdu
-/// </summary>
-/// <param name="pdu">pdu</param>
-/// <returns>pdu length or 0 if unknown</returns>
-static int32_t modbus_find_pdu_len(uint8_t *pdu)
+static void rtu_report_slave_stats(const rtu_slave_stats_t *stats)
 {
-    // it's error response, pdu is two bytes
-    if (pdu[0] & 0x80) {
-        return 2;
-    }
-
-    int32_t length = 0;
-
-    switch (pdu[0]) {
-    case FC_READ_COILS:
-    case FC_READ_DISCRETE_INPUTS:
-    case FC_READ_HOLDING_REGISTERS:
-    case FC_READ_INPUT_REGISTERS:
-        // 1 byte function code + 1 byte byte count + n bytes values
-        length = 2 + pdu[1];
-        break;
-
-    case FC_WRITE_COILS:
-    case FC_WRITE_HOLDING_REGISTERS:
-    case FC_WRITE_SINGLE_COIL:
-    case FC_WRITE_SINGLE_REGISTER:
-        // 1 byte function code + 2 bytes start addr, 2 byte quantity
-        length = 5;
-        break;
-
-    case FC_READ_EXCEPTION_STATUS:
-        // 1 byte function code + 1 byte output data
-        length = 2;
-        break;
-
-    case FC_DIAGNOSTICS:
-        // 1 byte function code, 2 byte sub-function , 2 bytes data
-        length = 5;
-        break;
-
-    case FC_GET_COMM_EVENT_COUNTER:
-        // 1 byte function code, 2 byte status, 2 bytes event count
-        length = 5;
-        break;
-
-    case FC_GET_COMM_EVENT_LOG:
-        length = 2 + pdu[1];
-        break;
-
-    case FC_REPORT_SERVER_ID:
-        length = 5;
-        break;
-
-    case FC_READ_FILE_RECORD:
-    case FC_WRITE_FILE_RECORD:
-        length = 2 + pdu[1];
-        break;
-
-    case FC_MASK_WRITE_REGISTER:
-        length = 7;
-        break;
-
-    case FC_READ_WRITE_REGISTERS:
-        length = 2 + pdu[1];
-        break;
-
-    case FC_READ_FIFO_QUEUE:
-        length = 2 + pdu[1];
-        break;
-
-    case FC_MEI:
-        // FC_MEI is not supported now as the pdu lenth cann't be found
-        // in pdu and not fixed.
-    default:
-        length = -1;
-        break;
-    }
-
-    return length;
+    char key[TELEMETRY_MAX_KEY_SIZE];
+
+    snprintf(key, sizeof(key), MODBUS_RTU_LATENCY_DATAPOINT, stats->slave_id, "P50");
+    diag_log_value(key, stats->p50_ms);
+    snprintf(key, sizeof(key), MODBUS_RTU_LATENCY_DATAPOINT, stats->slave_id, "P99");
+    diag_log_value(key, stats->p99_ms);
+    snprintf(key, sizeof(key), MODBUS_RTU_LATENCY_DATAPOINT, stats->slave_id, "TIMEOUT");
+    diag_log_value(key, stats->num_timeout);
 }
 
-/// <summary>
-/// try to receied count bytes over uart connection, timeout in MB_RTU_IO_TIMEOUT_MS
-/// </summary>
-/// <param name="ctx">RTU transportion instance</param>
-/// <param name="buf">buffer to receive data</param>
-/// <param name="count">count of bytes to receive</param>
-/// <param name="timeout">the value of timer in ms for this operation</param>
-/// <returns>error code</returns>
-static err_code rtu_read_bytes(modbus_transport_rtu_t *ctx, uint8_t *buf, int32_t length, int32_t *count, int32_t timeout)
+static void rtu_update_slave_stats(modbus_transport_rtu_t *ctx, const rtu_request_t *request, int32_t response_ms)
 {
-    err_code err = DEVICE_OK;
-    int total = 0;
-    struct timespec poll_sw;
-    struct pollfd fds[1];
-    fds[0].fd = ctx->rtcore_socket_fd;
-    fds[0].events = POLLIN;
-    timer_stopwatch_start(&poll_sw);
-
-    while (total < *count) {
-        int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
-
-        if (elapse_ms >= timeout) {
-            err = DEVICE_E_TIMEOUT;
-            break;
-        }
-
-        int nevents = poll(fds, 1, timeout - elapse_ms);
-
-        if (nevents < 0) {
-            LOGE("uart poll in error");
-            err = DEVICE_E_IO;
-            break;
-        } else if (nevents == 0) {
-            err = DEVICE_E_TIMEOUT;
-            break;
-        } else {
-            if (fds[0].revents & POLLHUP) {
-                LOGE("uart connection broken");
-                err = DEVICE_E_BROKEN;
-                break;
-            } else if (fds[0].revents & POLLERR) {
-                LOGE("uart poll error");
-                err = DEVICE_E_IO;
-                break;
-            } else if (fds[0].revents & POLLIN) {
-                int nread = recv(fds[0].fd, buf + total, length - total, 0);
-
-                if (nread < 0) {
-                    LOGE("uart read error");
-                    err = DEVICE_E_IO;
-                    break;
-                }
-
-                total += nread;
-            }
+    uint8_t slave_id = request->data[4];
+    rtu_slave_stats_t *stats = rtu_find_slave_stats(ctx, slave_id);
+
+    if (request->code == DEVICE_E_TIMEOUT) {
+        stats->num_timeout++;
+        // slave may just become slower, forget history and learn again
+        if (request->fast && (++stats->fast_timeouts >= MODBUS_RTU_MAX_FAST_TIMEOUTS)) {
+            LOGW("Slave %d timeout %d times in %dms, reset response time model", slave_id, stats->fast_timeouts,
+                 request->model_timeout);
+            stats->num_sample = 0;
+            stats->next_sample = 0;
+            stats->fast_timeouts = 0;
         }
+        rtu_report_slave_stats(stats);
+    } else if (request->code == DEVICE_OK) {
+        stats->fast_timeouts = 0;
+        rtu_add_latency_sample(stats, response_ms);
+        rtu_report_slave_stats(stats);
     }
-
-    *count = total;
-    return err;
 }
 
 /// <summary>
-/// try to receie one RTU frame over uart connection
+/// exchange all queued requests with RT core, in one batch if more than one
 /// </summary>
 /// <param name="ctx">RTU transportion instance</param>
-/// <param name="buf">buffer to receive one frame of MB_RTU_MAX_ADU_SIZE bytes</param>
-/// <param name="fbytes">bytes of received frame</param>
 /// <param name="timeout">the value of timer in ms for this operation</param>
-/// <returns>error code</returns>
-static err_code rtu_read_frame(modbus_transport_rtu_t *ctx, uint8_t *buf, int32_t length, int32_t *frame_bytes, int32_t timeout)
+static void rtu_exchange_requests(modbus_transport_rtu_t *ctx, int32_t timeout)
 {
-    // Find pdu len is tricky as we need to parse pdu to figure out
-    // read first three bytes of adu
-    struct timespec poll_sw;
-    timer_stopwatch_start(&poll_sw);
-    int32_t received_bytes = MB_RTU_HEADER_SIZE;
-    err_code err = rtu_read_bytes(ctx, buf, length, &received_bytes, timeout);
-
-    if (err) {
-        return err;
-    }
-
-    LOGD("PDU header <--%s", hex(buf, MB_RTU_HEADER_SIZE));
-    int32_t pdu_len = modbus_find_pdu_len(buf + 1);
-
-    if ((pdu_len <= 0) || (pdu_len > MB_RTU_MAX_ADU_SIZE - 3)) {
-        LOGE("Invalid pdu len %d", pdu_len);
-        return DEVICE_E_PROTOCOL;
-    }
-
-    // 1 byte slave_id + pdu + 2 bytes crc
-    *frame_bytes = 1 + pdu_len + 2;
-    int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
-
-    if (elapse_ms >= timeout) {
-        return DEVICE_E_TIMEOUT;
+    // no response can be back before gaps around request and response, a
+    // shorter wait, e.g. what remains of an almost expired device timeout,
+    // would time out at once
+    timeout = MAX(timeout, 2 * ctx->t35_ms);
+
+    ipc_command_t commands[MODBUS_RTU_MAX_BATCH];
+    struct timespec exchange_sw;
+    timer_stopwatch_start(&exchange_sw);
+
+    for (int32_t i = 0; i < ctx->num_request; i++) {
+        rtu_request_t *request = &ctx->requests[(ctx->head + i) % MODBUS_RTU_MAX_BATCH];
+
+        // fail fast on a slave known to respond much quicker than caller's timeout
+        request->model_timeout = rtu_model_timeout(ctx, rtu_find_slave_stats(ctx, request->data[4]));
+        request->fast = (request->model_timeout >= 0) && (request->model_timeout < timeout);
+        serialize_uint32(request->data, request->fast ? request->model_timeout : timeout);
+
+        commands[i].command = IPC_MODBUS_TRANSACT;
+        commands[i].data = request->data;
+        commands[i].len = 4 + request->adu_len;
+        commands[i].resp = request->pdu;
     }
 
-    if (*frame_bytes == received_bytes) {
-        return DEVICE_OK;
+    if (ctx->num_request == 1) {
+        rtu_request_t *request = &ctx->requests[ctx->head];
+        request->code = ipc_modbus_transact(ctx->rtcore_socket_fd, request->data + 4, request->adu_len, request->pdu,
+                                            &request->pdu_len, dserialize_uint32(request->data));
     } else {
-        pdu_len = *frame_bytes - received_bytes;
-        return rtu_read_bytes(ctx, buf + received_bytes, length - received_bytes, &pdu_len, timeout - elapse_ms);
+        err_code err = ipc_execute_batch(ctx->rtcore_socket_fd, commands, ctx->num_request, timeout);
+        for (int32_t i = 0; i < ctx->num_request; i++) {
+            rtu_request_t *request = &ctx->requests[(ctx->head + i) % MODBUS_RTU_MAX_BATCH];
+            request->code = err ? err : commands[i].code;
+            request->pdu_len = commands[i].resp_len;
+        }
     }
-}
-
-/// <summary>
-/// Adjust t35 timer if fail to get modbus response as time out.
-/// </summary>
-/// <param name="ctx">RTU transportion instance</param>
-/// <param name="code">error code</param>
-static void rtu_adjust_t35(modbus_transport_rtu_t* ctx, err_code code)
-{
-    // only adjust t35 if time out
-    if (DEVICE_E_TIMEOUT == code && ctx->t35_adjust_times > 0) {
-        ctx->t35_ms += MODBUS_T35_ADJUST_STEP;
-        ctx->t35_adjust_times -= 1;
 
-        LOGD("Try T3.5=%dms for next request", ctx->t35_ms);
+    // exchanges on RT core are back to back, attribute time evenly
+    int32_t response_ms = timer_stopwatch_stop(&exchange_sw) / ctx->num_request;
+    for (int32_t i = 0; i < ctx->num_request; i++) {
+        rtu_update_slave_stats(ctx, &ctx->requests[(ctx->head + i) % MODBUS_RTU_MAX_BATCH], response_ms);
     }
+
+    diag_log_value(MODBUS_T35_DATAPOINT, ctx->t35_ms);
+    ctx->num_exchanged = ctx->num_request;
 }
 
 // ------------------------ public interface --------------------------------
@@ -352,7 +268,7 @@ err_code rtu_open(modbus_transport_t *instance, int32_t timeout_ms)
     setsockopt(ctx->rtcore_socket_fd, SOL_SOCKET, SO_SNDTIMEO, &rt_timeout, sizeof(rt_timeout));
     setsockopt(ctx->rtcore_socket_fd, SOL_SOCKET, SO_RCVTIMEO, &rt_timeout, sizeof(rt_timeout));
 
-    uint8_t data[6];
+    uint8_t data[IPC_OPEN_UART_SIZE];
     int32_t size = sizeof(data);
     // serialize uart baudrate, parity and stopbits into message data.
     serialize_uint32(data, ctx->uart_config.baudRate);
@@ -361,6 +277,15 @@ err_code rtu_open(modbus_transport_t *instance, int32_t timeout_ms)
     err_code result = ipc_execute_command(ctx->rtcore_socket_fd, IPC_OPEN_UART, data, size);
     if (DEVICE_OK != result) {
         LOGE("ERROR: Could not open UART on the real-time core with error code: %d", result);
+        return result;
+    }
+
+    if (ctx->sim) {
+        result = ipc_modbus_sim_start(ctx->rtcore_socket_fd, &ctx->sim_config, ctx->uart_config.baudRate,
+                                      ctx->uart_config.parity, ctx->uart_config.stopBits, MODBUS_RTU_SIM_TIMEOUT_MS);
+        if (DEVICE_OK != result) {
+            LOGE("ERROR: Could not start simulated slaves on the real-time core with error code: %d", result);
+        }
     }
 
     return result;
@@ -382,6 +307,13 @@ err_code rtu_close(modbus_transport_t *instance)
     }
 
     if (ctx->rtcore_socket_fd >= 0) {
+        // interrupt timing of the session, forwarded like any other log
+        if (llog_islog(LOG_INFO)) {
+            ipc_dump_trace(ctx->rtcore_socket_fd, MODBUS_RTU_TRACE_TIMEOUT_MS);
+        }
+        if (ctx->sim) {
+            ipc_modbus_sim_stop(ctx->rtcore_socket_fd, MODBUS_RTU_SIM_TIMEOUT_MS);
+        }
         ipc_execute_command(ctx->rtcore_socket_fd, IPC_CLOSE_UART, NULL, 0);
         close(ctx->rtcore_socket_fd);
         ctx->rtcore_socket_fd = -1;
@@ -391,7 +323,20 @@ err_code rtu_close(modbus_transport_t *instance)
 }
 
 /// <summary>
-/// send request pdu
+/// forget outstanding requests, only the queued ones as RT core drop late
+/// response itself when next exchange starts
+/// </summary>
+void rtu_cancel_requests(modbus_transport_t *instance)
+{
+    modbus_transport_rtu_t *ctx = (modbus_transport_rtu_t *)instance;
+    ctx->head = 0;
+    ctx->num_request = 0;
+    ctx->num_exchanged = 0;
+}
+
+/// <summary>
+/// send request pdu, it's queued until response been asked for as the whole
+/// exchange is done by RT core
 /// </summary>
 /// <param name="pdu_len">pdu length to send</param>
 /// <returns>error code</returns>
@@ -400,33 +345,28 @@ err_code rtu_send_request(modbus_transport_t *instance, uint8_t slave_id, const
 {
     modbus_transport_rtu_t *ctx = (modbus_transport_rtu_t *)instance;
 
-    uint8_t adu[MB_RTU_MAX_ADU_SIZE];
-    adu[0] = slave_id;
-    memcpy_s(adu + 1, MB_RTU_MAX_ADU_SIZE - 1, pdu, pdu_len);
-
-    // crc for the entrie adu
-    uint16_t crc = crc16(adu, pdu_len + 1);
-    adu[1 + pdu_len] = crc & 0xFF;
-    adu[1 + pdu_len + 1] = (crc >> 8) & 0xFF;
+    if (ctx->rtcore_socket_fd < 0) {
+        return DEVICE_E_INVALID;
+    }
 
-    int32_t adu_len = pdu_len + 3; // 1 byte slave id + pdu + 2 bytes crc
-    struct timespec poll_sw;
-    timer_stopwatch_start(&poll_sw);
+    // 1 byte slave id + pdu, RT core append 2 bytes crc
+    if (pdu_len + 3 > MB_RTU_MAX_ADU_SIZE) {
+        LOGE("Request pdu too large: %d", pdu_len);
+        return DEVICE_E_INVALID;
+    }
 
-    if (rtu_ensure_idle(ctx, timeout) != 0) {
+    if (ctx->num_request == MODBUS_RTU_MAX_BATCH) {
+        LOGE("Too many outstanding requests");
         return DEVICE_E_BUSY;
     }
 
-    int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
-
-    err_code err = rtu_write_frame(ctx, adu, adu_len, timeout - elapse_ms);
+    rtu_request_t *request = &ctx->requests[(ctx->head + ctx->num_request) % MODBUS_RTU_MAX_BATCH];
+    request->data[4] = slave_id;
+    memcpy_s(request->data + 5, MB_RTU_MAX_ADU_SIZE - 1, pdu, pdu_len);
+    request->adu_len = pdu_len + 1;
+    ctx->num_request++;
 
-    if (err) {
-        LOGE("Failed to write request:%s", err_str(err));
-        return err;
-    }
-
-    LOGV("ADU-->%s", hex(adu, adu_len));
+    LOGV_HEX("ADU-->", request->data + 4, request->adu_len);
     return DEVICE_OK;
 }
 
@@ -442,39 +382,35 @@ err_code rtu_recv_response(modbus_transport_t *instance, uint8_t slave_id, uint8
                            int32_t timeout)
 {
     modbus_transport_rtu_t *ctx = (modbus_transport_rtu_t *)instance;
-    uint8_t adu[MB_RTU_MAX_ADU_SIZE];
 
-    int32_t adu_len = 0;
-    // adu must have enough space to receive MB_RTU_MAX_ADU_SIZE bytes
-    int err = rtu_read_frame(ctx, adu, MB_RTU_MAX_ADU_SIZE, &adu_len, timeout);
+    if (ctx->num_request == 0) {
+        LOGE("No request sent to slave %d", slave_id);
+        return DEVICE_E_INVALID;
+    }
 
-    diag_log_value(MODBUS_T35_DATAPOINT, ctx->t35_ms);
-    if (err != 0) {
-        LOGE("Failed to read adu:%s", err_str(err));
-        rtu_adjust_t35(ctx, err);
-        return err;
+    if (ctx->num_exchanged == 0) {
+        rtu_exchange_requests(ctx, timeout);
     }
 
-    LOGV("ADU<--%s", hex(adu, adu_len));
+    rtu_request_t *request = &ctx->requests[ctx->head];
+    ctx->head = (ctx->head + 1) % MODBUS_RTU_MAX_BATCH;
+    ctx->num_request--;
+    ctx->num_exchanged--;
 
-    if (adu[0] != slave_id) {
-        LOGE("Discard unexpected frame from slave %d, expected %d", adu[0], slave_id);
-        return DEVICE_E_PROTOCOL;
+    if (request->data[4] != slave_id) {
+        LOGE("Response is for slave %d, expected %d", request->data[4], slave_id);
+        return DEVICE_E_INVALID;
     }
 
-    uint16_t crc1 = (adu[adu_len - 1] << 8) + adu[adu_len - 2];
-    uint16_t crc2 = crc16(adu, adu_len - 2);
-
-    if (crc1 != crc2) {
-        LOGE("CRC error, recv=%x calc=%x", crc1, crc2);
-        return DEVICE_E_PROTOCOL;
+    if (request->code != DEVICE_OK) {
+        LOGE("Failed to read adu:%s", err_str(request->code));
+        return request->code;
     }
 
-    // 1 byte slave_id + pdu + 2 bytes crc
-    int32_t pdu_len = adu_len - 3;
     // Assume that the caller passes in the buffer with size of MODBUS_MAX_PDU_SIZE
-    memcpy_s(pdu, MODBUS_MAX_PDU_SIZE, adu + 1, pdu_len);
-    *ppdu_len = pdu_len;
+    memcpy_s(pdu, MODBUS_MAX_PDU_SIZE, request->pdu, request->pdu_len);
+    *ppdu_len = request->pdu_len;
+    LOGV_HEX("PDU<--", pdu, *ppdu_len);
     return DEVICE_OK;
 }
 
@@ -490,6 +426,13 @@ void modbus_transport_rtu_destroy(modbus_transport_t *instance)
 
     LOGD("rtu destory");
     rtu_close(instance);
+
+    modbus_transport_rtu_t *ctx = (modbus_transport_rtu_t *)instance;
+    while (ctx->slave_stats) {
+        rtu_slave_stats_t *stats = ctx->slave_stats;
+        ctx->slave_stats = stats->next;
+        FREE(stats);
+    }
     FREE(instance);
 }
 
@@ -514,10 +457,12 @@ modbus_transport_t *modbus_transport_rtu_create(const char *conn_str)
 
     LOGD("rtu create");
     modbus_transport_rtu_t *rtu = (modbus_transport_rtu_t *)CALLOC(1, sizeof(modbus_transport_rtu_t));
+    rtu->base.max_outstanding = MODBUS_RTU_MAX_BATCH;
     rtu->base.transport_open = rtu_open;
     rtu->base.transport_close = rtu_close;
     rtu->base.send_request = rtu_send_request;
     rtu->base.recv_response = rtu_recv_response;
+    rtu->base.cancel_requests = rtu_cancel_requests;
 
     rtu->uart_port = BOARD_UART;
     memcpy_s(&(rtu->uart_config), sizeof(UART_Config), &(config), sizeof(UART_Config));
@@ -525,18 +470,27 @@ modbus_transport_t *modbus_transport_rtu_create(const char *conn_str)
     rtu->rtcore_socket_fd = -1;
     rtu->uart_tx_enable_fd = -1;
 
-    if (rtu->uart_config.baudRate >= 19200) {
-        rtu->t35_ms = MODBUS_T35_MS;
-    } else {
-        // 1 start bit + dataBits + parity + stopBits
-        uint32_t bits_per_byte = 1 + rtu->uart_config.dataBits
-            + (rtu->uart_config.parity == UART_Parity_None ? 0 : 1)
-            + rtu->uart_config.stopBits;
+    const char *sim = strstr(conn_str, "," MODBUS_SIM_CONN_PREFIX);
+    if (sim) {
+        const char *options = sim + strlen("," MODBUS_SIM_CONN_PREFIX);
+        if (modbus_sim_parse_config(options, strlen(options), &rtu->sim_config) != 0) {
+            FREE(rtu);
+            return NULL;
+        }
+        rtu->sim = true;
+    }
 
-        float bytes_per_second = (float)(rtu->uart_config.baudRate) / bits_per_byte;
-        rtu->t35_ms = ceil(1000 * 3.5 / bytes_per_second);
+    // 1 start bit + dataBits + parity + stopBits
+    uint32_t bits_per_byte = 1 + rtu->uart_config.dataBits
+        + (rtu->uart_config.parity == UART_Parity_None ? 0 : 1)
+        + rtu->uart_config.stopBits;
+
+    // spec fix T3.5 at 1.75ms above 19200 baud, which is below MODBUS_T35_MS anyway
+    float bytes_per_second = (float)(rtu->uart_config.baudRate) / bits_per_byte;
+    rtu->t35_ms = ceil(1000 * 3.5 / bytes_per_second);
+    if (rtu->t35_ms < MODBUS_T35_MS) {
+        rtu->t35_ms = MODBUS_T35_MS;
     }
-    rtu->t35_adjust_times = MODBUS_T35_MAXIMUM_RETRY;
 
     return (modbus_transport_t *)rtu;
 }
@@ -0,0 +1,322 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <init/device_hal.h>
+#include <init/globals.h>
+#include <utils/llog.h>
+#include <utils/timer.h>
+#include <utils/utils.h>
+#include <driver/modbus.h>
+#include <safeclib/safe_lib.h>
+
+#include "modbus_transport.h"
+#include "modbus_transport_sim.h"
+
+// Simulated slaves answering in process, for load and soak tests of scheduler,
+// circuit breaker and batching without real devices. Slaves behind one
+// transport answer one request after another as on a serial bus or behind a
+// gateway, the caller waits the simulated response time in recv_response as
+// it would for the wire, and a request not answered costs the whole timeout.
+
+#define MB_SIM_MAX_PIPELINE_DEPTH 8
+
+// default slaves simulated when options don't say otherwise
+#define MB_SIM_DEFAULT_SLAVES 247
+#define MB_SIM_DEFAULT_REGISTERS 10000
+
+// request sent and its simulated response
+typedef struct mb_sim_pending_t mb_sim_pending_t;
+struct mb_sim_pending_t {
+    uint8_t unit_id;
+    // 0 if slave doesn't answer
+    int32_t pdu_len;
+    uint8_t pdu[MODBUS_SIM_MAX_PDU];
+    // when response is on the wire
+    struct timespec ts_ready;
+};
+
+typedef struct modbus_transport_sim_t modbus_transport_sim_t;
+struct modbus_transport_sim_t {
+    modbus_transport_t base; // must be first
+    modbus_sim_t sim;
+    int32_t bus;
+    // ring of outstanding requests
+    mb_sim_pending_t pending[MB_SIM_MAX_PIPELINE_DEPTH];
+    int32_t head;
+    int32_t num_pending;
+    // when last answered request is done and slaves are free for next one
+    struct timespec ts_free;
+};
+
+
+static bool parse_ppm(const char *str, char **end, uint32_t *ppm)
+{
+    double percent = strtod(str, end);
+    if (*end == str || percent < 0 || percent > 100) {
+        return false;
+    }
+    *ppm = (uint32_t)(percent * 10000 + 0.5);
+    return true;
+}
+
+static bool parse_us(const char *str, char **end, uint32_t *us)
+{
+    double ms = strtod(str, end);
+    if (*end == str || ms < 0 || ms > 3600 * 1000) {
+        return false;
+    }
+    *us = (uint32_t)(ms * 1000 + 0.5);
+    return true;
+}
+
+static bool parse_option(const char *name, size_t name_len, const char *value, modbus_sim_config_t *config)
+{
+    char *end = NULL;
+
+#define IS_OPTION(opt) (name_len == strlen(opt) && strncmp(name, opt, name_len) == 0)
+
+    if (IS_OPTION("slaves")) {
+        long n = strtol(value, &end, 10);
+        config->num_slaves = (uint8_t)n;
+        return end != value && n >= 1 && n <= 247;
+    } else if (IS_OPTION("first")) {
+        long id = strtol(value, &end, 10);
+        config->first_id = (uint8_t)id;
+        return end != value && id >= 1 && id <= 247;
+    } else if (IS_OPTION("registers")) {
+        long n = strtol(value, &end, 10);
+        config->num_registers = (uint16_t)n;
+        return end != value && n >= 1 && n <= UINT16_MAX;
+    } else if (IS_OPTION("latency")) {
+        if (!parse_us(value, &end, &config->latency_min_us)) {
+            return false;
+        }
+        config->latency_max_us = config->latency_min_us;
+        return *end != '-' || parse_us(end + 1, &end, &config->latency_max_us);
+    } else if (IS_OPTION("slow")) {
+        return parse_ppm(value, &end, &config->slow_ppm) && *end == ':' && parse_us(end + 1, &end, &config->slow_us);
+    } else if (IS_OPTION("exception")) {
+        return parse_ppm(value, &end, &config->exception_ppm);
+    } else if (IS_OPTION("timeout")) {
+        return parse_ppm(value, &end, &config->timeout_ppm);
+    } else if (IS_OPTION("change")) {
+        long ms = strtol(value, &end, 10);
+        config->change_ms = (uint32_t)ms;
+        config->change_ppm = 1000000;
+        return end != value && ms >= 0 && (*end != ':' || parse_ppm(end + 1, &end, &config->change_ppm));
+    } else if (IS_OPTION("seed")) {
+        config->seed = (uint32_t)strtoul(value, &end, 10);
+        return end != value;
+    }
+
+#undef IS_OPTION
+
+    return true;
+}
+
+static int32_t monotonic_ms(const struct timespec *ts)
+{
+    return (int32_t)SPEC2MS(*ts);
+}
+
+// ------------------------ transport interface --------------------------------
+
+static err_code sim_open(modbus_transport_t *instance, int32_t timeout_ms)
+{
+    modbus_transport_sim_t *ctx = (modbus_transport_sim_t *)instance;
+    LOGI("Open simulated bus %d: %d slaves from %d, latency %u-%uus", ctx->bus, ctx->sim.config.num_slaves,
+         ctx->sim.config.first_id, ctx->sim.config.latency_min_us, ctx->sim.config.latency_max_us);
+    return DEVICE_OK;
+}
+
+static err_code sim_close(modbus_transport_t *instance)
+{
+    modbus_transport_sim_t *ctx = (modbus_transport_sim_t *)instance;
+    const modbus_sim_stats_t *stats = &ctx->sim.stats;
+
+    LOGI("Close simulated bus %d: %u requests, %u exceptions, %u not answered", ctx->bus, stats->requests,
+         stats->exceptions, stats->timeouts);
+    ctx->num_pending = 0;
+    return DEVICE_OK;
+}
+
+static err_code sim_send_request(modbus_transport_t *instance, uint8_t id, const uint8_t *pdu, int32_t pdu_len,
+                                 int32_t timeout)
+{
+    modbus_transport_sim_t *ctx = (modbus_transport_sim_t *)instance;
+
+    if (ctx->num_pending >= ctx->base.max_outstanding) {
+        LOGE("Too many outstanding requests");
+        return DEVICE_E_BUSY;
+    }
+
+    struct timespec ts_now;
+    clock_gettime(CLOCK_MONOTONIC, &ts_now);
+
+    mb_sim_pending_t *pending = &ctx->pending[(ctx->head + ctx->num_pending) % MB_SIM_MAX_PIPELINE_DEPTH];
+    uint32_t delay_us = 0;
+    pending->unit_id = id;
+    pending->pdu_len = modbus_sim_handle(&ctx->sim, id, pdu, pdu_len, monotonic_ms(&ts_now), pending->pdu, &delay_us);
+
+    // slaves take requests one at a time, a request not answered hold them
+    // until caller gives up, which is when it cancels outstanding ones
+    struct timespec ts_start = timespec_compare(&ctx->ts_free, &ts_now) > 0 ? ctx->ts_free : ts_now;
+    struct timespec ts_delay = {.tv_sec = delay_us / 1000000, .tv_nsec = (delay_us % 1000000) * 1000};
+    pending->ts_ready = ts_start;
+    timespec_add(&pending->ts_ready, &ts_delay);
+    if (pending->pdu_len > 0) {
+        ctx->ts_free = pending->ts_ready;
+    }
+
+    ctx->num_pending++;
+    return DEVICE_OK;
+}
+
+static err_code sim_recv_response(modbus_transport_t *instance, uint8_t id, uint8_t *pdu, int32_t *ppdu_len,
+                                  int32_t timeout)
+{
+    modbus_transport_sim_t *ctx = (modbus_transport_sim_t *)instance;
+
+    if (ctx->num_pending == 0) {
+        LOGE("No request sent to slave %d", id);
+        return DEVICE_E_INVALID;
+    }
+
+    mb_sim_pending_t *pending = &ctx->pending[ctx->head];
+    ctx->head = (ctx->head + 1) % MB_SIM_MAX_PIPELINE_DEPTH;
+    ctx->num_pending--;
+
+    struct timespec ts_deadline;
+    clock_gettime(CLOCK_MONOTONIC, &ts_deadline);
+    struct timespec ts_timeout = MS2SPEC(timeout);
+    timespec_add(&ts_deadline, &ts_timeout);
+
+    if (pending->pdu_len == 0 || timespec_compare(&pending->ts_ready, &ts_deadline) > 0) {
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts_deadline, NULL) == EINTR) {
+        }
+        return DEVICE_E_TIMEOUT;
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &pending->ts_ready, NULL) == EINTR) {
+    }
+
+    if (pending->unit_id != id) {
+        LOGE("Response is for slave %d, expected %d", pending->unit_id, id);
+        return DEVICE_E_INVALID;
+    }
+
+    memcpy_s(pdu, MODBUS_MAX_PDU_SIZE, pending->pdu, pending->pdu_len);
+    *ppdu_len = pending->pdu_len;
+    return DEVICE_OK;
+}
+
+static void sim_cancel_requests(modbus_transport_t *instance)
+{
+    modbus_transport_sim_t *ctx = (modbus_transport_sim_t *)instance;
+    ctx->head = 0;
+    ctx->num_pending = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ctx->ts_free);
+}
+
+// ------------------------ public interface --------------------------------
+
+int modbus_sim_parse_config(const char *options, int len, modbus_sim_config_t *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->first_id = 1;
+    config->num_slaves = MB_SIM_DEFAULT_SLAVES;
+    config->num_registers = MB_SIM_DEFAULT_REGISTERS;
+    config->seed = 1;
+
+    char *str = STRNDUP(options, len);
+    int ret = 0;
+
+    for (char *opt = str, *next = NULL; opt && *opt; opt = next) {
+        next = strchr(opt, ',');
+        if (next) {
+            *next++ = '\0';
+        }
+
+        char *eq = strchr(opt, '=');
+        if (!eq) {
+            continue;
+        }
+
+        if (!parse_option(opt, eq - opt, eq + 1, config)) {
+            LOGE("Invalid simulated slaves option %s", opt);
+            ret = -1;
+            break;
+        }
+    }
+
+    FREE(str);
+    return ret;
+}
+
+
+bool modbus_transport_sim_match(const char *conn_str)
+{
+    return strncmp(conn_str, MODBUS_SIM_CONN_PREFIX, strlen(MODBUS_SIM_CONN_PREFIX)) == 0;
+}
+
+
+bool modbus_transport_is_sim(const modbus_transport_t *instance)
+{
+    return instance->send_request == sim_send_request;
+}
+
+
+void modbus_transport_sim_destroy(modbus_transport_t *instance)
+{
+    ASSERT(instance);
+    FREE(instance);
+}
+
+
+modbus_transport_t *modbus_transport_sim_create(const char *conn_str)
+{
+    ASSERT(conn_str);
+
+    const char *p = conn_str + strlen(MODBUS_SIM_CONN_PREFIX);
+    char *end = NULL;
+    long bus = strtol(p, &end, 10);
+    if (end == p) {
+        LOGE("Invalid simulated bus: %s", conn_str);
+        return NULL;
+    }
+
+    const char *options = (*end == ':') ? end + 1 : end;
+    modbus_transport_sim_t *sim = (modbus_transport_sim_t *)CALLOC(1, sizeof(modbus_transport_sim_t));
+    modbus_sim_config_t config;
+    if (modbus_sim_parse_config(options, strlen(options), &config) != 0) {
+        FREE(sim);
+        return NULL;
+    }
+
+    // pipeline depth is a transport option, not one of slaves
+    sim->base.max_outstanding = 1;
+    const char *depth = strstr(options, "depth=");
+    if (depth && (depth == options || depth[-1] == ',')) {
+        sim->base.max_outstanding = strtol(depth + strlen("depth="), NULL, 10);
+    }
+    if (sim->base.max_outstanding < 1 || sim->base.max_outstanding > MB_SIM_MAX_PIPELINE_DEPTH) {
+        LOGE("Invalid pipeline depth %d", sim->base.max_outstanding);
+        FREE(sim);
+        return NULL;
+    }
+
+    sim->base.transport_open = sim_open;
+    sim->base.transport_close = sim_close;
+    sim->base.send_request = sim_send_request;
+    sim->base.recv_response = sim_recv_response;
+    sim->base.cancel_requests = sim_cancel_requests;
+    sim->bus = (int32_t)bus;
+    modbus_sim_init(&sim->sim, &config);
+
+    return (modbus_transport_t *)sim;
+}
@@ -0,0 +1,55 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include <modbus_sim.h>
+
+#include "modbus_transport.h"
+
+// connection string of modbus tcp or rtu device starting with this is served
+// by simulated slaves in process, see modbus_transport_sim_create()
+#define MODBUS_SIM_CONN_PREFIX "sim:"
+
+/**
+ * parse options of simulated slaves, comma separated "name=value" of
+ * slaves=<n>, first=<id>, registers=<n>, latency=<min ms>[-<max ms>],
+ * slow=<percent>:<ms>, exception=<percent>, timeout=<percent>,
+ * change=<ms>:<percent> and seed=<n>, unknown names are ignored
+ * @param options options, not null terminated
+ * @param len length of options
+ * @param config out parameter receive slaves config, defaults for what isn't given
+ * @return 0 on success, -1 if a value is invalid
+ */
+int modbus_sim_parse_config(const char *options, int len, modbus_sim_config_t *config);
+
+/**
+ * tell if connection string asks for simulated slaves
+ * @param conn_str connection string, null terminated
+ * @return true if it does
+ */
+bool modbus_transport_sim_match(const char *conn_str);
+
+/**
+ * create transport to simulated slaves
+ * @param conn_str "sim:<bus>[:<options>]" null terminated, bus is a number
+ * telling apart simulated gateways or serial buses, options as of
+ * modbus_sim_parse_config() plus depth=<n> pipelined requests
+ * @return instance been created, NULL if connection string is invalid
+ */
+modbus_transport_t *modbus_transport_sim_create(const char *conn_str);
+
+/**
+ * tell if transport is a simulated one
+ * @param instance transport
+ * @return true if created by modbus_transport_sim_create()
+ */
+bool modbus_transport_is_sim(const modbus_transport_t *instance);
+
+/**
+ * destroy simulated transport
+ * @param instance instance to be destroyed
+ */
+void modbus_transport_sim_destroy(modbus_transport_t *instance);
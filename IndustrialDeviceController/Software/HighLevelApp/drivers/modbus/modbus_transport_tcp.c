@@ -4,6 +4,7 @@
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
 #include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,23 +29,90 @@
 
 // NOTE: Modbus tcp support simulataneous transcations and transcation id
 // must been used.
-// Current implementation assume only one outgoing transcation. Possible improvement
-// is to send multiple requests out and then wait them all to be completed.
+// By default only one outgoing transcation is allowed. When pipeline depth is
+// given in connection string, up to that many requests can be sent before the
+// response of first one is received, responses are matched by transcation id
+// and handed back in request order.
+//
+// Connections are kept by one background thread for all transports. Once a
+// transport is opened its connection is managed there: a connection found
+// broken by a poll is closed and reconnected with backoff, polls meanwhile fail
+// right away with DEVICE_E_BROKEN rather than each waiting a connect timeout.
 
 #define MB_TCP_MAX_ADU_SIZE 260
 
 // header not include unit_id
 #define MBAP_HEADER_SIZE 7
 
+// max pipeline depth can be configured per connection
+#define MB_TCP_MAX_PIPELINE_DEPTH 8
+
+// request sent and waiting for response
+typedef struct mb_tcp_pending_t mb_tcp_pending_t;
+struct mb_tcp_pending_t {
+    uint16_t transcation_id;
+    uint8_t unit_id;
+    bool received;
+    int32_t pdu_len;
+    uint8_t pdu[MODBUS_MAX_PDU_SIZE];
+};
+
 typedef struct modbus_transport_tcp_t modbus_transport_tcp_t;
 struct modbus_transport_tcp_t {
     modbus_transport_t base;
+    // set by connection thread only while -1, reset to -1 by polling thread
+    // only, both under s_conn.lock
     int sock_fd;
     int port;
     char ip[16]; // only support ipv4
     uint16_t transcation_id;
+
+    // FIFO of outstanding requests, oldest at pending_head
+    mb_tcp_pending_t pending[MB_TCP_MAX_PIPELINE_DEPTH];
+    int32_t pending_head;
+    int32_t num_pending;
+
+    // connection state, guarded by s_conn.lock
+    bool managed;
+    bool connecting;
+    int32_t attempts;
+    int32_t backoff_ms;
+    struct timespec ts_retry;
+    modbus_transport_tcp_t *next_managed;
+};
+
+// connection thread and the transports it keeps connected
+typedef struct mb_tcp_conn_manager_t mb_tcp_conn_manager_t;
+struct mb_tcp_conn_manager_t {
+    pthread_mutex_t lock;
+    // signaled when a transport need connecting or an attempt finished
+    pthread_cond_t cond;
+    bool running;
+    modbus_transport_tcp_t *transports;
 };
 
+static mb_tcp_conn_manager_t s_conn = {.lock = PTHREAD_MUTEX_INITIALIZER};
+static pthread_once_t s_conn_once = PTHREAD_ONCE_INIT;
+
+
+static void clear_pending(modbus_transport_tcp_t *ctx)
+{
+    ctx->pending_head = 0;
+    ctx->num_pending = 0;
+}
+
+
+static mb_tcp_pending_t *find_pending(modbus_transport_tcp_t *ctx, uint16_t transcation_id)
+{
+    for (int32_t i = 0; i < ctx->num_pending; i++) {
+        mb_tcp_pending_t *p = &ctx->pending[(ctx->pending_head + i) % MB_TCP_MAX_PIPELINE_DEPTH];
+        if (p->transcation_id == transcation_id) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
 
 /// <summary>
 /// try to send count bytes over tcp connection, timeout in MB_TCP_IO_TIMEOUT_MS
@@ -156,58 +224,244 @@ static err_code tcp_recv_bytes(int sockfd, uint8_t *buf, int count, int timeout)
 }
 
 
-/// <summary>
-/// open tcp connection
-/// </summary>
-err_code tcp_open(modbus_transport_t *instance, int32_t timeout_ms)
+// blocking connect, return socket or -1
+static int tcp_connect(const char *ip, int port, int32_t timeout_ms)
 {
-    modbus_transport_tcp_t *ctx = (modbus_transport_tcp_t *)instance;
-    LOGD("tcp_open %s:%d", ctx->ip, ctx->port);
-
     // assume ipv4, create a tcp socket
     int sock = socket(AF_INET, SOCK_STREAM, 0);
 
     if (sock < 0) {
         LOGE("Failed to open socket");
-        return DEVICE_E_IO;
+        return -1;
     }
 
     struct sockaddr_in server;
     memset(&server, 0, sizeof(server));
     server.sin_family = AF_INET;
-    server.sin_addr.s_addr = inet_addr(ctx->ip);
-    server.sin_port = htons(ctx->port);
+    server.sin_addr.s_addr = inet_addr(ip);
+    server.sin_port = htons(port);
 
     struct timeval timeout;
     timeout.tv_sec = timeout_ms / 1000;
     timeout.tv_usec = timeout_ms % 1000 * 1000;
     setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
 
+    // a gateway gone silent is found by keepalive rather than by polls timing out
+    int enable = 1, idle = MODBUS_TCP_KEEPIDLE_S, interval = MODBUS_TCP_KEEPINTVL_S, count = MODBUS_TCP_KEEPCNT;
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
     if (connect(sock, (struct sockaddr *)&server, sizeof(server)) != 0) {
-        LOGE("Failed to connect to %s:%d", ctx->ip, ctx->port);
+        LOGE("Failed to connect to %s:%d", ip, port);
         close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+
+static void conn_init_once(void)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s_conn.cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+
+/// <summary>
+/// connection thread, connect transports which are due in turn, exit once no
+/// transport is managed
+/// </summary>
+static void *conn_manager_thread(void *arg)
+{
+    pthread_mutex_lock(&s_conn.lock);
+
+    while (s_conn.transports) {
+        struct timespec ts_now, ts_wake = {0, 0};
+        clock_gettime(CLOCK_MONOTONIC, &ts_now);
+
+        modbus_transport_tcp_t *ctx = s_conn.transports;
+        for (; ctx; ctx = ctx->next_managed) {
+            if (ctx->sock_fd >= 0) {
+                continue;
+            }
+            if (timespec_compare(&ctx->ts_retry, &ts_now) <= 0) {
+                break;
+            }
+            if ((!ts_wake.tv_sec && !ts_wake.tv_nsec) || timespec_compare(&ctx->ts_retry, &ts_wake) < 0) {
+                ts_wake = ctx->ts_retry;
+            }
+        }
+
+        if (!ctx) {
+            if (ts_wake.tv_sec || ts_wake.tv_nsec) {
+                pthread_cond_timedwait(&s_conn.cond, &s_conn.lock, &ts_wake);
+            } else {
+                pthread_cond_wait(&s_conn.cond, &s_conn.lock);
+            }
+            continue;
+        }
+
+        ctx->connecting = true;
+        pthread_mutex_unlock(&s_conn.lock);
+
+        int sock = tcp_connect(ctx->ip, ctx->port, MODBUS_TCP_CONNECT_TIMEOUT_MS);
+
+        pthread_mutex_lock(&s_conn.lock);
+        ctx->connecting = false;
+        ctx->attempts++;
+        if (sock >= 0) {
+            LOGI("Connected to modbus server %s:%d", ctx->ip, ctx->port);
+            ctx->sock_fd = sock;
+            ctx->backoff_ms = 0;
+        } else {
+            ctx->backoff_ms = ctx->backoff_ms ? MIN(ctx->backoff_ms * 2, MODBUS_TCP_RECONNECT_MAX_MS)
+                                              : MODBUS_TCP_RECONNECT_MIN_MS;
+            clock_gettime(CLOCK_MONOTONIC, &ctx->ts_retry);
+            struct timespec backoff = MS2SPEC(ctx->backoff_ms);
+            timespec_add(&ctx->ts_retry, &backoff);
+            LOGW("Retry connecting %s:%d in %d ms", ctx->ip, ctx->port, ctx->backoff_ms);
+        }
+        pthread_cond_broadcast(&s_conn.cond);
+    }
+
+    s_conn.running = false;
+    pthread_mutex_unlock(&s_conn.lock);
+    return NULL;
+}
+
+
+/// <summary>
+/// socket of connection, -1 if it is being reconnected
+/// </summary>
+static int tcp_socket(modbus_transport_tcp_t *ctx)
+{
+    pthread_mutex_lock(&s_conn.lock);
+    int sock = ctx->sock_fd;
+    pthread_mutex_unlock(&s_conn.lock);
+    return sock;
+}
+
+
+/// <summary>
+/// close connection found broken, connection thread reconnect it right away
+/// and back off if that fails
+/// </summary>
+static void tcp_drop_connection(modbus_transport_tcp_t *ctx)
+{
+    pthread_mutex_lock(&s_conn.lock);
+    if (ctx->sock_fd >= 0) {
+        LOGW("Connection to %s:%d broken, reconnecting", ctx->ip, ctx->port);
+        close(ctx->sock_fd);
+        ctx->sock_fd = -1;
+        clock_gettime(CLOCK_MONOTONIC, &ctx->ts_retry);
+        pthread_cond_broadcast(&s_conn.cond);
+    }
+    clear_pending(ctx);
+    pthread_mutex_unlock(&s_conn.lock);
+}
+
+
+/// <summary>
+/// open tcp connection, it is managed by connection thread from now on. Wait
+/// for first attempt to connect, even if it failed the transport is opened and
+/// polls fail fast until connection thread get it connected
+/// </summary>
+err_code tcp_open(modbus_transport_t *instance, int32_t timeout_ms)
+{
+    modbus_transport_tcp_t *ctx = (modbus_transport_tcp_t *)instance;
+    LOGD("tcp_open %s:%d", ctx->ip, ctx->port);
+
+    pthread_once(&s_conn_once, conn_init_once);
+    pthread_mutex_lock(&s_conn.lock);
+
+    if (!ctx->managed) {
+        ctx->managed = true;
+        ctx->attempts = 0;
+        ctx->backoff_ms = 0;
+        clock_gettime(CLOCK_MONOTONIC, &ctx->ts_retry);
+        ctx->next_managed = s_conn.transports;
+        s_conn.transports = ctx;
+        clear_pending(ctx);
+
+        if (!s_conn.running) {
+            pthread_t tid;
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            if (pthread_create(&tid, &attr, conn_manager_thread, NULL) == 0) {
+                s_conn.running = true;
+            }
+            pthread_attr_destroy(&attr);
+        }
+        pthread_cond_broadcast(&s_conn.cond);
+    }
+
+    if (!s_conn.running) {
+        LOGE("Failed to start connection thread");
+        s_conn.transports = ctx->next_managed;
+        ctx->managed = false;
+        pthread_mutex_unlock(&s_conn.lock);
         return DEVICE_E_IO;
     }
 
-    LOGD("Connected to modbus server %s:%d", ctx->ip, ctx->port);
+    struct timespec ts_deadline;
+    clock_gettime(CLOCK_MONOTONIC, &ts_deadline);
+    struct timespec timeout = MS2SPEC(timeout_ms);
+    timespec_add(&ts_deadline, &timeout);
 
-    ctx->sock_fd = sock;
+    while (ctx->sock_fd < 0 && ctx->attempts == 0) {
+        if (pthread_cond_timedwait(&s_conn.cond, &s_conn.lock, &ts_deadline) != 0) {
+            break;
+        }
+    }
+
+    if (ctx->sock_fd < 0) {
+        LOGW("Not connected to %s:%d yet, keep trying in background", ctx->ip, ctx->port);
+    }
+
+    pthread_mutex_unlock(&s_conn.lock);
     return DEVICE_OK;
 }
 
 /// <summary>
-/// close tcp connection
+/// close tcp connection, it is no longer managed by connection thread
 /// </summary>
 /// <returns>0 on success, or -1 on failure</returns>
 err_code tcp_close(modbus_transport_t *instance)
 {
     modbus_transport_tcp_t *ctx = (modbus_transport_tcp_t *)instance;
-    
+
+    pthread_mutex_lock(&s_conn.lock);
+
+    if (ctx->managed) {
+        modbus_transport_tcp_t **pp = &s_conn.transports;
+        while (*pp != ctx) {
+            pp = &(*pp)->next_managed;
+        }
+        *pp = ctx->next_managed;
+        ctx->managed = false;
+
+        // attempt in progress hand socket over when done
+        while (ctx->connecting) {
+            pthread_cond_wait(&s_conn.cond, &s_conn.lock);
+        }
+        pthread_cond_broadcast(&s_conn.cond);
+    }
+
     if (ctx->sock_fd >= 0) {
         close(ctx->sock_fd);
         ctx->sock_fd = -1;
     }
+    clear_pending(ctx);
 
+    pthread_mutex_unlock(&s_conn.lock);
     return DEVICE_OK;
 }
 
@@ -223,10 +477,16 @@ err_code tcp_send_request(modbus_transport_t *instance, uint8_t unit_id, const u
 {
     modbus_transport_tcp_t *ctx = (modbus_transport_tcp_t *)instance;
     uint8_t adu[MB_TCP_MAX_ADU_SIZE];
+    int sock = tcp_socket(ctx);
 
-    if (ctx->sock_fd < 0) {
-        LOGE("Socket not open yet");
-        return DEVICE_E_INTERNAL;
+    if (sock < 0) {
+        // being reconnected in background
+        return DEVICE_E_BROKEN;
+    }
+
+    if (ctx->num_pending >= ctx->base.max_outstanding) {
+        LOGE("Too many outstanding requests");
+        return DEVICE_E_BUSY;
     }
 
     ctx->transcation_id++;
@@ -241,114 +501,183 @@ err_code tcp_send_request(modbus_transport_t *instance, uint8_t unit_id, const u
 
     int32_t adu_len = MBAP_HEADER_SIZE + pdu_len;
 
-    int err = tcp_send_bytes(ctx->sock_fd, adu, adu_len, timeout);
+    int err = tcp_send_bytes(sock, adu, adu_len, timeout);
 
     if (err) {
         LOGE("Failed to send request:%s", err_str(err));
+        if (err == DEVICE_E_BROKEN || err == DEVICE_E_IO) {
+            tcp_drop_connection(ctx);
+        }
+        clear_pending(ctx);
         return err;
     }
 
+    mb_tcp_pending_t *p = &ctx->pending[(ctx->pending_head + ctx->num_pending) % MB_TCP_MAX_PIPELINE_DEPTH];
+    p->transcation_id = ctx->transcation_id;
+    p->unit_id = unit_id;
+    p->received = false;
+    ctx->num_pending++;
+
 #ifdef DEBUG_TRAFFIC
-    LOGD("ADU --> %s", hex(adu, adu_len));
+    LOGD_HEX("ADU --> ", adu, adu_len);
 #endif
     return DEVICE_OK;
 }
 
 /// <summary>
-/// recv response for previously sent request
+/// receive one ADU and store it into matching pending request, ADU not belong to
+/// any pending request (e.g. late response of timed out request) is dropped
 /// </summary>
-/// <param name="pdu">pdu buffer</param>
-/// <param name="ppdu_len">pointer to variable that hold pdu len</param>
 /// <param name="timeout">the value of timer in ms for this operation</param>
 /// <returns>error code</returns>
-err_code tcp_recv_response(modbus_transport_t *instance, uint8_t unit_id, uint8_t *pdu, int32_t *ppdu_len,
-                           int32_t timeout)
+static err_code tcp_recv_adu(modbus_transport_tcp_t *ctx, int sock, int32_t timeout)
 {
-    modbus_transport_tcp_t *ctx = (modbus_transport_tcp_t *)instance;
-
     uint8_t adu[MB_TCP_MAX_ADU_SIZE];
     uint16_t transcation_id = 0;
     int32_t pdu_len = 0;
 
-    if (ctx->sock_fd < 0) {
-        LOGE("Socket not open yet");
-        return DEVICE_E_INTERNAL;
-    }
-
     struct timespec poll_sw;
     timer_stopwatch_start(&poll_sw);
 
-    do {
-        // receive MBAP header first
-        int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
+    // receive MBAP header first
+    err_code err = tcp_recv_bytes(sock, adu, MBAP_HEADER_SIZE, timeout);
 
-        if (elapse_ms >= timeout) {
-            return DEVICE_E_TIMEOUT;
-        }
-        err_code err = tcp_recv_bytes(ctx->sock_fd, adu, MBAP_HEADER_SIZE, timeout - elapse_ms);
+    if (err) {
+        LOGE("Failed to receive MBAP header:%s", err_str(err));
+        return err;
+    }
 
-        if (err) {
-            LOGE("Failed to receive MBAP header:%s", err_str(err));
-            return err;
-        }
+    transcation_id = (adu[0] << 8) + adu[1];
+    pdu_len = (adu[4] << 8) + adu[5] - 1; // exclude one byte unit id
 
-        transcation_id = (adu[0] << 8) + adu[1];
-        pdu_len = (adu[4] << 8) + adu[5] - 1; // exclude one byte unit id
+    if ((pdu_len < 0) || (pdu_len > MB_TCP_MAX_ADU_SIZE - MBAP_HEADER_SIZE)) {
+        LOGE("Invalid pdu len %d", pdu_len);
+        // clean any garbage data then bail out
+        uint8_t garbage;
+        int32_t elapse_ms;
 
-        if ((pdu_len < 0) || (pdu_len > MB_TCP_MAX_ADU_SIZE - MBAP_HEADER_SIZE)) {
-            LOGE("Invalid pdu len %d", pdu_len);
-            // clean any garbage data then bail out
-            uint8_t garbage;
+        do {
+            elapse_ms = timer_stopwatch_stop(&poll_sw);
 
-            do {
-                elapse_ms = timer_stopwatch_stop(&poll_sw);
+            if (elapse_ms >= timeout) {
+                return DEVICE_E_TIMEOUT;
+            }
+        } while (tcp_recv_bytes(sock, &garbage, 1, timeout - elapse_ms) == 0);
 
-                if (elapse_ms >= timeout) {
-                    return DEVICE_E_TIMEOUT;
-                }
-            } while (tcp_recv_bytes(ctx->sock_fd, &garbage, 1, timeout - elapse_ms) == 0);
+        return DEVICE_E_PROTOCOL;
+    }
 
-            return DEVICE_E_PROTOCOL;
-        }
+    // receive the pdu
+    int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
+
+    if (elapse_ms >= timeout) {
+        return DEVICE_E_TIMEOUT;
+    }
+
+    err = tcp_recv_bytes(sock, adu + MBAP_HEADER_SIZE, pdu_len, timeout - elapse_ms);
+
+    if (err) {
+        LOGE("Failed to receive pdu:%s", err_str(err));
+        return err;
+    }
+
+#ifdef DEBUG_TRAFFIC
+    LOGD_HEX("ADU<-- ", adu, MBAP_HEADER_SIZE + pdu_len);
+#endif
 
-        // receive the pdu
-        elapse_ms = timer_stopwatch_stop(&poll_sw);
+    mb_tcp_pending_t *p = find_pending(ctx, transcation_id);
+
+    if (!p || p->received) {
+        LOGW("Drop response for transcation %d", transcation_id);
+        return DEVICE_OK;
+    }
+
+    if (p->unit_id != adu[6]) {
+        LOGE("Expect unit_id %d, got %d", p->unit_id, adu[6]);
+        return DEVICE_E_PROTOCOL;
+    }
+
+    memcpy_s(p->pdu, sizeof(p->pdu), adu + MBAP_HEADER_SIZE, pdu_len);
+    p->pdu_len = pdu_len;
+    p->received = true;
+    return DEVICE_OK;
+}
+
+/// <summary>
+/// recv response for earliest outstanding request
+/// </summary>
+/// <param name="pdu">pdu buffer</param>
+/// <param name="ppdu_len">pointer to variable that hold pdu len</param>
+/// <param name="timeout">the value of timer in ms for this operation</param>
+/// <returns>error code</returns>
+err_code tcp_recv_response(modbus_transport_t *instance, uint8_t unit_id, uint8_t *pdu, int32_t *ppdu_len,
+                           int32_t timeout)
+{
+    modbus_transport_tcp_t *ctx = (modbus_transport_tcp_t *)instance;
+    int sock = tcp_socket(ctx);
+
+    if (sock < 0) {
+        clear_pending(ctx);
+        return DEVICE_E_BROKEN;
+    }
+
+    if (ctx->num_pending == 0) {
+        LOGE("No outstanding request");
+        return DEVICE_E_INVALID;
+    }
+
+    mb_tcp_pending_t *head = &ctx->pending[ctx->pending_head];
+
+    struct timespec poll_sw;
+    timer_stopwatch_start(&poll_sw);
+
+    // responses could be delayed or come out of order, keep receiving until
+    // we got response for earliest request
+    while (!head->received) {
+        int32_t elapse_ms = timer_stopwatch_stop(&poll_sw);
 
         if (elapse_ms >= timeout) {
+            clear_pending(ctx);
             return DEVICE_E_TIMEOUT;
         }
 
-        err = tcp_recv_bytes(ctx->sock_fd, adu + MBAP_HEADER_SIZE, pdu_len, timeout - elapse_ms);
+        err_code err = tcp_recv_adu(ctx, sock, timeout - elapse_ms);
 
         if (err) {
-            LOGE("Failed to receive pdu:%s", err_str(err));
+            // caller gives up current poll on error, late responses of
+            // requests still in flight will be dropped when received
+            if (err == DEVICE_E_BROKEN || err == DEVICE_E_IO) {
+                tcp_drop_connection(ctx);
+            }
+            clear_pending(ctx);
             return err;
         }
-
-#ifdef DEBUG_TRAFFIC
-        LOGD("ADU<-- %s", hex(adu, MBAP_HEADER_SIZE + pdu_len));
-#endif
-        // the response could be delayed, so wait until we received response
-        // for current transcation
-    } while (transcation_id < ctx->transcation_id);
-
-    if (transcation_id != ctx->transcation_id) {
-        LOGE("Expect response for transcation %d, got %d", ctx->transcation_id, transcation_id);
-        return DEVICE_E_PROTOCOL;
     }
 
-    if (unit_id != adu[6]) {
-        LOGE("Expect unit_id %d, got %d", unit_id, adu[6]);
+    ctx->pending_head = (ctx->pending_head + 1) % MB_TCP_MAX_PIPELINE_DEPTH;
+    ctx->num_pending--;
+
+    if (unit_id != head->unit_id) {
+        LOGE("Expect unit_id %d, got %d", unit_id, head->unit_id);
         return DEVICE_E_PROTOCOL;
     }
 
     // Assume that the caller passes in the buffer with size of MODBUS_MAX_PDU_SIZE
-    memcpy_s(pdu, MODBUS_MAX_PDU_SIZE, adu + MBAP_HEADER_SIZE, pdu_len);
-    *ppdu_len = pdu_len;
+    memcpy_s(pdu, MODBUS_MAX_PDU_SIZE, head->pdu, head->pdu_len);
+    *ppdu_len = head->pdu_len;
     return DEVICE_OK;
 }
 
 
+/// <summary>
+/// forget outstanding requests
+/// </summary>
+void tcp_cancel_requests(modbus_transport_t *instance)
+{
+    clear_pending((modbus_transport_tcp_t *)instance);
+}
+
+
 /// <summary>
 /// destroy tcp transport instance, free resource
 /// </summary>
@@ -356,16 +685,14 @@ void modbus_transport_tcp_destroy(modbus_transport_t *instance)
 {
     modbus_transport_tcp_t *ctx = (modbus_transport_tcp_t *)instance;
 
-    if (ctx->sock_fd >= 0) {
-        tcp_close(instance);
-    }
-
+    tcp_close(instance);
     FREE(ctx);
 }
 
 /// <summary>
 /// create modbus tcp transportation instance.
-/// connection string format is "ip:port", null terminated
+/// connection string format is "ip:port[:depth]", null terminated, depth is
+/// optional number of pipelined requests, default to 1
 /// </summary>
 modbus_transport_t *modbus_transport_tcp_create(const char *conn_str)
 {
@@ -377,12 +704,20 @@ modbus_transport_t *modbus_transport_tcp_create(const char *conn_str)
     tcp->base.transport_close = tcp_close;
     tcp->base.send_request = tcp_send_request;
     tcp->base.recv_response = tcp_recv_response;
+    tcp->base.cancel_requests = tcp_cancel_requests;
+
+    tcp->base.max_outstanding = 1;
 
     char *colon = strchr(conn_str, ':');
 
     if (colon) {
+        char *end = NULL;
         strncpy_s(tcp->ip, sizeof(tcp->ip), conn_str, colon - conn_str);
-        tcp->port = strtol(colon + 1, NULL, 10);
+        tcp->port = strtol(colon + 1, &end, 10);
+
+        if (end && *end == ':') {
+            tcp->base.max_outstanding = strtol(end + 1, NULL, 10);
+        }
     }
 
     if ((strlen(tcp->ip) == 0) || (!tcp->port)) {
@@ -391,6 +726,12 @@ modbus_transport_t *modbus_transport_tcp_create(const char *conn_str)
         return NULL;
     }
 
+    if (tcp->base.max_outstanding < 1 || tcp->base.max_outstanding > MB_TCP_MAX_PIPELINE_DEPTH) {
+        LOGE("Invalid pipeline depth %d", tcp->base.max_outstanding);
+        modbus_transport_tcp_destroy((modbus_transport_t *)tcp);
+        return NULL;
+    }
+
     tcp->transcation_id = 0;
     tcp->sock_fd = -1;
     return (modbus_transport_t *)tcp;
@@ -0,0 +1,503 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <applibs/application.h>
+
+#include <init/globals.h>
+#include <init/device_hal.h>
+#include <init/ipc.h>
+#include <utils/utils.h>
+#include <utils/llog.h>
+#include <driver/pulse.h>
+
+#include <frozen/frozen.h>
+#include <safeclib/safe_lib.h>
+
+// Pulses are counted on the RT core, where every edge interrupt is served
+// however busy the A7 is. The driver only starts counting on the pins its
+// schemas use and reads all counters with one IPC_PULSE_READ per poll.
+
+#define MAX_FIELD_LENGTH 100
+
+#define PULSE_DEFAULT_GATE_MS 1000
+#define PULSE_DEFAULT_DEBOUNCE 3
+
+// EINT capable pins on MT3620
+#define PULSE_MAX_PIN 23
+
+// data point definition array field sequence
+enum {
+    PULSE_SCHEMA_FIELD_KEY,
+    PULSE_SCHEMA_FIELD_PIN,
+    PULSE_SCHEMA_FIELD_TYPE,
+    PULSE_SCHEMA_FIELD_MULTIPLIER,
+    PULSE_SCHEMA_FIELD_DEADBAND,
+    PULSE_SCHEMA_FIELD_MAX_AGE,
+    PULSE_SCHEMA_FIELD_LAST
+};
+
+typedef struct pulse_read_plan_t pulse_read_plan_t;
+struct pulse_read_plan_t {
+    // pins any point of schema count
+    uint32_t pin_mask;
+};
+
+typedef struct pulse_device_t pulse_device_t;
+struct pulse_device_t {
+    device_driver_t base; // must be first
+    int rtcore_socket_fd;
+    uint16_t gate_ms;
+    uint8_t debounce;
+    // pins RT core is counting, 0 if not started
+    uint32_t pin_mask;
+};
+
+
+static err_code parse_point_definition(const char *ptr, int16_t len, data_point_t *p)
+{
+    if (!ptr || len <= 0 || !p) {
+        return DEVICE_E_CONFIG;
+    }
+
+    char buf[MAX_FIELD_LENGTH + 1];
+
+    pulse_point_t *pp = &(p->d.pulse);
+    // set default value
+    pp->scale = 1;
+    p->deadband = 0;
+    p->deadband_percent = false;
+    p->max_age_ms = -1;
+
+    int16_t field_num = 0;
+
+    for (int16_t b = 0, e = 0; b < len; b = e + 1, e = b) {
+        while (e < len && ptr[e] != ':') {
+            e++;
+        }
+
+        if (e - b > MAX_FIELD_LENGTH) {
+            return DEVICE_E_CONFIG;
+        }
+
+        switch (field_num) {
+        case PULSE_SCHEMA_FIELD_KEY:
+            strncpy_s(p->key, e - b + 1, ptr + b, e - b);
+            break;
+
+        case PULSE_SCHEMA_FIELD_PIN: {
+            strncpy_s(buf, sizeof(buf), ptr + b, e - b);
+            errno = 0;
+            char *endptr = NULL;
+            long pin = strtol(buf, &endptr, 10);
+            if (errno || endptr == buf || pin < 0 || pin > PULSE_MAX_PIN) {
+                return DEVICE_E_CONFIG;
+            }
+            pp->pin = pin;
+            break;
+        }
+
+        case PULSE_SCHEMA_FIELD_TYPE: {
+            strncpy_s(buf, sizeof(buf), ptr + b, e - b);
+            errno = 0;
+            pp->type = strtol(buf, NULL, 10);
+            if (errno || (pp->type != PULSE_TYPE_COUNT && pp->type != PULSE_TYPE_RATE)) {
+                return DEVICE_E_CONFIG;
+            }
+            break;
+        }
+
+        case PULSE_SCHEMA_FIELD_MULTIPLIER: {
+            strncpy_s(buf, sizeof(buf), ptr + b, e - b);
+            errno = 0;
+            double multiplier = strtod(buf, NULL);
+            if (errno || multiplier == 0) {
+                return DEVICE_E_CONFIG;
+            }
+            pp->scale = 1 / multiplier;
+            break;
+        }
+
+        // absolute deadband, or percent of last reported value when end with '%'
+        case PULSE_SCHEMA_FIELD_DEADBAND: {
+            if (e == b) {
+                break;
+            }
+            strncpy_s(buf, sizeof(buf), ptr + b, e - b);
+            errno = 0;
+            char *endptr = NULL;
+            double deadband = strtod(buf, &endptr);
+            if (errno || endptr == buf || deadband < 0) {
+                return DEVICE_E_CONFIG;
+            }
+            p->deadband = deadband;
+            p->deadband_percent = (*endptr == '%');
+            break;
+        }
+
+        // ms value from poll may serve on-demand read, empty to use schema maxAge
+        case PULSE_SCHEMA_FIELD_MAX_AGE: {
+            if (e == b) {
+                break;
+            }
+            strncpy_s(buf, sizeof(buf), ptr + b, e - b);
+            errno = 0;
+            char *endptr = NULL;
+            long max_age = strtol(buf, &endptr, 10);
+            if (errno || endptr == buf || max_age < 0 || max_age > INT32_MAX) {
+                return DEVICE_E_CONFIG;
+            }
+            p->max_age_ms = max_age;
+            break;
+        }
+        }
+
+        field_num++;
+    }
+
+    // minimum is key, pin, type
+    if (field_num < 3) {
+        return DEVICE_E_CONFIG;
+    } else {
+        return DEVICE_OK;
+    }
+}
+
+/// <summary>
+/// start counting on pins not counted yet, RT core can only be configured as
+/// a whole so counters restart when pins are added
+/// </summary>
+/// <returns>DEVICE_OK on success, or error code on failure</returns>
+static err_code ensure_counting(pulse_device_t *self, uint32_t pin_mask, int32_t timeout)
+{
+    if ((pin_mask & ~self->pin_mask) == 0) {
+        return DEVICE_OK;
+    }
+
+    if (self->pin_mask) {
+        LOGW("Pulse counters restart to add pins 0x%x", pin_mask & ~self->pin_mask);
+        ipc_pulse_stop(self->rtcore_socket_fd, timeout);
+        self->pin_mask = 0;
+    }
+
+    ipc_pulse_config_t config = {
+        .pin_mask = self->pin_mask | pin_mask, .gate_ms = self->gate_ms, .debounce = self->debounce};
+    err_code err = ipc_pulse_start(self->rtcore_socket_fd, &config, timeout);
+    if (err) {
+        LOGE("Failed to start pulse counting on pins 0x%x: %s", config.pin_mask, err_str(err));
+        return err;
+    }
+
+    self->pin_mask = config.pin_mask;
+    return DEVICE_OK;
+}
+
+static double point_value(const pulse_point_t *pp, const ipc_pulse_reading_t *reading)
+{
+    if (pp->type == PULSE_TYPE_RATE) {
+        return reading->frequency_mhz / 1000.0 * pp->scale;
+    } else {
+        return reading->count * (double)pp->scale;
+    }
+}
+
+static const ipc_pulse_reading_t *find_reading(const ipc_pulse_reading_t *readings, int32_t num_reading,
+                                               uint8_t pin)
+{
+    for (int32_t i = 0; i < num_reading; i++) {
+        if (readings[i].pin == pin) {
+            return &readings[i];
+        }
+    }
+    return NULL;
+}
+
+// ------------------------ public interface --------------------------------
+
+
+err_code pulse_open(void *instance, uint32_t unit_id, int32_t timeout)
+{
+    pulse_device_t *self = (pulse_device_t *)instance;
+    if (self->rtcore_socket_fd >= 0) {
+        return DEVICE_OK;
+    }
+
+    self->rtcore_socket_fd = Application_Connect(RT_APP_COMPONENT_ID);
+    if (self->rtcore_socket_fd == -1) {
+        LOGW("ERROR: Unable to create socket: %d (%s)\n", errno, strerror(errno));
+        return DEVICE_E_IO;
+    }
+
+    // Set timeout, to handle case where real-time capable application does not respond.
+    struct timeval rt_timeout = {.tv_sec = 0, .tv_usec = timeout * 1000 / 4};
+    setsockopt(self->rtcore_socket_fd, SOL_SOCKET, SO_SNDTIMEO, &rt_timeout, sizeof(rt_timeout));
+    setsockopt(self->rtcore_socket_fd, SOL_SOCKET, SO_RCVTIMEO, &rt_timeout, sizeof(rt_timeout));
+
+    self->pin_mask = 0;
+    return DEVICE_OK;
+}
+
+
+err_code pulse_close(void *instance)
+{
+    pulse_device_t *self = (pulse_device_t *)instance;
+    ASSERT(self);
+
+    LOGD("pulse_close");
+
+    if (self->rtcore_socket_fd >= 0) {
+        if (self->pin_mask) {
+            ipc_pulse_stop(self->rtcore_socket_fd, PULSE_DEFAULT_GATE_MS);
+            self->pin_mask = 0;
+        }
+        close(self->rtcore_socket_fd);
+        self->rtcore_socket_fd = -1;
+    }
+
+    return DEVICE_OK;
+}
+
+
+err_code pulse_get_point(void *instance, uint32_t unit_id, const char *key, data_schema_t *schema,
+                         telemetry_t *telemetry, int32_t timeout)
+{
+    pulse_device_t *self = (pulse_device_t *)instance;
+
+    if (self->rtcore_socket_fd < 0) {
+        return DEVICE_E_BROKEN;
+    }
+
+    int index = find_read_point_index(schema, key);
+    if (index < 0) {
+        LOGE("Can't read invalid data point %s", key);
+        return DEVICE_E_INVALID;
+    }
+    pulse_point_t *pp = &schema->points[index].d.pulse;
+
+    err_code err = ensure_counting(self, 1u << pp->pin, timeout);
+    if (err) {
+        return err;
+    }
+
+    ipc_pulse_reading_t readings[PULSE_MAX_PINS];
+    int32_t num_reading = 0;
+    err = ipc_pulse_read(self->rtcore_socket_fd, readings, PULSE_MAX_PINS, &num_reading, timeout);
+    if (err) {
+        LOGW("Failed to read point '%s':%d", key, pp->pin);
+        return err;
+    }
+
+    const ipc_pulse_reading_t *reading = find_reading(readings, num_reading, pp->pin);
+    if (!reading) {
+        return DEVICE_E_NO_DATA;
+    }
+
+    set_telemetry_number_value(telemetry, index, point_value(pp, reading), &schema->points[index]);
+    return DEVICE_OK;
+}
+
+
+err_code pulse_get_point_list(void *instance, uint32_t unit_id, data_schema_t *schema, telemetry_t *telemetry,
+                              int32_t timeout)
+{
+    pulse_device_t *self = (pulse_device_t *)instance;
+
+    if (self->rtcore_socket_fd < 0) {
+        return DEVICE_E_BROKEN;
+    }
+
+    pulse_read_plan_t *plan = (pulse_read_plan_t *)schema->read_plan;
+    if (!plan) {
+        LOGE("Schema %s has no read plan", schema->name);
+        return DEVICE_E_CONFIG;
+    }
+
+    err_code err = ensure_counting(self, plan->pin_mask, timeout);
+    if (err) {
+        return err;
+    }
+
+    ipc_pulse_reading_t readings[PULSE_MAX_PINS];
+    int32_t num_reading = 0;
+    err = ipc_pulse_read(self->rtcore_socket_fd, readings, PULSE_MAX_PINS, &num_reading, timeout);
+    if (err) {
+        return err;
+    }
+
+    for (int32_t i = 0; i < schema->num_read_point; i++) {
+        pulse_point_t *pp = &schema->points[i].d.pulse;
+        const ipc_pulse_reading_t *reading = find_reading(readings, num_reading, pp->pin);
+        if (!reading) {
+            LOGW("No pulse reading of pin %d for point %s", pp->pin, schema->points[i].key);
+            return DEVICE_E_NO_DATA;
+        }
+        set_telemetry_number_value(telemetry, i, point_value(pp, reading), &schema->points[i]);
+    }
+
+    return DEVICE_OK;
+}
+
+
+err_code pulse_set_point(void *instance, uint32_t unit_id, const char *key, const char *value,
+                         data_schema_t *schema, int32_t timeout)
+{
+    LOGE("Can't write pulse counter point %s", key);
+    return DEVICE_E_INVALID;
+}
+
+
+device_protocol_t pulse_get_protocol(void *instance)
+{
+    return DEVICE_PROTOCOL_PULSE;
+}
+
+
+err_code pulse_create_point_table(struct json_token *points_def, int *npoints, data_point_t **ppoints)
+{
+    if (!points_def || !points_def->ptr || points_def->len == 0) {
+        LOGW("schema has no points defintion");
+        *npoints = 0;
+        *ppoints = NULL;
+        return DEVICE_OK;
+    }
+
+    const char *ptr = points_def->ptr;
+    int len = points_def->len;
+    int num_point = 0;
+    size_t total_key_len = 0;
+
+    for (int b = 0, e = 0; b < len; b = e + 1, e = b) {
+        while (e < len && ptr[e] != ':') {
+            e++;
+        }
+        total_key_len += e - b;
+
+        while (e < len && ptr[e] != ',') {
+            e++;
+        }
+        num_point++;
+    }
+
+    data_point_t *points = CALLOC(num_point, sizeof(data_point_t));
+    // All keys been put in a single memory block to avoid fragment
+    char *keys = MALLOC(total_key_len + num_point);
+
+    for (int b = 0, e = 0, i = 0; b < len && i < num_point; b = e + 1, e = b, i++) {
+        while (e < len && ptr[e] != ',') {
+            e++;
+        }
+
+        data_point_t *p = &points[i];
+        p->key = keys;
+        if (parse_point_definition(ptr + b, e - b, p) != DEVICE_OK) {
+            LOGE("Failed to parse definition: [%.*s]", e - b, ptr + b);
+            pulse_destroy_point_table(points, num_point);
+            return DEVICE_E_CONFIG;
+        }
+
+        keys += strlen(p->key) + 1; // make sure to include null terminate
+    }
+
+    *npoints = num_point;
+    *ppoints = points;
+    return DEVICE_OK;
+}
+
+
+void pulse_destroy_point_table(data_point_t *points, int npoint)
+{
+    ASSERT(points);
+    // All keys been put in a single memory block to avoid fragment
+    FREE(points[0].key);
+    FREE(points);
+}
+
+
+err_code pulse_create_read_plan(const data_schema_t *schema, void **pplan)
+{
+    ASSERT(schema);
+    ASSERT(pplan);
+
+    // all pins are read by one request and must stay counting, so plan of
+    // any poll groups covers every point
+    pulse_read_plan_t *plan = (pulse_read_plan_t *)CALLOC(1, sizeof(pulse_read_plan_t));
+    for (int32_t i = 0; i < schema->num_read_point; i++) {
+        plan->pin_mask |= 1u << schema->points[i].d.pulse.pin;
+    }
+
+    if (__builtin_popcount(plan->pin_mask) > PULSE_MAX_PINS) {
+        LOGE("Schema %s counts more than %d pins", schema->name, PULSE_MAX_PINS);
+        pulse_destroy_read_plan(plan);
+        return DEVICE_E_CONFIG;
+    }
+
+    LOGI("Schema %s: %d points on pins 0x%x", schema->name, schema->num_read_point, plan->pin_mask);
+
+    *pplan = plan;
+    return DEVICE_OK;
+}
+
+
+void pulse_destroy_read_plan(void *plan)
+{
+    ASSERT(plan);
+    FREE(plan);
+}
+
+
+device_driver_t *pulse_create_driver(device_protocol_t protocol, const char *conn_str)
+{
+    unsigned int gate_ms = PULSE_DEFAULT_GATE_MS;
+    unsigned int debounce = PULSE_DEFAULT_DEBOUNCE;
+
+    // counter settings are the first field of connection string
+    if (conn_str && *conn_str && *conn_str != ',' && sscanf(conn_str, "%u:%u", &gate_ms, &debounce) < 1) {
+        LOGE("pulse invalid counter config: %s", conn_str);
+        return NULL;
+    }
+
+    if (gate_ms == 0 || gate_ms > UINT16_MAX || debounce > 7) {
+        LOGE("pulse invalid gate %u ms or debounce %u", gate_ms, debounce);
+        return NULL;
+    }
+
+    pulse_device_t *pulse = (pulse_device_t *)CALLOC(1, sizeof(pulse_device_t));
+
+    pulse->base.driver_open = pulse_open;
+    pulse->base.driver_close = pulse_close;
+    pulse->base.get_point = pulse_get_point;
+    pulse->base.get_point_list = pulse_get_point_list;
+    pulse->base.set_point = pulse_set_point;
+    pulse->base.get_protocol = pulse_get_protocol;
+
+    pulse->rtcore_socket_fd = -1;
+    pulse->gate_ms = gate_ms;
+    pulse->debounce = debounce;
+    pulse->pin_mask = 0;
+
+    LOGI("Created pulse driver: gate=%u ms, debounce=%u", gate_ms, debounce);
+
+    return (device_driver_t *)pulse;
+}
+
+
+void pulse_destroy_driver(device_driver_t *instance)
+{
+    pulse_device_t *self = (pulse_device_t *)instance;
+    ASSERT(self);
+
+    LOGI("Destroy pulse driver");
+
+    if (self->rtcore_socket_fd >= 0) {
+        pulse_close(self);
+    }
+    FREE(self);
+}
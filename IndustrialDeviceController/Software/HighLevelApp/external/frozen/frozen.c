@@ -439,6 +439,36 @@ static int json_doit(struct frozen *f) {
   return json_parse_value(f);
 }
 
+/* printable ASCII other than '"' and '\\', copied by json_escape as it is */
+#define JSON_IS_PLAIN(ch) ((ch) >= 0x20 && (ch) < 0x7f && (ch) != '"' && (ch) != '\\')
+
+/* bytes of a word, and word-at-a-time tests for any byte below n or equal to c */
+#define JSON_ONES ((size_t) -1 / 0xff)
+#define JSON_HIGHS (JSON_ONES * 0x80)
+#define JSON_HAS_LESS(w, n) (((w) - JSON_ONES * (n)) & ~(w) & JSON_HIGHS)
+#define JSON_HAS_BYTE(w, c) JSON_HAS_LESS((w) ^ (JSON_ONES * (c)), 1)
+
+/*
+ * Length of the run of plain characters at the start of p, tested a word at
+ * a time, so keys and values with nothing to escape are printed in one call.
+ */
+static size_t json_plain_run(const unsigned char *p, size_t len) {
+  size_t i = 0;
+
+  while (i + sizeof(size_t) <= len) {
+    size_t w;
+    memcpy(&w, p + i, sizeof(w));
+    if ((w & JSON_HIGHS) || JSON_HAS_LESS(w, 0x20) || JSON_HAS_BYTE(w, 0x7f) ||
+        JSON_HAS_BYTE(w, '"') || JSON_HAS_BYTE(w, '\\')) {
+      break;
+    }
+    i += sizeof(w);
+  }
+
+  while (i < len && JSON_IS_PLAIN(p[i])) i++;
+  return i;
+}
+
 int json_escape(struct json_out *out, const char *p, size_t len) WEAK;
 int json_escape(struct json_out *out, const char *p, size_t len) {
   size_t i, cl, n = 0;
@@ -446,6 +476,13 @@ int json_escape(struct json_out *out, const char *p, size_t len) {
   const char *specials = "btnvfr";
 
   for (i = 0; i < len; i++) {
+    size_t run = json_plain_run((const unsigned char *) p + i, len - i);
+    if (run > 0) {
+      n += out->printer(out, p + i, run);
+      i += run;
+      if (i == len) break;
+    }
+
     unsigned char ch = ((unsigned char *) p)[i];
     if (ch == '"' || ch == '\\') {
       n += out->printer(out, "\\", 1);
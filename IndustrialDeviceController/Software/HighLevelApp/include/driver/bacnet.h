@@ -0,0 +1,58 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdint.h>
+
+#include <init/device_hal.h>
+
+// properties read with one ReadPropertyMultiple, keep the response well
+// within the smallest max APDU devices commonly accept (480 octets) as
+// segmentation is not supported
+#define BACNET_MAX_POINTS_PER_REQUEST 16
+
+struct json_token;
+/**
+ * create bacnet point defintion table
+ * @param points_def json token contain point defintion for bacnet
+ * @param npoints out parameter contains number of points parsed on success
+ * @param ppoints out parameter contains array of points parsed on success
+ * @return DEVICE_OK on succeed or error code
+ */
+err_code bacnet_create_point_table(struct json_token *points_def, int *npoints, data_point_t **ppoints);
+
+/**
+ * destroy bacnet point defintion table
+ * @param points point defintion table to be destroyed
+ * @param npoints number of points in table
+ */
+void bacnet_destroy_point_table(data_point_t *points, int npoints);
+
+/**
+ * create bacnet read plan, points are sorted by object and property then
+ * split into ReadPropertyMultiple requests of BACNET_MAX_POINTS_PER_REQUEST
+ * @param schema schema with point table created
+ * @param pplan out parameter contains read plan created on success
+ * @return DEVICE_OK on succeed or error code
+ */
+err_code bacnet_create_read_plan(const data_schema_t *schema, void **pplan);
+
+/**
+ * destroy bacnet read plan
+ * @param plan read plan to be destroyed
+ */
+void bacnet_destroy_read_plan(void *plan);
+
+/**
+ * create bacnet/ip device driver
+ * @param protocol always DEVICE_PROTOCOL_BACNET_IP
+ * @param conn_str "ip[:port]" of device, port default to 47808
+ * @return device driver created
+ */
+device_driver_t *bacnet_create_driver(device_protocol_t protocol, const char *conn_str);
+
+/**
+ * destroy bacnet/ip device driver
+ * @param self device driver to be destroyed
+ */
+void bacnet_destroy_driver(device_driver_t *self);
@@ -2,12 +2,16 @@
    Licensed under the MIT License. */
 
 #pragma once
+#include <stdbool.h>
 #include <stdint.h>
 
 #include <init/device_hal.h>
 
 #define MODBUS_MAX_PDU_SIZE 253
 
+// writes to this unit id reach every slave on the bus, none of them respond
+#define MODBUS_BROADCAST_ID 0
+
 // only define supported function code
 enum {
     FC_INVALID = 0x00,
@@ -82,6 +86,21 @@ err_code modbus_create_point_table(struct json_token *points_def, int *npoints,
  */
 void modbus_destroy_point_table(data_point_t *points, int npoints);
 
+/**
+ * create modbus read plan, points are sorted by register type and address then
+ * merged into as few read requests as allowed by schema max_gap and protocol limit
+ * @param schema schema with point table created
+ * @param pplan out parameter contains read plan created on success
+ * @return DEVICE_OK on succeed or error code
+ */
+err_code modbus_create_read_plan(const data_schema_t *schema, void **pplan);
+
+/**
+ * destroy modbus read plan
+ * @param plan read plan to be destroyed
+ */
+void modbus_destroy_read_plan(void *plan);
+
 /**
  * create modbus device driver
  * @param protocol modbus rtu or tcp
@@ -95,3 +114,26 @@ device_driver_t *modbus_create_driver(device_protocol_t protocol, const char *co
  * @param self device driver to be destroyed
  */
 void modbus_destroy_driver(device_driver_t *self);
+
+/**
+ * keep registers of every poll in register cache, not only of schemas with
+ * points served from cache
+ * @param self modbus device driver
+ * @param keep true to keep them
+ */
+void modbus_keep_cache(device_driver_t *self, bool keep);
+
+/**
+ * read polled registers from register cache, without touching the bus
+ * @param self modbus device driver
+ * @param unit_id unit id on the downlink
+ * @param function_code read function code, FC_READ_COILS to FC_READ_INPUT_REGISTERS
+ * @param addr register address to read, on the wire
+ * @param quantity register quantity to read
+ * @param max_age_ms max age of registers in ms
+ * @param regs out parameter contains value of registers on success, one per bit for coils and inputs
+ * @return DEVICE_OK, DEVICE_E_NO_DATA if some register is not polled, DEVICE_E_TIMEOUT if
+ *         some is older than max_age_ms, DEVICE_E_INVALID if function code is not a read
+ */
+err_code modbus_read_cache(device_driver_t *self, uint32_t unit_id, uint8_t function_code, uint16_t addr,
+                           uint16_t quantity, int32_t max_age_ms, uint16_t *regs);
@@ -0,0 +1,65 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdint.h>
+
+#include <init/device_hal.h>
+
+// pins are counted by the RT core, which allows this many at once
+#define PULSE_MAX_PINS 8
+
+// what a pulse point reports of its pin
+enum {
+    PULSE_TYPE_INVALID = 0,
+    // pulses counted since counting started, divided by multiplier
+    PULSE_TYPE_COUNT = 1,
+    // pulses per second over the last gate window, divided by multiplier
+    PULSE_TYPE_RATE = 2
+};
+
+struct json_token;
+/**
+ * create pulse point defintion table
+ * @param points_def json token contain point defintion for pulse counter
+ * @param npoints out parameter contains number of points parsed on success
+ * @param ppoints out parameter contains array of points parsed on success
+ * @return DEVICE_OK on succeed or error code
+ */
+err_code pulse_create_point_table(struct json_token *points_def, int *npoints, data_point_t **ppoints);
+
+/**
+ * destroy pulse point defintion table
+ * @param points point defintion table to be destroyed
+ * @param npoints number of points in table
+ */
+void pulse_destroy_point_table(data_point_t *points, int npoints);
+
+/**
+ * create pulse read plan, the mask of pins points of schema count
+ * @param schema schema with point table created
+ * @param pplan out parameter contains read plan created on success
+ * @return DEVICE_OK on succeed or error code
+ */
+err_code pulse_create_read_plan(const data_schema_t *schema, void **pplan);
+
+/**
+ * destroy pulse read plan
+ * @param plan read plan to be destroyed
+ */
+void pulse_destroy_read_plan(void *plan);
+
+/**
+ * create pulse counter device driver
+ * @param protocol always DEVICE_PROTOCOL_PULSE
+ * @param conn_str "gate_ms[:debounce]", frequency window in ms and debounce
+ *        rate 0 (8 kHz) to 7 (62.5 Hz), may be followed by ',' and other fields
+ * @return device driver created
+ */
+device_driver_t *pulse_create_driver(device_protocol_t protocol, const char *conn_str);
+
+/**
+ * destroy pulse counter device driver
+ * @param self device driver to be destroyed
+ */
+void pulse_destroy_driver(device_driver_t *self);
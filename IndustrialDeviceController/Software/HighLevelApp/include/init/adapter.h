@@ -38,6 +38,16 @@ void adapter_deinit(void);
  */
 void adapter_provision(const char *payload, size_t payload_size, bool flush);
 
+/**
+ * write a point of schema to broadcast address of every modbus downlink with
+ * device of that schema, once per downlink however many devices it has
+ * @param schema_name name of schema point is defined in
+ * @param key point to write
+ * @param value value to write
+ * @return number of downlinks write is queued on, or -1 if point is invalid
+ */
+int adapter_broadcast_point(const char *schema_name, const char *key, const char *value);
+
 /**
  * @return string name of adapter
  */
@@ -8,22 +8,33 @@
 #include <time.h>
 
 #include <frozen/frozen.h>
+#include <iot/diag.h>
+#include <utils/arena.h>
 
 // bitmap flags
 #define FLAG_NONE         0x0
 #define FLAG_NO_BATCH     0x00000001u
 #define FLAG_CE_TIMESTAMP 0x00000002u
 #define FLAG_COV          0x00000004u
+#define FLAG_SUBSCRIBE    0x00000008u
+#define FLAG_VERIFY_WRITE 0x00000010u
 
 #define FLAG_NO_BATCH_STR     "no_batch"
 #define FLAG_CE_TIMESTAMP_STR "ce_timestamp"
 #define FLAG_COV_STR          "cov"
+#define FLAG_SUBSCRIBE_STR    "subscribe"
+#define FLAG_VERIFY_WRITE_STR "verify_write"
 
 
 #define IS_COV(telemetry, index) test_mask((telemetry)->cov_mask, index)
 #define IS_STR_VALUE(telemetry, index) test_mask((telemetry)->str_mask, index)
 #define IS_NUM_VALUE(telemetry, index) (!test_mask((telemetry)->str_mask, index))
 
+// poll groups of a schema, group 0 hold points not listed in any group
+#define SCHEMA_MAX_GROUPS 4
+// point is in group mask, empty mask stands for all groups
+#define IN_POINT_GROUPS(schema, groups, index) (!(groups) || (((groups) >> (schema)->points[index].group) & 1))
+
 typedef enum err_code err_code;
 enum err_code {
     DEVICE_OK,
@@ -42,7 +53,9 @@ enum err_code {
 typedef enum device_protocol_t {
     DEVICE_PROTOCOL_INVALID,
     DEVICE_PROTOCOL_MODBUS_TCP,
-    DEVICE_PROTOCOL_MODBUS_RTU
+    DEVICE_PROTOCOL_MODBUS_RTU,
+    DEVICE_PROTOCOL_PULSE,
+    DEVICE_PROTOCOL_BACNET_IP
 } device_protocol_t;
 
 
@@ -56,11 +69,46 @@ struct modbus_point_t {
     uint8_t bit_offset : 4;
 };
 
+typedef struct pulse_point_t pulse_point_t;
+struct pulse_point_t {
+    // reported value is counter value divided by multiplier, e.g. pulses per kWh
+    float scale;
+    uint8_t pin;
+    uint8_t type;
+};
+
+typedef struct bacnet_point_t bacnet_point_t;
+struct bacnet_point_t {
+    // reported value is property value divided by multiplier
+    float scale;
+    uint32_t instance;
+    uint32_t property;
+    uint16_t object_type;
+};
+
 typedef struct data_point_t data_point_t;
 struct data_point_t {
     char *key;
+    // value change within deadband is not reported as COV, absolute value or
+    // percent of last reported value, 0 to report any change
+    float deadband;
+    bool deadband_percent;
+    // ms polled value may be served from cache to on-demand read, -1 to use
+    // schema max_age_ms
+    int32_t max_age_ms;
+    // poll group point belongs to, 0 is polled at device interval
+    uint8_t group;
+    // alarm class point, its change is sent at once on priority path
+    bool priority;
+    // point is kept and may feed computed points, but is not uploaded
+    bool hidden;
+    // point group has an aggregation window, point is only reported as
+    // statistics of its window
+    bool aggregated;
     union {
         modbus_point_t modbus;
+        pulse_point_t pulse;
+        bacnet_point_t bacnet;
     } d;
 };
 
@@ -69,36 +117,130 @@ typedef struct data_schema_t data_schema_t;
 struct data_schema_t {
     char *name;
     int interval;
+    // bound poll interval stretch to while values don't change, 0 to not adapt
+    int32_t max_interval;
     int timeout;
     uint32_t flags;
     int offset;
     device_protocol_t protocol;
+    // points read from device come first, computed points follow them
     data_point_t *points;
     int32_t num_point;
+    int32_t num_read_point;
+    // expressions of computed points, id j is point num_read_point + j, NULL if none
+    struct expr_program_t *computed;
     int32_t integrity_period_ms;
+    // max hole in registers allowed to bridge when batching reads, -1 if no limit
+    int32_t max_gap;
+    // ms polled value may be served from cache to on-demand read, 0 to always
+    // read from device
+    int32_t max_age_ms;
+    // protocol specific read plan computed from points when schema loaded
+    void *read_plan;
+    // number of priority points
+    int32_t num_priority;
+    // poll groups, interval of group 0 is device interval
+    int32_t num_group;
+    int32_t group_interval[SCHEMA_MAX_GROUPS];
+    int32_t group_max_interval[SCHEMA_MAX_GROUPS];
+    // ms aggregation window of each group, 0 to report group every poll
+    int32_t group_window_ms[SCHEMA_MAX_GROUPS];
+    // groups with aggregation window, and number of points not aggregated nor hidden
+    uint32_t window_groups;
+    int32_t num_reported;
+    // groups read plan being created covers, 0 for all
+    uint32_t plan_groups;
+    // read plan of each proper subset of groups, indexed by group mask
+    void *group_plans[1 << SCHEMA_MAX_GROUPS];
+    // open addressing hash index from point key to point index, -1 for empty slot
+    int32_t *key_index;
+    uint32_t key_index_mask;
+    // hash of all point keys in order, identify key list for index based encoding
+    uint32_t key_hash;
+    // hash of schema definition in provision, to tell if it changed on reprovision
+    uint64_t def_hash;
     data_schema_t *next;
 };
 
-typedef union telemetry_value_t telemetry_value_t;
-union telemetry_value_t {
-        double num;
-        char *str;
+// string value of a point, short ones are kept inline and longer ones in
+// string arena of telemetry, so a changing string isn't allocated every poll
+#define TELEMETRY_INLINE_STR 16
+
+typedef struct telemetry_str_t telemetry_str_t;
+struct telemetry_str_t {
+    // slot in string arena, NULL when string is inline
+    char *ext;
+    // size of arena slot, reused by any string that fits
+    uint32_t cap;
+    char buf[TELEMETRY_INLINE_STR];
 };
 
+// statistics of number values of a point since its aggregation window opened
+typedef struct telemetry_window_t telemetry_window_t;
+struct telemetry_window_t {
+    uint32_t count;
+    double sum;
+    double min;
+    double max;
+};
+
+// values are kept as parallel arrays, so COV scan and serialization walk
+// plain doubles rather than a union per point
 typedef struct telemetry_t telemetry_t;
 struct telemetry_t {
     uint8_t *cov_mask;
     uint8_t *str_mask;
-    telemetry_value_t *values;
+    // number value of each point, NAN if not available or point is string
+    double *nums;
+    // value of each point when its change was last reported, deadband is
+    // applied against it. Allocated for schema with "cov" flag only, without
+    // it deadband doesn't apply
+    double *reported;
+    // string value of each point, allocated on first string value
+    telemetry_str_t *strs;
+    // arena of strings not fitting inline, compacted once most of it is stale
+    arena_t *str_arena;
+    size_t str_stale;
+    // window statistics of each point, allocated if schema aggregates, only
+    // aggregated points accumulate
+    telemetry_window_t *window;
     int num_values;
+    // when driver got last response of a read, zero if driver doesn't record it
+    struct timespec ts_response;
+};
+
+// monotonic timestamps of one reading on its way to iot hub
+typedef struct telemetry_trace_t telemetry_trace_t;
+struct telemetry_trace_t {
+    struct timespec ts_poll;
+    struct timespec ts_response;
+    struct timespec ts_decoded;
+    struct timespec ts_queued;
+};
+
+// circuit breaker of a device, a device that stopped answering is only probed
+typedef enum breaker_state_t breaker_state_t;
+enum breaker_state_t {
+    BREAKER_CLOSED,
+    // too many polls failed in a row, device is probed at backoff
+    BREAKER_OPEN,
+    // probe answered, next full poll close or open it again
+    BREAKER_HALF_OPEN
 };
 
 struct device_driver_t;
+struct downlink_t;
 typedef struct ce_device_t ce_device_t;
 struct ce_device_t {
     // scheduled time for next poll
     struct timespec ts_schedule;
 
+    // next poll of each point group, ts_schedule is the earliest of them
+    struct timespec ts_group[SCHEMA_MAX_GROUPS];
+
+    // groups polled by current poll, 0 for all
+    uint32_t poll_groups;
+
     // ms of last poll
     int32_t poll_duration;
 
@@ -117,6 +259,12 @@ struct ce_device_t {
     // report interval in ms
     int32_t interval;
 
+    // bound interval stretch to while values don't change, 0 to not adapt
+    int32_t max_interval;
+
+    // adaptive interval of device, or of each point group, 0 if not stretched
+    int32_t cur_interval[SCHEMA_MAX_GROUPS];
+
     // poll timeout in ms
     int32_t timeout;
 
@@ -132,14 +280,94 @@ struct ce_device_t {
     // device id, assume unit32 value unless there is new requirement
     uint32_t id;
 
+    // unit id local modbus tcp gateway serves device as, 0 if not served
+    uint8_t gateway_unit;
+
     telemetry_t *telemetry;
 
+    // reusable buffer telemetry message serialized into, sized from schema
+    char *message_buf;
+    size_t message_buf_size;
+
     struct timespec last_flush_ts;
 
+    // downlink (driver + connection) this device is polled through
+    struct downlink_t *downlink;
+
+    // slave on downlink this device is, shared by devices of same id
+    struct bus_slave_t *slave;
+
+    // true while device is queued or being polled by a worker
+    bool busy;
+
+    // tie breaker for devices with same schedule time, lower run first
+    uint32_t sched_seq;
+
+    // ms last poll started behind schedule and the worst seen so far
+    int32_t late_ms;
+    int32_t max_late_ms;
+
+    // next device in downlink work queue
+    ce_device_t *queue_next;
+
+    // hash of device definition in provision, to tell if it changed on reprovision
+    uint64_t def_hash;
+
+    // diag values logged after every poll: duration, lateness and worst lateness
+    diag_handle_t diag_poll;
+    diag_handle_t diag_late;
+    diag_handle_t diag_max_late;
+
+    // consecutive failed polls, breaker opens at ADAPTER_BREAKER_FAILURES
+    int32_t failures;
+    breaker_state_t breaker;
+    // ms between probes while breaker is open
+    int32_t backoff_ms;
+    diag_handle_t diag_breaker;
+
+    // id change notification of this device is reported with, never reused
+    // so notification of a retired subscription can't hit another device
+    uint32_t subscriber;
+
+    // device accepted change subscription, so is only polled for integrity
+    bool subscribed;
+
+    // last time subscription was made or tried
+    struct timespec ts_subscribe;
+
+    // changes notified while device was busy, applied when its poll is done
+    telemetry_t *pending;
+
+    // telemetry has changes notified and not reported yet
+    bool notified;
+
+    // when last successful poll completed
+    struct timespec ts_acquired;
+
+    // trace of last poll, and of telemetry waiting in a batch
+    telemetry_trace_t trace;
+    telemetry_trace_t batch_trace;
+
+    // value of priority points last seen, NAN until first read
+    double *priority_values;
+
+    // aggregation window of each group samples are accumulated in, as wall
+    // clock ms / window ms so windows align to the clock, 0 before first poll
+    int64_t window_index[SCHEMA_MAX_GROUPS];
+
     ce_device_t* next;    
 };
 
 
+/**
+ * called by driver for each point value change notified by device
+ * @param context context given to read_notification
+ * @param subscriber subscriber id given to subscribe
+ * @param index index of point in schema subscribed
+ * @param value new value of point, already scaled
+ */
+typedef void (*point_notify_fn)(void *context, uint32_t subscriber, int32_t index, double value);
+
 typedef struct device_driver_t device_driver_t;
 struct device_driver_t {
 /**
@@ -194,12 +422,74 @@ struct device_driver_t {
     err_code (*set_point)(void *instance, uint32_t id, const char *key, const char *value, data_schema_t *schema,
                           int32_t timeout);
 
+/**
+ * set data points to new values with as few requests as protocol allow, NULL if
+ * driver can only write them one by one with set_point
+ * @param self point to driver to be used
+ * @param id channel to be use
+ * @param keys data point names to be set
+ * @param values data point values to be set, in order of keys
+ * @param num_point number of points to be set
+ * @param schema data schema which contain defintion of data points
+ * @param timeout protection timer in ms for all of the writes
+ * @return DEVICE_OK if all points been set, or error code of first failure
+ */
+    err_code (*set_point_list)(void *instance, uint32_t id, const char *const *keys, const char *const *values,
+                               int32_t num_point, data_schema_t *schema, int32_t timeout);
+
 /**
  * get protocol of current driver
  * @param instance driver instance
  * @return device protocol of current driver
  */
     device_protocol_t (*get_protocol)(void *instance);
+
+/**
+ * subscribe to change notification of points in schema, NULL if protocol has
+ * no server side change notification. Subscription lapses after lifetime
+ * unless subscribed again, subscribing again replace previous subscription.
+ * Runs on worker thread, and wait for notify fd being read to get device's answer.
+ * @param instance driver instance
+ * @param id channel of device
+ * @param subscriber id notifications of this subscription are reported with
+ * @param schema data schema which contain defintion of data points
+ * @param lifetime_s seconds subscription lasts
+ * @param timeout protection timer in ms
+ * @return DEVICE_OK if device accepted subscription or error code
+ */
+    err_code (*subscribe)(void *instance, uint32_t id, uint32_t subscriber, data_schema_t *schema,
+                          int32_t lifetime_s, int32_t timeout);
+
+/**
+ * get file descriptor readable when notification arrive, NULL if subscribe is NULL
+ * @param instance driver instance
+ * @return file descriptor, or -1 if driver can't receive notification
+ */
+    int (*get_notify_fd)(void *instance);
+
+/**
+ * read notifications arrived on notify fd without blocking, runs on event loop thread
+ * @param instance driver instance
+ * @param notify called for each point changed
+ * @param context passed to notify
+ */
+    void (*read_notification)(void *instance, point_notify_fn notify, void *context);
+};
+
+struct json_token;
+// everything a protocol implement to be polled by adapter, registered in
+// protocol_drivers table of device_hal.c
+typedef struct protocol_driver_t protocol_driver_t;
+struct protocol_driver_t {
+    device_protocol_t protocol;
+    // name of protocol in schema and log
+    const char *name;
+    err_code (*create_point_table)(struct json_token *points_def, int *npoints, data_point_t **ppoints);
+    void (*destroy_point_table)(data_point_t *points, int npoints);
+    err_code (*create_read_plan)(const data_schema_t *schema, void **pplan);
+    void (*destroy_read_plan)(void *plan);
+    device_driver_t *(*create_driver)(device_protocol_t protocol, const char *conn_str);
+    void (*destroy_driver)(device_driver_t *driver);
 };
 
 /**
@@ -246,6 +536,13 @@ const char *err_str(err_code err);
  */ 
 device_protocol_t str2protocol(const char *str);
 
+/**
+ * find registered driver of protocol
+ * @param protocol protocol enum value
+ * @return driver of protocol, or NULL if protocol not supported
+ */
+const protocol_driver_t *find_protocol_driver(device_protocol_t protocol);
+
 /**
  * convert protocol enum value to protocol string value
  * @param proto - protocol enum value
@@ -271,6 +568,57 @@ err_code create_point_table(device_protocol_t protocol, struct json_token *point
  */
 void destroy_point_table(device_protocol_t protocol, data_point_t *points, int npoints);
 
+/**
+ * build hash index of point keys for schema, index is stored in schema->key_index
+ * @param schema schema with point table already created
+ */
+void create_point_index(data_schema_t *schema);
+
+/**
+ * destroy hash index of point keys
+ * @param schema schema which own the index
+ */
+void destroy_point_index(data_schema_t *schema);
+
+/**
+ * find index of point by key
+ * @param schema schema to search
+ * @param key point key
+ * @return index of point in schema->points, or -1 if not found
+ */
+int find_point_index(const data_schema_t *schema, const char *key);
+
+/**
+ * find index of a point read from device by key, for drivers
+ * @param schema schema to search
+ * @param key point key
+ * @return index of point in schema->points, or -1 if not found or point is computed
+ */
+int find_read_point_index(const data_schema_t *schema, const char *key);
+
+/**
+ * factory method to create read plan of a schema, plan is stored in schema->read_plan,
+ * with multiple poll groups a plan of every proper subset of groups is stored in
+ * schema->group_plans, so groups due together are read in one merged plan
+ * @param protocol protocol enum of schema
+ * @param schema schema with point table already created
+ * @return DEVICE_OK on succeed or error code
+ */
+err_code create_read_plan(device_protocol_t protocol, data_schema_t *schema);
+
+/**
+ * destroy read plan
+ * @param protocol protocol enum value of plan to be destroyed
+ * @param plan read plan to be destroyed
+ */
+void destroy_read_plan(device_protocol_t protocol, void *plan);
+
+/**
+ * destroy read plan and group plans of a schema
+ * @param schema schema whose plans to be destroyed
+ */
+void destroy_schema_plans(data_schema_t *schema);
+
 /**
  * factory method to create device driver
  * @param protocol protocol enum value of driver to be created
@@ -295,18 +643,52 @@ void update_telemetry_value(telemetry_t *telemetry, int index, const char *str_v
 
 
 /**
- * set ith value of telemetry to a number value
+ * set ith value of telemetry to a number value. With "cov" flag, a change within
+ * deadband of point from last reported value isn't reported as COV. Value of
+ * aggregated point is accumulated into its window statistics too
  * @param telemetry telemetry to be updated
  * @param index ith element to be updated
  * @param num_value number value to be updated
+ * @param point definition of data point, NULL to report any change
  */
-void set_telemetry_number_value(telemetry_t *telemetry, int index, double num_value);
+void set_telemetry_number_value(telemetry_t *telemetry, int index, double num_value, const data_point_t *point);
+
+/**
+ * evaluate computed points of schema from latest values in telemetry
+ * @param schema schema with computed points
+ * @param telemetry telemetry to be updated, values of all points of schema
+ * @param keep_cov keep change of computed point not reported yet, for
+ *        telemetry updated again before it's sent
+ * @return true if any computed point changed
+ */
+bool update_computed_points(const data_schema_t *schema, telemetry_t *telemetry, bool keep_cov);
 
 /**
  * set ith value of telemetry to a string value
  * @param telemetry telemetry to be updated
  * @param index ith element to be updated
- * @param str_value string value to be updated, old value will be freed and new value will be
- * malloc and copied over
+ * @param str_value string value to be updated, copied into telemetry
+ */
+void set_telemetry_string_value(telemetry_t *telemetry, int index, char *str_value);
+
+/**
+ * get ith value of telemetry as string, only valid while IS_STR_VALUE
+ * @param telemetry telemetry
+ * @param index ith element
+ * @return string value, owned by telemetry until value changes
+ */
+const char *get_telemetry_string_value(const telemetry_t *telemetry, int index);
+
+/**
+ * reset window statistics of aggregated points in groups
+ * @param schema schema of telemetry
+ * @param telemetry telemetry with window statistics
+ * @param groups mask of groups whose windows are closed
+ */
+void reset_telemetry_windows(const data_schema_t *schema, telemetry_t *telemetry, uint32_t groups);
+
+/**
+ * release string values of telemetry, for telemetry being destroyed
+ * @param telemetry telemetry
  */
-void set_telemetry_string_value(telemetry_t *telemetry, int index, char *str_value);
\ No newline at end of file
+void destroy_telemetry_strings(telemetry_t *telemetry);
\ No newline at end of file
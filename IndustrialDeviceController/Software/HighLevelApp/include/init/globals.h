@@ -33,10 +33,44 @@
 #define DIAG_LOG_REPORT_MS 5000
 #endif
 
+// how often allocator counters are published as diag values
+#ifndef DIAG_MEMORY_REPORT_MS
+#define DIAG_MEMORY_REPORT_MS 60000
+#endif
+
 #define DIAG_LED_UPDATE_MS 500
 
+// how often status of network interfaces is queried, see network_init
+#define NETWORK_STATUS_REFRESH_MS 1000
+
+// how long configured uplink must have been connected again before iot traffic
+// moves back to it from the standby interface, see network_get_uplink
+#ifndef NETWORK_UPLINK_RESTORE_MS
+#define NETWORK_UPLINK_RESTORE_MS 30000
+#endif
+
+// how late diag timers may fire to share a wakeup with other timers, the led
+// blinks so it gets less
+#define DIAG_TIMER_SLACK_MS 1000
+#define DIAG_LED_UPDATE_SLACK_MS 100
+
+// diagnostic values kept at most, preallocated
+#define DIAG_MAX_VALUES 1024
+// latency histograms kept at most, see diag_histogram
+#define DIAG_MAX_HISTOGRAMS 8
+#define DIAG_HISTOGRAM_KEY_SIZE 32
+
 #define DIAG_MAX_LOG_HISTORY 50
 #define DIAG_MAX_LOG_SIZE 1000
+#define DIAG_LOG_RING_SIZE (16 * 1024)
+// remote logs at or above this level keep raw arguments and are formatted at
+// upload, LOG_VERBOSE + 1 to format every log when it's made
+#ifndef DIAG_LOG_DEFERRED_LEVEL
+#define DIAG_LOG_DEFERRED_LEVEL LOG_DEBUG
+#endif
+// ratio log is expected to compress by, compressed upload take this many
+// times its byte budget of log and only fall back to less if it doesn't fit
+#define DIAG_LOG_UPLOAD_GZIP_RATIO 4
 #define DIAG_SYSTEM_BOOT_TIME 10
 
 #define DIAG_PEAK_USERMODE_MEMORY_WATERMARK 250
@@ -55,7 +89,87 @@
 #define IOT_SETUP_MAX_RETRY_MS 120*1000
 #endif
 
-#define IOT_PERIODIC_TASK_MS 100
+// first setup is tried as soon as network is up, checked this often until
+// then and while device auth is not ready yet
+#ifndef IOT_SETUP_FAST_RETRY_MS
+#define IOT_SETUP_FAST_RETRY_MS 1000
+#endif
+
+// hub of last successful provisioning is connected directly, DPS is used
+// instead if not authenticated within this time
+#define IOT_DIRECT_CONNECT_TIMEOUT_MS 15000
+#define IOT_DPS_TIMEOUT_MS 30000
+#define IOT_MAX_HOSTNAME_LEN 128
+
+// SDK DoWork run every IOT_DOWORK_MIN_MS while messages or acks are pending,
+// interval doubles each idle run up to IOT_DOWORK_MAX_MS
+#ifndef IOT_DOWORK_MIN_MS
+#define IOT_DOWORK_MIN_MS 100
+#endif
+
+#ifndef IOT_DOWORK_MAX_MS
+#define IOT_DOWORK_MAX_MS 2000
+#endif
+
+//////////// config for adapter task /////////////////
+// number of worker threads polling devices, shared by all downlinks
+#ifndef ADAPTER_WORKER_THREADS
+#define ADAPTER_WORKER_THREADS 4
+#endif
+
+// maximum concurrent polls on one downlink, transport only support one
+// outstanding transaction so far
+#define ADAPTER_MAX_INFLIGHT_PER_DOWNLINK 1
+
+// busy time of each downlink is reported as percent of this window, e.g.
+// BUS_UTIL_MODBUS_RTU_1, and warned about at or above ADAPTER_BUS_UTIL_WARN_PCT
+#define ADAPTER_BUS_UTIL_WINDOW_MS (60 * 1000)
+#define ADAPTER_BUS_UTIL_WARN_PCT 80
+#define ADAPTER_BUS_UTIL_DATAPOINT "BUS_UTIL_%s_%d"
+
+// first polls after provision are this far apart, so devices don't all hit
+// the bus at once
+#ifndef ADAPTER_FIRST_POLL_SPACING_MS
+#define ADAPTER_FIRST_POLL_SPACING_MS 200
+#endif
+
+// maximum number of device results handled in one go on main thread
+#define ADAPTER_RESULT_BATCH 16
+
+// point group due within this percent of its interval is read early along
+// with groups due now, so groups due close together share one poll
+#define ADAPTER_GROUP_MERGE_PCT 25
+
+// adaptive poll interval grow by this percent after each poll without value
+// change, up to configured max interval
+#define ADAPTER_ADAPTIVE_STRETCH_PCT 150
+
+// device failing this many polls in a row is only probed with one point read,
+// every poll interval at first and doubling up to max backoff
+#define ADAPTER_BREAKER_FAILURES 3
+#define ADAPTER_BREAKER_MAX_BACKOFF_MS (10 * 60 * 1000)
+
+// block size provision arena grows by
+#define ADAPTER_PROVISION_ARENA_CHUNK 4096
+
+// poll phase and COV baselines are saved at exit and restored on start, also
+// saved this often if not 0, in case app doesn't exit cleanly
+#ifndef TELEMETRY_STATE_SAVE_MS
+#define TELEMETRY_STATE_SAVE_MS 0
+#endif
+
+// telemetry batch size used when provision enable batching without maxSize,
+// upper bound is the inflight quota as a batch larger than that can never be sent
+#define TELEMETRY_BATCH_DEFAULT_SIZE (8*1024)
+#define TELEMETRY_BATCH_MAX_SIZE IOT_MAX_INFLIGHT_MESSAGE_SIZE
+
+// max time a telemetry message waits in batch before been sent
+#define TELEMETRY_BATCH_DEFAULT_LATENCY_MS 1000
+// telemetry stored while iot hub is not connected is replayed one message of
+// up to TELEMETRY_STORE_DRAIN_SIZE every TELEMETRY_STORE_DRAIN_MS, so live
+// telemetry keep most of the uplink
+#define TELEMETRY_STORE_DRAIN_SIZE (4*1024)
+#define TELEMETRY_STORE_DRAIN_MS 2000
 
 /////////// config for watchdog task ////////////
 #define WATCHDOG_WARNING_SEC 60
@@ -72,6 +186,59 @@
 // given packet with current baudrate multiple this factor
 #define UART_TX_ENABLE_DELAY_FACTOR    1.0
 
+// per slave response time model, once enough samples collected request
+// timeout is derived from p99 so a dead slave fails fast instead of eating
+// the whole device timeout
+#define MODBUS_RTU_LATENCY_SAMPLES 32
+#define MODBUS_RTU_LATENCY_MIN_SAMPLES 8
+#define MODBUS_RTU_TIMEOUT_FACTOR 3
+#define MODBUS_RTU_MIN_TIMEOUT_MS 50
+// consecutive timeouts on derived timeout before model is dropped, in case
+// slave just become slower
+#define MODBUS_RTU_MAX_FAST_TIMEOUTS 3
+
+// requests of one device poll exchanged with RT core in one IPC_BATCH, bounded
+// by mailbox message size as each response can be up to 269 bytes
+#define MODBUS_RTU_MAX_BATCH 3
+
+// time to wait for each RT core trace dump when connection is closed
+#define MODBUS_RTU_TRACE_TIMEOUT_MS 200
+
+// time to wait for RT core to start or stop simulated slaves
+#define MODBUS_RTU_SIM_TIMEOUT_MS 200
+
+// no slave answer a write to broadcast address 0, the bus is left idle this
+// long after it so slaves can process it before next request
+#define MODBUS_BROADCAST_TURNAROUND_MS 100
+
+//////////// MODBUS TCP //////////////////
+// connection to a gateway is kept by a background thread, a broken one is
+// reconnected there with backoff doubling from MIN to MAX, so polls fail fast
+// meanwhile instead of each waiting a connect timeout
+#define MODBUS_TCP_CONNECT_TIMEOUT_MS 3000
+#define MODBUS_TCP_RECONNECT_MIN_MS 500
+#define MODBUS_TCP_RECONNECT_MAX_MS (60 * 1000)
+// idle time before keepalive probes, interval and number of probes unanswered
+// before a silent gateway is taken as gone
+#define MODBUS_TCP_KEEPIDLE_S 30
+#define MODBUS_TCP_KEEPINTVL_S 10
+#define MODBUS_TCP_KEEPCNT 3
+
+//////////// MODBUS register cache //////////////////
+// max register blocks kept per unit for on-demand read, oldest replaced first
+#define MODBUS_CACHE_MAX_BLOCKS 32
+
+//////////// MODBUS TCP gateway //////////////////
+// local clients are served reads from register cache, a new client beyond
+// MAX_CLIENTS replaces the one idle longest
+#define MODBUS_GATEWAY_DEFAULT_PORT 502
+#define MODBUS_GATEWAY_MAX_CLIENTS 4
+// responses queued per client before its requests are left unread
+#define MODBUS_GATEWAY_TX_SIZE 1024
+// registers are served up to this many poll intervals old, unless provision
+// sets gateway maxAge
+#define MODBUS_GATEWAY_STALE_INTERVALS 2
+
 ///////////// PXC36 //////////////////////
 // buffer length for single string
 #define PXC36_STR_CHUNK_SIZE 512
@@ -81,24 +248,36 @@
 #define PXC36_UART_READ_RESPONSE_TIMEOUT_MS 10*1000
 
 ////////////// log /////////////////////
+// minimum T3.5 in ms assumed on A7 side when deriving timeouts, frame
+// timing itself is done by RT core
 #define MODBUS_T35_MS 5
-#define MODBUS_T35_ADJUST_STEP 3
-#define MODBUS_T35_MAXIMUM_RETRY 10
 #define MODBUS_T35_DATAPOINT "MODBUS_RTU_DELAY"
+// per slave response time stats, e.g. MODBUS_RTU_1_P99
+#define MODBUS_RTU_LATENCY_DATAPOINT "MODBUS_RTU_%d_%s"
 
 ///////////// mutable storage /////////
 // diag event file - 10k
 #define EVENT_FILE_OFFSET 0
 #define EVENT_FILE_SIZE 10000
 
-// local cache of provision - 30k
+// local cache of provision, gzip'd - 30k
 #define PROVISION_FILE_OFFSET 10100
 #define PROVISION_FILE_MAX_SIZE 30000
+// largest provision JSON or image of it kept in local cache, once decompressed
+#define PROVISION_MAX_SIZE (256 * 1024)
 
 // property file - 1k
 #define PROPERTY_FILE_OFFSET 40200
 #define PROPERTY_FILE_SIZE 1000
 
+// offline telemetry store - 20k
+#define TELEMETRY_STORE_OFFSET 41300
+#define TELEMETRY_STORE_SIZE 20000
+
+// poll schedule and COV baselines saved at exit - 4k
+#define TELEMETRY_STATE_OFFSET 61400
+#define TELEMETRY_STATE_SIZE 4000
+
 ///////////// edge /////////
 #define IOT_EDGE_IP1 "13.66.204.246"
 #define IOT_EDGE_IP2 "40.122.45.153"
@@ -6,14 +6,74 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <modbus_sim.h>
+
 #include "device_hal.h"
 
 typedef enum ipc_command_type_t {
+    // open modbus UART, request data is 4 bytes baud rate, 1 byte parity and
+    // 1 byte stop bits, optionally followed by 4 bytes max latency in us and
+    // 2 bytes max size of the messages UART bytes received outside
+    // IPC_MODBUS_TRANSACT are coalesced into, latency 0 sends them at once
     IPC_OPEN_UART,
     IPC_CLOSE_UART,
-    IPC_WRITE_UART
+    IPC_WRITE_UART,
+    // one whole modbus rtu exchange, request data is 4 bytes response timeout
+    // in ms followed by slave id and pdu, CRC is appended by RT core. Only
+    // responded when exchange is done, with ipc_transact_response_message_t
+    IPC_MODBUS_TRANSACT,
+    // envelope of several commands in one mailbox message, request data is
+    // the complete request messages back to back, and they are answered with
+    // one ipc_batch_response_message_t. Execution stop at first failed
+    // IPC_MODBUS_TRANSACT, commands after it are not answered
+    IPC_BATCH,
+    // read events recorded by the RT core trace probes since the previous
+    // IPC_TRACE_DUMP, answered with one ipc_trace_response_message_t. Send
+    // again while the response is full to get the rest
+    IPC_TRACE_DUMP,
+    // start streaming the ADC, request data is 4 bytes scan frequency in Hz
+    // followed by 2 bytes each of channel mask, number of scans averaged per
+    // sample, reference voltage in mV and samples per block. Answered with
+    // ipc_response_message_t, then blocks arrive unsolicited as IPC_ADC_BLOCK
+    IPC_ADC_START,
+    // stop streaming the ADC, answered with ipc_response_message_t
+    IPC_ADC_STOP,
+    // never sent by A7, seq_num counts blocks since IPC_ADC_START
+    IPC_ADC_BLOCK,
+    // start extracting features of I2S0 input, request data is 4 bytes sample
+    // rate in Hz followed by 2 bytes each of frames per vector and number of
+    // FFT bands. Answered with ipc_response_message_t, then vectors arrive
+    // unsolicited as IPC_AUDIO_FEATURES
+    IPC_AUDIO_START,
+    // stop extracting features, answered with ipc_response_message_t
+    IPC_AUDIO_STOP,
+    // never sent by A7, seq_num counts vectors since IPC_AUDIO_START
+    IPC_AUDIO_FEATURES,
+    // start counting pulses on GPIO pins, data is 4 bytes pin mask, 2 bytes
+    // gate window in ms, 1 byte debounce rate and 1 byte reserved. Answered
+    // with ipc_response_message_t
+    IPC_PULSE_START,
+    // stop counting pulses, answered with ipc_response_message_t
+    IPC_PULSE_STOP,
+    // read pulse counters, answered with one ipc_pulse_response_message_t
+    IPC_PULSE_READ,
+    // start simulated modbus slaves on ISU1, wired to ISU0, data is 1 byte
+    // first slave id, 1 byte number of slaves, 2 bytes registers per table,
+    // 4 bytes each of min and max latency in us, slow ppm, slow us, exception
+    // ppm, timeout ppm, change ms, change ppm and seed as of
+    // modbus_sim_config_t, then 4 bytes baud rate, 1 byte parity, 1 byte stop
+    // bits and 2 bytes reserved. Answered with ipc_response_message_t
+    IPC_MODBUS_SIM_START,
+    // stop simulated slaves, answered with ipc_response_message_t
+    IPC_MODBUS_SIM_STOP
 } ipc_command_type_t;
 
+// max payload of one mailbox message, bounded by intercore ring buffer
+#define IPC_MAX_MESSAGE_SIZE 1040
+
+#define IPC_OPEN_UART_SIZE 6
+#define IPC_OPEN_UART_COALESCE_SIZE 12
+
 typedef struct ipc_request_message_t {
     ipc_command_type_t command;
     uint32_t seq_num;
@@ -27,6 +87,99 @@ typedef struct ipc_response_message_t {
     err_code code;
 } ipc_response_message_t;
 
+// response of IPC_MODBUS_TRANSACT, data is the response pdu with slave id and
+// CRC stripped, valid only if code is DEVICE_OK
+typedef struct ipc_transact_response_message_t {
+    ipc_command_type_t command;
+    uint32_t seq_num;
+    err_code code;
+    uint32_t length;
+    uint8_t data[0];
+} ipc_transact_response_message_t;
+
+// response of IPC_BATCH, data is the responses of commands in the batch back
+// to back, in request order
+typedef struct ipc_batch_response_message_t {
+    ipc_command_type_t command;
+    uint32_t seq_num;
+    err_code code;
+    uint32_t length;
+    uint8_t data[0];
+} ipc_batch_response_message_t;
+
+// response of IPC_TRACE_DUMP, data is length bytes of 8 byte events oldest
+// first: 4 bytes GPT4 count, 2 bytes sequence number, 1 byte probe id with
+// bit 7 set on exit and 1 byte probe argument. tick_hz is the GPT4 rate, lost
+// the number of events overwritten before they were read
+typedef struct ipc_trace_response_message_t {
+    ipc_command_type_t command;
+    uint32_t seq_num;
+    err_code code;
+    uint32_t tick_hz;
+    uint32_t lost;
+    uint32_t length;
+    uint8_t data[0];
+} ipc_trace_response_message_t;
+
+#define IPC_TRACE_EVENT_SIZE 8
+
+// block of IPC_ADC_BLOCK, data is length bytes of 2 byte samples oldest first,
+// channel in the top 4 bits and averaged 12 bit value below. dropped is the
+// number of samples lost since the previous block
+typedef struct ipc_adc_block_message_t {
+    ipc_command_type_t command;
+    uint32_t seq_num;
+    err_code code;
+    uint32_t dropped;
+    uint32_t length;
+    uint8_t data[0];
+} ipc_adc_block_message_t;
+
+#define IPC_ADC_START_SIZE 12
+
+// vector of IPC_AUDIO_FEATURES, data is length bytes of 4 byte IEEE floats:
+// RMS and peak as fraction of full scale, then power of each FFT band
+// relative to a full scale sine. dropped is the number of 256 sample frames
+// lost since the previous vector
+typedef struct ipc_audio_features_message_t {
+    ipc_command_type_t command;
+    uint32_t seq_num;
+    err_code code;
+    uint32_t dropped;
+    uint32_t length;
+    uint8_t data[0];
+} ipc_audio_features_message_t;
+
+#define IPC_AUDIO_START_SIZE 8
+
+// response of IPC_PULSE_READ, data is length bytes of 12 byte readings lowest
+// pin first: 4 bytes pin, 4 bytes pulses counted since IPC_PULSE_START and 4
+// bytes frequency over the last gate window in millihertz
+typedef struct ipc_pulse_response_message_t {
+    ipc_command_type_t command;
+    uint32_t seq_num;
+    err_code code;
+    uint32_t length;
+    uint8_t data[0];
+} ipc_pulse_response_message_t;
+
+#define IPC_PULSE_START_SIZE 8
+#define IPC_PULSE_READING_SIZE 12
+
+#define IPC_MODBUS_SIM_START_SIZE 48
+
+// one command of a batch
+typedef struct ipc_command_t {
+    ipc_command_type_t command;
+    const uint8_t* data;
+    int32_t len;
+    // result of command, and response pdu of IPC_MODBUS_TRANSACT which must
+    // hold MODBUS_MAX_PDU_SIZE bytes
+    err_code code;
+    uint8_t* resp;
+    int32_t resp_len;
+} ipc_command_t;
+
 /**
  * Execute command on the real-time core
  * @param socket_fd the socket file handle
@@ -37,6 +190,198 @@ typedef struct ipc_response_message_t {
  */
 err_code ipc_execute_command(int socket_fd, ipc_command_type_t command, uint8_t* data, int32_t len);
 
+/**
+ * Execute several commands on the real-time core with one mailbox round trip
+ * @param socket_fd the socket file handle
+ * @param commands commands to be executed in order, result stored in each of them
+ * @param num_command number of commands
+ * @param timeout_ms time to wait for the whole batch
+ * @return error code of batch itself, command not executed has DEVICE_E_BUSY
+ */
+err_code ipc_execute_batch(int socket_fd, ipc_command_t* commands, int32_t num_command, int32_t timeout_ms);
+
+/**
+ * Execute one modbus rtu request/response exchange on the real-time core
+ * @param socket_fd the socket file handle
+ * @param adu slave id followed by request pdu, without CRC
+ * @param adu_len the length of adu
+ * @param pdu buffer to receive response pdu, must hold MODBUS_MAX_PDU_SIZE bytes
+ * @param ppdu_len pointer to variable to hold response pdu length
+ * @param timeout_ms time to wait for response
+ * @return error code
+ */
+err_code ipc_modbus_transact(int socket_fd, const uint8_t* adu, int32_t adu_len, uint8_t* pdu, int32_t* ppdu_len,
+                             int32_t timeout_ms);
+
+/**
+ * Read trace events recorded by the RT core since the previous call and log
+ * them at info level, with how long each probed handler ran
+ * @param socket_fd the socket file handle
+ * @param timeout_ms time to wait for each response
+ * @return error code
+ */
+err_code ipc_dump_trace(int socket_fd, int32_t timeout_ms);
+
+// parameters of IPC_ADC_START
+typedef struct ipc_adc_config_t {
+    // rate in Hz at which all enabled channels are scanned
+    uint32_t frequency;
+    uint16_t channel_mask;
+    // scans averaged into one sample of each channel
+    uint16_t decimation;
+    uint16_t vref_mv;
+    // samples, of all channels, in one IPC_ADC_BLOCK
+    uint16_t block_samples;
+} ipc_adc_config_t;
+
+// called with each IPC_ADC_BLOCK received, sample is channel << 12 | value
+typedef void (*ipc_adc_block_handler_t)(void* context, const uint16_t* samples, int32_t num_sample,
+                                        uint32_t dropped);
+
+/**
+ * Set the receiver of ADC blocks streamed by the real-time core, blocks
+ * received while waiting for any command response are passed to it too
+ * @param handler the handler, NULL to discard blocks
+ * @param context passed to handler
+ */
+void ipc_set_adc_block_handler(ipc_adc_block_handler_t handler, void* context);
+
+/**
+ * Start streaming ADC samples averaged on the real-time core
+ * @param socket_fd the socket file handle
+ * @param config acquisition parameters
+ * @param timeout_ms time to wait for response
+ * @return error code
+ */
+err_code ipc_adc_start(int socket_fd, const ipc_adc_config_t* config, int32_t timeout_ms);
+
+/**
+ * Stop streaming ADC samples
+ * @param socket_fd the socket file handle
+ * @param timeout_ms time to wait for response
+ * @return error code
+ */
+err_code ipc_adc_stop(int socket_fd, int32_t timeout_ms);
+
+// parameters of IPC_AUDIO_START
+typedef struct ipc_audio_config_t {
+    // sample rate in Hz, e.g. 16000
+    uint32_t rate;
+    // 256 sample frames combined into one vector
+    uint16_t frames_per_vector;
+    // FFT bands splitting 0 Hz to rate / 2 evenly
+    uint16_t bands;
+} ipc_audio_config_t;
+
+// called with each IPC_AUDIO_FEATURES received, rms and peak are fraction of
+// full scale and band power is relative to a full scale sine
+typedef void (*ipc_audio_features_handler_t)(void* context, float rms, float peak, const float* band_power,
+                                             int32_t num_band, uint32_t dropped);
+
+/**
+ * Set the receiver of feature vectors of I2S input extracted by the real-time
+ * core, vectors received while waiting for any command response are passed to
+ * it too
+ * @param handler the handler, NULL to discard vectors
+ * @param context passed to handler
+ */
+void ipc_set_audio_features_handler(ipc_audio_features_handler_t handler, void* context);
+
+/**
+ * Start extracting features of I2S input on the real-time core
+ * @param socket_fd the socket file handle
+ * @param config capture parameters
+ * @param timeout_ms time to wait for response
+ * @return error code
+ */
+err_code ipc_audio_start(int socket_fd, const ipc_audio_config_t* config, int32_t timeout_ms);
+
+/**
+ * Stop extracting features of I2S input
+ * @param socket_fd the socket file handle
+ * @param timeout_ms time to wait for response
+ * @return error code
+ */
+err_code ipc_audio_stop(int socket_fd, int32_t timeout_ms);
+
+// parameters of IPC_PULSE_START
+typedef struct ipc_pulse_config_t {
+    // EINT pins to count, at most 8
+    uint32_t pin_mask;
+    // window in ms the frequency is measured over
+    uint16_t gate_ms;
+    // debounce sampling rate, 0 for 8 kHz to 7 for 62.5 Hz halving each step
+    uint8_t debounce;
+} ipc_pulse_config_t;
+
+// counter of one pin read by IPC_PULSE_READ
+typedef struct ipc_pulse_reading_t {
+    uint32_t pin;
+    // pulses counted since IPC_PULSE_START, wrapping
+    uint32_t count;
+    // pulses over the last gate window, in millihertz
+    uint32_t frequency_mhz;
+} ipc_pulse_reading_t;
+
+/**
+ * Start counting pulses on GPIO pins on the real-time core
+ * @param socket_fd the socket file handle
+ * @param config counting parameters
+ * @param timeout_ms time to wait for response
+ * @return error code
+ */
+err_code ipc_pulse_start(int socket_fd, const ipc_pulse_config_t* config, int32_t timeout_ms);
+
+/**
+ * Stop counting pulses
+ * @param socket_fd the socket file handle
+ * @param timeout_ms time to wait for response
+ * @return error code
+ */
+err_code ipc_pulse_stop(int socket_fd, int32_t timeout_ms);
+
+/**
+ * Read the pulse counter of every counted pin
+ * @param socket_fd the socket file handle
+ * @param readings array to receive readings, lowest pin first
+ * @param max_reading length of readings
+ * @param pnum_reading pointer to variable to hold number of readings received
+ * @param timeout_ms time to wait for response
+ * @return error code, DEVICE_E_INVALID if counting not started
+ */
+err_code ipc_pulse_read(int socket_fd, ipc_pulse_reading_t* readings, int32_t max_reading, int32_t* pnum_reading,
+                        int32_t timeout_ms);
+
+/**
+ * Start simulated modbus slaves on the real-time core, answering on ISU1
+ * which must be wired to ISU0 the modbus master use
+ * @param socket_fd the socket file handle
+ * @param config slaves to simulate
+ * @param baud baud rate of the bus
+ * @param parity parity of the bus, as of IPC_OPEN_UART
+ * @param stop_bits stop bits of the bus
+ * @param timeout_ms time to wait for response
+ * @return error code, DEVICE_E_BUSY if already started
+ */
+err_code ipc_modbus_sim_start(int socket_fd, const modbus_sim_config_t* config, uint32_t baud, uint8_t parity,
+                              uint8_t stop_bits, int32_t timeout_ms);
+
+/**
+ * Stop simulated modbus slaves
+ * @param socket_fd the socket file handle
+ * @param timeout_ms time to wait for response
+ * @return error code
+ */
+err_code ipc_modbus_sim_stop(int socket_fd, int32_t timeout_ms);
+
+/**
+ * Pass ADC blocks and audio feature vectors already received to their
+ * handlers, without blocking
+ * @param socket_fd the socket file handle
+ * @return number of messages handled
+ */
+int32_t ipc_stream_poll(int socket_fd);
+
 /**
  * Serialize uint32 into a byte array.
  * @param data the byte array
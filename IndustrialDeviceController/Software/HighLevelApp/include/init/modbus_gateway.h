@@ -0,0 +1,42 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+#include <init/device_hal.h>
+
+/**
+ * read registers of a gateway unit without touching the bus, runs on event loop thread
+ * @param unit unit id requested by client
+ * @param reg_type register type to read
+ * @param addr register address to read
+ * @param quantity register quantity to read
+ * @param regs out parameter contains value of registers on success, one per bit for coils and inputs
+ * @return DEVICE_OK, DEVICE_E_CONFIG if no device is that unit, DEVICE_E_NO_DATA if registers are
+ *         not polled, DEVICE_E_TIMEOUT if they are stale
+ */
+typedef err_code (*modbus_gateway_read_func_t)(uint8_t unit, uint8_t reg_type, uint16_t addr, uint16_t quantity,
+                                               uint16_t *regs);
+
+/**
+ * initialize local modbus tcp gateway module, it doesn't listen until configured with a port
+ * @param eloop event loop instance clients are served on
+ * @param read callback to answer read requests with
+ * @return 0 on success or -1 on failure
+ */
+int modbus_gateway_init(EventLoop *eloop, modbus_gateway_read_func_t read);
+
+/**
+ * deinitialize gateway module, clients are disconnected
+ */
+void modbus_gateway_deinit(void);
+
+/**
+ * configure gateway, listening socket is reopened if port changed
+ * @param port tcp port to listen on, must be in AllowedTcpServerPorts of app manifest, 0 to stop
+ * @return 0 on success or -1 if port can't be listened on
+ */
+int modbus_gateway_config(uint16_t port);
@@ -0,0 +1,66 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+/**
+ * callback when a batch message been delivered or failed
+ * @param delivered true if message been delivered to iot hub
+ * @param items items added to the batch, empty if batch been reset since it was sent
+ * @param num_item number of items
+ */
+typedef void (*telemetry_batch_delivered_func_t)(bool delivered, void *const *items, int32_t num_item);
+
+/**
+ * initialize telemetry batch module, telemetry added will be coalesced into one iot
+ * message until reach size limit or latency window
+ * @param eloop event loop instance to schedule flush timer
+ * @param callback callback for delivery result of each batch message
+ * @return 0 on success or -1 on failure
+ */
+int telemetry_batch_init(EventLoop *eloop, telemetry_batch_delivered_func_t callback);
+
+/**
+ * deinitialize telemetry batch module, pending messages will be dropped
+ */
+void telemetry_batch_deinit(void);
+
+/**
+ * configure batch, pending messages will be flushed first
+ * @param binary true if messages are CBOR items, false for JSON objects
+ * @param max_size max size in bytes of one batch message, 0 to disable batching
+ * @param max_latency_ms max time a message stays in batch before flushed
+ */
+void telemetry_batch_config(bool binary, size_t max_size, int32_t max_latency_ms);
+
+/**
+ * check if batching is enabled
+ * @return true if enabled
+ */
+bool telemetry_batch_enabled(void);
+
+/**
+ * add one message to batch
+ * @param message message to add, JSON object or CBOR item depends on batch config
+ * @param len length of message
+ * @param item context of message to be passed to delivery callback, e.g. device
+ * @return 0 on success, -1 if message is too large or batch failed to be sent
+ */
+int telemetry_batch_add(const void *message, size_t len, void *item);
+
+/**
+ * send all pending messages now
+ */
+void telemetry_batch_flush(void);
+
+/**
+ * flush pending messages and invalidate items, delivery callback of batches sent
+ * before reset will receive no item
+ */
+void telemetry_batch_reset(void);
@@ -0,0 +1,28 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <init/device_hal.h>
+
+/**
+ * save poll schedule and COV baseline of devices to mutable storage, so polling
+ * and incremental reporting resume where they were on next start. Devices are
+ * saved in list order, baseline of a device is left out if it doesn't fit or
+ * device is being polled
+ * @param devices device list
+ * @param epoch provision epoch devices belong to
+ * @return number of devices saved, or -1 on failure
+ */
+int32_t telemetry_state_save(const ce_device_t *devices, int64_t epoch);
+
+/**
+ * restore saved state into devices of same provision epoch whose definition
+ * and schema didn't change, time passed since state was saved is accounted
+ * @param devices device list, telemetry of COV devices must be created already
+ * @param epoch provision epoch devices belong to
+ * @return number of devices restored
+ */
+int32_t telemetry_state_restore(ce_device_t *devices, int64_t epoch);
@@ -0,0 +1,39 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+/**
+ * initialize offline telemetry store, telemetry stored while iot hub is not
+ * connected is kept in mutable storage and replayed once connection is back,
+ * rate limited, batched and gzip compressed
+ * @param eloop event loop instance to schedule replay timer
+ * @return 0 on success or -1 on failure
+ */
+int telemetry_store_init(EventLoop *eloop);
+
+/**
+ * deinitialize offline telemetry store, stored telemetry stay in mutable storage
+ */
+void telemetry_store_deinit(void);
+
+/**
+ * store one telemetry message for replay, oldest messages are dropped if store is full
+ * @param message telemetry message, a JSON object or CBOR map
+ * @param len number of bytes in message, without null terminator
+ * @param binary true if message is CBOR
+ * @return 0 on success, -1 if message is larger than the store
+ */
+int telemetry_store_put(const void *message, size_t len, bool binary);
+
+/**
+ * get number of telemetry messages waiting for replay
+ * @return number of messages
+ */
+int32_t telemetry_store_count(void);
@@ -10,11 +10,17 @@
 /**
  * Sets up the client in order to establish the communication channel to Azure IoT Hub.
  * @param quota inflight message quota
+ * @param hub hostname of hub to connect directly, NULL to get hub assigned by DPS
  * @param context context to be used for c2d message, twin update and connection status callback from SDK layer
- * @return true if setup request been sent, need to wait for connection status callback to indicate if connection
- * been established.
+ * @return AZURE_SPHERE_PROV_RESULT_OK if setup request been sent, need to wait for connection status callback to
+ * indicate if connection been established.
  */
-AZURE_SPHERE_PROV_RESULT azure_iot_setup_client(size_t quota, void *context);
+AZURE_SPHERE_PROV_RESULT azure_iot_setup_client(size_t quota, const char *hub, void *context);
+
+/**
+ * @return hostname of hub client was last set up for, NULL if never set up
+ */
+const char *azure_iot_get_hostname(void);
 
 
 /**
@@ -48,6 +54,15 @@ int azure_iot_twin_report_async(const char* properties, device_twin_delivery_con
  */
 typedef void (*message_delivery_confirmation_func_t)(bool delivered, void *context);
 
+/**
+ * application property set on a d2c message, a list of them ends with NULL key
+ */
+typedef struct message_property_t message_property_t;
+struct message_property_t {
+    const char *key;
+    const char *value;
+};
+
 
 /**
  * Creates and enqueues a message to be delivered the IoT Hub. The message is not actually sent
@@ -58,6 +73,31 @@ typedef void (*message_delivery_confirmation_func_t)(bool delivered, void *conte
  */
 int azure_iot_send_message_async(const char *message, const char* message_type, message_delivery_confirmation_func_t callback, void *context);
 
+/**
+ * Creates and enqueues a priority message, e.g. an alarm. It is not held back by inflight message
+ * quota and carries "priority" property set to "high" so it can be routed ahead in the cloud.
+ * @param message The message to send
+ * @param message_type The type of the message to send
+ * @returns 0 if message been successfully queued, -1 otherwise
+ */
+int azure_iot_send_priority_message_async(const char *message, const char *message_type,
+                                          message_delivery_confirmation_func_t callback, void *context);
+
+/**
+ * Creates and enqueues a binary message to be delivered the IoT Hub.
+ * @param payload The message payload to send
+ * @param payload_size Number of bytes in payload
+ * @param message_type The type of the message to send
+ * @param content_type The content type of the message
+ * @param content_encoding The content encoding of the message, NULL for none
+ * @param properties Additional application properties, NULL for none
+ * @returns 0 if message been successfully queued, -1 otherwise
+ */
+int azure_iot_send_binary_message_async(const uint8_t *payload, size_t payload_size, const char *message_type,
+                                        const char *content_type, const char *content_encoding,
+                                        const message_property_t *properties,
+                                        message_delivery_confirmation_func_t callback, void *context);
+
 /**
  * Keeps IoT Hub Client alive by exchanging data with the Azure IoT Hub.
  * This function must to be invoked periodically so that the Azure IoT Hub
@@ -66,6 +106,12 @@ int azure_iot_send_message_async(const char *message, const char* message_type,
  */
 void azure_iot_do_periodic_tasks(void);
 
+/**
+ * @return whether SDK has work to do soon, messages or twin reports not yet
+ * acknowledged, or connection being established
+ */
+bool azure_iot_has_pending_work(void);
+
 /**
  * Type of the function callback invoked whenever a message is received from IoT Hub.
  * @param message c2d message been received, not null terminated
@@ -8,6 +8,7 @@
 #include <stdint.h>
 
 #include <applibs/eventloop.h>
+#include <utils/histogram.h>
 
 typedef enum event_code_t event_code_t;
 enum event_code_t {
@@ -33,6 +34,7 @@ enum event_code_t {
     EVENT_NETWORK_LOCAL,
     EVENT_NETWORK_IP_AVAILABLE,
     EVENT_NETWORK_INTERNET,
+    EVENT_NETWORK_UPLINK_FAILOVER,
 
     EVENT_TELEMETRY_FAILED = 200,
     EVENT_IOT_CONNECTED,
@@ -77,6 +79,43 @@ void diag_deinit(void);
  */
 void diag_log_value(const char *key, double value);
 
+// pre-resolved diagnostic value, saves key lookup on every log
+typedef uint32_t diag_handle_t;
+
+#define DIAG_INVALID_HANDLE 0u
+
+/**
+ * register a diagnostic value for logging through handle
+ * @param key key
+ * @return handle, DIAG_INVALID_HANDLE if there is no free slot
+ */
+diag_handle_t diag_register(const char *key);
+
+/**
+ * same as diag_register, also report min/max/mean/p95 of values logged since
+ * last report as key_min, key_max, key_mean and key_p95
+ * @param key key
+ * @return handle, DIAG_INVALID_HANDLE if there is no free slot
+ */
+diag_handle_t diag_register_stats(const char *key);
+
+/**
+ * log a diagnostic value by handle, ignored if value been removed since registered
+ * @param handle handle returned by diag_register/diag_register_stats
+ * @param value value
+ */
+void diag_log_handle(diag_handle_t handle, double value);
+
+/**
+ * get latency histogram reported with diag telemetry as key_p50, key_p90,
+ * key_p99, key_max and bucket counts as key_hist, counts are cleared on each
+ * report. histogram is created on first call and live until app exit, so caller
+ * can keep the pointer and record to it from any thread
+ * @param key key
+ * @return histogram, NULL if DIAG_MAX_HISTOGRAMS already registered
+ */
+histogram_t *diag_histogram(const char *key);
+
 /**
  * retrive a logged diagnostic value
  * @param key key to be retrived
@@ -4,10 +4,13 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <applibs/eventloop.h>
 #include <iot/azure_iot_utilities.h>
 
 #define IOT_MESSAGE_TYPE_TELEMETRY "telemetry"
+#define IOT_MESSAGE_TYPE_ALARM "alarm"
 #define IOT_MESSAGE_TYPE_OSUPGRADE "os_upgrade"
 
 #define IOT_MESSAGE_TYPE_DIAG_EVENTS "diag_events"
@@ -23,9 +26,12 @@
 #define IOT_COMMAND_PROVISION "provision"
 #define IOT_COMMAND_REBOOT "reboot"
 #define IOT_COMMAND_OTA_REBOOT "ota_reboot"
+#define IOT_COMMAND_BROADCAST "broadcast"
 
 #define IOT_MESSAGE_CONTENT_TYPE "application%2fjson"
+#define IOT_MESSAGE_CONTENT_TYPE_CBOR "application%2fcbor"
 #define IOT_MESSAGE_CONTENT_ENCODING "utf-8"
+#define IOT_MESSAGE_CONTENT_ENCODING_GZIP "gzip"
 
 /**
  * initialize iot module
@@ -52,6 +58,35 @@ void iot_deinit(void);
 int iot_send_message_async(const char* iot_message, const char* iot_message_type,
                            message_delivery_confirmation_func_t callback, void *context);
 
+/**
+ * send priority d2c message to iot hub, e.g. alarm, it isn't refused for inflight quota and iot
+ * hub client is worked at once instead of on its next period
+ * @param iot_message message to be sent
+ * @param iot_message_type message type to be sent
+ * @param callback callback function to indicate message deliver result
+ * @param context context for callback function
+ * @return 0 if message been successfully enqueue in SDK layer, negative if send attempt failed
+ */
+int iot_send_priority_message_async(const char *iot_message, const char *iot_message_type,
+                                    message_delivery_confirmation_func_t callback, void *context);
+
+/**
+ * send binary d2c message to iot hub
+ * @param payload message payload to be sent
+ * @param payload_size number of bytes in payload
+ * @param iot_message_type message type to be sent
+ * @param content_type content type system property of message
+ * @param content_encoding content encoding system property of message, NULL for none
+ * @param properties additional application properties ended by NULL key, NULL for none
+ * @param callback callback function to indicate message deliver result
+ * @param context context for callback function
+ * @return 0 if message been successfully enqueue in SDK layer, negative if send attempt failed
+ */
+int iot_send_binary_message_async(const uint8_t *payload, size_t payload_size, const char *iot_message_type,
+                                  const char *content_type, const char *content_encoding,
+                                  const message_property_t *properties,
+                                  message_delivery_confirmation_func_t callback, void *context);
+
 
 /**
  * report device twin to iot hub
@@ -0,0 +1,57 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+
+// bump allocator for objects sharing one lifetime, e.g. everything parsed
+// from one provision. objects are never freed one by one, the whole arena
+// is released at once
+typedef struct arena_t arena_t;
+
+/**
+ * create arena
+ * @param chunk_size size of each block arena grows by, a bigger allocation
+ *                   gets a block of its own
+ * @return arena
+ */
+arena_t *arena_create(size_t chunk_size);
+
+/**
+ * release every allocation made from arena, and arena itself
+ * @param arena arena to destroy, may be NULL
+ */
+void arena_destroy(arena_t *arena);
+
+/**
+ * allocate zeroed memory from arena
+ * @param arena arena
+ * @param size number of bytes
+ * @return pointer aligned for any type
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * duplicate at most len chars of string into arena
+ * @param arena arena
+ * @param s string
+ * @param len max number of chars
+ * @return NUL terminated copy
+ */
+char *arena_strndup(arena_t *arena, const char *s, size_t len);
+
+/**
+ * duplicate string into arena
+ * @param arena arena
+ * @param s string
+ * @return copy
+ */
+char *arena_strdup(arena_t *arena, const char *s);
+
+/**
+ * total bytes of blocks held by arena
+ * @param arena arena
+ * @return bytes
+ */
+size_t arena_size(const arena_t *arena);
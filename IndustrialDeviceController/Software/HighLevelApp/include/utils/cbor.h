@@ -0,0 +1,84 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// minimal CBOR (RFC 7049) encoder writing into caller provided buffer
+typedef struct cbor_writer_t cbor_writer_t;
+struct cbor_writer_t {
+    uint8_t *buf;
+    size_t size;
+    // bytes needed so far, may exceed size when buffer is too small
+    size_t len;
+};
+
+/**
+ * initialize CBOR writer
+ * @param w writer to be initialized
+ * @param buf buffer to write encoded data to
+ * @param size size of buffer
+ */
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t size);
+
+/**
+ * check if all encoded data fit in buffer
+ * @param w writer
+ * @return true if nothing been truncated
+ */
+static inline bool cbor_writer_ok(const cbor_writer_t *w)
+{
+    return w->len <= w->size;
+}
+
+/**
+ * write unsigned integer
+ * @param w writer
+ * @param value value to write
+ */
+void cbor_write_uint(cbor_writer_t *w, uint64_t value);
+
+/**
+ * write signed integer
+ * @param w writer
+ * @param value value to write
+ */
+void cbor_write_int(cbor_writer_t *w, int64_t value);
+
+/**
+ * write number in shortest lossless form, integer, single or double
+ * precision float, NAN is written as null
+ * @param w writer
+ * @param value value to write
+ */
+void cbor_write_number(cbor_writer_t *w, double value);
+
+/**
+ * write utf-8 text string
+ * @param w writer
+ * @param str string to write, NULL is written as null
+ */
+void cbor_write_text(cbor_writer_t *w, const char *str);
+
+/**
+ * write array header, followed by n items
+ * @param w writer
+ * @param n number of items in array
+ */
+void cbor_write_array(cbor_writer_t *w, size_t n);
+
+/**
+ * write map header, followed by n key/value pairs
+ * @param w writer
+ * @param n number of pairs in map
+ */
+void cbor_write_map(cbor_writer_t *w, size_t n);
+
+/**
+ * write null
+ * @param w writer
+ */
+void cbor_write_null(cbor_writer_t *w);
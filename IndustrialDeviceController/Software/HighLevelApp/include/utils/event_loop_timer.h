@@ -5,6 +5,8 @@
 #include <time.h>
 #include <applibs/eventloop.h>
 
+#include <utils/histogram.h>
+
 typedef struct event_loop_timer_t event_loop_timer_t;
 
 typedef void (*event_loop_timer_callback_t)(void *context);
@@ -14,12 +16,13 @@ typedef void (*event_loop_timer_callback_t)(void *context);
  * @param eloop EventLoop instance
  * @param init  initial expiration of the timer in seconds and nanoseconds, pass NULL or set both value to zero disarm timer 
  * @param interval repeat expiration in seconds and nanoseconds, pass NULL or set both to zero will expire just once as specified in init
+ * @param slack how late each expiration may be dispatched so it shares a wakeup with other timers, pass NULL for none
  * @param callback - callback been invoked on timer expiration
  * @param context - context to be used when invoke callback
  * @return timer instance, resource must be released with event_loop_unregister_timer()
  */
 event_loop_timer_t *event_loop_register_timer(EventLoop *eloop, const struct timespec *init, const struct timespec *interval,
-                                              event_loop_timer_callback_t callback, void *context);
+                                              const struct timespec *slack, event_loop_timer_callback_t callback, void *context);
 
 
 /**
@@ -54,4 +57,10 @@ int event_loop_set_timer_and_context(event_loop_timer_t *timer, const struct tim
  * @param timer timer to be cancelled
  * @return 0 on succed or -1 on failed
  */
-int event_loop_cancel_timer(event_loop_timer_t *timer);
\ No newline at end of file
+int event_loop_cancel_timer(event_loop_timer_t *timer);
+
+/**
+ * record number of timers dispatched by each wakeup
+ * @param hist histogram to record to, NULL to stop recording
+ */
+void event_loop_timer_set_dispatch_histogram(histogram_t *hist);
\ No newline at end of file
@@ -0,0 +1,68 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// deepest evaluation stack an expression may need, deeper ones don't compile
+#define EXPR_MAX_STACK 16
+
+/**
+ * Type of the function resolving a variable name of an expression
+ * @param name variable name, not NUL terminated
+ * @param len length of name
+ * @param context context given to expr_compile()
+ * @return index of the variable in values given to expr_eval(), -1 if unknown
+ */
+typedef int32_t (*expr_resolve_func_t)(const char *name, size_t len, void *context);
+
+// expressions compiled into stack bytecode, code of all of them in one block
+typedef struct expr_program_t expr_program_t;
+
+/**
+ * create an empty program
+ * @return program, release with expr_program_destroy()
+ */
+expr_program_t *expr_program_create(void);
+
+/**
+ * destroy program and its code
+ * @param program program, may be NULL
+ */
+void expr_program_destroy(expr_program_t *program);
+
+/**
+ * compile an expression and append it to program. Operators are those of C
+ * on doubles, with ! ~ & | ^ << >> on integer values and comparisons giving
+ * 1 or 0, functions are abs, sqrt, floor, round, min(a,b), max(a,b),
+ * bits(x,offset,width) and if(cond,a,b). A variable is a name of letters,
+ * digits, '_' and '.', or any name in single quotes
+ * @param program program to append to
+ * @param text expression, not NUL terminated
+ * @param len length of text
+ * @param resolve resolver of variable names
+ * @param context context passed to resolve
+ * @return id of compiled expression, -1 on syntax error, unknown variable or
+ *         expression needing a stack deeper than EXPR_MAX_STACK
+ */
+int32_t expr_compile(expr_program_t *program, const char *text, size_t len, expr_resolve_func_t resolve,
+                     void *context);
+
+/**
+ * evaluate a compiled expression, nothing is allocated
+ * @param program program expression was compiled into
+ * @param id id returned by expr_compile()
+ * @param values variable values, indexed as resolve returned
+ * @return value, NAN if a variable read is NAN, an integer operand is out of
+ *         range or the result is not finite
+ */
+double expr_eval(const expr_program_t *program, int32_t id, const double *values);
+
+/**
+ * get size of code and constants of program
+ * @param program program
+ * @return size in bytes
+ */
+size_t expr_program_size(const expr_program_t *program);
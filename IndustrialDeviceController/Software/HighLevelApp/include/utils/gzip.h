@@ -0,0 +1,43 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// minimal gzip (RFC 1952) compressor, single deflate block with fixed Huffman
+// codes and greedy LZ77 matching. Good enough for repetitive telemetry and
+// needs no dynamic memory beyond a small hash table on stack. Decompressor
+// takes any deflate stream, with its tables on stack too
+
+/**
+ * compress data in gzip format
+ * @param in data to compress
+ * @param len number of bytes in data
+ * @param out buffer for compressed data
+ * @param size size of buffer
+ * @return number of bytes written to out, 0 if it doesn't fit in buffer
+ */
+size_t gzip_compress(const uint8_t *in, size_t len, uint8_t *out, size_t size);
+
+/**
+ * decompress data in gzip format, any deflate blocks, as written by
+ * gzip_compress() or another compressor
+ * @param in gzip data
+ * @param len number of bytes in data
+ * @param out buffer for decompressed data
+ * @param size size of buffer
+ * @return number of bytes written to out, 0 if data is not valid gzip, fails
+ *         its CRC or doesn't fit in buffer
+ */
+size_t gzip_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t size);
+
+/**
+ * calculate CRC-32 (IEEE 802.3) of data
+ * @param crc CRC of previous data, 0 to start
+ * @param buf data
+ * @param len number of bytes in data
+ * @return updated CRC
+ */
+uint32_t gzip_crc32(uint32_t crc, const uint8_t *buf, size_t len);
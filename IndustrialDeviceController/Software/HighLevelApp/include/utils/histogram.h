@@ -0,0 +1,70 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// log-linear histogram in the style of HDR histogram: values below
+// 2^HISTOGRAM_SUB_BUCKET_BITS are counted exactly, above that every power of 2
+// is split into 2^HISTOGRAM_SUB_BUCKET_BITS buckets, so relative error stay
+// within 1/2^HISTOGRAM_SUB_BUCKET_BITS. values beyond HISTOGRAM_MAX_VALUE are
+// counted in last bucket
+#define HISTOGRAM_SUB_BUCKET_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1u << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_MAX_EXP 19
+#define HISTOGRAM_MAX_VALUE ((1u << (HISTOGRAM_MAX_EXP + 1)) - 1)
+#define HISTOGRAM_NUM_BUCKETS (HISTOGRAM_SUB_BUCKETS * (HISTOGRAM_MAX_EXP - HISTOGRAM_SUB_BUCKET_BITS + 2))
+
+typedef struct histogram_t histogram_t;
+struct histogram_t {
+    uint32_t counts[HISTOGRAM_NUM_BUCKETS];
+    uint32_t total;
+    uint32_t max;
+};
+
+/**
+ * clear all counts
+ * @param h histogram
+ */
+void histogram_reset(histogram_t *h);
+
+/**
+ * move counts to another histogram and clear them, values recorded meanwhile
+ * stay in source histogram
+ * @param h histogram
+ * @param out histogram receiving the counts
+ */
+void histogram_take(histogram_t *h, histogram_t *out);
+
+/**
+ * count one value, safe to call from multiple threads
+ * @param h histogram
+ * @param value value, e.g. latency in ms
+ */
+void histogram_record(histogram_t *h, uint32_t value);
+
+/**
+ * estimate value at given percentile
+ * @param h histogram
+ * @param percentile 0 to 100
+ * @return upper bound of bucket holding the percentile, 0 if histogram is empty
+ */
+uint32_t histogram_percentile(const histogram_t *h, double percentile);
+
+/**
+ * lowest value counted in a bucket
+ * @param bucket bucket index
+ * @return value
+ */
+uint32_t histogram_bucket_lower(int32_t bucket);
+
+/**
+ * print non-empty buckets as "lower:count" separated by space
+ * @param h histogram
+ * @param buf buffer to print to
+ * @param size size of buffer
+ * @return number of chars printed, truncated if buffer is too small
+ */
+int histogram_print(const histogram_t *h, char *buf, size_t size);
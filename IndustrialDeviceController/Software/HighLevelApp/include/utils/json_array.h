@@ -0,0 +1,30 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include <frozen/frozen.h>
+
+/**
+ * called for each element of a JSON array
+ * @param elem element token, as json_scanf_array_elem would return it
+ * @param index element index
+ * @param user_data user data passed to json_array_walk
+ * @return false to skip the remaining elements
+ */
+typedef bool (*json_array_elem_cb)(const struct json_token *elem, int index, void *user_data);
+
+/**
+ * visit every element of a JSON array in a single pass, instead of
+ * json_scanf_array_elem() which re-walks the array from the start for each
+ * index and so makes a loop over the array quadratic
+ * @param str JSON array
+ * @param len length of str
+ * @param cb called for each element in order
+ * @param user_data passed to cb
+ * @return number of elements visited, -1 if str is not valid JSON (the elements
+ *         before the error have still been visited)
+ */
+int json_array_walk(const char *str, int len, json_array_elem_cb cb, void *user_data);
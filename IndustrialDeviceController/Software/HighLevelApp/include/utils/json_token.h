@@ -0,0 +1,18 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <frozen/frozen.h>
+
+/**
+ * unescape a JSON string token, as json_scanf's %T returns it, into a caller
+ * buffer; unlike %Q nothing is allocated, the token itself is a slice of the
+ * scanned payload
+ * @param t string token
+ * @param buf receives the NUL terminated string
+ * @param size size of buf
+ * @return length of the string, -1 if t is missing, not a string, not a valid
+ *         JSON string or too long for buf
+ */
+int json_token_unescape(const struct json_token *t, char *buf, int size);
@@ -4,6 +4,8 @@
 #pragma once
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 
 
 #ifndef LOG_LEVEL
@@ -66,6 +68,17 @@ void llog_config(int endpoint, int level);
  */
 void llog(int level, const char *file, const char *func, const char *fmt,...);
 
+/**
+ * log a hex dump of raw bytes, e.g. a frame on the wire
+ * when deferred, only bytes are copied and hex() runs at upload
+ * @param level log level of this piece of log
+ * @param file which file
+ * @param prefix string literal printed before the dump
+ * @param data bytes to dump
+ * @param len number of bytes
+ */
+void llog_hex(int level, const char *file, const char *prefix, const unsigned char *data, size_t len);
+
 /**
  * check if certain level log will be printed
  * so we can check log level first before start time consuming log generation. e.g. (decode/encode)
@@ -80,6 +93,14 @@ bool llog_islog(int level);
  */
 bool llog_remote_log_enabled(void);
 
+/**
+ * config how log is uploaded to iothub
+ * @param gzip compress uploaded log with gzip, sent with content encoding gzip
+ * @param budget bytes sent per upload at most, 0 for no limit. log over budget
+ * stay for next upload, a single line longer than budget is still sent
+ */
+void llog_config_upload(bool gzip, int32_t budget);
+
 /**
  * upload log to iothub
  * log module maintain a buffer which can hold certain lines of log, upload log will flush
@@ -89,6 +110,10 @@ void llog_upload(void);
 
 #define LOGV(...) llog(LOG_VERBOSE, __FILE__, NULL, __VA_ARGS__)
 
+#define LOGV_HEX(prefix, data, len) llog_hex(LOG_VERBOSE, __FILE__, prefix, data, len)
+
+#define LOGD_HEX(prefix, data, len) llog_hex(LOG_DEBUG, __FILE__, prefix, data, len)
+
 #define LOGD(...) llog(LOG_DEBUG, __FILE__, NULL, __VA_ARGS__)
 
 #define LOGI(...) llog(LOG_INFO,  __FILE__, NULL, __VA_ARGS__)
@@ -22,7 +22,41 @@ void massert_fail(const char *expr, int line, const char *file);
  * so we don't need to check memory alloc result everywhere from within
  * the code, after all, there is no better way to recover when malloc failed
  * other than restart app.
+ * On both versions, allocations up to 256 bytes come from fixed size class
+ * pools, memory_report() shows the high-water mark of each pool.
  */
+
+// size class pools, and the heap for everything else
+#define MEMORY_NUM_CLASSES 6
+
+typedef struct memory_class_stats_t memory_class_stats_t;
+struct memory_class_stats_t {
+    // slot size, 0 for the heap
+    size_t size;
+    size_t num_alloc;
+    size_t num_free;
+    size_t num_used;
+    size_t max_used;
+    // allocations that found the pool full and went to the heap
+    size_t num_overflow;
+};
+
+typedef struct memory_stats_t memory_stats_t;
+struct memory_stats_t {
+    // bytes handed out, pool slots by slot size and heap blocks by usable size
+    size_t live_bytes;
+    size_t peak_bytes;
+    memory_class_stats_t classes[MEMORY_NUM_CLASSES];
+};
+
+/**
+ * copy the allocator counters, they're kept as allocations are made so this
+ * doesn't walk anything and is cheap enough to call periodically, unlike
+ * memory_report()
+ * @param stats counters out
+ */
+void memory_get_stats(memory_stats_t *stats);
+
 #ifdef DEBUG
 
 #define MALLOC(size)           mmalloc(size, __LINE__, __FILE__)
@@ -84,5 +118,6 @@ void *mrealloc(void *ptr, size_t size);
 char *mstrdup(const char *s);
 char *mstrndup(const char *s, size_t len);
 void mfree(void *ptr);
+void memory_report(int show_detail);
 
 #endif
@@ -2,6 +2,8 @@
    Licensed under the MIT License. */
   
 #pragma once
+#include <stdbool.h>
+#include <applibs/eventloop.h>
 #include <applibs/networking.h>
 
 typedef struct link_t {
@@ -10,16 +12,50 @@ typedef struct link_t {
 } link_t;
 
 /**
- * initialize network module
+ * Type of the function callback invoked when combined network status changes
+ * @param status combined status of all network interfaces, as network_get_status()
+ * @param context context given to network_set_status_callback()
+ */
+typedef void (*network_status_func_t)(Networking_InterfaceConnectionStatus status, void *context);
+
+/**
+ * Type of the function callback invoked when uplink moves to another interface
+ * @param uplink interface now carrying iot traffic, NULL if none reaches internet
+ * @param previous interface that carried it before, NULL if none did
+ * @param context context given to network_set_uplink_callback()
+ */
+typedef void (*network_uplink_func_t)(const char *uplink, const char *previous, void *context);
+
+/**
+ * initialize network module, status of interfaces is refreshed by a timer of
+ * event loop every NETWORK_STATUS_REFRESH_MS and cached for the query functions
+ * below, which can be called from any thread
+ * @param eloop event loop to refresh status on
  * @return 0 if succeed, negative otherwise
  */
-int network_init(void);
+int network_init(EventLoop *eloop);
 
 /**
  * deinitialize network module
  */
 void network_deinit(void);
 
+/**
+ * set callback invoked on event loop thread when combined network status
+ * changes, replacing previous one
+ * @param callback callback, NULL for none
+ * @param context context passed to callback
+ */
+void network_set_status_callback(network_status_func_t callback, void *context);
+
+/**
+ * set callback invoked on event loop thread when uplink moves to another
+ * interface, replacing previous one
+ * @param callback callback, NULL for none
+ * @param context context passed to callback
+ */
+void network_set_uplink_callback(network_uplink_func_t callback, void *context);
+
 /**
  * get MAC address of given interface
  * @param ifa_name interface name
@@ -30,6 +66,8 @@ void network_get_mac(const char* ifa_name, char* buf, size_t buf_size);
 
 /**
  * configure network uplink (how to connect to iot hub, wifi or ethernet)
+ * the configured one is preferred, the other interface is kept enabled as
+ * standby and takes over iot traffic while configured one can't reach internet
  * network downlink (if we try to use network to connect to CE device), currently we support
  * direct TCP connection and private ethernet connection
  * @param uplink uplink to iot hub configuration
@@ -43,7 +81,8 @@ int network_config(link_t* uplink, link_t* downlink);
  * Since IoT SDK will try to use whatever avaiable network unless we explicitly enable/disable certain
  * network interface, we intentionally enable both wifi and eth interface so we can have flexibility to
  * remote configure wifi connection.
- * @return combined network interface status, in other word, the closest status we can get toward internet connection
+ * @return combined network interface status, in other word, the closest status we can get toward internet connection,
+ * as of last refresh
  */
 Networking_InterfaceConnectionStatus network_get_status(void);
 
@@ -67,3 +106,12 @@ bool network_is_connected(void);
  */
 bool network_is_interface_connected(const char *nic);
 
+/**
+ * get interface iot traffic goes over, as of last refresh. It stays on the
+ * interface it's on while that reaches internet, and only moves to one that
+ * already does, back to configured uplink once that has been connected for
+ * NETWORK_UPLINK_RESTORE_MS
+ * @return "eth0", "wlan0", or NULL if no interface reaches internet
+ */
+const char *network_get_uplink(void);
+
@@ -2,12 +2,14 @@
    Licensed under the MIT License. */
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <time.h>
 #include <math.h>
+#include <float.h>
 #include <stdbool.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -19,9 +21,19 @@
 #include <init/adapter.h>
 #include <init/device_hal.h>
 #include <init/globals.h>
+#include <init/modbus_gateway.h>
+#include <init/telemetry_batch.h>
+#include <init/telemetry_state.h>
+#include <init/telemetry_store.h>
+#include <driver/modbus.h>
 #include <iot/diag.h>
 #include <iot/iot.h>
+#include <utils/arena.h>
+#include <utils/cbor.h>
 #include <utils/event_loop_timer.h>
+#include <utils/expr.h>
+#include <utils/gzip.h>
+#include <utils/json_array.h>
 #include <utils/llog.h>
 #include <utils/memory.h>
 #include <utils/network.h>
@@ -39,18 +51,231 @@ extern volatile bool g_app_running;
 
 #define MAX_CONNECTION_STRING_SIZE 100
 
-const char PROV_FILE_MAGIC[8] = {'P', 'R', 'O', 'V', ' ', 'V', '0', '1'};
-
+// room reserved in telemetry message for timestamp, field names and brackets
+#define TELEMETRY_MESSAGE_OVERHEAD 128
+// room reserved for each point besides its key, "[key,value]," with quoting
+#define TELEMETRY_POINT_OVERHEAD 8
+// max length of number value formatted by double_to_str on fast path
+#define TELEMETRY_NUM_VALUE_SIZE 24
+// above this magnitude (in 1/1000 unit) number is formatted by snprintf
+#define TELEMETRY_FIXED_POINT_LIMIT 1e15
+// longest key of window statistics, point key is cut so suffix always fits
+#define TELEMETRY_WINDOW_KEY_SIZE 128
+
+const char PROV_FILE_MAGIC[8] = {'P', 'R', 'O', 'V', ' ', 'V', '0', '2'};
+// provision JSON stored as is, saved by earlier versions
+const char PROV_FILE_MAGIC_V01[8] = {'P', 'R', 'O', 'V', ' ', 'V', '0', '1'};
+
+// header is followed by gzip'd provision JSON, then by gzip'd image of the
+// scanned provision unless it didn't fit. V01 header ends after size and is
+// followed by JSON, hashcode is of the JSON there
 struct prov_file_hdr_t {
-    char magic[8]; // "PROV V01"
-    uint32_t hashcode;
+    char magic[8]; // "PROV V02"
+    uint32_t hashcode; // of header fields after it
     int32_t size;
+    int32_t packed_size;
+    int32_t image_version;
+    int32_t image_size;
+    int32_t image_packed_size; // 0 if image isn't stored
+    int64_t epoch;
+    uint64_t content_hash;
+};
+
+// version of image layout and of what scanning a provision gives, bump it when
+// either changes so saved images are scanned from JSON again
+#define PROV_IMAGE_VERSION 2
+#define PROV_IMAGE_CHUNK 4096
+
+// kinds of image record
+#define PROV_RECORD_ADAPTER 'A'
+#define PROV_RECORD_SCHEMA 'S'
+#define PROV_RECORD_DEVICE 'D'
+
+#define PROV_RECORD_MAX_TOKEN 9
+#define PROV_RECORD_MAX_VALUE 6
+
+// tokens and values of an adapter record
+enum {
+    PROV_ADAPTER_NAME,
+    PROV_ADAPTER_LOCATION,
+    PROV_ADAPTER_SOURCE_ID,
+    PROV_ADAPTER_ENCODING,
+    PROV_ADAPTER_BATCH,
+    PROV_ADAPTER_TRACE,
+    PROV_ADAPTER_GATEWAY,
+    PROV_ADAPTER_UPLINK,
+    PROV_ADAPTER_DOWNLINK,
+    PROV_ADAPTER_TOKENS
+};
+
+// tokens of a schema record
+enum {
+    PROV_SCHEMA_NAME,
+    PROV_SCHEMA_PROTOCOL,
+    PROV_SCHEMA_FLAGS,
+    PROV_SCHEMA_POINTS,
+    PROV_SCHEMA_GROUPS,
+    PROV_SCHEMA_PRIORITY,
+    PROV_SCHEMA_COMPUTED,
+    PROV_SCHEMA_HIDDEN,
+    PROV_SCHEMA_TOKENS
+};
+
+// values of a schema record
+enum {
+    PROV_SCHEMA_INTERVAL,
+    PROV_SCHEMA_TIMEOUT,
+    PROV_SCHEMA_MAX_GAP,
+    PROV_SCHEMA_MAX_AGE,
+    PROV_SCHEMA_MAX_INTERVAL,
+    PROV_SCHEMA_AGGREGATE,
+    PROV_SCHEMA_VALUES
+};
+
+// tokens of a device record
+enum {
+    PROV_DEVICE_NAME,
+    PROV_DEVICE_SCHEMA,
+    PROV_DEVICE_ID,
+    PROV_DEVICE_CONNECTION,
+    PROV_DEVICE_LOCATION,
+    PROV_DEVICE_TOKENS
+};
+
+// values of a device record
+enum {
+    PROV_DEVICE_INTERVAL,
+    PROV_DEVICE_MAX_INTERVAL,
+    PROV_DEVICE_TIMEOUT,
+    PROV_DEVICE_MIN_GAP,
+    PROV_DEVICE_GATEWAY_UNIT,
+    PROV_DEVICE_PIPELINE,
+    PROV_DEVICE_VALUES
+};
+
+// fields of adapter, a schema or a device as scanned from provision JSON,
+// tokens point into JSON or into the image record was read from
+typedef struct prov_record_t prov_record_t;
+struct prov_record_t {
+    uint64_t def_hash;
+    struct json_token tokens[PROV_RECORD_MAX_TOKEN];
+    int32_t values[PROV_RECORD_MAX_VALUE];
+};
+
+// records of a provision in the order they were scanned, saved along with its
+// JSON so provision is built at startup without walking JSON again
+typedef struct prov_image_t prov_image_t;
+struct prov_image_t {
+    uint8_t *buf;
+    size_t len;
+    size_t size;
+    bool failed;
+};
+
+typedef struct prov_image_reader_t prov_image_reader_t;
+struct prov_image_reader_t {
+    const uint8_t *pos;
+    const uint8_t *end;
+};
+
+
+// a slave on a downlink, devices of same id on the link share it. Slaves that
+// need a quiet period between transactions get min_gap_ms, other slaves on the
+// bus are served meanwhile
+typedef struct bus_slave_t bus_slave_t;
+struct bus_slave_t {
+    uint32_t id;
+    int32_t min_gap_ms;
+    // last transaction with slave, in flight while ts_start is after ts_end
+    struct timespec ts_start;
+    struct timespec ts_end;
+    bus_slave_t *next;
+};
+
+// point written to broadcast address of a downlink, once for all its slaves
+typedef struct bus_write_t bus_write_t;
+struct bus_write_t {
+    data_schema_t *schema;
+    char *key;
+    char *value;
+    bus_write_t *next;
+};
+
+// a physical or logical link devices are polled through, e.g. the board
+// serial port for RTU devices or a TCP endpoint, each owns one driver instance
+typedef struct downlink_t downlink_t;
+struct downlink_t {
+    device_protocol_t protocol;
+    char *conn_str;
+    device_driver_t *driver;
+    bool opened;
+
+    bus_slave_t *slaves;
+
+    // broadcast writes waiting for the bus, served before queued polls
+    bus_write_t *write_head;
+    bus_write_t *write_tail;
+
+    // time transactions kept link busy since ts_util, reported as utilization
+    struct timespec ts_util;
+    int64_t busy_ms;
+    diag_handle_t diag_util;
+
+    // notify fd of driver registered in event loop, NULL if driver has none
+    EventRegistration *notify_io;
+
+    // number of polls allowed/running concurrently on this link
+    int32_t max_inflight;
+    int32_t inflight;
+
+    // devices due for poll, in FIFO order
+    ce_device_t *queue_head;
+    ce_device_t *queue_tail;
+
+    downlink_t *next;
+};
+
+// worker thread -> main thread result record
+typedef struct device_result_t device_result_t;
+struct device_result_t {
+    int64_t epoch;
+    ce_device_t *device;
 };
 
+typedef enum telemetry_encoding_t {
+    TELEMETRY_ENCODING_JSON,
+    // CBOR with point keys replaced by index into schema
+    TELEMETRY_ENCODING_CBOR
+} telemetry_encoding_t;
+
+#define TELEMETRY_ENCODING_JSON_STR "json"
+#define TELEMETRY_ENCODING_CBOR_STR "cbor"
+
+// CBOR telemetry message is a map with integer keys
+enum {
+    CBOR_TELEMETRY_TIMESTAMP, // epoch ms
+    CBOR_TELEMETRY_NAME,
+    CBOR_TELEMETRY_LOCATION,
+    CBOR_TELEMETRY_SCHEMA,    // schema key hash, identify key list point index refer to
+    CBOR_TELEMETRY_ERROR,
+    CBOR_TELEMETRY_POINTS,    // map of point index to value
+    CBOR_TELEMETRY_LAST
+};
 
 typedef struct adapter_t adapter_t;
 struct adapter_t {
     int64_t provision_epoch;
+    // hash of data section of current provision, a provision of other epoch
+    // with same content is not applied again
+    uint64_t provision_hash;
+    // names, schemas, devices and downlinks of current provision, released
+    // at once by reset_adapter
+    arena_t *arena;
+    // previous provision while a new one is parsed, unchanged schemas, devices
+    // and live drivers are taken over from it
+    adapter_t *prev;
+    // image recorded while provision is scanned from JSON, NULL if not saved
+    prov_image_t *image;
     char* name;
     char* location;
     char* source_id;
@@ -58,43 +283,155 @@ struct adapter_t {
     int32_t num_device;
     int32_t num_schema;
 
+    telemetry_encoding_t encoding;
+
+    // telemetry of devices coalesced into one message up to this size, 0 if disabled
+    size_t batch_size;
+
+    // trace of reading carried as message properties of telemetry sent alone
+    bool trace;
+    int32_t batch_latency_ms;
+
+    // port local modbus tcp gateway listens on, 0 if disabled, and max age of
+    // registers it serves, 0 to derive it from poll interval of device
+    int32_t gateway_port;
+    int32_t gateway_max_age_ms;
+
     link_t uplink;
     link_t downlink;
 
     ce_device_t* devices;
     data_schema_t* schemas;
-    device_driver_t *driver;
+    downlink_t *downlinks;
     uint32_t driver_state;
 
     struct timespec last_provisioned;
 
-    pthread_t worker_tid;
+    pthread_t worker_tids[ADAPTER_WORKER_THREADS];
+    int32_t num_worker;
+    bool stopping;
+
+    // downlink last served by a worker, for round robin
+    downlink_t *last_served;
+
+    // binary min heap of idle devices ordered by next schedule time
+    ce_device_t **sched_heap;
+    int32_t sched_size;
+    uint32_t sched_seq;
+
+    // total polls running on all downlinks
+    int32_t inflight;
+
     // worker thread -> main thread RESULT queue
     int result_pipe[2];
 
     EventRegistration *result_io;
     event_loop_timer_t *notify_timer;
+    event_loop_timer_t *state_timer;
     EventLoop *eloop;
 
+    // provision being applied is the one saved before restart, restore
+    // telemetry state saved with it
+    bool restore_state;
+
     char *pending_provision;
     pthread_mutex_t mutex;
+    // signaled when device queued or downlink become available
     pthread_cond_t cond;
-
-    ce_device_t *pending_device;
-    ce_device_t *ready_device;
+    // signaled when no poll is running
+    pthread_cond_t idle_cond;
 };
 
 
 static adapter_t s_adapter;
+static adapter_t s_prev_provision;
+
+// poll latency of all devices, recorded by worker threads
+static histogram_t *s_poll_hist = NULL;
+// acquisition to delivery of priority messages
+static histogram_t *s_alarm_hist = NULL;
+// stages of telemetry from poll start to delivery to iot hub
+static histogram_t *s_wire_hist = NULL;
+static histogram_t *s_decode_hist = NULL;
+static histogram_t *s_queue_hist = NULL;
+static histogram_t *s_deliver_hist = NULL;
+static histogram_t *s_age_hist = NULL;
+
+// last subscriber id given to a device
+static uint32_t s_subscriber_seq = 0;
+
+
+static uint32_t prov_header_hash(const struct prov_file_hdr_t *hdr)
+{
+    size_t offset = offsetof(struct prov_file_hdr_t, size);
+    return hash((const unsigned char *)hdr + offset, sizeof(*hdr) - offset);
+}
+
+// read provision of V01 file, JSON stored as is after header
+static char *load_provision_v01(int fd, const struct prov_file_hdr_t *hdr)
+{
+    if (hdr->size < 0 || hdr->size > PROVISION_FILE_MAX_SIZE) {
+        LOGW("provision file size invalid");
+        return NULL;
+    }
+
+    char *provision = (char *)MALLOC(hdr->size + 1);
+
+    if (read(fd, provision, hdr->size) != hdr->size) {
+        LOGW("Failed to read provision content");
+        FREE(provision);
+        return NULL;
+    }
+
+    provision[hdr->size] = 0;
+
+    if (hash((const unsigned char *)provision, hdr->size) != hdr->hashcode) {
+        LOGW("provision hashcode not match");
+        FREE(provision);
+        return NULL;
+    }
+    return provision;
+}
+
+// read and decompress packed_size bytes at offset after header, return size
+// bytes and a NUL after them, NULL if they can't be read or don't decompress
+static uint8_t *load_provision_part(int fd, int32_t offset, int32_t packed_size, int32_t size)
+{
+    off_t pos = PROVISION_FILE_OFFSET + sizeof(struct prov_file_hdr_t) + offset;
+    if (lseek(fd, pos, SEEK_SET) != pos) {
+        return NULL;
+    }
+
+    uint8_t *packed = (uint8_t *)MALLOC(packed_size);
+    if (read(fd, packed, packed_size) != packed_size) {
+        FREE(packed);
+        return NULL;
+    }
 
+    uint8_t *content = (uint8_t *)MALLOC(size + 1);
+    size_t len = gzip_decompress(packed, packed_size, content, size);
+    FREE(packed);
 
-// load local provision, return hashcode and null terminated provision
-// caller response to free provision
-static int load_local_provision(char **p_provision)
+    if (len != (size_t)size) {
+        FREE(content);
+        return NULL;
+    }
+    content[size] = 0;
+    return content;
+}
+
+// load local provision, image of it if saved by same image version, otherwise
+// null terminated JSON of it. Caller responsible to free what is returned
+static int load_local_provision(struct prov_file_hdr_t *hdr, char **p_provision, uint8_t **p_image)
 {
+    ASSERT(hdr);
     ASSERT(p_provision);
+    ASSERT(p_image);
+
+    *p_provision = NULL;
+    *p_image = NULL;
+    memset(hdr, 0, sizeof(*hdr));
 
-    struct prov_file_hdr_t hdr;
     int fd = Storage_OpenMutableFile();
     if (fd < 0) {
         LOGE("Failed to open mutable storage");
@@ -107,87 +444,179 @@ static int load_local_provision(char **p_provision)
         return -1;
     }
 
-    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+    ssize_t v01_size = offsetof(struct prov_file_hdr_t, packed_size);
+    if (read(fd, hdr, v01_size) != v01_size) {
         LOGE("Failed to read prov file header");
         close(fd);
         return -1;
     }
 
-    if (memcmp(hdr.magic, PROV_FILE_MAGIC, sizeof(PROV_FILE_MAGIC)) != 0) {
+    if (memcmp(hdr->magic, PROV_FILE_MAGIC_V01, sizeof(PROV_FILE_MAGIC_V01)) == 0) {
+        *p_provision = load_provision_v01(fd, hdr);
+        close(fd);
+        LOGI("load_local_provision: V01, hash=%x", hdr->hashcode);
+        return *p_provision ? 0 : -1;
+    }
+
+    if (memcmp(hdr->magic, PROV_FILE_MAGIC, sizeof(PROV_FILE_MAGIC)) != 0) {
         LOGW("provision file magic mismatch");
         close(fd);
         return -1;
     }
 
-    if (hdr.size < 0 || hdr.size > PROVISION_FILE_MAX_SIZE) {
-        LOGW("provision file size invalid");
+    ssize_t rest = sizeof(*hdr) - v01_size;
+    if (read(fd, (char *)hdr + v01_size, rest) != rest || prov_header_hash(hdr) != hdr->hashcode) {
+        LOGW("provision header invalid");
         close(fd);
         return -1;
     }
 
-    char *provision = (char *)MALLOC(hdr.size + 1);
-
-    if (read(fd, provision, hdr.size) != hdr.size) {
+    int32_t room = PROVISION_FILE_MAX_SIZE - sizeof(*hdr);
+    if (hdr->size <= 0 || hdr->size > PROVISION_MAX_SIZE || hdr->packed_size <= 0 || hdr->packed_size > room ||
+        hdr->image_size < 0 || hdr->image_size > PROVISION_MAX_SIZE || hdr->image_packed_size < 0 ||
+        hdr->image_packed_size > room - hdr->packed_size) {
+        LOGW("provision file size invalid");
         close(fd);
-        LOGW("Failed to read provision content");
-        FREE(provision);
         return -1;
     }
 
-    close(fd);
-    provision[hdr.size] = 0;
+    // image of another version is of no use, provision is scanned from JSON then
+    if (hdr->image_version == PROV_IMAGE_VERSION && hdr->image_packed_size > 0 && hdr->image_size > 0) {
+        *p_image = load_provision_part(fd, hdr->packed_size, hdr->image_packed_size, hdr->image_size);
+        if (!*p_image) {
+            LOGW("provision image corrupted, load JSON");
+        }
+    }
 
-    if (hash(provision, hdr.size) != hdr.hashcode) {
-        LOGW("provision hashcode not match");
-        FREE(provision);
-        return -1;
+    if (!*p_image) {
+        *p_provision = (char *)load_provision_part(fd, 0, hdr->packed_size, hdr->size);
+        if (!*p_provision) {
+            LOGW("provision content corrupted");
+            close(fd);
+            return -1;
+        }
     }
 
-    *p_provision = provision;
-    LOGI("load_local_provision: hash=%x", hdr.hashcode);
+    close(fd);
+    LOGI("load_local_provision: hash=%016llx, image=%d", (unsigned long long)hdr->content_hash, *p_image != NULL);
     return 0;
 }
 
 
-static int save_local_provision(const char *provision, size_t provision_size)
+// save provision JSON and image of it, both gzip'd. Image is left out if it
+// doesn't fit, provision is scanned from JSON at startup then
+static int save_local_provision(const char *provision, size_t provision_size, const prov_image_t *image,
+                                int64_t epoch, uint64_t content_hash)
 {
     ASSERT(provision);
 
+    struct prov_file_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy_s(hdr.magic, sizeof(hdr.magic), PROV_FILE_MAGIC, sizeof(PROV_FILE_MAGIC));
+
+    size_t room = PROVISION_FILE_MAX_SIZE - sizeof(hdr);
+    uint8_t *packed = (uint8_t *)MALLOC(room);
+
+    hdr.size = provision_size;
+    hdr.packed_size = provision_size <= PROVISION_MAX_SIZE ?
+        gzip_compress((const uint8_t *)provision, provision_size, packed, room) : 0;
+    if (hdr.packed_size == 0) {
+        LOGE("Provision doesn't fit in local storage");
+        FREE(packed);
+        return -1;
+    }
+
+    hdr.image_version = PROV_IMAGE_VERSION;
+    if (image && !image->failed && image->len > 0 && image->len <= PROVISION_MAX_SIZE) {
+        hdr.image_size = image->len;
+        hdr.image_packed_size = gzip_compress(image->buf, image->len, packed + hdr.packed_size, room - hdr.packed_size);
+    }
+    if (hdr.image_packed_size == 0) {
+        LOGW("Provision image not saved, it will be scanned from JSON");
+        hdr.image_size = 0;
+    }
+
+    hdr.epoch = epoch;
+    hdr.content_hash = content_hash;
+    hdr.hashcode = prov_header_hash(&hdr);
+
     int fd = Storage_OpenMutableFile();
     if (fd < 0) {
         LOGE("Failed to open mutable storage");
+        FREE(packed);
         return -1;
     }
 
-    struct prov_file_hdr_t hdr;
-    memcpy_s(hdr.magic, sizeof(hdr.magic), PROV_FILE_MAGIC, sizeof(PROV_FILE_MAGIC));
-    hdr.size = provision_size;
-    hdr.hashcode = hash(provision, provision_size);
     lseek(fd, PROVISION_FILE_OFFSET, SEEK_SET);
 
     if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
         close(fd);
+        FREE(packed);
         LOGE("Failed to write provision header");
         return -1;
     }
 
-    if (write(fd, provision, hdr.size) != hdr.size) {
+    ssize_t packed_size = hdr.packed_size + hdr.image_packed_size;
+    if (write(fd, packed, packed_size) != packed_size) {
         close(fd);
+        FREE(packed);
         LOGE("Failed to write provision content");
         return -1;
     }
 
     fsync(fd);
     close(fd);
+    FREE(packed);
 
-    LOGI("save_local_provision: hash=%x", hdr.hashcode);
+    LOGI("save_local_provision: hash=%016llx, size=%ld, packed=%ld, image=%ld", (unsigned long long)content_hash,
+         hdr.size, hdr.packed_size, hdr.image_packed_size);
     return 0;
 }
 
-// double to str and trim tailing '0's
+// double to str in "%.3f" and trim tailing '0's
 static char *double_to_str(double d)
 {
     static char buf[TELEMETRY_MAX_VALUE_SIZE];
+
+    // fast path, format as fixed point integer of 1/1000 unit, avoiding snprintf.
+    // value close to rounding tie is left to snprintf so output stay identical
+    double scaled = fabs(d) * 1000;
+    double frac = scaled - floor(scaled);
+
+    if (scaled < TELEMETRY_FIXED_POINT_LIMIT && fabs(frac - 0.5) > scaled * 4 * DBL_EPSILON) {
+        uint64_t mag = (uint64_t)llround(scaled);
+        char digits[TELEMETRY_NUM_VALUE_SIZE];
+        int ndigit = 0;
+
+        // at least 4 digits so there is always integer part
+        do {
+            digits[ndigit++] = '0' + (mag % 10);
+            mag /= 10;
+        } while (mag || ndigit < 4);
+
+        // skip trailing '0's of fraction part
+        int frac_begin = 0;
+        while (frac_begin < 3 && digits[frac_begin] == '0') {
+            frac_begin++;
+        }
+
+        int len = 0;
+        if (signbit(d)) {
+            buf[len++] = '-';
+        }
+        for (int i = ndigit - 1; i >= 3; i--) {
+            buf[len++] = digits[i];
+        }
+        if (frac_begin < 3) {
+            buf[len++] = '.';
+            for (int i = 2; i >= frac_begin; i--) {
+                buf[len++] = digits[i];
+            }
+        }
+        buf[len] = 0;
+        return buf;
+    }
+
     int nchar = snprintf(buf, sizeof(buf), "%.3f", d);
 
     for (int i = nchar - 1; i; i--) {
@@ -203,28 +632,73 @@ static char *double_to_str(double d)
     return buf;
 }
 
+// window statistics of aggregated point next to its last value, with key
+// suffixes as diag reports its aggregated values
+static int printf_point_window(struct json_out *out, const char *key, const telemetry_window_t *window)
+{
+    static const char *suffixes[] = {"_min", "_max", "_mean", "_count"};
+    double values[] = {window->min, window->max, window->sum / window->count, window->count};
+    char name[TELEMETRY_WINDOW_KEY_SIZE];
+    int len = 0;
+
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        snprintf(name, sizeof(name), "%.*s%s", TELEMETRY_WINDOW_KEY_SIZE - 8, key, suffixes[i]);
+        len += json_printf(out, ",[%Q,%Q]", name, double_to_str(values[i]));
+    }
+    return len;
+}
+
+// point goes in telemetry message, a window message carries aggregated points
+// of closed windows and a poll message the others
+static bool is_point_reported(const ce_device_t *device, int i, bool force, uint32_t windows)
+{
+    const data_schema_t *schema = device->schema;
+    const data_point_t *point = &schema->points[i];
+
+    if (point->hidden) {
+        return false;
+    }
+
+    if (windows) {
+        return point->aggregated && IN_POINT_GROUPS(schema, windows, i);
+    }
+
+    // skip unchanged value if COV flag set
+    return !point->aggregated && (force || IS_COV(device->telemetry, i));
+}
+
 static int printf_points(struct json_out *out, va_list *ap)
 {
     ce_device_t *device = va_arg(*ap, struct ce_device_t *);
     int force = va_arg(*ap, int);
+    uint32_t windows = va_arg(*ap, uint32_t);
 
     int len = json_printf(out, "[[%Q,\"%d\"]", "ERROR_CODE", device->err);
 
     for (int i = 0; i < device->schema->num_point; i++) {
-        // skip unchanged value if COV flag set
-        if (!force && !IS_COV(device->telemetry, i)) {
+        if (!is_point_reported(device, i, force, windows)) {
+            continue;
+        }
+
+        // without COV there is no value of groups not polled this time
+        if (!windows && !(device->schema->flags & FLAG_COV) &&
+            !IN_POINT_GROUPS(device->schema, device->poll_groups, i)) {
             continue;
         }
 
         if (IS_STR_VALUE(device->telemetry, i)) {
-            len += json_printf(out, ",[%Q,%Q]", device->schema->points[i].key, device->telemetry->values[i].str);
+            len += json_printf(out, ",[%Q,%Q]", device->schema->points[i].key, get_telemetry_string_value(device->telemetry, i));
         } else {
-            if (isnan(device->telemetry->values[i].num)) {
+            if (isnan(device->telemetry->nums[i])) {
                 len += json_printf(out, ",[%Q,%s]", device->schema->points[i].key, "null");
             } else {
-                len += json_printf(out, ",[%Q,%Q]", device->schema->points[i].key, double_to_str(device->telemetry->values[i].num));
+                len += json_printf(out, ",[%Q,%Q]", device->schema->points[i].key, double_to_str(device->telemetry->nums[i]));
             }
         }
+
+        if (windows && device->telemetry->window && device->telemetry->window[i].count) {
+            len += printf_point_window(out, device->schema->points[i].key, &device->telemetry->window[i]);
+        }
     }
 
     len += json_printf(out, "]");
@@ -240,8 +714,8 @@ static struct timespec calc_telemetry_timestamp(const ce_device_t *device)
         for (int i = 0; i < device->schema->num_point; i++) {
             if (IS_NUM_VALUE(device->telemetry, i) &&
                 (strcasecmp(device->schema->points[i].key, "timestamp") == 0) &&
-                (!isnan(device->telemetry->values[i].num))) {
-                ts.tv_sec = device->telemetry->values[i].num;
+                (!isnan(device->telemetry->nums[i]))) {
+                ts.tv_sec = device->telemetry->nums[i];
                 ts.tv_nsec = 0;
             }
         }
@@ -249,601 +723,2473 @@ static struct timespec calc_telemetry_timestamp(const ce_device_t *device)
     return ts;
 }
 
-static char *build_telemetry_message(const ce_device_t *device, bool force)
+static size_t estimate_telemetry_message_size(const ce_device_t *device)
 {
-    ASSERT(device);
+    size_t size = TELEMETRY_MESSAGE_OVERHEAD + strlen(device->name);
 
-    return json_asprintf("{timestamp:%Q,name:%Q,location:%Q,point:%M}",
-                                      timespec2str(calc_telemetry_timestamp(device)),
-                                      device->name,
-                                      device->location,
-                                      printf_points, device, force);
-}
+    if (device->location) {
+        size += strlen(device->location);
+    }
 
-static void telemetry_message_delivered(bool delivered, void *context)
-{
-    if (delivered) {
-        LOGI("Telemetry delivered");
-    } else {
-        LOGW("Telemetry delivery failed");
-        diag_log_event(EVENT_TELEMETRY_FAILED);
+    for (int i = 0; i < device->schema->num_point; i++) {
+        size += strlen(device->schema->points[i].key) + TELEMETRY_POINT_OVERHEAD + TELEMETRY_NUM_VALUE_SIZE;
     }
+    return size;
 }
 
-
-static void send_telemetry_message(const ce_device_t *device, bool force)
+// serialize telemetry into device message buffer, buffer only grows when
+// message not fit, e.g. string values or keys need escaping
+static const char *build_telemetry_message(ce_device_t *device, bool force, uint32_t windows)
 {
     ASSERT(device);
 
-    LOGI("[%s] Send telemetry to iothub, status=%s", err_str(device->err));
-    char *message = build_telemetry_message(device, force);
+    if (!device->message_buf) {
+        device->message_buf_size = estimate_telemetry_message_size(device);
+        device->message_buf = (char *)MALLOC(device->message_buf_size);
+    }
+
+    while (true) {
+        struct json_out out = JSON_OUT_BUF(device->message_buf, device->message_buf_size);
+        int len = json_printf(&out, "{timestamp:%Q,name:%Q,location:%Q,point:%M}",
+                              timespec2str(calc_telemetry_timestamp(device)),
+                              device->name,
+                              device->location,
+                              printf_points, device, force, windows);
 
-    const char *message_type = IOT_MESSAGE_TYPE_TELEMETRY;
+        if (len < device->message_buf_size) {
+            return device->message_buf;
+        }
 
-    int err = iot_send_message_async(message, message_type, telemetry_message_delivered, NULL);
-    if (err != 0) {
-        LOGW("Failed to send telemetry message");
-        diag_log_event(EVENT_TELEMETRY_FAILED);
+        LOGD("[%s] Grow telemetry buffer to %d", device->name, len + 1);
+        FREE(device->message_buf);
+        device->message_buf_size = len + 1;
+        device->message_buf = (char *)MALLOC(device->message_buf_size);
     }
-
-    FREE(message);
 }
 
-// schema name format: <name>[:<offset>][:<channel>]
-static data_schema_t *parse_schema(data_schema_t *schemas, const char *schema_name)
+static void encode_telemetry_cbor(cbor_writer_t *w, const ce_device_t *device, bool force, uint32_t windows)
 {
-    char *colon = strchr(schema_name, ':');
-    size_t len = 0;
+    const data_schema_t *schema = device->schema;
+    const telemetry_t *telemetry = device->telemetry;
 
-    if (colon) {
-        len = colon - schema_name;
-    } else {
-        len = strlen(schema_name);
+    int npoint = 0;
+    for (int i = 0; i < schema->num_point; i++) {
+        if (is_point_reported(device, i, force, windows)) {
+            npoint++;
+        }
     }
 
-    for (data_schema_t *schema = schemas; schema; schema = schema->next) {
+    cbor_write_map(w, CBOR_TELEMETRY_LAST);
+    cbor_write_uint(w, CBOR_TELEMETRY_TIMESTAMP);
+    cbor_write_uint(w, SPEC2MS(calc_telemetry_timestamp(device)));
+    cbor_write_uint(w, CBOR_TELEMETRY_NAME);
+    cbor_write_text(w, device->name);
+    cbor_write_uint(w, CBOR_TELEMETRY_LOCATION);
+    cbor_write_text(w, device->location);
+    cbor_write_uint(w, CBOR_TELEMETRY_SCHEMA);
+    cbor_write_uint(w, schema->key_hash);
+    cbor_write_uint(w, CBOR_TELEMETRY_ERROR);
+    cbor_write_uint(w, device->err);
+    cbor_write_uint(w, CBOR_TELEMETRY_POINTS);
+    cbor_write_map(w, npoint);
+
+    for (int i = 0; i < schema->num_point; i++) {
+        if (!is_point_reported(device, i, force, windows)) {
+            continue;
+        }
 
-        if ((len == strlen(schema->name)) && strncmp(schema->name, schema_name, len) == 0) {
-            return schema;
+        cbor_write_uint(w, i);
+        // window statistics as [last, min, max, mean, count]
+        const telemetry_window_t *window = telemetry->window ? &telemetry->window[i] : NULL;
+        if (windows && window && window->count && IS_NUM_VALUE(telemetry, i)) {
+            cbor_write_array(w, 5);
+            cbor_write_number(w, telemetry->nums[i]);
+            cbor_write_number(w, window->min);
+            cbor_write_number(w, window->max);
+            cbor_write_number(w, window->sum / window->count);
+            cbor_write_uint(w, window->count);
+        } else if (IS_STR_VALUE(telemetry, i)) {
+            cbor_write_text(w, get_telemetry_string_value(telemetry, i));
+        } else {
+            cbor_write_number(w, telemetry->nums[i]);
         }
     }
-
-    return NULL;
 }
 
-
-// schema name format: <name>[:<offset>][:<channel>]
-static int32_t parse_schema_offset(const char *schema_name)
+// serialize telemetry as CBOR into device message buffer, return encoded size
+static size_t build_telemetry_cbor(ce_device_t *device, bool force, uint32_t windows)
 {
-    if (!schema_name) {
-        return 0;
+    ASSERT(device);
+
+    if (!device->message_buf) {
+        device->message_buf_size = estimate_telemetry_message_size(device);
+        device->message_buf = (char *)MALLOC(device->message_buf_size);
     }
 
-    char *offset_str = strchr(schema_name, ':');
+    while (true) {
+        cbor_writer_t w;
+        cbor_writer_init(&w, (uint8_t *)device->message_buf, device->message_buf_size);
+        encode_telemetry_cbor(&w, device, force, windows);
 
-    if (offset_str && offset_str[1]) {
-        return strtol(offset_str + 1, NULL, 10);
-    }
+        if (cbor_writer_ok(&w)) {
+            return w.len;
+        }
 
-    return 0;
+        LOGD("[%s] Grow telemetry buffer to %d", device->name, w.len);
+        FREE(device->message_buf);
+        device->message_buf_size = w.len;
+        device->message_buf = (char *)MALLOC(device->message_buf_size);
+    }
 }
 
-// schema name format: <name>[:<offset>][:<channel>]
-// this will be deprecated as we now get channel from device->id section
-static uint32_t parse_schema_channel(const char *schema_name)
+static void record_stage(histogram_t *hist, const struct timespec *from, const struct timespec *to)
 {
-    if (!schema_name) {
-        return 0;
+    if (hist) {
+        histogram_record(hist, SPEC2MS(*to) - SPEC2MS(*from));
     }
+}
 
-    char *offset_str = strchr(schema_name, ':');
+static void record_telemetry_trace(const telemetry_trace_t *trace)
+{
+    struct timespec ts_delivered;
+    clock_gettime(CLOCK_MONOTONIC, &ts_delivered);
+
+    record_stage(s_wire_hist, &trace->ts_poll, &trace->ts_response);
+    record_stage(s_decode_hist, &trace->ts_response, &trace->ts_decoded);
+    record_stage(s_queue_hist, &trace->ts_decoded, &trace->ts_queued);
+    record_stage(s_deliver_hist, &trace->ts_queued, &ts_delivered);
+    record_stage(s_age_hist, &trace->ts_poll, &ts_delivered);
+}
 
-    if (offset_str && offset_str[1]) {
-        char *channel_str = strchr(offset_str + 1, ':');
+// context is trace of telemetry sent alone, NULL for a batch or replay
+static void telemetry_message_delivered(bool delivered, void *context)
+{
+    telemetry_trace_t *trace = (telemetry_trace_t *)context;
 
-        if (channel_str && channel_str[1]) {
-            return strtol(channel_str + 1, NULL, 10);
+    if (delivered) {
+        LOGI("Telemetry delivered");
+        if (trace) {
+            record_telemetry_trace(trace);
         }
+    } else {
+        LOGW("Telemetry delivery failed");
+        diag_log_event(EVENT_TELEMETRY_FAILED);
     }
-
-    return 0u;
+    FREE(trace);
 }
 
 
-static uint32_t parse_flag(const char *flag_str, int len)
+static void batch_telemetry_delivered(bool delivered, void *const *items, int32_t num_item)
 {
-    if (!flag_str || len <= 0) {
-        return FLAG_NONE;
-    }
-
-    if ((strlen(FLAG_NO_BATCH_STR) == len) && (strncasecmp(flag_str, FLAG_NO_BATCH_STR, len) == 0)) {
-        return FLAG_NO_BATCH;
+    // no item if adapter been reprovisioned since batch was sent, devices are gone
+    if (num_item == 0) {
+        telemetry_message_delivered(delivered, NULL);
+        return;
     }
 
-    if ((strlen(FLAG_CE_TIMESTAMP_STR) == len) && (strncasecmp(flag_str, FLAG_CE_TIMESTAMP_STR, len) == 0)) {
-        return FLAG_CE_TIMESTAMP;
+    for (int32_t i = 0; i < num_item; i++) {
+        const ce_device_t *device = (const ce_device_t *)items[i];
+        if (delivered) {
+            LOGI("[%s] Telemetry delivered", device->name);
+            record_telemetry_trace(&device->batch_trace);
+        } else {
+            LOGW("[%s] Telemetry delivery failed", device->name);
+            diag_log_event(EVENT_TELEMETRY_FAILED);
+        }
     }
+}
 
-    if ((strlen(FLAG_COV_STR) == len) && (strncasecmp(flag_str, FLAG_COV_STR, len) == 0)) {
-        return FLAG_COV;
-    }
 
-    return 0u;
+// trace as message properties, poll start in epoch ms and ms each stage took
+static void set_trace_properties(const telemetry_trace_t *trace, message_property_t *properties, char bufs[][24])
+{
+    struct timespec ts_age;
+    clock_gettime(CLOCK_MONOTONIC, &ts_age);
+    timespec_subtract(&ts_age, &trace->ts_poll);
+    struct timespec ts_poll = now();
+    timespec_subtract(&ts_poll, &ts_age);
+
+    snprintf(bufs[0], sizeof(bufs[0]), "%lld", (long long)SPEC2MS(ts_poll));
+    snprintf(bufs[1], sizeof(bufs[1]), "%lld", (long long)(SPEC2MS(trace->ts_response) - SPEC2MS(trace->ts_poll)));
+    snprintf(bufs[2], sizeof(bufs[2]), "%lld", (long long)(SPEC2MS(trace->ts_decoded) - SPEC2MS(trace->ts_response)));
+    snprintf(bufs[3], sizeof(bufs[3]), "%lld", (long long)(SPEC2MS(trace->ts_queued) - SPEC2MS(trace->ts_decoded)));
+
+    properties[0] = (message_property_t){"trace_poll", bufs[0]};
+    properties[1] = (message_property_t){"trace_wire_ms", bufs[1]};
+    properties[2] = (message_property_t){"trace_decode_ms", bufs[2]};
+    properties[3] = (message_property_t){"trace_queue_ms", bufs[3]};
+    properties[4] = (message_property_t){NULL, NULL};
 }
 
-static void destroy_device_telemetry(telemetry_t *telemetry)
+// windows is mask of groups whose aggregation window closed, to send their
+// statistics, 0 to send values of points not aggregated
+static void send_telemetry_message(ce_device_t *device, bool force, uint32_t windows, const telemetry_trace_t *trace)
 {
-    if (!telemetry) {
+    ASSERT(device);
+
+    LOGI("[%s] Send %s to iothub, status=%s", device->name, windows ? "window" : "telemetry", err_str(device->err));
+
+    const char *message_type = IOT_MESSAGE_TYPE_TELEMETRY;
+    bool binary = s_adapter.encoding == TELEMETRY_ENCODING_CBOR;
+    size_t size = binary ? build_telemetry_cbor(device, force, windows)
+                         : strlen(build_telemetry_message(device, force, windows));
+    int err = 0;
+
+    // keep for replay instead of losing it while iot hub is not reachable
+    if (!iot_is_connected()) {
+        if (telemetry_store_put(device->message_buf, size, binary) != 0) {
+            diag_log_event(EVENT_TELEMETRY_FAILED);
+        }
         return;
     }
 
-    // free string value
-    for (int i = 0; i < telemetry->num_values; i++) {
-        if (IS_STR_VALUE(telemetry, i)) {
-             FREE(telemetry->values[i].str);
-        }
+    telemetry_trace_t *queued = (telemetry_trace_t *)MALLOC(sizeof(telemetry_trace_t));
+    *queued = *trace;
+    clock_gettime(CLOCK_MONOTONIC, &queued->ts_queued);
+
+    // fall through to send alone if message doesn't fit in a batch
+    if (telemetry_batch_enabled() && telemetry_batch_add(device->message_buf, size, device) == 0) {
+        device->batch_trace = *queued;
+        FREE(queued);
+        return;
     }
-    FREE(telemetry->values);
-    FREE(telemetry->cov_mask);
-    FREE(telemetry->str_mask);
-    FREE(telemetry);
-}
 
-static telemetry_t* create_empty_device_telemetry(int num_values)
-{
-    telemetry_t *telemetry = CALLOC(1, sizeof(telemetry_t));
-    telemetry->cov_mask = CALLOC(1, (num_values + 7) / 8);
-    telemetry->str_mask = CALLOC(1, (num_values + 7) / 8);
-    telemetry->values = CALLOC(num_values, sizeof(telemetry_value_t));
+    message_property_t properties[5];
+    char bufs[4][24];
+    if (s_adapter.trace) {
+        set_trace_properties(queued, properties, bufs);
+    }
+
+    err = iot_send_binary_message_async((const uint8_t *)device->message_buf, size, message_type,
+                                        binary ? IOT_MESSAGE_CONTENT_TYPE_CBOR : IOT_MESSAGE_CONTENT_TYPE,
+                                        binary ? NULL : IOT_MESSAGE_CONTENT_ENCODING,
+                                        s_adapter.trace ? properties : NULL, telemetry_message_delivered, queued);
+
+    if (err != 0) {
+        FREE(queued);
+        LOGW("Failed to send telemetry message");
+        diag_log_event(EVENT_TELEMETRY_FAILED);
+        telemetry_store_put(device->message_buf, size, binary);
+    }
+}
+
+static bool is_priority_changed(const ce_device_t *device, int i)
+{
+    if (!device->schema->points[i].priority || !IS_NUM_VALUE(device->telemetry, i)) {
+        return false;
+    }
+
+    double cur = device->telemetry->nums[i];
+    double last = device->priority_values[i];
+    return !isnan(cur) && !isnan(last) && cur != last;
+}
+
+static int printf_priority_points(struct json_out *out, va_list *ap)
+{
+    ce_device_t *device = va_arg(*ap, struct ce_device_t *);
+
+    int len = json_printf(out, "[");
+    const char *sep = "";
+
+    for (int i = 0; i < device->schema->num_point; i++) {
+        if (is_priority_changed(device, i)) {
+            len += json_printf(out, "%s[%Q,%Q]", sep, device->schema->points[i].key,
+                               double_to_str(device->telemetry->nums[i]));
+            sep = ",";
+        }
+    }
+
+    len += json_printf(out, "]");
+    return len;
+}
+
+// acquisition time of alarm, measure how long it took to reach iot hub
+typedef struct alarm_context_t alarm_context_t;
+struct alarm_context_t {
+    struct timespec ts_acquired;
+};
+
+static void alarm_message_delivered(bool delivered, void *context)
+{
+    alarm_context_t *alarm = (alarm_context_t *)context;
+
+    if (delivered) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        int64_t latency_ms = SPEC2MS(ts) - SPEC2MS(alarm->ts_acquired);
+        LOGI("Alarm delivered in %lld ms", latency_ms);
+        if (s_alarm_hist) {
+            histogram_record(s_alarm_hist, latency_ms);
+        }
+    } else {
+        LOGW("Alarm delivery failed");
+        diag_log_event(EVENT_TELEMETRY_FAILED);
+    }
+    FREE(alarm);
+}
+
+// changes of priority points go out at once in a message of their own, ahead
+// of batching, aggregation and telemetry quota, full telemetry still follows
+static void send_priority_changes(ce_device_t *device, const struct timespec *ts_acquired)
+{
+    if (!device->schema->num_priority || !device->telemetry) {
+        return;
+    }
+
+    int32_t num_point = device->schema->num_point;
+    if (!device->priority_values) {
+        device->priority_values = (double *)MALLOC(num_point * sizeof(double));
+        for (int32_t i = 0; i < num_point; i++) {
+            device->priority_values[i] = NAN;
+        }
+    }
+
+    int32_t num_changed = 0;
+    for (int32_t i = 0; i < num_point && i < device->telemetry->num_values; i++) {
+        if (is_priority_changed(device, i)) {
+            num_changed++;
+        }
+    }
+
+    if (num_changed) {
+        // timestamp is when value was read, not when it is sent
+        struct timespec ts_age;
+        clock_gettime(CLOCK_MONOTONIC, &ts_age);
+        timespec_subtract(&ts_age, ts_acquired);
+        struct timespec ts = now();
+        timespec_subtract(&ts, &ts_age);
+
+        char *message = json_asprintf("{timestamp:%Q,name:%Q,location:%Q,point:%M}", timespec2str(ts),
+                                      device->name, device->location, printf_priority_points, device);
+
+        LOGI("[%s] Send %d priority changes to iothub", device->name, num_changed);
+
+        alarm_context_t *alarm = (alarm_context_t *)MALLOC(sizeof(alarm_context_t));
+        alarm->ts_acquired = *ts_acquired;
+
+        if (iot_send_priority_message_async(message, IOT_MESSAGE_TYPE_ALARM, alarm_message_delivered, alarm) != 0) {
+            LOGW("[%s] Failed to send priority message", device->name);
+            FREE(alarm);
+            if (telemetry_store_put(message, strlen(message), false) != 0) {
+                diag_log_event(EVENT_TELEMETRY_FAILED);
+            }
+        }
+        FREE(message);
+    }
+
+    for (int32_t i = 0; i < num_point && i < device->telemetry->num_values; i++) {
+        if (device->schema->points[i].priority && IS_NUM_VALUE(device->telemetry, i)) {
+            device->priority_values[i] = device->telemetry->nums[i];
+        }
+    }
+}
+
+// schema name format: <name>[:<offset>][:<channel>]
+static data_schema_t *parse_schema(data_schema_t *schemas, const char *schema_name)
+{
+    char *colon = strchr(schema_name, ':');
+    size_t len = 0;
+
+    if (colon) {
+        len = colon - schema_name;
+    } else {
+        len = strlen(schema_name);
+    }
+
+    for (data_schema_t *schema = schemas; schema; schema = schema->next) {
+
+        if ((len == strlen(schema->name)) && strncmp(schema->name, schema_name, len) == 0) {
+            return schema;
+        }
+    }
+
+    return NULL;
+}
+
+
+// schema name format: <name>[:<offset>][:<channel>]
+static int32_t parse_schema_offset(const char *schema_name)
+{
+    if (!schema_name) {
+        return 0;
+    }
+
+    char *offset_str = strchr(schema_name, ':');
+
+    if (offset_str && offset_str[1]) {
+        return strtol(offset_str + 1, NULL, 10);
+    }
+
+    return 0;
+}
+
+// schema name format: <name>[:<offset>][:<channel>]
+// this will be deprecated as we now get channel from device->id section
+static uint32_t parse_schema_channel(const char *schema_name)
+{
+    if (!schema_name) {
+        return 0;
+    }
+
+    char *offset_str = strchr(schema_name, ':');
+
+    if (offset_str && offset_str[1]) {
+        char *channel_str = strchr(offset_str + 1, ':');
+
+        if (channel_str && channel_str[1]) {
+            return strtol(channel_str + 1, NULL, 10);
+        }
+    }
+
+    return 0u;
+}
+
+
+static uint32_t parse_flag(const char *flag_str, int len)
+{
+    if (!flag_str || len <= 0) {
+        return FLAG_NONE;
+    }
+
+    if ((strlen(FLAG_NO_BATCH_STR) == len) && (strncasecmp(flag_str, FLAG_NO_BATCH_STR, len) == 0)) {
+        return FLAG_NO_BATCH;
+    }
+
+    if ((strlen(FLAG_CE_TIMESTAMP_STR) == len) && (strncasecmp(flag_str, FLAG_CE_TIMESTAMP_STR, len) == 0)) {
+        return FLAG_CE_TIMESTAMP;
+    }
+
+    if ((strlen(FLAG_COV_STR) == len) && (strncasecmp(flag_str, FLAG_COV_STR, len) == 0)) {
+        return FLAG_COV;
+    }
+
+    if ((strlen(FLAG_VERIFY_WRITE_STR) == len) && (strncasecmp(flag_str, FLAG_VERIFY_WRITE_STR, len) == 0)) {
+        return FLAG_VERIFY_WRITE;
+    }
+
+    // pushed changes are reported as COV
+    if ((strlen(FLAG_SUBSCRIBE_STR) == len) && (strncasecmp(flag_str, FLAG_SUBSCRIBE_STR, len) == 0)) {
+        return FLAG_SUBSCRIBE | FLAG_COV;
+    }
+
+    return 0u;
+}
+
+static void destroy_device_telemetry(telemetry_t *telemetry)
+{
+    if (!telemetry) {
+        return;
+    }
+
+    destroy_telemetry_strings(telemetry);
+    FREE(telemetry->window);
+    FREE(telemetry->nums);
+    FREE(telemetry->reported);
+    FREE(telemetry->cov_mask);
+    FREE(telemetry->str_mask);
+    FREE(telemetry);
+}
+
+// telemetry of a "cov" schema also keeps last reported values for deadband
+static telemetry_t* create_empty_device_telemetry(int num_values, bool cov)
+{
+    telemetry_t *telemetry = CALLOC(1, sizeof(telemetry_t));
+    telemetry->cov_mask = CALLOC(1, (num_values + 7) / 8);
+    telemetry->str_mask = CALLOC(1, (num_values + 7) / 8);
+    telemetry->nums = MALLOC(MAX(num_values, 1) * sizeof(double));
+    telemetry->reported = cov ? MALLOC(MAX(num_values, 1) * sizeof(double)) : NULL;
     telemetry->num_values = num_values;
     for (int i=0; i<num_values; i++) {
-        telemetry->values[i].num = NAN;
+        telemetry->nums[i] = NAN;
+        if (telemetry->reported) {
+            telemetry->reported[i] = NAN;
+        }
     }
     return telemetry;
 }
 
 
-static void destroy_schema(data_schema_t *schema)
-{
-    ASSERT(schema);
+// schema itself lives in provision arena, only release what driver created
+static void destroy_schema(data_schema_t *schema)
+{
+    ASSERT(schema);
+
+    destroy_point_index(schema);
+    destroy_schema_plans(schema);
+    if (schema->points) {
+        // keys of computed points are one block, starting at first of them
+        if (schema->num_point > schema->num_read_point) {
+            FREE(schema->points[schema->num_read_point].key);
+        }
+        destroy_point_table(schema->protocol, schema->points, schema->num_read_point);
+        schema->points = NULL;
+    }
+    expr_program_destroy(schema->computed);
+    schema->computed = NULL;
+}
+
+
+// device itself lives in provision arena, only release buffers grown at runtime
+static void destroy_device(ce_device_t *device)
+{
+    ASSERT(device);
+
+    destroy_device_telemetry(device->telemetry);
+    device->telemetry = NULL;
+    destroy_device_telemetry(device->pending);
+    device->pending = NULL;
+    FREE(device->message_buf);
+    FREE(device->priority_values);
+}
+
+
+// runs on worker thread after a successful poll. Subscription is renewed on
+// every poll while device accept it, as it is then only polled for integrity,
+// otherwise it is retried once an integrity period and device keep being polled
+static void subscribe_device(ce_device_t *device, data_schema_t *schema)
+{
+    device_driver_t *driver = device->downlink->driver;
+
+    struct timespec ts_now;
+    clock_gettime(CLOCK_MONOTONIC, &ts_now);
+    int64_t ms_last = SPEC2MS(device->ts_subscribe);
+    if (!device->subscribed && ms_last && SPEC2MS(ts_now) - ms_last < schema->integrity_period_ms) {
+        return;
+    }
+    device->ts_subscribe = ts_now;
+
+    // outlive one missed integrity poll
+    int32_t lifetime_s = schema->integrity_period_ms / 1000 * 2 + device->timeout / 1000 + 1;
+    err_code err = driver->subscribe(driver, device->id, device->subscriber, schema, lifetime_s, device->timeout);
+    if (err && device->subscribed) {
+        LOGW("[%s] Change subscription lost, poll every %d ms", device->name, device->interval);
+    } else if (!err && !device->subscribed) {
+        LOGI("[%s] Change subscribed, poll every %d ms", device->name, schema->integrity_period_ms);
+    }
+    device->subscribed = (err == DEVICE_OK);
+}
+
+
+static err_code open_downlink(ce_device_t *device)
+{
+    downlink_t *downlink = device->downlink;
+
+    if (!downlink->opened) {
+        LOGI("Open device driver");
+        if (downlink->driver->driver_open(downlink->driver, device->id, device->timeout) != DEVICE_OK) {
+            LOGE("Failed to open driver");
+            return DEVICE_E_INVALID;
+        }
+        downlink->opened = true;
+    }
+    return DEVICE_OK;
+}
+
+
+// read first point of a device with open breaker to tell if it's back, into
+// scratch telemetry so nothing is reported. Runs on worker thread as
+// query_device() does
+static err_code probe_device(ce_device_t *device)
+{
+    ASSERT(device);
+    ASSERT(device->schema);
+    ASSERT(device->downlink);
+
+    data_schema_t schema = *device->schema;
+    schema.offset = device->schema_offset;
+    // a cached value doesn't tell device answers
+    schema.max_age_ms = 0;
+
+    if (schema.num_read_point == 0) {
+        return DEVICE_OK;
+    }
+
+    if (open_downlink(device) != DEVICE_OK) {
+        return DEVICE_E_INVALID;
+    }
+
+    telemetry_t *scratch = create_empty_device_telemetry(schema.num_point, false);
+    device_driver_t *driver = device->downlink->driver;
+    err_code err = driver->get_point(driver, device->id, schema.points[0].key, &schema, scratch, device->timeout);
+    destroy_device_telemetry(scratch);
+
+    LOGI("[%s] Probe %s", device->name, err ? err_str(err) : "answered");
+    return err;
+}
+
+
+// runs on worker thread without adapter lock, device is owned by the worker
+// until result is posted back to main thread
+static err_code query_device(ce_device_t *device, int32_t *poll_duration)
+{
+    ASSERT(device);
+    ASSERT(device->schema);
+    ASSERT(device->downlink);
+
+    downlink_t *downlink = device->downlink;
+    struct timespec poll_sw;
+    timer_stopwatch_start(&poll_sw);
+    telemetry_trace_t trace = {.ts_poll = poll_sw};
+
+    // since we reuse schema for multiple devices which may be polled at the
+    // same time, query with a copy carrying offset of current device
+    data_schema_t schema = *device->schema;
+    schema.offset = device->schema_offset;
+
+    if (!device->telemetry) {
+        device->telemetry = create_empty_device_telemetry(schema.num_point, schema.flags & FLAG_COV);
+    }
+    if (schema.window_groups && !device->telemetry->window) {
+        device->telemetry->window = (telemetry_window_t *)CALLOC(schema.num_point, sizeof(telemetry_window_t));
+    }
+    device->telemetry->ts_response = (struct timespec){0, 0};
+
+    if (open_downlink(device) != DEVICE_OK) {
+        return DEVICE_E_INVALID;
+    }
+
+    // read only groups due, with plan merged for them
+    if (device->poll_groups && schema.group_plans[device->poll_groups]) {
+        schema.read_plan = schema.group_plans[device->poll_groups];
+    }
+
+    err_code err = downlink->driver->get_point_list(downlink->driver, device->id, &schema, device->telemetry, device->timeout);
+    schema.read_plan = device->schema->read_plan;
+
+    if (err) {
+        LOGE("[%s] Read points failed: %s", device->name, err_str(err));
+        return err;
+    }
+    update_computed_points(&schema, device->telemetry, false);
+    *poll_duration = timer_stopwatch_stop(&poll_sw);
+    if (s_poll_hist) {
+        histogram_record(s_poll_hist, *poll_duration);
+    }
+
+    // driver not telling when response arrived is counted as decoded then
+    clock_gettime(CLOCK_MONOTONIC, &trace.ts_decoded);
+    trace.ts_response = SPEC2MS(device->telemetry->ts_response) ? device->telemetry->ts_response : trace.ts_decoded;
+    device->trace = trace;
+    LOGI("[%s] Read points in %d ms", device->name, *poll_duration);
+
+    if ((schema.flags & FLAG_SUBSCRIBE) && downlink->notify_io) {
+        subscribe_device(device, &schema);
+    }
+    return DEVICE_OK;
+}
+
+
+// changes are reported once, clear them after telemetry is sent
+static void clear_telemetry_cov(telemetry_t *telemetry)
+{
+    memset(telemetry->cov_mask, 0, (telemetry->num_values + 7) / 8);
+}
+
+
+// runs on event loop thread with adapter lock, context is driver notified
+static void apply_point_notification(void *context, uint32_t subscriber, int32_t index, double value)
+{
+    for (ce_device_t *device = s_adapter.devices; device; device = device->next) {
+        if (device->downlink->driver != context || device->subscriber != subscriber) {
+            continue;
+        }
+
+        if (index < 0 || index >= device->schema->num_read_point) {
+            return;
+        }
+
+        // worker own telemetry while device is queued or polled, keep latest
+        // value and merge it when poll is done
+        if (device->busy) {
+            if (!device->pending) {
+                device->pending = create_empty_device_telemetry(device->schema->num_point, false);
+            }
+            device->pending->nums[index] = value;
+            set_mask(device->pending->cov_mask, index);
+            return;
+        }
+
+        if (!device->telemetry) {
+            device->telemetry = create_empty_device_telemetry(device->schema->num_point,
+                                                              device->schema->flags & FLAG_COV);
+        }
+        set_telemetry_number_value(device->telemetry, index, value, &device->schema->points[index]);
+        if (IS_COV(device->telemetry, index)) {
+            device->notified = true;
+        }
+        // computed points depending on it change along, not waiting for a poll
+        if (update_computed_points(device->schema, device->telemetry, true)) {
+            device->notified = true;
+        }
+        return;
+    }
+}
+
+
+// changes pushed by device are sent right away instead of waiting for a poll
+static void handle_downlink_notification(EventLoop *eloop, int fd, EventLoop_IoEvents events, void *context)
+{
+    device_driver_t *driver = (device_driver_t *)context;
+
+    pthread_mutex_lock(&s_adapter.mutex);
+    driver->read_notification(driver, apply_point_notification, driver);
+
+    for (ce_device_t *device = s_adapter.devices; device; device = device->next) {
+        if (device->notified) {
+            device->notified = false;
+            struct timespec ts_notified;
+            clock_gettime(CLOCK_MONOTONIC, &ts_notified);
+            // value pushed by device is on the wire and decoded when notified
+            telemetry_trace_t trace = {ts_notified, ts_notified, ts_notified, {0, 0}};
+            send_priority_changes(device, &ts_notified);
+            send_telemetry_message(device, false, 0, &trace);
+            clear_telemetry_cov(device->telemetry);
+        }
+    }
+    pthread_mutex_unlock(&s_adapter.mutex);
+}
+
+
+// driver is context of notification rather than downlink, so registration
+// can move with driver when downlink is taken over by a new provision
+static void register_downlink_notification(downlink_t *downlink)
+{
+    device_driver_t *driver = downlink->driver;
+    if (!driver->subscribe || !driver->get_notify_fd || !driver->read_notification) {
+        return;
+    }
+
+    int fd = driver->get_notify_fd(driver);
+    if (fd < 0) {
+        return;
+    }
+
+    downlink->notify_io =
+        EventLoop_RegisterIo(s_adapter.eloop, fd, EventLoop_Input, handle_downlink_notification, driver);
+    if (!downlink->notify_io) {
+        LOGW("Failed to register notification of downlink, devices will be polled");
+    }
+}
+
+
+static void destroy_bus_write(bus_write_t *write)
+{
+    FREE(write->key);
+    FREE(write->value);
+    FREE(write);
+}
+
+
+// drop broadcast writes not sent yet
+static void clear_bus_writes(downlink_t *downlink)
+{
+    while (downlink->write_head) {
+        bus_write_t *write = downlink->write_head;
+        downlink->write_head = write->next;
+        destroy_bus_write(write);
+    }
+    downlink->write_tail = NULL;
+}
+
+
+static void destroy_downlink(downlink_t *downlink)
+{
+    ASSERT(downlink);
+
+    clear_bus_writes(downlink);
+
+    if (downlink->notify_io) {
+        EventLoop_UnregisterIo(s_adapter.eloop, downlink->notify_io);
+        downlink->notify_io = NULL;
+    }
+
+    if (downlink->driver) {
+        if (downlink->opened) {
+            downlink->driver->driver_close(downlink->driver);
+        }
+        destroy_driver(downlink->driver);
+        downlink->driver = NULL;
+    }
+}
+
+
+// release schemas, devices and downlinks of a provision
+static void release_provision(adapter_t *adapter)
+{
+    for (ce_device_t *device = adapter->devices; device; device = device->next) {
+        destroy_device(device);
+    }
+
+    for (data_schema_t *schema = adapter->schemas; schema; schema = schema->next) {
+        destroy_schema(schema);
+    }
+
+    for (downlink_t *downlink = adapter->downlinks; downlink; downlink = downlink->next) {
+        destroy_downlink(downlink);
+    }
+
+    // everything else of the provision goes with its arena
+    arena_destroy(adapter->arena);
+    adapter->arena = NULL;
+    adapter->name = NULL;
+    adapter->location = NULL;
+    adapter->source_id = NULL;
+    memset(&adapter->uplink, 0, sizeof(adapter->uplink));
+    memset(&adapter->downlink, 0, sizeof(adapter->downlink));
+    adapter->devices = NULL;
+    adapter->schemas = NULL;
+    adapter->downlinks = NULL;
+    adapter->num_device = 0;
+    adapter->num_schema = 0;
+}
+
+
+// hand objects of a provision over to another adapter record, src is left empty
+static void move_provision(adapter_t *dst, adapter_t *src)
+{
+    dst->arena = src->arena;
+    dst->name = src->name;
+    dst->location = src->location;
+    dst->source_id = src->source_id;
+    dst->uplink = src->uplink;
+    dst->downlink = src->downlink;
+    dst->devices = src->devices;
+    dst->schemas = src->schemas;
+    dst->downlinks = src->downlinks;
+    dst->num_device = src->num_device;
+    dst->num_schema = src->num_schema;
+
+    src->arena = NULL;
+    src->name = NULL;
+    src->location = NULL;
+    src->source_id = NULL;
+    memset(&src->uplink, 0, sizeof(src->uplink));
+    memset(&src->downlink, 0, sizeof(src->downlink));
+    src->devices = NULL;
+    src->schemas = NULL;
+    src->downlinks = NULL;
+    src->num_device = 0;
+    src->num_schema = 0;
+}
+
+
+static void reset_adapter(adapter_t *adapter)
+{
+    ASSERT(adapter);
+
+    // batched telemetry refer to devices to be destroyed
+    telemetry_batch_reset();
+    telemetry_batch_config(false, 0, 0);
+    adapter->batch_size = 0;
+    adapter->batch_latency_ms = 0;
+
+    release_provision(adapter);
+
+    adapter->provision_epoch = 0;
+    adapter->provision_hash = 0;
+    adapter->encoding = TELEMETRY_ENCODING_JSON;
+    adapter->trace = false;
+    adapter->gateway_port = 0;
+    adapter->gateway_max_age_ms = 0;
+    adapter->last_served = NULL;
+    FREE(adapter->sched_heap);
+    adapter->sched_heap = NULL;
+    adapter->sched_size = 0;
+    adapter->sched_seq = 0;
+    adapter->driver_state = DRIVER_STATE_INIT;
+}
+
+
+// copy JSON string into provision arena, NULL if value is missing or not a string
+static char *arena_json_string(arena_t *arena, const struct json_token *t)
+{
+    if (t->type != JSON_TYPE_STRING) {
+        return NULL;
+    }
+
+    int len = json_unescape(t->ptr, t->len, NULL, 0);
+    if (len < 0) {
+        return NULL;
+    }
+
+    char *s = (char *)arena_alloc(arena, len + 1);
+    if (json_unescape(t->ptr, t->len, s, len) != len) {
+        return NULL;
+    }
+    s[len] = '\0';
+    return s;
+}
+
+// FNV-1a, wide enough that an edited definition never looks unchanged
+static uint64_t definition_hash(const char *str, int len)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)str[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+
+// record with every token missing and values 0
+static void init_record(prov_record_t *rec)
+{
+    memset(rec, 0, sizeof(*rec));
+    for (int i = 0; i < PROV_RECORD_MAX_TOKEN; i++) {
+        rec->tokens[i].type = JSON_TYPE_INVALID;
+    }
+}
+
+static void image_put(prov_image_t *image, const void *data, size_t len)
+{
+    if (image->failed || len == 0) {
+        return;
+    }
+
+    if (image->len + len > image->size) {
+        size_t size = image->size ? image->size : PROV_IMAGE_CHUNK;
+        while (size < image->len + len) {
+            size *= 2;
+        }
+        uint8_t *buf = (uint8_t *)REALLOC(image->buf, size);
+        if (!buf) {
+            image->failed = true;
+            return;
+        }
+        image->buf = buf;
+        image->size = size;
+    }
+
+    memcpy(image->buf + image->len, data, len);
+    image->len += len;
+}
+
+// append record with its first ntoken tokens and nvalue values, a token is
+// stored as type, length and text as it is in JSON
+static void image_put_record(prov_image_t *image, uint8_t kind, const prov_record_t *rec, uint8_t ntoken,
+                             uint8_t nvalue)
+{
+    uint8_t head[3] = {kind, ntoken, nvalue};
+    image_put(image, head, sizeof(head));
+    image_put(image, &rec->def_hash, sizeof(rec->def_hash));
+    image_put(image, rec->values, nvalue * sizeof(rec->values[0]));
+
+    for (int i = 0; i < ntoken; i++) {
+        const struct json_token *t = &rec->tokens[i];
+        uint8_t type = t->ptr ? t->type : JSON_TYPE_INVALID;
+        uint32_t len = t->ptr ? t->len : 0;
+        image_put(image, &type, sizeof(type));
+        image_put(image, &len, sizeof(len));
+        image_put(image, t->ptr, len);
+    }
+}
+
+static bool image_get(prov_image_reader_t *reader, void *data, size_t len)
+{
+    if ((size_t)(reader->end - reader->pos) < len) {
+        return false;
+    }
+    memcpy(data, reader->pos, len);
+    reader->pos += len;
+    return true;
+}
+
+// read next record, its tokens point into image. False at end of image or if
+// record is truncated
+static bool image_get_record(prov_image_reader_t *reader, uint8_t *kind, prov_record_t *rec)
+{
+    uint8_t head[3];
+    init_record(rec);
+
+    if (!image_get(reader, head, sizeof(head)) || head[1] > PROV_RECORD_MAX_TOKEN ||
+        head[2] > PROV_RECORD_MAX_VALUE || !image_get(reader, &rec->def_hash, sizeof(rec->def_hash)) ||
+        !image_get(reader, rec->values, head[2] * sizeof(rec->values[0]))) {
+        return false;
+    }
+
+    for (int i = 0; i < head[1]; i++) {
+        uint8_t type;
+        uint32_t len;
+        if (!image_get(reader, &type, sizeof(type)) || !image_get(reader, &len, sizeof(len)) ||
+            (size_t)(reader->end - reader->pos) < len) {
+            return false;
+        }
+
+        if (type != JSON_TYPE_INVALID) {
+            rec->tokens[i].ptr = (const char *)reader->pos;
+            rec->tokens[i].len = len;
+            rec->tokens[i].type = (enum json_token_type)type;
+        }
+        reader->pos += len;
+    }
+
+    *kind = head[0];
+    return true;
+}
+
+
+// take over point table, index and read plan of an unchanged schema from
+// previous provision, return false if there is none
+static bool take_retired_schema(adapter_t *adapter, data_schema_t *schema)
+{
+    if (!adapter->prev) {
+        return false;
+    }
+
+    for (data_schema_t *old = adapter->prev->schemas; old; old = old->next) {
+        if (old->def_hash != schema->def_hash || !old->points || strcmp(old->name, schema->name) != 0) {
+            continue;
+        }
+
+        schema->points = old->points;
+        schema->num_point = old->num_point;
+        schema->num_read_point = old->num_read_point;
+        schema->computed = old->computed;
+        schema->read_plan = old->read_plan;
+        memcpy(schema->group_plans, old->group_plans, sizeof(schema->group_plans));
+        schema->key_index = old->key_index;
+        schema->key_index_mask = old->key_index_mask;
+        schema->key_hash = old->key_hash;
+
+        old->points = NULL;
+        old->num_point = 0;
+        old->num_read_point = 0;
+        old->computed = NULL;
+        old->read_plan = NULL;
+        memset(old->group_plans, 0, sizeof(old->group_plans));
+        old->key_index = NULL;
+        old->key_index_mask = 0;
+        return true;
+    }
+    return false;
+}
+
+
+// take over live driver of same link from previous provision
+static device_driver_t *take_retired_driver(adapter_t *adapter, device_protocol_t protocol, const char *conn_str,
+                                            bool *opened, EventRegistration **notify_io)
+{
+    if (!adapter->prev) {
+        return NULL;
+    }
+
+    for (downlink_t *old = adapter->prev->downlinks; old; old = old->next) {
+        if (old->driver && old->protocol == protocol && strcmp(old->conn_str, conn_str) == 0) {
+            device_driver_t *driver = old->driver;
+            *opened = old->opened;
+            *notify_io = old->notify_io;
+            old->driver = NULL;
+            old->opened = false;
+            old->notify_io = NULL;
+            return driver;
+        }
+    }
+    return NULL;
+}
+
+
+// carry telemetry, COV and schedule state of an unchanged device over from
+// previous provision, return false if device is new or changed
+static bool take_retired_device(adapter_t *adapter, ce_device_t *device)
+{
+    if (!adapter->prev) {
+        return false;
+    }
+
+    for (ce_device_t *old = adapter->prev->devices; old; old = old->next) {
+        if (old->def_hash != device->def_hash || strcmp(old->name, device->name) != 0) {
+            continue;
+        }
+
+        if (old->schema->def_hash != device->schema->def_hash || !old->location || !device->location ||
+            strcmp(old->location, device->location) != 0 || strcmp(old->downlink->conn_str, device->downlink->conn_str) != 0) {
+            return false;
+        }
+
+        device->telemetry = old->telemetry;
+        device->message_buf = old->message_buf;
+        device->message_buf_size = old->message_buf_size;
+        device->ts_schedule = old->ts_schedule;
+        memcpy(device->ts_group, old->ts_group, sizeof(device->ts_group));
+        memcpy(device->cur_interval, old->cur_interval, sizeof(device->cur_interval));
+        memcpy(device->window_index, old->window_index, sizeof(device->window_index));
+        device->failures = old->failures;
+        device->breaker = old->breaker;
+        device->backoff_ms = old->backoff_ms;
+        device->last_flush_ts = old->last_flush_ts;
+        device->poll_duration = old->poll_duration;
+        device->err = old->err;
+        device->late_ms = old->late_ms;
+        device->max_late_ms = old->max_late_ms;
+
+        old->telemetry = NULL;
+        old->message_buf = NULL;
+        device->priority_values = old->priority_values;
+        old->priority_values = NULL;
+        old->message_buf_size = 0;
+        return true;
+    }
+    return false;
+}
+
+
+static void scan_link(arena_t *arena, link_t *link, const char *str, int len)
+{
+    struct json_token t_name = {.ptr=NULL, .len=0, .type=JSON_TYPE_INVALID};
+    struct json_token t_data = {.ptr=NULL, .len=0, .type=JSON_TYPE_INVALID};
+
+    json_scanf(str, len, "{interface:%T, data:%T}", &t_name, &t_data);
+    link->if_name = arena_json_string(arena, &t_name);
+    link->if_data = arena_json_string(arena, &t_data);
+}
+
+static void scan_uplink(const char *str, int len, void *user_data)
+{
+    adapter_t *adapter = (adapter_t *)user_data;
+    scan_link(adapter->arena, &adapter->uplink, str, len);
+}
+
+static void scan_downlink(const char *str, int len, void *user_data)
+{
+    adapter_t *adapter = (adapter_t *)user_data;
+    scan_link(adapter->arena, &adapter->downlink, str, len);
+}
+
+static void scan_protocol(const char *str, int len, void *user_data)
+{
+    data_schema_t *schema = (data_schema_t*)user_data;
+    char *str_protocol = STRNDUP(str, len);
+    schema->protocol = str2protocol(str_protocol);
+    FREE(str_protocol);
+}
+
+
+static bool scan_flag(const struct json_token *t_flag, int index, void *user_data)
+{
+    data_schema_t *schema = (data_schema_t *)user_data;
+    schema->flags |= parse_flag(t_flag->ptr, t_flag->len);
+    return true;
+}
+
+static void scan_flags(const char *str, int len, void *user_data)
+{
+    json_array_walk(str, len, scan_flag, user_data);
+}
+
+
+typedef struct point_group_scan_t point_group_scan_t;
+struct point_group_scan_t {
+    data_schema_t *schema;
+    uint8_t group;
+    bool failed;
+};
+
+static bool scan_group_point(const struct json_token *t_key, int index, void *user_data)
+{
+    point_group_scan_t *scan = (point_group_scan_t *)user_data;
+    data_schema_t *schema = scan->schema;
+
+    char *key = STRNDUP(t_key->ptr, t_key->len);
+    int point = find_point_index(schema, key);
+    FREE(key);
+
+    if (point < 0 || schema->points[point].group != 0) {
+        LOGE("unknown or regrouped point %.*s", t_key->len, t_key->ptr);
+        scan->failed = true;
+        return false;
+    }
+
+    schema->points[point].group = scan->group;
+    return true;
+}
+
+static bool scan_point_group(const struct json_token *t, int index, void *user_data)
+{
+    point_group_scan_t *scan = (point_group_scan_t *)user_data;
+    data_schema_t *schema = scan->schema;
+
+    if (schema->num_group == SCHEMA_MAX_GROUPS) {
+        LOGE("more than %d point groups", SCHEMA_MAX_GROUPS - 1);
+        scan->failed = true;
+        return false;
+    }
+
+    int32_t interval = 0;
+    int32_t max_interval = 0;
+    // window of schema if group doesn't set one
+    int32_t window_ms = schema->group_window_ms[0];
+    struct json_token t_points = {.ptr=NULL, .len=0, .type=JSON_TYPE_INVALID};
+    json_scanf(t->ptr, t->len, "{interval:%d, maxInterval:%d, aggregate:%d, points:%T}", &interval, &max_interval,
+               &window_ms, &t_points);
+
+    if (interval <= 0 || !t_points.ptr || window_ms < 0) {
+        LOGE("invalid point group interval or points");
+        scan->failed = true;
+        return false;
+    }
+
+    scan->group = schema->num_group++;
+    schema->group_interval[scan->group] = interval;
+    schema->group_max_interval[scan->group] = max_interval;
+    schema->group_window_ms[scan->group] = window_ms;
+    json_array_walk(t_points.ptr, t_points.len, scan_group_point, scan);
+    return !scan->failed;
+}
+
+// assign points to poll groups, points not listed stay in group 0 which is
+// polled at device interval
+static bool scan_point_groups(data_schema_t *schema, const struct json_token *t_groups)
+{
+    point_group_scan_t scan = {.schema = schema, .group = 0, .failed = false};
+
+    schema->num_group = 1;
+    for (int32_t i = 0; i < schema->num_point; i++) {
+        schema->points[i].group = 0;
+    }
+
+    if (t_groups->ptr) {
+        json_array_walk(t_groups->ptr, t_groups->len, scan_point_group, &scan);
+    }
+
+    // points of groups with aggregation window are only reported per window
+    schema->window_groups = 0;
+    schema->num_reported = 0;
+    for (int32_t g = 0; g < schema->num_group; g++) {
+        if (schema->group_window_ms[g] > 0) {
+            schema->window_groups |= 1u << g;
+        }
+    }
+    for (int32_t i = 0; i < schema->num_point; i++) {
+        data_point_t *point = &schema->points[i];
+        point->aggregated = (schema->window_groups >> point->group) & 1;
+        if (!point->aggregated && !point->hidden) {
+            schema->num_reported++;
+        }
+    }
+    return !scan.failed;
+}
+
+
+static bool scan_priority_point(const struct json_token *t_key, int index, void *user_data)
+{
+    data_schema_t *schema = (data_schema_t *)user_data;
+
+    char *key = STRNDUP(t_key->ptr, t_key->len);
+    int point = find_point_index(schema, key);
+    FREE(key);
+
+    if (point < 0) {
+        LOGE("unknown priority point %.*s", t_key->len, t_key->ptr);
+        return false;
+    }
+
+    if (!schema->points[point].priority) {
+        schema->points[point].priority = true;
+        schema->num_priority++;
+    }
+    return true;
+}
+
+// mark alarm class points listed in schema priority array
+static bool scan_priority_points(data_schema_t *schema, const struct json_token *t_priority)
+{
+    schema->num_priority = 0;
+    for (int32_t i = 0; i < schema->num_point; i++) {
+        schema->points[i].priority = false;
+    }
+
+    if (!t_priority->ptr) {
+        return true;
+    }
+    return json_array_walk(t_priority->ptr, t_priority->len, scan_priority_point, schema) >= 0;
+}
+
+
+typedef struct computed_scan_t computed_scan_t;
+struct computed_scan_t {
+    data_schema_t *schema;
+    // keys block of computed points and where next key goes
+    char *keys;
+    char *next_key;
+    bool failed;
+};
+
+// an expression may use points read from device and computed points defined
+// before it, points added so far are exactly those
+static int32_t resolve_computed_input(const char *name, size_t len, void *context)
+{
+    const data_schema_t *schema = (const data_schema_t *)context;
+
+    for (int32_t i = 0; i < schema->num_point; i++) {
+        if (strncmp(schema->points[i].key, name, len) == 0 && schema->points[i].key[len] == '\0') {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool scan_computed_point(const struct json_token *t, int index, void *user_data)
+{
+    computed_scan_t *scan = (computed_scan_t *)user_data;
+    data_schema_t *schema = scan->schema;
+
+    struct json_token t_key = {.ptr=NULL, .len=0, .type=JSON_TYPE_INVALID};
+    struct json_token t_expr = {.ptr=NULL, .len=0, .type=JSON_TYPE_INVALID};
+    struct json_token t_deadband = {.ptr=NULL, .len=0, .type=JSON_TYPE_INVALID};
+    json_scanf(t->ptr, t->len, "{key:%T, expr:%T, deadband:%T}", &t_key, &t_expr, &t_deadband);
+
+    if (t_key.type != JSON_TYPE_STRING || t_key.len == 0 || t_expr.type != JSON_TYPE_STRING ||
+        resolve_computed_input(t_key.ptr, t_key.len, schema) >= 0) {
+        LOGE("invalid or duplicated computed point %.*s", t_key.len, t_key.ptr);
+        scan->failed = true;
+        return false;
+    }
+
+    data_point_t *points = (data_point_t *)REALLOC(schema->points, (schema->num_point + 1) * sizeof(data_point_t));
+    if (!points) {
+        scan->failed = true;
+        return false;
+    }
+    schema->points = points;
+
+    data_point_t *p = &points[schema->num_point];
+    memset(p, 0, sizeof(data_point_t));
+    p->key = scan->next_key;
+    p->max_age_ms = -1;
+    memcpy(p->key, t_key.ptr, t_key.len);
+    p->key[t_key.len] = '\0';
+
+    // absolute deadband, or percent of last reported value when end with '%'
+    if (t_deadband.ptr) {
+        char buf[32];
+        char *endptr = NULL;
+        snprintf(buf, sizeof(buf), "%.*s", t_deadband.len, t_deadband.ptr);
+        double deadband = strtod(buf, &endptr);
+        if (endptr == buf || deadband < 0) {
+            LOGE("invalid deadband of computed point %s", p->key);
+            scan->failed = true;
+            return false;
+        }
+        p->deadband = deadband;
+        p->deadband_percent = (*endptr == '%');
+    }
+
+    if (expr_compile(schema->computed, t_expr.ptr, t_expr.len, resolve_computed_input, schema) < 0) {
+        LOGE("invalid expression of computed point %s", p->key);
+        scan->failed = true;
+        return false;
+    }
+
+    scan->next_key += t_key.len + 1;
+    schema->num_point++;
+    return true;
+}
+
+// append computed points after points read from device, each one an
+// expression compiled now and evaluated after every poll
+static bool scan_computed_points(data_schema_t *schema, const struct json_token *t_computed)
+{
+    schema->num_read_point = schema->num_point;
+    if (!t_computed->ptr) {
+        return true;
+    }
+
+    if (schema->num_read_point == 0) {
+        LOGE("computed points without points to read");
+        return false;
+    }
+
+    // keys are no longer than the array holding them
+    computed_scan_t scan = {.schema = schema, .failed = false};
+    scan.keys = (char *)MALLOC(t_computed->len + 1);
+    scan.next_key = scan.keys;
+    schema->computed = expr_program_create();
+
+    if (json_array_walk(t_computed->ptr, t_computed->len, scan_computed_point, &scan) < 0) {
+        scan.failed = true;
+    }
+
+    // destroy_schema release keys through first computed point
+    if (schema->num_point == schema->num_read_point) {
+        FREE(scan.keys);
+    }
+
+    if (!scan.failed) {
+        LOGI("Schema %s: %d computed points in %zu bytes of code", schema->name,
+             schema->num_point - schema->num_read_point, expr_program_size(schema->computed));
+    }
+    return !scan.failed;
+}
+
+
+static bool scan_hidden_point(const struct json_token *t_key, int index, void *user_data)
+{
+    data_schema_t *schema = (data_schema_t *)user_data;
+
+    char *key = STRNDUP(t_key->ptr, t_key->len);
+    int point = find_point_index(schema, key);
+    FREE(key);
+
+    if (point < 0) {
+        LOGE("unknown hidden point %.*s", t_key->len, t_key->ptr);
+        return false;
+    }
+
+    schema->points[point].hidden = true;
+    return true;
+}
+
+// mark points listed in schema hidden array, e.g. raw inputs of computed points
+static bool scan_hidden_points(data_schema_t *schema, const struct json_token *t_hidden)
+{
+    for (int32_t i = 0; i < schema->num_point; i++) {
+        schema->points[i].hidden = false;
+    }
+
+    if (!t_hidden->ptr) {
+        return true;
+    }
+    return json_array_walk(t_hidden->ptr, t_hidden->len, scan_hidden_point, schema) >= 0;
+}
+
+
+// build schema of a schema record, false stops the scan at an invalid schema
+static bool build_schema(adapter_t *adapter, prov_record_t *rec)
+{
+    struct json_token *t = rec->tokens;
+    data_schema_t *schema = (data_schema_t *)arena_alloc(adapter->arena, sizeof(data_schema_t));
+    schema->def_hash = rec->def_hash;
+    schema->interval = rec->values[PROV_SCHEMA_INTERVAL];
+    schema->timeout = rec->values[PROV_SCHEMA_TIMEOUT];
+    schema->max_gap = rec->values[PROV_SCHEMA_MAX_GAP];
+    schema->max_age_ms = rec->values[PROV_SCHEMA_MAX_AGE];
+    schema->max_interval = rec->values[PROV_SCHEMA_MAX_INTERVAL];
+    schema->group_window_ms[0] = rec->values[PROV_SCHEMA_AGGREGATE];
+
+    if (t[PROV_SCHEMA_PROTOCOL].ptr) {
+        scan_protocol(t[PROV_SCHEMA_PROTOCOL].ptr, t[PROV_SCHEMA_PROTOCOL].len, schema);
+    }
+    if (t[PROV_SCHEMA_FLAGS].ptr) {
+        scan_flags(t[PROV_SCHEMA_FLAGS].ptr, t[PROV_SCHEMA_FLAGS].len, schema);
+    }
+
+    schema->name = arena_json_string(adapter->arena, &t[PROV_SCHEMA_NAME]);
+    if (! schema->name) {
+        LOGE("missing schema name");
+        destroy_schema(schema);
+        return false;
+    }
+
+    if (schema->protocol == DEVICE_PROTOCOL_INVALID) {
+        LOGE("invalid schema protocol");
+        destroy_schema(schema);
+        return false;
+    }
+
+    if (schema->interval <= 0) {
+        LOGE("invalid schema interval");
+        destroy_schema(schema);
+        return false;
+    }
+
+    if (schema->timeout <= 0) {
+        LOGE("invalid schema timeout");
+        destroy_schema(schema);
+        return false;
+    }
+
+    if (schema->group_window_ms[0] < 0) {
+        LOGE("invalid schema aggregation window");
+        destroy_schema(schema);
+        return false;
+    }
+
+    if (take_retired_schema(adapter, schema)) {
+        LOGD("Schema %s not changed", schema->name);
+        // same definition, groups of taken over points and plans still hold
+        scan_point_groups(schema, &t[PROV_SCHEMA_GROUPS]);
+        scan_priority_points(schema, &t[PROV_SCHEMA_PRIORITY]);
+    } else {
+        if (create_point_table(schema->protocol, &t[PROV_SCHEMA_POINTS], &schema->num_point, &schema->points) !=
+            DEVICE_OK) {
+            LOGE("invalid points defintions");
+            destroy_schema(schema);
+            return false;
+        }
+        schema->num_read_point = schema->num_point;
+
+        if (!scan_computed_points(schema, &t[PROV_SCHEMA_COMPUTED])) {
+            LOGE("invalid computed points");
+            destroy_schema(schema);
+            return false;
+        }
+
+        create_point_index(schema);
+
+        if (!scan_hidden_points(schema, &t[PROV_SCHEMA_HIDDEN])) {
+            LOGE("invalid hidden points");
+            destroy_schema(schema);
+            return false;
+        }
+
+        if (!scan_point_groups(schema, &t[PROV_SCHEMA_GROUPS])) {
+            LOGE("invalid point groups");
+            destroy_schema(schema);
+            return false;
+        }
+
+        if (!scan_priority_points(schema, &t[PROV_SCHEMA_PRIORITY])) {
+            LOGE("invalid priority points");
+            destroy_schema(schema);
+            return false;
+        }
+
+        if (create_read_plan(schema->protocol, schema) != DEVICE_OK) {
+            LOGE("failed to create read plan");
+            destroy_schema(schema);
+            return false;
+        }
+    }
+
+    schema->integrity_period_ms = DEFAULT_INTEGRITY_PERIOD_MS;
+    schema->next = adapter->schemas;
+    adapter->schemas = schema;
+    adapter->num_schema++;
+
+    LOGI("Add schema [name=%s, protocol=%s, interval=%ld, timeout=%ld]", schema->name,
+         protocol2str(schema->protocol), schema->interval, schema->timeout);
+    return true;
+}
+
+// parse one element of the schemas array into a record, false stops the scan
+// at an invalid schema
+static bool scan_schema(const struct json_token *t, int index, void *user_data)
+{
+    adapter_t *adapter = (adapter_t *)user_data;
+
+    prov_record_t rec;
+    init_record(&rec);
+    struct json_token *tokens = rec.tokens;
+    int32_t *values = rec.values;
+    values[PROV_SCHEMA_MAX_GAP] = -1;
+    rec.def_hash = definition_hash(t->ptr, t->len);
+
+    json_scanf(t->ptr, t->len,
+               "{name:%T, protocol:%T, interval:%d, timeout:%d, flags:%T, maxGap:%d, maxAge:%d, maxInterval:%d, points:%T, groups:%T, priority:%T, "
+               "computed:%T, hidden:%T, aggregate:%d}",
+               &tokens[PROV_SCHEMA_NAME],
+               &tokens[PROV_SCHEMA_PROTOCOL],
+               &values[PROV_SCHEMA_INTERVAL],
+               &values[PROV_SCHEMA_TIMEOUT],
+               &tokens[PROV_SCHEMA_FLAGS],
+               &values[PROV_SCHEMA_MAX_GAP],
+               &values[PROV_SCHEMA_MAX_AGE],
+               &values[PROV_SCHEMA_MAX_INTERVAL],
+               &tokens[PROV_SCHEMA_POINTS],
+               &tokens[PROV_SCHEMA_GROUPS],
+               &tokens[PROV_SCHEMA_PRIORITY],
+               &tokens[PROV_SCHEMA_COMPUTED],
+               &tokens[PROV_SCHEMA_HIDDEN],
+               &values[PROV_SCHEMA_AGGREGATE]);
+
+    if (adapter->image) {
+        image_put_record(adapter->image, PROV_RECORD_SCHEMA, &rec, PROV_SCHEMA_TOKENS, PROV_SCHEMA_VALUES);
+    }
+    return build_schema(adapter, &rec);
+}
+
+static void scan_schema_array(const char *str, int len, void *user_data)
+{
+    if (!str || len <= 0 || !user_data) {
+        return;
+    }
+
+    // parse schemas array, in one pass over it
+    json_array_walk(str, len, scan_schema, user_data);
+}
+
+static const char *get_connection_string(ce_device_t *device)
+{
+    static char conn_str[MAX_CONNECTION_STRING_SIZE];
+
+    if (device->connection && s_adapter.downlink.if_data) {
+        snprintf(conn_str, sizeof(conn_str), "%s,%s", device->connection, s_adapter.downlink.if_data);
+        return conn_str;
+    } else if (s_adapter.downlink.if_data) {
+        return s_adapter.downlink.if_data;
+    } else if (device->connection) {
+       return device->connection;
+    } else {
+        return NULL;
+    }
+}
+
+// length of "ip:port" leading a tcp connection string
+static size_t tcp_endpoint_len(const char *conn_str)
+{
+    const char *p = strchr(conn_str, ':');
+    if (!p) {
+        return strlen(conn_str);
+    }
+
+    for (p++; *p >= '0' && *p <= '9'; p++) {
+    }
+    return p - conn_str;
+}
+
+// tcp connection string with depth of "pipeline" field of device, it takes
+// precedence over a depth suffix of the connection
+static char *set_pipeline_depth(arena_t *arena, const char *connection, int32_t depth)
+{
+    size_t len = tcp_endpoint_len(connection);
+    size_t size = len + 16;
+    char *conn_str = (char *)arena_alloc(arena, size);
+    snprintf(conn_str, size, "%.*s:%d", (int)len, connection, (int)depth);
+    return conn_str;
+}
+
+static bool is_same_downlink(const downlink_t *downlink, device_protocol_t protocol, const char *conn_str)
+{
+    if (downlink->protocol != protocol) {
+        return false;
+    }
+
+    // there is only one serial port on board, all RTU devices share it, and
+    // one counter on RT core serve all pulse devices
+    if (protocol == DEVICE_PROTOCOL_MODBUS_RTU || protocol == DEVICE_PROTOCOL_PULSE) {
+        return true;
+    }
+
+    // modbus tcp devices behind same gateway share its connection whatever
+    // pipeline depth they ask for
+    if (protocol == DEVICE_PROTOCOL_MODBUS_TCP) {
+        size_t len = tcp_endpoint_len(conn_str);
+        return len == tcp_endpoint_len(downlink->conn_str) && strncmp(downlink->conn_str, conn_str, len) == 0;
+    }
+
+    return strcmp(downlink->conn_str, conn_str) == 0;
+}
+
+// downlinks of a protocol are numbered in provision order, e.g. BUS_UTIL_MODBUS_TCP_1
+static void register_downlink_diag(adapter_t *adapter, downlink_t *downlink)
+{
+    char key[TELEMETRY_MAX_KEY_SIZE];
+    int32_t ordinal = 1;
+
+    for (downlink_t *d = adapter->downlinks; d; d = d->next) {
+        if (d->protocol == downlink->protocol) {
+            ordinal++;
+        }
+    }
+
+    snprintf(key, sizeof(key), ADAPTER_BUS_UTIL_DATAPOINT, protocol2str(downlink->protocol), ordinal);
+    downlink->diag_util = diag_register(key);
+}
+
+static downlink_t *find_or_create_downlink(adapter_t *adapter, ce_device_t *device)
+{
+    const char *conn_str = get_connection_string(device);
+    if (conn_str == NULL) {
+        LOGE("missing device connection");
+        return NULL;
+    }
+
+    for (downlink_t *downlink = adapter->downlinks; downlink; downlink = downlink->next) {
+        if (is_same_downlink(downlink, device->protocol, conn_str)) {
+            return downlink;
+        }
+    }
+
+    bool opened = false;
+    EventRegistration *notify_io = NULL;
+    device_driver_t *driver = take_retired_driver(adapter, device->protocol, conn_str, &opened, &notify_io);
+    if (!driver && (driver = create_driver(device->protocol, conn_str)) == NULL) {
+        LOGE("failed to create driver");
+        return NULL;
+    }
+
+    downlink_t *downlink = (downlink_t *)arena_alloc(adapter->arena, sizeof(downlink_t));
+    downlink->protocol = device->protocol;
+    downlink->conn_str = arena_strdup(adapter->arena, conn_str);
+    downlink->driver = driver;
+    downlink->opened = opened;
+    downlink->notify_io = notify_io;
+    if (!downlink->notify_io) {
+        register_downlink_notification(downlink);
+    }
+    downlink->max_inflight = ADAPTER_MAX_INFLIGHT_PER_DOWNLINK;
+    timer_stopwatch_start(&downlink->ts_util);
+    register_downlink_diag(adapter, downlink);
+    downlink->next = adapter->downlinks;
+    adapter->downlinks = downlink;
+
+    LOGI("Add downlink [protocol=%s, connection=%s]", protocol2str(downlink->protocol), downlink->conn_str);
+    return downlink;
+}
+
+// devices of same id on a downlink are one slave, the largest gap asked by
+// any of them apply
+static bus_slave_t *find_or_create_bus_slave(adapter_t *adapter, downlink_t *downlink, uint32_t id,
+                                             int32_t min_gap_ms)
+{
+    bus_slave_t *slave = downlink->slaves;
+    while (slave && slave->id != id) {
+        slave = slave->next;
+    }
+
+    if (!slave) {
+        slave = (bus_slave_t *)arena_alloc(adapter->arena, sizeof(bus_slave_t));
+        slave->id = id;
+        slave->next = downlink->slaves;
+        downlink->slaves = slave;
+    }
+
+    slave->min_gap_ms = MAX(slave->min_gap_ms, min_gap_ms);
+    return slave;
+}
+
+static void register_device_diag(ce_device_t *device)
+{
+    char key[TELEMETRY_MAX_KEY_SIZE];
+
+    device->diag_poll = diag_register_stats(device->name);
+    snprintf(key, sizeof(key), "%s_late_ms", device->name);
+    device->diag_late = diag_register_stats(key);
+    snprintf(key, sizeof(key), "%s_max_late_ms", device->name);
+    device->diag_max_late = diag_register(key);
+    snprintf(key, sizeof(key), "%s_breaker", device->name);
+    device->diag_breaker = diag_register(key);
+}
+
+// parse one element of the devices array, false stops the scan at an invalid device
+// unit id local gateway serves a modbus device as, its slave id unless set,
+// a unit already taken by another device isn't served
+static uint8_t scan_gateway_unit(adapter_t *adapter, const ce_device_t *device, int32_t unit)
+{
+    if (device->protocol != DEVICE_PROTOCOL_MODBUS_RTU && device->protocol != DEVICE_PROTOCOL_MODBUS_TCP) {
+        return 0;
+    }
+
+    if (unit < 0) {
+        unit = device->id;
+    }
+    if (unit < 1 || unit > 247) {
+        return 0;
+    }
+
+    for (ce_device_t *other = adapter->devices; other; other = other->next) {
+        if (other->gateway_unit == unit) {
+            LOGW("Gateway unit %ld of %s is taken by %s, not served", unit, device->name, other->name);
+            return 0;
+        }
+    }
+    return (uint8_t)unit;
+}
+
+
+// build device of a device record, false stops the scan at an invalid device
+static bool build_device(adapter_t *adapter, prov_record_t *rec)
+{
+    struct json_token *t = rec->tokens;
+    int32_t min_gap_ms = rec->values[PROV_DEVICE_MIN_GAP];
+    int32_t gateway_unit = rec->values[PROV_DEVICE_GATEWAY_UNIT];
+
+    ce_device_t *device = (ce_device_t *)arena_alloc(adapter->arena, sizeof(ce_device_t));
+    device->def_hash = rec->def_hash;
+    device->interval = rec->values[PROV_DEVICE_INTERVAL];
+    device->max_interval = rec->values[PROV_DEVICE_MAX_INTERVAL];
+    device->timeout = rec->values[PROV_DEVICE_TIMEOUT];
+
+    device->name = arena_json_string(adapter->arena, &t[PROV_DEVICE_NAME]);
+    device->connection = arena_json_string(adapter->arena, &t[PROV_DEVICE_CONNECTION]);
+    device->location = arena_json_string(adapter->arena, &t[PROV_DEVICE_LOCATION]);
+
+    char *schema_name = arena_json_string(adapter->arena, &t[PROV_DEVICE_SCHEMA]);
+    if (schema_name) {
+        device->schema = parse_schema(adapter->schemas, schema_name);
+        device->schema_offset = parse_schema_offset(schema_name);
+        device->id = parse_schema_channel(schema_name);
+    }
+
+    char *device_id = arena_json_string(adapter->arena, &t[PROV_DEVICE_ID]);
+    if (device_id) {
+        device->id = strtol(device_id, NULL, 10);
+    }
+
+    if (!device->name) {
+        LOGE("missing device name");
+        destroy_device(device);
+        return false;
+    }
+
+    if (!device->schema) {
+        LOGE("invalid device schema");
+        destroy_device(device);
+        return false;
+    }
+
+    if (!device->location) {
+        device->location = adapter->location;
+    }
+
+    if (device->interval <= 0) {
+        device->interval = device->schema->interval;
+    }
+
+    if (device->max_interval <= 0) {
+        device->max_interval = device->schema->max_interval;
+    }
+
+    if (device->timeout <= 0) {
+        device->timeout = device->schema->timeout;
+    }
+
+    device->protocol = device->schema->protocol;
+
+    int32_t pipeline = rec->values[PROV_DEVICE_PIPELINE];
+    if (pipeline > 0 && device->protocol == DEVICE_PROTOCOL_MODBUS_TCP && device->connection) {
+        device->connection = set_pipeline_depth(adapter->arena, device->connection, pipeline);
+    }
+
+    device->telemetry = NULL;
+    device->subscriber = ++s_subscriber_seq;
+
+    if ((device->downlink = find_or_create_downlink(adapter, device)) == NULL) {
+        LOGE("failed to find or create device driver");
+        destroy_device(device);
+        return false;
+    }
+    device->slave = find_or_create_bus_slave(adapter, device->downlink, device->id, min_gap_ms);
+    device->gateway_unit = scan_gateway_unit(adapter, device, gateway_unit);
 
-    FREE(schema->name);
-    if (schema->points) {
-        destroy_point_table(schema->protocol, schema->points, schema->num_point);
+    device->err = DEVICE_E_INVALID;
+    device->next = adapter->devices;
+    adapter->devices = device;
+    adapter->num_device++;
+    register_device_diag(device);
+
+    if (take_retired_device(adapter, device)) {
+        LOGI("Keep device [name=%s]", device->name);
+        return true;
     }
-    FREE(schema);
-}
 
+    LOGI("Add device [name=%s, schema=%s, interval=%ld, timeout=%ld]", device->name, device->schema->name,
+         device->interval, device->timeout);
 
-static void destroy_device(ce_device_t *device)
+    return true;
+}
+
+// parse one element of the devices array into a record
+static bool scan_device(const struct json_token *t, int index, void *user_data)
 {
-    ASSERT(device);
+    adapter_t *adapter = (adapter_t *)user_data;
 
-    FREE(device->name);
-    FREE(device->connection);
-    FREE(device->location);
+    prov_record_t rec;
+    init_record(&rec);
+    struct json_token *tokens = rec.tokens;
+    int32_t *values = rec.values;
+    values[PROV_DEVICE_GATEWAY_UNIT] = -1;
+    rec.def_hash = definition_hash(t->ptr, t->len);
+
+    json_scanf(t->ptr, t->len,
+               "{name:%T, schema:%T, id:%T, connection:%T, location:%T, interval:%d, maxInterval:%d, timeout:%d, minGap:%d, gatewayUnit:%d, "
+               "pipeline:%d}",
+               &tokens[PROV_DEVICE_NAME],
+               &tokens[PROV_DEVICE_SCHEMA],
+               &tokens[PROV_DEVICE_ID],
+               &tokens[PROV_DEVICE_CONNECTION],
+               &tokens[PROV_DEVICE_LOCATION],
+               &values[PROV_DEVICE_INTERVAL],
+               &values[PROV_DEVICE_MAX_INTERVAL],
+               &values[PROV_DEVICE_TIMEOUT],
+               &values[PROV_DEVICE_MIN_GAP],
+               &values[PROV_DEVICE_GATEWAY_UNIT],
+               &values[PROV_DEVICE_PIPELINE]);
+
+    if (adapter->image) {
+        image_put_record(adapter->image, PROV_RECORD_DEVICE, &rec, PROV_DEVICE_TOKENS, PROV_DEVICE_VALUES);
+    }
+    return build_device(adapter, &rec);
+}
 
-    destroy_device_telemetry(device->telemetry);
-    device->telemetry = NULL;
+static void scan_device_array(const char *str, int len, void *user_data)
+{
+    if (!str || len <= 0 || !user_data) {
+        return;
+    }
 
-    FREE(device);
+    // parse devices array, in one pass over it
+    json_array_walk(str, len, scan_device, user_data);
 }
 
 
-static ce_device_t *get_next_device_to_run(ce_device_t *current)
+static void scan_encoding(const char *str, int len, void *user_data)
 {
-    // nothing to schedule
-    if (!s_adapter.devices) {
-        return NULL;
-    }
+    telemetry_encoding_t *encoding = (telemetry_encoding_t *)user_data;
 
-    // schedule first device
-    if (!current) {
-        return s_adapter.devices;
+    if ((strlen(TELEMETRY_ENCODING_CBOR_STR) == len) && (strncasecmp(str, TELEMETRY_ENCODING_CBOR_STR, len) == 0)) {
+        *encoding = TELEMETRY_ENCODING_CBOR;
+    } else if ((strlen(TELEMETRY_ENCODING_JSON_STR) == len) && (strncasecmp(str, TELEMETRY_ENCODING_JSON_STR, len) == 0)) {
+        *encoding = TELEMETRY_ENCODING_JSON;
+    } else {
+        LOGW("unknown telemetry encoding %.*s, use json", len, str);
+        *encoding = TELEMETRY_ENCODING_JSON;
     }
+}
 
-    // if only one device, schedule that one again
-    if (s_adapter.devices->next == NULL) {
-        return s_adapter.devices;
-    }
+static void scan_batch(const char *str, int len, void *user_data)
+{
+    adapter_t *adapter = (adapter_t *)user_data;
 
-    // schedule next device with nearest schedule time, start from next device in line
-    //  so when some device won't starving when not able to catch up
-    ce_device_t *start = current->next ? current->next : s_adapter.devices;
-    ce_device_t *device = start;
-    ce_device_t *next = start;
+    int32_t max_size = TELEMETRY_BATCH_DEFAULT_SIZE;
+    int32_t max_latency = TELEMETRY_BATCH_DEFAULT_LATENCY_MS;
+    json_scanf(str, len, "{maxSize:%d,maxLatency:%d}", &max_size, &max_latency);
 
-    do {
-        if (timespec_compare(&device->ts_schedule, &next->ts_schedule) < 0) {
-            next = device;
-        }
+    adapter->batch_size = max_size > 0 ? max_size : 0;
+    adapter->batch_latency_ms = max_latency;
+}
+
+static void scan_gateway(const char *str, int len, void *user_data)
+{
+    adapter_t *adapter = (adapter_t *)user_data;
 
-        device = device->next ? device->next : s_adapter.devices;
-    } while (device != start);
+    int32_t port = MODBUS_GATEWAY_DEFAULT_PORT;
+    int32_t max_age = 0;
+    json_scanf(str, len, "{port:%d,maxAge:%d}", &port, &max_age);
 
-    return next;
+    if (port <= 0 || port > UINT16_MAX) {
+        LOGW("invalid gateway port %ld, gateway disabled", port);
+        port = 0;
+    }
+    adapter->gateway_port = port;
+    adapter->gateway_max_age_ms = max_age > 0 ? max_age : 0;
 }
 
+// set adapter properties of an adapter record
+static void build_adapter(adapter_t *adapter, const prov_record_t *rec)
+{
+    const struct json_token *t = rec->tokens;
+
+    if (t[PROV_ADAPTER_ENCODING].ptr) {
+        scan_encoding(t[PROV_ADAPTER_ENCODING].ptr, t[PROV_ADAPTER_ENCODING].len, &adapter->encoding);
+    }
+    if (t[PROV_ADAPTER_BATCH].ptr) {
+        scan_batch(t[PROV_ADAPTER_BATCH].ptr, t[PROV_ADAPTER_BATCH].len, adapter);
+    }
+    if (t[PROV_ADAPTER_TRACE].ptr) {
+        adapter->trace = t[PROV_ADAPTER_TRACE].type == JSON_TYPE_TRUE;
+    }
+    if (t[PROV_ADAPTER_GATEWAY].ptr) {
+        scan_gateway(t[PROV_ADAPTER_GATEWAY].ptr, t[PROV_ADAPTER_GATEWAY].len, adapter);
+    }
+    if (t[PROV_ADAPTER_UPLINK].ptr) {
+        scan_uplink(t[PROV_ADAPTER_UPLINK].ptr, t[PROV_ADAPTER_UPLINK].len, adapter);
+    }
+    if (t[PROV_ADAPTER_DOWNLINK].ptr) {
+        scan_downlink(t[PROV_ADAPTER_DOWNLINK].ptr, t[PROV_ADAPTER_DOWNLINK].len, adapter);
+    }
+
+    adapter->name = arena_json_string(adapter->arena, &t[PROV_ADAPTER_NAME]);
+    adapter->location = arena_json_string(adapter->arena, &t[PROV_ADAPTER_LOCATION]);
+    adapter->source_id = arena_json_string(adapter->arena, &t[PROV_ADAPTER_SOURCE_ID]);
+}
 
-static void query_device(ce_device_t *device)
+static void scan_provision(const char *str, int len, void *user_data)
 {
-    ASSERT(device);
-    ASSERT(device->schema);
+    if (!str || !len || !user_data) {
+        LOGE("invalid input");
+        return;
+    }
 
-    struct timespec poll_sw;
-    timer_stopwatch_start(&poll_sw);
+    adapter_t *adapter = (adapter_t *)user_data;
+    prov_record_t rec;
+    init_record(&rec);
+    struct json_token *tokens = rec.tokens;
 
-    // since we reuse schema for multiple devices, set schema offest from current device
-    // before we query device with that schema
-    device->schema->offset = device->schema_offset;
+    json_scanf(str, len, "{name:%T,location:%T,sourceId:%T,encoding:%T,batch:%T,trace:%T,gateway:%T,uplink:%T,downlink:%T}",
+               &tokens[PROV_ADAPTER_NAME],
+               &tokens[PROV_ADAPTER_LOCATION],
+               &tokens[PROV_ADAPTER_SOURCE_ID],
+               &tokens[PROV_ADAPTER_ENCODING],
+               &tokens[PROV_ADAPTER_BATCH],
+               &tokens[PROV_ADAPTER_TRACE],
+               &tokens[PROV_ADAPTER_GATEWAY],
+               &tokens[PROV_ADAPTER_UPLINK],
+               &tokens[PROV_ADAPTER_DOWNLINK]);
 
-    if (!device->telemetry) {
-        device->telemetry = create_empty_device_telemetry(device->schema->num_point);
+    if (adapter->image) {
+        image_put_record(adapter->image, PROV_RECORD_ADAPTER, &rec, PROV_ADAPTER_TOKENS, 0);
     }
 
-    if (s_adapter.driver_state == DRIVER_STATE_INIT) {
-        LOGI("Open device driver");
-        if (s_adapter.driver->driver_open(s_adapter.driver, device->id, device->timeout) != DEVICE_OK) {
-            LOGE("Failed to open driver");
+    // some of the schema, device field depend on adapter properties, so make
+    // sure they been scan first
+    build_adapter(adapter, &rec);
+
+    json_scanf(str, len, "{schemas:%M,devices:%M}",
+               scan_schema_array, adapter,
+               scan_device_array, adapter);
+}
+
+// build provision from its image, records are applied as scan_provision()
+// applied them when image was recorded, without walking provision JSON
+static void load_provision_image(adapter_t *adapter, const uint8_t *image, size_t image_size)
+{
+    prov_image_reader_t reader = {.pos = image, .end = image + image_size};
+    prov_record_t rec;
+    uint8_t kind;
+
+    // scan stopped at the first invalid schema or device, so did recording
+    while (image_get_record(&reader, &kind, &rec)) {
+        switch (kind) {
+        case PROV_RECORD_ADAPTER:
+            build_adapter(adapter, &rec);
+            break;
+        case PROV_RECORD_SCHEMA:
+            build_schema(adapter, &rec);
+            break;
+        case PROV_RECORD_DEVICE:
+            build_device(adapter, &rec);
+            break;
+        default:
+            LOGE("unknown provision image record %d", kind);
             return;
         }
     }
 
-    device->err = s_adapter.driver->get_point_list(s_adapter.driver, device->id, device->schema, device->telemetry, device->timeout);
-
-    if (device->err) {
-        LOGE("[%s] Read points failed: %s", device->name, err_str(device->err));
-        return;
+    if (reader.pos != reader.end) {
+        LOGE("provision image truncated");
     }
-    device->poll_duration = timer_stopwatch_stop(&poll_sw);
-    LOGI("[%s] Read points in %d ms", device->name, device->poll_duration);
 }
 
 
-static void reset_adapter(adapter_t *adapter)
+static bool is_adapter_valid(adapter_t *adapter)
 {
-    ASSERT(adapter);
+    if (!adapter) {
+        return false;
+    }
 
-    FREE(adapter->name);
-    FREE(adapter->location);
-    FREE(adapter->source_id);
-    FREE(adapter->uplink.if_name);
-    FREE(adapter->uplink.if_data);
-    FREE(adapter->downlink.if_name);
-    FREE(adapter->downlink.if_data);
-
-    while (adapter->devices) {
-        ce_device_t *device = adapter->devices;
-        adapter->devices = adapter->devices->next;
-        destroy_device(device);
+    if (!adapter->name) {
+        LOGE("missing adapter name");
+        return false;
     }
 
-    while (adapter->schemas) {
-        data_schema_t *schema = adapter->schemas;
-        adapter->schemas = adapter->schemas->next;
-        destroy_schema(schema);
+    if (!adapter->location) {
+        LOGE("missing adapter location");
+        return false;
     }
 
-    if (adapter->driver) {
-        if (adapter->driver_state & DRIVER_STATE_OPENED) {
-            adapter->driver->driver_close(adapter->driver);
-        }
-        destroy_driver(adapter->driver);
-        adapter->driver = NULL;
+    if (!adapter->source_id) {
+        LOGE("missing adapter source id");
+        return false;
     }
 
-    adapter->provision_epoch = 0;
-    adapter->num_device = 0;
-    adapter->num_schema = 0;
-    adapter->pending_device = NULL;
-    adapter->ready_device = NULL;
-    adapter->driver_state = DRIVER_STATE_INIT;
+    return true;
 }
 
 
-static void scan_link(const char *str, int len, void *user_data)
+static void enqueue_device_locked(ce_device_t *device)
 {
-    link_t *link = (link_t *)user_data;
-    json_scanf(str, len, "{interface:%Q, data:%Q}", &link->if_name, &link->if_data);
-}
+    downlink_t *downlink = device->downlink;
 
-static void scan_protocol(const char *str, int len, void *user_data)
-{
-    data_schema_t *schema = (data_schema_t*)user_data;
-    char *str_protocol = STRNDUP(str, len);
-    schema->protocol = str2protocol(str_protocol);
-    FREE(str_protocol);
-}
+    device->busy = true;
+    device->queue_next = NULL;
+    if (downlink->queue_tail) {
+        downlink->queue_tail->queue_next = device;
+    } else {
+        downlink->queue_head = device;
+    }
+    downlink->queue_tail = device;
 
+    pthread_cond_signal(&s_adapter.cond);
+}
 
-static void scan_flags(const char *str, int len, void *user_data)
+static ce_device_t *dequeue_device_locked(downlink_t *downlink)
 {
-    data_schema_t *schema = (data_schema_t *)user_data;
-    struct json_token t_flag;
+    ce_device_t *device = downlink->queue_head;
 
-    for (int i = 0; json_scanf_array_elem(str, len, "", i, &t_flag) > 0; i++) {
-        schema->flags |= parse_flag(t_flag.ptr, t_flag.len);
+    if (device) {
+        downlink->queue_head = device->queue_next;
+        if (!downlink->queue_head) {
+            downlink->queue_tail = NULL;
+        }
+        device->queue_next = NULL;
     }
+    return device;
 }
 
-
-
-static void scan_schema_array(const char *str, int len, void *user_data)
+static void remove_queued_device_locked(downlink_t *downlink, ce_device_t *device)
 {
-    if (!str || len <= 0 || !user_data) {
-        return;
+    ce_device_t *prev = NULL;
+    for (ce_device_t *d = downlink->queue_head; d != device; d = d->queue_next) {
+        prev = d;
     }
 
-    struct json_token t = {.ptr=NULL, .len=0, .type=JSON_TYPE_INVALID};
-    adapter_t *adapter = (adapter_t *)user_data;
+    if (prev) {
+        prev->queue_next = device->queue_next;
+    } else {
+        downlink->queue_head = device->queue_next;
+    }
+    if (downlink->queue_tail == device) {
+        downlink->queue_tail = prev;
+    }
+    device->queue_next = NULL;
+}
 
-    // parse schemas array
-    for (int i = 0; json_scanf_array_elem(str, len, "", i, &t) > 0; i++) {
-        struct json_token t_points_def = {.ptr=NULL, .len=0, .type=JSON_TYPE_INVALID};
-        data_schema_t *schema = (data_schema_t *)CALLOC(1, sizeof(data_schema_t));
-
-        json_scanf(t.ptr, t.len, "{name:%Q, protocol:%M, interval:%d, timeout:%d, flags:%M, points:%T}",
-                   &schema->name,
-                   scan_protocol, schema,
-                   &schema->interval,
-                   &schema->timeout,
-                   scan_flags, schema,
-                   &t_points_def);
-
-        if (! schema->name) {
-            LOGE("missing schema name");
-            destroy_schema(schema);
-            return;
-        }
+// pick queued device to poll next on a bus. Slaves still in their gap or
+// transaction are skipped rather than waited for, so the bus doesn't idle
+// while another slave could be served. Of the rest, the slave served longest
+// ago go first so a slave with many devices can't hog the bus, and devices of
+// same slave go in queue order. When none can go, wake is moved to when the
+// first gap ends
+static ce_device_t *pick_bus_device_locked(downlink_t *downlink, const struct timespec *now,
+                                           struct timespec *wake)
+{
+    ce_device_t *picked = NULL;
 
-        if (schema->protocol == DEVICE_PROTOCOL_INVALID) {
-            LOGE("invalid schema protocol");
-            destroy_schema(schema);
-            return;
+    for (ce_device_t *device = downlink->queue_head; device; device = device->queue_next) {
+        bus_slave_t *slave = device->slave;
+        if (timespec_compare(&slave->ts_start, &slave->ts_end) > 0) {
+            continue;
         }
 
-        if (schema->interval <= 0) {
-            LOGE("invalid schema interval");
-            destroy_schema(schema);
-            return;
+        struct timespec ready = MS2SPEC(slave->min_gap_ms);
+        timespec_add(&ready, &slave->ts_end);
+        if (timespec_compare(&ready, now) > 0) {
+            if ((!wake->tv_sec && !wake->tv_nsec) || timespec_compare(&ready, wake) < 0) {
+                *wake = ready;
+            }
+            continue;
         }
 
-        if (schema->timeout <= 0) {
-            LOGE("invalid schema timeout");
-            destroy_schema(schema);
-            return;
+        if (!picked || timespec_compare(&slave->ts_start, &picked->slave->ts_start) < 0) {
+            picked = device;
         }
+    }
 
-        if (create_point_table(schema->protocol, &t_points_def, &schema->num_point, &schema->points) != DEVICE_OK) {
-            LOGE("invalid points defintions");
-            destroy_schema(schema);
-            return;
+    return picked;
+}
+
+// pick next downlink which has broadcast write or device ready and free slot,
+// start from the one after last served so a busy downlink won't starve others
+static downlink_t *pick_ready_downlink_locked(const struct timespec *now, struct timespec *wake,
+                                              ce_device_t **pdevice)
+{
+    if (!s_adapter.downlinks) {
+        return NULL;
+    }
+
+    downlink_t *start = (s_adapter.last_served && s_adapter.last_served->next) ? s_adapter.last_served->next
+                                                                              : s_adapter.downlinks;
+    downlink_t *downlink = start;
+
+    do {
+        if (downlink->inflight < downlink->max_inflight) {
+            *pdevice = downlink->write_head ? NULL : pick_bus_device_locked(downlink, now, wake);
+            if (downlink->write_head || *pdevice) {
+                s_adapter.last_served = downlink;
+                return downlink;
+            }
         }
+        downlink = downlink->next ? downlink->next : s_adapter.downlinks;
+    } while (downlink != start);
+
+    return NULL;
+}
 
-        schema->integrity_period_ms = DEFAULT_INTEGRITY_PERIOD_MS;
-        schema->next = adapter->schemas;
-        adapter->schemas = schema;
-        adapter->num_schema++;
+// utilization of a window is the share of it transactions kept the bus busy
+static void account_bus_time_locked(downlink_t *downlink, int32_t busy_ms)
+{
+    downlink->busy_ms += busy_ms;
+
+    int32_t window_ms = timer_stopwatch_stop(&downlink->ts_util);
+    if (window_ms < ADAPTER_BUS_UTIL_WINDOW_MS) {
+        return;
+    }
 
-        LOGI("Add schema [name=%s, protocol=%s, interval=%ld, timeout=%ld]", schema->name,
-             protocol2str(schema->protocol), schema->interval, schema->timeout);
+    int32_t util_pct = (int32_t)(downlink->busy_ms * 100 / ((int64_t)window_ms * downlink->max_inflight));
+    diag_log_handle(downlink->diag_util, util_pct);
+    if (util_pct >= ADAPTER_BUS_UTIL_WARN_PCT) {
+        LOGW("Downlink [protocol=%s, connection=%s] %d%% busy, close to saturation", protocol2str(downlink->protocol),
+             downlink->conn_str, util_pct);
     }
+
+    downlink->busy_ms = 0;
+    timer_stopwatch_start(&downlink->ts_util);
 }
 
-static const char *get_connection_string(ce_device_t *device)
+// drop queued polls and wait for running ones to finish, so devices and
+// drivers can be released safely
+static void drain_workers_locked(void)
 {
-    static char conn_str[MAX_CONNECTION_STRING_SIZE];
+    for (downlink_t *downlink = s_adapter.downlinks; downlink; downlink = downlink->next) {
+        ce_device_t *device;
+        while ((device = dequeue_device_locked(downlink)) != NULL) {
+            device->busy = false;
+        }
+        clear_bus_writes(downlink);
+    }
 
-    if (device->connection && s_adapter.downlink.if_data) {
-        snprintf(conn_str, sizeof(conn_str), "%s,%s", device->connection, s_adapter.downlink.if_data);
-        return conn_str;
-    } else if (s_adapter.downlink.if_data) {
-        return s_adapter.downlink.if_data;
-    } else if (device->connection) {
-       return device->connection;
-    } else {
-        return NULL;
+    while (s_adapter.inflight > 0) {
+        pthread_cond_wait(&s_adapter.idle_cond, &s_adapter.mutex);
     }
 }
 
-static bool is_compatible_driver(device_protocol_t protocol, device_driver_t *driver)
+static bool is_scheduled_before(const ce_device_t *a, const ce_device_t *b)
 {
-    device_protocol_t driver_protocol = driver->get_protocol(driver);
+    int cmp = timespec_compare(&a->ts_schedule, &b->ts_schedule);
+    if (cmp != 0) {
+        return cmp < 0;
+    }
 
-    return (protocol == driver_protocol);
+    // same schedule time, first come first serve so no device starve
+    return (int32_t)(a->sched_seq - b->sched_seq) < 0;
 }
 
-static int find_or_create_driver(adapter_t *adapter, ce_device_t *device)
+static void swap_heap_entry(ce_device_t **heap, int32_t i, int32_t j)
 {
-    if (!adapter->driver) {
-        const char* conn_str = get_connection_string(device);
-        if ((conn_str == NULL) || (adapter->driver = create_driver(device->protocol, conn_str)) == NULL) {
-            LOGE("failed to create driver");
-            return -1;
-        }
-    } else {
-        if (!is_compatible_driver(device->protocol, adapter->driver)) {
-            return -1;
+    ce_device_t *tmp = heap[i];
+    heap[i] = heap[j];
+    heap[j] = tmp;
+}
+
+static void sched_push_locked(ce_device_t *device)
+{
+    ASSERT(s_adapter.sched_size < s_adapter.num_device);
+
+    ce_device_t **heap = s_adapter.sched_heap;
+    int32_t i = s_adapter.sched_size++;
+
+    device->sched_seq = s_adapter.sched_seq++;
+    heap[i] = device;
+
+    while (i > 0) {
+        int32_t parent = (i - 1) / 2;
+        if (!is_scheduled_before(heap[i], heap[parent])) {
+            break;
         }
+        swap_heap_entry(heap, i, parent);
+        i = parent;
     }
-    return 0;
 }
 
-static void scan_device_array(const char *str, int len, void *user_data)
+static ce_device_t *sched_peek_locked(void)
 {
-    if (!str || len <= 0 || !user_data) {
-        return;
+    return s_adapter.sched_size > 0 ? s_adapter.sched_heap[0] : NULL;
+}
+
+static ce_device_t *sched_pop_locked(void)
+{
+    if (s_adapter.sched_size == 0) {
+        return NULL;
     }
 
-    adapter_t *adapter = (adapter_t *)user_data;
-    struct json_token t;
-
-    for (int i = 0; json_scanf_array_elem(str, len, "", i, &t) > 0; i++) {
-        char *schema_name = NULL;
-        char *device_id = NULL;
-
-        ce_device_t *device = (ce_device_t *)CALLOC(1, sizeof(ce_device_t));
-        json_scanf(t.ptr, t.len, "{name:%Q, schema:%Q, id:%Q, connection:%Q, location:%Q, interval:%d, timeout:%d}",
-                   &device->name,
-                   &schema_name,
-                   &device_id,
-                   &device->connection,
-                   &device->location,
-                   &device->interval,
-                   &device->timeout);
-
-        // dealling with schema_name and device id first, so we don't bother to
-        // worry about free them in error case
-        if (schema_name) {
-            device->schema = parse_schema(adapter->schemas, schema_name);
-            device->schema_offset = parse_schema_offset(schema_name);
-            device->id = parse_schema_channel(schema_name);
-            FREE(schema_name);
-        }
-
-        if (device_id) {
-            device->id = strtol(device_id, NULL, 10);
-            FREE(device_id);
-        }
-
-        if (!device->name) {
-            LOGE("missing device name");
-            destroy_device(device);
-            return;
-        }
+    ce_device_t **heap = s_adapter.sched_heap;
+    ce_device_t *top = heap[0];
+    int32_t size = --s_adapter.sched_size;
+    heap[0] = heap[size];
 
-        if (!device->schema) {
-            LOGE("invalid device schema");
-            destroy_device(device);
-            return;
-        }
+    int32_t i = 0;
+    while (true) {
+        int32_t left = 2 * i + 1;
+        int32_t right = left + 1;
+        int32_t smallest = i;
 
-        if (!device->location && adapter->location) {
-            device->location = STRDUP(adapter->location);
+        if (left < size && is_scheduled_before(heap[left], heap[smallest])) {
+            smallest = left;
         }
-
-        if (device->interval <= 0) {
-            device->interval = device->schema->interval;
+        if (right < size && is_scheduled_before(heap[right], heap[smallest])) {
+            smallest = right;
         }
-
-        if (device->timeout <= 0) {
-            device->timeout = device->schema->timeout;
+        if (smallest == i) {
+            break;
         }
+        swap_heap_entry(heap, i, smallest);
+        i = smallest;
+    }
 
-        device->protocol = device->schema->protocol;
+    return top;
+}
 
-        device->telemetry = NULL;
+static void distribute_device_query_time(void)
+{
+    struct timespec ts_start;
+    clock_gettime(CLOCK_MONOTONIC, &ts_start);
 
-        if (find_or_create_driver(adapter, device) != 0) {
-            LOGE("failed to find or create device driver");
-            destroy_device(device);
-            return;
-        }
+    s_adapter.sched_heap = (ce_device_t **)CALLOC(s_adapter.num_device, sizeof(ce_device_t *));
 
-        device->err = DEVICE_E_INVALID;
-        device->next = adapter->devices;
-        adapter->devices = device;
-        adapter->num_device++;
+    for (ce_device_t *device = s_adapter.devices; device; device = device->next) {
+        // device kept from previous provision carry on with its own schedule
+        if (device->ts_schedule.tv_sec || device->ts_schedule.tv_nsec) {
+            sched_push_locked(device);
+            continue;
+        }
 
-        LOGI("Add device [name=%s, schema=%s, interval=%ld, timeout=%ld]", device->name, device->schema->name,
-             device->interval, device->timeout);
+        device->ts_schedule = ts_start;
+        device->last_flush_ts.tv_nsec = device->last_flush_ts.tv_sec = 0;
+        struct timespec ts_timeout = MS2SPEC(ADAPTER_FIRST_POLL_SPACING_MS);
+        timespec_add(&ts_start, &ts_timeout);
+        sched_push_locked(device);
     }
 }
 
-
-static void scan_provision(const char *str, int len, void *user_data)
+// resume polling phase and COV baselines saved before restart, so devices
+// neither poll at once nor all report in full
+static void restore_telemetry_state_locked(void)
 {
-    if (!str || !len || !user_data) {
-        LOGE("invalid input");
-        return;
+    for (ce_device_t *device = s_adapter.devices; device; device = device->next) {
+        if ((device->schema->flags & FLAG_COV) && !device->telemetry) {
+            device->telemetry = create_empty_device_telemetry(device->schema->num_point,
+                                                              device->schema->flags & FLAG_COV);
+        }
     }
+    telemetry_state_restore(s_adapter.devices, s_adapter.provision_epoch);
+}
 
-    adapter_t *adapter = (adapter_t *)user_data;
-
-    json_scanf(str, len, "{name:%Q,location:%Q,sourceId:%Q,uplink:%M,downlink:%M}",
-               &adapter->name,
-               &adapter->location,
-               &adapter->source_id,
-               scan_link, &adapter->uplink,
-               scan_link, &adapter->downlink);
+static void save_telemetry_state_callback(void *context)
+{
+    pthread_mutex_lock(&s_adapter.mutex);
+    if (s_adapter.num_device > 0) {
+        telemetry_state_save(s_adapter.devices, s_adapter.provision_epoch);
+    }
+    pthread_mutex_unlock(&s_adapter.mutex);
+}
 
-    // some of the schema, device field depend on adapter properties, so make
-    // sure they been scan first
-    json_scanf(str, len, "{schemas:%M,devices:%M}",
-               scan_schema_array, adapter,
-               scan_device_array, adapter);
+static void log_device_lateness(const ce_device_t *device)
+{
+    diag_log_handle(device->diag_late, device->late_ms);
+    diag_log_handle(device->diag_max_late, device->max_late_ms);
 }
 
 
-static bool is_adapter_valid(adapter_t *adapter)
+// return number of results read from pipe, or -1 on error
+static int consume_results_from_result_pipe(int fd, device_result_t *results, int max_results)
 {
-    if (!adapter) {
-        return false;
+    // each result is written in one go and smaller than PIPE_BUF, so pipe
+    // always hold whole records
+    ssize_t nread = read(fd, results, max_results * sizeof(device_result_t));
+    if (nread < 0) {
+        LOGE("Failed to retrive device result");
+        return -1;
     }
 
-    if (!adapter->name) {
-        LOGE("missing adapter name");
-        return false;
-    }
+    return nread / sizeof(device_result_t);
+}
 
-    if (!adapter->location) {
-        LOGE("missing adapter location");
-        return false;
-    }
+// merge changes notified while device was polled, they are not older than
+// what poll read, keeping change poll found
+static void apply_pending_changes(ce_device_t *device)
+{
+    telemetry_t *pending = device->pending;
+    telemetry_t *telemetry = device->telemetry;
 
-    if (!adapter->source_id) {
-        LOGE("missing adapter source id");
-        return false;
+    for (int i = 0; telemetry && i < pending->num_values && i < telemetry->num_values; i++) {
+        if (!test_mask(pending->cov_mask, i)) {
+            continue;
+        }
+
+        bool cov = IS_COV(telemetry, i);
+        set_telemetry_number_value(telemetry, i, pending->nums[i], &device->schema->points[i]);
+        if (cov) {
+            set_mask(telemetry->cov_mask, i);
+        }
     }
 
-    return true;
-}
+    if (telemetry) {
+        update_computed_points(device->schema, telemetry, true);
+    }
 
+    destroy_device_telemetry(pending);
+    device->pending = NULL;
+}
 
-static void notify_worker_locked(void *device)
+// subscribed device only need polling for integrity snapshot
+static int32_t poll_interval(const ce_device_t *device)
 {
-    s_adapter.pending_device = device;
-    pthread_cond_signal(&s_adapter.cond);
+    int32_t interval = device->cur_interval[0] ? device->cur_interval[0] : device->interval;
+    return device->subscribed ? MAX(interval, device->schema->integrity_period_ms) : interval;
 }
 
-static void notify_worker_callback(void *device)
+// answer local gateway client from register cache of device served as unit
+static err_code read_gateway_unit(uint8_t unit, uint8_t function_code, uint16_t addr, uint16_t quantity,
+                                  uint16_t *regs)
 {
     pthread_mutex_lock(&s_adapter.mutex);
-    notify_worker_locked(device);
+
+    // devices not served by gateway have unit 0, never a match
+    ce_device_t *device = s_adapter.devices;
+    while (device && (device->gateway_unit == 0 || device->gateway_unit != unit)) {
+        device = device->next;
+    }
+
+    err_code err = DEVICE_E_CONFIG;
+    if (device) {
+        int32_t max_age_ms = s_adapter.gateway_max_age_ms > 0 ? s_adapter.gateway_max_age_ms
+                                                              : MODBUS_GATEWAY_STALE_INTERVALS * poll_interval(device);
+        err = modbus_read_cache(device->downlink->driver, device->id, function_code, addr, quantity, max_age_ms,
+                                regs);
+    }
+
     pthread_mutex_unlock(&s_adapter.mutex);
+    return err;
 }
 
-static void distribute_device_query_time(void)
+
+// modbus drivers keep every poll in register cache while gateway serves it
+static void config_gateway_locked(void)
 {
-    struct timespec ts_start;
-    clock_gettime(CLOCK_MONOTONIC, &ts_start);
+    for (downlink_t *downlink = s_adapter.downlinks; downlink; downlink = downlink->next) {
+        if (downlink->protocol == DEVICE_PROTOCOL_MODBUS_RTU || downlink->protocol == DEVICE_PROTOCOL_MODBUS_TCP) {
+            modbus_keep_cache(downlink->driver, s_adapter.gateway_port > 0);
+        }
+    }
 
-    for (ce_device_t *device = s_adapter.devices; device; device = device->next) {
-        device->ts_schedule = ts_start;
-        device->last_flush_ts.tv_nsec = device->last_flush_ts.tv_sec = 0;
-        struct timespec ts_timeout = MS2SPEC(200);
-        timespec_add(&ts_start, &ts_timeout);
+    if (modbus_gateway_config(s_adapter.gateway_port) != 0) {
+        LOGE("Failed to start modbus tcp gateway on port %ld", s_adapter.gateway_port);
     }
 }
 
 
-static int64_t consume_epoch_from_result_pipe(int fd)
+// groups whose aggregation window closed since last poll, windows are
+// aligned to wall clock so every device closes them together
+static uint32_t close_device_windows(ce_device_t *device)
 {
-    int64_t epoch = 0;
-    if (read(fd, &epoch, sizeof(epoch)) < 0) {
-        LOGE("Failed to retrive device result");
-        return -1;
-    }
+    const data_schema_t *schema = device->schema;
+    int64_t ms_now = SPEC2MS(now());
+    uint32_t windows = 0;
+
+    for (int32_t g = 0; g < schema->num_group; g++) {
+        if (schema->group_window_ms[g] <= 0) {
+            continue;
+        }
 
-    return epoch;
+        int64_t index = ms_now / schema->group_window_ms[g];
+        if (device->window_index[g] && index != device->window_index[g]) {
+            windows |= 1u << g;
+        }
+        device->window_index[g] = index;
+    }
+    return windows;
 }
 
 static void report_device_telemetry(ce_device_t *device)
 {
     bool force = false;
 
-    // force flush all data points if reach integrity period or don't support COV
-    if (device->schema->flags & FLAG_COV) {
+    if (device->pending) {
+        apply_pending_changes(device);
+    }
+
+    // samples of this poll are counted in the window it closes
+    uint32_t windows = device->telemetry ? close_device_windows(device) : 0;
+
+    send_priority_changes(device, &device->ts_acquired);
+
+    // force flush all data points if reach integrity period or don't support
+    // COV, every poll of subscribed device is for integrity
+    if (device->subscribed) {
+        force = true;
+        clock_gettime(CLOCK_MONOTONIC, &device->last_flush_ts);
+    } else if (device->schema->flags & FLAG_COV) {
         struct timespec ts;
         clock_gettime(CLOCK_MONOTONIC, &ts);
         int64_t ms_now = SPEC2MS(ts);
@@ -856,12 +3202,23 @@ static void report_device_telemetry(ce_device_t *device)
         force = true;
     }
 
-    send_telemetry_message(device, force);
+    // with every point aggregated a poll has nothing to send but failure
+    if (device->schema->num_reported > 0 || device->err) {
+        send_telemetry_message(device, force, 0, &device->trace);
+    }
+
+    if (windows) {
+        send_telemetry_message(device, true, windows, &device->trace);
+        reset_telemetry_windows(device->schema, device->telemetry, windows);
+    }
 
-    // if we don't need to support COV for this device, free up all telemetry
-    if (!(device->schema->flags & FLAG_COV)) {
+    // if we don't need to support COV for this device, free up all telemetry,
+    // unless it holds windows being aggregated
+    if (!(device->schema->flags & FLAG_COV) && !device->schema->window_groups) {
         destroy_device_telemetry(device->telemetry);
         device->telemetry = NULL;
+    } else if (device->telemetry) {
+        clear_telemetry_cov(device->telemetry);
     }
 }
 
@@ -884,96 +3241,474 @@ static void infer_driver_state(void)
     }
 }
 
-static void schedule_next_device(ce_device_t *current)
+// poll interval of a point group, group 0 is polled at device interval
+static int32_t group_interval(const ce_device_t *device, int32_t group)
 {
-    ce_device_t *next = get_next_device_to_run(current);
+    int32_t interval = group ? device->schema->group_interval[group] : device->interval;
+    if (device->cur_interval[group]) {
+        interval = device->cur_interval[group];
+    }
+    return device->subscribed ? MAX(interval, device->schema->integrity_period_ms) : interval;
+}
 
-    if (next) {
-        struct timespec ts_next_task, ts_now;
-        clock_gettime(CLOCK_MONOTONIC, &ts_now);
+// count consecutive failed polls and open breaker at ADAPTER_BREAKER_FAILURES,
+// then device is only probed with a single point read at doubling backoff so
+// a dead device doesn't hold the bus for its timeout every interval. Probe
+// answered half open the breaker and a full poll follows at once, which
+// closes it or opens it again. Return true if result is of a probe
+static bool update_breaker_locked(ce_device_t *device)
+{
+    breaker_state_t last = device->breaker;
+
+    if (device->err == DEVICE_OK) {
+        device->failures = 0;
+        if (last == BREAKER_OPEN) {
+            device->breaker = BREAKER_HALF_OPEN;
+            clock_gettime(CLOCK_MONOTONIC, &device->ts_schedule);
+            memset(device->ts_group, 0, sizeof(device->ts_group));
+        } else if (last == BREAKER_HALF_OPEN) {
+            LOGI("[%s] Device answers again, breaker closed", device->name);
+            device->breaker = BREAKER_CLOSED;
+            device->backoff_ms = 0;
+        }
+    } else if (last == BREAKER_CLOSED && ++device->failures < ADAPTER_BREAKER_FAILURES) {
+        return false;
+    } else {
+        int32_t max_backoff_ms = MAX(ADAPTER_BREAKER_MAX_BACKOFF_MS, poll_interval(device));
+        if (last == BREAKER_CLOSED) {
+            device->backoff_ms = MIN(poll_interval(device), max_backoff_ms);
+            LOGW("[%s] %d polls failed in a row, breaker open", device->name, device->failures);
+        } else {
+            device->backoff_ms = MIN((int64_t)device->backoff_ms * 2, max_backoff_ms);
+        }
+        device->breaker = BREAKER_OPEN;
+
+        // probe is scheduled from result, not from interval of device
+        struct timespec ts_backoff = MS2SPEC(device->backoff_ms);
+        clock_gettime(CLOCK_MONOTONIC, &device->ts_schedule);
+        timespec_add(&device->ts_schedule, &ts_backoff);
+    }
+
+    if (device->breaker != last) {
+        diag_log_handle(device->diag_breaker, device->breaker);
+    }
+    return last == BREAKER_OPEN;
+}
+
+// device is next polled when its earliest group is due
+static void schedule_earliest_group(ce_device_t *device)
+{
+    device->ts_schedule = device->ts_group[0];
+    for (int32_t g = 1; g < device->schema->num_group; g++) {
+        if (timespec_compare(&device->ts_group[g], &device->ts_schedule) < 0) {
+            device->ts_schedule = device->ts_group[g];
+        }
+    }
+}
+
+// stretch interval of device, or of groups just polled, while none of their
+// points changed and snap it back to configured interval on any change. Next
+// poll was scheduled with interval before, move it by the difference
+static void adapt_poll_interval_locked(ce_device_t *device)
+{
+    const data_schema_t *schema = device->schema;
+    if (device->err != DEVICE_OK || device->subscribed || !(schema->flags & FLAG_COV) || !device->telemetry) {
+        return;
+    }
+
+    uint32_t changed = 0;
+    for (int32_t i = 0; i < schema->num_point; i++) {
+        if (IS_COV(device->telemetry, i)) {
+            changed |= 1u << schema->points[i].group;
+        }
+    }
+
+    struct timespec ts_now;
+    clock_gettime(CLOCK_MONOTONIC, &ts_now);
+    bool grouped = schema->num_group > 1;
 
-        if (timespec_compare(&next->ts_schedule, &ts_now) > 0) {
-            // when schedule task, data pointed by param will not been copy over, maintain a static copy
-            // so it's still avaiable when actual posting
-            ts_next_task = next->ts_schedule;
-            timespec_subtract(&ts_next_task, &ts_now);
-            event_loop_set_timer_and_context(s_adapter.notify_timer, &ts_next_task, NULL, next);
+    for (int32_t g = 0; g < MAX(schema->num_group, 1); g++) {
+        int32_t min_ms = g ? schema->group_interval[g] : device->interval;
+        int32_t max_ms = g ? schema->group_max_interval[g] : device->max_interval;
+        if (max_ms <= min_ms || (device->poll_groups && !((device->poll_groups >> g) & 1))) {
+            continue;
+        }
+
+        int32_t old_ms = device->cur_interval[g] ? device->cur_interval[g] : min_ms;
+        int32_t new_ms = ((changed >> g) & 1) ? min_ms : MIN((int64_t)old_ms * ADAPTER_ADAPTIVE_STRETCH_PCT / 100, max_ms);
+        if (new_ms == old_ms) {
+            continue;
+        }
+
+        if (new_ms == min_ms) {
+            LOGD("[%s] Values changed, poll group %d every %d ms", device->name, g, new_ms);
+        }
+        device->cur_interval[g] = new_ms;
+
+        struct timespec *ts_next = grouped ? &device->ts_group[g] : &device->ts_schedule;
+        if (new_ms > old_ms) {
+            struct timespec ts_delta = MS2SPEC(new_ms - old_ms);
+            timespec_add(ts_next, &ts_delta);
         } else {
-            // when timer running late, reset next run to current time and schedule immediately
-            // no need to catch up, this to ensure next poll happens with specified interval
-            LOGW("Timer for %s running late", next->name);
-            next->ts_schedule = ts_now;
-            notify_worker_locked(next);
+            struct timespec ts_delta = MS2SPEC(old_ms - new_ms);
+            timespec_subtract(ts_next, &ts_delta);
+            if (timespec_compare(ts_next, &ts_now) < 0) {
+                *ts_next = ts_now;
+            }
+        }
+    }
+
+    if (grouped) {
+        schedule_earliest_group(device);
+    }
+}
+
+// pick groups to poll now, those due and those due within merge window of
+// their interval, so one read plan covers them. A group on time keeps its
+// phase, a group read early restart its interval from now so no gap between
+// reads exceeds its interval
+static void schedule_device_groups_locked(ce_device_t *device, const struct timespec *ts_now)
+{
+    const data_schema_t *schema = device->schema;
+    uint32_t groups = 0;
+
+    for (int32_t g = 0; g < schema->num_group; g++) {
+        struct timespec *ts_group = &device->ts_group[g];
+        if (!ts_group->tv_sec && !ts_group->tv_nsec) {
+            *ts_group = device->ts_schedule;
+        }
+
+        int32_t interval = group_interval(device, g);
+        struct timespec ts_merge = MS2SPEC((int64_t)interval * ADAPTER_GROUP_MERGE_PCT / 100);
+        timespec_add(&ts_merge, ts_now);
+        if (timespec_compare(ts_group, &ts_merge) > 0) {
+            continue;
+        }
+
+        groups |= 1u << g;
+        struct timespec ts_interval = MS2SPEC(interval);
+        if (timespec_compare(ts_group, ts_now) > 0) {
+            *ts_group = *ts_now;
+        }
+        timespec_add(ts_group, &ts_interval);
+        if (timespec_compare(ts_group, ts_now) <= 0) {
+            *ts_group = *ts_now;
+            timespec_add(ts_group, &ts_interval);
+        }
+    }
+
+    schedule_earliest_group(device);
+    device->poll_groups = (groups == (1u << schema->num_group) - 1) ? 0 : groups;
+}
+
+// queue every idle device which is due and arm timer for the nearest one,
+// busy devices are not in heap and get pushed back when their result arrive
+static void schedule_devices_locked(void)
+{
+    struct timespec ts_now;
+    clock_gettime(CLOCK_MONOTONIC, &ts_now);
+
+    ce_device_t *device = NULL;
+
+    while ((device = sched_peek_locked()) != NULL && timespec_compare(&device->ts_schedule, &ts_now) <= 0) {
+        sched_pop_locked();
+
+        struct timespec ts_late = ts_now;
+        timespec_subtract(&ts_late, &device->ts_schedule);
+        device->late_ms = SPEC2MS(ts_late);
+        if (device->late_ms > device->max_late_ms) {
+            device->max_late_ms = device->late_ms;
         }
+
+        // next probe is scheduled when result of this one arrives
+        if (device->breaker == BREAKER_OPEN) {
+            enqueue_device_locked(device);
+            continue;
+        }
+
+        if (device->schema->num_group > 1) {
+            schedule_device_groups_locked(device, &ts_now);
+            enqueue_device_locked(device);
+            continue;
+        }
+
+        // use device->schedule instead of now() to avoid drifting
+        struct timespec ts_interval = MS2SPEC(poll_interval(device));
+        timespec_add(&device->ts_schedule, &ts_interval);
+
+        if (timespec_compare(&device->ts_schedule, &ts_now) <= 0) {
+            // when running late, reset next run based on current time, no need
+            // to catch up, this to ensure next poll happens with specified interval
+            LOGW("Timer for %s running late", device->name);
+            device->ts_schedule = ts_now;
+            timespec_add(&device->ts_schedule, &ts_interval);
+        }
+        enqueue_device_locked(device);
+    }
+
+    ce_device_t *next = sched_peek_locked();
+    if (next) {
+        struct timespec ts_next_task = next->ts_schedule;
+        timespec_subtract(&ts_next_task, &ts_now);
+        event_loop_set_timer(s_adapter.notify_timer, &ts_next_task, NULL);
+    } else {
+        event_loop_cancel_timer(s_adapter.notify_timer);
     }
 }
 
+static void schedule_devices_callback(void *context)
+{
+    pthread_mutex_lock(&s_adapter.mutex);
+    schedule_devices_locked();
+    pthread_mutex_unlock(&s_adapter.mutex);
+}
+
 static void handle_device_result(EventLoop *eloop, int fd, EventLoop_IoEvents events, void *context)
 {
-    if (consume_epoch_from_result_pipe(fd) != s_adapter.provision_epoch) {
-        LOGW("Stale result, ignore");
+    device_result_t results[ADAPTER_RESULT_BATCH];
+    int nresult = consume_results_from_result_pipe(fd, results, ADAPTER_RESULT_BATCH);
+    if (nresult <= 0) {
         return;
     }
 
     pthread_mutex_lock(&s_adapter.mutex);
 
-    if (s_adapter.ready_device) {
-        report_device_telemetry(s_adapter.ready_device);
+    bool updated = false;
+    for (int i = 0; i < nresult; i++) {
+        if (results[i].epoch != s_adapter.provision_epoch) {
+            LOGW("Stale result, ignore");
+            continue;
+        }
 
-        infer_driver_state();
+        ce_device_t *device = results[i].device;
+        device->busy = false;
+        bool probed = update_breaker_locked(device);
+        if (!probed) {
+            adapt_poll_interval_locked(device);
+        }
+        sched_push_locked(device);
+        if (!probed) {
+            report_device_telemetry(device);
+        }
 
-        if (s_adapter.ready_device->err == DEVICE_OK) {
-            diag_log_value(s_adapter.ready_device->name, s_adapter.ready_device->poll_duration);
+        if (device->err == DEVICE_OK) {
+            diag_log_handle(device->diag_poll, device->poll_duration);
         }
+        log_device_lateness(device);
+        updated = true;
     }
 
-    schedule_next_device(s_adapter.ready_device);
-    s_adapter.ready_device = NULL;
+    if (updated) {
+        infer_driver_state();
+        schedule_devices_locked();
+    }
 
     pthread_mutex_unlock(&s_adapter.mutex);
-    MEMORY_REPORT(0);
 }
 
 
-static void post_epoch_to_result_pipe(void)
+// broadcast a point write on downlink, no slave acknowledge it
+static err_code write_bus_broadcast(downlink_t *downlink, bus_write_t *write)
+{
+    device_driver_t *driver = downlink->driver;
+    int32_t timeout = write->schema->timeout;
+
+    if (!downlink->opened) {
+        if (driver->driver_open(driver, MODBUS_BROADCAST_ID, timeout) != DEVICE_OK) {
+            LOGE("Failed to open driver");
+            return DEVICE_E_INVALID;
+        }
+        downlink->opened = true;
+    }
+
+    err_code err = driver->set_point(driver, MODBUS_BROADCAST_ID, write->key, write->value, write->schema, timeout);
+    if (err) {
+        LOGE("Broadcast %s=%s on %s failed: %s", write->key, write->value, downlink->conn_str, err_str(err));
+    } else {
+        LOGI("Broadcast %s=%s on %s", write->key, write->value, downlink->conn_str);
+    }
+    return err;
+}
+
+static void post_result_to_result_pipe_locked(ce_device_t *device)
 {
-    if (write(s_adapter.result_pipe[PIPE_WRITE_END],
-            &s_adapter.provision_epoch, sizeof(s_adapter.provision_epoch)) <= 0) {
+    device_result_t result = {.epoch = s_adapter.provision_epoch, .device = device};
+
+    if (write(s_adapter.result_pipe[PIPE_WRITE_END], &result, sizeof(result)) != sizeof(result)) {
         LOGE("Failed to post result");
     }
 }
 
 static void *device_worker_thread(void *vargp)
 {
-    while (g_app_running) {
+    pthread_mutex_lock(&s_adapter.mutex);
+
+    while (g_app_running && !s_adapter.stopping) {
+        struct timespec ts_now, ts_wake = {0, 0};
+        ce_device_t *device = NULL;
+        clock_gettime(CLOCK_MONOTONIC, &ts_now);
+
+        downlink_t *downlink = pick_ready_downlink_locked(&ts_now, &ts_wake, &device);
+        if (!downlink) {
+            // devices queued behind slave gaps get due without any signal
+            if (ts_wake.tv_sec || ts_wake.tv_nsec) {
+                pthread_cond_timedwait(&s_adapter.cond, &s_adapter.mutex, &ts_wake);
+            } else {
+                pthread_cond_wait(&s_adapter.cond, &s_adapter.mutex);
+            }
+            continue;
+        }
+
+        bus_write_t *write = NULL;
+        if (device) {
+            remove_queued_device_locked(downlink, device);
+            device->slave->ts_start = ts_now;
+        } else {
+            write = downlink->write_head;
+            downlink->write_head = write->next;
+            if (!downlink->write_head) {
+                downlink->write_tail = NULL;
+            }
+        }
+        downlink->inflight++;
+        s_adapter.inflight++;
+        pthread_mutex_unlock(&s_adapter.mutex);
+
+        // poll without holding lock so other downlinks proceed in parallel
+        struct timespec busy_sw;
+        timer_stopwatch_start(&busy_sw);
+        int32_t poll_duration = 0;
+        err_code err = DEVICE_OK;
+        if (write) {
+            err = write_bus_broadcast(downlink, write);
+        } else if (device->breaker == BREAKER_OPEN) {
+            err = probe_device(device);
+        } else {
+            err = query_device(device, &poll_duration);
+        }
+        int32_t busy_ms = timer_stopwatch_stop(&busy_sw);
+
         pthread_mutex_lock(&s_adapter.mutex);
-        if (!s_adapter.pending_device) {
-            pthread_cond_wait(&s_adapter.cond, &s_adapter.mutex);
+        account_bus_time_locked(downlink, busy_ms);
+        if (write) {
+            destroy_bus_write(write);
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &device->slave->ts_end);
+            device->err = err;
+            if (err == DEVICE_OK) {
+                device->poll_duration = poll_duration;
+                device->ts_acquired = device->slave->ts_end;
+            }
+            post_result_to_result_pipe_locked(device);
         }
-        if (s_adapter.pending_device) {
-            // use device->schedule instead of now() to avoid drifting
-            struct timespec ts_interval = MS2SPEC(s_adapter.pending_device->interval);
-            timespec_add(&s_adapter.pending_device->ts_schedule, &ts_interval);
-            query_device(s_adapter.pending_device);
 
-            s_adapter.ready_device = s_adapter.pending_device;
-            s_adapter.pending_device = NULL;
+        downlink->inflight--;
+        if (--s_adapter.inflight == 0) {
+            pthread_cond_broadcast(&s_adapter.idle_cond);
+        }
 
-            post_epoch_to_result_pipe();
+        // downlink slot freed, let another worker pick up queued device
+        if (downlink->queue_head || downlink->write_head) {
+            pthread_cond_signal(&s_adapter.cond);
         }
-        pthread_mutex_unlock(&s_adapter.mutex);
     }
+
+    pthread_mutex_unlock(&s_adapter.mutex);
     return NULL;
 }
 
+// apply provision built from image or scanned from data of provision JSON,
+// recording its image if image is given. Return true if a changed provision
+// is applied
+static bool apply_provision(int64_t epoch, uint64_t content_hash, const struct json_token *t_data,
+                            const uint8_t *image, size_t image_size, prov_image_t *record)
+{
+    bool applied = false;
+    LOGD("apply_provision: epoch=%lld, hash=%016llx", epoch, (unsigned long long)content_hash);
+
+    iot_report_device_twin_async("{\"provision\":null}", NULL, NULL);
+
+    pthread_mutex_lock(&s_adapter.mutex);
+
+    // e.g. twin resync after reconnect, or same provision pushed again under a
+    // new epoch: devices keep polling, nothing is rebuilt or written to storage
+    if (epoch == s_adapter.provision_epoch ||
+        (s_adapter.provision_hash != 0 && content_hash == s_adapter.provision_hash)) {
+        diag_log_event(EVENT_PROVISION);
+        LOGI("provision is not changed");
+    }
+    else {
+        event_loop_cancel_timer(s_adapter.notify_timer);
+        drain_workers_locked();
+        // keep previous provision until new one is parsed so what didn't change
+        // is taken over instead of rebuilt
+        move_provision(&s_prev_provision, &s_adapter);
+        reset_adapter(&s_adapter);
+        s_adapter.prev = &s_prev_provision;
+        s_adapter.arena = arena_create(ADAPTER_PROVISION_ARENA_CHUNK);
+        if (image) {
+            load_provision_image(&s_adapter, image, image_size);
+        } else if (t_data->ptr) {
+            s_adapter.image = record;
+            scan_provision(t_data->ptr, t_data->len, &s_adapter);
+            s_adapter.image = NULL;
+        }
+        s_adapter.prev = NULL;
+        release_provision(&s_prev_provision);
+        LOGD("Provision parsed into %zu bytes", arena_size(s_adapter.arena));
+
+        if (is_adapter_valid(&s_adapter)) {
+            network_config(&s_adapter.uplink, &s_adapter.downlink);
+            s_adapter.provision_epoch = epoch;
+            s_adapter.provision_hash = content_hash;
+            telemetry_batch_config(s_adapter.encoding == TELEMETRY_ENCODING_CBOR, s_adapter.batch_size,
+                                   s_adapter.batch_latency_ms);
+            config_gateway_locked();
+
+            if (s_adapter.num_device > 0) {
+                if (s_adapter.restore_state) {
+                    restore_telemetry_state_locked();
+                }
+                distribute_device_query_time();
+                schedule_devices_locked();
+            }
+            diag_log_event(EVENT_PROVISION);
+            LOGI("provision succeed");
+            applied = true;
+        }
+        else {
+            reset_adapter(&s_adapter);
+            modbus_gateway_config(0);
+            diag_log_event(EVENT_PROVISION_FAILED);
+            LOGE("provision failed");
+        }
+    }
+
+    clock_gettime(CLOCK_BOOTTIME, &s_adapter.last_provisioned);
+    pthread_mutex_unlock(&s_adapter.mutex);
+    return applied;
+}
+
 static void apply_local_provision(void)
 {
     s_adapter.provision_epoch = 0;
+    struct prov_file_hdr_t hdr;
     char *local_provision = NULL;
-    if (load_local_provision(&local_provision) == 0) {
-        adapter_provision(local_provision, strlen(local_provision), false);
+    uint8_t *image = NULL;
+    if (load_local_provision(&hdr, &local_provision, &image) != 0) {
+        return;
+    }
+
+    s_adapter.restore_state = true;
+    if (image) {
+        apply_provision(hdr.epoch, hdr.content_hash, NULL, image, hdr.image_size, NULL);
+        FREE(image);
+    } else {
+        // image of other version is saved again, by the version now running
+        adapter_provision(local_provision, strlen(local_provision), hdr.image_version != PROV_IMAGE_VERSION);
         FREE(local_provision);
     }
+    s_adapter.restore_state = false;
 }
 // ---------------------------- public interface ------------------------------
 
@@ -981,7 +3716,19 @@ int adapter_init(EventLoop *eloop)
 {
     LOGI("adapter init");
 
+    // adapter may be initialized again after adapter_deinit()
     s_adapter.eloop = eloop;
+    s_adapter.stopping = false;
+    s_adapter.inflight = 0;
+    s_adapter.num_worker = 0;
+    s_adapter.state_timer = NULL;
+    s_poll_hist = diag_histogram("poll_ms");
+    s_alarm_hist = diag_histogram("alarm_ms");
+    s_wire_hist = diag_histogram("trace_wire_ms");
+    s_decode_hist = diag_histogram("trace_decode_ms");
+    s_queue_hist = diag_histogram("trace_queue_ms");
+    s_deliver_hist = diag_histogram("trace_deliver_ms");
+    s_age_hist = diag_histogram("trace_age_ms");
 
     if (pipe(s_adapter.result_pipe) == -1) {
         LOGE("Failed to create device result queue");
@@ -994,28 +3741,60 @@ int adapter_init(EventLoop *eloop)
         return -1;
     }
 
-    s_adapter.notify_timer = event_loop_register_timer(eloop, NULL, NULL, notify_worker_callback, NULL);
+    s_adapter.notify_timer = event_loop_register_timer(eloop, NULL, NULL, NULL, schedule_devices_callback, NULL);
     if (!s_adapter.notify_timer) {
         LOGE("Failed to register notify timer for device");
         return -1;
     }
 
+    if (telemetry_batch_init(eloop, batch_telemetry_delivered) != 0) {
+        return -1;
+    }
+
+    if (telemetry_store_init(eloop) != 0) {
+        return -1;
+    }
+
+    if (modbus_gateway_init(eloop, read_gateway_unit) != 0) {
+        return -1;
+    }
+
+    if (TELEMETRY_STATE_SAVE_MS > 0) {
+        struct timespec ts_save = MS2SPEC(TELEMETRY_STATE_SAVE_MS);
+        s_adapter.state_timer =
+            event_loop_register_timer(eloop, &ts_save, &ts_save, NULL, save_telemetry_state_callback, NULL);
+    }
+
     if (pthread_mutex_init(&s_adapter.mutex, NULL) != 0) {
         LOGE("Failed to create mutex");
         return -1;
     }
 
-    if (pthread_cond_init(&s_adapter.cond, NULL) != 0) {
+    // workers wait on cond until a slave gap ends, timed by CLOCK_MONOTONIC
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    int ret = pthread_cond_init(&s_adapter.cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    if (ret != 0) {
         perror("pthread_cond_init() error");
         return -1;
     }
 
-    // thread need to be created after pipe open
-    if (pthread_create(&s_adapter.worker_tid, NULL, device_worker_thread, &s_adapter) != 0) {
-        LOGE("Failed to create worker thread");
+    if (pthread_cond_init(&s_adapter.idle_cond, NULL) != 0) {
+        perror("pthread_cond_init() error");
         return -1;
     }
 
+    // thread need to be created after pipe open
+    for (int i = 0; i < ADAPTER_WORKER_THREADS; i++) {
+        if (pthread_create(&s_adapter.worker_tids[i], NULL, device_worker_thread, &s_adapter) != 0) {
+            LOGE("Failed to create worker thread");
+            return -1;
+        }
+        s_adapter.num_worker++;
+    }
+
     apply_local_provision();
 
     return 0;
@@ -1024,15 +3803,35 @@ int adapter_init(EventLoop *eloop)
 
 void adapter_deinit()
 {
-    pthread_cond_signal(&s_adapter.cond);
-    pthread_join(s_adapter.worker_tid, NULL);
+    pthread_mutex_lock(&s_adapter.mutex);
+    s_adapter.stopping = true;
+    pthread_cond_broadcast(&s_adapter.cond);
+    pthread_mutex_unlock(&s_adapter.mutex);
+
+    for (int i = 0; i < s_adapter.num_worker; i++) {
+        pthread_join(s_adapter.worker_tids[i], NULL);
+    }
+    s_adapter.num_worker = 0;
+
+    // workers are gone, telemetry of every device can be read
+    if (s_adapter.num_device > 0) {
+        telemetry_state_save(s_adapter.devices, s_adapter.provision_epoch);
+    }
+
     pthread_mutex_destroy(&s_adapter.mutex);
     pthread_cond_destroy(&s_adapter.cond);
+    pthread_cond_destroy(&s_adapter.idle_cond);
 
     EventLoop_UnregisterIo(s_adapter.eloop, s_adapter.result_io);
     close(s_adapter.result_pipe[PIPE_READ_END]);
     close(s_adapter.result_pipe[PIPE_WRITE_END]);
     event_loop_unregister_timer(s_adapter.eloop, s_adapter.notify_timer);
+    if (s_adapter.state_timer) {
+        event_loop_unregister_timer(s_adapter.eloop, s_adapter.state_timer);
+    }
+    telemetry_batch_deinit();
+    telemetry_store_deinit();
+    modbus_gateway_deinit();
 
     reset_adapter(&s_adapter);
 }
@@ -1042,46 +3841,65 @@ void adapter_provision(const char *provision, size_t provision_size, bool flush)
     ASSERT(provision);
 
     int64_t epoch;
-    json_scanf(provision, provision_size, "{epoch:%lld}", &epoch);
-    LOGD("adapter_provision: epoch=%lld", epoch);
+    struct json_token t_data = {.ptr = NULL, .len = 0, .type = JSON_TYPE_INVALID};
+    json_scanf(provision, provision_size, "{epoch:%lld,data:%T}", &epoch, &t_data);
+    uint64_t content_hash = definition_hash(t_data.ptr, t_data.len);
 
-    iot_report_device_twin_async("{\"provision\":null}", NULL, NULL);
+    prov_image_t image = {.buf = NULL, .len = 0, .size = 0, .failed = false};
+    if (apply_provision(epoch, content_hash, &t_data, NULL, 0, flush ? &image : NULL) && flush) {
+        save_local_provision(provision, provision_size, &image, epoch, content_hash);
+    }
+    FREE(image.buf);
+}
+
+int adapter_broadcast_point(const char *schema_name, const char *key, const char *value)
+{
+    ASSERT(schema_name);
+    ASSERT(key);
+    ASSERT(value);
 
     pthread_mutex_lock(&s_adapter.mutex);
 
-    if (epoch == s_adapter.provision_epoch) {
-        diag_log_event(EVENT_PROVISION);
-        LOGI("provision is not changed");
+    data_schema_t *schema = parse_schema(s_adapter.schemas, schema_name);
+    if (!schema || find_read_point_index(schema, key) < 0) {
+        pthread_mutex_unlock(&s_adapter.mutex);
+        LOGE("Can't broadcast invalid point %s:%s", schema_name, key);
+        return -1;
     }
-    else {
-        reset_adapter(&s_adapter);
-        json_scanf(provision, provision_size, "{data:%M}", scan_provision, &s_adapter);
-        event_loop_cancel_timer(s_adapter.notify_timer);
 
-        if (is_adapter_valid(&s_adapter)) {
-            network_config(&s_adapter.uplink, &s_adapter.downlink);
-            if (flush) {
-                save_local_provision(provision, provision_size);
-            }
-            s_adapter.provision_epoch = epoch;
+    int num_downlink = 0;
+    for (downlink_t *downlink = s_adapter.downlinks; downlink; downlink = downlink->next) {
+        if ((downlink->protocol != DEVICE_PROTOCOL_MODBUS_RTU && downlink->protocol != DEVICE_PROTOCOL_MODBUS_TCP) ||
+            !downlink->driver->set_point) {
+            continue;
+        }
 
-            if (s_adapter.num_device > 0) {
-                distribute_device_query_time();
-                notify_worker_locked(s_adapter.devices);
-            }
-            diag_log_event(EVENT_PROVISION);
-            LOGI("provision succeed");
+        ce_device_t *device = s_adapter.devices;
+        while (device && (device->downlink != downlink || device->schema != schema)) {
+            device = device->next;
         }
-        else {
-            reset_adapter(&s_adapter);
-            diag_log_event(EVENT_PROVISION_FAILED);
-            LOGE("provision failed");
+        if (!device) {
+            continue;
+        }
+
+        bus_write_t *write = (bus_write_t *)CALLOC(1, sizeof(bus_write_t));
+        write->schema = schema;
+        write->key = STRDUP(key);
+        write->value = STRDUP(value);
+        if (downlink->write_tail) {
+            downlink->write_tail->next = write;
+        } else {
+            downlink->write_head = write;
         }
+        downlink->write_tail = write;
+        num_downlink++;
     }
 
-    clock_gettime(CLOCK_BOOTTIME, &s_adapter.last_provisioned);
+    if (num_downlink > 0) {
+        pthread_cond_broadcast(&s_adapter.cond);
+    }
     pthread_mutex_unlock(&s_adapter.mutex);
-    MEMORY_REPORT(0);
+    return num_downlink;
 }
 
 const char *adapter_get_name(void)
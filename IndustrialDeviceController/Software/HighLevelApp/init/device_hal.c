@@ -9,17 +9,29 @@
 #include <init/globals.h>
 #include <init/device_hal.h>
 #include <frozen/frozen.h>
+#include <utils/arena.h>
+#include <utils/expr.h>
 #include <utils/llog.h>
 #include <utils/utils.h>
 #include <driver/modbus.h>
+#include <driver/pulse.h>
+#include <driver/bacnet.h>
 
-// must align with device_protocol_t enum
-static const char *protocol_str[] = {
-    "INVALID",
-    "MODBUS_TCP",
-    "MODBUS_RTU"
+// protocol drivers, a new protocol only need an entry here and its value in
+// device_protocol_t
+static const protocol_driver_t protocol_drivers[] = {
+    {DEVICE_PROTOCOL_MODBUS_TCP, "MODBUS_TCP", modbus_create_point_table, modbus_destroy_point_table,
+     modbus_create_read_plan, modbus_destroy_read_plan, modbus_create_driver, modbus_destroy_driver},
+    {DEVICE_PROTOCOL_MODBUS_RTU, "MODBUS_RTU", modbus_create_point_table, modbus_destroy_point_table,
+     modbus_create_read_plan, modbus_destroy_read_plan, modbus_create_driver, modbus_destroy_driver},
+    {DEVICE_PROTOCOL_PULSE, "PULSE", pulse_create_point_table, pulse_destroy_point_table,
+     pulse_create_read_plan, pulse_destroy_read_plan, pulse_create_driver, pulse_destroy_driver},
+    {DEVICE_PROTOCOL_BACNET_IP, "BACNET_IP", bacnet_create_point_table, bacnet_destroy_point_table,
+     bacnet_create_read_plan, bacnet_destroy_read_plan, bacnet_create_driver, bacnet_destroy_driver},
 };
 
+#define NUM_PROTOCOL_DRIVERS (sizeof(protocol_drivers) / sizeof(protocol_drivers[0]))
+
 static const char *error_name[] = {
     "DEVICE_OK",
     "DEVICE_E_INVALID",
@@ -39,17 +51,26 @@ const char *err_str(err_code err)
 }
 
 
-err_code create_point_table(device_protocol_t protocol, struct json_token *points_def, int* npoints, data_point_t **ppoints)
+const protocol_driver_t *find_protocol_driver(device_protocol_t protocol)
 {
-    switch (protocol) {
-    case DEVICE_PROTOCOL_MODBUS_RTU:
-    case DEVICE_PROTOCOL_MODBUS_TCP:
-        return modbus_create_point_table(points_def, npoints, ppoints);
+    for (size_t i = 0; i < NUM_PROTOCOL_DRIVERS; i++) {
+        if (protocol_drivers[i].protocol == protocol) {
+            return &protocol_drivers[i];
+        }
+    }
+    return NULL;
+}
+
 
-    default:
+err_code create_point_table(device_protocol_t protocol, struct json_token *points_def, int* npoints, data_point_t **ppoints)
+{
+    const protocol_driver_t *pd = find_protocol_driver(protocol);
+    if (!pd) {
         LOGE("Invalid protocol:%d", protocol);
         return DEVICE_E_INVALID;
     }
+
+    return pd->create_point_table(points_def, npoints, ppoints);
 }
 
 
@@ -57,30 +78,169 @@ void destroy_point_table(device_protocol_t protocol, data_point_t *points, int n
 {
     ASSERT(points);
 
-    switch (protocol) {
-    case DEVICE_PROTOCOL_MODBUS_RTU:
-    case DEVICE_PROTOCOL_MODBUS_TCP:
-        modbus_destroy_point_table(points, npoints);
-        break;
+    const protocol_driver_t *pd = find_protocol_driver(protocol);
+    if (!pd) {
+        LOGE("Invalid protocol:%d", protocol);
+        return;
+    }
+
+    pd->destroy_point_table(points, npoints);
+}
+
+
+static uint32_t hash_key(const char *key)
+{
+    return hash((const unsigned char *)key, strlen(key));
+}
+
+
+void create_point_index(data_schema_t *schema)
+{
+    ASSERT(schema);
+
+    // keep load factor no more than 0.5 so probe sequence stay short
+    uint32_t size = 1;
+    while (size < 2u * schema->num_point) {
+        size <<= 1;
+    }
+
+    schema->key_index = (int32_t *)MALLOC(size * sizeof(int32_t));
+    schema->key_index_mask = size - 1;
+    for (uint32_t i = 0; i < size; i++) {
+        schema->key_index[i] = -1;
+    }
+
+    // djb2 continued over all keys and their null terminator
+    schema->key_hash = 5381;
+
+    // linear probing, for duplicated keys the first one sits earlier in the
+    // probe sequence so lookup returns the first defined point
+    for (int i = 0; i < schema->num_point; i++) {
+        const char *key = schema->points[i].key;
+        for (size_t k = 0; k <= strlen(key); k++) {
+            schema->key_hash = ((schema->key_hash << 5) + schema->key_hash) + (unsigned char)key[k];
+        }
+
+        uint32_t slot = hash_key(key) & schema->key_index_mask;
+
+        while (schema->key_index[slot] >= 0) {
+            slot = (slot + 1) & schema->key_index_mask;
+        }
+        schema->key_index[slot] = i;
+    }
+}
+
+
+void destroy_point_index(data_schema_t *schema)
+{
+    ASSERT(schema);
+
+    FREE(schema->key_index);
+    schema->key_index = NULL;
+    schema->key_index_mask = 0;
+}
+
+
+int find_point_index(const data_schema_t *schema, const char *key)
+{
+    ASSERT(schema);
+    ASSERT(key);
+
+    if (!schema->key_index) {
+        for (int i = 0; i < schema->num_point; i++) {
+            if (strcmp(schema->points[i].key, key) == 0) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    uint32_t slot = hash_key(key) & schema->key_index_mask;
+
+    while (schema->key_index[slot] >= 0) {
+        int i = schema->key_index[slot];
+        if (strcmp(schema->points[i].key, key) == 0) {
+            return i;
+        }
+        slot = (slot + 1) & schema->key_index_mask;
+    }
+
+    return -1;
+}
+
+
+int find_read_point_index(const data_schema_t *schema, const char *key)
+{
+    int index = find_point_index(schema, key);
+    return index < schema->num_read_point ? index : -1;
+}
+
 
-    default:
+err_code create_read_plan(device_protocol_t protocol, data_schema_t *schema)
+{
+    const protocol_driver_t *pd = find_protocol_driver(protocol);
+    if (!pd) {
         LOGE("Invalid protocol:%d", protocol);
+        return DEVICE_E_INVALID;
+    }
+
+    schema->plan_groups = 0;
+    err_code err = pd->create_read_plan(schema, &schema->read_plan);
+
+    // plan of each set of groups due together, merged at load time so a poll
+    // only pick one
+    uint32_t all_groups = (1u << schema->num_group) - 1;
+    for (uint32_t groups = 1; !err && schema->num_group > 1 && groups < all_groups; groups++) {
+        schema->plan_groups = groups;
+        err = pd->create_read_plan(schema, &schema->group_plans[groups]);
     }
+    schema->plan_groups = 0;
+
+    return err;
 }
 
 
-device_driver_t *create_driver(device_protocol_t protocol, const char *conn_str)
+void destroy_read_plan(device_protocol_t protocol, void *plan)
+{
+    ASSERT(plan);
+
+    const protocol_driver_t *pd = find_protocol_driver(protocol);
+    if (!pd) {
+        LOGE("Invalid protocol:%d", protocol);
+        return;
+    }
+
+    pd->destroy_read_plan(plan);
+}
+
+
+void destroy_schema_plans(data_schema_t *schema)
 {
-    switch(protocol) {
-    case DEVICE_PROTOCOL_MODBUS_RTU:
-    case DEVICE_PROTOCOL_MODBUS_TCP:
-        return modbus_create_driver(protocol, conn_str);
+    ASSERT(schema);
+
+    if (schema->read_plan) {
+        destroy_read_plan(schema->protocol, schema->read_plan);
+        schema->read_plan = NULL;
+    }
+
+    for (int32_t i = 0; i < (1 << SCHEMA_MAX_GROUPS); i++) {
+        if (schema->group_plans[i]) {
+            destroy_read_plan(schema->protocol, schema->group_plans[i]);
+            schema->group_plans[i] = NULL;
+        }
+    }
+}
 
-    default:
+
+device_driver_t *create_driver(device_protocol_t protocol, const char *conn_str)
+{
+    const protocol_driver_t *pd = find_protocol_driver(protocol);
+    if (!pd) {
         LOGE("Invalid protocol:%d", protocol);
         return NULL;
     }
-    return NULL;
+
+    return pd->create_driver(protocol, conn_str);
 }
 
 
@@ -88,15 +248,13 @@ void destroy_driver(device_driver_t *driver)
 {
     ASSERT(driver);
 
-    switch (driver->get_protocol(driver)) {
-    case DEVICE_PROTOCOL_MODBUS_RTU:
-    case DEVICE_PROTOCOL_MODBUS_TCP:
-        modbus_destroy_driver(driver);
-        break;
-
-    default:
+    const protocol_driver_t *pd = find_protocol_driver(driver->get_protocol(driver));
+    if (!pd) {
         LOGE("Invalid protocol");
+        return;
     }
+
+    pd->destroy_driver(driver);
 }
 
 
@@ -104,12 +262,10 @@ device_protocol_t str2protocol(const char *str)
 {
     ASSERT(str);
 
-    int nprotocols = sizeof(protocol_str) / sizeof(protocol_str[0]);
-
-    for (int i = 0; i < nprotocols; i++) {
-
-        if (strcmp(str, protocol_str[i]) == 0)
-            return i;
+    for (size_t i = 0; i < NUM_PROTOCOL_DRIVERS; i++) {
+        if (strcmp(str, protocol_drivers[i].name) == 0) {
+            return protocol_drivers[i].protocol;
+        }
     }
 
     return DEVICE_PROTOCOL_INVALID;
@@ -117,12 +273,92 @@ device_protocol_t str2protocol(const char *str)
 
 const char *protocol2str(const device_protocol_t protocol)
 {
-    unsigned int nprotocols = sizeof(protocol_str) / sizeof(protocol_str[0]);
+    const protocol_driver_t *pd = find_protocol_driver(protocol);
+    return pd ? pd->name : "INVALID";
+}
 
-    if (protocol >= 0 && protocol < nprotocols) {
-        return protocol_str[protocol];
-    } else {
-        return protocol_str[DEVICE_PROTOCOL_INVALID];
+// arena block size of long strings, a few long strings of a device share one block
+#define TELEMETRY_STR_ARENA_CHUNK 512
+
+// copy live long strings into a new arena and drop the stale ones
+static void compact_telemetry_strings(telemetry_t *telemetry)
+{
+    arena_t *arena = arena_create(TELEMETRY_STR_ARENA_CHUNK);
+
+    for (int i = 0; i < telemetry->num_values; i++) {
+        telemetry_str_t *slot = &telemetry->strs[i];
+        if (slot->ext) {
+            char *ext = (char *)arena_alloc(arena, slot->cap);
+            strcpy(ext, slot->ext);
+            slot->ext = ext;
+        }
+    }
+
+    arena_destroy(telemetry->str_arena);
+    telemetry->str_arena = arena;
+    telemetry->str_stale = 0;
+}
+
+static void release_telemetry_string(telemetry_t *telemetry, telemetry_str_t *slot)
+{
+    if (slot->ext) {
+        telemetry->str_stale += slot->cap;
+        slot->ext = NULL;
+        slot->cap = 0;
+    }
+}
+
+static void store_telemetry_string(telemetry_t *telemetry, int index, const char *str_value)
+{
+    if (!telemetry->strs) {
+        telemetry->strs = (telemetry_str_t *)CALLOC(telemetry->num_values, sizeof(telemetry_str_t));
+    }
+
+    telemetry_str_t *slot = &telemetry->strs[index];
+    size_t len = strlen(str_value);
+
+    if (len < TELEMETRY_INLINE_STR) {
+        release_telemetry_string(telemetry, slot);
+        memcpy(slot->buf, str_value, len + 1);
+        return;
+    }
+
+    if (slot->ext && len < slot->cap) {
+        memcpy(slot->ext, str_value, len + 1);
+        return;
+    }
+
+    release_telemetry_string(telemetry, slot);
+    if (!telemetry->str_arena) {
+        telemetry->str_arena = arena_create(TELEMETRY_STR_ARENA_CHUNK);
+    } else if (telemetry->str_stale > arena_size(telemetry->str_arena) / 2) {
+        compact_telemetry_strings(telemetry);
+    }
+
+    // leave room to grow, so a string of varying length keeps its slot
+    slot->cap = len + 1 + len / 2;
+    slot->ext = (char *)arena_alloc(telemetry->str_arena, slot->cap);
+    memcpy(slot->ext, str_value, len + 1);
+}
+
+const char *get_telemetry_string_value(const telemetry_t *telemetry, int index)
+{
+    const telemetry_str_t *slot = &telemetry->strs[index];
+    return slot->ext ? slot->ext : slot->buf;
+}
+
+void destroy_telemetry_strings(telemetry_t *telemetry)
+{
+    arena_destroy(telemetry->str_arena);
+    telemetry->str_arena = NULL;
+    telemetry->str_stale = 0;
+    FREE(telemetry->strs);
+}
+
+static void set_reported_value(telemetry_t *telemetry, int index, double value)
+{
+    if (telemetry->reported) {
+        telemetry->reported[index] = value;
     }
 }
 
@@ -138,51 +374,119 @@ void update_telemetry_value(telemetry_t *telemetry, int index, const char *str_v
     bool was_str = test_mask(telemetry->str_mask, index);
 
     if (!is_str && !was_str) {
-        if (is_double_equal(num_value, telemetry->values[index].num)) {
+        if (is_double_equal(num_value, telemetry->nums[index])) {
             clear_mask(telemetry->cov_mask, index);
         } else {
-            telemetry->values[index].num = num_value;
+            telemetry->nums[index] = num_value;
+            set_reported_value(telemetry, index, num_value);
             set_mask(telemetry->cov_mask, index);
         }
     } else if (is_str && was_str) {
-        if (strcmp(str_value, telemetry->values[index].str) == 0) {
+        if (strcmp(str_value, get_telemetry_string_value(telemetry, index)) == 0) {
             clear_mask(telemetry->cov_mask, index);
         } else {
-            FREE(telemetry->values[index].str);
-            telemetry->values[index].str = STRDUP(str_value);
+            store_telemetry_string(telemetry, index, str_value);
             set_mask(telemetry->cov_mask, index);
         }
     } else if (is_str && !was_str) {
         set_mask(telemetry->str_mask, index);
-        telemetry->values[index].str = STRDUP(str_value);
+        store_telemetry_string(telemetry, index, str_value);
+        telemetry->nums[index] = NAN;
+        set_reported_value(telemetry, index, NAN);
         set_mask(telemetry->cov_mask, index);
     } else if (!is_str && was_str) {
         clear_mask(telemetry->str_mask, index);
-        FREE(telemetry->values[index].str);
-        telemetry->values[index].num = num_value;
+        release_telemetry_string(telemetry, &telemetry->strs[index]);
+        telemetry->nums[index] = num_value;
+        set_reported_value(telemetry, index, num_value);
         set_mask(telemetry->cov_mask, index);
     }
 }
 
-void set_telemetry_number_value(telemetry_t *telemetry, int index, double num_value)
+static bool is_within_deadband(const data_point_t *point, double last, double value)
 {
-    clear_mask(telemetry->str_mask, index);
-    if (is_double_equal(telemetry->values[index].num, num_value)) {
+    if (is_double_equal(last, value)) {
+        return true;
+    }
+
+    // always report change from or to unavailable value
+    if (!point || point->deadband <= 0 || isnan(last) || isnan(value)) {
+        return false;
+    }
+
+    double band = point->deadband_percent ? fabs(last) * point->deadband / 100 : point->deadband;
+    return fabs(value - last) <= band;
+}
+
+void set_telemetry_number_value(telemetry_t *telemetry, int index, double num_value, const data_point_t *point)
+{
+    if (test_mask(telemetry->str_mask, index)) {
+        clear_mask(telemetry->str_mask, index);
+        release_telemetry_string(telemetry, &telemetry->strs[index]);
+    }
+
+    // aggregated point reports its window, deadband of single value doesn't apply
+    bool aggregated = point && point->aggregated;
+    if (aggregated && telemetry->window && !isnan(num_value)) {
+        telemetry_window_t *window = &telemetry->window[index];
+        if (window->count == 0 || num_value < window->min) {
+            window->min = num_value;
+        }
+        if (window->count == 0 || num_value > window->max) {
+            window->max = num_value;
+        }
+        window->sum += num_value;
+        window->count++;
+    }
+
+    // latest reading is always kept, deadband only hold back COV of "cov"
+    // schema, against value last reported
+    double last = telemetry->reported ? telemetry->reported[index] : telemetry->nums[index];
+    const data_point_t *band = telemetry->reported && !aggregated ? point : NULL;
+    telemetry->nums[index] = num_value;
+
+    if (is_within_deadband(band, last, num_value)) {
         clear_mask(telemetry->cov_mask, index);
     } else {
         set_mask(telemetry->cov_mask, index);
-        telemetry->values[index].num = num_value;
+        set_reported_value(telemetry, index, num_value);
+    }
+}
+
+void reset_telemetry_windows(const data_schema_t *schema, telemetry_t *telemetry, uint32_t groups)
+{
+    for (int i = 0; telemetry->window && i < telemetry->num_values; i++) {
+        if (IN_POINT_GROUPS(schema, groups, i)) {
+            memset(&telemetry->window[i], 0, sizeof(telemetry_window_t));
+        }
     }
 }
 
+bool update_computed_points(const data_schema_t *schema, telemetry_t *telemetry, bool keep_cov)
+{
+    bool changed = false;
+
+    for (int32_t i = schema->num_read_point; schema->computed && i < schema->num_point; i++) {
+        bool cov = keep_cov && IS_COV(telemetry, i);
+        double value = expr_eval(schema->computed, i - schema->num_read_point, telemetry->nums);
+        set_telemetry_number_value(telemetry, i, value, &schema->points[i]);
+        changed |= IS_COV(telemetry, i);
+        if (cov) {
+            set_mask(telemetry->cov_mask, i);
+        }
+    }
+    return changed;
+}
+
 void set_telemetry_string_value(telemetry_t *telemetry, int index, char *str_value)
 {
-    set_mask(telemetry->str_mask, index);
-    if (strequal(telemetry->values[index].str, str_value)) {
+    if (test_mask(telemetry->str_mask, index) && strequal(get_telemetry_string_value(telemetry, index), str_value)) {
         clear_mask(telemetry->cov_mask, index);
     } else {
+        set_mask(telemetry->str_mask, index);
         set_mask(telemetry->cov_mask, index);
-        FREE(telemetry->values[index].str);
-        telemetry->values[index].str = STRDUP(str_value);
+        store_telemetry_string(telemetry, index, str_value ? str_value : "");
+        telemetry->nums[index] = NAN;
+        set_reported_value(telemetry, index, NAN);
     }
 }
@@ -4,17 +4,172 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/socket.h>
 
 #include <init/ipc.h>
+#include <driver/modbus.h>
+#include <iot/diag.h>
 #include <utils/llog.h>
 #include <utils/memory.h>
+#include <utils/timer.h>
 #include <safeclib/safe_lib.h>
 
+// M4 respond a transaction right after its own response timeout, allow some
+// more time for the mailbox round trip
+#define IPC_TRANSACT_MARGIN_MS 100
+
+// largest pdu M4 return in a transaction response
+#define IPC_TRANSACT_MAX_PDU_SIZE 256
+
+// trace ring on M4 hold 256 events, so a few full responses drain it
+#define IPC_TRACE_MAX_DUMPS 4
+
+// probe ids below this are the RT lib's own, by interrupt
+static const char* ipc_trace_probe_names[] = {"UART IRQ", "SPI IRQ", "MBOX IRQ", "ADC DMA IRQ"};
+
+static uint32_t msg_seq_num = 1;
+
+// round trip of IPC_MODBUS_TRANSACT, from send to response
+static histogram_t* transact_hist = NULL;
+
+// receiver of IPC_ADC_BLOCK, which M4 send whenever a block is full
+static ipc_adc_block_handler_t adc_block_handler = NULL;
+static void* adc_block_context = NULL;
+static uint32_t adc_block_seq_num = 0;
+
+// receiver of IPC_AUDIO_FEATURES, which M4 send whenever a vector is done
+static ipc_audio_features_handler_t audio_features_handler = NULL;
+static void* audio_features_context = NULL;
+static uint32_t audio_features_seq_num = 0;
+
+// unpack a block in place and pass it on, return false if message isn't one
+static bool ipc_dispatch_adc_block(uint8_t* buf, int32_t size)
+{
+    if ((size < (int32_t)sizeof(ipc_adc_block_message_t)) || (dserialize_uint32(buf) != IPC_ADC_BLOCK)) {
+        return false;
+    }
+
+    uint32_t seq_num = dserialize_uint32(buf + 4);
+    uint32_t dropped = dserialize_uint32(buf + 12);
+    int32_t length = dserialize_uint32(buf + 16);
+    if (length > size - (int32_t)sizeof(ipc_adc_block_message_t)) {
+        LOGW("Drop truncated adc block from M4");
+        return true;
+    }
+
+    if (seq_num != adc_block_seq_num + 1) {
+        LOGW("Missed %u adc blocks from M4", seq_num - adc_block_seq_num - 1);
+    }
+    adc_block_seq_num = seq_num;
+
+    uint8_t* data = buf + sizeof(ipc_adc_block_message_t);
+    uint16_t* samples = (uint16_t*)data;
+    int32_t num_sample = length / 2;
+    for (int32_t i = 0; i < num_sample; i++) {
+        samples[i] = data[2 * i] | (data[2 * i + 1] << 8);
+    }
+
+    if (adc_block_handler) {
+        adc_block_handler(adc_block_context, samples, num_sample, dropped);
+    }
+    return true;
+}
+
+// unpack a feature vector in place and pass it on, return false if message
+// isn't one
+static bool ipc_dispatch_audio_features(uint8_t* buf, int32_t size)
+{
+    if ((size < (int32_t)sizeof(ipc_audio_features_message_t))
+        || (dserialize_uint32(buf) != IPC_AUDIO_FEATURES)) {
+        return false;
+    }
+
+    uint32_t seq_num = dserialize_uint32(buf + 4);
+    uint32_t dropped = dserialize_uint32(buf + 12);
+    int32_t length = dserialize_uint32(buf + 16);
+    if ((length < 8) || (length > size - (int32_t)sizeof(ipc_audio_features_message_t))) {
+        LOGW("Drop truncated audio features from M4");
+        return true;
+    }
+
+    if (seq_num != audio_features_seq_num + 1) {
+        LOGW("Missed %u audio feature vectors from M4", seq_num - audio_features_seq_num - 1);
+    }
+    audio_features_seq_num = seq_num;
+
+    uint8_t* data = buf + sizeof(ipc_audio_features_message_t);
+    float* features = (float*)data;
+    int32_t num_feature = length / 4;
+    for (int32_t i = 0; i < num_feature; i++) {
+        uint32_t bits = dserialize_uint32(data + 4 * i);
+        memcpy_s(&features[i], sizeof(float), &bits, sizeof(bits));
+    }
+
+    if (audio_features_handler) {
+        audio_features_handler(audio_features_context, features[0], features[1], features + 2, num_feature - 2,
+                               dropped);
+    }
+    return true;
+}
+
+// pass on a message the M4 send without being asked, return false if message
+// isn't one
+static bool ipc_dispatch_stream(uint8_t* buf, int32_t size)
+{
+    return ipc_dispatch_adc_block(buf, size) || ipc_dispatch_audio_features(buf, size);
+}
+
+// wait for response of given command and sequence number, dropping stale
+// messages, return bytes received or negative error code
+static int32_t ipc_wait_response(int socket_fd, ipc_command_type_t command, uint32_t seq_num, uint8_t* buf,
+                                 int32_t size, int32_t timeout_ms)
+{
+    struct timespec wait_sw;
+    timer_stopwatch_start(&wait_sw);
+
+    while (true) {
+        int32_t remain_ms = timeout_ms + IPC_TRANSACT_MARGIN_MS - timer_stopwatch_stop(&wait_sw);
+        if (remain_ms <= 0) {
+            return -DEVICE_E_TIMEOUT;
+        }
+
+        struct pollfd fds[1];
+        fds[0].fd = socket_fd;
+        fds[0].events = POLLIN;
+
+        int nevents = poll(fds, 1, remain_ms);
+        if (nevents == 0) {
+            LOGE("ERROR: No result of command %d from M4", command);
+            return -DEVICE_E_TIMEOUT;
+        } else if (nevents < 0) {
+            LOGE("ERROR: Unable to poll M4: %d (%s)", errno, strerror(errno));
+            return -DEVICE_E_IO;
+        }
+
+        int bytes_received = recv(socket_fd, buf, size, 0);
+        if (bytes_received == -1) {
+            LOGE("ERROR: Unable to receive message from M4: %d (%s)", errno, strerror(errno));
+            return -DEVICE_E_IO;
+        }
+
+        if (ipc_dispatch_stream(buf, bytes_received)) {
+            continue;
+        }
+
+        // result of command abandoned earlier, or raw bytes from uart
+        if ((bytes_received < (int)sizeof(ipc_transact_response_message_t))
+            || (dserialize_uint32(buf) != command) || (dserialize_uint32(buf + 4) != seq_num)) {
+            LOGD("Drop %d bytes of stale message from M4", bytes_received);
+            continue;
+        }
+
+        return bytes_received;
+    }
+}
+
 err_code ipc_execute_command(int socket_fd, ipc_command_type_t command, uint8_t* data, int32_t len)
 {
-    static uint32_t msg_seq_num = 1;
-    
     int msg_length = sizeof(ipc_request_message_t) + len;
     uint8_t* msg = (uint8_t*)MALLOC(msg_length);
     serialize_uint32(msg, command);
@@ -54,6 +209,424 @@ err_code ipc_execute_command(int socket_fd, ipc_command_type_t command, uint8_t*
     return resp_msg.code;
 }
 
+err_code ipc_modbus_transact(int socket_fd, const uint8_t* adu, int32_t adu_len, uint8_t* pdu, int32_t* ppdu_len,
+                             int32_t timeout_ms)
+{
+    uint32_t seq_num = msg_seq_num++;
+    struct timespec transact_sw;
+    timer_stopwatch_start(&transact_sw);
+
+    int msg_length = sizeof(ipc_request_message_t) + 4 + adu_len;
+    uint8_t* msg = (uint8_t*)MALLOC(msg_length);
+    serialize_uint32(msg, IPC_MODBUS_TRANSACT);
+    serialize_uint32(msg + 4, seq_num);
+    serialize_uint32(msg + 8, 4 + adu_len);
+    serialize_uint32(msg + 12, timeout_ms);
+    memcpy_s(msg + 16, adu_len, adu, adu_len);
+
+    int bytes_sent = send(socket_fd, msg, msg_length, 0);
+    FREE(msg);
+    if (bytes_sent == -1) {
+        LOGE("ERROR: Unable to send transaction to M4: %d (%s)", errno, strerror(errno));
+        return DEVICE_E_IO;
+    }
+
+    uint8_t resp[sizeof(ipc_transact_response_message_t) + IPC_TRANSACT_MAX_PDU_SIZE];
+    int32_t bytes_received = ipc_wait_response(socket_fd, IPC_MODBUS_TRANSACT, seq_num, resp, sizeof(resp),
+                                               timeout_ms);
+    if (bytes_received < 0) {
+        return -bytes_received;
+    }
+
+    err_code code = dserialize_uint32(resp + 8);
+    uint32_t length = dserialize_uint32(resp + 12);
+    if (code != DEVICE_OK) {
+        return code;
+    }
+
+    if ((length > bytes_received - sizeof(ipc_transact_response_message_t)) || (length > MODBUS_MAX_PDU_SIZE)) {
+        LOGE("ERROR: Invalid pdu length %d from M4", length);
+        return DEVICE_E_PROTOCOL;
+    }
+
+    memcpy_s(pdu, MODBUS_MAX_PDU_SIZE, resp + sizeof(ipc_transact_response_message_t), length);
+    *ppdu_len = length;
+
+    // diag_histogram return the same histogram for a key, racing workers are fine
+    if (!transact_hist) {
+        transact_hist = diag_histogram("rt_transact_ms");
+    }
+    if (transact_hist) {
+        histogram_record(transact_hist, timer_stopwatch_stop(&transact_sw));
+    }
+    return DEVICE_OK;
+}
+
+err_code ipc_execute_batch(int socket_fd, ipc_command_t* commands, int32_t num_command, int32_t timeout_ms)
+{
+    uint32_t seq_num = msg_seq_num++;
+
+    int msg_length = sizeof(ipc_request_message_t);
+    for (int32_t i = 0; i < num_command; i++) {
+        msg_length += sizeof(ipc_request_message_t) + commands[i].len;
+    }
+
+    if (msg_length > IPC_MAX_MESSAGE_SIZE) {
+        LOGE("ERROR: Batch of %d commands too large: %d", num_command, msg_length);
+        return DEVICE_E_INVALID;
+    }
+
+    // each command keep its own sequence number to match its response
+    uint8_t* msg = (uint8_t*)MALLOC(msg_length);
+    uint32_t* sub_seq_nums = (uint32_t*)MALLOC(num_command * sizeof(uint32_t));
+    serialize_uint32(msg, IPC_BATCH);
+    serialize_uint32(msg + 4, seq_num);
+    serialize_uint32(msg + 8, msg_length - sizeof(ipc_request_message_t));
+
+    uint8_t* p = msg + sizeof(ipc_request_message_t);
+    for (int32_t i = 0; i < num_command; i++) {
+        sub_seq_nums[i] = msg_seq_num++;
+        p = serialize_uint32(p, commands[i].command);
+        p = serialize_uint32(p, sub_seq_nums[i]);
+        p = serialize_uint32(p, commands[i].len);
+        if (commands[i].len > 0) {
+            memcpy_s(p, commands[i].len, commands[i].data, commands[i].len);
+            p += commands[i].len;
+        }
+        commands[i].code = DEVICE_E_BUSY;
+        commands[i].resp_len = 0;
+    }
+
+    int bytes_sent = send(socket_fd, msg, msg_length, 0);
+    FREE(msg);
+    if (bytes_sent == -1) {
+        LOGE("ERROR: Unable to send batch to M4: %d (%s)", errno, strerror(errno));
+        FREE(sub_seq_nums);
+        return DEVICE_E_IO;
+    }
+
+    uint8_t* resp = (uint8_t*)MALLOC(IPC_MAX_MESSAGE_SIZE);
+    int32_t bytes_received = ipc_wait_response(socket_fd, IPC_BATCH, seq_num, resp, IPC_MAX_MESSAGE_SIZE, timeout_ms);
+    err_code code = bytes_received < 0 ? -bytes_received : dserialize_uint32(resp + 8);
+
+    if (code == DEVICE_OK) {
+        int32_t offset = sizeof(ipc_batch_response_message_t);
+        int32_t end = offset + dserialize_uint32(resp + 12);
+        if (end > bytes_received) {
+            end = bytes_received;
+        }
+
+        for (int32_t i = 0; i < num_command; i++) {
+            bool transact = commands[i].command == IPC_MODBUS_TRANSACT;
+            int32_t hdr_len = transact ? sizeof(ipc_transact_response_message_t) : sizeof(ipc_response_message_t);
+
+            if ((offset + hdr_len > end) || (dserialize_uint32(resp + offset + 4) != sub_seq_nums[i])) {
+                break;
+            }
+
+            commands[i].code = dserialize_uint32(resp + offset + 8);
+            if (transact) {
+                int32_t length = dserialize_uint32(resp + offset + 12);
+                if ((offset + hdr_len + length > end) || (length > MODBUS_MAX_PDU_SIZE)) {
+                    commands[i].code = DEVICE_E_PROTOCOL;
+                    break;
+                }
+                if (commands[i].code == DEVICE_OK) {
+                    memcpy_s(commands[i].resp, MODBUS_MAX_PDU_SIZE, resp + offset + hdr_len, length);
+                    commands[i].resp_len = length;
+                }
+                offset += length;
+            }
+            offset += hdr_len;
+        }
+    }
+
+    FREE(resp);
+    FREE(sub_seq_nums);
+    return code;
+}
+
+err_code ipc_dump_trace(int socket_fd, int32_t timeout_ms)
+{
+    // tick of last enter event of each probe, to report handler duration on exit
+    uint32_t enter_tick[128];
+    bool entered[128] = {false};
+
+    uint8_t* resp = (uint8_t*)MALLOC(IPC_MAX_MESSAGE_SIZE);
+    err_code code = DEVICE_OK;
+
+    for (int32_t dump = 0; dump < IPC_TRACE_MAX_DUMPS; dump++) {
+        uint32_t seq_num = msg_seq_num++;
+        uint8_t msg[sizeof(ipc_request_message_t)];
+        serialize_uint32(msg, IPC_TRACE_DUMP);
+        serialize_uint32(msg + 4, seq_num);
+        serialize_uint32(msg + 8, 0);
+
+        if (send(socket_fd, msg, sizeof(msg), 0) == -1) {
+            LOGE("ERROR: Unable to send trace dump to M4: %d (%s)", errno, strerror(errno));
+            code = DEVICE_E_IO;
+            break;
+        }
+
+        int32_t bytes_received = ipc_wait_response(socket_fd, IPC_TRACE_DUMP, seq_num, resp, IPC_MAX_MESSAGE_SIZE,
+                                                   timeout_ms);
+        if (bytes_received < 0) {
+            code = -bytes_received;
+            break;
+        }
+        if (bytes_received < (int32_t)sizeof(ipc_trace_response_message_t)) {
+            code = DEVICE_E_PROTOCOL;
+            break;
+        }
+
+        code = dserialize_uint32(resp + 8);
+        uint32_t tick_hz = dserialize_uint32(resp + 12);
+        uint32_t lost = dserialize_uint32(resp + 16);
+        int32_t length = dserialize_uint32(resp + 20);
+        if ((code != DEVICE_OK) || (tick_hz < 1000000)) {
+            LOGW("M4 trace not available: %d", code);
+            break;
+        }
+        if (length > bytes_received - (int32_t)sizeof(ipc_trace_response_message_t)) {
+            code = DEVICE_E_PROTOCOL;
+            break;
+        }
+
+        if (lost > 0) {
+            LOGI("M4 trace: %u events lost", lost);
+        }
+
+        uint32_t tick_per_us = tick_hz / 1000000;
+        int32_t num_event = length / IPC_TRACE_EVENT_SIZE;
+        for (int32_t i = 0; i < num_event; i++) {
+            uint8_t* event = resp + sizeof(ipc_trace_response_message_t) + i * IPC_TRACE_EVENT_SIZE;
+            uint32_t tick = dserialize_uint32(event);
+            bool exit = event[6] & 0x80;
+            uint8_t probe = event[6] & 0x7F;
+            uint8_t arg = event[7];
+
+            const char* name = probe < sizeof(ipc_trace_probe_names) / sizeof(ipc_trace_probe_names[0])
+                                   ? ipc_trace_probe_names[probe]
+                                   : "probe";
+            if (!exit) {
+                enter_tick[probe] = tick;
+                entered[probe] = true;
+                LOGI("M4 trace: %s %u.%u enter at %u us", name, probe, arg, tick / tick_per_us);
+            } else if (entered[probe]) {
+                entered[probe] = false;
+                LOGI("M4 trace: %s %u.%u exit at %u us, took %u us", name, probe, arg, tick / tick_per_us,
+                     (tick - enter_tick[probe]) / tick_per_us);
+            } else {
+                LOGI("M4 trace: %s %u.%u exit at %u us", name, probe, arg, tick / tick_per_us);
+            }
+        }
+
+        // not full, nothing more recorded
+        if (num_event < (IPC_MAX_MESSAGE_SIZE - (int32_t)sizeof(ipc_trace_response_message_t)) / IPC_TRACE_EVENT_SIZE) {
+            break;
+        }
+    }
+
+    FREE(resp);
+    return code;
+}
+
+void ipc_set_adc_block_handler(ipc_adc_block_handler_t handler, void* context)
+{
+    adc_block_handler = handler;
+    adc_block_context = context;
+}
+
+void ipc_set_audio_features_handler(ipc_audio_features_handler_t handler, void* context)
+{
+    audio_features_handler = handler;
+    audio_features_context = context;
+}
+
+// send a start or stop of a stream and wait for its response, messages of
+// streams received meanwhile are still dispatched
+static err_code ipc_stream_command(int socket_fd, ipc_command_type_t command, const uint8_t* data, int32_t len,
+                                   int32_t timeout_ms)
+{
+    uint32_t seq_num = msg_seq_num++;
+    uint8_t msg[IPC_MAX_MESSAGE_SIZE];
+    serialize_uint32(msg, command);
+    serialize_uint32(msg + 4, seq_num);
+    serialize_uint32(msg + 8, len);
+    if (len > 0) {
+        memcpy_s(msg + 12, sizeof(msg) - 12, data, len);
+    }
+
+    if (send(socket_fd, msg, sizeof(ipc_request_message_t) + len, 0) == -1) {
+        LOGE("ERROR: Unable to send command %d to M4: %d (%s)", command, errno, strerror(errno));
+        return DEVICE_E_IO;
+    }
+
+    int32_t bytes_received = ipc_wait_response(socket_fd, command, seq_num, msg, sizeof(msg), timeout_ms);
+    if (bytes_received < 0) {
+        return -bytes_received;
+    }
+
+    return dserialize_uint32(msg + 8);
+}
+
+err_code ipc_adc_start(int socket_fd, const ipc_adc_config_t* config, int32_t timeout_ms)
+{
+    uint8_t data[IPC_ADC_START_SIZE];
+    serialize_uint32(data, config->frequency);
+    data[4] = config->channel_mask;
+    data[5] = config->channel_mask >> 8;
+    data[6] = config->decimation;
+    data[7] = config->decimation >> 8;
+    data[8] = config->vref_mv;
+    data[9] = config->vref_mv >> 8;
+    data[10] = config->block_samples;
+    data[11] = config->block_samples >> 8;
+
+    adc_block_seq_num = 0;
+    return ipc_stream_command(socket_fd, IPC_ADC_START, data, sizeof(data), timeout_ms);
+}
+
+err_code ipc_adc_stop(int socket_fd, int32_t timeout_ms)
+{
+    return ipc_stream_command(socket_fd, IPC_ADC_STOP, NULL, 0, timeout_ms);
+}
+
+err_code ipc_audio_start(int socket_fd, const ipc_audio_config_t* config, int32_t timeout_ms)
+{
+    uint8_t data[IPC_AUDIO_START_SIZE];
+    serialize_uint32(data, config->rate);
+    data[4] = config->frames_per_vector;
+    data[5] = config->frames_per_vector >> 8;
+    data[6] = config->bands;
+    data[7] = config->bands >> 8;
+
+    audio_features_seq_num = 0;
+    return ipc_stream_command(socket_fd, IPC_AUDIO_START, data, sizeof(data), timeout_ms);
+}
+
+err_code ipc_audio_stop(int socket_fd, int32_t timeout_ms)
+{
+    return ipc_stream_command(socket_fd, IPC_AUDIO_STOP, NULL, 0, timeout_ms);
+}
+
+err_code ipc_pulse_start(int socket_fd, const ipc_pulse_config_t* config, int32_t timeout_ms)
+{
+    uint8_t data[IPC_PULSE_START_SIZE];
+    serialize_uint32(data, config->pin_mask);
+    data[4] = config->gate_ms;
+    data[5] = config->gate_ms >> 8;
+    data[6] = config->debounce;
+    data[7] = 0;
+
+    return ipc_stream_command(socket_fd, IPC_PULSE_START, data, sizeof(data), timeout_ms);
+}
+
+err_code ipc_pulse_stop(int socket_fd, int32_t timeout_ms)
+{
+    return ipc_stream_command(socket_fd, IPC_PULSE_STOP, NULL, 0, timeout_ms);
+}
+
+err_code ipc_pulse_read(int socket_fd, ipc_pulse_reading_t* readings, int32_t max_reading, int32_t* pnum_reading,
+                        int32_t timeout_ms)
+{
+    uint32_t seq_num = msg_seq_num++;
+    uint8_t msg[IPC_MAX_MESSAGE_SIZE];
+    serialize_uint32(msg, IPC_PULSE_READ);
+    serialize_uint32(msg + 4, seq_num);
+    serialize_uint32(msg + 8, 0);
+
+    *pnum_reading = 0;
+    if (send(socket_fd, msg, sizeof(ipc_request_message_t), 0) == -1) {
+        LOGE("ERROR: Unable to send pulse read to M4: %d (%s)", errno, strerror(errno));
+        return DEVICE_E_IO;
+    }
+
+    int32_t bytes_received = ipc_wait_response(socket_fd, IPC_PULSE_READ, seq_num, msg, sizeof(msg), timeout_ms);
+    if (bytes_received < 0) {
+        return -bytes_received;
+    }
+    if (bytes_received < (int32_t)sizeof(ipc_pulse_response_message_t)) {
+        return DEVICE_E_PROTOCOL;
+    }
+
+    err_code code = dserialize_uint32(msg + 8);
+    int32_t length = dserialize_uint32(msg + 12);
+    if (code != DEVICE_OK) {
+        return code;
+    }
+    if (length > bytes_received - (int32_t)sizeof(ipc_pulse_response_message_t)) {
+        return DEVICE_E_PROTOCOL;
+    }
+
+    int32_t num_reading = length / IPC_PULSE_READING_SIZE;
+    for (int32_t i = 0; i < num_reading && i < max_reading; i++) {
+        uint8_t* reading = msg + sizeof(ipc_pulse_response_message_t) + i * IPC_PULSE_READING_SIZE;
+        readings[i].pin = dserialize_uint32(reading);
+        readings[i].count = dserialize_uint32(reading + 4);
+        readings[i].frequency_mhz = dserialize_uint32(reading + 8);
+        (*pnum_reading)++;
+    }
+
+    return DEVICE_OK;
+}
+
+err_code ipc_modbus_sim_start(int socket_fd, const modbus_sim_config_t* config, uint32_t baud, uint8_t parity,
+                              uint8_t stop_bits, int32_t timeout_ms)
+{
+    uint8_t data[IPC_MODBUS_SIM_START_SIZE];
+    data[0] = config->first_id;
+    data[1] = config->num_slaves;
+    data[2] = config->num_registers;
+    data[3] = config->num_registers >> 8;
+    uint8_t* p = data + 4;
+    p = serialize_uint32(p, config->latency_min_us);
+    p = serialize_uint32(p, config->latency_max_us);
+    p = serialize_uint32(p, config->slow_ppm);
+    p = serialize_uint32(p, config->slow_us);
+    p = serialize_uint32(p, config->exception_ppm);
+    p = serialize_uint32(p, config->timeout_ppm);
+    p = serialize_uint32(p, config->change_ms);
+    p = serialize_uint32(p, config->change_ppm);
+    p = serialize_uint32(p, config->seed);
+    p = serialize_uint32(p, baud);
+    p[0] = parity;
+    p[1] = stop_bits;
+    p[2] = 0;
+    p[3] = 0;
+
+    return ipc_stream_command(socket_fd, IPC_MODBUS_SIM_START, data, sizeof(data), timeout_ms);
+}
+
+err_code ipc_modbus_sim_stop(int socket_fd, int32_t timeout_ms)
+{
+    return ipc_stream_command(socket_fd, IPC_MODBUS_SIM_STOP, NULL, 0, timeout_ms);
+}
+
+int32_t ipc_stream_poll(int socket_fd)
+{
+    uint8_t buf[IPC_MAX_MESSAGE_SIZE];
+    int32_t num_msg = 0;
+
+    while (true) {
+        int bytes_received = recv(socket_fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (bytes_received == -1) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                LOGE("ERROR: Unable to receive message from M4: %d (%s)", errno, strerror(errno));
+            }
+            break;
+        }
+
+        if (ipc_dispatch_stream(buf, bytes_received)) {
+            num_msg++;
+        } else {
+            LOGD("Drop %d bytes of stale message from M4", bytes_received);
+        }
+    }
+
+    return num_msg;
+}
+
 uint8_t* serialize_uint32(uint8_t* data, uint32_t value)
 {
     data[0] = value;
@@ -67,7 +67,7 @@ static int sphere_init(void)
     llog_config(LOG_ENDPOINT_SERIAL, LOG_VERBOSE);
 #endif
 
-    if (network_init() != 0) {
+    if (network_init(s_eloop) != 0) {
         LOGE("Failed to init wifi");
         return -1;
     }
@@ -0,0 +1,424 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <applibs/log.h>
+#include <applibs/eventloop.h>
+
+#include <driver/modbus.h>
+#include <init/globals.h>
+#include <init/modbus_gateway.h>
+#include <iot/diag.h>
+#include <utils/llog.h>
+#include <utils/memory.h>
+#include <utils/timer.h>
+#include <utils/utils.h>
+
+// transaction id, protocol id, length and unit id ahead of pdu
+#define MBAP_HEADER_SIZE 7
+#define MBAP_MAX_FRAME_SIZE (MBAP_HEADER_SIZE + MODBUS_MAX_PDU_SIZE)
+
+#define GATEWAY_MAX_READ_BITS 2000
+#define GATEWAY_MAX_READ_REGISTERS 125
+// largest response is a register read: function code, byte count and registers
+#define GATEWAY_MAX_RESPONSE_SIZE (MBAP_HEADER_SIZE + 2 + 2 * GATEWAY_MAX_READ_REGISTERS)
+
+#define EXCEPTION_ILLEGAL_FUNCTION 0x01
+#define EXCEPTION_ILLEGAL_ADDRESS 0x02
+#define EXCEPTION_ILLEGAL_VALUE 0x03
+#define EXCEPTION_GATEWAY_PATH_UNAVAILABLE 0x0A
+#define EXCEPTION_GATEWAY_TARGET_FAILED 0x0B
+
+// one connected client, requests are answered in order into tx, and not read
+// while tx can't take another response
+typedef struct gateway_client_t gateway_client_t;
+struct gateway_client_t {
+    int fd;
+    EventRegistration *io;
+    EventLoop_IoEvents events;
+    struct timespec ts_active;
+    uint8_t rx[MBAP_MAX_FRAME_SIZE];
+    size_t rx_len;
+    uint8_t tx[MODBUS_GATEWAY_TX_SIZE];
+    size_t tx_len;
+    size_t tx_sent;
+};
+
+typedef struct modbus_gateway_t modbus_gateway_t;
+struct modbus_gateway_t {
+    EventLoop *eloop;
+    modbus_gateway_read_func_t read;
+    uint16_t port;
+    int listen_fd;
+    EventRegistration *listen_io;
+    gateway_client_t *clients[MODBUS_GATEWAY_MAX_CLIENTS];
+    // registers of the read being answered, one per bit for coils and inputs
+    uint16_t regs[GATEWAY_MAX_READ_BITS];
+};
+
+static modbus_gateway_t s_gateway = {.listen_fd = -1};
+
+
+static void close_client(int slot)
+{
+    gateway_client_t *client = s_gateway.clients[slot];
+    EventLoop_UnregisterIo(s_gateway.eloop, client->io);
+    close(client->fd);
+    FREE(client);
+    s_gateway.clients[slot] = NULL;
+}
+
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+
+static size_t build_exception(uint8_t *rsp, uint8_t function_code, uint8_t exception)
+{
+    diag_log_count_value("gateway_exceptions");
+    rsp[0] = function_code | 0x80;
+    rsp[1] = exception;
+    return 2;
+}
+
+
+/// <summary>
+/// answer one request pdu of unit from register cache
+/// </summary>
+/// <returns>length of response pdu written to rsp</returns>
+static size_t handle_request(uint8_t unit, const uint8_t *req, size_t req_len, uint8_t *rsp)
+{
+    uint8_t fc = req[0];
+    bool bits = fc == FC_READ_COILS || fc == FC_READ_DISCRETE_INPUTS;
+
+    // unit 0 is what many masters send by default, no device is served as it
+    if (unit == 0) {
+        return build_exception(rsp, fc, EXCEPTION_GATEWAY_PATH_UNAVAILABLE);
+    }
+
+    if (!bits && fc != FC_READ_HOLDING_REGISTERS && fc != FC_READ_INPUT_REGISTERS) {
+        // read only, points are written through iot hub so writes are verified and logged
+        return build_exception(rsp, fc, EXCEPTION_ILLEGAL_FUNCTION);
+    }
+
+    if (req_len != 5) {
+        return build_exception(rsp, fc, EXCEPTION_ILLEGAL_VALUE);
+    }
+
+    uint16_t addr = (req[1] << 8) | req[2];
+    uint16_t quantity = (req[3] << 8) | req[4];
+    if (quantity == 0 || quantity > (bits ? GATEWAY_MAX_READ_BITS : GATEWAY_MAX_READ_REGISTERS)) {
+        return build_exception(rsp, fc, EXCEPTION_ILLEGAL_VALUE);
+    }
+    if ((uint32_t)addr + quantity > 0x10000) {
+        return build_exception(rsp, fc, EXCEPTION_ILLEGAL_ADDRESS);
+    }
+
+    switch (s_gateway.read(unit, fc, addr, quantity, s_gateway.regs)) {
+    case DEVICE_OK:
+        break;
+    case DEVICE_E_CONFIG:
+        return build_exception(rsp, fc, EXCEPTION_GATEWAY_PATH_UNAVAILABLE);
+    case DEVICE_E_NO_DATA:
+        // not polled, so not a register the device is known to have
+        return build_exception(rsp, fc, EXCEPTION_ILLEGAL_ADDRESS);
+    default:
+        // device stopped answering polls
+        return build_exception(rsp, fc, EXCEPTION_GATEWAY_TARGET_FAILED);
+    }
+
+    rsp[0] = fc;
+    if (bits) {
+        uint8_t nbytes = (quantity + 7) / 8;
+        rsp[1] = nbytes;
+        memset(rsp + 2, 0, nbytes);
+        for (uint16_t i = 0; i < quantity; i++) {
+            if (s_gateway.regs[i]) {
+                rsp[2 + i / 8] |= 1 << (i % 8);
+            }
+        }
+        return 2 + nbytes;
+    }
+
+    rsp[1] = quantity * 2;
+    for (uint16_t i = 0; i < quantity; i++) {
+        rsp[2 + 2 * i] = s_gateway.regs[i] >> 8;
+        rsp[3 + 2 * i] = s_gateway.regs[i] & 0xFF;
+    }
+    return 2 + quantity * 2;
+}
+
+
+/// <summary>
+/// answer whole frames received, as many as tx has room for
+/// </summary>
+/// <returns>false if client sent a malformed frame</returns>
+static bool process_requests(gateway_client_t *client)
+{
+    size_t pos = 0;
+
+    while (client->rx_len - pos >= MBAP_HEADER_SIZE) {
+        const uint8_t *frame = client->rx + pos;
+        uint16_t protocol = (frame[2] << 8) | frame[3];
+        uint16_t length = (frame[4] << 8) | frame[5];
+        if (protocol != 0 || length < 2 || length > MODBUS_MAX_PDU_SIZE + 1) {
+            LOGW("Gateway client sent malformed frame, disconnect");
+            return false;
+        }
+
+        size_t frame_size = 6 + length;
+        if (client->rx_len - pos < frame_size) {
+            break;
+        }
+
+        if (client->tx_sent == client->tx_len) {
+            client->tx_sent = client->tx_len = 0;
+        }
+        if (sizeof(client->tx) - client->tx_len < GATEWAY_MAX_RESPONSE_SIZE) {
+            // answered once client has read earlier responses
+            break;
+        }
+
+        uint8_t *rsp = client->tx + client->tx_len;
+        size_t pdu_len = handle_request(frame[6], frame + MBAP_HEADER_SIZE, length - 1, rsp + MBAP_HEADER_SIZE);
+        memcpy(rsp, frame, 4);
+        rsp[4] = (pdu_len + 1) >> 8;
+        rsp[5] = (pdu_len + 1) & 0xFF;
+        rsp[6] = frame[6];
+        client->tx_len += MBAP_HEADER_SIZE + pdu_len;
+
+        diag_log_count_value("gateway_requests");
+        pos += frame_size;
+    }
+
+    if (pos > 0) {
+        memmove(client->rx, client->rx + pos, client->rx_len - pos);
+        client->rx_len -= pos;
+    }
+    return true;
+}
+
+
+/// <summary>
+/// send queued responses without blocking
+/// </summary>
+/// <returns>false if connection is broken</returns>
+static bool flush_client(gateway_client_t *client)
+{
+    while (client->tx_sent < client->tx_len) {
+        ssize_t nsend = send(client->fd, client->tx + client->tx_sent, client->tx_len - client->tx_sent,
+                             MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (nsend < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        client->tx_sent += nsend;
+    }
+    return true;
+}
+
+
+/// <summary>
+/// wait for output while responses are queued, and for input while tx has room
+/// </summary>
+static void update_client_events(gateway_client_t *client)
+{
+    EventLoop_IoEvents events = 0;
+    if (client->tx_sent < client->tx_len) {
+        events |= EventLoop_Output;
+    }
+    if (client->tx_len == client->tx_sent || sizeof(client->tx) - client->tx_len >= GATEWAY_MAX_RESPONSE_SIZE) {
+        events |= EventLoop_Input;
+    }
+
+    if (events != client->events) {
+        EventLoop_ModifyIoEvents(s_gateway.eloop, client->io, events);
+        client->events = events;
+    }
+}
+
+
+static void handle_client_io(EventLoop *eloop, int fd, EventLoop_IoEvents events, void *context)
+{
+    int slot = (int)(intptr_t)context;
+    gateway_client_t *client = s_gateway.clients[slot];
+    bool ok = true;
+
+    if ((events & EventLoop_Input) && client->rx_len < sizeof(client->rx)) {
+        ssize_t nrecv = recv(client->fd, client->rx + client->rx_len, sizeof(client->rx) - client->rx_len,
+                             MSG_DONTWAIT);
+        if (nrecv > 0) {
+            client->rx_len += nrecv;
+            timer_stopwatch_start(&client->ts_active);
+        } else if (nrecv == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            ok = false;
+        }
+    }
+
+    // responses flushed make room for requests waiting on tx, until the
+    // socket takes no more or every whole request is answered
+    while (ok) {
+        size_t rx_len = client->rx_len;
+        ok = flush_client(client) && process_requests(client);
+        if (client->rx_len == rx_len) {
+            break;
+        }
+    }
+    ok = ok && flush_client(client);
+    if (!ok || (events & EventLoop_Error)) {
+        LOGI("Gateway client disconnected");
+        close_client(slot);
+        return;
+    }
+
+    update_client_events(client);
+}
+
+
+static void handle_accept(EventLoop *eloop, int fd, EventLoop_IoEvents events, void *context)
+{
+    int client_fd = accept(fd, NULL, NULL);
+    if (client_fd < 0) {
+        return;
+    }
+
+    if (set_nonblocking(client_fd) != 0) {
+        close(client_fd);
+        return;
+    }
+
+    // slot of a free client or else of the one idle longest, SCADA masters
+    // reconnecting after a restart don't find the gateway full of dead ones
+    int slot = 0;
+    for (int i = 0; i < MODBUS_GATEWAY_MAX_CLIENTS; i++) {
+        if (!s_gateway.clients[i]) {
+            slot = i;
+            break;
+        }
+        if (timespec_compare(&s_gateway.clients[i]->ts_active, &s_gateway.clients[slot]->ts_active) < 0) {
+            slot = i;
+        }
+    }
+    if (s_gateway.clients[slot]) {
+        LOGW("Gateway has %d clients, drop the one idle longest", MODBUS_GATEWAY_MAX_CLIENTS);
+        close_client(slot);
+    }
+
+    gateway_client_t *client = (gateway_client_t *)CALLOC(1, sizeof(gateway_client_t));
+    client->fd = client_fd;
+    client->events = EventLoop_Input;
+    timer_stopwatch_start(&client->ts_active);
+    client->io = EventLoop_RegisterIo(s_gateway.eloop, client_fd, client->events, handle_client_io,
+                                      (void *)(intptr_t)slot);
+    if (!client->io) {
+        LOGE("Failed to register gateway client");
+        close(client_fd);
+        FREE(client);
+        return;
+    }
+
+    s_gateway.clients[slot] = client;
+    LOGI("Gateway client connected");
+}
+
+
+static void stop_listening(void)
+{
+    for (int i = 0; i < MODBUS_GATEWAY_MAX_CLIENTS; i++) {
+        if (s_gateway.clients[i]) {
+            close_client(i);
+        }
+    }
+
+    if (s_gateway.listen_io) {
+        EventLoop_UnregisterIo(s_gateway.eloop, s_gateway.listen_io);
+        s_gateway.listen_io = NULL;
+    }
+    if (s_gateway.listen_fd >= 0) {
+        close(s_gateway.listen_fd);
+        s_gateway.listen_fd = -1;
+    }
+    s_gateway.port = 0;
+}
+
+
+static int start_listening(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOGE("Failed to create gateway socket: %d", errno);
+        return -1;
+    }
+
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (set_nonblocking(fd) != 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, MODBUS_GATEWAY_MAX_CLIENTS) != 0) {
+        LOGE("Failed to listen on gateway port %d: %d", port, errno);
+        close(fd);
+        return -1;
+    }
+
+    s_gateway.listen_io = EventLoop_RegisterIo(s_gateway.eloop, fd, EventLoop_Input, handle_accept, NULL);
+    if (!s_gateway.listen_io) {
+        LOGE("Failed to register gateway socket");
+        close(fd);
+        return -1;
+    }
+
+    s_gateway.listen_fd = fd;
+    s_gateway.port = port;
+    LOGI("Modbus TCP gateway listening on port %d", port);
+    return 0;
+}
+
+// ---------------------------- public interface ------------------------------
+
+int modbus_gateway_init(EventLoop *eloop, modbus_gateway_read_func_t read)
+{
+    ASSERT(eloop);
+    ASSERT(read);
+
+    s_gateway.eloop = eloop;
+    s_gateway.read = read;
+    return 0;
+}
+
+
+void modbus_gateway_deinit(void)
+{
+    stop_listening();
+    s_gateway.eloop = NULL;
+    s_gateway.read = NULL;
+}
+
+
+int modbus_gateway_config(uint16_t port)
+{
+    if (port == s_gateway.port) {
+        return 0;
+    }
+
+    stop_listening();
+    return port ? start_listening(port) : 0;
+}
@@ -0,0 +1,255 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+#include <applibs/eventloop.h>
+
+#include <init/globals.h>
+#include <init/telemetry_batch.h>
+#include <iot/iot.h>
+#include <utils/event_loop_timer.h>
+#include <utils/llog.h>
+#include <utils/memory.h>
+#include <utils/timer.h>
+
+// CBOR batch is an indefinite length array of telemetry items
+#define CBOR_INDEFINITE_ARRAY 0x9F
+#define CBOR_BREAK 0xFF
+
+#define BATCH_INITIAL_ITEMS 8
+
+// items of one batch message waiting for delivery result
+typedef struct batch_record_t batch_record_t;
+struct batch_record_t {
+    uint32_t generation;
+    int32_t num_item;
+    void *items[];
+};
+
+typedef struct telemetry_batch_t telemetry_batch_t;
+struct telemetry_batch_t {
+    EventLoop *eloop;
+    event_loop_timer_t *flush_timer;
+    telemetry_batch_delivered_func_t callback;
+
+    bool binary;
+    size_t max_size;
+    int32_t max_latency_ms;
+
+    // batch message under construction, header already written at start
+    uint8_t *buf;
+    size_t len;
+
+    void **items;
+    int32_t num_item;
+    int32_t max_item;
+
+    // bumped on reset so result of batches sent before are not reported
+    uint32_t generation;
+};
+
+static telemetry_batch_t s_batch;
+
+
+static size_t batch_trailer_size(void)
+{
+    // ']' and null terminator for JSON, break code for CBOR
+    return s_batch.binary ? 1 : 2;
+}
+
+
+static void start_batch(void)
+{
+    s_batch.buf[0] = s_batch.binary ? CBOR_INDEFINITE_ARRAY : '[';
+    s_batch.len = 1;
+    s_batch.num_item = 0;
+}
+
+
+static void batch_message_delivered(bool delivered, void *context)
+{
+    batch_record_t *record = (batch_record_t *)context;
+    ASSERT(record);
+
+    if (s_batch.callback) {
+        if (record->generation == s_batch.generation) {
+            s_batch.callback(delivered, record->items, record->num_item);
+        } else {
+            s_batch.callback(delivered, NULL, 0);
+        }
+    }
+
+    FREE(record);
+}
+
+
+static void flush_timer_callback(void *context)
+{
+    telemetry_batch_flush();
+}
+
+// ---------------------------- public interface ------------------------------
+
+int telemetry_batch_init(EventLoop *eloop, telemetry_batch_delivered_func_t callback)
+{
+    ASSERT(eloop);
+
+    s_batch.eloop = eloop;
+    s_batch.callback = callback;
+
+    s_batch.flush_timer = event_loop_register_timer(eloop, NULL, NULL, NULL, flush_timer_callback, NULL);
+    if (!s_batch.flush_timer) {
+        LOGE("Failed to register telemetry batch timer");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void telemetry_batch_deinit(void)
+{
+    // batches still inflight will be released on delivery without callback
+    s_batch.callback = NULL;
+    s_batch.generation++;
+
+    if (s_batch.flush_timer) {
+        event_loop_unregister_timer(s_batch.eloop, s_batch.flush_timer);
+        s_batch.flush_timer = NULL;
+    }
+
+    FREE(s_batch.buf);
+    FREE(s_batch.items);
+    s_batch.max_size = 0;
+    s_batch.len = 0;
+    s_batch.num_item = 0;
+    s_batch.max_item = 0;
+}
+
+
+void telemetry_batch_config(bool binary, size_t max_size, int32_t max_latency_ms)
+{
+    telemetry_batch_flush();
+
+    if (max_size > TELEMETRY_BATCH_MAX_SIZE) {
+        LOGW("Telemetry batch size %zu exceed limit, use %d", max_size, TELEMETRY_BATCH_MAX_SIZE);
+        max_size = TELEMETRY_BATCH_MAX_SIZE;
+    }
+
+    if (max_size != s_batch.max_size) {
+        FREE(s_batch.buf);
+        if (max_size > 0) {
+            s_batch.buf = (uint8_t *)MALLOC(max_size);
+        }
+    }
+
+    s_batch.binary = binary;
+    s_batch.max_size = max_size;
+    s_batch.max_latency_ms = max_latency_ms > 0 ? max_latency_ms : 0;
+
+    if (s_batch.buf) {
+        start_batch();
+    }
+}
+
+
+bool telemetry_batch_enabled(void)
+{
+    return s_batch.max_size > 0;
+}
+
+
+int telemetry_batch_add(const void *message, size_t len, void *item)
+{
+    ASSERT(message);
+
+    if (!telemetry_batch_enabled()) {
+        return -1;
+    }
+
+    // JSON object need a comma separator except the first one
+    size_t separator = (!s_batch.binary && s_batch.num_item > 0) ? 1 : 0;
+
+    if (s_batch.len + separator + len + batch_trailer_size() > s_batch.max_size) {
+        telemetry_batch_flush();
+        separator = 0;
+
+        // message won't fit even in an empty batch
+        if (s_batch.len + len + batch_trailer_size() > s_batch.max_size) {
+            return -1;
+        }
+    }
+
+    if (s_batch.num_item == s_batch.max_item) {
+        int32_t max_item = s_batch.max_item ? s_batch.max_item * 2 : BATCH_INITIAL_ITEMS;
+        s_batch.items = (void **)REALLOC(s_batch.items, max_item * sizeof(void *));
+        s_batch.max_item = max_item;
+    }
+
+    if (separator) {
+        s_batch.buf[s_batch.len++] = ',';
+    }
+    memcpy(s_batch.buf + s_batch.len, message, len);
+    s_batch.len += len;
+    s_batch.items[s_batch.num_item++] = item;
+
+    if (s_batch.num_item == 1) {
+        struct timespec init = MS2SPEC(s_batch.max_latency_ms);
+        // zero timespec would disarm the timer, flush on next loop instead
+        if (s_batch.max_latency_ms == 0) {
+            init.tv_nsec = 1;
+        }
+        event_loop_set_timer(s_batch.flush_timer, &init, NULL);
+    }
+
+    return 0;
+}
+
+
+void telemetry_batch_flush(void)
+{
+    if (!telemetry_batch_enabled() || s_batch.num_item == 0) {
+        return;
+    }
+
+    event_loop_cancel_timer(s_batch.flush_timer);
+
+    batch_record_t *record = (batch_record_t *)MALLOC(sizeof(batch_record_t) + s_batch.num_item * sizeof(void *));
+    record->generation = s_batch.generation;
+    record->num_item = s_batch.num_item;
+    memcpy(record->items, s_batch.items, s_batch.num_item * sizeof(void *));
+
+    int err;
+    LOGI("Send telemetry batch, items=%d, size=%zu", s_batch.num_item, s_batch.len);
+    if (s_batch.binary) {
+        s_batch.buf[s_batch.len++] = CBOR_BREAK;
+        err = iot_send_binary_message_async(s_batch.buf, s_batch.len, IOT_MESSAGE_TYPE_TELEMETRY,
+                                            IOT_MESSAGE_CONTENT_TYPE_CBOR, NULL, NULL, batch_message_delivered,
+                                            record);
+    } else {
+        s_batch.buf[s_batch.len++] = ']';
+        s_batch.buf[s_batch.len++] = '\0';
+        err = iot_send_message_async((const char *)s_batch.buf, IOT_MESSAGE_TYPE_TELEMETRY,
+                                     batch_message_delivered, record);
+    }
+
+    start_batch();
+
+    // no delivery callback from iot layer if failed to send
+    if (err != 0) {
+        LOGW("Failed to send telemetry batch");
+        batch_message_delivered(false, record);
+    }
+}
+
+
+void telemetry_batch_reset(void)
+{
+    telemetry_batch_flush();
+    s_batch.generation++;
+}
@@ -0,0 +1,251 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include <init/globals.h>
+#include <init/telemetry_state.h>
+#include <utils/llog.h>
+#include <utils/timer.h>
+#include <utils/utils.h>
+#include <safeclib/safe_lib.h>
+
+const char STATE_FILE_MAGIC[8] = {'T', 'S', 'T', 'A', ' ', 'V', '0', '1'};
+
+// state file is a header followed by one record per device, each record
+// followed by its baseline values if they fit
+typedef struct state_file_hdr_t state_file_hdr_t;
+struct state_file_hdr_t {
+    char magic[8];
+    int64_t epoch;
+    // realtime ms when saved, to account time app was not running
+    int64_t saved_ms;
+    uint32_t count;
+    uint32_t size;
+    // hash of records, detect torn write
+    uint32_t check;
+    uint32_t reserved;
+};
+
+typedef struct state_record_t state_record_t;
+struct state_record_t {
+    // definition hash of device and its schema
+    uint64_t key;
+    // ms until next poll
+    int32_t next_ms;
+    // ms since last integrity report, -1 if not reported yet
+    int32_t flush_age_ms;
+    // number of baseline values following record, 0 if not saved
+    uint16_t num_value;
+    uint16_t reserved;
+    uint32_t reserved2;
+};
+
+#define STATE_DATA_SIZE (TELEMETRY_STATE_SIZE - sizeof(state_file_hdr_t))
+#define STATE_DATA_OFFSET (TELEMETRY_STATE_OFFSET + sizeof(state_file_hdr_t))
+
+
+static uint64_t device_key(const ce_device_t *device)
+{
+    return device->def_hash * 31 + device->schema->def_hash;
+}
+
+static int64_t realtime_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return SPEC2MS(ts);
+}
+
+static int64_t monotonic_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return SPEC2MS(ts);
+}
+
+// timespec of ms, which is negative if it was before boot, only compared by SPEC2MS
+static struct timespec ms2spec_signed(int64_t ms)
+{
+    struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000};
+    return ts;
+}
+
+static bool is_baseline_saved(const ce_device_t *device)
+{
+    return (device->schema->flags & FLAG_COV) && device->telemetry && !device->busy &&
+           device->telemetry->num_values == device->schema->num_point && device->schema->num_point <= UINT16_MAX;
+}
+
+static void restore_device(ce_device_t *device, const state_record_t *record, const double *values, int64_t downtime_ms)
+{
+    int64_t now_ms = monotonic_ms();
+
+    // keep phase of poll schedule, as many intervals as passed are skipped
+    int64_t next_ms = record->next_ms - downtime_ms;
+    if (device->interval > 0 && next_ms < 0) {
+        next_ms = ((next_ms % device->interval) + device->interval) % device->interval;
+    }
+    device->ts_schedule = ms2spec_signed(now_ms + MAX(next_ms, 0));
+
+    // integrity report stay due when it would have been
+    if (record->flush_age_ms >= 0) {
+        int64_t flush_age_ms = record->flush_age_ms + downtime_ms;
+        if (flush_age_ms < device->schema->integrity_period_ms) {
+            // 0 stands for never reported
+            int64_t ms_flush = now_ms - flush_age_ms;
+            device->last_flush_ts = ms2spec_signed(ms_flush ? ms_flush : -1);
+        }
+    }
+
+    telemetry_t *telemetry = device->telemetry;
+    if (values && telemetry && record->num_value == telemetry->num_values) {
+        for (int32_t i = 0; i < record->num_value; i++) {
+            telemetry->nums[i] = values[i];
+            if (telemetry->reported) {
+                telemetry->reported[i] = values[i];
+            }
+        }
+    }
+}
+
+// ------------------------------ public interface ----------------------------
+
+int32_t telemetry_state_save(const ce_device_t *devices, int64_t epoch)
+{
+    uint8_t *data = (uint8_t *)MALLOC(STATE_DATA_SIZE);
+    uint32_t size = 0;
+    int32_t count = 0;
+    int64_t now_ms = monotonic_ms();
+
+    for (const ce_device_t *device = devices; device; device = device->next) {
+        if (size + sizeof(state_record_t) > STATE_DATA_SIZE) {
+            break;
+        }
+
+        state_record_t *record = (state_record_t *)(data + size);
+        memset(record, 0, sizeof(*record));
+        record->key = device_key(device);
+        record->next_ms = SPEC2MS(device->ts_schedule) - now_ms;
+        int64_t ms_flush = SPEC2MS(device->last_flush_ts);
+        record->flush_age_ms = ms_flush ? now_ms - ms_flush : -1;
+        size += sizeof(state_record_t);
+        count++;
+
+        size_t values_size = device->schema->num_point * sizeof(double);
+        if (is_baseline_saved(device) && size + values_size <= STATE_DATA_SIZE) {
+            const telemetry_t *telemetry = device->telemetry;
+            double *values = (double *)(data + size);
+            for (int32_t i = 0; i < telemetry->num_values; i++) {
+                double value = telemetry->reported ? telemetry->reported[i] : telemetry->nums[i];
+                values[i] = IS_STR_VALUE(telemetry, i) ? NAN : value;
+            }
+            record->num_value = telemetry->num_values;
+            size += values_size;
+        }
+    }
+
+    state_file_hdr_t hdr;
+    memcpy_s(hdr.magic, sizeof(hdr.magic), STATE_FILE_MAGIC, sizeof(STATE_FILE_MAGIC));
+    hdr.epoch = epoch;
+    hdr.saved_ms = realtime_ms();
+    hdr.count = count;
+    hdr.size = size;
+    hdr.check = hash(data, size);
+    hdr.reserved = 0;
+
+    int fd = Storage_OpenMutableFile();
+    if (fd < 0) {
+        LOGE("Failed to open mutable storage");
+        FREE(data);
+        return -1;
+    }
+
+    int32_t ret = count;
+    if (pwrite(fd, data, size, STATE_DATA_OFFSET) != size ||
+        pwrite(fd, &hdr, sizeof(hdr), TELEMETRY_STATE_OFFSET) != sizeof(hdr)) {
+        LOGE("Failed to write telemetry state");
+        ret = -1;
+    }
+
+    fsync(fd);
+    close(fd);
+    FREE(data);
+
+    LOGI("Saved state of %d devices in %u bytes", count, size);
+    return ret;
+}
+
+
+int32_t telemetry_state_restore(ce_device_t *devices, int64_t epoch)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd < 0) {
+        LOGE("Failed to open mutable storage");
+        return 0;
+    }
+
+    state_file_hdr_t hdr;
+    if (pread(fd, &hdr, sizeof(hdr), TELEMETRY_STATE_OFFSET) != sizeof(hdr) ||
+        memcmp(hdr.magic, STATE_FILE_MAGIC, sizeof(STATE_FILE_MAGIC)) != 0 || hdr.size > STATE_DATA_SIZE) {
+        LOGI("No telemetry state saved");
+        close(fd);
+        return 0;
+    }
+
+    if (hdr.epoch != epoch) {
+        LOGI("Telemetry state is of another provision");
+        close(fd);
+        return 0;
+    }
+
+    uint8_t *data = (uint8_t *)MALLOC(MAX(hdr.size, 1));
+    bool valid = pread(fd, data, hdr.size, STATE_DATA_OFFSET) == hdr.size && hash(data, hdr.size) == hdr.check;
+    close(fd);
+
+    if (!valid) {
+        LOGW("Telemetry state corrupted");
+        FREE(data);
+        return 0;
+    }
+
+    // realtime may jump once synced, then time not running is unknown
+    int64_t downtime_ms = MAX(realtime_ms() - hdr.saved_ms, 0);
+    int32_t restored = 0;
+
+    for (ce_device_t *device = devices; device; device = device->next) {
+        uint64_t key = device_key(device);
+        uint32_t offset = 0;
+
+        for (uint32_t i = 0; i < hdr.count && offset + sizeof(state_record_t) <= hdr.size; i++) {
+            const state_record_t *record = (const state_record_t *)(data + offset);
+            size_t values_size = record->num_value * sizeof(double);
+            offset += sizeof(state_record_t);
+
+            if (offset + values_size > hdr.size) {
+                break;
+            }
+
+            if (record->key == key) {
+                restore_device(device, record, record->num_value ? (const double *)(data + offset) : NULL,
+                               downtime_ms);
+                restored++;
+                break;
+            }
+            offset += values_size;
+        }
+    }
+
+    FREE(data);
+    LOGI("Restored state of %d devices, %lld ms since saved", restored, downtime_ms);
+    return restored;
+}
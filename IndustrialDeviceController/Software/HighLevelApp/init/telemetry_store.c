@@ -0,0 +1,395 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+#include <applibs/eventloop.h>
+#include <applibs/storage.h>
+
+#include <init/globals.h>
+#include <init/telemetry_store.h>
+#include <iot/diag.h>
+#include <iot/iot.h>
+#include <utils/event_loop_timer.h>
+#include <utils/gzip.h>
+#include <utils/llog.h>
+#include <utils/memory.h>
+#include <utils/timer.h>
+#include <utils/utils.h>
+#include <safeclib/safe_lib.h>
+
+#define CBOR_INDEFINITE_ARRAY 0x9F
+#define CBOR_BREAK 0xFF
+
+const char STORE_FILE_MAGIC[8] = {'T', 'S', 'T', 'R', ' ', 'V', '0', '1'};
+
+// store is a ring of variable size records after the header, a record never
+// wraps, the space left at end of ring is skipped with a zero length record
+// if it can hold a record header
+typedef struct store_file_hdr_t store_file_hdr_t;
+struct store_file_hdr_t {
+    char magic[8];
+    uint32_t head;
+    uint32_t tail;
+    uint32_t count;
+};
+
+typedef struct store_record_t store_record_t;
+struct store_record_t {
+    uint16_t len;
+    uint8_t binary;
+    uint8_t reserved;
+    // hash of message, detect torn write
+    uint32_t check;
+    uint8_t data[];
+};
+
+#define STORE_DATA_SIZE (TELEMETRY_STORE_SIZE - sizeof(store_file_hdr_t))
+#define STORE_DATA_OFFSET (TELEMETRY_STORE_OFFSET + sizeof(store_file_hdr_t))
+
+typedef struct telemetry_store_t telemetry_store_t;
+struct telemetry_store_t {
+    EventLoop *eloop;
+    event_loop_timer_t *drain_timer;
+
+    // copy of data area in mutable storage, records are read from here
+    uint8_t *data;
+    uint32_t head;
+    uint32_t tail;
+    int32_t count;
+
+    // replay message inflight, covering drain_count records from head
+    bool draining;
+    int32_t drain_count;
+    uint8_t *raw;
+    uint8_t *packed;
+
+    // bumped on deinit so result of replay sent before is ignored
+    uint32_t generation;
+};
+
+static telemetry_store_t s_store;
+
+
+static inline store_record_t *record_at(uint32_t offset)
+{
+    return (store_record_t *)(s_store.data + offset);
+}
+
+static inline uint32_t record_size(size_t len)
+{
+    // keep record header aligned
+    return (sizeof(store_record_t) + len + 3) & ~3u;
+}
+
+// offset of the record at or after offset, skipping end of ring
+static uint32_t record_start(uint32_t offset)
+{
+    if ((STORE_DATA_SIZE - offset < sizeof(store_record_t)) || (record_at(offset)->len == 0)) {
+        return 0;
+    }
+    return offset;
+}
+
+static uint32_t next_record(uint32_t offset)
+{
+    offset = record_start(offset);
+    return offset + record_size(record_at(offset)->len);
+}
+
+static uint32_t record_check(const store_record_t *record)
+{
+    return hash(record->data, record->len) ^ record->binary;
+}
+
+static void write_store(uint32_t offset, size_t len, bool with_hdr)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd < 0) {
+        LOGE("can't open mutable file");
+        return;
+    }
+
+    if (len > 0) {
+        pwrite(fd, s_store.data + offset, len, STORE_DATA_OFFSET + offset);
+    }
+
+    if (with_hdr) {
+        store_file_hdr_t hdr;
+        memcpy_s(hdr.magic, sizeof(STORE_FILE_MAGIC), STORE_FILE_MAGIC, sizeof(STORE_FILE_MAGIC));
+        hdr.head = s_store.head;
+        hdr.tail = s_store.tail;
+        hdr.count = s_store.count;
+        pwrite(fd, &hdr, sizeof(hdr), TELEMETRY_STORE_OFFSET);
+    }
+    close(fd);
+}
+
+// check if size bytes from offset are free, wrapped tells offset is start of ring
+static bool space_free(uint32_t offset, uint32_t size, bool wrapped)
+{
+    if (s_store.count == 0) {
+        return true;
+    }
+
+    if (s_store.head < s_store.tail) {
+        // live data in one piece, only start of ring can collide with it
+        return !wrapped || (offset + size <= s_store.head);
+    }
+
+    // live data wraps around, free space is between tail and head
+    return !wrapped && (offset + size <= s_store.head);
+}
+
+static void drop_oldest(void)
+{
+    s_store.head = next_record(s_store.head);
+    s_store.count--;
+    if (s_store.count == 0) {
+        s_store.head = s_store.tail = 0;
+    }
+    diag_log_count_value("telemetry_store_dropped");
+}
+
+static int32_t load_store(void)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd < 0) {
+        LOGE("can't open mutable file");
+        return -1;
+    }
+
+    store_file_hdr_t hdr;
+    bool valid = (pread(fd, &hdr, sizeof(hdr), TELEMETRY_STORE_OFFSET) == sizeof(hdr)) &&
+                 (memcmp(hdr.magic, STORE_FILE_MAGIC, sizeof(STORE_FILE_MAGIC)) == 0) &&
+                 (hdr.head < STORE_DATA_SIZE) && (hdr.tail <= STORE_DATA_SIZE);
+
+    // file end at last record written, rest of ring never been used
+    memset(s_store.data, 0, STORE_DATA_SIZE);
+    if (valid && pread(fd, s_store.data, STORE_DATA_SIZE, STORE_DATA_OFFSET) < 0) {
+        valid = false;
+    }
+    close(fd);
+
+    s_store.head = s_store.tail = 0;
+    s_store.count = 0;
+    if (!valid) {
+        return 0;
+    }
+
+    // keep intact records from head, a torn write only lose records after it
+    uint32_t offset = hdr.head;
+    for (uint32_t i = 0; i < hdr.count; i++) {
+        offset = record_start(offset);
+        store_record_t *record = record_at(offset);
+        if ((offset + record_size(record->len) > STORE_DATA_SIZE) || (record->check != record_check(record))) {
+            LOGW("Drop %u corrupted stored telemetry", hdr.count - i);
+            break;
+        }
+        if (i == 0) {
+            s_store.head = offset;
+        }
+        offset += record_size(record->len);
+        s_store.count++;
+    }
+    s_store.tail = s_store.count ? offset : 0;
+    return s_store.count;
+}
+
+static void release_drained(void)
+{
+    for (int32_t i = 0; i < s_store.drain_count && s_store.count > 0; i++) {
+        s_store.head = next_record(s_store.head);
+        s_store.count--;
+    }
+    if (s_store.count == 0) {
+        s_store.head = s_store.tail = 0;
+    }
+    write_store(0, 0, true);
+}
+
+static void replay_delivered(bool delivered, void *context)
+{
+    if ((uint32_t)(uintptr_t)context != s_store.generation) {
+        return;
+    }
+
+    if (delivered) {
+        LOGI("Replayed %d stored telemetry, %d left", s_store.drain_count, s_store.count - s_store.drain_count);
+        release_drained();
+    } else {
+        LOGW("Stored telemetry replay failed");
+    }
+    s_store.draining = false;
+}
+
+// join records of same encoding from head into one batch, return its size
+static size_t build_replay_batch(bool *binary)
+{
+    uint32_t offset = s_store.head;
+    size_t len = 1;
+
+    *binary = record_at(record_start(offset))->binary;
+    s_store.raw[0] = *binary ? CBOR_INDEFINITE_ARRAY : '[';
+    s_store.drain_count = 0;
+
+    while (s_store.drain_count < s_store.count) {
+        offset = record_start(offset);
+        store_record_t *record = record_at(offset);
+        // separator for JSON, trailer for both
+        size_t need = record->len + (*binary ? 0 : 1) + 1;
+
+        if ((record->binary != *binary) || (len + need > TELEMETRY_STORE_DRAIN_SIZE)) {
+            break;
+        }
+
+        if (!*binary && s_store.drain_count > 0) {
+            s_store.raw[len++] = ',';
+        }
+        memcpy(s_store.raw + len, record->data, record->len);
+        len += record->len;
+        s_store.drain_count++;
+        offset += record_size(record->len);
+    }
+
+    s_store.raw[len++] = *binary ? CBOR_BREAK : ']';
+    return len;
+}
+
+static void drain_timer_callback(void *context)
+{
+    if (s_store.draining || s_store.count == 0 || !iot_is_connected()) {
+        return;
+    }
+
+    bool binary;
+    size_t len = build_replay_batch(&binary);
+
+    // message larger than a replay batch, can never be sent
+    if (s_store.drain_count == 0) {
+        LOGW("Drop stored telemetry too large to replay");
+        s_store.drain_count = 1;
+        release_drained();
+        return;
+    }
+
+    const char *content_type = binary ? IOT_MESSAGE_CONTENT_TYPE_CBOR : IOT_MESSAGE_CONTENT_TYPE;
+    const uint8_t *payload = s_store.raw;
+    const char *encoding = binary ? NULL : IOT_MESSAGE_CONTENT_ENCODING;
+
+    size_t packed_len = gzip_compress(s_store.raw, len, s_store.packed, TELEMETRY_STORE_DRAIN_SIZE);
+    if (packed_len > 0 && packed_len < len) {
+        payload = s_store.packed;
+        encoding = IOT_MESSAGE_CONTENT_ENCODING_GZIP;
+        len = packed_len;
+    }
+
+    LOGI("Replay stored telemetry, items=%d, size=%zu, encoding=%s", s_store.drain_count, len,
+         encoding ? encoding : "none");
+    if (iot_send_binary_message_async(payload, len, IOT_MESSAGE_TYPE_TELEMETRY, content_type, encoding, NULL,
+                                      replay_delivered, (void *)(uintptr_t)s_store.generation) == 0) {
+        s_store.draining = true;
+    }
+}
+
+// ---------------------------- public interface ------------------------------
+
+int telemetry_store_init(EventLoop *eloop)
+{
+    ASSERT(eloop);
+
+    s_store.eloop = eloop;
+    s_store.data = (uint8_t *)MALLOC(STORE_DATA_SIZE);
+    s_store.raw = (uint8_t *)MALLOC(TELEMETRY_STORE_DRAIN_SIZE);
+    s_store.packed = (uint8_t *)MALLOC(TELEMETRY_STORE_DRAIN_SIZE);
+    s_store.draining = false;
+
+    if (load_store() > 0) {
+        LOGI("Loaded %d stored telemetry", s_store.count);
+    }
+
+    struct timespec interval = MS2SPEC(TELEMETRY_STORE_DRAIN_MS);
+    s_store.drain_timer = event_loop_register_timer(eloop, &interval, &interval, NULL, drain_timer_callback, NULL);
+    if (!s_store.drain_timer) {
+        LOGE("Failed to register telemetry store timer");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void telemetry_store_deinit(void)
+{
+    s_store.generation++;
+    s_store.draining = false;
+
+    if (s_store.drain_timer) {
+        event_loop_unregister_timer(s_store.eloop, s_store.drain_timer);
+        s_store.drain_timer = NULL;
+    }
+
+    FREE(s_store.data);
+    FREE(s_store.raw);
+    FREE(s_store.packed);
+    s_store.count = 0;
+}
+
+
+int telemetry_store_put(const void *message, size_t len, bool binary)
+{
+    ASSERT(message);
+
+    uint32_t size = record_size(len);
+    if (!s_store.data || len == 0 || len > UINT16_MAX || size > STORE_DATA_SIZE) {
+        return -1;
+    }
+
+    while (true) {
+        uint32_t offset = s_store.count ? s_store.tail : 0;
+        bool wrapped = offset + size > STORE_DATA_SIZE;
+        if (wrapped) {
+            offset = 0;
+        }
+
+        if (space_free(offset, size, wrapped)) {
+            if (wrapped && STORE_DATA_SIZE - s_store.tail >= sizeof(store_record_t)) {
+                record_at(s_store.tail)->len = 0;
+                write_store(s_store.tail, sizeof(store_record_t), false);
+            }
+
+            store_record_t *record = record_at(offset);
+            record->len = len;
+            record->binary = binary;
+            record->reserved = 0;
+            memcpy(record->data, message, len);
+            record->check = record_check(record);
+
+            if (s_store.count == 0) {
+                s_store.head = offset;
+            }
+            s_store.tail = offset + size;
+            s_store.count++;
+            write_store(offset, size, true);
+            return 0;
+        }
+
+        // message being replayed already been handed to iot layer, it can go
+        drop_oldest();
+        if (s_store.draining && s_store.drain_count > 0) {
+            s_store.drain_count--;
+        }
+    }
+}
+
+
+int32_t telemetry_store_count(void)
+{
+    return s_store.count;
+}
@@ -5,12 +5,18 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <applibs/application.h>
 #include <applibs/log.h>
+#include <applibs/networking.h>
 #include <applibs/storage.h>
 #include <azureiot/azure_sphere_provisioning.h>
+#include <azure_prov_client/prov_device_ll_client.h>
+#include <azure_prov_client/prov_security_factory.h>
+#include <azure_prov_client/prov_transport_mqtt_client.h>
 #include <azureiot/iothub.h>
 #include <azureiot/iothub_client_core_common.h>
 #include <azureiot/iothub_client_options.h>
@@ -19,6 +25,7 @@
 
 #include <init/globals.h>
 #include <utils/llog.h>
+#include <utils/timer.h>
 #include <utils/utils.h>
 #include <safeclib/safe_lib.h>
 #include <iot/diag.h>
@@ -33,6 +40,9 @@ struct d2c_context_t {
     size_t payload_size;
     message_delivery_confirmation_func_t delivery_callback;
     void *context;
+    // when message handed to IoTHubClient, for telemetry delivery latency
+    struct timespec ts_send;
+    bool telemetry;
 };
 
 typedef struct twin_report_context_t twin_report_context_t;
@@ -42,10 +52,26 @@ struct twin_report_context_t {
     void *context;
 };
 
+// result of registering with DPS
+typedef struct dps_context_t dps_context_t;
+struct dps_context_t {
+    bool done;
+    PROV_DEVICE_RESULT result;
+    char hub[IOT_MAX_HOSTNAME_LEN];
+};
+
 // String containing the scope id of the Device Provisioning Service
 // used to provision the app with the IoT hub hostname and the device id.
 static const char scopeId[] = "xxxxxxxxxxx";
 
+static const char dpsUrl[] = "global.azure-devices-provisioning.net";
+
+// device id is the Azure Sphere device id from DAA certificate
+static bool deviceIdForDaaCertUsage = true;
+
+// hub the client was last set up for, empty until set up
+static char iothub_hostname[IOT_MAX_HOSTNAME_LEN];
+
 static device_twin_update_func_t device_twin_update_cb = 0;
 
 static connection_status_func_t connection_status_cb = 0;
@@ -54,6 +80,10 @@ static message_received_func_t message_received_cb = 0;
 
 static IOTHUB_DEVICE_CLIENT_LL_HANDLE iothub_client_handle = NULL;
 
+static histogram_t *delivery_hist = NULL;
+
+static bool first_telemetry_delivered = false;
+
 static bool iothub_authenticated = false;
 
 static int keepalive_period_seconds = 240;
@@ -95,9 +125,9 @@ static const char *get_reason_string(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reas
     return reason_string;
 }
 
-static char *get_azure_sphere_provisioning_result_string(AZURE_SPHERE_PROV_RETURN_VALUE provisioning_result)
+static char *get_azure_sphere_provisioning_result_string(AZURE_SPHERE_PROV_RESULT provisioning_result)
 {
-    switch (provisioning_result.result) {
+    switch (provisioning_result) {
     case AZURE_SPHERE_PROV_RESULT_OK:
         return "AZURE_SPHERE_PROV_RESULT_OK";
     case AZURE_SPHERE_PROV_RESULT_INVALID_PARAM:
@@ -110,6 +140,8 @@ static char *get_azure_sphere_provisioning_result_string(AZURE_SPHERE_PROV_RETUR
         return "AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR";
     case AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR:
         return "AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR";
+    case AZURE_SPHERE_PROV_RESULT_IOTHUB_CLIENT_ERROR:
+        return "AZURE_SPHERE_PROV_RESULT_IOTHUB_CLIENT_ERROR";
     default:
         return "UNKNOWN_RETURN_VALUE";
     }
@@ -142,6 +174,17 @@ static void send_message_callback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void
         inflight_message_size = 0;
     }
 
+    if (ctx->telemetry && delivery_hist && result == IOTHUB_CLIENT_CONFIRMATION_OK) {
+        histogram_record(delivery_hist, timer_stopwatch_stop(&ctx->ts_send));
+    }
+
+    if (ctx->telemetry && !first_telemetry_delivered && result == IOTHUB_CLIENT_CONFIRMATION_OK) {
+        first_telemetry_delivered = true;
+        struct timespec ts_uptime;
+        clock_gettime(CLOCK_BOOTTIME, &ts_uptime);
+        diag_log_value("boot_to_telemetry_ms", SPEC2MS(ts_uptime));
+    }
+
     if (ctx->delivery_callback) {
         ctx->delivery_callback(result == IOTHUB_CLIENT_CONFIRMATION_OK, ctx->context);
     }
@@ -204,6 +247,8 @@ bool azure_iot_initialize(void)
         LOGE("failed initializing platform.");
         return false;
     }
+
+    delivery_hist = diag_histogram("iot_delivery_ms");
     return true;
 }
 
@@ -222,27 +267,117 @@ void azure_iot_destroy_client(void)
     }
 }
 
-AZURE_SPHERE_PROV_RESULT azure_iot_setup_client(size_t quota, void *context)
+static void dps_register_callback(PROV_DEVICE_RESULT register_result, const char *iothub_uri, const char *device_id,
+                                  void *context)
 {
-    LOGI("Connecting to IoTHub...");
+    dps_context_t *ctx = (dps_context_t *)context;
+    ctx->done = true;
+    ctx->result = register_result;
+
+    if (register_result == PROV_DEVICE_RESULT_OK && iothub_uri) {
+        LOGI("DPS assigned %s to hub %s", device_id ? device_id : "device", iothub_uri);
+        strncpy_s(ctx->hub, sizeof(ctx->hub), iothub_uri, sizeof(ctx->hub) - 1);
+    }
+}
 
+
+static AZURE_SPHERE_PROV_RESULT check_ready(void)
+{
+    bool ready = false;
+    if (Networking_IsNetworkingReady(&ready) != 0 || !ready) {
+        return AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY;
+    }
+
+    ready = false;
+    if (Application_IsDeviceAuthReady(&ready) != 0 || !ready) {
+        return AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY;
+    }
+    return AZURE_SPHERE_PROV_RESULT_OK;
+}
+
+
+// register with DPS and block until it assigned a hub or timeout, as
+// IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning does
+// but keeping hub it assigned
+static AZURE_SPHERE_PROV_RESULT dps_register(int32_t timeout_ms, char *hub, size_t hub_size)
+{
+    if (prov_dev_security_init(SECURE_DEVICE_TYPE_X509) != 0) {
+        LOGE("failed to initialize DPS security");
+        return AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR;
+    }
+
+    AZURE_SPHERE_PROV_RESULT result = AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR;
+    dps_context_t ctx = {.done = false};
+    PROV_DEVICE_LL_HANDLE prov_handle = Prov_Device_LL_Create(dpsUrl, scopeId, Prov_Device_MQTT_Protocol);
+
+    if (!prov_handle) {
+        LOGE("failed to create DPS client");
+        prov_dev_security_deinit();
+        return AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR;
+    }
+
+    if (Prov_Device_LL_SetOption(prov_handle, "SetDeviceId", &deviceIdForDaaCertUsage) != PROV_DEVICE_RESULT_OK ||
+        Prov_Device_LL_Register_Device(prov_handle, dps_register_callback, &ctx, NULL, NULL) != PROV_DEVICE_RESULT_OK) {
+        LOGE("failed to register device with DPS");
+        result = AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR;
+    } else {
+        struct timespec dps_sw;
+        timer_stopwatch_start(&dps_sw);
+
+        while (!ctx.done && timer_stopwatch_stop(&dps_sw) < timeout_ms) {
+            Prov_Device_LL_DoWork(prov_handle);
+            usleep(100 * 1000);
+        }
+
+        if (!ctx.done) {
+            LOGE("DPS registration timed out");
+        } else if (ctx.result == PROV_DEVICE_RESULT_OK && ctx.hub[0]) {
+            strcpy_s(hub, hub_size, ctx.hub);
+            result = AZURE_SPHERE_PROV_RESULT_OK;
+        } else {
+            LOGE("DPS registration failed: %d", ctx.result);
+        }
+    }
+
+    Prov_Device_LL_Destroy(prov_handle);
+    prov_dev_security_deinit();
+    return result;
+}
+
+
+AZURE_SPHERE_PROV_RESULT azure_iot_setup_client(size_t quota, const char *hub, void *context)
+{
     azure_iot_destroy_client();
 
-    AZURE_SPHERE_PROV_RETURN_VALUE prov_result =
-        IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning(scopeId, 30000, &iothub_client_handle);
+    AZURE_SPHERE_PROV_RESULT prov_result = check_ready();
 
-    LOGI("IoTHubDeviceClient_CreateWithAzureSphereDeviceAuthProvisioning returned '%s'.",
-         get_azure_sphere_provisioning_result_string(prov_result));
+    if (prov_result == AZURE_SPHERE_PROV_RESULT_OK && !hub) {
+        LOGI("Provisioning with DPS...");
+        prov_result = dps_register(IOT_DPS_TIMEOUT_MS, iothub_hostname, sizeof(iothub_hostname));
+    } else if (prov_result == AZURE_SPHERE_PROV_RESULT_OK) {
+        strncpy_s(iothub_hostname, sizeof(iothub_hostname), hub, sizeof(iothub_hostname) - 1);
+    }
 
-    if (prov_result.result != AZURE_SPHERE_PROV_RESULT_OK) {
-        return prov_result.result;
+    if (prov_result != AZURE_SPHERE_PROV_RESULT_OK) {
+        LOGE("Failed to setup client: %s", get_azure_sphere_provisioning_result_string(prov_result));
+        return prov_result;
     }
 
+    LOGI("Connecting to IoTHub %s...", iothub_hostname);
+    iothub_client_handle = IoTHubDeviceClient_LL_CreateWithAzureSphereFromDeviceAuth(iothub_hostname, MQTT_Protocol);
+
     if (iothub_client_handle == NULL) {
         LOGE("failed to create handler");
         return AZURE_SPHERE_PROV_RESULT_IOTHUB_CLIENT_ERROR;
     }
 
+    if (IoTHubDeviceClient_LL_SetOption(iothub_client_handle, "SetDeviceId", &deviceIdForDaaCertUsage) !=
+        IOTHUB_CLIENT_OK) {
+        LOGE("failed to set device id option");
+        azure_iot_destroy_client();
+        return AZURE_SPHERE_PROV_RESULT_IOTHUB_CLIENT_ERROR;
+    }
+
     if (IoTHubDeviceClient_LL_SetRetryPolicy(iothub_client_handle, IOTHUB_CLIENT_RETRY_NONE, 0) != IOTHUB_CLIENT_OK) {
         LOGE("failed to set retry policy");
         azure_iot_destroy_client();
@@ -284,6 +419,12 @@ AZURE_SPHERE_PROV_RESULT azure_iot_setup_client(size_t quota, void *context)
 }
 
 
+const char *azure_iot_get_hostname(void)
+{
+    return iothub_hostname[0] ? iothub_hostname : NULL;
+}
+
+
 void azure_iot_do_periodic_tasks(void)
 {
     if (iothub_client_handle) {
@@ -310,6 +451,40 @@ void azure_iot_set_connection_status_callback(connection_status_func_t callback)
 }
 
 
+static int send_message_handle_async(IOTHUB_MESSAGE_HANDLE message_handle, size_t message_len, const char *message_type,
+                                     const char *content_type, const char *content_encoding,
+                                     message_delivery_confirmation_func_t callback, void *context)
+{
+    // Set the system property of the message
+    IoTHubMessage_SetContentTypeSystemProperty(message_handle, content_type);
+    if (content_encoding) {
+        IoTHubMessage_SetContentEncodingSystemProperty(message_handle, content_encoding);
+    }
+
+    // Set the application property of the message
+    IoTHubMessage_SetProperty(message_handle, "message_type", message_type);
+
+    d2c_context_t *ctx = CALLOC(1, sizeof(d2c_context_t));
+    ctx->payload_size = message_len;
+    ctx->delivery_callback = callback;
+    ctx->context = context;
+    ctx->telemetry = strcmp(message_type, IOT_MESSAGE_TYPE_TELEMETRY) == 0;
+    timer_stopwatch_start(&ctx->ts_send);
+
+    if (IoTHubDeviceClient_LL_SendEventAsync(iothub_client_handle, message_handle, send_message_callback,
+                                             (void *)ctx) != IOTHUB_CLIENT_OK) {
+        LOGE("failed to hand over the message to IoTHubClient");
+        FREE(ctx);
+        IoTHubMessage_Destroy(message_handle);
+        return -1;
+    }
+
+    inflight_message_size += message_len;
+    IoTHubMessage_Destroy(message_handle);
+    return 0;
+}
+
+
 int azure_iot_send_message_async(const char *message, const char *message_type,
     message_delivery_confirmation_func_t callback, void *context)
 {
@@ -327,29 +502,50 @@ int azure_iot_send_message_async(const char *message, const char *message_type,
         return -1;
     }
 
-    // Set the system property of the message
-    IoTHubMessage_SetContentTypeSystemProperty(message_handle, IOT_MESSAGE_CONTENT_TYPE);
-    IoTHubMessage_SetContentEncodingSystemProperty(message_handle, IOT_MESSAGE_CONTENT_ENCODING);
+    return send_message_handle_async(message_handle, message_len, message_type, IOT_MESSAGE_CONTENT_TYPE,
+                                     IOT_MESSAGE_CONTENT_ENCODING, callback, context);
+}
 
-    // Set the application property of the message
-    IoTHubMessage_SetProperty(message_handle, "message_type", message_type);
 
-    d2c_context_t *ctx = CALLOC(1, sizeof(d2c_context_t));
-    ctx->payload_size = message_len;
-    ctx->delivery_callback = callback;
-    ctx->context = context;    
+int azure_iot_send_priority_message_async(const char *message, const char *message_type,
+                                          message_delivery_confirmation_func_t callback, void *context)
+{
+    IOTHUB_MESSAGE_HANDLE message_handle = IoTHubMessage_CreateFromString(message);
 
-    if (IoTHubDeviceClient_LL_SendEventAsync(iothub_client_handle, message_handle, send_message_callback,
-                                             (void *)ctx) != IOTHUB_CLIENT_OK) {
-        LOGE("failed to hand over the message to IoTHubClient");
-        FREE(ctx);
-        IoTHubMessage_Destroy(message_handle);
+    if (message_handle == 0) {
+        LOGE("unable to create a new IoTHubMessage");
         return -1;
     }
 
-    inflight_message_size += message_len;
-    IoTHubMessage_Destroy(message_handle);
-    return 0;
+    IoTHubMessage_SetProperty(message_handle, "priority", "high");
+    return send_message_handle_async(message_handle, strlen(message), message_type, IOT_MESSAGE_CONTENT_TYPE,
+                                     IOT_MESSAGE_CONTENT_ENCODING, callback, context);
+}
+
+
+int azure_iot_send_binary_message_async(const uint8_t *payload, size_t payload_size, const char *message_type,
+                                        const char *content_type, const char *content_encoding,
+                                        const message_property_t *properties,
+                                        message_delivery_confirmation_func_t callback, void *context)
+{
+    if (inflight_message_quota && (inflight_message_size + payload_size > inflight_message_quota)) {
+        LOGE("Exceed inflight message quota");
+        return -1;
+    }
+
+    IOTHUB_MESSAGE_HANDLE message_handle = IoTHubMessage_CreateFromByteArray(payload, payload_size);
+
+    if (message_handle == 0) {
+        LOGE("unable to create a new IoTHubMessage");
+        return -1;
+    }
+
+    for (const message_property_t *p = properties; p && p->key; p++) {
+        IoTHubMessage_SetProperty(message_handle, p->key, p->value);
+    }
+
+    return send_message_handle_async(message_handle, payload_size, message_type, content_type, content_encoding,
+                                     callback, context);
 }
 
 
@@ -383,3 +579,9 @@ bool azure_iot_is_connected(void)
 {
     return iothub_client_handle && iothub_authenticated;
 }
+
+
+bool azure_iot_has_pending_work(void)
+{
+    return iothub_client_handle && (inflight_message_size > 0 || !iothub_authenticated);
+}
@@ -4,6 +4,7 @@
 #include <math.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,63 +35,309 @@
 #define MAX_EVENT_IN_MEMORY 500
 #define MAX_MAC_ADDRESS_SIZE 20
 
-const char EVENT_FILE_MAGIC[8] = {'D', 'I', 'A', 'G', ' ', 'V', '0', '4'};
+const char EVENT_FILE_MAGIC[8] = {'D', 'I', 'A', 'G', ' ', 'V', '0', '5'};
 
 typedef struct event_t event_t;
 struct event_t {
     struct timespec ts;
     uint16_t code;
     uint16_t repeat;
+    // journal sequence number, 0 if not written to journal yet
+    uint32_t seq;
+};
+
+// p95 estimated with P-square algorithm, 5 markers instead of keeping samples
+#define DIAG_STATS_QUANTILE 0.95
+#define DIAG_STATS_MARKERS 5
+
+// aggregation of samples logged since last diag telemetry report
+typedef struct diag_stats_t diag_stats_t;
+struct diag_stats_t {
+    uint32_t count;
+    double min;
+    double max;
+    double sum;
+    // marker heights, first samples in arrival order until all markers set
+    double q[DIAG_STATS_MARKERS];
+    int32_t n[DIAG_STATS_MARKERS];
+    double np[DIAG_STATS_MARKERS];
 };
 
 typedef struct diag_value_t diag_value_t;
 struct diag_value_t {
     char *key;
     double value;
-    diag_value_t *next;
+    // bumped when slot is released, so a stale handle no longer match
+    uint16_t gen;
+    bool used;
+    diag_stats_t *stats;
 };
 
+// open addressing index over value slots, 0 for empty slot, -1 for removed
+// slot, otherwise slot index + 1
+#define DIAG_VALUE_INDEX_SIZE (2 * DIAG_MAX_VALUES)
+#define DIAG_INDEX_REMOVED (-1)
+
+#define DIAG_HANDLE(slot, gen) (((uint32_t)(gen) << 16) | ((uint32_t)(slot) + 1))
+#define DIAG_HANDLE_SLOT(h) ((int32_t)((h) & 0xFFFF) - 1)
+#define DIAG_HANDLE_GEN(h) ((uint16_t)((h) >> 16))
+
+// event file is an append only journal, a checkpoint header followed by a
+// ring of fixed size records. record with sequence number seq lives in slot
+// seq % EVENT_JOURNAL_RECORDS, events from head are not reported yet, up to
+// the first slot not holding the next sequence number
 typedef struct event_file_hdr_t event_file_hdr_t;
 struct event_file_hdr_t {
     char magic[8];
-    int32_t size;
+    uint32_t head;
 };
 
+typedef struct event_record_t event_record_t;
+struct event_record_t {
+    uint32_t seq;
+    // hash of remaining fields, detect torn write
+    uint32_t check;
+    int64_t sec;
+    int32_t nsec;
+    uint16_t code;
+    uint16_t repeat;
+};
+
+#define EVENT_JOURNAL_RECORDS ((EVENT_FILE_SIZE - sizeof(event_file_hdr_t)) / sizeof(event_record_t))
+#define EVENT_RECORD_OFFSET(seq) \
+    (EVENT_FILE_OFFSET + sizeof(event_file_hdr_t) + ((seq) % EVENT_JOURNAL_RECORDS) * sizeof(event_record_t))
+
+// events not in journal yet are written in batches, event logged to file sync
+// all immediately
+#define EVENT_JOURNAL_BATCH 16
+
+// top level properties of device twin reported
+typedef struct twin_state_t twin_state_t;
+struct twin_state_t {
+    char *name;
+    char *source_id;
+    const char *firmware;
+    int64_t last_boot;
+    int64_t last_app_start;
+    int64_t last_online;
+    int64_t last_offline;
+    int64_t last_provision;
+    char wifi_mac[MAX_MAC_ADDRESS_SIZE];
+    char eth_mac[MAX_MAC_ADDRESS_SIZE];
+    bool wifi_connected;
+    bool eth_connected;
+    // boot time of provision the device list belongs to
+    struct timespec provisioned;
+    // error of each device in list order, devices only valid while building
+    // the patch
+    ce_device_t *devices;
+    int32_t num_device;
+    int32_t *device_err;
+    // devices only probed as they stopped answering
+    int32_t open_breakers;
+};
 
 typedef struct diag_t diag_t;
 struct diag_t {
     pthread_mutex_t lock;
-    diag_value_t *values;
+    // values are logged from device worker threads too
+    pthread_mutex_t values_lock;
+    diag_value_t values[DIAG_MAX_VALUES];
+    int16_t value_index[DIAG_VALUE_INDEX_SIZE];
     event_loop_timer_t *heartbeat_timer;
     event_loop_timer_t *report_events_timer;
     event_loop_timer_t *report_twins_timer;
     event_loop_timer_t *report_telemetry_timer;
     event_loop_timer_t *report_log_timer;
     event_loop_timer_t *led_update_timer;
+    event_loop_timer_t *report_memory_timer;
 
     struct timespec ts_app_start;
     struct timespec ts_last_d2c;
     event_t events[MAX_EVENT_IN_MEMORY];
     int num_events;
-    char *reported_device_twin;
+    // events from first_dirty are new or changed since last journal write
+    int first_dirty;
+    uint32_t journal_head;
+    uint32_t journal_tail;
+    bool journal_head_dirty;
+    // device twin state last acknowledged by hub, NULL until first report
+    twin_state_t *reported_twin;
+    char wifi_mac[MAX_MAC_ADDRESS_SIZE];
+    char eth_mac[MAX_MAC_ADDRESS_SIZE];
     EventLoop *eloop;
 };
 
-static diag_t s_diag;
+static diag_t s_diag = {.values_lock = PTHREAD_MUTEX_INITIALIZER};
+
+// allocator counters published as diag values, see diag_report_memory_cb
+enum { MEM_CLASS_USED, MEM_CLASS_MAX, MEM_CLASS_ALLOCS, MEM_CLASS_FREES, MEM_CLASS_OVERFLOW, MEM_CLASS_VALUES };
+static const char *const s_mem_class_suffix[MEM_CLASS_VALUES] = {"used", "max", "allocs", "frees", "overflow"};
+
+typedef struct diag_memory_t diag_memory_t;
+struct diag_memory_t {
+    diag_handle_t live;
+    diag_handle_t peak;
+    diag_handle_t classes[MEMORY_NUM_CLASSES][MEM_CLASS_VALUES];
+};
+
+typedef struct diag_histogram_t diag_histogram_t;
+struct diag_histogram_t {
+    char key[DIAG_HISTOGRAM_KEY_SIZE];
+    histogram_t hist;
+};
+
+// kept out of s_diag, modules initialized before diag get their histogram too
+static pthread_mutex_t s_histograms_lock = PTHREAD_MUTEX_INITIALIZER;
+static diag_histogram_t s_histograms[DIAG_MAX_HISTOGRAMS];
+static int32_t s_num_histograms = 0;
+
+_Static_assert(DIAG_VALUE_INDEX_SIZE <= INT16_MAX && !(DIAG_VALUE_INDEX_SIZE & (DIAG_VALUE_INDEX_SIZE - 1)),
+               "diag value index must be a power of 2 addressable by int16_t");
+
+static void stats_reset(diag_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+static void stats_add(diag_stats_t *stats, double x)
+{
+    static const double dn[DIAG_STATS_MARKERS] = {0, DIAG_STATS_QUANTILE / 2, DIAG_STATS_QUANTILE,
+                                                  (1 + DIAG_STATS_QUANTILE) / 2, 1};
+    double *q = stats->q;
+    int32_t *n = stats->n;
+
+    stats->min = stats->count ? MIN(stats->min, x) : x;
+    stats->max = stats->count ? MAX(stats->max, x) : x;
+    stats->sum += x;
+
+    if (stats->count < DIAG_STATS_MARKERS) {
+        q[stats->count++] = x;
+        if (stats->count == DIAG_STATS_MARKERS) {
+            qsort(q, DIAG_STATS_MARKERS, sizeof(double), compare_double);
+            for (int i = 0; i < DIAG_STATS_MARKERS; i++) {
+                n[i] = i;
+                stats->np[i] = 4 * dn[i];
+            }
+        }
+        return;
+    }
+    stats->count++;
+
+    // cell the sample falls in, extending extreme markers if needed
+    int k;
+    if (x < q[0]) {
+        q[0] = x;
+        k = 0;
+    } else if (x >= q[4]) {
+        q[4] = x;
+        k = 3;
+    } else {
+        for (k = 0; k < 3 && x >= q[k + 1]; k++) {
+        }
+    }
+
+    for (int i = k + 1; i < DIAG_STATS_MARKERS; i++) {
+        n[i]++;
+    }
+    for (int i = 0; i < DIAG_STATS_MARKERS; i++) {
+        stats->np[i] += dn[i];
+    }
+
+    // move middle markers toward desired positions
+    for (int i = 1; i < 4; i++) {
+        double d = stats->np[i] - n[i];
+        if ((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1)) {
+            int ds = d > 0 ? 1 : -1;
+            double qp = q[i] + (double)ds / (n[i + 1] - n[i - 1]) *
+                                   ((n[i] - n[i - 1] + ds) * (q[i + 1] - q[i]) / (n[i + 1] - n[i]) +
+                                    (n[i + 1] - n[i] - ds) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+            if (q[i - 1] < qp && qp < q[i + 1]) {
+                q[i] = qp;
+            } else {
+                q[i] += ds * (q[i + ds] - q[i]) / (n[i + ds] - n[i]);
+            }
+            n[i] += ds;
+        }
+    }
+}
+
+static double stats_quantile(const diag_stats_t *stats)
+{
+    if (stats->count >= DIAG_STATS_MARKERS) {
+        return stats->q[2];
+    }
+
+    // too few samples for markers, pick from sorted samples
+    double sorted[DIAG_STATS_MARKERS];
+    memcpy(sorted, stats->q, stats->count * sizeof(double));
+    qsort(sorted, stats->count, sizeof(double), compare_double);
+    int32_t rank = (int32_t)ceil(DIAG_STATS_QUANTILE * stats->count) - 1;
+    return sorted[MAX(rank, 0)];
+}
 
 // diag telemetry
 static int printf_diag_points(struct json_out *out, va_list *ap)
 {
     diag_value_t *values = va_arg(*ap, struct diag_value_t *);
     int len = json_printf(out, "[");
+    bool first = true;
 
-    for (diag_value_t *point = values; point; point = point->next) {
+    for (int32_t i = 0; i < DIAG_MAX_VALUES; i++) {
+        diag_value_t *point = &values[i];
+        // registered but nothing logged yet
+        if (!point->used || isnan(point->value)) {
+            continue;
+        }
 
-        if (point != values) {
+        if (!first) {
             len += json_printf(out, ",");
         }
+        first = false;
         len += json_printf(out, "[%Q,\"%.0f\"]", point->key, point->value);
+
+        // aggregated values since last report instead of every sample
+        diag_stats_t *stats = point->stats;
+        if (stats && stats->count > 0) {
+            len += json_printf(out, ",[\"%s_min\",\"%.0f\"],[\"%s_max\",\"%.0f\"]", point->key, stats->min,
+                               point->key, stats->max);
+            len += json_printf(out, ",[\"%s_mean\",\"%.0f\"],[\"%s_p95\",\"%.0f\"]", point->key,
+                               stats->sum / stats->count, point->key, stats_quantile(stats));
+            stats_reset(stats);
+        }
     }
+
+    pthread_mutex_lock(&s_histograms_lock);
+    for (int32_t i = 0; i < s_num_histograms; i++) {
+        histogram_t hist;
+        histogram_take(&s_histograms[i].hist, &hist);
+        if (hist.total == 0) {
+            continue;
+        }
+
+        const char *key = s_histograms[i].key;
+        char buckets[HISTOGRAM_NUM_BUCKETS * 16];
+        histogram_print(&hist, buckets, sizeof(buckets));
+
+        if (!first) {
+            len += json_printf(out, ",");
+        }
+        first = false;
+        len += json_printf(out, "[\"%s_p50\",\"%u\"],[\"%s_p90\",\"%u\"]", key, histogram_percentile(&hist, 50),
+                           key, histogram_percentile(&hist, 90));
+        len += json_printf(out, ",[\"%s_p99\",\"%u\"],[\"%s_max\",\"%u\"]", key, histogram_percentile(&hist, 99),
+                           key, hist.max);
+        len += json_printf(out, ",[\"%s_hist\",%Q]", key, buckets);
+    }
+    pthread_mutex_unlock(&s_histograms_lock);
+
     len += json_printf(out, "]");
     return len;
 }
@@ -98,11 +345,13 @@ static int printf_diag_points(struct json_out *out, va_list *ap)
 
 static char *build_diag_telemetry_message(void)
 {
+    pthread_mutex_lock(&s_diag.values_lock);
     char *iot_message = json_asprintf("{timestamp:%Q,name:%Q,location:%Q,point:%M}",
                                       timespec2str(now()),
                                       adapter_get_name(),
                                       adapter_get_location(),
                                       printf_diag_points, s_diag.values);
+    pthread_mutex_unlock(&s_diag.values_lock);
 
     return iot_message;
 }
@@ -132,18 +381,108 @@ static void diag_report_telemetry_cb(void *context)
     }
 }
 
+// return index slot holding key, or the first free one key can be inserted at
+static int32_t find_index_slot(const char *key, bool *found)
+{
+    uint32_t mask = DIAG_VALUE_INDEX_SIZE - 1;
+    uint32_t i = hash((const unsigned char *)key, strlen(key)) & mask;
+    int32_t insert_at = -1;
+
+    *found = false;
+    for (uint32_t probe = 0; probe < DIAG_VALUE_INDEX_SIZE; probe++, i = (i + 1) & mask) {
+        int16_t entry = s_diag.value_index[i];
+        if (entry == 0) {
+            return insert_at >= 0 ? insert_at : (int32_t)i;
+        } else if (entry == DIAG_INDEX_REMOVED) {
+            if (insert_at < 0) {
+                insert_at = i;
+            }
+        } else if (strcmp(s_diag.values[entry - 1].key, key) == 0) {
+            *found = true;
+            return i;
+        }
+    }
+    return insert_at;
+}
+
 static diag_value_t* find_diag_value(const char* key)
 {
-    for (diag_value_t *p = s_diag.values; p; p = p->next) {
+    bool found;
+    int32_t i = find_index_slot(key, &found);
+    return found ? &s_diag.values[s_diag.value_index[i] - 1] : NULL;
+}
+
+// find or add value, NULL if all slots taken
+static diag_value_t *register_diag_value_locked(const char *key)
+{
+    bool found;
+    int32_t i = find_index_slot(key, &found);
+    if (found) {
+        return &s_diag.values[s_diag.value_index[i] - 1];
+    }
 
-        if (strcmp(p->key, key) == 0) {
-            return p;
-        }
+    int32_t slot = 0;
+    while (slot < DIAG_MAX_VALUES && s_diag.values[slot].used) {
+        slot++;
     }
 
-    return NULL;
+    if (i < 0 || slot == DIAG_MAX_VALUES) {
+        LOGW("Too many diag values, drop %s", key);
+        return NULL;
+    }
+
+    diag_value_t *p = &s_diag.values[slot];
+    p->key = STRDUP(key);
+    p->value = NAN;
+    p->used = true;
+    s_diag.value_index[i] = slot + 1;
+    return p;
 }
 
+static void set_diag_value_locked(diag_value_t *p, double value)
+{
+    p->value = value;
+    if (p->stats) {
+        stats_add(p->stats, value);
+    }
+}
+
+static diag_handle_t register_diag_handle(const char *key, bool stats)
+{
+    pthread_mutex_lock(&s_diag.values_lock);
+    diag_value_t *p = register_diag_value_locked(key);
+    if (p && stats && !p->stats) {
+        p->stats = (diag_stats_t *)CALLOC(1, sizeof(diag_stats_t));
+    }
+    diag_handle_t h = p ? DIAG_HANDLE(p - s_diag.values, p->gen) : DIAG_INVALID_HANDLE;
+    pthread_mutex_unlock(&s_diag.values_lock);
+    return h;
+}
+
+
+histogram_t *diag_histogram(const char *key)
+{
+    histogram_t *h = NULL;
+
+    pthread_mutex_lock(&s_histograms_lock);
+    for (int32_t i = 0; i < s_num_histograms && !h; i++) {
+        if (strcmp(s_histograms[i].key, key) == 0) {
+            h = &s_histograms[i].hist;
+        }
+    }
+
+    if (!h && s_num_histograms < DIAG_MAX_HISTOGRAMS) {
+        diag_histogram_t *entry = &s_histograms[s_num_histograms++];
+        strncpy_s(entry->key, sizeof(entry->key), key, sizeof(entry->key) - 1);
+        histogram_reset(&entry->hist);
+        h = &entry->hist;
+    } else if (!h) {
+        LOGW("Too many diag histograms, drop %s", key);
+    }
+    pthread_mutex_unlock(&s_histograms_lock);
+
+    return h;
+}
 
 // diag events
 //1/1/2010, any time stamp before this been regraded as invalid RTC for our solution
@@ -173,6 +512,67 @@ static int printf_events(struct json_out *out, va_list *ap)
     return len;
 }
 
+static uint32_t event_record_check(const event_record_t *rec)
+{
+    return hash((const unsigned char *)&rec->sec, sizeof(*rec) - offsetof(event_record_t, sec));
+}
+
+static void write_event_record(int fd, const event_t *event)
+{
+    event_record_t rec = {.seq = event->seq,
+                          .sec = event->ts.tv_sec,
+                          .nsec = event->ts.tv_nsec,
+                          .code = event->code & 0x7FFF,
+                          .repeat = event->repeat};
+    rec.check = event_record_check(&rec);
+    pwrite(fd, &rec, sizeof(rec), EVENT_RECORD_OFFSET(rec.seq));
+}
+
+static void write_event_journal_hdr(int fd)
+{
+    event_file_hdr_t hdr;
+    memcpy_s(hdr.magic, sizeof(EVENT_FILE_MAGIC), EVENT_FILE_MAGIC, sizeof(EVENT_FILE_MAGIC));
+    hdr.head = s_diag.journal_head;
+    pwrite(fd, &hdr, sizeof(hdr), EVENT_FILE_OFFSET);
+    s_diag.journal_head_dirty = false;
+}
+
+// append new events and rewrite changed ones, checkpoint head if it moved
+static int sync_event_journal(bool durable)
+{
+    if (s_diag.first_dirty >= s_diag.num_events && !s_diag.journal_head_dirty) return 0;
+
+    int fd = Storage_OpenMutableFile();
+    if (fd < 0) {
+        LOGE("can't open mutable file");
+        return -1;
+    }
+
+    for (int i = s_diag.first_dirty; i < s_diag.num_events; i++) {
+        event_t *event = &s_diag.events[i];
+        if (event->seq == 0) {
+            event->seq = s_diag.journal_tail++;
+            // ring is full, oldest record been overwritten
+            if (s_diag.journal_tail - s_diag.journal_head > EVENT_JOURNAL_RECORDS) {
+                s_diag.journal_head = s_diag.journal_tail - EVENT_JOURNAL_RECORDS;
+                s_diag.journal_head_dirty = true;
+            }
+        }
+        write_event_record(fd, event);
+    }
+    s_diag.first_dirty = s_diag.num_events;
+
+    if (s_diag.journal_head_dirty) {
+        write_event_journal_hdr(fd);
+    }
+
+    if (durable) {
+        fdatasync(fd);
+    }
+    close(fd);
+    return 0;
+}
+
 static void remove_events_upto(struct timespec *ts)
 {
     int nremove = 0;
@@ -184,6 +584,16 @@ static void remove_events_upto(struct timespec *ts)
     if (nremove > 0) {
         memmove(s_diag.events, s_diag.events + nremove, (s_diag.num_events - nremove) * sizeof(event_t));
         s_diag.num_events -= nremove;
+        s_diag.first_dirty = MAX(s_diag.first_dirty - nremove, 0);
+
+        // events are journaled in order, so remaining journaled events are a
+        // prefix. head never move back, first event may been overwritten already
+        uint32_t head = (s_diag.num_events > 0 && s_diag.events[0].seq) ? s_diag.events[0].seq : s_diag.journal_tail;
+        if (head > s_diag.journal_head) {
+            s_diag.journal_head = head;
+            s_diag.journal_head_dirty = true;
+            sync_event_journal(false);
+        }
     }
 }
 
@@ -200,30 +610,6 @@ static void event_message_delivered(bool delivered, void *context)
     FREE(last_event_ts);
 }
 
-static int save_events_to_file(void)
-{
-    if (s_diag.num_events <= 0) return 0;
-
-    event_file_hdr_t hdr;
-    memcpy_s(hdr.magic, sizeof(EVENT_FILE_MAGIC), EVENT_FILE_MAGIC, sizeof(EVENT_FILE_MAGIC));
-    hdr.size = s_diag.num_events * sizeof(event_t);
-
-    int fd = Storage_OpenMutableFile();
-    if (fd < 0) {
-        LOGE("can't open mutable file");
-        return -1;
-    }
-
-    lseek(fd, EVENT_FILE_OFFSET, SEEK_SET);
-    write(fd, &hdr, sizeof(event_file_hdr_t));
-    write(fd, s_diag.events, hdr.size);
-    s_diag.num_events = 0;
-    fsync(fd);
-    close(fd);
-    return 0;
-}
-
-
 static void log_event_internal(event_code_t code, bool flush)
 {
     // avoid reentry
@@ -232,12 +618,15 @@ static void log_event_internal(event_code_t code, bool flush)
     if ((s_diag.num_events > 0) && (code == s_diag.events[s_diag.num_events - 1].code)) {
         s_diag.events[s_diag.num_events - 1].repeat++;
         clock_gettime(CLOCK_REALTIME, &s_diag.events[s_diag.num_events - 1].ts);
+        s_diag.first_dirty = MIN(s_diag.first_dirty, s_diag.num_events - 1);
         LOGD("log repeat event: [%d %d]", code, s_diag.events[s_diag.num_events - 1].repeat);
     } else {
         if (s_diag.num_events < MAX_EVENT_IN_MEMORY) {
             s_diag.events[s_diag.num_events].code = code;
             s_diag.events[s_diag.num_events].repeat = 1;
+            s_diag.events[s_diag.num_events].seq = 0;
             clock_gettime(CLOCK_REALTIME, &s_diag.events[s_diag.num_events].ts);
+            s_diag.first_dirty = MIN(s_diag.first_dirty, s_diag.num_events);
             s_diag.num_events++;
             LOGD("log new event: [%d %d]", code, s_diag.events[s_diag.num_events - 1].repeat);
         } else {
@@ -245,8 +634,8 @@ static void log_event_internal(event_code_t code, bool flush)
         }
     }
 
-    if (flush) {
-        save_events_to_file();
+    if (flush || s_diag.num_events - s_diag.first_dirty >= EVENT_JOURNAL_BATCH) {
+        sync_event_journal(flush);
     }
     pthread_mutex_unlock(&s_diag.lock);
 }
@@ -278,47 +667,57 @@ static void diag_report_events_cb(void *context)
     }
 }
 
-static void clear_event_file(int fd)
+// start an empty journal
+static void reset_event_journal(int fd)
 {
-    event_file_hdr_t hdr;
-    memcpy_s(hdr.magic, sizeof(EVENT_FILE_MAGIC), EVENT_FILE_MAGIC, sizeof(EVENT_FILE_MAGIC));
-    hdr.size = 0;
-    lseek(fd, EVENT_FILE_OFFSET, SEEK_SET);
-    write(fd, &hdr, sizeof(event_file_hdr_t));
+    s_diag.journal_head = 1;
+    s_diag.journal_tail = 1;
+    write_event_journal_hdr(fd);
     fdatasync(fd);
 }
 
-// return number of event loaded from file
-static int load_event_from_file(int fd)
+// load events not reported yet from journal, return number of event loaded
+static int load_event_journal(int fd)
 {
     event_file_hdr_t hdr;
 
-    if (lseek(fd, EVENT_FILE_OFFSET, SEEK_SET) != EVENT_FILE_OFFSET) {
+    if (pread(fd, &hdr, sizeof(hdr), EVENT_FILE_OFFSET) != sizeof(hdr)) {
         LOGW("event file not exist");
+        reset_event_journal(fd);
         return 0;
     }
 
-    if (read(fd, &hdr, sizeof(event_file_hdr_t)) != sizeof(event_file_hdr_t)) {
-        LOGW("Failed to read event file hdr");
-        return 0;
-    }
-
-    if (memcmp(hdr.magic, EVENT_FILE_MAGIC, sizeof(EVENT_FILE_MAGIC)) != 0) {
+    if ((memcmp(hdr.magic, EVENT_FILE_MAGIC, sizeof(EVENT_FILE_MAGIC)) != 0) || (hdr.head == 0)) {
         LOGW("event file magic mismatch");
+        reset_event_journal(fd);
         return 0;
     }
 
-    if ((hdr.size < 0) || (hdr.size > EVENT_FILE_SIZE) || (hdr.size % sizeof(event_t) != 0)) {
-        LOGW("event file size incorrect");
-        return 0;
-    }
+    size_t size = EVENT_JOURNAL_RECORDS * sizeof(event_record_t);
+    event_record_t *records = (event_record_t *)MALLOC(size);
+    ssize_t nread = pread(fd, records, size, EVENT_FILE_OFFSET + sizeof(event_file_hdr_t));
+    int32_t nrecords = nread > 0 ? nread / sizeof(event_record_t) : 0;
 
-    if (read(fd, s_diag.events, hdr.size) != hdr.size) {
-        LOGW("Failed to load event from file");
-        return 0;
+    uint32_t seq = hdr.head;
+    s_diag.num_events = 0;
+    while (s_diag.num_events < MIN(MAX_EVENT_IN_MEMORY, (int)EVENT_JOURNAL_RECORDS)) {
+        int32_t slot = seq % EVENT_JOURNAL_RECORDS;
+        if (slot >= nrecords || records[slot].seq != seq || records[slot].check != event_record_check(&records[slot])) {
+            break;
+        }
+
+        event_t *event = &s_diag.events[s_diag.num_events++];
+        event->ts.tv_sec = records[slot].sec;
+        event->ts.tv_nsec = records[slot].nsec;
+        event->code = records[slot].code;
+        event->repeat = records[slot].repeat;
+        event->seq = seq++;
     }
+    FREE(records);
 
-    s_diag.num_events = hdr.size/sizeof(event_t);
+    s_diag.journal_head = hdr.head;
+    s_diag.journal_tail = seq;
+    s_diag.first_dirty = s_diag.num_events;
     LOGD("loaded %d event from file", s_diag.num_events);
 
     return s_diag.num_events;
@@ -350,103 +749,188 @@ static void diag_report_log_cb(void *context)
     }
 }
 
-// device twin
+// device twin, reported as patch of top level properties changed since state
+// last acknowledged by hub. Provision section is reset to null by every
+// provision so it is sent in full when adapter provisioned since, otherwise
+// only devices whose error changed
+static twin_state_t *build_twin_state(void)
+{
+    if (!adapter_get_source_id()) return NULL;
+
+    // mac doesn't change, look it up until interface show up
+    if (!s_diag.wifi_mac[0]) {
+        network_get_mac("wlan0", s_diag.wifi_mac, sizeof(s_diag.wifi_mac));
+    }
+    if (!s_diag.eth_mac[0]) {
+        network_get_mac("eth0", s_diag.eth_mac, sizeof(s_diag.eth_mac));
+    }
+
+    twin_state_t *state = (twin_state_t *)CALLOC(1, sizeof(twin_state_t));
+    state->name = adapter_get_name() ? STRDUP(adapter_get_name()) : NULL;
+    state->source_id = STRDUP(adapter_get_source_id());
+    state->firmware = app_version();
+
+    struct timespec ts_boot = {.tv_sec = 0, .tv_nsec = 0};
+    state->last_boot = timespec2epoch(boottime2realtime(ts_boot));
+    state->last_app_start = timespec2epoch(boottime2realtime(s_diag.ts_app_start));
+    state->last_online = timespec2epoch(boottime2realtime(iot_last_online()));
+    state->last_offline = timespec2epoch(boottime2realtime(iot_last_offline()));
+    state->provisioned = adapter_last_provisioned();
+    state->last_provision = timespec2epoch(boottime2realtime(state->provisioned));
+
+    strcpy_s(state->wifi_mac, sizeof(state->wifi_mac), s_diag.wifi_mac);
+    strcpy_s(state->eth_mac, sizeof(state->eth_mac), s_diag.eth_mac);
+    state->wifi_connected = network_is_interface_connected("wlan0");
+    state->eth_connected = network_is_interface_connected("eth0");
+
+    state->devices = adapter_get_devices();
+    for (ce_device_t *device = state->devices; device; device = device->next) {
+        state->num_device++;
+    }
+    if (state->num_device > 0) {
+        state->device_err = (int32_t *)MALLOC(state->num_device * sizeof(int32_t));
+        int32_t i = 0;
+        for (ce_device_t *device = state->devices; device; device = device->next) {
+            state->device_err[i++] = device->err;
+            state->open_breakers += device->breaker != BREAKER_CLOSED;
+        }
+    }
+
+    return state;
+}
+
+static void free_twin_state(twin_state_t *state)
+{
+    if (state) {
+        FREE(state->name);
+        FREE(state->source_id);
+        FREE(state->device_err);
+        FREE(state);
+    }
+}
+
+static bool is_str_changed(const char *cur, const char *acked)
+{
+    if (!cur || !acked) {
+        return cur != acked;
+    }
+    return strcmp(cur, acked) != 0;
+}
+
+// whether provision section is sent in full, device list and order are the
+// same until adapter is provisioned again
+static bool is_provision_reset(const twin_state_t *cur, const twin_state_t *acked)
+{
+    return !acked || timespec_compare(&cur->provisioned, &acked->provisioned) != 0;
+}
+
+static int32_t count_provision_changes(const twin_state_t *cur, const twin_state_t *acked)
+{
+    if (is_provision_reset(cur, acked)) {
+        return cur->num_device;
+    }
+
+    int32_t num = 0;
+    for (int32_t i = 0; i < cur->num_device; i++) {
+        if (cur->device_err[i] != acked->device_err[i]) {
+            num++;
+        }
+    }
+    return num;
+}
+
 static int32_t printf_provisions(struct json_out *out, va_list *ap)
 {
+    const twin_state_t *cur = va_arg(*ap, const twin_state_t *);
+    const twin_state_t *acked = va_arg(*ap, const twin_state_t *);
+    bool reset = is_provision_reset(cur, acked);
     int32_t num = 0;
     int32_t len = json_printf(out, "{");
 
-    for (ce_device_t *device = va_arg(*ap, struct ce_device_t *); device; device = device->next) {
+    int32_t i = 0;
+    for (ce_device_t *device = cur->devices; device && i < cur->num_device; device = device->next, i++) {
+        if (!reset && cur->device_err[i] == acked->device_err[i]) {
+            continue;
+        }
 
         if (num++ > 0) {
             len += json_printf(out, ",");
         }
 
-        len += json_printf(out, "%Q:%d", device->name, device->err);
+        len += json_printf(out, "%Q:%d", device->name, cur->device_err[i]);
     }
 
     len += json_printf(out, "}");
     return len;
 }
 
-static char *build_device_twin_to_report(void)
+static int32_t printf_twin_patch(struct json_out *out, va_list *ap)
 {
-    if (!adapter_get_source_id()) return NULL;
-
-    char wifiMac[MAX_MAC_ADDRESS_SIZE];
-    char ethMac[MAX_MAC_ADDRESS_SIZE];
+    const twin_state_t *cur = va_arg(*ap, const twin_state_t *);
+    const twin_state_t *acked = va_arg(*ap, const twin_state_t *);
+    int32_t num = 0;
+    int32_t len = json_printf(out, "{");
 
-    network_get_mac("wlan0", wifiMac, sizeof(wifiMac));
-    network_get_mac("eth0", ethMac, sizeof(ethMac));
+#define TWIN_PATCH(changed, fmt, ...)                                                                                  \
+    if (changed) {                                                                                                     \
+        if (num++ > 0) {                                                                                               \
+            len += json_printf(out, ",");                                                                              \
+        }                                                                                                              \
+        len += json_printf(out, fmt, __VA_ARGS__);                                                                     \
+    }
 
-    bool wifi_connected = network_is_interface_connected("wlan0");
-    bool eth_connected = network_is_interface_connected("eth0");
+    TWIN_PATCH(!acked || is_str_changed(cur->name, acked->name), "name:%Q", cur->name);
+    TWIN_PATCH(!acked || is_str_changed(cur->source_id, acked->source_id), "sourceId:%Q", cur->source_id);
+    TWIN_PATCH(!acked || is_str_changed(cur->firmware, acked->firmware), "firmwareVersion:%Q", cur->firmware);
+    TWIN_PATCH(!acked || cur->last_boot != acked->last_boot, "lastBoot:%" PRId64, cur->last_boot);
+    TWIN_PATCH(!acked || cur->last_app_start != acked->last_app_start, "lastAppStart:%" PRId64, cur->last_app_start);
+    TWIN_PATCH(!acked || cur->last_online != acked->last_online, "lastOnline:%" PRId64, cur->last_online);
+    TWIN_PATCH(!acked || cur->last_offline != acked->last_offline, "lastOffline:%" PRId64, cur->last_offline);
+    TWIN_PATCH(!acked || cur->last_provision != acked->last_provision, "lastProvision:%" PRId64, cur->last_provision);
+    TWIN_PATCH(!acked || strcmp(cur->wifi_mac, acked->wifi_mac) != 0, "wifiMac:%Q", cur->wifi_mac);
+    TWIN_PATCH(!acked || strcmp(cur->eth_mac, acked->eth_mac) != 0, "ethMac:%Q", cur->eth_mac);
+    TWIN_PATCH(!acked || cur->wifi_connected != acked->wifi_connected, "wifiConnected:%B", cur->wifi_connected);
+    TWIN_PATCH(!acked || cur->eth_connected != acked->eth_connected, "ethConnected:%B", cur->eth_connected);
+    TWIN_PATCH(!acked || cur->open_breakers != acked->open_breakers, "openBreakers:%d", cur->open_breakers);
+    TWIN_PATCH(count_provision_changes(cur, acked) > 0 || is_provision_reset(cur, acked), "provision:%M",
+               printf_provisions, cur, acked);
+
+#undef TWIN_PATCH
 
-    struct timespec ts_boot = {.tv_sec = 0, .tv_nsec = 0};
-    int64_t boot_epoch = timespec2epoch(boottime2realtime(ts_boot));
-    int64_t app_start_epoch = timespec2epoch(boottime2realtime(s_diag.ts_app_start));
-    int64_t online_epoch = timespec2epoch(boottime2realtime(iot_last_online()));
-    int64_t offline_epoch = timespec2epoch(boottime2realtime(iot_last_offline()));
-    int64_t provisioned_epoch = timespec2epoch(boottime2realtime(adapter_last_provisioned()));
-
-    char *twin = json_asprintf("{"
-                      "name:%Q,"
-                      "sourceId:%Q,"
-                      "firmwareVersion:%Q,"
-                      "lastBoot:%"PRId64","
-                      "lastAppStart:%"PRId64","
-                      "lastOnline:%"PRId64","
-                      "lastOffline:%"PRId64","
-                      "lastProvision:%"PRId64","
-                      "wifiMac:%Q,"
-                      "ethMac:%Q,"
-                      "wifiConnected:%B,"
-                      "ethConnected:%B,"
-                      "provision:%M"
-                      "}",
-                      adapter_get_name(),
-                      adapter_get_source_id(),
-                      app_version(),
-                      boot_epoch,
-                      app_start_epoch,
-                      online_epoch,
-                      offline_epoch,
-                      provisioned_epoch,
-                      wifiMac,
-                      ethMac,
-                      wifi_connected,
-                      eth_connected,
-                      printf_provisions, adapter_get_devices());
-
-    return twin;
+    len += json_printf(out, "}");
+    return len;
 }
 
 static void device_twin_reported(bool delivered, void *context)
 {
-    char *twin_to_report = (char*)context;
+    twin_state_t *state = (twin_state_t *)context;
     if (delivered) {
-        FREE(s_diag.reported_device_twin);
-        s_diag.reported_device_twin = twin_to_report;
+        free_twin_state(s_diag.reported_twin);
+        s_diag.reported_twin = state;
     } else {
-        FREE(twin_to_report);
+        free_twin_state(state);
     }
 }
 
 static void diag_report_twins(void)
 {
-    char *twin_to_report = build_device_twin_to_report();
+    twin_state_t *state = build_twin_state();
 
-    if (!twin_to_report) return;
+    if (!state) return;
 
-    if (s_diag.reported_device_twin == NULL || strcmp(twin_to_report, s_diag.reported_device_twin) != 0) {
-        LOGI("TWIN-UPDATE: %s", twin_to_report);
-        if (iot_report_device_twin_async(twin_to_report, device_twin_reported, twin_to_report) != 0) {
+    char *patch = json_asprintf("%M", printf_twin_patch, state, s_diag.reported_twin);
+
+    if (patch && strcmp(patch, "{}") != 0) {
+        LOGI("TWIN-UPDATE: %s", patch);
+        if (iot_report_device_twin_async(patch, device_twin_reported, state) != 0) {
             LOGE("Failed to report device twin");
-            FREE(twin_to_report);
+            free_twin_state(state);
         }
     } else {
-        FREE(twin_to_report);
+        free_twin_state(state);
     }
+
+    FREE(patch);
 }
 
 static void diag_report_twins_cb(void *context)
@@ -456,14 +940,10 @@ static void diag_report_twins_cb(void *context)
     }
 }
 
-static void report_network_status_change(Networking_InterfaceConnectionStatus status)
+static void report_network_status_change(Networking_InterfaceConnectionStatus status, void *context)
 {
-    static Networking_InterfaceConnectionStatus last_network_status = 0;
-    if (status != last_network_status) {
-        last_network_status = status;
-        diag_log_event(network_status_to_event(status));
-        LOGI("network status [%u] %s", status, network_get_status_str(status));
-    }
+    diag_log_event(network_status_to_event(status));
+    LOGI("network status [%u] %s", status, network_get_status_str(status));
 }
 
 // led
@@ -522,12 +1002,56 @@ static void update_app_led(void)
 
 static void diag_led_update_cb(void *context)
 {
-    Networking_InterfaceConnectionStatus status = network_get_status();
-    report_network_status_change(status);
-    update_network_led(status);
+    update_network_led(network_get_status());
     update_app_led();
 }
 
+static void register_memory_values(diag_memory_t *mem)
+{
+    memory_stats_t stats;
+    memory_get_stats(&stats);
+
+    mem->live = diag_register("mem_live");
+    mem->peak = diag_register("mem_peak");
+
+    for (int i = 0; i < MEMORY_NUM_CLASSES; i++) {
+        for (int j = 0; j < MEM_CLASS_VALUES; j++) {
+            char key[DIAG_HISTOGRAM_KEY_SIZE];
+            if (stats.classes[i].size) {
+                snprintf(key, sizeof(key), "mem_%zu_%s", stats.classes[i].size, s_mem_class_suffix[j]);
+            } else if (j != MEM_CLASS_OVERFLOW) {
+                snprintf(key, sizeof(key), "mem_heap_%s", s_mem_class_suffix[j]);
+            } else {
+                // the heap doesn't overflow
+                mem->classes[i][j] = DIAG_INVALID_HANDLE;
+                continue;
+            }
+            mem->classes[i][j] = diag_register(key);
+        }
+    }
+}
+
+// the counters are kept by the allocator, publishing them is a copy rather
+// than the walk MEMORY_REPORT does, see process_c2d_debug for that
+static void diag_report_memory_cb(void *context)
+{
+    diag_memory_t *mem = (diag_memory_t *)context;
+    memory_stats_t stats;
+    memory_get_stats(&stats);
+
+    diag_log_handle(mem->live, stats.live_bytes);
+    diag_log_handle(mem->peak, stats.peak_bytes);
+
+    for (int i = 0; i < MEMORY_NUM_CLASSES; i++) {
+        const memory_class_stats_t *c = &stats.classes[i];
+        diag_log_handle(mem->classes[i][MEM_CLASS_USED], c->num_used);
+        diag_log_handle(mem->classes[i][MEM_CLASS_MAX], c->max_used);
+        diag_log_handle(mem->classes[i][MEM_CLASS_ALLOCS], c->num_alloc);
+        diag_log_handle(mem->classes[i][MEM_CLASS_FREES], c->num_free);
+        diag_log_handle(mem->classes[i][MEM_CLASS_OVERFLOW], c->num_overflow);
+    }
+}
+
 static void detect_offline_recover_reboot(void)
 {
     struct timespec ts_now;
@@ -568,6 +1092,7 @@ static void diag_heartbeat_cb(void *context)
 static int init_diag_event(void)
 {
     s_diag.num_events = 0;
+    s_diag.first_dirty = 0;
 
     if (pthread_mutex_init(&s_diag.lock, NULL) != 0) {
         LOGE("mutex init has failed");
@@ -580,9 +1105,7 @@ static int init_diag_event(void)
         return -1;
     }
 
-    if (load_event_from_file(fd) > 0) {
-        clear_event_file(fd);
-    }
+    load_event_journal(fd);
     close(fd);
     return 0;
 }
@@ -603,53 +1126,76 @@ static void detect_system_reboot(void)
 static int schedule_heartbeat(void)
 {
     struct timespec ts_heartbeat = MS2SPEC(DIAG_HEARTBEAT_MS);
-    s_diag.heartbeat_timer = event_loop_register_timer(s_diag.eloop, &ts_heartbeat, &ts_heartbeat, diag_heartbeat_cb, NULL);
+    struct timespec ts_slack = MS2SPEC(DIAG_TIMER_SLACK_MS);
+    s_diag.heartbeat_timer = event_loop_register_timer(s_diag.eloop, &ts_heartbeat, &ts_heartbeat, &ts_slack, diag_heartbeat_cb, NULL);
     return s_diag.heartbeat_timer ? 0 : -1;
 }
 
 static int schedule_report_events(void)
 {
     struct timespec ts_event = MS2SPEC(DIAG_EVENT_REPORT_MS);
-    s_diag.report_events_timer = event_loop_register_timer(s_diag.eloop, &ts_event, &ts_event, diag_report_events_cb, NULL);
+    struct timespec ts_slack = MS2SPEC(DIAG_TIMER_SLACK_MS);
+    s_diag.report_events_timer = event_loop_register_timer(s_diag.eloop, &ts_event, &ts_event, &ts_slack, diag_report_events_cb, NULL);
     return s_diag.report_events_timer ? 0 : -1;
 }
 
 static int schedule_report_twin(void)
 {
     struct timespec ts_twin = MS2SPEC(DIAG_TWIN_REPORT_MS);
-    s_diag.report_twins_timer = event_loop_register_timer(s_diag.eloop, &ts_twin, &ts_twin, diag_report_twins_cb, NULL);
+    struct timespec ts_slack = MS2SPEC(DIAG_TIMER_SLACK_MS);
+    s_diag.report_twins_timer = event_loop_register_timer(s_diag.eloop, &ts_twin, &ts_twin, &ts_slack, diag_report_twins_cb, NULL);
     return s_diag.report_twins_timer ? 0 : -1;
 }
 
 static int schedule_report_telemetry(void)
 {
     struct timespec ts_telemetry = MS2SPEC(DIAG_TELEMETRY_REPORT_MS);
-    s_diag.report_telemetry_timer = event_loop_register_timer(s_diag.eloop, &ts_telemetry, &ts_telemetry, diag_report_telemetry_cb, NULL);
+    struct timespec ts_slack = MS2SPEC(DIAG_TIMER_SLACK_MS);
+    s_diag.report_telemetry_timer = event_loop_register_timer(s_diag.eloop, &ts_telemetry, &ts_telemetry, &ts_slack, diag_report_telemetry_cb, NULL);
     return s_diag.report_telemetry_timer ? 0 : -1;
 }
 
 static int schedule_report_log(void)
 {
     struct timespec ts_log = MS2SPEC(DIAG_LOG_REPORT_MS);
-    s_diag.report_log_timer = event_loop_register_timer(s_diag.eloop, &ts_log, &ts_log, diag_report_log_cb, NULL);
+    struct timespec ts_slack = MS2SPEC(DIAG_TIMER_SLACK_MS);
+    s_diag.report_log_timer = event_loop_register_timer(s_diag.eloop, &ts_log, &ts_log, &ts_slack, diag_report_log_cb, NULL);
     return s_diag.report_log_timer ? 0 : -1;
 }
 
 static int schedule_update_led(void)
 {
     struct timespec ts_led = MS2SPEC(DIAG_LED_UPDATE_MS);
-    s_diag.led_update_timer = event_loop_register_timer(s_diag.eloop, &ts_led, &ts_led, diag_led_update_cb, NULL);
+    struct timespec ts_slack = MS2SPEC(DIAG_LED_UPDATE_SLACK_MS);
+    s_diag.led_update_timer = event_loop_register_timer(s_diag.eloop, &ts_led, &ts_led, &ts_slack, diag_led_update_cb, NULL);
     return s_diag.led_update_timer ? 0 : -1;
 }
 
+static int schedule_report_memory(void)
+{
+    static diag_memory_t s_memory;
+    register_memory_values(&s_memory);
+
+    struct timespec ts_memory = MS2SPEC(DIAG_MEMORY_REPORT_MS);
+    struct timespec ts_slack = MS2SPEC(DIAG_TIMER_SLACK_MS);
+    s_diag.report_memory_timer = event_loop_register_timer(s_diag.eloop, &ts_memory, &ts_memory, &ts_slack, diag_report_memory_cb, &s_memory);
+    return s_diag.report_memory_timer ? 0 : -1;
+}
+
 static void free_diag_values(void)
 {
-    while (s_diag.values) {
-        diag_value_t *p = s_diag.values;
-        s_diag.values = p->next;
-        FREE(p->key);
-        FREE(p);
+    pthread_mutex_lock(&s_diag.values_lock);
+    for (int32_t i = 0; i < DIAG_MAX_VALUES; i++) {
+        diag_value_t *p = &s_diag.values[i];
+        if (p->used) {
+            FREE(p->key);
+            FREE(p->stats);
+            p->used = false;
+            p->gen++;
+        }
     }
+    memset(s_diag.value_index, 0, sizeof(s_diag.value_index));
+    pthread_mutex_unlock(&s_diag.values_lock);
 }
 
 // ---------------------------- public interface ------------------------------
@@ -704,71 +1250,110 @@ int diag_init(EventLoop *eloop)
         return -1;
     }
 
+    if (schedule_report_memory() != 0) {
+        LOGE("failed to schedule report memory");
+        return -1;
+    }
+
+    // status is already known by now, only changes from here on are notified
+    Networking_InterfaceConnectionStatus status = network_get_status();
+    if (status != 0) {
+        report_network_status_change(status, NULL);
+    }
+    network_set_status_callback(report_network_status_change, NULL);
+
+    // timers dispatched per event loop wakeup, shows how well timer slack coalesces wakeups
+    event_loop_timer_set_dispatch_histogram(diag_histogram("timer_dispatch"));
+
     return 0;
 }
 
 
 void diag_deinit()
 {
+    network_set_status_callback(NULL, NULL);
     free_diag_values();
 
+    event_loop_timer_set_dispatch_histogram(NULL);
     event_loop_unregister_timer(s_diag.eloop, s_diag.heartbeat_timer);
     event_loop_unregister_timer(s_diag.eloop, s_diag.report_events_timer);
     event_loop_unregister_timer(s_diag.eloop, s_diag.report_twins_timer);
     event_loop_unregister_timer(s_diag.eloop, s_diag.report_telemetry_timer);
     event_loop_unregister_timer(s_diag.eloop, s_diag.report_log_timer);
     event_loop_unregister_timer(s_diag.eloop, s_diag.led_update_timer);
+    event_loop_unregister_timer(s_diag.eloop, s_diag.report_memory_timer);
     pthread_mutex_destroy(&s_diag.lock);
 
-    FREE(s_diag.reported_device_twin);
+    free_twin_state(s_diag.reported_twin);
+    s_diag.reported_twin = NULL;
 }
 
 
 double diag_get_value(const char *key)
 {
+    pthread_mutex_lock(&s_diag.values_lock);
     diag_value_t *p = find_diag_value(key);
-    return p ? p->value : NAN;
+    double value = p ? p->value : NAN;
+    pthread_mutex_unlock(&s_diag.values_lock);
+    return value;
 }
 
 
 void diag_remove_value(const char* key)
 {
-    diag_value_t* prev = NULL;
-    diag_value_t* cur = s_diag.values;
-    while (cur) {
-        if (strcmp(cur->key, key) == 0) {
-            break;
-        }
-        prev = cur;
-        cur = cur->next;
-    }
+    pthread_mutex_lock(&s_diag.values_lock);
+    bool found;
+    int32_t i = find_index_slot(key, &found);
 
-    if (cur) {
-        if (prev) {
-            prev->next = cur->next;
-        }
-        else {
-            s_diag.values = cur->next;
-        }
-        FREE(cur->key);
-        FREE(cur);
+    if (found) {
+        diag_value_t *p = &s_diag.values[s_diag.value_index[i] - 1];
+        FREE(p->key);
+        FREE(p->stats);
+        p->used = false;
+        p->gen++;
+        s_diag.value_index[i] = DIAG_INDEX_REMOVED;
     }
+    pthread_mutex_unlock(&s_diag.values_lock);
 }
 
 
 void diag_log_value(const char *key, double value)
 {
-    diag_value_t *p = find_diag_value(key);
+    pthread_mutex_lock(&s_diag.values_lock);
+    diag_value_t *p = register_diag_value_locked(key);
 
     if (p) {
-        p->value = value;
-    } else {
-        p = (diag_value_t *)MALLOC(sizeof(diag_value_t));
-        p->key = STRDUP(key);
-        p->value = value;
-        p->next = s_diag.values;
-        s_diag.values = p;
+        set_diag_value_locked(p, value);
+    }
+    pthread_mutex_unlock(&s_diag.values_lock);
+}
+
+
+diag_handle_t diag_register(const char *key)
+{
+    return register_diag_handle(key, false);
+}
+
+
+diag_handle_t diag_register_stats(const char *key)
+{
+    return register_diag_handle(key, true);
+}
+
+
+void diag_log_handle(diag_handle_t handle, double value)
+{
+    int32_t slot = DIAG_HANDLE_SLOT(handle);
+    if (slot < 0 || slot >= DIAG_MAX_VALUES) {
+        return;
+    }
+
+    pthread_mutex_lock(&s_diag.values_lock);
+    diag_value_t *p = &s_diag.values[slot];
+    if (p->used && p->gen == DIAG_HANDLE_GEN(handle)) {
+        set_diag_value_locked(p, value);
     }
+    pthread_mutex_unlock(&s_diag.values_lock);
 }
 
 
@@ -25,18 +25,38 @@
 #include <utils/network.h>
 #include <utils/property.h>
 #include <utils/event_loop_timer.h>
+#include <utils/json_token.h>
 #include <frozen/frozen.h>
 
 extern volatile bool g_app_running;
 
+// longest C2D command and target app version taken from a message
+#define IOT_MAX_COMMAND_LEN 32
+#define IOT_MAX_APP_VERSION_LEN 64
+
 typedef struct iot_t iot_t;
 struct iot_t {
     event_loop_timer_t *setup_timer;
     event_loop_timer_t *periodic_timer;
+    // current DoWork interval, grows while SDK is idle
+    int32_t do_work_ms;
     event_loop_timer_t *reset_timer;
     struct timespec ts_last_online;
     struct timespec ts_last_offline;
     EventLoop *eloop;
+    // version a scheduled OTA reboot is for, outlives the C2D message
+    char target_app_version[IOT_MAX_APP_VERSION_LEN];
+    // hub of last successful provisioning, persisted across restart
+    char *hub;
+    // client set up for hub directly and not authenticated since, DPS is
+    // used next time if it doesn't get authenticated
+    bool direct_pending;
+    bool direct_failed;
+    bool setup_ok;
+    bool ever_connected;
+    // uplink moved off an interface at ts_failover and hub not connected since
+    bool failover_pending;
+    struct timespec ts_failover;
 };
 
 static iot_t s_iot;
@@ -102,17 +122,22 @@ static void process_c2d_reset(void)
     // reboot after 10s to give app a chance to ack the C2D message
     LOGI("Force app reset in 10s");
     struct timespec ts = {10, 0};
-    s_iot.reset_timer = event_loop_register_timer(s_iot.eloop, &ts, NULL, force_app_reset, NULL);
+    s_iot.reset_timer = event_loop_register_timer(s_iot.eloop, &ts, NULL, NULL, force_app_reset, NULL);
 }
 
 static void process_c2d_debug(const char *payload, size_t payload_size)
 {
     int debug_level = 0;
-    json_scanf(payload, payload_size, "{data:%d}", &debug_level);
+    bool gzip = false;
+    int budget = 0;
+    json_scanf(payload, payload_size, "{data:%d,gzip:%B,budget:%d}", &debug_level, &gzip, &budget);
 
     if (debug_level > 0) {
+        llog_config_upload(gzip, budget);
         llog_config(LOG_ENDPOINT_IOTHUB, debug_level);
-        LOGI("Remote debug on");
+        LOGI("Remote debug on, gzip=%d, budget=%d", gzip, budget);
+        // the full allocation walk only on request, the counters go out with diag
+        memory_report(1);
     } else {
         llog_config(LOG_ENDPOINT_CONSOLE, LOG_LEVEL);
         LOGI("Remote debug off");
@@ -123,28 +148,46 @@ static void process_c2d_reboot(void)
 {
     LOGI("Force system reboot in 10s");
     struct timespec ts = {10, 0};
-    s_iot.reset_timer = event_loop_register_timer(s_iot.eloop, &ts, NULL, force_system_reboot, NULL);
+    s_iot.reset_timer = event_loop_register_timer(s_iot.eloop, &ts, NULL, NULL, force_system_reboot, NULL);
 }
 
 static void process_c2d_ota_reboot(const char *payload, size_t payload_size)
 {
-    char *target_app_version = NULL;
-    json_scanf(payload, payload_size, "{target_app_version:%Q}", &target_app_version);
+    struct json_token t_version = {0};
+    json_scanf(payload, payload_size, "{target_app_version:%T}", &t_version);
 
-    if (target_app_version && strcmp(target_app_version, app_version()) != 0) {
+    char *target_app_version = s_iot.target_app_version;
+    if (json_token_unescape(&t_version, target_app_version, sizeof(s_iot.target_app_version)) >= 0 &&
+        strcmp(target_app_version, app_version()) != 0) {
         LOGI("Schedule App update: %s", target_app_version);
         struct timespec ts = { 1, 0 };
-        s_iot.reset_timer = event_loop_register_timer(s_iot.eloop, &ts, NULL, ota_system_reboot, target_app_version);
+        s_iot.reset_timer = event_loop_register_timer(s_iot.eloop, &ts, NULL, NULL, ota_system_reboot, target_app_version);
     }
 }
 
 
+static void process_c2d_broadcast(const char *payload, size_t payload_size)
+{
+    struct json_token t_schema = {0}, t_key = {0}, t_value = {0};
+    json_scanf(payload, payload_size, "{data:{schema:%T, key:%T, value:%T}}", &t_schema, &t_key, &t_value);
+
+    char schema[TELEMETRY_MAX_KEY_SIZE], key[TELEMETRY_MAX_KEY_SIZE], value[TELEMETRY_MAX_KEY_SIZE];
+    if (json_token_unescape(&t_schema, schema, sizeof(schema)) < 0 || json_token_unescape(&t_key, key, sizeof(key)) < 0 ||
+        json_token_unescape(&t_value, value, sizeof(value)) < 0) {
+        LOGE("Invalid broadcast command");
+        return;
+    }
+
+    adapter_broadcast_point(schema, key, value);
+}
+
 static void handle_c2d(const char *payload, size_t payload_size)
 {
-    char *command = NULL;
-    json_scanf(payload, payload_size, "{command:%Q}", &command);
+    struct json_token t_command = {0};
+    json_scanf(payload, payload_size, "{command:%T}", &t_command);
 
-    if (!command) {
+    char command[IOT_MAX_COMMAND_LEN];
+    if (json_token_unescape(&t_command, command, sizeof(command)) < 0) {
         LOGE("Invalid c2d message");
         return;
     }
@@ -159,11 +202,11 @@ static void handle_c2d(const char *payload, size_t payload_size)
         process_c2d_reboot();
     } else if (strcmp(command, IOT_COMMAND_OTA_REBOOT) == 0) {
         process_c2d_ota_reboot(payload, payload_size);
+    } else if (strcmp(command, IOT_COMMAND_BROADCAST) == 0) {
+        process_c2d_broadcast(payload, payload_size);
     } else {
         LOGE("Invalid C2D command:%s", command);
     }
-
-    FREE(command);
 }
 
 static void message_received(const char *payload, size_t payload_size, const char *message_type, void *context)
@@ -187,10 +230,12 @@ static void message_received(const char *payload, size_t payload_size, const cha
 
 static void scan_desired_twin(const char *str, int len, void *user_data)
 {
-    char *target_app_version = NULL;
-    json_scanf(str, len, "{target_app_version:%Q}", &target_app_version);
+    struct json_token t_version = {0};
+    json_scanf(str, len, "{target_app_version:%T}", &t_version);
 
-    if (target_app_version && (strcmp(app_version(), target_app_version) != 0)) {
+    char target_app_version[IOT_MAX_APP_VERSION_LEN];
+    if (json_token_unescape(&t_version, target_app_version, sizeof(target_app_version)) >= 0 &&
+        (strcmp(app_version(), target_app_version) != 0)) {
         LOGI("Schedule APP update: %s", target_app_version);
         ota_system_reboot(target_app_version);
     }
@@ -215,14 +260,56 @@ static void device_twin_update(const char *payload, size_t payload_size, void *c
     }
 }
 
+static void schedule_setup_in(int32_t delay_ms)
+{
+    struct timespec ts = MS2SPEC(delay_ms);
+    struct timespec ts_setup = MS2SPEC(IOT_SETUP_RETRY_MS);
+    event_loop_set_timer(s_iot.setup_timer, &ts, &ts_setup);
+}
+
+// keep hub connected, connect it directly on next start
+static void save_hub(void)
+{
+    const char *hub = azure_iot_get_hostname();
+
+    if (hub && (!s_iot.hub || strcmp(hub, s_iot.hub) != 0)) {
+        LOGI("Save hub %s", hub);
+        FREE(s_iot.hub);
+        s_iot.hub = STRDUP(hub);
+        write_property("iothub_hostname", s_iot.hub);
+    }
+}
+
 static void connection_status_changed(bool connected, IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void *context)
 {
     static bool last_connected = false;
     LOGI("iot hub %s", (connected ? "connected" : "disconnected"));
 
+    if (connected) {
+        s_iot.direct_pending = false;
+        save_hub();
+    } else if (s_iot.direct_pending) {
+        // hub may have changed since, provision again with DPS right away
+        LOGW("Failed to connect hub %s directly, fall back to DPS", s_iot.hub);
+        s_iot.direct_pending = false;
+        s_iot.direct_failed = true;
+        schedule_setup_in(IOT_SETUP_FAST_RETRY_MS);
+    }
+
     if (!last_connected && connected) {
         clock_gettime(CLOCK_BOOTTIME, &s_iot.ts_last_online);
         diag_log_event(EVENT_IOT_CONNECTED);
+        if (!s_iot.ever_connected) {
+            s_iot.ever_connected = true;
+            diag_log_value("boot_to_online_ms", SPEC2MS(s_iot.ts_last_online));
+        }
+        if (s_iot.failover_pending) {
+            // from uplink seen lost, up to NETWORK_STATUS_REFRESH_MS after it was
+            s_iot.failover_pending = false;
+            int32_t failover_ms = timer_stopwatch_stop(&s_iot.ts_failover);
+            LOGI("iot hub connected %d ms after uplink failover", failover_ms);
+            diag_log_value("uplink_failover_ms", failover_ms);
+        }
     } else if (last_connected && !connected) {
         clock_gettime(CLOCK_BOOTTIME, &s_iot.ts_last_offline);
         diag_log_event(iot_connection_status2event(reason));
@@ -249,29 +336,113 @@ static void log_setup_error_event(AZURE_SPHERE_PROV_RESULT result)
 }
 
 
+static void schedule_do_work(int32_t delay_ms)
+{
+    if (!s_iot.periodic_timer) return;
+
+    struct timespec ts = MS2SPEC(delay_ms);
+    // can't use 0 as that means disarm timer
+    if (delay_ms == 0) {
+        ts.tv_nsec = 1;
+    }
+    event_loop_set_timer(s_iot.periodic_timer, &ts, NULL);
+}
+
+// run DoWork on next loop iteration, for work just handed to SDK
+static void kick_do_work(void)
+{
+    s_iot.do_work_ms = IOT_DOWORK_MIN_MS;
+    schedule_do_work(0);
+}
+
 static void iot_setup_task(void *context)
 {
     if (azure_iot_is_connected()) return;
 
     if (!network_is_connected()) {
         LOGI("iot setup client failed due to no network");
+        // connect as soon as network is up rather than a retry later
+        if (!s_iot.setup_ok) {
+            schedule_setup_in(IOT_SETUP_FAST_RETRY_MS);
+        }
         return;
     }
 
+    // still not authenticated since set up for hub directly
+    if (s_iot.direct_pending) {
+        LOGW("Hub %s not connected in time, fall back to DPS", s_iot.hub);
+        s_iot.direct_pending = false;
+        s_iot.direct_failed = true;
+    }
+
+    bool direct = s_iot.hub && !s_iot.direct_failed;
+
     // we seen scenario that callback not been invoked even azure_iot_setup_client return ok
-    AZURE_SPHERE_PROV_RESULT result = azure_iot_setup_client(IOT_MAX_INFLIGHT_MESSAGE_SIZE, NULL);
+    AZURE_SPHERE_PROV_RESULT result =
+        azure_iot_setup_client(IOT_MAX_INFLIGHT_MESSAGE_SIZE, direct ? s_iot.hub : NULL, NULL);
 
     if (result == AZURE_SPHERE_PROV_RESULT_OK) {
         LOGI("iot setup client ok");
+        s_iot.setup_ok = true;
+        s_iot.direct_pending = direct;
+        // hub of DPS is tried directly again if that one get lost later
+        s_iot.direct_failed = false;
+        if (direct) {
+            schedule_setup_in(IOT_DIRECT_CONNECT_TIMEOUT_MS);
+        }
+        kick_do_work();
     } else {
         log_setup_error_event(result);
+        if (result == AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY ||
+            result == AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY) {
+            if (!s_iot.setup_ok) {
+                schedule_setup_in(IOT_SETUP_FAST_RETRY_MS);
+            }
+        }
     }
 }
 
 
+// The MQTT connection over the interface traffic moved off would only be found
+// dead by keepalive, and then set up again by the retry timer, so it's set up
+// over the new uplink right away
+static void uplink_changed(const char *uplink, const char *previous, void *context)
+{
+    if (previous) {
+        diag_log_event(EVENT_NETWORK_UPLINK_FAILOVER);
+        if (!s_iot.failover_pending) {
+            s_iot.failover_pending = true;
+            timer_stopwatch_start(&s_iot.ts_failover);
+        }
+    }
+
+    if (!uplink) {
+        // set up as soon as any interface reaches internet again
+        return;
+    }
+
+    LOGI("Connect iot hub over %s", uplink);
+    if (azure_iot_is_connected()) {
+        azure_iot_destroy_client();
+        connection_status_changed(false, IOTHUB_CLIENT_CONNECTION_NO_NETWORK, NULL);
+    }
+    // retried fast rather than at IOT_SETUP_RETRY_MS until it's set up again,
+    // and a hub being connected directly is tried again over the new uplink
+    s_iot.setup_ok = false;
+    s_iot.direct_pending = false;
+    iot_setup_task(NULL);
+}
+
 static void iot_periodic_task(void *context)
 {
     azure_iot_do_periodic_tasks();
+
+    if (azure_iot_has_pending_work()) {
+        s_iot.do_work_ms = IOT_DOWORK_MIN_MS;
+    } else {
+        s_iot.do_work_ms = MIN(s_iot.do_work_ms * 2, IOT_DOWORK_MAX_MS);
+    }
+    schedule_do_work(s_iot.do_work_ms);
 }
 
 static int init_sdk(void)
@@ -288,17 +459,18 @@ static int init_sdk(void)
 static int schedule_setup_task(void)
 {
     // can't use 0 as that means disarm timer
-    struct timespec init_setup = MS2SPEC(30*1000);
+    struct timespec init_setup = MS2SPEC(IOT_SETUP_FAST_RETRY_MS);
     struct timespec ts_setup = MS2SPEC(IOT_SETUP_RETRY_MS);
-    s_iot.setup_timer = event_loop_register_timer(s_iot.eloop, &init_setup, &ts_setup, iot_setup_task, NULL);
+    s_iot.setup_timer = event_loop_register_timer(s_iot.eloop, &init_setup, &ts_setup, NULL, iot_setup_task, NULL);
     return s_iot.setup_timer ? 0 : -1;
 }
 
 static int schedule_periodic_task(void)
 {
+    // one shot, rearmed by each run with an interval depending on pending work
     struct timespec init_periodic = MS2SPEC(1000);
-    struct timespec ts_periodic = MS2SPEC(IOT_PERIODIC_TASK_MS);
-    s_iot.periodic_timer = event_loop_register_timer(s_iot.eloop, &init_periodic, &ts_periodic, iot_periodic_task, NULL);
+    s_iot.do_work_ms = IOT_DOWORK_MIN_MS;
+    s_iot.periodic_timer = event_loop_register_timer(s_iot.eloop, &init_periodic, NULL, NULL, iot_periodic_task, NULL);
     return s_iot.periodic_timer ? 0 : -1;
 }
 
@@ -310,6 +482,7 @@ int iot_init(EventLoop *eloop)
     LOGI("iot init");
 
     s_iot.eloop = eloop;
+    s_iot.hub = read_property("iothub_hostname");
 
     if (init_sdk() != 0) {
         LOGE("Failed to initialize Azure IoT Hub SDK");
@@ -326,6 +499,8 @@ int iot_init(EventLoop *eloop)
         return -1;
     }
 
+    network_set_uplink_callback(uplink_changed, NULL);
+
     clock_gettime(CLOCK_BOOTTIME, &s_iot.ts_last_offline);
     return 0;
 }
@@ -333,14 +508,17 @@ int iot_init(EventLoop *eloop)
 
 void iot_deinit()
 {
+    network_set_uplink_callback(NULL, NULL);
     event_loop_unregister_timer(s_iot.eloop, s_iot.setup_timer);
     event_loop_unregister_timer(s_iot.eloop, s_iot.periodic_timer);
+    s_iot.periodic_timer = NULL;
     if (s_iot.reset_timer) {
         event_loop_unregister_timer(s_iot.eloop, s_iot.reset_timer);
     }
 
     azure_iot_destroy_client();
     azure_iot_deinitialize();
+    FREE(s_iot.hub);
 }
 
 
@@ -360,11 +538,62 @@ int iot_send_message_async(const char *iot_message, const char *iot_message_type
         return -1;
     }
 
-    return azure_iot_send_message_async(iot_message, iot_message_type, callback, context);
+    int err = azure_iot_send_message_async(iot_message, iot_message_type, callback, context);
+    if (err == 0) {
+        kick_do_work();
+    }
+    return err;
 }
 
 
 
+int iot_send_priority_message_async(const char *iot_message, const char *iot_message_type,
+                                    message_delivery_confirmation_func_t callback, void *context)
+{
+    ASSERT(iot_message);
+    ASSERT(iot_message_type);
+
+    if (!network_is_connected() || !azure_iot_is_connected()) {
+        LOGW("Can't send priority message as iot hub not reachable");
+        return -1;
+    }
+
+    int err = azure_iot_send_priority_message_async(iot_message, iot_message_type, callback, context);
+    if (err == 0) {
+        kick_do_work();
+    }
+    return err;
+}
+
+
+int iot_send_binary_message_async(const uint8_t *payload, size_t payload_size, const char *iot_message_type,
+                                  const char *content_type, const char *content_encoding,
+                                  const message_property_t *properties,
+                                  message_delivery_confirmation_func_t callback, void *context)
+{
+    ASSERT(payload);
+    ASSERT(iot_message_type);
+    ASSERT(content_type);
+
+    if (!network_is_connected()) {
+        LOGW("Can't send message as network not connected");
+        return -1;
+    }
+
+    if (!azure_iot_is_connected()) {
+        LOGW("Can't send message as iot hub not connected");
+        return -1;
+    }
+
+    int err = azure_iot_send_binary_message_async(payload, payload_size, iot_message_type, content_type,
+                                                  content_encoding, properties, callback, context);
+    if (err == 0) {
+        kick_do_work();
+    }
+    return err;
+}
+
+
 int iot_report_device_twin_async(const char *properties,
     device_twin_delivery_confirmation_func_t callback, void *context)
 {
@@ -380,7 +609,11 @@ int iot_report_device_twin_async(const char *properties,
         return -1;
     }
 
-    return azure_iot_twin_report_async(properties, callback, context);
+    int err = azure_iot_twin_report_async(properties, callback, context);
+    if (err == 0) {
+        kick_do_work();
+    }
+    return err;
 }
 
 
@@ -0,0 +1,112 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdalign.h>
+#include <string.h>
+
+#include <utils/arena.h>
+#include <utils/memory.h>
+
+#define ARENA_ALIGN alignof(max_align_t)
+#define ARENA_ROUND_UP(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+typedef struct arena_block_t arena_block_t;
+struct arena_block_t {
+    arena_block_t *next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) char data[];
+};
+
+struct arena_t {
+    size_t chunk_size;
+    size_t total;
+    arena_block_t *blocks;
+};
+
+
+static arena_block_t *arena_grow(arena_t *arena, size_t size)
+{
+    arena_block_t *block = (arena_block_t *)MALLOC(sizeof(arena_block_t) + size);
+    block->size = size;
+    block->used = 0;
+    arena->total += size;
+    return block;
+}
+
+
+arena_t *arena_create(size_t chunk_size)
+{
+    arena_t *arena = (arena_t *)CALLOC(1, sizeof(arena_t));
+    arena->chunk_size = ARENA_ROUND_UP(chunk_size);
+    return arena;
+}
+
+
+void arena_destroy(arena_t *arena)
+{
+    if (!arena) {
+        return;
+    }
+
+    while (arena->blocks) {
+        arena_block_t *block = arena->blocks;
+        arena->blocks = block->next;
+        FREE(block);
+    }
+    FREE(arena);
+}
+
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    ASSERT(arena);
+
+    size = ARENA_ROUND_UP(size ? size : 1);
+    arena_block_t *block = arena->blocks;
+
+    if (!block || block->size - block->used < size) {
+        if (size > arena->chunk_size / 4) {
+            // too big to share a block, keep current block for later allocations
+            block = arena_grow(arena, size);
+            if (arena->blocks) {
+                block->next = arena->blocks->next;
+                arena->blocks->next = block;
+            } else {
+                block->next = NULL;
+                arena->blocks = block;
+            }
+        } else {
+            block = arena_grow(arena, arena->chunk_size);
+            block->next = arena->blocks;
+            arena->blocks = block;
+        }
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+
+char *arena_strndup(arena_t *arena, const char *s, size_t len)
+{
+    len = strnlen(s, len);
+    char *out = (char *)arena_alloc(arena, len + 1);
+    memcpy(out, s, len);
+    out[len] = '\0';
+    return out;
+}
+
+
+char *arena_strdup(arena_t *arena, const char *s)
+{
+    return arena_strndup(arena, s, strlen(s));
+}
+
+
+size_t arena_size(const arena_t *arena)
+{
+    return arena ? arena->total : 0;
+}
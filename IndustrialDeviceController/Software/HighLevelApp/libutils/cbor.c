@@ -0,0 +1,140 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <string.h>
+
+#include <utils/cbor.h>
+
+// major types
+#define CBOR_UINT   0x00u
+#define CBOR_NINT   0x20u
+#define CBOR_TEXT   0x60u
+#define CBOR_ARRAY  0x80u
+#define CBOR_MAP    0xA0u
+
+#define CBOR_NULL    0xF6u
+#define CBOR_FLOAT32 0xFAu
+#define CBOR_FLOAT64 0xFBu
+
+static void put_bytes(cbor_writer_t *w, const uint8_t *data, size_t n)
+{
+    if (w->len + n <= w->size) {
+        memcpy(w->buf + w->len, data, n);
+    }
+    w->len += n;
+}
+
+static void put_byte(cbor_writer_t *w, uint8_t b)
+{
+    put_bytes(w, &b, 1);
+}
+
+// write big endian value of nbytes
+static void put_be(cbor_writer_t *w, uint64_t value, int nbytes)
+{
+    uint8_t tmp[8];
+    for (int i = nbytes - 1; i >= 0; i--) {
+        tmp[i] = value & 0xFF;
+        value >>= 8;
+    }
+    put_bytes(w, tmp, nbytes);
+}
+
+static void put_header(cbor_writer_t *w, uint8_t major, uint64_t value)
+{
+    if (value < 24) {
+        put_byte(w, major | value);
+    } else if (value <= UINT8_MAX) {
+        put_byte(w, major | 24);
+        put_be(w, value, 1);
+    } else if (value <= UINT16_MAX) {
+        put_byte(w, major | 25);
+        put_be(w, value, 2);
+    } else if (value <= UINT32_MAX) {
+        put_byte(w, major | 26);
+        put_be(w, value, 4);
+    } else {
+        put_byte(w, major | 27);
+        put_be(w, value, 8);
+    }
+}
+
+// ---------------------------- public interface ------------------------------
+
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t size)
+{
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+}
+
+void cbor_write_uint(cbor_writer_t *w, uint64_t value)
+{
+    put_header(w, CBOR_UINT, value);
+}
+
+void cbor_write_int(cbor_writer_t *w, int64_t value)
+{
+    if (value >= 0) {
+        put_header(w, CBOR_UINT, value);
+    } else {
+        // negative integer is encoded as -1 - n
+        put_header(w, CBOR_NINT, (uint64_t)(-1 - value));
+    }
+}
+
+void cbor_write_number(cbor_writer_t *w, double value)
+{
+    if (isnan(value)) {
+        cbor_write_null(w);
+        return;
+    }
+
+    // 2^63 is exact in double, anything integral below it fit in int64
+    if (value == floor(value) && fabs(value) < 9223372036854775808.0 && !(value == 0 && signbit(value))) {
+        cbor_write_int(w, (int64_t)value);
+        return;
+    }
+
+    float f = (float)value;
+    if ((double)f == value) {
+        uint32_t u32;
+        memcpy(&u32, &f, sizeof(u32));
+        put_byte(w, CBOR_FLOAT32);
+        put_be(w, u32, 4);
+        return;
+    }
+
+    uint64_t u64;
+    memcpy(&u64, &value, sizeof(u64));
+    put_byte(w, CBOR_FLOAT64);
+    put_be(w, u64, 8);
+}
+
+void cbor_write_text(cbor_writer_t *w, const char *str)
+{
+    if (!str) {
+        cbor_write_null(w);
+        return;
+    }
+
+    size_t n = strlen(str);
+    put_header(w, CBOR_TEXT, n);
+    put_bytes(w, (const uint8_t *)str, n);
+}
+
+void cbor_write_array(cbor_writer_t *w, size_t n)
+{
+    put_header(w, CBOR_ARRAY, n);
+}
+
+void cbor_write_map(cbor_writer_t *w, size_t n)
+{
+    put_header(w, CBOR_MAP, n);
+}
+
+void cbor_write_null(cbor_writer_t *w)
+{
+    put_byte(w, CBOR_NULL);
+}
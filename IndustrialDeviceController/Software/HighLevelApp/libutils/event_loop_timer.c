@@ -1,56 +1,391 @@
 /* Copyright (c) Microsoft Corporation. All rights reserved.
    Licensed under the MIT License. */
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/timerfd.h>
 #include <unistd.h>
 
 #include <init/globals.h>
 #include <utils/event_loop_timer.h>
 
+// All timers share one timerfd, armed for the earliest expiry, and are kept in a hierarchical
+// timer wheel: level 0 has a slot per tick, and each slot of level n covers a whole turn of
+// level n-1. A timer is filed at the level its expiry falls in and moves down a level each time
+// the level below completes a turn. Timers expiring within the same tick are dispatched by a
+// single wakeup. The tick is 1ms since adapter polls are scheduled to the millisecond.
+// A timer with slack may be dispatched up to slack late, the timerfd is armed for the earliest
+// deadline (expiry + slack) and the wakeup dispatches every timer already expired, so timers
+// whose slack windows overlap share a wakeup.
+#define WHEEL_TICK_MS   1
+#define WHEEL_LEVELS    5
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS     (1 << WHEEL_SLOT_BITS)
+#define WHEEL_SLOT_MASK (WHEEL_SLOTS - 1)
+// expiries beyond the wheel's range (~12 days) are filed in its last slot and re-filed from there
+#define WHEEL_MAX_TICKS ((1ull << (WHEEL_LEVELS * WHEEL_SLOT_BITS)) - 1)
+
+typedef struct list_node_t {
+    struct list_node_t *next;
+    struct list_node_t *prev;
+} list_node_t;
+
 struct event_loop_timer_t {
-    EventRegistration *reg;
-    int fd;
+    // must be first, a node in a slot list is converted back to its timer
+    list_node_t node;
+    bool armed;
+    // expiry and period in ms since the wheel was created, period 0 for one shot,
+    // slack is how late an expiry may be dispatched
+    uint64_t expires_ms;
+    uint64_t period_ms;
+    uint64_t slack_ms;
     void *context;
     event_loop_timer_callback_t callback;
 };
 
-static void timer_callback(EventLoop *eloop, int fd, EventLoop_IoEvents events, void *context)
+typedef struct {
+    EventLoop *eloop;
+    EventRegistration *reg;
+    int fd;
+    struct timespec base;
+    // next tick to dispatch, counted from base
+    uint64_t tick;
+    list_node_t slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t occupied[WHEEL_LEVELS];
+    int timer_count;
+    // timerfd is armed once all due timers have run
+    bool dispatching;
+} timer_wheel_t;
+
+static timer_wheel_t *s_wheel = NULL;
+static histogram_t *s_dispatch_hist = NULL;
+
+static void list_init(list_node_t *list)
+{
+    list->next = list;
+    list->prev = list;
+}
+
+static bool list_empty(const list_node_t *list)
+{
+    return list->next == list;
+}
+
+static void list_append(list_node_t *list, list_node_t *node)
+{
+    node->prev = list->prev;
+    node->next = list;
+    list->prev->next = node;
+    list->prev = node;
+}
+
+static void list_remove(list_node_t *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    list_init(node);
+}
+
+// move all nodes of from to the empty list to
+static void list_move(list_node_t *from, list_node_t *to)
+{
+    if (list_empty(from)) {
+        list_init(to);
+        return;
+    }
+
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    list_init(from);
+}
+
+static bool timespec_is_zero(const struct timespec *ts)
+{
+    return !ts || (ts->tv_sec == 0 && ts->tv_nsec == 0);
+}
+
+static uint64_t timespec2ms(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000 + ((uint64_t)ts->tv_nsec + 999999) / 1000000;
+}
+
+// ms elapsed since the wheel was created, rounded down to decide what is due, rounded up to
+// compute an expiry so that a timer never fires before its delay has elapsed
+static uint64_t wheel_now_ms(const timer_wheel_t *wheel, bool round_up)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t ns = (int64_t)(now.tv_sec - wheel->base.tv_sec) * 1000000000 + (now.tv_nsec - wheel->base.tv_nsec);
+    int64_t ms = (ns + (round_up ? 999999 : 0)) / 1000000;
+    return ns <= 0 ? 0 : (uint64_t)ms;
+}
+
+// first tick starting at or after the timer's expiry
+static uint64_t expiry_tick(const event_loop_timer_t *timer)
+{
+    return (timer->expires_ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+}
+
+static void wheel_file(timer_wheel_t *wheel, event_loop_timer_t *timer)
+{
+    uint64_t expires = expiry_tick(timer);
+    int level = 0;
+    int slot;
+
+    if (expires < wheel->tick) {
+        // already due, dispatch with next tick
+        slot = wheel->tick & WHEEL_SLOT_MASK;
+    } else {
+        uint64_t delta = expires - wheel->tick;
+        if (delta > WHEEL_MAX_TICKS) {
+            expires = wheel->tick + WHEEL_MAX_TICKS;
+            delta = WHEEL_MAX_TICKS;
+        }
+        while (delta >> ((level + 1) * WHEEL_SLOT_BITS)) {
+            level++;
+        }
+        slot = (expires >> (level * WHEEL_SLOT_BITS)) & WHEEL_SLOT_MASK;
+    }
+
+    list_append(&wheel->slots[level][slot], &timer->node);
+    wheel->occupied[level] |= 1ull << slot;
+}
+
+static void wheel_unfile(timer_wheel_t *wheel, event_loop_timer_t *timer)
+{
+    list_node_t *list = timer->node.next;
+    list_remove(&timer->node);
+
+    // a list left empty may be a slot list, clear its bit
+    if (list_empty(list)) {
+        for (int level = 0; level < WHEEL_LEVELS; level++) {
+            list_node_t *slots = wheel->slots[level];
+            if (list >= slots && list < slots + WHEEL_SLOTS) {
+                wheel->occupied[level] &= ~(1ull << (list - slots));
+                break;
+            }
+        }
+    }
+}
+
+// re-file timers of current slot at given level after the level below completed a turn,
+// return slot index, next level up needs cascading too when it is 0
+static int wheel_cascade(timer_wheel_t *wheel, int level)
+{
+    int slot = (wheel->tick >> (level * WHEEL_SLOT_BITS)) & WHEEL_SLOT_MASK;
+    list_node_t pending;
+    list_move(&wheel->slots[level][slot], &pending);
+    wheel->occupied[level] &= ~(1ull << slot);
+
+    while (!list_empty(&pending)) {
+        event_loop_timer_t *timer = (event_loop_timer_t *)pending.next;
+        list_remove(&timer->node);
+        wheel_file(wheel, timer);
+    }
+
+    return slot;
+}
+
+// last tick a timer may be dispatched at
+static uint64_t deadline_tick(const event_loop_timer_t *timer)
+{
+    return expiry_tick(timer) + timer->slack_ms / WHEEL_TICK_MS;
+}
+
+// arm timerfd for earliest deadline, or disarm it when no timer is armed
+static int wheel_arm(timer_wheel_t *wheel)
+{
+    bool found = false;
+    uint64_t earliest = 0;
+
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        uint64_t occupied = wheel->occupied[level];
+        while (occupied) {
+            list_node_t *list = &wheel->slots[level][__builtin_ctzll(occupied)];
+            occupied &= occupied - 1;
+            for (list_node_t *node = list->next; node != list; node = node->next) {
+                uint64_t deadline = deadline_tick((event_loop_timer_t *)node);
+                if (!found || deadline < earliest) {
+                    earliest = deadline;
+                    found = true;
+                }
+            }
+        }
+    }
+
+    struct itimerspec its = {.it_value = {0, 0}, .it_interval = {0, 0}};
+
+    if (found) {
+        if (earliest < wheel->tick) {
+            earliest = wheel->tick;
+        }
+        uint64_t ms = earliest * WHEEL_TICK_MS;
+        its.it_value.tv_sec = wheel->base.tv_sec + (time_t)(ms / 1000);
+        its.it_value.tv_nsec = wheel->base.tv_nsec + (long)(ms % 1000) * 1000000;
+        if (its.it_value.tv_nsec >= 1000000000) {
+            its.it_value.tv_sec++;
+            its.it_value.tv_nsec -= 1000000000;
+        }
+    }
+
+    return timerfd_settime(wheel->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+// dispatch timers of every tick up to now, ticks with an empty level 0 slot are skipped but
+// never past the end of a turn where the levels above are cascaded, return timers dispatched
+static int wheel_run(timer_wheel_t *wheel)
+{
+    int dispatched = 0;
+    uint64_t now_ms = wheel_now_ms(wheel, false);
+    uint64_t now = now_ms / WHEEL_TICK_MS;
+
+    while (wheel->tick <= now) {
+        int index = wheel->tick & WHEEL_SLOT_MASK;
+
+        if (index == 0) {
+            for (int level = 1; level < WHEEL_LEVELS && wheel_cascade(wheel, level) == 0; level++) {
+            }
+        }
+
+        uint64_t later = wheel->occupied[0] & (~0ull << index);
+        uint64_t turn_end = (wheel->tick | WHEEL_SLOT_MASK) + 1;
+        uint64_t next = later ? wheel->tick - index + __builtin_ctzll(later) : turn_end;
+
+        if (next > now) {
+            wheel->tick = now + 1;
+            break;
+        }
+
+        if (next == turn_end) {
+            wheel->tick = turn_end;
+            continue;
+        }
+
+        int slot = next & WHEEL_SLOT_MASK;
+        list_node_t due;
+        list_move(&wheel->slots[0][slot], &due);
+        wheel->occupied[0] &= ~(1ull << slot);
+        // timers set by callbacks below are filed relative to next tick
+        wheel->tick = next + 1;
+
+        while (!list_empty(&due)) {
+            event_loop_timer_t *timer = (event_loop_timer_t *)due.next;
+            list_remove(&timer->node);
+
+            // re-file periodic timer before callback, which may set or unregister it, missed
+            // expirations are reported by a single callback like timerfd did
+            if (timer->period_ms) {
+                timer->expires_ms += timer->period_ms;
+                if (timer->expires_ms <= now_ms) {
+                    timer->expires_ms += ((now_ms - timer->expires_ms) / timer->period_ms + 1) * timer->period_ms;
+                }
+                wheel_file(wheel, timer);
+            } else {
+                timer->armed = false;
+            }
+
+            timer->callback(timer->context);
+            dispatched++;
+        }
+    }
+
+    return dispatched;
+}
+
+static void wheel_destroy(timer_wheel_t *wheel)
+{
+    EventLoop_UnregisterIo(wheel->eloop, wheel->reg);
+    close(wheel->fd);
+    FREE(s_wheel);
+}
+
+static void wheel_callback(EventLoop *eloop, int fd, EventLoop_IoEvents events, void *context)
 {
     ASSERT(context);
-    event_loop_timer_t *timer = (event_loop_timer_t *)context;
+    timer_wheel_t *wheel = (timer_wheel_t *)context;
 
     // consume timer event now to avoid trigger again
     uint64_t timer_data = 0;
-    if (read(timer->fd, &timer_data, sizeof(timer_data)) == -1) {
+    if (read(wheel->fd, &timer_data, sizeof(timer_data)) == -1) {
+        return;
+    }
+
+    wheel->dispatching = true;
+    int dispatched = wheel_run(wheel);
+    wheel->dispatching = false;
+
+    if (s_dispatch_hist) {
+        histogram_record(s_dispatch_hist, dispatched);
+    }
+
+    // callbacks may have unregistered every timer
+    if (wheel->timer_count == 0) {
+        wheel_destroy(wheel);
         return;
     }
 
-    timer->callback(timer->context);
+    wheel_arm(wheel);
+}
+
+static timer_wheel_t *wheel_get(EventLoop *eloop)
+{
+    if (s_wheel) {
+        ASSERT(s_wheel->eloop == eloop);
+        return s_wheel;
+    }
+
+    timer_wheel_t *wheel = MALLOC(sizeof(timer_wheel_t));
+    wheel->eloop = eloop;
+    wheel->tick = 0;
+    wheel->timer_count = 0;
+    wheel->dispatching = false;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+            list_init(&wheel->slots[level][slot]);
+        }
+        wheel->occupied[level] = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wheel->base);
+
+    if ((wheel->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0) {
+        FREE(wheel);
+        return NULL;
+    }
+
+    if ((wheel->reg = EventLoop_RegisterIo(eloop, wheel->fd, EventLoop_Input, wheel_callback, wheel)) == NULL) {
+        close(wheel->fd);
+        FREE(wheel);
+        return NULL;
+    }
+
+    s_wheel = wheel;
+    return wheel;
 }
 
 
 event_loop_timer_t* event_loop_register_timer(EventLoop *eloop, const struct timespec *init, const struct timespec *interval,
-                            event_loop_timer_callback_t callback, void *context)
+                            const struct timespec *slack, event_loop_timer_callback_t callback, void *context)
 {
     ASSERT(eloop);
     ASSERT(callback);
 
+    timer_wheel_t *wheel = wheel_get(eloop);
+    if (!wheel) {
+        return NULL;
+    }
+
     event_loop_timer_t *timer = MALLOC(sizeof(event_loop_timer_t));
+    list_init(&timer->node);
+    timer->armed = false;
+    timer->slack_ms = timespec_is_zero(slack) ? 0 : timespec2ms(slack);
     timer->callback = callback;
     timer->context = context;
-
-    if ((timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0) {
-        FREE(timer);
-        return NULL;
-    }
+    wheel->timer_count++;
 
     if (event_loop_set_timer(timer, init, interval) < 0) {
-        FREE(timer);
-        return NULL;
-    }
-
-    if ((timer->reg = EventLoop_RegisterIo(eloop, timer->fd, EventLoop_Input, timer_callback, timer)) == NULL) {
-        FREE(timer);
+        event_loop_unregister_timer(eloop, timer);
         return NULL;
     }
 
@@ -62,27 +397,38 @@ void event_loop_unregister_timer(EventLoop *eloop, event_loop_timer_t *timer)
 {
     ASSERT(eloop);
     ASSERT(timer);
-    EventLoop_UnregisterIo(eloop, timer->reg);
-    close(timer->fd);
+    ASSERT(s_wheel);
+
+    if (timer->armed) {
+        wheel_unfile(s_wheel, timer);
+    }
     FREE(timer);
+
+    // timerfd is re-armed on its next expiration, at worst one without a timer
+    if (--s_wheel->timer_count == 0 && !s_wheel->dispatching) {
+        wheel_destroy(s_wheel);
+    }
 }
 
 
 int event_loop_set_timer(event_loop_timer_t *timer, const struct timespec *init, const struct timespec *interval)
 {
     ASSERT(timer);
+    ASSERT(s_wheel);
 
-    struct itimerspec its = {.it_value = {0, 0}, .it_interval={0, 0}};
-
-    if (init) {
-        its.it_value = *init;
+    if (timer->armed) {
+        wheel_unfile(s_wheel, timer);
+        timer->armed = false;
     }
 
-    if (interval) {
-        its.it_interval = *interval;
+    if (!timespec_is_zero(init)) {
+        timer->expires_ms = wheel_now_ms(s_wheel, true) + timespec2ms(init);
+        timer->period_ms = timespec_is_zero(interval) ? 0 : timespec2ms(interval);
+        wheel_file(s_wheel, timer);
+        timer->armed = true;
     }
 
-    return timerfd_settime(timer->fd, 0, &its, NULL);
+    return s_wheel->dispatching ? 0 : wheel_arm(s_wheel);
 }
 
 int event_loop_set_timer_and_context(event_loop_timer_t *timer, const struct timespec *init, const struct timespec *interval,
@@ -99,3 +445,8 @@ int event_loop_cancel_timer(event_loop_timer_t *timer)
     return event_loop_set_timer(timer, NULL, NULL);
 }
 
+
+void event_loop_timer_set_dispatch_histogram(histogram_t *hist)
+{
+    s_dispatch_hist = hist;
+}
@@ -0,0 +1,606 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/expr.h>
+#include <utils/llog.h>
+#include <utils/memory.h>
+
+// parenthesis and unary operators nested deeper than this don't compile, so a
+// provision can't run the recursive descent off the stack
+#define EXPR_MAX_NESTING 32
+
+// longest numeric literal
+#define EXPR_MAX_NUMBER_LEN 32
+
+// CONST and LOAD are followed by a 16 bit little endian operand, every
+// expression ends with RET
+typedef enum expr_op_t expr_op_t;
+enum expr_op_t {
+    EXPR_OP_RET,
+    EXPR_OP_CONST,
+    EXPR_OP_LOAD,
+    EXPR_OP_NEG,
+    EXPR_OP_NOT,
+    EXPR_OP_BNOT,
+    EXPR_OP_ADD,
+    EXPR_OP_SUB,
+    EXPR_OP_MUL,
+    EXPR_OP_DIV,
+    EXPR_OP_MOD,
+    EXPR_OP_SHL,
+    EXPR_OP_SHR,
+    EXPR_OP_BAND,
+    EXPR_OP_BOR,
+    EXPR_OP_BXOR,
+    EXPR_OP_LT,
+    EXPR_OP_LE,
+    EXPR_OP_GT,
+    EXPR_OP_GE,
+    EXPR_OP_EQ,
+    EXPR_OP_NE,
+    EXPR_OP_AND,
+    EXPR_OP_OR,
+    EXPR_OP_ABS,
+    EXPR_OP_SQRT,
+    EXPR_OP_FLOOR,
+    EXPR_OP_ROUND,
+    EXPR_OP_MIN,
+    EXPR_OP_MAX,
+    EXPR_OP_BITS,
+    EXPR_OP_IF
+};
+
+struct expr_program_t {
+    uint8_t *code;
+    size_t code_len;
+    size_t code_cap;
+    double *consts;
+    uint32_t num_const;
+    uint32_t const_cap;
+    // code offset each expression starts at, by id
+    uint32_t *entries;
+    int32_t num_entry;
+    int32_t entry_cap;
+};
+
+// binary operators by precedence level, 0 binds loosest
+typedef struct expr_binop_t expr_binop_t;
+struct expr_binop_t {
+    const char *token;
+    uint8_t op;
+    uint8_t level;
+};
+
+static const expr_binop_t binops[] = {
+    {"||", EXPR_OP_OR, 0},   {"&&", EXPR_OP_AND, 1}, {"|", EXPR_OP_BOR, 2},  {"^", EXPR_OP_BXOR, 3},
+    {"&", EXPR_OP_BAND, 4},  {"==", EXPR_OP_EQ, 5},  {"!=", EXPR_OP_NE, 5},  {"<", EXPR_OP_LT, 6},
+    {"<=", EXPR_OP_LE, 6},   {">", EXPR_OP_GT, 6},   {">=", EXPR_OP_GE, 6},  {"<<", EXPR_OP_SHL, 7},
+    {">>", EXPR_OP_SHR, 7},  {"+", EXPR_OP_ADD, 8},  {"-", EXPR_OP_SUB, 8},  {"*", EXPR_OP_MUL, 9},
+    {"/", EXPR_OP_DIV, 9},   {"%", EXPR_OP_MOD, 9},
+};
+
+#define EXPR_NUM_BINOPS (sizeof(binops) / sizeof(binops[0]))
+#define EXPR_NUM_LEVELS 10
+
+typedef struct expr_func_t expr_func_t;
+struct expr_func_t {
+    const char *name;
+    uint8_t op;
+    uint8_t num_arg;
+};
+
+static const expr_func_t funcs[] = {
+    {"abs", EXPR_OP_ABS, 1},   {"sqrt", EXPR_OP_SQRT, 1}, {"floor", EXPR_OP_FLOOR, 1}, {"round", EXPR_OP_ROUND, 1},
+    {"min", EXPR_OP_MIN, 2},   {"max", EXPR_OP_MAX, 2},   {"bits", EXPR_OP_BITS, 3},   {"if", EXPR_OP_IF, 3},
+};
+
+#define EXPR_NUM_FUNCS (sizeof(funcs) / sizeof(funcs[0]))
+
+typedef struct expr_parser_t expr_parser_t;
+struct expr_parser_t {
+    expr_program_t *program;
+    const char *text;
+    size_t len;
+    size_t pos;
+    expr_resolve_func_t resolve;
+    void *context;
+    // stack depth after code emitted so far, and the most it reached
+    int32_t depth;
+    int32_t max_depth;
+    int32_t nesting;
+    const char *error;
+};
+
+
+static bool grow(void **buf, size_t *cap, size_t need, size_t item_size)
+{
+    if (need <= *cap) {
+        return true;
+    }
+
+    size_t new_cap = *cap ? *cap * 2 : 16;
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+
+    void *p = REALLOC(*buf, new_cap * item_size);
+    if (!p) {
+        return false;
+    }
+    *buf = p;
+    *cap = new_cap;
+    return true;
+}
+
+static bool fail(expr_parser_t *p, const char *error)
+{
+    if (!p->error) {
+        p->error = error;
+    }
+    return false;
+}
+
+// emit op with the stack effect it has, operand is only written for CONST and LOAD
+static bool emit(expr_parser_t *p, uint8_t op, int32_t effect, uint16_t operand)
+{
+    expr_program_t *program = p->program;
+    bool has_operand = (op == EXPR_OP_CONST || op == EXPR_OP_LOAD);
+
+    if (!grow((void **)&program->code, &program->code_cap, program->code_len + 3, 1)) {
+        return fail(p, "out of memory");
+    }
+
+    program->code[program->code_len++] = op;
+    if (has_operand) {
+        program->code[program->code_len++] = operand & 0xff;
+        program->code[program->code_len++] = operand >> 8;
+    }
+
+    p->depth += effect;
+    if (p->depth > p->max_depth) {
+        p->max_depth = p->depth;
+    }
+    return p->max_depth <= EXPR_MAX_STACK || fail(p, "too deep");
+}
+
+static bool emit_const(expr_parser_t *p, double value)
+{
+    expr_program_t *program = p->program;
+
+    // constants are shared by all expressions of program
+    uint32_t i = 0;
+    while (i < program->num_const && memcmp(&program->consts[i], &value, sizeof(value)) != 0) {
+        i++;
+    }
+
+    if (i == program->num_const) {
+        size_t cap = program->const_cap;
+        if (i > UINT16_MAX || !grow((void **)&program->consts, &cap, i + 1, sizeof(double))) {
+            return fail(p, "too many constants");
+        }
+        program->const_cap = cap;
+        program->consts[program->num_const++] = value;
+    }
+    return emit(p, EXPR_OP_CONST, 1, i);
+}
+
+static void skip_space(expr_parser_t *p)
+{
+    while (p->pos < p->len && isspace((unsigned char)p->text[p->pos])) {
+        p->pos++;
+    }
+}
+
+static bool accept(expr_parser_t *p, char c)
+{
+    skip_space(p);
+    if (p->pos < p->len && p->text[p->pos] == c) {
+        p->pos++;
+        return true;
+    }
+    return false;
+}
+
+static bool is_name_char(char c, bool first)
+{
+    return isalpha((unsigned char)c) || c == '_' || (!first && (isdigit((unsigned char)c) || c == '.'));
+}
+
+// longest binary operator at current position, so "<" isn't taken for "<<"
+static const expr_binop_t *peek_binop(expr_parser_t *p)
+{
+    skip_space(p);
+
+    const expr_binop_t *best = NULL;
+    size_t best_len = 0;
+    for (size_t i = 0; i < EXPR_NUM_BINOPS; i++) {
+        size_t n = strlen(binops[i].token);
+        if (n > best_len && p->pos + n <= p->len && memcmp(p->text + p->pos, binops[i].token, n) == 0) {
+            best = &binops[i];
+            best_len = n;
+        }
+    }
+    return best;
+}
+
+static bool parse_binary(expr_parser_t *p, int level);
+
+static bool parse_number(expr_parser_t *p)
+{
+    char buf[EXPR_MAX_NUMBER_LEN + 1];
+    size_t n = 0;
+    bool hex = p->pos + 1 < p->len && p->text[p->pos] == '0' && (p->text[p->pos + 1] | 0x20) == 'x';
+
+    while (p->pos < p->len && n < EXPR_MAX_NUMBER_LEN) {
+        char c = p->text[p->pos];
+        bool exp_sign = !hex && n > 0 && (buf[n - 1] | 0x20) == 'e' && (c == '+' || c == '-');
+        if (!isalnum((unsigned char)c) && c != '.' && !exp_sign) {
+            break;
+        }
+        buf[n++] = c;
+        p->pos++;
+    }
+    buf[n] = '\0';
+
+    char *end = NULL;
+    double value = hex ? (double)strtoull(buf + 2, &end, 16) : strtod(buf, &end);
+    if (end == buf + (hex ? 2 : 0) || *end != '\0') {
+        return fail(p, "invalid number");
+    }
+    return emit_const(p, value);
+}
+
+static bool parse_call(expr_parser_t *p, const char *name, size_t len)
+{
+    const expr_func_t *func = NULL;
+    for (size_t i = 0; i < EXPR_NUM_FUNCS; i++) {
+        if (strlen(funcs[i].name) == len && memcmp(funcs[i].name, name, len) == 0) {
+            func = &funcs[i];
+        }
+    }
+    if (!func) {
+        return fail(p, "unknown function");
+    }
+
+    for (int32_t i = 0; i < func->num_arg; i++) {
+        if ((i > 0 && !accept(p, ',')) || !parse_binary(p, 0)) {
+            return fail(p, "invalid arguments");
+        }
+    }
+    if (!accept(p, ')')) {
+        return fail(p, "expected )");
+    }
+    return emit(p, func->op, 1 - func->num_arg, 0);
+}
+
+static bool parse_variable(expr_parser_t *p, const char *name, size_t len)
+{
+    int32_t index = p->resolve(name, len, p->context);
+    if (index < 0 || index > UINT16_MAX) {
+        return fail(p, "unknown variable");
+    }
+    return emit(p, EXPR_OP_LOAD, 1, (uint16_t)index);
+}
+
+static bool parse_primary(expr_parser_t *p)
+{
+    if (p->nesting > EXPR_MAX_NESTING) {
+        return fail(p, "too deep");
+    }
+
+    skip_space(p);
+    if (p->pos >= p->len) {
+        return fail(p, "unexpected end");
+    }
+
+    char c = p->text[p->pos];
+    if (isdigit((unsigned char)c) || c == '.') {
+        return parse_number(p);
+    }
+
+    if (c == '(') {
+        p->pos++;
+        p->nesting++;
+        bool ok = parse_binary(p, 0) && (accept(p, ')') || fail(p, "expected )"));
+        p->nesting--;
+        return ok;
+    }
+
+    if (c == '\'') {
+        const char *name = p->text + ++p->pos;
+        while (p->pos < p->len && p->text[p->pos] != '\'') {
+            p->pos++;
+        }
+        if (p->pos == p->len) {
+            return fail(p, "unterminated name");
+        }
+        size_t len = p->text + p->pos++ - name;
+        return parse_variable(p, name, len);
+    }
+
+    if (is_name_char(c, true)) {
+        const char *name = p->text + p->pos;
+        while (p->pos < p->len && is_name_char(p->text[p->pos], false)) {
+            p->pos++;
+        }
+        size_t len = p->text + p->pos - name;
+        if (!accept(p, '(')) {
+            return parse_variable(p, name, len);
+        }
+        p->nesting++;
+        bool ok = parse_call(p, name, len);
+        p->nesting--;
+        return ok;
+    }
+
+    return fail(p, "unexpected character");
+}
+
+static bool parse_unary(expr_parser_t *p)
+{
+    static const char unary_tokens[] = "-+!~";
+    static const uint8_t unary_ops[] = {EXPR_OP_NEG, 0, EXPR_OP_NOT, EXPR_OP_BNOT};
+
+    skip_space(p);
+    const char *u = p->pos < p->len && p->text[p->pos] ? strchr(unary_tokens, p->text[p->pos]) : NULL;
+    if (!u) {
+        return parse_primary(p);
+    }
+
+    if (++p->nesting > EXPR_MAX_NESTING) {
+        return fail(p, "too deep");
+    }
+    p->pos++;
+    bool ok = parse_unary(p);
+    p->nesting--;
+
+    uint8_t op = unary_ops[u - unary_tokens];
+    return ok && (!op || emit(p, op, 0, 0));
+}
+
+// operators of one level are left associative, operands bind tighter
+static bool parse_binary(expr_parser_t *p, int level)
+{
+    if (level == EXPR_NUM_LEVELS) {
+        return parse_unary(p);
+    }
+
+    bool ok = parse_binary(p, level + 1);
+    const expr_binop_t *binop = NULL;
+    while (ok && (binop = peek_binop(p)) && binop->level == level) {
+        p->pos += strlen(binop->token);
+        ok = parse_binary(p, level + 1) && emit(p, binop->op, -1, 0);
+    }
+    return ok;
+}
+
+
+// integer operand of bitwise operators, false if it's out of int64 range
+static inline bool to_int(double value, int64_t *out)
+{
+    if (!(value > -9.2e18 && value < 9.2e18)) {
+        return false;
+    }
+    *out = (int64_t)value;
+    return true;
+}
+
+static inline uint16_t operand(const uint8_t *pc)
+{
+    return pc[0] | (pc[1] << 8);
+}
+
+
+// ------------------------------ public interface ----------------------------
+
+expr_program_t *expr_program_create(void)
+{
+    return (expr_program_t *)CALLOC(1, sizeof(expr_program_t));
+}
+
+void expr_program_destroy(expr_program_t *program)
+{
+    if (!program) {
+        return;
+    }
+
+    FREE(program->code);
+    FREE(program->consts);
+    FREE(program->entries);
+    FREE(program);
+}
+
+int32_t expr_compile(expr_program_t *program, const char *text, size_t len, expr_resolve_func_t resolve,
+                     void *context)
+{
+    expr_parser_t p = {.program = program, .text = text, .len = len, .resolve = resolve, .context = context};
+    size_t start = program->code_len;
+
+    size_t entry_cap = program->entry_cap;
+    if (!grow((void **)&program->entries, &entry_cap, program->num_entry + 1, sizeof(uint32_t))) {
+        return -1;
+    }
+    program->entry_cap = entry_cap;
+
+    bool ok = parse_binary(&p, 0);
+    skip_space(&p);
+    if (ok && p.pos < p.len) {
+        ok = fail(&p, "unexpected character");
+    }
+    ok = ok && emit(&p, EXPR_OP_RET, -1, 0);
+
+    if (!ok) {
+        LOGE("Invalid expression, %s at %zu: %.*s", p.error, p.pos, (int)len, text);
+        program->code_len = start;
+        return -1;
+    }
+
+    program->entries[program->num_entry] = start;
+    return program->num_entry++;
+}
+
+double expr_eval(const expr_program_t *program, int32_t id, const double *values)
+{
+    double stack[EXPR_MAX_STACK];
+    int32_t sp = 0;
+    const uint8_t *pc = program->code + program->entries[id];
+    int64_t a = 0, b = 0, c = 0;
+    double x = 0;
+
+    // compile checked depth of stack, ops are trusted here
+    for (;;) {
+        switch (*pc++) {
+        case EXPR_OP_RET:
+            return isfinite(stack[0]) ? stack[0] : NAN;
+        case EXPR_OP_CONST:
+            stack[sp++] = program->consts[operand(pc)];
+            pc += 2;
+            break;
+        case EXPR_OP_LOAD:
+            x = values[operand(pc)];
+            if (isnan(x)) {
+                return NAN;
+            }
+            stack[sp++] = x;
+            pc += 2;
+            break;
+        case EXPR_OP_NEG:
+            stack[sp - 1] = -stack[sp - 1];
+            break;
+        case EXPR_OP_NOT:
+            stack[sp - 1] = stack[sp - 1] == 0;
+            break;
+        case EXPR_OP_BNOT:
+            if (!to_int(stack[sp - 1], &a)) {
+                return NAN;
+            }
+            stack[sp - 1] = (double)~a;
+            break;
+        case EXPR_OP_ADD:
+            sp--;
+            stack[sp - 1] += stack[sp];
+            break;
+        case EXPR_OP_SUB:
+            sp--;
+            stack[sp - 1] -= stack[sp];
+            break;
+        case EXPR_OP_MUL:
+            sp--;
+            stack[sp - 1] *= stack[sp];
+            break;
+        case EXPR_OP_DIV:
+            sp--;
+            stack[sp - 1] /= stack[sp];
+            break;
+        case EXPR_OP_MOD:
+            sp--;
+            stack[sp - 1] = fmod(stack[sp - 1], stack[sp]);
+            break;
+        case EXPR_OP_SHL:
+        case EXPR_OP_SHR:
+        case EXPR_OP_BAND:
+        case EXPR_OP_BOR:
+        case EXPR_OP_BXOR:
+            sp--;
+            if (!to_int(stack[sp - 1], &a) || !to_int(stack[sp], &b)) {
+                return NAN;
+            }
+            switch (pc[-1]) {
+            case EXPR_OP_SHL:
+                a = (b >= 0 && b < 64) ? (int64_t)((uint64_t)a << b) : 0;
+                break;
+            case EXPR_OP_SHR:
+                a = (b >= 0 && b < 64) ? (int64_t)((uint64_t)a >> b) : 0;
+                break;
+            case EXPR_OP_BAND:
+                a &= b;
+                break;
+            case EXPR_OP_BOR:
+                a |= b;
+                break;
+            default:
+                a ^= b;
+            }
+            stack[sp - 1] = (double)a;
+            break;
+        case EXPR_OP_LT:
+            sp--;
+            stack[sp - 1] = stack[sp - 1] < stack[sp];
+            break;
+        case EXPR_OP_LE:
+            sp--;
+            stack[sp - 1] = stack[sp - 1] <= stack[sp];
+            break;
+        case EXPR_OP_GT:
+            sp--;
+            stack[sp - 1] = stack[sp - 1] > stack[sp];
+            break;
+        case EXPR_OP_GE:
+            sp--;
+            stack[sp - 1] = stack[sp - 1] >= stack[sp];
+            break;
+        case EXPR_OP_EQ:
+            sp--;
+            stack[sp - 1] = stack[sp - 1] == stack[sp];
+            break;
+        case EXPR_OP_NE:
+            sp--;
+            stack[sp - 1] = stack[sp - 1] != stack[sp];
+            break;
+        case EXPR_OP_AND:
+            sp--;
+            stack[sp - 1] = stack[sp - 1] != 0 && stack[sp] != 0;
+            break;
+        case EXPR_OP_OR:
+            sp--;
+            stack[sp - 1] = stack[sp - 1] != 0 || stack[sp] != 0;
+            break;
+        case EXPR_OP_ABS:
+            stack[sp - 1] = fabs(stack[sp - 1]);
+            break;
+        case EXPR_OP_SQRT:
+            stack[sp - 1] = sqrt(stack[sp - 1]);
+            break;
+        case EXPR_OP_FLOOR:
+            stack[sp - 1] = floor(stack[sp - 1]);
+            break;
+        case EXPR_OP_ROUND:
+            stack[sp - 1] = round(stack[sp - 1]);
+            break;
+        case EXPR_OP_MIN:
+            sp--;
+            stack[sp - 1] = fmin(stack[sp - 1], stack[sp]);
+            break;
+        case EXPR_OP_MAX:
+            sp--;
+            stack[sp - 1] = fmax(stack[sp - 1], stack[sp]);
+            break;
+        case EXPR_OP_BITS:
+            // width bits of x from bit offset up
+            sp -= 2;
+            if (!to_int(stack[sp - 1], &a) || !to_int(stack[sp], &b) || !to_int(stack[sp + 1], &c) || b < 0 ||
+                b > 63 || c < 1 || c > 63) {
+                return NAN;
+            }
+            stack[sp - 1] = (double)(((uint64_t)a >> b) & ((1ull << c) - 1));
+            break;
+        case EXPR_OP_IF:
+            sp -= 2;
+            stack[sp - 1] = stack[sp - 1] != 0 ? stack[sp] : stack[sp + 1];
+            break;
+        default:
+            return NAN;
+        }
+    }
+}
+
+size_t expr_program_size(const expr_program_t *program)
+{
+    return program->code_len + program->num_const * sizeof(double) + program->num_entry * sizeof(uint32_t);
+}
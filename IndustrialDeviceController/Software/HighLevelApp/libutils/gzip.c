@@ -0,0 +1,514 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <utils/gzip.h>
+
+#define DEFLATE_WINDOW_SIZE 32768
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_HASH_BITS 12
+#define DEFLATE_HASH_SIZE (1 << DEFLATE_HASH_BITS)
+
+#define GZIP_HEADER_SIZE 10
+#define GZIP_TRAILER_SIZE 8
+
+static const uint16_t length_base[] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                       31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t length_extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                       2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+                                     193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t dist_extra[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                     6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+typedef struct bit_writer_t bit_writer_t;
+struct bit_writer_t {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    uint32_t bits;
+    int32_t nbits;
+    bool overflow;
+};
+
+static void put_bits(bit_writer_t *w, uint32_t value, int32_t nbits)
+{
+    w->bits |= value << w->nbits;
+    w->nbits += nbits;
+
+    while (w->nbits >= 8) {
+        if (w->len < w->size) {
+            w->buf[w->len++] = (uint8_t)w->bits;
+        } else {
+            w->overflow = true;
+        }
+        w->bits >>= 8;
+        w->nbits -= 8;
+    }
+}
+
+// Huffman codes are packed starting from most significant bit
+static void put_code(bit_writer_t *w, uint32_t code, int32_t nbits)
+{
+    uint32_t reversed = 0;
+    for (int32_t i = 0; i < nbits; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    put_bits(w, reversed, nbits);
+}
+
+// fixed literal/length code, RFC 1951 3.2.6
+static void put_symbol(bit_writer_t *w, uint32_t symbol)
+{
+    if (symbol < 144) {
+        put_code(w, 0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        put_code(w, 0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        put_code(w, symbol - 256, 7);
+    } else {
+        put_code(w, 0xC0 + symbol - 280, 8);
+    }
+}
+
+static void put_match(bit_writer_t *w, uint32_t length, uint32_t distance)
+{
+    int32_t i = sizeof(length_base) / sizeof(length_base[0]) - 1;
+    while (length_base[i] > length) {
+        i--;
+    }
+    put_symbol(w, 257 + i);
+    put_bits(w, length - length_base[i], length_extra[i]);
+
+    int32_t d = sizeof(dist_base) / sizeof(dist_base[0]) - 1;
+    while (dist_base[d] > distance) {
+        d--;
+    }
+    put_code(w, d, 5);
+    put_bits(w, distance - dist_base[d], dist_extra[d]);
+}
+
+typedef struct bit_reader_t bit_reader_t;
+struct bit_reader_t {
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+    uint32_t bits;
+    int32_t nbits;
+    bool overflow;
+};
+
+static uint32_t get_bits(bit_reader_t *r, int32_t nbits)
+{
+    while (r->nbits < nbits) {
+        if (r->pos < r->len) {
+            r->bits |= (uint32_t)r->buf[r->pos++] << r->nbits;
+        } else {
+            r->overflow = true;
+        }
+        r->nbits += 8;
+    }
+
+    uint32_t value = r->bits & ((1u << nbits) - 1);
+    r->bits >>= nbits;
+    r->nbits -= nbits;
+    return value;
+}
+
+// canonical Huffman code, as number of codes of each length and symbols
+// ordered by code
+#define INFLATE_MAX_BITS 15
+#define INFLATE_MAX_LITERALS 288
+#define INFLATE_MAX_DISTANCES 30
+
+typedef struct huffman_t huffman_t;
+struct huffman_t {
+    uint16_t count[INFLATE_MAX_BITS + 1];
+    uint16_t symbol[INFLATE_MAX_LITERALS];
+};
+
+// build code from code lengths, false if over-subscribed
+static bool build_huffman(huffman_t *h, const uint8_t *lengths, int32_t n)
+{
+    uint16_t offs[INFLATE_MAX_BITS + 1];
+
+    memset(h->count, 0, sizeof(h->count));
+    for (int32_t i = 0; i < n; i++) {
+        h->count[lengths[i]]++;
+    }
+
+    int32_t left = 1;
+    for (int32_t len = 1; len <= INFLATE_MAX_BITS; len++) {
+        left = (left << 1) - h->count[len];
+        if (left < 0) {
+            return false;
+        }
+    }
+
+    offs[1] = 0;
+    for (int32_t len = 1; len < INFLATE_MAX_BITS; len++) {
+        offs[len + 1] = offs[len] + h->count[len];
+    }
+    for (int32_t i = 0; i < n; i++) {
+        if (lengths[i]) {
+            h->symbol[offs[lengths[i]]++] = i;
+        }
+    }
+    return true;
+}
+
+// decode a symbol, codes are read bit by bit from most significant one
+static int32_t get_symbol(bit_reader_t *r, const huffman_t *h)
+{
+    int32_t code = 0, first = 0, index = 0;
+
+    for (int32_t len = 1; len <= INFLATE_MAX_BITS; len++) {
+        code |= get_bits(r, 1);
+        int32_t count = h->count[len];
+        if (code - first < count) {
+            return h->symbol[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static bool inflate_codes(bit_reader_t *r, const huffman_t *lit, const huffman_t *dist, uint8_t *out, size_t size,
+                          size_t *len)
+{
+    while (!r->overflow) {
+        int32_t symbol = get_symbol(r, lit);
+        if (symbol < 0) {
+            return false;
+        } else if (symbol < 256) {
+            if (*len == size) {
+                return false;
+            }
+            out[(*len)++] = (uint8_t)symbol;
+        } else if (symbol == 256) {
+            return true;
+        } else {
+            symbol -= 257;
+            if (symbol >= (int32_t)(sizeof(length_base) / sizeof(length_base[0]))) {
+                return false;
+            }
+            size_t length = length_base[symbol] + get_bits(r, length_extra[symbol]);
+
+            symbol = get_symbol(r, dist);
+            if (symbol < 0 || symbol >= INFLATE_MAX_DISTANCES) {
+                return false;
+            }
+            size_t distance = dist_base[symbol] + get_bits(r, dist_extra[symbol]);
+
+            if (distance > *len || length > size - *len) {
+                return false;
+            }
+            // overlapping copy repeats the last distance bytes
+            for (size_t i = 0; i < length; i++, (*len)++) {
+                out[*len] = out[*len - distance];
+            }
+        }
+    }
+    return false;
+}
+
+static bool inflate_fixed(bit_reader_t *r, uint8_t *out, size_t size, size_t *len)
+{
+    huffman_t lit, dist;
+    uint8_t lengths[INFLATE_MAX_LITERALS];
+
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 256 - 144);
+    memset(lengths + 256, 7, 280 - 256);
+    memset(lengths + 280, 8, INFLATE_MAX_LITERALS - 280);
+    build_huffman(&lit, lengths, INFLATE_MAX_LITERALS);
+
+    memset(lengths, 5, INFLATE_MAX_DISTANCES);
+    build_huffman(&dist, lengths, INFLATE_MAX_DISTANCES);
+
+    return inflate_codes(r, &lit, &dist, out, size, len);
+}
+
+static bool inflate_dynamic(bit_reader_t *r, uint8_t *out, size_t size, size_t *len)
+{
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    huffman_t lit, dist;
+    uint8_t lengths[INFLATE_MAX_LITERALS + INFLATE_MAX_DISTANCES];
+
+    int32_t nlen = get_bits(r, 5) + 257;
+    int32_t ndist = get_bits(r, 5) + 1;
+    int32_t ncode = get_bits(r, 4) + 4;
+    if (nlen > INFLATE_MAX_LITERALS || ndist > INFLATE_MAX_DISTANCES) {
+        return false;
+    }
+
+    memset(lengths, 0, 19);
+    for (int32_t i = 0; i < ncode; i++) {
+        lengths[order[i]] = get_bits(r, 3);
+    }
+    if (!build_huffman(&lit, lengths, 19)) {
+        return false;
+    }
+
+    // code lengths of both codes, with runs
+    int32_t i = 0;
+    while (i < nlen + ndist) {
+        int32_t symbol = get_symbol(r, &lit);
+        if (symbol < 0 || r->overflow) {
+            return false;
+        }
+        if (symbol < 16) {
+            lengths[i++] = symbol;
+            continue;
+        }
+
+        uint8_t value = 0;
+        int32_t repeat;
+        if (symbol == 16) {
+            if (i == 0) {
+                return false;
+            }
+            value = lengths[i - 1];
+            repeat = 3 + get_bits(r, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + get_bits(r, 3);
+        } else {
+            repeat = 11 + get_bits(r, 7);
+        }
+        if (i + repeat > nlen + ndist) {
+            return false;
+        }
+        memset(lengths + i, value, repeat);
+        i += repeat;
+    }
+
+    if (lengths[256] == 0 || !build_huffman(&lit, lengths, nlen) || !build_huffman(&dist, lengths + nlen, ndist)) {
+        return false;
+    }
+    return inflate_codes(r, &lit, &dist, out, size, len);
+}
+
+static uint32_t get_u32le(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t hash3(const uint8_t *p)
+{
+    uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+static void put_u32le(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+
+// CRC-32 of single byte n for reflected polynomial 0xEDB88320, generated
+// offline so it lives in read-only memory and is safe to use from any thread
+static const uint32_t CRC32_TABLE[256] = {
+    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+    0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+    0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+    0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+    0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+    0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+    0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+    0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+    0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+    0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+    0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+    0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+    0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+    0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+    0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+    0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+    0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+    0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+    0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+    0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+    0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+    0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+    0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+    0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+    0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+    0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+    0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+    0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+    0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D,
+};
+
+
+uint32_t gzip_crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = CRC32_TABLE[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+
+size_t gzip_compress(const uint8_t *in, size_t len, uint8_t *out, size_t size)
+{
+    static const uint8_t header[GZIP_HEADER_SIZE] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+
+    if (size < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE) {
+        return 0;
+    }
+    memcpy(out, header, GZIP_HEADER_SIZE);
+
+    bit_writer_t w = {.buf = out + GZIP_HEADER_SIZE, .size = size - GZIP_HEADER_SIZE - GZIP_TRAILER_SIZE};
+
+    // last block, fixed Huffman codes
+    put_bits(&w, 1, 1);
+    put_bits(&w, 1, 2);
+
+    // last position each 3 byte sequence seen at, + 1 so 0 is empty
+    uint32_t head[DEFLATE_HASH_SIZE];
+    memset(head, 0, sizeof(head));
+
+    size_t i = 0;
+    while (i < len && !w.overflow) {
+        uint32_t length = 0;
+        size_t distance = 0;
+
+        if (i + DEFLATE_MIN_MATCH <= len) {
+            uint32_t h = hash3(in + i);
+            size_t candidate = head[h];
+            head[h] = i + 1;
+
+            if (candidate > 0 && i - (candidate - 1) <= DEFLATE_WINDOW_SIZE) {
+                const uint8_t *m = in + candidate - 1;
+                size_t max = len - i < DEFLATE_MAX_MATCH ? len - i : DEFLATE_MAX_MATCH;
+                while (length < max && m[length] == in[i + length]) {
+                    length++;
+                }
+                distance = i - (candidate - 1);
+            }
+        }
+
+        if (length >= DEFLATE_MIN_MATCH) {
+            put_match(&w, length, distance);
+            // index skipped positions so later data can refer to them
+            for (size_t k = i + 1; k < i + length && k + DEFLATE_MIN_MATCH <= len; k++) {
+                head[hash3(in + k)] = k + 1;
+            }
+            i += length;
+        } else {
+            put_symbol(&w, in[i]);
+            i++;
+        }
+    }
+
+    // end of block and flush remaining bits
+    put_symbol(&w, 256);
+    put_bits(&w, 0, 7);
+
+    if (w.overflow) {
+        return 0;
+    }
+
+    uint8_t *trailer = out + GZIP_HEADER_SIZE + w.len;
+    put_u32le(trailer, gzip_crc32(0, in, len));
+    put_u32le(trailer + 4, (uint32_t)len);
+    return GZIP_HEADER_SIZE + w.len + GZIP_TRAILER_SIZE;
+}
+
+
+size_t gzip_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t size)
+{
+    if (len < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE || in[0] != 0x1F || in[1] != 0x8B || in[2] != 8) {
+        return 0;
+    }
+
+    // skip optional extra field, name, comment and header CRC
+    uint8_t flags = in[3];
+    size_t pos = GZIP_HEADER_SIZE;
+    if (flags & 0x04) {
+        pos = (pos + 2 <= len) ? pos + 2 + (in[pos] | (in[pos + 1] << 8)) : len;
+    }
+    for (uint8_t flag = 0x08; flag <= 0x10; flag <<= 1) {
+        if (flags & flag) {
+            while (pos < len && in[pos] != 0) {
+                pos++;
+            }
+            pos++;
+        }
+    }
+    if (flags & 0x02) {
+        pos += 2;
+    }
+    if (pos + GZIP_TRAILER_SIZE > len) {
+        return 0;
+    }
+
+    bit_reader_t r = {.buf = in + pos, .len = len - pos - GZIP_TRAILER_SIZE};
+    size_t n = 0;
+    bool last = false;
+
+    while (!last) {
+        last = get_bits(&r, 1);
+        uint32_t type = get_bits(&r, 2);
+        bool ok;
+
+        if (type == 0) {
+            // stored block starts at byte boundary, drop bits left of current byte
+            r.bits = 0;
+            r.nbits = 0;
+            if (r.pos + 4 > r.len) {
+                return 0;
+            }
+            size_t stored = r.buf[r.pos] | (r.buf[r.pos + 1] << 8);
+            if ((stored ^ 0xFFFF) != (size_t)(r.buf[r.pos + 2] | (r.buf[r.pos + 3] << 8))) {
+                return 0;
+            }
+            r.pos += 4;
+            ok = stored <= r.len - r.pos && stored <= size - n;
+            if (ok) {
+                memcpy(out + n, r.buf + r.pos, stored);
+                r.pos += stored;
+                n += stored;
+            }
+        } else if (type == 1) {
+            ok = inflate_fixed(&r, out, size, &n);
+        } else if (type == 2) {
+            ok = inflate_dynamic(&r, out, size, &n);
+        } else {
+            ok = false;
+        }
+
+        if (!ok || r.overflow) {
+            return 0;
+        }
+    }
+
+    const uint8_t *trailer = in + len - GZIP_TRAILER_SIZE;
+    if (get_u32le(trailer) != gzip_crc32(0, out, n) || get_u32le(trailer + 4) != (uint32_t)n) {
+        return 0;
+    }
+    return n;
+}
@@ -0,0 +1,116 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <utils/histogram.h>
+
+static int32_t bucket_of(uint32_t value)
+{
+    if (value > HISTOGRAM_MAX_VALUE) {
+        return HISTOGRAM_NUM_BUCKETS - 1;
+    }
+
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+
+    int32_t exp = 31 - __builtin_clz(value);
+    uint32_t sub = (value >> (exp - HISTOGRAM_SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return HISTOGRAM_SUB_BUCKETS * (exp - HISTOGRAM_SUB_BUCKET_BITS + 1) + sub;
+}
+
+
+uint32_t histogram_bucket_lower(int32_t bucket)
+{
+    if (bucket < (int32_t)HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    int32_t exp = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKET_BITS - 1;
+    uint32_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    return (HISTOGRAM_SUB_BUCKETS + sub) << (exp - HISTOGRAM_SUB_BUCKET_BITS);
+}
+
+
+void histogram_reset(histogram_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+
+void histogram_take(histogram_t *h, histogram_t *out)
+{
+    // subtract what been copied instead of clearing so no concurrent record is lost
+    for (int32_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+        out->counts[i] = __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&h->counts[i], out->counts[i], __ATOMIC_RELAXED);
+    }
+
+    out->total = 0;
+    for (int32_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+        out->total += out->counts[i];
+    }
+    __atomic_fetch_sub(&h->total, out->total, __ATOMIC_RELAXED);
+    out->max = __atomic_exchange_n(&h->max, 0, __ATOMIC_RELAXED);
+}
+
+
+void histogram_record(histogram_t *h, uint32_t value)
+{
+    __atomic_fetch_add(&h->counts[bucket_of(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+
+    uint32_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(&h->max, &max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+
+uint32_t histogram_percentile(const histogram_t *h, double percentile)
+{
+    if (h->total == 0) {
+        return 0;
+    }
+
+    // rank of the value, 1 based
+    uint64_t rank = (uint64_t)(percentile / 100 * h->total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int32_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            // never report above largest value recorded
+            uint32_t upper = (i + 1 < HISTOGRAM_NUM_BUCKETS) ? histogram_bucket_lower(i + 1) - 1 : h->max;
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
+
+
+int histogram_print(const histogram_t *h, char *buf, size_t size)
+{
+    size_t n = 0;
+    if (size > 0) {
+        buf[0] = '\0';
+    }
+
+    for (int32_t i = 0; i < HISTOGRAM_NUM_BUCKETS && n < size; i++) {
+        if (h->counts[i] == 0) {
+            continue;
+        }
+
+        int nprint = snprintf(buf + n, size - n, "%s%u:%u", n ? " " : "", histogram_bucket_lower(i), h->counts[i]);
+        if (nprint < 0) {
+            break;
+        }
+        n += nprint;
+    }
+    return n < size ? (int)n : (int)size - 1;
+}
@@ -0,0 +1,47 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include <utils/json_array.h>
+
+struct json_array_walk_info {
+    json_array_elem_cb cb;
+    void *user_data;
+    int count;
+    bool stopped;
+};
+
+
+static void json_array_walk_cb(void *callback_data, const char *name, size_t name_len, const char *path,
+                               const struct json_token *token)
+{
+    struct json_array_walk_info *info = (struct json_array_walk_info *)callback_data;
+
+    (void)name;
+    (void)name_len;
+
+    if (info->stopped || token->type == JSON_TYPE_OBJECT_START || token->type == JSON_TYPE_ARRAY_START) {
+        return;
+    }
+
+    // only the elements themselves, "[3]", not their members "[3].name" or "[3][0]"
+    if (path[0] != '[' || strchr(path + 1, '[') || strchr(path, '.')) {
+        return;
+    }
+
+    if (!info->cb(token, info->count++, info->user_data)) {
+        info->stopped = true;
+    }
+}
+
+
+int json_array_walk(const char *str, int len, json_array_elem_cb cb, void *user_data)
+{
+    struct json_array_walk_info info = {.cb = cb, .user_data = user_data, .count = 0, .stopped = false};
+
+    if (json_walk(str, len, json_array_walk_cb, &info) < 0) {
+        return -1;
+    }
+    return info.count;
+}
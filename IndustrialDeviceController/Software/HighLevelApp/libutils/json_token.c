@@ -0,0 +1,20 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <utils/json_token.h>
+
+int json_token_unescape(const struct json_token *t, char *buf, int size)
+{
+    if (!t->ptr || t->type != JSON_TYPE_STRING || size <= 0) {
+        return -1;
+    }
+
+    // json_unescape stops writing at the end of buf but still returns the full length
+    int len = json_unescape(t->ptr, t->len, buf, size - 1);
+    if (len < 0 || len >= size) {
+        return -1;
+    }
+
+    buf[len] = '\0';
+    return len;
+}
@@ -1,8 +1,10 @@
 /* Copyright (c) Microsoft Corporation. All rights reserved.
    Licensed under the MIT License. */
 
+#include <ctype.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,6 +20,8 @@
 #include <frozen/frozen.h>
 #include <init/globals.h>
 #include <iot/iot.h>
+#include <safeclib/safe_lib.h>
+#include <utils/gzip.h>
 #include <utils/llog.h>
 #include <utils/timer.h>
 #include <utils/utils.h>
@@ -27,16 +31,51 @@
 
 static const char LOG_TAGS[] = {'N', 'F', 'E', 'W', 'I', 'D', 'V'};
 
-typedef struct log_entry_t log_entry_t;
-struct log_entry_t {
-    char *body;
-    log_entry_t *next;
+// each record is a 2 bytes length followed by message body without NUL,
+// records wrap around the end of buffer
+#define LOG_RECORD_HEADER_SIZE sizeof(uint16_t)
+// set in record length if body is a deferred record formatted at upload
+#define LOG_RECORD_DEFERRED 0x8000
+#define LOG_RECORD_LEN_MASK 0x7fff
+
+// longest conversion spec kept by deferred record, e.g. "%-08.3llx"
+#define LOG_SPEC_MAX_SIZE 16
+
+// body of deferred record, followed by one 8 bytes slot per numeric argument
+// and a NUL terminated copy per string argument, in format order. format,
+// file and function are string literals so only their pointers are kept
+typedef struct log_deferred_t log_deferred_t;
+struct log_deferred_t {
+    struct timespec ts;
+    const char *file;
+    const char *func;
+    const char *fmt;
+    int32_t level;
+    // if non zero, arguments are replaced by raw bytes printed with hex()
+    int32_t hex_len;
 };
 
-typedef struct log_chunk_t log_chunk_t;
-struct log_chunk_t {
-    log_entry_t *head;
-    log_entry_t *tail;
+typedef enum {
+    LOG_ARG_NONE,
+    LOG_ARG_INT,
+    LOG_ARG_LONG,
+    LOG_ARG_LLONG,
+    LOG_ARG_SIZE,
+    LOG_ARG_PTRDIFF,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_PTR,
+    LOG_ARG_STR,
+    LOG_ARG_UNSUPPORTED
+} log_arg_t;
+
+typedef struct log_ring_t log_ring_t;
+struct log_ring_t {
+    char buf[DIAG_LOG_RING_SIZE];
+    // offset of oldest record
+    size_t head;
+    // offset next record is written at
+    size_t tail;
+    size_t used;
     int len;
 };
 
@@ -45,7 +84,11 @@ struct log_t {
     pthread_mutex_t lock;
     int endpoint;
     int level;
-    log_chunk_t chunks;
+    log_ring_t chunks;
+    // upload compressed with gzip, and bytes sent per upload at most, 0 for
+    // no limit. Logs over budget stay in ring for next upload
+    bool upload_gzip;
+    int32_t upload_budget;
     int uart_fd;
     int tx_enable_fd;
 
@@ -55,70 +98,382 @@ struct log_t {
 static log_t s_log;
 
 
-static int printf_logs(struct json_out *out, va_list *ap)
+_Static_assert(DIAG_MAX_LOG_SIZE <= LOG_RECORD_LEN_MASK, "log record length overflow");
+
+static void ring_write(log_ring_t *ring, size_t offset, const void *data, size_t len)
 {
-    int len = 0;
-    struct log_entry_t *p = va_arg(*ap, struct log_entry_t *);
-    int i = 0;
-    while (p) {
-        if (i > 0) {
-            json_printf(out, ",");
-        }
-        len += json_printf(out, "%s", p->body);
-        p = p->next;
-        i++;
+    size_t first = MIN(len, DIAG_LOG_RING_SIZE - offset);
+    memcpy(ring->buf + offset, data, first);
+    memcpy(ring->buf, (const char *)data + first, len - first);
+}
+
+static void ring_read(const log_ring_t *ring, size_t offset, void *data, size_t len)
+{
+    size_t first = MIN(len, DIAG_LOG_RING_SIZE - offset);
+    memcpy(data, ring->buf + offset, first);
+    memcpy((char *)data + first, ring->buf, len - first);
+}
+
+static void ring_reset(log_ring_t *ring)
+{
+    ring->head = ring->tail = 0;
+    ring->used = 0;
+    ring->len = 0;
+}
+
+// drop the oldest record
+static void ring_pop(log_ring_t *ring)
+{
+    uint16_t header;
+    ring_read(ring, ring->head, &header, LOG_RECORD_HEADER_SIZE);
+    size_t record_len = LOG_RECORD_HEADER_SIZE + (header & LOG_RECORD_LEN_MASK);
+    ring->head = (ring->head + record_len) % DIAG_LOG_RING_SIZE;
+    ring->used -= record_len;
+    ring->len--;
+}
+
+// append a record, dropping oldest ones to make room
+static void ring_push(log_ring_t *ring, uint16_t flags, const void *body, size_t body_len)
+{
+    size_t record_len = LOG_RECORD_HEADER_SIZE + body_len;
+
+    while (ring->len > 0 && (ring->len >= DIAG_MAX_LOG_HISTORY || ring->used + record_len > DIAG_LOG_RING_SIZE)) {
+        ring_pop(ring);
     }
-    return len;
+
+    uint16_t header = (uint16_t)body_len | flags;
+    ring_write(ring, ring->tail, &header, LOG_RECORD_HEADER_SIZE);
+    ring_write(ring, (ring->tail + LOG_RECORD_HEADER_SIZE) % DIAG_LOG_RING_SIZE, body, body_len);
+    ring->tail = (ring->tail + record_len) % DIAG_LOG_RING_SIZE;
+    ring->used += record_len;
+    ring->len++;
 }
 
+/// <summary>
+/// scan one printf conversion spec
+/// </summary>
+/// <param name="spec">points to the '%' starting the spec</param>
+/// <param name="end">set to the char after the spec</param>
+/// <returns>type of argument consumed by the spec</returns>
+static log_arg_t scan_spec(const char *spec, const char **end)
+{
+    const char *p = spec + 1;
+    *end = p;
 
-// add log entry into a fixed size list
-static void llog_iothub(const char * fmt, va_list args)
+    if (*p == '%') {
+        *end = p + 1;
+        return LOG_ARG_NONE;
+    }
+
+    // '*' width or precision takes an extra argument, not supported
+    while (*p && strchr("-+ #0", *p)) p++;
+    while (isdigit((unsigned char)*p)) p++;
+    if (*p == '.') {
+        p++;
+        while (isdigit((unsigned char)*p)) p++;
+    }
+
+    log_arg_t int_type = LOG_ARG_INT;
+    if (p[0] == 'h') {
+        p += (p[1] == 'h') ? 2 : 1;
+    } else if (p[0] == 'l' && p[1] == 'l') {
+        int_type = LOG_ARG_LLONG;
+        p += 2;
+    } else if (p[0] == 'l') {
+        int_type = LOG_ARG_LONG;
+        p++;
+    } else if (p[0] == 'j') {
+        int_type = LOG_ARG_LLONG;
+        p++;
+    } else if (p[0] == 'z') {
+        int_type = LOG_ARG_SIZE;
+        p++;
+    } else if (p[0] == 't') {
+        int_type = LOG_ARG_PTRDIFF;
+        p++;
+    }
+
+    if (!*p || p + 1 - spec >= LOG_SPEC_MAX_SIZE) {
+        return LOG_ARG_UNSUPPORTED;
+    }
+    *end = p + 1;
+
+    switch (*p) {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    case 'c':
+        return int_type;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        return LOG_ARG_DOUBLE;
+    case 's':
+        return int_type == LOG_ARG_INT ? LOG_ARG_STR : LOG_ARG_UNSUPPORTED;
+    case 'p':
+        return LOG_ARG_PTR;
+    default:
+        return LOG_ARG_UNSUPPORTED;
+    }
+}
+
+/// <summary>
+/// render a deferred record the way llog would have printed it
+/// </summary>
+/// <returns>length of message</returns>
+static size_t format_deferred(const char *body, size_t body_len, char *message, size_t size)
 {
-    char message[DIAG_MAX_LOG_SIZE];
+    log_deferred_t hdr;
+    memcpy(&hdr, body, sizeof(hdr));
+    const char *arg = body + sizeof(hdr);
+    const char *arg_end = body + body_len;
+
+    // leave room for the line break
+    size -= 1;
+    size_t n = 0;
+
+#define APPEND(...)                                                                                                    \
+    do {                                                                                                               \
+        int nprint = snprintf(message + n, size - n, __VA_ARGS__);                                                     \
+        n = (nprint < 0) ? n : MIN(size - 1, n + nprint);                                                              \
+    } while (0)
+
+    if (hdr.func) {
+        APPEND("%s %c %s: %s: ", timespec2str(hdr.ts), LOG_TAGS[hdr.level], hdr.file, hdr.func);
+    } else {
+        APPEND("%s %c %s: ", timespec2str(hdr.ts), LOG_TAGS[hdr.level], hdr.file);
+    }
 
-    if (vsnprintf(message, sizeof(message), fmt, args) == DIAG_MAX_LOG_SIZE - 1) {
-        // ensure message always end with CRLF
-        message[DIAG_MAX_LOG_SIZE - 2] = '\n';
+    if (hdr.hex_len > 0) {
+        APPEND("%s%s", hdr.fmt, hex((const unsigned char *)arg, hdr.hex_len));
     }
 
-    log_entry_t *p = NULL;
-    // if we are at capacity, remove the oldest entry and reuse it at the tail.
-    if (s_log.chunks.len >= DIAG_MAX_LOG_HISTORY) {
-        p = s_log.chunks.head;
-        s_log.chunks.head = p->next;
+    for (const char *p = hdr.hex_len > 0 ? "" : hdr.fmt; *p;) {
+        if (*p != '%') {
+            const char *literal = p;
+            while (*p && *p != '%') p++;
+            APPEND("%.*s", (int)(p - literal), literal);
+            continue;
+        }
 
-        if (p->body) {
-            FREE(p->body);
+        const char *end;
+        log_arg_t type = scan_spec(p, &end);
+        char spec[LOG_SPEC_MAX_SIZE];
+        strncpy_s(spec, sizeof(spec), p, end - p);
+        p = end;
+
+        uint64_t slot = 0;
+        if (type != LOG_ARG_NONE && type != LOG_ARG_STR) {
+            if (arg + sizeof(slot) > arg_end) break;
+            memcpy(&slot, arg, sizeof(slot));
+            arg += sizeof(slot);
         }
 
-        s_log.chunks.len--;
-    } else {
-        p = CALLOC(1, sizeof(log_entry_t));
+        switch (type) {
+        case LOG_ARG_NONE:
+            APPEND("%%");
+            break;
+        case LOG_ARG_INT:
+            APPEND(spec, (int)slot);
+            break;
+        case LOG_ARG_LONG:
+            APPEND(spec, (long)slot);
+            break;
+        case LOG_ARG_LLONG:
+            APPEND(spec, (long long)slot);
+            break;
+        case LOG_ARG_SIZE:
+            APPEND(spec, (size_t)slot);
+            break;
+        case LOG_ARG_PTRDIFF:
+            APPEND(spec, (ptrdiff_t)slot);
+            break;
+        case LOG_ARG_DOUBLE: {
+            double d;
+            memcpy(&d, &slot, sizeof(d));
+            APPEND(spec, d);
+            break;
+        }
+        case LOG_ARG_PTR:
+            APPEND(spec, (void *)(uintptr_t)slot);
+            break;
+        case LOG_ARG_STR:
+            APPEND(spec, arg);
+            arg += strnlen(arg, arg_end - arg) + 1;
+            break;
+        default:
+            break;
+        }
+    }
+#undef APPEND
+
+    message[n++] = '\n';
+    return n;
+}
+
+/// <summary>
+/// record a log line with its raw arguments, to be formatted at upload
+/// </summary>
+/// <returns>false if format not supported and log must be formatted now</returns>
+static bool llog_deferred(int level, const char *file, const char *func, const char *fmt, va_list args)
+{
+    union {
+        log_deferred_t hdr;
+        char buf[DIAG_MAX_LOG_SIZE];
+    } record;
+
+    record.hdr.ts = now();
+    record.hdr.file = file;
+    record.hdr.func = func;
+    record.hdr.fmt = fmt;
+    record.hdr.level = level;
+    record.hdr.hex_len = 0;
+
+    size_t len = sizeof(log_deferred_t);
+
+    for (const char *p = fmt; *p;) {
+        if (*p != '%') {
+            p++;
+            continue;
+        }
+
+        log_arg_t type = scan_spec(p, &p);
+        uint64_t slot = 0;
+
+        switch (type) {
+        case LOG_ARG_NONE:
+            continue;
+        case LOG_ARG_INT:
+            slot = (uint64_t)va_arg(args, int);
+            break;
+        case LOG_ARG_LONG:
+            slot = (uint64_t)va_arg(args, long);
+            break;
+        case LOG_ARG_LLONG:
+            slot = (uint64_t)va_arg(args, long long);
+            break;
+        case LOG_ARG_SIZE:
+            slot = (uint64_t)va_arg(args, size_t);
+            break;
+        case LOG_ARG_PTRDIFF:
+            slot = (uint64_t)va_arg(args, ptrdiff_t);
+            break;
+        case LOG_ARG_DOUBLE: {
+            double d = va_arg(args, double);
+            memcpy(&slot, &d, sizeof(slot));
+            break;
+        }
+        case LOG_ARG_PTR:
+            slot = (uintptr_t)va_arg(args, void *);
+            break;
+        case LOG_ARG_STR: {
+            // string may not outlive the call, keep a copy
+            const char *str = va_arg(args, const char *);
+            if (!str) {
+                str = "(null)";
+            }
+            size_t str_len = strnlen(str, sizeof(record.buf) - len);
+            if (len + str_len + 1 > sizeof(record.buf)) {
+                return false;
+            }
+            memcpy(record.buf + len, str, str_len + 1);
+            len += str_len + 1;
+            continue;
+        }
+        default:
+            return false;
+        }
+
+        if (len + sizeof(slot) > sizeof(record.buf)) {
+            return false;
+        }
+        memcpy(record.buf + len, &slot, sizeof(slot));
+        len += sizeof(slot);
     }
 
-    p->body = STRNDUP(message, DIAG_MAX_LOG_SIZE);
-    p->next = NULL;
-    s_log.chunks.len++;
+    ring_push(&s_log.chunks, LOG_RECORD_DEFERRED, record.buf, len);
+    return true;
+}
 
-    if (!s_log.chunks.tail) {
-        s_log.chunks.head = s_log.chunks.tail = p;
+// read the record at offset as it is uploaded, advance offset past it
+static size_t read_record(const log_ring_t *ring, size_t *offset, char *message)
+{
+    uint16_t header;
+    ring_read(ring, *offset, &header, LOG_RECORD_HEADER_SIZE);
+    *offset = (*offset + LOG_RECORD_HEADER_SIZE) % DIAG_LOG_RING_SIZE;
+    size_t body_len = header & LOG_RECORD_LEN_MASK;
+    size_t len = body_len;
+
+    if (header & LOG_RECORD_DEFERRED) {
+        char body[DIAG_MAX_LOG_SIZE];
+        ring_read(ring, *offset, body, body_len);
+        len = format_deferred(body, body_len, message, DIAG_MAX_LOG_SIZE);
     } else {
-        s_log.chunks.tail->next = p;
-        s_log.chunks.tail = p;
+        ring_read(ring, *offset, message, body_len);
+    }
+
+    *offset = (*offset + body_len) % DIAG_LOG_RING_SIZE;
+    return len;
+}
+
+// serialize oldest records as JSON array into buf, as many as fit in limit
+// but at least one and at most max_count. buf must hold a record over limit
+static size_t serialize_logs(const log_ring_t *ring, int max_count, char *buf, size_t limit, int *pcount)
+{
+    size_t offset = ring->head;
+    size_t len = 1;
+    int count = 0;
+
+    buf[0] = '[';
+    for (; count < MIN(ring->len, max_count); count++) {
+        char message[DIAG_MAX_LOG_SIZE];
+        size_t message_len = read_record(ring, &offset, message);
+
+        // separator and closing bracket
+        if (count > 0 && len + 1 + message_len + 1 > limit) {
+            break;
+        }
+        if (count > 0) {
+            buf[len++] = ',';
+        }
+        memcpy(buf + len, message, message_len);
+        len += message_len;
     }
+    buf[len++] = ']';
+
+    *pcount = count;
+    return len;
 }
 
-static void disable_iothub_endpoint(void)
+
+// add log entry into the ring, dropping oldest entries to make room
+static void llog_iothub(const char * fmt, va_list args)
 {
-    while (s_log.chunks.head) {
-        log_entry_t *p = s_log.chunks.head;
-        s_log.chunks.head = p->next;
-        FREE(p->body);
-        FREE(p);
+    char message[DIAG_MAX_LOG_SIZE];
+
+    int body_len = vsnprintf(message, sizeof(message), fmt, args);
+    if (body_len < 0) {
+        return;
+    } else if (body_len >= DIAG_MAX_LOG_SIZE - 1) {
+        // ensure message always end with CRLF
+        message[DIAG_MAX_LOG_SIZE - 2] = '\n';
+        body_len = DIAG_MAX_LOG_SIZE - 1;
     }
-    s_log.chunks.head = s_log.chunks.tail = NULL;
-    s_log.chunks.len = 0;
+
+    ring_push(&s_log.chunks, 0, message, body_len);
+}
+
+static void disable_iothub_endpoint(void)
+{
+    ring_reset(&s_log.chunks);
 }
 
 #ifdef ENABLE_SERIAL_LOG
@@ -215,6 +570,11 @@ void llog(int level, const char *file, const char *func, const char *fmt, ...)
     printf("\n");
 }
 
+void llog_hex(int level, const char *file, const char *prefix, const unsigned char *data, size_t len)
+{
+    llog(level, file, NULL, "%s%s", prefix, hex(data, len));
+}
+
 #else
 
 void llog(int level, const char *file, const char *func, const char *fmt, ...)
@@ -224,6 +584,20 @@ void llog(int level, const char *file, const char *func, const char *fmt, ...)
     // avoid reentry
     if (pthread_mutex_trylock(&s_log.lock) != 0) return;
 
+    va_list args;
+
+    // chatty levels only pay for copying arguments, formatting waits for upload
+    if (s_log.endpoint == LOG_ENDPOINT_IOTHUB && level >= DIAG_LOG_DEFERRED_LEVEL) {
+        va_start(args, fmt);
+        bool deferred = llog_deferred(level, file, func, fmt, args);
+        va_end(args);
+
+        if (deferred) {
+            pthread_mutex_unlock(&s_log.lock);
+            return;
+        }
+    }
+
     char newfmt[DIAG_MAX_LOG_SIZE];
 
     if (func) {
@@ -232,7 +606,6 @@ void llog(int level, const char *file, const char *func, const char *fmt, ...)
         snprintf(newfmt, sizeof(newfmt), "%s %c %s: %s\n", timespec2str(now()), LOG_TAGS[level], file, fmt);
     }
 
-    va_list args;
     va_start(args, fmt);
 
     if (s_log.endpoint == LOG_ENDPOINT_CONSOLE) {
@@ -249,6 +622,37 @@ void llog(int level, const char *file, const char *func, const char *fmt, ...)
     pthread_mutex_unlock(&s_log.lock);
 
 }
+
+void llog_hex(int level, const char *file, const char *prefix, const unsigned char *data, size_t len)
+{
+    if ((s_log.endpoint == LOG_ENDPOINT_NULL) || (level > s_log.level)) return;
+
+    if (s_log.endpoint != LOG_ENDPOINT_IOTHUB || level < DIAG_LOG_DEFERRED_LEVEL) {
+        llog(level, file, NULL, "%s%s", prefix, hex(data, len));
+        return;
+    }
+
+    if (pthread_mutex_trylock(&s_log.lock) != 0) return;
+
+    union {
+        log_deferred_t hdr;
+        char buf[DIAG_MAX_LOG_SIZE];
+    } record;
+
+    // hex() prints 3 chars per byte into its buffer
+    len = MIN(len, MIN(sizeof(record.buf) - sizeof(log_deferred_t), DIAG_MAX_LOG_SIZE / 3 - 1));
+
+    record.hdr.ts = now();
+    record.hdr.file = file;
+    record.hdr.func = NULL;
+    record.hdr.fmt = prefix;
+    record.hdr.level = level;
+    record.hdr.hex_len = len;
+    memcpy(record.buf + sizeof(log_deferred_t), data, len);
+
+    ring_push(&s_log.chunks, LOG_RECORD_DEFERRED, record.buf, sizeof(log_deferred_t) + len);
+    pthread_mutex_unlock(&s_log.lock);
+}
 #endif // TEST
 
 
@@ -261,8 +665,7 @@ int llog_init()
 
     s_log.endpoint = LOG_ENDPOINT_CONSOLE;
     s_log.level = LOG_LEVEL;
-    s_log.chunks.head = s_log.chunks.tail = NULL;
-    s_log.chunks.len = 0;
+    ring_reset(&s_log.chunks);
 
     return 0;
 }
@@ -294,21 +697,58 @@ bool llog_remote_log_enabled(void)
     return s_log.endpoint == LOG_ENDPOINT_IOTHUB && s_log.level > LOG_NONE;
 }
 
+void llog_config_upload(bool gzip, int32_t budget)
+{
+    pthread_mutex_lock(&s_log.lock);
+    s_log.upload_gzip = gzip;
+    s_log.upload_budget = MAX(budget, 0);
+    pthread_mutex_unlock(&s_log.lock);
+}
+
 void llog_upload(void)
 {
     if (s_log.chunks.len == 0) return;
 
-    char *iot_message = json_asprintf("[%M]", printf_logs, s_log.chunks.head);
-    iot_send_message_async(iot_message, IOT_MESSAGE_TYPE_DIAG_DEBUG, NULL, NULL);
-    FREE(iot_message);
+    // hold the ring while serializing, a log line from another thread is dropped
+    // rather than written over records being read
+    pthread_mutex_lock(&s_log.lock);
+
+    // logs compress several times, so compressed upload takes that many more
+    // bytes of logs for same budget
+    size_t budget = s_log.upload_budget > 0 ? (size_t)s_log.upload_budget : SIZE_MAX;
+    size_t cap = s_log.upload_gzip ? MIN(budget, SIZE_MAX / DIAG_LOG_UPLOAD_GZIP_RATIO) * DIAG_LOG_UPLOAD_GZIP_RATIO
+                                   : budget;
+    size_t limit = MIN(cap, (size_t)s_log.chunks.len * (DIAG_MAX_LOG_SIZE + 1) + 2);
+    // a record longer than budget still go alone
+    char *raw = (char *)MALLOC(MAX(limit, DIAG_MAX_LOG_SIZE + 2));
+
+    int count = 0;
+    size_t len = serialize_logs(&s_log.chunks, s_log.chunks.len, raw, limit, &count);
+    uint8_t *packed = NULL;
+    size_t packed_len = 0;
+
+    if (s_log.upload_gzip) {
+        packed = (uint8_t *)MALLOC(len);
+        packed_len = gzip_compress((const uint8_t *)raw, len, packed, len);
+        // compressed worse than expected, take fewer logs till it's in budget
+        while (count > 1 && (packed_len == 0 || packed_len > budget)) {
+            len = serialize_logs(&s_log.chunks, count / 2, raw, limit, &count);
+            packed_len = gzip_compress((const uint8_t *)raw, len, packed, len);
+        }
+    }
 
-    while (s_log.chunks.head) {
-        log_entry_t *p = s_log.chunks.head;
-        s_log.chunks.head = p->next;
-        FREE(p->body);
-        FREE(p);
+    for (int i = 0; i < count; i++) {
+        ring_pop(&s_log.chunks);
     }
+    pthread_mutex_unlock(&s_log.lock);
 
-    s_log.chunks.head = s_log.chunks.tail = NULL;
-    s_log.chunks.len = 0;
+    if (packed_len > 0) {
+        iot_send_binary_message_async(packed, packed_len, IOT_MESSAGE_TYPE_DIAG_DEBUG, IOT_MESSAGE_CONTENT_TYPE,
+                                      IOT_MESSAGE_CONTENT_ENCODING_GZIP, NULL, NULL, NULL);
+    } else {
+        iot_send_binary_message_async((const uint8_t *)raw, len, IOT_MESSAGE_TYPE_DIAG_DEBUG, IOT_MESSAGE_CONTENT_TYPE,
+                                      IOT_MESSAGE_CONTENT_ENCODING, NULL, NULL, NULL);
+    }
+    FREE(packed);
+    FREE(raw);
 }
@@ -11,6 +11,9 @@
  * __real_free as free.
  */
 
+#include <malloc.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,6 +28,264 @@ void massert_fail(const char *expr, int line, const char *file)
     abort();
 }
 
+// ------------------------ size class pools ---------------------------------
+// small allocations are served from one fixed arena per size class so that
+// objects allocated and freed again and again reuse the same slots instead of
+// fragmenting the heap. arena pages are only touched when a slot is first
+// handed out, freed slots are reused first. when a pool is full, allocation
+// falls back to malloc and is counted as overflow.
+//
+// every allocation is also counted, in O(1) and in both builds, for
+// memory_get_stats: live and peak bytes, and allocations and frees per size
+// class, anything not in a pool slot counting in the heap class by its usable
+// size.
+
+typedef struct mpool_t mpool_t;
+struct mpool_t {
+    size_t size;
+    size_t capacity;
+    char *base;
+    void *free_list;
+    // slots handed out from arena at least once
+    size_t num_touched;
+    size_t num_used;
+    size_t max_used;
+    size_t num_overflow;
+    size_t num_alloc;
+    size_t num_free;
+    pthread_mutex_t lock;
+};
+
+#define MPOOL(size, capacity) {size, capacity, NULL, NULL, 0, 0, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER}
+
+static mpool_t s_pools[] = {MPOOL(16, 512), MPOOL(32, 512), MPOOL(64, 256), MPOOL(128, 128), MPOOL(256, 64)};
+
+#define NUM_POOLS (sizeof(s_pools) / sizeof(s_pools[0]))
+#define POOL_MAX_SIZE 256
+
+_Static_assert(NUM_POOLS + 1 == MEMORY_NUM_CLASSES, "a class per pool and one for the heap");
+
+// bytes in pool slots and heap blocks handed out, updated with relaxed atomics
+static size_t s_live_bytes;
+static size_t s_peak_bytes;
+static size_t s_heap_alloc;
+static size_t s_heap_free;
+static size_t s_heap_used;
+static size_t s_heap_max_used;
+
+static void raise_max(size_t *max, size_t value)
+{
+    size_t seen = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (value > seen && !__atomic_compare_exchange_n(max, &seen, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void count_alloc(size_t bytes)
+{
+    raise_max(&s_peak_bytes, __atomic_add_fetch(&s_live_bytes, bytes, __ATOMIC_RELAXED));
+}
+
+static void count_free(size_t bytes)
+{
+    __atomic_sub_fetch(&s_live_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+static void count_heap_alloc(void *ptr)
+{
+    if (ptr) {
+        __atomic_add_fetch(&s_heap_alloc, 1, __ATOMIC_RELAXED);
+        raise_max(&s_heap_max_used, __atomic_add_fetch(&s_heap_used, 1, __ATOMIC_RELAXED));
+        count_alloc(malloc_usable_size(ptr));
+    }
+}
+
+static void count_heap_free(void *ptr)
+{
+    if (ptr) {
+        __atomic_add_fetch(&s_heap_free, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&s_heap_used, 1, __ATOMIC_RELAXED);
+        count_free(malloc_usable_size(ptr));
+    }
+}
+
+static void *heap_alloc(size_t size)
+{
+    void *ptr = malloc(size);
+    count_heap_alloc(ptr);
+    return ptr;
+}
+
+static void *heap_calloc(size_t nmemb, size_t size)
+{
+    void *ptr = calloc(nmemb, size);
+    count_heap_alloc(ptr);
+    return ptr;
+}
+
+static void heap_free(void *ptr)
+{
+    count_heap_free(ptr);
+    free(ptr);
+}
+
+static void *heap_realloc(void *ptr, size_t size)
+{
+    size_t old_size = malloc_usable_size(ptr);
+    void *new_ptr = realloc(ptr, size);
+    if (new_ptr) {
+        count_free(old_size);
+        count_alloc(malloc_usable_size(new_ptr));
+    }
+    return new_ptr;
+}
+
+
+static mpool_t *pool_of(const void *ptr)
+{
+    for (size_t i = 0; i < NUM_POOLS; i++) {
+        const char *base = __atomic_load_n(&s_pools[i].base, __ATOMIC_ACQUIRE);
+        if (base && (const char *)ptr >= base && (const char *)ptr < base + s_pools[i].size * s_pools[i].capacity) {
+            return &s_pools[i];
+        }
+    }
+    return NULL;
+}
+
+
+static void *pool_alloc(size_t size)
+{
+    mpool_t *pool = NULL;
+    for (size_t i = 0; i < NUM_POOLS; i++) {
+        if (size <= s_pools[i].size) {
+            pool = &s_pools[i];
+            break;
+        }
+    }
+
+    if (!pool) {
+        return heap_alloc(size);
+    }
+
+    void *ptr = NULL;
+    pthread_mutex_lock(&pool->lock);
+
+    if (!pool->base) {
+        char *base = malloc(pool->size * pool->capacity);
+        ASSERT(base);
+        __atomic_store_n(&pool->base, base, __ATOMIC_RELEASE);
+    }
+
+    if (pool->free_list) {
+        ptr = pool->free_list;
+        pool->free_list = *(void **)ptr;
+    } else if (pool->num_touched < pool->capacity) {
+        ptr = pool->base + pool->size * pool->num_touched++;
+    }
+
+    if (ptr) {
+        pool->num_alloc++;
+        pool->num_used++;
+        if (pool->num_used > pool->max_used) {
+            pool->max_used = pool->num_used;
+        }
+    } else {
+        pool->num_overflow++;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!ptr) {
+        return heap_alloc(size);
+    }
+    count_alloc(pool->size);
+    return ptr;
+}
+
+
+static void pool_free(void *ptr)
+{
+    mpool_t *pool = pool_of(ptr);
+    if (!pool) {
+        heap_free(ptr);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    *(void **)ptr = pool->free_list;
+    pool->free_list = ptr;
+    pool->num_free++;
+    pool->num_used--;
+    pthread_mutex_unlock(&pool->lock);
+
+    count_free(pool->size);
+}
+
+
+static void *pool_realloc(void *ptr, size_t size)
+{
+    mpool_t *pool = pool_of(ptr);
+    if (!pool) {
+        return heap_realloc(ptr, size);
+    }
+
+    if (size <= pool->size) {
+        return ptr;
+    }
+
+    void *new_ptr = pool_alloc(size);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, pool->size);
+        pool_free(ptr);
+    }
+    return new_ptr;
+}
+
+
+static void pool_report(void)
+{
+    memory_stats_t stats;
+    memory_get_stats(&stats);
+
+    fprintf(stderr, "Allocator [peak/live bytes] = %zu/%zu\n", stats.peak_bytes, stats.live_bytes);
+    for (size_t i = 0; i < NUM_POOLS; i++) {
+        mpool_t *pool = &s_pools[i];
+        pthread_mutex_lock(&pool->lock);
+        fprintf(stderr, "Pool %zu [max/current/capacity/overflow/allocs/frees] = %zu/%zu/%zu/%zu/%zu/%zu\n", pool->size,
+                pool->max_used, pool->num_used, pool->capacity, pool->num_overflow, pool->num_alloc, pool->num_free);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    const memory_class_stats_t *heap = &stats.classes[NUM_POOLS];
+    fprintf(stderr, "Heap [max/current/allocs/frees] = %zu/%zu/%zu/%zu\n", heap->max_used, heap->num_used, heap->num_alloc,
+            heap->num_free);
+}
+
+void memory_get_stats(memory_stats_t *stats)
+{
+    stats->live_bytes = __atomic_load_n(&s_live_bytes, __ATOMIC_RELAXED);
+    stats->peak_bytes = __atomic_load_n(&s_peak_bytes, __ATOMIC_RELAXED);
+
+    for (size_t i = 0; i < NUM_POOLS; i++) {
+        mpool_t *pool = &s_pools[i];
+        memory_class_stats_t *c = &stats->classes[i];
+        pthread_mutex_lock(&pool->lock);
+        c->size = pool->size;
+        c->num_alloc = pool->num_alloc;
+        c->num_free = pool->num_free;
+        c->num_used = pool->num_used;
+        c->max_used = pool->max_used;
+        c->num_overflow = pool->num_overflow;
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    memory_class_stats_t *heap = &stats->classes[NUM_POOLS];
+    heap->size = 0;
+    heap->num_alloc = __atomic_load_n(&s_heap_alloc, __ATOMIC_RELAXED);
+    heap->num_free = __atomic_load_n(&s_heap_free, __ATOMIC_RELAXED);
+    heap->num_used = __atomic_load_n(&s_heap_used, __ATOMIC_RELAXED);
+    heap->max_used = __atomic_load_n(&s_heap_max_used, __ATOMIC_RELAXED);
+    heap->num_overflow = 0;
+}
+
 #ifdef DEBUG
 
 #define NUM_BLOCKS 1000
@@ -49,7 +310,7 @@ void *mmalloc(size_t size, int line, const char* file)
         return NULL;
     }
 
-    void *ptr = malloc(size);
+    void *ptr = pool_alloc(size);
     ASSERT(ptr);
 
     g_allocated += size;
@@ -95,7 +356,7 @@ void mfree(void *ptr)
 
     // we may free memory from library, loose the check
     ASSERT(i<NUM_BLOCKS);
-    free(ptr);
+    pool_free(ptr);
 }
 
 
@@ -114,7 +375,7 @@ void *mrealloc(void *ptr, size_t size, int line, const char *file)
         return mmalloc(size, line, file);
     }
 
-    void *new_ptr = realloc(ptr, size);
+    void *new_ptr = pool_realloc(ptr, size);
     ASSERT(new_ptr);
 
     int i = 0;
@@ -182,6 +443,7 @@ char *mstrndup(const char *s, size_t n, int line, const char *file)
 void memory_report(int show_detail)
 {
     fprintf(stderr, "Memory [max/current/blocks] = %zu/%zu/%zu\n", g_allocated_max, g_allocated, g_allocated_blocks);
+    pool_report();
     if (show_detail) {
         for (int i = 0; i < NUM_BLOCKS; i++) {
             if (blocks[i].addr) {
@@ -199,7 +461,7 @@ void memory_report(int show_detail)
 
 void *mmalloc(size_t size)
 {
-    void *ptr = malloc(size);
+    void *ptr = pool_alloc(size);
     ASSERT(ptr);
     return ptr;
 }
@@ -207,36 +469,56 @@ void *mmalloc(size_t size)
 
 void *mcalloc(size_t nmemb, size_t size)
 {
-    void *ptr = calloc(nmemb, size);
+    // big blocks come zeroed from calloc without touching every page
+    if (size && nmemb > POOL_MAX_SIZE / size) {
+        void *ptr = heap_calloc(nmemb, size);
+        ASSERT(ptr);
+        return ptr;
+    }
+
+    void *ptr = pool_alloc(nmemb * size);
     ASSERT(ptr);
+    memset(ptr, 0, nmemb * size);
     return ptr;
 
 }
 
 void *mrealloc(void *ptr, size_t size)
 {
-    void *new_ptr = realloc(ptr, size);
+    void *new_ptr = ptr ? pool_realloc(ptr, size) : pool_alloc(size);
     ASSERT(new_ptr);
     return new_ptr;
 }
 
 char *mstrdup(const char *s)
 {
-    char *ptr = strdup(s);
-    ASSERT(ptr);
+    size_t len = strlen(s);
+    char *ptr = (char *)mmalloc(len + 1);
+    memcpy(ptr, s, len + 1);
     return ptr;
 }
 
 char *mstrndup(const char *s, size_t len)
 {
-    char *ptr = strndup(s, len);
-    ASSERT(ptr);
+    len = strnlen(s, len);
+    char *ptr = (char *)mmalloc(len + 1);
+    memcpy(ptr, s, len);
+    ptr[len] = '\0';
     return ptr;
 }
 
 void mfree(void *ptr)
 {
-    free(ptr);
+    if (!ptr) {
+        return;
+    }
+    pool_free(ptr);
+}
+
+void memory_report(int show_detail)
+{
+    (void)show_detail;
+    pool_report();
 }
 
 #endif
\ No newline at end of file
@@ -18,10 +18,111 @@
 #include <sys/types.h>
 
 #include <init/globals.h>
+#include <utils/event_loop_timer.h>
 #include <utils/llog.h>
 #include <utils/network.h>
+#include <utils/timer.h>
 #include <utils/utils.h>
 
+static const char IF_WIFI[] = "wlan0";
+static const char IF_ETH[] = "eth0";
+
+// Interface status is queried from applibs by one refresh timer, everyone
+// else read the cached copy, from any thread
+typedef struct network_t network_t;
+struct network_t {
+    EventLoop *eloop;
+    event_loop_timer_t *refresh_timer;
+    // written by refresh timer only, read with __atomic
+    Networking_InterfaceConnectionStatus wifi_status;
+    Networking_InterfaceConnectionStatus eth_status;
+    network_status_func_t callback;
+    void *context;
+    // IF_ETH, IF_WIFI or NULL, uplink is written by refresh timer only and
+    // primary by network_config, both read with __atomic
+    const char *uplink;
+    const char *primary;
+    // primary reaching internet since ts_primary_up, by refresh timer only
+    bool primary_up;
+    struct timespec ts_primary_up;
+    network_uplink_func_t uplink_callback;
+    void *uplink_context;
+};
+
+static network_t s_network;
+
+static bool is_status_connected(Networking_InterfaceConnectionStatus status)
+{
+    return (status & Networking_InterfaceConnectionStatus_ConnectedToInternet) != 0;
+}
+
+// Both interfaces stay enabled, so the standby one is connected already when
+// the uplink is lost and traffic moves without waiting for it to come up. A
+// move is only to an interface reaching internet, the one before is never
+// torn down for it
+static void refresh_uplink(void)
+{
+    const char *primary = __atomic_load_n(&s_network.primary, __ATOMIC_RELAXED);
+    const char *uplink = s_network.uplink;
+    const char *next = uplink;
+
+    bool primary_up = primary && network_is_interface_connected(primary);
+    if (primary_up && !s_network.primary_up) {
+        timer_stopwatch_start(&s_network.ts_primary_up);
+    }
+    s_network.primary_up = primary_up;
+
+    if (!uplink || !network_is_interface_connected(uplink)) {
+        if (primary_up) {
+            next = primary;
+        } else if (network_is_interface_connected(IF_ETH)) {
+            next = IF_ETH;
+        } else if (network_is_interface_connected(IF_WIFI)) {
+            next = IF_WIFI;
+        } else {
+            next = NULL;
+        }
+    } else if (primary_up && uplink != primary &&
+               timer_stopwatch_stop(&s_network.ts_primary_up) >= NETWORK_UPLINK_RESTORE_MS) {
+        // back on the configured one once it looks stable, not on every flap
+        next = primary;
+    }
+
+    if (next == uplink) {
+        return;
+    }
+
+    LOGI("uplink %s -> %s", uplink ? uplink : "none", next ? next : "none");
+    __atomic_store_n(&s_network.uplink, next, __ATOMIC_RELAXED);
+    if (s_network.uplink_callback) {
+        s_network.uplink_callback(next, uplink, s_network.uplink_context);
+    }
+}
+
+static void refresh_status(void)
+{
+    Networking_InterfaceConnectionStatus wifi_status = 0;
+    Networking_InterfaceConnectionStatus eth_status = 0;
+
+    Networking_GetInterfaceConnectionStatus(IF_WIFI, &wifi_status);
+    Networking_GetInterfaceConnectionStatus(IF_ETH, &eth_status);
+
+    Networking_InterfaceConnectionStatus last = network_get_status();
+    __atomic_store_n(&s_network.wifi_status, wifi_status, __ATOMIC_RELAXED);
+    __atomic_store_n(&s_network.eth_status, eth_status, __ATOMIC_RELAXED);
+
+    if ((wifi_status | eth_status) != last && s_network.callback) {
+        s_network.callback(wifi_status | eth_status, s_network.context);
+    }
+
+    refresh_uplink();
+}
+
+static void refresh_timer_callback(void *context)
+{
+    refresh_status();
+}
+
 static int config_downlink_private_network(const char *if_name)
 {
     static struct in_addr local_ip;
@@ -184,8 +285,10 @@ static int config_uplink(link_t *uplink)
     if (!uplink || !uplink->if_name) return -1;
 
     if (strcmp(uplink->if_name, "eth") == 0) {
+        __atomic_store_n(&s_network.primary, IF_ETH, __ATOMIC_RELAXED);
         return config_uplink_eth();
     } else if (strcmp(uplink->if_name, "wifi") == 0) {
+        __atomic_store_n(&s_network.primary, IF_WIFI, __ATOMIC_RELAXED);
         return config_uplink_wifi(uplink->if_data);
     } else {
         LOGE("Invalid uplink interface: %s", uplink->if_name);
@@ -221,16 +324,44 @@ static int config_downlink(link_t *downlink)
 
 // Check if any wifi SSID been configured, if yes, use WIFI otherwise fallback to
 // use Ethernet.
-int network_init()
+int network_init(EventLoop *eloop)
 {
+    ASSERT(eloop);
+
     LOGI("network_init");
-    Networking_SetInterfaceState("wlan0", true);
-    Networking_SetInterfaceState("eth0", true);
-    return 0;
+    Networking_SetInterfaceState(IF_WIFI, true);
+    Networking_SetInterfaceState(IF_ETH, true);
+
+    memset(&s_network, 0, sizeof(s_network));
+    s_network.eloop = eloop;
+    refresh_status();
+
+    struct timespec ts_refresh = MS2SPEC(NETWORK_STATUS_REFRESH_MS);
+    s_network.refresh_timer =
+        event_loop_register_timer(eloop, &ts_refresh, &ts_refresh, NULL, refresh_timer_callback, NULL);
+    return s_network.refresh_timer ? 0 : -1;
 }
 
 void network_deinit()
 {
+    if (s_network.refresh_timer) {
+        event_loop_unregister_timer(s_network.eloop, s_network.refresh_timer);
+        s_network.refresh_timer = NULL;
+    }
+    s_network.callback = NULL;
+    s_network.uplink_callback = NULL;
+}
+
+void network_set_status_callback(network_status_func_t callback, void *context)
+{
+    s_network.callback = callback;
+    s_network.context = context;
+}
+
+void network_set_uplink_callback(network_uplink_func_t callback, void *context)
+{
+    s_network.uplink_callback = callback;
+    s_network.uplink_context = context;
 }
 
 
@@ -267,12 +398,8 @@ const char *network_get_status_str(Networking_InterfaceConnectionStatus status)
 
 Networking_InterfaceConnectionStatus network_get_status(void)
 {
-    Networking_InterfaceConnectionStatus wifi_status = 0;
-    Networking_InterfaceConnectionStatus eth_status = 0;
-
-    Networking_GetInterfaceConnectionStatus("wlan0", &wifi_status);
-    Networking_GetInterfaceConnectionStatus("eth0", &eth_status);
-    return wifi_status | eth_status;
+    return __atomic_load_n(&s_network.wifi_status, __ATOMIC_RELAXED) |
+           __atomic_load_n(&s_network.eth_status, __ATOMIC_RELAXED);
 }
 
 void network_get_mac(const char *ifa_name, char *buf, size_t buf_size)
@@ -300,13 +427,24 @@ void network_get_mac(const char *ifa_name, char *buf, size_t buf_size)
 
 bool network_is_connected(void)
 {
-    return network_is_interface_connected("eth0") || network_is_interface_connected("wlan0");
+    return network_is_interface_connected(IF_ETH) || network_is_interface_connected(IF_WIFI);
 }
 
 bool network_is_interface_connected(const char *nic)
 {
+    if (strcmp(nic, IF_WIFI) == 0) {
+        return is_status_connected(__atomic_load_n(&s_network.wifi_status, __ATOMIC_RELAXED));
+    } else if (strcmp(nic, IF_ETH) == 0) {
+        return is_status_connected(__atomic_load_n(&s_network.eth_status, __ATOMIC_RELAXED));
+    }
+
+    // interface not cached
     Networking_InterfaceConnectionStatus status = 0;
     Networking_GetInterfaceConnectionStatus(nic, &status);
-    return (status & Networking_InterfaceConnectionStatus_ConnectedToInternet) != 0;    
+    return is_status_connected(status);
+}
 
+const char *network_get_uplink(void)
+{
+    return __atomic_load_n(&s_network.uplink, __ATOMIC_RELAXED);
 }
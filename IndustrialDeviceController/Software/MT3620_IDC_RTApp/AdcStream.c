@@ -0,0 +1,160 @@
+/* Copyright (c) Codethink Ltd. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lib/NVIC.h"
+#include "lib/ADC.h"
+
+#include "Scheduler.h"
+#include "AdcStream.h"
+
+// DMA ring, the interrupt is raised every half so there's half a ring of
+// time to average each half before the DMA overwrites it.
+#define ADC_STREAM_RING_SIZE 256
+
+static __attribute__((section(".sysram"))) uint32_t ring[ADC_STREAM_RING_SIZE];
+
+// Blocks are filled by the interrupt and emptied by the send task in turn,
+// full is only set by the interrupt and only cleared by the task.
+typedef struct {
+    uint16_t          samples[ADC_STREAM_MAX_BLOCK_SAMPLES];
+    volatile uint32_t count;
+    volatile bool     full;
+} AdcStream_Block;
+
+static AdcStream_Block blocks[2];
+static unsigned        fillBlock = 0;
+static unsigned        sendBlock = 0;
+
+static AdcContext             *adc = NULL;
+static AdcStream_Config        config;
+static AdcStream_BlockCallback blockCallback = NULL;
+
+static uint32_t          sum[ADC_STREAM_MAX_CHANNELS];
+static uint16_t          taken[ADC_STREAM_MAX_CHANNELS];
+static volatile uint32_t dropped = 0;
+
+static void AdcStream__Send(void *data);
+
+static Scheduler_Task sendTask = SCHEDULER_TASK(AdcStream__Send, SCHEDULER_PRIORITY_LOW, 0);
+
+static void AdcStream__Send(void *data)
+{
+    (void)data;
+
+    while (blocks[sendBlock].full) {
+        AdcStream_Block *block = &blocks[sendBlock];
+
+        uint32_t prevBasePri = NVIC_BlockIRQs();
+        uint32_t lost = dropped;
+        dropped = 0;
+        NVIC_RestoreIRQs(prevBasePri);
+
+        if (!blockCallback || !blockCallback(block->samples, block->count, lost)) {
+            prevBasePri = NVIC_BlockIRQs();
+            dropped += lost + block->count;
+            NVIC_RestoreIRQs(prevBasePri);
+        }
+
+        block->count = 0;
+        block->full = false;
+        sendBlock ^= 1;
+    }
+}
+
+// Called in the DMA interrupt with raw samples in place in the ring.
+static void AdcStream__Samples(const uint32_t *raw, uint32_t count)
+{
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        unsigned channel = raw[i] & 0xF;
+        if (channel >= ADC_STREAM_MAX_CHANNELS) {
+            continue;
+        }
+
+        sum[channel] += (raw[i] >> 4) & 0xFFF;
+        if (++taken[channel] < config.decimation) {
+            continue;
+        }
+
+        uint16_t mean = (sum[channel] + (config.decimation / 2)) / config.decimation;
+        sum[channel] = 0;
+        taken[channel] = 0;
+
+        AdcStream_Block *block = &blocks[fillBlock];
+        if (block->full) {
+            dropped++;
+            continue;
+        }
+
+        block->samples[block->count] = (channel << 12) | mean;
+        if (++block->count == config.blockSamples) {
+            block->full = true;
+            fillBlock ^= 1;
+            Scheduler_Post(&sendTask);
+        }
+    }
+}
+
+int32_t AdcStream_Start(const AdcStream_Config *cfg, AdcStream_BlockCallback callback)
+{
+    if (adc) {
+        return ERROR_BUSY;
+    }
+
+    if (!cfg || !callback || (cfg->channelMask == 0) ||
+        (cfg->channelMask >= (1U << ADC_STREAM_MAX_CHANNELS)) ||
+        (cfg->decimation == 0) || (cfg->blockSamples == 0) ||
+        (cfg->blockSamples > ADC_STREAM_MAX_BLOCK_SAMPLES) || (cfg->frequency == 0)) {
+        return ERROR_ADC_STREAM_CONFIG;
+    }
+
+    config = *cfg;
+    blockCallback = callback;
+
+    unsigned c;
+    for (c = 0; c < ADC_STREAM_MAX_CHANNELS; c++) {
+        sum[c] = 0;
+        taken[c] = 0;
+    }
+    blocks[0].count = 0;
+    blocks[0].full = false;
+    blocks[1].count = 0;
+    blocks[1].full = false;
+    fillBlock = 0;
+    sendBlock = 0;
+    dropped = 0;
+
+    adc = ADC_Open(MT3620_UNIT_ADC0);
+    if (!adc) {
+        return ERROR_UNSUPPORTED;
+    }
+
+    int32_t error = ADC_ReadContinuousAsync(adc, AdcStream__Samples,
+        ADC_STREAM_RING_SIZE, ring, config.channelMask,
+        config.frequency, config.referenceVoltage);
+    if (error != ERROR_NONE) {
+        AdcStream_Stop();
+    }
+
+    return error;
+}
+
+void AdcStream_Stop(void)
+{
+    if (!adc) {
+        return;
+    }
+
+    ADC_Stop(adc);
+    ADC_Close(adc);
+    adc = NULL;
+    blockCallback = NULL;
+}
+
+bool AdcStream_Running(void)
+{
+    return (adc != NULL);
+}
@@ -0,0 +1,77 @@
+/* Copyright (c) Codethink Ltd. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef AZURE_SPHERE_ADC_STREAM_H_
+#define AZURE_SPHERE_ADC_STREAM_H_
+
+#include "lib/Common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Continuous acquisition of the ADC for the main loop of an RT app. The ADC
+// scans its channels into a circular DMA ring in SYSRAM, and each time half
+// of the ring fills the interrupt averages every channel over a number of
+// scans. Averaged samples are packed into blocks, and only a full block is
+// handed to the main loop, from a scheduler task, to be sent on to the A7.
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/// <summary>Number of ADC channels which can be streamed.</summary>
+#define ADC_STREAM_MAX_CHANNELS      8
+
+/// <summary>Largest number of averaged samples in one block.</summary>
+#define ADC_STREAM_MAX_BLOCK_SAMPLES 504
+
+/// <summary>Returned when the stream configuration is invalid.</summary>
+#define ERROR_ADC_STREAM_CONFIG      (ERROR_SPECIFIC - 1)
+
+/// <summary>Acquisition parameters, see <see cref="AdcStream_Start" />.</summary>
+typedef struct {
+    /// <summary>Rate in Hz at which the ADC scans all the enabled channels.</summary>
+    uint32_t frequency;
+    /// <summary>Bit mask of the channels to sample.</summary>
+    uint16_t channelMask;
+    /// <summary>Number of scans averaged into one sample of each channel, 1 for none.</summary>
+    uint16_t decimation;
+    /// <summary>The reference voltage in millivolts, as for ADC_ReadPeriodicAsync.</summary>
+    uint16_t referenceVoltage;
+    /// <summary>Number of averaged samples, of all channels, in one block.</summary>
+    uint16_t blockSamples;
+} AdcStream_Config;
+
+/// <summary>
+/// <para>Called from a scheduler task with each full block. Each sample holds the channel
+/// in bits 12 to 15 and the averaged 12 bit value in bits 0 to 11, in the order they were
+/// taken. dropped is the number of samples lost since the previous block because the main
+/// loop fell behind.</para>
+/// </summary>
+/// <returns>'true' if the block was taken, 'false' to count it as dropped.</returns>
+typedef bool (*AdcStream_BlockCallback)(const uint16_t *samples, uint32_t count, uint32_t dropped);
+
+/// <summary>
+/// <para>Opens the ADC and starts streaming. Fails if a stream is already running.</para>
+/// </summary>
+/// <param name="config">The acquisition parameters, copied.</param>
+/// <param name="callback">Called with each full block of samples.</param>
+/// <returns>ERROR_NONE on success, or an error code.</returns>
+int32_t AdcStream_Start(const AdcStream_Config *config, AdcStream_BlockCallback callback);
+
+/// <summary>
+/// <para>Stops streaming and closes the ADC. Samples not yet in a full block are
+/// discarded.</para>
+/// </summary>
+void AdcStream_Stop(void);
+
+/// <summary>
+/// <para>Returns whether a stream is running.</para>
+/// </summary>
+bool AdcStream_Running(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // #ifndef AZURE_SPHERE_ADC_STREAM_H_
@@ -0,0 +1,348 @@
+/* Copyright (c) Codethink Ltd. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(__ARM_FEATURE_SIMD32)
+#include <arm_acle.h>
+#endif
+
+#include "lib/NVIC.h"
+#include "lib/I2S.h"
+
+#include "Scheduler.h"
+#include "AudioFeatures.h"
+
+// The I2S driver interrupts when its 1024 sample DMA ring is 3/4 full, so up
+// to three frames arrive at once, the fourth lets the task fall one behind.
+#define AUDIO_FEATURES_FRAME_COUNT 4
+
+#define AUDIO_FEATURES_BINS (AUDIO_FEATURES_FRAME_SIZE / 2)
+
+// Power of a full scale sine through the Hann window, summed over the
+// positive frequency bins.
+#define AUDIO_FEATURES_SINE_POWER \
+    (((float)AUDIO_FEATURES_FRAME_SIZE * AUDIO_FEATURES_FRAME_SIZE * 3.0f) / 32.0f)
+
+// Frames are filled by the interrupt and processed by the task in turn, full
+// is only set by the interrupt and only cleared by the task.
+typedef struct {
+    int16_t       samples[AUDIO_FEATURES_FRAME_SIZE] __attribute__((aligned(4)));
+    volatile bool full;
+} AudioFeatures_Frame;
+
+static AudioFeatures_Frame frames[AUDIO_FEATURES_FRAME_COUNT];
+static unsigned            fillFrame   = 0;
+static unsigned            fillCount   = 0;
+static bool                fillDiscard = false;
+static unsigned            procFrame   = 0;
+static volatile uint32_t   dropped     = 0;
+
+static I2S                    *i2s = NULL;
+static AudioFeatures_Config    config;
+static AudioFeatures_Callback  vectorCallback = NULL;
+
+// Hann window, FFT twiddles and bit reversal, computed once
+static bool    tablesReady = false;
+static float   window[AUDIO_FEATURES_FRAME_SIZE];
+static float   twiddleRe[AUDIO_FEATURES_BINS];
+static float   twiddleIm[AUDIO_FEATURES_BINS];
+static uint8_t bitReverse[AUDIO_FEATURES_FRAME_SIZE];
+
+static float fftRe[AUDIO_FEATURES_FRAME_SIZE];
+static float fftIm[AUDIO_FEATURES_FRAME_SIZE];
+
+// Accumulated over the frames of the vector being built
+static int64_t  sumSquares = 0;
+static uint32_t peak = 0;
+static float    bandPower[AUDIO_FEATURES_MAX_BANDS];
+static uint32_t vectorFrames = 0;
+static float    features[2 + AUDIO_FEATURES_MAX_BANDS];
+
+static void AudioFeatures__Process(void *data);
+
+static Scheduler_Task processTask = SCHEDULER_TASK(AudioFeatures__Process, SCHEDULER_PRIORITY_LOW, 0);
+
+static inline float AudioFeatures__Sqrt(float x)
+{
+#if defined(__ARM_FP)
+    float r;
+    __asm__ ("vsqrt.f32 %0, %1" : "=t" (r) : "t" (x));
+    return r;
+#else
+    float r = (x > 1.0f ? x : 1.0f);
+    unsigned i;
+    for (i = 0; i < 32; i++) {
+        r = 0.5f * (r + (x / r));
+    }
+    return r;
+#endif
+}
+
+static void AudioFeatures__InitTables(void)
+{
+    // Rotate by 2*pi/N in double precision rather than pulling in libm.
+    const double stepCos = 0.99969881869620422;
+    const double stepSin = 0.02454122852291229;
+    double c = 1.0, s = 0.0;
+
+    unsigned i;
+    for (i = 0; i < AUDIO_FEATURES_FRAME_SIZE; i++) {
+        window[i] = (float)(0.5 - (0.5 * c));
+        if (i < AUDIO_FEATURES_BINS) {
+            twiddleRe[i] = (float)c;
+            twiddleIm[i] = (float)-s;
+        }
+
+        double nc = (c * stepCos) - (s * stepSin);
+        s = (s * stepCos) + (c * stepSin);
+        c = nc;
+
+        unsigned r = 0, b;
+        for (b = 1; b < AUDIO_FEATURES_FRAME_SIZE; b <<= 1) {
+            r = (r << 1) | ((i & b) ? 1 : 0);
+        }
+        bitReverse[i] = r;
+    }
+
+    tablesReady = true;
+}
+
+// Sum of squares and peak magnitude of a frame, two samples at a time with
+// the M4 SIMD instructions where the compiler offers them.
+static void AudioFeatures__Stats(const int16_t *samples)
+{
+#if defined(__ARM_FEATURE_SIMD32)
+    const int16x2_t *pairs = (const int16x2_t *)samples;
+    int64_t  acc     = sumSquares;
+    uint32_t maxPair = 0;
+
+    unsigned i;
+    for (i = 0; i < (AUDIO_FEATURES_FRAME_SIZE / 2); i++) {
+        int16x2_t x = pairs[i];
+        acc = __smlald(x, x, acc);
+
+        // Per lane |x| then max, selecting on the GE flags of the subtract.
+        int16x2_t neg = __qsub16(0, x);
+        (void)__ssub16(x, neg);
+        int16x2_t mag = __sel(x, neg);
+        (void)__ssub16(mag, maxPair);
+        maxPair = __sel(mag, maxPair);
+    }
+
+    sumSquares = acc;
+    uint32_t lo = maxPair & 0xFFFF;
+    uint32_t hi = maxPair >> 16;
+    uint32_t m  = (lo > hi ? lo : hi);
+    if (m > peak) {
+        peak = m;
+    }
+#else
+    unsigned i;
+    for (i = 0; i < AUDIO_FEATURES_FRAME_SIZE; i++) {
+        int32_t x = samples[i];
+        sumSquares += x * x;
+        uint32_t m = (x < 0 ? -x : x);
+        if (m > peak) {
+            peak = m;
+        }
+    }
+#endif
+}
+
+// Windowed radix-2 FFT of a frame, accumulating the power of each band.
+static void AudioFeatures__Bands(const int16_t *samples)
+{
+    unsigned i;
+    for (i = 0; i < AUDIO_FEATURES_FRAME_SIZE; i++) {
+        unsigned r = bitReverse[i];
+        fftRe[r] = samples[i] * window[i] * (1.0f / 32768.0f);
+        fftIm[r] = 0.0f;
+    }
+
+    unsigned len;
+    for (len = 2; len <= AUDIO_FEATURES_FRAME_SIZE; len <<= 1) {
+        unsigned half = len / 2;
+        unsigned step = AUDIO_FEATURES_FRAME_SIZE / len;
+        unsigned start, k;
+        for (start = 0; start < AUDIO_FEATURES_FRAME_SIZE; start += len) {
+            for (k = 0; k < half; k++) {
+                float wr = twiddleRe[k * step];
+                float wi = twiddleIm[k * step];
+                unsigned a = start + k;
+                unsigned b = a + half;
+                float tr = (fftRe[b] * wr) - (fftIm[b] * wi);
+                float ti = (fftRe[b] * wi) + (fftIm[b] * wr);
+                fftRe[b] = fftRe[a] - tr;
+                fftIm[b] = fftIm[a] - ti;
+                fftRe[a] += tr;
+                fftIm[a] += ti;
+            }
+        }
+    }
+
+    unsigned band, k;
+    for (band = 0; band < config.bands; band++) {
+        unsigned first = (band * AUDIO_FEATURES_BINS) / config.bands;
+        unsigned last  = ((band + 1) * AUDIO_FEATURES_BINS) / config.bands;
+        float power = 0.0f;
+        for (k = first; k < last; k++) {
+            power += (fftRe[k] * fftRe[k]) + (fftIm[k] * fftIm[k]);
+        }
+        bandPower[band] += power;
+    }
+}
+
+static void AudioFeatures__Reset(void)
+{
+    sumSquares = 0;
+    peak = 0;
+    vectorFrames = 0;
+
+    unsigned band;
+    for (band = 0; band < AUDIO_FEATURES_MAX_BANDS; band++) {
+        bandPower[band] = 0.0f;
+    }
+}
+
+static void AudioFeatures__Emit(void)
+{
+    float samples = (float)vectorFrames * AUDIO_FEATURES_FRAME_SIZE;
+    features[0] = AudioFeatures__Sqrt((float)sumSquares / samples) * (1.0f / 32768.0f);
+    features[1] = peak * (1.0f / 32768.0f);
+
+    unsigned band;
+    for (band = 0; band < config.bands; band++) {
+        features[2 + band] = bandPower[band] / (vectorFrames * AUDIO_FEATURES_SINE_POWER);
+    }
+
+    uint32_t prevBasePri = NVIC_BlockIRQs();
+    uint32_t lost = dropped;
+    dropped = 0;
+    NVIC_RestoreIRQs(prevBasePri);
+
+    if (!vectorCallback || !vectorCallback(features, 2 + config.bands, lost)) {
+        prevBasePri = NVIC_BlockIRQs();
+        dropped += lost + vectorFrames;
+        NVIC_RestoreIRQs(prevBasePri);
+    }
+
+    AudioFeatures__Reset();
+}
+
+static void AudioFeatures__Process(void *data)
+{
+    (void)data;
+
+    while (frames[procFrame].full) {
+        AudioFeatures_Frame *frame = &frames[procFrame];
+        AudioFeatures__Stats(frame->samples);
+        AudioFeatures__Bands(frame->samples);
+
+        frame->full = false;
+        procFrame = (procFrame + 1) % AUDIO_FEATURES_FRAME_COUNT;
+
+        if (++vectorFrames >= config.framesPerVector) {
+            AudioFeatures__Emit();
+        }
+    }
+}
+
+// Called in the I2S DMA interrupt, always consumes everything so the DMA ring
+// never fills, discarding whole frames while the task is behind.
+static bool AudioFeatures__Input(void *data, uintptr_t size)
+{
+    const int16_t *in = (const int16_t *)data;
+    uintptr_t count = size / sizeof(int16_t);
+
+    while (count > 0) {
+        AudioFeatures_Frame *frame = &frames[fillFrame];
+        if (fillCount == 0) {
+            fillDiscard = frame->full;
+        }
+
+        uintptr_t n = AUDIO_FEATURES_FRAME_SIZE - fillCount;
+        if (n > count) {
+            n = count;
+        }
+        if (!fillDiscard) {
+            __builtin_memcpy(&frame->samples[fillCount], in, n * sizeof(int16_t));
+        }
+        fillCount += n;
+        in += n;
+        count -= n;
+
+        if (fillCount == AUDIO_FEATURES_FRAME_SIZE) {
+            fillCount = 0;
+            if (fillDiscard) {
+                dropped++;
+            } else {
+                frame->full = true;
+                fillFrame = (fillFrame + 1) % AUDIO_FEATURES_FRAME_COUNT;
+                Scheduler_Post(&processTask);
+            }
+        }
+    }
+
+    return true;
+}
+
+int32_t AudioFeatures_Start(const AudioFeatures_Config *cfg, AudioFeatures_Callback callback)
+{
+    if (i2s) {
+        return ERROR_BUSY;
+    }
+
+    if (!cfg || !callback || (cfg->framesPerVector == 0) || (cfg->bands == 0) ||
+        (cfg->bands > AUDIO_FEATURES_MAX_BANDS) || (cfg->bands > AUDIO_FEATURES_BINS)) {
+        return ERROR_AUDIO_FEATURES_CONFIG;
+    }
+
+    if (!tablesReady) {
+        AudioFeatures__InitTables();
+    }
+
+    config = *cfg;
+    vectorCallback = callback;
+
+    unsigned f;
+    for (f = 0; f < AUDIO_FEATURES_FRAME_COUNT; f++) {
+        frames[f].full = false;
+    }
+    fillFrame = 0;
+    fillCount = 0;
+    fillDiscard = false;
+    procFrame = 0;
+    dropped = 0;
+    AudioFeatures__Reset();
+
+    i2s = I2S_Open(MT3620_UNIT_I2S0, 0);
+    if (!i2s) {
+        return ERROR_UNSUPPORTED;
+    }
+
+    int32_t error = I2S_Input(i2s, I2S_FORMAT_I2S, 1, 16, config.rate, AudioFeatures__Input);
+    if (error != ERROR_NONE) {
+        AudioFeatures_Stop();
+    }
+
+    return error;
+}
+
+void AudioFeatures_Stop(void)
+{
+    if (!i2s) {
+        return;
+    }
+
+    I2S_Input(i2s, I2S_FORMAT_NONE, 0, 0, 0, NULL);
+    I2S_Close(i2s);
+    i2s = NULL;
+    vectorCallback = NULL;
+}
+
+bool AudioFeatures_Running(void)
+{
+    return (i2s != NULL);
+}
@@ -0,0 +1,73 @@
+/* Copyright (c) Codethink Ltd. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef AZURE_SPHERE_AUDIO_FEATURES_H_
+#define AZURE_SPHERE_AUDIO_FEATURES_H_
+
+#include "lib/Common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Feature extraction of mono 16 bit I2S input for vibration and audio
+// monitoring. The I2S DMA interrupt copies samples into a small ring of
+// frames, and a scheduler task reduces each frame to its RMS, peak and the
+// energy of evenly spaced FFT bands. Features of several frames are combined
+// into one vector, so only vectors and never raw samples leave the core.
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/// <summary>Samples per frame, the FFT size.</summary>
+#define AUDIO_FEATURES_FRAME_SIZE 256
+
+/// <summary>Largest number of FFT bands in a feature vector.</summary>
+#define AUDIO_FEATURES_MAX_BANDS  32
+
+/// <summary>Returned when the feature configuration is invalid.</summary>
+#define ERROR_AUDIO_FEATURES_CONFIG (ERROR_SPECIFIC - 1)
+
+/// <summary>Capture parameters, see <see cref="AudioFeatures_Start" />.</summary>
+typedef struct {
+    /// <summary>Sample rate in Hz, one the I2S block supports e.g. 16000.</summary>
+    uint32_t rate;
+    /// <summary>Number of frames combined into one feature vector.</summary>
+    uint16_t framesPerVector;
+    /// <summary>Number of FFT bands, splitting 0 Hz to rate / 2 evenly.</summary>
+    uint16_t bands;
+} AudioFeatures_Config;
+
+/// <summary>
+/// <para>Called from a scheduler task with each feature vector: the RMS and the peak
+/// magnitude of the samples as a fraction of full scale, followed by the mean power of
+/// each band relative to a full scale sine. dropped is the number of frames lost since
+/// the previous vector because processing fell behind.</para>
+/// </summary>
+/// <returns>'true' if the vector was taken, 'false' to count its frames as dropped.</returns>
+typedef bool (*AudioFeatures_Callback)(const float *features, uint32_t count, uint32_t dropped);
+
+/// <summary>
+/// <para>Opens I2S0 as a subordinate and starts capturing. Fails if a capture is
+/// already running.</para>
+/// </summary>
+/// <param name="config">The capture parameters, copied.</param>
+/// <param name="callback">Called with each feature vector.</param>
+/// <returns>ERROR_NONE on success, or an error code.</returns>
+int32_t AudioFeatures_Start(const AudioFeatures_Config *config, AudioFeatures_Callback callback);
+
+/// <summary>
+/// <para>Stops capturing and closes I2S0, frames not yet in a vector are discarded.</para>
+/// </summary>
+void AudioFeatures_Stop(void);
+
+/// <summary>
+/// <para>Returns whether a capture is running.</para>
+/// </summary>
+bool AudioFeatures_Running(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // #ifndef AZURE_SPHERE_AUDIO_FEATURES_H_
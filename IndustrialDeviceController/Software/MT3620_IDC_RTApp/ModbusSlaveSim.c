@@ -0,0 +1,206 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lib/mt3620/gpt.h"
+
+#include "Scheduler.h"
+#include "ModbusSlaveSim.h"
+#include "crc16.h"
+
+// Largest RTU frame, slave id, pdu and crc.
+#define MODBUS_SLAVE_SIM_MAX_ADU (1 + MODBUS_SIM_MAX_PDU + 2)
+
+// Character times of silence ending a frame, t3.5 rounded up.
+#define MODBUS_SLAVE_SIM_IDLE_CHARS 4
+
+static UART         *bus = NULL;
+static GPT          *delayTimer = NULL;
+static GPT          *clockTimer = NULL;
+static float         clockHz = 0;
+static modbus_sim_t  sim;
+
+// Clock counts are accumulated so register values keep changing past a wrap
+// of the 32-bit counter.
+static uint32_t lastCount = 0;
+static uint64_t elapsedCounts = 0;
+
+static uint8_t   request[MODBUS_SLAVE_SIM_MAX_ADU];
+static uintptr_t requestSize = 0;
+// Requests arriving while a response is pending are dropped, as a slave
+// busy answering wouldn't see them.
+static uint8_t   response[MODBUS_SLAVE_SIM_MAX_ADU];
+static uintptr_t responseSize = 0;
+static bool      responding = false;
+
+static uint32_t ModbusSlaveSim__NowMs(void)
+{
+    uint32_t count = GPT_GetCount(clockTimer);
+    elapsedCounts += (uint32_t)(count - lastCount);
+    lastCount = count;
+    return (uint32_t)((elapsedCounts * 1000) / (uint64_t)clockHz);
+}
+
+static void ModbusSlaveSim__Drain(void)
+{
+    uintptr_t avail = UART_ReadAvailable(bus);
+    if (avail == 0) {
+        return;
+    }
+
+    // Overlong frames are truncated, their crc then fails and they are ignored.
+    uintptr_t room = sizeof(request) - requestSize;
+    uintptr_t take = (avail < room ? avail : room);
+    if (take > 0) {
+        UART_Read(bus, request + requestSize, take);
+        requestSize += take;
+    }
+    while (avail > take) {
+        uint8_t discard[16];
+        uintptr_t n = (avail - take < sizeof(discard) ? avail - take : sizeof(discard));
+        UART_Read(bus, discard, n);
+        avail -= n;
+    }
+}
+
+static void ModbusSlaveSim__SendDeferred(void *data)
+{
+    (void)data;
+
+    if (bus && responding) {
+        UART_Write(bus, response, responseSize);
+    }
+    responding = false;
+}
+
+static void ModbusSlaveSim__Send(GPT *timer)
+{
+    (void)timer;
+
+    static Scheduler_Task task = SCHEDULER_TASK(ModbusSlaveSim__SendDeferred, SCHEDULER_PRIORITY_HIGH, 1000);
+    Scheduler_Post(&task);
+}
+
+static void ModbusSlaveSim__FrameDeferred(void *data)
+{
+    (void)data;
+
+    if (!bus) {
+        return;
+    }
+
+    ModbusSlaveSim__Drain();
+    uintptr_t size = requestSize;
+    requestSize = 0;
+
+    // Slave id, function code and crc at least.
+    if (responding || (size < 4) || !crc16_check_frame(request, size)) {
+        return;
+    }
+
+    uint32_t delayUs = 0;
+    int32_t pduLen = modbus_sim_handle(&sim, request[0], request + 1, (int32_t)(size - 3),
+                                       ModbusSlaveSim__NowMs(), response + 1, &delayUs);
+    if (pduLen <= 0) {
+        return;
+    }
+
+    response[0] = request[0];
+    uint16_t crc = crc16(response, 1 + pduLen);
+    response[1 + pduLen] = crc & 0xFF;
+    response[2 + pduLen] = crc >> 8;
+    responseSize = 3 + pduLen;
+    responding = true;
+
+    // GPT2 counts at 32kHz, so delays are kept to whole milliseconds.
+    uint32_t delayMs = (delayUs + 999) / 1000;
+    if ((delayMs == 0) ||
+        (GPT_StartTimeout(delayTimer, delayMs, GPT_UNITS_MILLISEC, ModbusSlaveSim__Send) != ERROR_NONE)) {
+        ModbusSlaveSim__SendDeferred(NULL);
+    }
+}
+
+static void ModbusSlaveSim__RxDeferred(void *data)
+{
+    (void)data;
+
+    if (bus) {
+        ModbusSlaveSim__Drain();
+    }
+}
+
+static void ModbusSlaveSim__Rx(void)
+{
+    static Scheduler_Task task = SCHEDULER_TASK(ModbusSlaveSim__RxDeferred, SCHEDULER_PRIORITY_HIGH, 1000);
+    Scheduler_Post(&task);
+}
+
+static void ModbusSlaveSim__Idle(void)
+{
+    static Scheduler_Task task = SCHEDULER_TASK(ModbusSlaveSim__FrameDeferred, SCHEDULER_PRIORITY_HIGH, 1000);
+    Scheduler_Post(&task);
+}
+
+int32_t ModbusSlaveSim_Start(const modbus_sim_config_t *config, unsigned baud, UART_Parity parity,
+                             unsigned stopBits, GPT *clock)
+{
+    if (bus) {
+        return ERROR_BUSY;
+    }
+
+    if (!config || !clock || (config->num_slaves == 0) || (config->num_registers == 0) ||
+        (GPT_GetSpeed(clock, &clockHz) != ERROR_NONE) || (clockHz <= 0)) {
+        return ERROR_PARAMETER;
+    }
+
+    modbus_sim_init(&sim, config);
+    clockTimer    = clock;
+    lastCount     = GPT_GetCount(clock);
+    elapsedCounts = 0;
+    requestSize   = 0;
+    responding    = false;
+
+    delayTimer = GPT_Open(MT3620_UNIT_GPT2, MT3620_GPT_012_HIGH_SPEED, GPT_MODE_ONE_SHOT);
+    if (!delayTimer) {
+        return ERROR_UNSUPPORTED;
+    }
+
+    bus = UART_OpenDMA(MT3620_UNIT_ISU1, baud, parity, stopBits, ModbusSlaveSim__Rx,
+                       MODBUS_SLAVE_SIM_IDLE_CHARS, ModbusSlaveSim__Idle);
+    if (!bus) {
+        GPT_Close(delayTimer);
+        delayTimer = NULL;
+        return ERROR_UNSUPPORTED;
+    }
+
+    return ERROR_NONE;
+}
+
+void ModbusSlaveSim_Stop(void)
+{
+    if (!bus) {
+        return;
+    }
+
+    GPT_Stop(delayTimer);
+    GPT_Close(delayTimer);
+    delayTimer = NULL;
+
+    UART_Close(bus);
+    bus = NULL;
+    responding = false;
+}
+
+bool ModbusSlaveSim_Running(void)
+{
+    return (bus != NULL);
+}
+
+void ModbusSlaveSim_GetStats(modbus_sim_stats_t *stats)
+{
+    if (stats) {
+        *stats = sim.stats;
+    }
+}
@@ -0,0 +1,59 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef AZURE_SPHERE_MODBUS_SLAVE_SIM_H_
+#define AZURE_SPHERE_MODBUS_SLAVE_SIM_H_
+
+#include "lib/Common.h"
+#include "lib/GPT.h"
+#include "lib/UART.h"
+
+#include "modbus_sim.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Simulated modbus RTU slaves on ISU1, for soak testing the whole RTU path of
+// the high level app, RT core master included, without real devices. ISU1
+// TX and RX are wired to ISU0 RX and TX. A request frame ends when the line
+// has been idle for four characters, and is answered after the simulated
+// response time measured by GPT2.
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/// <summary>
+/// <para>Starts answering requests on ISU1 as the configured slaves, using GPT2 to delay
+/// responses. Fails if the simulator is already running.</para>
+/// </summary>
+/// <param name="config">The slaves to simulate, copied.</param>
+/// <param name="baud">Baud rate of the bus.</param>
+/// <param name="parity">Parity of the bus.</param>
+/// <param name="stopBits">Stop bits of the bus, 1 or 2.</param>
+/// <param name="clock">Free running timer register values change with.</param>
+/// <returns>ERROR_NONE on success, or an error code.</returns>
+int32_t ModbusSlaveSim_Start(const modbus_sim_config_t *config, unsigned baud, UART_Parity parity,
+                             unsigned stopBits, GPT *clock);
+
+/// <summary>
+/// <para>Stops the simulator, releasing ISU1 and GPT2.</para>
+/// </summary>
+void ModbusSlaveSim_Stop(void);
+
+/// <summary>
+/// <para>Returns whether the simulator is running.</para>
+/// </summary>
+bool ModbusSlaveSim_Running(void);
+
+/// <summary>
+/// <para>Returns requests, responses and injected failures since the simulator was started.</para>
+/// </summary>
+/// <param name="stats">Receives the counters.</param>
+void ModbusSlaveSim_GetStats(modbus_sim_stats_t *stats);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // #ifndef AZURE_SPHERE_MODBUS_SLAVE_SIM_H_
@@ -0,0 +1,140 @@
+/* Copyright (c) Codethink Ltd. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lib/mt3620/gpt.h"
+#include "lib/NVIC.h"
+#include "lib/GPT.h"
+
+#include "PulseCounter.h"
+
+// Dual edge interrupts count both transitions, two edges make a pulse and an
+// odd edge is carried into the next window.
+typedef struct {
+    uint32_t pin;
+    uint32_t edgesSeen;
+    uint32_t carry;
+    uint32_t count;
+    uint32_t frequencyMilliHz;
+} PulseCounter_Pin;
+
+// Only written by the gate interrupt once running, read with it blocked.
+static PulseCounter_Pin pins[PULSE_COUNTER_MAX_PINS];
+static unsigned         pinCount = 0;
+
+static GPT                 *gate = NULL;
+static PulseCounter_Config  config;
+
+static void PulseCounter__Gate(GPT *timer)
+{
+    (void)timer;
+
+    unsigned i;
+    for (i = 0; i < pinCount; i++) {
+        PulseCounter_Pin *p = &pins[i];
+        uint32_t edges = GPIO_EdgeCaptureCount(p->pin);
+        uint32_t delta = (edges - p->edgesSeen) + p->carry;
+        p->edgesSeen = edges;
+        p->carry = delta & 1;
+
+        uint32_t pulses = delta / 2;
+        p->count += pulses;
+        p->frequencyMilliHz = (uint32_t)(((uint64_t)pulses * 1000000) / config.gateMs);
+    }
+}
+
+int32_t PulseCounter_Start(const PulseCounter_Config *cfg, GPT *timer)
+{
+    if (gate) {
+        return ERROR_BUSY;
+    }
+
+    if (!cfg || !timer || (cfg->pinMask == 0) || (cfg->pinMask >= (1U << GPIO_EINT_PIN_COUNT)) ||
+        (__builtin_popcount(cfg->pinMask) > PULSE_COUNTER_MAX_PINS) || (cfg->gateMs == 0) ||
+        (cfg->debounce >= GPIO_EINT_DBNC_FREQ_INVALID)) {
+        return ERROR_PULSE_COUNTER_CONFIG;
+    }
+
+    config = *cfg;
+
+    gate = GPT_Open(MT3620_UNIT_GPT1, MT3620_GPT_012_HIGH_SPEED, GPT_MODE_REPEAT);
+    if (!gate) {
+        return ERROR_UNSUPPORTED;
+    }
+
+    int32_t error = ERROR_NONE;
+    uint32_t pin;
+    pinCount = 0;
+    for (pin = 0; pin < GPIO_EINT_PIN_COUNT; pin++) {
+        if (!(config.pinMask & (1U << pin))) {
+            continue;
+        }
+
+        error = GPIO_EdgeCaptureEnable(pin, timer, config.debounce);
+        if (error != ERROR_NONE) {
+            PulseCounter_Stop();
+            return error;
+        }
+
+        PulseCounter_Pin *p = &pins[pinCount++];
+        p->pin = pin;
+        p->edgesSeen = GPIO_EdgeCaptureCount(pin);
+        p->carry = 0;
+        p->count = 0;
+        p->frequencyMilliHz = 0;
+    }
+
+    error = GPT_StartTimeout(gate, config.gateMs, GPT_UNITS_MILLISEC, PulseCounter__Gate);
+    if (error != ERROR_NONE) {
+        PulseCounter_Stop();
+    }
+
+    return error;
+}
+
+void PulseCounter_Stop(void)
+{
+    if (!gate) {
+        return;
+    }
+
+    GPT_Stop(gate);
+
+    unsigned i;
+    for (i = 0; i < pinCount; i++) {
+        GPIO_EdgeCaptureDisable(pins[i].pin);
+    }
+    pinCount = 0;
+
+    GPT_Close(gate);
+    gate = NULL;
+}
+
+bool PulseCounter_Running(void)
+{
+    return (gate != NULL);
+}
+
+uintptr_t PulseCounter_Read(PulseCounter_Reading *readings, uintptr_t max)
+{
+    if (!gate || !readings) {
+        return 0;
+    }
+
+    uintptr_t n = 0;
+    uint32_t prevBasePri = NVIC_BlockIRQs();
+    while ((n < max) && (n < pinCount)) {
+        // Include pulses of the open window so the count never lags the gate.
+        PulseCounter_Pin *p = &pins[n];
+        uint32_t delta = (GPIO_EdgeCaptureCount(p->pin) - p->edgesSeen) + p->carry;
+        readings[n].pin              = p->pin;
+        readings[n].count            = p->count + (delta / 2);
+        readings[n].frequencyMilliHz = p->frequencyMilliHz;
+        n++;
+    }
+    NVIC_RestoreIRQs(prevBasePri);
+
+    return n;
+}
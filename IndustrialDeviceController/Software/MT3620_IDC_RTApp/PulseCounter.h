@@ -0,0 +1,81 @@
+/* Copyright (c) Codethink Ltd. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef AZURE_SPHERE_PULSE_COUNTER_H_
+#define AZURE_SPHERE_PULSE_COUNTER_H_
+
+#include "lib/Common.h"
+#include "lib/GPIO.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Pulse counting on EINT capable GPIO pins, for meters with pulse outputs.
+// Every edge is counted in the EINT interrupt after the hardware debounce,
+// so no pulse is missed however busy the main loop is. A repeating gate timer
+// closes a window at a fixed interval, taking the number of pulses in it as
+// the frequency of each pin.
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/// <summary>Largest number of pins counted at once.</summary>
+#define PULSE_COUNTER_MAX_PINS     8
+
+/// <summary>Returned when the counter configuration is invalid.</summary>
+#define ERROR_PULSE_COUNTER_CONFIG (ERROR_SPECIFIC - 1)
+
+/// <summary>Counting parameters, see <see cref="PulseCounter_Start" />.</summary>
+typedef struct {
+    /// <summary>Bit mask of the EINT pins to count, at most PULSE_COUNTER_MAX_PINS bits.</summary>
+    uint32_t              pinMask;
+    /// <summary>Length in milliseconds of the window a frequency is measured over.</summary>
+    uint32_t              gateMs;
+    /// <summary>Hardware debounce sampling rate, input shorter than a few samples is ignored.</summary>
+    gpio_eint_dbnc_freq_e debounce;
+} PulseCounter_Config;
+
+/// <summary>Counter state of one pin, see <see cref="PulseCounter_Read" />.</summary>
+typedef struct {
+    /// <summary>The GPIO pin.</summary>
+    uint32_t pin;
+    /// <summary>Pulses counted since the counter was started, wrapping.</summary>
+    uint32_t count;
+    /// <summary>Pulses in the last complete gate window, in millihertz.</summary>
+    uint32_t frequencyMilliHz;
+} PulseCounter_Reading;
+
+/// <summary>
+/// <para>Starts counting on the pins of the mask, using GPT1 as the gate timer. Fails
+/// if counting is already running.</para>
+/// </summary>
+/// <param name="config">The counting parameters, copied.</param>
+/// <param name="timer">Free running timer to timestamp edges with, see
+/// <see cref="GPIO_EdgeCaptureEnable" />.</param>
+/// <returns>ERROR_NONE on success, or an error code.</returns>
+int32_t PulseCounter_Start(const PulseCounter_Config *config, GPT *timer);
+
+/// <summary>
+/// <para>Stops counting, releasing the pins and the gate timer.</para>
+/// </summary>
+void PulseCounter_Stop(void);
+
+/// <summary>
+/// <para>Returns whether counting is running.</para>
+/// </summary>
+bool PulseCounter_Running(void);
+
+/// <summary>
+/// <para>Reads the counter of each counted pin, lowest pin first.</para>
+/// </summary>
+/// <param name="readings">Array to fill.</param>
+/// <param name="max">Length of readings.</param>
+/// <returns>Number of readings filled, 0 if counting isn't running.</returns>
+uintptr_t PulseCounter_Read(PulseCounter_Reading *readings, uintptr_t max);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // #ifndef AZURE_SPHERE_PULSE_COUNTER_H_
@@ -63,6 +63,66 @@ int32_t Socket_Read(
     void         *data,
     uint32_t     *size);
 
+/// A message payload held in place in a shared ring buffer. The payload is
+/// data[0] followed by data[1], which is non-empty only when the payload
+/// wraps around the end of the buffer.
+typedef struct {
+    uint8_t  *data[2];
+    uint32_t  size[2];
+} Socket_Segments;
+
+/// Reserves space for a message of up to size bytes in the outbound ring buffer,
+/// so it can be built in place rather than copied in by Socket_Write. Nothing is
+/// visible to the HLApp, and Socket_Write fails with ERROR_BUSY, until
+/// Socket_Commit is called.
+int32_t Socket_Reserve(
+    Socket          *socket,
+    uint32_t         size,
+    Socket_Segments *segments);
+/// Sends the first size bytes of the reserved space, which may be fewer than
+/// were reserved. A size of zero abandons the reservation.
+int32_t Socket_Commit(
+    Socket             *socket,
+    const Component_Id *recipient,
+    uint32_t            size);
+
+/// Returns the next inbound message in place, without copying it out of the
+/// ring buffer. The segments stay valid, and Socket_Read fails with ERROR_BUSY,
+/// until Socket_Consume is called.
+int32_t Socket_Peek(
+    Socket          *socket,
+    Component_Id    *sender,
+    Socket_Segments *segments);
+/// Releases the message returned by Socket_Peek back to the HLApp.
+int32_t Socket_Consume(Socket *socket);
+
+/// Priorities of the outbound channels multiplexed over the shared ring buffer.
+/// Queued messages are written to the ring strictly by priority, so a message on
+/// the control channel never waits behind queued bulk data.
+typedef enum {
+    SOCKET_PRIORITY_CONTROL = 0,
+    SOCKET_PRIORITY_BULK    = 1,
+    SOCKET_PRIORITY_COUNT
+} Socket_Priority;
+
+/// Queues a message on the channel of the given priority and writes as many
+/// queued messages to the ring buffer as fit. Only fails if the channel's queue
+/// is full. Socket_Write bypasses the queues.
+int32_t Socket_Send(
+    Socket             *socket,
+    const Component_Id *recipient,
+    Socket_Priority     priority,
+    const void         *data,
+    uint32_t            size);
+/// Writes queued messages to the ring buffer until one doesn't fit. Call it from
+/// the callback set by Socket_SetTxCallback, deferred like rx_cb.
+int32_t Socket_Flush(Socket *socket);
+/// Returns the number of bytes, messages plus queue overhead, queued on a channel.
+uint32_t Socket_Queued(Socket *socket, Socket_Priority priority);
+/// Sets a callback invoked, in interrupt context, when the HLApp has read from
+/// the ring buffer so queued messages may now fit.
+void Socket_SetTxCallback(Socket *socket, void (*tx_cb)(Socket*));
+
 #ifdef __cplusplus
 }
 #endif
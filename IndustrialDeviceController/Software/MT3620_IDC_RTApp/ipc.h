@@ -22,11 +22,69 @@ typedef enum err_code {
 } err_code;
 
 typedef enum ipc_command_type_t {
+    // open modbus UART, request data is 4 bytes baud rate, 1 byte parity and
+    // 1 byte stop bits, optionally followed by 4 bytes max latency in us and
+    // 2 bytes max size of the messages UART bytes received outside
+    // IPC_MODBUS_TRANSACT are coalesced into, latency 0 sends them at once
     IPC_OPEN_UART,
     IPC_CLOSE_UART,
-    IPC_WRITE_UART
+    IPC_WRITE_UART,
+    // one whole modbus rtu exchange, request data is 4 bytes response timeout
+    // in ms followed by slave id and pdu, CRC is appended by RT core. Only
+    // responded when exchange is done, with ipc_transact_response_message_t
+    IPC_MODBUS_TRANSACT,
+    // envelope of several commands in one mailbox message, request data is
+    // the complete request messages back to back, and they are answered with
+    // one ipc_batch_response_message_t. Execution stop at first failed
+    // IPC_MODBUS_TRANSACT, commands after it are not answered
+    IPC_BATCH,
+    // read events recorded by the RT core trace probes since the previous
+    // IPC_TRACE_DUMP, answered with one ipc_trace_response_message_t. Send
+    // again while the response is full to get the rest
+    IPC_TRACE_DUMP,
+    // start streaming the ADC, request data is 4 bytes scan frequency in Hz
+    // followed by 2 bytes each of channel mask, number of scans averaged per
+    // sample, reference voltage in mV and samples per block. Answered with
+    // ipc_response_message_t, then blocks arrive unsolicited as IPC_ADC_BLOCK
+    IPC_ADC_START,
+    // stop streaming the ADC, answered with ipc_response_message_t
+    IPC_ADC_STOP,
+    // never sent by A7, seq_num counts blocks since IPC_ADC_START
+    IPC_ADC_BLOCK,
+    // start extracting features of I2S0 input, request data is 4 bytes sample
+    // rate in Hz followed by 2 bytes each of frames per vector and number of
+    // FFT bands. Answered with ipc_response_message_t, then vectors arrive
+    // unsolicited as IPC_AUDIO_FEATURES
+    IPC_AUDIO_START,
+    // stop extracting features, answered with ipc_response_message_t
+    IPC_AUDIO_STOP,
+    // never sent by A7, seq_num counts vectors since IPC_AUDIO_START
+    IPC_AUDIO_FEATURES,
+    // start counting pulses on GPIO pins, data is 4 bytes pin mask, 2 bytes
+    // gate window in ms, 1 byte debounce rate and 1 byte reserved. Answered
+    // with ipc_response_message_t
+    IPC_PULSE_START,
+    // stop counting pulses, answered with ipc_response_message_t
+    IPC_PULSE_STOP,
+    // read pulse counters, answered with one ipc_pulse_response_message_t
+    IPC_PULSE_READ,
+    // start simulated modbus slaves on ISU1, wired to ISU0, data is 1 byte
+    // first slave id, 1 byte number of slaves, 2 bytes registers per table,
+    // 4 bytes each of min and max latency in us, slow ppm, slow us, exception
+    // ppm, timeout ppm, change ms, change ppm and seed as of
+    // modbus_sim_config_t, then 4 bytes baud rate, 1 byte parity, 1 byte stop
+    // bits and 2 bytes reserved. Answered with ipc_response_message_t
+    IPC_MODBUS_SIM_START,
+    // stop simulated slaves, answered with ipc_response_message_t
+    IPC_MODBUS_SIM_STOP
 } ipc_command_type_t;
 
+// max payload of one mailbox message, bounded by intercore ring buffer
+#define IPC_MAX_MESSAGE_SIZE 1040
+
+#define IPC_OPEN_UART_SIZE 6
+#define IPC_OPEN_UART_COALESCE_SIZE 12
+
 typedef struct ipc_request_message_t {
     ipc_command_type_t command;
     uint32_t seq_num;
@@ -40,4 +98,85 @@ typedef struct ipc_response_message_t {
     err_code code;
 } ipc_response_message_t;
 
+// response of IPC_MODBUS_TRANSACT, data is the response pdu with slave id and
+// CRC stripped, valid only if code is DEVICE_OK
+typedef struct ipc_transact_response_message_t {
+    ipc_command_type_t command;
+    uint32_t seq_num;
+    err_code code;
+    uint32_t length;
+    uint8_t data[0];
+} ipc_transact_response_message_t;
+
+// response of IPC_BATCH, data is the responses of commands in the batch back
+// to back, in request order
+typedef struct ipc_batch_response_message_t {
+    ipc_command_type_t command;
+    uint32_t seq_num;
+    err_code code;
+    uint32_t length;
+    uint8_t data[0];
+} ipc_batch_response_message_t;
+
+// response of IPC_TRACE_DUMP, data is length bytes of 8 byte events oldest
+// first: 4 bytes GPT4 count, 2 bytes sequence number, 1 byte probe id with
+// bit 7 set on exit and 1 byte probe argument. tick_hz is the GPT4 rate, lost
+// the number of events overwritten before they were read
+typedef struct ipc_trace_response_message_t {
+    ipc_command_type_t command;
+    uint32_t seq_num;
+    err_code code;
+    uint32_t tick_hz;
+    uint32_t lost;
+    uint32_t length;
+    uint8_t data[0];
+} ipc_trace_response_message_t;
+
+#define IPC_TRACE_EVENT_SIZE 8
+
+// block of IPC_ADC_BLOCK, data is length bytes of 2 byte samples oldest first,
+// channel in the top 4 bits and averaged 12 bit value below. dropped is the
+// number of samples lost since the previous block
+typedef struct ipc_adc_block_message_t {
+    ipc_command_type_t command;
+    uint32_t seq_num;
+    err_code code;
+    uint32_t dropped;
+    uint32_t length;
+    uint8_t data[0];
+} ipc_adc_block_message_t;
+
+#define IPC_ADC_START_SIZE 12
+
+// vector of IPC_AUDIO_FEATURES, data is length bytes of 4 byte IEEE floats:
+// RMS and peak as fraction of full scale, then power of each FFT band
+// relative to a full scale sine. dropped is the number of 256 sample frames
+// lost since the previous vector
+typedef struct ipc_audio_features_message_t {
+    ipc_command_type_t command;
+    uint32_t seq_num;
+    err_code code;
+    uint32_t dropped;
+    uint32_t length;
+    uint8_t data[0];
+} ipc_audio_features_message_t;
+
+#define IPC_AUDIO_START_SIZE 8
+
+// response of IPC_PULSE_READ, data is length bytes of 12 byte readings lowest
+// pin first: 4 bytes pin, 4 bytes pulses counted since IPC_PULSE_START and 4
+// bytes frequency over the last gate window in millihertz
+typedef struct ipc_pulse_response_message_t {
+    ipc_command_type_t command;
+    uint32_t seq_num;
+    err_code code;
+    uint32_t length;
+    uint8_t data[0];
+} ipc_pulse_response_message_t;
+
+#define IPC_PULSE_START_SIZE 8
+#define IPC_PULSE_READING_SIZE 12
+
+#define IPC_MODBUS_SIM_START_SIZE 48
+
 #endif // #ifndef AZURE_SPHERE_IPC_H_
\ No newline at end of file
@@ -3,8 +3,10 @@
 
 #include "ADC.h"
 #include "Common.h"
+#include "CPUFreq.h"
 #include "GPT.h"
 #include "NVIC.h"
+#include "Trace.h"
 #include "mt3620/adc.h"
 #include "mt3620/gpt.h"
 #include "mt3620/dma.h"
@@ -28,6 +30,7 @@ struct AdcContext {
     uint16_t fifoSize;
     uint8_t channelsCount;
     void (*callback)(int32_t);
+    void (*rawCallback)(const uint32_t *, uint32_t);
 };
 
 static AdcContext context[MT3620_ADC_COUNT] = {0};
@@ -41,8 +44,8 @@ static inline uint32_t ADC_UnitToID(Platform_Unit unit) {
 }
 
 static inline void ADC_DMADisable(){
-    mt3620_dma_global->ch_en_set = (0 << MT3620_ADC_DMA_CHANNEL);
     MT3620_DMA_FIELD_WRITE(MT3620_ADC_DMA_CHANNEL, start, str, 0);
+    mt3620_dma_global->ch_en_clr = (1U << MT3620_ADC_DMA_CHANNEL);
 }
 
 static uint8_t ADC_CountChannels(uint16_t channelMask)
@@ -72,6 +75,7 @@ AdcContext *ADC_Open(Platform_Unit unit)
 
     context[id].init = true;
     context[id].callback = NULL;
+    context[id].rawCallback = NULL;
     context[id].rawData = NULL;
     context[id].data = NULL;
     context[id].fifoSize = 0;
@@ -113,16 +117,35 @@ void ADC_Close(AdcContext *handle)
     handle->fifoSize = 0;
     handle->channelsCount = 0;
     handle->callback = NULL;
+    handle->rawCallback = NULL;
+}
+
+void ADC_Stop(AdcContext *handle)
+{
+    if (!handle->init) {
+        return;
+    }
+
+    /* Stop conversions before the DMA, so the FIFO is left empty */
+    mt3620_adc_ctl0_t ctl0 = { .mask = mt3620_adc->adc_ctl0 };
+    ctl0.adc_fsm_en = 0;
+    ctl0.pmode_en = 0;
+    mt3620_adc->adc_ctl0 = ctl0.mask;
+
+    MT3620_ADC_FIELD_WRITE(adc_fifo_dma_en, rx_dma_en, 0);
+    ADC_DMADisable();
 }
 
 static int32_t ADC_Read(
     AdcContext *handle, void (*callback)(int32_t status),
+    void (*rawCallback)(const uint32_t *raw, uint32_t count),
     uint32_t dmaFifoSize, ADC_Data *data,
     uint32_t *rawData, uint16_t channel,
     bool periodic, uint32_t frequency,
     uint16_t referenceVoltage)
 {
     handle->callback = callback;
+    handle->rawCallback = rawCallback;
     handle->fifoSize = dmaFifoSize;
     handle->rawData = rawData;
     handle->data = data;
@@ -170,10 +193,14 @@ static int32_t ADC_Read(
     }
 #endif
 
-    /* Wait for time specified in datasheet */
+    /* Wait for time specified in datasheet, spinning if the application owns GPT3 */
     GPT *timer = GPT_Open(MT3620_UNIT_GPT3, MT3620_GPT_3_LOW_SPEED, GPT_MODE_NONE);
-    GPT_WaitTimer_Blocking(timer, 50, GPT_UNITS_MICROSEC);
-    GPT_Close(timer);
+    if (timer) {
+        GPT_WaitTimer_Blocking(timer, 50, GPT_UNITS_MICROSEC);
+        GPT_Close(timer);
+    } else {
+        for (uint32_t i = (CPUFreq_Get() / 1000000) * 50; i > 0; i--) __asm__("nop");
+    }
 
     /* Set trigger level based on number of channels selected */
     uint8_t numChannels = ADC_CountChannels(channel);
@@ -193,6 +220,9 @@ static int32_t ADC_Read(
     mt3620_dma[MT3620_ADC_DMA_CHANNEL].ffsize  = handle->fifoSize;
     if (handle->fifoSize == 1) {
         mt3620_dma[MT3620_ADC_DMA_CHANNEL].count = 1;
+    } else if (handle->rawCallback) {
+        // Continuous mode runs as a circular buffer, interrupting once it's half full.
+        mt3620_dma[MT3620_ADC_DMA_CHANNEL].count = handle->fifoSize / 2;
     } else {
         mt3620_dma[MT3620_ADC_DMA_CHANNEL].count   = ((3 * mt3620_dma[MT3620_ADC_DMA_CHANNEL].ffsize) / 4);
     }
@@ -234,7 +264,7 @@ int32_t ADC_ReadAsync(
     uint32_t dmaFifoSize, uint32_t *rawData,
     ADC_Data *data, uint16_t channel, uint16_t referenceVoltage)
 {
-    return ADC_Read(handle, callback, dmaFifoSize, data, rawData, channel,
+    return ADC_Read(handle, callback, NULL, dmaFifoSize, data, rawData, channel,
             false, 0, referenceVoltage);
 }
 
@@ -243,7 +273,22 @@ int32_t ADC_ReadPeriodicAsync(
     uint32_t dmaFifoSize, ADC_Data *data, uint32_t *rawData,
     uint16_t channel, uint32_t frequency, uint16_t referenceVoltage)
 {
-    return ADC_Read(handle, callback, dmaFifoSize, data, rawData, channel,
+    return ADC_Read(handle, callback, NULL, dmaFifoSize, data, rawData, channel,
+            true, frequency, referenceVoltage);
+}
+
+int32_t ADC_ReadContinuousAsync(
+    AdcContext *handle, void (*callback)(const uint32_t *raw, uint32_t count),
+    uint32_t ringSize, uint32_t *rawData,
+    uint16_t channel, uint32_t frequency, uint16_t referenceVoltage)
+{
+    // The ring is indexed with a mask and handed out in halves.
+    if (!callback || (ringSize < 2) || ((ringSize & (ringSize - 1)) != 0) ||
+        (ringSize / 2 < ADC_CountChannels(channel))) {
+        return ERROR_ADC_FIFO_INVALID;
+    }
+
+    return ADC_Read(handle, NULL, callback, ringSize, NULL, rawData, channel,
             true, frequency, referenceVoltage);
 }
 
@@ -266,7 +311,7 @@ int32_t ADC_ReadSync(
     }
 
     ADC_ReadSync_Ready = false;
-    int32_t status = ADC_Read(handle, &ADC_ReadSync_Callback, dmaFifoSize, data, rawData,
+    int32_t status = ADC_Read(handle, &ADC_ReadSync_Callback, NULL, dmaFifoSize, data, rawData,
             channel, false, 0, referenceVoltage);
 
     if (status != ERROR_NONE) {
@@ -285,6 +330,8 @@ int32_t ADC_ReadSync(
 
 void m4dma_irq_b_adc(void)
 {
+    TRACE_ENTER(TRACE_PROBE_ADC_DMA_IRQ, 0);
+
     AdcContext *handle = &context[0];
 
     volatile mt3620_dma_t * const dma = &mt3620_dma[MT3620_ADC_DMA_CHANNEL];
@@ -292,11 +339,23 @@ void m4dma_irq_b_adc(void)
     unsigned count = dma->ffcnt;
     unsigned swptr = MT3620_DMA_FIELD_READ(MT3620_ADC_DMA_CHANNEL, swptr, swptr) >> 2;
 
-    unsigned i;
-    for (i = 0; i < count; i++) {
-        unsigned j = (swptr + i) & (handle->fifoSize - 1);
-        handle->data[i].value   = (handle->rawData[j] >> 4) & 0xFFF;
-        handle->data[i].channel = handle->rawData[j] & 0xF;
+    if (handle->rawCallback) {
+        // Hand out the samples in place, as up to two segments when they wrap.
+        unsigned first = handle->fifoSize - swptr;
+        if (first > count) {
+            first = count;
+        }
+        handle->rawCallback(&handle->rawData[swptr], first);
+        if (count > first) {
+            handle->rawCallback(handle->rawData, count - first);
+        }
+    } else {
+        unsigned i;
+        for (i = 0; i < count; i++) {
+            unsigned j = (swptr + i) & (handle->fifoSize - 1);
+            handle->data[i].value   = (handle->rawData[j] >> 4) & 0xFFF;
+            handle->data[i].channel = handle->rawData[j] & 0xF;
+        }
     }
 
     // Increment swptr by count and toggle wrap bit if we wrapped
@@ -308,5 +367,9 @@ void m4dma_irq_b_adc(void)
     MT3620_DMA_FIELD_WRITE(MT3620_ADC_DMA_CHANNEL, ackint, ack, 1);
 
     //Pass the number of data copied back to the function caller
-    handle->callback(count);
+    if (handle->callback) {
+        handle->callback(count);
+    }
+
+    TRACE_EXIT(TRACE_PROBE_ADC_DMA_IRQ, 0);
 }
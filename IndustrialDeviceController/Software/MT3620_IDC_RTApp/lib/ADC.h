@@ -100,6 +100,39 @@ int32_t ADC_ReadPeriodicAsync(
     uint16_t channel, uint32_t frequency,
     uint16_t referenceVoltage);
 
+/// <summary>
+/// <para>Configures the appropriate ADC block to sample continuously into a circular DMA
+/// buffer. The callback is called in the interrupt each time half of the buffer has been
+/// filled, with the unformatted samples in place in the buffer, so it must consume them
+/// before the DMA comes round again. Samples are split in two calls when they wrap around
+/// the end of the buffer.</para>
+/// <para>Each raw sample holds the value in bits 4 to 15 and the channel in bits 0 to 3.</para>
+/// </summary>
+/// <param name="handle">The ADC block to enable.</param>
+/// <param name="callback">A pointer to a function that will be called during an interrupt
+/// with a pointer to the next raw samples and how many there are.</param>
+/// <param name="ringSize">How many entries the DMA buffer can hold, a power of two and at least
+/// twice the number of channels.</param>
+/// <param name="rawData">The DMA buffer, must be in memory the DMA can reach e.g. SYSRAM.</param>
+/// <param name="channel"> Which ADC channels to use, this is a bit mask, so 0111 would
+/// enable ADC channels 0, 1 and 2.</param>
+/// <param name="frequency">Sets the the frequency at which the ADC block is run.</param>
+/// <param name="referenceVoltage">The reference voltage being used, either between 1.62V and 1.92V
+/// or between 2.25V and 2.75V. Defaults to setting for 1.8V between 1.92V and 2.25V. This parameter
+/// is scaled in millivolts, so for 1.8V pass 1800 and for 2.5V pass 2500.</param>
+int32_t ADC_ReadContinuousAsync(
+    AdcContext *handle, void (*callback)(const uint32_t *raw, uint32_t count),
+    uint32_t ringSize, uint32_t *rawData,
+    uint16_t channel, uint32_t frequency,
+    uint16_t referenceVoltage);
+
+/// <summary>
+/// <para>Stops periodic or continuous sampling started on the ADC block, the handle
+/// stays open.</para>
+/// </summary>
+/// <param name="handle">The ADC block to stop.</param>
+void ADC_Stop(AdcContext *handle);
+
 /// <summary>
 /// <para>Configures the appropriate ADC block and returns the requested ADC data synchronously.
 /// </para>
@@ -13,7 +13,7 @@
 
 static mt3620_gpio_block pinToBlock(uint32_t pin)
 {
-    if (pin > MT3620_GPIO_COUNT) {
+    if (pin >= MT3620_GPIO_COUNT) {
         return MT3620_GPIO_BLOCK_NOT_MAPPED;
     }
     return mt3620_gpioPinMap[pin];
@@ -102,6 +102,127 @@ int32_t GPIO_Read(uint32_t pin, bool *state)
     return ERROR_NONE;
 }
 
+// Reads the input register of a block, which sits at a different offset for ISU and
+// I2S blocks, see GPIO_Read.
+static uint32_t readBlockInput(mt3620_gpio_block block)
+{
+    if (block < MT3620_GPIO_BLOCK_ISU_0) {
+        return mt3620_gpio[block]->gpio_pwm_grp_din;
+    } else if (block < MT3620_GPIO_BLOCK_I2S_0) {
+        return mt3620_gpio[block]->gpio_pwm_grp_din_isu;
+    }
+    return mt3620_gpio[block]->gpio_pwm_grp_global_ctrl__din_i2s;
+}
+
+// Sorts pins into a mask per block, bit i of select picks pins[i] for
+// selMask, the rest go to the other mask.
+static int32_t pinsToBlockMasks(
+    const uint32_t *pins, uintptr_t count, uint32_t select,
+    uint32_t selMask[MT3620_GPIO_BLOCK_COUNT], uint32_t otherMask[MT3620_GPIO_BLOCK_COUNT])
+{
+    if (count > GPIO_MAX_PINS) {
+        return ERROR_GPIO_TOO_MANY_PINS;
+    }
+
+    unsigned b;
+    for (b = 0; b < MT3620_GPIO_BLOCK_COUNT; b++) {
+        selMask[b]   = 0;
+        otherMask[b] = 0;
+    }
+
+    uintptr_t i;
+    for (i = 0; i < count; i++) {
+        mt3620_gpio_block block = pinToBlock(pins[i]);
+        if (block >= MT3620_GPIO_BLOCK_NOT_MAPPED) {
+            return ERROR_GPIO_NOT_A_PIN;
+        }
+
+        if (select & (1U << i)) {
+            selMask[block] |= getPinMask(pins[i], block);
+        } else {
+            otherMask[block] |= getPinMask(pins[i], block);
+        }
+    }
+
+    return ERROR_NONE;
+}
+
+int32_t GPIO_ReadPins(const uint32_t *pins, uintptr_t count, uint32_t *states)
+{
+    uint32_t used[MT3620_GPIO_BLOCK_COUNT];
+    uint32_t din[MT3620_GPIO_BLOCK_COUNT];
+    int32_t error = pinsToBlockMasks(pins, count, 0, din, used);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+
+    unsigned b;
+    for (b = 0; b < MT3620_GPIO_BLOCK_COUNT; b++) {
+        din[b] = (used[b] ? readBlockInput(b) : 0);
+    }
+
+    uint32_t result = 0;
+    uintptr_t i;
+    for (i = 0; i < count; i++) {
+        mt3620_gpio_block block = pinToBlock(pins[i]);
+        if (din[block] & getPinMask(pins[i], block)) {
+            result |= (1U << i);
+        }
+    }
+
+    *states = result;
+    return ERROR_NONE;
+}
+
+int32_t GPIO_WritePins(const uint32_t *pins, uintptr_t count, uint32_t states)
+{
+    uint32_t set[MT3620_GPIO_BLOCK_COUNT];
+    uint32_t reset[MT3620_GPIO_BLOCK_COUNT];
+    int32_t error = pinsToBlockMasks(pins, count, states, set, reset);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+
+    unsigned b;
+    for (b = 0; b < MT3620_GPIO_BLOCK_COUNT; b++) {
+        if (set[b]) {
+            mt3620_gpio[b]->gpio_pwm_grp_dout_set = set[b];
+        }
+        if (reset[b]) {
+            mt3620_gpio[b]->gpio_pwm_grp_dout_reset = reset[b];
+        }
+    }
+
+    return ERROR_NONE;
+}
+
+int32_t GPIO_TogglePins(const uint32_t *pins, uintptr_t count)
+{
+    uint32_t toggle[MT3620_GPIO_BLOCK_COUNT];
+    uint32_t unused[MT3620_GPIO_BLOCK_COUNT];
+    int32_t error = pinsToBlockMasks(pins, count, 0xFFFFFFFF, toggle, unused);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+
+    unsigned b;
+    for (b = 0; b < MT3620_GPIO_BLOCK_COUNT; b++) {
+        if (!toggle[b]) {
+            continue;
+        }
+
+        uint32_t dout = mt3620_gpio[b]->gpio_pwm_grp_dout;
+        if (toggle[b] & ~dout) {
+            mt3620_gpio[b]->gpio_pwm_grp_dout_set = toggle[b] & ~dout;
+        }
+        if (toggle[b] & dout) {
+            mt3620_gpio[b]->gpio_pwm_grp_dout_reset = toggle[b] & dout;
+        }
+    }
+
+    return ERROR_NONE;
+}
+
 #define PWM_MAX_DUTY_CYCLE 65535
 #define PWM_CLOCK_SEL_DEADZONE 5
 
@@ -258,6 +379,120 @@ int32_t EINT_DeConfigurePin(uint32_t pin)
 }
 
 
+// Edges are only written by the EINT handlers, which share a priority so
+// never preempt each other, and only read from the main loop.
+static GPT               *edgeTimer = NULL;
+static uint32_t           edgeEnabled = 0;
+static volatile uint32_t  edgeCount[GPIO_EINT_PIN_COUNT] = { 0 };
+static GPIO_Edge          edgeRing[GPIO_EDGE_CAPTURE_RING_SIZE];
+static volatile uint32_t  edgeHead = 0;
+static volatile uint32_t  edgeTail = 0;
+static volatile uint32_t  edgeLost = 0;
+
+int32_t GPIO_EdgeCaptureEnable(uint32_t pin, GPT *timer, gpio_eint_dbnc_freq_e freq)
+{
+    if (pin >= GPIO_EINT_PIN_COUNT) {
+        return ERROR_EINT_NOT_A_PIN;
+    }
+    if (!timer) {
+        return ERROR_PARAMETER;
+    }
+
+    int32_t error = GPIO_ConfigurePinForInput(pin);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+
+    edgeTimer = timer;
+    edgeCount[pin] = 0;
+    edgeEnabled |= (1U << pin);
+
+    gpio_eint_attr_t attr = {
+        .positive = true,
+        .dualEdge = true,
+        .freq     = freq
+    };
+    error = EINT_ConfigurePin(pin, &attr);
+    if (error != ERROR_NONE) {
+        edgeEnabled &= ~(1U << pin);
+    }
+    return error;
+}
+
+int32_t GPIO_EdgeCaptureDisable(uint32_t pin)
+{
+    if (pin >= GPIO_EINT_PIN_COUNT) {
+        return ERROR_EINT_NOT_A_PIN;
+    }
+
+    edgeEnabled &= ~(1U << pin);
+    return EINT_DeConfigurePin(pin);
+}
+
+uint32_t GPIO_EdgeCaptureCount(uint32_t pin)
+{
+    if (pin >= GPIO_EINT_PIN_COUNT) {
+        return 0;
+    }
+    return edgeCount[pin];
+}
+
+uintptr_t GPIO_EdgeCaptureRead(GPIO_Edge *edges, uintptr_t max, uint32_t *lost)
+{
+    uintptr_t n = 0;
+    uint32_t tail = edgeTail;
+    while ((n < max) && (tail != edgeHead)) {
+        edges[n++] = edgeRing[tail % GPIO_EDGE_CAPTURE_RING_SIZE];
+        tail++;
+    }
+    edgeTail = tail;
+
+    if (lost) {
+        uint32_t prevBasePri = NVIC_BlockIRQs();
+        *lost = edgeLost;
+        edgeLost = 0;
+        NVIC_RestoreIRQs(prevBasePri);
+    }
+
+    return n;
+}
+
+static void GPIO_EdgeCaptureIRQ(uint32_t pin)
+{
+    if (!(edgeEnabled & (1U << pin))) {
+        return;
+    }
+
+    uint32_t time = GPT_GetCount(edgeTimer);
+    bool level = false;
+    GPIO_Read(pin, &level);
+
+    edgeCount[pin]++;
+
+    uint32_t head = edgeHead;
+    if ((head - edgeTail) >= GPIO_EDGE_CAPTURE_RING_SIZE) {
+        edgeLost++;
+        return;
+    }
+
+    GPIO_Edge *edge = &edgeRing[head % GPIO_EDGE_CAPTURE_RING_SIZE];
+    edge->time  = time;
+    edge->pin   = pin;
+    edge->level = level;
+    edgeHead = head + 1;
+}
+
+#define GPIO_EINT_HANDLER(group, irq) \
+    void gpio_g##group##_irq##irq(void) { GPIO_EdgeCaptureIRQ(((group) * 4) + (irq)); }
+
+GPIO_EINT_HANDLER(0, 0) GPIO_EINT_HANDLER(0, 1) GPIO_EINT_HANDLER(0, 2) GPIO_EINT_HANDLER(0, 3)
+GPIO_EINT_HANDLER(1, 0) GPIO_EINT_HANDLER(1, 1) GPIO_EINT_HANDLER(1, 2) GPIO_EINT_HANDLER(1, 3)
+GPIO_EINT_HANDLER(2, 0) GPIO_EINT_HANDLER(2, 1) GPIO_EINT_HANDLER(2, 2) GPIO_EINT_HANDLER(2, 3)
+GPIO_EINT_HANDLER(3, 0) GPIO_EINT_HANDLER(3, 1) GPIO_EINT_HANDLER(3, 2) GPIO_EINT_HANDLER(3, 3)
+GPIO_EINT_HANDLER(4, 0) GPIO_EINT_HANDLER(4, 1) GPIO_EINT_HANDLER(4, 2) GPIO_EINT_HANDLER(4, 3)
+GPIO_EINT_HANDLER(5, 0) GPIO_EINT_HANDLER(5, 1) GPIO_EINT_HANDLER(5, 2) GPIO_EINT_HANDLER(5, 3)
+
+
 uint8_t EINT_GetDebounceCounter(uint32_t pin)
 {
     if (pin >= GPIO_EINT_PIN_COUNT) {
@@ -8,6 +8,7 @@
 #include <stdint.h>
 
 #include "Common.h"
+#include "GPT.h"
 
 #ifdef __cplusplus
  extern "C" {
@@ -19,6 +20,7 @@
 #define ERROR_PWM_NOT_A_PIN              (ERROR_SPECIFIC - 4)
 #define ERROR_EINT_NOT_A_PIN             (ERROR_SPECIFIC - 5)
 #define ERROR_EINT_ATTRIBUTE             (ERROR_SPECIFIC - 6)
+#define ERROR_GPIO_TOO_MANY_PINS         (ERROR_SPECIFIC - 7)
 
 /// <summary>
 /// <para>Configure a pin for output. Call <see cref="GPIO_Write" /> to set the
@@ -60,6 +62,39 @@ int32_t GPIO_Write(uint32_t pin, bool state);
 /// <returns>Zero on success or an error value as defined in this file or Common.h.</returns>
 int32_t GPIO_Read(uint32_t pin, bool *state);
 
+/// <summary>Largest number of pins passed to the GPIO_*Pins functions.</summary>
+#define GPIO_MAX_PINS 32
+
+/// <summary>
+/// <para>Read the state of several input pins at once. Pins are grouped by GPIO block
+/// and each block's input register is read once, so pins in the same block are sampled
+/// at the same instant.</para>
+/// </summary>
+/// <param name="pins">The pins to read, at most GPIO_MAX_PINS.</param>
+/// <param name="count">The number of pins.</param>
+/// <param name="states">On return, bit i is set if pins[i] is high.</param>
+/// <returns>Zero on success or an error value as defined in this file or Common.h.</returns>
+int32_t GPIO_ReadPins(const uint32_t *pins, uintptr_t count, uint32_t *states);
+
+/// <summary>
+/// <para>Set the state of several output pins at once, with one write to the set and
+/// reset registers of each GPIO block involved.</para>
+/// </summary>
+/// <param name="pins">The pins to write, at most GPIO_MAX_PINS.</param>
+/// <param name="count">The number of pins.</param>
+/// <param name="states">Bit i set drives pins[i] high, clear drives it low.</param>
+/// <returns>Zero on success or an error value as defined in this file or Common.h.</returns>
+int32_t GPIO_WritePins(const uint32_t *pins, uintptr_t count, uint32_t states);
+
+/// <summary>
+/// <para>Invert the state of several output pins at once, reading the output register
+/// of each GPIO block involved once.</para>
+/// </summary>
+/// <param name="pins">The pins to toggle, at most GPIO_MAX_PINS.</param>
+/// <param name="count">The number of pins.</param>
+/// <returns>Zero on success or an error value as defined in this file or Common.h.</returns>
+int32_t GPIO_TogglePins(const uint32_t *pins, uintptr_t count);
+
 /// <summary>
 /// <para>Setup a GPIO pin for PWM output.</para>
 /// </summary>
@@ -122,6 +157,58 @@ int32_t EINT_ConfigurePin(
 /// <returns>Zero on success or an error value as defined in this file or Common.h.</returns>
 int32_t EINT_DeConfigurePin(uint32_t pin);
 
+/* Edge capture */
+
+/// <summary>Number of edges buffered between calls to <see cref="GPIO_EdgeCaptureRead" />.</summary>
+#define GPIO_EDGE_CAPTURE_RING_SIZE 64
+
+/// <summary>A transition captured on a pin.</summary>
+typedef struct {
+    /// <summary>Count of the capture timer when the interrupt ran.</summary>
+    uint32_t time;
+    /// <summary>The pin, below GPIO_EINT_PIN_COUNT.</summary>
+    uint8_t  pin;
+    /// <summary>Level of the pin after the transition.</summary>
+    bool     level;
+} GPIO_Edge;
+
+/// <summary>
+/// <para>Configures an input pin as EINT source on both edges, counting transitions
+/// and recording each with a timestamp. The EINT interrupt handlers are implemented
+/// by this driver.</para>
+/// </summary>
+/// <param name="pin">A specific pin, only pins < GPIO_EINT_PIN_COUNT are supported.</param>
+/// <param name="timer">A free running timer used for timestamps, shared by all pins.</param>
+/// <param name="freq">Frequency of debounce counter.</param>
+/// <returns>Zero on success or an error value as defined in this file or Common.h.</returns>
+int32_t GPIO_EdgeCaptureEnable(uint32_t pin, GPT *timer, gpio_eint_dbnc_freq_e freq);
+
+/// <summary>
+/// <para>Stops capturing edges on a pin.</para>
+/// </summary>
+/// <param name="pin">A specific pin, only pins < GPIO_EINT_PIN_COUNT are supported.</param>
+/// <returns>Zero on success or an error value as defined in this file or Common.h.</returns>
+int32_t GPIO_EdgeCaptureDisable(uint32_t pin);
+
+/// <summary>
+/// <para>Returns the number of transitions on a pin since capture was enabled, kept even
+/// when the edge ring overflows. Counting pulses is half of this.</para>
+/// </summary>
+/// <param name="pin">A specific pin, only pins < GPIO_EINT_PIN_COUNT are supported.</param>
+/// <returns>Transition count, or 0 for an invalid pin.</returns>
+uint32_t GPIO_EdgeCaptureCount(uint32_t pin);
+
+/// <summary>
+/// <para>Copies buffered edges of all pins, oldest first, and removes them from the
+/// ring. Must not be called from an EINT handler.</para>
+/// </summary>
+/// <param name="edges">Buffer to receive the edges.</param>
+/// <param name="max">Capacity of the buffer.</param>
+/// <param name="lost">If not NULL, on return holds the number of edges dropped since the
+/// previous call because the ring was full.</param>
+/// <returns>The number of edges copied.</returns>
+uintptr_t GPIO_EdgeCaptureRead(GPIO_Edge *edges, uintptr_t max, uint32_t *lost);
+
 /// <summary>
 /// <para>Get debounce counter value.</para>
 /// </summary>
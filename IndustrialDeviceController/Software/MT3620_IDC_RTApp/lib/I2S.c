@@ -315,7 +315,7 @@ static void I2S_InputUpdate(I2S *handle)
     volatile mt3620_dma_t * const dma = &mt3620_dma[MT3620_I2S_DMA_RX(id)];
 
     unsigned  size   = MT3620_DMA_FIELD_READ(MT3620_I2S_DMA_RX(id), con, size);
-    uintptr_t remain = (dma->ffsize - dma->ffcnt) << size;
+    uintptr_t remain = dma->ffcnt << size;
     uintptr_t swptr  = MT3620_DMA_FIELD_READ(MT3620_I2S_DMA_RX(id), swptr, swptr);
 
     // Handle buffer wrap-around.
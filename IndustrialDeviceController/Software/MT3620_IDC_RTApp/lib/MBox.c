@@ -4,6 +4,7 @@
 #include "CPUFreq.h"
 #include "MBox.h"
 #include "NVIC.h"
+#include "Trace.h"
 
 #include "mt3620/mbox.h"
 
@@ -414,7 +415,10 @@ int32_t MBox_SW_Interrupt_Trigger(MBox *handle, uint8_t port)
 /// IRQs
 static void MBox_IRQ(MBox *handle, mt3620_mbox_int cb_type)
 {
+    TRACE_ENTER(TRACE_PROBE_MBOX_IRQ, cb_type);
+
     if (!handle || !handle->fifo_open) {
+        TRACE_EXIT(TRACE_PROBE_MBOX_IRQ, cb_type);
         return;
     }
 
@@ -467,6 +471,8 @@ static void MBox_IRQ(MBox *handle, mt3620_mbox_int cb_type)
     default:
         break;
     }
+
+    TRACE_EXIT(TRACE_PROBE_MBOX_IRQ, cb_type);
 }
 
 static inline void mbox_rd_int(int32_t index)
@@ -9,16 +9,68 @@
 #define PRINT_FLOAT_BASE 10
 #define PRINT_FLOAT_SIGDIG_DEFAULT 6
 
-int32_t UART_Print(UART *handle, const char *msg)
+// Where formatted text goes, straight to the UART when buff is NULL, else
+// gathered so a whole printf reaches the UART in one write. A UART with
+// deferred writes then drops a message in whole rather than cut.
+typedef struct {
+    UART     *handle;
+    char     *buff;
+    unsigned  size;
+    unsigned  length;
+} PrintOut;
+
+static int32_t Print__Flush(PrintOut *out)
+{
+    if (!out->buff || (out->length == 0)) {
+        return ERROR_NONE;
+    }
+    int32_t error = UART_Write(out->handle, out->buff, out->length);
+    out->length = 0;
+    return error;
+}
+
+static int32_t Print__Write(PrintOut *out, const void *data, uintptr_t size)
+{
+    if (size == 0) {
+        return ERROR_NONE;
+    }
+
+    if (!out->buff) {
+        return UART_Write(out->handle, data, size);
+    }
+
+    // Longer than the buffer, write out what's gathered and carry on.
+    if ((out->length + size) > out->size) {
+        int32_t error = Print__Flush(out);
+        if (error != ERROR_NONE) {
+            return error;
+        }
+        if (size > out->size) {
+            return UART_Write(out->handle, data, size);
+        }
+    }
+
+    __builtin_memcpy(&out->buff[out->length], data, size);
+    out->length += size;
+    return ERROR_NONE;
+}
+
+static inline int32_t Print__String(PrintOut *out, const char *msg)
 {
     if (!msg) {
         return ERROR_PARAMETER;
     }
-    return UART_Write(handle, (const uint8_t *)msg, __builtin_strlen(msg));
+    return Print__Write(out, msg, __builtin_strlen(msg));
+}
+
+int32_t UART_Print(UART *handle, const char *msg)
+{
+    PrintOut out = {.handle = handle};
+    return Print__String(&out, msg);
 }
 
-int32_t UART__PrintUIntBaseFiller(
-    UART    *handle,
+static int32_t Print__UIntBaseFiller(
+    PrintOut *out,
     int32_t  value,
     unsigned base,
     unsigned width,
@@ -55,7 +107,7 @@ int32_t UART__PrintUIntBaseFiller(
         buff[--p] = digit;
     }
 
-    return UART_Write(handle, &buff[p], w);
+    return Print__Write(out, &buff[p], w);
 }
 
 int32_t UART_PrintUIntBase(
@@ -65,11 +117,12 @@ int32_t UART_PrintUIntBase(
     unsigned  width,
     bool      upper)
 {
-    return UART__PrintUIntBaseFiller(handle, value, base, width, upper, '0');
+    PrintOut out = {.handle = handle};
+    return Print__UIntBaseFiller(&out, value, base, width, upper, '0');
 }
 
-static inline int32_t UART__PrintIntBaseFiller(
-    UART     *handle,
+static inline int32_t Print__IntBaseFiller(
+    PrintOut *out,
     int32_t   value,
     unsigned  base,
     unsigned  width,
@@ -77,15 +130,15 @@ static inline int32_t UART__PrintIntBaseFiller(
     char      filler)
 {
     if (value < 0) {
-        int32_t error = UART_Print(handle, "-");
+        int32_t error = Print__String(out, "-");
         if (error != ERROR_NONE) {
             return error;
         }
         value = -value;
     }
 
-    return UART__PrintUIntBaseFiller(handle, value, base,
-                                     width, upper, filler);
+    return Print__UIntBaseFiller(out, value, base,
+                                 width, upper, filler);
 }
 
 int32_t UART_PrintIntBase(
@@ -95,7 +148,8 @@ int32_t UART_PrintIntBase(
     unsigned  width,
     bool      upper)
 {
-    return UART__PrintIntBaseFiller(handle, value, base, width, upper, '0');
+    PrintOut out = {.handle = handle};
+    return Print__IntBaseFiller(&out, value, base, width, upper, '0');
 }
 
 static inline int32_t Int32_Power(int32_t base, int32_t exp)
@@ -114,8 +168,8 @@ static inline int32_t Int32_Power(int32_t base, int32_t exp)
     return result;
 }
 
-static inline int32_t UART__PrintFloatFiller(
-    UART     *handle,
+static inline int32_t Print__FloatFiller(
+    PrintOut *out,
     float     value,
     unsigned  sigDigits,
     unsigned  width,
@@ -127,7 +181,7 @@ static inline int32_t UART__PrintFloatFiller(
     int32_t error;
 
     if (value < 0) {
-        error = UART_Print(handle, "-");
+        error = Print__String(out, "-");
         if (error != ERROR_NONE) {
             return error;
         }
@@ -152,19 +206,19 @@ static inline int32_t UART__PrintFloatFiller(
     }
 
     /* Print LH.RH */
-    if ((error = UART__PrintUIntBaseFiller(handle, leftHand,
-                                           PRINT_FLOAT_BASE, (unsigned)lhWidth,
-                                           false, filler)) != ERROR_NONE) {
+    if ((error = Print__UIntBaseFiller(out, leftHand,
+                                       PRINT_FLOAT_BASE, (unsigned)lhWidth,
+                                       false, filler)) != ERROR_NONE) {
         return error;
     }
 
-    if ((error = UART_Print(handle, ".")) != ERROR_NONE) {
+    if ((error = Print__String(out, ".")) != ERROR_NONE) {
         return error;
     }
 
-    if ((error = UART_PrintUIntBase(handle, rightHand,
-                                    PRINT_FLOAT_BASE, sigDigits,
-                                    false)) != ERROR_NONE) {
+    if ((error = Print__UIntBaseFiller(out, rightHand,
+                                       PRINT_FLOAT_BASE, sigDigits,
+                                       false, '0')) != ERROR_NONE) {
         return error;
     }
     return ERROR_NONE;
@@ -176,7 +230,8 @@ int32_t UART_PrintFloatFiller(
     unsigned  sigDigits,
     unsigned  width)
 {
-    return UART__PrintFloatFiller(handle, value, sigDigits, width, '0');
+    PrintOut out = {.handle = handle};
+    return Print__FloatFiller(&out, value, sigDigits, width, '0');
 }
 
 typedef struct {
@@ -251,8 +306,11 @@ int32_t UART_vPrintf(UART *handle, const char *format, va_list args)
         return ERROR_PARAMETER;
     }
 
-    char     tempBuffer[PRINT_TEMP_PRINTF_BUFFER] = {'\0'};
-    unsigned tempIndex = 0;
+    char     tempBuffer[PRINT_TEMP_PRINTF_BUFFER];
+    PrintOut out = {.handle = handle,
+                    .buff   = tempBuffer,
+                    .size   = PRINT_TEMP_PRINTF_BUFFER,
+                    .length = 0};
     int32_t  error = ERROR_NONE;
 
     /* Loop through string and look for format specifier */
@@ -260,16 +318,13 @@ int32_t UART_vPrintf(UART *handle, const char *format, va_list args)
     formatSpec  spec;
     char        c;
     while (*format != '\0') {
-        if (tempIndex >= (PRINT_TEMP_PRINTF_BUFFER - 1)) {
-            error = ERROR_UART_PRINTF_INVALID;
-            break;
-        }
-
         if (*format == '%') {
             start = (char*)(format + 1);
             if (*start == '%') {
                 // handle %% pseudo-char
-                tempBuffer[tempIndex++] = *format;
+                if ((error = Print__Write(&out, format, 1)) != ERROR_NONE) {
+                    break;
+                }
                 format += 2;
                 continue;
             }
@@ -280,64 +335,56 @@ int32_t UART_vPrintf(UART *handle, const char *format, va_list args)
                 break;
             }
             format = end + 1;
-            if (tempIndex > 0) {
-                /* Write previously globbed tempBuffer */
-                tempBuffer[tempIndex] = '\0';
-                tempIndex             = 0;
-                if ((error = UART_Print(
-                    handle, (const char*)tempBuffer)) != ERROR_NONE) {
-                    break;
-                }
-            }
             /* Write formatted arg */
             switch (spec.type) {
             case 'd':
             case 'i':
-                error = UART__PrintIntBaseFiller(
-                    handle, va_arg(args, int), 10,
+                error = Print__IntBaseFiller(
+                    &out, va_arg(args, int), 10,
                     spec.width, false, spec.filler);
                 break;
             case 'u':
-                error = UART__PrintUIntBaseFiller(
-                    handle, va_arg(args, uint32_t), 10,
+                error = Print__UIntBaseFiller(
+                    &out, va_arg(args, uint32_t), 10,
                     spec.width, false, spec.filler);
                 break;
             case 'x':
-                error = UART__PrintUIntBaseFiller(
-                    handle, va_arg(args, uint32_t), 16,
+                error = Print__UIntBaseFiller(
+                    &out, va_arg(args, uint32_t), 16,
                     spec.width, false, spec.filler);
                 break;
             case 'o':
-                error = UART__PrintUIntBaseFiller(
-                    handle, va_arg(args, uint32_t), 8,
+                error = Print__UIntBaseFiller(
+                    &out, va_arg(args, uint32_t), 8,
                     spec.width, false, spec.filler);
                 break;
             case 'f':
-                error = UART__PrintFloatFiller(
-                    handle, (float)(va_arg(args, double)), spec.sigDigits,
+                error = Print__FloatFiller(
+                    &out, (float)(va_arg(args, double)), spec.sigDigits,
                     spec.width, spec.filler);
                 break;
             case 's':
-                error = UART_Print(
-                    handle, va_arg(args, const char*));
+                error = Print__String(
+                    &out, va_arg(args, const char*));
                 break;
             case 'c':
                 c = (char)va_arg(args, int);
-                error = UART_Print(
-                    handle, (const char*)(&c));
+                error = Print__Write(&out, &c, 1);
                 break;
             }
         }
         else {
-            tempBuffer[tempIndex++] = *format;
+            error = Print__Write(&out, format, 1);
             format++;
         }
+        if (error != ERROR_NONE) {
+            break;
+        }
     }
 
     if (error == ERROR_NONE) {
-        /* Write previously globbed tempBuffer */
-        tempBuffer[tempIndex] = '\0';
-        error = UART_Print(handle, (const char*)tempBuffer);
+        /* Write the whole message gathered in tempBuffer */
+        error = Print__Flush(&out);
     }
 
     return error;
@@ -111,6 +111,8 @@ static inline int32_t UART_PrintHexWidth(UART *handle, uint32_t value, uintptr_t
 /// <para>Subset of printf functionality for UART, supports format specs:
 /// %d, %u, %f, %x, %o, %c and %s. Also supports width and significant place
 /// specification (i.e. %08.7f) </para>
+/// <para>The message is formatted in whole before it's written, so on a UART
+/// set up with <see cref="UART_SetTxDeferred" /> it's queued or dropped in whole.</para>
 /// </summary>
 /// <param name="handle">Which UART to print the value to.</param>
 /// <param name="format">Format string.</param>
@@ -4,6 +4,7 @@
 #include "SPIMaster.h"
 #include "Common.h"
 #include "NVIC.h"
+#include "Trace.h"
 #include "mt3620/spi.h"
 #include "mt3620/dma.h"
 
@@ -16,6 +17,9 @@
 // This is the maximum number of globbed transactions we allow to queue
 #define SPI_MASTER_TRANSFER_COUNT_MAX 16
 
+// This is the maximum number of transfer sequences we allow to queue per interface
+#define SPI_MASTER_QUEUE_SIZE 4
+
 typedef enum {
     SPI_MASTER_TRANSFER_WRITE,
     SPI_MASTER_TRANSFER_READ,
@@ -30,6 +34,15 @@ typedef struct {
     const SPITransfer *transfer;
 } SPIMaster_TransferGlob;
 
+// A queued transfer sequence, split into globs which each fit the hardware buffers.
+typedef struct {
+    SPIMaster_TransferGlob  glob[SPI_MASTER_TRANSFER_COUNT_MAX];
+    unsigned                globCount;
+    void                    (*callback)(int32_t, uintptr_t);
+    void                    (*callbackUser)(int32_t, uintptr_t, void*);
+    void                   *userData;
+} SPIMaster_Request;
+
 struct SPIMaster {
     uint32_t                id;
     bool                    open;
@@ -37,19 +50,31 @@ struct SPIMaster {
     uint32_t                csLine;
     void                    (*csCallback)(SPIMaster*, bool);
     bool                    csEnable;
-    void                    (*callback)(int32_t, uintptr_t);
-    void                    (*callbackUser)(int32_t, uintptr_t, void*);
-    void                   *userData;
-    SPIMaster_TransferGlob  glob[SPI_MASTER_TRANSFER_COUNT_MAX];
-    unsigned                globCount, globTransferred;
+    SPIMaster_Request       queue[SPI_MASTER_QUEUE_SIZE];
+    unsigned                queueHead, queueCount;
+    bool                    active;
+    unsigned                globTransferred;
     int32_t                 dataCount;
+    unsigned                cfgActive;
+    bool                    cfgPrepared;
 };
 
 static SPIMaster spiContext[MT3620_SPI_COUNT] = { 0 };
 
 // TODO: Reduce sysram usage by providing a more limited set of buffers?
-// Each interface has two buffers for double buffering.
-static __attribute__((section(".sysram"))) mt3620_spi_dma_cfg_t SPIMaster_DmaConfig[MT3620_SPI_COUNT] = { 0 };
+// Each interface has two buffers for double buffering, the next glob is written
+// to one while the DMA is still sending the other. Buffer 0 holds the settings.
+static __attribute__((section(".sysram"))) mt3620_spi_dma_cfg_t SPIMaster_DmaConfig[MT3620_SPI_COUNT][2] = { 0 };
+
+// Copy settings held in buffer 0 to the other buffer, the data mode belongs to
+// whichever glob is in the buffer so it isn't copied.
+static inline void SPIMaster_DmaConfigSync(unsigned id)
+{
+    bool duplex = SPIMaster_DmaConfig[id][1].smmr.both_directional_data_mode;
+    SPIMaster_DmaConfig[id][1].smmr.mask  = SPIMaster_DmaConfig[id][0].smmr.mask;
+    SPIMaster_DmaConfig[id][1].smmr.both_directional_data_mode = duplex;
+    SPIMaster_DmaConfig[id][1].stcsr.mask = SPIMaster_DmaConfig[id][0].stcsr.mask;
+}
 
 #define SPI_PRIORITY 2
 
@@ -71,7 +96,8 @@ int32_t SPIMaster_Select(SPIMaster *handle, unsigned csLine)
     handle->csCallback = NULL;
 
     // Set the chip select line.
-    SPIMaster_DmaConfig[handle->id].smmr.rs_slave_sel = csLine;
+    SPIMaster_DmaConfig[handle->id][0].smmr.rs_slave_sel = csLine;
+    SPIMaster_DmaConfigSync(handle->id);
 
     return ERROR_NONE;
 }
@@ -87,7 +113,8 @@ int32_t SPIMaster_SelectEnable(SPIMaster *handle, bool enable)
 
     handle->csEnable = enable;
     if (!handle->csCallback) {
-        SPIMaster_DmaConfig[handle->id].smmr.rs_slave_sel = enable ? handle->csLine : MT3620_CS_NULL;
+        SPIMaster_DmaConfig[handle->id][0].smmr.rs_slave_sel = enable ? handle->csLine : MT3620_CS_NULL;
+        SPIMaster_DmaConfigSync(handle->id);
     }
 
     return ERROR_NONE;
@@ -105,7 +132,8 @@ int32_t SPIMaster_SetSelectLineCallback(
     handle->csEnable   = (csCallback != NULL);
     handle->csLine     = MT3620_CS_NULL;
 
-    SPIMaster_DmaConfig[handle->id].smmr.rs_slave_sel = MT3620_CS_NULL;
+    SPIMaster_DmaConfig[handle->id][0].smmr.rs_slave_sel = MT3620_CS_NULL;
+    SPIMaster_DmaConfigSync(handle->id);
 
     return ERROR_NONE;
 }
@@ -133,13 +161,14 @@ int32_t SPIMaster_Configure(SPIMaster *handle, bool cpol, bool cpha, uint32_t bu
         return ERROR_UNSUPPORTED;
     }
 
-    mt3620_spi_dma_cfg_t *cfg = &SPIMaster_DmaConfig[handle->id];
+    mt3620_spi_dma_cfg_t *cfg = &SPIMaster_DmaConfig[handle->id][0];
     cfg->smmr.cpol          = cpol;       // Set polarity for CPOL setting.
     cfg->smmr.cpha          = cpha;       // Set polarity for CPHA setting.
     cfg->smmr.rs_clk_sel    = rs_clk_sel; // Set serial clock SPI_CLK.
     cfg->smmr.more_buf_mode = 1;          // Select SPI buffer size.
     cfg->smmr.lsb_first     = false;      // Select MSB first.
     cfg->smmr.int_en        = true;       // Enable interrupts.
+    SPIMaster_DmaConfigSync(handle->id);
 
     return ERROR_NONE;
 }
@@ -224,12 +253,13 @@ SPIMaster *SPIMaster_Open(Platform_Unit unit)
     spiContext[id].csLine             = MT3620_CS_NULL;
     spiContext[id].csCallback         = NULL;
     spiContext[id].csEnable           = false;
-    spiContext[id].callback           = NULL;
-    spiContext[id].callbackUser       = NULL;
-    spiContext[id].userData           = NULL;
-    spiContext[id].globCount          = 0;
+    spiContext[id].queueHead          = 0;
+    spiContext[id].queueCount         = 0;
+    spiContext[id].active             = false;
     spiContext[id].globTransferred    = 0;
     spiContext[id].dataCount          = 0;
+    spiContext[id].cfgActive          = 0;
+    spiContext[id].cfgPrepared        = false;
 
     // Select the CS line.
     int32_t status = SPIMaster_Select(&spiContext[id], 0);
@@ -247,8 +277,9 @@ SPIMaster *SPIMaster_Open(Platform_Unit unit)
     NVIC_EnableIRQ(MT3620_SPI_INTERRUPT(id), SPI_PRIORITY);
 
     // Hard-code start to true in DMA transfers so transfer starts.
-    mt3620_spi_dma_cfg_t *cfg = &SPIMaster_DmaConfig[id];
+    mt3620_spi_dma_cfg_t *cfg = &SPIMaster_DmaConfig[id][0];
     cfg->stcsr.spi_master_start = true;
+    SPIMaster_DmaConfigSync(id);
 
     volatile mt3620_dma_t * const tx_dma = &mt3620_dma[MT3620_SPI_DMA_TX(id)];
     mt3620_dma_global->ch_en_set = (1U << MT3620_SPI_DMA_TX(id));
@@ -265,7 +296,7 @@ SPIMaster *SPIMaster_Open(Platform_Unit unit)
     dma_con_tx.size  = 2;
     tx_dma->con = dma_con_tx.mask;
     tx_dma->fixaddr = (uint32_t *)&mt3620_spi[id]->dataport;
-    tx_dma->pgmaddr = (uint32_t *)&SPIMaster_DmaConfig[id];
+    tx_dma->pgmaddr = (uint32_t *)&SPIMaster_DmaConfig[id][0];
 
     // Enable DMA mode.
     MT3620_SPI_FIELD_WRITE(id, cspol, dma_mode, true);
@@ -314,9 +345,11 @@ static inline void SPIMaster_WordCopy(volatile void *dst, volatile void *src, ui
     }
 }
 
-static int32_t SPIMaster_TransferGlobQueue(SPIMaster *handle, SPIMaster_TransferGlob *glob)
+// Write a glob to one of the interface's config buffers, ready to be started.
+static int32_t SPIMaster_TransferGlobPrepare(
+    SPIMaster *handle, const SPIMaster_TransferGlob *glob, unsigned cfgIndex)
 {
-    mt3620_spi_dma_cfg_t *cfg = &SPIMaster_DmaConfig[handle->id];
+    mt3620_spi_dma_cfg_t *cfg = &SPIMaster_DmaConfig[handle->id][cfgIndex];
 
     switch (glob->type) {
 #ifdef SPI_ALLOW_TRANSFER_WRITE
@@ -383,38 +416,74 @@ static int32_t SPIMaster_TransferGlobQueue(SPIMaster *handle, SPIMaster_Transfer
     // This workaround is required to make the MOSI line idle high due to SPI bug.
     sdor[p] = 0xFF;
 
+    return ERROR_NONE;
+}
+
+// Start the glob held in one of the interface's config buffers.
+static void SPIMaster_TransferGlobStart(SPIMaster *handle, unsigned cfgIndex)
+{
+    mt3620_spi_dma_cfg_t *cfg = &SPIMaster_DmaConfig[handle->id][cfgIndex];
+    handle->cfgActive = cfgIndex;
+
     if (handle->dma) {
         unsigned index = MT3620_SPI_DMA_TX(handle->id);
-        mt3620_dma[index].pgmaddr = (uint32_t*)&SPIMaster_DmaConfig[handle->id];
+        mt3620_dma[index].pgmaddr = (uint32_t*)cfg;
         mt3620_dma[index].count = (sizeof(mt3620_spi_dma_cfg_t) / 4);
         MT3620_DMA_FIELD_WRITE(index, start, str, true);
     } else {
-        SPIMaster_WordCopy(&mt3620_spi[handle->id]->soar, &SPIMaster_DmaConfig[handle->id], 11);
-        mt3620_spi[handle->id]->stcsr = SPIMaster_DmaConfig[handle->id].stcsr.mask;
+        SPIMaster_WordCopy(&mt3620_spi[handle->id]->soar, cfg, 11);
+        mt3620_spi[handle->id]->stcsr = cfg->stcsr.mask;
     }
+}
 
-    return ERROR_NONE;
+// Return the glob which will run after the current one, either the next glob of
+// the request at the head of the queue or the first glob of the request after it.
+static const SPIMaster_TransferGlob *SPIMaster_TransferGlobNext(SPIMaster *handle)
+{
+    const SPIMaster_Request *request = &handle->queue[handle->queueHead];
+    if ((handle->globTransferred + 1) < request->globCount) {
+        return &request->glob[handle->globTransferred + 1];
+    }
+    if (handle->queueCount < 2) {
+        return NULL;
+    }
+    return &handle->queue[(handle->queueHead + 1) % SPI_MASTER_QUEUE_SIZE].glob[0];
 }
 
-static int32_t SPIMaster_TransferSequentialAsyncGlob(
-    SPIMaster              *handle,
-    SPIMaster_TransferGlob *glob,
-    uint32_t                count,
-    void(*callback)     (int32_t status, uintptr_t dataCount),
-    void(*callbackUser) (int32_t status, uintptr_t dataCount, void *userData),
-    void                   *userData)
+// Write the next glob to the config buffer not in use, so it can start as soon
+// as the current glob completes. Must be called with the interface's IRQ blocked.
+static void SPIMaster_TransferGlobPrepareNext(SPIMaster *handle)
 {
-    if (!handle->open) {
-        return ERROR_HANDLE_CLOSED;
+    if (handle->cfgPrepared) {
+        return;
     }
-    if (count == 0) {
-        return ERROR_PARAMETER;
+
+    const SPIMaster_TransferGlob *next = SPIMaster_TransferGlobNext(handle);
+    if (next && (SPIMaster_TransferGlobPrepare(handle, next, (handle->cfgActive ^ 1)) == ERROR_NONE)) {
+        handle->cfgPrepared = true;
+    }
+}
+
+// Start the glob after the current one, using the prepared buffer if there is one.
+static int32_t SPIMaster_TransferGlobStartNext(SPIMaster *handle, const SPIMaster_TransferGlob *glob)
+{
+    unsigned cfgIndex = (handle->cfgActive ^ 1);
+    if (!handle->cfgPrepared) {
+        int32_t status = SPIMaster_TransferGlobPrepare(handle, glob, cfgIndex);
+        if (status != ERROR_NONE) {
+            return status;
+        }
     }
 
-    handle->callback        = callback;
-    handle->callbackUser    = callbackUser;
-    handle->userData        = userData;
-    handle->globCount       = count;
+    handle->cfgPrepared = false;
+    SPIMaster_TransferGlobStart(handle, cfgIndex);
+    return ERROR_NONE;
+}
+
+// Start the request at the head of the queue. Must be called with the interface's IRQ blocked.
+static int32_t SPIMaster_TransferRequestStart(SPIMaster *handle)
+{
+    handle->active          = true;
     handle->globTransferred = 0;
     handle->dataCount       = 0;
 
@@ -422,12 +491,67 @@ static int32_t SPIMaster_TransferSequentialAsyncGlob(
         handle->csCallback(handle, true);
     }
 
-    int32_t status = SPIMaster_TransferGlobQueue(handle, &glob[0]);
+    int32_t status = SPIMaster_TransferGlobStartNext(handle, &handle->queue[handle->queueHead].glob[0]);
     if (status != ERROR_NONE) {
-        handle->callback  = NULL;
-        handle->globCount = 0;
+        handle->active = false;
+        return status;
+    }
+
+    SPIMaster_TransferGlobPrepareNext(handle);
+    return ERROR_NONE;
+}
+
+// Remove the request at the head of the queue and call back its owner.
+static void SPIMaster_TransferRequestFinish(SPIMaster *handle, int32_t status, uintptr_t dataCount)
+{
+    SPIMaster_Request request = handle->queue[handle->queueHead];
+    handle->queueHead = (handle->queueHead + 1) % SPI_MASTER_QUEUE_SIZE;
+    handle->queueCount--;
+
+    if (handle->csEnable && handle->csCallback) {
+        handle->csCallback(handle, false);
+    }
+
+    // Keep the bus busy, the next request starts before this one is reported.
+    handle->active = false;
+    while ((handle->queueCount > 0) && (SPIMaster_TransferRequestStart(handle) != ERROR_NONE)) {
+        SPIMaster_TransferRequestFinish(handle, ERROR_SPI_TRANSFER_FAIL, 0);
+    }
+
+    if (request.callback) {
+        request.callback(status, dataCount);
+    } else if (request.callbackUser) {
+        request.callbackUser(status, dataCount, request.userData);
+    }
+}
+
+static int32_t SPIMaster_TransferSequentialAsyncGlob(
+    SPIMaster         *handle,
+    SPIMaster_Request *request)
+{
+    if (!handle->open) {
+        return ERROR_HANDLE_CLOSED;
+    }
+    if (request->globCount == 0) {
+        return ERROR_PARAMETER;
+    }
+
+    uint32_t prevBasePri = NVIC_BlockIRQs();
+
+    handle->queueCount++;
+
+    int32_t status = ERROR_NONE;
+    if (!handle->active) {
+        status = SPIMaster_TransferRequestStart(handle);
+        if (status != ERROR_NONE) {
+            handle->queueCount--;
+        }
+    } else {
+        // The previous transfer is still running, get this one ready to follow it.
+        SPIMaster_TransferGlobPrepareNext(handle);
     }
 
+    NVIC_RestoreIRQs(prevBasePri);
     return status;
 }
 
@@ -578,7 +702,15 @@ static int32_t SPIMaster_TransferSequentialAsync_Wrapper(
         return ERROR_PARAMETER;
     }
 
-    SPIMaster_TransferGlob *glob = handle->glob;
+    // Only the caller adds requests, the IRQ only removes them, so the free
+    // slot can't be taken while globs are being built into it.
+    if (handle->queueCount >= SPI_MASTER_QUEUE_SIZE) {
+        return ERROR_BUSY;
+    }
+
+    SPIMaster_Request *request = &handle->queue[
+        (handle->queueHead + handle->queueCount) % SPI_MASTER_QUEUE_SIZE];
+    SPIMaster_TransferGlob *glob = request->glob;
 
     unsigned t = 0, g = 0;
     int32_t status;
@@ -603,10 +735,11 @@ static int32_t SPIMaster_TransferSequentialAsync_Wrapper(
     }
     SPIMaster_TransferGlobFinalize(&glob[g]);
 
-    handle->globCount = (g + 1);
-    return SPIMaster_TransferSequentialAsyncGlob(handle, handle->glob,
-                                                 handle->globCount, callback,
-                                                 callbackUser, userData);
+    request->globCount    = (g + 1);
+    request->callback     = callback;
+    request->callbackUser = callbackUser;
+    request->userData     = userData;
+    return SPIMaster_TransferSequentialAsyncGlob(handle, request);
 }
 
 int32_t SPIMaster_TransferSequentialAsync(
@@ -619,10 +752,6 @@ int32_t SPIMaster_TransferSequentialAsync(
         return ERROR_PARAMETER;
     }
 
-    if (handle->callback) {
-        return ERROR_BUSY;
-    }
-
     return SPIMaster_TransferSequentialAsync_Wrapper(
         handle, transfer, count, callback, NULL, NULL);
 }
@@ -639,10 +768,6 @@ int32_t SPIMaster_TransferSequentialAsync_UserData(
         return ERROR_PARAMETER;
     }
 
-    if (handle->callback) {
-        return ERROR_BUSY;
-    }
-
     return SPIMaster_TransferSequentialAsync_Wrapper(
         handle, transfer, count, NULL, callback, userData);
 }
@@ -653,30 +778,38 @@ int32_t SPIMaster_TransferCancel(SPIMaster *handle)
         return ERROR_PARAMETER;
     }
 
+    uint32_t prevBasePri = NVIC_BlockIRQs();
+
     // stop DMA, reset spi_master_start and read spi_scrc (to clear it)
-    mt3620_spi_dma_cfg_t *cfg = &SPIMaster_DmaConfig[handle->id];
     MT3620_DMA_FIELD_WRITE(MT3620_SPI_DMA_TX(handle->id), start, str, false);
-    cfg->stcsr.spi_master_start = false;
+    MT3620_SPI_FIELD_WRITE(handle->id, stcsr, spi_master_start, false);
     uint32_t dummy_read = mt3620_spi[handle->id]->scsr;
     (void)dummy_read;
 
-    handle->globCount       = 0;
+    bool active = handle->active;
+    handle->active          = false;
+    handle->cfgPrepared     = false;
     handle->globTransferred = 0;
 
-    if (handle->callback) {
-        handle->callback(ERROR_SPI_TRANSFER_CANCEL, 0);
-        handle->callback = NULL;
-    } else if (handle->callbackUser) {
-        handle->callbackUser(ERROR_SPI_TRANSFER_CANCEL, 0, handle->userData);
-        handle->callbackUser = NULL;
+    // Every queued transfer is cancelled, later ones may depend on the first.
+    while (handle->queueCount > 0) {
+        SPIMaster_Request request = handle->queue[handle->queueHead];
+        handle->queueHead = (handle->queueHead + 1) % SPI_MASTER_QUEUE_SIZE;
+        handle->queueCount--;
+
+        if (request.callback) {
+            request.callback(ERROR_SPI_TRANSFER_CANCEL, 0);
+        } else if (request.callbackUser) {
+            request.callbackUser(ERROR_SPI_TRANSFER_CANCEL, 0, request.userData);
+        }
     }
 
-    int32_t status = ERROR_NONE;
-    if (handle->csEnable && handle->csCallback) {
+    if (active && handle->csEnable && handle->csCallback) {
         handle->csCallback(handle, false);
     }
 
-    return status;
+    NVIC_RestoreIRQs(prevBasePri);
+    return ERROR_NONE;
 }
 
 static volatile bool SPIMaster_TransferSequentialSync_Ready = false;
@@ -708,15 +841,20 @@ int32_t SPIMaster_TransferSequentialSync(SPIMaster *handle, SPITransfer *transfe
 
 static void SPIMaster_IRQ(Platform_Unit unit)
 {
+    TRACE_ENTER(TRACE_PROBE_SPI_IRQ, unit);
+
     unsigned id = SPIMaster_UnitToID(unit);
     if (id >= MT3620_SPI_COUNT) {
+        TRACE_EXIT(TRACE_PROBE_SPI_IRQ, unit);
         return;
     }
 
     SPIMaster *handle = &spiContext[id];
 
     // This should never happen
-    if (!handle->open) {
+    if (!handle->open || !handle->active) {
+        (void)mt3620_spi[id]->scsr;
+        TRACE_EXIT(TRACE_PROBE_SPI_IRQ, unit);
         return;
     }
 
@@ -726,66 +864,60 @@ static void SPIMaster_IRQ(Platform_Unit unit)
 
     int32_t status = ERROR_NONE;
 
+    SPIMaster_Request      *request = &handle->queue[handle->queueHead];
+    SPIMaster_TransferGlob *glob    = &request->glob[handle->globTransferred];
+
     // Clear interrupt flag and the status of the SPI transaction.
     if (!MT3620_SPI_FIELD_READ(id, scsr, spi_ok)) {
         status = ERROR_SPI_TRANSFER_FAIL;
+    } else if (handle->dma && (mt3620_dma[MT3620_SPI_DMA_TX(id)].rlct != 0)){
+        status = ERROR_SPI_TRANSFER_FAIL;
     } else {
-        SPIMaster_TransferGlob *glob = &handle->glob[handle->globTransferred];
-        if (handle->dma && (mt3620_dma[MT3620_SPI_DMA_TX(id)].rlct != 0)){
-            status = ERROR_SPI_TRANSFER_FAIL;
-        } else {
-            handle->dataCount += (glob->opcodeLen + glob->payloadLen);
-        }
-    }
-
-    bool final = (status != ERROR_NONE);
-    if (status == ERROR_NONE) {
-        unsigned g;
-        for (g = 0; g < handle->globCount; g++) {
-            SPIMaster_TransferGlob *glob = &handle->glob[g];
-
-            unsigned offset = 0;
-            unsigned t;
-            for (t = 0; t < glob->transferCount; t++) {
-                const SPITransfer *transfer = &glob->transfer[t];
-
-                if (transfer->readData) {
-                    unsigned sdirOffset = 0;
-                    if (glob->type == SPI_MASTER_TRANSFER_FULL_DUPLEX) {
-                        sdirOffset = 4;
-                    }
-
-                    // Read data out of SDIR.
-                    uint8_t *src = (uint8_t*)&mt3620_spi[handle->id]->sdir[sdirOffset];
-                    __builtin_memcpy(transfer->readData, &src[offset], transfer->length);
+        handle->dataCount += (glob->opcodeLen + glob->payloadLen);
+
+        // Read data out of SDIR for the glob which just completed, before the
+        // next one overwrites it.
+        unsigned offset = 0;
+        unsigned t;
+        for (t = 0; t < glob->transferCount; t++) {
+            const SPITransfer *transfer = &glob->transfer[t];
+
+            if (transfer->readData) {
+                unsigned sdirOffset = 0;
+                if (glob->type == SPI_MASTER_TRANSFER_FULL_DUPLEX) {
+                    sdirOffset = 4;
                 }
 
-                offset += transfer->length;
-                if (t == 0) offset -= glob->opcodeLen;
+                uint8_t *src = (uint8_t*)&mt3620_spi[handle->id]->sdir[sdirOffset];
+                __builtin_memcpy(transfer->readData, &src[offset], transfer->length);
             }
+
+            offset += transfer->length;
+            if (t == 0) offset -= glob->opcodeLen;
         }
+    }
 
+    if (status == ERROR_NONE) {
         handle->globTransferred++;
-        final = (handle->globTransferred >= handle->globCount);
-        if (!final) {
-            status = SPIMaster_TransferGlobQueue(
-                handle, &handle->glob[handle->globTransferred]);
-            final = (status != ERROR_NONE);
+        if (handle->globTransferred < request->globCount) {
+            status = SPIMaster_TransferGlobStartNext(
+                handle, &request->glob[handle->globTransferred]);
+            if (status == ERROR_NONE) {
+                SPIMaster_TransferGlobPrepareNext(handle);
+                TRACE_EXIT(TRACE_PROBE_SPI_IRQ, unit);
+                return;
+            }
         }
     }
 
-    if (final) {
-        if (handle->csEnable && handle->csCallback) {
-            handle->csCallback(handle, false);
-        }
-        if (handle->callback) {
-            handle->callback(status, handle->dataCount);
-            handle->callback = NULL;
-        } else if (handle->callbackUser) {
-            handle->callbackUser(status, handle->dataCount, handle->userData);
-            handle->callbackUser = NULL;
-        }
+    // A prepared glob of this request is no use once it has failed.
+    if (status != ERROR_NONE) {
+        handle->cfgPrepared = false;
     }
+
+    SPIMaster_TransferRequestFinish(handle, status, handle->dataCount);
+
+    TRACE_EXIT(TRACE_PROBE_SPI_IRQ, unit);
 }
 
 void isu_g0_spim_irq(void) { SPIMaster_IRQ(MT3620_UNIT_ISU0); }
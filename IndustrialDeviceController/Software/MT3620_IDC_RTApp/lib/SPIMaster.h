@@ -122,6 +122,10 @@ void SPIMaster_Close(SPIMaster *handle);
 /// <summary>
 /// <para>Executes a sequence of asynchronous SPI transactions
 /// (Read, Write or WriteThenRead) on the interface provided.</para>
+/// <para>Sequences are queued, up to four per interface, and run back-to-back; the
+/// next transaction is written to a second DMA buffer while the current one is on
+/// the bus. The transfer array is copied, but the data it points to must remain
+/// valid until the callback is called. Returns ERROR_BUSY if the queue is full.</para>
 /// </summary>
 /// <param name="handle">SPI handle to perform the transfer on.</param>
 /// <param name="transfer">A pointer to the base of an array of transfers, for more information
@@ -152,7 +156,8 @@ int32_t SPIMaster_TransferSequentialAsync_UserData(
         int32_t status, uintptr_t data_count, void *userData), void *userData);
 
 /// <summary>
-/// <para>Cancels the ongoing transfer.</para>
+/// <para>Cancels the ongoing transfer and any queued behind it, the callback of each
+/// is called with ERROR_SPI_TRANSFER_CANCEL.</para>
 /// </summary>
 /// <param name="handle">SPI handle to cancel transfer on.</param>
 /// <returns>Returns ERROR_NONE on success, or an error code on failure.</returns>
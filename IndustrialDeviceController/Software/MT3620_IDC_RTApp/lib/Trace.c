@@ -0,0 +1,78 @@
+/* Copyright (c) Codethink Ltd. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "Trace.h"
+
+#include <stddef.h>
+
+// Kept in TCM (the default data region) so recording never stalls on SYSRAM.
+Trace_Entry       Trace__Ring[TRACE_RING_SIZE] = { 0 };
+volatile uint32_t Trace__Head                  = 0;
+
+static uint32_t Trace__TickRate = 0;
+
+int32_t Trace_Init(GPT *timer)
+{
+    if (!timer || (GPT_GetId(timer) != MT3620_UNIT_GPT4)) {
+        return ERROR_PARAMETER;
+    }
+
+    if (!GPT_IsEnabled(timer)) {
+        int32_t error = GPT_Start_Freerun(timer);
+        if (error != ERROR_NONE) {
+            return error;
+        }
+    }
+
+    float speedHz;
+    int32_t error = GPT_GetSpeed(timer, &speedHz);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+
+    Trace__TickRate = (uint32_t)speedHz;
+    return ERROR_NONE;
+}
+
+uint32_t Trace_GetTickRate(void)
+{
+    return Trace__TickRate;
+}
+
+uintptr_t Trace_Read(uint32_t *cursor, Trace_Entry *entries, uintptr_t max, uint32_t *lost)
+{
+    if (!cursor || !entries) {
+        return 0;
+    }
+
+    uint32_t head = Trace__Head;
+    uint32_t skipped = 0;
+
+    // Anything more than a ring behind has been overwritten.
+    if ((head - *cursor) > TRACE_RING_SIZE) {
+        skipped += (head - *cursor) - TRACE_RING_SIZE;
+        *cursor  = head - TRACE_RING_SIZE;
+    }
+
+    uintptr_t count = 0;
+    while ((*cursor != head) && (count < max)) {
+        const Trace_Entry *entry = &Trace__Ring[*cursor & (TRACE_RING_SIZE - 1)];
+
+        uint16_t seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        entries[count] = *entry;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        // Taken by a newer event or still being written, either way it's gone.
+        if ((seq != (uint16_t)*cursor) || (entry->seq != seq)) {
+            skipped++;
+        } else {
+            count++;
+        }
+        (*cursor)++;
+    }
+
+    if (lost) {
+        *lost += skipped;
+    }
+    return count;
+}
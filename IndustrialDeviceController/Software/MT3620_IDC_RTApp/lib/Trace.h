@@ -0,0 +1,108 @@
+/* Copyright (c) Codethink Ltd. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef AZURE_SPHERE_TRACE_H_
+#define AZURE_SPHERE_TRACE_H_
+
+#include "Common.h"
+#include "GPT.h"
+#include "mt3620/gpt.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/// <summary>Number of events held before the oldest are overwritten, must be a power of two.</summary>
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 256
+#endif
+
+/// <summary>Probe identifiers recorded with each event, applications use TRACE_PROBE_USER and above.</summary>
+typedef enum {
+    TRACE_PROBE_UART_IRQ = 0,
+    TRACE_PROBE_SPI_IRQ  = 1,
+    TRACE_PROBE_MBOX_IRQ = 2,
+    TRACE_PROBE_ADC_DMA_IRQ = 3,
+    TRACE_PROBE_USER     = 16,
+} Trace_Probe;
+
+/// <summary>Set in <see cref="Trace_Entry" />.probe for an exit event.</summary>
+#define TRACE_PROBE_EXIT 0x80
+
+/// <summary>One recorded event.</summary>
+typedef struct {
+    /// <summary>GPT4 count when the event was recorded.</summary>
+    uint32_t time;
+    /// <summary>Low bits of the event's sequence number, used to detect overwritten entries.</summary>
+    uint16_t seq;
+    /// <summary>Probe identifier, with <see cref="TRACE_PROBE_EXIT" /> set on exit.</summary>
+    uint8_t  probe;
+    /// <summary>Probe specific argument, e.g. the unit an interrupt is for.</summary>
+    uint8_t  arg;
+} Trace_Entry;
+
+extern Trace_Entry       Trace__Ring[TRACE_RING_SIZE];
+extern volatile uint32_t Trace__Head;
+
+/// <summary>
+/// <para>Records an event. Lock free and safe to call from any interrupt, an interrupt
+/// preempting another only takes the next slot. Timestamps are read straight from GPT4,
+/// which must be free running, see <see cref="Trace_Init" />.</para>
+/// <para>Use <see cref="TRACE_ENTER" /> and <see cref="TRACE_EXIT" /> so probes compile
+/// out when TRACE_ENABLE isn't defined.</para>
+/// </summary>
+/// <param name="probe">Probe identifier, with TRACE_PROBE_EXIT set on exit.</param>
+/// <param name="arg">Probe specific argument.</param>
+static inline void Trace_Record(uint8_t probe, uint8_t arg)
+{
+    uint32_t seq = __atomic_fetch_add(&Trace__Head, 1, __ATOMIC_RELAXED);
+    Trace_Entry *entry = &Trace__Ring[seq & (TRACE_RING_SIZE - 1)];
+    entry->time  = mt3620_gpt->gpt4_cnt;
+    entry->probe = probe;
+    entry->arg   = arg;
+    // The sequence number goes last, the reader discards an entry if it changes.
+    __atomic_store_n(&entry->seq, (uint16_t)seq, __ATOMIC_RELEASE);
+}
+
+#ifdef TRACE_ENABLE
+#define TRACE_ENTER(probe, arg) Trace_Record((probe), (arg))
+#define TRACE_EXIT(probe, arg)  Trace_Record(((probe) | TRACE_PROBE_EXIT), (arg))
+#else
+#define TRACE_ENTER(probe, arg) do { } while (0)
+#define TRACE_EXIT(probe, arg)  do { } while (0)
+#endif
+
+/// <summary>
+/// <para>Starts tracing. Entries recorded before this carry meaningless timestamps.</para>
+/// </summary>
+/// <param name="timer">GPT4 handle, started free running if it isn't already.</param>
+/// <returns>ERROR_NONE on success, or an error code.</returns>
+int32_t Trace_Init(GPT *timer);
+
+/// <summary>
+/// <para>Returns the rate GPT4 was running at when tracing started, to convert
+/// <see cref="Trace_Entry" />.time to microseconds.</para>
+/// </summary>
+/// <returns>Timestamp rate in Hz, or 0 if tracing isn't started.</returns>
+uint32_t Trace_GetTickRate(void);
+
+/// <summary>
+/// <para>Copies out events recorded since the cursor, oldest first, and advances it.
+/// Events overwritten before they were read, or being overwritten while read, are
+/// skipped and counted as lost.</para>
+/// </summary>
+/// <param name="cursor">Sequence number of the next event to read, start at 0.</param>
+/// <param name="entries">Buffer for the events.</param>
+/// <param name="max">Capacity of entries.</param>
+/// <param name="lost">Optional, incremented by the number of events skipped.</param>
+/// <returns>Number of events copied.</returns>
+uintptr_t Trace_Read(uint32_t *cursor, Trace_Entry *entries, uintptr_t max, uint32_t *lost);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // #ifndef AZURE_SPHERE_TRACE_H_
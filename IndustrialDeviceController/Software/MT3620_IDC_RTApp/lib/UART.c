@@ -5,17 +5,14 @@
 #include "mt3620/uart.h"
 #include "mt3620/dma.h"
 #include "NVIC.h"
+#include "Trace.h"
 #include <stddef.h>
 #include <stdbool.h>
 
 
-// Disable DMA as it doesn't currently work
-#undef UART_ALLOW_DMA
-
-
 // Configure these variables as needed.
 #define TX_BUFFER_SIZE 256
-#define RX_BUFFER_SIZE 32
+#define RX_BUFFER_SIZE 256
 
 #if (TX_BUFFER_SIZE > 65536)
 #error "TX buffer size must be less than or equal 65536"
@@ -43,10 +40,17 @@ struct UART {
     unsigned id;
     bool     dma;
 
+    uint8_t *txBuff;
+    uint32_t txSize;
     uint32_t txRemain, txRead, txWrite;
     uint32_t rxRemain, rxRead, rxWrite;
 
+    // deferred writes drop what doesn't fit instead of waiting for room
+    bool     txDeferred;
+    uint32_t txDropped;
+
     void (*rxCallback)(void);
+    void (*idleCallback)(void);
 };
 
 static UART context[MT3620_UART_COUNT] = {0};
@@ -59,7 +63,19 @@ static inline unsigned UART_UnitToID(Platform_Unit unit)
     return (unit - MT3620_UNIT_UART_DEBUG);
 }
 
-UART *UART_Open(Platform_Unit unit, unsigned baud, UART_Parity parity, unsigned stopBits, void (*rxCallback)(void))
+// Advances a DMA virtual FIFO pointer by one element, toggling the wrap bit
+// and returning to the start of the buffer when the end is reached.
+static inline uint32_t UART_DMAPointerAdvance(uint32_t ptr, uint32_t size)
+{
+    if (((ptr & 0xFFFF) + 1) >= size) {
+        return (ptr ^ 0x00010000) & 0xFFFF0000;
+    }
+    return ptr + 1;
+}
+
+static UART *UART_OpenCommon(
+    Platform_Unit unit, unsigned baud, UART_Parity parity, unsigned stopBits,
+    bool dma, void (*rxCallback)(void), unsigned idleChars, void (*idleCallback)(void))
 {
     unsigned id = UART_UnitToID(unit);
     if (id >= MT3620_UART_COUNT) {
@@ -136,14 +152,6 @@ UART *UART_Open(Platform_Unit unit, unsigned baud, UART_Parity parity, unsigned
     fcr.fifoe = true; // FIFO Enable
     mt3620_uart[id]->fcr = fcr.mask;
 
-    bool dma = false;
-#ifdef UART_ALLOW_DMA
-    // Debug UART doesn't seem to have DMA support.
-    if (unit != MT3620_UNIT_UART_DEBUG) {
-        dma = true;
-    }
-#endif
-
     MT3620_UART_FIELD_WRITE(id, vfifo_en, vfifo_en, dma);
 
     if (dma) {
@@ -156,11 +164,12 @@ UART *UART_Open(Platform_Unit unit, unsigned baud, UART_Parity parity, unsigned
         tx_dma->ffsize  = TX_BUFFER_SIZE;
         tx_dma->count   = 0;
 
+        // TX is paced by the UART's DMA handshake, so needs no interrupt.
         mt3620_dma_con_t dma_con_tx = { .mask = tx_dma->con };
         dma_con_tx.dir  = 0;
         dma_con_tx.iten = false;
         dma_con_tx.toen = false;
-        dma_con_tx.dreq = false;//true;
+        dma_con_tx.dreq = true;
         dma_con_tx.size = 0;
         tx_dma->con = dma_con_tx.mask;
 
@@ -170,14 +179,15 @@ UART *UART_Open(Platform_Unit unit, unsigned baud, UART_Parity parity, unsigned
         MT3620_DMA_FIELD_WRITE(MT3620_UART_DMA_RX(id), start, str, false);
 
         volatile mt3620_dma_t * const rx_dma = &mt3620_dma[MT3620_UART_DMA_RX(id)];
-        rx_dma->fixaddr = (void *)&mt3620_uart[id]->thr;
+        rx_dma->fixaddr = (void *)&mt3620_uart[id]->rbr;
         rx_dma->pgmaddr = (void *)UART_BuffRX[id];
         rx_dma->ffsize  = RX_BUFFER_SIZE;
-        rx_dma->count = 0;
+        // RX runs as a circular buffer, interrupting once it's half full.
+        rx_dma->count   = RX_BUFFER_SIZE / 2;
 
         mt3620_dma_con_t dma_con_rx = { .mask = rx_dma->con };
         dma_con_rx.dir  = 1;
-        dma_con_rx.iten = false;
+        dma_con_rx.iten = (rxCallback != NULL);
         dma_con_rx.toen = false;
         dma_con_rx.dreq = true;
         dma_con_rx.size = 0;
@@ -190,10 +200,18 @@ UART *UART_Open(Platform_Unit unit, unsigned baud, UART_Parity parity, unsigned
         extend_add.tx_dma_hsk_en = true;
         extend_add.tx_auto_trans = true;
         mt3620_uart[id]->extend_add = extend_add.mask;
+
+        // The RX timeout interrupt is left to flag an idle line, once no character
+        // has arrived for idleChars character times.
+        mt3620_uart_swo_rto_limit_t rto = { .mask = mt3620_uart[id]->sw_rto_limit };
+        rto.sw_rto_limit_en = (idleCallback != NULL);
+        rto.sw_rto_limit    = (idleChars > 0x3F ? 0x3F : idleChars);
+        mt3620_uart[id]->sw_rto_limit = rto.mask;
     }
 
-    // If an RX callback was supplied then enable the Receive Buffer Full Interrupt.
-    if (rxCallback) {
+    // If an RX callback was supplied then enable the Receive Buffer Full Interrupt,
+    // in DMA mode this only delivers RX timeouts.
+    if (dma ? (idleCallback != NULL) : (rxCallback != NULL)) {
         // Enable Receiver Buffer Full Interrupt
         MT3620_UART_FIELD_WRITE(id, ier, erbfi, true);
     }
@@ -209,30 +227,61 @@ UART *UART_Open(Platform_Unit unit, unsigned baud, UART_Parity parity, unsigned
     context[id].open = true;
     context[id].dma  = dma;
 
+    context[id].txBuff   = UART_BuffTX[id];
+    context[id].txSize   = TX_BUFFER_SIZE;
     context[id].txRemain = TX_BUFFER_SIZE;
     context[id].txRead   = 0;
     context[id].txWrite  = 0;
 
+    context[id].txDeferred = false;
+    context[id].txDropped  = 0;
+
     context[id].rxRemain = RX_BUFFER_SIZE;
     context[id].rxRead   = 0;
     context[id].rxWrite  = 0;
 
-    context[id].rxCallback = rxCallback;
+    context[id].rxCallback   = rxCallback;
+    context[id].idleCallback = idleCallback;
 
     return &context[id];
 }
 
+UART *UART_Open(Platform_Unit unit, unsigned baud, UART_Parity parity, unsigned stopBits, void (*rxCallback)(void))
+{
+    return UART_OpenCommon(unit, baud, parity, stopBits, false, rxCallback, 0, NULL);
+}
+
+UART *UART_OpenDMA(
+    Platform_Unit unit, unsigned baud, UART_Parity parity, unsigned stopBits,
+    void (*rxCallback)(void), unsigned idleChars, void (*idleCallback)(void))
+{
+    // Debug UART doesn't have DMA support.
+    if (unit == MT3620_UNIT_UART_DEBUG) {
+        return NULL;
+    }
+
+    if (idleCallback && (idleChars == 0)) {
+        return NULL;
+    }
+
+    return UART_OpenCommon(unit, baud, parity, stopBits, true, rxCallback, idleChars, idleCallback);
+}
+
 void UART_Close(UART *handle)
 {
     if (!handle || !handle->open) {
         return;
     }
 
-    MT3620_DMA_FIELD_WRITE(MT3620_UART_DMA_TX(handle->id), start, str, false);
-    MT3620_DMA_FIELD_WRITE(MT3620_UART_DMA_RX(handle->id), start, str, false);
+    if (handle->dma) {
+        MT3620_DMA_FIELD_WRITE(MT3620_UART_DMA_TX(handle->id), start, str, false);
+        MT3620_DMA_FIELD_WRITE(MT3620_UART_DMA_RX(handle->id), start, str, false);
 
-    mt3620_dma_global->ch_en_clr = (1U << MT3620_UART_DMA_TX(handle->id));
-    mt3620_dma_global->ch_en_clr = (1U << MT3620_UART_DMA_RX(handle->id));
+        mt3620_dma_global->ch_en_clr = (1U << MT3620_UART_DMA_TX(handle->id));
+        mt3620_dma_global->ch_en_clr = (1U << MT3620_UART_DMA_RX(handle->id));
+
+        MT3620_UART_FIELD_WRITE(handle->id, vfifo_en, vfifo_en, false);
+    }
 
     mt3620_uart[handle->id]->ier = 0x00000000;
     NVIC_DisableIRQ(MT3620_UART_INTERRUPT(handle->id));
@@ -260,22 +309,18 @@ int32_t UART_Write(UART *handle, const void *data, uintptr_t size)
             // We can't send any bytes until TX fifo is not full.
             while (MT3620_DMA_FIELD_READ(MT3620_UART_DMA_TX(handle->id), ffsta, full));
 
-            MT3620_DMA_FIELD_WRITE(MT3620_UART_DMA_TX(handle->id), start, str, false);
-
             uintptr_t remain = (tx_dma->ffsize - tx_dma->ffcnt);
             uintptr_t chunk = (remain >= size ? size : remain);
 
+            // The wrap bit isn't part of the index, and the DMA only sees the
+            // new bytes once swptr is written back.
+            uint32_t swptr = tx_dma->swptr;
             uintptr_t i;
             for (i = 0; i < chunk; i++) {
-                UART_BuffTX[handle->id][tx_dma->swptr++] = ((const uint8_t *)data)[i];
-#if (TX_BUFFER_SIZE < 65536)
-                // When the buffer isn't exactly 16-bits we need to handle the wrap bit.
-                if ((tx_dma->swptr & 0xFFFF) > TX_BUFFER_SIZE) {
-                    tx_dma->swptr &= 0xFFFF0000;
-                    tx_dma->swptr ^= 0x00010000;
-                }
-#endif
+                UART_BuffTX[handle->id][swptr & 0xFFFF] = ((const uint8_t *)data)[i];
+                swptr = UART_DMAPointerAdvance(swptr, TX_BUFFER_SIZE);
             }
+            tx_dma->swptr = swptr;
 
             MT3620_DMA_FIELD_WRITE(MT3620_UART_DMA_TX(handle->id), start, str, true);
 
@@ -283,9 +328,23 @@ int32_t UART_Write(UART *handle, const void *data, uintptr_t size)
             size -= chunk;
         }
     } else {
+        bool idle = (handle->txRemain == handle->txSize)
+            && MT3620_UART_FIELD_READ(handle->id, lsr, thre);
+
+        // Deferred writes are dropped in whole, so a message never comes out cut.
+        if (handle->txDeferred) {
+            uintptr_t room = handle->txRemain;
+            if (idle) {
+                room += MT3620_UART_TX_FIFO_DEPTH - MT3620_UART_FIELD_READ(handle->id, tx_offset, tx_offset);
+            }
+            if (size > room) {
+                handle->txDropped += size;
+                return ERROR_NONE;
+            }
+        }
+
         // If nothing is queued in hardware, queue that first.
-        if ((handle->txRemain == TX_BUFFER_SIZE)
-            && MT3620_UART_FIELD_READ(handle->id, lsr, thre)) {
+        if (idle) {
             uint32_t offset = MT3620_UART_FIELD_READ(handle->id, tx_offset, tx_offset);
             uint32_t remain = MT3620_UART_TX_FIFO_DEPTH - offset;
 
@@ -311,10 +370,11 @@ int32_t UART_Write(UART *handle, const void *data, uintptr_t size)
             // We can't use memcpy here because the buffer wraps.
             uint32_t i;
             for (i = 0; i < chunk; i++) {
-                UART_BuffTX[handle->id][handle->txWrite++] = ((const uint8_t *)data)[i];
-                handle->txWrite %= TX_BUFFER_SIZE;
+                handle->txBuff[handle->txWrite++] = ((const uint8_t *)data)[i];
+                handle->txWrite &= (handle->txSize - 1);
             }
-            handle->txRemain -= chunk;
+            // The TX interrupt adds to txRemain, so it mustn't land in between.
+            __atomic_fetch_sub(&handle->txRemain, chunk, __ATOMIC_SEQ_CST);
 
             // Enable interrupt so queued data is processed.
             MT3620_UART_FIELD_WRITE(handle->id, ier, etbei, true);
@@ -327,8 +387,52 @@ int32_t UART_Write(UART *handle, const void *data, uintptr_t size)
     return ERROR_NONE;
 }
 
+int32_t UART_SetTxDeferred(UART *handle, uint8_t *buffer, uintptr_t size)
+{
+    if (!handle) {
+        return ERROR_PARAMETER;
+    }
+
+    if (!handle->open) {
+        return ERROR_HANDLE_CLOSED;
+    }
+
+    if (handle->dma) {
+        return ERROR_UNSUPPORTED;
+    }
+
+    if (!buffer || (size == 0) || (size > 65536) || ((size & (size - 1)) != 0)) {
+        return ERROR_PARAMETER;
+    }
+
+    // Only swap buffers once the old one has drained.
+    while (handle->txRemain != handle->txSize) {
+        __asm__("wfi");
+    }
+
+    NVIC_DisableIRQ(MT3620_UART_INTERRUPT(handle->id));
+    handle->txBuff     = buffer;
+    handle->txSize     = size;
+    handle->txRemain   = size;
+    handle->txRead     = 0;
+    handle->txWrite    = 0;
+    handle->txDeferred = true;
+    NVIC_EnableIRQ(MT3620_UART_INTERRUPT(handle->id), UART_PRIORITY);
+
+    return ERROR_NONE;
+}
+
+uint32_t UART_GetTxDropped(UART *handle)
+{
+    return (handle ? handle->txDropped : 0);
+}
+
 inline bool UART_IsWriteComplete(UART *handle)
 {
+    // Bytes still queued in the TX virtual FIFO haven't reached the UART yet.
+    if (handle->dma && (mt3620_dma[MT3620_UART_DMA_TX(handle->id)].ffcnt != 0)) {
+        return false;
+    }
     return MT3620_UART_FIELD_READ(handle->id, lsr, temt);
 }
 
@@ -352,24 +456,17 @@ int32_t UART_Read(UART *handle, void *data, uintptr_t size)
             // We can't receive any bytes while RX fifo is empty.
             while (MT3620_DMA_FIELD_READ(MT3620_UART_DMA_RX(handle->id), ffsta, empty));
 
-            MT3620_DMA_FIELD_WRITE(MT3620_UART_DMA_RX(handle->id), start, str, false);
-
             uintptr_t avail = rx_dma->ffcnt;
             uintptr_t chunk = (avail >= size ? size : avail);
 
+            // Writing swptr back hands the space over to the DMA again.
+            uint32_t swptr = rx_dma->swptr;
             uintptr_t i;
             for (i = 0; i < chunk; i++) {
-                ((uint8_t *)data)[i] = UART_BuffRX[handle->id][rx_dma->swptr++];
-#if (RX_BUFFER_SIZE < 65536)
-                // When the buffer isn't exactly 16-bits we need to handle the wrap bit.
-                if ((rx_dma->swptr & 0xFFFF) > RX_BUFFER_SIZE) {
-                    rx_dma->swptr &= 0xFFFF0000;
-                    rx_dma->swptr ^= 0x00010000;
-                }
-#endif
+                ((uint8_t *)data)[i] = UART_BuffRX[handle->id][swptr & 0xFFFF];
+                swptr = UART_DMAPointerAdvance(swptr, RX_BUFFER_SIZE);
             }
-
-            MT3620_DMA_FIELD_WRITE(MT3620_UART_DMA_RX(handle->id), start, str, true);
+            rx_dma->swptr = swptr;
 
             data = (void *)((uintptr_t)data + chunk);
             size -= chunk;
@@ -414,13 +511,17 @@ uintptr_t UART_ReadAvailable(UART *handle)
 
 static void UART_HandleIRQ(Platform_Unit unit)
 {
+    TRACE_ENTER(TRACE_PROBE_UART_IRQ, unit);
+
     unsigned id = UART_UnitToID(unit);
     if (id >= MT3620_UART_COUNT) {
+        TRACE_EXIT(TRACE_PROBE_UART_IRQ, unit);
         return;
     }
 
     UART *handle = &context[id];
     if (!handle->open) {
+        TRACE_EXIT(TRACE_PROBE_UART_IRQ, unit);
         return;
     }
 
@@ -438,13 +539,13 @@ static void UART_HandleIRQ(Platform_Unit unit)
             uint32_t remain = MT3620_UART_TX_FIFO_DEPTH - offset;
 
             uint32_t i;
-            for (i = 0; (i < remain) && (handle->txRemain < TX_BUFFER_SIZE); i++, handle->txRemain++) {
-                mt3620_uart[id]->thr = UART_BuffTX[id][handle->txRead++];
-                handle->txRead %= TX_BUFFER_SIZE;
+            for (i = 0; (i < remain) && (handle->txRemain < handle->txSize); i++, handle->txRemain++) {
+                mt3620_uart[id]->thr = handle->txBuff[handle->txRead++];
+                handle->txRead &= (handle->txSize - 1);
             }
 
             // If sent all enqueued data then disable TX interrupt.
-            if (handle->txRemain == TX_BUFFER_SIZE) {
+            if (handle->txRemain == handle->txSize) {
                 // Interrupt Enable Register
                 MT3620_UART_FIELD_WRITE(handle->id, ier, etbei, false);
             }
@@ -454,11 +555,18 @@ static void UART_HandleIRQ(Platform_Unit unit)
         // has occurred, meaning there is unread data still in the FIFO.
         case MT3620_UART_IIR_ID_RX_DATA_TIMEOUT:
         case MT3620_UART_IIR_ID_RX_DATA_RECEIVED:
-            if (!handle->dma) {
-                for (; (handle->rxRemain > 0) && MT3620_UART_FIELD_READ(handle->id, lsr, dr); handle->rxRemain--) {
-                    UART_BuffRX[id][handle->rxWrite++] = MT3620_UART_FIELD_READ(handle->id, rbr, rbr);
-                    handle->rxWrite %= RX_BUFFER_SIZE;
+            // In DMA mode data is already in the buffer, the DMA interrupt reports
+            // it filling up and the timeout reports the line going idle.
+            if (handle->dma) {
+                if ((iirId == MT3620_UART_IIR_ID_RX_DATA_TIMEOUT) && handle->idleCallback) {
+                    handle->idleCallback();
                 }
+                break;
+            }
+
+            for (; (handle->rxRemain > 0) && MT3620_UART_FIELD_READ(handle->id, lsr, dr); handle->rxRemain--) {
+                UART_BuffRX[id][handle->rxWrite++] = MT3620_UART_FIELD_READ(handle->id, rbr, rbr);
+                handle->rxWrite %= RX_BUFFER_SIZE;
             }
 
             if (handle->rxCallback) {
@@ -471,6 +579,24 @@ static void UART_HandleIRQ(Platform_Unit unit)
             break;
         } // switch (iirId) {
     } while (iirId != MT3620_UART_IIR_ID_NO_INTERRUPT_PENDING);
+
+    TRACE_EXIT(TRACE_PROBE_UART_IRQ, unit);
+}
+
+static void UART_HandleDMAIRQ(Platform_Unit unit)
+{
+    unsigned id = UART_UnitToID(unit);
+    if (id >= MT3620_UART_COUNT) {
+        return;
+    }
+
+    UART *handle = &context[id];
+
+    MT3620_DMA_FIELD_WRITE(MT3620_UART_DMA_RX(id), ackint, ack, 1);
+
+    if (handle->open && handle->dma && handle->rxCallback) {
+        handle->rxCallback();
+    }
 }
 
 void uart_irq_b(void)        { UART_HandleIRQ(MT3620_UNIT_UART_DEBUG); }
@@ -480,3 +606,10 @@ void isu_g2_uart_irq_b(void) { UART_HandleIRQ(MT3620_UNIT_ISU2      ); }
 void isu_g3_uart_irq_b(void) { UART_HandleIRQ(MT3620_UNIT_ISU3      ); }
 void isu_g4_uart_irq_b(void) { UART_HandleIRQ(MT3620_UNIT_ISU4      ); }
 void isu_g5_uart_irq_b(void) { UART_HandleIRQ(MT3620_UNIT_ISU5      ); }
+
+void m4dma_irq_b_isu0_uart_rx(void) { UART_HandleDMAIRQ(MT3620_UNIT_ISU0); }
+void m4dma_irq_b_isu1_uart_rx(void) { UART_HandleDMAIRQ(MT3620_UNIT_ISU1); }
+void m4dma_irq_b_isu2_uart_rx(void) { UART_HandleDMAIRQ(MT3620_UNIT_ISU2); }
+void m4dma_irq_b_isu3_uart_rx(void) { UART_HandleDMAIRQ(MT3620_UNIT_ISU3); }
+void m4dma_irq_b_isu4_uart_rx(void) { UART_HandleDMAIRQ(MT3620_UNIT_ISU4); }
+void m4dma_irq_b_isu5_uart_rx(void) { UART_HandleDMAIRQ(MT3620_UNIT_ISU5); }
@@ -51,6 +51,31 @@ UART *UART_Open(
     unsigned      stopBits,
     void         (*rxCallback)(void));
 
+/// <summary>
+/// <para>Same as <see cref="UART_Open" />, but data is moved between the UART and its buffers
+/// by DMA, rather than by an interrupt each time a 16-byte hardware FIFO reaches its threshold.
+/// Not available on the debug UART.</para>
+/// <para>RX runs as a circular DMA buffer. rxCallback is invoked when it becomes half full,
+/// and idleCallback once no character has been received for idleChars character times, so
+/// shorter bursts should be collected from idleCallback.</para>
+/// </summary>
+/// <param name="unit">Which UART to initialize, an ISU.</param>
+/// <param name="baud">Target baud rate.</param>
+/// <param name="parity">Parity mode: <see cref="UART_Parity" />.</param>
+/// <param name="stopBits">Number of stop bits, only 1 or 2 are valid.</param>
+/// <param name="rxCallback">An optional callback to invoke when the RX buffer is half full.</param>
+/// <param name="idleChars">Idle time, in character times (1 to 63), after which idleCallback
+/// is invoked.</param>
+/// <param name="idleCallback">An optional callback to invoke when the RX line goes idle.</param>
+UART *UART_OpenDMA(
+    Platform_Unit unit,
+    unsigned      baud,
+    UART_Parity   parity,
+    unsigned      stopBits,
+    void         (*rxCallback)(void),
+    unsigned      idleChars,
+    void         (*idleCallback)(void));
+
 /// <summary>
 /// <para>Releases a handle once it's finished using a given UART interface. 
 /// Once released the handle is free to be opened again.</para>
@@ -72,6 +97,25 @@ void UART_Close(UART *handle);
 /// <returns>ERROR_NONE on success, or an error code.</returns>
 int32_t UART_Write(UART *handle, const void *data, uintptr_t size);
 
+/// <summary>
+/// <para>Makes UART_Write queue into the supplied buffer, e.g. a larger one in TCM, and never
+/// wait for room: a write that doesn't fit in whole is dropped and counted, while the TX
+/// interrupt drains the buffer in the background. Meant for debug output, so printing can't
+/// stall the caller at the speed of the UART. Not supported in DMA mode.</para>
+/// </summary>
+/// <param name="handle">Which UART to defer writes of.</param>
+/// <param name="buffer">TX buffer, owned by the UART until it's closed.</param>
+/// <param name="size">Size of the buffer in bytes, a power of two up to 65536.</param>
+/// <returns>ERROR_NONE on success, or an error code.</returns>
+int32_t UART_SetTxDeferred(UART *handle, uint8_t *buffer, uintptr_t size);
+
+/// <summary>
+/// <para>Bytes dropped by UART_Write in deferred mode since the UART was opened.</para>
+/// </summary>
+/// <param name="handle">The UART to be queried.</param>
+/// <returns>Number of bytes dropped.</returns>
+uint32_t UART_GetTxDropped(UART *handle);
+
 /// <summary>
 /// This function checks if the UART's hardware TX buffer is actually empty.
 /// </summary>
@@ -117,11 +117,23 @@ void __attribute__((weak, alias("DefaultExceptionHandler"))) m4dma_irq_b_i2s0_tx
 void __attribute__((weak, alias("DefaultExceptionHandler"))) m4dma_irq_b_i2s0_rx(void);
 void __attribute__((weak, alias("DefaultExceptionHandler"))) m4dma_irq_b_i2s1_tx(void);
 void __attribute__((weak, alias("DefaultExceptionHandler"))) m4dma_irq_b_i2s1_rx(void);
+void __attribute__((weak, alias("DefaultExceptionHandler"))) m4dma_irq_b_isu0_uart_rx(void);
+void __attribute__((weak, alias("DefaultExceptionHandler"))) m4dma_irq_b_isu1_uart_rx(void);
+void __attribute__((weak, alias("DefaultExceptionHandler"))) m4dma_irq_b_isu2_uart_rx(void);
+void __attribute__((weak, alias("DefaultExceptionHandler"))) m4dma_irq_b_isu3_uart_rx(void);
+void __attribute__((weak, alias("DefaultExceptionHandler"))) m4dma_irq_b_isu4_uart_rx(void);
+void __attribute__((weak, alias("DefaultExceptionHandler"))) m4dma_irq_b_isu5_uart_rx(void);
 
 // DMA can interrupt many drivers, so we handle that here.
 static void m4dma_irq_b(void)
 {
     static void (*m4dma_irq_b_isr[MT3620_DMA_COUNT])(void) = {
+        [14] = m4dma_irq_b_isu0_uart_rx,
+        [16] = m4dma_irq_b_isu1_uart_rx,
+        [18] = m4dma_irq_b_isu2_uart_rx,
+        [20] = m4dma_irq_b_isu3_uart_rx,
+        [22] = m4dma_irq_b_isu4_uart_rx,
+        [24] = m4dma_irq_b_isu5_uart_rx,
         [25] = m4dma_irq_b_i2s0_tx,
         [26] = m4dma_irq_b_i2s0_rx,
         [27] = m4dma_irq_b_i2s1_tx,
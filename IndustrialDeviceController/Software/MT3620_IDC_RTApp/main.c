@@ -26,9 +26,16 @@
 #include "lib/UART.h"
 #include "lib/Print.h"
 #include "lib/GPT.h"
+#include "lib/Trace.h"
 
+#include "Scheduler.h"
 #include "Socket.h"
+#include "AdcStream.h"
+#include "AudioFeatures.h"
+#include "PulseCounter.h"
+#include "ModbusSlaveSim.h"
 #include "ipc.h"
+#include "crc16.h"
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) > (b) ? (b) : (a))
@@ -46,23 +53,76 @@ static const Component_Id A7ID =
 
 // Drivers
 static UART *debug = NULL;
+// debug output queued here in TCM and drained by the UART TX interrupt, so
+// printing never holds up message handling at 115200 baud
+static uint8_t debugTx[4096];
+static uint32_t debugDropped = 0;
 static UART *modbus = NULL;
 
 static Socket *socket = NULL;
-static uint8_t msg[sizeof(ipc_request_message_t) + MB_RTU_MAX_ADU_SIZE];
+static uint8_t msg[IPC_MAX_MESSAGE_SIZE];
 
 static uint8_t modbus_frame[MB_RTU_MAX_ADU_SIZE];
 static uint16_t size = 0;
 
-// Callbacks
-typedef struct CallbackNode {
-    bool enqueued;
-    struct CallbackNode *next;
-    void *data;
-    void (*cb)(void*);
-} CallbackNode;
+// Modbus exchange executed on behalf of A7 with IPC_MODBUS_TRANSACT, only one
+// at a time. GPT3 times T3.5 silence which end the response frame, GPT0 times
+// the wait for first byte of response.
+typedef struct ModbusTransaction {
+    bool active;
+    bool receiving;
+    uint32_t seq_num;
+    uint8_t slave_id;
+} ModbusTransaction;
+
+static ModbusTransaction transaction = {.active = false};
+static uint32_t t35_us = 1750;
+static GPT *t35Timer = NULL;
+static GPT *responseTimer = NULL;
+static GPT *latencyTimer = NULL;
+// transaction the timer fired for, as deferred callback may run after a new
+// transaction been started
+static volatile uint32_t t35FiredSeq = 0;
+static volatile uint32_t responseFiredSeq = 0;
+static uint8_t transactMsg[sizeof(ipc_transact_response_message_t) + MB_RTU_MAX_ADU_SIZE];
+
+// UART bytes received outside IPC_MODBUS_TRANSACT are coalesced and sent to A7
+// in one message once rxMaxSize bytes are in, or rxMaxLatency us after the
+// first of them. GPT3 times the latency, it is idle outside transactions
+#define RX_DEFAULT_MAX_LATENCY_US 2000
+#define RX_DEFAULT_MAX_SIZE MB_RTU_MAX_ADU_SIZE
+
+static uint8_t rxMsg[IPC_MAX_MESSAGE_SIZE];
+static uint32_t rxSize = 0;
+static uint32_t rxMaxLatency = RX_DEFAULT_MAX_LATENCY_US;
+static uint32_t rxMaxSize = RX_DEFAULT_MAX_SIZE;
+
+// IPC_BATCH being executed, responses of its commands are collected and sent
+// back in one message when all done
+typedef struct IpcBatch {
+    bool active;
+    // runBatch() on the stack, don't reenter
+    bool running;
+    uint32_t seq_num;
+    uint32_t length;
+    // next command in batchReq
+    uint32_t offset;
+    // bytes of responses in batchResp after the batch response header
+    uint32_t respLength;
+} IpcBatch;
+
+static IpcBatch batch = {.active = false};
+static uint8_t batchReq[IPC_MAX_MESSAGE_SIZE];
+static uint8_t batchResp[IPC_MAX_MESSAGE_SIZE];
+
+// blocks sent since IPC_ADC_START
+static uint32_t adcBlockSeq = 0;
+// feature vectors sent since IPC_AUDIO_START
+static uint32_t audioVectorSeq = 0;
+
+static void runBatch(void);
+static void startBatch(uint32_t seq_num, const uint8_t *data, uint32_t length);
 
-static void EnqueueCallback(CallbackNode *node);
 static void HandleUartIsu0RxIrq(void);
 
 // Msg callbacks
@@ -100,184 +160,833 @@ static uint32_t dserialize_uint32(uint8_t* data)
     return data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
 }
 
+// Send message to A7, or add it to batch response if a batch is running.
+// Responses go on the control channel, ahead of any queued UART bytes
+static int32_t ipcSendMsg(const uint8_t *data, uint32_t length)
+{
+    if (!batch.active) {
+        return Socket_Send(socket, &A7ID, SOCKET_PRIORITY_CONTROL, data, length);
+    }
+
+    uint32_t offset = sizeof(ipc_batch_response_message_t) + batch.respLength;
+    if (offset + length > IPC_MAX_MESSAGE_SIZE) {
+        return ERROR_SOCKET_INSUFFICIENT_SPACE;
+    }
+
+    for (uint32_t i = 0; i < length; i++) {
+        batchResp[offset + i] = data[i];
+    }
+    batch.respLength += length;
+    return ERROR_NONE;
+}
+
 // Send response message back to the application on A7.
 static void ipcSendResponseMsg(ipc_command_type_t command, uint32_t seq_num, err_code code)
 {
-    serialize_uint32(msg, command);
-    serialize_uint32(msg + 4, seq_num);
-    serialize_uint32(msg + 8, code);
+    uint8_t resp[sizeof(ipc_response_message_t)];
+    serialize_uint32(resp, command);
+    serialize_uint32(resp + 4, seq_num);
+    serialize_uint32(resp + 8, code);
 
-    int32_t error = Socket_Write(socket, &A7ID, msg, sizeof(ipc_response_message_t));
+    int32_t error = ipcSendMsg(resp, sizeof(resp));
     if (error != ERROR_NONE) {
         UART_Printf(debug, "ERROR: sending code %d for command %ld with seq_num %d- %ld\r\n", command, seq_num, code, error);
     }
 }
 
-static void handleRecvMsg(void *handle)
+// T3.5 in us, spec fix it at 1750us above 19200 baud
+static uint32_t calcT35(uint32_t baudRate, uint8_t parity, uint8_t stopBits)
 {
-    Socket *socket = (Socket*)handle;
+    if (baudRate > 19200) {
+        return 1750;
+    }
 
-    Component_Id senderId;
-    ipc_request_message_t request;
-    uint32_t msg_size = sizeof(msg);
+    // 1 start bit + 8 data bits + parity + stop bits
+    uint32_t bitsPerChar = 1 + 8 + (parity == UART_PARITY_NONE ? 0 : 1) + stopBits;
+    return (3500000 * bitsPerChar + baudRate - 1) / baudRate;
+}
 
-    if (Socket_NegotiationPending(socket)) {
-        UART_Printf(debug, "Negotiation pending, attempting renegotiation\n");
-        // NB: this is blocking, if you want to protect against hanging,
-        //     add a timeout
-        if (Socket_Negotiate(socket) != ERROR_NONE) {
-            UART_Printf(debug, "ERROR: renegotiating socket connection\n");
-        }
+// Write frame to modbus UART and wait until last stop bit been sent
+static int32_t modbusWriteFrame(const uint8_t *frame, uintptr_t length)
+{
+    int32_t result = UART_Write(modbus, frame, length);
+    if (ERROR_NONE != result) {
+        return result;
     }
 
-    int32_t error = Socket_Read(socket, &senderId, &msg, &msg_size);
+    // Wait for the UART's hardware TX buffer to empty
+    uint32_t retries = 0xFFFF;
+    while (retries && !UART_IsWriteComplete(modbus)) retries--;
+
+    if (retries == 0) {
+        return ERROR_TIMEOUT;
+    }
+
+    // This is fine-tuned with a scope to achieve a minimal delay,
+    // so to fully include the STOP bit after the TX of the last byte
+    for (int i = 300; i > 0; i--) __asm__("nop");
+    return ERROR_NONE;
+}
+
+// Send coalesced UART bytes to A7 as bulk data behind any responses, they are
+// kept for the next try if the socket is full
+static void flushRx(void)
+{
+    GPT_Stop(t35Timer);
+    if (rxSize == 0) {
+        return;
+    }
+
+    int32_t error = Socket_Send(socket, &A7ID, SOCKET_PRIORITY_BULK, rxMsg, rxSize);
     if (error != ERROR_NONE) {
-        UART_Printf(debug, "ERROR: receiving msg %s - %ld\r\n", msg, error);
+        UART_Printf(debug, "ERROR: sending %ld bytes to A7 with error code %ld\r\n", rxSize, error);
         return;
     }
+    rxSize = 0;
+}
+
+static void HandleRxLatencyExpiredDeferred(void *data)
+{
+    // ignore if bytes been sent on size, or a transaction took the timer, since it fired
+    if (!transaction.active && !GPT_IsEnabled(t35Timer)) {
+        flushRx();
+    }
+}
 
-    request.command = dserialize_uint32(msg);
-    request.seq_num = dserialize_uint32(msg + 4);
-    request.length = dserialize_uint32(msg + 8);
+static void HandleRxLatencyExpired(GPT *timer)
+{
+    static Scheduler_Task task = SCHEDULER_TASK(HandleRxLatencyExpiredDeferred, SCHEDULER_PRIORITY_NORMAL, 0);
+    Scheduler_Post(&task);
+}
 
-    UART_Printf(debug, "Message received: command %d seq_num %ld length %ld\r\nSender: ",
-        request.command, request.seq_num, request.length);
-    printComponentId(&senderId);
+// Send result of current transaction back to A7 and make link idle again
+static void finishTransaction(err_code code, const uint8_t *pdu, uint32_t length)
+{
+    GPT_Stop(t35Timer);
+    GPT_Stop(responseTimer);
+
+    serialize_uint32(transactMsg, IPC_MODBUS_TRANSACT);
+    serialize_uint32(transactMsg + 4, transaction.seq_num);
+    serialize_uint32(transactMsg + 8, code);
+    serialize_uint32(transactMsg + 12, length);
+    for (uint32_t i = 0; i < length; i++) {
+        transactMsg[16 + i] = pdu[i];
+    }
+
+    int32_t error = ipcSendMsg(transactMsg, sizeof(ipc_transact_response_message_t) + length);
+    if (error != ERROR_NONE) {
+        UART_Printf(debug, "ERROR: sending transaction %ld result %d - %ld\r\n", transaction.seq_num, code, error);
+    }
+
+    transaction.active = false;
+    transaction.receiving = false;
+    size = 0;
+
+    // continue batch this transaction belongs to, or stop it on failure
+    if (batch.active) {
+        if (code != DEVICE_OK) {
+            batch.offset = batch.length;
+        }
+        if (!batch.running) {
+            runBatch();
+        }
+    }
+}
+
+// Response frame ended by T3.5 silence or full buffer, validate and return pdu
+static void completeTransaction(void)
+{
+    // 1 byte slave id + at least 1 byte pdu + 2 bytes crc
+    if (size < 4) {
+        finishTransaction(DEVICE_E_PROTOCOL, NULL, 0);
+    } else if (!crc16_check_frame(modbus_frame, size)) {
+        UART_Print(debug, "ERROR: CRC error on modbus response\r\n");
+        finishTransaction(DEVICE_E_PROTOCOL, NULL, 0);
+    } else if (modbus_frame[0] != transaction.slave_id) {
+        UART_Printf(debug, "ERROR: response from slave %d, expected %d\r\n", modbus_frame[0], transaction.slave_id);
+        finishTransaction(DEVICE_E_PROTOCOL, NULL, 0);
+    } else {
+        finishTransaction(DEVICE_OK, modbus_frame + 1, size - 3);
+    }
+}
+
+static void HandleT35ExpiredDeferred(void *data)
+{
+    // ignore if timer been restarted by more bytes since it fired
+    if (transaction.active && transaction.receiving && (t35FiredSeq == transaction.seq_num) &&
+        !GPT_IsEnabled(t35Timer)) {
+        completeTransaction();
+    }
+}
+
+static void HandleT35Expired(GPT *timer)
+{
+    static Scheduler_Task task = SCHEDULER_TASK(HandleT35ExpiredDeferred, SCHEDULER_PRIORITY_NORMAL, 0);
+    t35FiredSeq = transaction.seq_num;
+    Scheduler_Post(&task);
+}
+
+static void HandleResponseTimeoutDeferred(void *data)
+{
+    if (transaction.active && !transaction.receiving && (responseFiredSeq == transaction.seq_num)) {
+        finishTransaction(DEVICE_E_TIMEOUT, NULL, 0);
+    }
+}
+
+static void HandleResponseTimeout(GPT *timer)
+{
+    static Scheduler_Task task = SCHEDULER_TASK(HandleResponseTimeoutDeferred, SCHEDULER_PRIORITY_NORMAL, 0);
+    responseFiredSeq = transaction.seq_num;
+    Scheduler_Post(&task);
+}
+
+// Start a modbus exchange, data is 4 bytes timeout in ms followed by slave id and pdu
+static void startTransaction(uint32_t seq_num, const uint8_t *data, uint32_t length)
+{
+    // bytes received before it still go to A7, the timer is the transaction's now
+    flushRx();
+
+    // previous transaction abandoned by A7, e.g. it timed out earlier
+    if (transaction.active) {
+        GPT_Stop(t35Timer);
+        GPT_Stop(responseTimer);
+    }
+
+    transaction.active = true;
+    transaction.receiving = false;
+    transaction.seq_num = seq_num;
+
+    // 4 bytes timeout + 1 byte slave id + at least 1 byte pdu, room for crc
+    if ((modbus == NULL) || (length < 6) || (length - 4 + 2 > MB_RTU_MAX_ADU_SIZE)) {
+        finishTransaction(modbus == NULL ? DEVICE_E_INVALID : DEVICE_E_PROTOCOL, NULL, 0);
+        return;
+    }
+
+    uint32_t timeout_ms = dserialize_uint32((uint8_t *)data);
+    uint32_t adu_len = length - 4;
+    uint8_t adu[MB_RTU_MAX_ADU_SIZE];
+    for (uint32_t i = 0; i < adu_len; i++) {
+        adu[i] = data[4 + i];
+    }
+    transaction.slave_id = adu[0];
+
+    uint16_t crc = crc16(adu, adu_len);
+    adu[adu_len++] = crc & 0xFF;
+    adu[adu_len++] = (crc >> 8) & 0xFF;
+
+    // drop garbage left on link, e.g. late response of abandoned transaction
+    uintptr_t avail;
+    while ((avail = UART_ReadAvailable(modbus)) > 0) {
+        UART_Read(modbus, modbus_frame, MIN(avail, MB_RTU_MAX_ADU_SIZE));
+    }
+    size = 0;
+
+    int32_t result = modbusWriteFrame(adu, adu_len);
+    if (result != ERROR_NONE) {
+        finishTransaction(result == ERROR_TIMEOUT ? DEVICE_E_TIMEOUT : DEVICE_E_IO, NULL, 0);
+        return;
+    }
+
+    if (GPT_StartTimeout(responseTimer, timeout_ms, GPT_UNITS_MILLISEC, HandleResponseTimeout) != ERROR_NONE) {
+        finishTransaction(DEVICE_E_INTERNAL, NULL, 0);
+    }
+}
+
+// Send a full block of ADC samples, on the bulk channel so it never holds up
+// command responses
+static bool sendAdcBlock(const uint16_t *samples, uint32_t count, uint32_t dropped)
+{
+    static uint8_t adcMsg[sizeof(ipc_adc_block_message_t) + (ADC_STREAM_MAX_BLOCK_SAMPLES * 2)];
+
+    serialize_uint32(adcMsg, IPC_ADC_BLOCK);
+    serialize_uint32(adcMsg + 4, ++adcBlockSeq);
+    serialize_uint32(adcMsg + 8, DEVICE_OK);
+    serialize_uint32(adcMsg + 12, dropped);
+    serialize_uint32(adcMsg + 16, count * 2);
+
+    uint8_t *p = adcMsg + sizeof(ipc_adc_block_message_t);
+    for (uint32_t i = 0; i < count; i++) {
+        *p++ = samples[i];
+        *p++ = samples[i] >> 8;
+    }
+
+    return Socket_Send(socket, &A7ID, SOCKET_PRIORITY_BULK, adcMsg, p - adcMsg) == ERROR_NONE;
+}
+
+static err_code startAdcStream(const uint8_t *data, uint32_t length)
+{
+    if (length < IPC_ADC_START_SIZE) {
+        return DEVICE_E_PROTOCOL;
+    }
+
+    AdcStream_Config config = {
+        .frequency        = dserialize_uint32((uint8_t *)data),
+        .channelMask      = data[4] | (data[5] << 8),
+        .decimation       = data[6] | (data[7] << 8),
+        .referenceVoltage = data[8] | (data[9] << 8),
+        .blockSamples     = data[10] | (data[11] << 8),
+    };
+
+    adcBlockSeq = 0;
+    int32_t error = AdcStream_Start(&config, sendAdcBlock);
+    if (error != ERROR_NONE) {
+        UART_Printf(debug, "ERROR: starting adc stream - %ld\r\n", error);
+    }
+
+    switch (error) {
+        case ERROR_NONE:
+            return DEVICE_OK;
+        case ERROR_BUSY:
+            return DEVICE_E_BUSY;
+        case ERROR_UNSUPPORTED:
+            return DEVICE_E_IO;
+        default:
+            return DEVICE_E_CONFIG;
+    }
+}
+
+// Send a feature vector of I2S input, on the bulk channel like ADC blocks
+static bool sendAudioFeatures(const float *features, uint32_t count, uint32_t dropped)
+{
+    static uint8_t audioMsg[sizeof(ipc_audio_features_message_t) + ((2 + AUDIO_FEATURES_MAX_BANDS) * 4)];
+
+    serialize_uint32(audioMsg, IPC_AUDIO_FEATURES);
+    serialize_uint32(audioMsg + 4, ++audioVectorSeq);
+    serialize_uint32(audioMsg + 8, DEVICE_OK);
+    serialize_uint32(audioMsg + 12, dropped);
+    serialize_uint32(audioMsg + 16, count * 4);
+
+    uint8_t *p = audioMsg + sizeof(ipc_audio_features_message_t);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t bits;
+        __builtin_memcpy(&bits, &features[i], sizeof(bits));
+        p = serialize_uint32(p, bits);
+    }
+
+    return Socket_Send(socket, &A7ID, SOCKET_PRIORITY_BULK, audioMsg, p - audioMsg) == ERROR_NONE;
+}
+
+static err_code startAudioFeatures(const uint8_t *data, uint32_t length)
+{
+    if (length < IPC_AUDIO_START_SIZE) {
+        return DEVICE_E_PROTOCOL;
+    }
+
+    AudioFeatures_Config config = {
+        .rate            = dserialize_uint32((uint8_t *)data),
+        .framesPerVector = data[4] | (data[5] << 8),
+        .bands           = data[6] | (data[7] << 8),
+    };
+
+    audioVectorSeq = 0;
+    int32_t error = AudioFeatures_Start(&config, sendAudioFeatures);
+    if (error != ERROR_NONE) {
+        UART_Printf(debug, "ERROR: starting audio features - %ld\r\n", error);
+    }
+
+    switch (error) {
+        case ERROR_NONE:
+            return DEVICE_OK;
+        case ERROR_BUSY:
+            return DEVICE_E_BUSY;
+        default:
+            return DEVICE_E_CONFIG;
+    }
+}
+
+static err_code startPulseCounter(const uint8_t *data, uint32_t length)
+{
+    if (length < IPC_PULSE_START_SIZE) {
+        return DEVICE_E_PROTOCOL;
+    }
+
+    PulseCounter_Config config = {
+        .pinMask  = dserialize_uint32((uint8_t *)data),
+        .gateMs   = data[4] | (data[5] << 8),
+        .debounce = data[6],
+    };
+
+    int32_t error = PulseCounter_Start(&config, latencyTimer);
+    if (error != ERROR_NONE) {
+        UART_Printf(debug, "ERROR: starting pulse counter - %ld\r\n", error);
+    }
+
+    switch (error) {
+        case ERROR_NONE:
+            return DEVICE_OK;
+        case ERROR_BUSY:
+            return DEVICE_E_BUSY;
+        case ERROR_UNSUPPORTED:
+            return DEVICE_E_IO;
+        default:
+            return DEVICE_E_CONFIG;
+    }
+}
+
+// Send the counter of every counted pin
+static void sendPulseReadings(uint32_t seq_num)
+{
+    static uint8_t pulseMsg[sizeof(ipc_pulse_response_message_t) + (PULSE_COUNTER_MAX_PINS * IPC_PULSE_READING_SIZE)];
+    static PulseCounter_Reading readings[PULSE_COUNTER_MAX_PINS];
+
+    uintptr_t count = PulseCounter_Read(readings, PULSE_COUNTER_MAX_PINS);
+
+    serialize_uint32(pulseMsg, IPC_PULSE_READ);
+    serialize_uint32(pulseMsg + 4, seq_num);
+    serialize_uint32(pulseMsg + 8, PulseCounter_Running() ? DEVICE_OK : DEVICE_E_INVALID);
+    serialize_uint32(pulseMsg + 12, count * IPC_PULSE_READING_SIZE);
+
+    uint8_t *p = pulseMsg + sizeof(ipc_pulse_response_message_t);
+    for (uintptr_t i = 0; i < count; i++) {
+        p = serialize_uint32(p, readings[i].pin);
+        p = serialize_uint32(p, readings[i].count);
+        p = serialize_uint32(p, readings[i].frequencyMilliHz);
+    }
+
+    int32_t error = ipcSendMsg(pulseMsg, p - pulseMsg);
+    if (error != ERROR_NONE) {
+        UART_Printf(debug, "ERROR: sending pulse readings - %ld\r\n", error);
+    }
+}
 
+// Send trace events recorded since the last dump, as many as fit one message
+static void sendTraceDump(uint32_t seq_num)
+{
+    static uint32_t cursor = 0;
+    static uint8_t traceMsg[IPC_MAX_MESSAGE_SIZE];
+    static Trace_Entry events[(IPC_MAX_MESSAGE_SIZE - sizeof(ipc_trace_response_message_t)) / IPC_TRACE_EVENT_SIZE];
+
+    uint32_t lost = 0;
+    uintptr_t count = Trace_Read(&cursor, events, sizeof(events) / sizeof(events[0]), &lost);
+
+    serialize_uint32(traceMsg, IPC_TRACE_DUMP);
+    serialize_uint32(traceMsg + 4, seq_num);
+    serialize_uint32(traceMsg + 8, Trace_GetTickRate() ? DEVICE_OK : DEVICE_E_CONFIG);
+    serialize_uint32(traceMsg + 12, Trace_GetTickRate());
+    serialize_uint32(traceMsg + 16, lost);
+    serialize_uint32(traceMsg + 20, count * IPC_TRACE_EVENT_SIZE);
+
+    uint8_t *p = traceMsg + sizeof(ipc_trace_response_message_t);
+    for (uintptr_t i = 0; i < count; i++, p += IPC_TRACE_EVENT_SIZE) {
+        serialize_uint32(p, events[i].time);
+        p[4] = events[i].seq;
+        p[5] = events[i].seq >> 8;
+        p[6] = events[i].probe;
+        p[7] = events[i].arg;
+    }
+
+    int32_t error = ipcSendMsg(traceMsg, p - traceMsg);
+    if (error != ERROR_NONE) {
+        UART_Printf(debug, "ERROR: sending trace dump - %ld\r\n", error);
+    }
+}
+
+// Execute one command, either received alone or as part of a batch
+static err_code startModbusSlaveSim(const uint8_t *data, uint32_t length)
+{
+    if (length < IPC_MODBUS_SIM_START_SIZE) {
+        return DEVICE_E_PROTOCOL;
+    }
+
+    uint8_t *p = (uint8_t *)data;
+    modbus_sim_config_t config = {
+        .first_id       = p[0],
+        .num_slaves     = p[1],
+        .num_registers  = p[2] | (p[3] << 8),
+        .latency_min_us = dserialize_uint32(p + 4),
+        .latency_max_us = dserialize_uint32(p + 8),
+        .slow_ppm       = dserialize_uint32(p + 12),
+        .slow_us        = dserialize_uint32(p + 16),
+        .exception_ppm  = dserialize_uint32(p + 20),
+        .timeout_ppm    = dserialize_uint32(p + 24),
+        .change_ms      = dserialize_uint32(p + 28),
+        .change_ppm     = dserialize_uint32(p + 32),
+        .seed           = dserialize_uint32(p + 36),
+    };
+
+    int32_t error = ModbusSlaveSim_Start(&config, dserialize_uint32(p + 40), p[44], p[45], latencyTimer);
+    if (error != ERROR_NONE) {
+        UART_Printf(debug, "ERROR: starting modbus slave simulator - %ld\r\n", error);
+    }
+
+    switch (error) {
+        case ERROR_NONE:
+            return DEVICE_OK;
+        case ERROR_BUSY:
+            return DEVICE_E_BUSY;
+        case ERROR_UNSUPPORTED:
+            return DEVICE_E_IO;
+        default:
+            return DEVICE_E_CONFIG;
+    }
+}
+
+static void handleCommand(ipc_command_type_t command, uint32_t seq_num, const uint8_t *data, uint32_t length)
+{
     int32_t result;
     uint32_t baudRate;
     uint8_t parity, stopBits;
-    switch (request.command) {
+    switch (command) {
         case IPC_OPEN_UART:
-            baudRate = dserialize_uint32(msg + 12);
-            parity = msg[16];
-            stopBits = msg[17];
+            baudRate = dserialize_uint32((uint8_t *)data);
+            parity = data[4];
+            stopBits = data[5];
             if (modbus != NULL) {
                 UART_Close(modbus);
                 modbus = NULL;
             }
 
+            GPT_Stop(t35Timer);
+            rxSize = 0;
+            rxMaxLatency = RX_DEFAULT_MAX_LATENCY_US;
+            rxMaxSize = RX_DEFAULT_MAX_SIZE;
+            if (length >= IPC_OPEN_UART_COALESCE_SIZE) {
+                rxMaxLatency = dserialize_uint32((uint8_t *)data + 6);
+                rxMaxSize = data[10] | (data[11] << 8);
+                if ((rxMaxSize == 0) || (rxMaxSize > sizeof(rxMsg))) {
+                    rxMaxSize = sizeof(rxMsg);
+                }
+            }
+
             modbus = UART_Open(MT3620_UNIT_ISU0, baudRate, parity, stopBits, HandleUartIsu0RxIrq);
-            ipcSendResponseMsg(IPC_OPEN_UART, request.seq_num,
+            t35_us = calcT35(baudRate, parity, stopBits);
+            ipcSendResponseMsg(IPC_OPEN_UART, seq_num,
                 modbus != NULL ? DEVICE_OK : DEVICE_E_IO);
             break;
 
         case IPC_CLOSE_UART:
+            if (transaction.active) {
+                finishTransaction(DEVICE_E_IO, NULL, 0);
+            }
+            flushRx();
             if (modbus != NULL) {
                 UART_Close(modbus);
                 modbus = NULL;
             }
-            ipcSendResponseMsg(IPC_CLOSE_UART, request.seq_num, DEVICE_OK);
+            ipcSendResponseMsg(IPC_CLOSE_UART, seq_num, DEVICE_OK);
             break;
 
         case IPC_WRITE_UART:
-            result = UART_Write(modbus, msg + 12, request.length);
-            if (ERROR_NONE == result)
-            {
-                // Wait for the UART's hardware TX buffer to empty
-                uint32_t retries = 0xFFFF;
-                while (retries && !UART_IsWriteComplete(modbus)) retries--;
-
-                if (retries == 0)
-                {
-                    result = ERROR_TIMEOUT;
-                }
-                else
-                {
-                    // This is fine-tuned with a scope to achieve a minimal delay,
-                    // so to fully include the STOP bit after the TX of the last byte
-                    for (int i = 300; i > 0; i--) __asm__("nop");
-                }
-                ipcSendResponseMsg(IPC_WRITE_UART, request.seq_num,
+            result = modbusWriteFrame(data, length);
+            if (ERROR_NONE == result || ERROR_TIMEOUT == result) {
+                ipcSendResponseMsg(IPC_WRITE_UART, seq_num,
                     result == ERROR_NONE ? DEVICE_OK : DEVICE_E_TIMEOUT);
             } else {
-                ipcSendResponseMsg(IPC_WRITE_UART, request.seq_num, DEVICE_E_IO);
+                ipcSendResponseMsg(IPC_WRITE_UART, seq_num, DEVICE_E_IO);
             }
             break;
 
+        case IPC_MODBUS_TRANSACT:
+            startTransaction(seq_num, data, length);
+            break;
+
+        case IPC_BATCH:
+            if (batch.active) {
+                ipcSendResponseMsg(IPC_BATCH, seq_num, DEVICE_E_INVALID);
+            } else {
+                startBatch(seq_num, data, length);
+            }
+            break;
+
+        case IPC_TRACE_DUMP:
+            sendTraceDump(seq_num);
+            break;
+
+        case IPC_ADC_START:
+            ipcSendResponseMsg(IPC_ADC_START, seq_num, startAdcStream(data, length));
+            break;
+
+        case IPC_ADC_STOP:
+            AdcStream_Stop();
+            ipcSendResponseMsg(IPC_ADC_STOP, seq_num, DEVICE_OK);
+            break;
+
+        case IPC_AUDIO_START:
+            ipcSendResponseMsg(IPC_AUDIO_START, seq_num, startAudioFeatures(data, length));
+            break;
+
+        case IPC_AUDIO_STOP:
+            AudioFeatures_Stop();
+            ipcSendResponseMsg(IPC_AUDIO_STOP, seq_num, DEVICE_OK);
+            break;
+
+        case IPC_PULSE_START:
+            ipcSendResponseMsg(IPC_PULSE_START, seq_num, startPulseCounter(data, length));
+            break;
+
+        case IPC_PULSE_STOP:
+            PulseCounter_Stop();
+            ipcSendResponseMsg(IPC_PULSE_STOP, seq_num, DEVICE_OK);
+            break;
+
+        case IPC_PULSE_READ:
+            sendPulseReadings(seq_num);
+            break;
+
+        case IPC_MODBUS_SIM_START:
+            ipcSendResponseMsg(IPC_MODBUS_SIM_START, seq_num, startModbusSlaveSim(data, length));
+            break;
+
+        case IPC_MODBUS_SIM_STOP:
+            ModbusSlaveSim_Stop();
+            ipcSendResponseMsg(IPC_MODBUS_SIM_STOP, seq_num, DEVICE_OK);
+            break;
+
         default:
-            UART_Printf(debug, "ERROR: receiving not supported command %d", request.command);
+            UART_Printf(debug, "ERROR: receiving not supported command %d", command);
     }
 }
 
-static void handleRecvMsgWrapper(Socket *handle)
+
+// Send batch response with all responses collected
+static void finishBatch(err_code code)
 {
-    static CallbackNode cbn = {.enqueued = false, .cb = handleRecvMsg, .data = NULL};
+    serialize_uint32(batchResp, IPC_BATCH);
+    serialize_uint32(batchResp + 4, batch.seq_num);
+    serialize_uint32(batchResp + 8, code);
+    serialize_uint32(batchResp + 12, batch.respLength);
+    batch.active = false;
 
-    if (!cbn.data) {
-        cbn.data = handle;
+    int32_t error = Socket_Send(socket, &A7ID, SOCKET_PRIORITY_CONTROL,
+        batchResp, sizeof(ipc_batch_response_message_t) + batch.respLength);
+    if (error != ERROR_NONE) {
+        UART_Printf(debug, "ERROR: sending batch %ld result - %ld\r\n", batch.seq_num, error);
     }
+}
 
-    EnqueueCallback(&cbn);
+// Execute commands of batch in order until one of them need to wait, e.g.
+// IPC_MODBUS_TRANSACT, finishTransaction() call back to continue
+static void runBatch(void)
+{
+    batch.running = true;
+
+    while (batch.active && !transaction.active) {
+        if (batch.offset >= batch.length) {
+            finishBatch(DEVICE_OK);
+            break;
+        }
+
+        const uint8_t *cmd = batchReq + batch.offset;
+        uint32_t cmdLength = dserialize_uint32((uint8_t *)cmd + 8);
+        if ((batch.offset + sizeof(ipc_request_message_t) > batch.length) ||
+            (cmdLength > batch.length - batch.offset - sizeof(ipc_request_message_t))) {
+            finishBatch(DEVICE_E_PROTOCOL);
+            break;
+        }
+
+        batch.offset += sizeof(ipc_request_message_t) + cmdLength;
+        handleCommand(dserialize_uint32((uint8_t *)cmd), dserialize_uint32((uint8_t *)cmd + 4),
+            cmd + sizeof(ipc_request_message_t), cmdLength);
+    }
+
+    batch.running = false;
 }
 
-static void HandleUartIsu0RxIrqDeferred(void* data)
+static void startBatch(uint32_t seq_num, const uint8_t *data, uint32_t length)
 {
-    uintptr_t avail = UART_ReadAvailable(modbus);
-    if (avail == 0) {
-        UART_Print(debug, "ERROR: UART received interrupt for zero bytes.\r\n");
+    // commands are kept as message is released once handled
+    for (uint32_t i = 0; i < length; i++) {
+        batchReq[i] = data[i];
+    }
+
+    batch.active = true;
+    batch.seq_num = seq_num;
+    batch.length = length;
+    batch.offset = 0;
+    batch.respLength = 0;
+    runBatch();
+}
+
+// Drop batch A7 no longer wait for, including its ongoing transaction
+static void abandonBatch(void)
+{
+    GPT_Stop(t35Timer);
+    GPT_Stop(responseTimer);
+    transaction.active = false;
+    transaction.receiving = false;
+    batch.active = false;
+}
+
+static void handleRecvMsg(void *handle)
+{
+    Socket *socket = (Socket*)handle;
+
+    Component_Id senderId;
+    ipc_request_message_t request;
+    Socket_Segments segments;
+
+    if (Socket_NegotiationPending(socket)) {
+        UART_Printf(debug, "Negotiation pending, attempting renegotiation\n");
+        // NB: this is blocking, if you want to protect against hanging,
+        //     add a timeout
+        if (Socket_Negotiate(socket) != ERROR_NONE) {
+            UART_Printf(debug, "ERROR: renegotiating socket connection\n");
+        }
+    }
+
+    int32_t error = Socket_Peek(socket, &senderId, &segments);
+    if (error != ERROR_NONE) {
+        UART_Printf(debug, "ERROR: receiving msg - %ld\r\n", error);
         return;
     }
 
-    avail = MIN(avail, MB_RTU_MAX_ADU_SIZE - size);
-    if (UART_Read(modbus, modbus_frame + size, avail) != ERROR_NONE) {
-        UART_Print(debug, "ERROR: Failed to read ");
-        UART_PrintUInt(debug, avail);
-        UART_Print(debug, " bytes from UART.\r\n");
+    // Parse and execute message in place in the shared ring buffer, only
+    // copy it out when it wraps around the end of the buffer
+    uint8_t *msg_data = segments.data[0];
+    uint32_t msg_size = segments.size[0] + segments.size[1];
+    if (segments.size[1] != 0) {
+        if (msg_size > sizeof(msg)) {
+            UART_Printf(debug, "ERROR: msg too long - %ld\r\n", msg_size);
+            Socket_Consume(socket);
+            return;
+        }
+        __builtin_memcpy(msg, segments.data[0], segments.size[0]);
+        __builtin_memcpy(msg + segments.size[0], segments.data[1], segments.size[1]);
+        msg_data = msg;
+        Socket_Consume(socket);
+    }
+
+    if (msg_size < sizeof(ipc_request_message_t)) {
+        UART_Printf(debug, "ERROR: msg too short - %ld\r\n", msg_size);
+        if (msg_data != msg) {
+            Socket_Consume(socket);
+        }
         return;
     }
 
-    UART_Print(debug, "UART received ");
-    UART_PrintUInt(debug, avail);
-    UART_Print(debug, " bytes: \'");
-    //UART_Write(debug, modbus_frame + end, avail);
-    printBytes(modbus_frame, size, avail);
-    UART_Print(debug, "\'.\r\n");
+    request.command = dserialize_uint32(msg_data);
+    request.seq_num = dserialize_uint32(msg_data + 4);
+    request.length = MIN(dserialize_uint32(msg_data + 8), msg_size - sizeof(ipc_request_message_t));
 
-    // Send bytes to A7 if in uard read mode
-    int32_t error = Socket_Write(socket, &A7ID, modbus_frame, size + avail);
-    if (error != ERROR_NONE) {
-        UART_Printf(debug, "ERROR: sending bytes to A7 with error code %ld\r\n", error);
-    } else {
-        size = 0;
+    uint32_t dropped = UART_GetTxDropped(debug);
+    if (dropped != debugDropped) {
+        UART_Printf(debug, "WARNING: %ld bytes of debug output dropped\r\n", dropped - debugDropped);
+        debugDropped = dropped;
+    }
+
+    UART_Printf(debug, "Message received: command %d seq_num %ld length %ld\r\nSender: ",
+        request.command, request.seq_num, request.length);
+    printComponentId(&senderId);
+
+    // A7 only send next message after getting result of previous
+    // one, so any batch still running been abandoned
+    if (batch.active) {
+        abandonBatch();
+    }
+
+    // Commands copy what they need to keep, so message can be released after
+    handleCommand(request.command, request.seq_num, msg_data + 12, request.length);
+    if (msg_data != msg) {
+        Socket_Consume(socket);
     }
 }
 
-static void HandleUartIsu0RxIrq(void) {
-    static CallbackNode cbn = { .enqueued = false, .cb = HandleUartIsu0RxIrqDeferred };
-    EnqueueCallback(&cbn);
+// A7 read from the ring buffer, write messages queued while it was full
+static void handleSendSpace(void *handle)
+{
+    Socket_Flush((Socket*)handle);
+
+    // UART bytes that didn't fit last time, unless still waiting for more
+    if (!transaction.active && (rxSize > 0) && !GPT_IsEnabled(t35Timer)) {
+        flushRx();
+    }
 }
 
-static CallbackNode *volatile callbacks = NULL;
+static void handleSendSpaceWrapper(Socket *handle)
+{
+    static Scheduler_Task task = SCHEDULER_TASK(handleSendSpace, SCHEDULER_PRIORITY_LOW, 0);
+
+    if (!task.data) {
+        task.data = handle;
+    }
 
-static void EnqueueCallback(CallbackNode *node)
+    Scheduler_Post(&task);
+}
+
+static void handleRecvMsgWrapper(Socket *handle)
 {
-    uint32_t prevBasePri = NVIC_BlockIRQs();
-    if (!node->enqueued) {
-        CallbackNode *prevHead = callbacks;
-        node->enqueued = true;
-        callbacks = node;
-        node->next = prevHead;
+    static Scheduler_Task task = SCHEDULER_TASK(handleRecvMsg, SCHEDULER_PRIORITY_LOW, 0);
+
+    if (!task.data) {
+        task.data = handle;
     }
-    NVIC_RestoreIRQs(prevBasePri);
+
+    Scheduler_Post(&task);
 }
 
-static void InvokeCallbacks(void)
+static void HandleUartIsu0RxIrqDeferred(void* data)
 {
-    CallbackNode *node;
-    do {
-        uint32_t prevBasePri = NVIC_BlockIRQs();
-        node = callbacks;
-        if (node) {
-            node->enqueued = false;
-            callbacks = node->next;
+    uintptr_t avail = UART_ReadAvailable(modbus);
+    if (avail == 0) {
+        UART_Print(debug, "ERROR: UART received interrupt for zero bytes.\r\n");
+        return;
+    }
+
+    // assemble response frame locally, A7 only get the complete pdu
+    if (transaction.active) {
+        if (size == MB_RTU_MAX_ADU_SIZE) {
+            completeTransaction();
+            return;
+        }
+
+        avail = MIN(avail, MB_RTU_MAX_ADU_SIZE - size);
+        if (UART_Read(modbus, modbus_frame + size, avail) != ERROR_NONE) {
+            finishTransaction(DEVICE_E_IO, NULL, 0);
+            return;
+        }
+        size += avail;
+
+        if (!transaction.receiving) {
+            transaction.receiving = true;
+            GPT_Stop(responseTimer);
+        }
+
+        if (size == MB_RTU_MAX_ADU_SIZE) {
+            completeTransaction();
+        } else {
+            GPT_Stop(t35Timer);
+            if (GPT_StartTimeout(t35Timer, t35_us, GPT_UNITS_MICROSEC, HandleT35Expired) != ERROR_NONE) {
+                completeTransaction();
+            }
         }
-        NVIC_RestoreIRQs(prevBasePri);
+        return;
+    }
+
+    // uart read mode, coalesce bytes so A7 wakes once per message rather than
+    // once per interrupt
+    while (avail > 0) {
+        if (rxSize == sizeof(rxMsg)) {
+            UART_Printf(debug, "ERROR: A7 not reading, dropped %ld UART bytes\r\n", rxSize);
+            rxSize = 0;
+        }
+
+        uintptr_t count = MIN(avail, sizeof(rxMsg) - rxSize);
+        if (UART_Read(modbus, rxMsg + rxSize, count) != ERROR_NONE) {
+            UART_Print(debug, "ERROR: Failed to read ");
+            UART_PrintUInt(debug, count);
+            UART_Print(debug, " bytes from UART.\r\n");
+            return;
+        }
+        rxSize += count;
+        avail -= count;
 
-        if (node) {
-            (node->cb)(node->data);
+        if (rxSize >= rxMaxSize) {
+            flushRx();
         }
-    } while (node);
+    }
+
+    if ((rxSize > 0) && !GPT_IsEnabled(t35Timer)) {
+        if ((rxMaxLatency == 0) ||
+            (GPT_StartTimeout(t35Timer, rxMaxLatency, GPT_UNITS_MICROSEC, HandleRxLatencyExpired) != ERROR_NONE)) {
+            flushRx();
+        }
+    }
+}
+
+static void HandleUartIsu0RxIrq(void) {
+    // Must run before the UART FIFO overflows, at 115200 baud 16 bytes take ~1.4ms.
+    static Scheduler_Task task = SCHEDULER_TASK(HandleUartIsu0RxIrqDeferred, SCHEDULER_PRIORITY_HIGH, 1000);
+    Scheduler_Post(&task);
 }
 
 _Noreturn void RTCoreMain(void)
@@ -286,18 +995,33 @@ _Noreturn void RTCoreMain(void)
     CPUFreq_Set(197600000);
 
     debug = UART_Open(MT3620_UNIT_UART_DEBUG, 115200, UART_PARITY_NONE, 1, NULL);
+    UART_SetTxDeferred(debug, debugTx, sizeof(debugTx));
     UART_Print(debug, "--------------------------------\r\n");
     UART_Print(debug, "MT3620_IDC_RTApp\r\n");
     UART_Print(debug, "App built on: " __DATE__ " " __TIME__ "\r\n");
 
+    t35Timer = GPT_Open(MT3620_UNIT_GPT3, 1000000, GPT_MODE_ONE_SHOT);
+    responseTimer = GPT_Open(MT3620_UNIT_GPT0, MT3620_GPT_012_HIGH_SPEED, GPT_MODE_ONE_SHOT);
+    if (!t35Timer || !responseTimer) {
+        UART_Printf(debug, "ERROR: GPT initialisation failed\r\n");
+    }
+
+    // GPT4 free runs at the CPU clock to measure task latency
+    latencyTimer = GPT_Open(MT3620_UNIT_GPT4, CPUFreq_Get(), GPT_MODE_NONE);
+    if (Scheduler_Init(latencyTimer) != ERROR_NONE) {
+        UART_Printf(debug, "ERROR: scheduler latency timer initialisation failed\r\n");
+        Scheduler_Init(NULL);
+    }
+    if (!latencyTimer || (Trace_Init(latencyTimer) != ERROR_NONE)) {
+        UART_Printf(debug, "ERROR: trace initialisation failed\r\n");
+    }
+
     // Setup socket
     socket = Socket_Open(handleRecvMsgWrapper);
     if (!socket) {
         UART_Printf(debug, "ERROR: socket initialisation failed\r\n");
     }
+    Socket_SetTxCallback(socket, handleSendSpaceWrapper);
 
-    for (;;) {
-        __asm__("wfi");
-        InvokeCallbacks();
-    }
+    Scheduler_Run();
 }
@@ -0,0 +1,85 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-16/MODBUS: reflected polynomial 0xA001, init 0xFFFF, no final xor.
+// Shared by the high level app RTU transport and the real-time app.
+#define CRC16_MODBUS_INIT 0xFFFFu
+
+// running a CRC over a complete frame including its trailing CRC bytes
+// (low byte first as sent on the wire) always ends with this residue
+#define CRC16_MODBUS_RESIDUE 0x0000u
+
+/**
+ * start an incremental CRC calculation
+ * @return initial CRC state
+ */
+static inline uint16_t crc16_init(void)
+{
+    return CRC16_MODBUS_INIT;
+}
+
+/**
+ * feed more bytes into an incremental CRC calculation, the bytes can be
+ * given in any number of chunks, e.g. as they stream in from uart
+ * @param crc current CRC state, from crc16_init() or previous crc16_update()
+ * @param buf bytes to feed
+ * @param len number of bytes
+ * @return updated CRC state
+ */
+uint16_t crc16_update(uint16_t crc, const uint8_t *buf, size_t len);
+
+/**
+ * finalize an incremental CRC calculation
+ * @param crc current CRC state
+ * @return CRC value, to be sent low byte first
+ */
+static inline uint16_t crc16_finalize(uint16_t crc)
+{
+    // CRC-16/MODBUS has no final xor
+    return crc;
+}
+
+/**
+ * calculate CRC for a whole buffer in one go
+ * @param buf bytes to calculate
+ * @param len number of bytes
+ * @return CRC value, to be sent low byte first
+ */
+static inline uint16_t crc16(const uint8_t *buf, size_t len)
+{
+    return crc16_finalize(crc16_update(crc16_init(), buf, len));
+}
+
+/**
+ * check a complete frame which ends with its CRC (low byte first)
+ * @param frame frame to check
+ * @param len frame length including the 2 bytes CRC
+ * @return non-zero if CRC matches
+ */
+static inline int crc16_check_frame(const uint8_t *frame, size_t len)
+{
+    return (len >= 2) && (crc16_update(crc16_init(), frame, len) == CRC16_MODBUS_RESIDUE);
+}
+
+/**
+ * reference bit-at-a-time implementation, kept for benchmark and verification only
+ */
+uint16_t crc16_update_bitwise(uint16_t crc, const uint8_t *buf, size_t len);
+
+/**
+ * byte-at-a-time implementation using the 256 entries table
+ */
+uint16_t crc16_update_table(uint16_t crc, const uint8_t *buf, size_t len);
+
+#ifdef CRC16_SLICE_BY_4
+/**
+ * slice-by-4 implementation, consume 4 bytes per iteration with 4 tables (2KB),
+ * only been built when CRC16_SLICE_BY_4 defined as it cost additional flash/ram
+ */
+uint16_t crc16_update_slice4(uint16_t crc, const uint8_t *buf, size_t len);
+#endif
@@ -0,0 +1,212 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "modbus_sim.h"
+
+// function codes and exceptions answered, the rest get illegal function
+#define FC_READ_COILS 0x01
+#define FC_READ_DISCRETE_INPUTS 0x02
+#define FC_READ_HOLDING_REGISTERS 0x03
+#define FC_READ_INPUT_REGISTERS 0x04
+#define FC_WRITE_SINGLE_COIL 0x05
+#define FC_WRITE_SINGLE_REGISTER 0x06
+#define FC_WRITE_COILS 0x0F
+#define FC_WRITE_HOLDING_REGISTERS 0x10
+
+#define EXCEPTION_ILLEGAL_FUNCTION 0x01
+#define EXCEPTION_ILLEGAL_ADDRESS 0x02
+#define EXCEPTION_ILLEGAL_VALUE 0x03
+
+#define PPM 1000000u
+
+
+static uint32_t mix32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// xorshift32, state never 0
+static uint32_t next_random(modbus_sim_t *sim)
+{
+    uint32_t x = sim->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sim->rng = x;
+    return x;
+}
+
+static int chance(modbus_sim_t *sim, uint32_t ppm)
+{
+    return ppm && (next_random(sim) % PPM) < ppm;
+}
+
+static int32_t exception(uint8_t function, uint8_t code, uint8_t *rsp)
+{
+    rsp[0] = function | 0x80;
+    rsp[1] = code;
+    return 2;
+}
+
+static int32_t read_bits(const modbus_sim_t *sim, uint8_t id, uint8_t table, const uint8_t *pdu, uint32_t now_ms,
+                         uint8_t *rsp)
+{
+    uint16_t addr = (pdu[1] << 8) | pdu[2];
+    uint16_t quantity = (pdu[3] << 8) | pdu[4];
+
+    if (quantity == 0 || quantity > 2000) {
+        return exception(pdu[0], EXCEPTION_ILLEGAL_VALUE, rsp);
+    }
+    if ((uint32_t)addr + quantity > sim->config.num_registers) {
+        return exception(pdu[0], EXCEPTION_ILLEGAL_ADDRESS, rsp);
+    }
+
+    uint8_t num_bytes = (quantity + 7) / 8;
+    rsp[0] = pdu[0];
+    rsp[1] = num_bytes;
+    for (uint8_t i = 0; i < num_bytes; i++) {
+        rsp[2 + i] = 0;
+    }
+    for (uint16_t i = 0; i < quantity; i++) {
+        if (modbus_sim_register(sim, id, table, addr + i, now_ms) & 1) {
+            rsp[2 + i / 8] |= 1u << (i % 8);
+        }
+    }
+    return 2 + num_bytes;
+}
+
+static int32_t read_registers(const modbus_sim_t *sim, uint8_t id, uint8_t table, const uint8_t *pdu,
+                              uint32_t now_ms, uint8_t *rsp)
+{
+    uint16_t addr = (pdu[1] << 8) | pdu[2];
+    uint16_t quantity = (pdu[3] << 8) | pdu[4];
+
+    if (quantity == 0 || quantity > 125) {
+        return exception(pdu[0], EXCEPTION_ILLEGAL_VALUE, rsp);
+    }
+    if ((uint32_t)addr + quantity > sim->config.num_registers) {
+        return exception(pdu[0], EXCEPTION_ILLEGAL_ADDRESS, rsp);
+    }
+
+    rsp[0] = pdu[0];
+    rsp[1] = quantity * 2;
+    for (uint16_t i = 0; i < quantity; i++) {
+        uint16_t value = modbus_sim_register(sim, id, table, addr + i, now_ms);
+        rsp[2 + i * 2] = value >> 8;
+        rsp[3 + i * 2] = value & 0xFF;
+    }
+    return 2 + quantity * 2;
+}
+
+// writes are checked as a slave would and echoed, values are not kept
+static int32_t write_registers(const modbus_sim_t *sim, const uint8_t *pdu, int32_t pdu_len, uint8_t *rsp)
+{
+    uint16_t addr = (pdu[1] << 8) | pdu[2];
+    uint16_t quantity = 1;
+
+    if (pdu[0] == FC_WRITE_COILS || pdu[0] == FC_WRITE_HOLDING_REGISTERS) {
+        quantity = (pdu[3] << 8) | pdu[4];
+        if (quantity == 0 || pdu_len < 6 || pdu_len < 6 + pdu[5]) {
+            return exception(pdu[0], EXCEPTION_ILLEGAL_VALUE, rsp);
+        }
+    }
+    if ((uint32_t)addr + quantity > sim->config.num_registers) {
+        return exception(pdu[0], EXCEPTION_ILLEGAL_ADDRESS, rsp);
+    }
+
+    for (int32_t i = 0; i < 5; i++) {
+        rsp[i] = pdu[i];
+    }
+    return 5;
+}
+
+// ------------------------------ public interface ----------------------------
+
+void modbus_sim_init(modbus_sim_t *sim, const modbus_sim_config_t *config)
+{
+    sim->config = *config;
+    if (sim->config.latency_max_us < sim->config.latency_min_us) {
+        sim->config.latency_max_us = sim->config.latency_min_us;
+    }
+    sim->rng = config->seed ? config->seed : 1;
+    sim->stats = (modbus_sim_stats_t){0};
+}
+
+
+uint16_t modbus_sim_register(const modbus_sim_t *sim, uint8_t id, uint8_t table, uint16_t addr, uint32_t now_ms)
+{
+    uint32_t key = ((uint32_t)id << 24) ^ ((uint32_t)table << 16) ^ addr;
+    uint32_t value = mix32(key ^ sim->config.seed);
+
+    // registers picked by their own hash step together, so changes per poll
+    // are change_ppm of registers read on average
+    const modbus_sim_config_t *config = &sim->config;
+    if (config->change_ms && mix32(key * 0x9E3779B9u) % PPM < config->change_ppm) {
+        value += now_ms / config->change_ms;
+    }
+    return (uint16_t)value;
+}
+
+
+int32_t modbus_sim_handle(modbus_sim_t *sim, uint8_t id, const uint8_t *pdu, int32_t pdu_len, uint32_t now_ms,
+                          uint8_t *rsp, uint32_t *delay_us)
+{
+    const modbus_sim_config_t *config = &sim->config;
+
+    sim->stats.requests++;
+    *delay_us = 0;
+
+    if (id == 0 || id < config->first_id || id - config->first_id >= config->num_slaves || pdu_len < 1 ||
+        chance(sim, config->timeout_ppm)) {
+        sim->stats.timeouts++;
+        return 0;
+    }
+
+    uint32_t spread = config->latency_max_us - config->latency_min_us;
+    *delay_us = config->latency_min_us + (spread ? next_random(sim) % (spread + 1) : 0);
+    if (chance(sim, config->slow_ppm)) {
+        *delay_us += config->slow_us;
+    }
+
+    int32_t len;
+    if (chance(sim, config->exception_ppm)) {
+        len = exception(pdu[0], MODBUS_SIM_EXCEPTION_BUSY, rsp);
+    } else if (pdu_len < 5) {
+        len = exception(pdu[0], EXCEPTION_ILLEGAL_VALUE, rsp);
+    } else {
+        switch (pdu[0]) {
+        case FC_READ_COILS:
+            len = read_bits(sim, id, 0, pdu, now_ms, rsp);
+            break;
+        case FC_READ_DISCRETE_INPUTS:
+            len = read_bits(sim, id, 1, pdu, now_ms, rsp);
+            break;
+        case FC_READ_HOLDING_REGISTERS:
+            len = read_registers(sim, id, 4, pdu, now_ms, rsp);
+            break;
+        case FC_READ_INPUT_REGISTERS:
+            len = read_registers(sim, id, 3, pdu, now_ms, rsp);
+            break;
+        case FC_WRITE_SINGLE_COIL:
+        case FC_WRITE_SINGLE_REGISTER:
+        case FC_WRITE_COILS:
+        case FC_WRITE_HOLDING_REGISTERS:
+            len = write_registers(sim, pdu, pdu_len, rsp);
+            break;
+        default:
+            len = exception(pdu[0], EXCEPTION_ILLEGAL_FUNCTION, rsp);
+            break;
+        }
+    }
+
+    if (rsp[0] & 0x80) {
+        sim->stats.exceptions++;
+    }
+    sim->stats.responses++;
+    return len;
+}
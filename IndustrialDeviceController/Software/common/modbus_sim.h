@@ -0,0 +1,92 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+// Simulated modbus slaves for load and soak testing, shared by the sim
+// transport of the high level app and the slave simulator of the real-time
+// app. It only computes what a slave would answer and how long it takes,
+// waiting and framing are left to the caller. Register values are derived
+// from slave id, table and address, so nothing is stored per slave and any
+// number of slaves costs the same memory. Writes are acknowledged but not
+// kept.
+
+// largest pdu of a request or response
+#define MODBUS_SIM_MAX_PDU 253
+
+// exception code of injected failures, slave device busy
+#define MODBUS_SIM_EXCEPTION_BUSY 0x06
+
+typedef struct modbus_sim_config_t modbus_sim_config_t;
+struct modbus_sim_config_t {
+    // slaves answer ids first_id to first_id + num_slaves - 1, others never answer
+    uint8_t first_id;
+    uint8_t num_slaves;
+    // registers, coils and inputs in each table, access beyond is answered
+    // with illegal data address
+    uint16_t num_registers;
+    // response time drawn evenly between min and max, slow_ppm of responses
+    // take slow_us more
+    uint32_t latency_min_us;
+    uint32_t latency_max_us;
+    uint32_t slow_ppm;
+    uint32_t slow_us;
+    // parts per million of requests answered with MODBUS_SIM_EXCEPTION_BUSY,
+    // and not answered at all
+    uint32_t exception_ppm;
+    uint32_t timeout_ppm;
+    // change_ppm of registers step every change_ms, 0 for constant values
+    uint32_t change_ms;
+    uint32_t change_ppm;
+    // seed of injected latency and failures, same seed same sequence
+    uint32_t seed;
+};
+
+typedef struct modbus_sim_stats_t modbus_sim_stats_t;
+struct modbus_sim_stats_t {
+    uint32_t requests;
+    uint32_t responses;
+    uint32_t exceptions;
+    uint32_t timeouts;
+};
+
+typedef struct modbus_sim_t modbus_sim_t;
+struct modbus_sim_t {
+    modbus_sim_config_t config;
+    uint32_t rng;
+    modbus_sim_stats_t stats;
+};
+
+/**
+ * set up simulated slaves
+ * @param sim simulator
+ * @param config slaves to simulate, copied
+ */
+void modbus_sim_init(modbus_sim_t *sim, const modbus_sim_config_t *config);
+
+/**
+ * answer one request as the addressed slave would
+ * @param sim simulator
+ * @param id slave id request is sent to, broadcast 0 is never answered
+ * @param pdu request pdu
+ * @param pdu_len length of request pdu
+ * @param now_ms any millisecond clock, register values change with it
+ * @param rsp buffer to receive response pdu, MODBUS_SIM_MAX_PDU bytes
+ * @param delay_us out parameter receive time slave takes to answer
+ * @return length of response pdu, 0 if slave doesn't answer
+ */
+int32_t modbus_sim_handle(modbus_sim_t *sim, uint8_t id, const uint8_t *pdu, int32_t pdu_len, uint32_t now_ms,
+                          uint8_t *rsp, uint32_t *delay_us);
+
+/**
+ * value of a register, or bit 0 of it for coils and inputs
+ * @param sim simulator
+ * @param id slave id
+ * @param table modbus table, 0 coils, 1 discrete inputs, 3 input registers, 4 holding registers
+ * @param addr register address from 0
+ * @param now_ms same clock as modbus_sim_handle()
+ * @return register value
+ */
+uint16_t modbus_sim_register(const modbus_sim_t *sim, uint8_t id, uint8_t table, uint16_t addr, uint32_t now_ms);
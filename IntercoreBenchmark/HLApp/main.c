@@ -0,0 +1,348 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// This sample C application for Azure Sphere measures what the intercore mailbox between the A7
+// and an M4 can do, against the benchmark RTApp. It logs, for messages of 16 bytes to 1 KB:
+// - one-way throughput from A7 to M4 and from M4 to A7, with the M4 reading and writing the ring
+//   buffers by copy, in place (zero-copy) and through its queue
+// - the same with small records batched into 1 KB messages
+// - ping-pong round trip latency percentiles
+//
+// It uses the following Azure Sphere libraries
+// - log (displays messages in the Device Output window during debugging)
+// - application (establish a connection with a real-time capable application)
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <applibs/application.h>
+#include <applibs/log.h>
+
+#include "bench_protocol.h"
+
+/// <summary>
+/// Exit codes for this application. These are used for the
+/// application exit code. They must all be between zero and 255,
+/// where zero is reserved for successful termination.
+/// </summary>
+typedef enum {
+    ExitCode_Success = 0,
+    ExitCode_TermHandler_SigTerm = 1,
+    ExitCode_Init_Connection = 2,
+    ExitCode_Init_SetSockOpt = 3,
+    ExitCode_Bench_Failed = 4
+} ExitCode;
+
+// Each throughput run moves about this many bytes, in at least BENCH_MIN_MESSAGES messages
+#define BENCH_BYTES_PER_RUN (512 * 1024)
+#define BENCH_MIN_MESSAGES 2000
+#define BENCH_ROUND_TRIPS 1000
+#define BENCH_TIMEOUT_MS 2000
+
+static const char rtAppComponentId[] = "47ca2131-0018-43f4-b483-6ac4be8916ad";
+static const uint16_t sizes[] = {16, 32, 64, 128, 256, 512, 1024};
+static const char *modeNames[BENCH_MODE_COUNT] = {"copy", "zero-copy", "queued"};
+
+static int sockFd = -1;
+static volatile sig_atomic_t exitCode = ExitCode_Success;
+static uint32_t seqNum = 0;
+static uint8_t txBuffer[BENCH_MAX_MESSAGE_SIZE];
+static uint8_t rxBuffer[BENCH_MAX_MESSAGE_SIZE];
+static uint32_t roundTrips[BENCH_ROUND_TRIPS];
+
+/// <summary>
+///     Signal handler for termination requests. This handler must be async-signal-safe.
+/// </summary>
+static void TerminationHandler(int signalNumber)
+{
+    // Don't use Log_Debug here, as it is not guaranteed to be async-signal-safe.
+    exitCode = ExitCode_TermHandler_SigTerm;
+}
+
+static uint64_t NowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static uint32_t RunCount(uint16_t size)
+{
+    uint32_t count = BENCH_BYTES_PER_RUN / size;
+    return count < BENCH_MIN_MESSAGES ? BENCH_MIN_MESSAGES : count;
+}
+
+/// <summary>
+///     Sends one message, waiting for room in the ring buffer while the RTApp is behind.
+/// </summary>
+static bool SendMessage(const void *data, size_t size)
+{
+    for (;;) {
+        ssize_t sent = send(sockFd, data, size, 0);
+        if (sent == (ssize_t)size) {
+            return true;
+        }
+
+        if ((sent < 0) && ((errno == EAGAIN) || (errno == ENOBUFS))) {
+            struct pollfd writable = {.fd = sockFd, .events = POLLOUT};
+            if (poll(&writable, 1, BENCH_TIMEOUT_MS) > 0) {
+                continue;
+            }
+            Log_Debug("ERROR: RTApp not reading\n");
+            return false;
+        }
+
+        Log_Debug("ERROR: send: %d (%s)\n", errno, strerror(errno));
+        return false;
+    }
+}
+
+/// <summary>
+///     Receives the next message into rxBuffer, -1 on error or after BENCH_TIMEOUT_MS.
+/// </summary>
+static ssize_t RecvMessage(void)
+{
+    ssize_t size = recv(sockFd, rxBuffer, sizeof(rxBuffer), 0);
+    if ((size < 0) && (errno != EAGAIN)) {
+        Log_Debug("ERROR: recv: %d (%s)\n", errno, strerror(errno));
+    }
+    return size;
+}
+
+/// <summary>
+///     Waits for the reply with command and seq, dropping anything else, e.g. late BENCH_DATA.
+/// </summary>
+static bool WaitReply(uint32_t command, uint32_t seq)
+{
+    for (;;) {
+        ssize_t size = RecvMessage();
+        if (size < 0) {
+            Log_Debug("ERROR: no reply to command %u\n", command);
+            return false;
+        }
+
+        const bench_header_t *header = (const bench_header_t *)rxBuffer;
+        if (((size_t)size >= sizeof(*header)) && (header->command == command) &&
+            (header->seq == seq)) {
+            return true;
+        }
+    }
+}
+
+static bool SetMode(bench_mode_t mode)
+{
+    bench_mode_message_t message = {.header = {.command = BENCH_MODE, .seq = ++seqNum},
+                                    .mode = mode};
+    return SendMessage(&message, sizeof(message)) && WaitReply(BENCH_MODE, seqNum);
+}
+
+/// <summary>
+///     A7 to M4: sends count messages of size bytes, each holding batch records, and logs the
+///     rate until the RTApp has read them all.
+/// </summary>
+static bool RunSink(const char *name, uint16_t size, uint16_t batch, uint32_t count)
+{
+    bench_header_t *header = (bench_header_t *)txBuffer;
+    header->command = BENCH_SINK;
+
+    uint64_t start = NowNs();
+    for (uint32_t i = 0; i < count; i++) {
+        header->seq = i;
+        if (!SendMessage(txBuffer, (size_t)size * batch)) {
+            return false;
+        }
+    }
+
+    bench_header_t request = {.command = BENCH_SINK_REPORT, .seq = ++seqNum};
+    if (!SendMessage(&request, sizeof(request)) || !WaitReply(BENCH_SINK_REPORT, seqNum)) {
+        return false;
+    }
+    double seconds = (double)(NowNs() - start) / 1e9;
+
+    bench_sink_report_t report;
+    memcpy(&report, rxBuffer, sizeof(report));
+    if ((report.messages != count) || (report.lost != 0)) {
+        Log_Debug("WARNING: RTApp got %u of %u messages, %u lost\n", report.messages, count,
+                  report.lost);
+    }
+
+    Log_Debug("  %-9s %4u B: %8.0f records/s %8.1f KB/s\n", name, size,
+              report.messages * batch / seconds, report.bytes / seconds / 1024);
+    return true;
+}
+
+/// <summary>
+///     M4 to A7: has the RTApp send count records of size bytes, batch per message, and logs the
+///     rate until the last one is received.
+/// </summary>
+static bool RunSource(bench_mode_t mode, uint16_t size, uint16_t batch, uint32_t count)
+{
+    bench_source_message_t request = {.header = {.command = BENCH_SOURCE, .seq = ++seqNum},
+                                      .mode = mode,
+                                      .count = count,
+                                      .size = size,
+                                      .batch = batch};
+
+    uint64_t start = NowNs();
+    uint64_t last = start;
+    if (!SendMessage(&request, sizeof(request))) {
+        return false;
+    }
+
+    uint32_t records = 0;
+    uint64_t bytes = 0;
+    while (records < count) {
+        ssize_t received = RecvMessage();
+        if (received < 0) {
+            Log_Debug("WARNING: received %u of %u records\n", records, count);
+            break;
+        }
+        if ((((const bench_header_t *)rxBuffer)->command != BENCH_DATA) ||
+            ((size_t)received < size)) {
+            continue;
+        }
+        last = NowNs();
+        records += (uint32_t)received / size;
+        bytes += (uint64_t)received;
+    }
+
+    double seconds = (double)(last - start) / 1e9;
+    Log_Debug("  %-9s %4u B: %8.0f records/s %8.1f KB/s\n", modeNames[mode], size,
+              records / seconds, bytes / seconds / 1024);
+    return true;
+}
+
+static int CompareUInt32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/// <summary>
+///     Ping-pong of BENCH_ROUND_TRIPS messages of size bytes, logs round trip percentiles.
+/// </summary>
+static bool RunEcho(bench_mode_t mode, uint16_t size)
+{
+    bench_header_t *header = (bench_header_t *)txBuffer;
+    header->command = BENCH_ECHO;
+
+    for (uint32_t i = 0; i < BENCH_ROUND_TRIPS; i++) {
+        header->seq = ++seqNum;
+        uint64_t start = NowNs();
+        if (!SendMessage(txBuffer, size) || !WaitReply(BENCH_ECHO, seqNum)) {
+            return false;
+        }
+        roundTrips[i] = (uint32_t)((NowNs() - start) / 1000);
+    }
+
+    qsort(roundTrips, BENCH_ROUND_TRIPS, sizeof(roundTrips[0]), CompareUInt32);
+    Log_Debug("  %-9s %4u B: p50 %5u us p90 %5u us p99 %5u us max %5u us\n", modeNames[mode], size,
+              roundTrips[BENCH_ROUND_TRIPS * 50 / 100], roundTrips[BENCH_ROUND_TRIPS * 90 / 100],
+              roundTrips[BENCH_ROUND_TRIPS * 99 / 100], roundTrips[BENCH_ROUND_TRIPS - 1]);
+    return true;
+}
+
+static bool RunBenchmarks(void)
+{
+    const size_t numSizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    Log_Debug("A7 to M4, one message per record:\n");
+    for (bench_mode_t mode = BENCH_MODE_COPY; mode <= BENCH_MODE_ZERO_COPY; mode++) {
+        if (!SetMode(mode)) {
+            return false;
+        }
+        for (size_t i = 0; (i < numSizes) && (exitCode == ExitCode_Success); i++) {
+            if (!RunSink(modeNames[mode], sizes[i], 1, RunCount(sizes[i]))) {
+                return false;
+            }
+        }
+    }
+
+    Log_Debug("A7 to M4, records batched into %u B messages:\n", BENCH_MAX_MESSAGE_SIZE);
+    if (!SetMode(BENCH_MODE_ZERO_COPY)) {
+        return false;
+    }
+    for (size_t i = 0; (i < numSizes - 1) && (exitCode == ExitCode_Success); i++) {
+        uint16_t batch = BENCH_MAX_MESSAGE_SIZE / sizes[i];
+        if (!RunSink("batched", sizes[i], batch, RunCount(BENCH_MAX_MESSAGE_SIZE))) {
+            return false;
+        }
+    }
+
+    Log_Debug("M4 to A7, one message per record:\n");
+    for (bench_mode_t mode = BENCH_MODE_COPY; mode < BENCH_MODE_COUNT; mode++) {
+        for (size_t i = 0; (i < numSizes) && (exitCode == ExitCode_Success); i++) {
+            if (!RunSource(mode, sizes[i], 1, RunCount(sizes[i]))) {
+                return false;
+            }
+        }
+    }
+
+    Log_Debug("M4 to A7, records batched into %u B messages:\n", BENCH_MAX_MESSAGE_SIZE);
+    for (size_t i = 0; (i < numSizes - 1) && (exitCode == ExitCode_Success); i++) {
+        uint16_t batch = BENCH_MAX_MESSAGE_SIZE / sizes[i];
+        if (!RunSource(BENCH_MODE_ZERO_COPY, sizes[i], batch, RunCount(sizes[i]))) {
+            return false;
+        }
+    }
+
+    Log_Debug("Round trip, %u messages:\n", BENCH_ROUND_TRIPS);
+    for (bench_mode_t mode = BENCH_MODE_COPY; mode <= BENCH_MODE_ZERO_COPY; mode++) {
+        if (!SetMode(mode)) {
+            return false;
+        }
+        for (size_t i = 0; (i < numSizes) && (exitCode == ExitCode_Success); i++) {
+            if (!RunEcho(mode, sizes[i])) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+int main(void)
+{
+    Log_Debug("Intercore benchmark application starting.\n");
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = TerminationHandler;
+    sigaction(SIGTERM, &action, NULL);
+
+    sockFd = Application_Connect(rtAppComponentId);
+    if (sockFd == -1) {
+        Log_Debug("ERROR: Unable to create socket: %d (%s)\n", errno, strerror(errno));
+        return ExitCode_Init_Connection;
+    }
+
+    // A stalled RTApp fails the run rather than hanging it.
+    const struct timeval timeout = {.tv_sec = BENCH_TIMEOUT_MS / 1000,
+                                    .tv_usec = (BENCH_TIMEOUT_MS % 1000) * 1000};
+    if ((setsockopt(sockFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1) ||
+        (setsockopt(sockFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1)) {
+        Log_Debug("ERROR: Unable to set socket timeout: %d (%s)\n", errno, strerror(errno));
+        close(sockFd);
+        return ExitCode_Init_SetSockOpt;
+    }
+
+    memset(txBuffer, 0xa5, sizeof(txBuffer));
+    if (!RunBenchmarks() && (exitCode == ExitCode_Success)) {
+        exitCode = ExitCode_Bench_Failed;
+    }
+
+    close(sockFd);
+    Log_Debug("Intercore benchmark %s.\n", exitCode == ExitCode_Success ? "done" : "failed");
+    return exitCode;
+}
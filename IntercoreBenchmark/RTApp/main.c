@@ -0,0 +1,361 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Intercore benchmark peer. Counts what the HLApp sends, echoes it back, or
+// sends records as fast as the ring buffer takes them, see bench_protocol.h.
+// The Socket, Scheduler and lib are the ones of MT3620_IDC_RTApp, so what is
+// measured is the transport the other RT apps use.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lib/CPUFreq.h"
+#include "lib/VectorTable.h"
+#include "lib/NVIC.h"
+#include "lib/GPT.h"
+#include "lib/UART.h"
+#include "lib/Print.h"
+
+#include "Scheduler.h"
+#include "Socket.h"
+
+#include "bench_protocol.h"
+
+#define MIN(a, b) ((a) > (b) ? (b) : (a))
+
+// Component ID of the benchmark HLApp
+static const Component_Id A7ID =
+{
+    .seg_0 = 0xc68f2ecd,
+    .seg_1 = 0xa99b,
+    .seg_2 = 0x4b17,
+    .seg_3_4 = {0x9f, 0x3b, 0xe2, 0xb0, 0xa2, 0xf2, 0x0a, 0x95}
+};
+
+static UART *debug = NULL;
+static Socket *socket = NULL;
+// GPT4 free runs at the CPU clock, both for the scheduler and for timestamps
+static GPT *timestamps = NULL;
+
+static bench_mode_t mode = BENCH_MODE_COPY;
+static uint8_t buffer[BENCH_MAX_MESSAGE_SIZE];
+
+// BENCH_SINK messages since the last BENCH_SINK_REPORT
+typedef struct BenchSink {
+    uint32_t messages;
+    uint32_t bytes;
+    uint32_t lost;
+    uint32_t nextSeq;
+    uint32_t first;
+    uint32_t last;
+} BenchSink;
+
+static BenchSink sink = {0};
+
+// BENCH_SOURCE being sent, continued when the HLApp makes room in the ring
+typedef struct BenchSource {
+    bool active;
+    bench_mode_t mode;
+    uint32_t count;
+    uint32_t size;
+    uint32_t batch;
+    uint32_t sent;
+    uint32_t seq;
+} BenchSource;
+
+static BenchSource source = {.active = false};
+
+// Copies size bytes from srcOffset of a message held in src to dstOffset of
+// one held in dst, either may wrap around the end of its ring buffer
+static void copySegments(Socket_Segments *dst, uint32_t dstOffset,
+    const Socket_Segments *src, uint32_t srcOffset, uint32_t size)
+{
+    unsigned d = 0, s = 0;
+    if (dstOffset >= dst->size[0]) {
+        dstOffset -= dst->size[0];
+        d = 1;
+    }
+    if (srcOffset >= src->size[0]) {
+        srcOffset -= src->size[0];
+        s = 1;
+    }
+
+    while (size > 0) {
+        uint32_t chunk = MIN(MIN(dst->size[d] - dstOffset, src->size[s] - srcOffset), size);
+        __builtin_memcpy(dst->data[d] + dstOffset, src->data[s] + srcOffset, chunk);
+        dstOffset += chunk;
+        srcOffset += chunk;
+        size -= chunk;
+        if (dstOffset == dst->size[d]) {
+            dstOffset = 0;
+            d++;
+        }
+        if (srcOffset == src->size[s]) {
+            srcOffset = 0;
+            s++;
+        }
+    }
+}
+
+static inline Socket_Segments linearSegments(void *data, uint32_t size)
+{
+    Socket_Segments segments = {.data = {data, NULL}, .size = {size, 0}};
+    return segments;
+}
+
+static void countSink(const bench_header_t *header, uint32_t size)
+{
+    uint32_t now = GPT_GetCount(timestamps);
+    if (sink.messages == 0) {
+        sink.first = now;
+    } else if (header->seq != sink.nextSeq) {
+        sink.lost += header->seq - sink.nextSeq;
+    }
+    sink.last = now;
+    sink.nextSeq = header->seq + 1;
+    sink.messages++;
+    sink.bytes += size;
+}
+
+static void sendSinkReport(uint32_t seq)
+{
+    float hz = 0;
+    GPT_GetSpeed(timestamps, &hz);
+
+    bench_sink_report_t report = {
+        .header = {.command = BENCH_SINK_REPORT, .seq = seq},
+        .messages = sink.messages,
+        .bytes = sink.bytes,
+        .lost = sink.lost,
+        .ticks = sink.last - sink.first,
+        .tick_hz = (uint32_t)hz};
+    sink = (BenchSink){0};
+
+    // ahead of any BENCH_DATA still queued in QUEUED mode
+    if (Socket_Send(socket, &A7ID, SOCKET_PRIORITY_CONTROL, &report, sizeof(report)) != ERROR_NONE) {
+        UART_Print(debug, "ERROR: sending sink report\r\n");
+    }
+}
+
+// Sends records of the current BENCH_SOURCE until the ring buffer or queue is
+// full, the HLApp reading from the ring calls it again
+static void runSource(void)
+{
+    while (source.active && (source.sent < source.count)) {
+        uint32_t batch = MIN(source.batch, source.count - source.sent);
+        uint32_t size = source.size * batch;
+        bench_header_t header = {.command = BENCH_DATA, .seq = source.seq};
+        int32_t error;
+
+        if (source.mode == BENCH_MODE_ZERO_COPY) {
+            // records are produced in place, as a real producer would
+            Socket_Segments segments;
+            error = Socket_Reserve(socket, size, &segments);
+            if (error == ERROR_NONE) {
+                __builtin_memset(segments.data[0], 0x5a, segments.size[0]);
+                if (segments.size[1] > 0) {
+                    __builtin_memset(segments.data[1], 0x5a, segments.size[1]);
+                }
+                Socket_Segments from = linearSegments(&header, sizeof(header));
+                copySegments(&segments, 0, &from, 0, sizeof(header));
+                error = Socket_Commit(socket, &A7ID, size);
+            }
+        } else {
+            __builtin_memcpy(buffer, &header, sizeof(header));
+            if (source.mode == BENCH_MODE_QUEUED) {
+                error = Socket_Send(socket, &A7ID, SOCKET_PRIORITY_BULK, buffer, size);
+            } else {
+                error = Socket_Write(socket, &A7ID, buffer, size);
+            }
+        }
+
+        if (error == ERROR_SOCKET_INSUFFICIENT_SPACE) {
+            return;
+        }
+        if (error != ERROR_NONE) {
+            UART_Printf(debug, "ERROR: sending source records - %ld\r\n", error);
+            source.active = false;
+            return;
+        }
+
+        source.sent += batch;
+        source.seq++;
+    }
+
+    source.active = false;
+}
+
+static void startSource(const bench_source_message_t *request)
+{
+    if ((request->mode >= BENCH_MODE_COUNT) || (request->size < sizeof(bench_header_t)) ||
+        (request->batch == 0) || ((uint32_t)request->size * request->batch > BENCH_MAX_MESSAGE_SIZE)) {
+        UART_Print(debug, "ERROR: invalid source request\r\n");
+        return;
+    }
+
+    source.active = true;
+    source.mode = request->mode;
+    source.count = request->count;
+    source.size = request->size;
+    source.batch = request->batch;
+    source.sent = 0;
+    source.seq = 0;
+
+    __builtin_memset(buffer, 0x5a, sizeof(buffer));
+    runSource();
+}
+
+static void replyHeader(const bench_header_t *header)
+{
+    if (Socket_Send(socket, &A7ID, SOCKET_PRIORITY_CONTROL, header, sizeof(*header)) != ERROR_NONE) {
+        UART_Print(debug, "ERROR: sending reply\r\n");
+    }
+}
+
+// Handles a message copied out of the ring into buffer
+static void handleMessage(uint32_t size)
+{
+    const bench_header_t *header = (const bench_header_t *)buffer;
+    switch (header->command) {
+        case BENCH_SINK:
+            countSink(header, size);
+            break;
+
+        case BENCH_SINK_REPORT:
+            sendSinkReport(header->seq);
+            break;
+
+        case BENCH_ECHO:
+            if (mode == BENCH_MODE_QUEUED) {
+                Socket_Send(socket, &A7ID, SOCKET_PRIORITY_BULK, buffer, size);
+            } else {
+                Socket_Write(socket, &A7ID, buffer, size);
+            }
+            break;
+
+        case BENCH_MODE:
+            if ((size >= sizeof(bench_mode_message_t)) &&
+                (((const bench_mode_message_t *)buffer)->mode < BENCH_MODE_COUNT)) {
+                mode = ((const bench_mode_message_t *)buffer)->mode;
+            }
+            replyHeader(header);
+            break;
+
+        case BENCH_SOURCE:
+            if (size >= sizeof(bench_source_message_t)) {
+                bench_source_message_t request;
+                __builtin_memcpy(&request, buffer, sizeof(request));
+                startSource(&request);
+            }
+            break;
+
+        default:
+            UART_Printf(debug, "ERROR: unknown command %ld\r\n", header->command);
+    }
+}
+
+// Handles a message in place in the ring, only what's needed is copied out
+static void handleSegments(Socket_Segments *segments, uint32_t size)
+{
+    bench_header_t header;
+    Socket_Segments to = linearSegments(&header, sizeof(header));
+    copySegments(&to, 0, segments, 0, sizeof(header));
+
+    Socket_Segments reply;
+    switch (header.command) {
+        case BENCH_SINK:
+            countSink(&header, size);
+            break;
+
+        case BENCH_ECHO:
+            if (Socket_Reserve(socket, size, &reply) == ERROR_NONE) {
+                copySegments(&reply, 0, segments, 0, size);
+                Socket_Commit(socket, &A7ID, size);
+            }
+            break;
+
+        default:
+            // the rest aren't timed, handle them as copies
+            to = linearSegments(buffer, size);
+            copySegments(&to, 0, segments, 0, size);
+            handleMessage(size);
+    }
+}
+
+static void handleRecvMsg(void *data)
+{
+    if (Socket_NegotiationPending(socket)) {
+        if (Socket_Negotiate(socket) != ERROR_NONE) {
+            UART_Print(debug, "ERROR: renegotiating socket connection\r\n");
+        }
+    }
+
+    // one interrupt may stand for several messages, take all there are
+    for (;;) {
+        Component_Id sender;
+        if (mode == BENCH_MODE_ZERO_COPY) {
+            Socket_Segments segments;
+            if (Socket_Peek(socket, &sender, &segments) != ERROR_NONE) {
+                break;
+            }
+            uint32_t size = segments.size[0] + segments.size[1];
+            if ((size >= sizeof(bench_header_t)) && (size <= BENCH_MAX_MESSAGE_SIZE)) {
+                handleSegments(&segments, size);
+            }
+            Socket_Consume(socket);
+        } else {
+            uint32_t size = sizeof(buffer);
+            if (Socket_Read(socket, &sender, buffer, &size) != ERROR_NONE) {
+                break;
+            }
+            if (size >= sizeof(bench_header_t)) {
+                handleMessage(size);
+            }
+        }
+    }
+}
+
+// The HLApp read from the ring buffer, write what waited for room
+static void handleSendSpace(void *data)
+{
+    Socket_Flush(socket);
+    runSource();
+}
+
+static void handleRecvMsgWrapper(Socket *handle)
+{
+    static Scheduler_Task task = SCHEDULER_TASK(handleRecvMsg, SCHEDULER_PRIORITY_NORMAL, 0);
+    Scheduler_Post(&task);
+}
+
+static void handleSendSpaceWrapper(Socket *handle)
+{
+    static Scheduler_Task task = SCHEDULER_TASK(handleSendSpace, SCHEDULER_PRIORITY_NORMAL, 0);
+    Scheduler_Post(&task);
+}
+
+_Noreturn void RTCoreMain(void)
+{
+    VectorTableInit();
+    CPUFreq_Set(197600000);
+
+    debug = UART_Open(MT3620_UNIT_UART_DEBUG, 115200, UART_PARITY_NONE, 1, NULL);
+    UART_Print(debug, "--------------------------------\r\n");
+    UART_Print(debug, "IntercoreBenchmark_RTApp\r\n");
+    UART_Print(debug, "App built on: " __DATE__ " " __TIME__ "\r\n");
+
+    timestamps = GPT_Open(MT3620_UNIT_GPT4, CPUFreq_Get(), GPT_MODE_NONE);
+    if (Scheduler_Init(timestamps) != ERROR_NONE) {
+        UART_Print(debug, "ERROR: GPT4 initialisation failed\r\n");
+        Scheduler_Init(NULL);
+    }
+
+    socket = Socket_Open(handleRecvMsgWrapper);
+    if (!socket) {
+        UART_Print(debug, "ERROR: socket initialisation failed\r\n");
+    }
+    Socket_SetTxCallback(socket, handleSendSpaceWrapper);
+
+    Scheduler_Run();
+}
@@ -0,0 +1,83 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+// Messages between the benchmark HLApp and RTApp. Every message starts with a
+// bench_header_t, and sizes count the header. Both cores are little endian, so
+// the packed structs go on the wire as they are.
+
+// max payload of one intercore message the A7 can send
+#define BENCH_MAX_MESSAGE_SIZE 1024
+
+typedef enum {
+    // A7 to M4, counted and dropped
+    BENCH_SINK = 1,
+    // A7 to M4, answered with a bench_sink_report_t covering the BENCH_SINK
+    // messages since the previous report
+    BENCH_SINK_REPORT,
+    // A7 to M4, sent back unchanged
+    BENCH_ECHO,
+    // A7 to M4, a bench_mode_message_t setting how the M4 reads and writes the
+    // ring buffers from now on, answered with its header
+    BENCH_MODE,
+    // A7 to M4, a bench_source_message_t, the M4 then sends count records as
+    // fast as the ring buffer takes them, as BENCH_DATA
+    BENCH_SOURCE,
+    // M4 to A7, batch records of size bytes back to back, the header is at the
+    // start of the first
+    BENCH_DATA
+} bench_command_t;
+
+typedef enum {
+    // Socket_Read and Socket_Write, through a buffer of the M4's
+    BENCH_MODE_COPY,
+    // Socket_Peek/Socket_Consume and Socket_Reserve/Socket_Commit, in place in
+    // the ring buffers
+    BENCH_MODE_ZERO_COPY,
+    // Socket_Read and Socket_Send, through the M4's bulk queue
+    BENCH_MODE_QUEUED,
+    BENCH_MODE_COUNT
+} bench_mode_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t command;
+    uint32_t seq;
+} bench_header_t;
+
+_Static_assert(sizeof(bench_header_t) == 8, "bench_header_t wire size");
+
+typedef struct __attribute__((packed)) {
+    bench_header_t header;
+    uint32_t mode;
+} bench_mode_message_t;
+
+_Static_assert(sizeof(bench_mode_message_t) == 12, "bench_mode_message_t wire size");
+
+typedef struct __attribute__((packed)) {
+    bench_header_t header;
+    // bench_mode_t the records are sent with
+    uint32_t mode;
+    // records to send in total, of size bytes each and batch of them per
+    // message, size * batch no more than BENCH_MAX_MESSAGE_SIZE
+    uint32_t count;
+    uint16_t size;
+    uint16_t batch;
+} bench_source_message_t;
+
+_Static_assert(sizeof(bench_source_message_t) == 20, "bench_source_message_t wire size");
+
+typedef struct __attribute__((packed)) {
+    bench_header_t header;
+    uint32_t messages;
+    uint32_t bytes;
+    // BENCH_SINK messages missing from the seq numbers
+    uint32_t lost;
+    // M4 time from the first BENCH_SINK message to the last, in ticks of tick_hz
+    uint32_t ticks;
+    uint32_t tick_hz;
+} bench_sink_report_t;
+
+_Static_assert(sizeof(bench_sink_report_t) == 28, "bench_sink_report_t wire size");
@@ -0,0 +1,468 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "lfsBench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define CHUNK_SIZE        4096
+#define MAX_FILE_SIZE     (256 * 1024)
+#define RANDOM_OPS        32            // reads, and as many writes
+#define LOG_RECORD_SIZE   64
+#define LOG_SYNC_EVERY    8
+#define MAX_LOG_RECORDS   1024
+#define SMALL_FILE_SIZE   32
+#define MAX_SMALL_FILES   64
+
+typedef struct {
+    uint32_t reads;
+    uint32_t progs;
+    uint32_t erases;
+    uint32_t syncs;
+    uint64_t readBytes;
+    uint64_t progBytes;
+} Counts;
+
+typedef struct {
+    uint32_t fileSize;
+    uint32_t logRecords;
+    uint32_t smallFiles;
+} Sizes;
+
+typedef struct {
+    const char* name;
+    int (*run)(lfs_t* lfs, const Sizes* sizes, uint32_t* ops, uint64_t* bytes);
+} Workload;
+
+// the callbacks of the backend being measured, and what LittleFs has asked of them
+static const struct lfs_config* target = NULL;
+static Counts counts;
+
+static uint8_t chunk[CHUNK_SIZE];
+static uint8_t readBack[CHUNK_SIZE];
+
+static int CountedRead(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size)
+{
+    counts.reads++;
+    counts.readBytes += size;
+    return target->read(target, block, off, buffer, size);
+}
+
+static int CountedProg(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size)
+{
+    counts.progs++;
+    counts.progBytes += size;
+    return target->prog(target, block, off, buffer, size);
+}
+
+static int CountedErase(const struct lfs_config* c, lfs_block_t block)
+{
+    counts.erases++;
+    return target->erase(target, block);
+}
+
+static int CountedSync(const struct lfs_config* c)
+{
+    counts.syncs++;
+    return target->sync(target);
+}
+
+static int RamRead(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size)
+{
+    const LfsBench_RamDisk* disk = c->context;
+    memcpy(buffer, &disk->data[block * c->block_size + off], size);
+    return LFS_ERR_OK;
+}
+
+static int RamProg(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size)
+{
+    LfsBench_RamDisk* disk = c->context;
+    memcpy(&disk->data[block * c->block_size + off], buffer, size);
+    return LFS_ERR_OK;
+}
+
+static int RamErase(const struct lfs_config* c, lfs_block_t block)
+{
+    LfsBench_RamDisk* disk = c->context;
+    memset(&disk->data[block * c->block_size], 0xFF, c->block_size);
+    return LFS_ERR_OK;
+}
+
+static int RamSync(const struct lfs_config* c)
+{
+    return LFS_ERR_OK;
+}
+
+int LfsBench_RamDiskInit(LfsBench_RamDisk* disk, const struct lfs_config* geometry, uint32_t size)
+{
+    memset(&disk->config, 0, sizeof(disk->config));
+    disk->config.block_count = size / geometry->block_size;
+    if (disk->config.block_count < 2)
+    {
+        return LFS_ERR_INVAL;
+    }
+
+    disk->data = malloc(disk->config.block_count * geometry->block_size);
+    if (!disk->data)
+    {
+        return LFS_ERR_NOMEM;
+    }
+
+    disk->config.context = disk;
+    disk->config.read = RamRead;
+    disk->config.prog = RamProg;
+    disk->config.erase = RamErase;
+    disk->config.sync = RamSync;
+    disk->config.read_size = geometry->read_size;
+    disk->config.prog_size = geometry->prog_size;
+    disk->config.block_size = geometry->block_size;
+    disk->config.block_cycles = geometry->block_cycles;
+    disk->config.cache_size = geometry->cache_size;
+    // one bit per block, in multiples of 8 bytes
+    disk->config.lookahead_size = MIN(geometry->lookahead_size, ((disk->config.block_count + 63) / 64) * 8);
+    disk->config.name_max = geometry->name_max;
+    return LFS_ERR_OK;
+}
+
+void LfsBench_RamDiskDeinit(LfsBench_RamDisk* disk)
+{
+    free(disk->data);
+    disk->data = NULL;
+}
+
+/// <summary>
+/// Fills chunk with a pattern which differs per chunk of the file, so reads are checked
+/// </summary>
+static void FillChunk(uint32_t offset)
+{
+    for (uint32_t i = 0; i < CHUNK_SIZE; i++)
+    {
+        chunk[i] = (uint8_t)((offset / CHUNK_SIZE) * 31 + i);
+    }
+}
+
+// A fixed sequence, so every backend sees the same offsets
+static uint32_t NextRandom(uint32_t* state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static int SeqWrite(lfs_t* lfs, const Sizes* sizes, uint32_t* ops, uint64_t* bytes)
+{
+    lfs_file_t file;
+    int result = lfs_file_open(lfs, &file, "/bench/seq", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+    if (result != LFS_ERR_OK)
+    {
+        return result;
+    }
+
+    for (uint32_t offset = 0; offset < sizes->fileSize; offset += CHUNK_SIZE)
+    {
+        FillChunk(offset);
+        lfs_ssize_t written = lfs_file_write(lfs, &file, chunk, CHUNK_SIZE);
+        if (written != CHUNK_SIZE)
+        {
+            lfs_file_close(lfs, &file);
+            return (written < 0) ? (int)written : LFS_ERR_NOSPC;
+        }
+        (*ops)++;
+        *bytes += CHUNK_SIZE;
+    }
+
+    return lfs_file_close(lfs, &file);
+}
+
+static int SeqRead(lfs_t* lfs, const Sizes* sizes, uint32_t* ops, uint64_t* bytes)
+{
+    lfs_file_t file;
+    int result = lfs_file_open(lfs, &file, "/bench/seq", LFS_O_RDONLY);
+    if (result != LFS_ERR_OK)
+    {
+        return result;
+    }
+
+    for (uint32_t offset = 0; offset < sizes->fileSize; offset += CHUNK_SIZE)
+    {
+        lfs_ssize_t read = lfs_file_read(lfs, &file, readBack, CHUNK_SIZE);
+        FillChunk(offset);
+        if ((read != CHUNK_SIZE) || (memcmp(readBack, chunk, CHUNK_SIZE) != 0))
+        {
+            lfs_file_close(lfs, &file);
+            return (read < 0) ? (int)read : LFS_ERR_CORRUPT;
+        }
+        (*ops)++;
+        *bytes += CHUNK_SIZE;
+    }
+
+    return lfs_file_close(lfs, &file);
+}
+
+static int Random4K(lfs_t* lfs, const Sizes* sizes, uint32_t* ops, uint64_t* bytes)
+{
+    lfs_file_t file;
+    int result = lfs_file_open(lfs, &file, "/bench/seq", LFS_O_RDWR);
+    if (result != LFS_ERR_OK)
+    {
+        return result;
+    }
+
+    uint32_t chunks = sizes->fileSize / CHUNK_SIZE;
+    uint32_t state = 1;
+    for (uint32_t i = 0; (result == LFS_ERR_OK) && (i < 2 * RANDOM_OPS); i++)
+    {
+        // a write is the same data again, so later reads still check out
+        uint32_t offset = (NextRandom(&state) % chunks) * CHUNK_SIZE;
+        lfs_soff_t position = lfs_file_seek(lfs, &file, (lfs_soff_t)offset, LFS_SEEK_SET);
+        if (position < 0)
+        {
+            result = (int)position;
+            break;
+        }
+
+        FillChunk(offset);
+        if ((i % 2) == 0)
+        {
+            lfs_ssize_t read = lfs_file_read(lfs, &file, readBack, CHUNK_SIZE);
+            if ((read != CHUNK_SIZE) || (memcmp(readBack, chunk, CHUNK_SIZE) != 0))
+            {
+                result = (read < 0) ? (int)read : LFS_ERR_CORRUPT;
+            }
+        }
+        else
+        {
+            lfs_ssize_t written = lfs_file_write(lfs, &file, chunk, CHUNK_SIZE);
+            if (written != CHUNK_SIZE)
+            {
+                result = (written < 0) ? (int)written : LFS_ERR_NOSPC;
+            }
+            else
+            {
+                result = lfs_file_sync(lfs, &file);
+            }
+        }
+        (*ops)++;
+        *bytes += CHUNK_SIZE;
+    }
+
+    int closed = lfs_file_close(lfs, &file);
+    return (result != LFS_ERR_OK) ? result : closed;
+}
+
+static int LogAppend(lfs_t* lfs, const Sizes* sizes, uint32_t* ops, uint64_t* bytes)
+{
+    lfs_file_t file;
+    int result = lfs_file_open(lfs, &file, "/bench/log", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND);
+    if (result != LFS_ERR_OK)
+    {
+        return result;
+    }
+
+    char record[LOG_RECORD_SIZE];
+    for (uint32_t i = 0; (result == LFS_ERR_OK) && (i < sizes->logRecords); i++)
+    {
+        memset(record, ' ', sizeof(record));
+        int length = snprintf(record, sizeof(record), "%u,sample,%u", i, i * 7);
+        record[length] = ' ';
+        record[sizeof(record) - 1] = '\n';
+
+        lfs_ssize_t written = lfs_file_write(lfs, &file, record, sizeof(record));
+        if (written != sizeof(record))
+        {
+            result = (written < 0) ? (int)written : LFS_ERR_NOSPC;
+            break;
+        }
+        if (((i + 1) % LOG_SYNC_EVERY) == 0)
+        {
+            result = lfs_file_sync(lfs, &file);
+        }
+        (*ops)++;
+        *bytes += sizeof(record);
+    }
+
+    int closed = lfs_file_close(lfs, &file);
+    return (result != LFS_ERR_OK) ? result : closed;
+}
+
+static int Metadata(lfs_t* lfs, const Sizes* sizes, uint32_t* ops, uint64_t* bytes)
+{
+    char path[32];
+    int result = lfs_mkdir(lfs, "/bench/meta");
+    if (result != LFS_ERR_OK)
+    {
+        return result;
+    }
+
+    FillChunk(0);
+    for (uint32_t i = 0; i < sizes->smallFiles; i++)
+    {
+        lfs_file_t file;
+        snprintf(path, sizeof(path), "/bench/meta/f%03u", i);
+        result = lfs_file_open(lfs, &file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL);
+        if (result != LFS_ERR_OK)
+        {
+            return result;
+        }
+        lfs_ssize_t written = lfs_file_write(lfs, &file, chunk, SMALL_FILE_SIZE);
+        result = lfs_file_close(lfs, &file);
+        if (written != SMALL_FILE_SIZE)
+        {
+            return (written < 0) ? (int)written : LFS_ERR_NOSPC;
+        }
+        if (result != LFS_ERR_OK)
+        {
+            return result;
+        }
+        (*ops)++;
+        *bytes += SMALL_FILE_SIZE;
+    }
+
+    for (uint32_t i = 0; i < sizes->smallFiles; i++)
+    {
+        struct lfs_info info;
+        snprintf(path, sizeof(path), "/bench/meta/f%03u", i);
+        result = lfs_stat(lfs, path, &info);
+        if (result != LFS_ERR_OK)
+        {
+            return result;
+        }
+        if (info.size != SMALL_FILE_SIZE)
+        {
+            return LFS_ERR_CORRUPT;
+        }
+        (*ops)++;
+    }
+
+    for (uint32_t i = 0; i < sizes->smallFiles; i++)
+    {
+        snprintf(path, sizeof(path), "/bench/meta/f%03u", i);
+        result = lfs_remove(lfs, path);
+        if (result != LFS_ERR_OK)
+        {
+            return result;
+        }
+        (*ops)++;
+    }
+
+    return lfs_remove(lfs, "/bench/meta");
+}
+
+// In order, seq-read and rand-4k use the file seq-write leaves.
+static const Workload workloads[] = {
+    { "seq-write", SeqWrite },
+    { "seq-read", SeqRead },
+    { "rand-4k", Random4K },
+    { "log-append", LogAppend },
+    { "metadata", Metadata },
+};
+
+static double Now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static void Report(const LfsBench_Backend* backend, const char* workload, uint32_t ops, uint64_t bytes,
+    double seconds, const BlockCache* cacheBefore)
+{
+    if (seconds <= 0.0)
+    {
+        seconds = 1e-9;
+    }
+
+    Log_Debug("%s %-10s %6u ops %9.1f ops/s %9.1f KB/s  read %u (%llu KB) prog %u (%llu KB) erase %u sync %u\n",
+        backend->name, workload, ops, ops / seconds, (bytes / 1024.0) / seconds,
+        counts.reads, (unsigned long long)(counts.readBytes / 1024), counts.progs,
+        (unsigned long long)(counts.progBytes / 1024), counts.erases, counts.syncs);
+
+    if (backend->cache)
+    {
+        Log_Debug("%s %-10s cache hits %u misses %u read-aheads %u write-backs %u\n", backend->name, workload,
+            backend->cache->hits - cacheBefore->hits, backend->cache->misses - cacheBefore->misses,
+            backend->cache->readAheads - cacheBefore->readAheads,
+            backend->cache->writeBacks - cacheBefore->writeBacks);
+    }
+}
+
+int LfsBench_Run(const LfsBench_Backend* backend)
+{
+    static lfs_t lfs;
+
+    // LittleFs calls the wrappers, which pass the backend its own config
+    struct lfs_config config = *backend->config;
+    config.read = CountedRead;
+    config.prog = CountedProg;
+    config.erase = CountedErase;
+    config.sync = CountedSync;
+    target = backend->config;
+
+    uint32_t capacity = config.block_size * config.block_count;
+    Sizes sizes = {
+        .fileSize = MIN(capacity / 4, MAX_FILE_SIZE) / CHUNK_SIZE * CHUNK_SIZE,
+        .logRecords = MIN(capacity / 8 / LOG_RECORD_SIZE, MAX_LOG_RECORDS),
+        .smallFiles = MAX_SMALL_FILES,
+    };
+    if (sizes.fileSize < CHUNK_SIZE)
+    {
+        Log_Debug("%s: %u bytes is too small to benchmark\n", backend->name, capacity);
+        return LFS_ERR_NOSPC;
+    }
+
+    Log_Debug("%s: benchmarking %u blocks of %u bytes, %u KB file, %u log records, %u small files\n",
+        backend->name, config.block_count, config.block_size, sizes.fileSize / 1024, sizes.logRecords,
+        sizes.smallFiles);
+
+    int result = lfs_format(&lfs, &config);
+    if (result == LFS_ERR_OK)
+    {
+        result = lfs_mount(&lfs, &config);
+    }
+    if (result != LFS_ERR_OK)
+    {
+        Log_Debug("%s: format and mount failed (%d)\n", backend->name, result);
+        return result;
+    }
+
+    result = lfs_mkdir(&lfs, "/bench");
+    for (size_t i = 0; (result == LFS_ERR_OK) && (i < sizeof(workloads) / sizeof(workloads[0])); i++)
+    {
+        BlockCache cacheBefore = { 0 };
+        if (backend->cache)
+        {
+            cacheBefore = *backend->cache;
+        }
+        memset(&counts, 0, sizeof(counts));
+
+        uint32_t ops = 0;
+        uint64_t bytes = 0;
+        double start = Now();
+        result = workloads[i].run(&lfs, &sizes, &ops, &bytes);
+        if ((result == LFS_ERR_OK) && backend->flush && (backend->flush() != 0))
+        {
+            result = LFS_ERR_IO;
+        }
+        double seconds = Now() - start;
+
+        if (result != LFS_ERR_OK)
+        {
+            Log_Debug("%s %-10s failed (%d)\n", backend->name, workloads[i].name, result);
+            break;
+        }
+        Report(backend, workloads[i].name, ops, bytes, seconds, &cacheBefore);
+    }
+
+    lfs_remove(&lfs, "/bench/seq");
+    lfs_remove(&lfs, "/bench/log");
+    lfs_remove(&lfs, "/bench");
+    lfs_unmount(&lfs);
+    target = NULL;
+    return result;
+}
@@ -0,0 +1,61 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "lfs.h"
+#include "blockCache.h"
+
+// LittleFs workload benchmark, run against the lfs_config of any backend.
+//
+// The backend's callbacks are wrapped to count the reads, programs, erases and
+// syncs LittleFs makes, then these workloads run in order on a freshly
+// formatted filesystem, each reporting ops/s, bytes/s and its callback counts
+// through Log_Debug:
+//
+//   seq-write   one file written 4 KB at a time
+//   seq-read    the same file read back 4 KB at a time
+//   rand-4k     4 KB reads and synced 4 KB overwrites at random offsets of it
+//   log-append  64 byte records appended to a log, synced every 8
+//   metadata    many small files created, stat'd and removed
+//
+// Sizes scale with the filesystem, up to a 256 KB file. The benchmark formats
+// the backend, anything stored on it is lost. Only one runs at a time.
+
+// RAM disk size for the baseline, in bytes.
+#define LFS_BENCH_RAM_SIZE (128 * 1024)
+
+typedef struct {
+    // printed with each result
+    const char* name;
+    // geometry and callbacks of the backend, the benchmark formats it
+    const struct lfs_config* config;
+    // optional, the cache's hits, misses, read-aheads and write-backs are reported
+    BlockCache* cache;
+    // optional, waits for writes still in flight when a workload ends, so they're timed
+    int (*flush)(void);
+} LfsBench_Backend;
+
+// A RAM disk with the geometry of another backend, for a baseline without any device.
+typedef struct {
+    struct lfs_config config;
+    uint8_t* data;
+} LfsBench_RamDisk;
+
+/// <summary>
+/// Allocates a RAM disk of size bytes, with the block, read, prog, cache and lookahead
+/// sizes of geometry. Returns 0 on success
+/// </summary>
+int LfsBench_RamDiskInit(LfsBench_RamDisk* disk, const struct lfs_config* geometry, uint32_t size);
+
+/// <summary>
+/// Frees the RAM disk
+/// </summary>
+void LfsBench_RamDiskDeinit(LfsBench_RamDisk* disk);
+
+/// <summary>
+/// Formats the backend and runs every workload on it, returns 0 or the first LittleFs error
+/// </summary>
+int LfsBench_Run(const LfsBench_Backend* backend);
@@ -11,7 +11,11 @@
 #include <applibs/networking.h>
 #include <signal.h>
 
-#include "remoteDiskIO.h"
+#include <applibs/eventloop.h>
+
+#include "remoteDiskAsync.h"
+#include "blockCache.h"
+#include "lfsBench.h"
 
 #include "littlefs/lfs.h"
 #include "littlefs/lfs_util.h"
@@ -24,12 +28,32 @@
 #define BLOCK_SIZE    (16 * SECTOR_SIZE)
 #define TOTAL_SIZE    (64 * BLOCK_SIZE)
 
-static int storage_read(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size);
-static int storage_program(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size);
-static int storage_erase(const struct lfs_config* c, lfs_block_t block);
-static int storage_sync(const struct lfs_config* c);
+// Every remote disk access is an HTTP request, so pages are cached and read
+// ahead (bounded by REMOTE_DISK_ASYNC_MAX_SIZE), and only written back when
+// LittleFs syncs. The write back is queued and sent in the background.
+#define CACHE_PAGES       32
+#define CACHE_READ_AHEAD  8
+
+static int storage_read(void* context, uint32_t page, uint32_t count, void* buffer);
+static int storage_program(void* context, uint32_t page, uint32_t count, const void* buffer);
+static int storage_program_ranges(void* context, const BlockCache_Range* ranges, uint32_t count, const void* buffer);
+static int storage_sync(void* context);
 
+static EventLoop* eventLoop = NULL;
 static lfs_t lfs;
+static BlockCache blockCache;
+
+static const BlockCache_Config blockCacheConfig = {
+    .lineSize = PAGE_SIZE,
+    .capacity = CACHE_PAGES,
+    .readAhead = CACHE_READ_AHEAD,
+    .read = storage_read,
+    .prog = storage_program,
+    .progRanges = storage_program_ranges,
+    .erase = NULL,
+    .sync = storage_sync,
+    .context = NULL,
+};
 static lfs_file_t file;
 
 char* content = "Test";
@@ -37,53 +61,114 @@ char buffer[512] = { 0 };
 
 const struct lfs_config g_littlefs_config = {
     // block device operations
-    .read = storage_read,
-    .prog = storage_program,
-    .erase = storage_erase,
-    .sync = storage_sync,
-    .read_size = 16,
+    .context = &blockCache,
+    .read = BlockCache_Read,
+    .prog = BlockCache_Prog,
+    .erase = BlockCache_Erase,
+    .sync = BlockCache_Sync,
+    // reads and writes are whole cache pages, and the lookahead covers every
+    // block (one bit each) so allocation never rescans the disk
+    .read_size = PAGE_SIZE,
     .prog_size = PAGE_SIZE,
     .block_size = SECTOR_SIZE,
     .block_count = TOTAL_SIZE / SECTOR_SIZE,
     .block_cycles = 1000000,
-    .cache_size = PAGE_SIZE,
-    .lookahead_size = 16,
+    .cache_size = 4 * PAGE_SIZE,
+    .lookahead_size = TOTAL_SIZE / SECTOR_SIZE / 8,
 };
 
-static int storage_read(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size)
+// Pages are addressed from the start of the disk, LittleFs block plus offset
+// has already been resolved by the block cache.
+static int storage_read(void* context, uint32_t page, uint32_t count, void* buffer)
 {
-    uint8_t* data = readBlockData(off, size);
-
-    if (data != NULL)
+    if (remoteDiskAsyncRead(page * PAGE_SIZE, buffer, count * PAGE_SIZE) != 0)
     {
-        memcpy(buffer, data, size);
+        return LFS_ERR_IO;
     }
 
     return LFS_ERR_OK;
 }
 
-static int storage_program(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size)
+// Writes are acknowledged once they're queued, a failure in the background is
+// reported by the next sync.
+static int storage_program(void* context, uint32_t page, uint32_t count, const void* buffer)
 {
-    writeBlockData(buffer, size, off);
+    if (remoteDiskAsyncWrite(page * PAGE_SIZE, buffer, count * PAGE_SIZE) != 0)
+    {
+        return LFS_ERR_IO;
+    }
 
     return LFS_ERR_OK;
 }
 
-static int storage_erase(const struct lfs_config* c, lfs_block_t block)
+// A sync usually leaves several separate runs of dirty pages, they're
+// written back with a single request.
+static int storage_program_ranges(void* context, const BlockCache_Range* ranges, uint32_t count, const void* buffer)
 {
+    remoteDiskRange diskRanges[REMOTE_DISK_ASYNC_MAX_RANGES];
+    if (count > REMOTE_DISK_ASYNC_MAX_RANGES)
+    {
+        return LFS_ERR_IO;
+    }
+
+    for (uint32_t x = 0; x < count; x++)
+    {
+        diskRanges[x].offset = ranges[x].line * PAGE_SIZE;
+        diskRanges[x].size = ranges[x].count * PAGE_SIZE;
+    }
+
+    if (remoteDiskAsyncWriteRanges(diskRanges, count, buffer) != 0)
+    {
+        return LFS_ERR_IO;
+    }
+
     return LFS_ERR_OK;
 }
 
-static int storage_sync(const struct lfs_config* c)
+// Doesn't wait for the queued writes, only reports any that have failed.
+static int storage_sync(void* context)
 {
+    if (remoteDiskAsyncCheckWrites() != 0)
+    {
+        return LFS_ERR_IO;
+    }
+
     return LFS_ERR_OK;
 }
 
+#ifdef LFS_BENCHMARK
+// Runs the LittleFs workloads on a RAM disk with the remote disk's geometry,
+// then on the remote disk itself, which is reformatted.
+static void RunBenchmarks(void)
+{
+    LfsBench_RamDisk ramDisk;
+    if (LfsBench_RamDiskInit(&ramDisk, &g_littlefs_config, LFS_BENCH_RAM_SIZE) == LFS_ERR_OK)
+    {
+        const LfsBench_Backend ram = { .name = "ram", .config = &ramDisk.config };
+        LfsBench_Run(&ram);
+        LfsBench_RamDiskDeinit(&ramDisk);
+    }
+
+    const LfsBench_Backend remote = {
+        .name = "remote",
+        .config = &g_littlefs_config,
+        .cache = &blockCache,
+        .flush = remoteDiskAsyncFlush,
+    };
+    LfsBench_Run(&remote);
+}
+#endif
+
 int main(void)
 {
     // initialize Curl based on whether ENABLE_CURL_MEMORY_TRACE is defined or not
     initCurl();
 
+    eventLoop = EventLoop_Create();
+    assert(eventLoop != NULL);
+    assert(remoteDiskAsyncInit(eventLoop, TOTAL_SIZE) == 0);
+    assert(BlockCache_Init(&blockCache, &blockCacheConfig) == LFS_ERR_OK);
+
     // wait for networking...
     bool isNetworkingReady = false;
     while (!isNetworkingReady)
@@ -91,6 +176,10 @@ int main(void)
         Networking_IsNetworkingReady(&isNetworkingReady);
     }
 
+#ifdef LFS_BENCHMARK
+    RunBenchmarks();
+#endif
+
     if (lfs_mount(&lfs, &g_littlefs_config) != LFS_ERR_OK) {
         Log_Debug("Format and Mount\n");
         assert(lfs_format(&lfs, &g_littlefs_config) == LFS_ERR_OK);
@@ -110,6 +199,20 @@ int main(void)
     Log_Debug("Close the file\n");
     assert(lfs_file_close(&lfs, &file) == LFS_ERR_OK);
 
+    // the writes queued by the close are sent while the event loop runs
+    while (remoteDiskAsyncPending() > 0)
+    {
+        EventLoop_Run_Result result = EventLoop_Run(eventLoop, -1, true);
+        if (result == EventLoop_Run_Failed && errno != EINTR)
+        {
+            break;
+        }
+    }
+    assert(remoteDiskAsyncFlush() == 0);
+
+    BlockCache_Deinit(&blockCache);
+    remoteDiskAsyncClose();
+    EventLoop_Close(eventLoop);
     cleanupCurl();
 
     while (true);   // spin...
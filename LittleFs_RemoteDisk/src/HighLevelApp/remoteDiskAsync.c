@@ -0,0 +1,671 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "remoteDiskAsync.h"
+#include "eventloop_timer_utilities.h"
+
+#include <curl/curl.h>
+#include <curl/multi.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// Each request may use a connection of its own, plus one being set up.
+#define REMOTE_DISK_ASYNC_MAX_SOCKETS (REMOTE_DISK_ASYNC_QUEUE_DEPTH + 1)
+
+// Longest wait for a socket while blocked on a reply.
+#define REMOTE_DISK_ASYNC_POLL_MS 1000
+
+typedef struct {
+	bool inUse;
+	bool inMulti;
+	bool isWrite;
+	bool done;
+	// a prefetch overtaken by a write, released once it completes
+	bool stale;
+	int result;
+	CURL* easy;
+	struct curl_slist* headers;
+	remoteDiskRange ranges[REMOTE_DISK_ASYNC_MAX_RANGES];
+	uint32_t rangeCount;
+	uint32_t size;
+	// bytes received, or sent for a write
+	uint32_t pos;
+	char url[64];
+	char header[REMOTE_DISK_ASYNC_MAX_RANGES * 24 + 16];
+	uint8_t data[REMOTE_DISK_ASYNC_MAX_SIZE];
+} asyncRequest;
+
+typedef struct {
+	bool inUse;
+	curl_socket_t fd;
+	EventLoop_IoEvents events;
+	EventRegistration* registration;
+} asyncSocket;
+
+static asyncRequest requests[REMOTE_DISK_ASYNC_QUEUE_DEPTH];
+static asyncSocket sockets[REMOTE_DISK_ASYNC_MAX_SOCKETS];
+
+static EventLoop* loop = NULL;
+static EventLoopTimer* timer = NULL;
+static CURLM* multi = NULL;
+static uint32_t diskSize = 0;
+
+// when curl next wants CURL_SOCKET_TIMEOUT, in CLOCK_MONOTONIC milliseconds
+static bool timerArmed = false;
+static int64_t timerDeadline = 0;
+
+static asyncRequest* prefetch = NULL;
+static uint32_t nextSequential = UINT32_MAX;
+static bool writeFailed = false;
+
+static const char* readUrl = "http://%s:5000/ReadBlockFromOffset?offset=%u&size=%u";
+static const char* writeRangesUrl = "http://%s:5000/WriteRanges";
+
+static int64_t nowMs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((int64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+static void release(asyncRequest* req)
+{
+	if (req->inMulti)
+	{
+		curl_multi_remove_handle(multi, req->easy);
+		req->inMulti = false;
+	}
+	curl_slist_free_all(req->headers);
+	req->headers = NULL;
+
+	if (req == prefetch)
+		prefetch = NULL;
+
+	req->inUse = false;
+}
+
+// Drops the prefetch, a request still in flight is released when it completes.
+static void dropPrefetch(void)
+{
+	if (prefetch == NULL)
+		return;
+
+	if (prefetch->done)
+	{
+		release(prefetch);
+	}
+	else
+	{
+		prefetch->stale = true;
+		prefetch = NULL;
+	}
+}
+
+static void collectCompleted(void)
+{
+	CURLMsg* msg;
+	int left;
+
+	while ((msg = curl_multi_info_read(multi, &left)) != NULL)
+	{
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		CURL* easy = msg->easy_handle;
+		CURLcode res = msg->data.result;
+
+		char* privateData = NULL;
+		curl_easy_getinfo(easy, CURLINFO_PRIVATE, &privateData);
+		asyncRequest* req = (asyncRequest*)privateData;
+
+		long status = 0;
+		curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
+
+		curl_multi_remove_handle(multi, easy);
+		req->inMulti = false;
+		req->result = ((res == CURLE_OK) && (status == 200) && (req->pos == req->size)) ? 0 : -1;
+		req->done = true;
+
+		if (req->isWrite)
+		{
+			// nobody waits for a write, so a failure is only reported by the next check
+			if (req->result != 0)
+			{
+				Log_Debug("ERROR: background write of %u bytes failed\n", req->size);
+				writeFailed = true;
+			}
+			release(req);
+		}
+		else if (req->stale)
+		{
+			release(req);
+		}
+	}
+}
+
+static void socketAction(curl_socket_t fd, int flags)
+{
+	int running = 0;
+	curl_multi_socket_action(multi, fd, flags, &running);
+	collectCompleted();
+}
+
+static void ioHandler(EventLoop* el, int fd, EventLoop_IoEvents events, void* context)
+{
+	int flags = 0;
+	if (events & EventLoop_Input)
+		flags |= CURL_CSELECT_IN;
+	if (events & EventLoop_Output)
+		flags |= CURL_CSELECT_OUT;
+	if (events & EventLoop_Error)
+		flags |= CURL_CSELECT_ERR;
+
+	socketAction(fd, flags);
+}
+
+static void timerHandler(EventLoopTimer* t)
+{
+	if (ConsumeEventLoopTimerEvent(t) != 0)
+		return;
+
+	timerArmed = false;
+	socketAction(CURL_SOCKET_TIMEOUT, 0);
+}
+
+// curl asks for a socket to be watched, changed or forgotten.
+static int socketCallback(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp)
+{
+	asyncSocket* sock = socketp;
+
+	if (what == CURL_POLL_REMOVE)
+	{
+		if (sock != NULL)
+		{
+			EventLoop_UnregisterIo(loop, sock->registration);
+			sock->inUse = false;
+			curl_multi_assign(multi, s, NULL);
+		}
+		return 0;
+	}
+
+	EventLoop_IoEvents events = 0;
+	if ((what == CURL_POLL_IN) || (what == CURL_POLL_INOUT))
+		events |= EventLoop_Input;
+	if ((what == CURL_POLL_OUT) || (what == CURL_POLL_INOUT))
+		events |= EventLoop_Output;
+
+	if (sock == NULL)
+	{
+		for (int x = 0; (x < REMOTE_DISK_ASYNC_MAX_SOCKETS) && (sock == NULL); x++)
+		{
+			if (!sockets[x].inUse)
+				sock = &sockets[x];
+		}
+		if (sock == NULL)
+			return -1;
+
+		sock->registration = EventLoop_RegisterIo(loop, s, events, ioHandler, NULL);
+		if (sock->registration == NULL)
+			return -1;
+
+		sock->inUse = true;
+		sock->fd = s;
+		curl_multi_assign(multi, s, sock);
+	}
+	else if (EventLoop_ModifyIoEvents(loop, sock->registration, events) != 0)
+	{
+		return -1;
+	}
+
+	sock->events = events;
+	return 0;
+}
+
+// curl asks for CURL_SOCKET_TIMEOUT after timeoutMs, or for the timer to be stopped.
+static int timerCallback(CURLM* m, long timeoutMs, void* userp)
+{
+	if (timeoutMs < 0)
+	{
+		timerArmed = false;
+		DisarmEventLoopTimer(timer);
+		return 0;
+	}
+
+	// a zero timespec would disarm the timer, so "now" is a nanosecond
+	struct timespec delay = { .tv_sec = timeoutMs / 1000, .tv_nsec = (timeoutMs % 1000) * 1000000 };
+	if (timeoutMs == 0)
+		delay.tv_nsec = 1;
+
+	timerArmed = true;
+	timerDeadline = nowMs() + timeoutMs;
+	return (SetEventLoopTimerOneShot(timer, &delay) == 0) ? 0 : -1;
+}
+
+// Runs curl until something happens on its sockets or its timer expires. Used
+// while blocked on a reply, so it doesn't depend on the EventLoop being run.
+static void pump(void)
+{
+	struct pollfd fds[REMOTE_DISK_ASYNC_MAX_SOCKETS];
+	nfds_t count = 0;
+
+	for (int x = 0; x < REMOTE_DISK_ASYNC_MAX_SOCKETS; x++)
+	{
+		if (!sockets[x].inUse)
+			continue;
+
+		fds[count].fd = sockets[x].fd;
+		fds[count].events = ((sockets[x].events & EventLoop_Input) ? POLLIN : 0)
+			| ((sockets[x].events & EventLoop_Output) ? POLLOUT : 0);
+		fds[count].revents = 0;
+		count++;
+	}
+
+	int timeout = REMOTE_DISK_ASYNC_POLL_MS;
+	if (timerArmed)
+	{
+		int64_t remaining = timerDeadline - nowMs();
+		timeout = (remaining <= 0) ? 0 : (int)MIN(remaining, REMOTE_DISK_ASYNC_POLL_MS);
+	}
+
+	if ((poll(fds, count, timeout) < 0) && (errno != EINTR))
+	{
+		Log_Debug("ERROR: poll failed: %s (%d)\n", strerror(errno), errno);
+		return;
+	}
+
+	for (nfds_t x = 0; x < count; x++)
+	{
+		if (fds[x].revents == 0)
+			continue;
+
+		int flags = 0;
+		if (fds[x].revents & POLLIN)
+			flags |= CURL_CSELECT_IN;
+		if (fds[x].revents & POLLOUT)
+			flags |= CURL_CSELECT_OUT;
+		if (fds[x].revents & (POLLERR | POLLHUP))
+			flags |= CURL_CSELECT_ERR;
+		socketAction(fds[x].fd, flags);
+	}
+
+	if (timerArmed && (nowMs() >= timerDeadline))
+	{
+		timerArmed = false;
+		DisarmEventLoopTimer(timer);
+		socketAction(CURL_SOCKET_TIMEOUT, 0);
+	}
+}
+
+static void waitFor(asyncRequest* req)
+{
+	while (!req->done)
+		pump();
+}
+
+static bool overlaps(const asyncRequest* req, uint32_t offset, uint32_t size)
+{
+	for (uint32_t x = 0; x < req->rangeCount; x++)
+	{
+		if ((offset < req->ranges[x].offset + req->ranges[x].size) && (req->ranges[x].offset < offset + size))
+			return true;
+	}
+	return false;
+}
+
+// Waits until no queued write touches the range.
+static void waitForWrites(uint32_t offset, uint32_t size)
+{
+	for (;;)
+	{
+		bool pending = false;
+		for (int x = 0; (x < REMOTE_DISK_ASYNC_QUEUE_DEPTH) && !pending; x++)
+		{
+			pending = requests[x].inUse && requests[x].isWrite && overlaps(&requests[x], offset, size);
+		}
+		if (!pending)
+			return;
+
+		pump();
+	}
+}
+
+// Returns a free request, waiting for one to complete if wait is set and the queue is full.
+static asyncRequest* acquire(bool wait)
+{
+	for (;;)
+	{
+		for (int x = 0; x < REMOTE_DISK_ASYNC_QUEUE_DEPTH; x++)
+		{
+			if (!requests[x].inUse)
+			{
+				asyncRequest* req = &requests[x];
+				req->inUse = true;
+				req->stale = false;
+				return req;
+			}
+		}
+
+		if (!wait)
+			return NULL;
+
+		// a prefetch nobody has asked for yet gives way to real requests
+		if ((prefetch != NULL) && prefetch->done)
+		{
+			dropPrefetch();
+			continue;
+		}
+
+		pump();
+	}
+}
+
+static size_t receiveData(void* ptr, size_t size, size_t nmemb, void* userp)
+{
+	asyncRequest* req = userp;
+	size_t n = size * nmemb;
+
+	// bug out if the data returned is too large.
+	if (req->pos + n > req->size)
+		return 0;
+
+	memcpy(&req->data[req->pos], ptr, n);
+	req->pos += n;
+	return n;
+}
+
+static size_t sendData(char* dest, size_t size, size_t nmemb, void* userp)
+{
+	asyncRequest* req = userp;
+	size_t n = MIN(size * nmemb, (size_t)(req->size - req->pos));
+
+	memcpy(dest, &req->data[req->pos], n);
+	req->pos += n;
+	return n;
+}
+
+static int startRequest(asyncRequest* req)
+{
+	if (req->easy == NULL)
+	{
+		req->easy = curl_easy_init();
+		if (req->easy == NULL)
+			return -1;
+	}
+	else
+	{
+		// the multi handle keeps the connections, so they're reused across requests
+		curl_easy_reset(req->easy);
+	}
+
+	req->done = false;
+	req->result = -1;
+	req->pos = 0;
+
+	CURL* curl = req->easy;
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, (char*)req);
+	curl_easy_setopt(curl, CURLOPT_URL, req->url);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long)5);
+	// bounds how long a blocked read, or a flush, can wait for the disk host
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)10);
+	curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, -1);
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+
+	if (req->isWrite)
+	{
+		curl_easy_setopt(curl, CURLOPT_POST, 1);
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, sendData);
+		curl_easy_setopt(curl, CURLOPT_READDATA, req);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)req->size);
+
+		req->headers = curl_slist_append(req->headers, req->header);
+		req->headers = curl_slist_append(req->headers, "Content-Type: application/octet-stream");
+		req->headers = curl_slist_append(req->headers, "Expect:");
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, req->headers);
+	}
+	else
+	{
+		curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, receiveData);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, req);
+	}
+
+	if (curl_multi_add_handle(multi, curl) != CURLM_OK)
+		return -1;
+
+	req->inMulti = true;
+	return 0;
+}
+
+static int startRead(asyncRequest* req, uint32_t offset, uint32_t size)
+{
+	req->isWrite = false;
+	req->ranges[0].offset = offset;
+	req->ranges[0].size = size;
+	req->rangeCount = 1;
+	req->size = size;
+	snprintf(req->url, sizeof(req->url), readUrl, PC_HOST_IP, offset, size);
+
+	return startRequest(req);
+}
+
+static void startPrefetch(uint32_t offset, uint32_t size)
+{
+	if (offset >= diskSize)
+		return;
+
+	// only into a free slot, a prefetch never waits
+	asyncRequest* req = acquire(false);
+	if (req == NULL)
+		return;
+
+	if (startRead(req, offset, MIN(size, diskSize - offset)) != 0)
+	{
+		release(req);
+		return;
+	}
+
+	prefetch = req;
+}
+
+int remoteDiskAsyncInit(EventLoop* eventLoop, uint32_t size)
+{
+	loop = eventLoop;
+	diskSize = size;
+
+	timer = CreateEventLoopDisarmedTimer(loop, timerHandler);
+	if (timer == NULL)
+		return -1;
+
+	multi = curl_multi_init();
+	if (multi == NULL)
+	{
+		DisposeEventLoopTimer(timer);
+		timer = NULL;
+		return -1;
+	}
+
+	curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, socketCallback);
+	curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, timerCallback);
+	curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)REMOTE_DISK_ASYNC_QUEUE_DEPTH);
+
+	return 0;
+}
+
+void remoteDiskAsyncClose(void)
+{
+	for (int x = 0; x < REMOTE_DISK_ASYNC_QUEUE_DEPTH; x++)
+	{
+		if (requests[x].inUse)
+			release(&requests[x]);
+
+		if (requests[x].easy != NULL)
+		{
+			curl_easy_cleanup(requests[x].easy);
+			requests[x].easy = NULL;
+		}
+	}
+
+	if (multi != NULL)
+	{
+		curl_multi_cleanup(multi);
+		multi = NULL;
+	}
+
+	for (int x = 0; x < REMOTE_DISK_ASYNC_MAX_SOCKETS; x++)
+	{
+		if (sockets[x].inUse)
+		{
+			EventLoop_UnregisterIo(loop, sockets[x].registration);
+			sockets[x].inUse = false;
+		}
+	}
+
+	DisposeEventLoopTimer(timer);
+	timer = NULL;
+	timerArmed = false;
+	nextSequential = UINT32_MAX;
+}
+
+int remoteDiskAsyncRead(uint32_t offset, uint8_t* buffer, uint32_t size)
+{
+	if ((multi == NULL) || (size == 0) || (size > REMOTE_DISK_ASYNC_MAX_SIZE))
+		return -1;
+
+	bool sequential = (offset == nextSequential);
+	nextSequential = offset + size;
+
+	// read what the writes queued before it left
+	waitForWrites(offset, size);
+
+	asyncRequest* req = NULL;
+	bool prefetched = false;
+	if ((prefetch != NULL) && (offset >= prefetch->ranges[0].offset)
+		&& (offset + size <= prefetch->ranges[0].offset + prefetch->size))
+	{
+		req = prefetch;
+		prefetch = NULL;
+		prefetched = true;
+	}
+	else
+	{
+		dropPrefetch();
+
+		req = acquire(true);
+		if (startRead(req, offset, size) != 0)
+		{
+			release(req);
+			return -1;
+		}
+	}
+
+	// the next range is fetched while this one is waited for
+	if (sequential && (prefetch == NULL))
+		startPrefetch(offset + size, size);
+
+	waitFor(req);
+
+	// a failed prefetch is retried as an ordinary read
+	if ((req->result != 0) && prefetched)
+	{
+		if (startRead(req, offset, size) != 0)
+		{
+			release(req);
+			return -1;
+		}
+		waitFor(req);
+	}
+
+	int result = req->result;
+	if (result == 0)
+		memcpy(buffer, &req->data[offset - req->ranges[0].offset], size);
+
+	release(req);
+	return result;
+}
+
+int remoteDiskAsyncWrite(uint32_t offset, const uint8_t* data, uint32_t size)
+{
+	remoteDiskRange range = { .offset = offset, .size = size };
+	return remoteDiskAsyncWriteRanges(&range, 1, data);
+}
+
+int remoteDiskAsyncWriteRanges(const remoteDiskRange* ranges, uint32_t count, const uint8_t* data)
+{
+	if ((multi == NULL) || (count == 0) || (count > REMOTE_DISK_ASYNC_MAX_RANGES))
+		return -1;
+
+	uint32_t total = 0;
+	for (uint32_t x = 0; x < count; x++)
+		total += ranges[x].size;
+
+	if ((total == 0) || (total > REMOTE_DISK_ASYNC_MAX_SIZE))
+		return -1;
+
+	for (uint32_t x = 0; x < count; x++)
+	{
+		// requests run concurrently, so an earlier write to the same place must land first
+		waitForWrites(ranges[x].offset, ranges[x].size);
+
+		if ((prefetch != NULL) && overlaps(prefetch, ranges[x].offset, ranges[x].size))
+			dropPrefetch();
+	}
+
+	asyncRequest* req = acquire(true);
+	req->isWrite = true;
+	req->rangeCount = count;
+	req->size = total;
+	memcpy(req->ranges, ranges, count * sizeof(remoteDiskRange));
+	memcpy(req->data, data, total);
+
+	size_t pos = snprintf(req->header, sizeof(req->header), "ranges: ");
+	for (uint32_t x = 0; x < count; x++)
+	{
+		pos += snprintf(&req->header[pos], sizeof(req->header) - pos, "%s%u:%u", (x > 0 ? "," : ""),
+			ranges[x].offset, ranges[x].size);
+	}
+	snprintf(req->url, sizeof(req->url), writeRangesUrl, PC_HOST_IP);
+
+	if (startRequest(req) != 0)
+	{
+		release(req);
+		return -1;
+	}
+
+	return 0;
+}
+
+uint32_t remoteDiskAsyncPending(void)
+{
+	uint32_t count = 0;
+	for (int x = 0; x < REMOTE_DISK_ASYNC_QUEUE_DEPTH; x++)
+	{
+		if (requests[x].inUse && requests[x].isWrite)
+			count++;
+	}
+	return count;
+}
+
+int remoteDiskAsyncCheckWrites(void)
+{
+	int result = writeFailed ? -1 : 0;
+	writeFailed = false;
+	return result;
+}
+
+int remoteDiskAsyncFlush(void)
+{
+	while ((multi != NULL) && (remoteDiskAsyncPending() > 0))
+		pump();
+
+	return remoteDiskAsyncCheckWrites();
+}
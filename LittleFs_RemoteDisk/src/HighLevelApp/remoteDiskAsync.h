@@ -0,0 +1,45 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+#include <applibs/eventloop.h>
+
+#include "remoteDiskIO.h"
+
+// Asynchronous access to the remote disk, on the curl multi interface.
+//
+// Requests are queued and run concurrently, their sockets and timeouts are
+// handled by the application's EventLoop. Writes are copied into the queue
+// and acknowledged straight away, then sent in the background; reads wait for
+// their reply, but a sequential read also queues a prefetch of the range
+// following it, which the next read is served from. A read, or a write, which
+// overlaps a queued write is held back until that write has completed, so the
+// disk host always sees them in order.
+
+// Most requests in flight at once, including the prefetch.
+#define REMOTE_DISK_ASYNC_QUEUE_DEPTH 8
+// Largest single request, the ranges of a write included.
+#define REMOTE_DISK_ASYNC_MAX_SIZE 4096
+// Most ranges in one write.
+#define REMOTE_DISK_ASYNC_MAX_RANGES 8
+
+// Sets up the multi handle on eventLoop, diskSize bounds the prefetch. Returns 0 on success.
+int remoteDiskAsyncInit(EventLoop* eventLoop, uint32_t diskSize);
+// Drops any request still queued, call remoteDiskAsyncFlush first to keep the writes.
+void remoteDiskAsyncClose(void);
+
+// Reads size bytes at offset into buffer, returns 0 on success.
+int remoteDiskAsyncRead(uint32_t offset, uint8_t* buffer, uint32_t size);
+// Queues a write of size bytes at offset, returns 0 once the data is queued.
+int remoteDiskAsyncWrite(uint32_t offset, const uint8_t* data, uint32_t size);
+// Queues a write of several ranges, data holds them back to back.
+int remoteDiskAsyncWriteRanges(const remoteDiskRange* ranges, uint32_t count, const uint8_t* data);
+
+// Number of writes queued or in flight.
+uint32_t remoteDiskAsyncPending(void);
+// Returns -1 if a background write has failed since the last check, 0 otherwise.
+int remoteDiskAsyncCheckWrites(void);
+// Waits for every queued write, returns -1 if any of them failed.
+int remoteDiskAsyncFlush(void);
@@ -5,6 +5,7 @@
 #include "stdint.h"
 #include <curl/curl.h>
 #include <curl/easy.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -13,6 +14,7 @@ static uint8_t readBuffer[4096];
 // Curl stuff.
 struct url_data {
 	size_t size;
+	size_t capacity;
 	uint8_t* data;
 };
 
@@ -25,132 +27,219 @@ struct url_data data;
 
 static char urlBuffer[255];
 
+// Range lists are sent as "offset:size,offset:size,..."
+static char rangesBuffer[REMOTE_DISK_MAX_RANGES * 24];
+
+// One handle is used for every request, so the connection to the disk host is
+// kept alive and reused instead of being set up again for each block.
+static CURL* curlHandle = NULL;
+
 static size_t write_data(void* ptr, size_t size, size_t nmemb, struct url_data* data)
 {
 	size_t index = data->size;
 	size_t n = (size * nmemb);
 
 	// bug out if the data returned is too large.
-	if (data->size + n > sizeof(readBuffer))
+	if (data->size + n > data->capacity)
 		return 0;
 
 	data->size += n;
 
 	memcpy((data->data + index), ptr, n);
-	data->data[data->size] = '\0';
 
 	return n;
 }
 
-static const readUrl = "http://%s:5000/ReadBlockFromOffset?offset=%u&size=%u";
+static size_t read_callback(char* dest, size_t size, size_t nmemb, void* userp)
+{
+	struct WriteThis* wt = (struct WriteThis*)userp;
+	size_t buffer_size = size * nmemb;
 
-uint8_t* readBlockData(uint32_t offset, uint32_t size)
+	if (wt->sizeleft) {
+		/* copy as much as possible from the source to the destination */
+		size_t copy_this_much = wt->sizeleft;
+		if (copy_this_much > buffer_size)
+			copy_this_much = buffer_size;
+		memcpy(dest, wt->readptr, copy_this_much);
+
+		wt->readptr += copy_this_much;
+		wt->sizeleft -= copy_this_much;
+		return copy_this_much; /* we copied this many bytes */
+	}
+
+	return 0; /* no more data left to deliver */
+}
+
+static CURL* getCurlHandle(void)
 {
-	snprintf(urlBuffer, 255, readUrl, PC_HOST_IP, offset, size);
+	if (curlHandle == NULL)
+	{
+		curlHandle = curl_easy_init();
+	}
+	else
+	{
+		// drop the previous request's options, live connections are kept
+		curl_easy_reset(curlHandle);
+	}
 
-	// use fixed buffer, reduce the number of mallocs.
-	data.size = 0;
-	data.data = &readBuffer[0];
+	if (curlHandle != NULL)
+	{
+		curl_easy_setopt(curlHandle, CURLOPT_TCP_KEEPALIVE, 1L);
+		curl_easy_setopt(curlHandle, CURLOPT_CONNECTTIMEOUT, (long)5);
+		curl_easy_setopt(curlHandle, CURLOPT_DNS_CACHE_TIMEOUT, -1);
 
-	CURLcode res = CURLE_OK;
+		// based on the libcurl sample - https://curl.se/libcurl/c/https.html 
+		curl_easy_setopt(curlHandle, CURLOPT_SSL_VERIFYPEER, 0L);
+		curl_easy_setopt(curlHandle, CURLOPT_SSL_VERIFYHOST, 0L);
+	}
+
+	return curlHandle;
+}
+
+void closeRemoteDisk(void)
+{
+	if (curlHandle != NULL)
+	{
+		curl_easy_cleanup(curlHandle);
+		curlHandle = NULL;
+	}
+}
+
+static int performRequest(CURL* curl)
+{
+	CURLcode res = curl_easy_perform(curl);
+
+	long status = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+
+	return ((res == CURLE_OK) && (status == 200)) ? 0 : -1;
+}
+
+static int getData(const char* url, uint8_t* buffer, size_t size)
+{
+	CURL* curl = getCurlHandle();
+	if (curl == NULL)
+		return -1;
+
+	// use the caller's buffer, reduce the number of mallocs.
+	data.size = 0;
+	data.capacity = size;
+	data.data = buffer;
 
-	CURL* curl = curl_easy_init();
-	curl_easy_setopt(curl, CURLOPT_URL, urlBuffer);
 	/* use a GET to fetch data */
+	curl_easy_setopt(curl, CURLOPT_URL, url);
 	curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &data);
 
-	// based on the libcurl sample - https://curl.se/libcurl/c/https.html 
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+	if ((performRequest(curl) != 0) || (data.size != size))
+		return -1;
 
-	/* Perform the request */
-	res = curl_easy_perform(curl);
-	curl_easy_cleanup(curl);
+	return 0;
+}
 
-	if (res == CURLE_OK)
-	{
-		// caller is responsible for freeing this.
-		return data.data;
-	}
+static int postData(const char* url, const char* header, const uint8_t* postData, size_t size)
+{
+	CURL* curl = getCurlHandle();
+	if (curl == NULL)
+		return -1;
+
+	struct WriteThis wt;
+	wt.readptr = (const char*)postData;
+	wt.sizeleft = size;
+
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_POST, 1);
+	curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback);
+	curl_easy_setopt(curl, CURLOPT_READDATA, &wt);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)wt.sizeleft);
+
+	struct curl_slist* hs = NULL;
+	hs = curl_slist_append(hs, header);
+	hs = curl_slist_append(hs, "Content-Type: application/octet-stream");
+	hs = curl_slist_append(hs, "Expect:");
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hs);
+
+	int result = performRequest(curl);
 
-	return NULL;
+	curl_slist_free_all(hs);
+	return result;
 }
 
-static size_t read_callback(char* dest, size_t size, size_t nmemb, void* userp)
+static const char* readUrl = "http://%s:5000/ReadBlockFromOffset?offset=%u&size=%u";
+
+uint8_t* readBlockData(uint32_t offset, uint32_t size)
 {
-	struct WriteThis* wt = (struct WriteThis*)userp;
-	size_t buffer_size = size * nmemb;
+	if (size > sizeof(readBuffer))
+		return NULL;
 
-	if (wt->sizeleft) {
-		/* copy as much as possible from the source to the destination */
-		size_t copy_this_much = wt->sizeleft;
-		if (copy_this_much > buffer_size)
-			copy_this_much = buffer_size;
-		memcpy(dest, wt->readptr, copy_this_much);
+	snprintf(urlBuffer, sizeof(urlBuffer), readUrl, PC_HOST_IP, offset, size);
 
-		wt->readptr += copy_this_much;
-		wt->sizeleft -= copy_this_much;
-		return copy_this_much; /* we copied this many bytes */
-	}
+	if (getData(urlBuffer, &readBuffer[0], size) != 0)
+		return NULL;
 
-	return 0; /* no more data left to deliver */
+	// the buffer is reused by the next read.
+	return &readBuffer[0];
 }
 
 static char* writeBlockURL = "http://%s:5000/WriteBlockFromOffset";
 
 int writeBlockData(uint8_t* sectorData, uint32_t size, uint32_t offset)
 {
-	CURL* curl;
-	CURLcode res = -1;
+	snprintf(urlBuffer, sizeof(urlBuffer), writeBlockURL, PC_HOST_IP);
 
-	struct WriteThis wt;
+	char tBuff[50];
+	snprintf(tBuff, sizeof(tBuff), "offset: %u", offset);
 
-	wt.readptr = sectorData;
-	wt.sizeleft = size;
+	return postData(urlBuffer, tBuff, sectorData, size);
+}
 
-	snprintf(urlBuffer, 255, writeBlockURL, PC_HOST_IP);
+// Formats ranges as "offset:size,..." into rangesBuffer and returns their total size, 0 on error.
+static uint32_t formatRanges(const remoteDiskRange* ranges, uint32_t count)
+{
+	if ((count == 0) || (count > REMOTE_DISK_MAX_RANGES))
+		return 0;
 
-	curl = curl_easy_init();
-	if (curl)
+	uint32_t total = 0;
+	size_t pos = 0;
+	for (uint32_t x = 0; x < count; x++)
 	{
-		// curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-		curl_easy_setopt(curl, CURLOPT_URL, urlBuffer);
+		pos += snprintf(&rangesBuffer[pos], sizeof(rangesBuffer) - pos, "%s%u:%u", (x > 0 ? "," : ""),
+			ranges[x].offset, ranges[x].size);
+		total += ranges[x].size;
+	}
 
-		curl_easy_setopt(curl, CURLOPT_POST, 1);
-		curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback);
-		curl_easy_setopt(curl, CURLOPT_READDATA, &wt);
+	return total;
+}
 
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)wt.sizeleft);
+static const char* readRangesUrl = "http://%s:5000/ReadRanges?ranges=%s";
 
-		curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long)5);
-		curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, -1);
+int readBlockRanges(const remoteDiskRange* ranges, uint32_t count, uint8_t* buffer)
+{
+	uint32_t total = formatRanges(ranges, count);
+	if (total == 0)
+		return -1;
 
-		curl_easy_setopt(curl, CURLOPT_SSL_SESSIONID_CACHE, 0);
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYSTATUS, 0);
-		curl_easy_setopt(curl, CURLOPT_CAINFO, NULL);
+	static char rangesUrl[sizeof(rangesBuffer) + 64];
+	snprintf(rangesUrl, sizeof(rangesUrl), readRangesUrl, PC_HOST_IP, rangesBuffer);
 
-		struct curl_slist* hs = NULL;
-		char tBuff[50];
-		memset(&tBuff[0], 0x00, 50);
-		snprintf(tBuff, 50, "offset: %d", offset);
-		hs = curl_slist_append(hs, tBuff);
-		hs = curl_slist_append(hs, "Content-Type: application/octet-stream");
-		hs = curl_slist_append(hs, "Expect:");
-		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hs);
+	return getData(rangesUrl, buffer, total);
+}
 
-		res = curl_easy_perform(curl);
+static const char* writeRangesUrl = "http://%s:5000/WriteRanges";
 
-		curl_slist_free_all(hs);
-		curl_easy_cleanup(curl);
-	}
+int writeBlockRanges(const remoteDiskRange* ranges, uint32_t count, const uint8_t* data)
+{
+	uint32_t total = formatRanges(ranges, count);
+	if (total == 0)
+		return -1;
 
-	if (res == CURLE_OK)
-		return 0;
+	snprintf(urlBuffer, sizeof(urlBuffer), writeRangesUrl, PC_HOST_IP);
 
-	return -1;
+	static char header[sizeof(rangesBuffer) + 16];
+	snprintf(header, sizeof(header), "ranges: %s", rangesBuffer);
+
+	return postData(urlBuffer, header, data, total);
 }
 
 int writeTrackData(uint8_t trackNum, uint8_t* trackData, uint16_t length)
@@ -6,3 +6,20 @@
 #include <stdint.h>
 uint8_t* readBlockData(uint32_t offset, uint32_t size);
 int writeBlockData(uint8_t* sectorData, uint32_t size, uint32_t offset);
+
+// A contiguous part of the disk, for the multi-range requests.
+typedef struct {
+	uint32_t offset;
+	uint32_t size;
+} remoteDiskRange;
+
+// Most ranges in one readBlockRanges or writeBlockRanges request.
+#define REMOTE_DISK_MAX_RANGES 32
+
+// Reads several ranges with one request, buffer receives them back to back.
+int readBlockRanges(const remoteDiskRange* ranges, uint32_t count, uint8_t* buffer);
+// Writes several ranges with one request, data holds them back to back.
+int writeBlockRanges(const remoteDiskRange* ranges, uint32_t count, const uint8_t* data);
+
+// Closes the connection kept open to the disk host.
+void closeRemoteDisk(void);
@@ -2,6 +2,7 @@
    Licensed under the MIT License. */
 
 #include "SDCardViaRtCore.h"
+#include <stdbool.h>
 #include "intercore_messages.h"
 #include <unistd.h>
 #include <errno.h>
@@ -18,7 +19,9 @@
 static const char rtAppComponentId[] = "005180bc-402f-4cb3-a662-72937dbcde47";
 
 static int sockFd = -1;
-static uint8_t recvBuffer[sizeof(struct SD_CMD_WITH_DATA)];
+static uint8_t recvBuffer[sizeof(struct SD_CMD_BLOCKS_DATA)];
+
+#define SD_BLOCK_SIZE sizeof(((struct SD_CMD_WITH_DATA*)0)->blockData)
 static ssize_t ReadRTData(uint8_t* data, size_t size);
 static ssize_t WriteRTData(uint8_t *data, size_t size);
 
@@ -134,6 +137,221 @@ int SDCard_ReadBlock(uint32_t block, uint8_t* data, uint32_t size)
     return -1;
 }
 
+/// <summary>
+/// Sends a range request (start block plus count) to the M4
+/// </summary>
+static int SendRange(uint8_t id, uint32_t block, uint32_t count)
+{
+    struct SD_CMD_BLOCKS request;
+    request.id = id;
+    request.blockNumber = block;
+    request.blockCount = count;
+
+    return (int)WriteRTData((uint8_t*)&request, sizeof(request));
+}
+
+/// <summary>
+/// Sends the data of a range write as MSG_BLOCKS_DATA chunks
+/// </summary>
+static int SendRangeData(uint32_t block, const uint8_t* data, uint32_t count)
+{
+    struct SD_CMD_BLOCKS_DATA chunk;
+    chunk.id = MSG_BLOCKS_DATA;
+
+    while (count > 0)
+    {
+        chunk.blockNumber = block;
+        chunk.blockCount = (count > MSG_BLOCKS_PER_CHUNK ? MSG_BLOCKS_PER_CHUNK : count);
+        memcpy(chunk.blockData, data, chunk.blockCount * SD_BLOCK_SIZE);
+
+        if (WriteRTData((uint8_t*)&chunk, sizeof(chunk)) == -1)
+        {
+            return -1;
+        }
+
+        block += chunk.blockCount;
+        data += chunk.blockCount * SD_BLOCK_SIZE;
+        count -= chunk.blockCount;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Receives the reply to a range request, the data chunks of a read are copied
+/// to data, and returns the result
+/// </summary>
+static int ReceiveRange(uint8_t resultId, uint32_t block, uint8_t* data, uint32_t count)
+{
+    uint32_t received = 0;
+    bool unexpected = false;
+    for (;;)
+    {
+        ssize_t numBytes = ReadRTData(&recvBuffer[0], sizeof(recvBuffer));
+        if (numBytes <= 0)
+        {
+            Log_Debug("range %d+%d - no result\n", block, count);
+            return -1;
+        }
+
+        if (recvBuffer[0] == resultId)
+        {
+            struct SD_CMD* pResult = (struct SD_CMD*)&recvBuffer[0];
+            if ((numBytes != sizeof(struct SD_CMD)) || (pResult->read_write_result != 0))
+            {
+                Log_Debug("range %d+%d - failed at block %d\n", block, count, pResult->blockNumber);
+                return -1;
+            }
+            return ((unexpected || (data && (received != count))) ? -1 : 0);
+        }
+
+        struct SD_CMD_BLOCKS_DATA* pChunk = (struct SD_CMD_BLOCKS_DATA*)&recvBuffer[0];
+        if (!data || unexpected || (recvBuffer[0] != MSG_BLOCKS_DATA) || (numBytes != sizeof(struct SD_CMD_BLOCKS_DATA))
+            || (pChunk->blockNumber != block + received) || (pChunk->blockCount > count - received))
+        {
+            // Unexpected, but the result still follows, so keep reading until it does.
+            Log_Debug("range %d+%d - unexpected message %d [%d bytes]\n", block, count, recvBuffer[0], numBytes);
+            unexpected = true;
+            continue;
+        }
+
+        memcpy(&data[received * SD_BLOCK_SIZE], pChunk->blockData, pChunk->blockCount * SD_BLOCK_SIZE);
+        received += pChunk->blockCount;
+    }
+}
+
+/// <summary>
+/// Write consecutive SD Card blocks
+/// the blocks are sent as ranges of up to MSG_BLOCKS_MAX, each acknowledged once;
+/// the next range is sent before waiting for the previous one's result so the
+/// M4 always has one queued
+/// </summary>
+int SDCard_WriteBlocks(uint32_t block, uint8_t* data, uint32_t count)
+{
+    uint32_t n = (count > MSG_BLOCKS_MAX ? MSG_BLOCKS_MAX : count);
+    if ((n > 0) && ((SendRange(MSG_BLOCKS_WRITE, block, n) == -1) || (SendRangeData(block, data, n) == -1)))
+    {
+        // failed to write to the M4
+        return -1;
+    }
+
+    while (count > 0)
+    {
+        uint32_t next = (count - n > MSG_BLOCKS_MAX ? MSG_BLOCKS_MAX : count - n);
+        int sent = 0;
+        if (next > 0)
+        {
+            sent = SendRange(MSG_BLOCKS_WRITE, block + n, next);
+            if (sent == 0)
+            {
+                sent = SendRangeData(block + n, &data[n * SD_BLOCK_SIZE], next);
+            }
+        }
+
+        int result = ReceiveRange(MSG_BLOCKS_WRITE_RESULT, block, NULL, n);
+        if ((result == -1) || (sent == -1))
+        {
+            if ((next > 0) && (sent == 0))
+            {
+                // drain the result of the range already queued
+                ReceiveRange(MSG_BLOCKS_WRITE_RESULT, block + n, NULL, next);
+            }
+            return -1;
+        }
+
+        block += n;
+        data += n * SD_BLOCK_SIZE;
+        count -= n;
+        n = next;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Read consecutive SD Card blocks
+/// the blocks are requested as ranges of up to MSG_BLOCKS_MAX; the next range
+/// is requested before the previous one is consumed, so the M4 reads it from
+/// the card while the A7 copies out the previous one
+/// </summary>
+int SDCard_ReadBlocks(uint32_t block, uint8_t* data, uint32_t count)
+{
+    uint32_t n = (count > MSG_BLOCKS_MAX ? MSG_BLOCKS_MAX : count);
+    if ((n > 0) && (SendRange(MSG_BLOCKS_READ, block, n) == -1))
+    {
+        // failed to write to the M4
+        return -1;
+    }
+
+    while (count > 0)
+    {
+        uint32_t next = (count - n > MSG_BLOCKS_MAX ? MSG_BLOCKS_MAX : count - n);
+        int sent = (next > 0 ? SendRange(MSG_BLOCKS_READ, block + n, next) : 0);
+
+        int result = ReceiveRange(MSG_BLOCKS_READ_RESULT, block, data, n);
+        if ((result == -1) || (sent == -1))
+        {
+            if ((next > 0) && (sent == 0))
+            {
+                // drain the reply to the range already requested
+                ReceiveRange(MSG_BLOCKS_READ_RESULT, block + n, NULL, next);
+            }
+            return -1;
+        }
+
+        block += n;
+        data += n * SD_BLOCK_SIZE;
+        count -= n;
+        n = next;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Read the card geometry the M4 parsed from the CSD
+/// </summary>
+int SDCard_GetGeometry(SDCard_Geometry* geometry)
+{
+    struct SD_CMD request;
+    request.id = MSG_GEOMETRY;
+    request.blockNumber = 0;
+    request.read_write_result = 0;
+
+    if (WriteRTData((uint8_t*)&request, sizeof(request)) == -1)
+    {
+        // failed to write to the M4
+        return -1;
+    }
+
+    ssize_t numBytes = ReadRTData(&recvBuffer[0], sizeof(recvBuffer));
+    struct SD_GEOMETRY* pData = (struct SD_GEOMETRY*)&recvBuffer[0];
+    if ((numBytes != sizeof(struct SD_GEOMETRY)) || (pData->id != MSG_GEOMETRY_RESULT) || (pData->result != 0))
+    {
+        Log_Debug("geometry - no result [%d bytes returned]\n", numBytes);
+        return -1;
+    }
+
+    geometry->blockSize = pData->blockSize;
+    geometry->blockCount = pData->blockCount;
+    geometry->eraseBlocks = pData->eraseBlocks;
+    return 0;
+}
+
+/// <summary>
+/// Erase consecutive SD Card blocks with a single card erase
+/// </summary>
+int SDCard_EraseBlocks(uint32_t block, uint32_t count)
+{
+    if (SendRange(MSG_BLOCKS_ERASE, block, count) == -1)
+    {
+        // failed to write to the M4
+        return -1;
+    }
+
+    return ReceiveRange(MSG_BLOCKS_ERASE_RESULT, block, NULL, count);
+}
+
 static ssize_t WriteRTData(uint8_t *data, size_t size)
 {
     ssize_t ret=send(sockFd, data, size, 0);
@@ -5,8 +5,23 @@
 #include <stdint.h>
 
 #pragma once
+
+typedef struct {
+    uint32_t blockSize;     // bytes per block
+    uint32_t blockCount;    // card capacity in blocks
+    uint32_t eraseBlocks;   // erase granularity in blocks
+} SDCard_Geometry;
+
 int SDCard_Init(void);
 void SDCard_Cleanup(void);
 
 int SDCard_WriteBlock(uint32_t block, uint8_t* data, uint32_t size);
 int SDCard_ReadBlock(uint32_t block, uint8_t* data, uint32_t size);
+
+// Multi-block transfers of count consecutive 512 byte blocks
+int SDCard_WriteBlocks(uint32_t block, uint8_t* data, uint32_t count);
+int SDCard_ReadBlocks(uint32_t block, uint8_t* data, uint32_t count);
+
+// Card geometry read from its CSD, and erase of consecutive blocks
+int SDCard_GetGeometry(SDCard_Geometry* geometry);
+int SDCard_EraseBlocks(uint32_t block, uint32_t count);
@@ -0,0 +1,364 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "blockCache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static uint8_t* LineData(BlockCache* cache, uint32_t slot)
+{
+    return &cache->data[slot * cache->config.lineSize];
+}
+
+static void Touch(BlockCache* cache, uint32_t slot)
+{
+    cache->entries[slot].lastUsed = ++cache->tick;
+}
+
+static int FindSlot(const BlockCache* cache, uint32_t line)
+{
+    for (uint32_t i = 0; i < cache->config.capacity; i++)
+    {
+        if (cache->entries[i].valid && (cache->entries[i].line == line))
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static int FindDirty(const BlockCache* cache, uint32_t line)
+{
+    int slot = FindSlot(cache, line);
+    return ((slot >= 0) && cache->entries[slot].dirty) ? slot : -1;
+}
+
+/// <summary>
+/// Returns the dirty line with the lowest line number at or after from
+/// </summary>
+static int LowestDirty(const BlockCache* cache, uint32_t from)
+{
+    int lowest = -1;
+    for (uint32_t i = 0; i < cache->config.capacity; i++)
+    {
+        if (cache->entries[i].valid && cache->entries[i].dirty && (cache->entries[i].line >= from)
+            && ((lowest == -1) || (cache->entries[i].line < cache->entries[lowest].line)))
+        {
+            lowest = (int)i;
+        }
+    }
+    return lowest;
+}
+
+/// <summary>
+/// Writes back all dirty lines in line order, each run of consecutive lines with
+/// a single device write, or several runs at once if the device takes ranges
+/// </summary>
+static int FlushDirty(BlockCache* cache)
+{
+    uint32_t lineSize = cache->config.lineSize;
+    uint32_t run[cache->scratchLines];
+    BlockCache_Range ranges[cache->scratchLines];
+
+    for (;;)
+    {
+        uint32_t count = 0;
+        uint32_t rangeCount = 0;
+        uint32_t from = 0;
+
+        while (count < cache->scratchLines)
+        {
+            int first = LowestDirty(cache, from);
+            if ((first == -1) || ((rangeCount > 0) && !cache->config.progRanges))
+            {
+                break;
+            }
+
+            BlockCache_Range* range = &ranges[rangeCount++];
+            range->line = cache->entries[first].line;
+            range->count = 0;
+            for (int slot = first; (slot >= 0) && (count < cache->scratchLines);
+                slot = FindDirty(cache, range->line + range->count))
+            {
+                memcpy(&cache->scratch[count * lineSize], LineData(cache, (uint32_t)slot), lineSize);
+                run[count++] = (uint32_t)slot;
+                range->count++;
+            }
+            from = range->line + range->count;
+        }
+
+        if (count == 0)
+        {
+            return LFS_ERR_OK;
+        }
+
+        int result = (rangeCount == 1)
+            ? cache->config.prog(cache->config.context, ranges[0].line, ranges[0].count, cache->scratch)
+            : cache->config.progRanges(cache->config.context, ranges, rangeCount, cache->scratch);
+        if (result != 0)
+        {
+            return LFS_ERR_IO;
+        }
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            cache->entries[run[i]].dirty = false;
+        }
+        cache->writeBacks += count;
+    }
+}
+
+/// <summary>
+/// Returns a free slot, evicting the least recently used line if there's none
+/// </summary>
+static int Victim(BlockCache* cache)
+{
+    uint32_t victim = 0;
+    for (uint32_t i = 0; i < cache->config.capacity; i++)
+    {
+        if (!cache->entries[i].valid)
+        {
+            return (int)i;
+        }
+        if (cache->entries[i].lastUsed < cache->entries[victim].lastUsed)
+        {
+            victim = i;
+        }
+    }
+
+    // Dirty lines are written back together, so they coalesce.
+    if (cache->entries[victim].dirty && (FlushDirty(cache) != LFS_ERR_OK))
+    {
+        return -1;
+    }
+
+    cache->entries[victim].valid = false;
+    return (int)victim;
+}
+
+/// <summary>
+/// Reads a line into the cache, along with the lines following it if the reads
+/// are sequential, and returns its slot
+/// </summary>
+static int Fill(BlockCache* cache, uint32_t line, uint32_t totalLines, bool readAhead)
+{
+    uint32_t count = 1;
+    if (readAhead && (line == cache->nextSequential))
+    {
+        uint32_t limit = MIN(MIN(cache->scratchLines, totalLines - line), cache->config.capacity / 2);
+
+        // stop at the first line already cached, it may be dirty
+        while ((count < limit) && (FindSlot(cache, line + count) < 0))
+        {
+            count++;
+        }
+    }
+
+    uint8_t* fetched = cache->scratch + (cache->scratchLines * cache->config.lineSize);
+    if (cache->config.read(cache->config.context, line, count, fetched) != 0)
+    {
+        return -1;
+    }
+
+    if (readAhead)
+    {
+        cache->nextSequential = line + count;
+        if (count > 1)
+        {
+            cache->readAheads++;
+        }
+    }
+
+    // Place the lines read ahead first, so the line asked for is the most recent.
+    int slot = -1;
+    for (uint32_t i = count; i-- > 0;)
+    {
+        slot = Victim(cache);
+        if (slot < 0)
+        {
+            return -1;
+        }
+        memcpy(LineData(cache, (uint32_t)slot), &fetched[i * cache->config.lineSize], cache->config.lineSize);
+        cache->entries[slot].line = line + i;
+        cache->entries[slot].valid = true;
+        cache->entries[slot].dirty = false;
+        Touch(cache, (uint32_t)slot);
+    }
+
+    return slot;
+}
+
+int BlockCache_Init(BlockCache* cache, const BlockCache_Config* config)
+{
+    if (!cache || !config || (config->lineSize == 0) || (config->capacity == 0) || !config->read || !config->prog)
+    {
+        return LFS_ERR_INVAL;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    cache->config = *config;
+    cache->scratchLines = (config->readAhead > 0 ? config->readAhead : 1);
+    cache->nextSequential = UINT32_MAX;
+
+    // The scratch buffer holds a write-back run followed by a read-ahead.
+    cache->entries = calloc(config->capacity, sizeof(BlockCache_Entry));
+    cache->data = malloc(config->capacity * config->lineSize);
+    cache->scratch = malloc(2 * cache->scratchLines * config->lineSize);
+    if (!cache->entries || !cache->data || !cache->scratch)
+    {
+        BlockCache_Deinit(cache);
+        return LFS_ERR_NOMEM;
+    }
+
+    return LFS_ERR_OK;
+}
+
+void BlockCache_Deinit(BlockCache* cache)
+{
+    free(cache->entries);
+    free(cache->data);
+    free(cache->scratch);
+    cache->entries = NULL;
+    cache->data = NULL;
+    cache->scratch = NULL;
+}
+
+void BlockCache_Invalidate(BlockCache* cache)
+{
+    memset(cache->entries, 0, cache->config.capacity * sizeof(BlockCache_Entry));
+    cache->nextSequential = UINT32_MAX;
+}
+
+int BlockCache_Read(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size)
+{
+    BlockCache* cache = c->context;
+    uint32_t lineSize = cache->config.lineSize;
+    uint32_t totalLines = c->block_count * (c->block_size / lineSize);
+    uint32_t addr = (block * c->block_size) + off;
+    uint8_t* out = buffer;
+
+    while (size > 0)
+    {
+        uint32_t line = addr / lineSize;
+        uint32_t lineOff = addr % lineSize;
+        uint32_t n = MIN(size, lineSize - lineOff);
+
+        int slot = FindSlot(cache, line);
+        if (slot >= 0)
+        {
+            cache->hits++;
+        }
+        else
+        {
+            cache->misses++;
+            slot = Fill(cache, line, totalLines, true);
+            if (slot < 0)
+            {
+                return LFS_ERR_IO;
+            }
+        }
+
+        Touch(cache, (uint32_t)slot);
+        memcpy(out, LineData(cache, (uint32_t)slot) + lineOff, n);
+
+        addr += n;
+        out += n;
+        size -= n;
+    }
+
+    return LFS_ERR_OK;
+}
+
+int BlockCache_Prog(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size)
+{
+    BlockCache* cache = c->context;
+    uint32_t lineSize = cache->config.lineSize;
+    uint32_t totalLines = c->block_count * (c->block_size / lineSize);
+    uint32_t addr = (block * c->block_size) + off;
+    const uint8_t* in = buffer;
+
+    while (size > 0)
+    {
+        uint32_t line = addr / lineSize;
+        uint32_t lineOff = addr % lineSize;
+        uint32_t n = MIN(size, lineSize - lineOff);
+
+        int slot = FindSlot(cache, line);
+        if (slot < 0)
+        {
+            // a whole line is overwritten, so there's no need to read it first
+            if (n == lineSize)
+            {
+                slot = Victim(cache);
+                if (slot >= 0)
+                {
+                    cache->entries[slot].line = line;
+                    cache->entries[slot].valid = true;
+                }
+            }
+            else
+            {
+                slot = Fill(cache, line, totalLines, false);
+            }
+            if (slot < 0)
+            {
+                return LFS_ERR_IO;
+            }
+        }
+
+        Touch(cache, (uint32_t)slot);
+        memcpy(LineData(cache, (uint32_t)slot) + lineOff, in, n);
+        cache->entries[slot].dirty = true;
+
+        addr += n;
+        in += n;
+        size -= n;
+    }
+
+    return LFS_ERR_OK;
+}
+
+int BlockCache_Erase(const struct lfs_config* c, lfs_block_t block)
+{
+    BlockCache* cache = c->context;
+    uint32_t count = c->block_size / cache->config.lineSize;
+    uint32_t first = block * count;
+
+    // whatever is cached for the block, dirty or not, is superseded by the erase
+    for (uint32_t i = 0; i < cache->config.capacity; i++)
+    {
+        if (cache->entries[i].valid && (cache->entries[i].line >= first) && (cache->entries[i].line < first + count))
+        {
+            cache->entries[i].valid = false;
+            cache->entries[i].dirty = false;
+        }
+    }
+
+    if (cache->config.erase && (cache->config.erase(cache->config.context, first, count) != 0))
+    {
+        return LFS_ERR_IO;
+    }
+
+    return LFS_ERR_OK;
+}
+
+int BlockCache_Sync(const struct lfs_config* c)
+{
+    BlockCache* cache = c->context;
+
+    int result = FlushDirty(cache);
+    if (result != LFS_ERR_OK)
+    {
+        return result;
+    }
+
+    if (cache->config.sync && (cache->config.sync(cache->config.context) != 0))
+    {
+        return LFS_ERR_IO;
+    }
+
+    return LFS_ERR_OK;
+}
@@ -0,0 +1,90 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lfs.h"
+
+// Write-back LRU cache between LittleFs and a block device.
+//
+// The device is addressed in lines of line_size bytes, the line of a LittleFs
+// address is (block * block_size + off) / line_size. Sequential misses are
+// detected and read ahead with a single device read, dirty lines are only
+// written back on eviction or BlockCache_Sync, consecutive ones with a single
+// device write.
+//
+// Point the lfs_config read/prog/erase/sync callbacks at the BlockCache_
+// functions below and its context at the BlockCache.
+
+// A run of consecutive lines, for devices which write several with one access.
+typedef struct {
+    uint32_t line;
+    uint32_t count;
+} BlockCache_Range;
+
+typedef struct {
+    // device line size in bytes, must divide the LittleFs block size
+    uint32_t lineSize;
+    // number of lines cached
+    uint32_t capacity;
+    // most lines fetched by one read, 1 disables read-ahead
+    uint32_t readAhead;
+
+    // device callbacks, return 0 on success
+    int (*read)(void* context, uint32_t line, uint32_t count, void* buffer);
+    int (*prog)(void* context, uint32_t line, uint32_t count, const void* buffer);
+    // optional, writes several runs with one access, buffer holds them back to back;
+    // without it every run of dirty lines is written back with its own prog
+    int (*progRanges)(void* context, const BlockCache_Range* ranges, uint32_t count, const void* buffer);
+    // optional, NULL when erasing isn't needed before programming
+    int (*erase)(void* context, uint32_t line, uint32_t count);
+    // optional
+    int (*sync)(void* context);
+    void* context;
+} BlockCache_Config;
+
+typedef struct {
+    uint32_t line;
+    uint32_t lastUsed;
+    bool     valid;
+    bool     dirty;
+} BlockCache_Entry;
+
+typedef struct {
+    BlockCache_Config config;
+    BlockCache_Entry* entries;
+    uint8_t* data;
+    uint8_t* scratch;
+    uint32_t scratchLines;
+    uint32_t tick;
+    uint32_t nextSequential;
+
+    // statistics, since BlockCache_Init
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t readAheads;
+    uint32_t writeBacks;
+} BlockCache;
+
+/// <summary>
+/// Allocates the cache, returns 0 on success
+/// </summary>
+int BlockCache_Init(BlockCache* cache, const BlockCache_Config* config);
+
+/// <summary>
+/// Frees the cache, dirty lines not synced are lost
+/// </summary>
+void BlockCache_Deinit(BlockCache* cache);
+
+/// <summary>
+/// Drops all cached lines, dirty lines not synced are lost
+/// </summary>
+void BlockCache_Invalidate(BlockCache* cache);
+
+int BlockCache_Read(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size);
+int BlockCache_Prog(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size);
+int BlockCache_Erase(const struct lfs_config* c, lfs_block_t block);
+int BlockCache_Sync(const struct lfs_config* c);
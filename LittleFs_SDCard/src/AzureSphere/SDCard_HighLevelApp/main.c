@@ -22,6 +22,8 @@
 #include "lfs_util.h"
 
 #include "SDCardViaRtCore.h"
+#include "blockCache.h"
+#include "lfsBench.h"
 
 #include "hw/mt3620_rdb.h"
 
@@ -40,7 +42,8 @@ typedef enum {
     ExitCode_ButtonTimer_Consume = 6,
     ExitCode_Init_Button = 7,
     ExitCode_Init_ButtonPollTimer = 8,
-    ExitCode_ButtonTimer_GetButtonState = 9
+    ExitCode_ButtonTimer_GetButtonState = 9,
+    ExitCode_Init_BlockCache = 10
 } ExitCode;
 
 static EventLoop* eventLoop = NULL;
@@ -60,24 +63,49 @@ static void CloseHandlers(void);
 // 4MB Card size = 4,194,304 bytes - 8192 blocks
 // 2GB Card size = 2,147,483,648 bytes = 4194304 total blocks
 // 
-// The Project is configured for 4MB Storage (8192 blocks)
+// LittleFs is configured from the card's geometry (its CSD) at startup, the
+// 4MB (8192 block) configuration below is only used if that can't be read.
 #define BLOCK_SIZE     512
 #define TOTAL_BLOCKS   8192     // TODO: Modify TOTAL_BLOCKS to match your SD Card configuration (total bytes/512)
 
+// With the card geometry, LittleFs blocks span several card blocks so they
+// are erased with a single card erase, reads and writes stay card block
+// aligned, and the caches and allocation lookahead are sized up.
+#define LFS_CARD_BLOCKS     8       // card blocks per LittleFs block
+#define LFS_CACHE_SIZE      2048
+#define LFS_LOOKAHEAD_MAX   1024    // bytes of allocation bitmap, one bit per LittleFs block
+
+// LittleFs re-reads its metadata blocks constantly, so blocks are cached on
+// the A7 and only written back to the card when LittleFs syncs.
+#define CACHE_BLOCKS       32
+#define CACHE_READ_AHEAD   8        // one range request, read by the M4 with a single command
+
 char* writeMessage = "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua\r\n";
 
-static int storage_read(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size);
-static int storage_program(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size);
-static int storage_erase(const struct lfs_config* c, lfs_block_t block);
-static int storage_sync(const struct lfs_config* c);
+static int storage_read(void* context, uint32_t block, uint32_t count, void* buffer);
+static int storage_program(void* context, uint32_t block, uint32_t count, const void* buffer);
+static int storage_erase(void* context, uint32_t block, uint32_t count);
 
 static lfs_t lfs;
+static BlockCache blockCache;
 
-const struct lfs_config g_littlefs_config = {
+static BlockCache_Config blockCacheConfig = {
+.lineSize = BLOCK_SIZE,
+.capacity = CACHE_BLOCKS,
+.readAhead = CACHE_READ_AHEAD,
 .read = storage_read,
 .prog = storage_program,
-.erase = storage_erase,
-.sync = storage_sync,
+.erase = NULL,     // set once the card's erase granularity is known
+.sync = NULL,
+.context = NULL
+};
+
+struct lfs_config g_littlefs_config = {
+.context = &blockCache,
+.read = BlockCache_Read,
+.prog = BlockCache_Prog,
+.erase = BlockCache_Erase,
+.sync = BlockCache_Sync,
 .read_size = BLOCK_SIZE,
 .prog_size = BLOCK_SIZE,
 .block_size = BLOCK_SIZE,
@@ -152,52 +180,87 @@ static void DoLittleFswork(void)
 }
 
 /// <summary>
-/// Littlefs callback function to handle reads from storage
+/// Block cache callback function to handle reads from storage
 /// </summary>
-static int storage_read(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size)
+static int storage_read(void* context, uint32_t block, uint32_t count, void* buffer)
 {
     // just need to read the block number/data over SD/Intercore.
 #ifdef SHOW_DEBUG_INFO
-    Log_Debug("Read Block %d\n", block);
+    Log_Debug("Read Block %d+%d\n", block, count);
 #endif
 
-    if (SDCard_ReadBlock(block, buffer, size) != LFS_ERR_OK)
+    int result = (count > 1)
+        ? SDCard_ReadBlocks(block, buffer, count)
+        : SDCard_ReadBlock(block, buffer, BLOCK_SIZE);
+    if (result != LFS_ERR_OK)
         return LFS_ERR_IO;
 
     return LFS_ERR_OK;
 }
 
 /// <summary>
-///  Littlefs callback function to handle writes to storage
+/// Block cache callback function to handle writes to storage
 /// </summary>
-static int storage_program(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size)
+static int storage_program(void* context, uint32_t block, uint32_t count, const void* buffer)
 {
-    if (SDCard_WriteBlock(block, buffer, size) != LFS_ERR_OK)
+    int result = (count > 1)
+        ? SDCard_WriteBlocks(block, (uint8_t*)buffer, count)
+        : SDCard_WriteBlock(block, (uint8_t*)buffer, BLOCK_SIZE);
+    if (result != LFS_ERR_OK)
         return LFS_ERR_IO;
 
     return LFS_ERR_OK;
 }
 
 /// <summary>
-/// Littlefs callback function to erase a storage block 
+/// Block cache callback function to erase storage blocks, lets the card's
+/// FTL prepare them for writing
 /// </summary>
-static int storage_erase(const struct lfs_config* c, lfs_block_t block)
+static int storage_erase(void* context, uint32_t block, uint32_t count)
 {
 #ifdef SHOW_DEBUG_INFO
-    Log_Debug("Erase Block %d\n", block);
+    Log_Debug("Erase Block %d+%d\n", block, count);
 #endif
 
-    uint8_t block_data[c->block_size];
-    memset(&block_data, 0x00, c->block_size);
-    return storage_program(c, block, 0x00, &block_data, c->block_size);
+    if (SDCard_EraseBlocks(block, count) != LFS_ERR_OK)
+        return LFS_ERR_IO;
+
+    return LFS_ERR_OK;
 }
 
 /// <summary>
-/// Littlefs callback function to sync storage (not used)
+/// Derive the LittleFs configuration from the card geometry
 /// </summary>
-static int storage_sync(const struct lfs_config* c)
+static void ConfigureStorage(void)
 {
-    return LFS_ERR_OK;
+    SDCard_Geometry geometry;
+    if ((SDCard_GetGeometry(&geometry) != 0) || (geometry.blockSize != BLOCK_SIZE)
+        || (geometry.blockCount < (2 * LFS_CARD_BLOCKS)))
+    {
+        Log_Debug("Card geometry unavailable, using %d blocks\n", TOTAL_BLOCKS);
+        return;
+    }
+
+    uint32_t blockSize = LFS_CARD_BLOCKS * BLOCK_SIZE;
+    uint32_t blockCount = geometry.blockCount / LFS_CARD_BLOCKS;
+    uint32_t lookahead = ((blockCount + 63) / 64) * 8;
+
+    g_littlefs_config.read_size = BLOCK_SIZE;
+    g_littlefs_config.prog_size = BLOCK_SIZE;
+    g_littlefs_config.block_size = blockSize;
+    g_littlefs_config.block_count = blockCount;
+    g_littlefs_config.cache_size = LFS_CACHE_SIZE;
+    g_littlefs_config.lookahead_size = (lookahead > LFS_LOOKAHEAD_MAX ? LFS_LOOKAHEAD_MAX : lookahead);
+
+    // A card which can only erase larger sectors would take neighbouring
+    // LittleFs blocks with it, so those aren't erased at all.
+    if ((geometry.eraseBlocks > 0) && ((LFS_CARD_BLOCKS % geometry.eraseBlocks) == 0))
+    {
+        blockCacheConfig.erase = storage_erase;
+    }
+
+    Log_Debug("Card has %u blocks, LittleFs uses %u blocks of %u bytes%s\n", geometry.blockCount,
+        blockCount, blockSize, (blockCacheConfig.erase ? "" : " without erase"));
 }
 
 /// <summary>
@@ -284,6 +347,14 @@ static ExitCode InitHandlers(void)
         return ExitCode_Init_Connection;
     }
 
+    ConfigureStorage();
+
+    if (BlockCache_Init(&blockCache, &blockCacheConfig) != LFS_ERR_OK)
+    {
+        Log_Debug("ERROR: Failed to allocate the block cache\n");
+        return ExitCode_Init_BlockCache;
+    }
+
     return ExitCode_Success;
 }
 
@@ -307,22 +378,38 @@ static void CloseFdAndPrintError(int fd, const char *fdName)
 /// </summary>
 void FormatCard(void)
 {
-    uint8_t formatBuffer[BLOCK_SIZE];
+    uint8_t formatBuffer[2 * BLOCK_SIZE];
 
-    memset(&formatBuffer[0], 0x00, BLOCK_SIZE);
+    memset(&formatBuffer[0], 0x00, sizeof(formatBuffer));
 
     Log_Debug("Formating blocks 0 and 1\n");
 
-    for (uint32_t x = 0; x < 2; x++)
+    if (SDCard_WriteBlocks(0, &formatBuffer[0], 2) != LFS_ERR_OK)
     {
-        if (SDCard_WriteBlock(x, &formatBuffer[0], BLOCK_SIZE) != LFS_ERR_OK)
-        {
-            Log_Debug("\nFailed to write block %d\n", x);
-            break;
-        }
+        Log_Debug("\nFailed to write blocks 0 and 1\n");
     }
 }
 
+#ifdef LFS_BENCHMARK
+/// <summary>
+/// Runs the LittleFs workloads on a RAM disk with the card's geometry, then on
+/// the card itself, which is reformatted
+/// </summary>
+static void RunBenchmarks(void)
+{
+    LfsBench_RamDisk ramDisk;
+    if (LfsBench_RamDiskInit(&ramDisk, &g_littlefs_config, LFS_BENCH_RAM_SIZE) == LFS_ERR_OK)
+    {
+        const LfsBench_Backend ram = { .name = "ram", .config = &ramDisk.config };
+        LfsBench_Run(&ram);
+        LfsBench_RamDiskDeinit(&ramDisk);
+    }
+
+    const LfsBench_Backend sd = { .name = "sd", .config = &g_littlefs_config, .cache = &blockCache };
+    LfsBench_Run(&sd);
+}
+#endif
+
 /// <summary>
 ///     Clean up the resources previously allocated.
 /// </summary>
@@ -330,6 +417,7 @@ static void CloseHandlers(void)
 {
     DisposeEventLoopTimer(buttonPollTimer);
     EventLoop_Close(eventLoop);
+    BlockCache_Deinit(&blockCache);
     SDCard_Cleanup();
     Log_Debug("Closing file descriptors.\n");
     CloseFdAndPrintError(buttonA_fd, "Button");
@@ -348,6 +436,13 @@ int main(void)
     // comment the FormatCard line to leave the SD Card intact on the next run of the application
     FormatCard();
 
+#ifdef LFS_BENCHMARK
+    if (exitCode == ExitCode_Success)
+    {
+        RunBenchmarks();
+    }
+#endif
+
     Log_Debug("Press 'Button A' to do LittleFs work\n");
 
     while (exitCode == ExitCode_Success) {
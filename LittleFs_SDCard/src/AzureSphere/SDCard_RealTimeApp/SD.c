@@ -10,8 +10,21 @@
 #define SPI_SD_TIMEOUT    200 // [ms]
 #define NUM_RETRIES       65536
 #define NUM_WRITE_RETRIES 3
+// An erase may keep the card busy far longer than a write does.
+#define NUM_ERASE_BUSY_WAITS 64
+
+// Data packets are streamed as queued SPI requests of SD_STREAM_GROUP transfers,
+// each of which is the size of the SPI hardware buffer.
+#define SD_STREAM_CHUNK   16
+#define SD_STREAM_GROUP   8
+#define SD_STREAM_MAX     512
+
+// The bus starts at the init clock, then runs at the card's TRAN_SPEED; if the
+// card can't be read back at that, the clock is halved until it can.
+#define SD_INIT_SPEED     400000
 
 static GPT *timer = NULL;
+static GPT *throughputTimer = NULL;
 
 typedef enum {
     GO_IDLE_STATE        =  0,
@@ -115,8 +128,44 @@ struct SDCard {
     uint32_t   blockLen;
     uint32_t   tranSpeed;
     uint32_t   maxTranSpeed;
+    uint32_t   blockCount;
+    uint32_t   eraseBlocks;
 };
 
+static SDCard SD_Cards[SD_CARD_MAX] = {0};
+
+// Kept apart from the cards, as reads account for themselves through a const card.
+typedef struct {
+    uint64_t bytes;
+    uint64_t ticks;
+} SD_Transferred;
+
+static struct {
+    SD_Transferred read;
+    SD_Transferred write;
+} SD_Stats[SD_CARD_MAX] = {0};
+
+// A write which returned before the card finished programming it, which
+// SD_PollBusy watches for; accounted as a write once the card is done.
+static struct {
+    bool     busy;
+    uint32_t bytes;
+    uint32_t start;
+} SD_Programming[SD_CARD_MAX] = {0};
+
+static uint32_t SD_Now(void)
+{
+    return (throughputTimer ? GPT_GetCount(throughputTimer) : 0);
+}
+
+static void SD_Account(const SDCard *card, bool write, uint32_t bytes, uint32_t start)
+{
+    SD_Transferred *t = (write ? &SD_Stats[card - SD_Cards].write : &SD_Stats[card - SD_Cards].read);
+    t->bytes += bytes;
+    // Ticks wrap at 32 bits, far longer than any transfer.
+    t->ticks += (uint32_t)(SD_Now() - start);
+}
+
 typedef struct {
     bool    done;
     int32_t status;
@@ -237,6 +286,107 @@ static bool SPITransfer__SyncTimeout(
     return true;
 }
 
+static SPITransfer streamTransfer[SD_STREAM_MAX / SD_STREAM_CHUNK];
+
+static volatile struct {
+    unsigned pending;
+    int32_t  status;
+} streamState = { 0 };
+
+static void streamDoneCallback(int32_t status, uintptr_t dataCount)
+{
+    (void)dataCount;
+    if ((status != ERROR_NONE) && (streamState.status == ERROR_NONE)) {
+        streamState.status = status;
+    }
+    streamState.pending--;
+}
+
+// Queue a whole data packet at once, so the SPI goes straight from one chunk
+// to the next instead of waiting for each to complete.
+static bool SPITransfer__StreamSyncTimeout(
+    SPIMaster         *interface,
+    void              *data,
+    uintptr_t          length,
+    SPI_TRANSFER_TYPE  transferType)
+{
+    if (!interface || (length > SD_STREAM_MAX)) {
+        return false;
+    }
+
+    uint8_t *data_byte = data;
+    unsigned count = 0;
+    uintptr_t offset;
+    for (offset = 0; offset < length; offset += SD_STREAM_CHUNK, count++) {
+        uintptr_t chunk = length - offset;
+        if (chunk > SD_STREAM_CHUNK) {
+            chunk = SD_STREAM_CHUNK;
+        }
+
+        streamTransfer[count].writeData = (transferType == SPI_WRITE ? &data_byte[offset] : NULL);
+        streamTransfer[count].readData  = (transferType == SPI_READ  ? &data_byte[offset] : NULL);
+        streamTransfer[count].length    = chunk;
+    }
+
+    if (GPT_IsEnabled(timer)) {
+        GPT_Stop(timer);
+    }
+    unsigned retries = NUM_RETRIES;
+    while ((retries-- > 0) && (GPT_StartTimeout(
+        timer, SPI_SD_TIMEOUT, GPT_UNITS_MILLISEC, NULL) == ERROR_NONE))
+        ;
+    if (retries == 0) {
+        return false;
+    }
+
+    streamState.pending = 0;
+    streamState.status  = ERROR_NONE;
+
+    // The data phase goes through DMA, the SPI is then fed the next chunk as
+    // soon as it's done with one; it falls back to PIO if DMA can't be enabled.
+    SPIMaster_DMAEnable(interface, true);
+
+    unsigned t;
+    for (t = 0; t < count; t += SD_STREAM_GROUP) {
+        unsigned group = count - t;
+        if (group > SD_STREAM_GROUP) {
+            group = SD_STREAM_GROUP;
+        }
+
+        streamState.pending++;
+        int32_t status;
+        while ((status = SPIMaster_TransferSequentialAsync(
+            interface, &streamTransfer[t], group, streamDoneCallback)) == ERROR_BUSY) {
+            __asm__("wfi");
+            if (!GPT_IsEnabled(timer)) {
+                break;
+            }
+        }
+
+        if (status != ERROR_NONE) {
+            streamState.pending--;
+            SPIMaster_TransferCancel(interface);
+            SPIMaster_DMAEnable(interface, false);
+            return false;
+        }
+    }
+
+    while (streamState.pending > 0) {
+        __asm__("wfi");
+        if (!GPT_IsEnabled(timer)) {
+            // Timed out, so cancel
+            SPIMaster_TransferCancel(interface);
+            SPIMaster_DMAEnable(interface, false);
+            return false;
+        }
+    }
+
+    // Commands and polls are a byte or few, which PIO turns round faster.
+    SPIMaster_DMAEnable(interface, false);
+
+    return (streamState.status == ERROR_NONE);
+}
+
 static bool SD_ClockBurst(SPIMaster* interface, unsigned cycles, bool select)
 {
     if (cycles == 0) {
@@ -335,7 +485,7 @@ static bool SD_Command(SPIMaster *interface, SD_CMD cmd, uint32_t argument,
     return true;
 }
 
-static bool SD_ReadDataPacket(const SDCard *card, uintptr_t size, void *data)
+static bool SD_ReceiveDataPacket(const SDCard *card, uintptr_t size, void *data)
 {
     unsigned retries = NUM_RETRIES;
     uint8_t byte = 0xFF;
@@ -349,17 +499,8 @@ static bool SD_ReadDataPacket(const SDCard *card, uintptr_t size, void *data)
         return false;
     }
 
-    uint8_t *data_byte = data;
-    uintptr_t packet = 16;
-    uintptr_t remain = size;
-    for (remain = size; remain; remain -= packet, data_byte += packet) {
-        if (packet > remain) {
-            packet = remain;
-        }
-
-        if (!SPITransfer__SyncTimeout(card->interface, data_byte, packet, SPI_READ)) {
-            return false;
-        }
+    if (!SPITransfer__StreamSyncTimeout(card->interface, data, size, SPI_READ)) {
+        return false;
     }
 
     uint16_t crc;
@@ -369,37 +510,48 @@ static bool SD_ReadDataPacket(const SDCard *card, uintptr_t size, void *data)
 
     // TODO: Verify the CRC.
 
+    return true;
+}
+
+static bool SD_ReadDataPacket(const SDCard *card, uintptr_t size, void *data)
+{
+    if (!SD_ReceiveDataPacket(card, size, data)) {
+        return false;
+    }
+
     // Clock burst is required here to give the card time to recover?
     SD_ClockBurst(card->interface, 32, false);
 
     return true;
 }
 
-static bool SD_WriteDataPacket(SDCard *card, uintptr_t size, const void *data)
+static bool SD_AwaitNotBusy(const SDCard *card)
 {
-    // Clock burst for >= 1 byte
-    SD_ClockBurst(card->interface, 16, false);
+    // Wait while card holds MISO low (busy)
+    unsigned busy_waits = NUM_RETRIES;
+    uint8_t byte = 0x00;
+    unsigned i;
+    for (i = 0; (i < busy_waits) && (byte == 0x00); i++) {
+        if (!SPITransfer__SyncTimeout(card->interface, &byte, 1, SPI_READ)) {
+            return false;
+        }
+    }
 
+    return (byte != 0x00);
+}
+
+static bool SD_SendDataPacket(SDCard *card, uint8_t token, uintptr_t size, const void *data)
+{
     // Write data token
-    static uint8_t write_token = DATA_TOKEN_WRITE_SINGLE;
-    if (!SPITransfer__SyncTimeout(card->interface, &write_token, 1, SPI_WRITE)) {
+    if (!SPITransfer__SyncTimeout(card->interface, &token, 1, SPI_WRITE)) {
         return false;
     }
 
     // Write data
-    uint8_t *data_byte = (uint8_t*)data;
-    uintptr_t packet = 16;
-    uintptr_t remain = size;
-    for (remain = size; remain; remain -= packet, data_byte += packet) {
-        if (packet > remain) {
-            packet = remain;
-        }
-
-        if (!SPITransfer__SyncTimeout(
-            card->interface, data_byte, packet, SPI_WRITE))
-        {
-            return false;
-        }
+    if (!SPITransfer__StreamSyncTimeout(
+        card->interface, (void*)data, size, SPI_WRITE))
+    {
+        return false;
     }
 
     // Write crc
@@ -420,24 +572,35 @@ static bool SD_WriteDataPacket(SDCard *card, uintptr_t size, const void *data)
             return false;
         }
     }
-    if ((byte & 0xF) != DATA_RESP_ACCEPTED) {
-        return false;
-    }
+    // The card then holds MISO low while it programs the data.
+    return ((byte & 0xF) == DATA_RESP_ACCEPTED);
+}
 
-    // Wait while card holds MISO low (busy)
-    unsigned busy_waits = NUM_RETRIES;
-    byte = 0x00;
-    for (i = 0; (i < busy_waits) && (byte == 0x00); i++) {
-        if (!SPITransfer__SyncTimeout(card->interface, &byte, 1, SPI_READ)) {
-            return false;
-        }
-    }
+static bool SD_WriteDataPacket(SDCard *card, uintptr_t size, const void *data)
+{
+    // Clock burst for >= 1 byte
+    SD_ClockBurst(card->interface, 16, false);
 
-    if (byte == 0x00) {
-        return false;
-    }
+    return SD_SendDataPacket(card, DATA_TOKEN_WRITE_SINGLE, size, data);
+}
 
-    return true;
+// The card is programming bytes written since start, until SD_PollBusy or
+// SD_AwaitIdle sees it release MISO.
+static void SD_BeginProgramming(const SDCard *card, uint32_t bytes, uint32_t start)
+{
+    SD_Programming[card - SD_Cards].busy  = true;
+    SD_Programming[card - SD_Cards].bytes = bytes;
+    SD_Programming[card - SD_Cards].start = start;
+}
+
+static void SD_EndProgramming(const SDCard *card, bool ok)
+{
+    SD_Programming[card - SD_Cards].busy = false;
+    SD_ClockBurst(card->interface, 32, false);
+    if (ok) {
+        SD_Account(card, true, SD_Programming[card - SD_Cards].bytes,
+            SD_Programming[card - SD_Cards].start);
+    }
 }
 
 static bool SD_ReadCSD(SDCard *card)
@@ -475,6 +638,23 @@ static bool SD_ReadCSD(SDCard *card)
         card->maxTranSpeed = tranSpeedValue * tranSpeedUnit;
     }
 
+    // Capacity, in 512 byte blocks.
+    unsigned csdStructure = (csd[0] >> 6);
+    if (csdStructure == 0) {
+        unsigned cSize     = ((csd[6] & 0x03) << 10) | (csd[7] << 2) | (csd[8] >> 6);
+        unsigned cSizeMult = ((csd[9] & 0x03) << 1) | (csd[10] >> 7);
+        unsigned readBlLen = (csd[5] & 0x0F);
+        card->blockCount = ((cSize + 1) << (cSizeMult + 2 + readBlLen)) / 512;
+    } else if (csdStructure == 1) {
+        unsigned cSize = ((csd[7] & 0x3F) << 16) | (csd[8] << 8) | csd[9];
+        card->blockCount = (cSize + 1) * 1024;
+    }
+
+    // Erase granularity, in blocks of the write block length.
+    bool     eraseBlkEn = ((csd[10] >> 6) & 0x01);
+    unsigned sectorSize = (((csd[10] & 0x3F) << 1) | (csd[11] >> 7)) + 1;
+    card->eraseBlocks = (eraseBlkEn ? 1 : sectorSize);
+
     return true;
 }
 
@@ -555,9 +735,26 @@ static bool SD_Initialize(SPIMaster *interface)
 }
 
 
+// Runs the bus at the card's TRAN_SPEED, or the fastest clock below it that
+// the CSD can be read back at.
+static void SD_NegotiateSpeed(SDCard *card)
+{
+    uint32_t speed = card->maxTranSpeed;
+    while (speed > SD_INIT_SPEED) {
+        if ((SPIMaster_Configure(card->interface, 0, 0, speed) == ERROR_NONE)
+            && SD_ReadCSD(card)) {
+            card->tranSpeed = speed;
+            return;
+        }
+        speed /= 2;
+    }
+
+    SPIMaster_Configure(card->interface, 0, 0, SD_INIT_SPEED);
+    card->tranSpeed = SD_INIT_SPEED;
+}
+
 SDCard *SD_Open(SPIMaster *interface)
 {
-    static SDCard SD_Cards[SD_CARD_MAX] = {0};
     SDCard *card = NULL;
     unsigned c;
     for (c = 0; c < SD_CARD_MAX; c++) {
@@ -577,7 +774,7 @@ SDCard *SD_Open(SPIMaster *interface)
 
 
     // Configure SPI Master to 400 kHz.
-    SPIMaster_Configure(interface, 0, 0, 400000);
+    SPIMaster_Configure(interface, 0, 0, SD_INIT_SPEED);
 
     unsigned retries = 5;
     unsigned i;
@@ -592,13 +789,17 @@ SDCard *SD_Open(SPIMaster *interface)
 
     card->interface    = interface;
     card->blockLen     = 512;
-    card->maxTranSpeed = 400000;
-    card->tranSpeed    = 400000;
+    card->maxTranSpeed = SD_INIT_SPEED;
+    card->tranSpeed    = SD_INIT_SPEED;
+    card->blockCount   = 0;
+    card->eraseBlocks  = 1;
 
-    if (SD_ReadCSD(card) && (card->maxTranSpeed != card->tranSpeed)) {
-        if (SPIMaster_Configure(card->interface, 0, 0, card->maxTranSpeed) == ERROR_NONE) {
-            card->tranSpeed = card->maxTranSpeed;
-        }
+    SD_Stats[card - SD_Cards].read  = (SD_Transferred){ 0 };
+    SD_Stats[card - SD_Cards].write = (SD_Transferred){ 0 };
+    SD_Programming[card - SD_Cards].busy = false;
+
+    if (SD_ReadCSD(card) && (card->maxTranSpeed > card->tranSpeed)) {
+        SD_NegotiateSpeed(card);
     }
 
     return card;
@@ -618,9 +819,103 @@ uint32_t SD_GetBlockLen(const SDCard *card)
 }
 
 
+uint32_t SD_GetBlockCount(const SDCard *card)
+{
+    return (card ? card->blockCount : 0);
+}
+
+
+uint32_t SD_GetEraseBlocks(const SDCard *card)
+{
+    return (card ? card->eraseBlocks : 0);
+}
+
+
+uint32_t SD_GetBusSpeed(const SDCard *card)
+{
+    return (card ? card->tranSpeed : 0);
+}
+
+
+int32_t SD_SetThroughputTimer(GPT *timer)
+{
+    float speedHz;
+    int32_t error = GPT_GetSpeed(timer, &speedHz);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+    throughputTimer = timer;
+    return ERROR_NONE;
+}
+
+
+static uint32_t SD_KBps(const SD_Transferred *t, float speedHz)
+{
+    if (t->ticks == 0) {
+        return 0;
+    }
+    return (uint32_t)(((float)t->bytes * speedHz) / ((float)t->ticks * 1000.0f));
+}
+
+
+bool SD_GetThroughput(const SDCard *card, SD_Throughput *throughput)
+{
+    float speedHz;
+    if (!card || !throughput || !throughputTimer
+        || (GPT_GetSpeed(throughputTimer, &speedHz) != ERROR_NONE)) {
+        return false;
+    }
+
+    throughput->busSpeed   = card->tranSpeed;
+    throughput->readBytes  = SD_Stats[card - SD_Cards].read.bytes;
+    throughput->writeBytes = SD_Stats[card - SD_Cards].write.bytes;
+    throughput->readKBps   = SD_KBps(&SD_Stats[card - SD_Cards].read, speedHz);
+    throughput->writeKBps  = SD_KBps(&SD_Stats[card - SD_Cards].write, speedHz);
+    return true;
+}
+
+
+int32_t SD_PollBusy(const SDCard *card)
+{
+    if (!card) {
+        return ERROR_PARAMETER;
+    }
+    if (!SD_Programming[card - SD_Cards].busy) {
+        return ERROR_NONE;
+    }
+
+    uint8_t byte = 0x00;
+    if (!SPITransfer__SyncTimeout(card->interface, &byte, 1, SPI_READ)) {
+        SD_EndProgramming(card, false);
+        return ERROR_TIMEOUT;
+    }
+    if (byte == 0x00) {
+        return ERROR_BUSY;
+    }
+
+    SD_EndProgramming(card, true);
+    return ERROR_NONE;
+}
+
+
+bool SD_AwaitIdle(const SDCard *card)
+{
+    if (!card) {
+        return false;
+    }
+    if (!SD_Programming[card - SD_Cards].busy) {
+        return true;
+    }
+
+    bool ok = SD_AwaitNotBusy(card);
+    SD_EndProgramming(card, ok);
+    return ok;
+}
+
+
 bool SD_SetBlockLen(SDCard *card, uint32_t len)
 {
-    if (!card || (len == 0)) {
+    if (!card || (len == 0) || !SD_AwaitIdle(card)) {
         return false;
     }
 
@@ -640,10 +935,12 @@ bool SD_SetBlockLen(SDCard *card, uint32_t len)
 
 bool SD_ReadBlock(const SDCard *card, uint32_t addr, void *data)
 {
-    if (!card || !data) {
+    if (!card || !data || !SD_AwaitIdle(card)) {
         return false;
     }
 
+    uint32_t start = SD_Now();
+
     SD_R1 response;
     if (!SD_CommandIncomplete(card->interface, READ_SINGLE_BLOCK, addr, sizeof(response), &response)) {
         return false;
@@ -653,20 +950,68 @@ bool SD_ReadBlock(const SDCard *card, uint32_t addr, void *data)
         return false;
     }
 
-    return SD_ReadDataPacket(card, card->blockLen, data);
+    if (!SD_ReadDataPacket(card, card->blockLen, data)) {
+        return false;
+    }
+
+    SD_Account(card, false, card->blockLen, start);
+    return true;
+}
+
+
+bool SD_WriteBlockStart(SDCard *card, uint32_t addr, const void *data)
+{
+    if (!card || !data || !SD_AwaitIdle(card)) {
+        return false;
+    }
+
+    unsigned attempt;
+    for (attempt = 0; attempt <= NUM_WRITE_RETRIES; attempt++) {
+        uint32_t start = SD_Now();
+
+        SD_R1 response;
+        if (!SD_CommandIncomplete(card->interface, WRITE_BLOCK, addr, sizeof(response), &response)) {
+            return false;
+        }
+
+        if (response.mask != 0x00) {
+            return false;
+        }
+
+        if (SD_WriteDataPacket(card, card->blockLen, data)) {
+            SD_BeginProgramming(card, card->blockLen, start);
+            return true;
+        }
+
+        // Let the card finish with a rejected block before it's sent again.
+        SD_AwaitNotBusy(card);
+        SD_ClockBurst(card->interface, 32, false);
+    }
+
+    return false;
 }
 
 
 bool SD_WriteBlock(SDCard *card, uint32_t addr, const void *data)
 {
-    if (!card || !data) {
+    return SD_WriteBlockStart(card, addr, data) && SD_AwaitIdle(card);
+}
+
+
+bool SD_ReadBlocks(const SDCard *card, uint32_t addr, uint32_t count, void *data)
+{
+    if (!card || !data || (count == 0) || !SD_AwaitIdle(card)) {
         return false;
     }
 
-    static unsigned num_retries = NUM_WRITE_RETRIES;
+    if (count == 1) {
+        return SD_ReadBlock(card, addr, data);
+    }
+
+    uint32_t start = SD_Now();
 
     SD_R1 response;
-    if (!SD_CommandIncomplete(card->interface, WRITE_BLOCK, addr, sizeof(response), &response)) {
+    if (!SD_CommandIncomplete(card->interface, READ_MULTIPLE_BLOCK, addr, sizeof(response), &response)) {
         return false;
     }
 
@@ -674,17 +1019,127 @@ bool SD_WriteBlock(SDCard *card, uint32_t addr, const void *data)
         return false;
     }
 
-    if (!SD_WriteDataPacket(card, card->blockLen, data)) {
-        if (num_retries > 0) {
-            num_retries--;
-            return SD_WriteBlock(card, addr, data);
-        }
-        else {
-            return false;
-        }
+    // The card streams blocks back to back, each with its own token and CRC,
+    // so CS stays asserted until the transfer is stopped.
+    bool ok = true;
+    uint8_t *block = data;
+    uint32_t i;
+    for (i = 0; ok && (i < count); i++, block += card->blockLen) {
+        ok = SD_ReceiveDataPacket(card, card->blockLen, block);
+    }
+
+    // Always stop, even after a failed packet, so the card returns to the
+    // transfer state; CMD12 is answered with R1b.
+    if (!SD_CommandIncomplete(card->interface, STOP_TRANSMISSION, 0, sizeof(response), &response)
+        || !SD_AwaitNotBusy(card)) {
+        ok = false;
+    }
+
+    SD_ClockBurst(card->interface, 32, false);
+
+    ok = ok && ((response.mask & 0x7E) == 0x00);
+    if (ok) {
+        SD_Account(card, false, (count * card->blockLen), start);
+    }
+    return ok;
+}
+
+
+bool SD_WriteBlocksStart(SDCard *card, uint32_t addr, uint32_t count, const void *data)
+{
+    if (!card || !data || (count == 0) || !SD_AwaitIdle(card)) {
+        return false;
+    }
+
+    if (count == 1) {
+        return SD_WriteBlockStart(card, addr, data);
+    }
+
+    uint32_t start = SD_Now();
+
+    SD_R1 response;
+
+    // Pre-erasing is only a hint to the card, so carry on if it's refused.
+    if (SD_Command(card->interface, APP_CMD, 0, sizeof(response), &response)
+        && ((response.mask & 0x7E) == 0x00)) {
+        SD_Command(card->interface, (SD_CMD)APP_SET_WR_BLK_ERASE_COUNT, count,
+            sizeof(response), &response);
+    }
+
+    if (!SD_CommandIncomplete(card->interface, WRITE_MULTIPLE_BLOCK, addr, sizeof(response), &response)) {
+        return false;
+    }
+
+    if (response.mask != 0x00) {
+        return false;
+    }
+
+    bool ok = true;
+    const uint8_t *block = data;
+    uint32_t i;
+    for (i = 0; ok && (i < count); i++, block += card->blockLen) {
+        // Clock burst for >= 1 byte, keeping the card selected.
+        SD_ClockBurst(card->interface, 8, true);
+        ok = SD_SendDataPacket(card, DATA_TOKEN_WRITE_MULT, card->blockLen, block)
+            && SD_AwaitNotBusy(card);
     }
-    else {
-        num_retries = NUM_WRITE_RETRIES;
+
+    // The stop token is sent even after a rejected block, the card then holds
+    // MISO low until it's finished programming what it accepted.
+    uint8_t stop[2] = { DATA_TOKEN_WRITE_MULT_STOP, 0xFF };
+    if (!SPITransfer__SyncTimeout(card->interface, stop, sizeof(stop), SPI_WRITE)) {
+        ok = false;
+    } else if (ok) {
+        SD_BeginProgramming(card, (count * card->blockLen), start);
         return true;
     }
+
+    SD_AwaitNotBusy(card);
+    SD_ClockBurst(card->interface, 32, false);
+    return false;
+}
+
+
+bool SD_WriteBlocks(SDCard *card, uint32_t addr, uint32_t count, const void *data)
+{
+    return SD_WriteBlocksStart(card, addr, count, data) && SD_AwaitIdle(card);
+}
+
+
+bool SD_EraseBlocks(SDCard *card, uint32_t addr, uint32_t count)
+{
+    if (!card || (count == 0) || !SD_AwaitIdle(card)) {
+        return false;
+    }
+
+    SD_R1 response;
+    if (!SD_Command(card->interface, ERASE_WR_BLK_START, addr, sizeof(response), &response)
+        || (response.mask != 0x00)) {
+        return false;
+    }
+
+    if (!SD_Command(card->interface, ERASE_WR_BLK_END, (addr + count - 1), sizeof(response), &response)
+        || (response.mask != 0x00)) {
+        return false;
+    }
+
+    // CMD38 is answered with R1b, the card holds MISO low until it's done.
+    if (!SD_CommandIncomplete(card->interface, ERASE, 0, sizeof(response), &response)) {
+        return false;
+    }
+
+    bool ok = (response.mask == 0x00);
+    unsigned i;
+    for (i = 0; ok && (i < NUM_ERASE_BUSY_WAITS); i++) {
+        if (SD_AwaitNotBusy(card)) {
+            break;
+        }
+    }
+    if (i >= NUM_ERASE_BUSY_WAITS) {
+        ok = false;
+    }
+
+    SD_ClockBurst(card->interface, 32, false);
+
+    return ok;
 }
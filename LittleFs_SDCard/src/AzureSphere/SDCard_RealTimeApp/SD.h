@@ -19,7 +19,52 @@ void     SD_Close(SDCard *card);
 uint32_t SD_GetBlockLen(const SDCard *card);
 bool     SD_SetBlockLen(SDCard *card, uint32_t len);
 
+// Geometry read from the card's CSD: capacity in 512 byte blocks (0 if the
+// CSD couldn't be read) and the erase granularity in blocks.
+uint32_t SD_GetBlockCount(const SDCard *card);
+uint32_t SD_GetEraseBlocks(const SDCard *card);
+
+// SPI clock the card runs at after SD_Open: its TRAN_SPEED, or the fastest
+// rate below that it could be read back at; SPIMaster_Configure takes the
+// nearest clock the SPI can make at or below this. Data packets are moved with
+// the SPI's DMA enabled, commands and polls with it disabled.
+uint32_t SD_GetBusSpeed(const SDCard *card);
+
+// Throughput of the block reads and writes, command overhead and busy waits
+// included, timed on a free running timer (GPT4 shared with the scheduler
+// works), which must be set before it's counted.
+typedef struct {
+    uint32_t busSpeed;   // [Hz]
+    uint32_t readKBps;
+    uint32_t writeKBps;
+    uint64_t readBytes;
+    uint64_t writeBytes;
+} SD_Throughput;
+
+int32_t  SD_SetThroughputTimer(GPT *timer);
+bool     SD_GetThroughput(const SDCard *card, SD_Throughput *throughput);
+
 bool     SD_ReadBlock (const SDCard *card, uint32_t addr, void *data);
 bool     SD_WriteBlock(SDCard *card, uint32_t addr, const void *data);
 
+// Multi-block transfers of count consecutive blocks, using a single command
+// (CMD18/CMD25) rather than one per block; data holds count * block length
+// bytes.
+bool     SD_ReadBlocks (const SDCard *card, uint32_t addr, uint32_t count, void *data);
+bool     SD_WriteBlocks(SDCard *card, uint32_t addr, uint32_t count, const void *data);
+
+// Writes which return once the card has accepted the data, leaving it busy
+// programming it; data may be reused straight away. SD_PollBusy checks once
+// with a single byte read, returning ERROR_BUSY until the card is done, so the
+// caller can poll on its own schedule. Any other call waits for the card to
+// finish first, as SD_AwaitIdle does.
+bool     SD_WriteBlockStart (SDCard *card, uint32_t addr, const void *data);
+bool     SD_WriteBlocksStart(SDCard *card, uint32_t addr, uint32_t count, const void *data);
+int32_t  SD_PollBusy(const SDCard *card);
+bool     SD_AwaitIdle(const SDCard *card);
+
+// Erases count consecutive blocks with CMD32/CMD33/CMD38, so the card can
+// prepare them for writing; erased blocks read back as all 0s or all 1s.
+bool     SD_EraseBlocks(SDCard *card, uint32_t addr, uint32_t count);
+
 #endif // #ifndef SD_H_
@@ -26,7 +26,10 @@
 #include "lib/UART.h"
 #include "lib/Print.h"
 #include "lib/SPIMaster.h"
+#include "lib/GPT.h"
+#include "lib/mt3620/gpt.h"
 
+#include "Scheduler.h"
 #include "Socket.h"
 #include "intercore_messages.h"
 #include "SD.h"
@@ -38,8 +41,41 @@ static SDCard* card = NULL;
 uint8_t dataBlock[PAGE_SIZE];
 
 struct SD_CMD_WITH_DATA txStruct;
+static struct SD_CMD_BLOCKS_DATA txChunk;
+
+// Range transfers are staged here, a read is fetched with a single CMD18
+// and a write is collected from the A7 before a single CMD25.
+static uint8_t multiBlock[MSG_BLOCKS_MAX * PAGE_SIZE];
+
+static struct {
+    bool     active;
+    bool     failed;
+    uint32_t blockNumber;
+    uint32_t blockCount;
+    uint32_t received;
+} multiWrite = { 0 };
+
+// Number of attempts to queue a reply while the A7 drains the ring buffer.
+#define SOCKET_WRITE_RETRIES 100000
+
+// A write's result is sent once the card has finished programming it, which
+// is polled every SD_BUSY_POLL_US on busyTimer; meanwhile the next requests
+// are received, and those which don't need the card are handled. After
+// SD_BUSY_POLLS, the longest an SDHC card may take, the write fails.
+#define SD_BUSY_POLL_US 100
+#define SD_BUSY_POLLS   5000
+
+static struct {
+    bool          active;
+    unsigned      polls;
+    struct SD_CMD result;
+} pendingWrite = { 0 };
+
+// A request left in the socket until the card is free.
+static bool recvDeferred = false;
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 static const Component_Id A7ID =
 {
@@ -49,21 +85,19 @@ static const Component_Id A7ID =
     .seg_3_4 = {0xba, 0xe1, 0xac, 0x26, 0xfc, 0xdd, 0x36, 0x27}
 };
 
-static uint8_t recvBuffer[720];
+static uint8_t recvBuffer[sizeof(struct SD_CMD_BLOCKS_DATA)];
 
 // Drivers
 static UART   *debug              = NULL;
 static Socket *socket             = NULL;
+static GPT    *busyTimer          = NULL;
 
-// Callbacks
-typedef struct CallbackNode {
-    bool enqueued;
-    struct CallbackNode *next;
-    void *data;
-    void (*cb)(void*);
-} CallbackNode;
+static void handleRecvMsg(void *handle);
+static void pollWrite(void *unused);
+static void PrintSDThroughput(void);
 
-static void EnqueueCallback(CallbackNode *node);
+static Scheduler_Task recvTask     = SCHEDULER_TASK(handleRecvMsg, SCHEDULER_PRIORITY_LOW, 0);
+static Scheduler_Task busyPollTask = SCHEDULER_TASK(pollWrite, SCHEDULER_PRIORITY_NORMAL, 0);
 
 static void printSDBlock(uint8_t* buff, uintptr_t blocklen, unsigned blockID)
 {
@@ -116,35 +150,285 @@ static void WriteDataToA7(uint8_t* data, ssize_t size)
     }
 }
 
-static void handleRecvMsg(void *handle)
+// Same as WriteDataToA7, but waits for the A7 to make room if the ring buffer
+// is full, for replies which are sent back to back.
+static bool WriteDataToA7Sync(const void* data, uint32_t size)
 {
-    Socket *socket = (Socket*)handle;
+    unsigned retries;
+    for (retries = 0; retries < SOCKET_WRITE_RETRIES; retries++) {
+        int32_t error = Socket_Write(socket, &A7ID, data, size);
+        if (error == ERROR_NONE) {
+            return true;
+        }
+        if (error != ERROR_SOCKET_INSUFFICIENT_SPACE) {
+            UART_Printf(debug, "Error Result: %d\r\n", error);
+            return false;
+        }
+    }
 
-    Component_Id senderId;
+    UART_Print(debug, "ERROR: timed out waiting for the A7\r\n");
+    return false;
+}
 
-    if (Socket_NegotiationPending(socket)) {
-        UART_Printf(debug, "Negotiation pending, attempting renegotiation\r\n");
-        // NB: this is blocking, if you want to protect against hanging,
-        //     add a timeout
-        if (Socket_Negotiate(socket) != ERROR_NONE) {
-            UART_Printf(debug, "ERROR: renegotiating socket connection\r\n");
+static void busyTimerCallback(GPT *timer)
+{
+    (void)timer;
+    Scheduler_Post(&busyPollTask);
+}
+
+// Sends the result of a write which the card accepted once it's programmed.
+static void AwaitWrite(uint8_t id, uint32_t blockNumber)
+{
+    pendingWrite.active = true;
+    pendingWrite.polls  = 0;
+    pendingWrite.result.id = id;
+    pendingWrite.result.blockNumber = blockNumber;
+    pendingWrite.result.read_write_result = 0;
+    Scheduler_Post(&busyPollTask);
+}
+
+static void pollWrite(void *unused)
+{
+    (void)unused;
+    if (!pendingWrite.active) {
+        return;
+    }
+
+    int32_t status = SD_PollBusy(card);
+    if (status == ERROR_BUSY) {
+        pendingWrite.polls++;
+        if ((pendingWrite.polls < SD_BUSY_POLLS) && busyTimer
+            && (GPT_StartTimeout(busyTimer, SD_BUSY_POLL_US, GPT_UNITS_MICROSEC,
+                busyTimerCallback) == ERROR_NONE)) {
+            return;
+        }
+        // Without the timer, or once the card is overdue, wait for it here.
+        status = (SD_AwaitIdle(card) ? ERROR_NONE : ERROR_TIMEOUT);
+    }
+    pendingWrite.active = false;
+
+    if (status != ERROR_NONE) {
+        pendingWrite.result.read_write_result = -1;
+        UART_Printf(debug, "ERROR: card busy after writing block %u - %ld\r\n",
+            pendingWrite.result.blockNumber, status);
+    }
+#ifdef SHOW_DEBUG_INFO
+    PrintSDThroughput();
+#endif
+    WriteDataToA7Sync(&pendingWrite.result, sizeof(pendingWrite.result));
+
+    if (recvDeferred) {
+        recvDeferred = false;
+        Scheduler_Post(&recvTask);
+    }
+}
+
+// Reads a range with one multi-block read and streams it to the A7 in
+// MSG_BLOCKS_DATA chunks, followed by a single result.
+static void ReadBlocksToA7(uint32_t blockNumber, uint32_t blockCount)
+{
+    struct SD_CMD cmd;
+    cmd.id = MSG_BLOCKS_READ_RESULT;
+    cmd.blockNumber = blockNumber;
+    cmd.read_write_result = -1;
+
+    if ((blockCount == 0) || (blockCount > MSG_BLOCKS_MAX)
+        || !SD_ReadBlocks(card, blockNumber, blockCount, multiBlock)) {
+        UART_Printf(debug, "ERROR: reading blocks %u+%u\r\n", blockNumber, blockCount);
+        WriteDataToA7Sync(&cmd, sizeof(cmd));
+        return;
+    }
+
+    uint32_t i;
+    for (i = 0; i < blockCount; i += MSG_BLOCKS_PER_CHUNK) {
+        txChunk.id = MSG_BLOCKS_DATA;
+        txChunk.blockNumber = blockNumber + i;
+        txChunk.blockCount = MIN(blockCount - i, MSG_BLOCKS_PER_CHUNK);
+        __builtin_memcpy(txChunk.blockData, &multiBlock[i * PAGE_SIZE], txChunk.blockCount * PAGE_SIZE);
+        if (!WriteDataToA7Sync(&txChunk, sizeof(txChunk))) {
             return;
         }
     }
 
-    uint32_t size = sizeof(recvBuffer);
-    int32_t error = Socket_Read(socket, &senderId, &recvBuffer[0], &size);
+    cmd.read_write_result = 0;
+#ifdef SHOW_DEBUG_INFO
+    PrintSDThroughput();
+#endif
+    WriteDataToA7Sync(&cmd, sizeof(cmd));
+}
+
+// Stages one chunk of a range write, once the last one arrives the range is
+// written and a single result is returned to the A7.
+static void StageWriteChunk(const struct SD_CMD_BLOCKS_DATA* pChunk)
+{
+    if (!multiWrite.active) {
+        UART_Printf(debug, "ERROR: unexpected chunk for block %u\r\n", pChunk->blockNumber);
+        return;
+    }
+
+    uint32_t blockCount = pChunk->blockCount;
+    if ((pChunk->blockNumber != (multiWrite.blockNumber + multiWrite.received))
+        || (blockCount == 0) || (blockCount > MSG_BLOCKS_PER_CHUNK)
+        || (blockCount > (multiWrite.blockCount - multiWrite.received))) {
+        // Keep counting so the result still follows the range's last chunk.
+        multiWrite.failed = true;
+        blockCount = MIN(MAX(blockCount, 1), multiWrite.blockCount - multiWrite.received);
+    } else {
+        __builtin_memcpy(&multiBlock[multiWrite.received * PAGE_SIZE], pChunk->blockData,
+            blockCount * PAGE_SIZE);
+    }
+
+    multiWrite.received += blockCount;
+    if (multiWrite.received < multiWrite.blockCount) {
+        return;
+    }
+    multiWrite.active = false;
+
+    if (!multiWrite.failed
+        && SD_WriteBlocksStart(card, multiWrite.blockNumber, multiWrite.blockCount, multiBlock)) {
+        // The next range is staged in multiBlock while the card programs this one.
+        AwaitWrite(MSG_BLOCKS_WRITE_RESULT, multiWrite.blockNumber);
+        return;
+    }
+
+    struct SD_CMD cmd;
+    cmd.id = MSG_BLOCKS_WRITE_RESULT;
+    cmd.blockNumber = multiWrite.blockNumber;
+    cmd.read_write_result = (multiWrite.failed ? -1 : 0);
+
+    if (!multiWrite.failed) {
+        // Fall back to single block writes, which are retried.
+        uint32_t i;
+        for (i = 0; i < multiWrite.blockCount; i++) {
+            if (!SD_WriteBlock(card, multiWrite.blockNumber + i, &multiBlock[i * PAGE_SIZE])) {
+                cmd.blockNumber = multiWrite.blockNumber + i;
+                cmd.read_write_result = -1;
+                break;
+            }
+        }
+    }
+
+    if (cmd.read_write_result != 0) {
+        UART_Printf(debug, "ERROR: writing blocks %u+%u\r\n",
+            multiWrite.blockNumber, multiWrite.blockCount);
+    }
+#ifdef SHOW_DEBUG_INFO
+    PrintSDThroughput();
+#endif
+    WriteDataToA7Sync(&cmd, sizeof(cmd));
+}
+
+// Reads a block from the SD card straight into the socket's shared ring
+// buffer, so the block isn't copied through dataBlock and txStruct.
+// Returns false if no contiguous space could be reserved.
+static bool ReadBlockToA7(uint32_t blockNumber)
+{
+    Socket_Segments segments;
+    if (Socket_Reserve(socket, sizeof(struct SD_CMD_WITH_DATA), &segments) != ERROR_NONE) {
+        return false;
+    }
+    if (segments.size[1] != 0) {
+        Socket_Commit(socket, &A7ID, 0);
+        return false;
+    }
+
+    struct SD_CMD_WITH_DATA* pResult = (struct SD_CMD_WITH_DATA*)segments.data[0];
+    pResult->id = MSG_BLOCK_READ_RESULT;
+    pResult->blockNumber = blockNumber;
+
+    if (!SD_ReadBlock(card, blockNumber, pResult->blockData)) {
+        // If read block fails then return an error state to the A7
+        UART_Printf(debug, "ERROR: reading block\r\n");
+        Socket_Commit(socket, &A7ID, 0);
+
+        struct SD_CMD cmd;
+        cmd.id = MSG_BLOCK_READ_RESULT;
+        cmd.blockNumber = blockNumber;
+        cmd.read_write_result = -1;
+        WriteDataToA7((uint8_t*)&cmd, sizeof(cmd));
+        return true;
+    }
+
+#ifdef SHOW_DEBUG_INFO
+    UART_Printf(debug, "Returning block %d - ", blockNumber);
+#endif
+    int32_t error = Socket_Commit(socket, &A7ID, sizeof(struct SD_CMD_WITH_DATA));
+    if (error != 0)
+    {
+        UART_Printf(debug, "Error Result: %d\r\n", error);
+    }
+    return true;
+}
+
+// Whether a request has to wait while the card is programming a write; a
+// chunk of a range only does if it's the last one, which writes the range.
+static bool NeedsCard(const struct SD_CMD_WITH_DATA* pMsg)
+{
+    switch (pMsg->id)
+    {
+    case MSG_BLOCKS_DATA:
+    {
+        const struct SD_CMD_BLOCKS_DATA* pChunk = (const struct SD_CMD_BLOCKS_DATA*)pMsg;
+        return multiWrite.active
+            && (MAX(pChunk->blockCount, 1) >= (multiWrite.blockCount - multiWrite.received));
+    }
 
+    case MSG_BLOCKS_WRITE:
+    case MSG_GEOMETRY:
+        return false;
+
+    default:
+        return true;
+    }
+}
+
+// Handles the next request in the socket, returns false once there are none
+// left or the next one must wait for the card.
+static bool handleNextMsg(Socket *socket)
+{
+    Component_Id senderId;
+
+    Socket_Segments segments;
+    int32_t error = Socket_Peek(socket, &senderId, &segments);
+
+    if (error == ERROR_SOCKET_INSUFFICIENT_SPACE) {
+        return false;
+    }
     if (error != ERROR_NONE) {
         UART_Printf(debug, "ERROR: receiving msg - %ld\r\n", error);
-        return;
+        return false;
     }
 
+    uint32_t size = segments.size[0] + segments.size[1];
+
 #ifdef SHOW_DEBUG_INFO
     UART_Printf(debug, "Received %d bytes\r\n", size);
 #endif
 
-    struct SD_CMD_WITH_DATA* pMsg = (struct SD_CMD_WITH_DATA*)&recvBuffer[0];
+    // Use the message in place in the shared ring buffer, unless it wraps
+    // around the end of the buffer.
+    struct SD_CMD_WITH_DATA* pMsg = (struct SD_CMD_WITH_DATA*)segments.data[0];
+    bool inPlace = (segments.size[1] == 0);
+    if (!inPlace) {
+        if (size > sizeof(recvBuffer)) {
+            UART_Printf(debug, "ERROR: msg too long - %ld\r\n", size);
+            Socket_Consume(socket);
+            return true;
+        }
+        __builtin_memcpy(&recvBuffer[0], segments.data[0], segments.size[0]);
+        __builtin_memcpy(&recvBuffer[segments.size[0]], segments.data[1], segments.size[1]);
+        pMsg = (struct SD_CMD_WITH_DATA*)&recvBuffer[0];
+    }
+
+    // Left in the socket, it's peeked again once the write completes.
+    if (pendingWrite.active && NeedsCard(pMsg)) {
+        recvDeferred = true;
+        return false;
+    }
+
+    if (!inPlace) {
+        Socket_Consume(socket);
+    }
 
     struct SD_CMD cmd;
     cmd.blockNumber = pMsg->blockNumber;
@@ -159,8 +443,16 @@ static void handleRecvMsg(void *handle)
 #ifdef SHOW_DEBUG_INFO
         UART_Printf(debug, "READ Block %d - ", pMsg->blockNumber);
 #endif
+        if (inPlace) {
+            Socket_Consume(socket);
+            inPlace = false;
+        }
+
+        if (ReadBlockToA7(cmd.blockNumber)) {
+            break;
+        }
 
-        if (!SD_ReadBlock(card, pMsg->blockNumber, &dataBlock[0])) {
+        if (!SD_ReadBlock(card, cmd.blockNumber, &dataBlock[0])) {
             // If read block fails then return an error state to the A7
             UART_Printf(debug, "ERROR: reading block\r\n");
             cmd.id = MSG_BLOCK_READ_RESULT;
@@ -172,10 +464,10 @@ static void handleRecvMsg(void *handle)
             // read successful, return the block to the A7
             // printSDBlock(dataBlock, PAGE_SIZE, pMsg->blockNumber);
             txStruct.id = MSG_BLOCK_READ_RESULT;
-            txStruct.blockNumber = pMsg->blockNumber;
+            txStruct.blockNumber = cmd.blockNumber;
             __builtin_memcpy(txStruct.blockData, dataBlock, PAGE_SIZE);
 #ifdef SHOW_DEBUG_INFO
-            UART_Printf(debug, "Returning block %d - ", pMsg->blockNumber);
+            UART_Printf(debug, "Returning block %d - ", cmd.blockNumber);
 #endif
             WriteDataToA7(&txStruct, sizeof(txStruct));
         }
@@ -187,63 +479,114 @@ static void handleRecvMsg(void *handle)
 #endif
         cmd.id = MSG_BLOCK_WRITE_RESULT;
 
-        if (!SD_WriteBlock(card, pMsg->blockNumber, pMsg->blockData)) {
-            // write block failed, return error state to the A7
-            cmd.read_write_result = -1;
-            UART_Printf(debug, "ERROR: writing block %d\r\n",pMsg->blockNumber);
-        }
-        else
-        {
-            // write block success, confirm result to the A7
-            cmd.id = MSG_BLOCK_WRITE_RESULT;
-            cmd.read_write_result = 0;
+        // The block is written to the card straight from the ring buffer,
+        // the result follows once the card has programmed it.
+        if (SD_WriteBlockStart(card, pMsg->blockNumber, pMsg->blockData)) {
+            AwaitWrite(MSG_BLOCK_WRITE_RESULT, cmd.blockNumber);
+            break;
         }
+
+        // write block failed, return error state to the A7
+        cmd.read_write_result = -1;
+        UART_Printf(debug, "ERROR: writing block %d\r\n",pMsg->blockNumber);
         WriteDataToA7(&cmd, sizeof(cmd));
         break;
+
+    case MSG_BLOCKS_READ:
+    {
+        const struct SD_CMD_BLOCKS* pBlocks = (const struct SD_CMD_BLOCKS*)pMsg;
+        uint32_t blockCount = pBlocks->blockCount;
+        if (inPlace) {
+            Socket_Consume(socket);
+            inPlace = false;
+        }
+
+        ReadBlocksToA7(cmd.blockNumber, blockCount);
+        break;
     }
- }
 
-static void handleRecvMsgWrapper(Socket *handle)
-{
-    static CallbackNode cbn = {.enqueued = false, .cb = handleRecvMsg, .data = NULL};
+    case MSG_BLOCKS_WRITE:
+    {
+        const struct SD_CMD_BLOCKS* pBlocks = (const struct SD_CMD_BLOCKS*)pMsg;
+        if ((pBlocks->blockCount == 0) || (pBlocks->blockCount > MSG_BLOCKS_MAX)) {
+            cmd.id = MSG_BLOCKS_WRITE_RESULT;
+            cmd.read_write_result = -1;
+            WriteDataToA7Sync(&cmd, sizeof(cmd));
+            break;
+        }
 
-    if (!cbn.data) {
-        cbn.data = handle;
+        // The data follows as MSG_BLOCKS_DATA chunks.
+        multiWrite.active      = true;
+        multiWrite.failed      = false;
+        multiWrite.blockNumber = pBlocks->blockNumber;
+        multiWrite.blockCount  = pBlocks->blockCount;
+        multiWrite.received    = 0;
+        break;
     }
 
-    EnqueueCallback(&cbn);
-}
+    case MSG_BLOCKS_DATA:
+        StageWriteChunk((const struct SD_CMD_BLOCKS_DATA*)pMsg);
+        break;
 
-static CallbackNode *volatile callbacks = NULL;
+    case MSG_GEOMETRY:
+    {
+        struct SD_GEOMETRY geometry;
+        geometry.id = MSG_GEOMETRY_RESULT;
+        geometry.blockSize = SD_GetBlockLen(card);
+        geometry.blockCount = SD_GetBlockCount(card);
+        geometry.eraseBlocks = SD_GetEraseBlocks(card);
+        geometry.result = ((geometry.blockCount > 0) ? 0 : -1);
+        WriteDataToA7Sync(&geometry, sizeof(geometry));
+        break;
+    }
 
-static void EnqueueCallback(CallbackNode *node)
-{
-    uint32_t prevBasePri = NVIC_BlockIRQs();
-    if (!node->enqueued) {
-        CallbackNode *prevHead = callbacks;
-        node->enqueued = true;
-        callbacks = node;
-        node->next = prevHead;
-    }
-    NVIC_RestoreIRQs(prevBasePri);
+    case MSG_BLOCKS_ERASE:
+    {
+        const struct SD_CMD_BLOCKS* pBlocks = (const struct SD_CMD_BLOCKS*)pMsg;
+        cmd.id = MSG_BLOCKS_ERASE_RESULT;
+        cmd.read_write_result = 0;
+        if (!SD_EraseBlocks(card, pBlocks->blockNumber, pBlocks->blockCount)) {
+            UART_Printf(debug, "ERROR: erasing blocks %u+%u\r\n", pBlocks->blockNumber, pBlocks->blockCount);
+            cmd.read_write_result = -1;
+        }
+        WriteDataToA7Sync(&cmd, sizeof(cmd));
+        break;
+    }
+    }
+
+    if (inPlace) {
+        Socket_Consume(socket);
+    }
+    return true;
 }
 
-static void InvokeCallbacks(void)
+static void handleRecvMsg(void *handle)
 {
-    CallbackNode *node;
-    do {
-        uint32_t prevBasePri = NVIC_BlockIRQs();
-        node = callbacks;
-        if (node) {
-            node->enqueued = false;
-            callbacks = node->next;
-        }
-        NVIC_RestoreIRQs(prevBasePri);
+    Socket *socket = (Socket*)handle;
 
-        if (node) {
-            (node->cb)(node->data);
+    if (Socket_NegotiationPending(socket)) {
+        UART_Printf(debug, "Negotiation pending, attempting renegotiation\r\n");
+        // NB: this is blocking, if you want to protect against hanging,
+        //     add a timeout
+        if (Socket_Negotiate(socket) != ERROR_NONE) {
+            UART_Printf(debug, "ERROR: renegotiating socket connection\r\n");
+            return;
         }
-    } while (node);
+    }
+
+    // Notifications are merged while the task is queued, so take every
+    // request that has arrived.
+    while (handleNextMsg(socket)) {
+    }
+}
+
+static void handleRecvMsgWrapper(Socket *handle)
+{
+    if (!recvTask.data) {
+        recvTask.data = handle;
+    }
+
+    Scheduler_Post(&recvTask);
 }
 
 /// <summary>
@@ -264,6 +607,36 @@ void SpiSDTest(void)
     }
 }
 
+// Prints the SD card's bus clock and the throughput of its block reads and
+// writes so far.
+static void PrintSDThroughput(void)
+{
+    SD_Throughput throughput;
+    if (!SD_GetThroughput(card, &throughput)) {
+        return;
+    }
+
+    UART_Printf(debug, "SD card at %u Hz: read %u.%02u MB/s, write %u.%02u MB/s\r\n",
+        throughput.busSpeed,
+        throughput.readKBps / 1000, (throughput.readKBps % 1000) / 10,
+        throughput.writeKBps / 1000, (throughput.writeKBps % 1000) / 10);
+}
+
+/// <summary>
+/// Times multi-block reads of the start of the card, which don't change it.
+/// </summary>
+static void SpiSDBenchmark(void)
+{
+    for (int x = 0; x < 16; x++)
+    {
+        if (!SD_ReadBlocks(card, 0, MSG_BLOCKS_MAX, multiBlock)) {
+            UART_Printf(debug, "ERROR: reading blocks 0+%u\r\n", MSG_BLOCKS_MAX);
+            return;
+        }
+    }
+    PrintSDThroughput();
+}
+
 _Noreturn void RTCoreMain(void)
 {
     VectorTableInit();
@@ -277,6 +650,21 @@ _Noreturn void RTCoreMain(void)
     UART_Print(debug, "M4 SD Card Interface Application\r\n");
     UART_Print(debug, "App built on: " __DATE__ " " __TIME__ "\r\n");
 
+    // GPT4 free runs at the CPU clock to measure task latency
+    GPT *latencyTimer = GPT_Open(MT3620_UNIT_GPT4, CPUFreq_Get(), GPT_MODE_NONE);
+    if (Scheduler_Init(latencyTimer) != ERROR_NONE) {
+        UART_Printf(debug, "ERROR: scheduler latency timer initialisation failed\r\n");
+        Scheduler_Init(NULL);
+    } else {
+        SD_SetThroughputTimer(latencyTimer);
+    }
+
+    // GPT1 times the polls of the card while it programs a write
+    busyTimer = GPT_Open(MT3620_UNIT_GPT1, MT3620_GPT_012_HIGH_SPEED, GPT_MODE_ONE_SHOT);
+    if (!busyTimer) {
+        UART_Printf(debug, "ERROR: busy poll timer initialisation failed\r\n");
+    }
+
     //volatile bool f = false;
     //while (!f) {
     //    // empty.
@@ -295,6 +683,7 @@ _Noreturn void RTCoreMain(void)
         UART_Print(debug,
             "ERROR: SPI initialisation failed\r\n");
     }
+    // The SD driver enables DMA for its data packets only.
     SPIMaster_DMAEnable(driver, false);
 
     // Use CSA for chip select.
@@ -304,13 +693,12 @@ _Noreturn void RTCoreMain(void)
     if (!card) {
         UART_Print(debug,
             "ERROR: Failed to open SD card.\r\n");
+    } else {
+        SpiSDBenchmark();
     }
 
     // SPI/SD test - read and display the first 10 SD Card blocks
     // SpiSDTest();
 
-    for (;;) {
-        __asm__("wfi");
-        InvokeCallbacks();
-    }
+    Scheduler_Run();
 }
@@ -17,6 +17,23 @@
 #define MSG_BLOCK_READ          2
 #define MSG_BLOCK_READ_RESULT   3
 #define MSG_BLOCK_WRITE_RESULT  4
+#define MSG_BLOCKS_READ         5
+#define MSG_BLOCKS_WRITE        6
+#define MSG_BLOCKS_DATA         7
+#define MSG_BLOCKS_READ_RESULT  8
+#define MSG_BLOCKS_WRITE_RESULT 9
+#define MSG_GEOMETRY            10
+#define MSG_GEOMETRY_RESULT     11
+#define MSG_BLOCKS_ERASE        12
+#define MSG_BLOCKS_ERASE_RESULT 13
+
+// Most blocks a single MSG_BLOCKS_READ or MSG_BLOCKS_WRITE range may cover,
+// longer transfers are split into several ranges by the sender.
+#define MSG_BLOCKS_MAX          8
+
+// Blocks carried by one MSG_BLOCKS_DATA chunk, bounded by the largest
+// message the intercore ring buffer takes (1040 bytes).
+#define MSG_BLOCKS_PER_CHUNK    2
 
 
 /// <summary>
@@ -37,3 +54,38 @@ struct SD_CMD_WITH_DATA {
     uint8_t     blockData[512];     // block data to write or read.
 };
 
+/// <summary>
+/// Use for range requests (start block plus count).
+/// A read is answered with the range's data as MSG_BLOCKS_DATA chunks, in block
+/// order, then a single MSG_BLOCKS_READ_RESULT SD_CMD. A write is followed by
+/// the range's data as MSG_BLOCKS_DATA chunks and answered with a single
+/// MSG_BLOCKS_WRITE_RESULT SD_CMD once all of it has been written. On error
+/// the result carries the first failed block and no further chunks are sent.
+/// </summary>
+struct SD_CMD_BLOCKS {
+    uint8_t     id;                 // Message Type (BLOCKS_WRITE or BLOCKS_READ)
+    uint32_t    blockNumber;        // first block number on card to read or write
+    uint32_t    blockCount;         // number of blocks, 1 to MSG_BLOCKS_MAX
+};
+
+/// <summary>
+/// Use for geometry results, a geometry request is a bare SD_CMD.
+/// An erase range is a SD_CMD_BLOCKS, answered with a MSG_BLOCKS_ERASE_RESULT SD_CMD.
+/// </summary>
+struct SD_GEOMETRY {
+    uint8_t     id;                 // Message Type (GEOMETRY_RESULT)
+    uint32_t    blockSize;          // bytes per block, the unit of all block numbers
+    uint32_t    blockCount;         // card capacity in blocks, read from the CSD
+    uint32_t    eraseBlocks;        // erase granularity in blocks
+    int         result;             // 0 on success, the other fields are only valid then
+};
+
+/// <summary>
+/// Use for the data of range requests
+/// </summary>
+struct SD_CMD_BLOCKS_DATA {
+    uint8_t     id;                 // Message Type (BLOCKS_DATA)
+    uint32_t    blockNumber;        // block number on card of the first block in the chunk
+    uint32_t    blockCount;         // number of blocks in the chunk, 1 to MSG_BLOCKS_PER_CHUNK
+    uint8_t     blockData[MSG_BLOCKS_PER_CHUNK * 512];
+};
@@ -1,5 +1,6 @@
 ﻿using Microsoft.Win32.SafeHandles;
 using System;
+using System.Diagnostics;
 using System.IO;
 using System.Runtime.InteropServices;
 
@@ -43,6 +44,13 @@ namespace ReadRawSDCard
           uint dwShareMode, IntPtr lpSecurityAttributes, uint dwCreationDisposition,
           uint dwFlagsAndAttributes, IntPtr hTemplateFile);
 
+        // Blocks read per ReadFile call. Raw device reads must be whole sectors, and large sequential
+        // reads are what an SD card reader is fast at - one 512 byte read at a time runs at a fraction
+        // of the card's speed.
+        const int BlocksPerRead = 8192;     // 4MB
+
+        const uint FILE_FLAG_SEQUENTIAL_SCAN = 0x08000000;
+
         [DllImport("kernel32", SetLastError = true)]
         internal extern static int ReadFile(SafeFileHandle handle, byte[] bytes,
            int numBytesToRead, out int numBytesRead, IntPtr overlapped_MustBeZero);
@@ -58,7 +66,7 @@ namespace ReadRawSDCard
             uint GENERIC_READ = 0x80000000;
             uint OPEN_EXISTING = 3;
 
-            SafeFileHandle handleValue = CreateFile(physicalDrive, GENERIC_READ, 0, IntPtr.Zero, OPEN_EXISTING, 0, IntPtr.Zero);
+            SafeFileHandle handleValue = CreateFile(physicalDrive, GENERIC_READ, 0, IntPtr.Zero, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, IntPtr.Zero);
             if (handleValue.IsInvalid)
             {
                 Console.WriteLine($"Failed to open '{physicalDrive}' - try running as administrator");
@@ -66,19 +74,45 @@ namespace ReadRawSDCard
             }
 
             Console.WriteLine($"Opening output file '{outFile}'");
-            FileStream myStream = File.OpenWrite(outFile);
-            // allocate 'block size' for reading.
-            byte[] buf = new byte[512];
+            FileStream myStream = new FileStream(outFile, FileMode.Create, FileAccess.Write, FileShare.None, BlocksPerRead * 512);
+            byte[] buf = new byte[BlocksPerRead * 512];
             int moveToHigh = 0;
             int bytesRead = 0;
 
-            for(UInt32 x=0; x < numberOfBlocks;x++)
+            // Read the device sequentially from the start, the file pointer moves on with each read.
+            SetFilePointer(handleValue, 0, out moveToHigh, EMoveMethod.Begin);
+
+            Stopwatch total = Stopwatch.StartNew();
+            Stopwatch reading = new Stopwatch();
+            Stopwatch writing = new Stopwatch();
+            long lastReport = 0;
+
+            UInt32 blocksDone = 0;
+            while (blocksDone < numberOfBlocks)
             {
-                Console.Write($"Block {x} of {numberOfBlocks}\r");
-                int offset = Convert.ToInt32(x) * 512;
-                SetFilePointer(handleValue, offset, out moveToHigh, EMoveMethod.Begin);
-                ReadFile(handleValue, buf, 512, out bytesRead, IntPtr.Zero);
-                myStream.Write(buf, 0, 512);
+                int blocks = (int)Math.Min((UInt32)BlocksPerRead, numberOfBlocks - blocksDone);
+
+                reading.Start();
+                int ok = ReadFile(handleValue, buf, blocks * 512, out bytesRead, IntPtr.Zero);
+                reading.Stop();
+                if (ok == 0 || bytesRead == 0)
+                {
+                    Console.WriteLine();
+                    Console.WriteLine($"Read failed at block {blocksDone} (error {Marshal.GetLastWin32Error()})");
+                    break;
+                }
+
+                writing.Start();
+                myStream.Write(buf, 0, bytesRead);
+                writing.Stop();
+
+                blocksDone += (UInt32)(bytesRead / 512);
+
+                if (total.ElapsedMilliseconds - lastReport >= 1000 || blocksDone >= numberOfBlocks)
+                {
+                    lastReport = total.ElapsedMilliseconds;
+                    ReportProgress(blocksDone, numberOfBlocks, total, reading, writing);
+                }
             }
 
             Console.WriteLine();
@@ -87,5 +121,13 @@ namespace ReadRawSDCard
             myStream.Close();
             handleValue.Close();
         }
+
+        static void ReportProgress(UInt32 blocksDone, UInt32 numberOfBlocks, Stopwatch total, Stopwatch reading, Stopwatch writing)
+        {
+            double megabytes = blocksDone * 512.0 / (1024 * 1024);
+            double seconds = Math.Max(total.Elapsed.TotalSeconds, 0.001);
+            Console.Write($"Block {blocksDone} of {numberOfBlocks} - {megabytes:F1} MB, {megabytes / seconds:F1} MB/s " +
+                $"(card read {reading.Elapsed.TotalSeconds:F1}s, image write {writing.Elapsed.TotalSeconds:F1}s)\r");
+        }
     }
 }
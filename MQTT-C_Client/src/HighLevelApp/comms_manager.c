@@ -2,6 +2,7 @@
    Licensed under the MIT License. */
 
 #include "comms_manager.h"
+#include "spill_queue.h"
 
 /* Maximum size for network read/write callbacks. There is also a v5 define that
    describes the max MQTT control packet size, DEFAULT_MAX_PKT_SZ. */
@@ -9,14 +10,30 @@
 #define SEND_BUFFER_SIZE 512
 #define RECEIVE_BUFFER_SIZE 512
 #define BILLION 1000000000
+/* How long queued messages wait for more to join them, before being flushed in one go. */
+#define PUBLISH_FLUSH_DELAY_MS 10
+/* QoS 1 messages published and not acknowledged yet, more wait in the spill queue.
+   Can be set in CMakeLists.txt, along with the spill queue's size in mutable storage. */
+#ifndef MQTT_QOS1_INFLIGHT_WINDOW
+#define MQTT_QOS1_INFLIGHT_WINDOW 8
+#endif
+#ifndef MQTT_SPILL_QUEUE_SIZE
+#define MQTT_SPILL_QUEUE_SIZE (60 * 1024)
+#endif
+#define MAX_TOPIC_SIZE 128
+/* Reconnects wait a random time between half and all of the backoff, which doubles on each failure */
+#define RECONNECT_BACKOFF_MIN_MS 1000
+#define RECONNECT_BACKOFF_MAX_MS 64000
 
 static void mqtt_ping_handler(EventLoopTimer* eventLoopTimer);
 static void mqtt_reconnect_handler(EventLoopTimer* eventLoopTimer);
+static void mqtt_flush_handler(EventLoopTimer* eventLoopTimer);
 static void mqtt_set_subscriptions(void);
 static void reconnect_client(struct mqtt_client* client, void** reconnect_state_vptr);
 
 static WOLFSSL_CTX* ctx = NULL;
 static WOLFSSL* ssl = NULL;
+static WOLFSSL_SESSION* tls_session = NULL;
 static bool wolfSslInitialized = false;
 struct mqtt_client client;
 int sockfd = -1;
@@ -24,6 +41,14 @@ int sockfd = -1;
 EventRegistration* mqtt_socket_registration = NULL;
 
 static bool mqtt_connected = false;
+static bool mqtt_flush_pending = false;
+static bool mqtt_reinitialized = false;
+static mqtt_publish_stats publish_stats;
+static uint32_t reconnect_backoff_ms = RECONNECT_BACKOFF_MIN_MS;
+static bool reconnect_scheduled = false;
+/* Time to first publish after a link drop, from the first reconnect attempt */
+static bool link_dropped = false;
+static struct timespec link_drop_time;
 static void (*_mqtt_connected_cb)(void);
 const char** _sub_topics = NULL;
 size_t _sub_topic_count = 0;
@@ -46,11 +71,31 @@ uint8_t recvbuf[RECEIVE_BUFFER_SIZE];
 // When .period is {0,0} then the timer is a oneshot timer
 DX_TIMER_BINDING mqtt_reconnect_timer = { .period = {0, 0}, .name = "mqtt_reconnect_timer", .handler = mqtt_reconnect_handler };
 DX_TIMER_BINDING mqtt_ping_timer = { .period = {30, 0}, .name = "mqtt_ping_timer", .handler = mqtt_ping_handler };
+DX_TIMER_BINDING mqtt_flush_timer = { .period = {0, 0}, .name = "mqtt_flush_timer", .handler = mqtt_flush_handler };
 
 bool is_mqtt_connected(void) {
 	return mqtt_connected;
 }
 
+static long elapsed_ms(const struct timespec* since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long)(now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/// <summary>
+/// Retries the connection after the backoff, with jitter so devices dropped together don't reconnect together
+/// </summary>
+static void schedule_reconnect(void) {
+	uint32_t delay_ms = reconnect_backoff_ms / 2 + (uint32_t)rand() % (reconnect_backoff_ms / 2 + 1);
+
+	reconnect_scheduled = true;
+	dx_timerOneShotSet(&mqtt_reconnect_timer, &(struct timespec) { delay_ms / 1000, (long)(delay_ms % 1000) * 1000000 });
+	Log_Debug("Reconnecting in %u ms\n", delay_ms);
+
+	reconnect_backoff_ms = (reconnect_backoff_ms * 2 < RECONNECT_BACKOFF_MAX_MS) ? reconnect_backoff_ms * 2 : RECONNECT_BACKOFF_MAX_MS;
+}
+
 static void mqtt_ping_handler(EventLoopTimer* eventLoopTimer){
 	if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0) {
 		dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
@@ -61,16 +106,194 @@ static void mqtt_ping_handler(EventLoopTimer* eventLoopTimer){
 	}
 }
 
-void publish_message(const void* data, size_t data_length, const char* topic) {
-	if (strlen(topic) == 0 || !dx_isNetworkReady()) { return; }
+/// <summary>
+/// Bytes a PUBLISH takes in the send buffer: the packet (up to 5 bytes of fixed header,
+/// the length-prefixed topic, the packet id above QoS 0 and the payload) and its queue entry
+/// </summary>
+static size_t publish_packet_size(size_t topic_length, size_t data_length, uint8_t qos) {
+	return 5 + 2 + topic_length + (qos == MQTT_PUBLISH_QOS_0 ? 0 : 2) + data_length + sizeof(struct mqtt_queued_message);
+}
+
+static void schedule_flush(void) {
+	if (!mqtt_flush_pending) {
+		mqtt_flush_pending = true;
+		dx_timerOneShotSet(&mqtt_flush_timer, &(struct timespec) { 0, PUBLISH_FLUSH_DELAY_MS * (BILLION / 1000) });
+	}
+}
 
-	mqtt_mq_clean(&client.mq);
+static bool queue_publish(const void* data, size_t data_length, const char* topic, size_t topic_length, uint8_t qos) {
+	/* A PUBLISH that doesn't fit would put the client in MQTT_ERROR_SEND_BUFFER_IS_FULL */
+	if (client.mq.curr_sz < publish_packet_size(topic_length, data_length, qos)) {
+		mqtt_mq_clean(&client.mq);
+		if (client.mq.curr_sz < publish_packet_size(topic_length, data_length, qos)) {
+			return false;
+		}
+	}
 
-	if (client.mq.curr_sz >= data_length) {
-		mqtt_publish(&client, topic, data, data_length, MQTT_PUBLISH_QOS_0);
+	if (mqtt_publish(&client, topic, data, data_length, qos) != MQTT_OK) {
+		return false;
 	}
 
+	schedule_flush();
+	return true;
+}
+
+bool queue_message(const void* data, size_t data_length, const char* topic) {
+	size_t topic_length = strlen(topic);
+	if (topic_length == 0 || !dx_isNetworkReady()) { return false; }
+
+	return queue_publish(data, data_length, topic, topic_length, MQTT_PUBLISH_QOS_0);
+}
+
+/// <summary>
+/// QoS 1 PUBLISH packets in the send buffer which haven't been acknowledged yet
+/// </summary>
+static uint32_t count_inflight(void) {
+	uint32_t inflight = 0;
+
+	if (!mqtt_reinitialized) {
+		return 0;
+	}
+	for (ssize_t i = 0; i < mqtt_mq_length(&client.mq); i++) {
+		struct mqtt_queued_message* msg = mqtt_mq_get(&client.mq, i);
+		if (msg->control_type == MQTT_CONTROL_PUBLISH && msg->state != MQTT_QUEUED_COMPLETE &&
+			((msg->start[0] >> 1) & 0x03) == 1) {
+			inflight++;
+		}
+	}
+	return inflight;
+}
+
+/// <summary>
+/// Publishes the messages waiting in the spill queue, oldest first, while the window and the send buffer allow
+/// </summary>
+static void drain_spill_queue(void) {
+	size_t topic_length, data_length;
+	char topic[MAX_TOPIC_SIZE];
+	uint8_t data[SEND_BUFFER_SIZE];
+
+	if (!mqtt_connected) {
+		return;
+	}
+
+	uint32_t inflight = count_inflight();
+	while (inflight < MQTT_QOS1_INFLIGHT_WINDOW && spill_queue_front(&topic_length, &data_length)) {
+		if (topic_length >= sizeof(topic) || data_length > sizeof(data)) {
+			Log_Debug("ERROR: dropping a spilled message too large to publish\n");
+			spill_queue_pop();
+			publish_stats.dropped++;
+			continue;
+		}
+		if (!spill_queue_read_front(topic, data) ||
+			!queue_publish(data, data_length, topic, topic_length, MQTT_PUBLISH_QOS_1)) {
+			break;
+		}
+		spill_queue_pop();
+		publish_stats.published++;
+		inflight++;
+	}
+}
+
+bool queue_message_qos1(const void* data, size_t data_length, const char* topic) {
+	size_t topic_length = strlen(topic);
+	if (topic_length == 0 || topic_length >= MAX_TOPIC_SIZE) { return false; }
+
+	/* Behind older spilled messages, or beyond the window, the message waits its turn in storage */
+	if (mqtt_connected && spill_queue_bytes() == 0 && count_inflight() < MQTT_QOS1_INFLIGHT_WINDOW &&
+		queue_publish(data, data_length, topic, topic_length, MQTT_PUBLISH_QOS_1)) {
+		publish_stats.published++;
+		return true;
+	}
+
+	if (!spill_queue_push(topic, topic_length, data, data_length)) {
+		publish_stats.dropped++;
+		return false;
+	}
+	publish_stats.spilled++;
+	return true;
+}
+
+/// <summary>
+/// Spills the unacknowledged QoS 1 messages of the send buffer, which a reconnect discards,
+/// so that they are published again once connected (after the messages already spilled)
+/// </summary>
+static void spill_unacknowledged(void) {
+	if (!mqtt_reinitialized) {
+		return;
+	}
+
+	for (ssize_t i = 0; i < mqtt_mq_length(&client.mq); i++) {
+		struct mqtt_queued_message* msg = mqtt_mq_get(&client.mq, i);
+		const uint8_t* packet = msg->start;
+		if (msg->control_type != MQTT_CONTROL_PUBLISH || msg->state == MQTT_QUEUED_COMPLETE ||
+			((packet[0] >> 1) & 0x03) != 1) {
+			continue;
+		}
+
+		/* Fixed header with its variable length remaining length, topic, packet id, payload */
+		size_t offset = 1;
+		while (offset < 5 && (packet[offset] & 0x80)) {
+			offset++;
+		}
+		offset++;
+		size_t topic_length = ((size_t)packet[offset] << 8) | packet[offset + 1];
+		const char* topic = (const char*)&packet[offset + 2];
+		offset += 2 + topic_length + 2;
+		if (offset > msg->size) {
+			continue;
+		}
+
+		if (spill_queue_push(topic, topic_length, packet + offset, msg->size - offset)) {
+			publish_stats.requeued++;
+		} else {
+			publish_stats.dropped++;
+		}
+	}
+}
+
+void get_publish_stats(mqtt_publish_stats* stats) {
+	*stats = publish_stats;
+	stats->inflight = count_inflight();
+	/* Each message published is acknowledged, still in flight or was requeued by a reconnect */
+	stats->acked = publish_stats.published - publish_stats.requeued - stats->inflight;
+	stats->spill_bytes = (uint32_t)spill_queue_bytes();
+}
+
+void flush_messages(void) {
+	mqtt_flush_pending = false;
+
+	/* MQTT-C writes each queued packet on its own, corking the socket lets
+	   the kernel send them in full segments rather than one per packet */
+	int cork = 1;
+	bool corked = sockfd != -1 && setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork)) == 0;
+
 	mqtt_sync(&client);
+
+	if (corked && sockfd != -1) {
+		cork = 0;
+		setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+	}
+
+	if (link_dropped && mqtt_connected && client.error == MQTT_OK) {
+		link_dropped = false;
+		Log_Debug("Time to first publish after the link drop: %ld ms\n", elapsed_ms(&link_drop_time));
+	}
+}
+
+void publish_message(const void* data, size_t data_length, const char* topic) {
+	if (queue_message(data, data_length, topic)) {
+		flush_messages();
+	}
+}
+
+static void mqtt_flush_handler(EventLoopTimer* eventLoopTimer) {
+	if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0) {
+		dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
+		return;
+	}
+	if (mqtt_flush_pending) {
+		flush_messages();
+	}
 }
 
 /// <summary>
@@ -82,6 +305,7 @@ static void mqtt_reconnect_handler(EventLoopTimer* eventLoopTimer) {
 		return;
 	}
 
+	reconnect_scheduled = false;
 	reconnect_client(&client, &client.reconnect_state);
 	return;
 
@@ -94,6 +318,9 @@ static void mqtt_reconnect_handler(EventLoopTimer* eventLoopTimer) {
 
 static void msg_handler(EventLoop* el, int fd, EventLoop_IoEvents events, void* context) {
 	mqtt_sync(&client);
+
+	/* PUBACKs free the window for spilled messages */
+	drain_spill_queue();
 }
 
 static char* get_absolute_storage_path(const char* file, const char* name) {
@@ -104,65 +331,16 @@ static char* get_absolute_storage_path(const char* file, const char* name) {
 	return abs_path;
 }
 
-static WOLFSSL* open_nb_socket(const char* addr, const char* port) {
-	int ret, rv;
+/// <summary>
+/// Creates the wolfSSL context and loads the certificates, once: the context is kept across
+/// reconnects, along with its session cache, so that they can resume the TLS session
+/// </summary>
+static bool init_tls_context(void) {
+	int ret;
 	char* abs_path = NULL;
-	struct addrinfo hints = { 0 };
 
-	hints.ai_family = AF_UNSPEC; /* IPv4 or IPv6 */
-	hints.ai_socktype = SOCK_STREAM; /* Must be TCP */
-
-
-	struct addrinfo* p, * servinfo;
-
-	if (ssl != NULL) {
-		wolfSSL_free(ssl);
-		ssl = NULL;
-	}
 	if (ctx != NULL) {
-		wolfSSL_CTX_free(ctx);
-		ctx = NULL;
-	}
-	if (wolfSslInitialized) {
-		wolfSSL_Cleanup();
-		wolfSslInitialized = false;
-	}
-	if (mqtt_socket_registration != NULL) {
-		EventLoop_UnregisterIo(dx_timerGetEventLoop(), mqtt_socket_registration);
-	}
-	if (sockfd != -1) {
-
-		close(sockfd);
-		sockfd = -1;
-	}
-
-	/* get address information */
-	rv = getaddrinfo(addr, port, &hints, &servinfo);
-	if (rv != 0) {
-		Log_Debug("Failed to open socket (getaddrinfo): %s\n", gai_strerror(rv));
-		goto cleanupLabel;
-	}
-
-	/* open the first possible socket */
-	for (p = servinfo; p != NULL; p = p->ai_next) {
-		sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-		if (sockfd == -1) continue;
-
-		/* connect to server */
-		rv = connect(sockfd, p->ai_addr, p->ai_addrlen);
-		if (rv == -1) {
-			close(sockfd);
-			sockfd = -1;
-			continue;
-		}
-		break;
-	}
-
-	/* free servinfo */
-	freeaddrinfo(servinfo);
-
-	if (sockfd == -1) {
-		goto cleanupLabel;
+		return true;
 	}
 
 	/* Initialize wolfSSL */
@@ -227,20 +405,118 @@ static WOLFSSL* open_nb_socket(const char* addr, const char* port) {
 	free(abs_path);
 	abs_path = NULL;
 
+	return true;
+
+cleanupLabel:
+	if (ctx != NULL) {
+		wolfSSL_CTX_free(ctx);
+		ctx = NULL;
+	}
+	if (wolfSslInitialized) {
+		wolfSSL_Cleanup();
+		wolfSslInitialized = false;
+	}
+
+	return false;
+}
+
+/// <summary>
+/// Closes the connection, keeping its TLS session to resume it on the next one
+/// </summary>
+static void close_socket(void) {
+	if (ssl != NULL) {
+		if (wolfSSL_is_init_finished(ssl)) {
+			if (tls_session != NULL) {
+				wolfSSL_SESSION_free(tls_session);
+			}
+			tls_session = wolfSSL_get1_session(ssl);
+		}
+		wolfSSL_free(ssl);
+		ssl = NULL;
+	}
+	if (mqtt_socket_registration != NULL) {
+		EventLoop_UnregisterIo(dx_timerGetEventLoop(), mqtt_socket_registration);
+		mqtt_socket_registration = NULL;
+	}
+	if (sockfd != -1) {
+		close(sockfd);
+		sockfd = -1;
+	}
+}
+
+static WOLFSSL* open_nb_socket(const char* addr, const char* port) {
+	int rv;
+	struct addrinfo hints = { 0 };
+
+	hints.ai_family = AF_UNSPEC; /* IPv4 or IPv6 */
+	hints.ai_socktype = SOCK_STREAM; /* Must be TCP */
+
+
+	struct addrinfo* p, * servinfo;
+
+	close_socket();
+
+	/* get address information */
+	rv = getaddrinfo(addr, port, &hints, &servinfo);
+	if (rv != 0) {
+		Log_Debug("Failed to open socket (getaddrinfo): %s\n", gai_strerror(rv));
+		goto cleanupLabel;
+	}
+
+	/* open the first possible socket */
+	for (p = servinfo; p != NULL; p = p->ai_next) {
+		sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+		if (sockfd == -1) continue;
+
+		/* connect to server */
+		rv = connect(sockfd, p->ai_addr, p->ai_addrlen);
+		if (rv == -1) {
+			close(sockfd);
+			sockfd = -1;
+			continue;
+		}
+		break;
+	}
+
+	/* free servinfo */
+	freeaddrinfo(servinfo);
+
+	if (sockfd == -1) {
+		goto cleanupLabel;
+	}
+
+	if (!init_tls_context()) {
+		goto cleanupLabel;
+	}
+
 	ssl = wolfSSL_new(ctx);
 	if (ssl == NULL) {
 		goto cleanupLabel;
 	}
 
 	// Associate socket with wolfSSL session.
-	r = wolfSSL_set_fd(ssl, sockfd);
+	int r = wolfSSL_set_fd(ssl, sockfd);
 	if (r != WOLFSSL_SUCCESS) {
 		Log_Debug("ERROR: wolfSSL_set_fd %d\n", r);
 		goto cleanupLabel;
 	}
 
-	if (wolfSSL_connect(ssl) != WOLFSSL_SUCCESS) {
-		Log_Debug("ERROR: wolfSSL_connect, reason = %d\n", wolfSSL_get_error(ssl, ret));
+	/* Offer the previous session, the broker skips the certificate exchange if it still has it */
+#ifdef HAVE_SESSION_TICKET
+	wolfSSL_UseSessionTicket(ssl);
+#endif
+	if (tls_session != NULL && wolfSSL_set_session(ssl, tls_session) != WOLFSSL_SUCCESS) {
+		Log_Debug("WARNING: unable to offer the previous TLS session\n");
+	}
+
+	if ((r = wolfSSL_connect(ssl)) != WOLFSSL_SUCCESS) {
+		Log_Debug("ERROR: wolfSSL_connect, reason = %d\n", wolfSSL_get_error(ssl, r));
+
+		/* The broker may have rejected the session, start afresh next time */
+		if (tls_session != NULL) {
+			wolfSSL_SESSION_free(tls_session);
+			tls_session = NULL;
+		}
 		goto cleanupLabel;
 	}
 
@@ -256,14 +532,6 @@ cleanupLabel:
 		wolfSSL_free(ssl);
 		ssl = NULL;
 	}
-	if (ctx != NULL) {
-		wolfSSL_CTX_free(ctx);
-		ctx = NULL;
-	}
-	if (wolfSslInitialized) {
-		wolfSSL_Cleanup();
-		wolfSslInitialized = false;
-	}
 	if (sockfd != -1) {
 		close(sockfd);
 		sockfd = -1;
@@ -281,26 +549,43 @@ static void reconnect_client(struct mqtt_client* client, void** reconnect_state_
 		return;
 	}
 
+	/* MQTT-C calls back on every sync while in error, wait for the backoff instead */
+	if (reconnect_scheduled) {
+		return;
+	}
+
 	/* Perform error handling here. */
 	if (client->error != MQTT_ERROR_INITIAL_RECONNECT) {
 		Log_Debug("reconnect_client: called while client was in error state \"%s\"\n",
 			mqtt_error_str(client->error)
 		);
+		if (!link_dropped) {
+			link_dropped = true;
+			clock_gettime(CLOCK_MONOTONIC, &link_drop_time);
+		}
 	}
 
 	/* Open a new socket. */
+	struct timespec connect_time;
+	clock_gettime(CLOCK_MONOTONIC, &connect_time);
 	WOLFSSL* ssl = open_nb_socket(reconnect_state->hostname, reconnect_state->port);
 	if (ssl == NULL) {
-		dx_timerOneShotSet(&mqtt_reconnect_timer, &(struct timespec) { 2, 0 });
 		Log_Debug("Failed to open socket: ");
+		schedule_reconnect();
 		return;
 	}
+	Log_Debug("TLS connected in %ld ms, session %s\n", elapsed_ms(&connect_time),
+		wolfSSL_session_reused(ssl) ? "resumed" : "negotiated");
+
+	/* The clean session drops the unacknowledged messages, keep them to publish again */
+	spill_unacknowledged();
 
 	/* Reinitialize the client. */
 	mqtt_reinit(client, ssl,
 		reconnect_state->sendbuf, reconnect_state->sendbufsz,
 		reconnect_state->recvbuf, reconnect_state->recvbufsz
 	);
+	mqtt_reinitialized = true;
 
 	/* Create an anonymous session */
 	const char* client_id = NULL;
@@ -322,7 +607,10 @@ static void mqtt_set_subscriptions(void) {
 		}
 
 		mqtt_connected = true;
+		reconnect_backoff_ms = RECONNECT_BACKOFF_MIN_MS;
 		_mqtt_connected_cb();
+
+		drain_spill_queue();
 	}
 }
 
@@ -344,10 +632,18 @@ void initialize_mqtt(void (*publish_callback)(void** unused, struct mqtt_respons
 	reconnect_state.recvbuf = recvbuf;
 	reconnect_state.recvbufsz = sizeof(recvbuf);
 
+	spill_queue_init(MQTT_SPILL_QUEUE_SIZE);
+
+	/* Seeds the reconnect jitter, differently on each device */
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	srand((unsigned)(now.tv_nsec ^ now.tv_sec));
+
 	mqtt_init_reconnect(&client, reconnect_client, &reconnect_state, publish_callback);
 
 	dx_timerStart(&mqtt_reconnect_timer);
 	dx_timerStart(&mqtt_ping_timer);
+	dx_timerStart(&mqtt_flush_timer);
 
 	reconnect_client(&client, &client.reconnect_state);
 }
\ No newline at end of file
@@ -13,11 +13,34 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdbool.h>
 #include <sys/select.h>
+#include <time.h>
 #include <wolfssl/ssl.h>
 
+typedef struct {
+	uint32_t published;		// QoS 1 messages handed to MQTT-C
+	uint32_t acked;			// of those, acknowledged by the broker
+	uint32_t inflight;		// of those, waiting for their PUBACK
+	uint32_t requeued;		// of those, spilled again as a reconnect dropped them unacknowledged
+	uint32_t spilled;		// QoS 1 messages which waited in the spill queue
+	uint32_t dropped;		// QoS 1 messages lost as the spill queue was full
+	uint32_t spill_bytes;	// bytes waiting in the spill queue, the backpressure
+} mqtt_publish_stats;
+
 void initialize_mqtt(void (*publish_callback)(void** unused, struct mqtt_response_publish* published), void (*mqtt_connected_cb)(void),
 	const char** sub_topics, size_t sub_topic_count);
+// Publishes a message at QoS 0 and flushes it, with any other queued message, right away
 void publish_message(const void* data, size_t data_length, const char* topic);
+// Queues a message at QoS 0 in the send buffer without flushing it, returns false if it doesn't fit.
+// Queued messages are flushed together by flush_messages(), or from the event loop shortly after the first one
+bool queue_message(const void* data, size_t data_length, const char* topic);
+void flush_messages(void);
+// Publishes a message at QoS 1, with up to MQTT_QOS1_INFLIGHT_WINDOW messages waiting for their PUBACK.
+// Messages beyond the window, or which don't fit in the send buffer, wait in a spill queue in mutable storage
+// and are published as PUBACKs come in. Returns false if the message was dropped as the spill queue is full
+bool queue_message_qos1(const void* data, size_t data_length, const char* topic);
+void get_publish_stats(mqtt_publish_stats* stats);
 bool is_mqtt_connected(void);
@@ -9,8 +9,11 @@
 #include "mqtt.h"
 #include "string.h"
 #include <applibs/log.h>
+#include <stdio.h>
+#include <time.h>
 
 static void publish_message_timer_handler(EventLoopTimer *eventLoopTimer);
+static void bench_timer_handler(EventLoopTimer *eventLoopTimer);
 
 typedef struct {
     char message[128];
@@ -19,6 +22,10 @@ typedef struct {
 
 MQTT_MESSAGE mqtt_msg;
 
+// Log the publish statistics every minute
+#define STATS_LOG_PERIOD 60
+static unsigned publish_count = 0;
+
 const char *sub_topics[] = {"azuresphere/sample/device"};
 const char *pub_topic = "azuresphere/sample/host";
 
@@ -27,22 +34,141 @@ static DX_TIMER_BINDING publish_message_timer = {
     .period = {1, 0}, .name = "publish_message_timer", .handler = publish_message_timer_handler};
 static DX_TIMER_BINDING *timerSet[] = {&publish_message_timer};
 
+// Benchmark mode, driven by PyMqttHost.py --bench: "BENCH <rate> <size> <count> <qos>" on the device topic
+// makes the device publish count messages of size bytes at rate per second, each one
+// "B,<seq>,<epoch ms>," padded with 'x', and "STOP" ends it early. The echo is paused meanwhile.
+#define BENCH_TICK_MS 10
+#define BENCH_MAX_PAYLOAD 384
+static DX_TIMER_BINDING bench_timer = {
+    .period = {0, BENCH_TICK_MS * 1000000}, .name = "bench_timer", .handler = bench_timer_handler};
+
+static struct {
+    bool running;
+    unsigned rate;
+    size_t size;
+    uint32_t count;
+    int qos;
+    uint32_t sent;
+    struct timespec start;
+} bench;
+
 static void publish_message_timer_handler(EventLoopTimer *eventLoopTimer)
 {
     if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0) {
         dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
         return;
     }
-    if (is_mqtt_connected()) {
-        publish_message(mqtt_msg.message, mqtt_msg.message_length, pub_topic);
+    if (bench.running) {
+        return;
+    }
+
+    // QoS 1 messages queued while disconnected wait in the spill queue
+    queue_message_qos1(mqtt_msg.message, mqtt_msg.message_length, pub_topic);
+
+    if (++publish_count % STATS_LOG_PERIOD == 0) {
+        mqtt_publish_stats stats;
+        get_publish_stats(&stats);
+        Log_Debug("Published %u, acked %u, in flight %u, requeued %u, spilled %u, dropped %u, %u bytes spilled\n",
+                  stats.published, stats.acked, stats.inflight, stats.requeued, stats.spilled,
+                  stats.dropped, stats.spill_bytes);
+    }
+}
+
+static void bench_stop(void)
+{
+    if (bench.running) {
+        bench.running = false;
+        dx_timerStop(&bench_timer);
+        Log_Debug("Benchmark done, %u messages sent\n", bench.sent);
     }
 }
 
+static void bench_timer_handler(EventLoopTimer *eventLoopTimer)
+{
+    char payload[BENCH_MAX_PAYLOAD];
+    struct timespec now;
+
+    if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0) {
+        dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
+        return;
+    }
+
+    // Catch up with the messages due by now, so the rate doesn't depend on the tick
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t elapsed_ms = (int64_t)(now.tv_sec - bench.start.tv_sec) * 1000 +
+                         (now.tv_nsec - bench.start.tv_nsec) / 1000000;
+    uint64_t due = (uint64_t)elapsed_ms * bench.rate / 1000 + 1;
+
+    while (bench.sent < bench.count && bench.sent < due) {
+        struct timespec wall;
+        clock_gettime(CLOCK_REALTIME, &wall);
+        int length = snprintf(payload, sizeof(payload), "B,%u,%llu,", bench.sent,
+                              (unsigned long long)wall.tv_sec * 1000 + (unsigned long long)(wall.tv_nsec / 1000000));
+        size_t size = bench.size > (size_t)length ? bench.size : (size_t)length;
+        memset(payload + length, 'x', size - (size_t)length);
+
+        // A full send buffer at QoS 0 is counted as loss by the host
+        if (bench.qos == 1) {
+            queue_message_qos1(payload, size, pub_topic);
+        } else {
+            queue_message(payload, size, pub_topic);
+        }
+        bench.sent++;
+    }
+
+    if (bench.sent >= bench.count) {
+        bench_stop();
+    }
+}
+
+// Returns true if the message was a benchmark command
+static bool bench_command(const char *message, size_t length)
+{
+    char command[64];
+    unsigned rate, size, count;
+    int qos;
+
+    if (length >= sizeof(command)) {
+        return false;
+    }
+    memcpy(command, message, length);
+    command[length] = '\0';
+
+    if (strcmp(command, "STOP") == 0) {
+        bench_stop();
+        return true;
+    }
+    if (sscanf(command, "BENCH %u %u %u %d", &rate, &size, &count, &qos) != 4) {
+        return false;
+    }
+
+    bench_stop();
+    if (rate == 0 || count == 0 || size > BENCH_MAX_PAYLOAD || (qos != 0 && qos != 1)) {
+        Log_Debug("ERROR: invalid benchmark %s\n", command);
+        return true;
+    }
+
+    bench.rate = rate;
+    bench.size = size;
+    bench.count = count;
+    bench.qos = qos;
+    bench.sent = 0;
+    clock_gettime(CLOCK_MONOTONIC, &bench.start);
+    bench.running = true;
+    dx_timerStart(&bench_timer);
+    Log_Debug("Benchmark: %u messages of %u bytes at %u/s, QoS %d\n", count, size, rate, qos);
+    return true;
+}
+
 // this function is called when the device receives a new message from the MQTT Broker
 static void publish_callback(void **unused, struct mqtt_response_publish *published)
 {
     char *message;
 
+    if (bench_command(published->application_message, published->application_message_size)) {
+        return;
+    }
+
     if (published->application_message_size <= sizeof(mqtt_msg.message)) {
 
         memcpy(mqtt_msg.message, published->application_message,
@@ -85,6 +211,7 @@ static void InitPeripheralsAndHandlers(void)
 /// </summary>
 static void ClosePeripheralsAndHandlers(void)
 {
+    bench_stop();
     dx_timerSetStop(timerSet, NELEMS(timerSet));
     dx_timerEventLoopStop();
 }
@@ -0,0 +1,143 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "spill_queue.h"
+#include <applibs/log.h>
+#include <applibs/storage.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SPILL_QUEUE_MAGIC 0x4c505351 /* "QSPL" */
+
+/* The file starts with this header, followed by the records from read_offset to write_offset */
+struct spill_header_t {
+	uint32_t magic;
+	uint32_t read_offset;
+	uint32_t write_offset;
+};
+
+struct spill_record_t {
+	uint16_t topic_length;
+	uint16_t data_length;
+}; /* followed by the topic, without terminator, and the data */
+
+static int spill_fd = -1;
+static size_t spill_max_bytes = 0;
+static struct spill_header_t header;
+
+static bool write_header(void) {
+	if (pwrite(spill_fd, &header, sizeof(header), 0) != sizeof(header)) {
+		Log_Debug("ERROR: spill queue header write failed: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+/* Empties the queue, and the file with it */
+static void reset(void) {
+	header = (struct spill_header_t){ .magic = SPILL_QUEUE_MAGIC, .read_offset = sizeof(header), .write_offset = sizeof(header) };
+	ftruncate(spill_fd, 0);
+	write_header();
+}
+
+bool spill_queue_init(size_t max_bytes) {
+	spill_fd = Storage_OpenMutableFile();
+	if (spill_fd == -1) {
+		Log_Debug("ERROR: unable to open the spill queue: %s\n", strerror(errno));
+		return false;
+	}
+	spill_max_bytes = max_bytes;
+
+	/* Keep the messages queued before a restart, if the header is sane */
+	off_t size = lseek(spill_fd, 0, SEEK_END);
+	if (pread(spill_fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != SPILL_QUEUE_MAGIC ||
+		header.read_offset < sizeof(header) || header.read_offset > header.write_offset || header.write_offset > size) {
+		reset();
+	}
+	return true;
+}
+
+void spill_queue_close(void) {
+	if (spill_fd != -1) {
+		close(spill_fd);
+		spill_fd = -1;
+	}
+}
+
+bool spill_queue_push(const char* topic, size_t topic_length, const void* data, size_t data_length) {
+	struct spill_record_t record = { .topic_length = (uint16_t)topic_length, .data_length = (uint16_t)data_length };
+	size_t record_size = sizeof(record) + topic_length + data_length;
+
+	if (spill_fd == -1 || topic_length > UINT16_MAX || data_length > UINT16_MAX ||
+		header.write_offset + record_size > spill_max_bytes) {
+		return false;
+	}
+
+	off_t offset = header.write_offset;
+	if (pwrite(spill_fd, &record, sizeof(record), offset) != sizeof(record) ||
+		pwrite(spill_fd, topic, topic_length, offset + (off_t)sizeof(record)) != (ssize_t)topic_length ||
+		pwrite(spill_fd, data, data_length, offset + (off_t)(sizeof(record) + topic_length)) != (ssize_t)data_length) {
+		Log_Debug("ERROR: spill queue write failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	header.write_offset += (uint32_t)record_size;
+	return write_header();
+}
+
+bool spill_queue_front(size_t* topic_length, size_t* data_length) {
+	struct spill_record_t record;
+
+	if (spill_fd == -1 || header.read_offset == header.write_offset) {
+		return false;
+	}
+	if (pread(spill_fd, &record, sizeof(record), header.read_offset) != sizeof(record)) {
+		Log_Debug("ERROR: spill queue read failed, emptying it: %s\n", strerror(errno));
+		reset();
+		return false;
+	}
+
+	*topic_length = record.topic_length;
+	*data_length = record.data_length;
+	return true;
+}
+
+bool spill_queue_read_front(char* topic, void* data) {
+	size_t topic_length, data_length;
+
+	if (!spill_queue_front(&topic_length, &data_length)) {
+		return false;
+	}
+
+	off_t offset = header.read_offset + (off_t)sizeof(struct spill_record_t);
+	if (pread(spill_fd, topic, topic_length, offset) != (ssize_t)topic_length ||
+		pread(spill_fd, data, data_length, offset + (off_t)topic_length) != (ssize_t)data_length) {
+		Log_Debug("ERROR: spill queue read failed, emptying it: %s\n", strerror(errno));
+		reset();
+		return false;
+	}
+
+	topic[topic_length] = '\0';
+	return true;
+}
+
+void spill_queue_pop(void) {
+	size_t topic_length, data_length;
+
+	if (!spill_queue_front(&topic_length, &data_length)) {
+		return;
+	}
+
+	header.read_offset += (uint32_t)(sizeof(struct spill_record_t) + topic_length + data_length);
+	if (header.read_offset >= header.write_offset) {
+		reset();
+	} else {
+		write_header();
+	}
+}
+
+size_t spill_queue_bytes(void) {
+	return header.write_offset - header.read_offset;
+}
@@ -0,0 +1,22 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A FIFO of MQTT messages in the app's mutable storage, for QoS 1 messages which can't be
+// published yet (the inflight window or the send buffer is full). It survives app restarts;
+// the space of the messages read is reclaimed once the queue is empty.
+
+bool spill_queue_init(size_t max_bytes);
+void spill_queue_close(void);
+// Appends a message, returns false if the queue is full or storage failed
+bool spill_queue_push(const char* topic, size_t topic_length, const void* data, size_t data_length);
+// Gives the lengths of the oldest message, returns false if the queue is empty
+bool spill_queue_front(size_t* topic_length, size_t* data_length);
+// Reads the oldest message, topic gets topic_length + 1 bytes with its terminator
+bool spill_queue_read_front(char* topic, void* data);
+void spill_queue_pop(void);
+size_t spill_queue_bytes(void);
@@ -1,26 +1,135 @@
 # Copyright (c) Microsoft Corporation. All rights reserved.
 # Licensed under the MIT License.
 
+import argparse
+import json
 import os
+import threading
 import time
 import paho.mqtt.client as paho
 import ssl
 from pathlib import Path
 
 broker_address='test.mosquitto.org'
+device_topic='azuresphere/sample/device'
+host_topic='azuresphere/sample/host'
+
+parser=argparse.ArgumentParser(description='MQTT host for the Azure Sphere MQTT-C sample: echoes the device\'s messages, or benchmarks it')
+parser.add_argument('--bench', action='store_true', help='drive the device with BENCH commands and report latency, throughput and loss')
+parser.add_argument('--rate', type=int, default=10, help='messages per second the device publishes (default 10)')
+parser.add_argument('--size', type=int, default=64, help='payload bytes, up to 384 (default 64)')
+parser.add_argument('--qos', type=int, choices=[0, 1], default=1, help='QoS the device publishes at (default 1)')
+parser.add_argument('--duration', type=float, default=10, help='seconds of publishing per run (default 10)')
+parser.add_argument('--runs', type=int, default=1, help='runs to perform, 0 to soak until interrupted (default 1)')
+parser.add_argument('--grace', type=float, default=5, help='seconds to wait for late messages after a run (default 5)')
+parser.add_argument('--json', action='store_true', help='print each run\'s report as a JSON line')
+args=parser.parse_args()
+
+##
+## Echo mode: rotate each message left by one character and send it back
+##
 
 def on_message(client, userdata, message):
   msg=str(message.payload.decode("utf-8"))
   print("received message =",msg)
   msg=msg[len(msg)-1]+msg[0:len(msg)-1]
-  client.publish("azuresphere/sample/device",msg)
+  client.publish(device_topic,msg)
+
+##
+## Benchmark mode: each message is "B,<seq>,<device epoch ms>," padded to the payload size.
+## The latency compares the device's clock with the host's, so both must be NTP synchronised.
+##
+
+class BenchRun:
+  def __init__(self, count):
+    self.lock=threading.Lock()
+    self.count=count
+    self.received=set()
+    self.duplicates=0
+    self.latencies=[]
+    self.bytes=0
+    self.first=None
+    self.last=None
+
+  def add(self, payload):
+    fields=payload.split(b',', 3)
+    if len(fields) < 3 or fields[0] != b'B':
+      return
+    now=time.time()
+    seq=int(fields[1])
+    with self.lock:
+      if seq in self.received:
+        self.duplicates+=1
+        return
+      self.received.add(seq)
+      self.latencies.append(now*1000 - int(fields[2]))
+      self.bytes+=len(payload)
+      if self.first is None:
+        self.first=now
+      self.last=now
+
+  def report(self):
+    with self.lock:
+      latencies=sorted(self.latencies)
+      received=len(self.received)
+      elapsed=(self.last - self.first) if received > 1 else 0
+      def percentile(p):
+        return round(latencies[min(len(latencies) - 1, int(p*len(latencies)))], 1) if latencies else None
+      return {
+        'sent': self.count,
+        'received': received,
+        'lost': self.count - received,
+        'loss_pct': round(100.0*(self.count - received)/self.count, 2),
+        'duplicates': self.duplicates,
+        'msgs_per_s': round((received - 1)/elapsed, 1) if elapsed else None,
+        'bytes_per_s': round(self.bytes/elapsed) if elapsed else None,
+        'latency_ms_min': percentile(0),
+        'latency_ms_p50': percentile(0.5),
+        'latency_ms_p95': percentile(0.95),
+        'latency_ms_p99': percentile(0.99),
+        'latency_ms_max': percentile(1),
+      }
+
+current_run=None
+connected=threading.Event()
+
+def on_bench_message(client, userdata, message):
+  run=current_run
+  if run is not None:
+    run.add(message.payload)
+
+def print_report(run_index, report):
+  if args.json:
+    print(json.dumps(dict(run=run_index, rate=args.rate, size=args.size, qos=args.qos, **report)), flush=True)
+    return
+  print("run %d: %d/%d received (%.2f%% lost, %d duplicates), %s msg/s, %s B/s" % (run_index, report['received'],
+    report['sent'], report['loss_pct'], report['duplicates'], report['msgs_per_s'], report['bytes_per_s']))
+  print("  latency ms: min %s, p50 %s, p95 %s, p99 %s, max %s" % (report['latency_ms_min'], report['latency_ms_p50'],
+    report['latency_ms_p95'], report['latency_ms_p99'], report['latency_ms_max']), flush=True)
+
+def bench(client):
+  global current_run
+  count=max(1, int(args.rate*args.duration))
+  run_index=1
+  try:
+    while args.runs == 0 or run_index <= args.runs:
+      current_run=BenchRun(count)
+      client.publish(device_topic, "BENCH %d %d %d %d" % (args.rate, args.size, count, args.qos), qos=1)
+      time.sleep(args.duration + args.grace)
+      print_report(run_index, current_run.report())
+      run_index+=1
+  except KeyboardInterrupt:
+    pass
+  finally:
+    client.publish(device_topic, "STOP", qos=1).wait_for_publish()
 
 def on_connect(client, userdata, flags, rc):
   print("Connected ")
-  client.subscribe("azuresphere/sample/host")
+  client.subscribe(host_topic, qos=args.qos if args.bench else 0)
+  connected.set()
 
-client=paho.Client() 
-client.on_message=on_message
+client=paho.Client()
+client.on_message=on_bench_message if args.bench else on_message
 client.on_connect=on_connect
 print("connecting to broker")
 
@@ -36,8 +145,12 @@ client.tls_set(ca_certs=os.path.join(certsDir,'mosquitto.org.crt'), certfile=os.
 client.tls_insecure_set(False)
 client.connect(broker_address, 8883, 60)
 
-##start loop to process received messages
-client.loop_forever()
-
-
-
+if args.bench:
+  ##process received messages in the background while driving the device
+  client.loop_start()
+  connected.wait()
+  bench(client)
+  client.loop_stop()
+else:
+  ##start loop to process received messages
+  client.loop_forever()
@@ -1,15 +1,62 @@
 # Copyright (c) Microsoft Corporation.
 # Licensed under the MIT License.
 
+import argparse
+import os
+import re
 import time
 import urllib.request
 import json
-from threading import Thread
+from threading import Thread, BoundedSemaphore, Lock
 import socket
 import sys
 import subprocess
 import shutil
 
+# Devices are found and signal completion in parallel, but at most this many per-device actions
+# run at once - a tray of devices sideloading together saturates the PC's USB and CPU.
+DEFAULT_MAX_PARALLEL = 8
+
+actionslots = BoundedSemaphore(DEFAULT_MAX_PARALLEL)
+logdir = None
+
+# per connection path: {'ok': True/False/None while running, 'seconds': action time}
+results = {}
+resultslock = Lock()
+
+def argumentparser(description):
+    parser = argparse.ArgumentParser(description=description)
+    parser.add_argument("--parallel", type=int, default=DEFAULT_MAX_PARALLEL,
+                        help="maximum number of devices to run the action on at once (default: %(default)s)")
+    parser.add_argument("--logdir",
+                        help="write each device's azsphere commands and output to <logdir>/<connection path>.log")
+    return parser
+
+def openlog(device):
+    device['log'] = None
+    if logdir is not None:
+        name = re.sub(r'[^A-Za-z0-9_.-]', '_', device['DeviceConnectionPath'])
+        device['log'] = open(os.path.join(logdir, name + ".log"), "a")
+
+def writelog(device, text):
+    if device is not None and device.get('log') is not None:
+        device['log'].write(time.strftime("%H:%M:%S ") + text + "\n")
+        device['log'].flush()
+
+def summary():
+    with resultslock:
+        succeeded = sum(1 for r in results.values() if r['ok'] is True)
+        failed = sum(1 for r in results.values() if r['ok'] is False)
+        running = sum(1 for r in results.values() if r['ok'] is None)
+    return str(succeeded) + " succeeded, " + str(failed) + " failed, " + str(running) + " in progress"
+
+def printsummary():
+    print("Summary: " + summary())
+    with resultslock:
+        for path, r in sorted(results.items()):
+            status = "in progress" if r['ok'] is None else ("ok" if r['ok'] else "FAILED")
+            print("\t" + path + ": " + status + ("" if r['ok'] is None else " ({:.1f}s)".format(r['seconds'])))
+
 def done(device, ok):
     if ok is None:
         print("WARNING: per device action returned 'None' - assuming success")
@@ -40,9 +87,38 @@ def done(device, ok):
 
 def doaction(per_device_action, device):
     time.sleep(5)
-    done(device, per_device_action(device))
+    path = device['DeviceConnectionPath']
+    with actionslots:
+        with resultslock:
+            results[path] = {'ok': None, 'seconds': 0}
+        openlog(device)
+        writelog(device, "action started")
+        starttime = time.time()
+        try:
+            ok = per_device_action(device)
+        except Exception as e:
+            print("ERROR: per device action on device at " + path + " raised " + repr(e))
+            ok = False
+        if ok is None:
+            print("WARNING: per device action returned 'None' - assuming success")
+            ok = True
+        seconds = time.time() - starttime
+        writelog(device, "action " + ("succeeded" if ok else "failed") + " in {:.1f}s".format(seconds))
+        if device['log'] is not None:
+            device['log'].close()
+            device['log'] = None
+        with resultslock:
+            results[path] = {'ok': ok, 'seconds': seconds}
+    print("\t\t" + summary())
+    done(device, ok)
+
+def perdevice(per_device_action, max_parallel = DEFAULT_MAX_PARALLEL, log_dir = None):
+    global actionslots, logdir
+    actionslots = BoundedSemaphore(max(1, max_parallel))
+    logdir = log_dir
+    if logdir is not None:
+        os.makedirs(logdir, exist_ok=True)
 
-def perdevice(per_device_action):
     listattachedurl="http://localhost:48938/api/service/devices"
     deviceList = []
 
@@ -96,6 +172,7 @@ def perdevice(per_device_action):
         try:
             time.sleep(0.2)
         except:
+            printsummary()
             if len(deviceList) == 0:
                 return 0
             else:
@@ -119,6 +196,7 @@ def azspherecommand(args, device = None):
         args = args + ["--device", device['DeviceConnectionPath']]
 
     result = subprocess.run(args, stderr=subprocess.STDOUT, stdout=subprocess.PIPE) 
+    writelog(device, ' '.join(args) + " -> " + str(result.returncode) + "\n" + result.stdout.decode('utf-8', 'replace'))
     if result.returncode != 0:
         if device is not None:
             print("Azsphere command " + ' '.join(args) + " on device at " + device['DeviceConnectionPath'] + " failed with output:")
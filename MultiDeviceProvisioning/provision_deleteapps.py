@@ -8,6 +8,8 @@ def deleteapps(device):
     result=provision.azspherecommand(["device", "sideload", "delete"], device)
     return result.returncode == 0
    
+args = provision.argumentparser("Delete applications from any attached Azure Sphere devices").parse_args()
+
 print("Deleting apps from any attached Azure Sphere devices in parallel.  Press Ctrl-C to exit.")
-ret = provision.perdevice(deleteapps)
+ret = provision.perdevice(deleteapps, args.parallel, args.logdir)
 sys.exit(ret)
\ No newline at end of file
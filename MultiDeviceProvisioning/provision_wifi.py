@@ -25,15 +25,16 @@ def configure_wifi(device):
         print("No need to add WiFi network to device at " + device["DeviceConnectionPath"])
     return True
 
-if len(sys.argv) != 3:
-    print("Please provide the SSID and Network Key")
-    sys.exit(-1)
+parser = provision.argumentparser("Configure Wi-Fi on any attached Azure Sphere devices")
+parser.add_argument("ssid")
+parser.add_argument("networkkey")
+args = parser.parse_args()
 
-wifi_ssid=sys.argv[1]
-wifi_network_key=sys.argv[2]
+wifi_ssid=args.ssid
+wifi_network_key=args.networkkey
 
 print("Configuring Wi-Fi for any attached Azure Sphere devices in parallel (",wifi_ssid, ':', wifi_network_key, "). Press Ctrl-C to exit.")
 
-ret = provision.perdevice(configure_wifi)
+ret = provision.perdevice(configure_wifi, args.parallel, args.logdir)
 
 sys.exit(ret)
\ No newline at end of file
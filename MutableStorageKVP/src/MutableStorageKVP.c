@@ -6,197 +6,889 @@
 #include <string.h>
 #include "cJSON/cJSON.h"
 #include <errno.h>
-
-ssize_t getStorageString(char **jsonString);
-bool writeJsonToStorage(cJSON *cJson);
-
-/// <summary>  
-///  Writes Key/Value pair (keyName, String) into Mutable storage (JSON).
+#include <sys/timerfd.h>
+
+// Mutable storage holds a log of records, after a 4 byte magic:
+//    uint8 type, uint16 keyLen, key, uint16 valueLen, value    (little endian, no terminators)
+// a valueLen of KVP_LOG_TOMBSTONE deletes the key. Changes are appended; once the log
+// would grow past twice the size of its live records it's rewritten with just those.
+// A KVP1 log has no type byte, every value is a string.
+#define KVP_LOG_MAGIC "KVP2"
+#define KVP_LOG_MAGIC_V1 "KVP1"
+#define KVP_LOG_MAGIC_LEN 4
+#define KVP_LOG_TOMBSTONE 0xFFFF
+#define KVP_LOG_MAX_LEN (KVP_LOG_TOMBSTONE - 1)
+
+// the type of an entry deleted since the last write to storage
+#define KVP_DELETED 0xFF
+
+// Records are written to storage through a buffer this size, so saving the store takes
+// the same memory however large it has grown.
+#define KVP_WRITE_CHUNK 256
+
+typedef struct
+{
+	char *key;
+	uint8_t type;		// a ProfileValueType, or KVP_DELETED
+	bool pending;		// changed since the last write to storage
+	uint16_t length;
+	uint8_t *value;		// length bytes as stored (numbers little endian), plus a terminator
+} kvpEntry;
+
+typedef struct
+{
+	int fd;
+	size_t used;
+	size_t written;		// bytes that made it to storage
+	bool failed;
+	uint8_t buffer[KVP_WRITE_CHUNK];
+} kvpWriter;
+
+ssize_t getStorageString(char **contents);
+
+static bool loadCache(void);
+static void loadJson(const char *json);
+static void replayLog(const uint8_t *log, size_t length, bool typed);
+static kvpEntry *findEntry(const char *keyName);
+static bool setEntry(const char *keyName, uint8_t type, const void *value, size_t length, bool *changed);
+static void freeEntries(void);
+static bool setValue(char *keyName, const ProfileValue *value, bool *changed);
+static ssize_t getValue(char *keyName, ProfileValue *value);
+static size_t encodeRecords(bool pendingOnly, kvpWriter *writer);
+static void writeBytes(kvpWriter *writer, const void *data, size_t length);
+static void flushWriter(kvpWriter *writer);
+static bool appendToLog(void);
+static bool rewriteLog(void);
+static void scheduleFlush(void);
+static void flushTimerEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+
+// The Key/Value pairs, replayed from mutable storage on first use. Changes not in storage yet
+// are marked pending; they're written when the cache is committed, or once no change has
+// been made for the flush delay.
+static kvpEntry *_entries = NULL;
+static size_t _entryCount = 0;
+static size_t _entryCapacity = 0;
+static bool _loaded = false;
+static bool _dirty = false;
+// Bytes of valid log in storage, 0 if the log has to be rewritten (empty, older format, torn tail).
+static size_t _logSize = 0;
+
+// Without an event loop (InitProfileStrings not called) every change is written straight away.
+static EventLoop *_eventLoop = NULL;
+static int _flushTimerFd = -1;
+static EventRegistration *_flushTimerReg = NULL;
+static uint32_t _flushDelayMs = 0;
+
+/// <summary>
+///  Sets up the delayed writes to mutable storage on eventLoop: changes are written once
+///  no other change has been made for flushDelayMs milliseconds, or on CommitProfileStrings.
 ///  Returns 'true' on success, 'false' on failure.
 /// </summary>
-bool WriteProfileString(char *keyName, char *value)
+bool InitProfileStrings(EventLoop *eventLoop, uint32_t flushDelayMs)
 {
 #ifdef SHOW_DEBUG_MSGS
 	Log_Debug(">>> %s\n", __func__);
 #endif
 
-	char *jsonString = 0x00;
-	ssize_t length = getStorageString(&jsonString);
+	if (_flushTimerFd != -1)
+		return true;
 
-	if (length == -1)
+	_flushTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (_flushTimerFd == -1)
 	{
-		Log_Debug("Error: writing to mutable storage: errno %d\n", errno);
+		Log_Debug("Error: creating mutable storage flush timer: errno %d\n", errno);
 		return false;
 	}
 
-	cJSON *cJson = NULL;
-	if (length == 0) // nothing in storage.
+	_flushTimerReg = EventLoop_RegisterIo(eventLoop, _flushTimerFd, EventLoop_Input, flushTimerEventHandler, NULL);
+	if (_flushTimerReg == NULL)
 	{
-		cJson = cJSON_CreateObject();
-		cJSON_AddStringToObject(cJson, keyName, value);
-	}
-	else
-	{
-		// convert to JSON, read the element.
-		cJson = cJSON_Parse(jsonString);
-
-		cJSON *pItem = cJSON_GetObjectItemCaseSensitive(cJson, keyName);
-		if (pItem == NULL)	// don't have the item in the JSON
-		{
-			cJSON_AddStringToObject(cJson, keyName, value);
-		}
-		else
-		{
-			cJSON *pNewItem = cJSON_CreateString(value);
-			cJSON_ReplaceItemInObjectCaseSensitive(cJson, keyName, pNewItem);
-		}
+		Log_Debug("Error: registering mutable storage flush timer: errno %d\n", errno);
+		close(_flushTimerFd);
+		_flushTimerFd = -1;
+		return false;
 	}
 
-	writeJsonToStorage(cJson);
+	_eventLoop = eventLoop;
+	_flushDelayMs = flushDelayMs;
 
-	cJSON_Delete(cJson);
-	free(jsonString);
+	// a change made before the event loop was set up may still be pending
+	if (_dirty)
+		scheduleFlush();
 
 	return true;
 }
 
-bool DeleteProfileString(char *keyName)
+/// <summary>
+///  Writes any pending change to mutable storage and releases the cache, and the flush timer.
+/// </summary>
+void CloseProfileStrings(void)
 {
 #ifdef SHOW_DEBUG_MSGS
 	Log_Debug(">>> %s\n", __func__);
 #endif
 
-	char *jsonString = 0x00;
-	ssize_t length = getStorageString(&jsonString);
+	CommitProfileStrings();
 
-	// nothing in storage, bail
-	if (length == -1)
+	if (_flushTimerReg != NULL)
+	{
+		EventLoop_UnregisterIo(_eventLoop, _flushTimerReg);
+		_flushTimerReg = NULL;
+		_eventLoop = NULL;
+	}
+	if (_flushTimerFd != -1)
+	{
+		close(_flushTimerFd);
+		_flushTimerFd = -1;
+	}
+
+	freeEntries();
+	_loaded = false;
+	_dirty = false;
+}
+
+/// <summary>
+///  Writes any pending change to mutable storage.
+///  Returns 'true' on success (or nothing to write), 'false' on failure.
+/// </summary>
+bool CommitProfileStrings(void)
+{
+#ifdef SHOW_DEBUG_MSGS
+	Log_Debug(">>> %s\n", __func__);
+#endif
+
+	if (!_dirty)
+		return true;
+
+	// append the changes, unless the log would end up more than twice its live size
+	size_t liveSize = encodeRecords(false, NULL);
+	size_t pendingSize = encodeRecords(true, NULL);
+	bool compact = _logSize == 0 || _logSize + pendingSize > 2 * liveSize;
+
+	// a failed append may be for want of space, try reclaiming it
+	if (!(compact ? rewriteLog() : (appendToLog() || rewriteLog())))
 		return false;
 
-	// convert to JSON, read the element.
-	cJSON *cJson = cJSON_Parse(jsonString);
+	// everything is in storage, the deletes included
+	size_t kept = 0;
+	for (size_t i = 0; i < _entryCount; i++)
+	{
+		kvpEntry *entry = &_entries[i];
+		if (entry->type == KVP_DELETED)
+		{
+			free(entry->key);
+			free(entry->value);
+			continue;
+		}
+		entry->pending = false;
+		_entries[kept++] = *entry;
+	}
+	_entryCount = kept;
+	_dirty = false;
 
-	bool ret = false;
-	cJSON *pItem = cJSON_GetObjectItemCaseSensitive(cJson, keyName);
-	if (pItem != NULL)	// item is in the JSON
+	// nothing left for the timer to do
+	if (_flushTimerFd != -1)
 	{
-		cJSON_DeleteItemFromObject(cJson, keyName);
-		writeJsonToStorage(cJson);
-		ret = true;
+		struct itimerspec disarm = { 0 };
+		timerfd_settime(_flushTimerFd, 0, &disarm, NULL);
 	}
 
-	cJSON_Delete(cJson);
-	free(jsonString);
+	return true;
+}
 
-	return ret;
+/// <summary>
+///  Writes Key/Value pair (keyName, String) into Mutable storage.
+///  Returns 'true' on success, 'false' on failure.
+/// </summary>
+bool WriteProfileString(char *keyName, char *value)
+{
+	ProfileValue profileValue = { .type = ProfileValue_String, .value.buffer = { value, 0 } };
+	return SetProfileValues(&keyName, 1, &profileValue);
 }
 
-/// <summary>  
+/// <summary>
 ///  Gets Value from storage based on KeyName.
 ///  returns -1 for error or no matching Key
 /// </summary>
 ssize_t GetProfileString(char *keyName, char *returnedString, size_t Size)
+{
+	ProfileValue profileValue = { .type = ProfileValue_String, .value.buffer = { returnedString, Size } };
+	GetProfileValues(&keyName, 1, &profileValue);
+	return profileValue.length;
+}
+
+bool WriteProfileInt(char *keyName, int32_t value)
+{
+	ProfileValue profileValue = { .type = ProfileValue_Int, .value.intValue = value };
+	return SetProfileValues(&keyName, 1, &profileValue);
+}
+
+/// <summary>
+///  Gets an int from storage, a string holding a whole number is converted.
+///  Returns 'true' on success, 'false' for error or no matching Key
+/// </summary>
+bool GetProfileInt(char *keyName, int32_t *value)
+{
+	ProfileValue profileValue = { .type = ProfileValue_Int };
+	if (GetProfileValues(&keyName, 1, &profileValue) != 1)
+		return false;
+
+	*value = profileValue.value.intValue;
+	return true;
+}
+
+bool WriteProfileFloat(char *keyName, float value)
+{
+	ProfileValue profileValue = { .type = ProfileValue_Float, .value.floatValue = value };
+	return SetProfileValues(&keyName, 1, &profileValue);
+}
+
+/// <summary>
+///  Gets a float from storage, an int or a string holding a number is converted.
+///  Returns 'true' on success, 'false' for error or no matching Key
+/// </summary>
+bool GetProfileFloat(char *keyName, float *value)
+{
+	ProfileValue profileValue = { .type = ProfileValue_Float };
+	if (GetProfileValues(&keyName, 1, &profileValue) != 1)
+		return false;
+
+	*value = profileValue.value.floatValue;
+	return true;
+}
+
+bool WriteProfileBlob(char *keyName, const void *data, size_t size)
+{
+	ProfileValue profileValue = { .type = ProfileValue_Blob, .value.buffer = { (void *)data, size } };
+	return SetProfileValues(&keyName, 1, &profileValue);
+}
+
+/// <summary>
+///  Copies a blob from storage into buffer.
+///  returns -1 for error, no matching Key or a blob larger than size, otherwise its size
+/// </summary>
+ssize_t GetProfileBlob(char *keyName, void *buffer, size_t size)
+{
+	ProfileValue profileValue = { .type = ProfileValue_Blob, .value.buffer = { buffer, size } };
+	GetProfileValues(&keyName, 1, &profileValue);
+	return profileValue.length;
+}
+
+/// <summary>
+///  Writes count Key/Value pairs into Mutable storage, with a single write for all of them.
+///  Returns 'true' on success, 'false' on failure (the pairs before the failed one are kept).
+/// </summary>
+bool SetProfileValues(char *keyNames[], size_t count, const ProfileValue values[])
 {
 #ifdef SHOW_DEBUG_MSGS
 	Log_Debug(">>> %s\n", __func__);
 #endif
 
-	char *jsonString = 0x00;
-	ssize_t length = getStorageString(&jsonString);
+	if (!loadCache())
+	{
+		Log_Debug("Error: writing to mutable storage: errno %d\n", errno);
+		return false;
+	}
 
-	// Log_Debug("GetProfileString JSON: %s\n", jsonString);
+	bool bRet = true;
+	bool changed = false;
+	for (size_t i = 0; i < count && bRet; i++)
+	{
+		bRet = setValue(keyNames[i], &values[i], &changed);
+	}
+
+	if (changed)
+	{
+		_dirty = true;
+		scheduleFlush();
+	}
+
+	return bRet;
+}
+
+/// <summary>
+///  Gets count Values from storage, each in the type (and for a string or blob, into the
+///  buffer) given by values[i]; values[i].length is set to the bytes returned, -1 if missing.
+///  Returns the number of Values found, -1 for error.
+/// </summary>
+ssize_t GetProfileValues(char *keyNames[], size_t count, ProfileValue values[])
+{
+#ifdef SHOW_DEBUG_MSGS
+	Log_Debug(">>> %s\n", __func__);
+#endif
+
+	for (size_t i = 0; i < count; i++)
+	{
+		values[i].length = -1;
+	}
 
-	if (length <= 0)
+	if (!loadCache())
 	{
 		Log_Debug("Error: reading mutable storage: errno %d\n", errno);
 		return -1;
 	}
 
-	ssize_t retVal = -1;
-	memset(returnedString, 0x00, Size);
+	ssize_t found = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		values[i].length = getValue(keyNames[i], &values[i]);
+		if (values[i].length != -1)
+			found++;
+	}
+
+	return found;
+}
+
+bool DeleteProfileString(char *keyName)
+{
+#ifdef SHOW_DEBUG_MSGS
+	Log_Debug(">>> %s\n", __func__);
+#endif
+
+	if (!loadCache())
+		return false;
+
+	kvpEntry *entry = findEntry(keyName);
+	if (entry == NULL || entry->type == KVP_DELETED)	// item isn't in storage
+		return false;
+
+	free(entry->value);
+	entry->value = NULL;
+	entry->length = 0;
+	entry->type = KVP_DELETED;
+	entry->pending = true;
+
+	_dirty = true;
+	scheduleFlush();
+
+	return true;
+}
+
+/// <summary>
+///  Stores value in the cache under keyName, setting *changed unless it's already there.
+///  Returns 'true' on success, 'false' on failure.
+/// </summary>
+static bool setValue(char *keyName, const ProfileValue *value, bool *changed)
+{
+	uint8_t number[4];
+	const void *data = number;
+	size_t length = sizeof(number);
+	uint32_t bits;
+
+	switch (value->type)
+	{
+	case ProfileValue_String:
+		data = value->value.buffer.data;
+		length = strlen((const char *)data);
+		break;
+	case ProfileValue_Blob:
+		data = value->value.buffer.data;
+		length = value->value.buffer.size;
+		break;
+	case ProfileValue_Int:
+	case ProfileValue_Float:
+		if (value->type == ProfileValue_Int)
+			bits = (uint32_t)value->value.intValue;
+		else
+			memcpy(&bits, &value->value.floatValue, sizeof(bits));
+		number[0] = (uint8_t)bits;
+		number[1] = (uint8_t)(bits >> 8);
+		number[2] = (uint8_t)(bits >> 16);
+		number[3] = (uint8_t)(bits >> 24);
+		break;
+	default:
+		return false;
+	}
+
+	if (strlen(keyName) > KVP_LOG_MAX_LEN || length > KVP_LOG_MAX_LEN)
+	{
+		Log_Debug("Error: key or value too long for mutable storage\n");
+		return false;
+	}
+
+	return setEntry(keyName, (uint8_t)value->type, data, length, changed);
+}
+
+/// <summary>
+///  Copies the Value for keyName out of the cache, converting it to value->type.
+///  returns -1 for no matching Key (or no conversion), otherwise the bytes returned
+/// </summary>
+static ssize_t getValue(char *keyName, ProfileValue *value)
+{
+	kvpEntry *entry = findEntry(keyName);
+
+	if (value->type == ProfileValue_String)
+		memset(value->value.buffer.data, 0x00, value->value.buffer.size);
+
+	if (entry == NULL || entry->type == KVP_DELETED)
+		return -1;
+
+	const char *string = (const char *)entry->value;
+	char *end = NULL;
+	uint32_t bits = 0;
+	if (entry->length == sizeof(bits))
+	{
+		bits = (uint32_t)entry->value[0] | (uint32_t)entry->value[1] << 8 |
+			(uint32_t)entry->value[2] << 16 | (uint32_t)entry->value[3] << 24;
+	}
+	else if (entry->type == ProfileValue_Int || entry->type == ProfileValue_Float)
+	{
+		return -1;
+	}
+
+	switch (value->type)
+	{
+	case ProfileValue_String:
+	case ProfileValue_Blob:
+		if (entry->type != value->type || entry->length > value->value.buffer.size)
+			return -1;
+		memcpy(value->value.buffer.data, entry->value, entry->length);
+		return entry->length;
+
+	case ProfileValue_Int:
+		if (entry->type == ProfileValue_Int)
+		{
+			value->value.intValue = (int32_t)bits;
+		}
+		else if (entry->type == ProfileValue_String && entry->length > 0)
+		{
+			long number = strtol(string, &end, 10);
+			if (*end != 0x00 || number < INT32_MIN || number > INT32_MAX)
+				return -1;
+			value->value.intValue = (int32_t)number;
+		}
+		else
+		{
+			return -1;
+		}
+		return sizeof(value->value.intValue);
+
+	case ProfileValue_Float:
+		if (entry->type == ProfileValue_Float)
+		{
+			memcpy(&value->value.floatValue, &bits, sizeof(bits));
+		}
+		else if (entry->type == ProfileValue_Int)
+		{
+			value->value.floatValue = (float)(int32_t)bits;
+		}
+		else if (entry->type == ProfileValue_String && entry->length > 0)
+		{
+			value->value.floatValue = strtof(string, &end);
+			if (*end != 0x00)
+				return -1;
+		}
+		else
+		{
+			return -1;
+		}
+		return sizeof(value->value.floatValue);
+
+	default:
+		return -1;
+	}
+}
+
+/// <summary>
+///  Replays mutable storage into the cache, the first time it's needed.
+///  Returns 'true' on success, 'false' if mutable storage can't be read.
+/// </summary>
+static bool loadCache(void)
+{
+	if (_loaded)
+		return true;
+
+	char *storage = 0x00;
+	ssize_t length = getStorageString(&storage);
+	if (length == -1)
+		return false;
+
+	_logSize = 0;
+	if (length >= KVP_LOG_MAGIC_LEN && memcmp(storage, KVP_LOG_MAGIC, KVP_LOG_MAGIC_LEN) == 0)
+	{
+		replayLog((const uint8_t *)storage, (size_t)length, true);
+	}
+	else if (length >= KVP_LOG_MAGIC_LEN && memcmp(storage, KVP_LOG_MAGIC_V1, KVP_LOG_MAGIC_LEN) == 0)
+	{
+		replayLog((const uint8_t *)storage, (size_t)length, false);
+		_logSize = 0;		// can't append typed records to it, converted on the next write
+	}
+	else if (length > 0)
+	{
+		// written by an earlier version as a JSON document, converted on the next write
+		loadJson(storage);
+	}
+	free(storage);
+
+	_loaded = true;
+	return true;
+}
+
+/// <summary>
+///  Adds the strings of a JSON document, as written by earlier versions, to the cache.
+/// </summary>
+static void loadJson(const char *json)
+{
+	cJSON *root = cJSON_Parse(json);
+	if (!cJSON_IsObject(root))
+	{
+		cJSON_Delete(root);
+		return;
+	}
+
+	bool changed = false;
+	cJSON *pItem = NULL;
+	cJSON_ArrayForEach(pItem, root)
+	{
+		if (cJSON_IsString(pItem) && strlen(pItem->string) <= KVP_LOG_MAX_LEN && strlen(pItem->valuestring) <= KVP_LOG_MAX_LEN)
+			setEntry(pItem->string, ProfileValue_String, pItem->valuestring, strlen(pItem->valuestring), &changed);
+	}
+	cJSON_Delete(root);
+}
 
-	// convert to JSON, read the element.
-	cJSON *cJson = cJSON_Parse(jsonString);
-	cJSON *pItem = cJSON_GetObjectItemCaseSensitive(cJson, keyName);
-	if (pItem != NULL)
+/// <summary>
+///  Applies the records of the log to the cache, setting _logSize to the length of the
+///  log if it's intact; a record cut short by a failed write ends the replay.
+///  Records of an untyped (KVP1) log are all strings.
+/// </summary>
+static void replayLog(const uint8_t *log, size_t length, bool typed)
+{
+	size_t headerLen = typed ? 5 : 4;
+	size_t pos = KVP_LOG_MAGIC_LEN;
+	while (length - pos >= headerLen)
 	{
-		size_t sLength = strlen(pItem->valuestring);
-		if (sLength <= Size)
+		const uint8_t *record = log + pos;
+		uint8_t type = typed ? record[0] : ProfileValue_String;
+		if (typed)
+			record++;
+
+		size_t keyLen = (size_t)(record[0] | (record[1] << 8));
+		if (length - pos - headerLen < keyLen)
+			break;
+		size_t valueLen = (size_t)(record[2 + keyLen] | (record[3 + keyLen] << 8));
+		size_t valueLenInLog = valueLen == KVP_LOG_TOMBSTONE ? 0 : valueLen;
+		if (length - pos - headerLen - keyLen < valueLenInLog)
+			break;
+
+		char *key = (char *)malloc(keyLen + 1);
+		if (key == NULL)
+			return;
+		memcpy(key, record + 2, keyLen);
+		key[keyLen] = 0x00;
+
+		bool changed = false;
+		if (valueLen != KVP_LOG_TOMBSTONE)
+		{
+			setEntry(key, type, record + 4 + keyLen, valueLen, &changed);
+		}
+		else
 		{
-			strncpy(returnedString, pItem->valuestring, sLength);
-			retVal = (ssize_t)sLength;
+			// nothing's pending while replaying, so the entry can go altogether
+			kvpEntry *entry = findEntry(key);
+			if (entry != NULL)
+			{
+				free(entry->key);
+				free(entry->value);
+				*entry = _entries[--_entryCount];
+			}
 		}
+		free(key);
+
+		pos += headerLen + keyLen + valueLenInLog;
+	}
+
+	// anything after the last whole record gets dropped by rewriting the log
+	_logSize = pos == length ? length : 0;
+
+	// replayed records are already in storage
+	for (size_t i = 0; i < _entryCount; i++)
+	{
+		_entries[i].pending = false;
 	}
+}
 
-	cJSON_Delete(cJson);
-	free(jsonString);
+static kvpEntry *findEntry(const char *keyName)
+{
+	for (size_t i = 0; i < _entryCount; i++)
+	{
+		if (strcmp(_entries[i].key, keyName) == 0)
+			return &_entries[i];
+	}
 
-	return retVal;
+	return NULL;
 }
 
-/// <summary>  
-///  Reads JSON string from storage
-///  returns -1 for error or length of string on success
-///  caller is responsible for releasing allocated memory
+/// <summary>
+///  Stores length bytes of value as keyName's Value, marking it pending and setting
+///  *changed, unless the same Value is already there.
+///  Returns 'true' on success, 'false' if out of memory.
 /// </summary>
-ssize_t getStorageString(char **jsonString)
+static bool setEntry(const char *keyName, uint8_t type, const void *value, size_t length, bool *changed)
 {
-#ifdef SHOW_DEBUG_MSGS
-	Log_Debug(">>> %s\n", __func__);
-#endif
+	kvpEntry *entry = findEntry(keyName);
+	if (entry != NULL && entry->type == type && entry->length == length && memcmp(entry->value, value, length) == 0)
+		return true;		// unchanged, nothing to write
 
-	int fd = Storage_OpenMutableFile();
-	ssize_t ret = -1;
-	if (fd != -1)
+	uint8_t *copy = (uint8_t *)malloc(length + 1);
+	if (copy == NULL)
+		return false;
+	memcpy(copy, value, length);
+	copy[length] = 0x00;
+
+	if (entry == NULL)
 	{
-		off_t length = lseek(fd, 0, SEEK_END);
-		*jsonString = (char*)malloc((size_t)length + 1);
+		char *key = strdup(keyName);
+		if (key == NULL)
+		{
+			free(copy);
+			return false;
+		}
 
-#ifdef SHOW_DEBUG_MSGS
-		Log_Debug("malloc %s, 0x%lx\n", __func__, jsonString);
-#endif
+		if (_entryCount == _entryCapacity)
+		{
+			size_t capacity = _entryCapacity == 0 ? 8 : _entryCapacity * 2;
+			kvpEntry *entries = (kvpEntry *)realloc(_entries, capacity * sizeof(kvpEntry));
+			if (entries == NULL)
+			{
+				free(key);
+				free(copy);
+				return false;
+			}
+			_entries = entries;
+			_entryCapacity = capacity;
+		}
 
-		memset(*jsonString, 0x00, (size_t)length + 1);
-		lseek(fd, 0, SEEK_SET);
-		ret = read(fd, *jsonString, (size_t)length);
-		close(fd);
+		entry = &_entries[_entryCount++];
+		entry->key = key;
+		entry->value = NULL;
 	}
 
-	return ret;
+	free(entry->value);
+	entry->value = copy;
+	entry->length = (uint16_t)length;
+	entry->type = type;
+	entry->pending = true;
+	*changed = true;
+
+	return true;
+}
+
+static void freeEntries(void)
+{
+	for (size_t i = 0; i < _entryCount; i++)
+	{
+		free(_entries[i].key);
+		free(_entries[i].value);
+	}
+	free(_entries);
+	_entries = NULL;
+	_entryCount = 0;
+	_entryCapacity = 0;
 }
 
-/// <summary>  
-///  Writes JSON string to storage (extracts char * from cJSON object)
+/// <summary>
+///  Encodes the live entries, after the magic, or just the pending ones (deletes as
+///  tombstones), as log records to writer. Pass writer as NULL to size them; returns their length.
+/// </summary>
+static size_t encodeRecords(bool pendingOnly, kvpWriter *writer)
+{
+	size_t length = 0;
+	if (!pendingOnly)
+	{
+		if (writer != NULL)
+			writeBytes(writer, KVP_LOG_MAGIC, KVP_LOG_MAGIC_LEN);
+		length = KVP_LOG_MAGIC_LEN;
+	}
+
+	for (size_t i = 0; i < _entryCount; i++)
+	{
+		kvpEntry *entry = &_entries[i];
+		if (pendingOnly ? !entry->pending : entry->type == KVP_DELETED)
+			continue;
+
+		size_t keyLen = strlen(entry->key);
+		if (writer != NULL)
+		{
+			uint16_t valueLenInLog = entry->type == KVP_DELETED ? KVP_LOG_TOMBSTONE : entry->length;
+			uint8_t header[3] = { entry->type, (uint8_t)keyLen, (uint8_t)(keyLen >> 8) };
+			uint8_t valueHeader[2] = { (uint8_t)valueLenInLog, (uint8_t)(valueLenInLog >> 8) };
+			writeBytes(writer, header, sizeof(header));
+			writeBytes(writer, entry->key, keyLen);
+			writeBytes(writer, valueHeader, sizeof(valueHeader));
+			writeBytes(writer, entry->value, entry->length);
+		}
+		length += 5 + keyLen + entry->length;
+	}
+
+	return length;
+}
+
+/// <summary>
+///  Copies length bytes into the writer's buffer, writing it to storage each time it fills.
+/// </summary>
+static void writeBytes(kvpWriter *writer, const void *data, size_t length)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	while (length > 0 && !writer->failed)
+	{
+		size_t chunk = KVP_WRITE_CHUNK - writer->used;
+		if (chunk > length)
+			chunk = length;
+		memcpy(writer->buffer + writer->used, bytes, chunk);
+		writer->used += chunk;
+		bytes += chunk;
+		length -= chunk;
+
+		if (writer->used == KVP_WRITE_CHUNK)
+			flushWriter(writer);
+	}
+}
+
+/// <summary>
+///  Writes what's in the writer's buffer to storage, a short write fails the writer.
+/// </summary>
+static void flushWriter(kvpWriter *writer)
+{
+	if (writer->used == 0 || writer->failed)
+		return;
+
+	ssize_t numWritten = write(writer->fd, writer->buffer, writer->used);
+	if (numWritten > 0)
+		writer->written += (size_t)numWritten;
+	if (numWritten != (ssize_t)writer->used)
+		writer->failed = true;
+	writer->used = 0;
+}
+
+/// <summary>
+///  Appends the pending changes to the log in mutable storage.
 ///  Returns 'true' for success, 'false' for failure.
 /// </summary>
-bool writeJsonToStorage(cJSON *cJson)
+static bool appendToLog(void)
 {
+	bool bRet = false;
+	int fd = Storage_OpenMutableFile();
+	if (fd != -1)
+	{
+		kvpWriter writer = { .fd = fd };
+		lseek(fd, (off_t)_logSize, SEEK_SET);
+		encodeRecords(true, &writer);
+		flushWriter(&writer);
+		close(fd);
+
+		if (!writer.failed)
+		{
+			_logSize += writer.written;
+			bRet = true;
+		}
+		else if (writer.written > 0)
+		{
+			_logSize = 0;		// part of a record made it, the log has to be rewritten
+		}
+	}
+
 #ifdef SHOW_DEBUG_MSGS
-	Log_Debug(">>> %s\n", __func__);
+	if (bRet == false)
+	{
+		Log_Debug("Error: error appending to mutable storage\n");
+	}
 #endif
 
+	return bRet;
+}
+
+/// <summary>
+///  Rewrites mutable storage with a log holding just the live Key/Value pairs.
+///  Returns 'true' for success, 'false' for failure.
+/// </summary>
+static bool rewriteLog(void)
+{
 	bool bRet = false;
+	_logSize = 0;
 	Storage_DeleteMutableFile();	// delete original file before writing new file
 	int fd = Storage_OpenMutableFile();
 	if (fd != -1)
 	{
-		char *data = cJSON_Print(cJson);
-		size_t dataLen = strlen(data);
-		lseek(fd, 0, SEEK_SET);
-		ssize_t numWritten=write(fd, data, dataLen);
+		kvpWriter writer = { .fd = fd };
+		encodeRecords(false, &writer);
+		flushWriter(&writer);
 		close(fd);
-		free(data);
 
-		if (numWritten == (ssize_t)dataLen)
+		if (!writer.failed)
+		{
+			_logSize = writer.written;
 			bRet = true;
+		}
 	}
 
 #ifdef SHOW_DEBUG_MSGS
 	if (bRet == false)
 	{
-		Log_Debug("Error: error writing json to mutable storage\n");
+		Log_Debug("Error: error rewriting mutable storage\n");
 	}
 #endif
 
 	return bRet;
 }
+
+/// <summary>
+///  Writes the cache after the flush delay, restarting the delay if a write is already due.
+///  Without an event loop, writes it straight away.
+/// </summary>
+static void scheduleFlush(void)
+{
+	if (_flushTimerFd == -1)
+	{
+		CommitProfileStrings();
+		return;
+	}
+
+	struct itimerspec delay = { .it_value = { .tv_sec = _flushDelayMs / 1000, .tv_nsec = (_flushDelayMs % 1000) * 1000000 } };
+	if (_flushDelayMs == 0)
+		delay.it_value.tv_nsec = 1;		// a zero it_value would disarm the timer
+	timerfd_settime(_flushTimerFd, 0, &delay, NULL);
+}
+
+static void flushTimerEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) == -1)
+		return;
+
+	if (!CommitProfileStrings())
+	{
+		Log_Debug("Error: writing mutable storage, will retry\n");
+		scheduleFlush();
+	}
+}
+
+/// <summary>
+///  Reads the contents of mutable storage
+///  returns -1 for error or length of string on success
+///  caller is responsible for releasing allocated memory
+/// </summary>
+ssize_t getStorageString(char **contents)
+{
+#ifdef SHOW_DEBUG_MSGS
+	Log_Debug(">>> %s\n", __func__);
+#endif
+
+	int fd = Storage_OpenMutableFile();
+	ssize_t ret = -1;
+	if (fd != -1)
+	{
+		off_t length = lseek(fd, 0, SEEK_END);
+		*contents = (char*)malloc((size_t)length + 1);
+
+#ifdef SHOW_DEBUG_MSGS
+		Log_Debug("malloc %s, 0x%lx\n", __func__, contents);
+#endif
+
+		memset(*contents, 0x00, (size_t)length + 1);
+		lseek(fd, 0, SEEK_SET);
+		ret = read(fd, *contents, (size_t)length);
+		close(fd);
+	}
+
+	return ret;
+}
@@ -10,7 +10,52 @@
 #include <stdlib.h>
 
 #include "applibs/log.h"
+#include <applibs/eventloop.h>
 
 bool WriteProfileString(char *keyName, char *value);
 ssize_t GetProfileString(char *keyName, char *returnedString, size_t Size);
 bool DeleteProfileString(char *keyName);
+
+bool WriteProfileInt(char *keyName, int32_t value);
+bool GetProfileInt(char *keyName, int32_t *value);
+bool WriteProfileFloat(char *keyName, float value);
+bool GetProfileFloat(char *keyName, float *value);
+bool WriteProfileBlob(char *keyName, const void *data, size_t size);
+ssize_t GetProfileBlob(char *keyName, void *buffer, size_t size);
+
+typedef enum
+{
+	ProfileValue_String,
+	ProfileValue_Int,
+	ProfileValue_Float,
+	ProfileValue_Blob
+} ProfileValueType;
+
+// A Value for SetProfileValues/GetProfileValues. For a string or blob, buffer points at the
+// data (a get fills it, size is the buffer size; a set string's size is ignored).
+typedef struct
+{
+	ProfileValueType type;
+	union
+	{
+		int32_t intValue;
+		float floatValue;
+		struct
+		{
+			void *data;
+			size_t size;
+		} buffer;
+	} value;
+	ssize_t length;		// set by GetProfileValues, bytes returned or -1 if missing
+} ProfileValue;
+
+// Set/get several Key/Value pairs at once, a batch of changes is written to storage together.
+bool SetProfileValues(char *keyNames[], size_t count, const ProfileValue values[]);
+ssize_t GetProfileValues(char *keyNames[], size_t count, ProfileValue values[]);
+
+// Mutable storage (a log of changes) is replayed once and kept in memory, changes are written back with
+// CommitProfileStrings, or after a delay once InitProfileStrings has been called;
+// until then, and without it, every change is written straight away.
+bool InitProfileStrings(EventLoop *eventLoop, uint32_t flushDelayMs);
+bool CommitProfileStrings(void);
+void CloseProfileStrings(void);
@@ -0,0 +1,255 @@
+#include <errno.h>
+#include <ifaddrs.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <netpacket/packet.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+
+#include "addressMonitor.h"
+
+static char monitoredInterface[IF_NAMESIZE];
+static AddressMonitor_Callback changeCallback = NULL;
+static void *changeContext = NULL;
+
+static int eventFd = -1;    // the netlink socket, or the fallback timer
+static bool usingNetlink = false;
+static EventLoop *monitorLoop = NULL;
+static EventRegistration *eventReg = NULL;
+
+static AddressMonitor_Address addresses[ADDRESS_MONITOR_MAX_ADDRESSES];
+static size_t addressCount = 0;
+// where the IPv4 and MAC addresses are in the table, -1 if not there
+static int ipv4Index = -1;
+static int macIndex = -1;
+
+static bool SameAddress(const AddressMonitor_Address *a, const AddressMonitor_Address *b)
+{
+    if (a->family != b->family) {
+        return false;
+    }
+    if (a->family == AF_INET) {
+        return a->ipv4.s_addr == b->ipv4.s_addr;
+    }
+    return memcmp(a->mac, b->mac, sizeof(a->mac)) == 0;
+}
+
+static bool TableHas(const AddressMonitor_Address *table, size_t count,
+                     const AddressMonitor_Address *address)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (SameAddress(&table[i], address)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+///     Enumerates the interface's addresses, replaces the cache and calls back for each address
+///     added or removed since the last time.
+/// </summary>
+static int Refresh(void)
+{
+    struct ifaddrs *addr_list;
+    if (getifaddrs(&addr_list) != 0) {
+        Log_Debug("ERROR: getifaddrs: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    AddressMonitor_Address current[ADDRESS_MONITOR_MAX_ADDRESSES];
+    size_t currentCount = 0;
+
+    for (struct ifaddrs *it = addr_list; it != NULL; it = it->ifa_next) {
+        if ((it->ifa_addr == NULL) || (strcmp(it->ifa_name, monitoredInterface) != 0) ||
+            (currentCount == ADDRESS_MONITOR_MAX_ADDRESSES)) {
+            continue;
+        }
+
+        AddressMonitor_Address address = {.family = it->ifa_addr->sa_family};
+        if (address.family == AF_INET) {
+            address.ipv4 = ((struct sockaddr_in *)it->ifa_addr)->sin_addr;
+        } else if (address.family == AF_PACKET) {
+            memcpy(address.mac, ((struct sockaddr_ll *)it->ifa_addr)->sll_addr, sizeof(address.mac));
+        } else {
+            continue;
+        }
+
+        if (!TableHas(current, currentCount, &address)) {
+            current[currentCount++] = address;
+        }
+    }
+
+    freeifaddrs(addr_list);
+
+    for (size_t i = 0; i < addressCount; i++) {
+        if (!TableHas(current, currentCount, &addresses[i]) && (changeCallback != NULL)) {
+            changeCallback(AddressMonitor_Removed, &addresses[i], changeContext);
+        }
+    }
+    for (size_t i = 0; i < currentCount; i++) {
+        if (!TableHas(addresses, addressCount, &current[i]) && (changeCallback != NULL)) {
+            changeCallback(AddressMonitor_Added, &current[i], changeContext);
+        }
+    }
+
+    memcpy(addresses, current, currentCount * sizeof(current[0]));
+    addressCount = currentCount;
+
+    ipv4Index = -1;
+    macIndex = -1;
+    for (size_t i = 0; i < addressCount; i++) {
+        if ((addresses[i].family == AF_INET) && (ipv4Index < 0)) {
+            ipv4Index = (int)i;
+        } else if ((addresses[i].family == AF_PACKET) && (macIndex < 0)) {
+            macIndex = (int)i;
+        }
+    }
+
+    return 0;
+}
+
+static void EventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    if (usingNetlink) {
+        // the messages only say something changed, a burst of them is one refresh
+        uint8_t buffer[4096];
+        bool changed = false;
+        ssize_t length;
+        while ((length = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            for (struct nlmsghdr *msg = (struct nlmsghdr *)buffer; NLMSG_OK(msg, (size_t)length);
+                 msg = NLMSG_NEXT(msg, length)) {
+                if ((msg->nlmsg_type == RTM_NEWADDR) || (msg->nlmsg_type == RTM_DELADDR) ||
+                    (msg->nlmsg_type == RTM_NEWLINK) || (msg->nlmsg_type == RTM_DELLINK)) {
+                    changed = true;
+                }
+            }
+        }
+        if (errno == ENOBUFS) {
+            // the socket overflowed and notifications were lost, only a refresh is safe
+            changed = true;
+        }
+        if (!changed) {
+            return;
+        }
+    } else {
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof(expirations)) < 0) {
+            return;
+        }
+    }
+
+    Refresh();
+}
+
+static int OpenNetlink(void)
+{
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct sockaddr_nl local = {.nl_family = AF_NETLINK,
+                                .nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR};
+    if (bind(fd, (struct sockaddr *)&local, sizeof(local)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int OpenPollTimer(void)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct itimerspec period = {.it_interval = {.tv_sec = ADDRESS_MONITOR_POLL_SECONDS},
+                                .it_value = {.tv_sec = ADDRESS_MONITOR_POLL_SECONDS}};
+    if (timerfd_settime(fd, 0, &period, NULL) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int AddressMonitor_Start(EventLoop *eventLoop, const char *interface,
+                         AddressMonitor_Callback callback, void *context)
+{
+    strncpy(monitoredInterface, interface, sizeof(monitoredInterface) - 1);
+    monitoredInterface[sizeof(monitoredInterface) - 1] = '\0';
+    changeCallback = callback;
+    changeContext = context;
+    addressCount = 0;
+
+    // subscribe before the first enumeration, so a change in between isn't missed
+    eventFd = OpenNetlink();
+    usingNetlink = eventFd >= 0;
+    if (!usingNetlink) {
+        Log_Debug("INFO: No netlink socket (%d, %s), checking %s every %d second(s)\n", errno,
+                  strerror(errno), monitoredInterface, ADDRESS_MONITOR_POLL_SECONDS);
+        eventFd = OpenPollTimer();
+        if (eventFd < 0) {
+            Log_Debug("ERROR: timerfd_create: %d (%s)\n", errno, strerror(errno));
+            return -1;
+        }
+    }
+
+    monitorLoop = eventLoop;
+    eventReg = EventLoop_RegisterIo(eventLoop, eventFd, EventLoop_Input, EventHandler, NULL);
+    if (eventReg == NULL) {
+        close(eventFd);
+        eventFd = -1;
+        return -1;
+    }
+
+    return Refresh();
+}
+
+void AddressMonitor_Stop(void)
+{
+    if (eventReg != NULL) {
+        EventLoop_UnregisterIo(monitorLoop, eventReg);
+        eventReg = NULL;
+    }
+    if (eventFd >= 0) {
+        close(eventFd);
+        eventFd = -1;
+    }
+
+    addressCount = 0;
+    ipv4Index = -1;
+    macIndex = -1;
+}
+
+bool AddressMonitor_GetIpv4(struct in_addr *address)
+{
+    if (ipv4Index < 0) {
+        return false;
+    }
+    *address = addresses[ipv4Index].ipv4;
+    return true;
+}
+
+bool AddressMonitor_GetMac(uint8_t mac[6])
+{
+    if (macIndex < 0) {
+        return false;
+    }
+    memcpy(mac, addresses[macIndex].mac, sizeof(addresses[macIndex].mac));
+    return true;
+}
+
+size_t AddressMonitor_GetAddresses(const AddressMonitor_Address **table)
+{
+    *table = addresses;
+    return addressCount;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+// Keeps a cached table of the MAC and IPv4 addresses of one network interface, and calls back
+// only when an address is added to or removed from it.
+//
+// The monitor listens on a NETLINK_ROUTE socket for link and IPv4 address changes and
+// re-enumerates the interface only when one arrives. Where the OS doesn't give the app a netlink
+// socket it falls back to re-enumerating on a timer, the callbacks are the same either way.
+// The Get functions read the cache, they never enumerate.
+
+#define ADDRESS_MONITOR_MAX_ADDRESSES 8
+#define ADDRESS_MONITOR_POLL_SECONDS 1
+
+typedef enum {
+    AddressMonitor_Added,
+    AddressMonitor_Removed
+} AddressMonitor_Event;
+
+typedef struct {
+    // AF_INET or AF_PACKET
+    int family;
+    union {
+        struct in_addr ipv4;
+        uint8_t mac[6];
+    };
+} AddressMonitor_Address;
+
+typedef void (*AddressMonitor_Callback)(AddressMonitor_Event event,
+                                        const AddressMonitor_Address *address, void *context);
+
+/// <summary>
+///     Fills the cache for the interface, calling back Added for each address it already has,
+///     then watches for changes on the event loop.
+/// </summary>
+/// <returns>0 on success, -1 on failure</returns>
+int AddressMonitor_Start(EventLoop *eventLoop, const char *interface,
+                         AddressMonitor_Callback callback, void *context);
+
+/// <summary>
+///     Stops watching and empties the cache.
+/// </summary>
+void AddressMonitor_Stop(void);
+
+/// <summary>
+///     The cached IPv4 address of the interface, false if it has none.
+/// </summary>
+bool AddressMonitor_GetIpv4(struct in_addr *address);
+
+/// <summary>
+///     The cached MAC address of the interface, false if it has none.
+/// </summary>
+bool AddressMonitor_GetMac(uint8_t mac[6]);
+
+/// <summary>
+///     The whole cached table, returns the number of addresses in it.
+/// </summary>
+size_t AddressMonitor_GetAddresses(const AddressMonitor_Address **addresses);
@@ -1,80 +1,91 @@
-﻿// This minimal Azure Sphere app prints the MAC and IP address of the network interface.
+﻿// This minimal Azure Sphere app prints the MAC and IP address of the network interface, then
+// prints each address the interface gains or loses while it runs.
 //
 // It uses the API for the following Azure Sphere application libraries:
+// - eventloop (system invokes handlers for address change notifications)
 // - log (displays messages in the Device Output window during debugging)
 
 #include <arpa/inet.h>
 #include <stdbool.h>
 #include <errno.h>
-#include <ifaddrs.h>
-#include <netpacket/packet.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
-#include <time.h>
 
+#include <applibs/eventloop.h>
 #include <applibs/log.h>
 
-static void PrintNetworkInterfaceAddresses(const char* interface);
+#include "addressMonitor.h"
+
+static void AddressChanged(AddressMonitor_Event event, const AddressMonitor_Address *address,
+                           void *context);
+static void TerminationHandler(int signalNumber);
 
 // Network interface.
 static const char networkInterface[] = "wlan0";
 static const size_t maxMacAddrLength = 18;
 
+static volatile sig_atomic_t exitRequested = false;
+
 /// <summary>
-///     Prints the MAC and IP address of the network interface.
-/// <param name="interface">The interface for which to print the network address.</param>
+///     Prints the MAC or IP address the network interface gained or lost; the address monitor
+///     calls back only when its cached table changes.
 /// </summary>
-static void PrintNetworkInterfaceAddresses(const char *interface)
+static void AddressChanged(AddressMonitor_Event event, const AddressMonitor_Address *address,
+                           void *context)
 {
-    struct ifaddrs *addr_list;
-    struct ifaddrs *it;
-    int n;
+    const char *change = event == AddressMonitor_Added ? "" : " removed";
 
-    //  Get a linked list of network interfaces.
-    if (getifaddrs(&addr_list) != 0) {
-        Log_Debug("ERROR: getifaddrs: %d (%s)\n", errno, strerror(errno));
+    if (address->family == AF_INET) {
+        Log_Debug("%s IP address%s: %s \n", networkInterface, change, inet_ntoa(address->ipv4));
     } else {
-        for (it = addr_list, n = 0; it != NULL; it = it->ifa_next, ++n) {
-            if (it->ifa_addr == NULL) {
-                continue;
-            }
-
-            if (strncmp(it->ifa_name, interface, strlen(interface)) == 0) {
-                if (it->ifa_addr->sa_family == AF_INET) {
-                    // Get the internet address.
-                    struct sockaddr_in *addr = (struct sockaddr_in *)it->ifa_addr;
-                    char *ip_address = inet_ntoa(addr->sin_addr);
-
-                    Log_Debug("%s IP address: %s \n", interface, ip_address);
-                } else if (it->ifa_addr->sa_family == AF_PACKET) {
-                    char mac_string[maxMacAddrLength];
-
-                    // Get the physical-layer address.
-                    struct sockaddr_ll *mac_addr = (struct sockaddr_ll *)it->ifa_addr;
-                    unsigned char *mac = mac_addr->sll_addr;
-
-                    // Format the address.
-                    snprintf(mac_string, maxMacAddrLength, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0],
-                            mac[1], mac[2], mac[3], mac[4], mac[5]);
-
-                    Log_Debug("%s MAC: %s \n", interface, mac_string);
-                }
-            }
-        }
+        char mac_string[maxMacAddrLength];
+        const uint8_t *mac = address->mac;
+
+        // Format the address.
+        snprintf(mac_string, maxMacAddrLength, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1],
+                 mac[2], mac[3], mac[4], mac[5]);
+
+        Log_Debug("%s MAC%s: %s \n", networkInterface, change, mac_string);
     }
+}
 
-    freeifaddrs(addr_list);
+/// <summary>
+///     Signal handler for termination requests. This handler must be async-signal-safe.
+/// </summary>
+static void TerminationHandler(int signalNumber)
+{
+    exitRequested = true;
 }
 
 int main(void)
 {
     Log_Debug("Starting Print network Address application...\n");
 
-    PrintNetworkInterfaceAddresses(networkInterface);
+    struct sigaction action = {.sa_handler = TerminationHandler};
+    sigaction(SIGTERM, &action, NULL);
 
-    const struct timespec sleepTime = { .tv_sec = 1, .tv_nsec = 0 };
-    while (true) {
-        nanosleep(&sleepTime, NULL);
+    EventLoop *eventLoop = EventLoop_Create();
+    if (eventLoop == NULL) {
+        Log_Debug("ERROR: Could not create event loop.\n");
+        return -1;
     }
-}
\ No newline at end of file
+
+    // the current addresses are printed as they're cached, then only changes
+    if (AddressMonitor_Start(eventLoop, networkInterface, AddressChanged, NULL) != 0) {
+        EventLoop_Close(eventLoop);
+        return -1;
+    }
+
+    while (!exitRequested) {
+        EventLoop_Run_Result result = EventLoop_Run(eventLoop, -1, true);
+        if (result == EventLoop_Run_Failed && errno != EINTR) {
+            break;
+        }
+    }
+
+    AddressMonitor_Stop();
+    EventLoop_Close(eventLoop);
+
+    return 0;
+}
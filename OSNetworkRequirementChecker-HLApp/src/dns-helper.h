@@ -26,6 +26,12 @@ typedef struct {
     char *alias;
 } ServiceInstanceDetails;
 
+/// <summary>The required endpoints, resolved by the DNS test</summary>
+extern const char *ServerList[];
+extern const unsigned int ServerListLen;
+/// <summary>The network interface whose connection status is checked</summary>
+extern const char *NetworkInterface;
+
 /// <summary>
 /// Send a service discovery query
 /// </summary>
@@ -6,6 +6,9 @@
 //  (https://docs.microsoft.com/en-us/azure-sphere/network/ports-protocols-domains).
 //  2. NTP time sync with known time servers
 //
+// The default probe test runs all of the DNS, NTP and TCP checks concurrently; the sequential
+// DNS and custom NTP tests above are built with -DSEQUENTIAL_DIAGNOSTICS=ON.
+//
 // It uses the APIs in the following Azure Sphere application libraries:
 // - log (displays messages in the Device Output window during debugging)
 // - networking (get network interface connection status)
@@ -13,6 +16,7 @@
 
 #include "dns-helper.h"
 #include "ntp-helper.h"
+#include "probe-engine.h"
 
 void TerminationHandler(int signalNumber)
 {
@@ -22,6 +26,7 @@ void TerminationHandler(int signalNumber)
 
 int main(void)
 {
+#ifdef SEQUENTIAL_DIAGNOSTICS
     bool success = RunDNSDiagnostic();
     success &= RunNTPDiagnostic();
 
@@ -30,6 +35,13 @@ int main(void)
 
     DNSResolverCleanUp();
     CustomNTPCleanUp();
+#else
+    bool success = RunProbeDiagnostic();
+
+    PrintProbeSummary();
+
+    ProbeCleanUp();
+#endif
 
     if (success) {
         Log_Debug("PASS: Diagnostic App Finished Successfully.\n");
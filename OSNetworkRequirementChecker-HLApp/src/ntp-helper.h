@@ -4,6 +4,10 @@
 #pragma once
 #include "common.h"
 
+/// <summary>The time servers tested</summary>
+extern const char *NTPServerList[];
+extern const unsigned int NTPServerListLen;
+
 /// <summary>
 ///     Set up event handlers.
 /// </summary>
@@ -0,0 +1,393 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "probe-engine.h"
+#include "dns-helper.h"
+#include "ntp-helper.h"
+#include <fcntl.h>
+#include <resolv.h>
+#include <time.h>
+
+#define DNS_SERVER_PORT 53
+#define NTP_SERVER_PORT 123
+#define TLS_PORT 443
+#define QUERY_BUF_SIZE 512u
+#define ANSWER_BUF_SIZE 2048u
+#define NTP_PACKET_SIZE 48
+#define NCSI_RETRY_MAX 5
+
+// Per-probe deadlines, in milliseconds
+#define DNS_PROBE_TIMEOUT_MS 5000
+#define NTP_PROBE_TIMEOUT_MS 5000
+#define TCP_PROBE_TIMEOUT_MS 5000
+
+// How often the deadlines and the network status are checked
+#define PROBE_TICK_MS 100
+
+// DNS probes first, one per endpoint, then their TCP probes, then the NTP probes
+static Probe *probes = NULL;
+static unsigned int probeCount = 0;
+static unsigned int probesPending = 0;
+
+static EventLoop *probeEventLoop = NULL;
+static EventLoopTimer *probeTimer = NULL;
+static bool probesStarted = false;
+static int networkRetryCounter = 0;
+
+static void StartTcpProbe(Probe *probe, struct in_addr address);
+
+static long ElapsedMs(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static void CloseProbe(Probe *probe)
+{
+    if (probe->registration != NULL) {
+        EventLoop_UnregisterIo(probeEventLoop, probe->registration);
+        probe->registration = NULL;
+    }
+    if (probe->fd != -1) {
+        CloseFdAndPrintError(probe->fd, probe->target);
+        probe->fd = -1;
+    }
+}
+
+static void FinishProbe(Probe *probe, ProbeState state, int error)
+{
+    if (probe->state != ProbeState_Pending) {
+        return;
+    }
+    probe->latencyMs = ElapsedMs(&probe->start);
+    probe->state = state;
+    probe->error = error;
+    CloseProbe(probe);
+    --probesPending;
+
+    // Resolved endpoints are then checked for reachability
+    if (probe->type == ProbeType_Dns) {
+        Probe *tcpProbe = &probes[(unsigned int)(probe - probes) + ServerListLen];
+        if (state == ProbeState_Passed) {
+            StartTcpProbe(tcpProbe, probe->address);
+        } else {
+            tcpProbe->state = ProbeState_Failed;
+            tcpProbe->error = EHOSTUNREACH;
+        }
+    }
+
+    if (probesPending == 0) {
+        exitCode = ExitCode_Test_Finish;
+    }
+}
+
+/// <summary>
+///     Open the probe's non-blocking socket and register its handler for the given events.
+/// </summary>
+/// <returns>0 if succeeded, -1 if an error occurred (the probe has then failed).</returns>
+static int OpenProbe(Probe *probe, int socketType, EventLoop_IoEvents events,
+                     EventLoopIoCallback *handler, long timeoutMs)
+{
+    clock_gettime(CLOCK_MONOTONIC, &probe->start);
+    probe->deadline = probe->start;
+    probe->deadline.tv_sec += timeoutMs / 1000;
+    probe->deadline.tv_nsec += (timeoutMs % 1000) * 1000000;
+    if (probe->deadline.tv_nsec >= 1000000000) {
+        probe->deadline.tv_sec += 1;
+        probe->deadline.tv_nsec -= 1000000000;
+    }
+    probe->state = ProbeState_Pending;
+    ++probesPending;
+
+    probe->fd = socket(AF_INET, socketType | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (probe->fd == -1) {
+        Log_Debug("ERROR: Failed to create socket for %s: %s (%d)\n", probe->target,
+                  strerror(errno), errno);
+        FinishProbe(probe, ProbeState_Failed, errno);
+        return -1;
+    }
+
+    probe->registration = EventLoop_RegisterIo(probeEventLoop, probe->fd, events, handler, probe);
+    if (probe->registration == NULL) {
+        Log_Debug("ERROR: Failed to register socket for %s: %s (%d)\n", probe->target,
+                  strerror(errno), errno);
+        FinishProbe(probe, ProbeState_Failed, errno);
+        return -1;
+    }
+    return 0;
+}
+
+static void HandleDnsResponse(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    Probe *probe = context;
+    unsigned char answerBuf[ANSWER_BUF_SIZE];
+    ns_msg msg;
+    ns_rr rr;
+
+    ssize_t len = recv(fd, answerBuf, sizeof(answerBuf), 0);
+    if (len == -1) {
+        if (errno != EAGAIN) {
+            FinishProbe(probe, ProbeState_Failed, errno);
+        }
+        return;
+    }
+    if (ns_initparse(answerBuf, (int)len, &msg) != 0) {
+        FinishProbe(probe, ProbeState_Failed, EBADMSG);
+        return;
+    }
+
+    // The resolver follows CNAME chains, the answer ends with the A records
+    int count = ns_msg_count(msg, ns_s_an);
+    for (int i = 0; i < count; ++i) {
+        if (ns_parserr(&msg, ns_s_an, i, &rr) == 0 && ns_rr_type(rr) == ns_t_a &&
+            ns_rr_rdlen(rr) == sizeof(probe->address)) {
+            memcpy(&probe->address, ns_rr_rdata(rr), sizeof(probe->address));
+            FinishProbe(probe, ProbeState_Passed, 0);
+            return;
+        }
+    }
+    FinishProbe(probe, ProbeState_Failed, ENOENT);
+}
+
+static void StartDnsProbe(Probe *probe)
+{
+    unsigned char queryBuf[QUERY_BUF_SIZE];
+
+    if (OpenProbe(probe, SOCK_DGRAM, EventLoop_Input, HandleDnsResponse, DNS_PROBE_TIMEOUT_MS) !=
+        0) {
+        return;
+    }
+
+    int messageSize = res_mkquery(ns_o_query, probe->target, ns_c_in, ns_t_a, NULL, 0, NULL,
+                                  queryBuf, sizeof(queryBuf));
+    if (messageSize <= 0) {
+        Log_Debug("ERROR: res_mkquery: %s (%d)\n", strerror(errno), errno);
+        FinishProbe(probe, ProbeState_Failed, errno);
+        return;
+    }
+
+    // The device's resolver listens on the loopback address
+    struct sockaddr_in si = {.sin_family = AF_INET,
+                             .sin_port = htons(DNS_SERVER_PORT),
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    if (sendto(probe->fd, queryBuf, (size_t)messageSize, 0, (struct sockaddr *)&si, sizeof(si)) ==
+        -1) {
+        Log_Debug("ERROR: sendto: %s (%d)\n", strerror(errno), errno);
+        FinishProbe(probe, ProbeState_Failed, errno);
+    }
+}
+
+static void HandleNtpResponse(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    Probe *probe = context;
+    uint8_t packet[NTP_PACKET_SIZE];
+
+    ssize_t len = recv(fd, packet, sizeof(packet), 0);
+    if (len == -1) {
+        if (errno != EAGAIN) {
+            FinishProbe(probe, ProbeState_Failed, errno);
+        }
+        return;
+    }
+
+    // A server reply (mode 4) from a synchronised server (stratum 1 to 15)
+    if (len < NTP_PACKET_SIZE || (packet[0] & 0x07) != 4 || packet[1] == 0 || packet[1] > 15) {
+        FinishProbe(probe, ProbeState_Failed, EBADMSG);
+        return;
+    }
+    probe->stratum = packet[1];
+    FinishProbe(probe, ProbeState_Passed, 0);
+}
+
+static void StartNtpProbe(Probe *probe)
+{
+    // Version 4, client mode, the rest may be zero for a one-off query
+    uint8_t packet[NTP_PACKET_SIZE] = {(4 << 3) | 3};
+
+    if (OpenProbe(probe, SOCK_DGRAM, EventLoop_Input, HandleNtpResponse, NTP_PROBE_TIMEOUT_MS) !=
+        0) {
+        return;
+    }
+
+    struct sockaddr_in si = {.sin_family = AF_INET, .sin_port = htons(NTP_SERVER_PORT)};
+    if (inet_pton(AF_INET, probe->target, &si.sin_addr) != 1) {
+        FinishProbe(probe, ProbeState_Failed, EINVAL);
+        return;
+    }
+    if (connect(probe->fd, (struct sockaddr *)&si, sizeof(si)) == -1 ||
+        send(probe->fd, packet, sizeof(packet), 0) == -1) {
+        Log_Debug("ERROR: NTP query to %s: %s (%d)\n", probe->target, strerror(errno), errno);
+        FinishProbe(probe, ProbeState_Failed, errno);
+    }
+}
+
+static void HandleTcpConnected(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    Probe *probe = context;
+    int error = 0;
+    socklen_t errorLength = sizeof(error);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) == -1) {
+        error = errno;
+    }
+    FinishProbe(probe, error == 0 ? ProbeState_Passed : ProbeState_Failed, error);
+}
+
+static void StartTcpProbe(Probe *probe, struct in_addr address)
+{
+    probe->address = address;
+    if (OpenProbe(probe, SOCK_STREAM, EventLoop_Output, HandleTcpConnected,
+                  TCP_PROBE_TIMEOUT_MS) != 0) {
+        return;
+    }
+
+    struct sockaddr_in si = {.sin_family = AF_INET, .sin_port = htons(TLS_PORT), .sin_addr = address};
+    if (connect(probe->fd, (struct sockaddr *)&si, sizeof(si)) == -1 && errno != EINPROGRESS) {
+        FinishProbe(probe, ProbeState_Failed, errno);
+    }
+}
+
+static void StartProbes(void)
+{
+    // Held while starting, so that probes failing right away don't finish the test early
+    ++probesPending;
+    for (unsigned int i = 0; i < ServerListLen; ++i) {
+        StartDnsProbe(&probes[i]);
+    }
+    for (unsigned int i = 2 * ServerListLen; i < probeCount; ++i) {
+        StartNtpProbe(&probes[i]);
+    }
+    if (--probesPending == 0) {
+        exitCode = ExitCode_Test_Finish;
+    }
+}
+
+static void ProbeTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        exitCode = ExitCode_ConnectionTimer_Consume;
+        return;
+    }
+
+    // Start once the network is ready, or anyway after a few seconds as the DNS test does
+    if (!probesStarted) {
+        bool isConnectionReady = false;
+        if (IsConnectionReady(NetworkInterface, &isConnectionReady) != 0) {
+            exitCode = ExitCode_ConnectionTimer_ConnectionReady;
+            return;
+        }
+        if (isConnectionReady || (networkRetryCounter++) >= NCSI_RETRY_MAX * 1000 / PROBE_TICK_MS) {
+            probesStarted = true;
+            Log_Debug("EVENT: Starting %u probes\n", probeCount);
+            StartProbes();
+        }
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (unsigned int i = 0; i < probeCount; ++i) {
+        Probe *probe = &probes[i];
+        if (probe->state == ProbeState_Pending &&
+            (now.tv_sec > probe->deadline.tv_sec ||
+             (now.tv_sec == probe->deadline.tv_sec && now.tv_nsec >= probe->deadline.tv_nsec))) {
+            FinishProbe(probe, ProbeState_TimedOut, ETIMEDOUT);
+        }
+    }
+}
+
+bool RunProbeDiagnostic(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = TerminationHandler;
+    sigaction(SIGTERM, &action, NULL);
+
+    exitCode = ExitCode_Success;
+    Log_Debug("INFO: Starting probe test\n");
+
+    probeCount = 2 * ServerListLen + NTPServerListLen;
+    probes = calloc(probeCount, sizeof(Probe));
+    if (probes == NULL) {
+        return false;
+    }
+    for (unsigned int i = 0; i < probeCount; ++i) {
+        probes[i].fd = -1;
+        if (i < ServerListLen) {
+            probes[i].type = ProbeType_Dns;
+            probes[i].target = ServerList[i];
+        } else if (i < 2 * ServerListLen) {
+            probes[i].type = ProbeType_Tcp;
+            probes[i].target = ServerList[i - ServerListLen];
+        } else {
+            probes[i].type = ProbeType_Ntp;
+            probes[i].target = NTPServerList[i - 2 * ServerListLen];
+        }
+    }
+
+    probeEventLoop = EventLoop_Create();
+    if (probeEventLoop == NULL) {
+        Log_Debug("ERROR: Could not create event loop.\n");
+        return false;
+    }
+    static const struct timespec tick = {.tv_sec = 0, .tv_nsec = PROBE_TICK_MS * 1000000};
+    probeTimer = CreateEventLoopPeriodicTimer(probeEventLoop, &ProbeTimerEventHandler, &tick);
+    if (probeTimer == NULL) {
+        return false;
+    }
+
+    while (exitCode == ExitCode_Success) {
+        EventLoop_Run_Result result = EventLoop_Run(probeEventLoop, -1, true);
+        // Continue if interrupted by signal, e.g. due to breakpoint being set.
+        if (result == EventLoop_Run_Failed && errno != EINTR) {
+            exitCode = ExitCode_Main_EventLoopFail;
+        }
+    }
+
+    for (unsigned int i = 0; i < probeCount; ++i) {
+        if (probes[i].state != ProbeState_Passed) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PrintProbeSummary(void)
+{
+    static const char *typeNames[] = {"DNS", "NTP", "TCP"};
+    static const char *stateNames[] = {"not run", "pending", "OK", "FAILED", "TIMED OUT"};
+
+    Log_Debug("\n\nProbe Summary:\n");
+    for (unsigned int i = 0; i < probeCount; ++i) {
+        Probe *probe = &probes[i];
+        Log_Debug("\t%s %-45s %-9s", typeNames[probe->type], probe->target,
+                  stateNames[probe->state]);
+        if (probe->state == ProbeState_Passed || probe->state == ProbeState_Failed ||
+            probe->state == ProbeState_TimedOut) {
+            Log_Debug(" %5ld ms", probe->latencyMs);
+        }
+        if (probe->state == ProbeState_Passed && probe->type != ProbeType_Ntp) {
+            Log_Debug("  %s", inet_ntoa(probe->address));
+        } else if (probe->state == ProbeState_Passed) {
+            Log_Debug("  stratum %u", probe->stratum);
+        } else if (probe->error != 0) {
+            Log_Debug("  %s", strerror(probe->error));
+        }
+        Log_Debug("\n");
+    }
+}
+
+void ProbeCleanUp(void)
+{
+    for (unsigned int i = 0; i < probeCount; ++i) {
+        CloseProbe(&probes[i]);
+    }
+    free(probes);
+    probes = NULL;
+    probeCount = 0;
+    probesPending = 0;
+
+    DisposeEventLoopTimer(probeTimer);
+    EventLoop_Close(probeEventLoop);
+}
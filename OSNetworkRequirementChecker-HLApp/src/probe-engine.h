@@ -0,0 +1,68 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include "common.h"
+
+/// <summary>
+/// The kinds of probe: a DNS A query through the device's resolver, an NTP query to a time
+/// server, and a TCP connection to port 443 of the address a DNS probe resolved.
+/// </summary>
+typedef enum {
+    ProbeType_Dns = 0,
+    ProbeType_Ntp = 1,
+    ProbeType_Tcp = 2
+} ProbeType;
+
+typedef enum {
+    ProbeState_NotStarted = 0,
+    ProbeState_Pending = 1,
+    ProbeState_Passed = 2,
+    ProbeState_Failed = 3,
+    ProbeState_TimedOut = 4
+} ProbeState;
+
+/// <summary>
+/// Data structure for a probe and its outcome.
+/// </summary>
+typedef struct {
+    /// <summary>What the probe checks</summary>
+    ProbeType type;
+    /// <summary>Host name (DNS, TCP) or IPv4 address (NTP) probed</summary>
+    const char *target;
+    /// <summary>Where the probe is at, or how it ended</summary>
+    ProbeState state;
+    /// <summary>The probe's socket, -1 when not open</summary>
+    int fd;
+    /// <summary>The socket's registration in the probe event loop</summary>
+    EventRegistration *registration;
+    /// <summary>When the probe started</summary>
+    struct timespec start;
+    /// <summary>When the probe fails if it hasn't completed</summary>
+    struct timespec deadline;
+    /// <summary>Time from start to completion, in milliseconds</summary>
+    long latencyMs;
+    /// <summary>Address resolved by a DNS probe, connected to by a TCP probe</summary>
+    struct in_addr address;
+    /// <summary>Stratum of the server answering an NTP probe</summary>
+    uint8_t stratum;
+    /// <summary>errno of a failed probe, 0 otherwise</summary>
+    int error;
+} Probe;
+
+/// <summary>
+///     Run the DNS, NTP and TCP probes against all the required endpoints concurrently,
+///     each with its own deadline, on a single event loop.
+/// </summary>
+/// <returns>true if all the probes passed.</returns>
+bool RunProbeDiagnostic(void);
+
+/// <summary>
+///     Print each probe's outcome and latency.
+/// </summary>
+void PrintProbeSummary(void);
+
+/// <summary>
+///     Clean up the resources previously allocated for the probes.
+/// </summary>
+void ProbeCleanUp(void);
@@ -6,19 +6,37 @@
 #	pragma comment(lib, "Ws2_32.lib")
 #	include <WS2tcpip.h>
 #	include <winsock2.h>
+#	define ERR_IN_PROGRESS		WSAEWOULDBLOCK
+#	define ERR_WOULD_BLOCK		WSAEWOULDBLOCK
+#	define ERR_TIMED_OUT		WSAETIMEDOUT
 #else
 #	include <sys/types.h>
 #	include <sys/socket.h>
+#	include <sys/select.h>
 #   include <unistd.h>
+#	include <fcntl.h>
+#	include <errno.h>
 #	include <netinet/in.h>
 #	include <arpa/inet.h>
 #	include <netdb.h>
+#	define ERR_IN_PROGRESS		EINPROGRESS
+#	define ERR_WOULD_BLOCK		EWOULDBLOCK
+#	define ERR_TIMED_OUT		ETIMEDOUT
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <string.h>
 #include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
 
 const char *const ntpServers[] =
 {
@@ -77,6 +95,9 @@ const t_endpoint endpoints[] =
 #define NTP_PORT_OUT		124				// NTP requests from Azure Sphere are sourced through local port 124
 #define NTP_TIMESTAMP_DELTA 2208988800ull	// 70 years in seconds
 #define SOCKET_TIMEOUT_SEC	10				// The socket timeout for receiving (in seconds)
+#define DEFAULT_REPEAT		5				// Attempts per endpoint in concurrent mode
+#define DEFAULT_THREADS		16				// Worker threads in concurrent mode
+#define ERR_BAD_REPLY		-1				// The NTP server's reply was not a valid server packet
 
 typedef struct
 {
@@ -113,8 +134,26 @@ typedef struct
 
 } ntp_packet;				 // Total: 384 bits or 48 bytes.
 
+typedef enum
+{
+	CHECK_NTP,
+	CHECK_TCP
+} t_check_type;
+
+typedef struct
+{
+	t_check_type type;
+	const char *hostname;
+	int port;
+	std::string address;				// IPv4 address the last attempt resolved to
+	int attempts;
+	std::vector<double> latencies_ms;	// One per successful attempt
+	int last_error;						// Error code of the last failed attempt, 0 if none failed
+} t_check_result;
+
 int query_ntp_server(const char *hostname, int ntp_port, int src_port);
 int resolve_hostname(const char *hostname, int port);
+int run_concurrent_checks(int repeat, int threads, bool csv);
 
 
 int getSocketErrorCode(void)
@@ -336,8 +375,377 @@ int resolve_hostname(const char *hostname, int port)
 	return iRes;
 }
 
+static void close_socket(int sock_fd)
+{
+#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
+	closesocket(sock_fd);
+#else
+	close(sock_fd);
+#endif
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Thread-safe IPv4 name resolution (gethostbyname() returns a shared static buffer)
+static int resolve_ipv4(const char *hostname, struct sockaddr_in *addr)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+
+	struct addrinfo *result = NULL;
+	int iRes = getaddrinfo(hostname, NULL, &hints, &result);
+	if (iRes == 0)
+	{
+		memcpy(addr, result->ai_addr, sizeof(*addr));
+		freeaddrinfo(result);
+	}
+	return iRes;
+}
+
+// NTP requests keep the OS source port, so two requests to the same server would share one
+// address/port 4-tuple: hold the server's lock so that only one of them is outstanding at a time.
+static std::mutex ntp_server_locks_mutex;
+static std::map<uint32_t, std::mutex> ntp_server_locks;
+
+static std::mutex &ntp_server_lock(const struct sockaddr_in *server_addr)
+{
+	std::lock_guard<std::mutex> guard(ntp_server_locks_mutex);
+	return ntp_server_locks[server_addr->sin_addr.s_addr];
+}
+
+// A single NTP request/response, timed from sending the request to receiving the reply
+static int ntp_attempt(const struct sockaddr_in *server_addr, int src_port, double *latency_ms)
+{
+	int iRes = 0;
+
+	ntp_packet packet = { 0 };
+	packet.vn = 4;
+	packet.mode = 3;
+
+	std::lock_guard<std::mutex> server_guard(ntp_server_lock(server_addr));
+
+	int sock_fd = (int)socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock_fd < 0)
+	{
+		return getSocketErrorCode();
+	}
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
+	DWORD timeout = SOCKET_TIMEOUT_SEC * 1000;
+#else
+	struct timeval timeout;
+	timeout.tv_sec = SOCKET_TIMEOUT_SEC;
+	timeout.tv_usec = 0;
+#endif
+	// Workers querying different servers share the source port: each socket is connected to its
+	// server, and requests to the same server are serialized, so every socket has its own 4-tuple.
+	int reuse = 1;
+	struct sockaddr_in client_addr;
+	memset(&client_addr, 0, sizeof(client_addr));
+	client_addr.sin_family = AF_INET;
+	client_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	client_addr.sin_port = htons(src_port);
+
+	if (setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout)) < 0 ||
+		setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse)) < 0 ||
+		bind(sock_fd, (struct sockaddr *)&client_addr, sizeof(client_addr)) < 0 ||
+		connect(sock_fd, (const struct sockaddr *)server_addr, sizeof(*server_addr)) < 0)
+	{
+		iRes = getSocketErrorCode();
+	}
+	else
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (send(sock_fd, (const char *)&packet, sizeof(packet), 0) < 0)
+		{
+			iRes = getSocketErrorCode();
+		}
+		else
+		{
+			int recv_bytes = recv(sock_fd, (char *)&packet, sizeof(packet), 0);
+			if (recv_bytes < 0)
+			{
+				iRes = getSocketErrorCode();
+				if (iRes == ERR_WOULD_BLOCK)
+				{
+					iRes = ERR_TIMED_OUT;
+				}
+			}
+			else if (recv_bytes < (int)sizeof(packet) || packet.mode != 4 || packet.stratum == 0)
+			{
+				iRes = ERR_BAD_REPLY;
+			}
+			else
+			{
+				*latency_ms = elapsed_ms(start);
+			}
+		}
+	}
+
+	close_socket(sock_fd);
+	return iRes;
+}
+
+// A single non-blocking TCP connection, timed from connect() to the handshake completing
+static int tcp_attempt(const struct sockaddr_in *server_addr, double *latency_ms)
+{
+	int iRes = 0;
+
+	int sock_fd = (int)socket(AF_INET, SOCK_STREAM, 0);
+	if (sock_fd < 0)
+	{
+		return getSocketErrorCode();
+	}
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
+	u_long non_blocking = 1;
+	ioctlsocket(sock_fd, FIONBIO, &non_blocking);
+#else
+	fcntl(sock_fd, F_SETFL, fcntl(sock_fd, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if (connect(sock_fd, (const struct sockaddr *)server_addr, sizeof(*server_addr)) < 0)
+	{
+		iRes = getSocketErrorCode();
+		if (iRes == ERR_IN_PROGRESS)
+		{
+			// Wait for the handshake: Windows reports a failed connect() in the except set,
+			// Linux in the write set along with SO_ERROR.
+			fd_set write_fds, except_fds;
+			FD_ZERO(&write_fds);
+			FD_ZERO(&except_fds);
+			FD_SET(sock_fd, &write_fds);
+			FD_SET(sock_fd, &except_fds);
+			struct timeval tv;
+			tv.tv_sec = SOCKET_TIMEOUT_SEC;
+			tv.tv_usec = 0;
+
+			int ready = select(sock_fd + 1, NULL, &write_fds, &except_fds, &tv);
+			if (ready == 0)
+			{
+				iRes = ERR_TIMED_OUT;
+			}
+			else if (ready < 0)
+			{
+				iRes = getSocketErrorCode();
+			}
+			else
+			{
+				int so_error = 0;
+				socklen_t so_error_len = sizeof(so_error);
+				getsockopt(sock_fd, SOL_SOCKET, SO_ERROR, (char *)&so_error, &so_error_len);
+				iRes = so_error;
+			}
+		}
+	}
+
+	if (iRes == 0)
+	{
+		*latency_ms = elapsed_ms(start);
+	}
+
+	close_socket(sock_fd);
+	return iRes;
+}
+
+// Run all of a check's repetitions back to back, so that a server never sees concurrent requests from us
+static void run_check(t_check_result *check, int repeat)
+{
+	for (int i = 0; i < repeat; i++)
+	{
+		struct sockaddr_in server_addr;
+		double latency_ms = 0;
+
+		check->attempts++;
+		int iRes = resolve_ipv4(check->hostname, &server_addr);
+		if (iRes == 0)
+		{
+			char address[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &server_addr.sin_addr, address, sizeof(address));
+			check->address = address;
+
+			server_addr.sin_port = htons(check->port);
+			iRes = (CHECK_NTP == check->type) ? ntp_attempt(&server_addr, NTP_PORT_OUT, &latency_ms) : tcp_attempt(&server_addr, &latency_ms);
+		}
+
+		if (iRes == 0)
+		{
+			check->latencies_ms.push_back(latency_ms);
+		}
+		else
+		{
+			check->last_error = iRes;
+		}
+	}
+}
+
+// Nearest-rank percentile of a sorted, non-empty vector
+static double percentile(const std::vector<double> &sorted, double p)
+{
+	size_t rank = (size_t)(p * sorted.size() + 0.999999);
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void print_results(std::vector<t_check_result> &checks, int repeat, bool csv)
+{
+	if (csv)
+	{
+		printf("type,host,port,address,attempts,successes,min_ms,median_ms,p95_ms,last_error\n");
+	}
+	else
+	{
+		printf("{\"repeat\":%d,\"results\":[\n", repeat);
+	}
+
+	for (size_t i = 0; i < checks.size(); i++)
+	{
+		t_check_result &check = checks[i];
+		std::sort(check.latencies_ms.begin(), check.latencies_ms.end());
+
+		const char *type = (CHECK_NTP == check.type) ? "ntp" : "tcp";
+		char stats[96];
+		if (check.latencies_ms.empty())
+		{
+			sprintf(stats, csv ? ",," : "null,\"median_ms\":null,\"p95_ms\":null");
+		}
+		else
+		{
+			sprintf(stats, csv ? "%.1f,%.1f,%.1f" : "%.1f,\"median_ms\":%.1f,\"p95_ms\":%.1f",
+				check.latencies_ms.front(), percentile(check.latencies_ms, 0.5), percentile(check.latencies_ms, 0.95));
+		}
+
+		if (csv)
+		{
+			printf("%s,%s,%d,%s,%d,%d,%s,%d\n", type, check.hostname, check.port, check.address.c_str(),
+				check.attempts, (int)check.latencies_ms.size(), stats, check.last_error);
+		}
+		else
+		{
+			printf("{\"type\":\"%s\",\"host\":\"%s\",\"port\":%d,\"address\":\"%s\",\"attempts\":%d,\"successes\":%d,"
+				"\"min_ms\":%s,\"last_error\":%d}%s\n", type, check.hostname, check.port, check.address.c_str(),
+				check.attempts, (int)check.latencies_ms.size(), stats, check.last_error, (i + 1 < checks.size()) ? "," : "");
+		}
+	}
+
+	if (!csv)
+	{
+		printf("]}\n");
+	}
+	fflush(stdout);
+}
+
+int run_concurrent_checks(int repeat, int threads, bool csv)
+{
+#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+	{
+		int iRes = getSocketErrorCode();
+		std::cerr << "WSAStartup() failed with error code " << iRes << std::endl;
+		return iRes;
+	}
+#endif
+
+	std::vector<t_check_result> checks;
+	for (int i = 0; *ntpServers[i]; i++)
+	{
+		t_check_result check = { CHECK_NTP, ntpServers[i], NTP_PORT, "", 0, std::vector<double>(), 0 };
+		checks.push_back(check);
+	}
+	for (int i = 0; *endpoints[i].hostname; i++)
+	{
+		if (-1 != endpoints[i].port)
+		{
+			t_check_result check = { CHECK_TCP, endpoints[i].hostname, endpoints[i].port, "", 0, std::vector<double>(), 0 };
+			checks.push_back(check);
+		}
+	}
+
+	// Each worker takes the next unclaimed endpoint until none are left
+	if (threads > (int)checks.size())
+	{
+		threads = (int)checks.size();
+	}
+	std::cerr << "Checking " << checks.size() << " endpoints " << repeat << " times each, on " << threads << " threads..." << std::endl;
+
+	std::atomic<size_t> next_check(0);
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; i++)
+	{
+		workers.push_back(std::thread([&checks, &next_check, repeat]()
+		{
+			for (size_t j = next_check++; j < checks.size(); j = next_check++)
+			{
+				run_check(&checks[j], repeat);
+			}
+		}));
+	}
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+
+	print_results(checks, repeat, csv);
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
+	WSACleanup();
+#endif
+
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
+	bool concurrent = false;
+	bool csv = false;
+	int repeat = DEFAULT_REPEAT;
+	int threads = DEFAULT_THREADS;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (0 == strcmp(argv[i], "--concurrent"))
+		{
+			concurrent = true;
+		}
+		else if (0 == strcmp(argv[i], "--repeat") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+		{
+			repeat = atoi(argv[++i]);
+		}
+		else if (0 == strcmp(argv[i], "--threads") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+		{
+			threads = atoi(argv[++i]);
+		}
+		else if (0 == strcmp(argv[i], "--format") && i + 1 < argc && (0 == strcmp(argv[i + 1], "json") || 0 == strcmp(argv[i + 1], "csv")))
+		{
+			csv = (0 == strcmp(argv[++i], "csv"));
+		}
+		else
+		{
+			std::cerr << "Usage: " << argv[0] << " [--concurrent [--repeat N] [--threads N] [--format json|csv]]" << std::endl;
+			return 1;
+		}
+	}
+
+	if (concurrent)
+	{
+		// Keep stdout machine-readable: only the results go there
+		std::cerr << "Azure Sphere network-checkup utility." << std::endl << std::endl;
+		try
+		{
+			return run_concurrent_checks(repeat, threads, csv);
+		}
+		catch (...)
+		{
+			std::cerr << std::endl << "Unexpected exception executing checks!" << std::endl;
+			return 1;
+		}
+	}
+
 	std::cout << "Azure Sphere network-checkup utility." << std::endl << std::endl;
 	try
 	{
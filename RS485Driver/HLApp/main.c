@@ -56,6 +56,9 @@ static EventLoopTimer *sendTimer = NULL;
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 static uint8_t rs485RxBuffer[2000];
 
+// Modbus RTU frames are delimited by at least 3.5 characters (of 10 bits) of line silence
+#define MODBUS_RTU_IDLE_BIT_TIMES	35
+
 // Handy typedef, used in SendTimerEventHandler for processing Modbus commands
 typedef struct {
 
@@ -115,6 +118,13 @@ static void Rs485ReceiveHandler(int bytesReceived)
 	// Just re-logging the received bytes.	
 	if (bytesReceived > 0)
 	{		
+		uint32_t timestamp;
+		uint8_t flags;
+		if (Rs485_GetLastFrameInfo(&timestamp, &flags)) {
+			Log_Debug("Rs485 Callback: frame received at %u.%03us%s\n", timestamp / RS485_TIMESTAMP_HZ,
+				(timestamp % RS485_TIMESTAMP_HZ) * 1000 / RS485_TIMESTAMP_HZ,
+				(flags & RS485_FRAME_FLAG_OVERFLOW) ? " (truncated)" : "");
+		}
 		Log_Debug("Rs485 Callback: received %d bytes: ", bytesReceived);
 		for (int i = 0; i < bytesReceived; ++i) {
 			Log_Debug("%02x", rs485RxBuffer[i]);
@@ -161,6 +171,11 @@ static ExitCode InitHandlers(void)
 		return ExitCode_Init_Rs485;
 	}
 
+	// Receive each Modbus response as a whole, rather than split in arbitrary chunks
+	if (Rs485_SetFrameMode(MODBUS_RTU_IDLE_BIT_TIMES) == -1) {
+		return ExitCode_Init_Rs485;
+	}
+
 	return ExitCode_Success;
 }
 
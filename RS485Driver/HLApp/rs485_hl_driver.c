@@ -5,6 +5,8 @@
 
 #include <errno.h>
 #include <string.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <applibs/log.h>
@@ -21,7 +23,71 @@ static Rs485ReceiveCallback *userCallback = NULL;
 static uint8_t *rs485rxBuffer = NULL;
 static size_t rs485rxBufferSize = 0;
 
+// The port messages are sent to, and the one the last received message came from
+static uint8_t selectedPort = 0;
+static uint8_t lastPort = 0;
+
+// Frame mode is switched, per port, when the RTApp acknowledges it, lastFrame.length
+// is 0 unless the last callback delivered a frame.
+static bool frameMode[RS485_MAX_PORTS];
+static bool requestedFrameMode[RS485_MAX_PORTS];
+static Rs485FrameHeader lastFrame;
+
+static Rs485LogLevel logLevel = Rs485_LogLevel_Errors;
+
+// Transactions waiting for their response, no more than the RTApp queues for each port.
+// The callback is NULL for the one Rs485_Transact() waits for.
+typedef struct {
+	bool used;
+	uint8_t port;
+	uint16_t id;
+	uint16_t timeoutMs;
+	Rs485TransactCallback *callback;
+	void *context;
+} PendingTransaction;
+
+// Added to the timeouts of the transactions ahead, for Rs485_Transact() to give up on the RTApp
+#define TRANSACT_WAIT_MARGIN_MS	1000
+
+#define MAX_PENDING_TRANSACTIONS	(RS485_TRANSACT_QUEUE_SIZE * RS485_MAX_PORTS)
+
+static PendingTransaction pendingTransactions[MAX_PENDING_TRANSACTIONS];
+static uint16_t nextTransactionId = 0;
+
+#ifdef RS485_LOG_PAYLOADS
+// Logs a payload as a single line, formatted in hex up to RS485_LOG_PAYLOAD_MAX bytes
+#define RS485_LOG_PAYLOAD_MAX	64
+static void LogPayload(const char *direction, const uint8_t *data, size_t size)
+{
+	char hex[RS485_LOG_PAYLOAD_MAX * 3 + 4];
+	size_t shown = (size < RS485_LOG_PAYLOAD_MAX) ? size : RS485_LOG_PAYLOAD_MAX;
+	static const char digits[] = "0123456789abcdef";
+	char *p = hex;
+
+	for (size_t i = 0; i < shown; ++i) {
+		*p++ = digits[data[i] >> 4];
+		*p++ = digits[data[i] & 0x0f];
+		*p++ = ':';
+	}
+	if (shown < size) {
+		memcpy(p, "...", 3);
+		p += 3;
+	}
+	else if (p != hex) {
+		p--;
+	}
+	*p = '\0';
+
+	Log_Debug("Rs485_Driver: %s %zu bytes: %s\n", direction, size, hex);
+}
+#define LOG_PAYLOAD(direction, data, size) \
+	do { if (logLevel >= Rs485_LogLevel_Payloads) LogPayload(direction, data, size); } while (0)
+#else
+#define LOG_PAYLOAD(direction, data, size) do { } while (0)
+#endif
+
 static void RTAppSocketEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+static void HandleMessage(int bytesReceived);
 
 int Rs485_Init(EventLoop *eventLoop, uint8_t *rxBuffer, size_t rxBufferSize, Rs485ReceiveCallback *callback)
 {
@@ -85,6 +151,10 @@ void Rs485_Close(void)
 
 	rtAppSockFd = -1;
 	userCallback = NULL;
+	selectedPort = 0;
+	lastPort = 0;
+	memset(frameMode, 0, sizeof(frameMode));
+	memset(pendingTransactions, 0, sizeof(pendingTransactions));
 	rs485rxBuffer = NULL;
 	rs485rxBufferSize = 0;
 }
@@ -98,24 +168,354 @@ int Rs485_Send(const void *data, size_t dataLen)
 		return -1;
 	}
 
-	// Log the bytes to be sent
-	Log_Debug("Rs485_Driver: sending %ld bytes: ", dataLen);
-	for (int i = 0; i < dataLen; ++i) {
-		Log_Debug("%02x", ((char*)data)[i]);
-		if (i != dataLen - 1) {
-			Log_Debug(":");
-		}
+	LOG_PAYLOAD("sending", data, dataLen);
+
+	// Messages for ports other than 0 go behind their port's header
+	uint8_t message[sizeof(Rs485PortHeader) + MAX_HLAPP_MESSAGE_SIZE];
+	size_t headerLen = 0;
+	if (selectedPort != 0)
+	{
+		Rs485PortHeader header = { .command = RS485_CMD_PORT, .port = selectedPort };
+		memcpy(message, &header, sizeof(header));
+		memcpy(message + sizeof(header), data, dataLen);
+		data = message;
+		headerLen = sizeof(header);
 	}
-	Log_Debug("\n");
 
 	// Send the block to the RS-485 RTApp driver
-	int bytesSent = send(rtAppSockFd, data, dataLen, 0);
+	int bytesSent = send(rtAppSockFd, data, headerLen + dataLen, 0);
 	if (bytesSent == -1) {
 		Log_Debug("ERROR: Unable to send message to the RS-485 driver: %d (%s)\n", errno, strerror(errno));
 		return -1;
 	}
 
-	return bytesSent;
+	return bytesSent - (int)headerLen;
+}
+
+int Rs485_SetPort(uint8_t port)
+{
+	if (port >= RS485_MAX_PORTS)
+	{
+		Log_Debug("ERROR: invalid port: %u (< %d)\n", port, RS485_MAX_PORTS);
+		errno = EINVAL;
+		return -1;
+	}
+
+	selectedPort = port;
+	return 0;
+}
+
+uint8_t Rs485_GetLastPort(void)
+{
+	return lastPort;
+}
+
+// Strips the port header of a message received from the RTApp, if any, and returns its length
+static int UnpackPort(int bytesReceived)
+{
+	Rs485PortHeader header;
+
+	lastPort = 0;
+	if (bytesReceived < (int)sizeof(header)) {
+		return bytesReceived;
+	}
+
+	memcpy(&header, rs485rxBuffer, sizeof(header));
+	if (header.command != RS485_CMD_PORT || header.port >= RS485_MAX_PORTS) {
+		return bytesReceived;
+	}
+
+	bytesReceived -= (int)sizeof(header);
+	memmove(rs485rxBuffer, rs485rxBuffer + sizeof(header), (size_t)bytesReceived);
+	lastPort = header.port;
+	return bytesReceived;
+}
+
+void Rs485_SetLogLevel(Rs485LogLevel level)
+{
+	logLevel = level;
+}
+
+int Rs485_SetLineConfig(uint32_t baudRate, Rs485Parity parity, uint8_t stopBits)
+{
+	Rs485LineConfig config = {
+		.command = RS485_CMD_SET_LINE_CONFIG, .baudRate = baudRate, .parity = (uint8_t)parity, .stopBits = stopBits };
+
+	return Rs485_Send(&config, sizeof(config));
+}
+
+int Rs485_SetFrameMode(uint16_t idleBitTimes)
+{
+	uint8_t command[6];
+	uint32_t code = RS485_CMD_SET_FRAME_MODE;
+
+	memcpy(command, &code, sizeof(code));
+	memcpy(command + sizeof(code), &idleBitTimes, sizeof(idleBitTimes));
+	requestedFrameMode[selectedPort] = idleBitTimes != 0;
+
+	return Rs485_Send(command, sizeof(command));
+}
+
+bool Rs485_GetLastFrameInfo(uint32_t *timestamp, uint8_t *flags)
+{
+	if (lastFrame.length == 0) {
+		return false;
+	}
+
+	if (NULL != timestamp) {
+		*timestamp = lastFrame.timestamp;
+	}
+	if (NULL != flags) {
+		*flags = lastFrame.flags;
+	}
+	return true;
+}
+
+// Returns the payload length of a frame mode message, after moving the payload to the start of
+// the RX buffer, or -1 if the message isn't a frame (i.e. a special command's response).
+static int UnpackFrame(int bytesReceived)
+{
+	Rs485FrameHeader header;
+	uint32_t code;
+
+	if (bytesReceived == 8) {
+		memcpy(&code, rs485rxBuffer, sizeof(code));
+		if (code == RS485_CMD_SET_FRAME_MODE || code == RS485_CMD_SET_BAUDRATE || code == RS485_CMD_SET_LINE_CONFIG) {
+			return -1;
+		}
+	}
+	if (bytesReceived <= (int)sizeof(header)) {
+		return -1;
+	}
+
+	memcpy(&header, rs485rxBuffer, sizeof(header));
+	if (header.length == 0) {
+		return -1;
+	}
+
+	// The recv() truncated the frame to the RX buffer's size
+	if (header.length > bytesReceived - sizeof(header)) {
+		header.length = (uint16_t)(bytesReceived - sizeof(header));
+		header.flags |= RS485_FRAME_FLAG_OVERFLOW;
+	}
+
+	memmove(rs485rxBuffer, rs485rxBuffer + sizeof(header), header.length);
+	lastFrame = header;
+	return header.length;
+}
+
+// Queues a transaction on the RTApp, returns its slot in pendingTransactions or -1 on error.
+static int SendTransaction(const void *request, size_t requestLen, uint32_t timeoutMs,
+	Rs485TransactCallback *callback, void *context)
+{
+	uint8_t message[MAX_HLAPP_MESSAGE_SIZE];
+	Rs485TransactRequest header = {
+		.command = RS485_CMD_TRANSACT, .id = nextTransactionId, .timeoutMs = (uint16_t)timeoutMs };
+
+	if (requestLen == 0 || requestLen > RS485_TRANSACT_MAX_REQUEST_SIZE || timeoutMs > UINT16_MAX)
+	{
+		Log_Debug("ERROR: invalid transaction: %zu bytes (<= %zu), %u ms timeout\n", requestLen,
+			RS485_TRANSACT_MAX_REQUEST_SIZE, timeoutMs);
+		errno = EINVAL;
+		return -1;
+	}
+
+	int slot = 0;
+	while (slot < MAX_PENDING_TRANSACTIONS && pendingTransactions[slot].used) {
+		slot++;
+	}
+	if (slot == MAX_PENDING_TRANSACTIONS)
+	{
+		Log_Debug("ERROR: too many transactions pending (%d)\n", MAX_PENDING_TRANSACTIONS);
+		errno = EBUSY;
+		return -1;
+	}
+
+	memcpy(message, &header, sizeof(header));
+	memcpy(message + sizeof(header), request, requestLen);
+	if (Rs485_Send(message, sizeof(header) + requestLen) == -1) {
+		return -1;
+	}
+
+	pendingTransactions[slot] = (PendingTransaction) {
+		.used = true, .port = selectedPort, .id = header.id, .timeoutMs = header.timeoutMs, .callback = callback, .context = context };
+	nextTransactionId++;
+	return slot;
+}
+
+// Returns true if the message in the RX buffer is a transaction's response, and gives its header
+static bool IsTransactResponse(int bytesReceived, Rs485TransactResponse *response)
+{
+	if (bytesReceived < (int)sizeof(*response)) {
+		return false;
+	}
+
+	memcpy(response, rs485rxBuffer, sizeof(*response));
+	return response->command == RS485_CMD_TRANSACT;
+}
+
+int Rs485_TransactAsync(const void *request, size_t requestLen, uint32_t timeoutMs,
+	Rs485TransactCallback *callback, void *context)
+{
+	if (NULL == callback) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return (SendTransaction(request, requestLen, timeoutMs, callback, context) == -1) ? -1 : 0;
+}
+
+int Rs485_Transact(const void *request, size_t requestLen, uint8_t *response, size_t maxResponseLen, uint32_t timeoutMs)
+{
+	// Responses are received into the RX buffer, like any other message
+	if (NULL == rs485rxBuffer) {
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	int slot = SendTransaction(request, requestLen, timeoutMs, NULL, NULL);
+	if (slot == -1) {
+		return -1;
+	}
+	PendingTransaction *transaction = &pendingTransactions[slot];
+
+	// The RTApp answers within the timeouts of the transactions queued ahead on the port and this one's
+	uint32_t waitMs = TRANSACT_WAIT_MARGIN_MS;
+	for (int i = 0; i < MAX_PENDING_TRANSACTIONS; ++i) {
+		if (pendingTransactions[i].used && pendingTransactions[i].port == transaction->port) {
+			waitMs += pendingTransactions[i].timeoutMs;
+		}
+	}
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += waitMs / 1000;
+	deadline.tv_nsec += (long)(waitMs % 1000) * 1000000;
+
+	while (true)
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		int64_t remainingMs = (int64_t)(deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+		if (remainingMs <= 0)
+		{
+			Log_Debug("ERROR: no response from the RS-485 driver for transaction %u\n", transaction->id);
+			transaction->used = false;
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		struct pollfd pollFd = { .fd = rtAppSockFd, .events = POLLIN };
+		int ready = poll(&pollFd, 1, (int)remainingMs);
+		if (ready == -1 && errno != EINTR)
+		{
+			Log_Debug("ERROR: Unable to wait for the RS-485 driver: %d (%s)\n", errno, strerror(errno));
+			transaction->used = false;
+			return -1;
+		}
+		if (ready <= 0) {
+			continue;
+		}
+
+		int bytesReceived = recv(rtAppSockFd, rs485rxBuffer, rs485rxBufferSize, 0);
+		if (bytesReceived == -1)
+		{
+			Log_Debug("ERROR: Unable to receive message from the RS-485 driver: %d (%s)\n", errno, strerror(errno));
+			transaction->used = false;
+			return -1;
+		}
+		bytesReceived = UnpackPort(bytesReceived);
+
+		// Anything else received meanwhile is handled as usual
+		Rs485TransactResponse header;
+		if (!IsTransactResponse(bytesReceived, &header) || header.id != transaction->id)
+		{
+			HandleMessage(bytesReceived);
+			continue;
+		}
+
+		LOG_PAYLOAD("received", rs485rxBuffer, (size_t)bytesReceived);
+		transaction->used = false;
+
+		size_t responseLen = (size_t)bytesReceived - sizeof(header);
+		memcpy(response, rs485rxBuffer + sizeof(header), (responseLen < maxResponseLen) ? responseLen : maxResponseLen);
+
+		switch (header.status)
+		{
+		case RS485_TRANSACT_OK:
+			if (responseLen <= maxResponseLen) {
+				return (int)responseLen;
+			}
+			// fall through
+		case RS485_TRANSACT_OVERFLOW:
+			errno = EOVERFLOW;
+			return -1;
+		case RS485_TRANSACT_TIMEOUT:
+			errno = ETIMEDOUT;
+			return -1;
+		case RS485_TRANSACT_QUEUE_FULL:
+			errno = EBUSY;
+			return -1;
+		default:
+			errno = EIO;
+			return -1;
+		}
+	}
+}
+
+// Hands a transaction's response to its callback, returns false if the message isn't one
+static bool DispatchTransactResponse(int bytesReceived)
+{
+	Rs485TransactResponse header;
+	if (!IsTransactResponse(bytesReceived, &header)) {
+		return false;
+	}
+
+	for (int i = 0; i < MAX_PENDING_TRANSACTIONS; ++i)
+	{
+		PendingTransaction *transaction = &pendingTransactions[i];
+		if (transaction->used && transaction->id == header.id && NULL != transaction->callback)
+		{
+			// Freed first, so that the callback can queue the next transaction
+			transaction->used = false;
+			transaction->callback((Rs485TransactStatus)header.status, rs485rxBuffer + sizeof(header),
+				bytesReceived - (int)sizeof(header), transaction->context);
+			return true;
+		}
+	}
+
+	Log_Debug("ERROR: response to unknown transaction %u dropped\n", header.id);
+	return true;
+}
+
+// Handles a message received from the RTApp into the RX buffer
+static void HandleMessage(int bytesReceived)
+{
+	LOG_PAYLOAD("received", rs485rxBuffer, (size_t)bytesReceived);
+
+	if (DispatchTransactResponse(bytesReceived)) {
+		return;
+	}
+
+	// Switch mode once the RTApp has acknowledged it
+	uint32_t code;
+	memcpy(&code, rs485rxBuffer, sizeof(code));
+	if ((bytesReceived == 8) && (code == RS485_CMD_SET_FRAME_MODE) && (rs485rxBuffer[4] == 0x00)) {
+		frameMode[lastPort] = requestedFrameMode[lastPort];
+	}
+
+	lastFrame.length = 0;
+	if (frameMode[lastPort])
+	{
+		int frameLength = UnpackFrame(bytesReceived);
+		if (frameLength >= 0) {
+			bytesReceived = frameLength;
+		}
+	}
+
+	if (NULL != userCallback)
+	{
+		userCallback(bytesReceived);
+	}
 }
 
 void RTAppSocketEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
@@ -131,19 +531,6 @@ void RTAppSocketEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, v
 			return;
 		}
 
-		// Log the received bytes
-		Log_Debug("Rs485_Driver: received %d bytes: ", bytesReceived);
-		for (int i = 0; i < bytesReceived; ++i) {
-			Log_Debug("%02x", rs485rxBuffer[i]);
-			if (i != bytesReceived - 1) {
-				Log_Debug(":");
-			}
-		}
-		Log_Debug("\n");
-
-		if (NULL != userCallback)
-		{
-			userCallback(bytesReceived);
-		}
+		HandleMessage(UnpackPort(bytesReceived));
 	}
 }
@@ -5,8 +5,16 @@
 
 
 typedef void Rs485ReceiveCallback(int bytesReceived);	// The receive callback, called upon any receive event from the real-time RS-485 driver (RTApp).
+typedef void Rs485TransactCallback(Rs485TransactStatus status, const uint8_t *response, int responseLen, void *context);	// Called with a transaction's outcome, see Rs485_TransactAsync().
 extern const char rtAppComponentId[];			// The corresponding RTApp's ComponentId, to be defined externally (i.e. in main.c).
 
+// What the driver logs: errors only (the default), or also a line per message sent and received.
+// The payload lines are only compiled in when RS485_LOG_PAYLOADS is defined (see CMakeLists.txt).
+typedef enum {
+	Rs485_LogLevel_Errors = 0,
+	Rs485_LogLevel_Payloads = 1
+} Rs485LogLevel;
+
 /// <summary>
 ///	Initializes the connection to the real-time RS-485 driver (RTApp).
 /// </summary>
@@ -30,4 +38,83 @@ void Rs485_Close(void);
 /// <param name="data">A pointer to the data buffer.</param>
 /// <param name="size">Size of the data buffer in bytes.</param>
 /// <returns>The number of bytes sent or -1 on error.</returns>
-int Rs485_Send(const void *data, size_t dataLen);
\ No newline at end of file
+int Rs485_Send(const void *data, size_t dataLen);
+
+/// <summary>
+/// Selects the port, i.e. the bus, that the following calls address: Rs485_Send(), Rs485_SetLineConfig(),
+/// Rs485_SetFrameMode(), Rs485_Transact() and Rs485_TransactAsync(). Port 0, the default, is the only one
+/// unless the RTApp is built with a larger RS485_PORT_COUNT.
+/// </summary>
+/// <param name="port">The port, below RS485_MAX_PORTS.</param>
+/// <returns>'0' on success, -1 on error.</returns>
+int Rs485_SetPort(uint8_t port);
+
+/// <summary>
+/// Gives the port that the message passed to the current receive callback came from.
+/// </summary>
+/// <returns>The port.</returns>
+uint8_t Rs485_GetLastPort(void);
+
+/// <summary>
+/// Sets the RS-485 UART's baudrate, parity and stop bits. The RTApp answers with an 8-byte message,
+/// RS485_CMD_SET_LINE_CONFIG followed by 0x00000000 on success or 0xFFFFFFFF on failure.
+/// </summary>
+/// <param name="baudRate">The baudrate, up to RS485_MAX_BAUDRATE (above 115200, build the RTApp with RS485_UART_DMA).</param>
+/// <param name="parity">The parity, an Rs485Parity.</param>
+/// <param name="stopBits">The number of stop bits, 1 or 2.</param>
+/// <returns>The number of bytes sent or -1 on error.</returns>
+int Rs485_SetLineConfig(uint32_t baudRate, Rs485Parity parity, uint8_t stopBits);
+
+/// <summary>
+/// Switches the real-time RS-485 driver (RTApp) between stream and frame mode.
+/// In stream mode (the default) the receive callback gets the received bytes as the RTApp buffered them,
+/// in frame mode it gets exactly one bus frame per call: the bytes received between two idle gaps of the
+/// given length on the line, i.e. 35 bit-times (3.5 characters) for Modbus RTU.
+/// The mode changes when the RTApp's response to the command is received.
+/// </summary>
+/// <param name="idleBitTimes">The idle gap ending a frame, in bit-times at the current baudrate, or 0 for stream mode.</param>
+/// <returns>The number of bytes sent or -1 on error.</returns>
+int Rs485_SetFrameMode(uint16_t idleBitTimes);
+
+/// <summary>
+/// In frame mode, gives the details of the frame passed to the current receive callback.
+/// </summary>
+/// <param name="timestamp">Receives when the frame's first byte was read, in RS485_TIMESTAMP_HZ ticks, or NULL.</param>
+/// <param name="flags">Receives the frame's RS485_FRAME_FLAG_* flags, or NULL.</param>
+/// <returns>'true' if the callback was given a frame, 'false' otherwise.</returns>
+bool Rs485_GetLastFrameInfo(uint32_t *timestamp, uint8_t *flags);
+
+/// <summary>
+/// Sets what the driver logs, see Rs485LogLevel.
+/// </summary>
+/// <param name="level">The log level.</param>
+void Rs485_SetLogLevel(Rs485LogLevel level);
+
+/// <summary>
+/// Writes a request to the bus and waits for the response, i.e. the frame received after it, ended by an idle gap
+/// (the frame mode's, or RS485_TRANSACT_IDLE_BIT_TIMES in stream mode). The RTApp drives DE/!RE and times the response
+/// from the request's last byte, so no guard delays are needed on the HL side. Other messages received meanwhile are
+/// delivered to the receive callback as usual.
+/// </summary>
+/// <param name="request">A pointer to the request bytes.</param>
+/// <param name="requestLen">Size of the request in bytes, up to RS485_TRANSACT_MAX_REQUEST_SIZE.</param>
+/// <param name="response">A pointer to the buffer receiving the response.</param>
+/// <param name="maxResponseLen">Size of the response buffer in bytes.</param>
+/// <param name="timeoutMs">How long the RTApp waits for the response to start, in milliseconds (up to 65535).</param>
+/// <returns>The response's length in bytes, or -1 on error with errno set: ETIMEDOUT if no response came,
+/// EOVERFLOW if it didn't fit (truncated to maxResponseLen), EBUSY if too many transactions are pending.</returns>
+int Rs485_Transact(const void *request, size_t requestLen, uint8_t *response, size_t maxResponseLen, uint32_t timeoutMs);
+
+/// <summary>
+/// Queues a transaction like Rs485_Transact() without waiting for it: the callback is invoked from the event loop
+/// with the outcome and the response, which is only valid during the call.
+/// Up to RS485_TRANSACT_QUEUE_SIZE transactions can be pending per port, they go on the bus in order.
+/// </summary>
+/// <param name="request">A pointer to the request bytes.</param>
+/// <param name="requestLen">Size of the request in bytes, up to RS485_TRANSACT_MAX_REQUEST_SIZE.</param>
+/// <param name="timeoutMs">How long the RTApp waits for the response to start, in milliseconds (up to 65535).</param>
+/// <param name="callback">A pointer to the 'Rs485TransactCallback'-typed function to invoke with the response.</param>
+/// <param name="context">Passed to the callback.</param>
+/// <returns>'0' if the transaction was queued, -1 on error.</returns>
+int Rs485_TransactAsync(const void *request, size_t requestLen, uint32_t timeoutMs,
+	Rs485TransactCallback *callback, void *context);
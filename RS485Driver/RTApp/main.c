@@ -16,14 +16,66 @@
 #include "lib/Print.h"
 
 #include "..\common_defs.h"
+#include "Scheduler.h"
 #include "Socket.h"
 #include "ringBuffer.h"
 #include "rs485_driver.h"
 
 #define DEBUG_INFO
 static UART *debug = NULL;
+#ifdef RS485_DEBUG_DEFERRED
+// Debug output is queued here and drained by the UART TX interrupt, so DEBUG_INFO's per byte
+// dumps don't hold up the bus at 115200 baud
+static uint8_t debugTx[4096];
+static uint32_t debugDropped = 0;
+#endif
 static Socket *socket = NULL;
 static GPT *sendTimer = NULL;
+static GPT *portTimer = NULL;
+static GPT *timestampTimer = NULL;
+
+// Transactions queued by the HLApp
+typedef struct {
+	Rs485TransactRequest header;
+	uint8_t request[RS485_TRANSACT_MAX_REQUEST_SIZE];
+	uint32_t size;
+} Transaction;
+
+_Static_assert(sizeof(Rs485TransactResponse) == sizeof(Rs485FrameHeader), "responses are built in place in the frame");
+
+// The state of each bus. Its idle gap and response timeout are deadlines in timestampTimer
+// ticks, all the ports' share portTimer, which is started for the earliest one
+typedef struct {
+	uint32_t id;
+	uint32_t baudRate;
+
+	// Frame mode state, frameIdleBitTimes is 0 in stream mode
+	uint16_t frameIdleBitTimes;
+	uint32_t frameIdleTicks;
+	bool idleArmed;
+	uint32_t idleDue;
+
+	// The transaction at transactHead is on the bus while transactActive, with its response
+	// received in the frame (whose header is then replaced by the response's)
+	Transaction transactQueue[RS485_TRANSACT_QUEUE_SIZE];
+	uint32_t transactHead;
+	uint32_t transactCount;
+	bool transactActive;
+	bool responseArmed;
+	uint32_t responseDue;
+
+	Scheduler_Task uartRxTask;
+
+	// The frame being received, after room for the Rs485PortHeader it's sent with
+	uint8_t message[sizeof(Rs485PortHeader) + sizeof(Rs485FrameHeader) + RS485_MAX_FRAME_SIZE];
+} Port;
+
+static Port ports[DRIVER_PORT_COUNT];
+
+static inline uint8_t *portFrame(Port *port)
+{
+	return port->message + sizeof(Rs485PortHeader);
+}
 
 static const Component_Id A7ID =
 {
@@ -33,55 +85,201 @@ static const Component_Id A7ID =
 	.seg_3_4 = {0x9C, 0x76, 0x6F, 0xBD, 0xBB, 0x44, 0x11, 0x31}
 };
 
-typedef struct CallbackNode {
-	bool enqueued;
-	struct CallbackNode *next;
-	void *data;
-	void (*cb_void)(void);
-	void (*cb_void_ptr)(void *);
-} CallbackNode;
-static CallbackNode *volatile callbacks = NULL;
+// Function prototypes
+static void HandleUartRxIrq(uint32_t port);
+static void handleSendMsgTimer(void *data);
+static void sendFrame(Port *port);
 
+// Prefixes a message of a port other than 0 with its Rs485PortHeader, in the room left for it
+// before the message, and returns where the message to send starts
+static uint8_t *tagMessage(const Port *port, uint8_t *message, uint32_t *size)
+{
+	if (port->id == 0) {
+		return message;
+	}
 
-// Function prototypes
-static void HandleUartRxIrq(void);
+	Rs485PortHeader header = { .command = RS485_CMD_PORT, .port = (uint8_t)port->id };
+	message -= sizeof(header);
+	memcpy(message, &header, sizeof(header));
+	*size += sizeof(header);
+	return message;
+}
+
+static inline bool deadlinePassed(uint32_t due, uint32_t now)
+{
+	return (int32_t)(now - due) >= 0;
+}
+
+static void HandlePortTimerExpiredDeferred(void *data);
+static Scheduler_Task portTimerTask = SCHEDULER_TASK(HandlePortTimerExpiredDeferred, SCHEDULER_PRIORITY_NORMAL, 0);
 
-// Callback handlers
-static void EnqueueCallback(CallbackNode *node)
+static void HandlePortTimerExpired(GPT *timer)
 {
-	uint32_t prevBasePri = NVIC_BlockIRQs();
-	if (!node->enqueued) {
-		CallbackNode *prevHead = callbacks;
-		node->enqueued = true;
-		callbacks = node;
-		node->next = prevHead;
-	}
-	NVIC_RestoreIRQs(prevBasePri);
+	Scheduler_Post(&portTimerTask);
 }
-static void InvokeCallbacks(void)
+
+// Starts portTimer for the earliest deadline of all ports, if any
+static void schedulePortTimer(void)
 {
-	CallbackNode *node = NULL;
-
-	do {
-		uint32_t prevBasePri = NVIC_BlockIRQs();
-		node = callbacks;
-		if (node) {
-			node->enqueued = false;
-			callbacks = node->next;
+	uint32_t now = GPT_GetCount(timestampTimer);
+	int32_t earliest = INT32_MAX;
+	bool armed = false;
+
+	for (uint32_t i = 0; i < DRIVER_PORT_COUNT; i++)
+	{
+		Port *port = &ports[i];
+		if (port->idleArmed && ((int32_t)(port->idleDue - now) < earliest)) {
+			earliest = (int32_t)(port->idleDue - now);
+		}
+		if (port->responseArmed && ((int32_t)(port->responseDue - now) < earliest)) {
+			earliest = (int32_t)(port->responseDue - now);
 		}
-		NVIC_RestoreIRQs(prevBasePri);
+		armed |= port->idleArmed || port->responseArmed;
+	}
 
-		if (node) {
-			if (NULL != node->cb_void)
-			{
-				(*node->cb_void)();
-			}
-			else if (NULL != node->cb_void_ptr)
-			{
-				(*node->cb_void_ptr)(node->data);
-			}
+	GPT_Stop(portTimer);
+	if (!armed) {
+		return;
+	}
+
+	uint32_t us = (earliest <= 0) ? 1 :
+		(uint32_t)(((uint64_t)earliest * 1000000UL + RS485_TIMESTAMP_HZ - 1) / RS485_TIMESTAMP_HZ);
+	if (GPT_StartTimeout(portTimer, us, GPT_UNITS_MICROSEC, HandlePortTimerExpired) != ERROR_NONE) {
+		// Poll the deadlines from the main loop instead
+		Scheduler_Post(&portTimerTask);
+	}
+}
+
+// The idle gap closing a frame, in whole ticks plus one, as the gap may start at the end of a tick
+static void updateFrameIdleTime(Port *port)
+{
+	uint32_t bitTimes = port->frameIdleBitTimes ? port->frameIdleBitTimes : RS485_TRANSACT_IDLE_BIT_TIMES;
+	port->frameIdleTicks = (uint32_t)(((uint64_t)bitTimes * RS485_TIMESTAMP_HZ + port->baudRate - 1) / port->baudRate) + 1;
+}
+
+static void setBaudRate(Port *port, uint32_t baud)
+{
+	port->baudRate = baud;
+	updateFrameIdleTime(port);
+
+	// RX must be read before the 16-byte UART FIFO overflows, the deadline follows the baudrate:
+	// 16 characters of up to 10 bits, i.e. ~16ms at 9600 baud, ~170us at 921600
+	port->uartRxTask.deadline = (16 * 10 * 1000000UL) / port->baudRate;
+}
+
+static bool setFrameMode(Port *port, uint16_t idleBitTimes)
+{
+	if ((idleBitTimes != 0) && (!portTimer || !timestampTimer)) {
+		return false;
+	}
+
+	// Hand over whatever was received in the previous mode first, so that
+	// the command's response goes out in a message of its own
+	// A transaction's response is left to complete as it is
+	if (!port->transactActive) {
+		port->idleArmed = false;
+		if (((Rs485FrameHeader *)portFrame(port))->length != 0) {
+			sendFrame(port);
 		}
-	} while (node);
+	}
+	if (ring_buffer_count(&rs485_rxRingBuffers[port->id]) != 0) {
+		handleSendMsgTimer(NULL);
+	}
+
+	port->frameIdleBitTimes = idleBitTimes;
+	updateFrameIdleTime(port);
+	return true;
+}
+
+// Sends a transaction's response, message has room for the Rs485PortHeader before it and
+// for the response header before the length bytes of response
+static void sendTransactResponse(Port *port, uint8_t *message, uint16_t id, Rs485TransactStatus status, uint32_t length)
+{
+	Rs485TransactResponse *response = (Rs485TransactResponse *)message;
+
+	response->command = RS485_CMD_TRANSACT;
+	response->id = id;
+	response->status = status;
+	response->reserved = 0;
+
+#ifdef DEBUG_INFO
+	UART_Printf(debug, "Port %ld transaction %d done, status %d, %ld bytes response\r\n", port->id, id, status, length);
+#endif
+	uint32_t size = sizeof(*response) + length;
+	message = tagMessage(port, message, &size);
+	int32_t error = Socket_Send(socket, &A7ID, SOCKET_PRIORITY_CONTROL, message, size);
+	if (error != ERROR_NONE) {
+		UART_Printf(debug, "Transaction response LOST (error: %ld)!!\r\n", error);
+	}
+}
+
+static void finishTransaction(Port *port, Rs485TransactStatus status);
+
+// Writes the next queued request, unless a transaction is under way or a frame is being received
+static void startTransaction(Port *port)
+{
+	if (port->transactActive || (port->transactCount == 0) ||
+		(((Rs485FrameHeader *)portFrame(port))->length != 0) || port->idleArmed) {
+		return;
+	}
+
+	Transaction *transaction = &port->transactQueue[port->transactHead];
+	port->transactActive = true;
+
+#ifdef DEBUG_INFO
+	UART_Printf(debug, "Port %ld transaction %d: writing %ld bytes\r\n", port->id, transaction->header.id, transaction->size);
+#endif
+	uint32_t timeoutMs = transaction->header.timeoutMs ? transaction->header.timeoutMs : 1;
+	if (Rs485_Write(port->id, transaction->request, transaction->size) != ERROR_NONE) {
+		finishTransaction(port, RS485_TRANSACT_FAILED);
+		return;
+	}
+
+	port->responseDue = GPT_GetCount(timestampTimer) + (timeoutMs * RS485_TIMESTAMP_HZ + 999) / 1000 + 1;
+	port->responseArmed = true;
+	schedulePortTimer();
+}
+
+static void finishTransaction(Port *port, Rs485TransactStatus status)
+{
+	Rs485FrameHeader *frame = (Rs485FrameHeader *)portFrame(port);
+	Transaction *transaction = &port->transactQueue[port->transactHead];
+	uint32_t length = frame->length;
+
+	port->responseArmed = false;
+	if ((status == RS485_TRANSACT_OK) && (frame->flags & RS485_FRAME_FLAG_OVERFLOW)) {
+		status = RS485_TRANSACT_OVERFLOW;
+	}
+	sendTransactResponse(port, portFrame(port), transaction->header.id, status, length);
+	frame->length = 0;
+
+	port->transactHead = (port->transactHead + 1) % RS485_TRANSACT_QUEUE_SIZE;
+	port->transactCount--;
+	port->transactActive = false;
+	startTransaction(port);
+}
+
+static void queueTransaction(Port *port, const uint8_t *data, uint32_t size)
+{
+	Rs485TransactRequest header;
+	memcpy(&header, data, sizeof(header));
+	size -= sizeof(header);
+
+	if ((port->transactCount == RS485_TRANSACT_QUEUE_SIZE) || !portTimer || !timestampTimer ||
+		(size > RS485_TRANSACT_MAX_REQUEST_SIZE)) {
+		uint8_t response[sizeof(Rs485PortHeader) + sizeof(Rs485TransactResponse)];
+		sendTransactResponse(port, response + sizeof(Rs485PortHeader), header.id,
+			(port->transactCount == RS485_TRANSACT_QUEUE_SIZE) ? RS485_TRANSACT_QUEUE_FULL : RS485_TRANSACT_FAILED, 0);
+		return;
+	}
+
+	Transaction *transaction = &port->transactQueue[(port->transactHead + port->transactCount) % RS485_TRANSACT_QUEUE_SIZE];
+	transaction->header = header;
+	memcpy(transaction->request, data + sizeof(header), size);
+	transaction->size = size;
+	port->transactCount++;
+
+	startTransaction(port);
 }
 
 // Handlers for messages received from the HLApp
@@ -90,7 +288,8 @@ static void handleRecvMsg(void *handle)
 	Socket *socket = (Socket *)handle;
 
 	Component_Id senderId;
-	static uint8_t msg[MAX_HLAPP_MESSAGE_SIZE];
+	static uint8_t msg[sizeof(Rs485PortHeader) + MAX_HLAPP_MESSAGE_SIZE];
+	Socket_Segments segments;
 
 	if (Socket_NegotiationPending(socket)) {
 		UART_Printf(debug, "Negotiation pending, attempting renegotiation\n");
@@ -101,96 +300,228 @@ static void handleRecvMsg(void *handle)
 		}
 	}
 
-	// Read the message from the HLApp mailbox socket
-	uint32_t bytesRead = sizeof(msg);
-	int32_t error = Socket_Read(socket, &senderId, &msg, &bytesRead);
+	// Peek the message in the HLApp mailbox socket, it is only copied out
+	// when it wraps around the end of the shared ring buffer
+	int32_t error = Socket_Peek(socket, &senderId, &segments);
 	if (error != ERROR_NONE) {
 		UART_Printf(debug, "ERROR: receiving message from HLApp - %ld\r\n", error);
+		return;
+	}
+
+	uint32_t bytesRead = segments.size[0] + segments.size[1];
+	uint8_t *data = segments.data[0];
+	if (segments.size[1] != 0)
+	{
+		if (bytesRead > sizeof(msg)) {
+			UART_Printf(debug, "ERROR: message from HLApp too long - %ld\r\n", bytesRead);
+			Socket_Consume(socket);
+			return;
+		}
+		memcpy(msg, segments.data[0], segments.size[0]);
+		memcpy(msg + segments.size[0], segments.data[1], segments.size[1]);
+		Socket_Consume(socket);
+		data = msg;
 	}
-	else if (bytesRead > sizeof(msg)) {
-		UART_Printf(debug, "ERROR: message from HLApp too long - %ld\r\n", bytesRead);
+
+#ifdef RS485_DEBUG_DEFERRED
+	uint32_t dropped = UART_GetTxDropped(debug);
+	if (dropped != debugDropped) {
+		UART_Printf(debug, "WARNING: %ld bytes of debug output dropped\r\n", dropped - debugDropped);
+		debugDropped = dropped;
 	}
+#endif
 
+	// Which port is it for?
+	uint32_t portId = 0;
+	if ((bytesRead >= sizeof(Rs485PortHeader)) && (*((uint32_t *)&data[0]) == RS485_CMD_PORT))
+	{
+		portId = ((Rs485PortHeader *)data)->port;
+		data += sizeof(Rs485PortHeader);
+		bytesRead -= sizeof(Rs485PortHeader);
+	}
+	Port *port = (portId < DRIVER_PORT_COUNT) ? &ports[portId] : NULL;
 
 	// Is this a special command?
-	if (*((uint32_t *)&msg[0]) == 0xffffffffUL)
+	uint32_t command = (bytesRead >= 6) ? *((uint32_t *)&data[0]) : 0;
+	if (port == NULL)
+	{
+		UART_Printf(debug, "Message from HLApp DROPPED, no port %ld!!\r\n", portId);
+	}
+	else if ((command == RS485_CMD_TRANSACT) && (bytesRead >= sizeof(Rs485TransactRequest)))
+	{
+		queueTransaction(port, data, bytesRead);
+	}
+	else if ((command == RS485_CMD_SET_BAUDRATE) || (command == RS485_CMD_SET_FRAME_MODE) ||
+		((command == RS485_CMD_SET_LINE_CONFIG) && (bytesRead == sizeof(Rs485LineConfig))))
 	{
-		bool bRes = Rs485_Init(*((uint16_t *)&msg[4]), NULL);
+		uint16_t argument = *((uint16_t *)&data[4]);
+		bool bRes;
+		uint8_t resp[8];
 
-		if (bRes)
+		if (command == RS485_CMD_SET_BAUDRATE)
 		{
-			memcpy(msg, "\xff\xff\xff\xff\x00\x00\x00\x00", 8);			
+			bRes = Rs485_Init(port->id, argument, NULL);
+			if (bRes)
+			{
+				setBaudRate(port, argument);
+			}
+#ifdef DEBUG_INFO
+			UART_Printf(debug, "Changing port %ld baud rate to %d --> %s\r\n", port->id, argument, bRes ? "OK" : "FAILED!!");
+#endif
 		}
-		else
+		else if (command == RS485_CMD_SET_LINE_CONFIG)
 		{
-			memcpy(msg, "\xff\xff\xff\xff\xff\xff\xff\xff", 8);
+			Rs485LineConfig config;
+			memcpy(&config, data, sizeof(config));
+			bRes = Rs485_SetLineConfig(port->id, config.baudRate, (Rs485Parity)config.parity, config.stopBits);
+			if (bRes)
+			{
+				setBaudRate(port, config.baudRate);
+			}
+#ifdef DEBUG_INFO
+			UART_Printf(debug, "Changing port %ld line to %ld baud, parity %d, %d stop bits --> %s\r\n",
+				port->id, config.baudRate, config.parity, config.stopBits, bRes ? "OK" : "FAILED!!");
+#endif
 		}
-
+		else
+		{
+			bRes = setFrameMode(port, argument);
 #ifdef DEBUG_INFO
-		UART_Printf(debug, "Changing baud rate to %d --> %s\r\n", *((uint16_t *)&msg[4]), bRes ? "OK" : "FAILED!!");
+			UART_Printf(debug, "Changing port %ld to %s mode (idle gap %d bit-times) --> %s\r\n",
+				port->id, argument ? "frame" : "stream", argument, bRes ? "OK" : "FAILED!!");
 #endif
+		}
 
-		if (ring_buffer_push_bytes(&rs485_rxRingBuffer, msg, 8) == -1)
+		memcpy(resp, &command, 4);
+		memset(resp + 4, bRes ? 0x00 : 0xff, 4);
+
+		if (ring_buffer_push_bytes(&rs485_rxRingBuffers[port->id], resp, 8) == -1)
 		{
-			UART_Print(debug, "Message to HLApp LOST (rs485_rxRingBuffer overflow)!! ");
+			UART_Print(debug, "Message to HLApp LOST (rs485_rxRingBuffers overflow)!! ");
 		}
 	}
 	else
 	{
 #ifdef DEBUG_INFO
-		UART_Printf(debug, "Received %ld bytes from HLApp: ", bytesRead);
+		UART_Printf(debug, "Received %ld bytes from HLApp for port %ld: ", bytesRead, port->id);
 		for (uint32_t i = 0; i < bytesRead; ++i) {
-			UART_Printf(debug, "%02x", msg[i]);
+			UART_Printf(debug, "%02x", data[i]);
 			if (i != bytesRead - 1) {
 				UART_Print(debug, ":");
 			}
 		}
 		UART_Print(debug, " --> sending to RS-485 field bus\r\n");
 #endif
-		if ((error = Rs485_Write(msg, bytesRead)) != ERROR_NONE)
+		// Written to the UART straight from the shared ring buffer
+		if ((error = Rs485_Write(port->id, data, bytesRead)) != ERROR_NONE)
 		{
 			UART_Printf(debug, "Message from HLApp LOST (error: %ld)!!\r\n", error);
 		}
 	}
+
+	if (segments.size[1] == 0)
+	{
+		Socket_Consume(socket);
+	}
 }
 static void handleRecvMsgWrapper(Socket *handle)
 {
-	static CallbackNode cbn = { .enqueued = false, .cb_void = NULL, .cb_void_ptr = handleRecvMsg, .data = NULL };
+	static Scheduler_Task task = SCHEDULER_TASK(handleRecvMsg, SCHEDULER_PRIORITY_LOW, 0);
 
-	if (!cbn.data) {
-		cbn.data = handle;
+	if (!task.data) {
+		task.data = handle;
 	}
 
-	EnqueueCallback(&cbn);
+	Scheduler_Post(&task);
 }
 
-// Handler for messages to be sent to the HLApp
-static void handleSendMsgTimer(void *data)
+// HLApp read from the ring buffer, write frames queued while it was full
+static void handleSendSpace(void *handle)
+{
+	Socket_Flush((Socket *)handle);
+}
+static void handleSendSpaceWrapper(Socket *handle)
 {
-	// Dequeue the bytes to be sent to the HLApp
-	int bytesBuffered = ring_buffer_count(&rs485_rxRingBuffer);
-	uint8_t buffer[bytesBuffered];
-	int32_t error;
+	static Scheduler_Task task = SCHEDULER_TASK(handleSendSpace, SCHEDULER_PRIORITY_LOW, 0);
+
+	if (!task.data) {
+		task.data = handle;
+	}
 
-	if ((error = ring_buffer_pop_bytes(&rs485_rxRingBuffer, buffer, bytesBuffered)) == -1)
+	Scheduler_Post(&task);
+}
+
+// Copies the port's header, if any, and as many bytes of its ring buffer as fill the reserved segments
+static bool fillSegments(const Port *port, Socket_Segments *segments)
+{
+	Rs485PortHeader header = { .command = RS485_CMD_PORT, .port = (uint8_t)port->id };
+	const uint8_t *prefix = (const uint8_t *)&header;
+	uint32_t prefixSize = (port->id == 0) ? 0 : sizeof(header);
+
+	for (uint32_t i = 0; i < 2; i++)
 	{
-		UART_Printf(debug, "Message from HLApp LOST (error: %ld)!!\r\n", error);
+		uint8_t *data = segments->data[i];
+		uint32_t size = segments->size[i];
+		uint32_t copied = (prefixSize < size) ? prefixSize : size;
+
+		memcpy(data, prefix, copied);
+		prefix += copied;
+		prefixSize -= copied;
+
+		if ((size != copied) &&
+			(ring_buffer_pop_bytes(&rs485_rxRingBuffers[port->id], data + copied, size - copied) == -1)) {
+			return false;
+		}
 	}
-	else
+	return true;
+}
+
+// Handler for messages to be sent to the HLApp, one per port with bytes received
+static void handleSendMsgTimer(void *data)
+{
+	for (uint32_t i = 0; i < DRIVER_PORT_COUNT; i++)
 	{
+		// Dequeue the bytes to be sent to the HLApp straight into the socket's
+		// shared ring buffer
+		Port *port = &ports[i];
+		uint32_t bytesBuffered = ring_buffer_count(&rs485_rxRingBuffers[i]);
+		Socket_Segments segments;
+		int32_t error;
+
+		if (bytesBuffered == 0)
+		{
+			continue;
+		}
+		if (port->id != 0)
+		{
+			bytesBuffered += sizeof(Rs485PortHeader);
+		}
+
+		if ((error = Socket_Reserve(socket, bytesBuffered, &segments)) != ERROR_NONE)
+		{
+			UART_Printf(debug, "ERROR: sending message - %ld\r\n", error);
+		}
+		else if (!fillSegments(port, &segments))
+		{
+			Socket_Commit(socket, &A7ID, 0);
+			UART_Printf(debug, "Message from HLApp LOST (error: %ld)!!\r\n", -1L);
+		}
+		else
+		{
 #ifdef DEBUG_INFO
-		UART_Printf(debug, "Sending %d bytes to HLApp: ", bytesBuffered);
-		for (uint32_t i = 0; i < bytesBuffered; ++i) {
-			UART_Printf(debug, "%02x", buffer[i]);
-			if (i != bytesBuffered - 1) {
-				UART_Print(debug, ":");
+			UART_Printf(debug, "Sending %ld bytes to HLApp: ", bytesBuffered);
+			for (uint32_t j = 0; j < bytesBuffered; ++j) {
+				UART_Printf(debug, "%02x", j < segments.size[0] ? segments.data[0][j] : segments.data[1][j - segments.size[0]]);
+				if (j != bytesBuffered - 1) {
+					UART_Print(debug, ":");
+				}
 			}
-		}
-		UART_Print(debug, "\r\n");
+			UART_Print(debug, "\r\n");
 #endif
-		error = Socket_Write(socket, &A7ID, buffer, bytesBuffered);
-		if (error != ERROR_NONE) {
-			UART_Printf(debug, "ERROR: sending message - %ld\r\n", error);
+			error = Socket_Commit(socket, &A7ID, bytesBuffered);
+			if (error != ERROR_NONE) {
+				UART_Printf(debug, "ERROR: sending message - %ld\r\n", error);
+			}
 		}
 	}
 
@@ -201,28 +532,132 @@ static void handleSendMsgTimerWrapper(GPT *timer)
 	if (NULL != timer)
 		(void)(timer);
 
-	static CallbackNode cbn = { .enqueued = false, .cb_void = NULL, .cb_void_ptr = handleSendMsgTimer, .data = NULL };
-	EnqueueCallback(&cbn);
+	static Scheduler_Task task = SCHEDULER_TASK(handleSendMsgTimer, SCHEDULER_PRIORITY_NORMAL, 0);
+	Scheduler_Post(&task);
 }
 
-// IRQ Handlers for the RS-485 UART
-static void HandleUartRxIrqDeferred(void)
+// Frame mode: one message, header and payload, per frame received from the bus
+static void sendFrame(Port *port)
 {
-	uintptr_t avail = Rs485_ReadAvailable();
+	Rs485FrameHeader *header = (Rs485FrameHeader *)portFrame(port);
+	uint32_t size = sizeof(*header) + header->length;
+	uint8_t *message = tagMessage(port, portFrame(port), &size);
+
+#ifdef DEBUG_INFO
+	UART_Printf(debug, "Sending port %ld %d bytes frame to HLApp\r\n", port->id, header->length);
+#endif
+	int32_t error = Socket_Send(socket, &A7ID, SOCKET_PRIORITY_BULK, message, size);
+	if (error != ERROR_NONE) {
+		UART_Printf(debug, "Frame from UART LOST (error: %ld)!!\r\n", error);
+	}
+	header->length = 0;
+}
+
+// A frame has ended, it is either the response to the transaction under way or sent on its own
+static void completeFrame(Port *port)
+{
+	if (port->transactActive) {
+		finishTransaction(port, RS485_TRANSACT_OK);
+	} else {
+		sendFrame(port);
+		startTransaction(port);
+	}
+}
+
+static void HandlePortTimerExpiredDeferred(void *data)
+{
+	uint32_t now = GPT_GetCount(timestampTimer);
+
+	for (uint32_t i = 0; i < DRIVER_PORT_COUNT; i++)
+	{
+		Port *port = &ports[i];
+		Rs485FrameHeader *frame = (Rs485FrameHeader *)portFrame(port);
+
+		// Ignore if more bytes have come in since the gap was due, the RX handler restarts it
+		if (port->idleArmed && deadlinePassed(port->idleDue, now))
+		{
+			port->idleArmed = false;
+			if ((Rs485_ReadAvailable(port->id) == 0) && (frame->length != 0)) {
+				completeFrame(port);
+			}
+		}
+
+		// Ignore if the response has started since, its idle gap ends the transaction
+		if (port->responseArmed && deadlinePassed(port->responseDue, now))
+		{
+			port->responseArmed = false;
+			if (port->transactActive && (frame->length == 0)) {
+				finishTransaction(port, RS485_TRANSACT_TIMEOUT);
+			}
+		}
+	}
+
+	schedulePortTimer();
+}
+
+static void receiveFrameBytes(Port *port, uintptr_t avail)
+{
+	Rs485FrameHeader *header = (Rs485FrameHeader *)portFrame(port);
+	uint8_t *payload = portFrame(port) + sizeof(*header);
+
+	if (header->length == 0) {
+		header->timestamp = GPT_GetCount(timestampTimer);
+		header->flags = 0;
+		header->reserved = 0;
+	}
+
+	uintptr_t size = RS485_MAX_FRAME_SIZE - header->length;
+	if (size > avail) {
+		size = avail;
+	}
+	if (Rs485_Read(port->id, payload + header->length, size) != ERROR_NONE) {
+		UART_Printf(debug, "ERROR: Failed to read %zu bytes from UART.\r\n", size);
+		return;
+	}
+	header->length += size;
+
+	// Drain the rest of an oversized frame, so it doesn't start the next one
+	for (avail -= size; avail != 0; avail -= size)
+	{
+		uint8_t discard[16];
+		size = (avail < sizeof(discard)) ? avail : sizeof(discard);
+		if (Rs485_Read(port->id, discard, size) != ERROR_NONE) {
+			break;
+		}
+		header->flags |= RS485_FRAME_FLAG_OVERFLOW;
+	}
+
+	port->idleDue = GPT_GetCount(timestampTimer) + port->frameIdleTicks;
+	port->idleArmed = true;
+	schedulePortTimer();
+}
+
+// IRQ Handlers for the RS-485 UARTs
+static void HandleUartRxIrqDeferred(void *data)
+{
+	Port *port = (Port *)data;
+	ringBuffer_t *rxRingBuffer = &rs485_rxRingBuffers[port->id];
+
+	uintptr_t avail = Rs485_ReadAvailable(port->id);
 	if (avail == 0) {
 		UART_Print(debug, "ERROR: UART received interrupt for zero bytes.\r\n");
 		return;
 	}
 
+	if ((port->frameIdleBitTimes != 0) || port->transactActive) {
+		receiveFrameBytes(port, avail);
+		return;
+	}
+
 	uint8_t buffer[avail];
-	if (Rs485_Read(buffer, avail) != ERROR_NONE) {
+	if (Rs485_Read(port->id, buffer, avail) != ERROR_NONE) {
 
 		UART_Printf(debug, "ERROR: Failed to read %zu bytes from UART.\r\n", avail);
 		return;
 	}
 
 #ifdef DEBUG_INFO
-	UART_Printf(debug, "Received %zu bytes from RS-485 bus: ", avail);
+	UART_Printf(debug, "Received %zu bytes from RS-485 bus %ld: ", avail, port->id);
 	for (uint32_t i = 0; i < avail; ++i) {
 		UART_Printf(debug, "%02x", buffer[i]);
 		if (i != avail - 1) {
@@ -234,20 +669,19 @@ static void HandleUartRxIrqDeferred(void)
 
 	// If the RX buffer overflows the desired limit, immediately send the bytes to the HLApp
 	// so to lower chances of losing bytes from the serial port in between GPT interrupts.
-	if (ring_buffer_count(&rs485_rxRingBuffer) > DRIVER_MAX_RX_BUFFER_FILL_SIZE)
+	if (ring_buffer_count(rxRingBuffer) > DRIVER_MAX_RX_BUFFER_FILL_SIZE)
 	{
 		handleSendMsgTimerWrapper(NULL);
 	}
 
 	// Enqueue the received bytes in the ring buffer, to be sent to the HLApp upon GPT interrupts.
-	if (ring_buffer_push_bytes(&rs485_rxRingBuffer, buffer, avail) == -1)
+	if (ring_buffer_push_bytes(rxRingBuffer, buffer, avail) == -1)
 	{
-		UART_Print(debug, "Message from UART LOST (rs485_rxRingBuffer overflow)!! ");
+		UART_Print(debug, "Message from UART LOST (rs485_rxRingBuffers overflow)!! ");
 	}
 }
-static void HandleUartRxIrq(void) {
-	static CallbackNode cbn = { .enqueued = false, .cb_void = HandleUartRxIrqDeferred, .cb_void_ptr = NULL, .data = NULL };
-	EnqueueCallback(&cbn);
+static void HandleUartRxIrq(uint32_t port) {
+	Scheduler_Post(&ports[port].uartRxTask);
 }
 
 _Noreturn void RTCoreMain(void)
@@ -257,13 +691,46 @@ _Noreturn void RTCoreMain(void)
 
 	// Initialize the debug UART
 	debug = UART_Open(MT3620_UNIT_UART_DEBUG, 115200, UART_PARITY_NONE, 1, NULL);
+#ifdef RS485_DEBUG_DEFERRED
+	UART_SetTxDeferred(debug, debugTx, sizeof(debugTx));
+#endif
 	UART_Print(debug, "RS-485 real-time driver\r\n");
 	UART_Print(debug, "Built on: " __DATE__ " " __TIME__ "\r\n");
 
-	// Initialize the RS-485 driver
-	Rs485_Init(9600, HandleUartRxIrq);
+	// GPT4 free runs at the CPU clock to measure task latency
+	GPT *latencyTimer = GPT_Open(MT3620_UNIT_GPT4, CPUFreq_Get(), GPT_MODE_NONE);
+	if (Scheduler_Init(latencyTimer) != ERROR_NONE) {
+		UART_Printf(debug, "ERROR: Scheduler_Init failed\r\n");
+		Scheduler_Init(NULL);
+	}
+
+	// Initialize the RS-485 driver, every port at the default baudrate
+	for (uint32_t i = 0; i < DRIVER_PORT_COUNT; i++)
+	{
+		Port *port = &ports[i];
+		port->id = i;
+		port->uartRxTask = (Scheduler_Task)SCHEDULER_TASK(HandleUartRxIrqDeferred, SCHEDULER_PRIORITY_HIGH, 0);
+		port->uartRxTask.data = port;
+		setBaudRate(port, DRIVER_ISU_DEFAULT_BAURATE);
+
+		if (!Rs485_Init(i, port->baudRate, HandleUartRxIrq)) {
+			UART_Printf(debug, "ERROR: port %ld initialisation failed\r\n", i);
+		}
+	}
 
-	// Setup GPT1 as "Write to HLApp" timer
+	// GPT3 times the idle gaps ending frames and the transactions' response timeouts of every
+	// port, GPT2 free runs to timestamp frames and to tell when those are due
+	portTimer = GPT_Open(MT3620_UNIT_GPT3, 1000000, GPT_MODE_ONE_SHOT);
+	timestampTimer = GPT_Open(MT3620_UNIT_GPT2, RS485_TIMESTAMP_HZ, GPT_MODE_NONE);
+	if (!portTimer || !timestampTimer || (GPT_Start_Freerun(timestampTimer) != ERROR_NONE)) {
+		UART_Printf(debug, "ERROR: frame mode timers initialisation failed\r\n");
+		GPT_Close(portTimer);
+		GPT_Close(timestampTimer);
+		portTimer = NULL;
+		timestampTimer = NULL;
+	}
+
+	// Setup GPT0 as "Write to HLApp" timer
 	sendTimer = GPT_Open(MT3620_UNIT_GPT0, MT3620_GPT_012_HIGH_SPEED, GPT_MODE_REPEAT);
 	if (!sendTimer) {
 		UART_Printf(debug, "ERROR: GPT_Open failed\r\n");
@@ -286,10 +753,8 @@ _Noreturn void RTCoreMain(void)
 	if (!socket) {
 		UART_Printf(debug, "ERROR: Socket_Open failed\r\n");
 	}
+	Socket_SetTxCallback(socket, handleSendSpaceWrapper);
 
-	for (;;) {
-		__asm__("wfi");
-		InvokeCallbacks();
-	}
+	Scheduler_Run();
 }
 
@@ -11,66 +11,137 @@
 #include "lib/UART.h"
 #include "rs485_driver.h"
 
-static Platform_Unit driverISU = DRIVER_ISU;
-static unsigned driverIsuBaudrate = DRIVER_ISU_DEFAULT_BAURATE;
-static uint8_t driverEnableGPIO = DRIVER_DE_GPIO;
-static UART *uart_handle = NULL;
-static void (*uart_rxIrq_callback)(void);
-
-uint8_t rxBuffer[DRIVER_MAX_RX_BUFFER_SIZE];
-ringBuffer_t rs485_rxRingBuffer;
-
-bool Rs485_Init(uint32_t baudrate, void (*rxIrqCallback)(void))
+// A port's UART, DE/!RE GPIO and line configuration
+typedef struct {
+	Platform_Unit isu;
+	uint8_t enableGPIO;
+	unsigned baudrate;
+	UART_Parity parity;
+	unsigned stopBits;
+	UART *handle;
+	void (*rxIrqCallback)(uint32_t port);
+	uint8_t rxBuffer[DRIVER_MAX_RX_BUFFER_SIZE];
+} Rs485Port;
+
+static const Platform_Unit driverISUs[] = DRIVER_ISUS;
+static const uint8_t driverEnableGPIOs[] = DRIVER_DE_GPIOS;
+static Rs485Port ports[DRIVER_PORT_COUNT];
+
+ringBuffer_t rs485_rxRingBuffers[DRIVER_PORT_COUNT];
+
+// The UART's RX callback takes no argument, these pass on which port it's for
+static void handleRxIrq0(void) { ports[0].rxIrqCallback(0); }
+#if DRIVER_PORT_COUNT > 1
+static void handleRxIrq1(void) { ports[1].rxIrqCallback(1); }
+#endif
+#if DRIVER_PORT_COUNT > 2
+static void handleRxIrq2(void) { ports[2].rxIrqCallback(2); }
+#endif
+#if DRIVER_PORT_COUNT > 3
+static void handleRxIrq3(void) { ports[3].rxIrqCallback(3); }
+#endif
+
+static void (* const rxIrqHandlers[DRIVER_PORT_COUNT])(void) = {
+	handleRxIrq0,
+#if DRIVER_PORT_COUNT > 1
+	handleRxIrq1,
+#endif
+#if DRIVER_PORT_COUNT > 2
+	handleRxIrq2,
+#endif
+#if DRIVER_PORT_COUNT > 3
+	handleRxIrq3,
+#endif
+};
+
+bool Rs485_Init(uint32_t port, uint32_t baudrate, void (*rxIrqCallback)(uint32_t port))
 {
-	if (baudrate == 0)
+	if ((port >= DRIVER_PORT_COUNT) || (baudrate == 0))
 		return false;
 
-	if (NULL != uart_handle)
+	Rs485Port *p = &ports[port];
+	if (NULL != p->handle)
+	{
+		UART_Close(p->handle);
+	}
+	else if (0 == p->baudrate)
 	{
-		UART_Close(uart_handle);
+		// First use of the port
+		p->isu = driverISUs[port];
+		p->enableGPIO = driverEnableGPIOs[port];
+		p->parity = UART_PARITY_NONE;
+		p->stopBits = 1;
 	}
 
-	driverIsuBaudrate = baudrate;
+	p->baudrate = baudrate;
 
 	// Initialize the RS-485 UART
 	if (NULL != rxIrqCallback)
 	{
-		uart_rxIrq_callback = rxIrqCallback;
+		p->rxIrqCallback = rxIrqCallback;
+	}
+	if (NULL == p->rxIrqCallback)
+	{
+		return false;
 	}
-	uart_handle = UART_Open(driverISU, driverIsuBaudrate, UART_PARITY_NONE, 1, uart_rxIrq_callback);
-	if (!uart_handle) {
+#ifdef RS485_UART_DMA
+	// RX fills a circular DMA buffer, the callback runs when it's half full or the line goes idle
+	p->handle = UART_OpenDMA(p->isu, p->baudrate, p->parity, p->stopBits,
+		rxIrqHandlers[port], DRIVER_DMA_IDLE_CHARS, rxIrqHandlers[port]);
+#else
+	p->handle = UART_Open(p->isu, p->baudrate, p->parity, p->stopBits, rxIrqHandlers[port]);
+#endif
+	if (!p->handle) {
 		return false;
 	}
 
 	// Setup the RX message queue to be sent to the HLApp
-	ring_buffer_init(&rs485_rxRingBuffer, rxBuffer, sizeof(rxBuffer));
+	ring_buffer_init(&rs485_rxRingBuffers[port], p->rxBuffer, sizeof(p->rxBuffer));
 
 	// Setup DE/!RE driver GPIO
-	GPIO_ConfigurePinForOutput(driverEnableGPIO);
-	GPIO_Write(driverEnableGPIO, false);
+	GPIO_ConfigurePinForOutput(p->enableGPIO);
+	GPIO_Write(p->enableGPIO, false);
 
 	return true;
 }
 
-inline void Rs485_Close(void)
+bool Rs485_SetLineConfig(uint32_t port, uint32_t baudrate, Rs485Parity parity, uint8_t stopBits)
+{
+	static const UART_Parity uartParity[] = {
+		[RS485_PARITY_NONE] = UART_PARITY_NONE,
+		[RS485_PARITY_ODD] = UART_PARITY_ODD,
+		[RS485_PARITY_EVEN] = UART_PARITY_EVEN
+	};
+
+	if ((port >= DRIVER_PORT_COUNT) || (NULL == ports[port].handle) ||
+		(baudrate > RS485_MAX_BAUDRATE) || (parity > RS485_PARITY_EVEN) || (stopBits < 1) || (stopBits > 2))
+		return false;
+
+	ports[port].parity = uartParity[parity];
+	ports[port].stopBits = stopBits;
+	return Rs485_Init(port, baudrate, NULL);
+}
+
+inline void Rs485_Close(uint32_t port)
 {
-	UART_Close(uart_handle);
-	uart_handle = NULL;
+	UART_Close(ports[port].handle);
+	ports[port].handle = NULL;
 }
 
-inline uintptr_t Rs485_ReadAvailable(void)
+inline uintptr_t Rs485_ReadAvailable(uint32_t port)
 {
-	return UART_ReadAvailable(uart_handle);
+	return UART_ReadAvailable(ports[port].handle);
 }
 
-inline int32_t Rs485_Read(void *data, uintptr_t size)
+inline int32_t Rs485_Read(uint32_t port, void *data, uintptr_t size)
 {
-	return UART_Read(uart_handle, data, size);
+	return UART_Read(ports[port].handle, data, size);
 }
 
-int32_t Rs485_Write(const void *data, uintptr_t size)
+int32_t Rs485_Write(uint32_t port, const void *data, uintptr_t size)
 {
 	int32_t res = ERROR_BUSY;
+	uint8_t driverEnableGPIO = ports[port].enableGPIO;
 
 	bool state;
 	if (GPIO_Read(driverEnableGPIO, &state) == ERROR_NONE && state == false)
@@ -80,13 +151,13 @@ int32_t Rs485_Write(const void *data, uintptr_t size)
 		GPIO_Write(driverEnableGPIO, true);
 
 		// Write to the RS-485 transceiver
-		int32_t res = UART_Write(uart_handle, data, size);
+		int32_t res = UART_Write(ports[port].handle, data, size);
 
 		if (ERROR_NONE == res)
 		{
 			// Wait for the UART's hardware TX buffer to empty
 			uint32_t retries = 0xFFFF;
-			while (retries && !UART_IsWriteComplete(uart_handle)) retries--;
+			while (retries && !UART_IsWriteComplete(ports[port].handle)) retries--;
 
 			if (retries == 0)
 			{
@@ -13,51 +13,74 @@
 //////////////////////////////////////////////////////////////////////////////////
 // GLOBAL VARIABLES
 //////////////////////////////////////////////////////////////////////////////////
-#define DRIVER_ISU						MT3620_UNIT_ISU0
+// The ports driven, port N on the Nth ISU and DE GPIO below. Ports beyond the first need their
+// ISUs and GPIOs listed in app_manifest.json, see RS485_PORT_COUNT in CMakeLists.txt
+#ifndef DRIVER_PORT_COUNT
+#define DRIVER_PORT_COUNT				1
+#endif
+#define DRIVER_ISUS						{ MT3620_UNIT_ISU0, MT3620_UNIT_ISU1, MT3620_UNIT_ISU2, MT3620_UNIT_ISU3 }
+#define DRIVER_DE_GPIOS					{ 42, 43, 44, 45 }
 #define DRIVER_ISU_DEFAULT_BAURATE		9600
-#define DRIVER_DE_GPIO					42
 #define DRIVER_MAX_RX_BUFFER_SIZE		2048
 #define DRIVER_MAX_RX_BUFFER_FILL_SIZE  2000
+#define DRIVER_DMA_IDLE_CHARS			1		// with RS485_UART_DMA, RX is handed over after a character time of silence
 
-extern ringBuffer_t rs485_rxRingBuffer;
+_Static_assert((DRIVER_PORT_COUNT >= 1) && (DRIVER_PORT_COUNT <= RS485_MAX_PORTS), "DRIVER_PORT_COUNT out of range");
+
+// Received bytes of each port, waiting to be sent to the HLApp
+extern ringBuffer_t rs485_rxRingBuffers[DRIVER_PORT_COUNT];
 
 
 /// <summary>
-/// This function initializes the internal RS-485 UART handle, DE GPIO and TX ring buffer.
+/// This function initializes a port's internal RS-485 UART handle, DE GPIO and RX ring buffer.
 /// </summary>
+/// <param name="port">The port, below DRIVER_PORT_COUNT.</param>
 /// <param name="baudrate">The baudrate to which the UART should be configured.</param>
-/// <param name="rxIrqCallback">A pointer to the function to be called upon an RX interrupt.
+/// <param name="rxIrqCallback">A pointer to the function to be called with the port upon an RX interrupt.
 /// If NULL the previous setting is retained (useful when just changing the baudrate).</param>
 /// <returns>'true' is the initialization succeeds, 'false' otherwise.</returns>
-bool Rs485_Init(uint32_t baudrate, void (*rxIrqCallback)(void));
+bool Rs485_Init(uint32_t port, uint32_t baudrate, void (*rxIrqCallback)(uint32_t port));
+
+/// <summary>
+/// Reinitializes a port's RS-485 UART with the given line configuration, which is kept by later Rs485_Init() calls.
+/// </summary>
+/// <param name="port">The port, below DRIVER_PORT_COUNT.</param>
+/// <param name="baudrate">The baudrate, up to RS485_MAX_BAUDRATE.</param>
+/// <param name="parity">The parity, an Rs485Parity.</param>
+/// <param name="stopBits">The number of stop bits, 1 or 2.</param>
+/// <returns>'true' is the configuration is valid and applied, 'false' otherwise.</returns>
+bool Rs485_SetLineConfig(uint32_t port, uint32_t baudrate, Rs485Parity parity, uint8_t stopBits);
 
 /// <summary>
-/// Closes the internal UART handle used by the RS-485 driver.
+/// Closes the internal UART handle used by a port of the RS-485 driver.
 /// </summary>
-/// <param name=""></param>
+/// <param name="port">The port, below DRIVER_PORT_COUNT.</param>
 /// <returns></returns>
-void Rs485_Close(void);
+void Rs485_Close(uint32_t port);
 
 /// <summary>
 /// This function returns the number of bytes currently buffered for a RS-485 UART.
 /// </summary>
+/// <param name="port">The port, below DRIVER_PORT_COUNT.</param>
 /// <returns>Number of bytes available to be read.</returns>
-uintptr_t Rs485_ReadAvailable(void);
+uintptr_t Rs485_ReadAvailable(uint32_t port);
 
 /// <summary>
-/// This function blocks until it has read size bytes from the RS-485 UART.
+/// This function blocks until it has read size bytes from a RS-485 UART.
 /// </summary>
+/// <param name="port">The port, below DRIVER_PORT_COUNT.</param>
 /// <param name="data">Start of buffer into which data should be written.</param>
 /// <param name="size">Size of data in bytes.</param>
 /// <returns>ERROR_NONE on success, or an error code.</returns>
-int32_t Rs485_Read(void *data, uintptr_t size);
+int32_t Rs485_Read(uint32_t port, void *data, uintptr_t size);
 
 /// <summary>
-/// <para>Buffers the supplied data and asynchronously writes it to the internal RS-485 UART handle.
+/// <para>Buffers the supplied data and asynchronously writes it to a port's internal RS-485 UART handle.
 /// If there is not enough space to buffer the data, then any unbuffered data will be discarded.
 /// The size of the buffer is defined by the TX_BUFFER_SIZE macro in lib\UART.c.</para>
 /// </summary>
+/// <param name="port">The port, below DRIVER_PORT_COUNT.</param>
 /// <param name="data">A pointer to the data buffer.</param>
 /// <param name="size">Size of the data buffer in bytes.</param>
 /// <returns>ERROR_NONE on success, or an error code.</returns>
-int32_t Rs485_Write(const void *data, uintptr_t size);
\ No newline at end of file
+int32_t Rs485_Write(uint32_t port, const void *data, uintptr_t size);
\ No newline at end of file
@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 // This is the maximum message size that the HLApp can send
 // to the RS-485 RTApp driver. This header is used by both Apps.
 #define MAX_HLAPP_MESSAGE_SIZE	64
@@ -12,4 +14,99 @@
 // any received bytes to the HLApp.
 // Bytes are any ways sent in case the received amount
 // overflows DRIVER_MAX_RX_BUFFER_FILL_SIZE (defined in rs485_driver.h).
-#define RTDRV_SEND_DELAY_MSEC	10
\ No newline at end of file
+#define RTDRV_SEND_DELAY_MSEC	10
+
+// Special commands from the HLApp start with four 0xFF... bytes, followed by a
+// little-endian uint16_t argument; the RTApp answers each one with an 8-byte
+// message of the same four bytes followed by 0x00000000 (OK) or 0xFFFFFFFF (failed).
+#define RS485_CMD_SET_BAUDRATE		0xffffffffUL	// argument: the baudrate
+#define RS485_CMD_SET_FRAME_MODE	0xfffffffeUL	// argument: idle gap in bit-times, 0 for stream mode
+
+// The baudrate argument above caps at 65535, RS485_CMD_SET_LINE_CONFIG sets the whole line
+// configuration instead: the message is an Rs485LineConfig, answered like the commands above.
+// The RX deadlines scale with the baudrate, so that rates up to 921600 keep up with the UART FIFO.
+#define RS485_CMD_SET_LINE_CONFIG	0xfffffffcUL
+#define RS485_MAX_BAUDRATE			921600
+
+typedef enum
+{
+	RS485_PARITY_NONE = 0,
+	RS485_PARITY_ODD = 1,
+	RS485_PARITY_EVEN = 2
+} Rs485Parity;
+
+typedef struct __attribute__((packed))
+{
+	uint32_t command;		// RS485_CMD_SET_LINE_CONFIG
+	uint32_t baudRate;		// up to RS485_MAX_BAUDRATE
+	uint8_t parity;			// an Rs485Parity
+	uint8_t stopBits;		// 1 or 2
+} Rs485LineConfig;
+
+// In frame mode the RTApp sends the HLApp exactly one message per bus frame, a frame
+// being the bytes received between two idle gaps on the line (i.e. a Modbus RTU
+// frame with a 3.5 character, 35 bit-times, gap). Each message is an Rs485FrameHeader
+// followed by its length bytes of payload.
+// In stream mode (the default) the received bytes are sent every RTDRV_SEND_DELAY_MSEC,
+// regardless of frame boundaries.
+#define RS485_MAX_FRAME_SIZE		256
+#define RS485_TIMESTAMP_HZ			32768			// Rs485FrameHeader.timestamp ticks per second
+#define RS485_FRAME_FLAG_OVERFLOW	0x01			// the frame was longer than RS485_MAX_FRAME_SIZE, the rest was dropped
+
+typedef struct __attribute__((packed))
+{
+	uint32_t timestamp;		// when the frame's first byte was read, in RS485_TIMESTAMP_HZ ticks
+	uint16_t length;
+	uint8_t flags;
+	uint8_t reserved;
+} Rs485FrameHeader;
+
+// A transaction writes a request to the bus and returns the response: the frame received after
+// it, ended by an idle gap (the frame mode's, or RS485_TRANSACT_IDLE_BIT_TIMES in stream mode).
+// The RTApp queues up to RS485_TRANSACT_QUEUE_SIZE requests and writes each one as soon as the
+// previous response has ended, answering every request with an Rs485TransactResponse followed
+// by the response bytes, or by none if no response started within the request's timeout.
+#define RS485_CMD_TRANSACT				0xfffffffdUL
+#define RS485_TRANSACT_QUEUE_SIZE		8
+#define RS485_TRANSACT_IDLE_BIT_TIMES	35
+#define RS485_TRANSACT_MAX_REQUEST_SIZE	(MAX_HLAPP_MESSAGE_SIZE - sizeof(Rs485TransactRequest))
+
+typedef enum
+{
+	RS485_TRANSACT_OK = 0,
+	RS485_TRANSACT_TIMEOUT = 1,			// no response within the timeout
+	RS485_TRANSACT_OVERFLOW = 2,		// the response was longer than RS485_MAX_FRAME_SIZE, the rest was dropped
+	RS485_TRANSACT_QUEUE_FULL = 3,
+	RS485_TRANSACT_FAILED = 4			// the request couldn't be written to the bus
+} Rs485TransactStatus;
+
+typedef struct __attribute__((packed))
+{
+	uint32_t command;		// RS485_CMD_TRANSACT
+	uint16_t id;			// echoed in the response
+	uint16_t timeoutMs;		// from the request's last byte to the response's first one
+} Rs485TransactRequest;		// followed by the request bytes
+
+typedef struct __attribute__((packed))
+{
+	uint32_t command;		// RS485_CMD_TRANSACT
+	uint16_t id;
+	uint8_t status;			// an Rs485TransactStatus
+	uint8_t reserved;
+} Rs485TransactResponse;	// followed by the response bytes
+
+// One RTApp can drive up to RS485_MAX_PORTS buses, each on its own ISU with its own line
+// configuration, framing and transactions. A message for a port other than 0 is prefixed with an
+// Rs485PortHeader, and so is every message the RTApp sends on behalf of such a port, i.e. the
+// command answers, frames, received bytes and transaction responses of port 1 all start with
+// [0xfb 0xff 0xff 0xff 0x01 0x00 0x00 0x00]. Messages without it are port 0's, so HLApps driving
+// a single bus are unchanged. MAX_HLAPP_MESSAGE_SIZE doesn't count the header.
+#define RS485_CMD_PORT				0xfffffffbUL
+#define RS485_MAX_PORTS				4
+
+typedef struct __attribute__((packed))
+{
+	uint32_t command;		// RS485_CMD_PORT
+	uint8_t port;			// 1 to RS485_MAX_PORTS - 1
+	uint8_t reserved[3];
+} Rs485PortHeader;			// followed by the port's message
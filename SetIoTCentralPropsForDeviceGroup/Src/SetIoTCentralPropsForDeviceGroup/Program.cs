@@ -8,7 +8,9 @@ using RestSharp;
 using System;
 using System.Collections.Generic;
 using System.Diagnostics;
+using System.IO;
 using System.Linq;
+using System.Threading;
 using System.Threading.Tasks;
 
 namespace SetIoTCentralPropsForDeviceGroup
@@ -32,12 +34,26 @@ namespace SetIoTCentralPropsForDeviceGroup
         /// </summary>
         private const string AzureSphereApiUri = "https://prod.core.sphere.azure.net";
         /// <summary>
+        /// Maximum number of REST requests (Azure Sphere and IoT Central) in flight at once.
+        /// </summary>
+        private const int MaxConcurrentRequests = 8;
+        private static readonly SemaphoreSlim RequestSlots = new SemaphoreSlim(MaxConcurrentRequests);
+        private static int RequestCount = 0;
+        /// <summary>
+        /// Each tenant's device list is cached for this long, use --refresh to ignore the cache.
+        /// </summary>
+        private static readonly TimeSpan DeviceCacheLifetime = TimeSpan.FromMinutes(15);
+        private static readonly string DeviceCacheFolder = Path.Combine(Path.GetTempPath(), "AzureSphereDeviceCache");
+        /// <summary>
         /// Program entry-point.
         /// </summary>
         /// <returns>Zero on success, otherwise non-zero.</returns>
 
         public static async Task<int> Main(string[] args)
         {
+            bool refresh = args.Contains("--refresh");
+            args = args.Where(a => a != "--refresh").ToArray();
+
             if (!validateCmdArgs(args))
                 return -1;
 
@@ -58,7 +74,7 @@ namespace SetIoTCentralPropsForDeviceGroup
                 return -1;
             }
 
-            string result = GetData("tenants", token);
+            string result = await GetDataAsync("tenants", token).ConfigureAwait(false);
 
             List<Tenant> tenantList = JsonConvert.DeserializeObject<List<Tenant>>(result);
 
@@ -73,12 +89,17 @@ namespace SetIoTCentralPropsForDeviceGroup
             string tenantId = string.Empty;
             string tenantName = string.Empty;
 
-            foreach (Tenant tenant in tenantList)
-            {
-                result = GetData($"tenants/{tenant.Id}/devices", token);
+            // Fetch every tenant's devices concurrently
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            List<Item>[] tenantDevices = await Task.WhenAll(tenantList.Select(tenant => GetTenantDevicesAsync(tenant, token, refresh))).ConfigureAwait(false);
 
-                Devices devices = JsonConvert.DeserializeObject<Devices>(result);
-                foreach (Item item in devices.Items)
+            int deviceCount = tenantDevices.Sum(list => list.Count);
+            double seconds = Math.Max(stopwatch.Elapsed.TotalSeconds, 0.001);
+            Console.WriteLine($"Listed {deviceCount} device(s) in {seconds:F1}s, {RequestCount} request(s), {deviceCount / seconds:F0} devices/s");
+
+            foreach (List<Item> devices in tenantDevices)
+            {
+                foreach (Item item in devices)
                 {
                     if (item.DeviceGroupId != null && item.DeviceGroupId == args[2])
                     {
@@ -97,29 +118,52 @@ namespace SetIoTCentralPropsForDeviceGroup
 
             string iotcAppUrl = args[0].TrimEnd('/');
 
-            foreach(string s in DeviceUpdateList)
+            // Update the devices in parallel, each device's requests share the request slots
+            stopwatch.Restart();
+            bool?[] updated = await Task.WhenAll(DeviceUpdateList.Select(s => UpdateDeviceAsync(iotcAppUrl, s.ToLower(), args[1], args[3]))).ConfigureAwait(false);
+
+            seconds = Math.Max(stopwatch.Elapsed.TotalSeconds, 0.001);
+            Console.WriteLine($"{updated.Count(u => u == true)} succeeded, {updated.Count(u => u == false)} failed, {updated.Count(u => u == null)} not in IoTC - {seconds:F1}s, {DeviceUpdateList.Count / seconds:F1} devices/s");
+
+            return 0;
+        }
+
+        /// <summary>
+        /// Set the property on one device, if it's in the IoTC app
+        /// </summary>
+        /// <returns>true if set, false if setting failed, null if the device isn't in IoTC</returns>
+        private static async Task<bool?> UpdateDeviceAsync(string iotcAppUrl, string deviceId, string token, string JsonContent)
+        {
+            if (!await isValidIoTCDevice(iotcAppUrl, deviceId, token).ConfigureAwait(false))
             {
-                if (isValidIoTCDevice(iotcAppUrl, s.ToLower(), args[1]))
-                {
-                    Console.Write($"Setting device id: {s} - ");
-                    string currentProperties=GetDeviceProperties(iotcAppUrl, s.ToLower(), args[1]);
-                    Debug.WriteLine(currentProperties);
-                    if (setIoTCDeviceProperties(iotcAppUrl, s.ToLower(), args[1], args[3],currentProperties))
-                    {
-                        Console.WriteLine("Successed");
-                    }
-                    else
-                    {
-                        Console.WriteLine("Failed");
-                    }
-                }
-                else
-                {
-                    Debug.WriteLine($"Device not found in IoTC: {s}");
-                }
+                Debug.WriteLine($"Device not found in IoTC: {deviceId}");
+                return null;
             }
 
-            return 0;
+            string currentProperties = await GetDeviceProperties(iotcAppUrl, deviceId, token).ConfigureAwait(false);
+            Debug.WriteLine(currentProperties);
+            bool ok = await setIoTCDeviceProperties(iotcAppUrl, deviceId, token, JsonContent, currentProperties).ConfigureAwait(false);
+            Console.WriteLine($"Setting device id: {deviceId} - " + (ok ? "Succeeded" : "Failed"));
+            return ok;
+        }
+
+        /// <summary>
+        /// Execute a REST request, waiting for one of the request slots
+        /// </summary>
+        private static async Task<IRestResponse> ExecuteAsync(string baseURI, IRestRequest request)
+        {
+            await RequestSlots.WaitAsync().ConfigureAwait(false);
+            try
+            {
+                RestClient client = new RestClient(baseURI);
+                IRestResponse response = await client.ExecuteAsync(request).ConfigureAwait(false);
+                Interlocked.Increment(ref RequestCount);
+                return response;
+            }
+            finally
+            {
+                RequestSlots.Release();
+            }
         }
 
         /// <summary>
@@ -190,8 +234,11 @@ namespace SetIoTCentralPropsForDeviceGroup
         /// <param name="currentProperties"></param> IoTC device properties (contains the device template)
         /// <returns></returns>
         // PUT https://appsubdomain.azureiotcentral.com/api/preview/devices/{deviceId}/properties
-        static bool setIoTCDeviceProperties(string baseURI, string deviceId, string token, string JsonContent, string currentProperties)
+        static async Task<bool> setIoTCDeviceProperties(string baseURI, string deviceId, string token, string JsonContent, string currentProperties)
         {
+            if (string.IsNullOrEmpty(currentProperties))
+                return false;
+
             // get first key from properties
             IList<JToken> templateObj = JObject.Parse(currentProperties);
             var iotcTemplate = ((JProperty)templateObj[0]).Name;
@@ -227,13 +274,11 @@ namespace SetIoTCentralPropsForDeviceGroup
 
             bool retVal = false;
 
-            RestClient client = new RestClient(baseURI);
-
             var request = new RestRequest($"api/preview/devices/{deviceId.ToLower()}/properties", Method.PUT);
             request.AddJsonBody(json);
 
             request.AddParameter("Authorization", token, ParameterType.HttpHeader);
-            var response = client.Execute(request);
+            var response = await ExecuteAsync(baseURI, request).ConfigureAwait(false);
 
             if (response.IsSuccessful)
             {
@@ -255,13 +300,12 @@ namespace SetIoTCentralPropsForDeviceGroup
         /// <param name="token"></param> Azure Sphere API Token
         /// <returns></returns>
         // GET https://appsubdomain.azureiotcentral.com/api/preview/devices/{deviceId}
-        private static bool isValidIoTCDevice(string baseURI, string deviceId, string token)
+        private static async Task<bool> isValidIoTCDevice(string baseURI, string deviceId, string token)
         {
             bool retVal = false;
-            RestClient client = new RestClient(baseURI);
             var request = new RestRequest($"api/preview/devices/{deviceId}", Method.GET);
             request.AddParameter("Authorization", token, ParameterType.HttpHeader);
-            var response = client.Execute(request);
+            var response = await ExecuteAsync(baseURI, request).ConfigureAwait(false);
 
             if (response.IsSuccessful)
             {
@@ -272,12 +316,11 @@ namespace SetIoTCentralPropsForDeviceGroup
         }
 
         // GET https://appsubdomain.azureiotcentral.com/api/preview/devices/{deviceId}
-        private static string GetDeviceProperties(string baseURI, string deviceId, string token)
+        private static async Task<string> GetDeviceProperties(string baseURI, string deviceId, string token)
         {
-            RestClient client = new RestClient(baseURI);
             var request = new RestRequest($"api/preview/devices/{deviceId.ToLower()}/properties", Method.GET);
             request.AddParameter("Authorization", token, ParameterType.HttpHeader);
-            var response = client.Execute(request);
+            var response = await ExecuteAsync(baseURI, request).ConfigureAwait(false);
 
             if (response.IsSuccessful)
             {
@@ -292,13 +335,17 @@ namespace SetIoTCentralPropsForDeviceGroup
         /// </summary>
         /// <param name="relativeUrl"></param> API path to execute
         /// <param name="token"></param> Azure Sphere API Token
+        /// <param name="continuationToken"></param> Continuation token from the previous page, if any
         /// <returns></returns>
-        private static string GetData(string relativeUrl, string token)
+        private static async Task<string> GetDataAsync(string relativeUrl, string token, string continuationToken = null)
         {
-            var client = new RestClient(AzureSphereApiUri);
             var request = new RestRequest($"/v2/{relativeUrl}", Method.GET);
             request.AddParameter("Authorization", string.Format("Bearer " + token), ParameterType.HttpHeader);
-            var response = client.Execute(request);
+            if (!string.IsNullOrEmpty(continuationToken))
+            {
+                request.AddParameter("Sphere-Continuation", continuationToken, ParameterType.HttpHeader);
+            }
+            var response = await ExecuteAsync(AzureSphereApiUri, request).ConfigureAwait(false);
 
             if (response.IsSuccessful)
             {
@@ -307,6 +354,46 @@ namespace SetIoTCentralPropsForDeviceGroup
             return string.Empty;
         }
 
+        /// <summary>
+        /// Get all of a tenant's devices, following continuation tokens, from the local cache if it's recent.
+        /// A list that fails part way is returned but not cached.
+        /// </summary>
+        /// <param name="tenant"></param> Azure Sphere tenant
+        /// <param name="token"></param> Azure Sphere API Token
+        /// <param name="refresh"></param> Ignore the cache
+        /// <returns></returns>
+        private static async Task<List<Item>> GetTenantDevicesAsync(Tenant tenant, string token, bool refresh)
+        {
+            string cacheFile = Path.Combine(DeviceCacheFolder, $"{tenant.Id}.json");
+            if (!refresh && File.Exists(cacheFile) && DateTime.UtcNow - File.GetLastWriteTimeUtc(cacheFile) < DeviceCacheLifetime)
+            {
+                return JsonConvert.DeserializeObject<List<Item>>(File.ReadAllText(cacheFile)) ?? new List<Item>();
+            }
+
+            List<Item> items = new List<Item>();
+            string continuationToken = null;
+            do
+            {
+                string result = await GetDataAsync($"tenants/{tenant.Id}/devices", token, continuationToken).ConfigureAwait(false);
+                if (string.IsNullOrEmpty(result))
+                {
+                    Console.WriteLine($"Failed to list the devices in tenant {tenant.Name}");
+                    return items;
+                }
+
+                Devices devices = JsonConvert.DeserializeObject<Devices>(result);
+                if (devices.Items != null)
+                {
+                    items.AddRange(devices.Items);
+                }
+                continuationToken = devices.ContinuationToken?.ToString();
+            } while (!string.IsNullOrEmpty(continuationToken));
+
+            Directory.CreateDirectory(DeviceCacheFolder);
+            File.WriteAllText(cacheFile, JsonConvert.SerializeObject(items));
+            return items;
+        }
+
         /// <summary>
         /// Get an Azure Sphere access token based on user login credentials
         /// </summary>
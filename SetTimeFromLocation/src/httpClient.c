@@ -0,0 +1,212 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "httpClient.h"
+
+#include <applibs/log.h>
+#include <curl/easy.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One handle per host: libcurl keeps a handle's connection open between requests, so
+// repeated calls to the same service skip the DNS lookup and the TCP and TLS handshakes.
+struct host_handle {
+	char host[64];
+	CURL* curl;
+	unsigned long lastUsed;
+};
+
+struct url_data {
+	size_t size;
+	size_t capacity;
+	char* data;
+};
+
+static struct host_handle hostHandles[HTTP_CLIENT_MAX_HOSTS];
+static struct url_data response;
+static unsigned long requestCount = 0;
+static bool initialized = false;
+
+static size_t write_data(void* ptr, size_t size, size_t nmemb, struct url_data* data)
+{
+	size_t n = (size * nmemb);
+
+	if (data->size + n + 1 > data->capacity) {	/* +1 for '\0' */
+		size_t capacity = data->capacity;
+		while (data->size + n + 1 > capacity) {
+			capacity *= 2;
+		}
+
+		char* tmp = realloc(data->data, capacity);
+		if (tmp == NULL) {
+			return 0;
+		}
+		data->data = tmp;
+		data->capacity = capacity;
+	}
+
+	memcpy((data->data + data->size), ptr, n);
+	data->size += n;
+	data->data[data->size] = '\0';
+
+	return n;
+}
+
+static bool HttpClient_Init(void)
+{
+	if (initialized) {
+		return true;
+	}
+
+	if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
+		Log_Debug("ERROR: curl_global_init failed\n");
+		return false;
+	}
+
+	response.data = malloc(HTTP_CLIENT_RESPONSE_SIZE);
+	if (response.data == NULL) {
+		curl_global_cleanup();
+		return false;
+	}
+	response.capacity = HTTP_CLIENT_RESPONSE_SIZE;
+
+	memset(hostHandles, 0x00, sizeof(hostHandles));
+	initialized = true;
+	return true;
+}
+
+void HttpClient_Cleanup(void)
+{
+	if (!initialized) {
+		return;
+	}
+
+	for (int i = 0; i < HTTP_CLIENT_MAX_HOSTS; i++) {
+		if (hostHandles[i].curl != NULL) {
+			curl_easy_cleanup(hostHandles[i].curl);
+		}
+	}
+	memset(hostHandles, 0x00, sizeof(hostHandles));
+
+	free(response.data);
+	memset(&response, 0x00, sizeof(response));
+
+	curl_global_cleanup();
+	initialized = false;
+}
+
+/// <summary>
+/// Returns the handle for the url's host, reset for a new request, creating it if needed.
+/// </summary>
+static CURL* GetHandle(const char* url)
+{
+	// "scheme://host[:port]/path" -> "host[:port]"
+	const char* host = strstr(url, "://");
+	host = (host != NULL) ? host + 3 : url;
+	size_t hostLen = strcspn(host, "/?#");
+
+	struct host_handle* slot = NULL;
+	for (int i = 0; i < HTTP_CLIENT_MAX_HOSTS; i++) {
+		struct host_handle* entry = &hostHandles[i];
+		if (entry->curl != NULL && strlen(entry->host) == hostLen && strncmp(entry->host, host, hostLen) == 0) {
+			slot = entry;
+			break;
+		}
+		if (slot == NULL || (slot->curl != NULL && (entry->curl == NULL || entry->lastUsed < slot->lastUsed))) {
+			slot = entry;
+		}
+	}
+
+	if (slot->curl != NULL && strlen(slot->host) == hostLen && strncmp(slot->host, host, hostLen) == 0) {
+		// drop the previous request's options, the live connection is kept
+		curl_easy_reset(slot->curl);
+	} else {
+		if (slot->curl != NULL) {
+			curl_easy_cleanup(slot->curl);
+		}
+		memset(slot, 0x00, sizeof(*slot));
+		if (hostLen >= sizeof(slot->host)) {
+			hostLen = sizeof(slot->host) - 1;
+		}
+		memcpy(slot->host, host, hostLen);
+
+		slot->curl = curl_easy_init();
+		if (slot->curl == NULL) {
+			return NULL;
+		}
+	}
+
+	slot->lastUsed = ++requestCount;
+
+	curl_easy_setopt(slot->curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(slot->curl, CURLOPT_DNS_CACHE_TIMEOUT, -1L);
+	curl_easy_setopt(slot->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+	curl_easy_setopt(slot->curl, CURLOPT_SSL_VERIFYHOST, 0L);
+#ifdef HTTP_CLIENT_USE_HTTP2
+	// Only takes effect if the libcurl in use was built with HTTP/2 support; otherwise HTTP/1.1 is used.
+	curl_easy_setopt(slot->curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+#endif
+
+	return slot->curl;
+}
+
+static const char* Perform(CURL* curl, const char* url, struct curl_slist* headers)
+{
+	response.size = 0;
+	response.data[0] = '\0';
+
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+	if (headers != NULL) {
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	}
+
+	CURLcode res = curl_easy_perform(curl);
+	if (res != CURLE_OK) {
+		Log_Debug("ERROR: %s: %s\n", url, curl_easy_strerror(res));
+		return NULL;
+	}
+
+	long status = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+	if (status < 200 || status > 299) {
+		Log_Debug("ERROR: %s: HTTP status %ld\n", url, status);
+		return NULL;
+	}
+
+	return response.data;
+}
+
+const char* HttpClient_Get(const char* url, struct curl_slist* headers)
+{
+	if (!HttpClient_Init()) {
+		return NULL;
+	}
+
+	CURL* curl = GetHandle(url);
+	if (curl == NULL) {
+		return NULL;
+	}
+
+	curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+	return Perform(curl, url, headers);
+}
+
+const char* HttpClient_Post(const char* url, const char* body, struct curl_slist* headers)
+{
+	if (!HttpClient_Init()) {
+		return NULL;
+	}
+
+	CURL* curl = GetHandle(url);
+	if (curl == NULL) {
+		return NULL;
+	}
+
+	curl_easy_setopt(curl, CURLOPT_POST, 1L);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)((body != NULL) ? strlen(body) : 0));
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (body != NULL) ? body : "");
+	return Perform(curl, url, headers);
+}
@@ -0,0 +1,33 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <curl/curl.h>
+
+// Hosts that keep a connected handle; the least recently used one is closed to make room.
+#ifndef HTTP_CLIENT_MAX_HOSTS
+#define HTTP_CLIENT_MAX_HOSTS	4
+#endif
+
+// Initial size of the response buffer, which grows (doubling) to fit larger responses.
+#ifndef HTTP_CLIENT_RESPONSE_SIZE
+#define HTTP_CLIENT_RESPONSE_SIZE	2048
+#endif
+
+/// <summary>
+/// HTTP GET of url. headers may be NULL.
+/// Returns the NUL terminated response body, which stays valid until the next request, or NULL
+/// if the request failed or the server didn't answer with a 2xx status.
+/// </summary>
+const char* HttpClient_Get(const char* url, struct curl_slist* headers);
+
+/// <summary>
+/// HTTP POST of body (NULL for an empty body) to url, with the same result as HttpClient_Get.
+/// </summary>
+const char* HttpClient_Post(const char* url, const char* body, struct curl_slist* headers);
+
+/// <summary>
+/// Close all the pooled connections and release libcurl.
+/// </summary>
+void HttpClient_Cleanup(void);
@@ -3,4 +3,5 @@
 
 #pragma once
 
-char * getHttpData(const char *url);
+// Returns the response body, valid until the next request, or NULL on failure.
+const char * getHttpData(const char *url);
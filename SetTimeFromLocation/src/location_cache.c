@@ -0,0 +1,76 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "location_cache.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+// Bump the version when struct location_cache changes, so an old cache is ignored.
+#define LOCATION_CACHE_MAGIC	0x4C4F4301	// "LOC" version 1
+
+struct location_cache_record {
+	uint32_t magic;
+	struct location_cache cache;
+};
+
+bool LocationCache_Load(struct location_cache* cache)
+{
+	struct location_cache_record record;
+
+	int fd = Storage_OpenMutableFile();
+	if (fd < 0)
+	{
+		Log_Debug("ERROR: Could not open mutable file: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	ssize_t bytesRead = read(fd, &record, sizeof(record));
+	close(fd);
+
+	if (bytesRead != sizeof(record) || record.magic != LOCATION_CACHE_MAGIC)
+	{
+		return false;
+	}
+
+	*cache = record.cache;
+	return true;
+}
+
+bool LocationCache_Save(const struct location_cache* cache)
+{
+	struct location_cache_record record = { .magic = LOCATION_CACHE_MAGIC, .cache = *cache };
+
+	int fd = Storage_OpenMutableFile();
+	if (fd < 0)
+	{
+		Log_Debug("ERROR: Could not open mutable file: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	ssize_t bytesWritten = write(fd, &record, sizeof(record));
+	close(fd);
+
+	if (bytesWritten != sizeof(record))
+	{
+		Log_Debug("ERROR: Could not write the location cache: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+bool LocationCache_IsCurrent(const struct location_cache* cache, const struct location_info* location)
+{
+	if (strncmp(cache->location.publicIp, location->publicIp, sizeof(location->publicIp)) != 0)
+	{
+		return false;
+	}
+
+	// a clock behind the lookup time hasn't been synchronized yet, so the age is unknown
+	int64_t now = (int64_t)time(NULL);
+	return now >= cache->fetchedAt && now - cache->fetchedAt < LOCATION_CACHE_TTL_SECONDS;
+}
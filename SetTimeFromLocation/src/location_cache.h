@@ -0,0 +1,36 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "location_from_ip.h"
+#include "settime.h"
+
+// A cached time zone is looked up again after this long, even if the public IP hasn't changed.
+#define LOCATION_CACHE_TTL_SECONDS	(24 * 60 * 60)
+
+// The last location and time zone found, kept in mutable storage.
+struct location_cache {
+	struct location_info location;	// includes the public IP address the location was found for
+	struct timezone_info timeZone;
+	int64_t fetchedAt;				// UTC time of the lookup
+};
+
+/// <summary>
+/// Read the cached location and time zone from mutable storage. Returns false if there's none.
+/// </summary>
+bool LocationCache_Load(struct location_cache* cache);
+
+/// <summary>
+/// Write the location and time zone to mutable storage.
+/// </summary>
+bool LocationCache_Save(const struct location_cache* cache);
+
+/// <summary>
+/// The cache is current if it was made for the same public IP less than LOCATION_CACHE_TTL_SECONDS ago.
+/// </summary>
+bool LocationCache_IsCurrent(const struct location_cache* cache, const struct location_info* location);
@@ -21,13 +21,14 @@ struct location_info* GetLocationData(void)
 {
 	memset(&locationInfo, 0x00, sizeof(locationInfo));
 
-	char* data = getHttpData(geoIfyURL);
+	const char* data = getHttpData(geoIfyURL);
 	if (data != NULL)
 	{
 		JSON_Value* rootProperties = NULL;
 		rootProperties = json_parse_string(data);
 		JSON_Object* rootObject = json_value_get_object(rootProperties);
 
+		const char* publicIp = json_object_get_string(rootObject, "ip");
 		const char* countryCode = json_object_get_string(rootObject, "country_code");
 		const char* latitude = json_object_get_string(rootObject, "latitude");
 		const char* longitude = json_object_get_string(rootObject, "longitude");
@@ -38,15 +39,13 @@ struct location_info* GetLocationData(void)
 		Log_Debug("Lat %f\n", lat);
 		Log_Debug("Lng %f\n", lng);
 
+		snprintf(locationInfo.publicIp, sizeof(locationInfo.publicIp), "%s", publicIp != NULL ? publicIp : "");
 		snprintf(locationInfo.countryCode, 10, countryCode);
 		locationInfo.lat = lat;
 		locationInfo.lng = lng;
 
 		// Free the memory allocated by the call to json_parse_string()
 		json_value_free(rootProperties);
-		
-		// need to free data since this was allocated in the getHttpData function.
-		free(data);
 		return &locationInfo;
 	}
 	return NULL;
@@ -4,6 +4,7 @@
 #pragma once
 
 struct location_info {
+	char publicIp[46];	// the device's public IP address, the location is looked up from
 	char countryCode[10];
 	double lat;
 	double lng;
@@ -10,6 +10,7 @@
 #include <applibs/networking.h>
 
 #include "location_from_ip.h"
+#include "location_cache.h"
 #include "settime.h"
 
 void delay(int ms)
@@ -24,6 +25,16 @@ int main(void)
 {
     Log_Debug("Starting application...\n");
 
+    // use the last time zone found straight away, the lookup below checks it's still right
+    struct location_cache cache;
+    bool haveCache = LocationCache_Load(&cache);
+    if (haveCache)
+    {
+        ApplyTimeZone(&cache.timeZone);
+        Log_Debug("Using cached time zone %s (UTC%+d s) for %s\n", cache.timeZone.abbreviation,
+                  (int)cache.timeZone.gmtOffset, cache.location.publicIp);
+    }
+
     bool isNetworkReady = false;
     while (!isNetworkReady)
     {
@@ -39,7 +50,17 @@ int main(void)
     struct location_info *locInfo = GetLocationData();
     if (locInfo != NULL)
     {
-        SetLocalTime(locInfo->lat, locInfo->lng);
+        // same public IP and not too old: the cached time zone stands, skip the time zone lookup
+        if (haveCache && LocationCache_IsCurrent(&cache, locInfo))
+        {
+            Log_Debug("Location unchanged, cached time zone is current\n");
+        }
+        else if (SetLocalTime(locInfo->lat, locInfo->lng, &cache.timeZone) == 0)
+        {
+            cache.location = *locInfo;
+            cache.fetchedAt = (int64_t)time(NULL);
+            LocationCache_Save(&cache);
+        }
     }
 
     // don't let the app exit.
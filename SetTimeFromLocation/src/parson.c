@@ -47,11 +47,21 @@
 #define sscanf THINK_TWICE_ABOUT_USING_SSCANF
 
 #define STARTING_CAPACITY 16
+/* In an arena nothing is freed until the whole document goes, so objects and arrays there grow
+   from a smaller capacity and aren't trimmed after parsing */
+#define ARENA_STARTING_CAPACITY 4
+#define ARENA_MIN_BLOCK_SIZE 256
+#define ARENA_ALIGN sizeof(double)
 #define MAX_NESTING 2048
+/* Objects with this many keys get a hash index on their first lookup, smaller ones are scanned */
+#define OBJECT_INDEX_THRESHOLD 32
+#define OBJECT_INDEX_EMPTY ((size_t)-1)
 
 #define FLOAT_FORMAT "%1.17g" /* do not increase precision without incresing NUM_BUF_SIZE */
 /* double printed with "%1.17g" shouldn't be longer than 25 bytes so let's use 64 */
 #define NUM_BUF_SIZE 64
+/* json_serialize_to_string starts with this much and doubles as the text grows */
+#define SERIALIZE_MIN_BUFFER_SIZE 256
 
 #define SIZEOF_TOKEN(a) (sizeof(a) - 1)
 #define SKIP_CHAR(str) ((*str)++)
@@ -67,6 +77,12 @@
 static JSON_Malloc_Function parson_malloc = malloc;
 static JSON_Free_Function parson_free = free;
 
+/* Arena the document being parsed is allocated from, NULL for the heap */
+static JSON_Arena *parse_arena = NULL;
+static int parse_into_arena = 0;
+/* Strings of the document being parsed are unescaped over the text itself, always into an arena */
+static int parse_in_situ = 0;
+
 #define IS_CONT(b) (((unsigned char)(b)&0xC0) == 0x80) /* is utf-8 continuation byte */
 
 /* Type definitions */
@@ -79,7 +95,20 @@ typedef union json_value_value {
     int null;
 } JSON_Value_Value;
 
+typedef struct json_arena_block_t {
+    struct json_arena_block_t *next;
+    size_t size;
+    size_t used;
+} JSON_Arena_Block;
+
+/* Bump allocator holding every part of one parsed document */
+struct json_arena_t {
+    JSON_Arena_Block *blocks;
+    JSON_Value *root;
+};
+
 struct json_value_t {
+    JSON_Arena *arena; /* arena the value, and its object or array, are allocated from, or NULL */
     JSON_Value *parent;
     JSON_Value_Type type;
     JSON_Value_Value value;
@@ -91,6 +120,8 @@ struct json_object_t {
     JSON_Value **values;
     size_t count;
     size_t capacity;
+    size_t *cells; /* open addressed index of names, item + 1 or 0 when empty, may be NULL */
+    size_t cell_capacity;
 };
 
 struct json_array_t {
@@ -100,9 +131,29 @@ struct json_array_t {
     size_t capacity;
 };
 
+/* Text being serialized. With data NULL it's only counted, otherwise it's written to data, which
+   is reallocated as it fills when growable and fails the serialization when not. length doesn't
+   count the terminator, room for it is always kept */
+typedef struct json_output_t {
+    char *data;
+    size_t length;
+    size_t capacity;
+    int growable;
+} JSON_Output;
+
+/* Arena */
+static JSON_Arena *json_arena_create(size_t size_hint);
+static void *json_arena_alloc(JSON_Arena *arena, size_t size);
+static void json_arena_release(JSON_Arena *arena);
+static void *parson_alloc(JSON_Arena *arena, size_t size);
+static void parson_release(JSON_Arena *arena, void *ptr);
+static void json_value_free_in_arena(JSON_Value *value);
+static JSON_Value *parse_root_value(const char **string);
+
 /* Various */
 static void remove_comments(char *string, const char *start_token, const char *end_token);
 static char *parson_strndup(const char *string, size_t n);
+static char *parson_strndup_in(JSON_Arena *arena, const char *string, size_t n);
 static char *parson_strdup(const char *string);
 static int hex_char_to_int(char c);
 static int parse_utf16_hex(const char *string, unsigned int *result);
@@ -110,15 +161,21 @@ static int num_bytes_in_utf8_sequence(unsigned char c);
 static int verify_utf8_sequence(const unsigned char *string, int *len);
 static int is_valid_utf8(const char *string, size_t string_len);
 static int is_decimal(const char *string, size_t length);
+static size_t hash_string(const char *string, size_t n);
 
 /* JSON Object */
 static JSON_Object *json_object_init(JSON_Value *wrapping_value);
 static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_Value *value);
 static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_t name_len,
                                     JSON_Value *value);
+static JSON_Status json_object_add_no_copy(JSON_Object *object, char *name, JSON_Value *value);
 static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity);
 static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
                                           size_t name_len);
+static size_t json_object_find(const JSON_Object *object, const char *name, size_t name_len);
+static JSON_Status json_object_build_index(JSON_Object *object);
+static void json_object_index_insert(JSON_Object *object, size_t item);
+static void json_object_drop_index(JSON_Object *object);
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
                                                int free_value);
 static JSON_Status json_object_dotremove_internal(JSON_Object *object, const char *name,
@@ -148,16 +205,133 @@ static JSON_Value *parse_null_value(const char **string);
 static JSON_Value *parse_value(const char **string, size_t nesting);
 
 /* Serialization */
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty,
-                                      char *num_buf);
-static int json_serialize_string(const char *string, char *buf);
-static int append_indent(char *buf, int level);
-static int append_string(char *buf, const char *string);
+static JSON_Status json_serialize_to_output_r(const JSON_Value *value, JSON_Output *out, int level,
+                                              int is_pretty, char *num_buf);
+static JSON_Status json_serialize_string(const char *string, JSON_Output *out);
+static JSON_Status append_indent(JSON_Output *out, int level);
+static JSON_Status append_string(JSON_Output *out, const char *string);
+static JSON_Status append_bytes(JSON_Output *out, const char *bytes, size_t n);
+static size_t json_serialization_size_r(const JSON_Value *value, int is_pretty);
+static JSON_Status json_serialize_to_buffer_with(const JSON_Value *value, char *buf,
+                                                 size_t buf_size_in_bytes, int is_pretty);
+static char *json_serialize_to_string_with(const JSON_Value *value, int is_pretty);
+
+/* Arena */
+static JSON_Arena *json_arena_create(size_t size_hint)
+{
+    JSON_Arena *arena = (JSON_Arena *)parson_malloc(sizeof(JSON_Arena));
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->blocks = NULL;
+    arena->root = NULL;
+    /* the first block is sized from the text, so most documents fit in one */
+    if (json_arena_alloc(arena, MAX(size_hint * 2, ARENA_MIN_BLOCK_SIZE)) == NULL) {
+        parson_free(arena);
+        return NULL;
+    }
+    arena->blocks->used = 0;
+    return arena;
+}
+
+static void *json_arena_alloc(JSON_Arena *arena, size_t size)
+{
+    JSON_Arena_Block *block = arena->blocks;
+    const size_t header_size = (sizeof(JSON_Arena_Block) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (block == NULL || block->size - block->used < size) {
+        size_t block_size = MAX(block ? block->size * 2 : 0, size);
+        block = (JSON_Arena_Block *)parson_malloc(header_size + block_size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    block->used += size;
+    return (char *)block + header_size + block->used - size;
+}
+
+static void json_arena_release(JSON_Arena *arena)
+{
+    JSON_Arena_Block *block = arena->blocks, *next = NULL;
+    while (block != NULL) {
+        next = block->next;
+        parson_free(block);
+        block = next;
+    }
+    parson_free(arena);
+}
+
+static void *parson_alloc(JSON_Arena *arena, size_t size)
+{
+    return arena ? json_arena_alloc(arena, size) : parson_malloc(size);
+}
+
+static void parson_release(JSON_Arena *arena, void *ptr)
+{
+    if (arena == NULL) {
+        parson_free(ptr);
+    }
+}
+
+/* Frees the parts of an arena value that aren't in its arena (values added after parsing), and
+   the arena itself if value is the document it was parsed for */
+static void json_value_free_in_arena(JSON_Value *value)
+{
+    size_t i;
+    JSON_Value *child = NULL;
+    size_t count = 0;
+    if (value->type == JSONObject) {
+        count = value->value.object->count;
+    } else if (value->type == JSONArray) {
+        count = value->value.array->count;
+    }
+    for (i = 0; i < count; i++) {
+        child = value->type == JSONObject ? value->value.object->values[i]
+                                          : value->value.array->items[i];
+        if (child->arena == value->arena) {
+            json_value_free_in_arena(child);
+        } else {
+            json_value_free(child);
+        }
+    }
+    if (value->arena->root == value) {
+        json_arena_release(value->arena);
+    }
+}
+
+static JSON_Value *parse_root_value(const char **string)
+{
+    JSON_Value *value = NULL;
+    if (!parse_into_arena) {
+        return parse_value(string, 0);
+    }
+    parse_arena = json_arena_create(strlen(*string));
+    if (parse_arena == NULL) {
+        return NULL;
+    }
+    value = parse_value(string, 0);
+    if (value == NULL) {
+        json_arena_release(parse_arena);
+    } else {
+        parse_arena->root = value;
+    }
+    parse_arena = NULL;
+    return value;
+}
 
 /* Various */
 static char *parson_strndup(const char *string, size_t n)
 {
-    char *output_string = (char *)parson_malloc(n + 1);
+    return parson_strndup_in(NULL, string, n);
+}
+
+static char *parson_strndup_in(JSON_Arena *arena, const char *string, size_t n)
+{
+    char *output_string = (char *)parson_alloc(arena, n + 1);
     if (!output_string) {
         return NULL;
     }
@@ -286,6 +460,18 @@ static int is_decimal(const char *string, size_t length)
     return 1;
 }
 
+/* FNV-1a */
+static size_t hash_string(const char *string, size_t n)
+{
+    size_t i;
+    unsigned long hash = 2166136261UL;
+    for (i = 0; i < n && string[i] != '\0'; i++) {
+        hash ^= (unsigned char)string[i];
+        hash *= 16777619UL;
+    }
+    return (size_t)hash;
+}
+
 static void remove_comments(char *string, const char *start_token, const char *end_token)
 {
     int in_string = 0, escaped = 0;
@@ -325,7 +511,7 @@ static void remove_comments(char *string, const char *start_token, const char *e
 /* JSON Object */
 static JSON_Object *json_object_init(JSON_Value *wrapping_value)
 {
-    JSON_Object *new_obj = (JSON_Object *)parson_malloc(sizeof(JSON_Object));
+    JSON_Object *new_obj = (JSON_Object *)parson_alloc(wrapping_value->arena, sizeof(JSON_Object));
     if (new_obj == NULL) {
         return NULL;
     }
@@ -334,6 +520,8 @@ static JSON_Object *json_object_init(JSON_Value *wrapping_value)
     new_obj->values = (JSON_Value **)NULL;
     new_obj->capacity = 0;
     new_obj->count = 0;
+    new_obj->cells = (size_t *)NULL;
+    new_obj->cell_capacity = 0;
     return new_obj;
 }
 
@@ -348,27 +536,46 @@ static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_V
 static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_t name_len,
                                     JSON_Value *value)
 {
-    size_t index = 0;
+    char *name_copy = NULL;
     if (object == NULL || name == NULL || value == NULL) {
         return JSONFailure;
     }
-    if (json_object_getn_value(object, name, name_len) != NULL) {
+    name_copy = parson_strndup_in(object->wrapping_value->arena, name, name_len);
+    if (name_copy == NULL) {
+        return JSONFailure;
+    }
+    if (json_object_add_no_copy(object, name_copy, value) == JSONFailure) {
+        parson_release(object->wrapping_value->arena, name_copy);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+/* Takes ownership of name on success, which must come from the object's arena (or the heap) */
+static JSON_Status json_object_add_no_copy(JSON_Object *object, char *name, JSON_Value *value)
+{
+    JSON_Arena *arena = object->wrapping_value->arena;
+    if (json_object_getn_value(object, name, strlen(name)) != NULL) {
         return JSONFailure;
     }
     if (object->count >= object->capacity) {
-        size_t new_capacity = MAX(object->capacity * 2, STARTING_CAPACITY);
+        size_t new_capacity =
+            MAX(object->capacity * 2, arena ? ARENA_STARTING_CAPACITY : STARTING_CAPACITY);
         if (json_object_resize(object, new_capacity) == JSONFailure) {
             return JSONFailure;
         }
     }
-    index = object->count;
-    object->names[index] = parson_strndup(name, name_len);
-    if (object->names[index] == NULL) {
-        return JSONFailure;
-    }
     value->parent = json_object_get_wrapping_value(object);
-    object->values[index] = value;
+    object->names[object->count] = name;
+    object->values[object->count] = value;
     object->count++;
+    if (object->cells != NULL) {
+        if (object->count * 2 > object->cell_capacity) {
+            json_object_drop_index(object); /* rebuilt larger on the next lookup */
+        } else {
+            json_object_index_insert(object, object->count - 1);
+        }
+    }
     return JSONSuccess;
 }
 
@@ -376,26 +583,27 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
 {
     char **temp_names = NULL;
     JSON_Value **temp_values = NULL;
+    JSON_Arena *arena = object->wrapping_value->arena;
 
     if ((object->names == NULL && object->values != NULL) ||
         (object->names != NULL && object->values == NULL) || new_capacity == 0) {
         return JSONFailure; /* Shouldn't happen */
     }
-    temp_names = (char **)parson_malloc(new_capacity * sizeof(char *));
+    temp_names = (char **)parson_alloc(arena, new_capacity * sizeof(char *));
     if (temp_names == NULL) {
         return JSONFailure;
     }
-    temp_values = (JSON_Value **)parson_malloc(new_capacity * sizeof(JSON_Value *));
+    temp_values = (JSON_Value **)parson_alloc(arena, new_capacity * sizeof(JSON_Value *));
     if (temp_values == NULL) {
-        parson_free(temp_names);
+        parson_release(arena, temp_names);
         return JSONFailure;
     }
     if (object->names != NULL && object->values != NULL && object->count > 0) {
         memcpy(temp_names, object->names, object->count * sizeof(char *));
         memcpy(temp_values, object->values, object->count * sizeof(JSON_Value *));
     }
-    parson_free(object->names);
-    parson_free(object->values);
+    parson_release(arena, object->names);
+    parson_release(arena, object->values);
     object->names = temp_names;
     object->values = temp_values;
     object->capacity = new_capacity;
@@ -405,42 +613,107 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
 static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
                                           size_t name_len)
 {
-    size_t i, name_length;
-    for (i = 0; i < json_object_get_count(object); i++) {
+    size_t i = json_object_find(object, name, name_len);
+    return i == OBJECT_INDEX_EMPTY ? NULL : object->values[i];
+}
+
+/* Returns the item holding name, or OBJECT_INDEX_EMPTY */
+static size_t json_object_find(const JSON_Object *object, const char *name, size_t name_len)
+{
+    size_t i, name_length, mask, cell;
+    if (object == NULL) {
+        return OBJECT_INDEX_EMPTY;
+    }
+    if (object->cells == NULL && object->count >= OBJECT_INDEX_THRESHOLD) {
+        /* A failed build only leaves the object without an index, so scan instead */
+        json_object_build_index((JSON_Object *)object);
+    }
+    if (object->cells != NULL) {
+        mask = object->cell_capacity - 1;
+        for (cell = hash_string(name, name_len) & mask; object->cells[cell] != 0;
+             cell = (cell + 1) & mask) {
+            i = object->cells[cell] - 1;
+            if (strlen(object->names[i]) == name_len &&
+                strncmp(object->names[i], name, name_len) == 0) {
+                return i;
+            }
+        }
+        return OBJECT_INDEX_EMPTY;
+    }
+    for (i = 0; i < object->count; i++) {
         name_length = strlen(object->names[i]);
         if (name_length != name_len) {
             continue;
         }
         if (strncmp(object->names[i], name, name_len) == 0) {
-            return object->values[i];
+            return i;
         }
     }
-    return NULL;
+    return OBJECT_INDEX_EMPTY;
+}
+
+/* Indexes every item, the table is kept at most half full */
+static JSON_Status json_object_build_index(JSON_Object *object)
+{
+    size_t i, cell_capacity = OBJECT_INDEX_THRESHOLD;
+    while (cell_capacity < object->capacity * 2 || cell_capacity < (object->count + 1) * 2) {
+        cell_capacity *= 2;
+    }
+    object->cells =
+        (size_t *)parson_alloc(object->wrapping_value->arena, cell_capacity * sizeof(size_t));
+    if (object->cells == NULL) {
+        return JSONFailure;
+    }
+    memset(object->cells, 0, cell_capacity * sizeof(size_t));
+    object->cell_capacity = cell_capacity;
+    for (i = 0; i < object->count; i++) {
+        json_object_index_insert(object, i);
+    }
+    return JSONSuccess;
+}
+
+static void json_object_index_insert(JSON_Object *object, size_t item)
+{
+    size_t mask = object->cell_capacity - 1;
+    size_t cell = hash_string(object->names[item], strlen(object->names[item])) & mask;
+    while (object->cells[cell] != 0) {
+        cell = (cell + 1) & mask;
+    }
+    object->cells[cell] = item + 1;
+}
+
+static void json_object_drop_index(JSON_Object *object)
+{
+    parson_release(object->wrapping_value->arena, object->cells);
+    object->cells = (size_t *)NULL;
+    object->cell_capacity = 0;
 }
 
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
                                                int free_value)
 {
     size_t i = 0, last_item_index = 0;
-    if (object == NULL || json_object_get_value(object, name) == NULL) {
+    if (object == NULL || name == NULL) {
+        return JSONFailure;
+    }
+    i = json_object_find(object, name, strlen(name));
+    if (i == OBJECT_INDEX_EMPTY) {
         return JSONFailure;
     }
     last_item_index = json_object_get_count(object) - 1;
-    for (i = 0; i < json_object_get_count(object); i++) {
-        if (strcmp(object->names[i], name) == 0) {
-            parson_free(object->names[i]);
-            if (free_value) {
-                json_value_free(object->values[i]);
-            }
-            if (i != last_item_index) { /* Replace key value pair with one from the end */
-                object->names[i] = object->names[last_item_index];
-                object->values[i] = object->values[last_item_index];
-            }
-            object->count -= 1;
-            return JSONSuccess;
-        }
+    parson_release(object->wrapping_value->arena, object->names[i]);
+    if (free_value) {
+        json_value_free(object->values[i]);
+    }
+    if (i != last_item_index) { /* Replace key value pair with one from the end */
+        object->names[i] = object->names[last_item_index];
+        object->values[i] = object->values[last_item_index];
     }
-    return JSONFailure; /* No execution path should end here */
+    object->count -= 1;
+    if (object->cells != NULL) {
+        json_object_drop_index(object); /* items have moved */
+    }
+    return JSONSuccess;
 }
 
 static JSON_Status json_object_dotremove_internal(JSON_Object *object, const char *name,
@@ -469,13 +742,14 @@ static void json_object_free(JSON_Object *object)
     }
     parson_free(object->names);
     parson_free(object->values);
+    parson_free(object->cells);
     parson_free(object);
 }
 
 /* JSON Array */
 static JSON_Array *json_array_init(JSON_Value *wrapping_value)
 {
-    JSON_Array *new_array = (JSON_Array *)parson_malloc(sizeof(JSON_Array));
+    JSON_Array *new_array = (JSON_Array *)parson_alloc(wrapping_value->arena, sizeof(JSON_Array));
     if (new_array == NULL) {
         return NULL;
     }
@@ -489,7 +763,9 @@ static JSON_Array *json_array_init(JSON_Value *wrapping_value)
 static JSON_Status json_array_add(JSON_Array *array, JSON_Value *value)
 {
     if (array->count >= array->capacity) {
-        size_t new_capacity = MAX(array->capacity * 2, STARTING_CAPACITY);
+        size_t new_capacity = MAX(array->capacity * 2, array->wrapping_value->arena
+                                                           ? ARENA_STARTING_CAPACITY
+                                                           : STARTING_CAPACITY);
         if (json_array_resize(array, new_capacity) == JSONFailure) {
             return JSONFailure;
         }
@@ -503,17 +779,18 @@ static JSON_Status json_array_add(JSON_Array *array, JSON_Value *value)
 static JSON_Status json_array_resize(JSON_Array *array, size_t new_capacity)
 {
     JSON_Value **new_items = NULL;
+    JSON_Arena *arena = array->wrapping_value->arena;
     if (new_capacity == 0) {
         return JSONFailure;
     }
-    new_items = (JSON_Value **)parson_malloc(new_capacity * sizeof(JSON_Value *));
+    new_items = (JSON_Value **)parson_alloc(arena, new_capacity * sizeof(JSON_Value *));
     if (new_items == NULL) {
         return JSONFailure;
     }
     if (array->items != NULL && array->count > 0) {
         memcpy(new_items, array->items, array->count * sizeof(JSON_Value *));
     }
-    parson_free(array->items);
+    parson_release(arena, array->items);
     array->items = new_items;
     array->capacity = new_capacity;
     return JSONSuccess;
@@ -532,10 +809,11 @@ static void json_array_free(JSON_Array *array)
 /* JSON Value */
 static JSON_Value *json_value_init_string_no_copy(char *string)
 {
-    JSON_Value *new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value));
+    JSON_Value *new_value = (JSON_Value *)parson_alloc(parse_arena, sizeof(JSON_Value));
     if (!new_value) {
         return NULL;
     }
+    new_value->arena = parse_arena;
     new_value->parent = NULL;
     new_value->type = JSONString;
     new_value->value.string = string;
@@ -621,7 +899,12 @@ static char *process_string(const char *input, size_t len)
     size_t initial_size = (len + 1) * sizeof(char);
     size_t final_size = 0;
     char *output = NULL, *output_ptr = NULL, *resized_output = NULL;
-    output = (char *)parson_malloc(initial_size);
+    if (parse_in_situ) {
+        /* escapes never get longer once processed, and each is read before it's overwritten */
+        output = (char *)input;
+    } else {
+        output = (char *)parson_alloc(parse_arena, initial_size);
+    }
     if (output == NULL) {
         goto error;
     }
@@ -672,6 +955,9 @@ static char *process_string(const char *input, size_t len)
         input_ptr++;
     }
     *output_ptr = '\0';
+    if (parse_arena != NULL) {
+        return output; /* shrinking would only take more of the arena */
+    }
     /* resize to new length */
     final_size = (size_t)(output_ptr - output) + 1;
     /* todo: don't resize if final_size == initial_size */
@@ -683,7 +969,9 @@ static char *process_string(const char *input, size_t len)
     parson_free(output);
     return resized_output;
 error:
-    parson_free(output);
+    if (!parse_in_situ) {
+        parson_release(parse_arena, output);
+    }
     return NULL;
 }
 
@@ -764,24 +1052,23 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
         }
         SKIP_WHITESPACES(string);
         if (**string != ':') {
-            parson_free(new_key);
+            parson_release(parse_arena, new_key);
             json_value_free(output_value);
             return NULL;
         }
         SKIP_CHAR(string);
         new_value = parse_value(string, nesting);
         if (new_value == NULL) {
-            parson_free(new_key);
+            parson_release(parse_arena, new_key);
             json_value_free(output_value);
             return NULL;
         }
-        if (json_object_add(output_object, new_key, new_value) == JSONFailure) {
-            parson_free(new_key);
+        if (json_object_add_no_copy(output_object, new_key, new_value) == JSONFailure) {
+            parson_release(parse_arena, new_key);
             json_value_free(new_value);
             json_value_free(output_value);
             return NULL;
         }
-        parson_free(new_key);
         SKIP_WHITESPACES(string);
         if (**string != ',') {
             break;
@@ -791,7 +1078,8 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
     }
     SKIP_WHITESPACES(string);
     if (**string != '}' || /* Trim object after parsing is over */
-        json_object_resize(output_object, json_object_get_count(output_object)) == JSONFailure) {
+        (parse_arena == NULL &&
+         json_object_resize(output_object, json_object_get_count(output_object)) == JSONFailure)) {
         json_value_free(output_value);
         return NULL;
     }
@@ -838,7 +1126,8 @@ static JSON_Value *parse_array_value(const char **string, size_t nesting)
     }
     SKIP_WHITESPACES(string);
     if (**string != ']' || /* Trim array after parsing is over */
-        json_array_resize(output_array, json_array_get_count(output_array)) == JSONFailure) {
+        (parse_arena == NULL &&
+         json_array_resize(output_array, json_array_get_count(output_array)) == JSONFailure)) {
         json_value_free(output_value);
         return NULL;
     }
@@ -855,7 +1144,7 @@ static JSON_Value *parse_string_value(const char **string)
     }
     value = json_value_init_string_no_copy(new_string);
     if (value == NULL) {
-        parson_free(new_string);
+        parson_release(parse_arena, new_string);
         return NULL;
     }
     return value;
@@ -899,32 +1188,29 @@ static JSON_Value *parse_null_value(const char **string)
 }
 
 /* Serialization */
-#define APPEND_STRING(str)                   \
-    do {                                     \
-        written = append_string(buf, (str)); \
-        if (written < 0) {                   \
-            return -1;                       \
-        }                                    \
-        if (buf != NULL) {                   \
-            buf += written;                  \
-        }                                    \
-        written_total += written;            \
+#define APPEND_STRING(str)                              \
+    do {                                                \
+        if (append_string(out, (str)) == JSONFailure) { \
+            return JSONFailure;                         \
+        }                                               \
+    } while (0)
+
+#define APPEND_BYTES(bytes, n)                                \
+    do {                                                      \
+        if (append_bytes(out, (bytes), (n)) == JSONFailure) { \
+            return JSONFailure;                               \
+        }                                                     \
     } while (0)
 
-#define APPEND_INDENT(level)                   \
-    do {                                       \
-        written = append_indent(buf, (level)); \
-        if (written < 0) {                     \
-            return -1;                         \
-        }                                      \
-        if (buf != NULL) {                     \
-            buf += written;                    \
-        }                                      \
-        written_total += written;              \
+#define APPEND_INDENT(level)                              \
+    do {                                                  \
+        if (append_indent(out, (level)) == JSONFailure) { \
+            return JSONFailure;                           \
+        }                                                 \
     } while (0)
 
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty,
-                                      char *num_buf)
+static JSON_Status json_serialize_to_output_r(const JSON_Value *value, JSON_Output *out, int level,
+                                              int is_pretty, char *num_buf)
 {
     const char *key = NULL, *string = NULL;
     JSON_Value *temp_value = NULL;
@@ -932,7 +1218,7 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
     JSON_Object *object = NULL;
     size_t i = 0, count = 0;
     double num = 0.0;
-    int written = -1, written_total = 0;
+    int written = -1;
 
     switch (json_value_get_type(value)) {
     case JSONArray:
@@ -947,14 +1233,10 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
                 APPEND_INDENT(level + 1);
             }
             temp_value = json_array_get_value(array, i);
-            written = json_serialize_to_buffer_r(temp_value, buf, level + 1, is_pretty, num_buf);
-            if (written < 0) {
-                return -1;
-            }
-            if (buf != NULL) {
-                buf += written;
+            if (json_serialize_to_output_r(temp_value, out, level + 1, is_pretty, num_buf) ==
+                JSONFailure) {
+                return JSONFailure;
             }
-            written_total += written;
             if (i < (count - 1)) {
                 APPEND_STRING(",");
             }
@@ -966,7 +1248,7 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             APPEND_INDENT(level);
         }
         APPEND_STRING("]");
-        return written_total;
+        return JSONSuccess;
     case JSONObject:
         object = json_value_get_object(value);
         count = json_object_get_count(object);
@@ -977,32 +1259,23 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
         for (i = 0; i < count; i++) {
             key = json_object_get_name(object, i);
             if (key == NULL) {
-                return -1;
+                return JSONFailure;
             }
             if (is_pretty) {
                 APPEND_INDENT(level + 1);
             }
-            written = json_serialize_string(key, buf);
-            if (written < 0) {
-                return -1;
-            }
-            if (buf != NULL) {
-                buf += written;
+            if (json_serialize_string(key, out) == JSONFailure) {
+                return JSONFailure;
             }
-            written_total += written;
             APPEND_STRING(":");
             if (is_pretty) {
                 APPEND_STRING(" ");
             }
             temp_value = json_object_get_value(object, key);
-            written = json_serialize_to_buffer_r(temp_value, buf, level + 1, is_pretty, num_buf);
-            if (written < 0) {
-                return -1;
-            }
-            if (buf != NULL) {
-                buf += written;
+            if (json_serialize_to_output_r(temp_value, out, level + 1, is_pretty, num_buf) ==
+                JSONFailure) {
+                return JSONFailure;
             }
-            written_total += written;
             if (i < (count - 1)) {
                 APPEND_STRING(",");
             }
@@ -1014,60 +1287,50 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             APPEND_INDENT(level);
         }
         APPEND_STRING("}");
-        return written_total;
+        return JSONSuccess;
     case JSONString:
         string = json_value_get_string(value);
         if (string == NULL) {
-            return -1;
-        }
-        written = json_serialize_string(string, buf);
-        if (written < 0) {
-            return -1;
-        }
-        if (buf != NULL) {
-            buf += written;
+            return JSONFailure;
         }
-        written_total += written;
-        return written_total;
+        return json_serialize_string(string, out);
     case JSONBoolean:
         if (json_value_get_boolean(value)) {
             APPEND_STRING("true");
         } else {
             APPEND_STRING("false");
         }
-        return written_total;
+        return JSONSuccess;
     case JSONNumber:
         num = json_value_get_number(value);
-        if (buf != NULL) {
-            num_buf = buf;
-        }
         written = sprintf(num_buf, FLOAT_FORMAT, num);
         if (written < 0) {
-            return -1;
-        }
-        if (buf != NULL) {
-            buf += written;
+            return JSONFailure;
         }
-        written_total += written;
-        return written_total;
+        APPEND_BYTES(num_buf, (size_t)written);
+        return JSONSuccess;
     case JSONNull:
         APPEND_STRING("null");
-        return written_total;
+        return JSONSuccess;
     case JSONError:
-        return -1;
+        return JSONFailure;
     default:
-        return -1;
+        return JSONFailure;
     }
 }
 
-static int json_serialize_string(const char *string, char *buf)
+static JSON_Status json_serialize_string(const char *string, JSON_Output *out)
 {
-    size_t i = 0, len = strlen(string);
+    size_t i = 0, run = 0, len = strlen(string);
     char c = '\0';
-    int written = -1, written_total = 0;
     APPEND_STRING("\"");
     for (i = 0; i < len; i++) {
         c = string[i];
+        if ((unsigned char)c >= 0x20 && c != '\"' && c != '\\' && c != '/') {
+            continue; /* appended with the rest of its run */
+        }
+        APPEND_BYTES(string + run, i - run);
+        run = i + 1;
         switch (c) {
         case '\"':
             APPEND_STRING("\\\"");
@@ -1180,37 +1443,106 @@ static int json_serialize_string(const char *string, char *buf)
             APPEND_STRING("\\u001f");
             break;
         default:
-            if (buf != NULL) {
-                buf[0] = c;
-                buf += 1;
-            }
-            written_total += 1;
             break;
         }
     }
+    APPEND_BYTES(string + run, len - run);
     APPEND_STRING("\"");
-    return written_total;
+    return JSONSuccess;
 }
 
-static int append_indent(char *buf, int level)
+static JSON_Status append_indent(JSON_Output *out, int level)
 {
     int i;
-    int written = -1, written_total = 0;
     for (i = 0; i < level; i++) {
         APPEND_STRING("    ");
     }
-    return written_total;
+    return JSONSuccess;
+}
+
+static JSON_Status append_string(JSON_Output *out, const char *string)
+{
+    return append_bytes(out, string, strlen(string));
+}
+
+static JSON_Status append_bytes(JSON_Output *out, const char *bytes, size_t n)
+{
+    size_t needed = out->length + n + 1, new_capacity = 0;
+    char *new_data = NULL;
+    if (out->data == NULL) {
+        out->length += n;
+        return JSONSuccess;
+    }
+    if (needed > out->capacity) {
+        if (!out->growable) {
+            return JSONFailure;
+        }
+        new_capacity = MAX(out->capacity * 2, needed);
+        new_data = (char *)parson_malloc(new_capacity);
+        if (new_data == NULL) {
+            return JSONFailure;
+        }
+        memcpy(new_data, out->data, out->length);
+        parson_free(out->data);
+        out->data = new_data;
+        out->capacity = new_capacity;
+    }
+    memcpy(out->data + out->length, bytes, n);
+    out->length += n;
+    return JSONSuccess;
+}
+
+static size_t json_serialization_size_r(const JSON_Value *value, int is_pretty)
+{
+    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
+                                   it only once */
+    JSON_Output out = {NULL, 0, 0, 0};
+    if (json_serialize_to_output_r(value, &out, 0, is_pretty, num_buf) == JSONFailure) {
+        return 0;
+    }
+    return out.length + 1;
 }
 
-static int append_string(char *buf, const char *string)
+static JSON_Status json_serialize_to_buffer_with(const JSON_Value *value, char *buf,
+                                                 size_t buf_size_in_bytes, int is_pretty)
 {
-    if (buf == NULL) {
-        return (int)strlen(string);
+    char num_buf[NUM_BUF_SIZE];
+    JSON_Output out;
+    if (buf == NULL || buf_size_in_bytes == 0) {
+        return JSONFailure;
     }
-    return sprintf(buf, "%s", string);
+    out.data = buf;
+    out.length = 0;
+    out.capacity = buf_size_in_bytes;
+    out.growable = 0;
+    if (json_serialize_to_output_r(value, &out, 0, is_pretty, num_buf) == JSONFailure) {
+        return JSONFailure;
+    }
+    out.data[out.length] = '\0';
+    return JSONSuccess;
+}
+
+static char *json_serialize_to_string_with(const JSON_Value *value, int is_pretty)
+{
+    char num_buf[NUM_BUF_SIZE];
+    JSON_Output out;
+    out.data = (char *)parson_malloc(SERIALIZE_MIN_BUFFER_SIZE);
+    if (out.data == NULL) {
+        return NULL;
+    }
+    out.length = 0;
+    out.capacity = SERIALIZE_MIN_BUFFER_SIZE;
+    out.growable = 1;
+    if (json_serialize_to_output_r(value, &out, 0, is_pretty, num_buf) == JSONFailure) {
+        parson_free(out.data);
+        return NULL;
+    }
+    out.data[out.length] = '\0';
+    return out.data;
 }
 
 #undef APPEND_STRING
+#undef APPEND_BYTES
 #undef APPEND_INDENT
 
 /* Parser API */
@@ -1222,7 +1554,7 @@ JSON_Value *json_parse_string(const char *string)
     if (string[0] == '\xEF' && string[1] == '\xBB' && string[2] == '\xBF') {
         string = string + 3; /* Support for UTF-8 BOM */
     }
-    return parse_value((const char **)&string, 0);
+    return parse_root_value((const char **)&string);
 }
 
 JSON_Value *json_parse_string_with_comments(const char *string)
@@ -1236,7 +1568,7 @@ JSON_Value *json_parse_string_with_comments(const char *string)
     remove_comments(string_mutable_copy, "/*", "*/");
     remove_comments(string_mutable_copy, "//", "\n");
     string_mutable_copy_ptr = string_mutable_copy;
-    result = parse_value((const char **)&string_mutable_copy_ptr, 0);
+    result = parse_root_value((const char **)&string_mutable_copy_ptr);
     parson_free(string_mutable_copy);
     return result;
 }
@@ -1443,6 +1775,10 @@ JSON_Value *json_value_get_parent(const JSON_Value *value)
 
 void json_value_free(JSON_Value *value)
 {
+    if (value != NULL && value->arena != NULL) {
+        json_value_free_in_arena(value);
+        return;
+    }
     switch (json_value_get_type(value)) {
     case JSONObject:
         json_object_free(value->value.object);
@@ -1461,15 +1797,16 @@ void json_value_free(JSON_Value *value)
 
 JSON_Value *json_value_init_object(void)
 {
-    JSON_Value *new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value));
+    JSON_Value *new_value = (JSON_Value *)parson_alloc(parse_arena, sizeof(JSON_Value));
     if (!new_value) {
         return NULL;
     }
+    new_value->arena = parse_arena;
     new_value->parent = NULL;
     new_value->type = JSONObject;
     new_value->value.object = json_object_init(new_value);
     if (!new_value->value.object) {
-        parson_free(new_value);
+        parson_release(parse_arena, new_value);
         return NULL;
     }
     return new_value;
@@ -1477,15 +1814,16 @@ JSON_Value *json_value_init_object(void)
 
 JSON_Value *json_value_init_array(void)
 {
-    JSON_Value *new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value));
+    JSON_Value *new_value = (JSON_Value *)parson_alloc(parse_arena, sizeof(JSON_Value));
     if (!new_value) {
         return NULL;
     }
+    new_value->arena = parse_arena;
     new_value->parent = NULL;
     new_value->type = JSONArray;
     new_value->value.array = json_array_init(new_value);
     if (!new_value->value.array) {
-        parson_free(new_value);
+        parson_release(parse_arena, new_value);
         return NULL;
     }
     return new_value;
@@ -1520,10 +1858,11 @@ JSON_Value *json_value_init_number(double number)
     if ((number * 0.0) != 0.0) { /* nan and inf test */
         return NULL;
     }
-    new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value));
+    new_value = (JSON_Value *)parson_alloc(parse_arena, sizeof(JSON_Value));
     if (new_value == NULL) {
         return NULL;
     }
+    new_value->arena = parse_arena;
     new_value->parent = NULL;
     new_value->type = JSONNumber;
     new_value->value.number = number;
@@ -1532,10 +1871,11 @@ JSON_Value *json_value_init_number(double number)
 
 JSON_Value *json_value_init_boolean(int boolean)
 {
-    JSON_Value *new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value));
+    JSON_Value *new_value = (JSON_Value *)parson_alloc(parse_arena, sizeof(JSON_Value));
     if (!new_value) {
         return NULL;
     }
+    new_value->arena = parse_arena;
     new_value->parent = NULL;
     new_value->type = JSONBoolean;
     new_value->value.boolean = boolean ? 1 : 0;
@@ -1544,10 +1884,11 @@ JSON_Value *json_value_init_boolean(int boolean)
 
 JSON_Value *json_value_init_null(void)
 {
-    JSON_Value *new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value));
+    JSON_Value *new_value = (JSON_Value *)parson_alloc(parse_arena, sizeof(JSON_Value));
     if (!new_value) {
         return NULL;
     }
+    new_value->arena = parse_arena;
     new_value->parent = NULL;
     new_value->type = JSONNull;
     return new_value;
@@ -1635,87 +1976,33 @@ JSON_Value *json_value_deep_copy(const JSON_Value *value)
 
 size_t json_serialization_size(const JSON_Value *value)
 {
-    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
-                                   it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 0, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    return json_serialization_size_r(value, 0);
 }
 
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes)
 {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
-        return JSONFailure;
-    }
-    written = json_serialize_to_buffer_r(value, buf, 0, 0, NULL);
-    if (written < 0) {
-        return JSONFailure;
-    }
-    return JSONSuccess;
+    return json_serialize_to_buffer_with(value, buf, buf_size_in_bytes, 0);
 }
 
 char *json_serialize_to_string(const JSON_Value *value)
 {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
-        return NULL;
-    }
-    buf = (char *)parson_malloc(buf_size_bytes);
-    if (buf == NULL) {
-        return NULL;
-    }
-    serialization_result = json_serialize_to_buffer(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure) {
-        json_free_serialized_string(buf);
-        return NULL;
-    }
-    return buf;
+    return json_serialize_to_string_with(value, 0);
 }
 
 size_t json_serialization_size_pretty(const JSON_Value *value)
 {
-    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
-                                   it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 1, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    return json_serialization_size_r(value, 1);
 }
 
 JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf,
                                             size_t buf_size_in_bytes)
 {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size_pretty(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
-        return JSONFailure;
-    }
-    written = json_serialize_to_buffer_r(value, buf, 0, 1, NULL);
-    if (written < 0) {
-        return JSONFailure;
-    }
-    return JSONSuccess;
+    return json_serialize_to_buffer_with(value, buf, buf_size_in_bytes, 1);
 }
 
 char *json_serialize_to_string_pretty(const JSON_Value *value)
 {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size_pretty(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
-        return NULL;
-    }
-    buf = (char *)parson_malloc(buf_size_bytes);
-    if (buf == NULL) {
-        return NULL;
-    }
-    serialization_result = json_serialize_to_buffer_pretty(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure) {
-        json_free_serialized_string(buf);
-        return NULL;
-    }
-    return buf;
+    return json_serialize_to_string_with(value, 1);
 }
 
 void json_free_serialized_string(char *string)
@@ -1876,20 +2163,15 @@ JSON_Status json_array_append_null(JSON_Array *array)
 JSON_Status json_object_set_value(JSON_Object *object, const char *name, JSON_Value *value)
 {
     size_t i = 0;
-    JSON_Value *old_value;
     if (object == NULL || name == NULL || value == NULL || value->parent != NULL) {
         return JSONFailure;
     }
-    old_value = json_object_get_value(object, name);
-    if (old_value != NULL) { /* free and overwrite old value */
-        json_value_free(old_value);
-        for (i = 0; i < json_object_get_count(object); i++) {
-            if (strcmp(object->names[i], name) == 0) {
-                value->parent = json_object_get_wrapping_value(object);
-                object->values[i] = value;
-                return JSONSuccess;
-            }
-        }
+    i = json_object_find(object, name, strlen(name));
+    if (i != OBJECT_INDEX_EMPTY) { /* free and overwrite old value */
+        json_value_free(object->values[i]);
+        value->parent = json_object_get_wrapping_value(object);
+        object->values[i] = value;
+        return JSONSuccess;
     }
     /* add new key value pair */
     return json_object_add(object, name, value);
@@ -2028,10 +2310,13 @@ JSON_Status json_object_clear(JSON_Object *object)
         return JSONFailure;
     }
     for (i = 0; i < json_object_get_count(object); i++) {
-        parson_free(object->names[i]);
+        parson_release(object->wrapping_value->arena, object->names[i]);
         json_value_free(object->values[i]);
     }
     object->count = 0;
+    if (object->cells != NULL) {
+        json_object_drop_index(object);
+    }
     return JSONSuccess;
 }
 
@@ -2200,3 +2485,30 @@ void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Fu
     parson_malloc = malloc_fun;
     parson_free = free_fun;
 }
+
+void json_set_arena_parsing(int enabled)
+{
+    parse_into_arena = enabled;
+}
+
+JSON_Value *json_parse_string_arena(const char *string)
+{
+    JSON_Value *result = NULL;
+    int was_enabled = parse_into_arena;
+    parse_into_arena = 1;
+    result = json_parse_string(string);
+    parse_into_arena = was_enabled;
+    return result;
+}
+
+JSON_Value *json_parse_string_in_situ(char *string)
+{
+    JSON_Value *result = NULL;
+    int was_enabled = parse_into_arena;
+    parse_into_arena = 1;
+    parse_in_situ = 1;
+    result = json_parse_string(string);
+    parse_in_situ = 0;
+    parse_into_arena = was_enabled;
+    return result;
+}
@@ -41,6 +41,7 @@ extern "C" {
 typedef struct json_object_t JSON_Object;
 typedef struct json_array_t JSON_Array;
 typedef struct json_value_t JSON_Value;
+typedef struct json_arena_t JSON_Arena;
 
 enum json_value_type {
     JSONError = -1,
@@ -63,6 +64,19 @@ typedef void (*JSON_Free_Function)(void *);
    from stdlib will be used for all allocations */
 void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun);
 
+/* Parses every document into an arena of its own: its values, names, strings and arrays come from a
+   few blocks (allocated with the functions above) rather than one allocation each, and
+   json_value_free on the root releases them in one go. Values later added to the document are
+   allocated as usual and freed with it. Off by default, json_parse_string_arena parses one document
+   that way regardless */
+void json_set_arena_parsing(int enabled);
+JSON_Value *json_parse_string_arena(const char *string);
+
+/* Parses into an arena like json_parse_string_arena, but names and string values are unescaped in
+   place and point into string, so the document takes no copy of them. string is modified, even if
+   parsing fails, and must outlive the returned value */
+JSON_Value *json_parse_string_in_situ(char *string);
+
 /*  Parses first JSON value in a string, returns NULL in case of error */
 JSON_Value *json_parse_string(const char *string);
 
@@ -70,7 +84,10 @@ JSON_Value *json_parse_string(const char *string);
     returns NULL in case of error */
 JSON_Value *json_parse_string_with_comments(const char *string);
 
-/* Serialization */
+/* Serialization
+   Each is a single pass over the value. json_serialize_to_buffer fails once the text doesn't fit in
+   buf, which is left partly written, and json_serialize_to_string grows its buffer as it goes, so
+   neither needs json_serialization_size first */
 size_t json_serialization_size(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes);
 char *json_serialize_to_string(const JSON_Value *value);
@@ -18,7 +18,26 @@ const char* TimeZoneAPITemplate = "https://api.timezonedb.com/v2.1/get-time-zone
 
 char urlWithParameters[128];	// buffer to hold REST API URL including lat/long.
 
-void SetLocalTime(double lat, double lng)
+void ApplyTimeZone(const struct timezone_info *tzInfo)
+{
+	// POSIX TZ offsets are west of UTC, e.g. "PST+08:00" for UTC-8
+	int32_t offset = tzInfo->gmtOffset;
+	char sign = (offset > 0) ? '-' : '+';
+	if (offset < 0)
+	{
+		offset = -offset;
+	}
+
+	// the name must be at least three letters
+	const char *name = (strlen(tzInfo->abbreviation) >= 3 && strspn(tzInfo->abbreviation, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz") == strlen(tzInfo->abbreviation)) ? tzInfo->abbreviation : "LOC";
+
+	char tz[32];
+	snprintf(tz, sizeof(tz), "%s%c%02d:%02d", name, sign, (int)(offset / 3600), (int)((offset % 3600) / 60));
+	setenv("TZ", tz, 1);
+	tzset();
+}
+
+int SetLocalTime(double lat, double lng, struct timezone_info *tzInfo)
 {
 	char localTimeBuffer[80];
 
@@ -26,34 +45,48 @@ void SetLocalTime(double lat, double lng)
 	if (ret >= sizeof(urlWithParameters))	// buffer isn't large enough.
 	{
 		Log_Debug("SetLocalTime, buffer is too small - cannot set local time\n");
-		return;
+		return -1;
 	}
 
-	char *data = getHttpData(urlWithParameters);
-
-	if (data != NULL)
+	const char *data = getHttpData(urlWithParameters);
+	if (data == NULL)
 	{
-		JSON_Value* rootValue = json_parse_string(data);
-		JSON_Object* rootObject = json_value_get_object(rootValue);
-		time_t timestamp = (time_t)json_object_get_number(rootObject, "timestamp");
+		return -1;
+	}
 
+	JSON_Value* rootValue = json_parse_string(data);
+	JSON_Object* rootObject = json_value_get_object(rootValue);
+	if (rootObject == NULL || !json_object_has_value(rootObject, "gmtOffset"))
+	{
+		Log_Debug("SetLocalTime, unexpected response: %s\n", data);
 		json_value_free(rootValue);
+		return -1;
+	}
 
-		struct timespec tv;
+	// timestamp is the local time, gmtOffset the local time's offset from UTC
+	time_t timestamp = (time_t)json_object_get_number(rootObject, "timestamp");
+	tzInfo->gmtOffset = (int32_t)json_object_get_number(rootObject, "gmtOffset");
+	const char *abbreviation = json_object_get_string(rootObject, "abbreviation");
+	snprintf(tzInfo->abbreviation, sizeof(tzInfo->abbreviation), "%s", abbreviation != NULL ? abbreviation : "");
 
-		tv.tv_nsec = 0;
-		tv.tv_sec = timestamp;	// replace with contents of json.
+	json_value_free(rootValue);
 
-		clock_settime(CLOCK_REALTIME, &tv);
+	struct timespec tv;
 
-		// show local time.
-		struct tm  ts;
-		ts = *localtime(&timestamp);
-		if (strftime(localTimeBuffer, sizeof(localTimeBuffer), "%a %Y-%m-%d %H:%M:%S", &ts) != 0)
-		{
-			Log_Debug("Time set to: %s\n", localTimeBuffer);
-		}
+	tv.tv_nsec = 0;
+	tv.tv_sec = timestamp - tzInfo->gmtOffset;	// UTC
 
-		free(data);
+	clock_settime(CLOCK_REALTIME, &tv);
+	ApplyTimeZone(tzInfo);
+
+	// show local time.
+	time_t now = time(NULL);
+	struct tm  ts;
+	ts = *localtime(&now);
+	if (strftime(localTimeBuffer, sizeof(localTimeBuffer), "%a %Y-%m-%d %H:%M:%S %Z", &ts) != 0)
+	{
+		Log_Debug("Time set to: %s\n", localTimeBuffer);
 	}
+
+	return 0;
 }
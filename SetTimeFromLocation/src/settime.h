@@ -3,4 +3,20 @@
 
 #pragma once
 
-void SetLocalTime(double lat, double lng);
+#include <stdint.h>
+
+struct timezone_info {
+	int32_t gmtOffset;		// seconds east of UTC, including daylight saving time
+	char abbreviation[8];	// e.g. "PST"
+};
+
+/// <summary>
+/// Look up the time zone at lat/lng, set the system clock (UTC) and apply the time zone.
+/// tzInfo receives the time zone. Returns 0 on success, -1 otherwise.
+/// </summary>
+int SetLocalTime(double lat, double lng, struct timezone_info *tzInfo);
+
+/// <summary>
+/// Make localtime() use the given time zone.
+/// </summary>
+void ApplyTimeZone(const struct timezone_info *tzInfo);
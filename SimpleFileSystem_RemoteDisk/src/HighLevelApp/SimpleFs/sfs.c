@@ -8,6 +8,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <ctype.h>
 
 #ifdef _WIN32
 	#define Log_Debug	printf
@@ -27,6 +28,45 @@ static uint32_t _totalBlocks = 0;	// Number of 512 byte blocks on the storage me
 static uint8_t rootBlock[BLOCK_SIZE];
 
 #define FS_SIG	0xffaa		// magic number to determine whether the root block is 'Simple FS'
+#define FS_SIG_V2	0xffab	// version 2, journaled and checksummed
+
+// Version 2 layout
+//   block 0, 1                 two copies of the root block, the valid one with the highest sequence is current
+//   block 2 .. 2+LOG_BLOCKS-1  journal, each block holds a directory update, written round robin
+//   block 2+LOG_BLOCKS ..      directories
+// A directory update (a file written or deleted) is written to the next journal block instead of
+// rewriting the root block, the root is only rewritten (to the other copy) once every
+// FS_LOG_BLOCKS updates, or when a directory is added. Root, journal and file header blocks carry
+// a CRC32, file headers also hold a CRC32 of the file data. A write torn by power loss fails its
+// CRC and is ignored at mount, leaving the state before it.
+#define FS_LOG_BLOCKS		16
+#define FS_LOG_FIRST_BLOCK	2
+#define FS_JOURNAL_SIG		0x4a524e4c
+
+// version 2, held in the last 16 bytes of the root block
+struct rootJournal
+{
+	uint32_t formatId;			// changes with each format, so journal entries from before it are ignored
+	uint32_t sequence;			// journal entries up to and including this one are in the root
+	uint32_t reserved;
+	uint32_t crc;				// CRC32 of the root block, with this field zero
+};
+
+// version 2 journal block
+struct journalEntry
+{
+	uint32_t sig;
+	uint32_t formatId;
+	uint32_t sequence;
+	uint32_t directoryIndex;
+	uint8_t directory[32];		// struct directory, as it is after the update
+	uint32_t crc;				// CRC32 of the entry, with this field zero
+};
+
+static int _version = 1;
+static uint32_t _sequence = 0;		// last journal entry written
+static uint32_t _rootSequence = 0;	// sequence held in the current root copy
+static uint32_t _rootCopy = 0;		// block holding the current root copy
 
 // root block, this stores the magic sig, total number of blocks (512 bytes per block), and number of provisioned directories
 struct root	// root is 16 bytes long (makes 32 byte alignment of directories easy to read)
@@ -55,6 +95,45 @@ struct directory	// directory is 32 bytes
 	uint32_t dirFull;			// 0 directory is not full, 1 directory is full
 };
 
+// Record files (see FS_AppendRecords) carry this after the fileEntry in their header block,
+// it's all zeros for other files.
+struct recordHeader
+{
+	uint32_t recordSize;		// size of each record, 0 if this isn't a record file
+	uint32_t consumed;			// number of records at the start of the file already consumed
+};
+
+// everything SimpleFs keeps in a file header block
+struct fileHeader
+{
+	struct fileEntry entry;
+	struct recordHeader records;
+	uint32_t dataCrc;			// version 2, CRC32 of the fileSize bytes of data
+	uint32_t crc;				// version 2, CRC32 of the header, with this field zero
+};
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// root block can hold at most 15 directories
+#define FS_MAX_DIRECTORIES ((BLOCK_SIZE - sizeof(struct root)) / sizeof(struct directory))
+
+// In-RAM index of the directories, built at mount and kept up to date by every write, so
+// looking a directory up or counting its files doesn't walk the root block, and the headers
+// of the oldest and newest files are only read from the block device once.
+struct directoryIndex
+{
+	char name[sizeof(((struct directory*)0)->dirName) + 1];	// lower case, NUL terminated
+	size_t nameLength;
+	uint32_t blocksPerFile;		// data blocks per file, not including the file header block
+	uint32_t numFiles;
+	bool oldestValid;			// oldest holds the header of the file at the tail
+	bool newestValid;			// newest holds the header of the file before the head
+	struct fileHeader oldest;
+	struct fileHeader newest;
+};
+
+static struct directoryIndex _directoryIndex[FS_MAX_DIRECTORIES];
+
 // Determine state of File System initialization - can be initialized but not mounted (init, format, then mount)
 static bool _init = false;
 static bool _mount = false;
@@ -63,6 +142,17 @@ static bool _mount = false;
 static int FS_GetFullDirectory(int dirOffset, struct directory* dir);
 static uint32_t FS_GetNumberOfBlocksPerFile(struct directory* dir);
 static int FS_WriteDirectoryToRoot(struct directory* dir, int directoryIndex);
+static void FS_IndexDirectory(int directoryIndex);
+static int FS_WriteRoot(void);
+static uint32_t FS_Crc32(uint32_t crc, const void* data, size_t size);
+static int FS_FindDirectory(const char* name);
+static int FS_GetOldestFileHeader(int directoryIndex, struct fileEntry* fileInfo);
+static struct fileHeader* FS_LoadOldestHeader(int directoryIndex);
+static struct fileHeader* FS_LoadNewestHeader(int directoryIndex);
+static int FS_AddFile(int directoryIndex, const char* fileName, const uint8_t* data, size_t size, uint32_t recordSize);
+static int FS_DeleteOldestFile(int directoryIndex);
+static int FS_ReadFileData(int directoryIndex, uint32_t slot, uint32_t offset, uint8_t* data, size_t size);
+static int FS_ReadWholeFile(int directoryIndex, uint32_t slot, const struct fileHeader* header, uint8_t* data);
 
 static bool FS_IsFileSystemReady(void)
 {
@@ -72,6 +162,158 @@ static bool FS_IsFileSystemReady(void)
 	return false;
 }
 
+/// <summary>
+/// CRC32 (IEEE), crc is 0 to start or the result of a previous call to continue it
+/// </summary>
+static uint32_t FS_Crc32(uint32_t crc, const void* data, size_t size)
+{
+	static uint32_t table[256];
+	static bool tableReady = false;
+
+	if (!tableReady)
+	{
+		for (uint32_t x = 0; x < 256; x++)
+		{
+			uint32_t c = x;
+			for (int bit = 0; bit < 8; bit++)
+				c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+			table[x] = c;
+		}
+		tableReady = true;
+	}
+
+	const uint8_t* p = data;
+	crc = ~crc;
+	while (size--)
+		crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+static struct rootJournal* FS_GetRootJournal(uint8_t* block)
+{
+	return (struct rootJournal*)(block + BLOCK_SIZE - sizeof(struct rootJournal));
+}
+
+static uint32_t FS_RootCrc(uint8_t* block)
+{
+	struct rootJournal* journal = FS_GetRootJournal(block);
+	uint32_t saved = journal->crc;
+
+	journal->crc = 0;
+	uint32_t crc = FS_Crc32(0, block, BLOCK_SIZE);
+	journal->crc = saved;
+
+	return crc;
+}
+
+/// <summary>
+/// Helper function to write the root block, for version 2 to the other root copy, so a torn write leaves the current one
+/// </summary>
+static int FS_WriteRoot(void)
+{
+	if (_version == 1)
+		return _writeBlockCallback(0, rootBlock, BLOCK_SIZE);
+
+	struct rootJournal* journal = FS_GetRootJournal(rootBlock);
+	journal->sequence = _sequence;
+	journal->crc = FS_RootCrc(rootBlock);
+
+	uint32_t copy = 1 - _rootCopy;
+	if (_writeBlockCallback(copy, rootBlock, BLOCK_SIZE) != 0)
+		return -1;
+
+	_rootCopy = copy;
+	_rootSequence = _sequence;
+	return 0;
+}
+
+/// <summary>
+/// Helper function to read a version 2 root copy, returns -1 if it isn't valid
+/// </summary>
+static int FS_ReadRootCopy(uint32_t copy, uint8_t* block)
+{
+	if (_readBlockCallback(copy, block, BLOCK_SIZE) != 0)
+		return -1;
+
+	struct root* pRoot = (struct root*)block;
+	if (pRoot->sig != FS_SIG_V2 || FS_GetRootJournal(block)->crc != FS_RootCrc(block))
+		return -1;
+
+	return 0;
+}
+
+static bool FS_ReadJournalEntry(uint32_t slot, struct journalEntry* entry)
+{
+	uint8_t block[BLOCK_SIZE];
+	if (_readBlockCallback(FS_LOG_FIRST_BLOCK + slot, block, BLOCK_SIZE) != 0)
+		return false;
+
+	memcpy(entry, block, sizeof(struct journalEntry));
+	uint32_t crc = entry->crc;
+	entry->crc = 0;
+
+	return entry->sig == FS_JOURNAL_SIG && crc == FS_Crc32(0, entry, sizeof(struct journalEntry))
+		&& entry->formatId == FS_GetRootJournal(rootBlock)->formatId;
+}
+
+/// <summary>
+/// Helper function to apply the journal entries written after the current root copy, in order
+/// </summary>
+static void FS_ReplayJournal(void)
+{
+	struct root* pRoot = (struct root*)rootBlock;
+	struct journalEntry entries[FS_LOG_BLOCKS];
+	bool valid[FS_LOG_BLOCKS];
+
+	for (uint32_t slot = 0; slot < FS_LOG_BLOCKS; slot++)
+		valid[slot] = FS_ReadJournalEntry(slot, &entries[slot]);
+
+	// entry n is in slot n % FS_LOG_BLOCKS, stop at the first one missing (or torn)
+	for (;;)
+	{
+		uint32_t slot = (_sequence + 1) % FS_LOG_BLOCKS;
+		if (!valid[slot] || entries[slot].sequence != _sequence + 1 || entries[slot].directoryIndex >= pRoot->numDirectories)
+			break;
+
+		memcpy(&dirList[entries[slot].directoryIndex], entries[slot].directory, sizeof(struct directory));
+		_sequence++;
+	}
+}
+
+/// <summary>
+/// Helper function to record a directory update, in the journal for version 2, otherwise by rewriting the root block
+/// </summary>
+static int FS_WriteJournal(int directoryIndex)
+{
+	if (_version == 1)
+		return _writeBlockCallback(0, rootBlock, BLOCK_SIZE);
+
+	// the journal is full once it holds every entry since the root, fold them into it
+	if (_sequence + 1 - _rootSequence > FS_LOG_BLOCKS)
+	{
+		if (FS_WriteRoot() != 0)
+			return -1;
+	}
+
+	uint8_t block[BLOCK_SIZE];
+	struct journalEntry* entry = (struct journalEntry*)block;
+
+	memset(block, 0x00, BLOCK_SIZE);
+	entry->sig = FS_JOURNAL_SIG;
+	entry->formatId = FS_GetRootJournal(rootBlock)->formatId;
+	entry->sequence = _sequence + 1;
+	entry->directoryIndex = (uint32_t)directoryIndex;
+	memcpy(entry->directory, &dirList[directoryIndex], sizeof(struct directory));
+	entry->crc = FS_Crc32(0, entry, sizeof(struct journalEntry));
+
+	if (_writeBlockCallback(FS_LOG_FIRST_BLOCK + (entry->sequence % FS_LOG_BLOCKS), block, BLOCK_SIZE) != 0)
+		return -1;
+
+	_sequence++;
+	return 0;
+}
+
 /// <summary>
 /// Initialize SimpleFs, this stores the read/write callbacks, attempts to load the root block, and verifies the root block signature
 /// </summary>
@@ -114,10 +356,49 @@ int FS_Mount(void)
 	}
 
 	struct root* pRoot = (struct root*)rootBlock;
-	if (pRoot->sig != FS_SIG || pRoot->storageNumBlocks == 0)
+	if (pRoot->sig == FS_SIG)
+	{
+		_version = 1;
+	}
+	else
+	{
+		// version 2, use whichever root copy is valid and newest, then catch up from the journal
+		uint8_t other[BLOCK_SIZE];
+		bool valid0 = FS_ReadRootCopy(0, rootBlock) == 0;
+		bool valid1 = FS_ReadRootCopy(1, other) == 0;
+
+		if (valid1 && (!valid0 || FS_GetRootJournal(other)->sequence > FS_GetRootJournal(rootBlock)->sequence))
+		{
+			memcpy(rootBlock, other, BLOCK_SIZE);
+			_rootCopy = 1;
+		}
+		else if (valid0)
+		{
+			_rootCopy = 0;
+		}
+		else
+		{
+			return -1;
+		}
+
+		_version = 2;
+		_rootSequence = FS_GetRootJournal(rootBlock)->sequence;
+		_sequence = _rootSequence;
+	}
+
+	if (pRoot->storageNumBlocks == 0 || pRoot->numDirectories > FS_MAX_DIRECTORIES)
 		return -1;
 
+	if (_version == 2)
+		FS_ReplayJournal();
+
 	_mount = true;
+
+	for (int x = 0; x < pRoot->numDirectories; x++)
+	{
+		FS_IndexDirectory(x);
+	}
+
 	return 0;
 }
 
@@ -138,16 +419,39 @@ int FS_Format(void)
 		return -1;
 	}
 
+	// the journal left by a previous format must not be replayed, so the format id moves on from it
+	uint8_t block[BLOCK_SIZE];
+	uint32_t formatId = (uint32_t)time(NULL);
+	for (uint32_t copy = 0; copy < 2; copy++)
+	{
+		if (FS_ReadRootCopy(copy, block) == 0 && FS_GetRootJournal(block)->formatId >= formatId)
+			formatId = FS_GetRootJournal(block)->formatId + 1;
+	}
+
 	struct root newRoot;
-	newRoot.sig = 0xffaa;
+	newRoot.sig = FS_SIG_V2;
 	newRoot.storageNumBlocks = _totalBlocks;
 	newRoot.numDirectories = 0;
 	memset(newRoot.reserved, 0x00, sizeof(newRoot.reserved));
 
 	memset(rootBlock, 0x00, BLOCK_SIZE);
 	memcpy(rootBlock, &newRoot, sizeof(struct root));
+	FS_GetRootJournal(rootBlock)->formatId = formatId;
+	memset(_directoryIndex, 0x00, sizeof(_directoryIndex));
+
+	_version = 2;
+	_sequence = 0;
+	_rootSequence = 0;
+
+	// the second copy is cleared, so it can't be newer than the first
+	memset(block, 0x00, BLOCK_SIZE);
+	if (_writeBlockCallback(1, block, BLOCK_SIZE) != 0)
+	{
+		return -1;
+	}
 
-	if (!_writeBlockCallback(0, rootBlock, BLOCK_SIZE) == 0)
+	_rootCopy = 1;
+	if (FS_WriteRoot() != 0)
 	{
 		return -1;
 	}
@@ -188,20 +492,18 @@ int FS_AddDirectory(struct dirEntry* dir)
 
 	// setup directory, add to root block and write 
 	struct root* pRoot = (struct root*)&rootBlock;
-	if (pRoot->numDirectories + 1 * sizeof(struct directory) + sizeof(struct root) > BLOCK_SIZE)
+	if ((pRoot->numDirectories + 1) * sizeof(struct directory) + sizeof(struct root) > BLOCK_SIZE)
 		return -1;		// not enough room for a new directory.
 
-	uint32_t nextBlock = 0;
-	// calc next start block position
+	// calc next start block position, after the root block (and journal) and the existing directories
+	uint32_t nextBlock = (_version == 1) ? 1 : FS_LOG_FIRST_BLOCK + FS_LOG_BLOCKS;
 	for (int x = 0; x < pRoot->numDirectories; x++)
 	{
-		// pDir = ; // FS_GetFullDirectory(x);
-		uint32_t numBlocks = FS_GetNumberOfBlocksPerFile(&newDir);
-		nextBlock += numBlocks;
+		uint32_t dirEnd = dirList[x].firstBlock + (dirList[x].maxFiles * (FS_GetNumberOfBlocksPerFile(&dirList[x]) + 1));
+		if (dirEnd > nextBlock)
+			nextBlock = dirEnd;
 	}
 
-	nextBlock++;	// skip the root block
-
 	// calculate the number of blocks needed for file (file size/512 - rounded up) + 1 block per file for header.
 	// Get NumBlocks per file
 	uint32_t numFileBlocks = FS_GetNumberOfBlocksPerFile(&newDir);
@@ -222,8 +524,9 @@ int FS_AddDirectory(struct dirEntry* dir)
 	// copy in the directory information
 	memcpy(&dirList[pRoot->numDirectories], &newDir, sizeof(struct directory));
 
+	FS_IndexDirectory(pRoot->numDirectories);
 	pRoot->numDirectories++;	// increment the number of directories
-	result = _writeBlockCallback(0, rootBlock, BLOCK_SIZE);
+	result = FS_WriteRoot();
 
 	if (result == -1)
 	{
@@ -275,30 +578,12 @@ int FS_GetDirectoryByName(char* dirName, struct dirEntry* dir)
 		return -1;
 	}
 
-	int numDirs = FS_GetNumberOfDirectories();
-	if (numDirs == -1 || numDirs == 0)
+	int dirNumber = FS_FindDirectory(dirName);
+	if (dirNumber == -1)
 		return -1;
 
-	struct dirEntry sDir;
-	for (int x = 0; x < numDirs; x++)
-	{
-		FS_GetDirectoryByIndex(x, &sDir);
-
-		int cmpResult = 0;
-#ifdef _WIN32
-		cmpResult=_strnicmp(dirName, sDir.dirName, strlen(dirName));
-#else
-		cmpResult = strncasecmp(dirName, sDir.dirName, strlen(dirName));
-#endif
-
-		if (cmpResult == 0)
-		{
-			memcpy(dir, &sDir, sizeof(struct dirEntry));
-			return 0;
-		}
-	}
-
-	return -1;
+	memcpy(dir, &dirList[dirNumber], sizeof(struct dirEntry));
+	return 0;
 }
 /// <summary>
 ///  helper function to get the full directory information for a directory index
@@ -347,42 +632,164 @@ int FS_GetNumberOfDirectories(void)
 }
 
 /// <summary>
-/// Internal helper function to return a directory index based on name
+/// Helper function to (re)build the index entry for a directory from the root block
 /// </summary>
-static int FS_GetDirectoryFromName(char* name, int* directoryIndex, struct dirEntry* dir)
+static void FS_IndexDirectory(int directoryIndex)
 {
-#ifdef SHOW_FUNCTION_TRACE
-	Log_Debug(">>> %s\n", __func__);
-#endif
+	struct directory* dir = &dirList[directoryIndex];
+	struct directoryIndex* index = &_directoryIndex[directoryIndex];
 
-	// If we haven't been initialized, bail.
-	if (!FS_IsFileSystemReady())
+	memset(index, 0x00, sizeof(struct directoryIndex));
+	for (size_t x = 0; x < sizeof(dir->dirName) && dir->dirName[x] != 0; x++)
 	{
-		return -1;
+		index->name[x] = (char)tolower(dir->dirName[x]);
+		index->nameLength++;
 	}
 
+	index->blocksPerFile = FS_GetNumberOfBlocksPerFile(dir);
+
+	if (dir->dirFull == 1)
+		index->numFiles = dir->maxFiles;
+	else if (dir->head >= dir->tail)
+		index->numFiles = dir->head - dir->tail;
+	else
+		index->numFiles = dir->maxFiles + dir->head - dir->tail;
+}
+
+/// <summary>
+/// Helper function to find a directory by name (case insensitive, name may be a prefix of the directory name)
+/// </summary>
+/// <returns> directory index, -1 if there's no such directory </returns>
+static int FS_FindDirectory(const char* name)
+{
 	struct root* pRoot = (struct root*)rootBlock;
-	if (pRoot->numDirectories == 0)
+	size_t length = strlen(name);
+
+	// directory names are at most 8 characters, a longer name can't match
+	if (length > sizeof(_directoryIndex[0].name) - 1)
+		return -1;
+
+	for (int x = 0; x < pRoot->numDirectories; x++)
+	{
+		if (length > _directoryIndex[x].nameLength)
+			continue;
+
+		size_t c = 0;
+		while (c < length && (char)tolower((unsigned char)name[c]) == _directoryIndex[x].name[c])
+			c++;
+
+		if (c == length)
+			return x;
+	}
+
+	return -1;
+}
+
+/// <summary>
+/// Helper function to get the first block (the header) of the file in a slot of a directory
+/// </summary>
+static uint32_t FS_GetFileHeaderBlock(int directoryIndex, uint32_t slot)
+{
+	return dirList[directoryIndex].firstBlock + (slot * (_directoryIndex[directoryIndex].blocksPerFile + 1));
+}
+
+static int FS_ReadFileHeader(int directoryIndex, uint32_t slot, struct fileHeader* header)
+{
+	uint8_t fileHeader[BLOCK_SIZE];
+	if (_readBlockCallback(FS_GetFileHeaderBlock(directoryIndex, slot), fileHeader, BLOCK_SIZE) == -1)
 		return -1;
 
-	int cmpResult = 0;
+	memcpy(header, fileHeader, sizeof(struct fileHeader));
 
-	for (uint16_t x = 0; x < pRoot->numDirectories; x++)
+	if (_version == 2)
 	{
-#ifdef _WIN32
-		cmpResult = _strnicmp(dirList[x].dirName, name, strlen(name));
-#else
-		cmpResult = strncasecmp(dirList[x].dirName, name, strlen(name));
-#endif
+		uint32_t crc = header->crc;
+		header->crc = 0;
+		if (crc != FS_Crc32(0, header, sizeof(struct fileHeader)))
+			return -1;
+		header->crc = crc;
+	}
 
-		if (cmpResult == 0)
-		{
-			*directoryIndex = x;	// needed to update the root block after writes
-			memcpy(dir, &dirList[x], sizeof(struct dirEntry));
-			return 0;
-		}
+	return 0;
+}
+
+static int FS_WriteFileHeader(int directoryIndex, uint32_t slot, const struct fileHeader* header)
+{
+	uint8_t fileHeader[BLOCK_SIZE];
+	memset(fileHeader, 0x00, BLOCK_SIZE);
+	memcpy(fileHeader, header, sizeof(struct fileHeader));
+
+	if (_version == 2)
+	{
+		struct fileHeader* written = (struct fileHeader*)fileHeader;
+		written->crc = 0;
+		written->crc = FS_Crc32(0, written, sizeof(struct fileHeader));
+	}
+
+	return _writeBlockCallback(FS_GetFileHeaderBlock(directoryIndex, slot), fileHeader, BLOCK_SIZE);
+}
+
+/// <summary>
+/// Helper function to keep the oldest and newest headers in step when they're the same file
+/// </summary>
+static void FS_SyncSingleFile(struct directoryIndex* index, const struct fileHeader* latest)
+{
+	if (index->numFiles != 1)
+		return;
+
+	memcpy(&index->oldest, latest, sizeof(struct fileHeader));
+	memcpy(&index->newest, latest, sizeof(struct fileHeader));
+	index->oldestValid = true;
+	index->newestValid = true;
+}
+
+/// <summary>
+/// Helper functions to get the header of the oldest/newest file in a directory, from the index when it's known
+/// </summary>
+/// <returns> NULL if the directory is empty or the header can't be read </returns>
+static struct fileHeader* FS_LoadOldestHeader(int directoryIndex)
+{
+	struct directoryIndex* index = &_directoryIndex[directoryIndex];
+
+	if (index->numFiles == 0)
+		return NULL;
+
+	if (!index->oldestValid)
+	{
+		if (FS_ReadFileHeader(directoryIndex, dirList[directoryIndex].tail, &index->oldest) == -1)
+			return NULL;
+		index->oldestValid = true;
 	}
 
+	return &index->oldest;
+}
+
+static struct fileHeader* FS_LoadNewestHeader(int directoryIndex)
+{
+	struct directoryIndex* index = &_directoryIndex[directoryIndex];
+	struct directory* dir = &dirList[directoryIndex];
+
+	if (index->numFiles == 0)
+		return NULL;
+
+	if (!index->newestValid)
+	{
+		uint32_t slot = (dir->head + dir->maxFiles - 1) % dir->maxFiles;
+		if (FS_ReadFileHeader(directoryIndex, slot, &index->newest) == -1)
+			return NULL;
+		index->newestValid = true;
+	}
+
+	return &index->newest;
+}
+
+static int FS_GetOldestFileHeader(int directoryIndex, struct fileEntry* fileInfo)
+{
+	struct fileHeader* header = FS_LoadOldestHeader(directoryIndex);
+	if (header == NULL)
+		return -1;
+
+	memcpy(fileInfo, &header->entry, sizeof(struct fileEntry));
 	return 0;
 }
 
@@ -404,7 +811,7 @@ static int FS_WriteDirectoryToRoot(struct directory* dir, int directoryIndex)
 	}
 
 	memcpy(&dirList[directoryIndex], dir, sizeof(struct directory));
-	int result = _writeBlockCallback(0, rootBlock, BLOCK_SIZE);
+	int result = FS_WriteJournal(directoryIndex);
 
 	return result;
 }
@@ -450,33 +857,11 @@ int FS_GetNumberOfFilesInDirectory(char* dirName)
 		return -1;
 	}
 
-	int dirIndex = 0;
-	struct dirEntry pDirEntry;
-	int result = FS_GetDirectoryFromName(dirName, &dirIndex, &pDirEntry);
-	if (result == -1)
+	int dirIndex = FS_FindDirectory(dirName);
+	if (dirIndex == -1)
 		return -1;
 
-	struct directory pDir;
-	FS_GetFullDirectory(dirIndex, &pDir);
-
-	// if directory is full then return the max number of items.
-	if (pDir.dirFull == 1)
-	{
-		return (int)pDir.maxFiles;
-	}
-
-	int numberOfFiles = 0;
-
-	if (pDir.head >= pDir.tail)
-	{
-		numberOfFiles = (int)(pDir.head - pDir.tail);
-	}
-	else
-	{
-		numberOfFiles = (int)(pDir.maxFiles + pDir.head - pDir.tail);
-	}
-
-	return numberOfFiles;
+	return (int)_directoryIndex[dirIndex].numFiles;
 }
 
 /// <summary>
@@ -496,32 +881,11 @@ int FS_GetOldestFileInfo(char* dirName, struct fileEntry* pFileEntry)
 		return -1;
 	}
 
-	uint8_t fileHeader[BLOCK_SIZE];
-
-	int numfilesInDir = FS_GetNumberOfFilesInDirectory(dirName);
-	if (numfilesInDir == 0)
-		return -1;
-
-	int dirIndex = 0;
-
-	struct dirEntry pDirEntry;
-	int result = FS_GetDirectoryFromName(dirName, &dirIndex, &pDirEntry);
-	if (result == -1)
-		return -1;
-
-	struct directory pDir;
-	FS_GetFullDirectory(dirIndex, &pDir);
-
-	uint32_t numBlocksPerFile = FS_GetNumberOfBlocksPerFile(&pDir);
-	result = _readBlockCallback(pDir.firstBlock + (pDir.tail * (numBlocksPerFile + 1)), fileHeader, BLOCK_SIZE);
-	if (result == -1)
+	int dirIndex = FS_FindDirectory(dirName);
+	if (dirIndex == -1 || _directoryIndex[dirIndex].numFiles == 0)
 		return -1;
 
-	struct file* pFile = (struct file*)fileHeader;
-
-	memcpy(pFileEntry, pFile, sizeof(struct fileEntry));
-
-	return 0;
+	return FS_GetOldestFileHeader(dirIndex, pFileEntry);
 }
 
 /// <summary>
@@ -546,53 +910,23 @@ int FS_ReadOldestFile(char* dirName, uint8_t* data, size_t size)
 		return -1;
 	}
 
-	uint8_t fileHeader[BLOCK_SIZE];
-
-	int numfilesInDir = FS_GetNumberOfFilesInDirectory(dirName);
-	if (numfilesInDir == -1)
-		return -1;
-
-	int dirIndex = 0;
-	struct dirEntry pDirEntry;
-	int result = FS_GetDirectoryFromName(dirName, &dirIndex, &pDirEntry);
-	if (result == -1)
+	int dirIndex = FS_FindDirectory(dirName);
+	if (dirIndex == -1)
 		return -1;
 
 	struct directory pDir;
 	FS_GetFullDirectory(dirIndex, &pDir);
 
-	uint32_t numBlocksPerFile = FS_GetNumberOfBlocksPerFile(&pDir);		// doesn't include the file header block
-
-	// read the header of the file
-	uint32_t fileHeaderBlock = pDir.firstBlock + (pDir.tail * (numBlocksPerFile + 1));
-	uint32_t fileDataBlock = fileHeaderBlock + 1;
-
-	result = _readBlockCallback(fileHeaderBlock, fileHeader, BLOCK_SIZE);
-	if (result == -1)
+	// the header of the file, usually already known from FS_GetOldestFileInfo
+	struct fileHeader* header = FS_LoadOldestHeader(dirIndex);
+	if (header == NULL)
 		return -1;
 
-	struct fileEntry* pFile = (struct fileEntry*)fileHeader;
-
 	// requesting more bytes than are in the file.
-	if (size > pFile->fileSize)
+	if (size > header->entry.fileSize)
 		return -1;
 
-	uint32_t numBlocksToRead = pFile->fileSize / BLOCK_SIZE;
-	if (pFile->fileSize % BLOCK_SIZE != 0)
-		numBlocksToRead++;
-
-	uint32_t bytesToRead = pFile->fileSize;
-
-	uint8_t block[BLOCK_SIZE];
-
-	for (uint32_t x = 0; x < numBlocksToRead; x++)
-	{
-		_readBlockCallback(fileDataBlock + x, block, BLOCK_SIZE);
-		memcpy(data + (x * BLOCK_SIZE), block, bytesToRead >= BLOCK_SIZE ? BLOCK_SIZE : bytesToRead);
-		bytesToRead -= BLOCK_SIZE;
-	}
-
-	return 0;
+	return FS_ReadWholeFile(dirIndex, pDir.tail, header, data);
 }
 
 /// <summary>
@@ -612,19 +946,21 @@ int FS_DeleteOldestFileInDirectory(char* dirName)
 		return -1;
 	}
 
-	int dirIndex = 0;
-	struct dirEntry pDirEntry;
-	int result = FS_GetDirectoryFromName(dirName, &dirIndex, &pDirEntry);
-	if (result == -1)
+	int dirIndex = FS_FindDirectory(dirName);
+	if (dirIndex == -1)
 		return -1;
 
-	struct directory pDir;
-	FS_GetFullDirectory(dirIndex, &pDir);
+	return FS_DeleteOldestFile(dirIndex);
+}
 
-	int numFiles = FS_GetNumberOfFilesInDirectory(dirName);
+static int FS_DeleteOldestFile(int directoryIndex)
+{
+	struct directory pDir;
+	FS_GetFullDirectory(directoryIndex, &pDir);
 
 	// no files, nothing to delete
-	if (numFiles == 0)
+	struct directoryIndex* index = &_directoryIndex[directoryIndex];
+	if (index->numFiles == 0)
 		return -1;
 
 	// mark the directory as 'not full'
@@ -632,7 +968,14 @@ int FS_DeleteOldestFileInDirectory(char* dirName)
 	// no need to actually delete the file, simply move the head/tail pointers in the directory
 	pDir.tail = (pDir.tail + 1) % pDir.maxFiles;
 
-	result = FS_WriteDirectoryToRoot(&pDir, dirIndex);
+	index->numFiles--;
+	index->oldestValid = false;
+	if (index->numFiles == 0)
+		index->newestValid = false;
+	else if (index->newestValid)
+		FS_SyncSingleFile(index, &index->newest);
+
+	int result = FS_WriteDirectoryToRoot(&pDir, directoryIndex);
 
 	return result;
 }
@@ -658,14 +1001,26 @@ int FS_WriteFile(char* dirName, char* fileName, uint8_t* data, size_t size)
 		return -1;
 	}
 
-	int currentDirectoryIndex = 0;
-	struct fileEntry newFile;
-
-	struct dirEntry pDirEntry;
-	int result = FS_GetDirectoryFromName(dirName, &currentDirectoryIndex, &pDirEntry);
-	if (result == -1)
+	int currentDirectoryIndex = FS_FindDirectory(dirName);
+	if (currentDirectoryIndex == -1)
 		return -1;
 
+#ifdef FS_TRACE
+	Log_Debug("----------------------------------\n");
+	Log_Debug("Directory '%s', file '%s'\n", dirName, fileName);
+#endif
+
+	return FS_AddFile(currentDirectoryIndex, fileName, data, size, 0);
+}
+
+/// <summary>
+/// Helper function to write a new file at the head of a directory, recordSize is 0 unless it's a record file
+/// </summary>
+static int FS_AddFile(int currentDirectoryIndex, const char* fileName, const uint8_t* data, size_t size, uint32_t recordSize)
+{
+	struct fileHeader newFile;
+	struct directoryIndex* index = &_directoryIndex[currentDirectoryIndex];
+
 	// Get the directory information
 	struct directory currentDir;
 	FS_GetFullDirectory(currentDirectoryIndex, &currentDir);
@@ -677,23 +1032,19 @@ int FS_WriteFile(char* dirName, char* fileName, uint8_t* data, size_t size)
 	}
 
 	// calculate the number of blocks needed to write the file.
-	uint32_t numBlocksPerFile = FS_GetNumberOfBlocksPerFile(&currentDir);	// this is the number of blocks for the data, not including the file header
+	uint32_t numBlocksPerFile = index->blocksPerFile;	// this is the number of blocks for the data, not including the file header
 	uint32_t fileHeaderBlock = (currentDir.head * (numBlocksPerFile + 1)) + currentDir.firstBlock;	// physical block number for the file header
 	uint32_t fileDataBlock = fileHeaderBlock + 1;	// point to the first block of the file data
 
-	memset(&newFile, 0x00, sizeof(struct fileEntry));
-	snprintf(newFile.fileName,32, fileName);
-	newFile.fileSize = size;	// set the number of bytes
+	memset(&newFile, 0x00, sizeof(struct fileHeader));
+	snprintf((char*)newFile.entry.fileName, sizeof(newFile.entry.fileName), "%s", fileName);
+	newFile.entry.fileSize = size;	// set the number of bytes
+	newFile.records.recordSize = recordSize;
+	newFile.dataCrc = FS_Crc32(0, data, size);
 
 	// add date time to file info
 	time_t fileTime=time(NULL);
-	newFile.datetime = (uint32_t)fileTime;
-
-	// setup the file header block
-	uint8_t fileHeader[BLOCK_SIZE];
-
-	memset(fileHeader, 0x00, BLOCK_SIZE);
-	memcpy(fileHeader, &newFile, sizeof(struct fileEntry));
+	newFile.entry.datetime = (uint32_t)fileTime;
 
 	// determine how many chunks we need to write.
 	size_t numWriteBlocks=size / BLOCK_SIZE;
@@ -701,8 +1052,6 @@ int FS_WriteFile(char* dirName, char* fileName, uint8_t* data, size_t size)
 		numWriteBlocks++;
 
 #ifdef FS_TRACE
-	Log_Debug("----------------------------------\n");
-	Log_Debug("Directory '%s', file '%s'\n", dirName, fileName);
 	Log_Debug("tail %d, head %d\n", currentDir.tail, currentDir.head);
 	Log_Debug("firstBlock %d, numBlocks %d (LastBlock %d)\n", fileHeaderBlock, numWriteBlocks, (fileHeaderBlock + numWriteBlocks));
 #endif
@@ -729,7 +1078,7 @@ int FS_WriteFile(char* dirName, char* fileName, uint8_t* data, size_t size)
 	}
 
 	// Write the file header.
-	_writeBlockCallback(fileHeaderBlock, fileHeader, BLOCK_SIZE);
+	FS_WriteFileHeader(currentDirectoryIndex, currentDir.head, &newFile);
 
 	// update the directory information/root block
 	// if we've wrapped around, and are overwriting existing data.
@@ -737,14 +1086,25 @@ int FS_WriteFile(char* dirName, char* fileName, uint8_t* data, size_t size)
 	if (currentDir.dirFull == 1)
 	{
 		currentDir.tail= (currentDir.tail+1) % currentDir.maxFiles;
+		// the oldest file was just overwritten, the new oldest is read when it's needed
+		index->oldestValid = false;
+	}
+	else
+	{
+		index->numFiles++;
 	}
 
+	memcpy(&index->newest, &newFile, sizeof(struct fileHeader));
+	index->newestValid = true;
+	// the first file in an empty directory is also its oldest
+	FS_SyncSingleFile(index, &newFile);
+
 	currentDir.head = (currentDir.head + 1) % currentDir.maxFiles;
 
 	if (currentDir.head == currentDir.tail)
 		currentDir.dirFull = 1;
 
-	result = FS_WriteDirectoryToRoot(&currentDir, currentDirectoryIndex);
+	int result = FS_WriteDirectoryToRoot(&currentDir, currentDirectoryIndex);
 
 	return result;
 }
@@ -769,17 +1129,16 @@ int FS_GetFileInfoForIndex(char* dirName, size_t fileIndex, struct fileEntry* fi
 	}
 
 	// does the directory exist?
-	int dirIndex = 0;
-	struct dirEntry pDirEntry;
-	int result = FS_GetDirectoryFromName(dirName, &dirIndex, &pDirEntry);
-	if (result == -1)
+	int dirIndex = FS_FindDirectory(dirName);
+	if (dirIndex == -1)
 		return -1;
 
 	struct directory pDir;
 	FS_GetFullDirectory(dirIndex, &pDir);
 
 	// Get the number of files in the directory, if zero, bail
-	int numFiles = FS_GetNumberOfFilesInDirectory(dirName);
+	int numFiles = (int)_directoryIndex[dirIndex].numFiles;
+	int result = 0;
 
 	// no files, nothing to delete
 	if (numFiles == 0)
@@ -789,17 +1148,19 @@ int FS_GetFileInfoForIndex(char* dirName, size_t fileIndex, struct fileEntry* fi
 	if (fileIndex >= (size_t)numFiles)
 		return -1;
 
+	// the oldest file's header is in the index
+	if (fileIndex == 0)
+		return FS_GetOldestFileHeader(dirIndex, fileInfo);
+
 	// fixup overflow.
 	size_t readIndex = (fileIndex + pDir.tail) % pDir.maxFiles;
 
-	uint8_t fileHeader[BLOCK_SIZE];
-	uint32_t numBlocksPerFile = FS_GetNumberOfBlocksPerFile(&pDir);
-	result = _readBlockCallback(pDir.firstBlock + (readIndex * (numBlocksPerFile + 1)), fileHeader, BLOCK_SIZE);
+	struct fileHeader header;
+	result = FS_ReadFileHeader(dirIndex, (uint32_t)readIndex, &header);
 	if (result == -1)
 		return -1;
 
-	struct file* pFile = (struct file*)fileHeader;
-	memcpy(fileInfo, pFile, sizeof(struct fileEntry));
+	memcpy(fileInfo, &header.entry, sizeof(struct fileEntry));
 
 	return 0;
 }
@@ -817,17 +1178,16 @@ int FS_ReadFileForIndex(char* dirName, size_t fileIndex, uint8_t* data, size_t s
 	}
 
 	// does the directory exist?
-	int dirIndex = 0;
-	struct dirEntry pDirEntry;
-	int result = FS_GetDirectoryFromName(dirName, &dirIndex, &pDirEntry);
-	if (result == -1)
+	int dirIndex = FS_FindDirectory(dirName);
+	if (dirIndex == -1)
 		return -1;
 
 	struct directory pDir;
 	FS_GetFullDirectory(dirIndex, &pDir);
 
 	// Get the number of files in the directory, if zero, bail
-	int numFiles = FS_GetNumberOfFilesInDirectory(dirName);
+	int numFiles = (int)_directoryIndex[dirIndex].numFiles;
+	int result = 0;
 
 	// no files, nothing to delete
 	if (numFiles == 0)
@@ -837,41 +1197,274 @@ int FS_ReadFileForIndex(char* dirName, size_t fileIndex, uint8_t* data, size_t s
 	if (fileIndex >= (size_t)numFiles)
 		return -1;
 
-	uint32_t numBlocksPerFile = FS_GetNumberOfBlocksPerFile(&pDir);		// doesn't include the file header block
-
 	// fixup overflow.
 	size_t readIndex = (fileIndex + pDir.tail) % pDir.maxFiles;
 
 	// read the header of the file
-	uint32_t fileHeaderBlock = pDir.firstBlock + (readIndex * (numBlocksPerFile + 1));
-	uint32_t fileDataBlock = fileHeaderBlock + 1;
-
-	uint8_t fileHeader[BLOCK_SIZE];
-	result = _readBlockCallback(fileHeaderBlock, fileHeader, BLOCK_SIZE);
+	struct fileHeader header;
+	result = FS_ReadFileHeader(dirIndex, (uint32_t)readIndex, &header);
 	if (result == -1)
 		return -1;
 
-	struct fileEntry* pFile = (struct fileEntry*)fileHeader;
-
 	// requesting more bytes than are in the file.
-	if (size > pFile->fileSize)
+	if (size > header.entry.fileSize)
+		return -1;
+
+	return FS_ReadWholeFile(dirIndex, (uint32_t)readIndex, &header, data);
+}
+
+/// <summary>
+/// Helper function to read part of the data of the file in a slot of a directory
+/// </summary>
+static int FS_ReadFileData(int directoryIndex, uint32_t slot, uint32_t offset, uint8_t* data, size_t size)
+{
+	uint32_t fileDataBlock = FS_GetFileHeaderBlock(directoryIndex, slot) + 1;
+	uint8_t block[BLOCK_SIZE];
+
+	while (size > 0)
+	{
+		uint32_t blockOffset = offset % BLOCK_SIZE;
+		size_t n = MIN(size, (size_t)(BLOCK_SIZE - blockOffset));
+
+		if (_readBlockCallback(fileDataBlock + (offset / BLOCK_SIZE), block, BLOCK_SIZE) == -1)
+			return -1;
+
+		memcpy(data, block + blockOffset, n);
+		data += n;
+		offset += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+/// <summary>
+/// Helper function to read all the data of a file, for version 2 checking it against the CRC in its header
+/// </summary>
+static int FS_ReadWholeFile(int directoryIndex, uint32_t slot, const struct fileHeader* header, uint8_t* data)
+{
+	if (FS_ReadFileData(directoryIndex, slot, 0, data, header->entry.fileSize) == -1)
 		return -1;
 
-	uint32_t numBlocksToRead = pFile->fileSize / BLOCK_SIZE;
-	if (pFile->fileSize % BLOCK_SIZE != 0)
-		numBlocksToRead++;
+	if (_version == 2 && FS_Crc32(0, data, header->entry.fileSize) != header->dataCrc)
+		return -1;
 
-	uint32_t bytesToRead = pFile->fileSize;
+	return 0;
+}
 
+/// <summary>
+/// Helper function to write part of the data of the file in a slot of a directory, anything in the
+/// file after offset + size is lost
+/// </summary>
+static int FS_WriteFileData(int directoryIndex, uint32_t slot, uint32_t offset, const uint8_t* data, size_t size)
+{
+	uint32_t fileDataBlock = FS_GetFileHeaderBlock(directoryIndex, slot) + 1;
 	uint8_t block[BLOCK_SIZE];
 
-	for (uint32_t x = 0; x < numBlocksToRead; x++)
+	while (size > 0)
+	{
+		uint32_t blockOffset = offset % BLOCK_SIZE;
+		size_t n = MIN(size, (size_t)(BLOCK_SIZE - blockOffset));
+
+		// only the block the data starts part way through has anything to keep
+		memset(block, 0x00, BLOCK_SIZE);
+		if (blockOffset != 0 && _readBlockCallback(fileDataBlock + (offset / BLOCK_SIZE), block, BLOCK_SIZE) == -1)
+			return -1;
+
+		memcpy(block + blockOffset, data, n);
+		if (_writeBlockCallback(fileDataBlock + (offset / BLOCK_SIZE), block, BLOCK_SIZE) != 0)
+			return -1;
+
+		data += n;
+		offset += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+/// <summary>
+/// Appends fixed size records to a directory. Records are packed into the newest file until it
+/// reaches the directory's maxFileSize, so small records share blocks instead of taking a file
+/// (and at least two blocks) each. Like FS_WriteFile, a full directory overwrites its oldest file.
+/// </summary>
+/// <param name="dirName"></param>
+/// <param name="records">count records of recordSize bytes, back to back</param>
+/// <param name="recordSize">must be the same for every call on a directory</param>
+/// <param name="count"></param>
+/// <returns> -1 for error, 0 for success </returns>
+int FS_AppendRecords(char* dirName, const void* records, size_t recordSize, size_t count)
+{
+#ifdef SHOW_FUNCTION_TRACE
+	Log_Debug(">>> %s\n", __func__);
+#endif
+
+	// If we haven't been initialized, bail.
+	if (!FS_IsFileSystemReady())
 	{
-		_readBlockCallback(fileDataBlock + x, block, BLOCK_SIZE);
-		memcpy(data + (x * BLOCK_SIZE), block, bytesToRead >= BLOCK_SIZE ? BLOCK_SIZE : bytesToRead);
-		bytesToRead -= BLOCK_SIZE;
+		return -1;
+	}
+
+	int dirIndex = FS_FindDirectory(dirName);
+	if (dirIndex == -1)
+		return -1;
+
+	struct directory* dir = &dirList[dirIndex];
+	struct directoryIndex* index = &_directoryIndex[dirIndex];
+	if (recordSize == 0 || recordSize > dir->maxFileSize)
+		return -1;
+
+	uint32_t recordsPerFile = dir->maxFileSize / recordSize;
+	const uint8_t* data = records;
+
+	while (count > 0)
+	{
+		size_t n = 0;
+		struct fileHeader* newest = FS_LoadNewestHeader(dirIndex);
+
+		if (newest != NULL && newest->records.recordSize == recordSize && newest->entry.fileSize / recordSize < recordsPerFile)
+		{
+			// room left in the newest file, add to the end of it
+			uint32_t slot = (dir->head + dir->maxFiles - 1) % dir->maxFiles;
+			n = MIN(count, (size_t)(recordsPerFile - (newest->entry.fileSize / recordSize)));
+
+			if (FS_WriteFileData(dirIndex, slot, newest->entry.fileSize, data, n * recordSize) == -1)
+				return -1;
+
+			newest->entry.fileSize += (uint32_t)(n * recordSize);
+			newest->dataCrc = FS_Crc32(newest->dataCrc, data, n * recordSize);
+			newest->entry.datetime = (uint32_t)time(NULL);
+			if (FS_WriteFileHeader(dirIndex, slot, newest) != 0)
+				return -1;
+
+			FS_SyncSingleFile(index, newest);
+		}
+		else
+		{
+			n = MIN(count, (size_t)recordsPerFile);
+			if (FS_AddFile(dirIndex, "records", data, n * recordSize, (uint32_t)recordSize) != 0)
+				return -1;
+		}
+
+		data += n * recordSize;
+		count -= n;
 	}
 
 	return 0;
 }
 
+/// <summary>
+/// Reads up to maxCount of the oldest records in a directory, without consuming them.
+/// Call FS_ConsumeRecords once they've been dealt with.
+/// </summary>
+/// <param name="dirName"></param>
+/// <param name="records">room for maxCount records</param>
+/// <param name="recordSize">the size the records were appended with</param>
+/// <param name="maxCount"></param>
+/// <returns> -1 on error, otherwise the number of records read (0 if there are none) </returns>
+int FS_ReadRecords(char* dirName, void* records, size_t recordSize, size_t maxCount)
+{
+#ifdef SHOW_FUNCTION_TRACE
+	Log_Debug(">>> %s\n", __func__);
+#endif
+
+	// If we haven't been initialized, bail.
+	if (!FS_IsFileSystemReady())
+	{
+		return -1;
+	}
+
+	int dirIndex = FS_FindDirectory(dirName);
+	if (dirIndex == -1 || recordSize == 0)
+		return -1;
+
+	struct directory* dir = &dirList[dirIndex];
+	struct directoryIndex* index = &_directoryIndex[dirIndex];
+	uint8_t* data = records;
+	size_t count = 0;
+
+	for (uint32_t x = 0; x < index->numFiles && count < maxCount; x++)
+	{
+		struct fileHeader header;
+		struct fileHeader* known = NULL;
+
+		// the first and last files' headers are in the index, the ones between are read
+		if (x == 0)
+			known = FS_LoadOldestHeader(dirIndex);
+		else if (x == index->numFiles - 1)
+			known = FS_LoadNewestHeader(dirIndex);
+
+		uint32_t slot = (dir->tail + x) % dir->maxFiles;
+		if (known != NULL)
+			memcpy(&header, known, sizeof(struct fileHeader));
+		else if (FS_ReadFileHeader(dirIndex, slot, &header) == -1)
+			return -1;
+
+		// stop at anything that isn't a file of these records
+		if (header.records.recordSize != recordSize)
+			return count == 0 ? -1 : (int)count;
+
+		uint32_t stored = header.entry.fileSize / (uint32_t)recordSize;
+		size_t n = MIN(maxCount - count, (size_t)(stored - header.records.consumed));
+
+		if (FS_ReadFileData(dirIndex, slot, header.records.consumed * (uint32_t)recordSize, data + (count * recordSize), n * recordSize) == -1)
+			return -1;
+
+		count += n;
+	}
+
+	return (int)count;
+}
+
+/// <summary>
+/// Consumes the oldest count records in a directory, typically the ones just returned by FS_ReadRecords.
+/// Files are deleted once all their records are consumed.
+/// </summary>
+/// <param name="dirName"></param>
+/// <param name="count"></param>
+/// <returns> -1 on error (including fewer than count records stored), 0 on success </returns>
+int FS_ConsumeRecords(char* dirName, size_t count)
+{
+#ifdef SHOW_FUNCTION_TRACE
+	Log_Debug(">>> %s\n", __func__);
+#endif
+
+	// If we haven't been initialized, bail.
+	if (!FS_IsFileSystemReady())
+	{
+		return -1;
+	}
+
+	int dirIndex = FS_FindDirectory(dirName);
+	if (dirIndex == -1)
+		return -1;
+
+	struct directoryIndex* index = &_directoryIndex[dirIndex];
+
+	while (count > 0)
+	{
+		struct fileHeader* oldest = FS_LoadOldestHeader(dirIndex);
+		if (oldest == NULL || oldest->records.recordSize == 0)
+			return -1;
+
+		uint32_t remaining = (oldest->entry.fileSize / oldest->records.recordSize) - oldest->records.consumed;
+		if (count >= remaining)
+		{
+			if (FS_DeleteOldestFile(dirIndex) != 0)
+				return -1;
+			count -= remaining;
+		}
+		else
+		{
+			// only the header changes, the records stay where they are
+			oldest->records.consumed += (uint32_t)count;
+			if (FS_WriteFileHeader(dirIndex, dirList[dirIndex].tail, oldest) != 0)
+				return -1;
+
+			FS_SyncSingleFile(index, oldest);
+			count = 0;
+		}
+	}
+
+	return 0;
+}
@@ -48,6 +48,11 @@ int FS_DeleteOldestFileInDirectory(char* dirName);
 int FS_GetFileInfoForIndex(char* dirName, size_t fileIndex, struct fileEntry* fileInfo);
 int FS_ReadFileForIndex(char* dirName, size_t fileIndex, uint8_t* data, size_t size);
 
+// Record APIs - fixed size records packed into the files of a directory, read and consumed oldest first
+int FS_AppendRecords(char* dirName, const void* records, size_t recordSize, size_t count);
+int FS_ReadRecords(char* dirName, void* records, size_t recordSize, size_t maxCount);
+int FS_ConsumeRecords(char* dirName, size_t count);
+
 
 
 
@@ -133,6 +133,7 @@ int main(void)
 
     DoIndexReads();
 
+    closeRemoteDisk();
     cleanupCurl();
 
     while (true);   // spin...
@@ -3,30 +3,56 @@
 
 #!/usr/bin/env python
 # encoding: utf-8
+import argparse
 import json
+import mmap
 import os
 from pathlib import Path
 from flask import Flask, request, jsonify, make_response, session
+from werkzeug.serving import WSGIRequestHandler
 import datetime
 
-def memoryCRC():
-    memCRC=0
-    for val in diskData:
-        memCRC=memCRC+val
-        memCRC=memCRC & 0xffff
-    print('memCRC : ',hex(memCRC))
+parser=argparse.ArgumentParser(description='Remote disk host for the Azure Sphere application')
+parser.add_argument('--image', default='RemoteDisk.img',
+                    help='disk image file, created if missing (default: %(default)s)')
+parser.add_argument('--size', type=int, default=4194304,
+                    help='disk size in bytes, matching the application storage layout (default: %(default)s)')
+parser.add_argument('--sync', action='store_true',
+                    help='flush each write to the image file before replying')
+parser.add_argument('--verbose', action='store_true',
+                    help='log each request, with a hex dump of the data')
+args=parser.parse_args()
+
+# 16 bit sum of the bytes, the same checksum the device logs
+def blockCRC(data):
+    return sum(memoryview(data)) & 0xffff
+
+def log(*values):
+    if args.verbose:
+        print(*values)
 
 app = Flask(__name__)
 
 print("Python disk host")
 
-# create empty 'disk'
-# could easily modify this to read from a file
-diskData=bytearray(4194304)
-print("data length",len(diskData))
+# The 'disk' is the image file mapped into memory, so its contents survive a restart.
+# The OS writes changed pages back to the file, --sync does it before each write is acknowledged.
+imageFile=open(args.image, 'a+b')
+if os.path.getsize(args.image) < args.size:
+    imageFile.truncate(args.size)
+diskData=mmap.mmap(imageFile.fileno(), args.size)
+print("image",args.image,"data length",len(diskData))
 
-print('startup memory CRC')
-memoryCRC()
+print('startup memory CRC : ',hex(blockCRC(diskData)))
+
+def validRange(offset, size):
+    return offset >= 0 and size > 0 and offset+size <= len(diskData)
+
+def syncRange(offset, size):
+    if args.sync:
+        # flush offsets must be page aligned
+        start=offset - (offset % mmap.ALLOCATIONGRANULARITY)
+        diskData.flush(start, offset+size-start)
 
 # -------------------------------------------------------------------------------------
 # Block level read and write.
@@ -43,16 +69,16 @@ def query_sector():
         diskOffset=int(offset)
         blockSize=int(size)
 
-        print("Request for offset: ",hex(diskOffset))
-        returnData=diskData[diskOffset:diskOffset+blockSize]
+        if not validRange(diskOffset, blockSize):
+            response=make_response(jsonify({'error': 'read request is out of range'}),400)
+            return response
 
-        crc=0
-        for val in returnData:
-            crc=crc+val
-            crc=crc & 0xffff
+        returnData=diskData[diskOffset:diskOffset+blockSize]
 
-        print("Read CRC", hex(crc))
-        hexDump(returnData,diskOffset)
+        if args.verbose:
+            print("Request for offset: ",hex(diskOffset))
+            print("Read CRC", hex(blockCRC(returnData)))
+            hexDump(returnData,diskOffset)
 
         response = make_response(returnData,200)
         response.headers.set('Content-Type', 'application/octet-stream')
@@ -60,53 +86,104 @@ def query_sector():
 
 @app.route('/WriteBlockFromOffset', methods=['POST'])
 def write_sector():
-    print("Content Length: ",request.content_length)
-    print("Content Type  : ", request.content_type)
-    print("Headers       : ", request.headers)
+    log("Content Length: ",request.content_length)
+    log("Headers       : ", request.headers)
 
-    offset=request.headers['offset']
+    offset=request.headers.get('offset')
 
-    if not offset:
+    if not offset or not request.content_length:
         response=make_response(jsonify({'error': 'write request is not valid'}),400)
         return response
     else:
         blockOffset=int(offset)
+
+        if not validRange(blockOffset, request.content_length):
+            response=make_response(jsonify({'error': 'write request is out of range'}),400)
+            return response
+
         chunk = request.stream.read(request.content_length)    # read a sector
+        if len(chunk) != request.content_length:
+            response=make_response(jsonify({'error': 'write data is short'}),400)
+            return response
 
-        print("chunk type: ",type(chunk))
-        print("chunk len : ",len(chunk))
+        # update the disk image
+        diskData[blockOffset: blockOffset+len(chunk)]=chunk
+        syncRange(blockOffset, len(chunk))
 
-        print("save ",len(chunk),"bytes to ",hex(blockOffset))
+        if args.verbose:
+            print("save ",len(chunk),"bytes to ",hex(blockOffset))
+            print("CRC", hex(blockCRC(chunk)))
+            hexDump(chunk,blockOffset)
+            print("Validate CRC", hex(blockCRC(diskData[blockOffset:blockOffset+len(chunk)])))
 
-        crc=0
-        for val in chunk:
-            crc=crc+val
-            crc=crc & 0xffff
+        response=make_response("OK",200)
+        return response
 
-        print("CRC", hex(crc))
+# -------------------------------------------------------------------------------------
+# Multi-range read and write, several blocks per request.
+# Ranges are given as "offset:size,offset:size,..." and their data is sent back to back.
+
+def parseRanges(rangeList):
+    ranges=[]
+    try:
+        for item in rangeList.split(','):
+            offset,size=item.split(':')
+            offset=int(offset)
+            size=int(size)
+            if not validRange(offset, size):
+                return None
+            ranges.append((offset,size))
+    except ValueError:
+        return None
+    return ranges if ranges else None
+
+@app.route('/ReadRanges', methods=['GET'])
+def read_ranges():
+    ranges=parseRanges(request.args.get('ranges', ''))
+
+    if not ranges:
+        response=make_response(jsonify({'error': 'read ranges request is not valid'}),400)
+        return response
 
-        print('Update disk image')
-        # update the disk image
-        diskData[blockOffset: blockOffset+len(chunk)]=chunk
+    returnData=bytearray()
+    for offset,size in ranges:
+        returnData+=diskData[offset:offset+size]
 
-        print('---------------------------------------------------------')
+    log("Read", len(ranges), "ranges,", len(returnData), "bytes")
 
-        memoryCRC()
-        hexDump(chunk,blockOffset)
+    response = make_response(bytes(returnData),200)
+    response.headers.set('Content-Type', 'application/octet-stream')
+    return response
 
-        print('validate new CRC')
-        validateCRC=0
-        for x in range(request.content_length):
-            validateCRC=validateCRC+diskData[blockOffset+x]
-            validateCRC=validateCRC & 0xffff
+@app.route('/WriteRanges', methods=['POST'])
+def write_ranges():
+    ranges=parseRanges(request.headers.get('ranges', ''))
+    total=sum(size for offset,size in ranges) if ranges else 0
 
-        print("Validate CRC", hex(validateCRC))
+    if not ranges or request.content_length != total:
+        response=make_response(jsonify({'error': 'write ranges request is not valid'}),400)
+        return response
 
-        response=make_response("OK",200)
+    chunk = request.stream.read(total)
+    if len(chunk) != total:
+        response=make_response(jsonify({'error': 'write ranges data is short'}),400)
         return response
 
+    pos=0
+    for offset,size in ranges:
+        diskData[offset:offset+size]=chunk[pos:pos+size]
+        syncRange(offset, size)
+        pos+=size
+
+    log("Wrote", len(ranges), "ranges,", total, "bytes")
+
+    response=make_response("OK",200)
+    return response
+
+# Flush the image file, and save a snapshot of it to TestDisk.dsk
 @app.route('/WriteDisk', methods=['GET'])
 def write_disk():
+    diskData.flush()
     fp=open("TestDisk.dsk","wb")
     fp.write(diskData)
     fp.close()
@@ -142,4 +219,6 @@ def hexDump(data, offset, banner=False):
         print(' '*((16-linebreak)*3), end='')
         print('  '+asciiData)
 
+# HTTP/1.1 so the device's connection is kept alive between requests.
+WSGIRequestHandler.protocol_version = "HTTP/1.1"
 app.run(host='0.0.0.0')
\ No newline at end of file
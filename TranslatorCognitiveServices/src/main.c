@@ -1,12 +1,23 @@
 ﻿#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
 
 #include "applibs_versions.h"
 #include <applibs/log.h>
+#include <applibs/eventloop.h>
 
 #include "translator.h"
 
+static volatile sig_atomic_t exitApp = false;
+
+static void TerminationHandler(int signalNumber)
+{
+	// Don't use Log_Debug here, as it is not guaranteed to be async-signal-safe.
+	exitApp = true;
+}
+
 int main(int argc, char *argv[])
 {
 	char LangId[40] = { 0 };
@@ -16,6 +27,19 @@ int main(int argc, char *argv[])
 	Log_Debug("Application starting.\n");
 	Log_Debug("Input text: %s\n", inputText);
 
+	struct sigaction action;
+	memset(&action, 0, sizeof(struct sigaction));
+	action.sa_handler = TerminationHandler;
+	sigaction(SIGTERM, &action, NULL);
+
+	// the event loop keeps the Translator token fresh in the background
+	EventLoop* eventLoop = EventLoop_Create();
+	if (eventLoop == NULL || Translator_Init(eventLoop) != 0)
+	{
+		Log_Debug("ERROR: could not set up the event loop\n");
+		return -1;
+	}
+
 	if (Translator_DetectLanguage(inputText, &LangId[0], sizeof(LangId)) == 0)		// if detect worked
 	{
 		Log_Debug("Detected language: %s\n", LangId);
@@ -25,7 +49,29 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	while(true);		// spin
-	
+	// several strings, e.g. a UI's labels, in one request
+	static const char* uiStrings[] = { "Température", "Humidité", "Batterie faible" };
+	static char uiTranslations[3][64];
+	char* uiOutputs[] = { uiTranslations[0], uiTranslations[1], uiTranslations[2] };
+	if (Translator_TranslateBatch(uiStrings, 3, "fr", uiOutputs, sizeof(uiTranslations[0]), "en") > 0)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			Log_Debug("%s -> %s\n", uiStrings[i], uiTranslations[i]);
+		}
+	}
+
+	while (!exitApp)
+	{
+		EventLoop_Run_Result result = EventLoop_Run(eventLoop, -1, true);
+		if (result == EventLoop_Run_Failed && errno != EINTR)
+		{
+			break;
+		}
+	}
+
+	Translator_Cleanup();
+	EventLoop_Close(eventLoop);
+
 	return 0;
 }
@@ -3,75 +3,50 @@
 
 #include <applibs/log.h>
 
-#include <curl/curl.h>
-#include <curl/easy.h>
+#include "translator.h"
+#include "httpClient.h"
+#include "eventloop_timer_utilities.h"
 #include "parson.h"
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
 
 
 static char* translatorAPIKey = "";	// Get the Translator key from the Azure Portal - in your translator resource, look at 'Keys and Endpoint'
 
 #define TRANSLATOR_TOKEN_LENGTH	1024
 static char translatorToken[TRANSLATOR_TOKEN_LENGTH] = { 0 };
+
+// Tokens are valid for 10 minutes; the event loop fetches a new one 2 minutes before
+// the current one expires, so detect/translate calls don't wait on the token endpoint.
+#define TRANSLATOR_TOKEN_LIFETIME_SECONDS	600
+#define TRANSLATOR_TOKEN_REFRESH_SECONDS	480
+#define TRANSLATOR_TOKEN_RETRY_SECONDS		30
+static struct timespec tokenExpiry = { 0, 0 };	// CLOCK_MONOTONIC
+static EventLoopTimer* tokenRefreshTimer = NULL;
+
 static char* tokenURL = "https://api.cognitive.microsoft.com/sts/v1.0/issuetoken";
 static char* detectLanguageURL = "https://api.cognitive.microsofttranslator.com/detect?api-version=3.0";
 static char* translateLanguageURL = "https://api.cognitive.microsofttranslator.com/translate?api-version=3.0";
 
 static char jsonBuffer[256] = { 0 };
 
-static char* HttpPost(char* postURL, char* data);
-static int GetTranslatorToken(void);
-
-// Curl stuff.
-struct url_data {
-	size_t size;
-	char* data;
-};
+// Request body of a batch translation, built once per call in this preallocated buffer.
+static char batchBuffer[TRANSLATOR_BATCH_BODY_SIZE] = { 0 };
 
-CURL* curl;
-CURLcode res;
-
-struct url_data postData;
-
-static size_t write_data(void* ptr, size_t size, size_t nmemb, struct url_data* data)
-{
-	size_t index = data->size;
-	size_t n = (size * nmemb);
-	char* tmp;
-
-	data->size += (size * nmemb);
-
-	tmp = realloc(data->data, data->size + 1); /* +1 for '\0' */
-
-	if (tmp) {
-		data->data = tmp;
-	}
-	else {
-		if (data->data) {
-			free(data->data);
-		}
-		return 0;
-	}
-
-	memcpy((data->data + index), ptr, n);
-	data->data[data->size] = '\0';
-
-	return size * nmemb;
-}
+static const char* HttpPost(char* postURL, char* data, bool useToken);
+static int GetTranslatorToken(void);
+static int EnsureTranslatorToken(void);
 
 int Translator_DetectLanguage(char* inputString, char* detectedLanguage, size_t detectedLanguageLen)
 {
-	if (strlen(translatorToken) == 0)
-	{
-		int result = GetTranslatorToken();
-		if (result == -1)
-			return -1;
-	}
+	if (EnsureTranslatorToken() == -1)
+		return -1;
 
 	snprintf(jsonBuffer, 256, "[{ \"Text\": \"%s\" }]", inputString);
 
-	char *data = HttpPost(detectLanguageURL, jsonBuffer);
+	const char *data = HttpPost(detectLanguageURL, jsonBuffer, true);
 	if (data == NULL)
 		return -1;
 
@@ -83,19 +58,14 @@ int Translator_DetectLanguage(char* inputString, char* detectedLanguage, size_t
 	const char* lang = json_object_dotget_string(langObject, "language");
 	strncpy(detectedLanguage, lang, detectedLanguageLen);
 	json_value_free(root_value);
-	free(data);
 
 	return 0;
 }
 
 int Translator_Translate(char* inputString, char* FromLang, char* outputString, size_t outputStringLen, char* ToLang)
 {
-	if (strlen(translatorToken) == 0)
-	{
-		int result = GetTranslatorToken();
-		if (result == -1)
-			return -1;
-	}
+	if (EnsureTranslatorToken() == -1)
+		return -1;
 
 	char translateURL[260] = { 0 };
 	snprintf(translateURL, 260, "%s&from=%s&to=%s", translateLanguageURL, FromLang, ToLang);
@@ -103,7 +73,7 @@ int Translator_Translate(char* inputString, char* FromLang, char* outputString,
 	char jsonBuffer[256] = { 0 };
 	snprintf(jsonBuffer, 256, "[{ \"Text\": \"%s\" }]", inputString);
 
-	char* data = HttpPost(translateURL, jsonBuffer);
+	const char* data = HttpPost(translateURL, jsonBuffer, true);
 
 	if (data == NULL)
 		return -1;
@@ -116,12 +86,70 @@ int Translator_Translate(char* inputString, char* FromLang, char* outputString,
 	JSON_Object* translation = json_array_get_object(translations, i);	// get first element
 	const char* translatedText = json_object_dotget_string(translation, "text");
 	strncpy(outputString, translatedText, outputStringLen);
-	free(data);
 	json_value_free(root_value);
 
 	return 0;
 }
 
+int Translator_TranslateBatch(const char* const* inputStrings, size_t count, char* FromLang, char** outputStrings, size_t outputStringLen, char* ToLang)
+{
+	if (count == 0 || count > TRANSLATOR_BATCH_MAX_TEXTS)
+	{
+		Log_Debug("ERROR: batch of %u texts, 1 to %d supported\n", (unsigned)count, TRANSLATOR_BATCH_MAX_TEXTS);
+		return -1;
+	}
+
+	if (EnsureTranslatorToken() == -1)
+		return -1;
+
+	char translateURL[260] = { 0 };
+	snprintf(translateURL, 260, "%s&from=%s&to=%s", translateLanguageURL, FromLang, ToLang);
+
+	// [{ "Text": "..." }, ...] - parson escapes the texts
+	JSON_Value* request = json_value_init_array();
+	JSON_Array* requestArray = json_value_get_array(request);
+	for (size_t i = 0; i < count; i++)
+	{
+		JSON_Value* item = json_value_init_object();
+		json_object_set_string(json_value_get_object(item), "Text", inputStrings[i]);
+		json_array_append_value(requestArray, item);
+	}
+
+	JSON_Status status = json_serialize_to_buffer(request, batchBuffer, sizeof(batchBuffer));
+	json_value_free(request);
+	if (status != JSONSuccess)
+	{
+		Log_Debug("ERROR: batch request larger than %d bytes\n", TRANSLATOR_BATCH_BODY_SIZE);
+		return -1;
+	}
+
+	const char* data = HttpPost(translateURL, batchBuffer, true);
+	if (data == NULL)
+		return -1;
+
+	// the results are in the order of the inputs: [{ "translations": [{ "text": "...", ... }] }, ...]
+	int translated = 0;
+	JSON_Value* root_value = json_parse_string(data);
+	JSON_Array* translationArray = json_value_get_array(root_value);
+	for (size_t i = 0; i < count; i++)
+	{
+		JSON_Object* langObject = json_array_get_object(translationArray, i);
+		JSON_Array* translations = json_object_dotget_array(langObject, "translations");
+		const char* translatedText = json_object_dotget_string(json_array_get_object(translations, 0), "text");
+
+		outputStrings[i][0] = '\0';
+		if (translatedText != NULL)
+		{
+			strncpy(outputStrings[i], translatedText, outputStringLen - 1);
+			outputStrings[i][outputStringLen - 1] = '\0';
+			translated++;
+		}
+	}
+	json_value_free(root_value);
+
+	return translated;
+}
+
 /// <summary>
 /// Get a Translator Cognitive Services token (use in detect/translate APIs)
 /// </summary>
@@ -133,74 +161,122 @@ static int GetTranslatorToken(void)
 		return -1;
 	}
 
-	char *result=HttpPost(tokenURL, NULL);
+	// the token's lifetime starts when it's issued, so count from before the request
+	struct timespec requested;
+	clock_gettime(CLOCK_MONOTONIC, &requested);
+
+	const char *result=HttpPost(tokenURL, NULL, false);
 	if (result == NULL)
 	{
 		return -1;
 	}
 
-	memset(translatorToken, 0x00, TRANSLATOR_TOKEN_LENGTH);
-	if (strlen(result) > TRANSLATOR_TOKEN_LENGTH)
+	// keep the current token if the new one can't be used
+	if (strlen(result) >= TRANSLATOR_TOKEN_LENGTH)
 	{
-		Log_Debug("ERROR: Translator Token length > %d\n", TRANSLATOR_TOKEN_LENGTH);
-		free(result);
+		Log_Debug("ERROR: Translator Token length >= %d\n", TRANSLATOR_TOKEN_LENGTH);
 		return -1;
 	}
 
-	strncpy(translatorToken, result, TRANSLATOR_TOKEN_LENGTH);
-	free(result);
+	memset(translatorToken, 0x00, TRANSLATOR_TOKEN_LENGTH);
+	strncpy(translatorToken, result, TRANSLATOR_TOKEN_LENGTH - 1);
+	tokenExpiry.tv_sec = requested.tv_sec + TRANSLATOR_TOKEN_LIFETIME_SECONDS;
+	tokenExpiry.tv_nsec = requested.tv_nsec;
 
 	return 0;
 }
 
-static char * HttpPost(char *postURL, char *data)
+/// <summary>
+/// Make sure there's an unexpired token. This only blocks on the token endpoint if the
+/// background refresh hasn't run (no event loop) or has been failing until expiry.
+/// </summary>
+static int EnsureTranslatorToken(void)
 {
-	if (strlen(translatorAPIKey) == 0)
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (translatorToken[0] != 0 && now.tv_sec < tokenExpiry.tv_sec)
 	{
-		Log_Debug("ERROR: You need to set the translatorAPIKey\n");
-		return NULL;
+		return 0;
 	}
 
-	curl_global_init(CURL_GLOBAL_ALL);
-	curl = curl_easy_init();
+	return GetTranslatorToken();
+}
+
+/// <summary>
+/// Timer event: fetch a new token ahead of the current one's expiry.
+/// </summary>
+static void TokenRefreshTimerEventHandler(EventLoopTimer* timer)
+{
+	if (ConsumeEventLoopTimerEvent(timer) != 0)
+	{
+		return;
+	}
 
-	postData.size = 0;
-	postData.data = malloc(1);
+	struct timespec next = { TRANSLATOR_TOKEN_REFRESH_SECONDS, 0 };
+	if (GetTranslatorToken() != 0)
+	{
+		Log_Debug("ERROR: Translator token refresh failed, retrying in %d seconds\n", TRANSLATOR_TOKEN_RETRY_SECONDS);
+		next.tv_sec = TRANSLATOR_TOKEN_RETRY_SECONDS;
+	}
 
-	curl_easy_setopt(curl, CURLOPT_URL, postURL);
-	curl_easy_setopt(curl, CURLOPT_POST, 1L);
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &postData);
+	SetEventLoopTimerOneShot(timer, &next);
+}
 
-	if (data != NULL)
+int Translator_Init(EventLoop* eventLoop)
+{
+	tokenRefreshTimer = CreateEventLoopDisarmedTimer(eventLoop, TokenRefreshTimerEventHandler);
+	if (tokenRefreshTimer == NULL)
 	{
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, strlen(data));
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
+		return -1;
 	}
-	else
+
+	struct timespec next = { TRANSLATOR_TOKEN_REFRESH_SECONDS, 0 };
+	if (GetTranslatorToken() != 0)
+	{
+		next.tv_sec = TRANSLATOR_TOKEN_RETRY_SECONDS;
+	}
+
+	return SetEventLoopTimerOneShot(tokenRefreshTimer, &next);
+}
+
+void Translator_Cleanup(void)
+{
+	DisposeEventLoopTimer(tokenRefreshTimer);
+	tokenRefreshTimer = NULL;
+	HttpClient_Cleanup();
+}
+
+/// <summary>
+/// POST to a Translator endpoint; the connection to each host is kept open between calls.
+/// The token endpoint takes the API key, detect/translate take the token (useToken).
+/// The result is valid until the next request.
+/// </summary>
+static const char * HttpPost(char *postURL, char *data, bool useToken)
+{
+	if (strlen(translatorAPIKey) == 0)
 	{
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, 0L);
+		Log_Debug("ERROR: You need to set the translatorAPIKey\n");
+		return NULL;
 	}
 
-	char authHeader[128] = { 0 };
-	snprintf(authHeader, 128, "Ocp-Apim-Subscription-Key: %s", translatorAPIKey);
+	char authHeader[TRANSLATOR_TOKEN_LENGTH + 32] = { 0 };
+	if (useToken)
+	{
+		snprintf(authHeader, sizeof(authHeader), "Authorization: Bearer %s", translatorToken);
+	}
+	else
+	{
+		snprintf(authHeader, sizeof(authHeader), "Ocp-Apim-Subscription-Key: %s", translatorAPIKey);
+	}
 
 	struct curl_slist* hs = NULL;
 	hs = curl_slist_append(hs, "Content-Type: application/json");
 	hs = curl_slist_append(hs, authHeader);
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hs);
 
 	/* Perform the request */
-	res = curl_easy_perform(curl);
+	const char *result = HttpClient_Post(postURL, data, hs);
 	curl_slist_free_all(hs);
 
-	if (res == CURLE_OK)
-	{
-		return postData.data;	// caller is responsible for freeing this.
-	}
-
-	free(postData.data);
-	return NULL;
+	return result;
 }
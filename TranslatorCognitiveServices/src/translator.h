@@ -4,6 +4,27 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <applibs/eventloop.h>
+
+/// <summary>
+/// Fetch a Translator token and keep it fresh: the event loop refreshes it ahead of its expiry.
+/// Returns -1 if the refresh timer can't be created; a failed first fetch is retried by the timer.
+/// </summary>
+int Translator_Init(EventLoop* eventLoop);
+void Translator_Cleanup(void);
 
 int Translator_DetectLanguage(char* inputString, char* detectedLanguage, size_t detectedLanguageLen);
 int Translator_Translate(char* inputString, char* FromLang, char* outputString, size_t outputStringLen, char *ToLang);
+
+// Limits of one batch request (the service accepts up to 1000 texts and 50,000 characters)
+#define TRANSLATOR_BATCH_MAX_TEXTS	100
+#define TRANSLATOR_BATCH_BODY_SIZE	8192
+
+/// <summary>
+/// Translate count strings with one request. outputStrings[i] receives the translation of
+/// inputStrings[i] and is a caller buffer of outputStringLen bytes, left empty if that text
+/// failed to translate.
+/// Returns the number of strings translated, or -1 if the request failed.
+/// </summary>
+int Translator_TranslateBatch(const char* const* inputStrings, size_t count, char* FromLang, char** outputStrings, size_t outputStringLen, char* ToLang);
@@ -4,120 +4,471 @@
 using System;
 using System.Collections.Generic;
 using System.Diagnostics;
-using System.Drawing;
 using System.IO;
 using System.Net;
 using System.Net.Sockets;
 using System.Text;
+using System.Text.RegularExpressions;
+using System.Threading;
+using System.Threading.Channels;
+using System.Threading.Tasks;
 
 namespace PcUdpLogReceiver
 {
+    // The receiver is a pipeline, so a slow console or disk never stalls the socket:
+    //
+    //   receive thread  -> datagrams channel -> processing task -> console (filtered)
+    //                                                           -> file channel -> file writer task
+    //
+    // The receive thread only copies datagrams off a socket with a large receive buffer. When the
+    // datagrams channel is full the datagram is dropped and counted, rather than left to overflow
+    // the socket unseen. The file writer takes every record queued since its last pass, writes them
+    // in one go and rotates the log file when it grows too big. Filters only apply to the console,
+    // the log file gets every line.
     class Program
     {
         private const int listenPort = 1824;
         private static ConsoleColor Concolor = ConsoleColor.Gray;
 
-        static void Main(string[] args)
+        private const int headerSize = 16;          // UdpLogHeader
+        private const int lineHeaderSize = 8;       // UdpLogLine
+        private const byte protocolVersion = 1;     // UDPLOG_VERSION
+        private const byte severityInfo = 1;
+        private const byte severityWarning = 2;
+        private const byte severityError = 3;
+        private static readonly TimeSpan statsPeriod = TimeSpan.FromSeconds(10);
+        private static DateTime lastReport = DateTime.Now;
+
+        private const int socketBufferSize = 8 * 1024 * 1024;
+        private const int datagramQueueSize = 16384;
+        private const int fileQueueSize = 16384;
+        private const long defaultMaxFileSize = 64 * 1024 * 1024;
+        private const int defaultKeepFiles = 4;
+
+        // Datagrams carry a sequence per device: a gap counts as loss, until the missing datagram
+        // arrives late, when it counts as reordered instead.
+        private class DeviceStats
         {
-            Console.Clear();
-            Console.ForegroundColor = ConsoleColor.White;
+            public uint LastSequence;
+            public long Received;
+            public long Lost;
+            public long Reordered;
+            public uint Dropped;        // lines the device's log ring had no room for
+        }
+
+        private static readonly Dictionary<uint, DeviceStats> devices = new Dictionary<uint, DeviceStats>();
+
+        // Pipeline counters, in datagrams; the receive thread and file writer update theirs with Interlocked
+        private static long received;
+        private static long dropped;
+        private static long written;
+        private static long lastReceived, lastDropped, lastWritten;
+
+        private class Options
+        {
+            public uint DeviceHash = 0xffffffff;
+            public byte MinSeverity = 0;
+            public Regex Match;
+            public string LogFile = Path.Combine(Directory.GetCurrentDirectory(), "deviceLog.txt");
+            public long MaxFileSize = defaultMaxFileSize;
+            public int KeepFiles = defaultKeepFiles;
+            public bool ShowDateTime = true;
+        }
 
-            bool showDateTime = true;
-            uint DeviceHash = 0xffffffff;
-            if (args.Length == 1)       // see if we have a hex value for a device hash to show.
+        private static void TrackSequence(uint deviceId, uint sequence, uint dropped)
+        {
+            if (!devices.TryGetValue(deviceId, out DeviceStats stats) || sequence == 0)
             {
-                DeviceHash=(uint) Convert.ToUInt32(args[0], 16);
-                Debug.WriteLine($"Device Hash: 0x{DeviceHash:X}");
+                // a new device, or one that restarted
+                devices[deviceId] = new DeviceStats { LastSequence = sequence, Received = 1, Dropped = dropped };
+                return;
             }
 
-            UdpClient listener = new UdpClient(listenPort);
-            IPEndPoint groupEP = new IPEndPoint(IPAddress.Any, listenPort);
+            stats.Received++;
+            int gap = (int)(sequence - stats.LastSequence);
+            if (gap > 0)
+            {
+                stats.Lost += gap - 1;
+                stats.LastSequence = sequence;
+            }
+            else if (gap < 0 && stats.Lost > 0)
+            {
+                stats.Lost--;
+                stats.Reordered++;
+            }
+            stats.Dropped = dropped;
+        }
 
-            string outFile = Path.Combine(Directory.GetCurrentDirectory(), "deviceLog.txt");
+        private static void ReportStats(double seconds)
+        {
+            long rx = Interlocked.Read(ref received);
+            long drop = Interlocked.Read(ref dropped);
+            long wr = Interlocked.Read(ref written);
+            Console.WriteLine($"receiver: {(rx - lastReceived) / seconds:F1} received/s, {(drop - lastDropped) / seconds:F1} dropped/s, " +
+                $"{(wr - lastWritten) / seconds:F1} written/s ({rx} received, {drop} dropped, {wr} written)");
+            lastReceived = rx;
+            lastDropped = drop;
+            lastWritten = wr;
 
-            Console.WriteLine("Azure Sphere Console Debug Client");
+            foreach (KeyValuePair<uint, DeviceStats> device in devices)
+            {
+                DeviceStats stats = device.Value;
+                double sent = stats.Received + stats.Lost;
+                Console.WriteLine($"{device.Key:X8}: {stats.Received} datagrams, {stats.Lost} lost ({100 * stats.Lost / sent:F2}%), " +
+                    $"{stats.Reordered} reordered ({100 * stats.Reordered / sent:F2}%), {stats.Dropped} lines dropped on the device");
+            }
+        }
 
-            try
+        private static void Usage()
+        {
+            Console.WriteLine("PcUdpLogReceiver [deviceId] [--severity debug|info|warning|error] [--match regex]");
+            Console.WriteLine("                 [--log file] [--max-size MB] [--keep files]");
+        }
+
+        private static Options ParseArgs(string[] args)
+        {
+            Options options = new Options();
+
+            for (int i = 0; i < args.Length; i++)
             {
-                while (true)
+                string value = i + 1 < args.Length ? args[i + 1] : null;
+                switch (args[i])
                 {
-                    byte[] bytes = listener.Receive(ref groupEP);
+                    case "--severity":
+                        int severity = Array.IndexOf(new[] { "debug", "info", "warning", "error" }, value?.ToLowerInvariant());
+                        if (severity < 0)
+                        {
+                            return null;
+                        }
+                        options.MinSeverity = (byte)severity;
+                        i++;
+                        break;
+                    case "--match":
+                        if (value == null)
+                        {
+                            return null;
+                        }
+                        options.Match = new Regex(value, RegexOptions.Compiled);
+                        i++;
+                        break;
+                    case "--log":
+                        if (value == null)
+                        {
+                            return null;
+                        }
+                        options.LogFile = Path.GetFullPath(value);
+                        i++;
+                        break;
+                    case "--max-size":
+                        if (!long.TryParse(value, out long megabytes) || megabytes <= 0)
+                        {
+                            return null;
+                        }
+                        options.MaxFileSize = megabytes * 1024 * 1024;
+                        i++;
+                        break;
+                    case "--keep":
+                        if (!int.TryParse(value, out options.KeepFiles) || options.KeepFiles < 0)
+                        {
+                            return null;
+                        }
+                        i++;
+                        break;
+                    default:
+                        // a hex value for a device hash to show
+                        try
+                        {
+                            options.DeviceHash = Convert.ToUInt32(args[i], 16);
+                        }
+                        catch (FormatException)
+                        {
+                            return null;
+                        }
+                        Debug.WriteLine($"Device Hash: 0x{options.DeviceHash:X}");
+                        break;
+                }
+            }
 
-                    if (bytes.Length > 4)
-                    {
-                        // build device Id.
-                        uint rxDeviceId = (uint)((bytes[0] * 0x1000000) + (bytes[1] * 0x10000) + (bytes[2] * 0x100) + bytes[3]);
+            return options;
+        }
 
-                        if (DeviceHash == 0xffffffff || (DeviceHash == rxDeviceId))
-                        {
+        // Copies each datagram off the socket and queues it, counting the ones there's no room for
+        private static void ReceiveLoop(Socket socket, ChannelWriter<byte[]> datagrams, CancellationToken cancel)
+        {
+            byte[] buffer = new byte[65536];
+            EndPoint remote = new IPEndPoint(IPAddress.Any, 0);
 
-                            // Encoding.ASCII.GetString(bytes, 0, bytes.Length);
-                            string output = Encoding.UTF8.GetString(bytes, 4, bytes.Length - 4);
-
-                            Concolor = ConsoleColor.Gray;
-
-                            if (output.Trim().ToLower().StartsWith("information:") || output.Trim().ToLower().StartsWith("info:"))
-                            {
-                                Concolor = ConsoleColor.Cyan;
-                            }
-
-                            if (output.Trim().ToLower().StartsWith("error:") || output.Trim().ToLower().StartsWith("warning:"))
-                            {
-                                Concolor = ConsoleColor.Red;
-                            }
-
-                            if (Concolor != ConsoleColor.Gray)
-                            {
-                                Console.ForegroundColor = Concolor;
-                            }
-
-                            if (DeviceHash == 0xffffffff)
-                            {
-
-                                Console.Write($"{rxDeviceId,0:X8} ");
-                            }
-
-                            if (showDateTime)
-                            {
-                                DateTime dt = DateTime.Now;
-                                Console.Write($"{dt.ToShortDateString()} {dt.ToShortTimeString()}: ");
-                                Debug.Write($"{dt.ToShortDateString()} {dt.ToShortTimeString()}: ");
-
-                                string dateString = string.Format("{0} {1}:", dt.ToShortDateString(), dt.ToShortTimeString());
-                                File.AppendAllText(outFile, dateString + Environment.NewLine);
-                            }
-
-                            Console.Write($"{output}");
-                            Debug.Write($"{output}");
-                            File.AppendAllText(outFile, output);
-
-                            if (!output.Contains('\n'))
-                            {
-                                Console.WriteLine();
-                                Debug.WriteLine("");
-                                File.AppendAllText(outFile, Environment.NewLine);
-                            }
-
-                            if (Concolor != ConsoleColor.Gray)
-                            {
-                                Console.ForegroundColor = ConsoleColor.Gray;
-                            }
-                        }
-                    }
-                    else
+            try
+            {
+                while (!cancel.IsCancellationRequested)
+                {
+                    int length = socket.ReceiveFrom(buffer, ref remote);
+                    byte[] datagram = new byte[length];
+                    Buffer.BlockCopy(buffer, 0, datagram, 0, length);
+
+                    Interlocked.Increment(ref received);
+                    if (!datagrams.TryWrite(datagram))
                     {
-                        Debug.WriteLine($"Rx'd buffer {bytes.Length} bytes.");
+                        Interlocked.Increment(ref dropped);
                     }
                 }
             }
-            catch (SocketException e)
+            catch (SocketException e) when (!cancel.IsCancellationRequested)
             {
                 Console.WriteLine(e);
             }
+            catch (SocketException)
+            {
+                // the socket was closed to stop the loop
+            }
+            catch (ObjectDisposedException)
+            {
+            }
             finally
             {
-                listener.Close();
+                datagrams.TryComplete();
             }
         }
+
+        // Writes every record queued since the last pass, then flushes once; rotates the file past maxFileSize
+        private static async Task FileWriterLoop(ChannelReader<string> records, Options options)
+        {
+            StreamWriter writer = OpenLogFile(options.LogFile);
+
+            while (await records.WaitToReadAsync())
+            {
+                long batch = 0;
+                while (records.TryRead(out string record))
+                {
+                    writer.Write(record);
+                    batch++;
+                }
+                writer.Flush();
+                Interlocked.Add(ref written, batch);
+
+                if (writer.BaseStream.Length >= options.MaxFileSize)
+                {
+                    writer.Dispose();
+                    RotateLogFiles(options.LogFile, options.KeepFiles);
+                    writer = OpenLogFile(options.LogFile);
+                }
+            }
+
+            writer.Dispose();
+        }
+
+        private static StreamWriter OpenLogFile(string path)
+        {
+            FileStream stream = new FileStream(path, FileMode.Append, FileAccess.Write, FileShare.Read, 1 << 16);
+            return new StreamWriter(stream, new UTF8Encoding(false), 1 << 16);
+        }
+
+        // deviceLog.txt becomes deviceLog.1.txt, deviceLog.1.txt becomes deviceLog.2.txt, and so on up to keep files
+        private static void RotateLogFiles(string path, int keep)
+        {
+            string directory = Path.GetDirectoryName(path);
+            string name = Path.GetFileNameWithoutExtension(path);
+            string extension = Path.GetExtension(path);
+            string Rotated(int n) => Path.Combine(directory, $"{name}.{n}{extension}");
+
+            if (keep == 0)
+            {
+                File.Delete(path);
+                return;
+            }
+
+            File.Delete(Rotated(keep));
+            for (int n = keep - 1; n >= 1; n--)
+            {
+                if (File.Exists(Rotated(n)))
+                {
+                    File.Move(Rotated(n), Rotated(n + 1));
+                }
+            }
+            File.Move(path, Rotated(1));
+        }
+
+        private static bool ShowOnConsole(Options options, byte severity, string output)
+        {
+            return severity >= options.MinSeverity && (options.Match == null || options.Match.IsMatch(output));
+        }
+
+        // Parses a datagram, prints the lines that pass the filters and queues them all for the log file
+        private static void ProcessDatagram(byte[] bytes, Options options, ChannelWriter<string> records)
+        {
+            // the header and line layouts are UdpLogHeader and UdpLogLine in udplog.h, little endian
+            if (bytes.Length < headerSize || bytes[0] != protocolVersion)
+            {
+                Debug.WriteLine($"Rx'd buffer {bytes.Length} bytes, not a version {protocolVersion} log datagram.");
+                return;
+            }
+
+            int lineCount = bytes[1];
+            uint rxDeviceId = BitConverter.ToUInt32(bytes, 4);
+            uint sequence = BitConverter.ToUInt32(bytes, 8);
+            uint dropped = BitConverter.ToUInt32(bytes, 12);
+
+            if (options.DeviceHash != 0xffffffff && options.DeviceHash != rxDeviceId)
+            {
+                return;
+            }
+
+            TrackSequence(rxDeviceId, sequence, dropped);
+
+            StringBuilder record = new StringBuilder();
+            int offset = headerSize;
+            for (int line = 0; line < lineCount && offset + lineHeaderSize <= bytes.Length; line++)
+            {
+                uint timestampMs = BitConverter.ToUInt32(bytes, offset);
+                byte severity = bytes[offset + 4];
+                int length = BitConverter.ToUInt16(bytes, offset + 6);
+                offset += lineHeaderSize;
+                if (offset + length > bytes.Length)
+                {
+                    Debug.WriteLine($"Truncated line from {rxDeviceId:X8}.");
+                    break;
+                }
+                string output = Encoding.UTF8.GetString(bytes, offset, length);
+                offset += length;
+
+                string dateString = null;
+                if (options.ShowDateTime)
+                {
+                    DateTime dt = DateTime.Now;
+                    dateString = string.Format("{0} {1} ({2:F3}):", dt.ToShortDateString(), dt.ToShortTimeString(), timestampMs / 1000.0);
+                    record.Append(dateString).Append(Environment.NewLine);
+                }
+                record.Append(output);
+                if (!output.Contains('\n'))
+                {
+                    record.Append(Environment.NewLine);
+                }
+
+                if (!ShowOnConsole(options, severity, output))
+                {
+                    continue;
+                }
+
+                Concolor = ConsoleColor.Gray;
+
+                if (severity == severityInfo)
+                {
+                    Concolor = ConsoleColor.Cyan;
+                }
+
+                if (severity == severityWarning || severity == severityError)
+                {
+                    Concolor = ConsoleColor.Red;
+                }
+
+                if (Concolor != ConsoleColor.Gray)
+                {
+                    Console.ForegroundColor = Concolor;
+                }
+
+                if (options.DeviceHash == 0xffffffff)
+                {
+                    Console.Write($"{rxDeviceId,0:X8} ");
+                }
+
+                if (dateString != null)
+                {
+                    Console.Write($"{dateString} ");
+                    Debug.Write($"{dateString} ");
+                }
+
+                Console.Write($"{output}");
+                Debug.Write($"{output}");
+
+                if (!output.Contains('\n'))
+                {
+                    Console.WriteLine();
+                    Debug.WriteLine("");
+                }
+
+                if (Concolor != ConsoleColor.Gray)
+                {
+                    Console.ForegroundColor = ConsoleColor.Gray;
+                }
+            }
+
+            // the file channel is unbounded in practice, it's only full if the disk can't keep up at all
+            if (!records.TryWrite(record.ToString()))
+            {
+                Interlocked.Increment(ref Program.dropped);
+            }
+        }
+
+        static void Main(string[] args)
+        {
+            Options options = ParseArgs(args);
+            if (options == null)
+            {
+                Usage();
+                return;
+            }
+
+            Console.Clear();
+            Console.ForegroundColor = ConsoleColor.White;
+
+            Socket socket = new Socket(AddressFamily.InterNetwork, SocketType.Dgram, ProtocolType.Udp);
+            socket.ReceiveBufferSize = socketBufferSize;
+            socket.Bind(new IPEndPoint(IPAddress.Any, listenPort));
+
+            Channel<byte[]> datagrams = Channel.CreateBounded<byte[]>(new BoundedChannelOptions(datagramQueueSize)
+            {
+                SingleReader = true,
+                SingleWriter = true,
+                FullMode = BoundedChannelFullMode.Wait     // TryWrite fails when full, so drops are counted
+            });
+            Channel<string> records = Channel.CreateBounded<string>(new BoundedChannelOptions(fileQueueSize)
+            {
+                SingleReader = true,
+                SingleWriter = true,
+                FullMode = BoundedChannelFullMode.Wait
+            });
+
+            CancellationTokenSource cancel = new CancellationTokenSource();
+            Console.CancelKeyPress += (sender, e) =>
+            {
+                // stop receiving, then let the pipeline drain into the log file
+                e.Cancel = true;
+                cancel.Cancel();
+                socket.Close();
+            };
+
+            Console.WriteLine("Azure Sphere Console Debug Client");
+            Console.WriteLine($"Logging to {options.LogFile}, receive buffer {socket.ReceiveBufferSize} bytes");
+
+            Thread receiver = new Thread(() => ReceiveLoop(socket, datagrams.Writer, cancel.Token))
+            {
+                IsBackground = true,
+                Name = "UdpLogReceive",
+                Priority = ThreadPriority.AboveNormal
+            };
+            receiver.Start();
+
+            Task fileWriter = Task.Run(() => FileWriterLoop(records.Reader, options));
+
+            ChannelReader<byte[]> reader = datagrams.Reader;
+            while (reader.WaitToReadAsync().AsTask().GetAwaiter().GetResult())
+            {
+                while (reader.TryRead(out byte[] bytes))
+                {
+                    ProcessDatagram(bytes, options, records.Writer);
+                }
+
+                TimeSpan sinceReport = DateTime.Now - lastReport;
+                if (sinceReport >= statsPeriod)
+                {
+                    lastReport = DateTime.Now;
+                    ReportStats(sinceReport.TotalSeconds);
+                }
+            }
+
+            records.Writer.Complete();
+            fileWriter.GetAwaiter().GetResult();
+            ReportStats((DateTime.Now - lastReport).TotalSeconds);
+        }
     }
 }
@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+uint32_t GetDeviceIdHash(const uint8_t* key, size_t length);
@@ -2,14 +2,19 @@
    Licensed under the MIT License. */
 
 #include "udplog.h"
+#include "GetDeviceHash.h"
 #include <stdbool.h>
 #include <stdint.h>
+#include <strings.h>
+#include <ctype.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <string.h>
 #include <stdio.h>
@@ -17,38 +22,183 @@
 
 #include <stdarg.h>
 
+#include <applibs/networking.h>
+
 #define PORT 1824
 
+// Log_Debug formats the line on the caller's thread and queues it in the log ring, the sender
+// thread drains the ring every SEND_PERIOD_MS, packing as many lines as fit into each datagram.
+// When the ring is full the line is dropped and counted, the caller never waits on the network.
+#define LOG_RING_SLOTS 32			// power of two
+#define LOG_LINE_MAX 496			// longer lines are truncated
+#define DATAGRAM_MAX 1472			// a 1500 byte Ethernet MTU less the IP and UDP headers
+#define SEND_PERIOD_MS 20
+
 static int 	sock=-1;
 
 static struct sockaddr_in broadcast_addr;
 static socklen_t addr_len;
 static int ret;
-static char sock_buffer[500];
+static char sock_buffer[DATAGRAM_MAX];
+
+static pthread_once_t slogInit = PTHREAD_ONCE_INIT;
 
-static bool slogInit = false;
+// Bounded multi producer, single consumer queue: each slot's sequence tells whose turn it is,
+// producers claim a slot by moving enqueuePos, and publish it by advancing the slot's sequence.
+typedef struct {
+	size_t seq;
+	UdpLogLine line;
+	char text[LOG_LINE_MAX];
+} LogSlot;
+
+static LogSlot logRing[LOG_RING_SLOTS];
+static size_t enqueuePos = 0;
+static size_t dequeuePos = 0;		// sender thread only
+static uint32_t dropped = 0;
+static uint32_t deviceId = 0xffffffff;
 
 void initSlog(void);
 
-#ifdef USE_SOCKET_LOG
-int Log_Debug(const char *fmt, ...)
+static uint32_t MonotonicMs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+static UdpLogSeverity SeverityOf(const char* text)
 {
-	if (!slogInit)
+	static const struct {
+		const char* prefix;
+		UdpLogSeverity severity;
+	} prefixes[] = {
+		{ "error:", UDPLOG_SEVERITY_ERROR },
+		{ "warning:", UDPLOG_SEVERITY_WARNING },
+		{ "info:", UDPLOG_SEVERITY_INFO },
+		{ "information:", UDPLOG_SEVERITY_INFO },
+	};
+
+	while (isspace((unsigned char)*text))
+	{
+		text++;
+	}
+	for (size_t x = 0; x < sizeof(prefixes) / sizeof(prefixes[0]); x++)
 	{
-		initSlog();
+		if (strncasecmp(text, prefixes[x].prefix, strlen(prefixes[x].prefix)) == 0)
+		{
+			return prefixes[x].severity;
+		}
 	}
+	return UDPLOG_SEVERITY_DEBUG;
+}
 
-	memset(sock_buffer, 0x00, sizeof(sock_buffer));
-	va_list args;
-	va_start(args, fmt);
+static bool LogRing_Push(const char* text, size_t length, uint32_t timestampMs)
+{
+	size_t pos = __atomic_load_n(&enqueuePos, __ATOMIC_RELAXED);
+	LogSlot* slot;
+
+	while (true)
+	{
+		slot = &logRing[pos & (LOG_RING_SLOTS - 1)];
+		size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&enqueuePos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				break;
+			}
+		}
+		else if (diff < 0)
+		{
+			// the sender hasn't freed this slot yet, the ring is full
+			return false;
+		}
+		else
+		{
+			pos = __atomic_load_n(&enqueuePos, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy(slot->text, text, length);
+	slot->line.timestampMs = timestampMs;
+	slot->line.severity = (uint8_t)SeverityOf(text);
+	slot->line.reserved = 0;
+	slot->line.length = (uint16_t)length;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static LogSlot* LogRing_Peek(void)
+{
+	LogSlot* slot = &logRing[dequeuePos & (LOG_RING_SLOTS - 1)];
+	return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == dequeuePos + 1 ? slot : NULL;
+}
+
+static void LogRing_Pop(LogSlot* slot)
+{
+	__atomic_store_n(&slot->seq, dequeuePos + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+	dequeuePos++;
+}
+
+static void SendDatagram(UdpLogHeader* header, size_t length)
+{
+	if (header->lineCount > 0)
+	{
+		header->dropped = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+		ret = sendto(sock, sock_buffer, length, 0, (struct sockaddr*) &broadcast_addr, addr_len);
+		header->sequence++;
+		header->lineCount = 0;
+	}
+}
 
-	// You could use the first four bytes to contain a unique value per device.
-	sock_buffer[3] = 0xff;
-	sock_buffer[2] = 0xff;
-	sock_buffer[1] = 0xff;
-	sock_buffer[0] = 0xff;
+static void* SenderThread(void* arg)
+{
+	const struct timespec period = { .tv_sec = 0, .tv_nsec = SEND_PERIOD_MS * 1000000 };
+	UdpLogHeader* header = (UdpLogHeader*)sock_buffer;
+
+	memset(header, 0, sizeof(*header));
+	header->version = UDPLOG_VERSION;
+
+	while (true)
+	{
+		size_t length = sizeof(UdpLogHeader);
+		header->deviceId = __atomic_load_n(&deviceId, __ATOMIC_RELAXED);
+
+		LogSlot* slot;
+		while ((slot = LogRing_Peek()) != NULL)
+		{
+			size_t lineLength = sizeof(UdpLogLine) + slot->line.length;
+			if (length + lineLength > sizeof(sock_buffer) || header->lineCount == UINT8_MAX)
+			{
+				SendDatagram(header, length);
+				length = sizeof(UdpLogHeader);
+			}
+			memcpy(sock_buffer + length, &slot->line, sizeof(UdpLogLine));
+			memcpy(sock_buffer + length + sizeof(UdpLogLine), slot->text, slot->line.length);
+			length += lineLength;
+			header->lineCount++;
+			LogRing_Pop(slot);
+		}
+		SendDatagram(header, length);
+
+		nanosleep(&period, NULL);
+	}
+
+	return NULL;
+}
 
-	int vsRet=vsnprintf(sock_buffer+4, sizeof(sock_buffer) - 4, fmt, args);
+#ifdef USE_SOCKET_LOG
+int Log_Debug(const char *fmt, ...)
+{
+	pthread_once(&slogInit, initSlog);
+	uint32_t timestampMs = MonotonicMs();
+
+	char line[LOG_LINE_MAX];
+	va_list args;
+	va_start(args, fmt);
+	int vsRet=vsnprintf(line, sizeof(line), fmt, args);
 	va_end(args);
 
 	if (vsRet < 0)	// encoding error
@@ -57,16 +207,37 @@ int Log_Debug(const char *fmt, ...)
 		return -1;
 	}
 
-	ret = sendto(sock, sock_buffer, strnlen(sock_buffer + 4, sizeof(sock_buffer) - 4)+4, 0, (struct sockaddr*) &broadcast_addr, addr_len);
-	return ret;
+	size_t length = (size_t)vsRet < sizeof(line) ? (size_t)vsRet : sizeof(line) - 1;
+	if (sock < 0 || !LogRing_Push(line, length, timestampMs))
+	{
+		__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	return (int)length;
 }
 #endif
 
+void UdpLog_SetDeviceId(uint32_t id)
+{
+	__atomic_store_n(&deviceId, id, __ATOMIC_RELAXED);
+}
+
 void initSlog(void)
 {
 	int yes = 1;
 
-	slogInit = true;
+	// the WLAN MAC address tells devices apart, without needing the app's network connected
+	Networking_Interface_HardwareAddress mac;
+	if (__atomic_load_n(&deviceId, __ATOMIC_RELAXED) == 0xffffffff && Networking_GetHardwareAddress("wlan0", &mac) == 0)
+	{
+		__atomic_store_n(&deviceId, GetDeviceIdHash(mac.address, sizeof(mac.address)), __ATOMIC_RELAXED);
+	}
+
+	for (size_t x = 0; x < LOG_RING_SLOTS; x++)
+	{
+		logRing[x].seq = x;
+	}
+
 	sock = socket(AF_INET, SOCK_DGRAM, 0);
 	if (sock < 0) {
 		perror("sock error");
@@ -86,4 +257,13 @@ void initSlog(void)
 	broadcast_addr.sin_family = AF_INET;
 	broadcast_addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
 	broadcast_addr.sin_port = htons(PORT);
-}
\ No newline at end of file
+
+	pthread_t sender;
+	if (pthread_create(&sender, NULL, SenderThread, NULL) != 0) {
+		perror("pthread_create error");
+		close(sock);
+		sock=-1;
+		return;
+	}
+	pthread_detach(sender);
+}
@@ -0,0 +1,180 @@
+/* Copyright (c) Codethink Ltd. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lib/NVIC.h"
+
+#include "Scheduler.h"
+
+// One FIFO per priority, tasks are appended at the tail so they run in the
+// order they were posted.
+typedef struct {
+    Scheduler_Task *head;
+    Scheduler_Task *tail;
+} Scheduler_Queue;
+
+static Scheduler_Queue queues[SCHEDULER_PRIORITY_COUNT] = { 0 };
+
+static GPT      *latencyTimer = NULL;
+static uint32_t  ticksPerUs   = 0;
+
+// Helper function for reading the latency timer, ticks wrap at 32 bits.
+static inline uint32_t Scheduler__Now(void)
+{
+    return latencyTimer ? GPT_GetCount(latencyTimer) : 0;
+}
+
+int32_t Scheduler_Init(GPT *timer)
+{
+    unsigned p;
+    for (p = 0; p < SCHEDULER_PRIORITY_COUNT; p++) {
+        queues[p].head = NULL;
+        queues[p].tail = NULL;
+    }
+
+    latencyTimer = NULL;
+    ticksPerUs   = 0;
+    if (!timer) {
+        return ERROR_NONE;
+    }
+
+    float speedHz;
+    int32_t error = GPT_GetSpeed(timer, &speedHz);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+    if (speedHz < 1000000.0f) {
+        return ERROR_PARAMETER;
+    }
+
+    error = GPT_Start_Freerun(timer);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+
+    latencyTimer = timer;
+    ticksPerUs   = (uint32_t)(speedHz / 1000000.0f);
+    return ERROR_NONE;
+}
+
+void Scheduler_Post(Scheduler_Task *task)
+{
+    if (!task || (task->priority >= SCHEDULER_PRIORITY_COUNT)) {
+        return;
+    }
+
+    uint32_t prevBasePri = NVIC_BlockIRQs();
+    if (!task->enqueued) {
+        Scheduler_Queue *queue = &queues[task->priority];
+
+        task->enqueued = true;
+        task->next     = NULL;
+        task->posted   = Scheduler__Now();
+
+        if (queue->tail) {
+            queue->tail->next = task;
+        } else {
+            queue->head = task;
+        }
+        queue->tail = task;
+    }
+    NVIC_RestoreIRQs(prevBasePri);
+}
+
+// Helper function for removing the highest priority pending task, must be
+// called with IRQs blocked.
+static Scheduler_Task *Scheduler__Pop(void)
+{
+    unsigned p;
+    for (p = 0; p < SCHEDULER_PRIORITY_COUNT; p++) {
+        Scheduler_Task *task = queues[p].head;
+        if (task) {
+            queues[p].head = task->next;
+            if (!queues[p].head) {
+                queues[p].tail = NULL;
+            }
+            task->enqueued = false;
+            return task;
+        }
+    }
+    return NULL;
+}
+
+bool Scheduler_RunOne(void)
+{
+    uint32_t prevBasePri = NVIC_BlockIRQs();
+    Scheduler_Task *task = Scheduler__Pop();
+    uint32_t latency = 0;
+    if (task && latencyTimer) {
+        latency = Scheduler__Now() - task->posted;
+    }
+    NVIC_RestoreIRQs(prevBasePri);
+
+    if (!task) {
+        return false;
+    }
+
+    if (latency > task->maxLatency) {
+        task->maxLatency = latency;
+    }
+    if (latencyTimer && (task->deadline > 0) && (latency > (task->deadline * ticksPerUs))) {
+        task->missed++;
+    }
+
+    task->cb(task->data);
+    return true;
+}
+
+// Helper function for checking whether any task is pending.
+static inline bool Scheduler__Pending(void)
+{
+    unsigned p;
+    for (p = 0; p < SCHEDULER_PRIORITY_COUNT; p++) {
+        if (queues[p].head) {
+            return true;
+        }
+    }
+    return false;
+}
+
+_Noreturn void Scheduler_Run(void)
+{
+    for (;;) {
+        while (Scheduler_RunOne()) { }
+
+        // Check and sleep with interrupts masked, so a task posted between the
+        // check and the wfi still wakes the core; it's handled once unmasked.
+        __asm__ volatile("cpsid i");
+        if (!Scheduler__Pending()) {
+            __asm__ volatile("wfi");
+        }
+        __asm__ volatile("cpsie i");
+    }
+}
+
+uint32_t Scheduler_MaxLatency(const Scheduler_Task *task)
+{
+    if (!task || (ticksPerUs == 0)) {
+        return 0;
+    }
+    return task->maxLatency / ticksPerUs;
+}
+
+uint32_t Scheduler_Missed(const Scheduler_Task *task)
+{
+    return task ? task->missed : 0;
+}
+
+void Scheduler_ResetStats(Scheduler_Task *task)
+{
+    if (!task) {
+        return;
+    }
+
+    uint32_t prevBasePri = NVIC_BlockIRQs();
+    task->maxLatency = 0;
+    task->missed     = 0;
+    NVIC_RestoreIRQs(prevBasePri);
+}
@@ -0,0 +1,115 @@
+/* Copyright (c) Codethink Ltd. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef AZURE_SPHERE_SCHEDULER_H_
+#define AZURE_SPHERE_SCHEDULER_H_
+
+#include "lib/Common.h"
+#include "lib/GPT.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Cooperative run-to-completion scheduler for the main loop of an RT app.
+// Interrupt handlers post tasks, which run one at a time from the main loop,
+// highest priority first and in the order posted within a priority. A task
+// is never preempted by another task, so a posted high priority task waits
+// at most for the task currently running, never for the rest of the queue.
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/// <summary>Task priorities, lower values run first.</summary>
+typedef enum {
+    /// <summary>Deferred interrupt work which must keep up with hardware, e.g. UART RX.</summary>
+    SCHEDULER_PRIORITY_HIGH   = 0,
+    /// <summary>Timer expiry and protocol handling.</summary>
+    SCHEDULER_PRIORITY_NORMAL = 1,
+    /// <summary>Bulk work, e.g. mailbox messages from the A7.</summary>
+    SCHEDULER_PRIORITY_LOW    = 2,
+    SCHEDULER_PRIORITY_COUNT
+} Scheduler_Priority;
+
+typedef struct Scheduler_Task Scheduler_Task;
+
+/// <summary>
+/// <para>A unit of deferred work, normally statically allocated by the code which posts it.
+/// Use <see cref="SCHEDULER_TASK" /> to initialize one; the remaining fields are owned by
+/// the scheduler.</para>
+/// </summary>
+struct Scheduler_Task {
+    /// <summary>Function to run, passed data.</summary>
+    void              (*cb)(void*);
+    /// <summary>User data passed to cb.</summary>
+    void               *data;
+    /// <summary>Priority the task runs at.</summary>
+    Scheduler_Priority  priority;
+    /// <summary>Latency in microseconds after which a run counts as missed, 0 for none.</summary>
+    uint32_t            deadline;
+
+    bool                enqueued;
+    Scheduler_Task     *next;
+    uint32_t            posted;
+    uint32_t            maxLatency;
+    uint32_t            missed;
+};
+
+/// <summary>Static initializer for a <see cref="Scheduler_Task" />.</summary>
+#define SCHEDULER_TASK(callback, prio, deadlineUs) \
+    { .cb = (callback), .data = NULL, .priority = (prio), .deadline = (deadlineUs) }
+
+/// <summary>
+/// <para>Starts the scheduler. Must be called before any task is posted.</para>
+/// <para>If a timer is passed, it is started free running and used to measure how long
+/// each task waits between being posted and starting. A fast timer opened with
+/// GPT_MODE_NONE (GPT4) is best, as it counts up without interrupting.</para>
+/// </summary>
+/// <param name="timer">An open, stopped timer for latency measurement, or NULL.</param>
+/// <returns>ERROR_NONE on success, or an error code.</returns>
+int32_t Scheduler_Init(GPT *timer);
+
+/// <summary>
+/// <para>Queues a task to run from the main loop. Posting a task which is already
+/// queued has no effect. Safe to call from interrupt handlers.</para>
+/// </summary>
+/// <param name="task">The task to post.</param>
+void Scheduler_Post(Scheduler_Task *task);
+
+/// <summary>
+/// <para>Runs the highest priority pending task, if there is one.</para>
+/// </summary>
+/// <returns>'true' if a task was run, 'false' if none were pending.</returns>
+bool Scheduler_RunOne(void);
+
+/// <summary>
+/// <para>Runs tasks forever, sleeping with wfi while none are pending.</para>
+/// </summary>
+_Noreturn void Scheduler_Run(void);
+
+/// <summary>
+/// <para>Returns the longest time, in microseconds, the task has waited to run since
+/// it was last reset, or 0 if latency isn't measured.</para>
+/// </summary>
+/// <param name="task">The task to query.</param>
+/// <returns>Maximum latency in microseconds.</returns>
+uint32_t Scheduler_MaxLatency(const Scheduler_Task *task);
+
+/// <summary>
+/// <para>Returns the number of runs which started later than the task's deadline.</para>
+/// </summary>
+/// <param name="task">The task to query.</param>
+/// <returns>Number of missed deadlines.</returns>
+uint32_t Scheduler_Missed(const Scheduler_Task *task);
+
+/// <summary>
+/// <para>Resets the latency and missed deadline counters of a task.</para>
+/// </summary>
+/// <param name="task">The task to reset.</param>
+void Scheduler_ResetStats(Scheduler_Task *task);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // #ifndef AZURE_SPHERE_SCHEDULER_H_
@@ -0,0 +1,827 @@
+/* Copyright (c) Codethink Ltd. All rights reserved.
+   Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// This is derivative of logical-intercore.c in
+// https://github.com/Azure/azure-sphere-samples/tree/master/Samples/IntercoreComms
+// but rewritten to be more consistent with other high level drivers in
+// sample set
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lib/MBox.h"
+
+#include "Socket.h"
+
+#define FIFO_MSG_NEG_LEN 3
+
+typedef struct __attribute__((__packed__)) {
+    // read and write index in bytes
+    uint32_t writeIndex;
+    uint32_t readIndex;
+    uint32_t reserved[14];
+} Socket_Ringbuffer_Header;
+
+typedef struct __attribute__((__packed__)) {
+    Socket_Ringbuffer_Header header;
+    uint8_t                  data[];
+} Socket_Ringbuffer_Shared;
+
+typedef struct {
+    Socket_Ringbuffer_Shared *sharedData;
+    uintptr_t                 capacity;
+} Socket_Ringbuffer;
+
+#define RB_WRITE_INDEX(rb) rb.sharedData->header.writeIndex
+#define RB_READ_INDEX(rb)  rb.sharedData->header.readIndex
+
+typedef struct {
+    Component_Id  comp_id;
+    uint32_t      reserved;
+} Socket_Msg_Header;
+
+// Size in bytes of the queue kept for each outbound priority.
+#define SOCKET_QUEUE_SIZE 2048
+
+// Messages waiting for space in the local ringbuffer. Each entry is a
+// Socket_Queue_Entry followed by its payload, both may wrap around.
+typedef struct {
+    uint8_t   data[SOCKET_QUEUE_SIZE];
+    uint32_t  head;
+    uint32_t  used;
+} Socket_Queue;
+
+typedef struct {
+    Component_Id  recipient;
+    uint32_t      size;
+} Socket_Queue_Entry;
+
+/* Handle to socket connection containing state of shared ring buffer
+
+   ringRemote state is updated by the A7 core and read by the M4 core
+   ringLocal state is updated by the M4 core and read by the A7 core */
+struct Socket {
+    bool               open;
+    void             (*rx_cb)(Socket*);
+    MBox              *mailbox;
+    Socket_Ringbuffer  ringRemote;
+    Socket_Ringbuffer  ringLocal;
+    // Block being built in place by Socket_Reserve / Socket_Commit
+    bool               reserved;
+    uint32_t           reservedSize;
+    // Block being read in place by Socket_Peek / Socket_Consume
+    bool               peeked;
+    uint32_t           peekedSize;
+    // Outbound messages queued by Socket_Send, one queue per priority
+    Socket_Queue       queues[SOCKET_PRIORITY_COUNT];
+    void             (*tx_cb)(Socket*);
+};
+
+static Socket context = {0};
+
+// Buffer descriptor commands
+#define SOCKET_CMD_LOCAL_BUFFER_DESC  0xba5e0001
+#define SOCKET_CMD_REMOTE_BUFFER_DESC 0xba5e0002
+#define SOCKET_CMD_END_OF_SETUP       0xba5e0003
+
+// Blocks inside the shared buffer have this alignment.
+#define RB_ALIGNMENT 16
+// Maximum payload size in bytes. This does not include a header which
+// is prepended by
+#define RB_MAX_PAYLOAD_LEN 1040
+
+static const uint8_t SOCKET_PORT_MSG_RECV = 1;
+static const uint8_t SOCKET_PORT_MSG_SENT = 0;
+static const uint8_t SOCKET_PORT_FLAGS    =
+    (SOCKET_PORT_MSG_RECV + 1) | (SOCKET_PORT_MSG_SENT + 1);
+
+static uint32_t RoundUp(uint32_t value, uint32_t alignment)
+{
+    // alignment must be a power of two.
+    return (value + (alignment - 1)) & ~(alignment - 1);
+}
+
+static Socket_Ringbuffer Socket_Ringbuffer__Parse_Desc(uint32_t buffer_desc)
+{
+    Socket_Ringbuffer buffer;
+    // The buffer size is encoded as a power of two in the bottom five bits.
+    buffer.capacity = (1U << (buffer_desc & 0x1F)) - sizeof(Socket_Ringbuffer_Header);
+    // The buffer header is a 32-byte aligned pointer which is stored in the
+    // top 27 bits.
+    buffer.sharedData = (Socket_Ringbuffer_Shared*)(buffer_desc & ~0x1F);
+
+    return buffer;
+}
+
+static void Socket__Msg_Available(void *user_data, uint8_t port)
+{
+    if (!user_data || (port >= MBOX_SW_INT_PORT_COUNT)) {
+        return;
+    }
+
+    Socket *handle = (Socket*)user_data;
+
+    // The HLApp raises the "sent" port once it has read from our ringbuffer,
+    // so there may now be space for queued messages.
+    if (port == SOCKET_PORT_MSG_SENT) {
+        if (handle->tx_cb) {
+            handle->tx_cb(handle);
+        }
+        return;
+    }
+
+    if (port != SOCKET_PORT_MSG_RECV) {
+        return;
+    }
+
+    handle->rx_cb(handle);
+}
+
+Socket* Socket_Open(void (*rx_cb)(Socket*))
+{
+    if (context.open) {
+        return NULL;
+    }
+
+    // Initialise MBox and FIFO
+    MBox *mbox;
+    if ((mbox = MBox_FIFO_Open(
+        MT3620_UNIT_MBOX_CA7, NULL, NULL, NULL, &context, -1, -1)) == NULL) {
+        return NULL;
+    }
+
+    context.mailbox = mbox;
+    if (Socket_Negotiate(&context) != ERROR_NONE) {
+        Socket_Close(&context);
+        return NULL;
+    }
+
+    // Setup SW Interrupts
+    if (MBox_SW_Interrupt_Setup(
+            context.mailbox, SOCKET_PORT_FLAGS,
+            Socket__Msg_Available) != ERROR_NONE)
+    {
+        Socket_Close(&context);
+        return NULL;
+    }
+
+    // Update context
+    context.rx_cb = rx_cb;
+    context.open  = true;
+
+    return &context;
+}
+
+int32_t Socket_Close(Socket *socket)
+{
+    if (!socket || !socket->open) {
+        return ERROR_PARAMETER;
+    }
+
+    MBox_SW_Interrupt_Teardown(socket->mailbox);
+    MBox_FIFO_Close(socket->mailbox);
+    socket->open = false;
+
+    return ERROR_NONE;
+}
+
+
+bool Socket_NegotiationPending(Socket *socket)
+{
+    if (!socket)    {
+        return false;
+    }
+
+    return (MBox_FIFO_Reads_Available(socket->mailbox) != 0);
+}
+
+int32_t Socket_Negotiate(Socket *socket)
+{
+    if (!socket) {
+        return ERROR_SOCKET_NEGOTIATION;
+    }
+
+    // Get buffer descriptors from MBox FIFO
+    uint32_t  cmd[FIFO_MSG_NEG_LEN], data[FIFO_MSG_NEG_LEN];
+
+    // Block and wait for A7 core to negotiate buffer descriptors
+    if (MBox_FIFO_ReadSync(socket->mailbox, cmd, data, FIFO_MSG_NEG_LEN) != ERROR_NONE)
+    {
+        MBox_FIFO_Close(socket->mailbox);
+        return ERROR_SOCKET_NEGOTIATION;
+    }
+
+    // Parse buffer descriptors
+    Socket_Ringbuffer ringRemote, ringLocal;
+    unsigned parsed = 0;
+
+    for (unsigned i = 0; i < FIFO_MSG_NEG_LEN; i++) {
+        switch (cmd[i]) {
+        case SOCKET_CMD_LOCAL_BUFFER_DESC:
+            ringLocal = Socket_Ringbuffer__Parse_Desc(data[i]);
+            parsed |= 1;
+            break;
+
+        case SOCKET_CMD_REMOTE_BUFFER_DESC:
+            ringRemote = Socket_Ringbuffer__Parse_Desc(data[i]);
+            parsed |= 2;
+            break;
+
+        case SOCKET_CMD_END_OF_SETUP:
+            parsed |= 4;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if ((parsed != 7) ||
+       (ringLocal.capacity == 0) ||
+       (ringRemote.capacity == 0))
+    {
+        return ERROR_SOCKET_NEGOTIATION;
+    }
+
+    socket->ringRemote = ringRemote;
+    socket->ringLocal  = ringLocal;
+    socket->reserved   = false;
+    socket->peeked     = false;
+
+    // Queued messages were meant for the connection being replaced.
+    for (unsigned i = 0; i < SOCKET_PRIORITY_COUNT; i++) {
+        socket->queues[i].head = 0;
+        socket->queues[i].used = 0;
+    }
+
+    return ERROR_NONE;
+}
+
+
+void Socket_Reset(Socket *socket)
+{
+    if (!socket) {
+        return;
+    }
+
+    MBox_FIFO_Reset(socket->mailbox, true);
+}
+
+static void Socket__Signal(Socket *socket, uint8_t port)
+{
+    // Ensure memory writes have completed (not just been sent) before raising interrupt.
+    // "no instruction that appears in program order after the DSB instruction can execute until the
+    // DSB completes" ARMv7M Architecture Reference Manual, ARM DDI 0403E.d S A3.7.3
+    __asm__ volatile("dsb");
+    MBox_SW_Interrupt_Trigger(socket->mailbox, port);
+}
+
+// Advances a ringbuffer position by size bytes, wrapping around to start of
+// buffer if required.
+static uint32_t Socket__Advance(const Socket_Ringbuffer *rb, uint32_t pos, uint32_t size)
+{
+    uint32_t finalPos = pos + size;
+    if (finalPos >= rb->capacity) {
+        finalPos -= rb->capacity;
+    }
+    return finalPos;
+}
+
+// Advances a ringbuffer position past a block, to start of next possible block.
+static uint32_t Socket__Next_Block(const Socket_Ringbuffer *rb, uint32_t pos, uint32_t payloadSize)
+{
+    pos = Socket__Advance(rb, pos, sizeof(uint32_t) + sizeof(Socket_Msg_Header) + payloadSize);
+    pos = RoundUp(pos, RB_ALIGNMENT);
+    if (pos >= rb->capacity) {
+        pos -= rb->capacity;
+    }
+    return pos;
+}
+
+// Describes size bytes starting at pos as one or two contiguous segments,
+// the second starting at the beginning of the buffer if the region wraps.
+static void Socket__Segments(
+    const Socket_Ringbuffer *rb, uint32_t pos, uint32_t size, Socket_Segments *segments)
+{
+    uint32_t spaceToEnd = rb->capacity - pos;
+    uint32_t sizeToEnd  = (size > spaceToEnd ? spaceToEnd : size);
+
+    segments->data[0] = &(rb->sharedData->data[pos]);
+    segments->size[0] = sizeToEnd;
+    segments->data[1] = &(rb->sharedData->data[0]);
+    segments->size[1] = size - sizeToEnd;
+}
+
+// Helper function for Socket_Write. Writes data to the local ringbuffer,
+// and wraps around to start of buffer if required. Returns updated write position.
+static uint32_t Socket__Write_RB(
+    const Socket_Ringbuffer *rb, uint32_t startPos, const void *src, size_t size)
+{
+    uint32_t spaceToEnd = rb->capacity - startPos;
+
+    uint32_t writeToEnd = size;
+    // If the new data would wrap around the end of the buffer then only write
+    // spaceToEnd bytes before subsequently writing to the start of the buffer.
+    if (size > spaceToEnd) {
+        writeToEnd = spaceToEnd;
+    }
+
+    const uint8_t *src8 = (const uint8_t *)src;
+
+    __builtin_memcpy(&(rb->sharedData->data[startPos]), src8, writeToEnd);
+    // If not enough space to write all data before end of buffer, then write remainder at start.
+    __builtin_memcpy(&(rb->sharedData->data[0]), src8 + writeToEnd, size - writeToEnd);
+
+    uint32_t finalPos = startPos + size;
+    if (finalPos > rb->capacity) {
+        finalPos -= rb->capacity;
+    }
+    return finalPos;
+}
+
+// Helper function for Socket_Write and Socket_Reserve. Checks there is space
+// in the local ringbuffer for a block carrying size bytes of payload, and
+// returns the position the block will be written at.
+static int32_t Socket__Write_Space(Socket *socket, uint32_t size, uint32_t *writePosition)
+{
+    if (size > RB_MAX_PAYLOAD_LEN) {
+        return ERROR_SOCKET_INSUFFICIENT_SPACE;
+    }
+
+    // Last position read by HLApp. Corresponding release occurs on
+    // high-level core.
+    uint32_t remoteReadPosition;
+    __atomic_load(&(RB_READ_INDEX(socket->ringRemote)),
+        &remoteReadPosition, __ATOMIC_ACQUIRE);
+    // Last position written to by RTApp.
+    uint32_t localWritePosition = RB_WRITE_INDEX(socket->ringLocal);
+
+    // Sanity check read and write positions.
+    if ((remoteReadPosition >= socket->ringLocal.capacity) ||
+        ((remoteReadPosition % RB_ALIGNMENT) != 0) ||
+        (localWritePosition >= socket->ringLocal.capacity) ||
+        ((localWritePosition % RB_ALIGNMENT) != 0)) {
+        return ERROR_SOCKET_INSUFFICIENT_SPACE;
+    }
+
+    // If the read pointer is behind the write pointer, then the free space
+    // wraps around, and the used space doesn't.
+    uint32_t availSpace;
+    if (remoteReadPosition <= localWritePosition) {
+        availSpace = remoteReadPosition - localWritePosition +
+            socket->ringLocal.capacity;
+    } else {
+        availSpace = remoteReadPosition - localWritePosition;
+    }
+
+    // Check whether there is enough space to enqueue the next block.
+    uint32_t reqBlockSize = sizeof(uint32_t) + sizeof(Socket_Msg_Header) + size;
+
+    if (availSpace < reqBlockSize + RB_ALIGNMENT) {
+        return ERROR_SOCKET_INSUFFICIENT_SPACE;
+    }
+
+    *writePosition = localWritePosition;
+    return ERROR_NONE;
+}
+
+// Helper function for Socket_Write and Socket_Commit. Writes the block size
+// and header in front of a payload which is already in the local ringbuffer,
+// then publishes the block to the HLApp.
+static void Socket__Write_Publish(
+    Socket *socket, const Component_Id *recipient, uint32_t writePosition, uint32_t size)
+{
+    uint32_t nextPosition = Socket__Next_Block(&(socket->ringLocal), writePosition, size);
+
+    // The value in the block size field does not include the space taken by the
+    // block size field itself.
+    uint32_t blockSizeExcSizeField = sizeof(Socket_Msg_Header) + size;
+    writePosition = Socket__Write_RB(
+        &(socket->ringLocal), writePosition, &blockSizeExcSizeField,
+        sizeof(blockSizeExcSizeField));
+
+    // Write header
+    Socket_Msg_Header msg_header = {0};
+    msg_header.comp_id = *recipient;
+    Socket__Write_RB(
+        &(socket->ringLocal), writePosition,
+        &msg_header, sizeof(Socket_Msg_Header));
+
+    // Ensure write position update is seen after new content has been written.
+    // Corresponding acquire is on high-level core.
+    __atomic_store(
+        &(RB_WRITE_INDEX(socket->ringLocal)),
+        &nextPosition, __ATOMIC_RELEASE);
+
+    Socket__Signal(socket, SOCKET_PORT_MSG_SENT);
+}
+
+int32_t Socket_Write(
+    Socket             *socket,
+    const Component_Id *recipient,
+    const void         *data,
+    uint32_t            size)
+{
+    if (!socket || !recipient || !data || (size == 0)) {
+        return ERROR_PARAMETER;
+    }
+
+    // A reserved block is being built in place at the write position.
+    if (socket->reserved) {
+        return ERROR_BUSY;
+    }
+
+    uint32_t localWritePosition;
+    int32_t  error = Socket__Write_Space(socket, size, &localWritePosition);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+
+    // Write data, then the block size and header in front of it.
+    Socket__Write_RB(
+        &(socket->ringLocal),
+        Socket__Advance(&(socket->ringLocal), localWritePosition,
+            sizeof(uint32_t) + sizeof(Socket_Msg_Header)),
+        data, size);
+
+    Socket__Write_Publish(socket, recipient, localWritePosition, size);
+
+    return ERROR_NONE;
+}
+
+int32_t Socket_Reserve(
+    Socket          *socket,
+    uint32_t         size,
+    Socket_Segments *segments)
+{
+    if (!socket || !segments || (size == 0)) {
+        return ERROR_PARAMETER;
+    }
+
+    uint32_t localWritePosition;
+    int32_t  error = Socket__Write_Space(socket, size, &localWritePosition);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+
+    // The payload follows the block size field and header.
+    Socket__Segments(&(socket->ringLocal),
+        Socket__Advance(&(socket->ringLocal), localWritePosition,
+            sizeof(uint32_t) + sizeof(Socket_Msg_Header)),
+        size, segments);
+
+    socket->reserved     = true;
+    socket->reservedSize = size;
+
+    return ERROR_NONE;
+}
+
+int32_t Socket_Commit(
+    Socket             *socket,
+    const Component_Id *recipient,
+    uint32_t            size)
+{
+    if (!socket || !socket->reserved) {
+        return ERROR_PARAMETER;
+    }
+
+    socket->reserved = false;
+
+    // A size of zero abandons the reservation.
+    if (size == 0) {
+        return ERROR_NONE;
+    }
+
+    if (!recipient || (size > socket->reservedSize)) {
+        return ERROR_PARAMETER;
+    }
+
+    // Only this core moves the local write position, so it still points at
+    // the reserved block.
+    Socket__Write_Publish(socket, recipient, RB_WRITE_INDEX(socket->ringLocal), size);
+
+    return ERROR_NONE;
+}
+
+// Copies size bytes into a queue at offset from its head, wrapping around
+// to start of queue if required.
+static void Socket__Queue_Write(
+    Socket_Queue *queue, uint32_t offset, const void *src, uint32_t size)
+{
+    const uint8_t *src8 = (const uint8_t *)src;
+    uint32_t pos = (queue->head + offset) % SOCKET_QUEUE_SIZE;
+    for (uint32_t i = 0; i < size; i++) {
+        queue->data[pos] = src8[i];
+        pos = (pos + 1) % SOCKET_QUEUE_SIZE;
+    }
+}
+
+// Copies size bytes out of a queue at offset from its head, wrapping around
+// to start of queue if required.
+static void Socket__Queue_Read(
+    const Socket_Queue *queue, uint32_t offset, void *dest, uint32_t size)
+{
+    uint8_t *dest8 = (uint8_t *)dest;
+    uint32_t pos = (queue->head + offset) % SOCKET_QUEUE_SIZE;
+    for (uint32_t i = 0; i < size; i++) {
+        dest8[i] = queue->data[pos];
+        pos = (pos + 1) % SOCKET_QUEUE_SIZE;
+    }
+}
+
+int32_t Socket_Send(
+    Socket             *socket,
+    const Component_Id *recipient,
+    Socket_Priority     priority,
+    const void         *data,
+    uint32_t            size)
+{
+    if (!socket || !recipient || !data || (size == 0) ||
+        (priority >= SOCKET_PRIORITY_COUNT)) {
+        return ERROR_PARAMETER;
+    }
+
+    if (size > RB_MAX_PAYLOAD_LEN) {
+        return ERROR_SOCKET_INSUFFICIENT_SPACE;
+    }
+
+    Socket_Queue *queue = &(socket->queues[priority]);
+    uint32_t entrySize = sizeof(Socket_Queue_Entry) + size;
+    if (entrySize > SOCKET_QUEUE_SIZE - queue->used) {
+        return ERROR_SOCKET_INSUFFICIENT_SPACE;
+    }
+
+    Socket_Queue_Entry entry = { .recipient = *recipient, .size = size };
+    Socket__Queue_Write(queue, queue->used, &entry, sizeof(entry));
+    Socket__Queue_Write(queue, queue->used + sizeof(entry), data, size);
+    queue->used += entrySize;
+
+    // Not being able to send now isn't an error, the message stays queued.
+    Socket_Flush(socket);
+    return ERROR_NONE;
+}
+
+int32_t Socket_Flush(Socket *socket)
+{
+    if (!socket) {
+        return ERROR_PARAMETER;
+    }
+
+    // A reserved block is being built in place at the write position.
+    if (socket->reserved) {
+        return ERROR_BUSY;
+    }
+
+    // Stop at the first message which doesn't fit, so lower priorities
+    // never take the space a higher priority message is waiting for.
+    for (unsigned i = 0; i < SOCKET_PRIORITY_COUNT; i++) {
+        Socket_Queue *queue = &(socket->queues[i]);
+        while (queue->used > 0) {
+            Socket_Queue_Entry entry;
+            Socket__Queue_Read(queue, 0, &entry, sizeof(entry));
+
+            uint32_t localWritePosition;
+            int32_t  error = Socket__Write_Space(socket, entry.size, &localWritePosition);
+            if (error != ERROR_NONE) {
+                return error;
+            }
+
+            Socket_Segments segments;
+            Socket__Segments(&(socket->ringLocal),
+                Socket__Advance(&(socket->ringLocal), localWritePosition,
+                    sizeof(uint32_t) + sizeof(Socket_Msg_Header)),
+                entry.size, &segments);
+            Socket__Queue_Read(queue, sizeof(entry), segments.data[0], segments.size[0]);
+            Socket__Queue_Read(queue, sizeof(entry) + segments.size[0],
+                segments.data[1], segments.size[1]);
+
+            Socket__Write_Publish(socket, &entry.recipient, localWritePosition, entry.size);
+
+            uint32_t entrySize = sizeof(entry) + entry.size;
+            queue->head = (queue->head + entrySize) % SOCKET_QUEUE_SIZE;
+            queue->used -= entrySize;
+        }
+    }
+
+    return ERROR_NONE;
+}
+
+uint32_t Socket_Queued(Socket *socket, Socket_Priority priority)
+{
+    if (!socket || (priority >= SOCKET_PRIORITY_COUNT)) {
+        return 0;
+    }
+    return socket->queues[priority].used;
+}
+
+void Socket_SetTxCallback(Socket *socket, void (*tx_cb)(Socket*))
+{
+    if (!socket) {
+        return;
+    }
+    socket->tx_cb = tx_cb;
+}
+
+// Helper function for Socket_Read. Reads data from the remote ring buffer,
+// and wraps around to start of buffer if required. Returns updated read position.
+static uint32_t Socket__Read_RB(
+    const Socket_Ringbuffer *rb, uint32_t startPos, void *dest, size_t size)
+{
+    uint32_t availToEnd = rb->capacity - startPos;
+
+    uint32_t readFromEnd = size;
+    // If the available data wraps around the end of the buffer then only read
+    // availToEnd bytes before subsequently reading from the start of the buffer.
+    if (size > availToEnd) {
+        readFromEnd = availToEnd;
+    }
+
+    uint8_t *dest8 = (uint8_t *)dest;
+    __builtin_memcpy(dest, &(rb->sharedData->data[startPos]), readFromEnd);
+
+    // If block wrapped around the end of the buffer, then read remainder from start.
+    __builtin_memcpy(dest8 + readFromEnd, &(rb->sharedData->data[0]), size - readFromEnd);
+
+    uint32_t finalPos = startPos + size;
+    if (finalPos > rb->capacity) {
+        finalPos -= rb->capacity;
+    }
+    return finalPos;
+}
+
+// Helper function for Socket_Read and Socket_Peek. Checks a complete block is
+// available in the remote ringbuffer and reads its sender header. Returns the
+// position of the block, the position of its payload and the payload size.
+static int32_t Socket__Read_Block(
+    Socket       *socket,
+    Component_Id *sender,
+    uint32_t     *blockPosition,
+    uint32_t     *payloadPosition,
+    uint32_t     *payloadSize)
+{
+    // Don't read message content until have seen that remote write position has been updated.
+    // Corresponding release occurs on high-level core.
+    uint32_t remoteWritePosition;
+    __atomic_load(&(RB_WRITE_INDEX(socket->ringRemote)), &remoteWritePosition, __ATOMIC_ACQUIRE);
+    // Last position read from by this RTApp.
+    uint32_t localReadPosition = RB_READ_INDEX(socket->ringLocal);
+
+    // Sanity check read and write positions.
+    if ((remoteWritePosition >= socket->ringRemote.capacity) ||
+        ((remoteWritePosition % RB_ALIGNMENT) != 0) ||
+        (localReadPosition >= socket->ringRemote.capacity) ||
+        ((localReadPosition % RB_ALIGNMENT) != 0)) {
+        return ERROR_SOCKET_INSUFFICIENT_SPACE;
+    }
+
+    *blockPosition = localReadPosition;
+
+    // Get the maximum amount of available data. The actual block size may be
+    // smaller than this.
+
+    uint32_t availData;
+    // If data is contiguous in buffer then difference between write and read positions...
+    if (remoteWritePosition >= localReadPosition) {
+        availData = remoteWritePosition - localReadPosition;
+    }
+    // ...else data wraps around end and resumes at start of buffer
+    else {
+        availData = remoteWritePosition - localReadPosition + socket->ringRemote.capacity;
+    }
+
+    // The amount of available data must be at least enough to hold the block size.
+    // If not, caller will assume that no message was available.
+    const size_t blockSizeSize = sizeof(uint32_t);
+    // The block size must be stored in four contiguous bytes before wraparound.
+    uint32_t dataToEnd = socket->ringRemote.capacity - localReadPosition;
+    if ((availData < blockSizeSize) || (blockSizeSize > dataToEnd)) {
+        return ERROR_SOCKET_INSUFFICIENT_SPACE;
+    }
+
+    // The block size followed by the actual block can be no longer than the available data.
+    uint32_t blockSize;
+    localReadPosition = Socket__Read_RB(
+        &(socket->ringRemote), localReadPosition, &blockSize, sizeof(blockSize));
+    uint32_t totalBlockSize;
+
+    totalBlockSize = blockSizeSize + blockSize;
+    if (totalBlockSize > availData) {
+        return ERROR_SOCKET_INSUFFICIENT_SPACE;
+    }
+
+    if (blockSize < sizeof(Socket_Msg_Header)) {
+        return ERROR_SOCKET_INSUFFICIENT_SPACE;
+    }
+
+    // Read the sender ID from the header, skipping the reserved word. This may
+    // wraparound to the start of the buffer.
+    Socket__Read_RB(
+        &(socket->ringRemote), localReadPosition,
+        sender, sizeof(Component_Id));
+    localReadPosition = Socket__Advance(
+        &(socket->ringRemote), localReadPosition, sizeof(Socket_Msg_Header));
+
+    *payloadPosition = localReadPosition;
+    *payloadSize     = blockSize - sizeof(Socket_Msg_Header);
+
+    return ERROR_NONE;
+}
+
+// Helper function for Socket_Read and Socket_Consume. Releases a block back
+// to the HLApp.
+static void Socket__Read_Release(Socket *socket, uint32_t blockPosition, uint32_t payloadSize)
+{
+    // Align read position to next possible location for next buffer.
+    // This may wrap around.
+    uint32_t localReadPosition = Socket__Next_Block(&(socket->ringRemote), blockPosition, payloadSize);
+
+    // The message content must have been retrieved before the high-level core
+    // sees the read position has been updated. Corresponding acquire occurs
+    // on high-level core.
+    __atomic_store(
+        &(RB_READ_INDEX(socket->ringLocal)),
+        &localReadPosition, __ATOMIC_RELEASE);
+
+    Socket__Signal(socket, SOCKET_PORT_MSG_RECV);
+}
+
+int32_t Socket_Read(
+    Socket       *socket,
+    Component_Id *sender,
+    void         *data,
+    uint32_t     *size)
+{
+    if (!socket || !sender || !data || !size) {
+        return ERROR_PARAMETER;
+    }
+
+    // A peeked block is still being read in place at the read position.
+    if (socket->peeked) {
+        return ERROR_BUSY;
+    }
+
+    uint32_t blockPosition, payloadPosition, senderPayloadSize;
+    int32_t  error = Socket__Read_Block(
+        socket, sender, &blockPosition, &payloadPosition, &senderPayloadSize);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+
+    // The caller-supplied buffer must be large enough to contain the
+    // payload in the buffer, excluding component ID and reserved word.
+    if (senderPayloadSize > *size) {
+        return ERROR_SOCKET_INSUFFICIENT_SPACE;
+    }
+
+    // Tell the caller the actual block size.
+    *size = senderPayloadSize;
+
+    // Read data
+    Socket__Read_RB(
+        &(socket->ringRemote),
+        payloadPosition, data, senderPayloadSize);
+
+    Socket__Read_Release(socket, blockPosition, senderPayloadSize);
+
+    return ERROR_NONE;
+}
+
+int32_t Socket_Peek(
+    Socket          *socket,
+    Component_Id    *sender,
+    Socket_Segments *segments)
+{
+    if (!socket || !sender || !segments) {
+        return ERROR_PARAMETER;
+    }
+
+    uint32_t blockPosition, payloadPosition, senderPayloadSize;
+    int32_t  error = Socket__Read_Block(
+        socket, sender, &blockPosition, &payloadPosition, &senderPayloadSize);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+
+    Socket__Segments(&(socket->ringRemote), payloadPosition, senderPayloadSize, segments);
+
+    socket->peeked     = true;
+    socket->peekedSize = senderPayloadSize;
+
+    return ERROR_NONE;
+}
+
+int32_t Socket_Consume(Socket *socket)
+{
+    if (!socket || !socket->peeked) {
+        return ERROR_PARAMETER;
+    }
+
+    socket->peeked = false;
+
+    // Only this core moves the local read position, so it still points at
+    // the peeked block.
+    Socket__Read_Release(socket, RB_READ_INDEX(socket->ringLocal), socket->peekedSize);
+
+    return ERROR_NONE;
+}
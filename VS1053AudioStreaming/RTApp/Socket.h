@@ -0,0 +1,130 @@
+/* Copyright (c) Codethink Ltd. All rights reserved.
+   Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef AZURE_SPHERE_SOCKET_H_
+#define AZURE_SPHERE_SOCKET_H_
+
+#include "lib/Common.h"
+#include "lib/Platform.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// This interface is for communicating over a "socket" with a partner core.
+// It supports connection with linux socket interface on the A7, which
+// negotiates the connection by calling Application_Connect(Component_Id).
+// Implementation depends on MBox.h.
+// It is derivative of logical-intercore.h in
+// https://github.com/Azure/azure-sphere-samples/tree/master/Samples/IntercoreComms
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Returned when there's a space issue.</summary>
+#define ERROR_SOCKET_INSUFFICIENT_SPACE (ERROR_SPECIFIC - 1)
+
+/// Returned when negotiation fails.</summary>
+#define ERROR_SOCKET_NEGOTIATION        (ERROR_SPECIFIC - 2)
+
+typedef struct Socket Socket;
+
+/// When sending a message, this is the recipient HLApp's component ID.
+/// When receiving a message, this is the sender HLApp's component ID.
+typedef struct {
+    /// 4-byte little-endian word
+    uint32_t seg_0;
+    /// 2-byte little-endian half
+    uint16_t seg_1;
+    /// 2-byte little-endian half
+    uint16_t seg_2;
+    /// 2-byte big-endian & 6-byte big-endian
+    uint8_t  seg_3_4[8];
+} Component_Id;
+
+Socket* Socket_Open(void (*rx_cb)(Socket*));
+int32_t Socket_Close(Socket *socket);
+
+bool    Socket_NegotiationPending(Socket *socket);
+int32_t Socket_Negotiate(Socket *socket);
+
+void Socket_Reset(Socket *socket);
+
+int32_t Socket_Write(
+    Socket             *socket,
+    const Component_Id *recipient,
+    const void         *data,
+    uint32_t            size);
+int32_t Socket_Read(
+    Socket       *socket,
+    Component_Id *sender,
+    void         *data,
+    uint32_t     *size);
+
+/// A message payload held in place in a shared ring buffer. The payload is
+/// data[0] followed by data[1], which is non-empty only when the payload
+/// wraps around the end of the buffer.
+typedef struct {
+    uint8_t  *data[2];
+    uint32_t  size[2];
+} Socket_Segments;
+
+/// Reserves space for a message of up to size bytes in the outbound ring buffer,
+/// so it can be built in place rather than copied in by Socket_Write. Nothing is
+/// visible to the HLApp, and Socket_Write fails with ERROR_BUSY, until
+/// Socket_Commit is called.
+int32_t Socket_Reserve(
+    Socket          *socket,
+    uint32_t         size,
+    Socket_Segments *segments);
+/// Sends the first size bytes of the reserved space, which may be fewer than
+/// were reserved. A size of zero abandons the reservation.
+int32_t Socket_Commit(
+    Socket             *socket,
+    const Component_Id *recipient,
+    uint32_t            size);
+
+/// Returns the next inbound message in place, without copying it out of the
+/// ring buffer. The segments stay valid, and Socket_Read fails with ERROR_BUSY,
+/// until Socket_Consume is called.
+int32_t Socket_Peek(
+    Socket          *socket,
+    Component_Id    *sender,
+    Socket_Segments *segments);
+/// Releases the message returned by Socket_Peek back to the HLApp.
+int32_t Socket_Consume(Socket *socket);
+
+/// Priorities of the outbound channels multiplexed over the shared ring buffer.
+/// Queued messages are written to the ring strictly by priority, so a message on
+/// the control channel never waits behind queued bulk data.
+typedef enum {
+    SOCKET_PRIORITY_CONTROL = 0,
+    SOCKET_PRIORITY_BULK    = 1,
+    SOCKET_PRIORITY_COUNT
+} Socket_Priority;
+
+/// Queues a message on the channel of the given priority and writes as many
+/// queued messages to the ring buffer as fit. Only fails if the channel's queue
+/// is full. Socket_Write bypasses the queues.
+int32_t Socket_Send(
+    Socket             *socket,
+    const Component_Id *recipient,
+    Socket_Priority     priority,
+    const void         *data,
+    uint32_t            size);
+/// Writes queued messages to the ring buffer until one doesn't fit. Call it from
+/// the callback set by Socket_SetTxCallback, deferred like rx_cb.
+int32_t Socket_Flush(Socket *socket);
+/// Returns the number of bytes, messages plus queue overhead, queued on a channel.
+uint32_t Socket_Queued(Socket *socket, Socket_Priority priority);
+/// Sets a callback invoked, in interrupt context, when the HLApp has read from
+/// the ring buffer so queued messages may now fit.
+void Socket_SetTxCallback(Socket *socket, void (*tx_cb)(Socket*));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // #ifndef AZURE_SPHERE_SOCKET_H_
@@ -0,0 +1,484 @@
+/*
+* Copyright (c) Microsoft Corporation.
+* Licensed under the MIT License.
+*/
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lib/mt3620/gpt.h"
+#include "lib/GPT.h"
+#include "lib/GPIO.h"
+#include "lib/SPIMaster.h"
+#include "lib/CPUFreq.h"
+#include "lib/VectorTable.h"
+#include "lib/NVIC.h"
+#include "lib/Print.h"
+
+#include "../audio_ipc.h"
+#include "Scheduler.h"
+#include "Socket.h"
+
+// VS1053 wiring on the Seeed RDB, the pins the high level app's hardware definition maps
+#define VS1053_DREQ_GPIO 6			// header 2 pin 6, EINT6
+#define VS1053_DCS_GPIO 43			// header 2 pin 12
+#define VS1053_RST_GPIO 44			// header 2 pin 14
+#define VS1053_CS_GPIO 59			// header 1 pin 3
+
+#define VS1053_SCI_WRITE 0x02
+#define VS1053_SCI_READ 0x03
+#define SCI_MODE 0x00
+#define SCI_STATUS 0x01
+#define SCI_CLOCKF 0x03
+#define SCI_VOL 0x0B
+
+#define SM_SDINEW 0x0800
+#define SCI_CLOCKF_3X 0x6000		// CLKI = 3 x XTALI
+#define SPI_INIT_SPEED 1000000		// SCI reads below XTALI / 7 until CLOCKF is set
+#define SPI_PLAY_SPEED 4000000		// SCI reads below CLKI / 7 after
+
+#define SDI_CHUNK 32				// the VS1053 takes at least this much while DREQ is high
+#define SPI_WRITE_MAX 16			// bytes per SPIMaster write transfer
+#define DREQ_TIMEOUT_MS 100
+#define FEED_BACKSTOP_MS 10			// in case the DREQ edge is missed
+
+static UART *debug = NULL;
+static Socket *socket = NULL;
+static SPIMaster *spi = NULL;
+static GPT *delayTimer = NULL;
+static GPT *backstopTimer = NULL;
+
+static const Component_Id A7ID =
+{
+	.seg_0 = 0xE3054BAF,
+	.seg_1 = 0x808F,
+	.seg_2 = 0x46E2,
+	.seg_3_4 = {0xA7, 0xDC, 0xA5, 0x20, 0xBB, 0x81, 0xAF, 0x1F}
+};
+
+// The HLApp fills the buffers in turn, and they play out in the same order
+typedef struct {
+	uint8_t data[AUDIO_IPC_MAX_DATA];
+	uint32_t length;
+	uint32_t position;				// next byte to send to the codec
+	volatile bool full;
+} AudioBuffer;
+
+static AudioBuffer buffers[AUDIO_IPC_BUFFERS];
+static unsigned fillIndex = 0;
+static unsigned playIndex = 0;
+
+static bool sciSelected = false;	// picks the chip select the SPI driver drives
+static volatile bool transferActive = false;
+static volatile int32_t transferStatus = ERROR_NONE;
+static uint32_t transferLength = 0;	// bytes of the buffer in the last transfer started
+static SPITransfer transfers[SDI_CHUNK / SPI_WRITE_MAX];
+
+static bool playing = false;		// audio has arrived since the last START
+static bool starved = false;		// the underrun has been counted
+static int pendingVolume = -1;
+static uint8_t pendingCredits = 0;
+static AudioIpcStatus status = { .type = AUDIO_IPC_STATUS };
+
+static const gpio_eint_attr_t dreqEint = {
+	.positive = true,
+	.dualEdge = false,
+	.freq = GPIO_EINT_DBNC_FREQ_8KHZ
+};
+
+static void feed(void *data);
+static Scheduler_Task feedTask = SCHEDULER_TASK(feed, SCHEDULER_PRIORITY_HIGH, 1000);
+static void sendStatus(void *data);
+static Scheduler_Task statusTask = SCHEDULER_TASK(sendStatus, SCHEDULER_PRIORITY_NORMAL, 0);
+
+// xCS for SCI register access, xDCS for SDI audio data, both active low
+static void selectLine(SPIMaster *handle, bool select)
+{
+	(void)handle;
+	GPIO_Write(sciSelected ? VS1053_CS_GPIO : VS1053_DCS_GPIO, !select);
+}
+
+static bool dreqHigh(void)
+{
+	bool high = false;
+	GPIO_Read(VS1053_DREQ_GPIO, &high);
+	return high;
+}
+
+static bool waitForDreq(void)
+{
+	for (int x = 0; x < DREQ_TIMEOUT_MS; x++) {
+		if (dreqHigh()) {
+			return true;
+		}
+		GPT_WaitTimer_Blocking(delayTimer, 1, GPT_UNITS_MILLISEC);
+	}
+	UART_Print(debug, "ERROR: timed out waiting for DREQ\r\n");
+	return false;
+}
+
+// Register access is synchronous, and only made while no audio transfer is running
+static int32_t sciWrite(uint8_t address, uint16_t value)
+{
+	uint8_t command[4] = { VS1053_SCI_WRITE, address, (uint8_t)(value >> 8), (uint8_t)value };
+
+	sciSelected = true;
+	int32_t error = SPIMaster_WriteSync(spi, command, sizeof(command));
+	sciSelected = false;
+
+	waitForDreq();
+	return error;
+}
+
+static int32_t sciRead(uint8_t address, uint16_t *value)
+{
+	uint8_t command[2] = { VS1053_SCI_READ, address };
+	uint8_t data[2] = { 0 };
+
+	sciSelected = true;
+	int32_t error = SPIMaster_WriteThenReadSync(spi, command, sizeof(command), data, sizeof(data));
+	sciSelected = false;
+
+	*value = (uint16_t)((data[0] << 8) | data[1]);
+	return error;
+}
+
+// As VS1053_SetVolume in the high level app: attenuation in 0.5dB steps, the same on both channels
+static void setVolume(uint8_t volume)
+{
+	int32_t error = sciWrite(SCI_VOL, (uint16_t)((volume << 8) | volume));
+	if (error != ERROR_NONE) {
+		UART_Printf(debug, "ERROR: setting the volume - %ld\r\n", error);
+	}
+}
+
+static bool codecInit(void)
+{
+	GPIO_ConfigurePinForOutput(VS1053_CS_GPIO);
+	GPIO_Write(VS1053_CS_GPIO, true);
+	GPIO_ConfigurePinForOutput(VS1053_DCS_GPIO);
+	GPIO_Write(VS1053_DCS_GPIO, true);
+	GPIO_ConfigurePinForOutput(VS1053_RST_GPIO);
+	GPIO_ConfigurePinForInput(VS1053_DREQ_GPIO);
+
+	delayTimer = GPT_Open(MT3620_UNIT_GPT1, MT3620_GPT_012_HIGH_SPEED, GPT_MODE_NONE);
+	if (!delayTimer) {
+		UART_Print(debug, "ERROR: GPT_Open failed\r\n");
+		return false;
+	}
+
+	spi = SPIMaster_Open(MT3620_UNIT_ISU1);
+	if (!spi) {
+		UART_Print(debug, "ERROR: SPIMaster_Open failed\r\n");
+		return false;
+	}
+	int32_t error;
+	if ((error = SPIMaster_Configure(spi, false, false, SPI_INIT_SPEED)) != ERROR_NONE) {
+		UART_Printf(debug, "ERROR: SPIMaster_Configure failed %ld\r\n", error);
+		return false;
+	}
+	SPIMaster_SetSelectLineCallback(spi, selectLine);
+
+	GPIO_Write(VS1053_RST_GPIO, false);
+	GPT_WaitTimer_Blocking(delayTimer, 10, GPT_UNITS_MILLISEC);
+	GPIO_Write(VS1053_RST_GPIO, true);
+	if (!waitForDreq()) {
+		return false;
+	}
+
+	uint16_t value = 0;
+	if ((error = sciRead(SCI_STATUS, &value)) != ERROR_NONE) {
+		UART_Printf(debug, "ERROR: reading SCI_STATUS - %ld\r\n", error);
+		return false;
+	}
+	UART_Printf(debug, "VS1053 version %u\r\n", (value >> 4) & 0x0F);
+
+	sciWrite(SCI_MODE, SM_SDINEW);
+	sciWrite(SCI_CLOCKF, SCI_CLOCKF_3X);
+	if ((error = SPIMaster_Configure(spi, false, false, SPI_PLAY_SPEED)) != ERROR_NONE) {
+		UART_Printf(debug, "ERROR: SPIMaster_Configure failed %ld\r\n", error);
+		return false;
+	}
+	return true;
+}
+
+// The EINT is only armed while feed waits for DREQ, and disarms itself, so a level
+// triggered interrupt can't hold off the scheduler while the codec wants data
+void gpio_g1_irq2(void)
+{
+	EINT_DeConfigurePin(VS1053_DREQ_GPIO);
+	Scheduler_Post(&feedTask);
+}
+
+static void transferDone(int32_t result, uintptr_t count)
+{
+	(void)count;
+	transferStatus = result;
+	transferActive = false;
+	Scheduler_Post(&feedTask);
+}
+
+static void feedBackstop(GPT *timer)
+{
+	(void)timer;
+	Scheduler_Post(&feedTask);
+}
+
+// Moves the stream from the buffers to the codec 32 bytes at a time, whenever DREQ is high
+static void feed(void *data)
+{
+	if (transferActive) {
+		return;
+	}
+
+	AudioBuffer *buffer = &buffers[playIndex];
+	if (transferLength > 0) {
+		// a failed chunk is sent again
+		if (transferStatus == ERROR_NONE) {
+			buffer->position += transferLength;
+			status.bytesPlayed += transferLength;
+		} else {
+			UART_Printf(debug, "ERROR: SPI transfer failed %ld\r\n", transferStatus);
+		}
+		transferLength = 0;
+
+		if (buffer->position >= buffer->length) {
+			buffer->full = false;
+			playIndex = (playIndex + 1) % AUDIO_IPC_BUFFERS;
+			buffer = &buffers[playIndex];
+			pendingCredits++;
+			Scheduler_Post(&statusTask);
+		}
+	}
+
+	if (pendingVolume >= 0) {
+		setVolume((uint8_t)pendingVolume);
+		pendingVolume = -1;
+	}
+
+	if (!dreqHigh()) {
+		EINT_ConfigurePin(VS1053_DREQ_GPIO, (gpio_eint_attr_t *)&dreqEint);
+		return;
+	}
+
+	if (!buffer->full) {
+		if (playing && !starved) {
+			status.underruns++;
+			starved = true;
+		}
+		return;
+	}
+	starved = false;
+
+	uint32_t length = buffer->length - buffer->position;
+	if (length > SDI_CHUNK) {
+		length = SDI_CHUNK;
+	}
+
+	uintptr_t count = 0;
+	for (uint32_t offset = 0; offset < length; offset += SPI_WRITE_MAX) {
+		transfers[count].writeData = &buffer->data[buffer->position + offset];
+		transfers[count].readData = NULL;
+		transfers[count].length = (length - offset) < SPI_WRITE_MAX ? (length - offset) : SPI_WRITE_MAX;
+		count++;
+	}
+
+	transferLength = length;
+	transferActive = true;
+	int32_t error = SPIMaster_TransferSequentialAsync(spi, transfers, count, transferDone);
+	if (error != ERROR_NONE) {
+		transferActive = false;
+		transferLength = 0;
+		UART_Printf(debug, "ERROR: SPIMaster_TransferSequentialAsync failed %ld\r\n", error);
+	}
+}
+
+static void sendStatus(void *data)
+{
+	status.credits = pendingCredits;
+
+	// on failure the credits stay pending, for the next status
+	int32_t error = Socket_Send(socket, &A7ID, SOCKET_PRIORITY_CONTROL, &status, sizeof(status));
+	if (error == ERROR_NONE) {
+		pendingCredits = 0;
+	} else {
+		UART_Printf(debug, "ERROR: sending status - %ld\r\n", error);
+	}
+}
+
+static void startPlayback(uint8_t volume)
+{
+	if (transferActive) {
+		SPIMaster_TransferCancel(spi);
+	}
+	transferActive = false;
+	transferLength = 0;
+
+	for (unsigned x = 0; x < AUDIO_IPC_BUFFERS; x++) {
+		buffers[x].full = false;
+	}
+	fillIndex = 0;
+	playIndex = 0;
+	playing = false;
+	starved = false;
+	pendingVolume = volume;
+
+	status.underruns = 0;
+	status.overruns = 0;
+	status.bytesPlayed = 0;
+	pendingCredits = AUDIO_IPC_BUFFERS;
+
+	Scheduler_Post(&statusTask);
+	Scheduler_Post(&feedTask);
+}
+
+// Copies size bytes from offset into the peeked message, which may wrap in the ring buffer
+static void copySegments(const Socket_Segments *segments, uint32_t offset, uint8_t *dest, uint32_t size)
+{
+	for (unsigned s = 0; s < 2 && size > 0; s++) {
+		if (offset >= segments->size[s]) {
+			offset -= segments->size[s];
+			continue;
+		}
+		uint32_t length = segments->size[s] - offset;
+		if (length > size) {
+			length = size;
+		}
+		memcpy(dest, segments->data[s] + offset, length);
+		dest += length;
+		size -= length;
+		offset = 0;
+	}
+}
+
+// Handlers for messages received from the HLApp
+static void handleRecvMsg(void *handle)
+{
+	Socket *socket = (Socket *)handle;
+
+	Component_Id senderId;
+	Socket_Segments segments;
+
+	if (Socket_NegotiationPending(socket)) {
+		UART_Printf(debug, "Negotiation pending, attempting renegotiation\n");
+
+		// NB: this is blocking, if you want to protect against hanging, add a timeout!
+		if (Socket_Negotiate(socket) != ERROR_NONE) {
+			UART_Printf(debug, "ERROR: renegotiating socket connection\n");
+		}
+	}
+
+	// Messages are read in place, only the audio is copied out, straight into its buffer
+	while (Socket_Peek(socket, &senderId, &segments) == ERROR_NONE) {
+		uint32_t size = segments.size[0] + segments.size[1];
+		uint8_t header[2] = { 0 };
+		copySegments(&segments, 0, header, size < sizeof(header) ? size : sizeof(header));
+
+		switch (header[0]) {
+		case AUDIO_IPC_START:
+			startPlayback(header[1]);
+			break;
+
+		case AUDIO_IPC_VOLUME:
+			pendingVolume = header[1];
+			Scheduler_Post(&feedTask);
+			break;
+
+		case AUDIO_IPC_DATA: {
+			uint32_t length = size > sizeof(AudioIpcData) ? size - sizeof(AudioIpcData) : 0;
+			AudioBuffer *buffer = &buffers[fillIndex];
+			if (buffer->full || length > AUDIO_IPC_MAX_DATA) {
+				status.overruns++;
+				break;
+			}
+			if (length == 0) {
+				break;
+			}
+			copySegments(&segments, sizeof(AudioIpcData), buffer->data, length);
+			buffer->length = length;
+			buffer->position = 0;
+			buffer->full = true;
+			fillIndex = (fillIndex + 1) % AUDIO_IPC_BUFFERS;
+			playing = true;
+			Scheduler_Post(&feedTask);
+			break;
+		}
+
+		default:
+			UART_Printf(debug, "ERROR: unknown message 0x%02x from HLApp\r\n", header[0]);
+			break;
+		}
+
+		Socket_Consume(socket);
+	}
+}
+static void handleRecvMsgWrapper(Socket *handle)
+{
+	static Scheduler_Task task = SCHEDULER_TASK(handleRecvMsg, SCHEDULER_PRIORITY_NORMAL, 0);
+
+	if (!task.data) {
+		task.data = handle;
+	}
+
+	Scheduler_Post(&task);
+}
+
+static void handleTxSpace(void *handle)
+{
+	Socket_Flush((Socket *)handle);
+}
+static void handleTxSpaceWrapper(Socket *handle)
+{
+	static Scheduler_Task task = SCHEDULER_TASK(handleTxSpace, SCHEDULER_PRIORITY_NORMAL, 0);
+
+	if (!task.data) {
+		task.data = handle;
+	}
+
+	Scheduler_Post(&task);
+}
+
+_Noreturn void RTCoreMain(void)
+{
+	VectorTableInit();
+
+	// Initialize the debug UART
+	debug = UART_Open(MT3620_UNIT_UART_DEBUG, 115200, UART_PARITY_NONE, 1, NULL);
+	UART_Print(debug, "VS1053 real-time feeder\r\n");
+	UART_Print(debug, "Built on: " __DATE__ " " __TIME__ "\r\n");
+
+	// GPT4 free runs at the CPU clock to measure task latency
+	GPT *latencyTimer = GPT_Open(MT3620_UNIT_GPT4, CPUFreq_Get(), GPT_MODE_NONE);
+	if (Scheduler_Init(latencyTimer) != ERROR_NONE) {
+		UART_Printf(debug, "ERROR: Scheduler_Init failed\r\n");
+		Scheduler_Init(NULL);
+	}
+
+	if (!codecInit()) {
+		UART_Print(debug, "ERROR: VS1053 initialization failed\r\n");
+	}
+
+	backstopTimer = GPT_Open(MT3620_UNIT_GPT0, MT3620_GPT_012_HIGH_SPEED, GPT_MODE_REPEAT);
+	if (!backstopTimer) {
+		UART_Printf(debug, "ERROR: GPT_Open failed\r\n");
+	} else {
+		int32_t error;
+		if ((error = GPT_StartTimeout(
+			backstopTimer, FEED_BACKSTOP_MS, GPT_UNITS_MILLISEC,
+			feedBackstop)) != ERROR_NONE) {
+			UART_Printf(debug, "ERROR: GPT_StartTimeout failed %ld\r\n", error);
+		}
+	}
+
+	// Setup the receive socket for the HLApp
+	socket = Socket_Open(handleRecvMsgWrapper);
+	if (!socket) {
+		UART_Printf(debug, "ERROR: Socket_Open failed\r\n");
+	} else {
+		Socket_SetTxCallback(socket, handleTxSpaceWrapper);
+	}
+
+	Scheduler_Run();
+}
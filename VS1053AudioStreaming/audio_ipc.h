@@ -0,0 +1,48 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+// Messages between the high level app and the real-time app, which owns the VS1053 when the
+// high level app is built with ENABLE_RT_CODEC. This header is used by both apps.
+//
+// The real-time app double buffers the audio: it grants a credit for each of its two buffers
+// that is free, and the high level app sends one AUDIO_IPC_DATA message per credit. A credit
+// comes back in an AUDIO_IPC_STATUS once the real-time app has played the buffer out.
+
+#define AUDIO_IPC_BUFFERS 2
+#define AUDIO_IPC_MAX_DATA 960      // audio bytes per AUDIO_IPC_DATA, within the 1KB message limit
+
+// HL to RT: (re)start playback, any buffered audio is dropped. The volume is the VS1053
+// attenuation in 0.5dB steps, as VS1053_SetVolume takes it.
+#define AUDIO_IPC_START 0x01
+typedef struct {
+    uint8_t type;                   // AUDIO_IPC_START
+    uint8_t volume;
+} AudioIpcStart;
+
+// HL to RT: up to AUDIO_IPC_MAX_DATA bytes of the stream follow the header.
+#define AUDIO_IPC_DATA 0x02
+typedef struct {
+    uint8_t type;                   // AUDIO_IPC_DATA
+    uint8_t reserved[3];
+} AudioIpcData;
+
+#define AUDIO_IPC_VOLUME 0x03
+typedef struct {
+    uint8_t type;                   // AUDIO_IPC_VOLUME
+    uint8_t volume;
+} AudioIpcVolume;
+
+// RT to HL: credits for buffers freed since the last status, and the running counters.
+#define AUDIO_IPC_STATUS 0x81
+typedef struct {
+    uint8_t type;                   // AUDIO_IPC_STATUS
+    uint8_t credits;
+    uint8_t reserved[2];
+    uint32_t underruns;             // DREQ asked for data with both buffers empty
+    uint32_t overruns;              // AUDIO_IPC_DATA without a credit, dropped
+    uint32_t bytesPlayed;
+} AudioIpcStatus;
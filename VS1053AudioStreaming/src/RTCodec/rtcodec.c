@@ -0,0 +1,150 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "rtcodec.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <applibs/application.h>
+#include <applibs/log.h>
+
+static const char rtAppComponentId[] = "5B6C1E7A-3D2F-4C8B-9E41-7A0C2D9F6B13";
+
+static int rtAppSockFd = -1;
+static unsigned credits = 0;
+static uint8_t volume = 0;		// the VS1053's reset value
+static AudioIpcStatus lastStatus;
+
+static uint8_t dataMessage[sizeof(AudioIpcData) + RTCODEC_DATA_CHUNK];
+
+// Reads one message from the real-time app, returns 1 if it was a status, 0 if there was none
+// to read without waiting, -1 on error (a timeout included, when waiting).
+static int ReceiveStatus(bool wait)
+{
+	AudioIpcStatus status;
+	ssize_t length = recv(rtAppSockFd, &status, sizeof(status), wait ? 0 : MSG_DONTWAIT);
+	if (length < 0)
+	{
+		if (!wait && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			return 0;
+		}
+		Log_Debug("ERROR: receiving from the real-time app: %d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+
+	if ((size_t)length < sizeof(status) || status.type != AUDIO_IPC_STATUS)
+	{
+		Log_Debug("Unexpected message from the real-time app\n");
+		return 0;
+	}
+
+	credits += status.credits;
+	if (status.underruns != lastStatus.underruns)
+	{
+		Log_Debug("Real-time app underrun (%lu)\n", (unsigned long)status.underruns);
+	}
+	lastStatus = status;
+	return 1;
+}
+
+static int Send(const void* message, size_t length)
+{
+	if (send(rtAppSockFd, message, length, 0) < 0)
+	{
+		Log_Debug("ERROR: sending to the real-time app: %d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int RTCodec_Init(void)
+{
+	rtAppSockFd = Application_Connect(rtAppComponentId);
+	if (rtAppSockFd == -1)
+	{
+		Log_Debug("ERROR: Unable to create socket: %d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+
+	// a credit is due well within this when the real-time app is playing
+	static const struct timeval recvTimeout = { .tv_sec = 5, .tv_usec = 0 };
+	if (setsockopt(rtAppSockFd, SOL_SOCKET, SO_RCVTIMEO, &recvTimeout, sizeof(recvTimeout)) == -1)
+	{
+		Log_Debug("ERROR: Unable to set socket timeout: %d (%s)\n", errno, strerror(errno));
+		RTCodec_Cleanup();
+		return -1;
+	}
+
+	// the status answering START carries a credit per buffer
+	credits = 0;
+	memset(&lastStatus, 0, sizeof(lastStatus));
+	AudioIpcStart start = { .type = AUDIO_IPC_START, .volume = volume };
+	if (Send(&start, sizeof(start)) != 0)
+	{
+		RTCodec_Cleanup();
+		return -1;
+	}
+
+	return 0;
+}
+
+void RTCodec_SetVolume(uint16_t newVolume)
+{
+	volume = (uint8_t)newVolume;
+	AudioIpcVolume message = { .type = AUDIO_IPC_VOLUME, .volume = volume };
+	Send(&message, sizeof(message));
+}
+
+int RTCodec_PlayBuffer(const uint8_t* data, size_t len)
+{
+	AudioIpcData* header = (AudioIpcData*)dataMessage;
+	header->type = AUDIO_IPC_DATA;
+
+	while (len > 0)
+	{
+		while (credits == 0)
+		{
+			if (ReceiveStatus(true) < 0)
+			{
+				return -1;
+			}
+		}
+
+		size_t length = len < RTCODEC_DATA_CHUNK ? len : RTCODEC_DATA_CHUNK;
+		memcpy(dataMessage + sizeof(AudioIpcData), data, length);
+		if (Send(dataMessage, sizeof(AudioIpcData) + length) != 0)
+		{
+			return -1;
+		}
+		credits--;
+		data += length;
+		len -= length;
+	}
+	return 0;
+}
+
+bool RTCodec_IsReadyForData(void)
+{
+	while (ReceiveStatus(false) > 0)
+	{
+	}
+	return credits > 0;
+}
+
+void RTCodec_LogStats(void)
+{
+	Log_Debug("Real-time app: %lu underruns, %lu overruns, %lu bytes played\n", (unsigned long)lastStatus.underruns,
+		(unsigned long)lastStatus.overruns, (unsigned long)lastStatus.bytesPlayed);
+}
+
+void RTCodec_Cleanup(void)
+{
+	if (rtAppSockFd >= 0)
+	{
+		close(rtAppSockFd);
+		rtAppSockFd = -1;
+	}
+}
@@ -0,0 +1,25 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "audio_ipc.h"
+
+// The VS1053 driven by the real-time app (see RTApp), with the same calls as vs1053.h. Audio goes
+// over the intercore socket in messages of up to RTCODEC_DATA_CHUNK bytes, one per credit.
+#define RTCODEC_DATA_CHUNK AUDIO_IPC_MAX_DATA
+
+// Connects to the real-time app and (re)starts its playback, returns -1 if it can't be reached.
+int RTCodec_Init(void);
+void RTCodec_SetVolume(uint16_t volume);
+// Sends len bytes of audio, waiting for credits as needed, returns -1 if the real-time app stops taking data.
+int RTCodec_PlayBuffer(const uint8_t* data, size_t len);
+// true while the real-time app has a free buffer, for up to RTCODEC_DATA_CHUNK bytes.
+bool RTCodec_IsReadyForData(void);
+// Logs the real-time app's underrun, overrun and played byte counts from its last status.
+void RTCodec_LogStats(void);
+void RTCodec_Cleanup(void);
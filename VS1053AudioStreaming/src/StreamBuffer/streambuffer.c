@@ -0,0 +1,68 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "streambuffer.h"
+#include <string.h>
+
+bool StreamBuffer_Init(StreamBuffer* buffer, uint8_t* storage, size_t size)
+{
+	if (size == 0 || (size & (size - 1)) != 0)
+	{
+		return false;
+	}
+
+	buffer->data = storage;
+	buffer->size = size;
+	buffer->head = 0;
+	buffer->tail = 0;
+	return true;
+}
+
+size_t StreamBuffer_Used(const StreamBuffer* buffer)
+{
+	return __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE);
+}
+
+size_t StreamBuffer_Free(const StreamBuffer* buffer)
+{
+	return buffer->size - StreamBuffer_Used(buffer);
+}
+
+size_t StreamBuffer_Write(StreamBuffer* buffer, const uint8_t* data, size_t len)
+{
+	size_t head = buffer->head;
+	size_t tail = __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE);
+	size_t space = buffer->size - (head - tail);
+	if (len > space)
+	{
+		len = space;
+	}
+
+	size_t offset = head & (buffer->size - 1);
+	size_t first = buffer->size - offset < len ? buffer->size - offset : len;
+	memcpy(buffer->data + offset, data, first);
+	memcpy(buffer->data, data + first, len - first);
+
+	// publish the bytes only once they're copied in
+	__atomic_store_n(&buffer->head, head + len, __ATOMIC_RELEASE);
+	return len;
+}
+
+size_t StreamBuffer_Read(StreamBuffer* buffer, uint8_t* dest, size_t len)
+{
+	size_t tail = buffer->tail;
+	size_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+	if (len > head - tail)
+	{
+		len = head - tail;
+	}
+
+	size_t offset = tail & (buffer->size - 1);
+	size_t first = buffer->size - offset < len ? buffer->size - offset : len;
+	memcpy(dest, buffer->data + offset, first);
+	memcpy(dest + first, buffer->data, len - first);
+
+	// hand the space back only once the bytes are copied out
+	__atomic_store_n(&buffer->tail, tail + len, __ATOMIC_RELEASE);
+	return len;
+}
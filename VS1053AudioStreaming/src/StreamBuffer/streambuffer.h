@@ -0,0 +1,27 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte ring buffer between one producer thread and one consumer thread, without locks: the
+// producer only moves head, the consumer only moves tail. size must be a power of two.
+typedef struct {
+	uint8_t* data;
+	size_t size;
+	size_t head;	// total bytes written
+	size_t tail;	// total bytes read
+} StreamBuffer;
+
+bool StreamBuffer_Init(StreamBuffer* buffer, uint8_t* storage, size_t size);
+size_t StreamBuffer_Used(const StreamBuffer* buffer);
+size_t StreamBuffer_Free(const StreamBuffer* buffer);
+
+// Producer: copies as much of data as fits, returns the bytes taken.
+size_t StreamBuffer_Write(StreamBuffer* buffer, const uint8_t* data, size_t len);
+
+// Consumer: copies up to len bytes into dest, returns the bytes copied.
+size_t StreamBuffer_Read(StreamBuffer* buffer, uint8_t* dest, size_t len);
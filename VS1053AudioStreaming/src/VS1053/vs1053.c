@@ -231,6 +231,42 @@ void VS1053_PlayByte(uint8_t data)
 	dataModeOff();
 }
 
+int VS1053_PlayBuffer(const uint8_t* data, size_t len)
+{
+	int ret = 0;
+	dataModeOn();
+
+	while (len > 0)
+	{
+		size_t chunk = len < VS1053_DATA_CHUNK ? len : VS1053_DATA_CHUNK;
+		if (WaitOnDREQHigh() == -1)
+		{
+			Log_Debug("ERROR: VS1053 not requesting data\n");
+			ret = -1;
+			break;
+		}
+
+		if (write(vs1053_fd, data, chunk) != (ssize_t)chunk)
+		{
+			Log_Debug("ERROR: VS1053 data write failed: %s (%d)\n", strerror(errno), errno);
+			ret = -1;
+			break;
+		}
+		data += chunk;
+		len -= chunk;
+	}
+
+	dataModeOff();
+	return ret;
+}
+
+bool VS1053_IsReadyForData(void)
+{
+	GPIO_Value_Type dReq = GPIO_Value_Low;
+	GPIO_GetValue(vs1053_DREQ, &dReq);
+	return dReq == GPIO_Value_High;
+}
+
 void VS1053_SetVolume(uint16_t volume)
 {
 	uint16_t vol = (uint16_t)((volume * 0x100) + volume);
@@ -7,8 +7,15 @@
 #include <stdint.h>
 #include <unistd.h>
 
+// bytes the VS1053 can always take when DREQ is high
+#define VS1053_DATA_CHUNK 32
+
 int VS1053_Init(void);
 void VS1053_SetVolume(uint16_t volume);
 void VS1053_PlayByte(uint8_t data);
+// Sends len bytes of audio in one SPI transfer per VS1053_DATA_CHUNK, returns -1 if the codec stops taking data.
+int VS1053_PlayBuffer(const uint8_t* data, size_t len);
+// true while DREQ is high, the VS1053 can take VS1053_DATA_CHUNK bytes without waiting.
+bool VS1053_IsReadyForData(void);
 void VS1053_Cleanup(void);
 
@@ -7,6 +7,8 @@
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <strings.h>
+#include <pthread.h>
 
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -18,7 +20,27 @@
 #include <applibs/log.h>
 #include <applibs/storage.h>
 
+#include "streambuffer.h"
+
+// With ENABLE_RT_CODEC the real-time app in RTApp owns the VS1053 and its pins, and this app only
+// does the networking, sending it the audio over the intercore socket.
+#ifdef ENABLE_RT_CODEC
+#include "rtcodec.h"
+#define CODEC_DATA_CHUNK RTCODEC_DATA_CHUNK
+#define Codec_Init RTCodec_Init
+#define Codec_SetVolume RTCodec_SetVolume
+#define Codec_PlayBuffer RTCodec_PlayBuffer
+#define Codec_IsReadyForData RTCodec_IsReadyForData
+#define Codec_Cleanup RTCodec_Cleanup
+#else
 #include "vs1053.h"
+#define CODEC_DATA_CHUNK VS1053_DATA_CHUNK
+#define Codec_Init VS1053_Init
+#define Codec_SetVolume VS1053_SetVolume
+#define Codec_PlayBuffer VS1053_PlayBuffer
+#define Codec_IsReadyForData VS1053_IsReadyForData
+#define Codec_Cleanup VS1053_Cleanup
+#endif
 
 // KOUW/NPR Seattle 32kbps audio stream
 static char httpRequest[1024];
@@ -28,39 +50,34 @@ static uint8_t audioBuffer[4096];
 static const char* streamHost = "17853.live.streamtheworld.com";
 static const char* streamPath = "KUOWFM_LOW_MP3.mp3";
 static const char *request_template = "GET /%s HTTP/1.1\r\nHost: %s\r\nContent-Type: audio/mpeg\r\n\r\n";
-static const char* httpOK = "HTTP/1.0 200 OK";
-static const char* httpServiceNotAvailable = "HTTP/1.0 503";
 
-int ReadEmbeddedAudio(char* audioFile, uint8_t **audioData, ssize_t *audioLength)
-{
-    *audioData = NULL;
-    *audioLength = 0;
+// The stream is read by a receive thread into the jitter buffer, and fed from there to the VS1053
+// as it asks for data. Playback starts (and restarts after an underrun) once JITTER_BUFFER_PREFILL
+// bytes are buffered, so a network stall shorter than that isn't heard; JITTER_BUFFER_SIZE must
+// be a power of two. At 32kbps 16KB is four seconds of audio.
+#define JITTER_BUFFER_SIZE (16 * 1024)
+#define JITTER_BUFFER_PREFILL (JITTER_BUFFER_SIZE / 2)
+#define STREAM_STATS_PERIOD_SECONDS 10
 
-    int audioFd = Storage_OpenFileInImagePackage(audioFile);
-    if (audioFd >= 0)
-    {
-        off_t length = lseek(audioFd, 0, SEEK_END);	// get the length of the file
+static uint8_t jitterStorage[JITTER_BUFFER_SIZE];
+static StreamBuffer jitterBuffer;
 
-        *audioData = (uint8_t*)calloc((size_t)length, 1);	// allocate space for the audio
-        if (*audioData == NULL)
-        {
-            Log_Debug("Failed to allocate memory for Embedded Resource\n");
-            close(audioFd);
-            return -1;
-        }
+// underruns: the buffer ran dry while playing; overruns: a read had to wait for space in the buffer.
+typedef struct {
+    unsigned long underruns;    // written by the feeder
+    unsigned long overruns;     // written by the receive thread
+} StreamStats;
+static StreamStats streamStats;
 
-        lseek(audioFd, 0, SEEK_SET);
-        read(audioFd, *audioData, (size_t)length);
-        *audioLength = (ssize_t)length;
-        close(audioFd);
-    }
-    else
-    {
-        Log_Debug("Cannot open %s\n", audioFile);
-        return -1;
-    }
+static bool receiveDone = false;    // the receive thread has stopped, set by it
+static bool stopReceiving = false;  // the feeder has given up, set by it
 
-    return 0;
+static char httpHeader[1024];
+
+static void SleepMs(int ms)
+{
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
 }
 
 int InitSocket(void)
@@ -85,38 +102,269 @@ int InitSocket(void)
     return _sockFd;
 }
 
-int PlayEmbeddedResource(void)
+// Checks the status line and headers of an HTTP response (header is NUL terminated, without the
+// blank line), returns true if the body is a stream we can play.
+static bool CheckHttpResponse(char* header)
 {
-    uint8_t* pAudio = NULL;
-    ssize_t audioLength = 0;
+    char protocol[16] = { 0 };
+    int status = 0;
+    if (sscanf(header, "%15s %d", protocol, &status) != 2)
+    {
+        Log_Debug("Malformed HTTP response\n");
+        return false;
+    }
 
-    int ret = ReadEmbeddedAudio("speech.mp3", &pAudio, &audioLength);
-    if (ret != 0)
+    if (status != 200)
     {
-        Log_Debug("Failed to get audio data\n");
-        return -1;
+        if (status == 503)
+        {
+            Log_Debug("Service not available\n");
+        }
+        else
+        {
+            Log_Debug("HTTP error %d\n", status);
+        }
+        return false;
     }
 
-    if (VS1053_Init() == 0)
+    char* savePtr = NULL;
+    strtok_r(header, "\r\n", &savePtr);     // status line
+    for (char* line = strtok_r(NULL, "\r\n", &savePtr); line != NULL; line = strtok_r(NULL, "\r\n", &savePtr))
     {
-        VS1053_SetVolume(20);
+        static const char contentType[] = "Content-Type:";
+        static const char transferEncoding[] = "Transfer-Encoding:";
 
-        for (ssize_t x = 0; x < audioLength; x++)
+        if (strncasecmp(line, contentType, sizeof(contentType) - 1) == 0)
         {
-            VS1053_PlayByte(pAudio[x]);
+            Log_Debug("Stream %s\n", line);
         }
+        // the codec would be fed the chunk sizes along with the audio
+        else if (strncasecmp(line, transferEncoding, sizeof(transferEncoding) - 1) == 0 && strstr(line, "chunked") != NULL)
+        {
+            Log_Debug("Chunked transfer encoding isn't supported\n");
+            return false;
+        }
+    }
+
+    return true;
+}
 
-        free(pAudio);
-        VS1053_SetVolume(0);
-        Log_Debug("Cleanup\n");
-        VS1053_Cleanup();
+// Writes length bytes into the jitter buffer, waiting for the feeder to make space as needed, unless
+// it gives up. Returns true if it had to wait.
+static bool WriteJitterBuffer(const uint8_t* data, size_t length)
+{
+    bool waited = false;
+    while (length > 0 && !__atomic_load_n(&stopReceiving, __ATOMIC_ACQUIRE))
+    {
+        size_t written = StreamBuffer_Write(&jitterBuffer, data, length);
+        data += written;
+        length -= written;
+        if (length > 0)
+        {
+            waited = true;
+            SleepMs(10);
+        }
     }
-    else
+    return waited;
+}
+
+static void* ReceiveThread(void* arg)
+{
+    int sockFd = (int)(intptr_t)arg;
+    size_t headerLength = 0;
+    bool haveHeader = false;
+
+    while (!__atomic_load_n(&stopReceiving, __ATOMIC_ACQUIRE))
+    {
+        ssize_t length = read(sockFd, audioBuffer, sizeof(audioBuffer));
+        if (length <= 0)
+        {
+            Log_Debug("!read\n");
+            break;
+        }
+
+        const uint8_t* body = audioBuffer;
+        size_t bodyLength = (size_t)length;
+
+        // the header can arrive over several reads, and share the last with the start of the audio
+        if (!haveHeader)
+        {
+            size_t copy = sizeof(httpHeader) - 1 - headerLength;
+            if (copy > (size_t)length)
+            {
+                copy = (size_t)length;
+            }
+            memcpy(httpHeader + headerLength, audioBuffer, copy);
+            headerLength += copy;
+            httpHeader[headerLength] = '\0';
+
+            char* end = strstr(httpHeader, "\r\n\r\n");
+            if (end == NULL)
+            {
+                if (headerLength == sizeof(httpHeader) - 1)
+                {
+                    Log_Debug("HTTP header too long\n");
+                    break;
+                }
+                continue;
+            }
+
+            size_t bodyStart = (size_t)(end - httpHeader) + 4 - (headerLength - copy);
+            body += bodyStart;
+            bodyLength -= bodyStart;
+
+            *end = '\0';
+            if (!CheckHttpResponse(httpHeader))
+            {
+                break;
+            }
+            haveHeader = true;
+        }
+
+        if (WriteJitterBuffer(body, bodyLength))
+        {
+            __atomic_fetch_add(&streamStats.overruns, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    __atomic_store_n(&receiveDone, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void LogStreamStats(void)
+{
+    Log_Debug("Jitter buffer: %zu bytes, %lu underruns, %lu overruns\n", StreamBuffer_Used(&jitterBuffer),
+        __atomic_load_n(&streamStats.underruns, __ATOMIC_RELAXED), __atomic_load_n(&streamStats.overruns, __ATOMIC_RELAXED));
+#ifdef ENABLE_RT_CODEC
+    RTCodec_LogStats();
+#endif
+}
+
+// Drains the jitter buffer into the VS1053 until the stream ends, or the codec stops taking data.
+static void FeedCodec(void)
+{
+    uint8_t chunk[CODEC_DATA_CHUNK];
+    bool playing = false;
+    time_t lastStats = time(NULL);
+
+    while (true)
+    {
+        bool done = __atomic_load_n(&receiveDone, __ATOMIC_ACQUIRE);
+        size_t used = StreamBuffer_Used(&jitterBuffer);
+
+        if (time(NULL) - lastStats >= STREAM_STATS_PERIOD_SECONDS)
+        {
+            lastStats = time(NULL);
+            LogStreamStats();
+        }
+
+        if (!playing)
+        {
+            if (used >= JITTER_BUFFER_PREFILL || (done && used > 0))
+            {
+                playing = true;
+            }
+            else if (done)
+            {
+                break;
+            }
+            else
+            {
+                SleepMs(10);
+                continue;
+            }
+        }
+
+        if (used == 0)
+        {
+            if (done)
+            {
+                break;
+            }
+            __atomic_fetch_add(&streamStats.underruns, 1, __ATOMIC_RELAXED);
+            playing = false;
+            continue;
+        }
+
+        // the codec's FIFO (or the real-time app's other buffer) holds well over a millisecond of
+        // audio, so polling this often keeps it full
+        if (!Codec_IsReadyForData())
+        {
+            SleepMs(1);
+            continue;
+        }
+
+        size_t length = StreamBuffer_Read(&jitterBuffer, chunk, sizeof(chunk));
+        if (Codec_PlayBuffer(chunk, length) != 0)
+        {
+            break;
+        }
+    }
+
+    LogStreamStats();
+}
+
+// Reads the resource into the jitter buffer a block at a time, so a clip of any length plays in
+// the jitter buffer's memory. The file is always read faster than it plays, waiting isn't an overrun.
+static void* ResourceReadThread(void* arg)
+{
+    int audioFd = (int)(intptr_t)arg;
+
+    while (!__atomic_load_n(&stopReceiving, __ATOMIC_ACQUIRE))
     {
-        Log_Debug("Failed to initialize VS1053 hardware\n");
+        ssize_t length = read(audioFd, audioBuffer, sizeof(audioBuffer));
+        if (length <= 0)
+        {
+            if (length < 0)
+            {
+                Log_Debug("ERROR: reading the resource: %s (%d)\n", strerror(errno), errno);
+            }
+            break;
+        }
+        WriteJitterBuffer(audioBuffer, (size_t)length);
+    }
+
+    __atomic_store_n(&receiveDone, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int PlayEmbeddedResource(void)
+{
+    int audioFd = Storage_OpenFileInImagePackage("speech.mp3");
+    if (audioFd < 0)
+    {
+        Log_Debug("Cannot open speech.mp3\n");
+        return -1;
+    }
+
+    if (Codec_Init() != 0)
+    {
+        Log_Debug("Failed to initialize the codec\n");
+        close(audioFd);
         return -1;
     }
 
+    Codec_SetVolume(20);
+    StreamBuffer_Init(&jitterBuffer, jitterStorage, sizeof(jitterStorage));
+
+    pthread_t readThread;
+    if (pthread_create(&readThread, NULL, ResourceReadThread, (void*)(intptr_t)audioFd) == 0)
+    {
+        FeedCodec();
+
+        __atomic_store_n(&stopReceiving, true, __ATOMIC_RELEASE);
+        pthread_join(readThread, NULL);
+    }
+    else
+    {
+        Log_Debug("Failed to start the resource read thread\n");
+    }
+
+    close(audioFd);
+    Codec_SetVolume(0);
+    Log_Debug("Cleanup\n");
+    Codec_Cleanup();
+
     return 0;
 }
 
@@ -130,11 +378,10 @@ int PlayInternetRadio(void)
         return -1;
     }
 
-    if (VS1053_Init() == 0)
+    if (Codec_Init() == 0)
     {
-        VS1053_SetVolume(20);
-
-        ssize_t length = 0;
+        Codec_SetVolume(20);
+        StreamBuffer_Init(&jitterBuffer, jitterStorage, sizeof(jitterStorage));
 
         // setup the HTTP request
         snprintf(httpRequest, 1024, request_template, streamPath, streamHost);
@@ -142,47 +389,32 @@ int PlayInternetRadio(void)
         // write the HTTP Request.
         write(SockFd, httpRequest, strlen(httpRequest));
 
-        while (true)
+        pthread_t receiveThread;
+        if (pthread_create(&receiveThread, NULL, ReceiveThread, (void*)(intptr_t)SockFd) == 0)
         {
-            // read audio data
-            length = read(SockFd, audioBuffer, 4096);
-            if (length <= 0)
-            {
-                Log_Debug("!read\n");
-                break;
-            }
-            else
-            {
-                if (strncmp(audioBuffer, httpServiceNotAvailable, strlen(httpServiceNotAvailable)) == 0)
-                {
-                    Log_Debug("Service not available\n");
-                    break;
-                }
-                if (strncmp(audioBuffer, httpOK, strlen(httpOK)) == 0)
-                {
-                    Log_Debug("Skip HTTP OK Response\n");
-                }
-                else
-                {
-                    for (int x = 0; x < length; x++)
-                    {
-                        VS1053_PlayByte(audioBuffer[x]);
-                    }
-                }
-            }
+            FeedCodec();
+
+            // unblock the receive thread's read if the codec stopped first
+            __atomic_store_n(&stopReceiving, true, __ATOMIC_RELEASE);
+            shutdown(SockFd, SHUT_RDWR);
+            pthread_join(receiveThread, NULL);
+        }
+        else
+        {
+            Log_Debug("Failed to start the receive thread\n");
         }
 
-        VS1053_SetVolume(0);
+        Codec_SetVolume(0);
         close(SockFd);
     }
     else
     {
-        Log_Debug("Error initializing VS1053\n");
+        Log_Debug("Error initializing the codec\n");
         return -1;
     }
 
     Log_Debug("Cleanup\n");
-    VS1053_Cleanup();
+    Codec_Cleanup();
 
     return 0;
 }
@@ -35,27 +35,29 @@ namespace WebHookPublicAPIServicePrincipal.Controllers
             if (string.IsNullOrEmpty(DeviceId))
                 return "Bad Request";
 
-            // Get Service Principal Token.
+            // Get Service Principal Token (cached until close to its expiry).
             string token = await Utils.GetAS3Token();
 
-            // Get some basic information for the device in the Azure Sphere tenant.
-            string deviceData = Utils.GetData($"tenants/{AzureSphereTenantId}/devices/{DeviceId}", token);
-            Debug.WriteLine(deviceData);
+            // Get some basic information for the device in the Azure Sphere tenant, batched with concurrent webhook calls.
+            DeviceInfo devInfo = await Utils.GetDeviceInfoAsync(AzureSphereTenantId, DeviceId, token);
 
-            if (string.IsNullOrEmpty(deviceData))
+            if (devInfo == null)
             {
                 return "Bad Request";
             }
+            Debug.WriteLine(JsonConvert.SerializeObject(devInfo));
 
-            DeviceInfo devInfo = JsonConvert.DeserializeObject<DeviceInfo>(deviceData);
-
+            // Device groups and products are shared by many devices and rarely change, so they come from the response cache.
             // https://prod.core.sphere.azure.net/v2/tenants/{tenantId}/devicegroups/{deviceGroupId}
-            string deviceGroup = Utils.GetData($"tenants/{AzureSphereTenantId}/devicegroups/{devInfo.DeviceGroupId}", token);
+            Task<string> deviceGroupTask = Utils.GetCachedDataAsync($"tenants/{AzureSphereTenantId}/devicegroups/{devInfo.DeviceGroupId}", token, Utils.MetadataTimeToLive);
+            // https://prod.core.sphere.azure.net/v2/tenants/{tenantId}/products/{productId}
+            Task<string> productTask = Utils.GetCachedDataAsync($"tenants/{AzureSphereTenantId}/products/{devInfo.ProductId}", token, Utils.MetadataTimeToLive);
+
+            string deviceGroup = await deviceGroupTask;
             Debug.WriteLine(deviceGroup);
             DeviceGroupInfo dgInfo = JsonConvert.DeserializeObject<DeviceGroupInfo>(deviceGroup);
 
-            // https://prod.core.sphere.azure.net/v2/tenants/{tenantId}/products/{productId}
-            string product = Utils.GetData($"tenants/{AzureSphereTenantId}/products/{devInfo.ProductId}", token);
+            string product = await productTask;
             Debug.WriteLine(product);
             ProductInfo prodInfo = JsonConvert.DeserializeObject<ProductInfo>(product);
 
@@ -1,9 +1,15 @@
 ﻿/* Copyright (c) Microsoft Corporation. All rights reserved.
    Licensed under the MIT License. */
 
+using Azure.Core;
 using Azure.Identity;
+using Newtonsoft.Json;
 using RestSharp;
 using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Linq;
+using System.Threading;
 using System.Threading.Tasks;
 
 namespace WebHookPublicAPIServicePrincipal
@@ -14,7 +20,39 @@ namespace WebHookPublicAPIServicePrincipal
         /// Azure Sphere Public API URI
         /// </summary>
         private const string AzureSphereApiUri = "https://prod.core.sphere.azure.net";
-        public static string GetData(string EndpointUrl, string token)
+
+        /// <summary>
+        /// How long before its expiry a cached token is renewed
+        /// </summary>
+        private static readonly TimeSpan TokenRefreshMargin = TimeSpan.FromMinutes(5);
+
+        /// <summary>
+        /// How long tenant metadata (device groups, products) is reused, as it rarely changes and many devices share it
+        /// </summary>
+        public static readonly TimeSpan MetadataTimeToLive = TimeSpan.FromMinutes(10);
+
+        /// <summary>
+        /// How long a device query waits for others to batch with, when webhook calls arrive in bursts (e.g. during an OTA wave)
+        /// </summary>
+        private static readonly TimeSpan DeviceBatchWindow = TimeSpan.FromMilliseconds(250);
+
+        /// <summary>
+        /// From this many devices in a batch, list the tenant's devices rather than query each one
+        /// </summary>
+        private const int DeviceListThreshold = 10;
+
+        private static readonly RestClient ApiClient = new RestClient(AzureSphereApiUri);
+        private static readonly DefaultAzureCredential Credential = new DefaultAzureCredential();
+        private static readonly SemaphoreSlim TokenLock = new SemaphoreSlim(1, 1);
+        private static AccessToken CachedToken;
+
+        private static readonly ConcurrentDictionary<string, CachedResponse> ResponseCache = new ConcurrentDictionary<string, CachedResponse>();
+
+        private static readonly object BatchLock = new object();
+        private static readonly Dictionary<string, Dictionary<string, TaskCompletionSource<DeviceInfo>>> PendingDeviceQueries =
+            new Dictionary<string, Dictionary<string, TaskCompletionSource<DeviceInfo>>>();
+
+        public static async Task<string> GetDataAsync(string EndpointUrl, string token, string continuationToken = null)
         {
             var request = (RestRequest)null;
             var client = (RestClient)null;
@@ -22,9 +60,13 @@ namespace WebHookPublicAPIServicePrincipal
             // calling an Azure Sphere API
             if (!string.IsNullOrEmpty(token))
             {
-                client = new RestClient(AzureSphereApiUri);
+                client = ApiClient;
                 request = new RestRequest($"/v2/{EndpointUrl}", Method.GET);
                 request.AddParameter("Authorization", string.Format("Bearer " + token), ParameterType.HttpHeader);
+                if (!string.IsNullOrEmpty(continuationToken))
+                {
+                    request.AddParameter("Sphere-Continuation", continuationToken, ParameterType.HttpHeader);
+                }
             }
             else
             {
@@ -35,7 +77,7 @@ namespace WebHookPublicAPIServicePrincipal
                 request = new RestRequest(relativePath, Method.GET);
             }
 
-            var response = client.Execute(request);
+            var response = await client.ExecuteAsync(request).ConfigureAwait(false);
 
             if (response.IsSuccessful)
             {
@@ -44,16 +86,161 @@ namespace WebHookPublicAPIServicePrincipal
             return string.Empty;
         }
 
+        /// <summary>
+        /// Get data through the response cache: concurrent calls for the same endpoint share a single request,
+        /// and its successful response is reused for <paramref name="timeToLive"/>.
+        /// </summary>
+        public static async Task<string> GetCachedDataAsync(string EndpointUrl, string token, TimeSpan timeToLive)
+        {
+            DateTimeOffset now = DateTimeOffset.UtcNow;
+            CachedResponse entry = ResponseCache.AddOrUpdate(EndpointUrl,
+                url => new CachedResponse(url, token, now + timeToLive),
+                (url, cached) => cached.Expires > now ? cached : new CachedResponse(url, token, now + timeToLive));
+
+            string content = await entry.Content.Value.ConfigureAwait(false);
+            if (string.IsNullOrEmpty(content))
+            {
+                // Don't keep failures, but only drop this entry, not one a concurrent call may have replaced it with
+                ((ICollection<KeyValuePair<string, CachedResponse>>)ResponseCache).Remove(new KeyValuePair<string, CachedResponse>(EndpointUrl, entry));
+            }
+            return content;
+        }
+
+        /// <summary>
+        /// Get a device's information, batched with the other queries for the same tenant that arrive within
+        /// <see cref="DeviceBatchWindow"/>. Returns null if the device could not be found.
+        /// </summary>
+        public static Task<DeviceInfo> GetDeviceInfoAsync(string tenantId, string deviceId, string token)
+        {
+            TaskCompletionSource<DeviceInfo> query;
+            bool newBatch = false;
+
+            lock (BatchLock)
+            {
+                if (!PendingDeviceQueries.TryGetValue(tenantId, out var batch))
+                {
+                    batch = new Dictionary<string, TaskCompletionSource<DeviceInfo>>(StringComparer.OrdinalIgnoreCase);
+                    PendingDeviceQueries[tenantId] = batch;
+                    newBatch = true;
+                }
+                if (!batch.TryGetValue(deviceId, out query))
+                {
+                    query = new TaskCompletionSource<DeviceInfo>(TaskCreationOptions.RunContinuationsAsynchronously);
+                    batch[deviceId] = query;
+                }
+            }
+
+            if (newBatch)
+            {
+                _ = RunDeviceBatchAsync(tenantId, token);
+            }
+            return query.Task;
+        }
+
+        private static async Task RunDeviceBatchAsync(string tenantId, string token)
+        {
+            await Task.Delay(DeviceBatchWindow).ConfigureAwait(false);
+
+            Dictionary<string, TaskCompletionSource<DeviceInfo>> batch;
+            lock (BatchLock)
+            {
+                batch = PendingDeviceQueries[tenantId];
+                PendingDeviceQueries.Remove(tenantId);
+            }
+
+            try
+            {
+                var listed = new Dictionary<string, DeviceInfo>(StringComparer.OrdinalIgnoreCase);
+                if (batch.Count >= DeviceListThreshold)
+                {
+                    foreach (DeviceInfo device in await ListDevicesAsync(tenantId, token).ConfigureAwait(false))
+                    {
+                        listed[device.DeviceId] = device;
+                    }
+                }
+
+                // Query individually whatever the listing didn't return
+                await Task.WhenAll(batch.Select(async query =>
+                {
+                    if (!listed.TryGetValue(query.Key, out DeviceInfo device))
+                    {
+                        string deviceData = await GetDataAsync($"tenants/{tenantId}/devices/{query.Key}", token).ConfigureAwait(false);
+                        device = string.IsNullOrEmpty(deviceData) ? null : JsonConvert.DeserializeObject<DeviceInfo>(deviceData);
+                    }
+                    query.Value.TrySetResult(device);
+                })).ConfigureAwait(false);
+            }
+            catch (Exception ex)
+            {
+                foreach (var query in batch.Values)
+                {
+                    query.TrySetException(ex);
+                }
+            }
+        }
+
+        private static async Task<List<DeviceInfo>> ListDevicesAsync(string tenantId, string token)
+        {
+            var devices = new List<DeviceInfo>();
+            string continuationToken = null;
+
+            do
+            {
+                string result = await GetDataAsync($"tenants/{tenantId}/devices", token, continuationToken).ConfigureAwait(false);
+                if (string.IsNullOrEmpty(result))
+                {
+                    break;
+                }
+
+                DeviceList page = JsonConvert.DeserializeObject<DeviceList>(result);
+                if (page.Items != null)
+                {
+                    devices.AddRange(page.Items);
+                }
+                continuationToken = page.ContinuationToken;
+            } while (!string.IsNullOrEmpty(continuationToken));
+
+            return devices;
+        }
+
         public static async Task<string> GetAS3Token()
         {
-            DefaultAzureCredential credential = new DefaultAzureCredential();
-            var result = await credential.GetTokenAsync(new Azure.Core.TokenRequestContext(
-            new[] { "https://firstparty.sphere.azure.net/api/.default" }));
+            await TokenLock.WaitAsync().ConfigureAwait(false);
+            try
+            {
+                // Reuse the token until it's close to expiry, rather than acquiring one per call
+                if (string.IsNullOrEmpty(CachedToken.Token) || CachedToken.ExpiresOn - TokenRefreshMargin <= DateTimeOffset.UtcNow)
+                {
+                    CachedToken = await Credential.GetTokenAsync(new TokenRequestContext(
+                        new[] { "https://firstparty.sphere.azure.net/api/.default" })).ConfigureAwait(false);
+                }
+                return CachedToken.Token;
+            }
+            finally
+            {
+                TokenLock.Release();
+            }
+        }
+
+        private class CachedResponse
+        {
+            public CachedResponse(string EndpointUrl, string token, DateTimeOffset expires)
+            {
+                Content = new Lazy<Task<string>>(() => GetDataAsync(EndpointUrl, token));
+                Expires = expires;
+            }
 
-            return result.Token;
+            public Lazy<Task<string>> Content { get; }
+            public DateTimeOffset Expires { get; }
         }
     }
 
+    public class DeviceList
+    {
+        public List<DeviceInfo> Items { get; set; }
+        public string ContinuationToken { get; set; }
+    }
+
     public class DeviceInfo
     {
         public string DeviceId { get; set; }
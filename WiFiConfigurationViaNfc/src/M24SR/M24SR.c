@@ -68,6 +68,17 @@ static uint8_t NDefBuffer[NDEFMSBUFFERLEN];	// Need to check spec on max size.
 static uint8_t writeBuffer[BUFFER_SIZE];
 static uint8_t readBuffer[BUFFER_SIZE];
 
+// 5.6.7 ReadBinary - the M24SR returns at most 0xf6 bytes per command, files are read in
+// commands of this size.
+#define MAX_READ_BINARY_LENGTH	0xf6
+// I-Block response around the data: PCB, then SW1 SW2 and the CRC
+#define RESPONSE_OVERHEAD		5
+#define READ_BINARY_ATTEMPTS	3
+
+// The M24SR GPO goes low for the RF session of an NFC tap. Applications can't take GPIO
+// interrupts, so the pin is polled, often enough to catch a tap (which lasts far longer).
+#define GPO_POLL_PERIOD_MS		50
+
 static int WriteCommandAPDU(uint8_t class, uint8_t instruction, uint8_t p1, uint8_t p2, size_t dataLen, uint8_t* data);
 
 // 5.6.7 ReadBinary Command uses APDU without data/length
@@ -86,6 +97,8 @@ static uint16_t M24SR_UpdateCrc(uint8_t ch, uint16_t* lpwCrc);
 static int M24SR_SelectFileNdefApp(void);
 static int M24SR_SelectFileNdefFile(void);
 static uint16_t M24SR_GetMessageLength(void);
+static int M24SR_ReadBinary(uint16_t offset, uint8_t* buffer, size_t length);
+static int M24SR_CheckResponse(const uint8_t* frame, size_t length);
 static int M24SR_ProcessNDEFMessage(uint8_t* buffer, uint16_t length, struct M24SR_WifiConfig* wifiConfig);
 static void M24SR_ShowSystemFile(void);
 static int M24SR_VerifyI2cPassword(void);
@@ -214,7 +227,7 @@ int M24SR_Init(EventLoop *eventLoop, M24SR_GPOCallback callback)
 	I2CMaster_SetBusSpeed(_i2cFd, I2C_BUS_SPEED_STANDARD);
 	I2CMaster_SetTimeout(_i2cFd, 100);
 
-	struct timespec GpoPollCheckPeriod = { .tv_sec = 0, .tv_nsec = 1000000 };
+	struct timespec GpoPollCheckPeriod = { .tv_sec = 0, .tv_nsec = GPO_POLL_PERIOD_MS * 1000000 };
 	gpoPollTimer = CreateEventLoopPeriodicTimer(eventLoop, &GpoPollTimerEventHandler, &GpoPollCheckPeriod);
 	if (gpoPollTimer == NULL) {
 		exitCode = ExitCode_Init_Failed;
@@ -299,12 +312,14 @@ static uint16_t M24SR_GetMessageLength(void)
 #endif
 
 	uint16_t msgLen = 0;
-	uint8_t MsgData[7] = { 0 };
+	uint8_t MsgData[2] = { 0 };
 
-	WriteSimpleAPDU(0x00, INS_READ_BINARY, 0x00, 0x00, 0x02);
-	ReadI2C(&MsgData[0], 7);
+	if (M24SR_ReadBinary(0, &MsgData[0], 2) != 0)
+	{
+		return 0;
+	}
 
-	msgLen = (uint16_t)((MsgData[1] << 8) + (MsgData[2] & 0x00ff));
+	msgLen = (uint16_t)((MsgData[0] << 8) + (MsgData[1] & 0x00ff));
 
 	// invalid length.
 	if (msgLen == 0xfefe)
@@ -337,22 +352,82 @@ static void M24SR_SelectSystemFile(void)
 	}
 }
 
+/// <summary>
+/// 5.6.7 ReadBinary - read length bytes at offset from the selected file, in commands of the
+/// largest size the M24SR supports. Each response's CRC and status word are checked, and a
+/// response that fails is read again.
+/// </summary>
+static int M24SR_ReadBinary(uint16_t offset, uint8_t* buffer, size_t length)
+{
+#ifdef ENABLE_VERBOSE_DEBUG_OUTPUT
+	Log_Debug("%s\n", __func__);
+#endif
+
+	while (length > 0)
+	{
+		size_t chunk = length > MAX_READ_BINARY_LENGTH ? MAX_READ_BINARY_LENGTH : length;
+		int attempt = 0;
+
+		for (; attempt < READ_BINARY_ATTEMPTS; attempt++)
+		{
+			WriteSimpleAPDU(0x00, INS_READ_BINARY, (uint8_t)(offset >> 8), (uint8_t)(offset & 0xff), chunk);
+			if (ReadI2C(&readBuffer[0], chunk + RESPONSE_OVERHEAD) == 0 &&
+				M24SR_CheckResponse(&readBuffer[0], chunk + RESPONSE_OVERHEAD) == 0)
+			{
+				break;
+			}
+		}
+
+		if (attempt == READ_BINARY_ATTEMPTS)
+		{
+			Log_Debug("ERROR: ReadBinary of %zu bytes at offset %u failed\n", chunk, offset);
+			return -1;
+		}
+
+		memcpy(buffer, &readBuffer[1], chunk);	// skip the PCB
+		buffer += chunk;
+		offset = (uint16_t)(offset + chunk);
+		length -= chunk;
+	}
+
+	return 0;
+}
+
+/// <summary>
+/// Check an I-Block response: the CRC over the PCB, data and status word, then the status word
+/// itself (0x9000 - command completed).
+/// </summary>
+static int M24SR_CheckResponse(const uint8_t* frame, size_t length)
+{
+	uint16_t crc = M24SR_ComputeCrc((uint8_t*)frame, (uint8_t)(length - 2));
+
+	if (frame[length - 2] != (uint8_t)(crc & 0xff) || frame[length - 1] != (uint8_t)(crc >> 8))
+	{
+		Log_Debug("ERROR: Response CRC mismatch\n");
+		return -1;
+	}
+
+	if (frame[length - 4] != 0x90 || frame[length - 3] != 0x00)
+	{
+		Log_Debug("ERROR: Response status 0x%02x%02x\n", frame[length - 4], frame[length - 3]);
+		return -1;
+	}
+
+	return 0;
+}
+
 // 3.1.4 System file layout 
-static void M24SR_ReadSystemFile(uint8_t* buffer, size_t length)
+static int M24SR_ReadSystemFile(uint8_t* buffer, size_t length)
 {
 #ifdef ENABLE_VERBOSE_DEBUG_OUTPUT
 	Log_Debug("%s\n", __func__);
 #endif
 
-	size_t readLength = (size_t)(length + 5);
-	uint8_t data[readLength];
-	memset(data, 0x00, readLength);
-	WriteSimpleAPDU(0x00, INS_READ_BINARY, 0x00, 0x00, length);
-	ReadI2C(data, readLength);
-	memcpy(buffer, &data[1], length);	// offset of 1, then length bytes == system file contents.
+	int ret = M24SR_ReadBinary(0, buffer, length);
 #ifdef ENABLE_VERBOSE_DEBUG_OUTPUT
-	DumpBuffer(data, (uint16_t)readLength);
+	DumpBuffer(buffer, length);
 #endif
+	return ret;
 }
 
 /// <summary>
@@ -371,11 +446,9 @@ void M24SR_ShowSystemFile(void)
 
 	if (fileLength == 0x12)
 	{
-		memset(readBuffer, 0x00, fileLength);
-
-		M24SR_ReadSystemFile(&readBuffer[0], (fileLength & 0xff));
+		uint8_t systemFile[0x12] = { 0 };
 
-		if (readBuffer[0x11] == 0x84)
+		if (M24SR_ReadSystemFile(&systemFile[0], fileLength) == 0 && systemFile[0x11] == 0x84)
 		{
 #ifdef ENABLE_VERBOSE_DEBUG_OUTPUT
 			Log_Debug("System file read OK\n");
@@ -604,21 +677,25 @@ int M24SR_GetNdefMessage(uint8_t* buffer, size_t length, struct M24SR_WifiConfig
 	M24SR_SelectFileNdefApp();
 	M24SR_SelectFileNdefFile();
 	uint16_t msgLen=M24SR_GetMessageLength();
-	if (msgLen != 0)
+	if (msgLen != 0 && (size_t)msgLen + 2 <= length)
 	{
 		Log_Debug("NDEF Message Length %d\n", msgLen);
-		M24SR_ReadSystemFile(readBuffer, ((uint8_t)(msgLen & 0xff)));
+		// the whole file: the two length bytes, then the message
+		ret = M24SR_ReadBinary(0, buffer, (size_t)msgLen + 2);
 #ifdef ENABLE_VERBOSE_DEBUG_OUTPUT
 		Log_Debug("---------------\n");
 		Log_Debug("NDEF Message:\n");
-		DumpBuffer(readBuffer, msgLen);
+		DumpBuffer(buffer, (size_t)msgLen + 2);
 		Log_Debug("---------------\n");
 #endif
-		ret = M24SR_ProcessNDEFMessage(readBuffer, msgLen, wifiConfig);
+		if (ret == 0)
+		{
+			ret = M24SR_ProcessNDEFMessage(buffer, msgLen, wifiConfig);
+		}
 	}
 	else
 	{
-		ret = -1;	// message length is invalid
+		ret = -1;	// message length is invalid, or the message doesn't fit the buffer
 	}
 
 	M24SR_Deselect();
@@ -5,6 +5,8 @@
 #include "stdarg.h"
 #include "stdint.h"
 #include "stdlib.h"
+#include "errno.h"
+#include "fcntl.h"
 #include "SerialWiFiConfig.h"
 
 #include <applibs/networking.h>
@@ -24,15 +26,52 @@ EventRegistration* uartEventReg = NULL;
 enum menuOptionState { TOPLEVEL = 0, SSID = 1, PASSKEY = 2 };
 enum menuOptionState menuOption = TOPLEVEL;
 
+static void handleTopLevelMenuSelection(char* message);
+static void handleSsid(char* message);
+static void handlePasskey(char* message);
+
+// Each complete line goes to the handler for the menu state it was entered in
+static void (*const stateHandlers[])(char* message) = {
+    [TOPLEVEL] = handleTopLevelMenuSelection,
+    [SSID] = handleSsid,
+    [PASSKEY] = handlePasskey,
+};
+
+static void rebootCommand(void);
+static void listNetworksCommand(void);
+static void addNetworkCommand(void);
+
+// Top level menu, in menu order: option n runs menuCommands[n - 1]
+typedef struct {
+    const char* description;
+    void (*handler)(void);
+} MenuCommand;
+
+static const MenuCommand menuCommands[] = {
+    { "Reboot", rebootCommand },
+    { "Get stored Wi-Fi networks", listNetworksCommand },
+    { "Add Wi-Fi", addNetworkCommand },
+};
+
+#define MENU_COMMAND_COUNT (sizeof(menuCommands) / sizeof(menuCommands[0]))
+
 #define UART_MESSAGE_SIZE 80
-static uint8_t inputBuffer[UART_MESSAGE_SIZE];
-static ssize_t inputBufferPointer = 0;
 static uint8_t uartMessage[UART_MESSAGE_SIZE];
 static int uartFd = -1;
 
+// Line reader: each UART event reads all the bytes the UART has and scans them once, moving a
+// line's characters into lineBuffer until a CR or LF completes it; a line can span reads and events.
+// The echo of a whole read goes back in one write, so a script pasted into the terminal keeps up
+// with the baud rate rather than costing a formatted write per character.
+#define UART_RECEIVE_SIZE 256
+static uint8_t receiveBuffer[UART_RECEIVE_SIZE];
+static uint8_t echoBuffer[UART_RECEIVE_SIZE * 2];   // CR is echoed as CR LF
+static char lineBuffer[UART_MESSAGE_SIZE];
+static size_t lineLength = 0;
+static bool lastWasCr = false;                      // the LF of a CR LF doesn't end another line
+
 static char ssid[WIFICONFIG_SSID_MAX_LENGTH];
 
-static const char* menu = "\r\n1. Reboot\r\n2. Get stored Wi-Fi networks\r\n3. Add Wi-Fi\r\n\r\nOption>";
 static const char* ssidPrompt = "SSID >";
 static const char* networkKeyPrompt = "Network Key >";
 
@@ -47,6 +86,9 @@ bool SerialWiFiConfig_Init(EventLoop* eventLoop)
     if (uartFd < 0)
         return false;
 
+    // the event handler reads until the UART is empty
+    fcntl(uartFd, F_SETFL, fcntl(uartFd, F_GETFL) | O_NONBLOCK);
+
     uartEventReg = EventLoop_RegisterIo(eventLoop, uartFd, EventLoop_Input, UartEventHandler, NULL);
     if (uartEventReg == NULL)
     {
@@ -61,119 +103,140 @@ bool SerialWiFiConfig_Init(EventLoop* eventLoop)
     return true;
 }
 
+// The UART may take less than all of the data per write, so write until it has it all
+static void SendUartData(int uartFd, const uint8_t* data, size_t length)
+{
+    size_t sent = 0;
+
+    while (sent < length)
+    {
+        ssize_t bytesSent = write(uartFd, data + sent, length - sent);
+        if (bytesSent < 0)
+        {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            return;
+        }
+        sent += (size_t)bytesSent;
+    }
+}
+
 static void SendUartMessage(int uartFd, const char* dataToSend)
 {
-    write(uartFd, dataToSend, strlen(dataToSend));
+    SendUartData(uartFd, (const uint8_t*)dataToSend, strlen(dataToSend));
 }
 
 static void serialPrintMenu(void)
 {
-    serialPrint("\r\n%s", menu);
+    serialPrint("\r\n\r\n");
+    for (size_t x = 0; x < MENU_COMMAND_COUNT; x++)
+    {
+        serialPrint("%u. %s\r\n", (unsigned)(x + 1), menuCommands[x].description);
+    }
+    serialPrint("\r\nOption>");
 }
 
 static void handleTopLevelMenuSelection(char* message)
 {
     int selection = atoi(message);
 
-    if (selection == 3)
-    {
-        menuOption = SSID;
-        serialPrint(ssidPrompt);
-    }
-
-    if (selection == 1)
+    if (selection >= 1 && (size_t)selection <= MENU_COMMAND_COUNT)
     {
-        serialPrint("Rebooting...\n");
-        PowerManagement_ForceSystemReboot();
+        menuCommands[selection - 1].handler();
     }
+}
 
-    if (selection == 2)
-    {
-        serialPrint("\r\nStored Wi-Fi networks:\r\n");
+static void rebootCommand(void)
+{
+    serialPrint("Rebooting...\n");
+    PowerManagement_ForceSystemReboot();
+}
 
-        ssize_t numNetworks = WifiConfig_GetStoredNetworkCount();
-        if (numNetworks > 0)
-        {
-            WifiConfig_StoredNetwork* pStoredNetworks = (WifiConfig_StoredNetwork*)malloc(sizeof(WifiConfig_StoredNetwork) * (size_t)numNetworks);
-            WifiConfig_GetStoredNetworks(pStoredNetworks, (size_t)numNetworks);
+static void listNetworksCommand(void)
+{
+    serialPrint("\r\nStored Wi-Fi networks:\r\n");
 
-            for (int x = 0; x < numNetworks; x++)
-            {
-                serialPrint("%.*s : %s : %s\r\n", pStoredNetworks[x].ssidLength, pStoredNetworks[x].ssid, pStoredNetworks[x].isEnabled == true ? "Enabled" : "Not Enabled", pStoredNetworks[x].isConnected == true ? "Connected" : "Not Connected");
-            }
+    ssize_t numNetworks = WifiConfig_GetStoredNetworkCount();
+    if (numNetworks > 0)
+    {
+        WifiConfig_StoredNetwork* pStoredNetworks = (WifiConfig_StoredNetwork*)malloc(sizeof(WifiConfig_StoredNetwork) * (size_t)numNetworks);
+        WifiConfig_GetStoredNetworks(pStoredNetworks, (size_t)numNetworks);
 
-            free(pStoredNetworks);
-        }
-        else
+        for (int x = 0; x < numNetworks; x++)
         {
-            serialPrint("No stored Wi-Fi networks\r\n");
+            serialPrint("%.*s : %s : %s\r\n", pStoredNetworks[x].ssidLength, pStoredNetworks[x].ssid, pStoredNetworks[x].isEnabled == true ? "Enabled" : "Not Enabled", pStoredNetworks[x].isConnected == true ? "Connected" : "Not Connected");
         }
-        serialPrint("\r\n");
+
+        free(pStoredNetworks);
+    }
+    else
+    {
+        serialPrint("No stored Wi-Fi networks\r\n");
     }
+    serialPrint("\r\n");
 }
 
-static void MessageHandler(char* message)
+static void addNetworkCommand(void)
 {
-    switch (menuOption)
+    menuOption = SSID;
+    serialPrint(ssidPrompt);
+}
+
+static void handleSsid(char* message)
+{
+    size_t length = strlen(message);
+
+    if (length == 0)
     {
-    case SSID:
-        if (strlen(message) == 0)
-        {
-            // abort setting the SSID/PASSKEY
-            menuOption = TOPLEVEL;
-        }
-        else
-        {
-            if (strlen(message) < WIFICONFIG_SSID_MAX_LENGTH)
-            {
-                menuOption = PASSKEY;
-                strncpy(ssid, message, WIFICONFIG_SSID_MAX_LENGTH);
-                serialPrint(networkKeyPrompt);
-            }
-            else
-            {
-                serialPrint("SSID is too long, try again\r\n");
-                serialPrint(ssidPrompt);
-            }
-        }
-        break;
-    case PASSKEY:
-        if (strlen(message) == 0)
-        {
-            // abort setting the SSID/PASSKEY
-            menuOption = TOPLEVEL;
-        }
-        else
-        {
-            if (strlen(message) < WIFICONFIG_WPA2_KEY_MAX_BUFFER_SIZE)
-            {
-                menuOption = TOPLEVEL;      // set top level menu, and add network
-                int networkId = WifiConfig_AddNetwork();
-                WifiConfig_SetSSID(networkId, ssid, strlen(ssid));
-                WifiConfig_SetSecurityType(networkId, WifiConfig_Security_Wpa2_Psk);
-                WifiConfig_SetPSK(networkId, message, strlen(message));
-                WifiConfig_SetNetworkEnabled(networkId, true);
-                WifiConfig_PersistConfig();
-            }
-            else
-            {
-                serialPrint("SSID is too long, try again\r\n");
-                serialPrint(ssidPrompt);
-            }
-        }
-        break;
-    case TOPLEVEL:
-        handleTopLevelMenuSelection(message);
+        // abort setting the SSID/PASSKEY
+        menuOption = TOPLEVEL;
+    }
+    else if (length < WIFICONFIG_SSID_MAX_LENGTH)
+    {
+        menuOption = PASSKEY;
+        strncpy(ssid, message, WIFICONFIG_SSID_MAX_LENGTH);
+        serialPrint(networkKeyPrompt);
+    }
+    else
+    {
+        serialPrint("SSID is too long, try again\r\n");
+        serialPrint(ssidPrompt);
+    }
+}
+
+static void handlePasskey(char* message)
+{
+    size_t length = strlen(message);
 
-        break;
-    default:
-        serialPrint(menu);
+    if (length == 0)
+    {
+        // abort setting the SSID/PASSKEY
+        menuOption = TOPLEVEL;
+    }
+    else if (length < WIFICONFIG_WPA2_KEY_MAX_BUFFER_SIZE)
+    {
+        menuOption = TOPLEVEL;      // set top level menu, and add network
+        int networkId = WifiConfig_AddNetwork();
+        WifiConfig_SetSSID(networkId, ssid, strlen(ssid));
+        WifiConfig_SetSecurityType(networkId, WifiConfig_Security_Wpa2_Psk);
+        WifiConfig_SetPSK(networkId, message, length);
+        WifiConfig_SetNetworkEnabled(networkId, true);
+        WifiConfig_PersistConfig();
+    }
+    else
+    {
+        serialPrint("Network key is too long, try again\r\n");
+        serialPrint(networkKeyPrompt);
     }
+}
 
+static void MessageHandler(char* message)
+{
+    stateHandlers[menuOption](message);
 
     if (menuOption == TOPLEVEL)
     {
-        serialPrint(menu);
+        serialPrintMenu();
     }
 }
 
@@ -193,48 +256,56 @@ static void serialPrint(const char* fmt, ...)
 
 void UartEventHandler(EventLoop* el, int fd, EventLoop_IoEvents events, void* context)
 {
-    const size_t receiveBufferSize = 16;
-    uint8_t receiveBuffer[receiveBufferSize + 1]; // allow extra byte for string termination
     ssize_t bytesRead;
 
-    // Read incoming UART data. It is expected behavior that messages may be received in multiple
-    // partial chunks.
-    memset(receiveBuffer, 0x00, receiveBufferSize);
-    bytesRead = read(uartFd, receiveBuffer, receiveBufferSize);
-    if (bytesRead == -1) {
-        return;
-    }
-
-    // process the bytes from the PC/Terminal.
-    for (int x = 0; x < bytesRead; x++)
+    // Read incoming UART data until there's none left. It is expected behavior that messages may be
+    // received in multiple partial chunks.
+    while ((bytesRead = read(uartFd, receiveBuffer, sizeof(receiveBuffer))) > 0)
     {
-        uint8_t chr = receiveBuffer[x];
+        size_t echoLength = 0;
 
-        switch (chr)
+        // process the bytes from the PC/Terminal.
+        for (ssize_t x = 0; x < bytesRead; x++)
         {
-        case 0x7f:  // backspace in putty
-        case 0x08:
-            if (inputBufferPointer-1 > -1)
-            {
-                inputBufferPointer--;
-                inputBuffer[inputBufferPointer] = 0x00;
-                serialPrint("%c", chr);   // will update the terminal
-            }
-            break;
-        case 0x0d:
-            serialPrint("\r\n");
-            MessageHandler(inputBuffer);
-            inputBufferPointer = 0x00;  // reset the buffer pointer.
-            memset(inputBuffer, 0x00, UART_MESSAGE_SIZE); // clear the buffer.
-            break;
-        default:
-            if (inputBufferPointer + 1 < UART_MESSAGE_SIZE)
+            uint8_t chr = receiveBuffer[x];
+            bool afterCr = lastWasCr;
+            lastWasCr = chr == 0x0d;
+
+            switch (chr)
             {
-                inputBuffer[inputBufferPointer++] = chr;
-                inputBuffer[inputBufferPointer] = 0x00;
-                serialPrint("%c", chr);   // will update the terminal
+            case 0x7f:  // backspace in putty
+            case 0x08:
+                if (lineLength > 0)
+                {
+                    lineLength--;
+                    echoBuffer[echoLength++] = chr;   // will update the terminal
+                }
+                break;
+            case 0x0a:
+                if (afterCr)
+                    break;
+                // fall through, the line ended with LF alone
+            case 0x0d:
+                // the echo goes out ahead of anything the line's command prints
+                echoBuffer[echoLength++] = '\r';
+                echoBuffer[echoLength++] = '\n';
+                SendUartData(uartFd, echoBuffer, echoLength);
+                echoLength = 0;
+
+                lineBuffer[lineLength] = 0x00;
+                lineLength = 0;
+                MessageHandler(lineBuffer);
+                break;
+            default:
+                if (lineLength + 1 < UART_MESSAGE_SIZE)
+                {
+                    lineBuffer[lineLength++] = (char)chr;
+                    echoBuffer[echoLength++] = chr;   // will update the terminal
+                }
+                break;
             }
-            break;
         }
+
+        SendUartData(uartFd, echoBuffer, echoLength);
     }
 }